@@ -210,6 +210,19 @@ def setupEnv(env, pathToRoot = "."):
     if siteExists and hasattr(Site, "extraNamespace"):
         namespaceDict = {"FIELD3D_EXTRA_NAMESPACE" : Site.extraNamespace}
         env.AppendUnique(CPPDEFINES = namespaceDict)
+    # Runtime statistics
+    if siteExists and hasattr(Site, "disableStats") and Site.disableStats:
+        env.AppendUnique(CPPDEFINES = {"FIELD3D_DISABLE_STATS" : None})
+    # Hardware half/float conversion, see HalfConvert.h
+    if siteExists and hasattr(Site, "enableF16C") and Site.enableF16C:
+        env.AppendUnique(CCFLAGS = ["-mf16c", "-mavx"])
+    # Additional sparse block codecs, see BlockCodec.h
+    if siteExists and hasattr(Site, "enableLz4") and Site.enableLz4:
+        env.AppendUnique(CPPDEFINES = {"FIELD3D_LZ4" : None})
+        env.Append(LIBS = ["lz4"])
+    if siteExists and hasattr(Site, "enableZstd") and Site.enableZstd:
+        env.AppendUnique(CPPDEFINES = {"FIELD3D_ZSTD" : None})
+        env.Append(LIBS = ["zstd"])
     # System libs
     env.Append(LIBS = ["z", "pthread"])
     # Hdf5 lib
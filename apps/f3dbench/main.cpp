@@ -0,0 +1,848 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <Field3D/DenseField.h>
+#include <Field3D/SparseField.h>
+#include <Field3D/SparseFile.h>
+#include <Field3D/MIPField.h>
+#include <Field3D/MIPInterp.h>
+#include <Field3D/FieldInterp.h>
+#include <Field3D/InitIO.h>
+#include <Field3D/Field3DFile.h>
+#include <Field3D/PatternMatch.h>
+
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+// Options struct
+//----------------------------------------------------------------------------//
+
+struct Options {
+  Options()
+    : numSamples(1000000), numRepeats(3), cacheMemUse(1000.0f), seed(1)
+  { }
+  string         inputFile;
+  string         outputFile;
+  vector<string> names;
+  vector<string> attributes;
+  vector<size_t> threadCounts;
+  size_t         numSamples;
+  size_t         numRepeats;
+  float          cacheMemUse;
+  int            seed;
+};
+
+//----------------------------------------------------------------------------//
+// JsonWriter
+//----------------------------------------------------------------------------//
+
+//! Writes indented JSON to a stream. Values are added in order, and 
+//! objects and arrays are closed explicitly. Keys are left empty for the
+//! elements of arrays.
+class JsonWriter
+{
+public:
+  JsonWriter(ostream &os)
+    : m_os(os)
+  { 
+    m_isFirst.push_back(true);
+    m_os.precision(8);
+  }
+  ~JsonWriter()
+  { m_os << endl; }
+  void beginObject(const string &key = string())
+  { 
+    separator(key);
+    m_os << "{";
+    m_isFirst.push_back(true);
+  }
+  void endObject()
+  { close('}'); }
+  void beginArray(const string &key = string())
+  { 
+    separator(key);
+    m_os << "[";
+    m_isFirst.push_back(true);
+  }
+  void endArray()
+  { close(']'); }
+  template <typename T>
+  void value(const string &key, const T &v)
+  {
+    separator(key);
+    m_os << v;
+  }
+  void value(const string &key, const double v)
+  {
+    separator(key);
+    if (v != v || v == std::numeric_limits<double>::infinity() ||
+        v == -std::numeric_limits<double>::infinity()) {
+      m_os << "null";
+    } else {
+      m_os << v;
+    }
+  }
+  void value(const string &key, const bool v)
+  {
+    separator(key);
+    m_os << (v ? "true" : "false");
+  }
+  void value(const string &key, const char *v)
+  { value(key, string(v)); }
+  void value(const string &key, const string &v)
+  {
+    separator(key);
+    m_os << quote(v);
+  }
+private:
+  //! Writes the comma, line break and indentation before a value
+  void separator(const string &key)
+  {
+    if (!m_isFirst.back()) {
+      m_os << ",";
+    }
+    m_isFirst.back() = false;
+    if (m_isFirst.size() > 1) {
+      m_os << endl;
+      indent();
+    }
+    if (!key.empty()) {
+      m_os << quote(key) << ": ";
+    }
+  }
+  void close(const char c)
+  {
+    const bool isEmpty = m_isFirst.back();
+    m_isFirst.pop_back();
+    if (!isEmpty) {
+      m_os << endl;
+      indent();
+    }
+    m_os << c;
+  }
+  void indent()
+  { m_os << string(2 * (m_isFirst.size() - 1), ' '); }
+  static string quote(const string &s)
+  {
+    string result("\"");
+    BOOST_FOREACH (const char c, s) {
+      switch (c) {
+      case '"':  result += "\\\""; break;
+      case '\\': result += "\\\\"; break;
+      case '\n': result += "\\n";  break;
+      case '\t': result += "\\t";  break;
+      default:   
+        if (static_cast<unsigned char>(c) < 0x20) {
+          result += ' ';
+        } else {
+          result += c;
+        }
+      }
+    }
+    return result + "\"";
+  }
+  ostream     &m_os;
+  //! Whether the innermost object or array is still empty
+  vector<bool> m_isFirst;
+};
+
+//----------------------------------------------------------------------------//
+// Constants
+//----------------------------------------------------------------------------//
+
+//! Number of samples each thread claims at a time
+const size_t k_sampleChunkSize = 4096;
+
+//----------------------------------------------------------------------------//
+// Result structs
+//----------------------------------------------------------------------------//
+
+//! Times taken by a repeated measurement, in seconds
+struct Timings {
+  Timings()
+    : min(std::numeric_limits<double>::max()), total(0.0), count(0)
+  { }
+  void add(const double seconds)
+  {
+    min = std::min(min, seconds);
+    total += seconds;
+    count++;
+  }
+  double mean() const
+  { return count ? total / count : 0.0; }
+  double min, total;
+  size_t count;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sampling throughput of one field
+struct SampleResult {
+  SampleResult()
+    : random(0.0), coherent(0.0), mip(0.0), hasMIP(false)
+  { }
+  //! Samples per second
+  double random, coherent, mip;
+  bool   hasMIP;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Dynamic loading statistics, gathered while sampling randomly with the
+//! sparse block cache enabled
+struct CacheResult {
+  CacheResult()
+    : samplesPerSecond(0.0), loads(0), loadedBlocks(0), efficiency(0.0f),
+      isValid(false)
+  { }
+  double    samplesPerSecond;
+  long long loads, loadedBlocks;
+  float     efficiency;
+  bool      isValid;
+};
+
+//----------------------------------------------------------------------------//
+// Function prototypes
+//----------------------------------------------------------------------------//
+
+//! Parses command line options, puts them in Options struct.
+Options parseOptions(int argc, char **argv);
+
+//! Returns the wall clock time in seconds
+double wallTime();
+
+//! Runs all benchmarks on the input file
+void runBenchmarks(const Options &options, JsonWriter &json);
+
+//! Benchmarks a layer, if it holds fields of the given data type. Returns
+//! false otherwise.
+template <typename Data_T>
+bool benchLayer(const Options &options, const string &partition, 
+                const string &layer, JsonWriter &json);
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv)
+{
+  Field3D::initIO();
+
+  Options options = parseOptions(argc, argv);
+
+  if (options.outputFile.empty()) {
+    JsonWriter json(cout);
+    runBenchmarks(options, json);
+  } else {
+    ofstream os(options.outputFile.c_str());
+    if (!os) {
+      cerr << "ERROR: Couldn't create output file: " 
+           << options.outputFile << endl;
+      return 1;
+    }
+    JsonWriter json(os);
+    runBenchmarks(options, json);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Options parseOptions(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+
+  po::options_description desc("Available options");
+
+  desc.add_options()
+    ("help,h", "Display help")
+    ("input-file,i", po::value<vector<string> >(), "Input file")
+    ("output-file,o", po::value<string>(), 
+     "File to write the JSON results to. Defaults to stdout.")
+    ("name,n", po::value<vector<string> >(), "Benchmark field(s) by name")
+    ("attribute,a", po::value<vector<string> >(), 
+     "Benchmark field(s) by attribute")
+    ("threads,t", po::value<vector<size_t> >()->multitoken(), 
+     "Thread counts to read with. Defaults to 1 and the number of cores.")
+    ("samples,s", po::value<size_t>(), "Number of samples per benchmark")
+    ("repeats,r", po::value<size_t>(), "Number of times to repeat reads")
+    ("cache-mem,m", po::value<float>(), 
+     "Memory limit of the sparse block cache, in MB")
+    ("seed", po::value<int>(), "Random seed for sample positions")
+    ;
+  
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  po::positional_options_description p;
+  p.add("input-file", -1);
+  
+  try {
+    po::store(po::command_line_parser(argc, argv).
+              options(desc).positional(p).run(), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  if (vm.count("help")) {
+    cout << desc << endl;
+    exit(0);
+  }
+
+  if (vm.count("input-file")) {
+    if (vm["input-file"].as<vector<string> >().size() > 1) {
+      cerr << "WARNING: Got more than one input filename. "
+           << "First entry will be used." << endl;
+    }
+    options.inputFile = vm["input-file"].as<vector<string> >()[0];
+  } else {
+    cerr << "No input file specified." << endl;
+    exit(1);
+  }
+  if (vm.count("output-file")) {
+    options.outputFile = vm["output-file"].as<string>();
+  }
+  if (vm.count("name")) {
+    options.names = vm["name"].as<vector<string> >();
+  }
+  if (vm.count("attribute")) {
+    options.attributes = vm["attribute"].as<vector<string> >();
+  }
+  if (vm.count("threads")) {
+    options.threadCounts = vm["threads"].as<vector<size_t> >();
+  } else {
+    options.threadCounts.push_back(1);
+    const size_t numCores = boost::thread::hardware_concurrency();
+    if (numCores > 1) {
+      options.threadCounts.push_back(numCores);
+    }
+  }
+  if (vm.count("samples")) {
+    options.numSamples = std::max(vm["samples"].as<size_t>(), size_t(1));
+  }
+  if (vm.count("repeats")) {
+    options.numRepeats = std::max(vm["repeats"].as<size_t>(), size_t(1));
+  }
+  if (vm.count("cache-mem")) {
+    options.cacheMemUse = vm["cache-mem"].as<float>();
+  }
+  if (vm.count("seed")) {
+    options.seed = vm["seed"].as<int>();
+  }
+
+  return options;
+}
+
+//----------------------------------------------------------------------------//
+
+double wallTime()
+{
+  using namespace boost::posix_time;
+  static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+  return (microsec_clock::universal_time() - epoch).total_microseconds() * 
+    1e-6;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the fields of a scalar or vector layer
+template <typename Data_T>
+struct LayerReader
+{
+  static typename Field<Data_T>::Vec 
+  read(const Field3DInputFile &in, const string &partition, 
+       const string &layer)
+  { return in.readScalarLayers<Data_T>(partition, layer); }
+};
+
+template <typename T>
+struct LayerReader<FIELD3D_VEC3_T<T> >
+{
+  static typename Field<FIELD3D_VEC3_T<T> >::Vec 
+  read(const Field3DInputFile &in, const string &partition, 
+       const string &layer)
+  { return in.readVectorLayers<T>(partition, layer); }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Samples a chunk of points with an interpolator. The per-chunk results 
+//! are kept so that the lookups can't be optimized away.
+template <typename Field_T, typename Interp_T>
+struct SampleOp
+{
+  typedef typename Field_T::value_type Data_T;
+  SampleOp(const Field_T &field, const Interp_T &interp, 
+           const vector<V3d> &points, vector<Data_T> &results)
+    : m_field(field), m_interp(interp), m_points(points), m_results(results)
+  { }
+  void operator() (const size_t chunk) const
+  {
+    const size_t begin = chunk * k_sampleChunkSize;
+    const size_t end = std::min(begin + k_sampleChunkSize, m_points.size());
+    Data_T sum = Data_T(0.0);
+    for (size_t i = begin; i < end; ++i) {
+      sum += m_interp.sample(m_field, m_points[i]);
+    }
+    m_results[chunk] = sum;
+  }
+  const Field_T       &m_field;
+  const Interp_T      &m_interp;
+  const vector<V3d>   &m_points;
+  vector<Data_T>      &m_results;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Samples a chunk of points with a MIP interpolator, each with its own 
+//! spot size
+template <typename MIP_T>
+struct MIPSampleOp
+{
+  typedef typename MIP_T::value_type   Data_T;
+  typedef typename MIP_T::LinearInterp Interp;
+  MIPSampleOp(const Interp &interp, const vector<V3d> &points, 
+              const vector<float> &spotSizes, vector<Data_T> &results)
+    : m_interp(interp), m_points(points), m_spotSizes(spotSizes), 
+      m_results(results)
+  { }
+  void operator() (const size_t chunk) const
+  {
+    const size_t begin = chunk * k_sampleChunkSize;
+    const size_t end = std::min(begin + k_sampleChunkSize, m_points.size());
+    Data_T sum = Data_T(0.0);
+    for (size_t i = begin; i < end; ++i) {
+      sum += m_interp.sample(m_points[i], m_spotSizes[i]);
+    }
+    m_results[chunk] = sum;
+  }
+  const Interp        &m_interp;
+  const vector<V3d>   &m_points;
+  const vector<float> &m_spotSizes;
+  vector<Data_T>      &m_results;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Returns the number of chunks needed for the given number of samples
+inline size_t numChunks(const size_t numSamples)
+{
+  return (numSamples + k_sampleChunkSize - 1) / k_sampleChunkSize;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns samples per second of the interpolator over the points, using
+//! numIOThreads() threads
+template <typename Field_T, typename Interp_T>
+double timeSampling(const Field_T &field, const Interp_T &interp, 
+                    const vector<V3d> &points)
+{
+  typedef typename Field_T::value_type Data_T;
+  vector<Data_T> results(numChunks(points.size()));
+  const double start = wallTime();
+  Sparse::runBlockOp(SampleOp<Field_T, Interp_T>(field, interp, points, 
+                                                 results), 
+                     results.size());
+  return points.size() / std::max(wallTime() - start, 1e-9);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Picks the fastest interpolator available for the field's type
+template <typename Data_T>
+double timeSampling(const Field<Data_T> &field, const vector<V3d> &points)
+{
+  if (const SparseField<Data_T> *sparse = 
+      dynamic_cast<const SparseField<Data_T> *>(&field)) {
+    return timeSampling(*sparse, 
+                        typename SparseField<Data_T>::LinearInterp(), 
+                        points);
+  }
+  if (const DenseField<Data_T> *dense = 
+      dynamic_cast<const DenseField<Data_T> *>(&field)) {
+    return timeSampling(*dense, 
+                        typename DenseField<Data_T>::LinearInterp(), 
+                        points);
+  }
+  return timeSampling(field, LinearFieldInterp<Data_T>(), points);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns samples per second of a MIP field, with spot sizes spread 
+//! across all of its levels
+template <typename MIP_T>
+double timeMIPSampling(const MIP_T &mip, const vector<V3d> &points, 
+                       const int seed)
+{
+  typedef typename MIP_T::value_type Data_T;
+
+  const double voxelSize = mip.mapping()->wsVoxelSize(0, 0, 0).x;
+  const double maxSpotSize = voxelSize * (1 << (mip.numLevels() - 1));
+  FIELD3D_RAND48 rng(seed);
+  vector<float> spotSizes(points.size());
+  BOOST_FOREACH (float &spotSize, spotSizes) {
+    spotSize = static_cast<float>(rng.nextf(0.0, maxSpotSize));
+  }
+
+  typename MIP_T::LinearInterp interp(mip);
+  vector<Data_T> results(numChunks(points.size()));
+  const double start = wallTime();
+  Sparse::runBlockOp(MIPSampleOp<MIP_T>(interp, points, spotSizes, results),
+                     results.size());
+  return points.size() / std::max(wallTime() - start, 1e-9);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns random voxel space positions within the data window
+vector<V3d> randomPoints(const Box3i &dataWindow, const size_t numPoints,
+                         const int seed)
+{
+  const V3d min = V3d(dataWindow.min);
+  const V3d max = V3d(dataWindow.max) + V3d(1.0);
+  FIELD3D_RAND48 rng(seed);
+  vector<V3d> points(numPoints);
+  BOOST_FOREACH (V3d &p, points) {
+    p.x = rng.nextf(min.x, max.x);
+    p.y = rng.nextf(min.y, max.y);
+    p.z = rng.nextf(min.z, max.z);
+  }
+  return points;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns voxel space positions that walk the data window in scanline 
+//! order, two samples per voxel along x, wrapping around if there are more
+//! points than that
+vector<V3d> coherentPoints(const Box3i &dataWindow, const size_t numPoints)
+{
+  const V3i res = dataWindow.size() + V3i(1);
+  const size_t rowSize = 2 * res.x;
+  vector<V3d> points(numPoints);
+  for (size_t i = 0; i < numPoints; ++i) {
+    const size_t row = i / rowSize;
+    points[i] = V3d(dataWindow.min.x + 0.25 + 0.5 * (i % rowSize),
+                    dataWindow.min.y + 0.5 + row % res.y,
+                    dataWindow.min.z + 0.5 + (row / res.y) % res.z);
+  }
+  return points;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Benchmarks sampling of one field
+template <typename Data_T>
+SampleResult benchSampling(const Field<Data_T> &field, const Options &options)
+{
+  typedef MIPSparseField<Data_T> MIPSparse;
+  typedef MIPDenseField<Data_T>  MIPDense;
+
+  SampleResult result;
+
+  const Box3i dw = field.dataWindow();
+  const vector<V3d> random = randomPoints(dw, options.numSamples, 
+                                          options.seed);
+  const vector<V3d> coherent = coherentPoints(dw, options.numSamples);
+
+  result.random = timeSampling(field, random);
+  result.coherent = timeSampling(field, coherent);
+
+  if (const MIPSparse *mip = dynamic_cast<const MIPSparse *>(&field)) {
+    result.mip = timeMIPSampling(*mip, random, options.seed);
+    result.hasMIP = true;
+  } else if (const MIPDense *mip = dynamic_cast<const MIPDense *>(&field)) {
+    result.mip = timeMIPSampling(*mip, random, options.seed);
+    result.hasMIP = true;
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Whether the field is read through the sparse block cache
+template <typename Data_T>
+bool isSparse(const Field<Data_T> &field)
+{
+  return dynamic_cast<const SparseField<Data_T> *>(&field) ||
+    dynamic_cast<const MIPSparseField<Data_T> *>(&field);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Rereads the layer with dynamic loading and samples it randomly, starting
+//! from an empty cache
+template <typename Data_T>
+CacheResult benchCache(const Options &options, const string &partition, 
+                       const string &layer, const size_t fieldIdx)
+{
+  SparseFileManager &manager = SparseFileManager::singleton();
+
+  CacheResult result;
+
+  manager.setLimitMemUse(true);
+  manager.setMaxMemUse(options.cacheMemUse);
+  manager.flushCache();
+  {
+    Field3DInputFile in;
+    if (in.open(options.inputFile)) {
+      typename Field<Data_T>::Vec fields = 
+        LayerReader<Data_T>::read(in, partition, layer);
+      if (fieldIdx < fields.size()) {
+        const Field<Data_T> &field = *fields[fieldIdx];
+        const vector<V3d> points = randomPoints(field.dataWindow(), 
+                                                options.numSamples, 
+                                                options.seed);
+        manager.resetCacheStatistics();
+        result.samplesPerSecond = timeSampling(field, points);
+        result.loads = manager.totalLoads();
+        result.loadedBlocks = manager.totalLoadedBlocks();
+        result.efficiency = manager.cacheEfficiency();
+        result.isValid = true;
+      }
+    }
+  }
+  manager.flushCache();
+  manager.setLimitMemUse(false);
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool benchLayer(const Options &options, const string &partition, 
+                const string &layer, JsonWriter &json)
+{
+  typedef typename Field<Data_T>::Vec FieldVec;
+
+  // Read throughput by thread count ---
+
+  FieldVec fields;
+  vector<Timings> readTimes(options.threadCounts.size());
+  long long bytes = 0;
+
+  for (size_t t = 0; t < options.threadCounts.size(); ++t) {
+    Field3D::setNumIOThreads(options.threadCounts[t]);
+    for (size_t r = 0; r < options.numRepeats; ++r) {
+      Field3DInputFile in;
+      if (!in.open(options.inputFile)) {
+        return false;
+      }
+      fields.clear();
+      const double start = wallTime();
+      fields = LayerReader<Data_T>::read(in, partition, layer);
+      readTimes[t].add(wallTime() - start);
+      if (fields.empty()) {
+        return false;
+      }
+    }
+  }
+  BOOST_FOREACH (const typename Field<Data_T>::Ptr &field, fields) {
+    bytes += field->memSize();
+  }
+
+  json.beginObject();
+  json.value("partition", partition);
+  json.value("layer", layer);
+  json.value("data_type", DataTypeTraits<Data_T>::name());
+  json.value("bytes", bytes);
+
+  json.beginArray("read");
+  for (size_t t = 0; t < options.threadCounts.size(); ++t) {
+    json.beginObject();
+    json.value("threads", options.threadCounts[t]);
+    json.value("seconds_min", readTimes[t].min);
+    json.value("seconds_mean", readTimes[t].mean());
+    json.value("mb_per_second", 
+               bytes / (1024.0 * 1024.0) / std::max(readTimes[t].min, 1e-9));
+    json.endObject();
+  }
+  json.endArray();
+
+  // Sampling, with the fields in memory and with dynamic loading ---
+
+  json.beginArray("fields");
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const Field<Data_T> &field = *fields[i];
+    const SampleResult sampling = benchSampling(field, options);
+    json.beginObject();
+    json.value("name", field.name);
+    json.value("class_name", field.className());
+    json.value("voxels", field.voxelCount());
+    json.value("memory_bytes", field.memSize());
+    json.beginObject("samples_per_second");
+    json.value("random", sampling.random);
+    json.value("coherent", sampling.coherent);
+    if (sampling.hasMIP) {
+      json.value("mip", sampling.mip);
+    }
+    json.endObject();
+    if (isSparse(field)) {
+      const CacheResult cache = 
+        benchCache<Data_T>(options, partition, layer, i);
+      if (cache.isValid) {
+        json.beginObject("dynamic_load");
+        json.value("cache_mb", static_cast<double>(options.cacheMemUse));
+        json.value("samples_per_second", cache.samplesPerSecond);
+        json.value("block_loads", cache.loads);
+        json.value("blocks_loaded", cache.loadedBlocks);
+        json.value("efficiency", static_cast<double>(cache.efficiency));
+        json.endObject();
+      }
+    }
+    json.endObject();
+  }
+  json.endArray();
+
+  json.endObject();
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void runBenchmarks(const Options &options, JsonWriter &json)
+{
+  json.beginObject();
+  json.value("file", options.inputFile);
+  json.value("field3d_version", 
+             boost::lexical_cast<string>(FIELD3D_MAJOR_VER) + "." +
+             boost::lexical_cast<string>(FIELD3D_MINOR_VER) + "." +
+             boost::lexical_cast<string>(FIELD3D_MICRO_VER));
+  json.value("samples", options.numSamples);
+  json.value("repeats", options.numRepeats);
+
+  // Open latency ---
+
+  Timings openTimes;
+  for (size_t r = 0; r < options.numRepeats; ++r) {
+    Field3DInputFile in;
+    const double start = wallTime();
+    const bool isOpen = in.open(options.inputFile);
+    openTimes.add(wallTime() - start);
+    if (!isOpen) {
+      cerr << "ERROR: Couldn't open file: " << options.inputFile << endl;
+      json.value("error", "Couldn't open file");
+      json.endObject();
+      return;
+    }
+  }
+
+  Field3DInputFile in;
+  in.open(options.inputFile);
+  json.value("encoding", in.encoding());
+  json.beginObject("open");
+  json.value("seconds_min", openTimes.min);
+  json.value("seconds_mean", openTimes.mean());
+  json.endObject();
+
+  // Layers ---
+
+  json.beginArray("layers");
+
+  // Parse the patterns once for all partitions and layers
+  const MatchPattern namePattern(options.names);
+  const MatchPattern attributePattern(options.attributes);
+
+  std::vector<std::string> partitions;
+  in.getPartitionNames(partitions);
+
+  BOOST_FOREACH (const string &partition, partitions) {
+
+    if (!namePattern.match(partition)) {
+      continue;
+    }
+
+    std::vector<std::string> scalarLayers, vectorLayers;
+    in.getScalarLayerNames(scalarLayers, partition);
+    in.getVectorLayerNames(vectorLayers, partition);
+
+    BOOST_FOREACH (const string &layer, scalarLayers) {
+      if (!attributePattern.match(layer)) {
+        continue;
+      }
+      benchLayer<half>(options, partition, layer, json) ||
+        benchLayer<float>(options, partition, layer, json) ||
+        benchLayer<double>(options, partition, layer, json);
+    }
+
+    BOOST_FOREACH (const string &layer, vectorLayers) {
+      if (!attributePattern.match(layer)) {
+        continue;
+      }
+      benchLayer<V3h>(options, partition, layer, json) ||
+        benchLayer<V3f>(options, partition, layer, json) ||
+        benchLayer<V3d>(options, partition, layer, json);
+    }
+
+  }
+
+  json.endArray();
+  json.endObject();
+}
+
+//----------------------------------------------------------------------------//
@@ -35,7 +35,9 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <vector>
 #include <map>
 #include <string>
@@ -47,6 +49,7 @@
 #include <Field3D/DenseField.h>
 #include <Field3D/MACField.h>
 #include <Field3D/SparseField.h>
+#include <Field3D/SparseFile.h>
 #include <Field3D/InitIO.h>
 #include <Field3D/Field3DFile.h>
 
@@ -60,9 +63,56 @@ using namespace Field3D;
 //----------------------------------------------------------------------------//
 
 struct Options {
+  Options()
+    : doStats(false), doHeadersOnly(false), doVerify(false), numThreads(0)
+  { }
   vector<string> inputFiles;
   vector<string> names;
   vector<string> attributes;
+  bool           doStats;
+  bool           doHeadersOnly;
+  bool           doVerify;
+  size_t         numThreads;
+};
+
+//----------------------------------------------------------------------------//
+// ValueStats struct
+//----------------------------------------------------------------------------//
+
+//! Value statistics of part of a field. Vector fields get one entry per
+//! component.
+struct ValueStats {
+  ValueStats()
+    : numVoxels(0), numBlocks(0), numAllocated(0), allocatedVoxels(0), 
+      filledVoxels(0)
+  {
+    for (int c = 0; c < 3; ++c) {
+      min[c] = std::numeric_limits<double>::max();
+      max[c] = -std::numeric_limits<double>::max();
+      sum[c] = 0.0;
+    }
+  }
+  //! Adds the statistics of another part of the field
+  void merge(const ValueStats &other)
+  {
+    for (int c = 0; c < 3; ++c) {
+      min[c] = std::min(min[c], other.min[c]);
+      max[c] = std::max(max[c], other.max[c]);
+      sum[c] += other.sum[c];
+    }
+    numVoxels       += other.numVoxels;
+    numBlocks       += other.numBlocks;
+    numAllocated    += other.numAllocated;
+    allocatedVoxels += other.allocatedVoxels;
+    filledVoxels    += other.filledVoxels;
+  }
+  double min[3], max[3], sum[3];
+  size_t numVoxels;
+  //! Blocks of sparse fields
+  size_t numBlocks, numAllocated;
+  //! Voxels of allocated blocks, and those that differ from the block's 
+  //! empty value
+  size_t allocatedVoxels, filledVoxels;
 };
 
 //----------------------------------------------------------------------------//
@@ -73,7 +123,8 @@ struct Options {
 Options parseOptions(int argc, char **argv);
 
 //! Prints information about all fields in file.
-void printFileInfo(const std::string &filename, const Options &options);
+//! \returns The number of corrupt blocks and slabs found, if verifying
+size_t printFileInfo(const std::string &filename, const Options &options);
 
 //! Prints the information about a single field
 template <typename Data_T>
@@ -89,6 +140,24 @@ void printMapping(FieldMapping::Ptr mapping);
 //! Pattern matching used for field names and attributes
 bool matchString(const std::string &str, const vector<string> &patterns);
 
+//! Prints how each matching layer is stored, without reading voxels
+void printLayerStorage(const Field3DInputFile &in, const string &partition,
+                       const string &layer);
+
+//! Checks each matching layer against its checksums and prints the result,
+//! without decompressing anything
+//! \returns The number of corrupt blocks and slabs
+size_t printLayerVerification(const Field3DInputFile &in, 
+                              const string &partition, const string &layer);
+
+//! Prints the header of each matching layer, without reading voxels
+void printLayerHeaders(const Field3DInputFile &in, const string &partition,
+                       const string &layer, const bool isVectorLayer);
+
+//! Scans the voxels of a field in parallel and prints their statistics
+template <typename Data_T>
+void printFieldStats(typename Field<Data_T>::Ptr field);
+
 //----------------------------------------------------------------------------//
 // Function implementations
 //----------------------------------------------------------------------------//
@@ -99,9 +168,22 @@ int main(int argc, char **argv)
 
   Options options = parseOptions(argc, argv);
 
+  if (options.numThreads > 0) {
+    Field3D::setNumIOThreads(options.numThreads);
+  }
+
+  // Sparse fields are read as their block maps. Statistics then load each
+  // block as it is scanned, within the cache's memory limit
+  if (options.doStats) {
+    SparseFileManager::singleton().setLimitMemUse(true);
+  }
+
+  size_t numCorrupt = 0;
   BOOST_FOREACH (const string &file, options.inputFiles) {
-    printFileInfo(file, options);
+    numCorrupt += printFileInfo(file, options);
   }
+
+  return numCorrupt > 0 ? 1 : 0;
 }
 
 //----------------------------------------------------------------------------//
@@ -119,6 +201,14 @@ Options parseOptions(int argc, char **argv)
     ("input-file", po::value<vector<string> >(), "Input files")
     ("name,n", po::value<vector<string> >(), "Load field(s) by name")
     ("attribute,a", po::value<vector<string> >(), "Load field(s) by attribute")
+    ("stats,s", po::value<bool>(), 
+     "Whether to print the storage and value statistics of each field.")
+    ("headers-only,H", po::value<bool>(), 
+     "Whether to print only what can be found without reading voxels.")
+    ("verify,v", po::value<bool>(), 
+     "Whether to check the compressed data of each field against its "
+     "checksums, without reading voxels.")
+    ("num-threads,t", po::value<size_t>(), "Number of threads to use")
     ;
   
   po::variables_map vm;
@@ -161,6 +251,22 @@ Options parseOptions(int argc, char **argv)
   {
     options.attributes = vm["attribute"].as<std::vector<std::string> >();
   }
+  if (vm.count("stats"))
+  {
+    options.doStats = vm["stats"].as<bool>();
+  }
+  if (vm.count("headers-only"))
+  {
+    options.doHeadersOnly = vm["headers-only"].as<bool>();
+  }
+  if (vm.count("verify"))
+  {
+    options.doVerify = vm["verify"].as<bool>();
+  }
+  if (vm.count("num-threads"))
+  {
+    options.numThreads = vm["num-threads"].as<size_t>();
+  }
 
   return options;
 }
@@ -234,6 +340,244 @@ void printFieldInfo(typename Field<Data_T>::Ptr field, const Options &options)
   printMap(field->metadata().vecFloatMetadata(), "      ");
   cout << "    String metadata:" << endl;
   printMap(field->metadata().strMetadata(), "      ");
+
+  if (options.doStats) {
+    printFieldStats<Data_T>(field);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void printLayerStorage(const Field3DInputFile &in, const string &partition,
+                       const string &layer)
+{
+  vector<File::LayerStorage> storage = in.layerStorage(partition, layer);
+  BOOST_FOREACH (const File::LayerStorage &s, storage) {
+    cout << "  Layer: " << endl
+         << "    Partition:    " << s.partition << endl
+         << "    Attribute:    " << layer << endl
+         << "    Field type:   " << s.className << endl
+         << "    Stored bytes: " << s.dataBytes << endl;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t printLayerVerification(const Field3DInputFile &in, 
+                              const string &partition, const string &layer)
+{
+  size_t numCorrupt = 0;
+  vector<File::LayerVerification> results = in.verifyLayer(partition, layer);
+  BOOST_FOREACH (const File::LayerVerification &v, results) {
+    cout << "  Layer: " << endl
+         << "    Partition:  " << v.partition << endl
+         << "    Attribute:  " << layer << endl
+         << "    Field type: " << v.className << endl
+         << "    Checked:    " << v.numChecked << endl
+         << "    Corrupt:    " << v.numCorrupt << endl
+         << "    Unchecked:  " << v.numUnchecked << endl;
+    numCorrupt += v.numCorrupt;
+  }
+  return numCorrupt;
+}
+
+//----------------------------------------------------------------------------//
+
+void printLayerHeaders(const Field3DInputFile &in, const string &partition,
+                       const string &layer, const bool isVectorLayer)
+{
+  EmptyField<float>::Vec proxies = 
+    in.readProxyLayer<float>(partition, layer, isVectorLayer);
+  BOOST_FOREACH (EmptyField<float>::Ptr field, proxies) {
+    Box3i dataWindow = field->dataWindow();
+    Box3i extents = field->extents();
+
+    cout << "  Field: " << endl
+         << "    Name:        " << field->name << endl
+         << "    Attribute:   " << field->attribute << endl
+         << "    Extents:     " << extents.min << " " << extents.max << endl
+         << "    Data window: " << dataWindow.min << " " << dataWindow.max 
+         << endl;
+
+    printMapping(field->mapping());
+
+    cout << "    Int metadata:" << endl;
+    printMap(field->metadata().intMetadata(), "      ");
+    cout << "    Float metadata:" << endl;
+    printMap(field->metadata().floatMetadata(), "      ");
+    cout << "    V3i metadata:" << endl;
+    printMap(field->metadata().vecIntMetadata(), "      ");
+    cout << "    V3f metadata:" << endl;
+    printMap(field->metadata().vecFloatMetadata(), "      ");
+    cout << "    String metadata:" << endl;
+    printMap(field->metadata().strMetadata(), "      ");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Number of components of a voxel
+template <typename T>
+int numComponents(const T &)
+{ return 1; }
+
+template <typename T>
+int numComponents(const Imath::Vec3<T> &)
+{ return 3; }
+
+//! Returns a component of a voxel
+template <typename T>
+double component(const T &value, const int)
+{ return static_cast<double>(value); }
+
+template <typename T>
+double component(const Imath::Vec3<T> &value, const int c)
+{ return static_cast<double>(value[c]); }
+
+//----------------------------------------------------------------------------//
+
+//! Adds a voxel value to stats, count times
+template <typename Data_T>
+void addValue(ValueStats &stats, const Data_T &value, const size_t count)
+{
+  for (int c = 0; c < numComponents(value); ++c) {
+    const double x = component(value, c);
+    stats.min[c] = std::min(stats.min[c], x);
+    stats.max[c] = std::max(stats.max[c], x);
+    stats.sum[c] += x * count;
+  }
+  stats.numVoxels += count;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Gathers the statistics of each block of a SparseField. Unallocated 
+//! blocks are accounted for by their empty value, without loading anything
+template <typename Data_T>
+struct SparseStatsOp
+{
+  SparseStatsOp(const SparseField<Data_T> &field, vector<ValueStats> &results)
+    : m_field(field), m_results(results)
+  { }
+  void operator() (const size_t idx) const
+  {
+    const V3i    blockRes = m_field.blockRes();
+    const int    order    = m_field.blockOrder();
+    const Box3i  dw       = m_field.dataWindow();
+    const V3i    block(idx % blockRes.x, (idx / blockRes.x) % blockRes.y,
+                       idx / (blockRes.x * blockRes.y));
+    const V3i    size     = Sparse::validBlockSize(dw.size() + V3i(1), order,
+                                                   block);
+    const Data_T empty    = m_field.getBlockEmptyValue(block.x, block.y, 
+                                                       block.z);
+    ValueStats &stats = m_results[idx];
+    stats.numBlocks = 1;
+    if (!m_field.blockIsAllocated(block.x, block.y, block.z)) {
+      addValue(stats, empty, static_cast<size_t>(size.x) * size.y * size.z);
+      return;
+    }
+    stats.numAllocated = 1;
+    typename SparseField<Data_T>::Accessor accessor(m_field);
+    const V3i origin = dw.min + block * (1 << order);
+    for (int k = origin.z; k < origin.z + size.z; ++k) {
+      for (int j = origin.y; j < origin.y + size.y; ++j) {
+        for (int i = origin.x; i < origin.x + size.x; ++i) {
+          const Data_T value = accessor.value(i, j, k);
+          addValue(stats, value, 1);
+          if (value != empty) {
+            stats.filledVoxels++;
+          }
+        }
+      }
+    }
+    stats.allocatedVoxels = stats.numVoxels;
+  }
+  const SparseField<Data_T> &m_field;
+  vector<ValueStats>             &m_results;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Gathers the statistics of each z slice of any other field
+template <typename Data_T>
+struct SliceStatsOp
+{
+  SliceStatsOp(const Field<Data_T> &field, vector<ValueStats> &results)
+    : m_field(field), m_results(results)
+  { }
+  void operator() (const size_t idx) const
+  {
+    const Box3i dw = m_field.dataWindow();
+    const int   k  = dw.min.z + static_cast<int>(idx);
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        addValue(m_results[idx], m_field.value(i, j, k), 1);
+      }
+    }
+  }
+  const Field<Data_T> &m_field;
+  vector<ValueStats>       &m_results;
+};
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void printFieldStats(typename Field<Data_T>::Ptr field)
+{
+  const Box3i dw = field->dataWindow();
+  if (dw.isEmpty()) {
+    return;
+  }
+
+  // Scan blocks or slices in parallel, then merge them in order
+  vector<ValueStats> results;
+  size_t        memBytes = 0;
+  if (SparseField<Data_T> *sparse = 
+      dynamic_cast<SparseField<Data_T> *>(field.get())) {
+    const V3i res = sparse->blockRes();
+    results.resize(static_cast<size_t>(res.x) * res.y * res.z);
+    Sparse::runBlockOp(SparseStatsOp<Data_T>(*sparse, results), 
+                       results.size());
+  } else {
+    results.resize(dw.max.z - dw.min.z + 1);
+    Sparse::runBlockOp(SliceStatsOp<Data_T>(*field, results), 
+                       results.size());
+  }
+  ValueStats stats;
+  BOOST_FOREACH (const ValueStats &s, results) {
+    stats.merge(s);
+  }
+  if (stats.numBlocks > 0) {
+    memBytes = stats.allocatedVoxels * sizeof(Data_T);
+  } else {
+    memBytes = stats.numVoxels * sizeof(Data_T);
+  }
+
+  cout << "    Statistics:" << endl
+       << "      Voxel bytes:      " << memBytes << endl;
+  if (stats.numBlocks > 0) {
+    cout << "      Allocated blocks: " << stats.numAllocated << " of " 
+         << stats.numBlocks << " (" 
+         << 100.0 * stats.numAllocated / stats.numBlocks << "%)" << endl
+         << "      Block fill ratio: " 
+         << (stats.allocatedVoxels > 0 ? 
+             static_cast<double>(stats.filledVoxels) / stats.allocatedVoxels :
+             0.0) << endl;
+  }
+  const int numComps = numComponents(Data_T());
+  cout << "      Min:  ";
+  for (int c = 0; c < numComps; ++c) {
+    cout << " " << stats.min[c];
+  }
+  cout << endl << "      Max:  ";
+  for (int c = 0; c < numComps; ++c) {
+    cout << " " << stats.max[c];
+  }
+  cout << endl << "      Mean: ";
+  for (int c = 0; c < numComps; ++c) {
+    cout << " " << stats.sum[c] / stats.numVoxels;
+  }
+  cout << endl;
 }
 
 //----------------------------------------------------------------------------//
@@ -258,7 +602,7 @@ bool matchString(const std::string &str, const vector<string> &patterns)
 
 //----------------------------------------------------------------------------//
 
-void printFileInfo(const std::string &filename, const Options &options)
+size_t printFileInfo(const std::string &filename, const Options &options)
 {
   typedef Field3D::half half;
 
@@ -276,6 +620,8 @@ void printFileInfo(const std::string &filename, const Options &options)
   vector<string> partitions;
   in.getPartitionNames(partitions);
 
+  size_t numCorrupt = 0;
+
   BOOST_FOREACH (const string &partition, partitions) {
 
     if (!matchString(partition, options.names)) {
@@ -292,6 +638,18 @@ void printFileInfo(const std::string &filename, const Options &options)
         continue;
       }  
 
+      if (options.doVerify) {
+        numCorrupt += printLayerVerification(in, partition, scalarLayer);
+        continue;
+      }
+      if (options.doStats || options.doHeadersOnly) {
+        printLayerStorage(in, partition, scalarLayer);
+      }
+      if (options.doHeadersOnly) {
+        printLayerHeaders(in, partition, scalarLayer, false);
+        continue;
+      }
+
       Field<half>::Vec hScalarFields = 
         in.readScalarLayers<half>(partition, scalarLayer);
       BOOST_FOREACH (Field<half>::Ptr field, hScalarFields) {
@@ -318,6 +676,18 @@ void printFileInfo(const std::string &filename, const Options &options)
         continue;
       }  
 
+      if (options.doVerify) {
+        numCorrupt += printLayerVerification(in, partition, vectorLayer);
+        continue;
+      }
+      if (options.doStats || options.doHeadersOnly) {
+        printLayerStorage(in, partition, vectorLayer);
+      }
+      if (options.doHeadersOnly) {
+        printLayerHeaders(in, partition, vectorLayer, true);
+        continue;
+      }
+
       Field<V3h>::Vec hVectorFields = 
         in.readVectorLayers<half>(partition, vectorLayer);
       BOOST_FOREACH (Field<V3h>::Ptr field, hVectorFields) {
@@ -352,6 +722,7 @@ void printFileInfo(const std::string &filename, const Options &options)
   cout << "    String metadata:" << endl;
   printMap(in.metadata().strMetadata(), "      ");
 
+  return numCorrupt;
 }
 
 //----------------------------------------------------------------------------//
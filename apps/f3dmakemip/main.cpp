@@ -35,17 +35,25 @@
 
 //----------------------------------------------------------------------------//
 
+#include <cstdio>
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <map>
 #include <string>
 
+#include <sys/stat.h>
+
+#include <boost/atomic.hpp>
 #include <boost/regex.hpp>
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <Field3D/DenseField.h>
 #include <Field3D/Field3DFile.h>
+#include <Field3D/FileSequence.h>
 #include <Field3D/InitIO.h>
 #include <Field3D/MIPField.h>
 #include <Field3D/MIPUtil.h>
@@ -65,9 +73,10 @@ using namespace Field3D;
 struct Options {
   Options() 
     : minRes(4), numThreads(8), doMinMax(false), minMaxResMult(0.5), 
-      doOgawa(true)
+      doOgawa(true), doPerAxis(false), numFrames(0), doForce(false)
   { }
   vector<string> inputFiles;
+  string         inputSequence;
   string         outputFile;
   vector<string> names;
   vector<string> attributes;
@@ -76,6 +85,34 @@ struct Options {
   bool           doMinMax;
   float          minMaxResMult;
   bool           doOgawa;
+  bool           doPerAxis;
+  size_t         numFrames;
+  bool           doForce;
+};
+
+//----------------------------------------------------------------------------//
+// SequenceState struct
+//----------------------------------------------------------------------------//
+
+//! Shared by the threads that process the frames of a sequence
+struct SequenceState {
+  SequenceState(const FileSequence &i_inputs, const FileSequence &i_outputs,
+                const vector<size_t> &i_frames, const Options &i_options)
+    : inputs(i_inputs), outputs(i_outputs), frames(i_frames), 
+      options(i_options), nextFrame(0), failed(false)
+  { }
+  const FileSequence    &inputs;
+  const FileSequence    &outputs;
+  //! Indices of the frames that need processing
+  const vector<size_t>  &frames;
+  //! Options for each frame. numThreads is the share of a single frame
+  const Options         &options;
+  //! Next entry of frames to process. Claimed without locking
+  boost::atomic<size_t>  nextFrame;
+  //! Set if any frame failed
+  boost::atomic<bool>    failed;
+  //! Keeps the output of each frame together
+  boost::mutex           printMutex;
 };
 
 //----------------------------------------------------------------------------//
@@ -85,9 +122,15 @@ struct Options {
 //! Parses command line options, puts them in Options struct.
 Options parseOptions(int argc, char **argv);
 
-//! Prints information about all fields in file.
-void makeMIP(const std::string &filename, const Options &options,
-             Field3DOutputFile &out);
+//! Writes MIP versions of the matching fields in file to out.
+//! \returns False if the file couldn't be opened
+bool makeMIP(const std::string &filename, const Options &options,
+             Field3DOutputFile &out, std::ostream &os);
+
+//! Processes each frame of options.inputSequence into the matching frame of
+//! the output sequence, several frames at a time.
+//! \returns The exit code
+int makeMIPSequence(const Options &options);
 
 //----------------------------------------------------------------------------//
 // Function implementations
@@ -99,10 +142,6 @@ int main(int argc, char **argv)
 
   Options options = parseOptions(argc, argv);
 
-  // Set num threads ---
-
-  Field3D::setNumIOThreads(options.numThreads);
-  
   // Set HDF5/Ogawa ---
 
   Field3DOutputFile::useOgawa(options.doOgawa);
@@ -113,6 +152,16 @@ int main(int argc, char **argv)
     cout << "Writing HDF5." << endl;
   }
 
+  // Sequences set up their own threading ---
+
+  if (!options.inputSequence.empty()) {
+    return makeMIPSequence(options);
+  }
+
+  // Set num threads ---
+
+  Field3D::setNumIOThreads(options.numThreads);
+  
   // Open output file ---
 
   Field3DOutputFile out;
@@ -123,7 +172,9 @@ int main(int argc, char **argv)
   }
 
   BOOST_FOREACH (const string &file, options.inputFiles) {
-    makeMIP(file, options, out);
+    if (!makeMIP(file, options, out, cout)) {
+      return 1;
+    }
   }
 }
 
@@ -142,6 +193,13 @@ Options parseOptions(int argc, char **argv)
      "Display help")
     ("input-file,i", po::value<vector<string> >(), 
      "Input files")
+    ("input-sequence,s", po::value<string>(), 
+     "Input file sequence, such as in.1-100#.f3d. The output file is then "
+     "a sequence of the same length.")
+    ("concurrent-frames,c", po::value<size_t>(), 
+     "Number of sequence frames to process at once. 0 picks a number.")
+    ("force,f", po::value<bool>(), 
+     "Whether to process sequence frames whose output is up to date.")
     ("name,n", po::value<vector<string> >(), 
      "Load field(s) by name")
     ("attribute,a", po::value<vector<string> >(), 
@@ -158,6 +216,8 @@ Options parseOptions(int argc, char **argv)
      "Output file")
     ("ogawa,g", po::value<bool>(), 
      "Whether to output an Ogawa file.")
+    ("per-axis,p", po::value<bool>(), 
+     "Whether to reduce each axis only until it reaches min-res.")
     ;
   
   po::variables_map vm;
@@ -191,6 +251,15 @@ Options parseOptions(int argc, char **argv)
   if (vm.count("input-file")) {
     options.inputFiles = vm["input-file"].as<std::vector<std::string> >();
   }
+  if (vm.count("input-sequence")) {
+    options.inputSequence = vm["input-sequence"].as<std::string>();
+  }
+  if (vm.count("concurrent-frames")) {
+    options.numFrames = vm["concurrent-frames"].as<size_t>();
+  }
+  if (vm.count("force")) {
+    options.doForce = vm["force"].as<bool>();
+  }
   if (vm.count("min-res")) {
     options.minRes = vm["min-res"].as<int>();
   }
@@ -215,6 +284,9 @@ Options parseOptions(int argc, char **argv)
   if (vm.count("ogawa")) {
     options.doOgawa = vm["ogawa"].as<bool>();
   }
+  if (vm.count("per-axis")) {
+    options.doPerAxis = vm["per-axis"].as<bool>();
+  }
 
   return options;
 }
@@ -223,18 +295,19 @@ Options parseOptions(int argc, char **argv)
 
 template <typename T>
 void writeField(const typename Field<Imath::Vec3<T> >::Ptr f, 
-                Field3DOutputFile &out)
+                Field3DOutputFile &out, std::ostream &os)
 {
-  cout << "  Writing \"" << f->attribute << "\"" << endl;
+  os << "  Writing \"" << f->attribute << "\"" << endl;
   out.writeVectorLayer<T>(f);
 }
 
 //----------------------------------------------------------------------------//
 
 template <typename Data_T>
-void writeField(const typename Field<Data_T>::Ptr &f, Field3DOutputFile &out)
+void writeField(const typename Field<Data_T>::Ptr &f, Field3DOutputFile &out,
+                std::ostream &os)
 {
-  cout << "  Writing \"" << f->attribute << "\"" << endl;
+  os << "  Writing \"" << f->attribute << "\"" << endl;
   out.writeScalarLayer<Data_T>(f);
 }
 
@@ -242,25 +315,28 @@ void writeField(const typename Field<Data_T>::Ptr &f, Field3DOutputFile &out)
 
 template <typename Data_T>
 void makeMIP(typename Field<Data_T>::Ptr field, const Options &options,
-             Field3DOutputFile &out)
+             Field3DOutputFile &out, std::ostream &os)
 {
   typedef DenseField<Data_T>     DenseType;
   typedef SparseField<Data_T>    SparseType;
   typedef MIPDenseField<Data_T>  MIPDenseType;
   typedef MIPSparseField<Data_T> MIPSparseType;
 
-  cout << "  Filtering \"" << field->name << ":" << field->attribute 
+  os << "  Filtering \"" << field->name << ":" << field->attribute 
        << "\" (" << field->classType() << ")" << endl;
 
-  const V3i offset = computeOffset(*field);
+  const V3i          offset    = computeOffset(*field);
+  const MIPReduction reduction = 
+    options.doPerAxis ? MIPReducePerAxis : MIPReduceUniform;
   
   // Handle dense fields
   if (DenseType *dense = dynamic_cast<DenseType*>(field.get())) {
-    // MIP
+    // MIP. The levels are filtered as they're written
     typename MIPDenseType::Ptr mip = 
-      makeMIP<MIPDenseType, TriangleFilter>
-      (*dense, options.minRes, offset, options.numThreads);
-    writeField<Data_T>(mip, out);
+      makeStreamingMIP<MIPDenseType, TriangleFilter>
+      (typename DenseType::Ptr(dense), options.minRes, offset, 
+       options.numThreads, reduction);
+    writeField<Data_T>(mip, out, os);
     // Min/Max
     if (options.doMinMax) {
       std::pair<typename MIPDenseType::Ptr, typename MIPDenseType::Ptr> p =
@@ -269,19 +345,20 @@ void makeMIP(typename Field<Data_T>::Ptr field, const Options &options,
                                   options.numThreads);
       p.first->attribute += k_minSuffix;
       p.second->attribute += k_maxSuffix;
-      writeField<Data_T>(p.first, out);
-      writeField<Data_T>(p.second, out);
+      writeField<Data_T>(p.first, out, os);
+      writeField<Data_T>(p.second, out, os);
     }
     return;
   }
 
   // Handle sparse fields
   if (SparseType *sparse = dynamic_cast<SparseType*>(field.get())) {
-    // MIP
+    // MIP. The levels are filtered as they're written
     typename MIPSparseType::Ptr mip = 
-      makeMIP<MIPSparseType, TriangleFilter>
-      (*sparse, options.minRes, offset, options.numThreads);
-    writeField<Data_T>(mip, out);
+      makeStreamingMIP<MIPSparseType, TriangleFilter>
+      (typename SparseType::Ptr(sparse), options.minRes, offset, 
+       options.numThreads, reduction);
+    writeField<Data_T>(mip, out, os);
     // Min/Max
     if (options.doMinMax) {
       std::pair<typename MIPSparseType::Ptr, typename MIPSparseType::Ptr> p =
@@ -290,19 +367,20 @@ void makeMIP(typename Field<Data_T>::Ptr field, const Options &options,
                                   options.numThreads);
       p.first->attribute += k_minSuffix;
       p.second->attribute += k_maxSuffix;
-      writeField<Data_T>(p.first, out);
-      writeField<Data_T>(p.second, out);
+      writeField<Data_T>(p.first, out, os);
+      writeField<Data_T>(p.second, out, os);
     }
     return;
   }
 
   // Handle MIP dense fields
   if (MIPDenseType *dense = dynamic_cast<MIPDenseType*>(field.get())) {
-    // MIP
+    // MIP. The levels are filtered as they're written
     typename MIPDenseType::Ptr mip = 
-      makeMIP<MIPDenseType, TriangleFilter>
-      (*dense->concreteMipLevel(0), options.minRes, offset, options.numThreads);
-    writeField<Data_T>(mip, out);
+      makeStreamingMIP<MIPDenseType, TriangleFilter>
+      (dense->concreteMipLevel(0), options.minRes, offset, options.numThreads,
+       reduction);
+    writeField<Data_T>(mip, out, os);
     // Min/Max
     if (options.doMinMax) {
       std::pair<typename MIPDenseType::Ptr, typename MIPDenseType::Ptr> p =
@@ -311,18 +389,20 @@ void makeMIP(typename Field<Data_T>::Ptr field, const Options &options,
                                   options.numThreads);
       p.first->attribute += k_minSuffix;
       p.second->attribute += k_maxSuffix;
-      writeField<Data_T>(p.first, out);
-      writeField<Data_T>(p.second, out);
+      writeField<Data_T>(p.first, out, os);
+      writeField<Data_T>(p.second, out, os);
     }
     return;
   }
 
   // Handle MIP sparse fields
   if (MIPSparseType *sparse = dynamic_cast<MIPSparseType*>(field.get())) {
-    // MIP
-    typename MIPSparseType::Ptr mip = makeMIP<MIPSparseType, TriangleFilter>
-      (*sparse->concreteMipLevel(0), options.minRes, offset, options.numThreads);
-    writeField<Data_T>(mip, out);
+    // MIP. The levels are filtered as they're written
+    typename MIPSparseType::Ptr mip = 
+      makeStreamingMIP<MIPSparseType, TriangleFilter>
+      (sparse->concreteMipLevel(0), options.minRes, offset, options.numThreads,
+       reduction);
+    writeField<Data_T>(mip, out, os);
     // Min/Max
     if (options.doMinMax) {
       std::pair<typename MIPSparseType::Ptr, typename MIPSparseType::Ptr> p =
@@ -331,8 +411,8 @@ void makeMIP(typename Field<Data_T>::Ptr field, const Options &options,
                                   options.numThreads);
       p.first->attribute += k_minSuffix;
       p.second->attribute += k_maxSuffix;
-      writeField<Data_T>(p.first, out);
-      writeField<Data_T>(p.second, out);
+      writeField<Data_T>(p.first, out, os);
+      writeField<Data_T>(p.second, out, os);
     }
     return;
   }
@@ -341,26 +421,30 @@ void makeMIP(typename Field<Data_T>::Ptr field, const Options &options,
 
 //----------------------------------------------------------------------------//
 
-void makeMIP(const std::string &filename, const Options &options,
-             Field3DOutputFile &out)
+bool makeMIP(const std::string &filename, const Options &options,
+             Field3DOutputFile &out, std::ostream &os)
 {
   typedef Field3D::half half;
 
   Field3DInputFile in;
 
   if (!in.open(filename)) {
-    cout << "Error: Couldn't open f3d file: " << filename << endl;
-    exit(1);
+    os << "Error: Couldn't open f3d file: " << filename << endl;
+    return false;
   }
 
-  cout << "Opening file: " << endl << "  " << filename << endl;
+  os << "Opening file: " << endl << "  " << filename << endl;
+
+  // Parse the patterns once for all partitions and layers
+  const MatchPattern namePattern(options.names);
+  const MatchPattern attributePattern(options.attributes);
 
   vector<string> partitions;
   in.getPartitionNames(partitions);
 
   BOOST_FOREACH (const string &partition, partitions) {
 
-    if (!match(partition, options.names)) {
+    if (!namePattern.match(partition)) {
       continue;
     }
 
@@ -370,63 +454,183 @@ void makeMIP(const std::string &filename, const Options &options,
 
     BOOST_FOREACH (const string &scalarLayer, scalarLayers) {
 
-      if (!match(scalarLayer, options.attributes)) {
+      if (!attributePattern.match(scalarLayer)) {
         continue;
       }  
 
       // Skip _min and _max fields
       if (scalarLayer.find(k_minSuffix) != std::string::npos ||
           scalarLayer.find(k_maxSuffix) != std::string::npos) {
-        cout << "  ... skipping " << scalarLayer << endl;
+        os << "  ... skipping " << scalarLayer << endl;
       }
 
       Field<half>::Vec hScalarFields = 
         in.readScalarLayers<half>(partition, scalarLayer);
       BOOST_FOREACH (Field<half>::Ptr field, hScalarFields) {
-        makeMIP<half>(field, options, out);
+        makeMIP<half>(field, options, out, os);
       }
 
       Field<float>::Vec fScalarFields = 
         in.readScalarLayers<float>(partition, scalarLayer);
       BOOST_FOREACH (Field<float>::Ptr field, fScalarFields) {
-        makeMIP<float>(field, options, out);
+        makeMIP<float>(field, options, out, os);
       }
 
       Field<double>::Vec dScalarFields = 
         in.readScalarLayers<double>(partition, scalarLayer);
       BOOST_FOREACH (Field<double>::Ptr field, dScalarFields) {
-        makeMIP<double>(field, options, out);
+        makeMIP<double>(field, options, out, os);
       }
 
     }
 
     BOOST_FOREACH (const string &vectorLayer, vectorLayers) {
       
-      if (!match(vectorLayer, options.attributes)) {
+      if (!attributePattern.match(vectorLayer)) {
         continue;
       }  
 
       Field<V3h>::Vec hVectorFields = 
         in.readVectorLayers<half>(partition, vectorLayer);
       BOOST_FOREACH (Field<V3h>::Ptr field, hVectorFields) {
-        makeMIP<V3h>(field, options, out);
+        makeMIP<V3h>(field, options, out, os);
       }
 
       Field<V3f>::Vec fVectorFields = 
         in.readVectorLayers<float>(partition, vectorLayer);
       BOOST_FOREACH (Field<V3f>::Ptr field, fVectorFields) {
-        makeMIP<V3f>(field, options, out);
+        makeMIP<V3f>(field, options, out, os);
       }
 
       Field<V3d>::Vec dVectorFields = 
         in.readVectorLayers<double>(partition, vectorLayer);
       BOOST_FOREACH (Field<V3d>::Ptr field, dVectorFields) {
-        makeMIP<V3d>(field, options, out);
+        makeMIP<V3d>(field, options, out, os);
+      }
+
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Whether output was modified more recently than input
+bool isUpToDate(const std::string &input, const std::string &output)
+{
+  struct stat inputInfo, outputInfo;
+  if (stat(input.c_str(), &inputInfo) != 0 || 
+      stat(output.c_str(), &outputInfo) != 0) {
+    return false;
+  }
+  return outputInfo.st_mtime > inputInfo.st_mtime;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Processes frames of a sequence until there are none left. Each thread
+//! claims its next frame as it finishes the previous one, so that while 
+//! one frame is being read, others are being filtered or written.
+class MakeMIPFrameOp
+{
+public:
+  MakeMIPFrameOp(SequenceState &state)
+    : m_state(state)
+  { }
+  void operator() ()
+  {
+    for (size_t i = m_state.nextFrame.fetch_add(1); 
+         i < m_state.frames.size(); 
+         i = m_state.nextFrame.fetch_add(1)) {
+      const size_t  frame  = m_state.frames[i];
+      const string &output = m_state.outputs.filename(frame);
+      // Buffer the frame's output, so that frames don't interleave
+      std::ostringstream os;
+      bool success = false;
+      {
+        Field3DOutputFile out;
+        if (out.create(output)) {
+          success = makeMIP(m_state.inputs.filename(frame), m_state.options,
+                            out, os);
+        } else {
+          os << "ERROR: Couldn't create output file: " << output << endl;
+        }
+      }
+      // Don't leave a partial frame that would count as up to date
+      if (!success) {
+        std::remove(output.c_str());
+        m_state.failed = true;
       }
+      boost::mutex::scoped_lock lock(m_state.printMutex);
+      cout << os.str() << std::flush;
+    }
+  }
+private:
+  SequenceState &m_state;
+};
+
+//----------------------------------------------------------------------------//
+
+int makeMIPSequence(const Options &options)
+{
+  const FileSequence inputs(options.inputSequence);
+  const FileSequence outputs(options.outputFile);
 
+  if (inputs.size() == 0) {
+    cout << "ERROR: Couldn't resolve input sequence: " 
+         << options.inputSequence << endl;
+    return 1;
+  }
+  if (outputs.size() != inputs.size()) {
+    cout << "ERROR: Output sequence " << options.outputFile 
+         << " doesn't match the length of the input sequence" << endl;
+    return 1;
+  }
+
+  // Find the frames to process ---
+
+  vector<size_t> frames;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!options.doForce && 
+        isUpToDate(inputs.filename(i), outputs.filename(i))) {
+      cout << "Skipping up to date file: " << outputs.filename(i) << endl;
+    } else {
+      frames.push_back(i);
     }
   }
+  if (frames.empty()) {
+    return 0;
+  }
+
+  // Share the threads between the frames in flight. By default, three 
+  // frames overlap, so that one can be read while one is filtered and one 
+  // is written ---
+
+  const size_t numThreads = std::max(options.numThreads, size_t(1));
+  size_t       numFrames  = options.numFrames > 0 ? 
+    options.numFrames : std::min(numThreads, size_t(3));
+  numFrames = std::min(numFrames, frames.size());
+
+  Options frameOptions = options;
+  frameOptions.numThreads = std::max(numThreads / numFrames, size_t(1));
+
+  Field3D::setNumIOThreads(frameOptions.numThreads);
+
+  cout << "Processing " << frames.size() << " frames, " << numFrames 
+       << " at a time." << endl;
+
+  // Process ---
+
+  SequenceState state(inputs, outputs, frames, frameOptions);
+
+  boost::thread_group threads;
+  for (size_t i = 0; i < numFrames; ++i) {
+    threads.create_thread(MakeMIPFrameOp(state));
+  }
+  threads.join_all();
 
+  return state.failed ? 1 : 0;
 }
 
 //----------------------------------------------------------------------------//
@@ -38,6 +38,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 
 #include <boost/regex.hpp>
@@ -59,7 +60,7 @@ using namespace Field3D;
 
 struct Options {
   Options() 
-    : numThreads(1), doOgawa(true)
+    : numThreads(1), doOgawa(true), doDecode(false)
   { }
   vector<string> inputFiles;
   string         outputFile;
@@ -67,6 +68,7 @@ struct Options {
   vector<string> attributes;
   size_t         numThreads;
   bool           doOgawa;
+  bool           doDecode;
 };
 
 //----------------------------------------------------------------------------//
@@ -138,6 +140,8 @@ Options parseOptions(int argc, char **argv)
     ("ogawa,g", po::value<bool>(), "Whether to output an Ogawa file.")
     ("num-threads,t", po::value<size_t>(), "Number of threads to use")
     ("output-file,o", po::value<string>(), "Output file")
+    ("decode,d", po::value<bool>(), 
+     "Whether to read and rewrite the fields rather than copy their data.")
     ;
   
   po::variables_map vm;
@@ -186,6 +190,9 @@ Options parseOptions(int argc, char **argv)
   if (vm.count("output-file")) {
     options.outputFile = vm["output-file"].as<std::string>();
   }
+  if (vm.count("decode")) {
+    options.doDecode = vm["decode"].as<bool>();
+  }
 
   return options;
 }
@@ -223,12 +230,20 @@ void writeOutput(const std::string &filename, const Options &options,
 
   cout << "Opening file: " << endl << "  " << filename << endl;
 
+  // Parse the patterns once for all partitions and layers
+  const MatchPattern namePattern(options.names);
+  const MatchPattern attributePattern(options.attributes);
+
   vector<string> partitions;
   in.getPartitionNames(partitions);
 
+  // Between Ogawa files, the layers are copied without being decoded
+  const bool doCopy = 
+    !options.doDecode && options.doOgawa && in.encoding() == "Ogawa";
+
   BOOST_FOREACH (const string &partition, partitions) {
 
-    if (!match(partition, options.names)) {
+    if (!namePattern.match(partition)) {
       continue;
     }
 
@@ -236,9 +251,25 @@ void writeOutput(const std::string &filename, const Options &options,
     in.getScalarLayerNames(scalarLayers, partition);
     in.getVectorLayerNames(vectorLayers, partition);
 
+    if (doCopy) {
+      // Each name covers the layer in every partition of that name
+      set<string> layers(scalarLayers.begin(), scalarLayers.end());
+      layers.insert(vectorLayers.begin(), vectorLayers.end());
+      BOOST_FOREACH (const string &layer, layers) {
+        if (!attributePattern.match(layer)) {
+          continue;
+        }
+        if (!out.copyLayer(in, partition, layer)) {
+          cout << "Error: Couldn't copy layer " << partition << ":" 
+               << layer << endl;
+        }
+      }
+      continue;
+    }
+
     BOOST_FOREACH (const string &scalarLayer, scalarLayers) {
 
-      if (!match(scalarLayer, options.attributes)) {
+      if (!attributePattern.match(scalarLayer)) {
         continue;
       }  
 
@@ -264,7 +295,7 @@ void writeOutput(const std::string &filename, const Options &options,
 
     BOOST_FOREACH (const string &vectorLayer, vectorLayers) {
       
-      if (!match(vectorLayer, options.attributes)) {
+      if (!attributePattern.match(vectorLayer)) {
         continue;
       }  
 
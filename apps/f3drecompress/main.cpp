@@ -0,0 +1,476 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/cstdint.hpp>
+
+#include <Field3D/SparseField.h>
+#include <Field3D/InitIO.h>
+#include <Field3D/Field3DFile.h>
+#include <Field3D/PatternMatch.h>
+#include <Field3D/Transcode.h>
+
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+// Options struct
+//----------------------------------------------------------------------------//
+
+struct Options {
+  Options() 
+    : codec(SparseCodecZlib), level(1), quantizeBits(0), 
+      blockOrder(0), doUniformTiles(false), doDedupe(false), 
+      doVerify(true), numThreads(0)
+  { }
+  string         inputFile;
+  string         outputFile;
+  vector<string> names;
+  vector<string> attributes;
+  SparseCodec    codec;
+  int            level;
+  int            quantizeBits;
+  int            blockOrder;
+  bool           doUniformTiles;
+  bool           doDedupe;
+  bool           doVerify;
+  size_t         numThreads;
+};
+
+//----------------------------------------------------------------------------//
+// Checksums struct
+//----------------------------------------------------------------------------//
+
+//! Checksums of the voxels of each field in a file, and the time it took 
+//! to read them. Each field is keyed on its partition, layer, class and 
+//! data window.
+struct Checksums {
+  typedef std::pair<string, boost::uint64_t> Entry;
+  Checksums()
+    : readTime(0.0), numBytes(0)
+  { }
+  vector<Entry>   sums;
+  //! Seconds spent reading, i.e. decoding, the fields
+  double          readTime;
+  //! In-memory size of the voxel data read
+  boost::uint64_t numBytes;
+};
+
+//----------------------------------------------------------------------------//
+// Function prototypes
+//----------------------------------------------------------------------------//
+
+//! Parses command line options, puts them in Options struct.
+Options parseOptions(int argc, char **argv);
+
+//! Returns the wall clock time in seconds
+double wallTime();
+
+//! Returns the size of a file in bytes, or 0 if it can't be found
+boost::uint64_t fileSize(const string &filename);
+
+//! Reads the matching layers of a file and checksums their voxels
+bool checksumFile(const string &filename, const Options &options, 
+                  Checksums &checksums);
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv)
+{
+  Field3D::initIO();
+
+  Options options = parseOptions(argc, argv);
+
+  if (options.inputFile.empty()) {
+    cout << "ERROR: No input file given." << endl;
+    return 1;
+  }
+
+  // Set num threads ---
+
+  if (options.numThreads > 0) {
+    Field3D::setNumIOThreads(options.numThreads);
+  }
+
+  // Set compression ---
+
+  Field3D::setSparseStorageMode(SparseStorageCompressed);
+  Field3D::setDenseStorageMode(DenseStorageCompressed);
+  Field3D::setSparseCodec(options.codec);
+  Field3D::setSparseCompressionLevel(options.level);
+  Field3D::setSparseQuantizeBits(options.quantizeBits);
+  Field3D::setSparseBlockDedupe(options.doDedupe);
+
+  // Without an output file the input is replaced, once the result checks out
+  const bool isInPlace = options.outputFile.empty();
+  const string outputFile = isInPlace ? 
+    options.inputFile + ".recompress.tmp" : options.outputFile;
+
+  // Recompress ---
+
+  TranscodeOptions transcodeOptions;
+  transcodeOptions.partitions           = options.names;
+  transcodeOptions.layers               = options.attributes;
+  transcodeOptions.blockOrder           = options.blockOrder;
+  transcodeOptions.releaseUniformBlocks = options.doUniformTiles;
+
+  cout << "Recompressing " << options.inputFile << endl;
+
+  const double start = wallTime();
+  if (!transcode(options.inputFile, outputFile, transcodeOptions)) {
+    cout << "ERROR: Couldn't recompress " << options.inputFile << endl;
+    std::remove(outputFile.c_str());
+    return 1;
+  }
+  const double writeTime = wallTime() - start;
+
+  // Compare ---
+
+  const boost::uint64_t inSize = fileSize(options.inputFile);
+  const boost::uint64_t outSize = fileSize(outputFile);
+
+  cout << fixed << setprecision(3)
+       << "  Input size:     " << inSize << " bytes" << endl
+       << "  Output size:    " << outSize << " bytes (" 
+       << (inSize ? 100.0 * outSize / inSize : 0.0) << "%)" << endl
+       << "  Recompressed in " << writeTime << " s" << endl;
+
+  if (options.doVerify) {
+    Checksums inSums, outSums;
+    if (!checksumFile(options.inputFile, options, inSums) ||
+        !checksumFile(outputFile, options, outSums)) {
+      cout << "ERROR: Couldn't read back the fields" << endl;
+      std::remove(outputFile.c_str());
+      return 1;
+    }
+    const double mb = inSums.numBytes / (1024.0 * 1024.0);
+    cout << "  Input decode:   " << inSums.readTime << " s (" 
+         << mb / std::max(inSums.readTime, 1e-9) << " MB/s)" << endl
+         << "  Output decode:  " << outSums.readTime << " s (" 
+         << mb / std::max(outSums.readTime, 1e-9) << " MB/s)" << endl;
+    // Layers may be written in another order than they were read. Lossy 
+    // settings change the voxels, so only the layout is checked then
+    std::sort(inSums.sums.begin(), inSums.sums.end());
+    std::sort(outSums.sums.begin(), outSums.sums.end());
+    bool matches = inSums.sums.size() == outSums.sums.size();
+    for (size_t i = 0; matches && i < inSums.sums.size(); ++i) {
+      matches = inSums.sums[i].first == outSums.sums[i].first &&
+        (options.quantizeBits != 0 || 
+         inSums.sums[i].second == outSums.sums[i].second);
+    }
+    if (!matches) {
+      cout << "ERROR: The recompressed fields don't match the input" << endl;
+      std::remove(outputFile.c_str());
+      return 1;
+    }
+    cout << "  Checksums " 
+         << (options.quantizeBits == 0 ? "match" : "skipped, quantized") 
+         << endl;
+  }
+
+  if (isInPlace && std::rename(outputFile.c_str(), 
+                               options.inputFile.c_str()) != 0) {
+    cout << "ERROR: Couldn't replace " << options.inputFile << endl;
+    std::remove(outputFile.c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------//
+
+Options parseOptions(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+
+  po::options_description desc("Available options");
+
+  desc.add_options()
+    ("help,h", "Display help")
+    ("input-file,i", po::value<string>(), "Input file")
+    ("output-file,o", po::value<string>(), 
+     "Output file. Without one, the input file is replaced.")
+    ("name,n", po::value<vector<string> >(), "Recompress field(s) by name")
+    ("attribute,a", po::value<vector<string> >(), 
+     "Recompress field(s) by attribute")
+    ("codec,c", po::value<string>(), "Codec (zlib/shuffle_zlib)")
+    ("level,l", po::value<int>(), "zlib compression level (1-9)")
+    ("quantize,q", po::value<int>(), 
+     "Quantize sparse blocks to 8 or 12 bits. 0 is lossless.")
+    ("block-order,b", po::value<int>(), 
+     "Block order of sparse fields. 0 keeps the current one.")
+    ("uniform-tiles,u", po::value<bool>(), 
+     "Whether to store sparse blocks that hold one value as constant tiles")
+    ("dedupe,d", po::value<bool>(), 
+     "Whether to store identical sparse blocks once")
+    ("verify,v", po::value<bool>(), 
+     "Whether to read back and checksum the result. On by default.")
+    ("num-threads,t", po::value<size_t>(), "Number of threads to use")
+    ;
+  
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  if (vm.count("help")) {
+    cout << desc << endl;
+    exit(0);
+  }
+
+  if (vm.count("input-file")) {
+    options.inputFile = vm["input-file"].as<std::string>();
+  }
+  if (vm.count("output-file")) {
+    options.outputFile = vm["output-file"].as<std::string>();
+  }
+  if (vm.count("name")) {
+    options.names = vm["name"].as<std::vector<std::string> >();
+  }
+  if (vm.count("attribute")) {
+    options.attributes = vm["attribute"].as<std::vector<std::string> >();
+  }
+  if (vm.count("codec")) {
+    const string codec = vm["codec"].as<std::string>();
+    if (codec == "zlib") {
+      options.codec = SparseCodecZlib;
+    } else if (codec == "shuffle_zlib") {
+      options.codec = SparseCodecShuffleZlib;
+    } else {
+      cerr << "Unknown codec: " << codec << endl;
+      exit(1);
+    }
+  }
+  if (vm.count("level")) {
+    options.level = vm["level"].as<int>();
+  }
+  if (vm.count("quantize")) {
+    options.quantizeBits = vm["quantize"].as<int>();
+    if (options.quantizeBits != 0 && options.quantizeBits != 8 && 
+        options.quantizeBits != 12) {
+      cerr << "Quantization must be 0, 8 or 12 bits" << endl;
+      exit(1);
+    }
+  }
+  if (vm.count("block-order")) {
+    options.blockOrder = vm["block-order"].as<int>();
+  }
+  if (vm.count("uniform-tiles")) {
+    options.doUniformTiles = vm["uniform-tiles"].as<bool>();
+  }
+  if (vm.count("dedupe")) {
+    options.doDedupe = vm["dedupe"].as<bool>();
+  }
+  if (vm.count("verify")) {
+    options.doVerify = vm["verify"].as<bool>();
+  }
+  if (vm.count("num-threads")) {
+    options.numThreads = vm["num-threads"].as<size_t>();
+  }
+
+  return options;
+}
+
+//----------------------------------------------------------------------------//
+
+double wallTime()
+{
+  using namespace boost::posix_time;
+  static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+  return (microsec_clock::universal_time() - epoch).total_microseconds() * 
+    1e-6;
+}
+
+//----------------------------------------------------------------------------//
+
+boost::uint64_t fileSize(const string &filename)
+{
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0) {
+    return 0;
+  }
+  return info.st_size;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Hashes the bytes of the voxels of one z slice, FNV-1a style
+template <typename Data_T>
+struct ChecksumSliceOp
+{
+  ChecksumSliceOp(const Field<Data_T> &field, 
+                  vector<boost::uint64_t> &sums)
+    : m_field(field), m_sums(sums)
+  { }
+  void operator() (const size_t idx) const
+  {
+    const Box3i &dw = m_field.dataWindow();
+    const int k = dw.min.z + static_cast<int>(idx);
+    boost::uint64_t sum = 14695981039346656037ULL;
+    for (int j = dw.min.y; j <= dw.max.y; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x; ++i) {
+        const Data_T value = m_field.value(i, j, k);
+        const unsigned char *bytes = 
+          reinterpret_cast<const unsigned char *>(&value);
+        for (size_t b = 0; b < sizeof(Data_T); ++b) {
+          sum = (sum ^ bytes[b]) * 1099511628211ULL;
+        }
+      }
+    }
+    m_sums[idx] = sum;
+  }
+  const Field<Data_T>     &m_field;
+  vector<boost::uint64_t> &m_sums;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Adds the checksums of the fields of a layer, hashing each field's z 
+//! slices in parallel
+template <typename Data_T>
+void addChecksums(const typename Field<Data_T>::Vec &fields, 
+                  const string &key, Checksums &checksums)
+{
+  BOOST_FOREACH (const typename Field<Data_T>::Ptr &field, fields) {
+    const Box3i &dw = field->dataWindow();
+    vector<boost::uint64_t> sliceSums(dw.isEmpty() ? 0 : 
+                                      dw.max.z - dw.min.z + 1);
+    Sparse::runBlockOp(ChecksumSliceOp<Data_T>(*field, sliceSums), 
+                       sliceSums.size());
+    boost::uint64_t sum = 14695981039346656037ULL;
+    BOOST_FOREACH (const boost::uint64_t sliceSum, sliceSums) {
+      sum = (sum ^ sliceSum) * 1099511628211ULL;
+    }
+    std::ostringstream fieldKey;
+    fieldKey << key << " " << field->className() << " " 
+             << dw.min << " " << dw.max;
+    checksums.sums.push_back(Checksums::Entry(fieldKey.str(), sum));
+    checksums.numBytes += field->voxelCount() * sizeof(Data_T);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads a layer, if it holds the given data type, timing the read
+template <typename T>
+void checksumLayer(const Field3DInputFile &in, const string &partition,
+                   const string &layer, const bool isVector, 
+                   Checksums &checksums)
+{
+  const string key = partition + ":" + layer;
+  if (isVector) {
+    const double start = wallTime();
+    typename Field<FIELD3D_VEC3_T<T> >::Vec fields = 
+      in.readVectorLayers<T>(partition, layer);
+    checksums.readTime += wallTime() - start;
+    addChecksums<FIELD3D_VEC3_T<T> >(fields, key, checksums);
+  } else {
+    const double start = wallTime();
+    typename Field<T>::Vec fields = in.readScalarLayers<T>(partition, layer);
+    checksums.readTime += wallTime() - start;
+    addChecksums<T>(fields, key, checksums);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool checksumFile(const string &filename, const Options &options, 
+                  Checksums &checksums)
+{
+  Field3DInputFile in;
+  if (!in.open(filename)) {
+    return false;
+  }
+
+  // Parse the patterns once for all partitions and layers
+  const MatchPattern namePattern(options.names);
+  const MatchPattern attributePattern(options.attributes);
+
+  std::vector<std::string> partitions;
+  in.getPartitionNames(partitions);
+
+  BOOST_FOREACH (const string &partition, partitions) {
+    if (!namePattern.match(partition)) {
+      continue;
+    }
+    std::vector<std::string> scalarLayers, vectorLayers;
+    in.getScalarLayerNames(scalarLayers, partition);
+    in.getVectorLayerNames(vectorLayers, partition);
+    BOOST_FOREACH (const string &layer, scalarLayers) {
+      if (attributePattern.match(layer)) {
+        checksumLayer<half>(in, partition, layer, false, checksums);
+        checksumLayer<float>(in, partition, layer, false, checksums);
+        checksumLayer<double>(in, partition, layer, false, checksums);
+      }
+    }
+    BOOST_FOREACH (const string &layer, vectorLayers) {
+      if (attributePattern.match(layer)) {
+        checksumLayer<half>(in, partition, layer, true, checksums);
+        checksumLayer<float>(in, partition, layer, true, checksums);
+        checksumLayer<double>(in, partition, layer, true, checksums);
+      }
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
@@ -35,6 +35,8 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <vector>
 #include <map>
@@ -42,6 +44,7 @@
 
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <Field3D/DenseField.h>
 #include <Field3D/MACField.h>
@@ -62,7 +65,8 @@ struct Options {
   Options()
     : name("field_name"), attribute("field_attribute"),
       resolution(64), fieldType("DenseField"), fill("small_sphere"),
-      bits(32), isVectorField(false)
+      bits(32), isVectorField(false), fillRatio(0.15), numLayers(1), 
+      numPartitions(1), numThreads(0), seed(1)
   { }
   string     filename;
   string     name;
@@ -72,6 +76,40 @@ struct Options {
   string     fill;
   int        bits;
   bool       isVectorField;
+  double     fillRatio;
+  int        numLayers;
+  int        numPartitions;
+  size_t     numThreads;
+  int        seed;
+};
+
+//----------------------------------------------------------------------------//
+// Fill struct
+//----------------------------------------------------------------------------//
+
+//! Procedural density used to fill the fields. Positions are given in the
+//! local space of the field, i.e. [0,1] across its extents.
+struct Fill {
+  enum Type {
+    FillNone,
+    FillFullSphere,
+    FillSmallSphere,
+    FillSmoke
+  };
+  Fill()
+    : type(FillNone), radius(0.0), threshold(0.0), seed(0), voxelSize(0.0)
+  { }
+  //! Returns the density at a local space position
+  double density(const V3d &lsP) const;
+  Type   type;
+  //! Radius of the sphere fills, in local space
+  double radius;
+  //! Noise value below which the smoke fill is empty
+  double threshold;
+  //! Seed of the smoke fill's noise
+  int    seed;
+  //! Size of a voxel in local space, used to anti-alias the sphere edges
+  double voxelSize;
 };
 
 //----------------------------------------------------------------------------//
@@ -90,7 +128,23 @@ void createConcreteScalarField(const Options &options);
 template <typename Data_T>
 void createConcreteVectorField(const Options &options);
 
-void setCommon(const FieldRes::Ptr field, const Options &options);
+//! Returns the name of the given partition, or the attribute of the given 
+//! layer. The first one keeps the base name.
+string indexedName(const string &base, const int idx);
+
+//! Sets up the fill for a given layer of the field
+Fill setupFill(const Options &options, const int layerIdx);
+
+//! Fills a dense or sparse field in parallel, a block at a time
+template <typename Data_T>
+void fillField(typename ResizableField<Data_T>::Ptr field, const Fill &fill);
+
+//! Fills a MAC field in parallel, a z slice of faces at a time
+template <typename Data_T>
+void fillMACField(typename MACField<Data_T>::Ptr field, const Fill &fill);
+
+void setCommon(const FieldRes::Ptr field, const Options &options, 
+               const int partitionIdx, const int layerIdx);
 
 //----------------------------------------------------------------------------//
 // Function implementations
@@ -102,6 +156,10 @@ int main(int argc, char **argv)
 
   Options options = parseOptions(argc, argv);
 
+  if (options.numThreads > 0) {
+    Field3D::setNumIOThreads(options.numThreads);
+  }
+
   createField(options);
 }
 
@@ -121,12 +179,20 @@ Options parseOptions(int argc, char **argv)
     ("name,n", po::value<string>(), "Field name")
     ("attribute,a", po::value<string>(), "Field attribute")
     ("type,t", po::value<string>(), "Field type (DenseField/SparseField/MACField)")
-    ("fill,f", po::value<string>(), "Fill with (full_sphere/small_sphere)")
+    ("fill,f", po::value<string>(), 
+     "Fill with (full_sphere/small_sphere/smoke/none)")
+    ("fill-ratio,r", po::value<double>(), 
+     "Fraction of voxels that smoke fills (0-1)")
     ("xres,x", po::value<int>(), "X resolution")
     ("yres,y", po::value<int>(), "Y resolution")
     ("zres,z", po::value<int>(), "Z resolution")
     ("bits,b", po::value<int>(), "Bit depth (16/32/64)")
     ("vector,v", "Whether to create a vector field")    
+    ("layers,l", po::value<int>(), "Number of layers per partition")
+    ("partitions,p", po::value<int>(), 
+     "Number of partitions, each with its own mapping")
+    ("num-threads,j", po::value<size_t>(), "Number of threads to use")
+    ("seed,s", po::value<int>(), "Random seed of the smoke fill")
     ;
   
   po::variables_map vm;
@@ -169,6 +235,15 @@ Options parseOptions(int argc, char **argv)
   {
     options.fieldType = vm["type"].as<string>();
   }
+  if (vm.count("fill"))
+  {
+    options.fill = vm["fill"].as<string>();
+  }
+  if (vm.count("fill-ratio"))
+  {
+    options.fillRatio = 
+      std::min(std::max(vm["fill-ratio"].as<double>(), 0.0), 1.0);
+  }
   if (vm.count("xres"))
   {
     options.resolution.x = vm["xres"].as<int>();
@@ -189,6 +264,22 @@ Options parseOptions(int argc, char **argv)
   {
     options.isVectorField = true;
   }
+  if (vm.count("layers"))
+  {
+    options.numLayers = std::max(vm["layers"].as<int>(), 1);
+  }
+  if (vm.count("partitions"))
+  {
+    options.numPartitions = std::max(vm["partitions"].as<int>(), 1);
+  }
+  if (vm.count("num-threads"))
+  {
+    options.numThreads = vm["num-threads"].as<size_t>();
+  }
+  if (vm.count("seed"))
+  {
+    options.seed = vm["seed"].as<int>();
+  }
 
   return options;
 }
@@ -244,63 +335,346 @@ template <typename Data_T>
 void createConcreteScalarField(const Options &options)
 {
   typedef typename ResizableField<Data_T>::Ptr Ptr;
-  Ptr field;
 
-  if (options.fieldType == "SparseField") {
-    field = Ptr(new SparseField<Data_T>);
-  } else {
-    field = Ptr(new DenseField<Data_T>);
+  Field3DOutputFile out;
+  out.create(options.filename);
+
+  for (int p = 0; p < options.numPartitions; ++p) {
+    for (int l = 0; l < options.numLayers; ++l) {
+      Ptr field;
+      if (options.fieldType == "SparseField") {
+        field = Ptr(new SparseField<Data_T>);
+      } else {
+        field = Ptr(new DenseField<Data_T>);
+      }
+
+      field->setSize(options.resolution);
+      setCommon(field, options, p, l);
+      fillField<Data_T>(field, setupFill(options, l));
+
+      out.writeScalarLayer<Data_T>(field);
+    }
   }
 
-  field->setSize(options.resolution);
-  setCommon(field, options);
+  writeGlobalMetadata(out);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void createConcreteVectorField(const Options &options)
+{
+  typedef typename ResizableField<FIELD3D_VEC3_T<Data_T> >::Ptr Ptr;
 
   Field3DOutputFile out;
   out.create(options.filename);
-  out.writeScalarLayer<Data_T>(field);
+
+  for (int p = 0; p < options.numPartitions; ++p) {
+    for (int l = 0; l < options.numLayers; ++l) {
+      typedef MACField<FIELD3D_VEC3_T<Data_T> > MAC;
+      Ptr field;
+      if (options.fieldType == "SparseField") {
+        field = Ptr(new SparseField<FIELD3D_VEC3_T<Data_T> >);
+      } else if (options.fieldType == "MACField") {
+        field = Ptr(new MAC);
+      } else {
+        field = Ptr(new DenseField<FIELD3D_VEC3_T<Data_T> >); 
+      }
+
+      field->setSize(options.resolution);  
+      setCommon(field, options, p, l);
+      if (typename MAC::Ptr mac = field_dynamic_cast<MAC>(field)) {
+        fillMACField<FIELD3D_VEC3_T<Data_T> >(mac, setupFill(options, l));
+      } else {
+        fillField<FIELD3D_VEC3_T<Data_T> >(field, setupFill(options, l));
+      }
+
+      out.writeVectorLayer<Data_T>(field);
+    }
+  }
+
   writeGlobalMetadata(out);
 }
 
 //----------------------------------------------------------------------------//
 
+string indexedName(const string &base, const int idx)
+{
+  if (idx == 0) {
+    return base;
+  }
+  return base + "_" + boost::lexical_cast<string>(idx);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Hashes a lattice point to a value in [0,1]
+double latticeValue(const int i, const int j, const int k, const int seed)
+{
+  unsigned int h = static_cast<unsigned int>(seed) * 0x9e3779b9u;
+  h ^= static_cast<unsigned int>(i) * 0x85ebca6bu;
+  h = (h << 13) | (h >> 19);
+  h ^= static_cast<unsigned int>(j) * 0xc2b2ae35u;
+  h = (h << 13) | (h >> 19);
+  h ^= static_cast<unsigned int>(k) * 0x27d4eb2fu;
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  return (h & 0xffffff) / static_cast<double>(0xffffff);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Smoothly interpolated value noise, in [0,1]
+double valueNoise(const V3d &p, const int seed)
+{
+  const V3d fl(std::floor(p.x), std::floor(p.y), std::floor(p.z));
+  const int i = static_cast<int>(fl.x);
+  const int j = static_cast<int>(fl.y);
+  const int k = static_cast<int>(fl.z);
+  V3d t = p - fl;
+  t = V3d(t.x * t.x * (3.0 - 2.0 * t.x), t.y * t.y * (3.0 - 2.0 * t.y),
+          t.z * t.z * (3.0 - 2.0 * t.z));
+  double result = 0.0;
+  for (int c = 0; c < 8; ++c) {
+    const int di = c & 1, dj = (c >> 1) & 1, dk = (c >> 2) & 1;
+    const double weight = (di ? t.x : 1.0 - t.x) * (dj ? t.y : 1.0 - t.y) * 
+      (dk ? t.z : 1.0 - t.z);
+    result += weight * latticeValue(i + di, j + dj, k + dk, seed);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Fractal sum of value noise. Billows that thin out towards the top of 
+//! the field give a smoke plume-like look.
+double smokeNoise(const V3d &lsP, const int seed)
+{
+  double result = 0.0, amplitude = 0.5, frequency = 4.0;
+  for (int octave = 0; octave < 5; ++octave) {
+    result += amplitude * valueNoise(lsP * frequency, seed + octave);
+    amplitude *= 0.5;
+    frequency *= 2.0;
+  }
+  return result * (1.25 - 0.5 * lsP.y);
+}
+
+//----------------------------------------------------------------------------//
+
+double Fill::density(const V3d &lsP) const
+{
+  switch (type) {
+  case FillFullSphere:
+  case FillSmallSphere:
+    {
+      // Ramp from 1 to 0 across one voxel at the surface
+      const double dist = (lsP - V3d(0.5)).length();
+      return std::min(std::max((radius - dist) / voxelSize + 0.5, 0.0), 1.0);
+    }
+  case FillSmoke:
+    {
+      const double n = smokeNoise(lsP, seed);
+      return n > threshold ? std::min((n - threshold) * 4.0, 1.0) : 0.0;
+    }
+  case FillNone:
+  default:
+    return 0.0;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+Fill setupFill(const Options &options, const int layerIdx)
+{
+  Fill fill;
+
+  const V3i &res = options.resolution;
+  fill.voxelSize = 1.0 / std::max(1, std::min(res.x, std::min(res.y, res.z)));
+
+  if (options.fill == "full_sphere") {
+    fill.type = Fill::FillFullSphere;
+    fill.radius = 0.5;
+  } else if (options.fill == "small_sphere") {
+    fill.type = Fill::FillSmallSphere;
+    fill.radius = 0.25;
+  } else if (options.fill == "smoke") {
+    fill.type = Fill::FillSmoke;
+    fill.seed = options.seed + 1000 * layerIdx;
+    // Pick the threshold that leaves the requested fraction of voxels 
+    // filled, judging by a set of random voxels
+    const size_t numProbes = 20000;
+    FIELD3D_RAND48 rng(fill.seed);
+    vector<double> values(numProbes);
+    BOOST_FOREACH (double &value, values) {
+      V3d lsP(rng.nextf(), rng.nextf(), rng.nextf());
+      value = smokeNoise(lsP, fill.seed);
+    }
+    std::sort(values.begin(), values.end());
+    const size_t idx = static_cast<size_t>((1.0 - options.fillRatio) * 
+                                           numProbes);
+    fill.threshold = idx < numProbes ? values[idx] : values.back() + 1.0;
+  } else if (options.fill != "none") {
+    cout << "WARNING: Unknown fill: " << options.fill 
+         << ". Leaving fields empty." << endl;
+  }
+
+  return fill;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns a voxel value given a density
 template <typename Data_T>
-void createConcreteVectorField(const Options &options)
+Data_T densityValue(const double density)
+{ return static_cast<Data_T>(density); }
+
+template <>
+V3h densityValue<V3h>(const double density)
+{ return V3h(static_cast<half>(density)); }
+
+template <>
+V3f densityValue<V3f>(const double density)
+{ return V3f(static_cast<float>(density)); }
+
+template <>
+V3d densityValue<V3d>(const double density)
+{ return V3d(density); }
+
+//----------------------------------------------------------------------------//
+
+//! Fills one tile of a dense or sparse field, as picked by Sparse::runBlockOp.
+//! Voxels with zero density are left alone, so that the blocks of sparse
+//! fields outside the fill stay unallocated. Each tile of a SparseField is 
+//! one of its blocks, so that no two threads allocate the same block.
+template <typename Data_T>
+struct FillTileOp
 {
-  typedef typename ResizableField<FIELD3D_VEC3_T<Data_T> >::Ptr Ptr;
-  Ptr field;
+  FillTileOp(ResizableField<Data_T> &field, const Fill &fill, 
+             const int tileOrder)
+    : m_field(field), m_fill(fill), m_tileOrder(tileOrder)
+  { 
+    const V3i res = field.dataResolution();
+    const int tileSize = 1 << tileOrder;
+    m_tileRes = (res + V3i(tileSize - 1)) / tileSize;
+  }
+  size_t numTiles() const
+  { return static_cast<size_t>(m_tileRes.x) * m_tileRes.y * m_tileRes.z; }
+  void operator() (const size_t idx) const
+  {
+    const Box3i &dw = m_field.dataWindow();
+    const V3i tile(idx % m_tileRes.x, (idx / m_tileRes.x) % m_tileRes.y,
+                   idx / (m_tileRes.x * m_tileRes.y));
+    const V3i size = Sparse::validBlockSize(m_field.dataResolution(), 
+                                            m_tileOrder, tile);
+    const V3i origin = dw.min + tile * (1 << m_tileOrder);
+    for (int k = origin.z; k < origin.z + size.z; ++k) {
+      for (int j = origin.y; j < origin.y + size.y; ++j) {
+        for (int i = origin.x; i < origin.x + size.x; ++i) {
+          V3d lsP;
+          m_field.mapping()->voxelToLocal(V3d(i, j, k) + V3d(0.5), lsP);
+          const double density = m_fill.density(lsP);
+          if (density > 0.0) {
+            m_field.lvalue(i, j, k) = densityValue<Data_T>(density);
+          }
+        }
+      }
+    }
+  }
+  ResizableField<Data_T> &m_field;
+  const Fill             &m_fill;
+  const int               m_tileOrder;
+  V3i                     m_tileRes;
+};
 
-  if (options.fieldType == "SparseField") {
-    field = Ptr(new SparseField<FIELD3D_VEC3_T<Data_T> >);
-  } else if (options.fieldType == "MACField") {
-    field = Ptr(new MACField<FIELD3D_VEC3_T<Data_T> >);
-  } else {
-    field = Ptr(new DenseField<FIELD3D_VEC3_T<Data_T> >); 
+//----------------------------------------------------------------------------//
+
+//! Fills a slice of the u, v and w faces of a MAC field
+template <typename Data_T>
+struct FillMACSliceOp
+{
+  FillMACSliceOp(MACField<Data_T> &field, const Fill &fill)
+    : m_field(field), m_fill(fill)
+  { }
+  void operator() (const size_t idx) const
+  {
+    const Box3i &dw = m_field.dataWindow();
+    const int k = dw.min.z + static_cast<int>(idx);
+    for (int j = dw.min.y; j <= dw.max.y + 1; ++j) {
+      for (int i = dw.min.x; i <= dw.max.x + 1; ++i) {
+        if (j <= dw.max.y && k <= dw.max.z) {
+          m_field.u(i, j, k) = faceValue(V3d(i, j + 0.5, k + 0.5));
+        }
+        if (i <= dw.max.x && k <= dw.max.z) {
+          m_field.v(i, j, k) = faceValue(V3d(i + 0.5, j, k + 0.5));
+        }
+        if (i <= dw.max.x && j <= dw.max.y) {
+          m_field.w(i, j, k) = faceValue(V3d(i + 0.5, j + 0.5, k));
+        }
+      }
+    }
+  }
+  typename MACField<Data_T>::real_t faceValue(const V3d &vsP) const
+  {
+    V3d lsP;
+    m_field.mapping()->voxelToLocal(vsP, lsP);
+    return static_cast<typename MACField<Data_T>::real_t>
+      (m_fill.density(lsP));
   }
+  MACField<Data_T> &m_field;
+  const Fill       &m_fill;
+};
 
-  field->setSize(options.resolution);  
-  setCommon(field, options);
+//----------------------------------------------------------------------------//
 
-  Field3DOutputFile out;
-  out.create(options.filename);
-  out.writeVectorLayer<Data_T>(field);
-  writeGlobalMetadata(out);
+template <typename Data_T>
+void fillField(typename ResizableField<Data_T>::Ptr field, const Fill &fill)
+{
+  if (fill.type == Fill::FillNone) {
+    return;
+  }
+
+  int tileOrder = 4;
+  if (SparseField<Data_T> *sparse = 
+      dynamic_cast<SparseField<Data_T> *>(field.get())) {
+    tileOrder = sparse->blockOrder();
+  }
+  FillTileOp<Data_T> op(*field, fill, tileOrder);
+  Sparse::runBlockOp(op, op.numTiles());
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void fillMACField(typename MACField<Data_T>::Ptr field, const Fill &fill)
+{
+  if (fill.type == Fill::FillNone) {
+    return;
+  }
+
+  const Box3i &dw = field->dataWindow();
+  Sparse::runBlockOp(FillMACSliceOp<Data_T>(*field, fill), 
+                     dw.max.z - dw.min.z + 2);
 }
 
 //----------------------------------------------------------------------------//
 
-void setCommon(const FieldRes::Ptr field, const Options &options)
+void setCommon(const FieldRes::Ptr field, const Options &options, 
+               const int partitionIdx, const int layerIdx)
 {
-  field->name = options.name;
-  field->attribute = options.attribute; 
+  field->name = indexedName(options.name, partitionIdx);
+  field->attribute = indexedName(options.attribute, layerIdx);
   field->metadata().setFloatMetadata("float_metadata", 1.0f);
   field->metadata().setVecFloatMetadata("vec_float_metadata", V3f(1.0f));
   field->metadata().setIntMetadata("int_metadata", 1);
   field->metadata().setVecIntMetadata("vec_int_metadata", V3i(1));
   field->metadata().setStrMetadata("str_metadata", "string");
 
+  // Each partition gets a mapping of its own
   M44d localToWorld;
   localToWorld.setScale(options.resolution);
-  localToWorld *= M44d().setTranslation(V3d(1.0, 2.0, 3.0));
+  localToWorld *= M44d().setTranslation(V3d(1.0, 2.0, 3.0) + 
+                                        V3d(partitionIdx * 1.5, 0.0, 0.0));
 
   MatrixFieldMapping::Ptr mapping(new MatrixFieldMapping);
   mapping->setLocalToWorld(localToWorld);
@@ -0,0 +1,167 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc.
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+#include <Field3D/InitIO.h>
+#include <Field3D/Transcode.h>
+
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+// Options struct
+//----------------------------------------------------------------------------//
+
+struct Options {
+  Options() 
+    : numThreads(0)
+  { }
+  string         inputFile;
+  string         outputFile;
+  vector<string> names;
+  vector<string> attributes;
+  size_t         numThreads;
+};
+
+//----------------------------------------------------------------------------//
+// Function prototypes
+//----------------------------------------------------------------------------//
+
+//! Parses command line options, puts them in Options struct.
+Options parseOptions(int argc, char **argv);
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv)
+{
+  Field3D::initIO();
+
+  Options options = parseOptions(argc, argv);
+
+  if (options.inputFile.empty() || options.outputFile.empty()) {
+    cout << "ERROR: Both an input and an output file are needed." << endl;
+    return 1;
+  }
+
+  // Set num threads ---
+
+  if (options.numThreads > 0) {
+    Field3D::setNumIOThreads(options.numThreads);
+  }
+
+  // Transcode ---
+
+  TranscodeOptions transcodeOptions;
+  transcodeOptions.partitions = options.names;
+  transcodeOptions.layers     = options.attributes;
+
+  cout << "Converting " << options.inputFile << " to Ogawa." << endl;
+
+  if (!transcode(options.inputFile, options.outputFile, transcodeOptions)) {
+    cout << "ERROR: Couldn't convert " << options.inputFile << " to " 
+         << options.outputFile << endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------//
+
+Options parseOptions(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+
+  po::options_description desc("Available options");
+
+  desc.add_options()
+    ("help,h", "Display help")
+    ("input-file,i", po::value<string>(), "Input file")
+    ("name,n", po::value<vector<string> >(), "Convert field(s) by name")
+    ("attribute,a", po::value<vector<string> >(), 
+     "Convert field(s) by attribute")
+    ("num-threads,t", po::value<size_t>(), "Number of threads to use")
+    ("output-file,o", po::value<string>(), "Output file")
+    ;
+  
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  if (vm.count("help")) {
+    cout << desc << endl;
+    exit(0);
+  }
+
+  if (vm.count("input-file")) {
+    options.inputFile = vm["input-file"].as<std::string>();
+  }
+  if (vm.count("num-threads")) {
+    options.numThreads = vm["num-threads"].as<size_t>();
+  }
+  if (vm.count("name")) {
+    options.names = vm["name"].as<std::vector<std::string> >();
+  }
+  if (vm.count("attribute")) {
+    options.attributes = vm["attribute"].as<std::vector<std::string> >();
+  }
+  if (vm.count("output-file")) {
+    options.outputFile = vm["output-file"].as<std::string>();
+  }
+
+  return options;
+}
+
+//----------------------------------------------------------------------------//
+
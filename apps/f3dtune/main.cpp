@@ -0,0 +1,441 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+#include <string>
+
+#include <boost/program_options.hpp>
+#include <boost/foreach.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+
+#include <Field3D/SparseField.h>
+#include <Field3D/InitIO.h>
+#include <Field3D/Field3DFile.h>
+#include <Field3D/PatternMatch.h>
+#include <Field3D/SparseTune.h>
+#include <Field3D/Transcode.h>
+
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+// Options struct
+//----------------------------------------------------------------------------//
+
+struct Options {
+  Options() 
+    : workload("rays"), numSamples(1000), numShown(5)
+  { }
+  string            inputFile;
+  string            outputFile;
+  string            traceFile;
+  vector<string>    names;
+  vector<string>    attributes;
+  string            workload;
+  size_t            numSamples;
+  size_t            numShown;
+  SparseTuneOptions tune;
+};
+
+//----------------------------------------------------------------------------//
+// Totals struct
+//----------------------------------------------------------------------------//
+
+//! Identifies a candidate setting by block order, codec and level
+typedef boost::tuple<int, int, int> CandidateKey;
+
+//! Results of each candidate, summed over all tuned fields
+typedef std::map<CandidateKey, SparseTuneResult> Totals;
+
+//----------------------------------------------------------------------------//
+// Function prototypes
+//----------------------------------------------------------------------------//
+
+//! Parses command line options, puts them in Options struct.
+Options parseOptions(int argc, char **argv);
+
+//! Reads a trace file with one "i j k" voxel per line
+bool readTrace(const string &filename, vector<V3i> &trace);
+
+//! Tunes the sparse fields of a file and sums the results into totals
+bool tuneFile(const Options &options, const vector<V3i> &trace, 
+              Totals &totals);
+
+//! Prints a table of results
+void printResults(const vector<SparseTuneResult> &results, 
+                  const size_t numShown);
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv)
+{
+  Field3D::initIO();
+
+  Options options = parseOptions(argc, argv);
+
+  if (options.inputFile.empty()) {
+    cout << "ERROR: No input file given." << endl;
+    return 1;
+  }
+
+  vector<V3i> trace;
+  if (!options.traceFile.empty() && !readTrace(options.traceFile, trace)) {
+    cout << "ERROR: Couldn't read trace " << options.traceFile << endl;
+    return 1;
+  }
+
+  // Tune ---
+
+  Totals totals;
+  if (!tuneFile(options, trace, totals)) {
+    cout << "ERROR: Couldn't read " << options.inputFile << endl;
+    return 1;
+  }
+  if (totals.empty()) {
+    cout << "No sparse fields to tune" << endl;
+    return 0;
+  }
+
+  vector<SparseTuneResult> results;
+  BOOST_FOREACH (const Totals::value_type &total, totals) {
+    results.push_back(total.second);
+  }
+  scoreSparseTuning(results, options.tune.sizeWeight);
+
+  cout << "All fields:" << endl;
+  printResults(results, options.numShown);
+
+  // Apply ---
+
+  if (options.outputFile.empty()) {
+    return 0;
+  }
+
+  const SparseTuneResult &best = results.front();
+  Field3D::setSparseStorageMode(SparseStorageCompressed);
+  applySparseTuning(best);
+
+  TranscodeOptions transcodeOptions;
+  transcodeOptions.partitions = options.names;
+  transcodeOptions.layers     = options.attributes;
+  transcodeOptions.blockOrder = best.blockOrder;
+
+  cout << "Writing " << options.outputFile << endl;
+
+  if (!transcode(options.inputFile, options.outputFile, transcodeOptions)) {
+    cout << "ERROR: Couldn't write " << options.outputFile << endl;
+    std::remove(options.outputFile.c_str());
+    return 1;
+  }
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------//
+
+Options parseOptions(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+
+  po::options_description desc("Available options");
+
+  desc.add_options()
+    ("help,h", "Display help")
+    ("input-file,i", po::value<string>(), "Input file")
+    ("output-file,o", po::value<string>(), 
+     "Output file. If given, the input is written to it with the best "
+     "setting for all tuned fields.")
+    ("name,n", po::value<vector<string> >(), "Tune field(s) by name")
+    ("attribute,a", po::value<vector<string> >(), 
+     "Tune field(s) by attribute")
+    ("trace,t", po::value<string>(), 
+     "Access trace, one \"i j k\" voxel per line. Replaces the workload.")
+    ("workload,w", po::value<string>(), 
+     "Synthetic access pattern (rays/points/all). Default is rays.")
+    ("samples,s", po::value<size_t>(), 
+     "Number of rays or points in the workload. Default is 1000.")
+    ("block-order,b", po::value<vector<int> >(), 
+     "Block order(s) to try. Default is 3, 4 and 5.")
+    ("codec,c", po::value<vector<string> >(), 
+     "Codec(s) to try (zlib/shuffle_zlib). Default is both.")
+    ("level,l", po::value<vector<int> >(), 
+     "zlib compression level(s) to try (1-9). Default is 1 and 6.")
+    ("size-weight,z", po::value<double>(), 
+     "How much file size counts against sampling cost (0-1). "
+     "Default is 0.5.")
+    ("show", po::value<size_t>(), 
+     "Number of candidates to print per field. Default is 5.")
+    ;
+  
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  if (vm.count("help")) {
+    cout << desc << endl;
+    exit(0);
+  }
+
+  if (vm.count("input-file")) {
+    options.inputFile = vm["input-file"].as<std::string>();
+  }
+  if (vm.count("output-file")) {
+    options.outputFile = vm["output-file"].as<std::string>();
+  }
+  if (vm.count("name")) {
+    options.names = vm["name"].as<std::vector<std::string> >();
+  }
+  if (vm.count("attribute")) {
+    options.attributes = vm["attribute"].as<std::vector<std::string> >();
+  }
+  if (vm.count("trace")) {
+    options.traceFile = vm["trace"].as<std::string>();
+  }
+  if (vm.count("workload")) {
+    options.workload = vm["workload"].as<std::string>();
+    if (options.workload != "rays" && options.workload != "points" && 
+        options.workload != "all") {
+      cerr << "Unknown workload: " << options.workload << endl;
+      exit(1);
+    }
+  }
+  if (vm.count("samples")) {
+    options.numSamples = vm["samples"].as<size_t>();
+  }
+  if (vm.count("block-order")) {
+    options.tune.blockOrders = vm["block-order"].as<std::vector<int> >();
+  }
+  if (vm.count("codec")) {
+    options.tune.codecs.clear();
+    BOOST_FOREACH (const string &codec, 
+                   vm["codec"].as<std::vector<std::string> >()) {
+      if (codec == "zlib") {
+        options.tune.codecs.push_back(SparseCodecZlib);
+      } else if (codec == "shuffle_zlib") {
+        options.tune.codecs.push_back(SparseCodecShuffleZlib);
+      } else {
+        cerr << "Unknown codec: " << codec << endl;
+        exit(1);
+      }
+    }
+  }
+  if (vm.count("level")) {
+    options.tune.levels = vm["level"].as<std::vector<int> >();
+  }
+  if (vm.count("size-weight")) {
+    options.tune.sizeWeight = vm["size-weight"].as<double>();
+  }
+  if (vm.count("show")) {
+    options.numShown = vm["show"].as<size_t>();
+  }
+
+  return options;
+}
+
+//----------------------------------------------------------------------------//
+
+bool readTrace(const string &filename, vector<V3i> &trace)
+{
+  std::ifstream in(filename.c_str());
+  if (!in) {
+    return false;
+  }
+  V3i voxel;
+  while (in >> voxel.x >> voxel.y >> voxel.z) {
+    trace.push_back(voxel);
+  }
+  return in.eof();
+}
+
+//----------------------------------------------------------------------------//
+
+void printResults(const vector<SparseTuneResult> &results, 
+                  const size_t numShown)
+{
+  cout << "  order  codec         level  blocks  touched        MB"
+       << "   decode MB/s  sample ms   score" << endl;
+  for (size_t i = 0; i < std::min(numShown, results.size()); ++i) {
+    const SparseTuneResult &r = results[i];
+    cout << "  " << setw(5) << r.blockOrder << "  " << left << setw(12) 
+         << (r.codec == SparseCodecShuffleZlib ? "shuffle_zlib" : "zlib") 
+         << right << setw(7) << r.level 
+         << setw(8) << r.numBlocks << setw(9) << r.numTouchedBlocks 
+         << fixed << setprecision(3)
+         << setw(10) << r.fileBytes / (1024.0 * 1024.0)
+         << setw(14) << r.decodeBytesPerSecond / (1024.0 * 1024.0)
+         << setw(11) << r.sampleSeconds * 1000.0
+         << setw(8) << r.score << endl;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Adds a field's results to the totals. Decode speeds are averaged, 
+//! weighted by the number of blocks.
+void addToTotals(const vector<SparseTuneResult> &results, Totals &totals)
+{
+  BOOST_FOREACH (const SparseTuneResult &r, results) {
+    SparseTuneResult &total = 
+      totals[CandidateKey(r.blockOrder, r.codec, r.level)];
+    total.blockOrder = r.blockOrder;
+    total.codec      = r.codec;
+    total.level      = r.level;
+    const size_t numBlocks = total.numBlocks + r.numBlocks;
+    if (numBlocks > 0) {
+      total.decodeBytesPerSecond = 
+        (total.decodeBytesPerSecond * total.numBlocks + 
+         r.decodeBytesPerSecond * r.numBlocks) / numBlocks;
+    }
+    total.numBlocks         = numBlocks;
+    total.numTouchedBlocks += r.numTouchedBlocks;
+    total.fileBytes        += r.fileBytes;
+    total.sampleSeconds    += r.sampleSeconds;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Tunes the SparseFields of a list
+template <typename Data_T>
+void tuneFields(const typename Field<Data_T>::Vec &fields, 
+                const string &key, const Options &options, 
+                const vector<V3i> &fileTrace, Totals &totals)
+{
+  BOOST_FOREACH (const typename Field<Data_T>::Ptr &field, fields) {
+    typename SparseField<Data_T>::Ptr sparse = 
+      field_dynamic_cast<SparseField<Data_T> >(field);
+    if (!sparse) {
+      continue;
+    }
+    vector<V3i> trace = fileTrace;
+    if (options.traceFile.empty()) {
+      const Box3i &dw = sparse->dataWindow();
+      if (options.workload == "rays") {
+        trace = makeRayTrace(dw, options.numSamples);
+      } else if (options.workload == "points") {
+        trace = makePointTrace(dw, options.numSamples);
+      }
+    }
+    const vector<SparseTuneResult> results = 
+      tuneSparseField(*sparse, trace, options.tune);
+    cout << key << " (block order " << sparse->blockOrder() << "):" << endl;
+    printResults(results, options.numShown);
+    addToTotals(results, totals);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads a layer, if it holds the given data type, and tunes its fields
+template <typename T>
+void tuneLayer(const Field3DInputFile &in, const string &partition,
+               const string &layer, const bool isVector, 
+               const Options &options, const vector<V3i> &trace, 
+               Totals &totals)
+{
+  const string key = partition + ":" + layer;
+  if (isVector) {
+    tuneFields<FIELD3D_VEC3_T<T> >(in.readVectorLayers<T>(partition, layer),
+                                   key, options, trace, totals);
+  } else {
+    tuneFields<T>(in.readScalarLayers<T>(partition, layer), 
+                  key, options, trace, totals);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool tuneFile(const Options &options, const vector<V3i> &trace, 
+              Totals &totals)
+{
+  Field3DInputFile in;
+  if (!in.open(options.inputFile)) {
+    return false;
+  }
+
+  // Parse the patterns once for all partitions and layers
+  const MatchPattern namePattern(options.names);
+  const MatchPattern attributePattern(options.attributes);
+
+  std::vector<std::string> partitions;
+  in.getPartitionNames(partitions);
+
+  BOOST_FOREACH (const string &partition, partitions) {
+    if (!namePattern.match(partition)) {
+      continue;
+    }
+    std::vector<std::string> scalarLayers, vectorLayers;
+    in.getScalarLayerNames(scalarLayers, partition);
+    in.getVectorLayerNames(vectorLayers, partition);
+    BOOST_FOREACH (const string &layer, scalarLayers) {
+      if (attributePattern.match(layer)) {
+        tuneLayer<half>(in, partition, layer, false, options, trace, totals);
+        tuneLayer<float>(in, partition, layer, false, options, trace, totals);
+        tuneLayer<double>(in, partition, layer, false, options, trace, 
+                          totals);
+      }
+    }
+    BOOST_FOREACH (const string &layer, vectorLayers) {
+      if (attributePattern.match(layer)) {
+        tuneLayer<half>(in, partition, layer, true, options, trace, totals);
+        tuneLayer<float>(in, partition, layer, true, options, trace, totals);
+        tuneLayer<double>(in, partition, layer, true, options, trace, totals);
+      }
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
@@ -23,9 +23,13 @@ INCLUDES	= -I. -I.. -I$(MAYA_LOCATION)/include \
 
 LD	 = $(C++) -shared $(NO_TRANS_LINK) $(C++FLAGS)
 
+#edit this if your boost libraries use another naming scheme
+BOOST_LIBS = -lboost_thread -lboost_system
+
 # add more libs if you need to for your plugin
 LIBS	 = -L$(MAYA_LOCATION)/lib -lOpenMaya\
-				 -Wl,-rpath,$(FIELD3D_LIB) -L$(FIELD3D_LIB) -lField3D
+				 -Wl,-rpath,$(FIELD3D_LIB) -L$(FIELD3D_LIB) -lField3D\
+				 $(BOOST_LIBS)
 
 
 exportF3d.so:	exportF3d.o
@@ -68,7 +68,10 @@
 #include <iostream>
 #include <fstream>
 
-#include <Field3D/DenseField.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <Field3D/SparseField.h>
 #include <Field3D/MACField.h>
 #include <Field3D/Field3DFile.h>
 #include <Field3D/InitIO.h>
@@ -90,6 +93,127 @@
 using namespace std;
 using namespace Field3D;
 
+//----------------------------------------------------------------------------//
+
+//! Offsets between neighboring voxels in the fluid's buffers, as given by
+//! MFnFluid::index(). Computed once, so that the copies don't call into 
+//! Maya from other threads.
+struct FluidLayout
+{
+  FluidLayout(MFnFluid &fluidFn, const V3i &res)
+  {
+    origin = fluidFn.index(0, 0, 0);
+    stride.x = res.x > 1 ? fluidFn.index(1, 0, 0) - origin : 0;
+    stride.y = res.y > 1 ? fluidFn.index(0, 1, 0) - origin : 0;
+    stride.z = res.z > 1 ? fluidFn.index(0, 0, 1) - origin : 0;
+  }
+  size_t index(int i, int j, int k) const
+  { return origin + i * stride.x + j * stride.y + k * stride.z; }
+  int origin;
+  V3i stride;
+};
+
+//----------------------------------------------------------------------------//
+
+//! A fluid channel and the field it is copied to. Vector channels use all
+//! three pointers, scalar ones only the first
+struct FluidChannel
+{
+  FluidChannel(const float *x, SparseFieldf::Ptr f)
+    : field(f) 
+  { data[0] = x; data[1] = data[2] = NULL; }
+  FluidChannel(const float *x, const float *y, const float *z, 
+               SparseField3f::Ptr f)
+    : vecField(f)
+  { data[0] = x; data[1] = y; data[2] = z; }
+  const float *data[3];
+  SparseFieldf::Ptr field;
+  SparseField3f::Ptr vecField;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Copies one block of one channel from the fluid buffers into its 
+//! SparseField, as picked by Sparse::runBlockOp. Voxels that are zero are 
+//! skipped, so empty blocks are never allocated. Each block is only touched
+//! by one thread.
+struct CopyChannelBlockOp
+{
+  CopyChannelBlockOp(const vector<FluidChannel> &channels, 
+                     const FluidLayout &layout, const V3i &blockRes, 
+                     const int blockOrder, const V3i &res)
+    : m_channels(channels), m_layout(layout), m_blockRes(blockRes), 
+      m_blockOrder(blockOrder), m_res(res)
+  { }
+  size_t numBlocks() const
+  { return static_cast<size_t>(m_blockRes.x) * m_blockRes.y * m_blockRes.z; }
+  void operator() (const size_t idx) const
+  {
+    const FluidChannel &channel = m_channels[idx / numBlocks()];
+    const size_t b = idx % numBlocks();
+    const V3i block(b % m_blockRes.x, (b / m_blockRes.x) % m_blockRes.y,
+                    b / (m_blockRes.x * m_blockRes.y));
+    const V3i size = Sparse::validBlockSize(m_res, m_blockOrder, block);
+    const V3i origin = block * (1 << m_blockOrder);
+    for (int k = origin.z; k < origin.z + size.z; ++k) {
+      for (int j = origin.y; j < origin.y + size.y; ++j) {
+        for (int i = origin.x; i < origin.x + size.x; ++i) {
+          const size_t f = m_layout.index(i, j, k);
+          if (channel.field) {
+            const float value = channel.data[0][f];
+            if (value != 0.0f) {
+              channel.field->fastLValue(i, j, k) = value;
+            }
+          } else {
+            const V3f value(channel.data[0][f], channel.data[1][f], 
+                            channel.data[2][f]);
+            if (value != V3f(0.0f)) {
+              channel.vecField->fastLValue(i, j, k) = value;
+            }
+          }
+        }
+      }
+    }
+  }
+  const vector<FluidChannel> &m_channels;
+  const FluidLayout          &m_layout;
+  const V3i                   m_blockRes;
+  const int                   m_blockOrder;
+  const V3i                   m_res;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Copies one z slice of the face velocities into a MACField. The Maya 
+//! buffers are ordered x fastest, with one extra face along their own axis
+struct CopyVelocitySliceOp
+{
+  CopyVelocitySliceOp(const float *xVel, const float *yVel, const float *zVel,
+                      MACField3f &mac, const V3i &res)
+    : m_xVel(xVel), m_yVel(yVel), m_zVel(zVel), m_mac(mac), m_res(res)
+  { }
+  void operator() (const size_t idx) const
+  {
+    const int z = static_cast<int>(idx);
+    for (int y = 0; y <= m_res.y; ++y) {
+      for (int x = 0; x <= m_res.x; ++x) {
+        if (z < m_res.z && y < m_res.y) {
+          m_mac.u(x, y, z) = m_xVel[(z * m_res.y + y) * (m_res.x + 1) + x];
+        }
+        if (z < m_res.z && x < m_res.x) {
+          m_mac.v(x, y, z) = m_yVel[(z * (m_res.y + 1) + y) * m_res.x + x];
+        }
+        if (y < m_res.y && x < m_res.x) {
+          m_mac.w(x, y, z) = m_zVel[(z * m_res.y + y) * m_res.x + x];
+        }
+      }
+    }
+  }
+  const float *m_xVel, *m_yVel, *m_zVel;
+  MACField3f  &m_mac;
+  const V3i    m_res;
+};
+
 
 //----------------------------------------------------------------------------//
 
@@ -111,6 +235,10 @@ public:
 
 private:
   void setF3dField(MFnFluid &fluidFn, const char *outputPath, const MDagPath &dagPath);
+
+  //! Waits for the layers of the previous frame to be written, and closes
+  //! its file
+  void finishPendingWrite();
     
 
 private:
@@ -131,6 +259,12 @@ private:
   bool           m_texture; //<- export texture as well
   bool           m_falloff; //<- export falloff as well
   int            m_numOversample; //<- oversamples the fluids but only writes out on whole frames
+  int            m_numThreads; //<- threads used to copy and compress the fields
+
+  //! File of the previous frame, still being written in the background 
+  //! while the next frame is simulated
+  boost::shared_ptr<Field3DOutputFile> m_pendingOut;
+  MString        m_pendingPath;
 };
 
 //----------------------------------------------------------------------------//
@@ -149,6 +283,7 @@ exportF3d::exportF3d()
   m_texture = false;
   m_falloff = false;
   m_numOversample = 1;
+  m_numThreads = 0;
 }
 
 //----------------------------------------------------------------------------//
@@ -166,6 +301,7 @@ MSyntax exportF3d::newSyntax()
     stat = syntax.addFlag("-at", "-addTexture",MSyntax::kNoArg);ERRCHK; 
     stat = syntax.addFlag("-af", "-addFalloff",MSyntax::kNoArg);ERRCHK;
     stat = syntax.addFlag("-ns", "-numOversample",MSyntax::kLong);ERRCHK; 
+    stat = syntax.addFlag("-nt", "-numThreads",MSyntax::kLong);ERRCHK; 
     
     stat = syntax.addFlag("-d", "-debug");ERRCHK; 
     syntax.addFlag("-h", "-help");
@@ -209,6 +345,8 @@ MStatus exportF3d::parseArgs( const MArgList &args )
       "    -af    -addFalloff        Export falloff\n"
       "    -ns    -numOversample     Oversamples the solver at each sum frame but\n"
       "                              only writes out whole frame sim data\n"
+      "    -nt    -numThreads   int  Threads used to copy and compress the\n"
+      "                              fields. Defaults to the number of cores\n"
       "    -d     -debug\n"
       "    -h     -help\n"
       "Example:\n"
@@ -261,6 +399,11 @@ MStatus exportF3d::parseArgs( const MArgList &args )
     }
   }
 
+  if (argData.isFlagSet("-numThreads"))
+  {
+    status = argData.getFlagArgument("-numThreads", 0, m_numThreads);
+  }
+
   status = argData.getObjects(m_slist);
   if (!status)
   {
@@ -291,6 +434,10 @@ MStatus exportF3d::doIt(const MArgList& args)
   
   float currentFrame = MAnimControl::currentTime().value();
 
+  const size_t numThreads = m_numThreads > 0 ? m_numThreads : 
+    std::max(boost::thread::hardware_concurrency(), 1u);
+  Field3D::setNumIOThreads(numThreads);
+
   MItSelectionList selListIter(m_slist, MFn::kFluid, &status);  
   for (; !selListIter.isDone(); selListIter.next())
   {
@@ -388,6 +535,7 @@ MStatus exportF3d::doIt(const MArgList& args)
    
     }
 
+    finishPendingWrite();
     computation.endComputation();	
     // only one fluid object 
     break;
@@ -401,6 +549,20 @@ MStatus exportF3d::doIt(const MArgList& args)
 
 
 
+/////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////
+
+void exportF3d::finishPendingWrite()
+{
+  if (!m_pendingOut) {
+    return;
+  }
+  if (!m_pendingOut->close()) {
+    MGlobal::displayError("Couldn't write file: " + m_pendingPath);
+  }
+  m_pendingOut.reset();
+}
+
 /////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////
 
@@ -412,7 +574,7 @@ void exportF3d::setF3dField(MFnFluid &fluidFn, const char *outputPath,
       
     MStatus stat;
 
-    unsigned int i, xres = 0, yres = 0, zres = 0;
+    unsigned int xres = 0, yres = 0, zres = 0;
     double xdim,ydim,zdim;
     // Get the resolution of the fluid container      
     stat = fluidFn.getResolution(xres, yres, zres);
@@ -501,8 +663,8 @@ void exportF3d::setF3dField(MFnFluid &fluidFn, const char *outputPath,
     }
             
     /// Fields 
-    DenseFieldf::Ptr densityFld, tempFld, fuelFld, pressureFld, falloffFld;
-    DenseField3f::Ptr CdFld, uvwFld;
+    SparseFieldf::Ptr densityFld, tempFld, fuelFld, pressureFld, falloffFld;
+    SparseField3f::Ptr CdFld, uvwFld;
     MACField3f::Ptr vMac;
 
     MPlug autoResizePlug = fluidFn.findPlug("autoResize", &stat); 
@@ -535,27 +697,27 @@ void exportF3d::setF3dField(MFnFluid &fluidFn, const char *outputPath,
     mapping->setLocalToWorld(localToWorld);  
       
     if (m_density){
-      densityFld = new DenseFieldf;
+      densityFld = new SparseFieldf;
       densityFld->setSize(res);
       densityFld->setMapping(mapping);
     }
     if (m_fuel){
-      fuelFld = new DenseFieldf;
+      fuelFld = new SparseFieldf;
       fuelFld->setSize(res); 
       fuelFld->setMapping(mapping);
     }
     if (m_temperature){
-      tempFld = new DenseFieldf;
+      tempFld = new SparseFieldf;
       tempFld->setSize(res);
       tempFld->setMapping(mapping);
     }
     if (m_pressure){
-      pressureFld = new DenseFieldf;
+      pressureFld = new SparseFieldf;
       pressureFld->setSize(res);
       pressureFld->setMapping(mapping);
     }
     if (m_falloff){
-      falloffFld = new DenseFieldf;
+      falloffFld = new SparseFieldf;
       falloffFld->setSize(res);
       falloffFld->setMapping(mapping);
     }
@@ -565,66 +727,59 @@ void exportF3d::setF3dField(MFnFluid &fluidFn, const char *outputPath,
       vMac->setMapping(mapping);
     } 
     if (m_color){
-      CdFld = new DenseField3f;
+      CdFld = new SparseField3f;
       CdFld->setSize(res);
       CdFld->setMapping(mapping);
     } 
     if (m_texture){
-      uvwFld = new DenseField3f;
+      uvwFld = new SparseField3f;
       uvwFld->setSize(res);
       uvwFld->setMapping(mapping);
     } 
         
-    size_t iX, iY, iZ;      
-    for( iZ = 0; iZ < zres; iZ++ ) 
-    {
-      for( iX = 0; iX < xres; iX++ )
-      {
-        for( iY = 0; iY < yres ; iY++ ) 
-        {
-    
-          /// data is in x major but we are writting in z major order
-          i = fluidFn.index( iX, iY,  iZ);
-            
-          if ( m_density ) 
-            densityFld->lvalue(iX, iY, iZ) = density[i];            
-          if ( m_temperature ) 
-            tempFld->lvalue(iX, iY, iZ) = temp[i];
-          if ( m_fuel )   
-            fuelFld->lvalue(iX, iY, iZ) = fuel[i];
-          if ( m_pressure )   
-            pressureFld->lvalue(iX, iY, iZ) = pressure[i];
-          if ( m_falloff )   
-            falloffFld->lvalue(iX, iY, iZ) = falloff[i];
-          if (m_color)
-            CdFld->lvalue(iX, iY, iZ) = V3f(r[i], g[i], b[i]);
-          if (m_texture)
-            uvwFld->lvalue(iX, iY, iZ) = V3f(u[i], v[i], w[i]);
-        }
-      }      
+    /// Copy the blocks of all channels in parallel, straight from the 
+    /// fluid buffers. All sparse fields share the same block layout
+    vector<FluidChannel> channels;
+    if (m_density) 
+      channels.push_back(FluidChannel(density, densityFld));
+    if (m_temperature) 
+      channels.push_back(FluidChannel(temp, tempFld));
+    if (m_fuel) 
+      channels.push_back(FluidChannel(fuel, fuelFld));
+    if (m_pressure) 
+      channels.push_back(FluidChannel(pressure, pressureFld));
+    if (m_falloff) 
+      channels.push_back(FluidChannel(falloff, falloffFld));
+    if (m_color) 
+      channels.push_back(FluidChannel(r, g, b, CdFld));
+    if (m_texture) 
+      channels.push_back(FluidChannel(u, v, w, uvwFld));
+
+    if (!channels.empty()) {
+      const FluidLayout layout(fluidFn, res);
+      const int blockOrder = channels[0].field ? 
+        channels[0].field->blockOrder() : channels[0].vecField->blockOrder();
+      const V3i blockRes = channels[0].field ? 
+        channels[0].field->blockRes() : channels[0].vecField->blockRes();
+      CopyChannelBlockOp op(channels, layout, blockRes, blockOrder, res);
+      Sparse::runBlockOp(op, op.numBlocks() * channels.size());
     }
-
       
     if (m_vel) {
-      unsigned x,y,z;
-      for(z=0;z<zres;++z) for(y=0;y<yres;++y) for(x=0;x<xres+1;++x) {
-            vMac->u(x,y,z) = *Xvel++;
-          }
-        
-      for(z=0;z<zres;++z) for(y=0;y<yres+1;++y) for(x=0;x<xres;++x) {
-            vMac->v(x,y,z) = *Yvel++;
-          }
-        
-      for(z=0;z<zres+1;++z) for(y=0;y<yres;++y) for(x=0;x<xres;++x) {
-            vMac->w(x,y,z) = *Zvel++;
-          }                        
+      Sparse::runBlockOp(CopyVelocitySliceOp(Xvel, Yvel, Zvel, *vMac, res), 
+                         zres + 1);
     } 
-     
-    Field3DOutputFile out;
+
+    /// Layers are compressed and written on a background thread while the
+    /// next frame is simulated. The previous frame's file is closed once 
+    /// this frame's layers have been handed over
+    boost::shared_ptr<Field3DOutputFile> outPtr(new Field3DOutputFile);
+    Field3DOutputFile &out = *outPtr;
     if (!out.create(outputPath)) {
       MGlobal::displayError("Couldn't create file: "+ MString(outputPath));
       return;
     }
+    out.setBackgroundWrites(true);
 
     string fieldname("maya");
 
@@ -643,7 +798,9 @@ void exportF3d::setF3dField(MFnFluid &fluidFn, const char *outputPath,
     if (m_vel)
       out.writeVectorLayer<float>(fieldname,"v_mac", vMac);      
 
-    out.close(); 
+    finishPendingWrite();
+    m_pendingOut = outPtr;
+    m_pendingPath = outputPath;
 
   }
   catch(const std::exception &e)
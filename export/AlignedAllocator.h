@@ -0,0 +1,183 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file AlignedAllocator.h
+  \brief Contains the AlignedAllocator class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_AlignedAllocator_H_
+#define _INCLUDED_Field3D_AlignedAllocator_H_
+
+//----------------------------------------------------------------------------//
+
+#include <cstddef>
+#include <limits>
+#include <new>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Field storage allocation
+//----------------------------------------------------------------------------//
+
+//! Size of the huge pages that field storage uses when hugePages() is on
+const size_t k_hugePageBytes = 2 << 20;
+
+//! Allocates bytes of field storage, aligned to alignment bytes. When
+//! hugePages() is on, allocations of at least k_hugePageBytes are aligned
+//! to a huge page and advised to use transparent huge pages.
+//! \returns NULL on failure
+FIELD3D_API void* allocFieldStorage(const size_t bytes,
+                                    const size_t alignment);
+
+//! Frees storage returned by allocFieldStorage()
+FIELD3D_API void freeFieldStorage(void *p);
+
+//----------------------------------------------------------------------------//
+// AlignedAllocator
+//----------------------------------------------------------------------------//
+
+/*! \class AlignedAllocator
+  \brief Standard allocator that aligns its memory to Alignment bytes.
+  Alignment must be a power of two and a multiple of sizeof(void*).
+
+  Used by DenseField, so that its first voxel starts on a cache line and on
+  the boundary expected by aligned SIMD loads. Memory comes from
+  allocFieldStorage(), so large arrays use huge pages if enabled.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef T              value_type;
+  typedef T*             pointer;
+  typedef const T*       const_pointer;
+  typedef T&             reference;
+  typedef const T&       const_reference;
+  typedef size_t         size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  template <class U>
+  struct rebind
+  {
+    typedef AlignedAllocator<U, Alignment> other;
+  };
+
+  // Constants -----------------------------------------------------------------
+
+  static const size_t alignment = Alignment;
+
+  // Constructors --------------------------------------------------------------
+
+  AlignedAllocator()
+  { }
+  AlignedAllocator(const AlignedAllocator &)
+  { }
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment> &)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  pointer address(reference x) const
+  { return &x; }
+  const_pointer address(const_reference x) const
+  { return &x; }
+
+  //! Allocates room for n elements. Throws std::bad_alloc on failure.
+  pointer allocate(size_type n, const void * = 0)
+  {
+    if (n == 0) {
+      return NULL;
+    }
+    if (n > max_size()) {
+      throw std::bad_alloc();
+    }
+    void *p = allocFieldStorage(n * sizeof(T), Alignment);
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return static_cast<pointer>(p);
+  }
+
+  void deallocate(pointer p, size_type)
+  {
+    freeFieldStorage(p);
+  }
+
+  size_type max_size() const
+  { return std::numeric_limits<size_type>::max() / sizeof(T); }
+
+  void construct(pointer p, const T &value)
+  { new (static_cast<void*>(p)) T(value); }
+  void destroy(pointer p)
+  { p->~T(); }
+
+};
+
+//----------------------------------------------------------------------------//
+
+//! All AlignedAllocators with the same alignment share one heap
+template <class T, class U, size_t Alignment>
+bool operator == (const AlignedAllocator<T, Alignment> &,
+                  const AlignedAllocator<U, Alignment> &)
+{ return true; }
+
+template <class T, class U, size_t Alignment>
+bool operator != (const AlignedAllocator<T, Alignment> &,
+                  const AlignedAllocator<U, Alignment> &)
+{ return false; }
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
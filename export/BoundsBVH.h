@@ -0,0 +1,153 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BoundsBVH.h
+  \brief Contains the BoundsBVH class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_BoundsBVH_H_
+#define _INCLUDED_Field3D_BoundsBVH_H_
+
+#include <vector>
+
+#include "Types.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// BoundsBVH
+//----------------------------------------------------------------------------//
+
+/*! \class BoundsBVH
+  \brief A bounding volume hierarchy over a set of boxes, answering which
+  of them contain a point or are crossed by a ray.
+
+  Used by FieldGroup to find the fields near a lookup without visiting
+  every one of them. The boxes are split at the median of their centers
+  along the widest axis until at most k_maxLeafSize remain in a node.
+
+  Queries are conservative, with the boxes padded slightly, so that 
+  callers can run their exact tests on the hits only.
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API BoundsBVH
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef std::vector<size_t> IndexVec;
+
+  // Constants -----------------------------------------------------------------
+
+  //! Largest number of boxes in a leaf
+  static const size_t k_maxLeafSize = 4;
+
+  // Ctors ---------------------------------------------------------------------
+
+  BoundsBVH()
+    : m_numBoxes(0)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Builds the hierarchy over the given boxes, replacing any previous 
+  //! one. Empty boxes are never hit.
+  void build(const std::vector<Box3d> &bounds);
+
+  //! Removes all boxes
+  void clear();
+
+  //! Number of boxes the hierarchy was built over
+  size_t size() const
+  { return m_numBoxes; }
+
+  //! Sets hits to the indices of the boxes that contain wsP, in 
+  //! increasing order
+  void findPoint(const V3d &wsP, IndexVec &hits) const;
+
+  //! Sets hits to the indices of the boxes that the ray passes through at 
+  //! or after its origin, in increasing order
+  void findRay(const Ray3d &wsRay, IndexVec &hits) const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! A node is a leaf if count is non-zero, in which case its boxes are
+  //! m_indices[first, first + count). Otherwise its children are nodes 
+  //! first and first + 1.
+  struct Node
+  {
+    Box3d  bounds;
+    size_t first;
+    size_t count;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Builds the node over m_indices[first, first + count)
+  void buildNode(const size_t node, const size_t first, const size_t count,
+                 const std::vector<Box3d> &bounds, 
+                 const std::vector<V3d> &centers);
+
+  // Data members --------------------------------------------------------------
+
+  std::vector<Node>  m_nodes;
+  //! Box indices, grouped by leaf
+  IndexVec           m_indices;
+  //! Padded bounds of each box
+  std::vector<Box3d> m_bounds;
+  size_t             m_numBoxes;
+
+};
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -44,9 +44,12 @@
 #ifndef _INCLUDED_Field3D_ClassFactory_H_
 #define _INCLUDED_Field3D_ClassFactory_H_
 
-#include <map>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
 #include "Field.h"
 #include "FieldIO.h"
 #include "FieldMappingIO.h"
@@ -103,6 +106,13 @@ public:
   //! Instances an IO object by name
   FieldIO::Ptr createFieldIO(const std::string &className) const;
 
+  //! Returns the IO object of the given class that is kept by the factory, 
+  //! rather than creating a new one. Readers and writers use this, since 
+  //! it avoids an allocation per layer.
+  //! \note The instance is shared by all files and threads, so FieldIO
+  //! classes must not keep state between calls.
+  FieldIO::Ptr sharedFieldIO(const std::string &className) const;
+
   //! }
 
   //! \name FieldMapping class 
@@ -122,6 +132,11 @@ public:
   //! Instances an IO object by name
   FieldMappingIO::Ptr createFieldMappingIO(const std::string &className) const;
 
+  //! Returns the IO object of the given class that is kept by the factory. 
+  //! Same rules as sharedFieldIO().
+  FieldMappingIO::Ptr 
+  sharedFieldMappingIO(const std::string &className) const;
+
   //! }
 
   //! Access point for the singleton instance.
@@ -131,11 +146,33 @@ private:
       
   // Typedefs ------------------------------------------------------------------
 
+  // Lookups happen for every layer read or written, so the registries are 
+  // hashed rather than sorted.
+
   typedef std::vector<std::string> NameVec;
-  typedef std::map<std::string, CreateFieldFnPtr> FieldFuncMap;
-  typedef std::map<std::string, CreateFieldIOFnPtr> FieldIOFuncMap;
-  typedef std::map<std::string, CreateFieldMappingFnPtr> FieldMappingFuncMap;
-  typedef std::map<std::string, CreateFieldMappingIOFnPtr> FieldMappingIOFuncMap;
+  typedef boost::unordered_map<std::string, CreateFieldFnPtr> FieldFuncMap;
+  typedef boost::unordered_map<std::string, CreateFieldIOFnPtr> 
+  FieldIOFuncMap;
+  typedef boost::unordered_map<std::string, CreateFieldMappingFnPtr> 
+  FieldMappingFuncMap;
+  typedef boost::unordered_map<std::string, CreateFieldMappingIOFnPtr> 
+  FieldMappingIOFuncMap;
+  typedef boost::unordered_map<std::string, FieldIO::Ptr> FieldIOMap;
+  typedef boost::unordered_map<std::string, FieldMappingIO::Ptr> 
+  FieldMappingIOMap;
+
+  typedef boost::shared_lock<boost::shared_mutex> SharedLock;
+  typedef boost::unique_lock<boost::shared_mutex> UniqueLock;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Looks up className in one of the registries. For the singleton, a 
+  //! miss loads the plugin that provides the class, if a plugin manifest 
+  //! lists it, and looks again.
+  //! \returns The entry, or a null value if the class isn't known
+  template <class Map_T>
+  typename Map_T::mapped_type 
+  lookup(const Map_T &map, const std::string &className) const;
 
   // Data members --------------------------------------------------------------
 
@@ -148,6 +185,8 @@ private:
   FieldIOFuncMap m_fieldIOs;
   //! 
   NameVec m_fieldIONames;
+  //! The instances returned by sharedFieldIO(). The key is the class name.
+  FieldIOMap m_sharedFieldIOs;
 
   //! Map of create functions for FieldMappings.  The key is the class name.
   FieldMappingFuncMap m_mappings;
@@ -159,6 +198,13 @@ private:
   FieldMappingIOFuncMap m_mappingIOs;
   //! 
   NameVec m_fieldMappingIONames;
+  //! The instances returned by sharedFieldMappingIO(). The key is the class 
+  //! name.
+  FieldMappingIOMap m_sharedMappingIOs;
+
+  //! Guards the registries, since plugins can register classes while 
+  //! other threads read files
+  mutable boost::shared_mutex m_mutex;
 
   //! Pointer to static instance
   static ClassFactory *ms_instance;
@@ -126,6 +126,15 @@ private:
     float m_match;
   };
 
+  //! Used when binary searching the m_samples vector.
+  struct CompareT
+  {
+    bool operator()(const float t, const Sample &sample) const
+    {
+      return t < sample.first;
+    }
+  };
+
   //! Used when finding values in the m_samples vector.
   struct CheckTEqual : 
     public std::unary_function<std::pair<float, T>, bool>
@@ -204,9 +213,9 @@ T Curve<T>::linear(const float t) const
     return defaultReturnValue();
   }
   // Find the first sample location that is greater than the interpolation
-  // position
+  // position. The samples are sorted, so this is a binary search.
   typename SampleVec::const_iterator i =
-    find_if(m_samples.begin(), m_samples.end(), CheckTGreaterThan(t));
+    upper_bound(m_samples.begin(), m_samples.end(), t, CompareT());
   // If we get end() back then there was no sample larger, so we return the
   // last value. If we got the first value then there is only one value and
   // we return that.
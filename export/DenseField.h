@@ -47,7 +47,9 @@
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 
+#include "AlignedAllocator.h"
 #include "Field.h"
 
 //----------------------------------------------------------------------------//
@@ -73,6 +75,17 @@ class CubicGenericFieldInterp;
   \ingroup field
   \brief This subclass of Field stores data in a contiguous std::vector.
 
+  The storage is aligned to DenseField::k_alignment bytes. X rows are 
+  contiguous, and rowPtr() and span() give direct access to them for loops 
+  that process whole rows at a time. Such loops should step between rows
+  and slices with rowStride() and sliceStride() rather than with the data
+  resolution.
+
+  The voxels may instead live in a memory-mapped file, see setMappedData().
+  Such a field reads straight from the mapping, and copies the voxels into
+  its own storage the first time it's written to. That first write must not
+  race with other accesses.
+
   Regarding threading granularity - DenseField considers each scanline
   (i.e. continuous X coords) to be one grain. Thus, numGrains is res.y * res.z.
 
@@ -97,6 +110,40 @@ public:
 
   typedef ResizableField<Data_T> base;
 
+  //! Alignment of the voxel storage, in bytes
+  static const size_t k_alignment = 64;
+
+  typedef std::vector<Data_T, AlignedAllocator<Data_T, k_alignment> > 
+  StorageVec;
+
+  //! A box of voxels, given by a pointer to its first voxel and the number
+  //! of voxels between consecutive rows and slices. Returned by span().
+  template <class T>
+  struct SpanT
+  {
+    SpanT()
+      : data(NULL), rowStride(0), sliceStride(0)
+    { bounds.makeEmpty(); }
+    //! Pointer to the first voxel of row (j, k), in voxel space
+    T* row(int j, int k) const
+    { 
+      return data + (j - bounds.min.y) * rowStride + 
+        (k - bounds.min.z) * sliceStride; 
+    }
+    //! Pointer to voxel (bounds.min.x, bounds.min.y, bounds.min.z). NULL 
+    //! if the span is empty.
+    T     *data;
+    //! The voxels covered by the span
+    Box3i  bounds;
+    //! Number of voxels from one row to the next
+    size_t rowStride;
+    //! Number of voxels from one slice to the next
+    size_t sliceStride;
+  };
+
+  typedef SpanT<Data_T>       Span;
+  typedef SpanT<const Data_T> ConstSpan;
+
   // Constructors --------------------------------------------------------------
 
   //! \name Constructors & destructor
@@ -105,6 +152,12 @@ public:
   //! Constructs an empty buffer
   DenseField();
 
+  //! Copies the voxels, or shares the mapping of a mapped field
+  DenseField(const DenseField &other);
+
+  //! Copies the voxels, or shares the mapping of a mapped field
+  DenseField& operator=(const DenseField &other);
+
   // \}
 
   // Main methods --------------------------------------------------------------
@@ -112,6 +165,20 @@ public:
   //! Clears all the voxels in the storage
   virtual void clear(const Data_T &value);
 
+  // Mapped storage ------------------------------------------------------------
+
+  //! Resizes the field and points it at voxels it doesn't own, typically in
+  //! a memory-mapped file, instead of allocating storage. The voxels must be
+  //! laid out like the field's own storage, and stay valid for as long as 
+  //! owner is held.
+  void setMappedData(const Box3i &extents, const Box3i &dataWindow,
+                     const Data_T *voxels, 
+                     const boost::shared_ptr<const void> &owner);
+
+  //! Whether the voxels are read from a mapping rather than owned
+  bool isMapped() const
+  { return m_mapping.get() != NULL; }
+
   // Threading-related ---------------------------------------------------------
 
   //! Number of 'grains' to use with threaded access
@@ -156,6 +223,30 @@ public:
   //! Write access to voxel. Notice that this is non-virtual.
   Data_T& fastLValue(int i, int j, int k);
 
+  // Bulk voxel access ---------------------------------------------------------
+
+  //! \name Bulk voxel access
+  //! \{
+
+  //! Pointer to the first voxel of row (j, k), which is followed by the 
+  //! rest of the row's voxels in x order.
+  const Data_T* rowPtr(int j, int k) const;
+  //! Pointer to the first voxel of row (j, k), which is followed by the 
+  //! rest of the row's voxels in x order.
+  Data_T* rowPtr(int j, int k);
+  //! Read access to the voxels of a box, clipped to the data window
+  ConstSpan span(const Box3i &box) const;
+  //! Write access to the voxels of a box, clipped to the data window
+  Span span(const Box3i &box);
+  //! Number of voxels from one row to the next
+  size_t rowStride() const
+  { return m_memSize.x; }
+  //! Number of voxels from one slice to the next
+  size_t sliceStride() const
+  { return m_memSizeXY; }
+
+  //! \}
+
   // Iterators -----------------------------------------------------------------
 
   //! \name Iterators
@@ -221,7 +312,14 @@ protected:
   //! X scanline * Y scanline size
   size_t m_memSizeXY;
   //! Field storage
-  std::vector<Data_T> m_data;
+  StorageVec m_data;
+  //! The voxels, either m_data or mapped
+  Data_T *m_voxels;
+  //! Keeps the mapped voxels valid. Null unless the field is mapped.
+  boost::shared_ptr<const void> m_mapping;
+  //! Set while setMappedData() resizes the field, so that sizeChanged() 
+  //! doesn't allocate
+  bool m_isSettingMapping;
 
 private:
 
@@ -231,6 +329,9 @@ private:
 
   // Direct access to memory for iterators -------------------------------------
 
+  //! Copies mapped voxels into the field's own storage, before a write
+  void unmap();
+
   //! Returns a pointer to a given element. Used by the iterators mainly.
   inline Data_T* ptr(int i, int j, int k);
   //! Returns a pointer to a given element. Used by the iterators mainly.
@@ -445,21 +546,97 @@ private:
 template <class Data_T>
 DenseField<Data_T>::DenseField()
   : base(),
-    m_memSize(0), m_memSizeXY(0)
+    m_memSize(0), m_memSizeXY(0), m_voxels(NULL), m_isSettingMapping(false)
 {
   // Empty
 }
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+DenseField<Data_T>::DenseField(const DenseField &other)
+  : base(other),
+    m_memSize(other.m_memSize), m_memSizeXY(other.m_memSizeXY), 
+    m_data(other.m_data), m_mapping(other.m_mapping), 
+    m_isSettingMapping(false)
+{
+  m_voxels = m_mapping ? other.m_voxels : 
+    (m_data.empty() ? NULL : &m_data[0]);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+DenseField<Data_T>& DenseField<Data_T>::operator=(const DenseField &other)
+{
+  if (this != &other) {
+    base::operator=(other);
+    m_memSize    = other.m_memSize;
+    m_memSizeXY  = other.m_memSizeXY;
+    m_data       = other.m_data;
+    m_mapping    = other.m_mapping;
+    m_voxels     = m_mapping ? other.m_voxels : 
+      (m_data.empty() ? NULL : &m_data[0]);
+  }
+  return *this;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 void DenseField<Data_T>::clear(const Data_T &value)
 {
+  if (m_mapping) {
+    // No point copying voxels that are about to be overwritten
+    m_mapping.reset();
+    m_data.resize(m_memSize.x * m_memSize.y * m_memSize.z);
+    m_voxels = m_data.empty() ? NULL : &m_data[0];
+  }
   std::fill(m_data.begin(), m_data.end(), value);
 }
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void DenseField<Data_T>::setMappedData(const Box3i &extents, 
+                                       const Box3i &dataWindow,
+                                       const Data_T *voxels, 
+                                       const boost::shared_ptr<const void> 
+                                       &owner)
+{
+  m_isSettingMapping = true;
+  try {
+    base::setSize(extents, dataWindow);
+  }
+  catch (...) {
+    m_isSettingMapping = false;
+    throw;
+  }
+  m_isSettingMapping = false;
+  // The voxels are never written through m_voxels while m_mapping is set
+  m_voxels  = const_cast<Data_T *>(voxels);
+  m_mapping = owner;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void DenseField<Data_T>::unmap()
+{
+  const Data_T *mapped = m_voxels;
+  try {
+    m_data.assign(mapped, mapped + m_memSize.x * m_memSize.y * m_memSize.z);
+  }
+  catch (std::bad_alloc &) {
+    throw Exc::MemoryException("Couldn't allocate DenseField of size " + 
+                               boost::lexical_cast<std::string>(m_memSize));
+  }
+  m_voxels = m_data.empty() ? NULL : &m_data[0];
+  m_mapping.reset();
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 size_t DenseField<Data_T>::numGrains() const
 {
@@ -529,7 +706,7 @@ const Data_T& DenseField<Data_T>::fastValue(int i, int j, int k) const
   j -= base::m_dataWindow.min.y;
   k -= base::m_dataWindow.min.z;
   // Access data
-  return m_data[i + j * m_memSize.x + k * m_memSizeXY];
+  return m_voxels[i + j * m_memSize.x + k * m_memSizeXY];
 }
 
 //----------------------------------------------------------------------------//
@@ -547,8 +724,72 @@ Data_T& DenseField<Data_T>::fastLValue(int i, int j, int k)
   i -= base::m_dataWindow.min.x;
   j -= base::m_dataWindow.min.y;
   k -= base::m_dataWindow.min.z;
+  // Write to our own storage
+  if (m_mapping) {
+    unmap();
+  }
   // Access data
-  return m_data[i + j * m_memSize.x + k * m_memSizeXY];
+  return m_voxels[i + j * m_memSize.x + k * m_memSizeXY];
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+const Data_T* DenseField<Data_T>::rowPtr(int j, int k) const
+{
+  assert (j >= base::m_dataWindow.min.y);
+  assert (j <= base::m_dataWindow.max.y);
+  assert (k >= base::m_dataWindow.min.z);
+  assert (k <= base::m_dataWindow.max.z);
+  return ptr(base::m_dataWindow.min.x, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T* DenseField<Data_T>::rowPtr(int j, int k)
+{
+  assert (j >= base::m_dataWindow.min.y);
+  assert (j <= base::m_dataWindow.max.y);
+  assert (k >= base::m_dataWindow.min.z);
+  assert (k <= base::m_dataWindow.max.z);
+  return ptr(base::m_dataWindow.min.x, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename DenseField<Data_T>::ConstSpan 
+DenseField<Data_T>::span(const Box3i &box) const
+{
+  ConstSpan result;
+  const Box3i bounds = Field3D::clipBounds(box, base::m_dataWindow);
+  if (bounds.isEmpty()) {
+    return result;
+  }
+  result.data        = ptr(bounds.min.x, bounds.min.y, bounds.min.z);
+  result.bounds      = bounds;
+  result.rowStride   = m_memSize.x;
+  result.sliceStride = m_memSizeXY;
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename DenseField<Data_T>::Span 
+DenseField<Data_T>::span(const Box3i &box)
+{
+  Span result;
+  const Box3i bounds = Field3D::clipBounds(box, base::m_dataWindow);
+  if (bounds.isEmpty()) {
+    return result;
+  }
+  result.data        = ptr(bounds.min.x, bounds.min.y, bounds.min.z);
+  result.bounds      = bounds;
+  result.rowStride   = m_memSize.x;
+  result.sliceStride = m_memSizeXY;
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -661,10 +902,18 @@ void DenseField<Data_T>::sizeChanged()
                                boost::lexical_cast<std::string>(
                                  base::m_dataWindow.max));
 
-  // Allocate memory
+  // Allocate memory, unless the voxels are about to be mapped
+  m_mapping.reset();
+  m_voxels = NULL;
+  StorageVec().swap(m_data);
+  if (m_isSettingMapping) {
+    return;
+  }
   try {
-    std::vector<Data_T>().swap(m_data);
     m_data.resize(m_memSize.x * m_memSize.y * m_memSize.z);
+    if (!m_data.empty()) {
+      m_voxels = &m_data[0];
+    }
   }
   catch (std::bad_alloc &) {
     throw Exc::MemoryException("Couldn't allocate DenseField of size " + 
@@ -677,12 +926,16 @@ void DenseField<Data_T>::sizeChanged()
 template <class Data_T>
 inline Data_T* DenseField<Data_T>::ptr(int i, int j, int k)
 {
+  // Write to our own storage
+  if (m_mapping) {
+    unmap();
+  }
   // Add crop window offset
   i -= base::m_dataWindow.min.x;
   j -= base::m_dataWindow.min.y;
   k -= base::m_dataWindow.min.z;
   // Access data
-  return &m_data[i + j * m_memSize.x + k * m_memSizeXY];      
+  return m_voxels + (i + j * m_memSize.x + k * m_memSizeXY);
 }
 
 //----------------------------------------------------------------------------//
@@ -695,7 +948,7 @@ inline const Data_T* DenseField<Data_T>::ptr(int i, int j, int k) const
   j -= base::m_dataWindow.min.y;
   k -= base::m_dataWindow.min.z;
   // Access data
-  return &m_data[i + j * m_memSize.x + k * m_memSizeXY];
+  return m_voxels + (i + j * m_memSize.x + k * m_memSizeXY);
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,836 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file ExprField.h
+  \brief Contains the ExprField class, which composes fields lazily, and 
+  the Expr functions that build its expressions.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_ExprField_H_
+#define _INCLUDED_Field3D_ExprField_H_
+
+#include <algorithm>
+
+#include <boost/mpl/if.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "DenseField.h"
+#include "FieldArithmetic.h"
+#include "FieldInterp.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// ExprNode
+//----------------------------------------------------------------------------//
+
+//! Most voxels an ExprNode evaluates per call
+const int k_exprChunkSize = 256;
+
+//----------------------------------------------------------------------------//
+
+/*! \class ExprNode
+  \ingroup field
+  \brief A node of an expression tree. Nodes evaluate up to 
+  k_exprChunkSize voxels per call, so the virtual call is paid once per 
+  chunk rather than once per voxel, and the loops that apply each operation
+  run over contiguous arrays that the compiler can vectorize.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class ExprNode
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_ptr<const ExprNode> Ptr;
+
+  // Constructors --------------------------------------------------------------
+
+  virtual ~ExprNode()
+  { /* Empty */ }
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Evaluates n voxels along x, starting at (i, j, k)
+  virtual void row(int i, int j, int k, int n, Data_T *out) const = 0;
+  //! Evaluates the n voxels at ijk
+  virtual void gather(int n, const V3i *ijk, Data_T *out) const = 0;
+  //! Memory used by the node and its children, not counting the fields 
+  //! they read
+  virtual long long int memSize() const = 0;
+
+};
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! A constant value
+  template <class Data_T>
+  class ConstExprNode : public ExprNode<Data_T>
+  {
+  public:
+    ConstExprNode(const Data_T &value)
+      : m_value(value)
+    { }
+    virtual void row(int, int, int, int n, Data_T *out) const
+    { std::fill(out, out + n, m_value); }
+    virtual void gather(int n, const V3i *, Data_T *out) const
+    { std::fill(out, out + n, m_value); }
+    virtual long long int memSize() const
+    { return sizeof(*this); }
+  private:
+    Data_T m_value;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads a DenseField. Rows are copied straight out of the field.
+  template <class Data_T>
+  class DenseExprNode : public ExprNode<Data_T>
+  {
+  public:
+    DenseExprNode(const typename DenseField<Data_T>::Ptr &field)
+      : m_field(field)
+    { }
+    virtual void row(int i, int j, int k, int n, Data_T *out) const
+    { 
+      const Data_T *p = 
+        m_field->rowPtr(j, k) + (i - m_field->dataWindow().min.x);
+      std::copy(p, p + n, out);
+    }
+    virtual void gather(int n, const V3i *ijk, Data_T *out) const
+    {
+      for (int v = 0; v < n; ++v) {
+        out[v] = m_field->fastValue(ijk[v].x, ijk[v].y, ijk[v].z);
+      }
+    }
+    virtual long long int memSize() const
+    { return sizeof(*this); }
+  private:
+    typename DenseField<Data_T>::Ptr m_field;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads a SparseField. Rows are read a block at a time, and the rows of
+  //! unallocated blocks are filled with their empty value.
+  template <class Data_T>
+  class SparseExprNode : public ExprNode<Data_T>
+  {
+  public:
+    SparseExprNode(const typename SparseField<Data_T>::Ptr &field)
+      : m_field(field)
+    { }
+    virtual void row(int i, int j, int k, int n, Data_T *out) const
+    { 
+      const SparseField<Data_T> &f = *m_field;
+      // Blocks of dynamically loaded fields need to be referenced
+      if (f.isDynamicLoad()) {
+        for (int x = 0; x < n; ++x) {
+          out[x] = f.fastValue(i + x, j, k);
+        }
+        return;
+      }
+      const Box3i               &dw     = f.dataWindow();
+      const int                  order  = f.blockOrder();
+      const int                  mask   = (1 << order) - 1;
+      const Sparse::BlockLayout  layout = f.blockLayout();
+      const int lj = j - dw.min.y, lk = k - dw.min.z;
+      const int bj = lj >> order, bk = lk >> order;
+      const int vj = lj & mask, vk = lk & mask;
+      for (int x = 0; x < n; ) {
+        const int li   = i + x - dw.min.x;
+        const int bi   = li >> order, vi = li & mask;
+        const int span = std::min(n - x, mask + 1 - vi);
+        if (f.blockIsAllocated(bi, bj, bk)) {
+          const Data_T *p = f.blockData(bi, bj, bk);
+          if (layout == Sparse::BlockLayoutLinear) {
+            p += Sparse::blockIndex(vi, vj, vk, order, layout);
+            std::copy(p, p + span, out + x);
+          } else {
+            for (int s = 0; s < span; ++s) {
+              out[x + s] = p[Sparse::blockIndex(vi + s, vj, vk, order, 
+                                                layout)];
+            }
+          }
+        } else {
+          std::fill(out + x, out + x + span, 
+                    f.getBlockEmptyValue(bi, bj, bk));
+        }
+        x += span;
+      }
+    }
+    virtual void gather(int n, const V3i *ijk, Data_T *out) const
+    {
+      for (int v = 0; v < n; ++v) {
+        out[v] = m_field->fastValue(ijk[v].x, ijk[v].y, ijk[v].z);
+      }
+    }
+    virtual long long int memSize() const
+    { return sizeof(*this); }
+  private:
+    typename SparseField<Data_T>::Ptr m_field;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Applies a FieldOps binary operation as op(a, b)
+  template <class Data_T, class Op_T>
+  class BinaryExprNode : public ExprNode<Data_T>
+  {
+  public:
+    typedef typename ExprNode<Data_T>::Ptr NodePtr;
+    BinaryExprNode(const NodePtr &a, const NodePtr &b, const Op_T &op)
+      : m_a(a), m_b(b), m_op(op)
+    { }
+    virtual void row(int i, int j, int k, int n, Data_T *out) const
+    { 
+      Data_T b[k_exprChunkSize];
+      m_a->row(i, j, k, n, out);
+      m_b->row(i, j, k, n, b);
+      combineRow(out, b, n, m_op);
+    }
+    virtual void gather(int n, const V3i *ijk, Data_T *out) const
+    {
+      Data_T b[k_exprChunkSize];
+      m_a->gather(n, ijk, out);
+      m_b->gather(n, ijk, b);
+      combineRow(out, b, n, m_op);
+    }
+    virtual long long int memSize() const
+    { return sizeof(*this) + m_a->memSize() + m_b->memSize(); }
+  private:
+    NodePtr m_a, m_b;
+    Op_T    m_op;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Applies a FieldOps unary operation
+  template <class Data_T, class Op_T>
+  class UnaryExprNode : public ExprNode<Data_T>
+  {
+  public:
+    typedef typename ExprNode<Data_T>::Ptr NodePtr;
+    UnaryExprNode(const NodePtr &a, const Op_T &op)
+      : m_a(a), m_op(op)
+    { }
+    virtual void row(int i, int j, int k, int n, Data_T *out) const
+    { 
+      m_a->row(i, j, k, n, out);
+      transformRow(out, n, m_op);
+    }
+    virtual void gather(int n, const V3i *ijk, Data_T *out) const
+    {
+      m_a->gather(n, ijk, out);
+      transformRow(out, n, m_op);
+    }
+    virtual long long int memSize() const
+    { return sizeof(*this) + m_a->memSize(); }
+  private:
+    NodePtr m_a;
+    Op_T    m_op;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Expression
+//----------------------------------------------------------------------------//
+
+/*! \class Expression
+  \ingroup field
+  \brief An expression tree along with the data window it's defined over.
+  Built by the Expr functions and turned into a field by ExprField.
+
+  The data window is the intersection of those of the fields the 
+  expression reads, and the mapping and extents are those of the first of
+  them. Expressions of constants only are unbounded. All fields are 
+  expected to share their voxel space.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class Expression
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Data_T                         value_type;
+  typedef typename ExprNode<Data_T>::Ptr NodePtr;
+
+  // Constructors --------------------------------------------------------------
+
+  //! An unbounded expression
+  explicit Expression(const NodePtr &node)
+    : m_node(node), m_isBounded(false)
+  { }
+
+  //! An expression over the given window of a field
+  Expression(const NodePtr &node, const FieldRes &field)
+    : m_node(node), m_isBounded(true), m_extents(field.extents()), 
+      m_dataWindow(field.dataWindow()), m_mapping(field.mapping())
+  { }
+
+  //! An expression with the bounds of a and b combined
+  template <class A_T, class B_T>
+  Expression(const NodePtr &node, const Expression<A_T> &a, 
+             const Expression<B_T> &b)
+    : m_node(node), m_isBounded(a.isBounded() || b.isBounded())
+  { 
+    if (a.isBounded()) {
+      m_extents    = a.extents();
+      m_dataWindow = a.dataWindow();
+      m_mapping    = a.mapping();
+      if (b.isBounded()) {
+        m_dataWindow = clipBounds(m_dataWindow, b.dataWindow());
+      }
+    } else if (b.isBounded()) {
+      m_extents    = b.extents();
+      m_dataWindow = b.dataWindow();
+      m_mapping    = b.mapping();
+    }
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! The root of the expression tree
+  const NodePtr& node() const
+  { return m_node; }
+  //! Whether the expression reads any fields
+  bool isBounded() const
+  { return m_isBounded; }
+  //! Extents of the first field read
+  const Box3i& extents() const
+  { return m_extents; }
+  //! Voxels where all the fields read are defined
+  const Box3i& dataWindow() const
+  { return m_dataWindow; }
+  //! Mapping of the first field read
+  const FieldMapping::Ptr& mapping() const
+  { return m_mapping; }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  NodePtr           m_node;
+  bool              m_isBounded;
+  Box3i             m_extents;
+  Box3i             m_dataWindow;
+  FieldMapping::Ptr m_mapping;
+
+};
+
+//----------------------------------------------------------------------------//
+// ExprField
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class ExprFieldInterp;
+
+//----------------------------------------------------------------------------//
+
+/*! \class ExprField
+  \ingroup field
+  \brief A Field whose voxels are computed from other fields on demand.
+
+  Combining fields with ExprField, e.g. 
+  ExprField<float>(Expr::add(a, Expr::mul(b, 0.5f))), allocates no voxel 
+  data: each lookup evaluates the expression for the voxels it needs. 
+  row() evaluates runs of voxels at a time, reading dense rows and sparse
+  blocks directly, and the linear interpolator gathers the stencils of a 
+  batch of points through a single evaluation. ExprFields work with 
+  Sampler and FieldGroup like any other field.
+
+  Compared to ProceduralField, which is sampled through a virtual call per
+  lookup, the operations are known at compile time and applied to whole 
+  chunks of voxels. 
+
+  \note The fields an expression reads are held by reference count, and 
+  must not be modified while the ExprField is used.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class ExprField : public Field<Data_T>
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::intrusive_ptr<ExprField> Ptr;
+  typedef std::vector<Ptr>                Vec;
+
+  typedef ExprFieldInterp<Data_T>         LinearInterp;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef ExprField<Data_T> class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS
+
+  static const char *staticClassName()
+  {
+    return "ExprField";
+  }
+
+  static const char *staticClassType()
+  {
+    return ExprField<Data_T>::ms_classType.name();
+  }
+
+  // Constructors --------------------------------------------------------------
+
+  //! Takes its data window, extents and mapping from the expression
+  explicit ExprField(const Expression<Data_T> &expr)
+    : m_expr(expr)
+  { 
+    base::m_extents    = expr.extents();
+    base::m_dataWindow = expr.dataWindow();
+    if (expr.mapping()) {
+      base::setMapping(expr.mapping());
+    }
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Value of a single voxel, without a virtual call
+  Data_T fastValue(int i, int j, int k) const
+  {
+    const V3i ijk(i, j, k);
+    Data_T    value;
+    m_expr.node()->gather(1, &ijk, &value);
+    return value;
+  }
+
+  //! Evaluates n voxels along x, starting at (i, j, k). The voxels must be
+  //! within the data window.
+  void row(int i, int j, int k, int n, Data_T *out) const
+  {
+    for (int x = 0; x < n; x += k_exprChunkSize) {
+      m_expr.node()->row(i + x, j, k, std::min(k_exprChunkSize, n - x), 
+                         out + x);
+    }
+  }
+
+  //! Evaluates the n voxels at ijk, which must be within the data window
+  void gather(int n, const V3i *ijk, Data_T *out) const
+  {
+    for (int v = 0; v < n; v += k_exprChunkSize) {
+      m_expr.node()->gather(std::min(k_exprChunkSize, n - v), ijk + v, 
+                            out + v);
+    }
+  }
+
+  //! The expression
+  const Expression<Data_T>& expression() const
+  { return m_expr; }
+
+  // From Field base class -----------------------------------------------------
+
+  //! \name From Field
+  //! \{  
+  virtual Data_T value(int i, int j, int k) const
+  { return fastValue(i, j, k); }
+  //! Counts the expression, but not the fields it reads
+  virtual long long int memSize() const
+  { return sizeof(*this) + base::memSize() + m_expr.node()->memSize(); }
+  //! \}
+
+  // From FieldBase ------------------------------------------------------------
+
+  //! \name From FieldBase
+  //! \{
+
+  FIELD3D_CLASSNAME_CLASSTYPE_IMPLEMENTATION
+
+  virtual FieldBase::Ptr clone() const
+  { return Ptr(new ExprField(*this)); }
+
+  //! \}
+
+private:
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<ExprField<Data_T> > ms_classType;
+
+  // Data members --------------------------------------------------------------
+
+  Expression<Data_T> m_expr;
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Field<Data_T> base;
+
+};
+
+//----------------------------------------------------------------------------//
+// Static member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(ExprField);
+
+//----------------------------------------------------------------------------//
+// ExprFieldInterp
+//----------------------------------------------------------------------------//
+
+/* \class ExprFieldInterp
+   \ingroup field
+   \brief Linear interpolator for ExprFields. The batched sample() gathers
+   the corners of many points and evaluates them all at once.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class ExprFieldInterp : public RefBase
+{
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Data_T value_type;
+  typedef boost::intrusive_ptr<ExprFieldInterp> Ptr;
+  
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef ExprFieldInterp class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "ExprFieldInterp";
+  }
+  
+  static const char* staticClassType()
+  {
+    return ms_classType.name();
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  value_type sample(const ExprField<Data_T> &field, const V3d &vsP) const
+  {
+    V3i                    corners[8];
+    Data_T                 v[8];
+    FIELD3D_VEC3_T<double> f1, f2;
+    setupCorners(field, vsP, corners, f1, f2);
+    field.expression().node()->gather(8, corners, v);
+    return interpolate(v, f1, f2);
+  }
+
+  //! Samples n points at once
+  void sample(const ExprField<Data_T> &field, size_t n, const V3f *vsP, 
+              value_type *out) const
+  {
+    const size_t           chunk = k_exprChunkSize / 8;
+    V3i                    corners[k_exprChunkSize];
+    Data_T                 v[k_exprChunkSize];
+    FIELD3D_VEC3_T<double> f1[k_exprChunkSize / 8], f2[k_exprChunkSize / 8];
+    for (size_t first = 0; first < n; first += chunk) {
+      const size_t m = std::min(chunk, n - first);
+      for (size_t p = 0; p < m; ++p) {
+        setupCorners(field, V3d(vsP[first + p]), corners + 8 * p, 
+                     f1[p], f2[p]);
+      }
+      field.expression().node()->gather(static_cast<int>(8 * m), corners, v);
+      for (size_t p = 0; p < m; ++p) {
+        out[first + p] = interpolate(v + 8 * p, f1[p], f2[p]);
+      }
+    }
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Finds the 8 voxels of the stencil at vsP, with x varying fastest, and
+  //! their weights
+  static void setupCorners(const ExprField<Data_T> &field, const V3d &vsP,
+                           V3i *c, FIELD3D_VEC3_T<double> &f1, 
+                           FIELD3D_VEC3_T<double> &f2)
+  {
+    V3i c1, c2;
+    detail::linearStencilSetup(field.dataWindow(), vsP, c1, c2, f1, f2);
+    c[0] = V3i(c1.x, c1.y, c1.z);
+    c[1] = V3i(c2.x, c1.y, c1.z);
+    c[2] = V3i(c1.x, c2.y, c1.z);
+    c[3] = V3i(c2.x, c2.y, c1.z);
+    c[4] = V3i(c1.x, c1.y, c2.z);
+    c[5] = V3i(c2.x, c1.y, c2.z);
+    c[6] = V3i(c1.x, c2.y, c2.z);
+    c[7] = V3i(c2.x, c2.y, c2.z);
+  }
+
+  //! Interpolates the 8 values of a stencil, summed in the same order as 
+  //! LinearGenericFieldInterp
+  static Data_T interpolate(const Data_T *v, const FIELD3D_VEC3_T<double> &f1,
+                            const FIELD3D_VEC3_T<double> &f2)
+  {
+    return static_cast<Data_T>
+      (f1.x * (f1.y * (f1.z * v[0] + f2.z * v[4]) +
+               f2.y * (f1.z * v[2] + f2.z * v[6])) +
+       f2.x * (f1.y * (f1.z * v[1] + f2.z * v[5]) +
+               f2.y * (f1.z * v[3] + f2.z * v[7])));
+  }
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<ExprFieldInterp<Data_T> > ms_classType;
+  
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef RefBase base;    
+
+};
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(ExprFieldInterp);
+
+//----------------------------------------------------------------------------//
+// ExprArg
+//----------------------------------------------------------------------------//
+
+//! Turns the arguments of the Expr functions into expressions. Anything 
+//! that isn't a field or an expression is a constant.
+template <class T>
+struct ExprArg
+{
+  static const bool isField = false;
+  typedef T value_type;
+  template <class Data_T>
+  static Expression<Data_T> make(const T &value)
+  { 
+    return Expression<Data_T>
+      (typename ExprNode<Data_T>::Ptr
+       (new detail::ConstExprNode<Data_T>(static_cast<Data_T>(value))));
+  }
+};
+
+template <class T>
+struct ExprArg<boost::intrusive_ptr<DenseField<T> > >
+{
+  static const bool isField = true;
+  typedef T value_type;
+  template <class Data_T>
+  static Expression<Data_T> make(const typename DenseField<T>::Ptr &field)
+  { 
+    return Expression<Data_T>
+      (typename ExprNode<Data_T>::Ptr(new detail::DenseExprNode<T>(field)), 
+       *field);
+  }
+};
+
+template <class T>
+struct ExprArg<boost::intrusive_ptr<SparseField<T> > >
+{
+  static const bool isField = true;
+  typedef T value_type;
+  template <class Data_T>
+  static Expression<Data_T> make(const typename SparseField<T>::Ptr &field)
+  { 
+    return Expression<Data_T>
+      (typename ExprNode<Data_T>::Ptr(new detail::SparseExprNode<T>(field)),
+       *field);
+  }
+};
+
+template <class T>
+struct ExprArg<boost::intrusive_ptr<ExprField<T> > >
+{
+  static const bool isField = true;
+  typedef T value_type;
+  template <class Data_T>
+  static Expression<Data_T> make(const typename ExprField<T>::Ptr &field)
+  { return field->expression(); }
+};
+
+template <class T>
+struct ExprArg<Expression<T> >
+{
+  static const bool isField = true;
+  typedef T value_type;
+  template <class Data_T>
+  static Expression<Data_T> make(const Expression<T> &expr)
+  { return expr; }
+};
+
+//----------------------------------------------------------------------------//
+
+//! The data type of an expression of a and b, taken from whichever isn't 
+//! a constant
+template <class A_T, class B_T>
+struct ExprResult
+{
+  typedef typename boost::mpl::if_c<ExprArg<A_T>::isField, 
+                                    typename ExprArg<A_T>::value_type,
+                                    typename ExprArg<B_T>::value_type>::type
+  type;
+};
+
+//----------------------------------------------------------------------------//
+// Expr
+//----------------------------------------------------------------------------//
+
+/*! \namespace Expr
+  Functions that build expressions out of fields, expressions and 
+  constants. Arguments may be DenseField, SparseField and ExprField 
+  pointers, Expressions, or constants, which are cast to the data type of
+  the fields. The operations are those of FieldOps.
+*/
+
+namespace Expr {
+
+  //--------------------------------------------------------------------------//
+
+  //! Applies op(a, b)
+  template <class A_T, class B_T, class Op_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  binary(const A_T &a, const B_T &b, const Op_T &op)
+  {
+    typedef typename ExprResult<A_T, B_T>::type Data_T;
+    typedef typename ExprNode<Data_T>::Ptr      NodePtr;
+    const Expression<Data_T> ea = ExprArg<A_T>::template make<Data_T>(a);
+    const Expression<Data_T> eb = ExprArg<B_T>::template make<Data_T>(b);
+    const NodePtr node(new detail::BinaryExprNode<Data_T, Op_T>
+                       (ea.node(), eb.node(), op));
+    return Expression<Data_T>(node, ea, eb);
+  }
+
+  //! Applies op(a)
+  template <class A_T, class Op_T>
+  Expression<typename ExprArg<A_T>::value_type> 
+  unary(const A_T &a, const Op_T &op)
+  {
+    typedef typename ExprArg<A_T>::value_type Data_T;
+    typedef typename ExprNode<Data_T>::Ptr    NodePtr;
+    const Expression<Data_T> ea = ExprArg<A_T>::template make<Data_T>(a);
+    const NodePtr node(new detail::UnaryExprNode<Data_T, Op_T>
+                       (ea.node(), op));
+    return Expression<Data_T>(node, ea, ea);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! a + b
+  template <class A_T, class B_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  add(const A_T &a, const B_T &b)
+  { return binary(a, b, FieldOps::Add()); }
+
+  //! a - b
+  template <class A_T, class B_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  sub(const A_T &a, const B_T &b)
+  { return binary(a, b, FieldOps::Sub()); }
+
+  //! a * b, per component for vectors
+  template <class A_T, class B_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  mul(const A_T &a, const B_T &b)
+  { return binary(a, b, FieldOps::Mul()); }
+
+  //! Per-component minimum of a and b
+  template <class A_T, class B_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  min(const A_T &a, const B_T &b)
+  { return binary(a, b, FieldOps::Min()); }
+
+  //! Per-component maximum of a and b
+  template <class A_T, class B_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  max(const A_T &a, const B_T &b)
+  { return binary(a, b, FieldOps::Max()); }
+
+  //! Linear blend from a to b by a constant weight
+  template <class A_T, class B_T>
+  Expression<typename ExprResult<A_T, B_T>::type> 
+  lerp(const A_T &a, const B_T &b, const float t)
+  { return binary(a, b, FieldOps::Lerp(t)); }
+
+  //! a multiplied by a constant
+  template <class A_T>
+  Expression<typename ExprArg<A_T>::value_type> 
+  scale(const A_T &a, const float s)
+  { return unary(a, FieldOps::Scale(s)); }
+
+  //! a with each component clamped to [lo, hi]
+  template <class A_T>
+  Expression<typename ExprArg<A_T>::value_type> 
+  clamp(const A_T &a, const typename ExprArg<A_T>::value_type &lo,
+        const typename ExprArg<A_T>::value_type &hi)
+  { 
+    typedef typename ExprArg<A_T>::value_type Data_T;
+    return unary(a, FieldOps::Clamp<Data_T>(lo, hi)); 
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // namespace Expr
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
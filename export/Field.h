@@ -350,7 +350,8 @@ inline void FieldRes::setMapping(FieldMapping::Ptr mapping)
     m_mapping = mapping->clone(); 
     m_mapping->setExtents(m_extents); 
   } else {
-    Msg::print(Msg::SevWarning, 
+    static Msg::RateLimit limit;
+    Msg::print(limit, Msg::SevWarning, 
                "Tried to call FieldRes::setMapping with null pointer");
   }
   // Tell subclasses about the mapping change
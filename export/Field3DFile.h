@@ -50,17 +50,21 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
 #include <list>
 #include <string>
 #include <vector>
 
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "EmptyField.h"
 #include "Field.h"
 #include "Field3DFileHDF5.h"
 #include "FieldMetadata.h"
 #include "ClassFactory.h"
+#include "MACField.h"
 #include "OgawaFwd.h"
 
 //----------------------------------------------------------------------------//
@@ -77,6 +81,9 @@ FIELD3D_NAMESPACE_OPEN
 
 class Field3DInputFileHDF5;
 class Field3DOutputFileHDF5;
+class MatchPattern;
+template <typename Data_T> class SparseAtlas;
+template <class Data_T> class DenseField;
 
 //----------------------------------------------------------------------------//
 // Layer
@@ -101,6 +108,77 @@ public:
   //! The name of the parent partition. We need this in order to open
   //! its group.
   std::string parent;
+
+  // The members below come from the file's layer index, if it has one ---
+
+  //! Ogawa-level child index of the layer group within its partition group.
+  //! -1 if not known.
+  int childIndex;
+  //! Class name of the field. Empty if not known.
+  std::string className;
+  //! On-disk data type, as an OgDataType. -1 if not known.
+  int dataType;
+  //! Data window of the field
+  Box3i dataWindow;
+
+  //! Ctor
+  Layer()
+    : childIndex(-1), dataType(-1)
+  { }
+};
+
+//----------------------------------------------------------------------------//
+
+/*! \class LayerStorage
+  \ingroup file_int
+  Describes how a layer is stored in an Ogawa file. Found by 
+  Field3DInputFile::layerStorage() without reading the layer's voxels.
+*/
+
+class LayerStorage
+{
+public:
+  //! The internal name of the layer's partition
+  std::string partition;
+  //! Class name of the field
+  std::string className;
+  //! Bytes taken up in the file by the field's attributes and data, i.e. 
+  //! everything but its metadata
+  uint64_t dataBytes;
+
+  //! Ctor
+  LayerStorage()
+    : dataBytes(0)
+  { }
+};
+
+//----------------------------------------------------------------------------//
+
+/*! \class LayerVerification
+  \ingroup file_int
+  Result of checking a layer's compressed blocks and slabs against their 
+  checksums. Found by Field3DInputFile::verifyLayer() without decompressing
+  anything.
+*/
+
+class LayerVerification
+{
+public:
+  //! The internal name of the layer's partition
+  std::string partition;
+  //! Class name of the field
+  std::string className;
+  //! Number of compressed elements that matched their checksums
+  size_t numChecked;
+  //! Number of compressed elements that didn't match their checksums
+  size_t numCorrupt;
+  //! Number of compressed elements that were written without checksums
+  size_t numUnchecked;
+
+  //! Ctor
+  LayerVerification()
+    : numChecked(0), numCorrupt(0), numUnchecked(0)
+  { }
 };
   
 } // namespace File
@@ -141,7 +219,7 @@ public:
 
   //! Ctor
   Partition() 
-    : RefBase() 
+    : RefBase(), childIndex(-1), mappingChildIndex(-1), m_isExpanded(true)
   { }
 
   // From RefBase --------------------------------------------------------------
@@ -169,12 +247,27 @@ public:
   //! Sets the group pointer
   void setGroup(boost::shared_ptr<OgOGroup> ptr);
 
+  //! Whether the mapping and layers have been filled in. Partitions read 
+  //! from a file start out with only their name and are expanded on first
+  //! access.
+  bool isExpanded() const
+  { return m_isExpanded; }
+  //! Sets the expanded state
+  void setExpanded(bool expanded)
+  { m_isExpanded = expanded; }
+
   // Public data members -------------------------------------------------------
 
   //! Name of the partition
   std::string name;
   //! Pointer to the mapping object.
   FieldMapping::Ptr mapping;
+  //! Ogawa-level child index of the partition group within the root group.
+  //! -1 if not known.
+  int childIndex;
+  //! Ogawa-level child index of the mapping group within the partition
+  //! group. -1 if not known.
+  int mappingChildIndex;
 
 private:
 
@@ -184,6 +277,8 @@ private:
   LayerList m_layers;
   //! Group representing the partition
   boost::shared_ptr<OgOGroup> m_group;
+  //! Whether the mapping and layers are filled in
+  bool m_isExpanded;
 
   // Typedefs ------------------------------------------------------------------
 
@@ -260,6 +355,21 @@ public:
   void getVectorLayerNames(std::vector<std::string> &names, 
                            const std::string &partitionName) const;
 
+  //! Gets the names of the partitions that match the pattern, in the 
+  //! order of getPartitionNames()
+  void getPartitionNames(std::vector<std::string> &names,
+                         const MatchPattern &pattern) const;
+  //! Gets the names of the scalar layers in a given partition that match 
+  //! the pattern
+  void getScalarLayerNames(std::vector<std::string> &names, 
+                           const std::string &partitionName,
+                           const MatchPattern &pattern) const;
+  //! Gets the names of the vector layers in a given partition that match 
+  //! the pattern
+  void getVectorLayerNames(std::vector<std::string> &names, 
+                           const std::string &partitionName,
+                           const MatchPattern &pattern) const;
+
   //! \}
 
   //! \name Convenience methods for partitionName
@@ -278,6 +388,7 @@ public:
     if (m_hdf5Base) {
       return m_hdf5Base->metadata();
     }
+    expandMetadata();
     return m_metadata; 
   }
 
@@ -287,6 +398,7 @@ public:
     if (m_hdf5Base) {
       return m_hdf5Base->metadata();
     }
+    expandMetadata();
     return m_metadata; 
   }
  
@@ -323,6 +435,14 @@ protected:
 
   //! Closes the file if open.
   virtual void closeInternal() = 0;
+  //! Fills in the mapping and layers of a partition that was only named
+  //! when the file was opened. Called by partition() before returning it.
+  virtual void expandPartition(File::Partition &/* part */) const
+  { /* Empty */ }
+  //! Reads the global metadata if it hasn't been yet. Called by metadata()
+  //! before returning it.
+  virtual void expandMetadata() const
+  { /* Empty */ }
   //! Returns a pointer to the given partition
   //! \returns NULL if no partition was found of that name
   File::Partition::Ptr partition(const std::string &partitionName);
@@ -426,7 +546,8 @@ public:
 
   // Main interface ------------------------------------------------------------
 
-  //! Opens the given file
+  //! Opens the given file. Ogawa files can also be opened through a 
+  //! stream source, e.g. "http://host/file.f3d", see StreamSource.h.
   //! \returns Whether successful
   bool open(const std::string &filename);
 
@@ -449,6 +570,47 @@ public:
   readLayers(const std::string &partitionName,
              const std::string &layerName) const;
 
+  //! Reads all the layers with any of the given names, spreading the layers
+  //! over numIOThreads() threads. The fields are returned in the same order
+  //! as readLayers() would return them, each layer once.
+  //! \param layerNames If empty, all layers are read, as with an empty 
+  //! layerName. This holds for both Ogawa and HDF5 files.
+  template <class Data_T>
+  typename Field<Data_T>::Vec
+  readLayers(const std::vector<std::string> &layerNames) const;
+
+  //! Reads the part of each layer with the given name that overlaps 
+  //! voxelWindow. Sparse fields only read the blocks that overlap the 
+  //! window; the other blocks keep their empty value. Dense fields are
+  //! read with the overlap as their data window, and left out if there is
+  //! no overlap. Other field types are read in full.
+  //! \note Windowed reads bypass the field cache, but a layer already in the
+  //! cache is returned as is.
+  template <class Data_T>
+  typename Field<Data_T>::Vec
+  readLayers(const std::string &layerName, const Box3i &voxelWindow) const;
+
+  //! Reads the brick atlases stored with the first layer of the given 
+  //! partition and layer name: one for a SparseField, or one per level, 
+  //! finest first, for a MIP field of SparseFields.
+  //! \returns An empty vector if the layer was written without atlases.
+  //! \sa Field3DOutputFile::setWriteSparseAtlases(), SparseAtlas
+  template <class Data_T>
+  std::vector<boost::shared_ptr<SparseAtlas<Data_T> > >
+  readSparseAtlases(const std::string &partitionName,
+                    const std::string &layerName) const;
+
+  //! Reads a single face component of the first MACField layer with the
+  //! given partition and layer name, leaving the other two components on
+  //! disk. Data_T is the scalar type of the layer's vectors. 
+  //! \returns Null if there is no such layer, or if the file is HDF5.
+  //! \sa MACFieldIO::readComponent() for the layout of the result
+  template <class Data_T>
+  typename DenseField<Data_T>::Ptr
+  readMACComponent(const std::string &partitionName,
+                   const std::string &layerName, 
+                   const MACComponent comp) const;
+
   //! \name Backward compatibility
   //! \{
 
@@ -478,6 +640,31 @@ public:
     return readLayers<Data_T>(partitionName, layerName); 
   }
 
+  //! Reads the scalar layers with any of the given names concurrently
+  //! \note Layers in HDF5 files are read one at a time
+  template <class Data_T>
+  typename Field<Data_T>::Vec
+  readScalarLayers(const std::vector<std::string> &layerNames) const
+  { 
+    if (m_hdf5) {
+      return m_hdf5->readScalarLayers<Data_T>(layerNames);
+    }
+    return readLayers<Data_T>(layerNames); 
+  }
+
+  //! Reads the part of each scalar layer that overlaps voxelWindow
+  //! \note Only DenseFields are read in part from HDF5 files
+  template <class Data_T>
+  typename Field<Data_T>::Vec
+  readScalarLayers(const std::string &layerName, 
+                   const Box3i &voxelWindow) const
+  { 
+    if (m_hdf5) {
+      return m_hdf5->readScalarLayers<Data_T>(layerName, voxelWindow);
+    }
+    return readLayers<Data_T>(layerName, voxelWindow); 
+  }
+
   //! Retrieves all the layers of vector type and maintains their on-disk
   //! data types
   //! \param layerName If a string is passed in, only layers of that name will
@@ -504,6 +691,54 @@ public:
     return readLayers<FIELD3D_VEC3_T<Data_T> >(partitionName, layerName); 
   }
 
+  //! Reads the vector layers with any of the given names concurrently
+  //! \note Layers in HDF5 files are read one at a time
+  template <class Data_T>
+  typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
+  readVectorLayers(const std::vector<std::string> &layerNames) const
+  { 
+    if (m_hdf5) {
+      return m_hdf5->readVectorLayers<Data_T>(layerNames);
+    }
+    return readLayers<FIELD3D_VEC3_T<Data_T> >(layerNames); 
+  }
+
+  //! Reads the part of each vector layer that overlaps voxelWindow
+  //! \note Only DenseFields are read in part from HDF5 files
+  template <class Data_T>
+  typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
+  readVectorLayers(const std::string &layerName, 
+                   const Box3i &voxelWindow) const
+  { 
+    if (m_hdf5) {
+      return m_hdf5->readVectorLayers<Data_T>(layerName, voxelWindow);
+    }
+    return readLayers<FIELD3D_VEC3_T<Data_T> >(layerName, voxelWindow); 
+  }
+
+  //! \}
+
+  //! \name Reading layer storage from disk
+  //! \{
+
+  //! Describes how each layer named layerName in the partitions named 
+  //! partitionName is stored, in the order the partitions were written. 
+  //! Only the layers' groups and the sizes of their data are read, never 
+  //! the voxels.
+  //! \note Returns nothing for HDF5 files
+  std::vector<File::LayerStorage> 
+  layerStorage(const std::string &partitionName, 
+               const std::string &layerName) const;
+
+  //! Checks the compressed data of each layer named layerName in the 
+  //! partitions named partitionName against the checksums written with it,
+  //! on numIOThreads() threads. Nothing is decompressed.
+  //! \note Returns nothing for HDF5 files
+  //! \sa setWriteChecksums()
+  std::vector<File::LayerVerification> 
+  verifyLayer(const std::string &partitionName, 
+              const std::string &layerName) const;
+
   //! \}
 
   //! \name Reading proxy data from disk
@@ -576,6 +811,14 @@ private:
   readLayer(const std::string &intPartitionName, 
             const std::string &layerName) const;
 
+  //! As readLayer(), but only reads the part of the layer that overlaps 
+  //! voxelWindow, unless it is null. Windowed reads are never cached.
+  template <class Data_T>
+  typename Field<Data_T>::Ptr 
+  readLayerWindow(const std::string &intPartitionName, 
+                  const std::string &layerName, 
+                  const Box3i *voxelWindow) const;
+
   //! Retrieves a proxy version (EmptyField) from a given Ogawa location
   //! \note Although the call is templated, all fields are read, regardless
   //! of bit depth.
@@ -585,14 +828,35 @@ private:
                  const std::string &attribute, 
                  FieldMapping::Ptr mapping) const;
   
-  //! Sets up all the partitions and layers, but does not load any data
+  //! Sets up the partitions by name only. Their mappings and layers are 
+  //! read by expandPartition() on first access.
   bool readPartitionAndLayerInfo();
 
+  //! Sets up the partitions and their layers from the file's layer index.
+  //! \returns False if the file has no usable index
+  bool readLayerIndex();
+
+  //! Opens the group of a partition, directly if its position is known
+  OgIGroup openPartitionGroup(const File::Partition &part) const;
+
+  //! Opens the group of a layer, directly if its position is known
+  OgIGroup openLayerGroup(const OgIGroup &partitionGroup, 
+                          const File::Layer &layer) const;
+
+  // From Field3DFileBase ------------------------------------------------------
+
+  //! Reads the mapping and the layer names of the partition
+  virtual void expandPartition(File::Partition &part) const;
+  //! Reads the global metadata group
+  virtual void expandMetadata() const;
+
   //! Read metadata for this layer
   bool readMetadata(const OgIGroup &metadataGroup, FieldBase::Ptr field) const;
 
-  //! Read global metadata for this file
-  bool readMetadata(const OgIGroup &metadataGroup);
+  // Friends -------------------------------------------------------------------
+
+  //! Opens the layer groups of the input file in copyLayer()
+  friend class Field3DOutputFile;
 
   // Data members --------------------------------------------------------------
 
@@ -602,6 +866,11 @@ private:
   boost::shared_ptr<Alembic::Ogawa::IArchive> m_archive;
   //! Pointer to root group
   boost::shared_ptr<OgIGroup> m_root;
+  //! Whether the global metadata has been read
+  mutable bool m_isMetadataRead;
+  //! Serializes the lazy expansion of partitions and metadata, since layers
+  //! may be read from several threads
+  mutable boost::mutex m_expandMutex;
 
   //! HDF5 fallback
   boost::shared_ptr<Field3DInputFileHDF5> m_hdf5;
@@ -679,6 +948,17 @@ public:
     }
   }
 
+  //! Whether create() currently outputs Ogawa files
+  static bool usingOgawa()
+  { return ms_doOgawa; }
+
+  //! Whether to end Ogawa files with an index of their layers. Readers that
+  //! find the index open the partitions and layers directly instead of 
+  //! searching for them by name. Readers that don't know about it ignore it.
+  //! Defaults to true.
+  static void useLayerIndex(const bool enabled)
+  { ms_doLayerIndex = enabled; }
+
   //! \name Writing layer to disk
   //! \{
 
@@ -705,6 +985,14 @@ public:
     return writeLayer<Data_T>(layer->name, layer->attribute, layer); 
   }
 
+  //! Writes several layers, using their field and attribute names for 
+  //! partition and layer. The blocks of all SparseField layers are 
+  //! compressed together on numIOThreads() threads before the layers are 
+  //! written, in order.
+  //! \returns False if any layer failed to write
+  template <class Data_T>
+  bool writeLayers(const typename Field<Data_T>::Vec &layers);
+
   //! \}
 
   //! \name Backward compatibility
@@ -745,6 +1033,21 @@ public:
     return writeLayer<Data_T>(layer); 
   }
 
+  //! Writes several scalar layers, compressing them together
+  //! \sa writeLayers()
+  template <class Data_T>
+  bool writeScalarLayers(const typename Field<Data_T>::Vec &layers)
+  { 
+    if (m_hdf5) {
+      bool success = true;
+      for (size_t i = 0; i < layers.size(); ++i) {
+        success &= m_hdf5->writeScalarLayer<Data_T>(layers[i]);
+      }
+      return success;
+    }
+    return writeLayers<Data_T>(layers); 
+  }
+
   //! Writes a scalar layer to the "Default" partition.
   template <class Data_T>
   bool writeVectorLayer(const std::string &layerName, 
@@ -780,6 +1083,109 @@ public:
     return writeLayer<FIELD3D_VEC3_T<Data_T> >(layer); 
   }
 
+  //! Writes several vector layers, compressing them together
+  //! \sa writeLayers()
+  template <class Data_T>
+  bool 
+  writeVectorLayers(const typename Field<FIELD3D_VEC3_T<Data_T> >::Vec &layers)
+  { 
+    if (m_hdf5) {
+      bool success = true;
+      for (size_t i = 0; i < layers.size(); ++i) {
+        success &= m_hdf5->writeVectorLayer<Data_T>(layers[i]);
+      }
+      return success;
+    }
+    return writeLayers<FIELD3D_VEC3_T<Data_T> >(layers); 
+  }
+
+  //! \name Streaming layers to disk
+  //! \{
+
+  //! Writes a layer that reads back as a DenseField<Data_T>, without the 
+  //! field ever being in memory. The layout supplies the extents, data 
+  //! window, mapping and metadata. fillSlice(k, slice) is then called for 
+  //! each z slice of the data window, in order, and fills in its voxels with
+  //! x varying fastest. Only one slice is held in memory at a time.
+  //! \note Ogawa files only. Queued background writes are flushed first.
+  template <class Data_T>
+  bool writeDenseLayer(const std::string &partitionName, 
+                       const std::string &layerName,
+                       typename EmptyField<Data_T>::Ptr layout,
+                       const boost::function<void (int, Data_T *)> &fillSlice);
+
+  //! Writes a layer that reads back as a SparseField<Data_T> with the given
+  //! block order, without the field ever being in memory. The layout 
+  //! supplies the extents, data window, mapping and metadata. 
+  //! fillBlock(block, voxels, emptyValue) is then called for each block 
+  //! coordinate, x varying fastest. It either fills in the block's voxels 
+  //! and returns true, or sets emptyValue and returns false to leave the 
+  //! block unallocated. Only one block is held in memory at a time.
+  //! \note Ogawa files only. Queued background writes are flushed first.
+  template <class Data_T>
+  bool writeSparseLayer(const std::string &partitionName, 
+                        const std::string &layerName,
+                        typename EmptyField<Data_T>::Ptr layout,
+                        const int blockOrder,
+                        const boost::function<bool (const V3i &, Data_T *, 
+                                                    Data_T &)> &fillBlock);
+
+  //! \}
+
+  //! \name Copying layers between files
+  //! \{
+
+  //! Copies each layer named layerName in the partitions named 
+  //! partitionName of in, without reading the fields. The field data is 
+  //! copied across byte for byte, so sparse blocks are never decompressed 
+  //! and recompressed. The mapping and metadata are read, so that the layers
+  //! join partitions in this file the same way written layers do.
+  //! \note Ogawa files only. Queued background writes are flushed first.
+  //! \returns False if no layer was found or any layer failed to copy
+  bool copyLayer(const Field3DInputFile &in, const std::string &partitionName,
+                 const std::string &layerName);
+
+  //! \}
+
+  //! \name Background writing
+  //! \{
+
+  //! Sets whether writeLayer() hands layers to a background thread and 
+  //! returns right away. Each layer is copied before it is queued, so the
+  //! caller is free to modify it afterwards. close() waits for queued 
+  //! layers to be written.
+  //! \note While background writes are enabled, call flush() before asking
+  //! the file about its partitions and layers.
+  void setBackgroundWrites(const bool enabled);
+
+  //! Sets how much memory, in MB, the copies of queued layers may use. 
+  //! writeLayer() blocks while the queue is full. A layer larger than the
+  //! limit is queued once the queue has emptied.
+  void setMaxBackgroundMemUse(const float megabytes);
+
+  //! Waits for all queued layers to be written
+  //! \returns False if any of them failed to write since the last flush()
+  bool flush();
+
+  //! \}
+
+  //! \name Sparse brick atlases
+  //! \{
+
+  //! Sets whether writeLayer() also stores a SparseAtlas of each layer 
+  //! that is a SparseField, or of each level of a MIP field of 
+  //! SparseFields, next to the layer's data. GPU readers may then load the
+  //! packed bricks with Field3DInputFile::readSparseAtlases() instead of 
+  //! packing them on every load. Other readers ignore the atlases. 
+  //! Disabled by default.
+  //! \param padding Number of neighboring voxels around each brick
+  //! \note The levels of MIP fields are loaded, or filtered, once more to
+  //! build their atlases.
+  void setWriteSparseAtlases(const bool enabled, const int padding = 1)
+  { m_atlasPadding = enabled ? std::max(padding, 0) : -1; }
+
+  //! \}
+
   //! This routine is call if you want to write out global metadata to disk
   bool writeGlobalMetadata();
 
@@ -799,6 +1205,8 @@ private:
       m_hdf5->closeInternal();
       return;
     }
+    flush();
+    writeLayerIndex();
     cleanup();
   }
 
@@ -817,6 +1225,26 @@ private:
 
   // Convenience methods -------------------------------------------------------
 
+  //! Writes a layer to disk right away. writeLayer() either calls this 
+  //! directly or queues a call to it for the background writer
+  template <class Data_T>
+  bool writeLayerNow(const std::string &partitionName, 
+                     const std::string &layerName, 
+                     typename Field<Data_T>::Ptr layer);
+
+  //! Writes the data of a layer into the layer's group
+  typedef boost::function<bool (OgOGroup &)> WriteDataFunc;
+
+  //! Adds a layer group to the right partition, creating the partition if
+  //! needed, and writes the layer's metadata. The voxels are written by
+  //! writeData. field supplies the partition, mapping and metadata.
+  bool writeLayerGroup(const std::string &partitionName, 
+                       const std::string &layerName, 
+                       FieldRes::Ptr field,
+                       const std::string &className,
+                       const int dataType,
+                       const WriteDataFunc &writeData);
+
   //! Increment the partition or make it zero if there's not an integer suffix
   std::string incrementPartitionName(std::string &pname);
 
@@ -835,10 +1263,16 @@ private:
   //! Writes metadata for this file
   bool writeMetadata(OgOGroup &metadataGroup);
 
+  //! Writes the layer index after the last layer. Called when the file is 
+  //! closed, or destroyed without being closed.
+  bool writeLayerIndex();
+
  // Data members --------------------------------------------------------------
 
   //! Whether to output ogawa files
   static bool ms_doOgawa;
+  //! Whether to write the layer index
+  static bool ms_doLayerIndex;
 
   //! Pointer to the Ogawa archive
   boost::shared_ptr<Alembic::Ogawa::OArchive> m_archive;
@@ -848,6 +1282,15 @@ private:
   //! HDF5 fallback
   boost::shared_ptr<Field3DOutputFileHDF5> m_hdf5;
 
+  //! Thread and queue of background writes. Null unless enabled
+  class BackgroundWriter;
+  boost::shared_ptr<BackgroundWriter> m_backgroundWriter;
+  //! Memory limit of the background write queue, in MB
+  float m_maxBackgroundMemUse;
+  //! Padding of the sparse atlases written with each layer. Negative if 
+  //! none are written
+  int m_atlasPadding;
+
 };
 
 //----------------------------------------------------------------------------//
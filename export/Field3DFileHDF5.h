@@ -49,6 +49,7 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
 #include <list>
 #include <string>
 #include <vector>
@@ -80,11 +81,13 @@ FIELD3D_NAMESPACE_OPEN
 // \{
 
 //! This function creates a FieldIO instance based on className
-//! which then reads the field data from layerGroup location
+//! which then reads the field data from layerGroup location. Only the part
+//! that overlaps voxelWindow is read, unless it is null.
 template <class Data_T>
 typename Field<Data_T>::Ptr 
 readField(const std::string &className, hid_t layerGroup,
-          const std::string &filename, const std::string &layerPath);
+          const std::string &filename, const std::string &layerPath,
+          const Box3i *voxelWindow = NULL);
 
 //! This function creates a FieldIO instance based on field->className()
 //! which then writes the field data in layerGroup location
@@ -470,6 +473,20 @@ public:
   readScalarLayers(const std::string &partitionName, 
                    const std::string &layerName) const;
 
+  //! Retrieves the scalar layers with any of the given names, in file order
+  //! \param layerNames If empty, all layers are read.
+  template <class Data_T>
+  typename Field<Data_T>::Vec
+  readScalarLayers(const std::vector<std::string> &layerNames) const;
+
+  //! Reads the part of each scalar layer that overlaps voxelWindow. 
+  //! DenseFields are read through a hyperslab selection and get the overlap
+  //! as their data window. Other fields are read in full.
+  template <class Data_T>
+  typename Field<Data_T>::Vec
+  readScalarLayers(const std::string &layerName, 
+                   const Box3i &voxelWindow) const;
+
   //! Retrieves all the layers of vector type and maintains their on-disk
   //! data types
   //! \param layerName If a string is passed in, only layers of that name will
@@ -484,6 +501,20 @@ public:
   readVectorLayers(const std::string &partitionName, 
                    const std::string &layerName) const;
 
+  //! Retrieves the vector layers with any of the given names, in file order
+  //! \param layerNames If empty, all layers are read.
+  template <class Data_T>
+  typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
+  readVectorLayers(const std::vector<std::string> &layerNames) const;
+
+  //! Reads the part of each vector layer that overlaps voxelWindow. 
+  //! DenseFields are read through a hyperslab selection and get the overlap
+  //! as their data window. Other fields are read in full.
+  template <class Data_T>
+  typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
+  readVectorLayers(const std::string &layerName, 
+                   const Box3i &voxelWindow) const;
+
   //! Retrieves all layers for all partitions.
   //! Converts it to the given template type if needed
   template <template <typename T> class Field_T, class Data_T>
@@ -714,12 +745,15 @@ private:
                   const std::string &layerName) const;
   
   //! This call does the actual reading of a layer. Notice that it expects
-  //! a unique -internal- partition name.
+  //! a unique -internal- partition name. Only the part of the layer that
+  //! overlaps voxelWindow is read, unless it is null. Windowed reads are 
+  //! never cached.
   template <class Data_T>
   typename Field<Data_T>::Ptr 
   readLayer(const std::string &intPartitionName, 
             const std::string &layerName,
-            bool isVectorLayer) const;
+            bool isVectorLayer,
+            const Box3i *voxelWindow = NULL) const;
 
   //! Sets up all the partitions and layers, but does not load any data
   bool readPartitionAndLayerInfo();
@@ -937,6 +971,40 @@ Field3DInputFileHDF5::readScalarLayers(const std::string &name) const
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+typename Field<Data_T>::Vec
+Field3DInputFileHDF5::readScalarLayers
+(const std::vector<std::string> &layerNames) const
+{
+  using namespace std;
+  
+  typedef typename Field<Data_T>::Ptr FieldPtr;
+  typedef typename Field<Data_T>::Vec FieldList;
+
+  FieldList ret;
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (vector<string>::iterator p = parts.begin(); p != parts.end(); ++p) {
+    std::vector<std::string> layers;
+    getIntScalarLayerNames(layers, *p);
+    for (vector<string>::iterator l = layers.begin(); l != layers.end(); ++l) {
+      // Only read if it matches one of the names
+      if (layerNames.empty() || 
+          find(layerNames.begin(), layerNames.end(), *l) != layerNames.end()) {
+        FieldPtr mf = readScalarLayer<Data_T>(*p, *l);
+        if (mf) {
+          ret.push_back(mf);
+        }
+      }
+    }
+  }
+  
+  return ret;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 typename Field<Data_T>::Vec
 Field3DInputFileHDF5::readScalarLayers(const std::string &partitionName, 
@@ -1008,6 +1076,40 @@ Field3DInputFileHDF5::readVectorLayers(const std::string &name) const
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
+Field3DInputFileHDF5::readVectorLayers
+(const std::vector<std::string> &layerNames) const
+{
+  using namespace std;
+  
+  typedef typename Field<FIELD3D_VEC3_T<Data_T> >::Ptr FieldPtr;
+  typedef typename Field<FIELD3D_VEC3_T<Data_T> >::Vec FieldList;
+  
+  FieldList ret;
+  
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+  
+  for (vector<string>::iterator p = parts.begin(); p != parts.end(); ++p) {
+    std::vector<std::string> layers;
+    getIntVectorLayerNames(layers, *p);
+    for (vector<string>::iterator l = layers.begin(); l != layers.end(); ++l) {
+      // Only read if it matches one of the names
+      if (layerNames.empty() || 
+          find(layerNames.begin(), layerNames.end(), *l) != layerNames.end()) {
+        FieldPtr mf = readVectorLayer<Data_T>(*p, *l);
+        if (mf)
+          ret.push_back(mf);
+      }
+    }
+  }
+  
+  return ret;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
 Field3DInputFileHDF5::readVectorLayers(const std::string &partitionName, 
@@ -1047,11 +1149,79 @@ Field3DInputFileHDF5::readVectorLayers(const std::string &partitionName,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+typename Field<Data_T>::Vec
+Field3DInputFileHDF5::readScalarLayers(const std::string &name,
+                                       const Box3i &voxelWindow) const
+{
+  using namespace std;
+  
+  typedef typename Field<Data_T>::Ptr FieldPtr;
+  typedef typename Field<Data_T>::Vec FieldList;
+
+  FieldList ret;
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (vector<string>::iterator p = parts.begin(); p != parts.end(); ++p) {
+    std::vector<std::string> layers;
+    getIntScalarLayerNames(layers, *p);
+    for (vector<string>::iterator l = layers.begin(); l != layers.end(); ++l) {
+      // Only read if it matches the name
+      if ((name.length() == 0) || (*l == name)) {
+        FieldPtr mf = readLayer<Data_T>(*p, *l, false, &voxelWindow);
+        if (mf) {
+          ret.push_back(mf);
+        }
+      }
+    }
+  }
+  
+  return ret;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename Field<FIELD3D_VEC3_T<Data_T> >::Vec
+Field3DInputFileHDF5::readVectorLayers(const std::string &name,
+                                       const Box3i &voxelWindow) const
+{
+  using namespace std;
+  
+  typedef typename Field<FIELD3D_VEC3_T<Data_T> >::Ptr FieldPtr;
+  typedef typename Field<FIELD3D_VEC3_T<Data_T> >::Vec FieldList;
+  
+  FieldList ret;
+  
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+  
+  for (vector<string>::iterator p = parts.begin(); p != parts.end(); ++p) {
+    std::vector<std::string> layers;
+    getIntVectorLayerNames(layers, *p);
+    for (vector<string>::iterator l = layers.begin(); l != layers.end(); ++l) {
+      // Only read if it matches the name
+      if ((name.length() == 0) || (*l == name)) {
+        FieldPtr mf = 
+          readLayer<FIELD3D_VEC3_T<Data_T> >(*p, *l, true, &voxelWindow);
+        if (mf)
+          ret.push_back(mf);
+      }
+    }
+  }
+  
+  return ret;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 typename Field<Data_T>::Ptr
 Field3DInputFileHDF5::readLayer(const std::string &intPartitionName,
                                 const std::string &layerName,
-                                bool isVectorLayer) const
+                                bool isVectorLayer,
+                                const Box3i *voxelWindow) const
 {
   using namespace boost;
   using namespace std;
@@ -1117,7 +1287,8 @@ Field3DInputFileHDF5::readLayer(const std::string &intPartitionName,
   lock.unlock();
 
   typename Field<Data_T>::Ptr field;
-  field = readField<Data_T>(className, layerGroup.id(), m_filename, layerPath);
+  field = readField<Data_T>(className, layerGroup.id(), m_filename, layerPath,
+                            voxelWindow);
 
   if (!field) {
 #if 0 // This isn't really an error
@@ -1142,8 +1313,9 @@ Field3DInputFileHDF5::readLayer(const std::string &intPartitionName,
   field->attribute = layerName;
   field->setMapping(part->mapping);
 
-  // Cache the field for future use
-  if (field) {
+  // Cache the field for future use. Part of a field must not stand in for
+  // all of it
+  if (field && !voxelWindow) {
     cache.cacheField(field, m_filename, layerPath);
   }
 
@@ -1642,14 +1814,15 @@ Field3DOutputFileHDF5::writeVectorLayer
 template <class Data_T>
 typename Field<Data_T>::Ptr 
 readField(const std::string &className, hid_t layerGroup,
-          const std::string &filename, const std::string &layerPath)
+          const std::string &filename, const std::string &layerPath,
+          const Box3i *voxelWindow)
 {
 
   ClassFactory &factory = ClassFactory::singleton();
   
   typedef typename Field<Data_T>::Ptr FieldPtr;
 
-  FieldIO::Ptr io = factory.createFieldIO(className);
+  FieldIO::Ptr io = factory.sharedFieldIO(className);
   if (!io) {
     Msg::print(Msg::SevWarning, "Unable to find class type: " + 
                className);
@@ -1657,7 +1830,9 @@ readField(const std::string &className, hid_t layerGroup,
   }
 
   DataTypeEnum typeEnum = DataTypeTraits<Data_T>::typeEnum();
-  FieldBase::Ptr field = io->read(layerGroup, filename, layerPath, typeEnum);
+  FieldBase::Ptr field = voxelWindow ? 
+    io->readWindow(layerGroup, filename, layerPath, typeEnum, *voxelWindow) :
+    io->read(layerGroup, filename, layerPath, typeEnum);
 
   if (!field) {
     // We don't need to print a message, because it could just be that
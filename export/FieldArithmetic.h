@@ -0,0 +1,549 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file FieldArithmetic.h
+  \brief Contains block-parallel arithmetic and compositing operations on 
+  dense and sparse fields.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_FieldArithmetic_H_
+#define _INCLUDED_Field3D_FieldArithmetic_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "DenseField.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// FieldOps
+//----------------------------------------------------------------------------//
+
+/*! \namespace FieldOps
+  Operations for use with combineFields() and transformField(). Binary 
+  operations are called as op(dst, src) and unary operations as op(dst). 
+  Vector operations work per component.
+*/
+
+namespace FieldOps {
+
+  //--------------------------------------------------------------------------//
+
+  template <class T>
+  inline T max(const T &a, const T &b)
+  {
+    return a < b ? b : a;
+  }
+
+  template <class T>
+  inline FIELD3D_VEC3_T<T> max(const FIELD3D_VEC3_T<T> &a, 
+                               const FIELD3D_VEC3_T<T> &b)
+  {
+    return FIELD3D_VEC3_T<T>(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
+  }
+
+  template <class T>
+  inline T min(const T &a, const T &b)
+  {
+    return b < a ? b : a;
+  }
+
+  template <class T>
+  inline FIELD3D_VEC3_T<T> min(const FIELD3D_VEC3_T<T> &a, 
+                               const FIELD3D_VEC3_T<T> &b)
+  {
+    return FIELD3D_VEC3_T<T>(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! dst + src
+  struct Add
+  {
+    template <class T>
+    T operator() (const T &a, const T &b) const
+    { return a + b; }
+  };
+
+  //! dst - src
+  struct Sub
+  {
+    template <class T>
+    T operator() (const T &a, const T &b) const
+    { return a - b; }
+  };
+
+  //! dst * src. Multiplies per component for vectors, which is useful for
+  //! masking.
+  struct Mul
+  {
+    template <class T>
+    T operator() (const T &a, const T &b) const
+    { return a * b; }
+  };
+
+  //! Per-component maximum of dst and src
+  struct Max
+  {
+    template <class T>
+    T operator() (const T &a, const T &b) const
+    { return max(a, b); }
+  };
+
+  //! Per-component minimum of dst and src
+  struct Min
+  {
+    template <class T>
+    T operator() (const T &a, const T &b) const
+    { return min(a, b); }
+  };
+
+  //! Linear blend from dst to src by a constant weight
+  struct Lerp
+  {
+    Lerp(const float t)
+      : m_t(t)
+    { }
+    template <class T>
+    T operator() (const T &a, const T &b) const
+    { return static_cast<T>(a + (b - a) * m_t); }
+  private:
+    float m_t;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Multiplies by a constant
+  struct Scale
+  {
+    Scale(const float s)
+      : m_s(s)
+    { }
+    template <class T>
+    T operator() (const T &a) const
+    { return static_cast<T>(a * m_s); }
+  private:
+    float m_s;
+  };
+
+  //! Clamps each component to a constant range
+  template <class Data_T>
+  struct Clamp
+  {
+    Clamp(const Data_T &lo, const Data_T &hi)
+      : m_lo(lo), m_hi(hi)
+    { }
+    Data_T operator() (const Data_T &a) const
+    { return min(max(a, m_lo), m_hi); }
+  private:
+    Data_T m_lo, m_hi;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace FieldOps
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Sets each voxel of dst to op(dst, src). Only the voxels where the data
+//! windows of dst and src overlap are changed; dst keeps its size.
+//! \note Runs on numIOThreads() threads, one block of dst at a time. Where
+//! a dst block is unallocated and the src voxels it overlaps are a single
+//! empty value, the block is updated without allocating it or touching any
+//! voxel memory.
+//! \note dst must not be dynamically loaded.
+template <class Data_T, class Src_T, class Op_T>
+void combineFields(SparseField<Data_T> &dst, const Src_T &src, 
+                   const Op_T &op);
+
+//! Dense version runs one z slice of the overlap at a time
+template <class Data_T, class Src_T, class Op_T>
+void combineFields(DenseField<Data_T> &dst, const Src_T &src, 
+                   const Op_T &op);
+
+//----------------------------------------------------------------------------//
+
+//! Sets each voxel of dst to op(dst). Unallocated blocks only have their
+//! empty value changed.
+//! \note dst must not be dynamically loaded.
+template <class Data_T, class Op_T>
+void transformField(SparseField<Data_T> &dst, const Op_T &op);
+
+//! Dense version runs one z slice at a time
+template <class Data_T, class Op_T>
+void transformField(DenseField<Data_T> &dst, const Op_T &op);
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Applies op to each pair of dst and src values. Kept free of branches
+  //! so that the compiler may vectorize it.
+  template <class Data_T, class Op_T>
+  inline void combineRow(Data_T *dst, const Data_T *src, const int n, 
+                         const Op_T &op)
+  {
+    for (int i = 0; i < n; ++i) {
+      dst[i] = op(dst[i], src[i]);
+    }
+  }
+
+  //! Applies op to each dst value
+  template <class Data_T, class Op_T>
+  inline void transformRow(Data_T *dst, const int n, const Op_T &op)
+  {
+    for (int i = 0; i < n; ++i) {
+      dst[i] = op(dst[i]);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns n src values starting at (i, j, k). Dense rows are contiguous,
+  //! so a pointer into the field is returned.
+  template <class Data_T>
+  inline const Data_T* sourceRow(const DenseField<Data_T> &f, 
+                                 const int i, const int j, const int k, 
+                                 const int /*n*/, 
+                                 std::vector<Data_T> &/*scratch*/)
+  {
+    return f.rowPtr(j, k) + (i - f.dataWindow().min.x);
+  }
+
+  //! Fallback version reads the values into scratch
+  template <class Field_T>
+  inline const typename Field_T::value_type* 
+  sourceRow(const Field_T &f, const int i, const int j, const int k, 
+            const int n, std::vector<typename Field_T::value_type> &scratch)
+  {
+    scratch.resize(n);
+    for (int x = 0; x < n; ++x) {
+      scratch[x] = f.fastValue(i + x, j, k);
+    }
+    return &scratch[0];
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns true if all voxels of region lie in unallocated blocks that 
+  //! share a single empty value, which is returned in value
+  template <class Data_T>
+  bool regionEmptyValue(const SparseField<Data_T> &f, const Box3i &region, 
+                        Data_T &value)
+  {
+    const Box3i dbsBounds = blockCoords(region, &f);
+    bool first = true;
+    for (int k = dbsBounds.min.z; k <= dbsBounds.max.z; ++k) {
+      for (int j = dbsBounds.min.y; j <= dbsBounds.max.y; ++j) {
+        for (int i = dbsBounds.min.x; i <= dbsBounds.max.x; ++i) {
+          if (f.blockIsAllocated(i, j, k)) {
+            return false;
+          }
+          const Data_T emptyValue = f.getBlockEmptyValue(i, j, k);
+          if (first) {
+            value = emptyValue;
+            first = false;
+          } else if (emptyValue != value) {
+            return false;
+          }
+        }
+      }
+    }
+    return !first;
+  }
+
+  //! Fallback version always returns false
+  template <class Field_T, class Data_T>
+  bool regionEmptyValue(const Field_T &/*f*/, const Box3i &/*region*/, 
+                        Data_T &/*value*/)
+  {
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Combines one block of a sparse field with src
+  template <class Data_T, class Src_T, class Op_T>
+  class CombineSparseBlockOp
+  {
+  public:
+    CombineSparseBlockOp(SparseField<Data_T> &dst, const Src_T &src,
+                         const Op_T &op)
+      : m_dst(dst), m_src(src), m_op(op)
+    { }
+    void operator() (const size_t idx)
+    {
+      const Box3i               dw        = m_dst.dataWindow();
+      const int                 order     = m_dst.blockOrder();
+      const Sparse::BlockLayout layout    = m_dst.blockLayout();
+      const V3i                 br        = m_dst.blockRes();
+      const V3i                 blockIdx  = 
+        V3i(idx % br.x, (idx / br.x) % br.y, idx / (br.x * br.y));
+      const V3i                 first     = 
+        dw.min + blockIdx * m_dst.blockSize();
+      const V3i                 size      = 
+        Sparse::validBlockSize(dw.size() + V3i(1), order, blockIdx);
+      const Box3i               region(first, first + size - V3i(1));
+      const Box3i               overlap   = 
+        clipBounds(region, m_src.dataWindow());
+
+      if (overlap.isEmpty()) {
+        return;
+      }
+
+      const bool allocated = 
+        m_dst.blockIsAllocated(blockIdx.x, blockIdx.y, blockIdx.z);
+      const int  n         = overlap.max.x - overlap.min.x + 1;
+
+      // A uniform source region needs no reads
+      Data_T     srcValue;
+      const bool srcIsUniform = regionEmptyValue(m_src, overlap, srcValue);
+      if (srcIsUniform) {
+        if (!allocated) {
+          const Data_T emptyValue = 
+            m_dst.getBlockEmptyValue(blockIdx.x, blockIdx.y, blockIdx.z);
+          const Data_T value = m_op(emptyValue, srcValue);
+          if (value == emptyValue) {
+            return;
+          }
+          if (overlap == region) {
+            m_dst.setBlockEmptyValue(blockIdx.x, blockIdx.y, blockIdx.z, 
+                                     value);
+            return;
+          }
+        }
+        m_uniform.assign(n, srcValue);
+      }
+
+      // Allocate the block if needed and update it directly
+      if (!allocated) {
+        m_dst.fastLValue(first.x, first.y, first.z) = 
+          m_dst.getBlockEmptyValue(blockIdx.x, blockIdx.y, blockIdx.z);
+      }
+      Data_T *p = m_dst.blockData(blockIdx.x, blockIdx.y, blockIdx.z);
+      for (int k = overlap.min.z; k <= overlap.max.z; ++k) {
+        for (int j = overlap.min.y; j <= overlap.max.y; ++j) {
+          const Data_T *s = srcIsUniform ? &m_uniform[0] :
+            sourceRow(m_src, overlap.min.x, j, k, n, m_scratch);
+          if (layout == Sparse::BlockLayoutLinear) {
+            combineRow(p + Sparse::blockIndex(overlap.min.x - first.x, 
+                                              j - first.y, k - first.z, 
+                                              order, layout), 
+                       s, n, m_op);
+          } else {
+            for (int i = 0; i < n; ++i) {
+              Data_T &d = p[Sparse::blockIndex(overlap.min.x + i - first.x,
+                                               j - first.y, k - first.z, 
+                                               order, layout)];
+              d = m_op(d, s[i]);
+            }
+          }
+        }
+      }
+    }
+  private:
+    SparseField<Data_T> &m_dst;
+    const Src_T         &m_src;
+    Op_T                 m_op;
+    //! Per-thread copies of src rows
+    std::vector<Data_T>  m_scratch;
+    //! Per-thread row of a uniform src value
+    std::vector<Data_T>  m_uniform;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Combines one z slice of a dense field with src
+  template <class Data_T, class Src_T, class Op_T>
+  class CombineDenseSliceOp
+  {
+  public:
+    CombineDenseSliceOp(DenseField<Data_T> &dst, const Src_T &src,
+                        const Op_T &op, const Box3i &overlap)
+      : m_dst(dst), m_src(src), m_op(op), m_overlap(overlap)
+    { }
+    void operator() (const size_t idx)
+    {
+      const int k = m_overlap.min.z + static_cast<int>(idx);
+      const int n = m_overlap.max.x - m_overlap.min.x + 1;
+      for (int j = m_overlap.min.y; j <= m_overlap.max.y; ++j) {
+        combineRow(&m_dst.fastLValue(m_overlap.min.x, j, k), 
+                   sourceRow(m_src, m_overlap.min.x, j, k, n, m_scratch), 
+                   n, m_op);
+      }
+    }
+  private:
+    DenseField<Data_T>  &m_dst;
+    const Src_T         &m_src;
+    Op_T                 m_op;
+    const Box3i          m_overlap;
+    //! Per-thread copies of src rows
+    std::vector<Data_T>  m_scratch;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Transforms one block of a sparse field
+  template <class Data_T, class Op_T>
+  class TransformSparseBlockOp
+  {
+  public:
+    TransformSparseBlockOp(SparseField<Data_T> &dst, const Op_T &op)
+      : m_dst(dst), m_op(op)
+    { }
+    void operator() (const size_t idx) const
+    {
+      const V3i br = m_dst.blockRes();
+      const int bi = idx % br.x;
+      const int bj = (idx / br.x) % br.y;
+      const int bk = idx / (br.x * br.y);
+      if (m_dst.blockIsAllocated(bi, bj, bk)) {
+        const int blockSize = m_dst.blockSize();
+        transformRow(m_dst.blockData(bi, bj, bk), 
+                     blockSize * blockSize * blockSize, m_op);
+      } else {
+        m_dst.setBlockEmptyValue(bi, bj, bk, 
+                                 m_op(m_dst.getBlockEmptyValue(bi, bj, bk)));
+      }
+    }
+  private:
+    SparseField<Data_T> &m_dst;
+    Op_T                 m_op;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Transforms one z slice of a dense field
+  template <class Data_T, class Op_T>
+  class TransformDenseSliceOp
+  {
+  public:
+    TransformDenseSliceOp(DenseField<Data_T> &dst, const Op_T &op)
+      : m_dst(dst), m_op(op)
+    { }
+    void operator() (const size_t idx) const
+    {
+      const Box3i dw = m_dst.dataWindow();
+      const int   k  = dw.min.z + static_cast<int>(idx);
+      const int   n  = dw.max.x - dw.min.x + 1;
+      for (int j = dw.min.y; j <= dw.max.y; ++j) {
+        transformRow(m_dst.rowPtr(j, k), n, m_op);
+      }
+    }
+  private:
+    DenseField<Data_T> &m_dst;
+    Op_T                m_op;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Src_T, class Op_T>
+void combineFields(SparseField<Data_T> &dst, const Src_T &src, 
+                   const Op_T &op)
+{
+  const V3i br = dst.blockRes();
+  Sparse::runBlockOp(detail::CombineSparseBlockOp<Data_T, Src_T, Op_T>
+                     (dst, src, op), 
+                     static_cast<size_t>(br.x) * br.y * br.z);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Src_T, class Op_T>
+void combineFields(DenseField<Data_T> &dst, const Src_T &src, 
+                   const Op_T &op)
+{
+  const Box3i overlap = clipBounds(dst.dataWindow(), src.dataWindow());
+  if (overlap.isEmpty()) {
+    return;
+  }
+  Sparse::runBlockOp(detail::CombineDenseSliceOp<Data_T, Src_T, Op_T>
+                     (dst, src, op, overlap), 
+                     overlap.max.z - overlap.min.z + 1);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Op_T>
+void transformField(SparseField<Data_T> &dst, const Op_T &op)
+{
+  const V3i br = dst.blockRes();
+  Sparse::runBlockOp(detail::TransformSparseBlockOp<Data_T, Op_T>(dst, op),
+                     static_cast<size_t>(br.x) * br.y * br.z);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Op_T>
+void transformField(DenseField<Data_T> &dst, const Op_T &op)
+{
+  const Box3i dw = dst.dataWindow();
+  if (dw.isEmpty()) {
+    return;
+  }
+  Sparse::runBlockOp(detail::TransformDenseSliceOp<Data_T, Op_T>(dst, op),
+                     dw.max.z - dw.min.z + 1);
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
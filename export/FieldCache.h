@@ -46,10 +46,17 @@
 
 //----------------------------------------------------------------------------//
 
+#include <list>
+#include <map>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/thread/mutex.hpp>
-#include <boost/foreach.hpp>
 
 #include "Field.h"
+#include "MemoryBudget.h"
+#include "Stats.h"
 
 //----------------------------------------------------------------------------//
 
@@ -69,14 +76,25 @@ FIELD3D_NAMESPACE_OPEN
    in memory. If it is, then readField() returns a pointer rather than 
    reading the data again from disk.
 
-   \note FieldCache does not increment the reference count of cached fields,
-   so objects will be deallocated naturally.
+   The entries are spread over a fixed number of shards, picked by hashing
+   the file name and layer path, and each shard has its own mutex. Threads
+   that read different layers thus rarely wait for each other. Lookups 
+   don't allocate.
+
+   \note By default, FieldCache does not increment the reference count of 
+   cached fields, so objects will be deallocated naturally. Calling 
+   setMaxMemSize() with a non-zero budget makes the cache hold on to the
+   most recently used fields until their memSize() adds up to the budget,
+   so that they can be reused after their last user has released them.
+   Each data type has its own cache, and thus its own budget. The retained
+   fields also count towards the MemoryBudget, which may evict them to make
+   room for other caches.
  */
 
 //----------------------------------------------------------------------------//
 
 template <typename Data_T>
-class FieldCache
+class FieldCache : public MemoryBudgetClient
 {
 public:
 
@@ -85,8 +103,50 @@ public:
   typedef Field<Data_T> Field_T;
   typedef typename Field_T::Ptr FieldPtr;
   typedef typename Field_T::WeakPtr WeakPtr;
-  typedef std::pair<WeakPtr, Field_T*> CacheEntry;
-  typedef std::map<std::string, CacheEntry> Cache;
+  //! A cached field, with its memory use at the time it was cached
+  struct CacheEntry
+  {
+    CacheEntry()
+      : field(NULL), memSize(0)
+    { }
+    WeakPtr weakPtr;
+    Field_T *field;
+    long long int memSize;
+  };
+  //! Maps a layer path to its entry
+  typedef std::map<std::string, CacheEntry> LayerMap;
+  //! Maps a file name to the entries of its layers
+  typedef std::map<std::string, LayerMap> Cache;
+  //! A field held on to by the cache, with its memory use at the time it
+  //! was cached
+  struct RetainedEntry
+  {
+    FieldPtr field;
+    long long int memSize;
+  };
+  //! Retained fields, most recently used first
+  typedef std::list<RetainedEntry> RetainedList;
+  //! Maps a retained field to its place in the list
+  typedef std::map<Field_T*, typename RetainedList::iterator> RetainedMap;
+
+  // Constants -----------------------------------------------------------------
+
+  //! Number of independently locked shards
+  static const size_t k_numShards = 16;
+
+  // Constructors --------------------------------------------------------------
+
+  FieldCache()
+    : m_memSize(0), m_retainedMemSize(0), m_maxMemSize(0)
+  {
+    MemoryBudget::singleton().registerClient(
+      this, MemoryBudget::k_priorityFieldCache);
+  }
+
+  ~FieldCache()
+  {
+    MemoryBudget::singleton().unregisterClient(this);
+  }
 
   // Access to singleton -------------------------------------------------------
 
@@ -103,27 +163,89 @@ public:
   //! Adds the given field to the cache. 
   void cacheField(FieldPtr field, const std::string &filename,
                   const std::string &layerPath);
-  //! Returns the memory use of all currently loaded fields
+  //! Returns the memory use of all currently loaded fields, as recorded 
+  //! when they were cached. This reads a running total without locking,
+  //! so it may be polled from other threads. Fields that have been 
+  //! deallocated are counted until their entries are dropped, which 
+  //! happens when they are looked up, when another field is cached in the
+  //! same shard, or when setMaxMemSize() is called.
   long long int memSize() const;
 
+  // Retention -----------------------------------------------------------------
+
+  //! Sets the total memSize() of the fields that the cache holds on to, 
+  //! evicting the least recently used ones if needed. Fields larger than 
+  //! the budget are never held on to. The default of 0 only tracks fields
+  //! that are in use elsewhere. Also drops the entries of all deallocated
+  //! fields.
+  void setMaxMemSize(const long long int bytes);
+  //! Returns the budget set with setMaxMemSize()
+  long long int maxMemSize() const;
+  //! Returns the memory use of the fields that the cache holds on to
+  long long int retainedMemSize() const;
+
+  // From MemoryBudgetClient ---------------------------------------------------
+
+  //! Returns retainedMemSize()
+  virtual long long int budgetMemUse() const;
+  //! Releases the least recently used retained fields
+  virtual long long int budgetRelease(const long long int bytes);
+
 private:
 
+  // Structs -------------------------------------------------------------------
+
+  //! One independently locked part of the cache
+  struct Shard
+  {
+    //! The entries of the shard
+    Cache cache;
+    //! Mutex to prevent reading from and writing to the shard concurrently
+    boost::mutex mutex;
+  };
+
   // Utility functions --------------------------------------------------------
 
-  //! Constructs the cache key for a given file and layer path.
-  std::string key(const std::string &filename,
-                  const std::string &layerPath);
+  //! Returns the shard that holds the given file and layer path.
+  Shard& shard(const std::string &filename, 
+               const std::string &layerPath) const;
+  //! Removes the entries of a shard whose fields have been deallocated.
+  //! The shard's mutex must be held.
+  //! \returns The memory use recorded for the removed entries
+  static long long int prune(Shard &shard);
+  //! Makes field the most recently used retained field, replacing 
+  //! previous, which was cached under the same key. Evicted fields are 
+  //! moved to evicted, so that they can be deallocated after the retention
+  //! mutex is released.
+  void retain(FieldPtr field, Field_T *previous, 
+              const long long int fieldMemSize, 
+              std::vector<FieldPtr> &evicted);
+  //! Releases the least recently used fields until the retained fields fit
+  //! in the budget. The retention mutex must be held.
+  void evict(std::vector<FieldPtr> &evicted);
 
   // Data members -------------------------------------------------------------
 
-  //! The cache itself. Maps a 'key' to a weak pointer and a raw pointer.
-  Cache m_cache;
+  //! The cache itself. Each shard maps a file name and layer path to a 
+  //! weak pointer and a raw pointer.
+  mutable Shard m_shards[k_numShards];
+  //! Sum of the memory use of the entries of all shards
+  boost::atomic<long long int> m_memSize;
+  //! The fields that the cache holds on to, most recently used first
+  RetainedList m_retained;
+  //! Maps a retained field to its place in m_retained
+  RetainedMap m_retainedMap;
+  //! Sum of the memory use of the retained fields
+  long long int m_retainedMemSize;
+  //! Budget for the retained fields. 0 means no fields are retained. Read
+  //! without the retention mutex, so that lookups only take it when needed
+  boost::atomic<long long int> m_maxMemSize;
+  //! Mutex protecting the retained fields
+  mutable boost::mutex m_retentionMutex;
   //! The singleton instance
   static FieldCache *ms_singleton;
   //! Mutex to prevent multiple allocaation of the singleton
   static boost::mutex ms_creationMutex;
-  //! Mutex to prevent reading from and writing to the cache concurrently.
-  static boost::mutex ms_accessMutex;
 };
 
 //----------------------------------------------------------------------------//
@@ -147,19 +269,45 @@ typename FieldCache<Data_T>::FieldPtr
 FieldCache<Data_T>::getCachedField(const std::string &filename,
                                    const std::string &layerPath)
 {
-  boost::mutex::scoped_lock lock(ms_accessMutex);
-  // First see if the request has ever been processed
-  typename Cache::iterator i = m_cache.find(key(filename, layerPath));
-  if (i == m_cache.end()) {
-    return FieldPtr();
+  FieldPtr result;
+
+  {
+    Shard &s = shard(filename, layerPath);
+    Stats::ScopedLock<boost::mutex> lock(s.mutex, Stats::FieldCacheLockWait);
+    // First see if the request has ever been processed
+    typename Cache::iterator f = s.cache.find(filename);
+    if (f == s.cache.end()) {
+      return FieldPtr();
+    }
+    typename LayerMap::iterator l = f->second.find(layerPath);
+    if (l == f->second.end()) {
+      return FieldPtr();
+    }
+    // Next, check if the weak_ptr is valid. Entries of deallocated fields
+    // are removed
+    CacheEntry &entry = l->second;
+    if (entry.weakPtr.expired()) {
+      m_memSize -= entry.memSize;
+      f->second.erase(l);
+      if (f->second.empty()) {
+        s.cache.erase(f);
+      }
+      return FieldPtr();
+    }
+    result = FieldPtr(entry.field);
   }
-  // Next, check if all weak_ptrs are valid
-  CacheEntry &entry = i->second;
-  WeakPtr weakPtr = entry.first;
-  if (weakPtr.expired()) {
-    return FieldPtr();
+
+  // Retained fields become the most recently used
+  if (m_maxMemSize > 0) {
+    Stats::ScopedLock<boost::mutex> 
+      lock(m_retentionMutex, Stats::FieldCacheLockWait);
+    typename RetainedMap::iterator r = m_retainedMap.find(result.get());
+    if (r != m_retainedMap.end()) {
+      m_retained.splice(m_retained.begin(), m_retained, r->second);
+    }
   }
-  return FieldPtr(entry.second);
+
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -168,9 +316,36 @@ template <typename Data_T>
 void FieldCache<Data_T>::cacheField(FieldPtr field, const std::string &filename,
                                     const std::string &layerPath)
 {
-  boost::mutex::scoped_lock lock(ms_accessMutex);
-  m_cache[key(filename, layerPath)] = 
-    std::make_pair(field->weakPtr(), field.get());
+  // Declared before the locks, so that evicted fields are deallocated 
+  // after they are released
+  std::vector<FieldPtr> evicted;
+
+  // Computed outside the lock, as it may visit the levels of a MIP field
+  const long long int fieldMemSize = field->memSize();
+
+  Field_T *previous = NULL;
+
+  {
+    Shard &s = shard(filename, layerPath);
+    Stats::ScopedLock<boost::mutex> lock(s.mutex, Stats::FieldCacheLockWait);
+    // Since memSize() doesn't visit the shards, the entries of deallocated
+    // fields are dropped as new ones come in
+    m_memSize -= prune(s);
+    CacheEntry &entry = s.cache[filename][layerPath];
+    if (entry.field) {
+      previous = entry.field;
+      m_memSize -= entry.memSize;
+    }
+    entry.weakPtr = field->weakPtr();
+    entry.field   = field.get();
+    entry.memSize = fieldMemSize;
+    m_memSize    += fieldMemSize;
+  }
+
+  if (m_maxMemSize > 0) {
+    retain(field, previous, fieldMemSize, evicted);
+    MemoryBudget::singleton().enforce();
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -178,31 +353,165 @@ void FieldCache<Data_T>::cacheField(FieldPtr field, const std::string &filename,
 template <typename Data_T>
 long long int FieldCache<Data_T>::memSize() const
 {
-  boost::mutex::scoped_lock lock(ms_accessMutex);
+  return m_memSize.load(boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void FieldCache<Data_T>::setMaxMemSize(const long long int bytes)
+{
+  std::vector<FieldPtr> evicted;
 
-  long long int memSize = 0;
+  for (size_t i = 0; i < k_numShards; ++i) {
+    boost::mutex::scoped_lock lock(m_shards[i].mutex);
+    m_memSize -= prune(m_shards[i]);
+  }
+
+  boost::mutex::scoped_lock lock(m_retentionMutex);
+  m_maxMemSize = bytes;
+  evict(evicted);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int FieldCache<Data_T>::maxMemSize() const
+{
+  return m_maxMemSize;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int FieldCache<Data_T>::retainedMemSize() const
+{
+  boost::mutex::scoped_lock lock(m_retentionMutex);
+  return m_retainedMemSize;
+}
 
-  BOOST_FOREACH (const typename Cache::value_type &i, m_cache) {
-    // Check if pointer is valid
-    WeakPtr weakPtr = i.second.first;
-    if (weakPtr.expired()) {
-      continue;
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int FieldCache<Data_T>::budgetMemUse() const
+{
+  return retainedMemSize();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int FieldCache<Data_T>::budgetRelease(const long long int bytes)
+{
+  // Declared before the lock, so that evicted fields are deallocated 
+  // after it is released
+  std::vector<FieldPtr> evicted;
+
+  boost::mutex::scoped_lock lock(m_retentionMutex);
+
+  long long int released = 0;
+  while (!m_retained.empty() && released < bytes) {
+    RetainedEntry &last = m_retained.back();
+    released          += last.memSize;
+    m_retainedMemSize -= last.memSize;
+    evicted.push_back(last.field);
+    m_retainedMap.erase(last.field.get());
+    m_retained.pop_back();
+  }
+
+  return released;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename FieldCache<Data_T>::Shard& 
+FieldCache<Data_T>::shard(const std::string &filename,
+                          const std::string &layerPath) const
+{ 
+  size_t seed = boost::hash_value(filename);
+  boost::hash_combine(seed, layerPath);
+  return m_shards[seed % k_numShards];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int FieldCache<Data_T>::prune(Shard &shard)
+{
+  long long int removed = 0;
+  typename Cache::iterator f = shard.cache.begin();
+  while (f != shard.cache.end()) {
+    typename LayerMap::iterator l = f->second.begin();
+    while (l != f->second.end()) {
+      if (l->second.weakPtr.expired()) {
+        removed += l->second.memSize;
+        f->second.erase(l++);
+      } else {
+        ++l;
+      }
+    }
+    if (f->second.empty()) {
+      shard.cache.erase(f++);
     } else {
-      // If valid, accumulate memory
-      memSize += i.second.second->memSize();
+      ++f;
     }
   }
+  return removed;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void FieldCache<Data_T>::retain(FieldPtr field, Field_T *previous, 
+                                const long long int fieldMemSize,
+                                std::vector<FieldPtr> &evicted)
+{
+  boost::mutex::scoped_lock lock(m_retentionMutex);
+
+  // Release the field previously cached under the same key
+  typename RetainedMap::iterator r = m_retainedMap.find(previous);
+  if (previous && previous != field.get() && r != m_retainedMap.end()) {
+    m_retainedMemSize -= r->second->memSize;
+    evicted.push_back(r->second->field);
+    m_retained.erase(r->second);
+    m_retainedMap.erase(r);
+  }
+
+  // A field that is already retained only becomes the most recently used
+  r = m_retainedMap.find(field.get());
+  if (r != m_retainedMap.end()) {
+    m_retained.splice(m_retained.begin(), m_retained, r->second);
+    return;
+  }
+
+  if (fieldMemSize > m_maxMemSize) {
+    return;
+  }
 
-  return memSize;
+  RetainedEntry entry;
+  entry.field   = field;
+  entry.memSize = fieldMemSize;
+  m_retained.push_front(entry);
+  m_retainedMap[field.get()] = m_retained.begin();
+  m_retainedMemSize += fieldMemSize;
+
+  evict(evicted);
 }
 
 //----------------------------------------------------------------------------//
 
 template <typename Data_T>
-std::string FieldCache<Data_T>::key(const std::string &filename,
-                                    const std::string &layerPath)
-{ 
-  return filename + "/" + layerPath; 
+void FieldCache<Data_T>::evict(std::vector<FieldPtr> &evicted)
+{
+  while (!m_retained.empty() && 
+         (m_maxMemSize <= 0 || m_retainedMemSize > m_maxMemSize)) {
+    RetainedEntry &last = m_retained.back();
+    m_retainedMemSize -= last.memSize;
+    evicted.push_back(last.field);
+    m_retainedMap.erase(last.field.get());
+    m_retained.pop_back();
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,305 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*! \file FieldDispatch.h
+  \brief Contains dispatchField(), which resolves the concrete type of a 
+  field once and hands it to a functor that is instantiated per type.
+
+  Algorithms written against a concrete Field_T call the non-virtual 
+  fastValue() and iterators, which the compiler can inline. A dispatch 
+  functor has a templated call operator, for example:
+
+  \code
+  struct SumOp
+  {
+    SumOp() : sum(0.0) { }
+    template <class Field_T>
+    void operator()(const Field_T &field)
+    { sum = reduceSum(field); }
+    template <class Field_T>
+    void operator()(const MIPField<Field_T> &field)
+    { (*this)(*field.concreteMipLevel(0)); }
+    double sum;
+  };
+
+  SumOp op;
+  if (!dispatchField<float>(field, op)) {
+    // Not one of the known types. Fall back to Field<float>::value()
+  }
+  \endcode
+
+  Overloads for MIPField are picked over the generic operator, since 
+  MIP fields don't have a fastValue() of their own.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_FieldDispatch_H_
+#define _INCLUDED_Field3D_FieldDispatch_H_
+
+#include <vector>
+
+#include <boost/mpl/begin_end.hpp>
+#include <boost/mpl/deref.hpp>
+#include <boost/mpl/next.hpp>
+#include <boost/mpl/vector.hpp>
+
+#include "DenseField.h"
+#include "MIPField.h"
+#include "SparseField.h"
+#include "Traits.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Type lists
+//----------------------------------------------------------------------------//
+
+//! Concrete field types that dispatchField() resolves for a data type, in 
+//! the order they are tried. Subclasses, such as LevelSetField, resolve to
+//! the first type in the list that they derive from.
+template <class Data_T>
+struct DispatchFieldTypes
+{
+  typedef boost::mpl::vector<DenseField<Data_T>, 
+                             SparseField<Data_T>, 
+                             MIPField<DenseField<Data_T> >, 
+                             MIPField<SparseField<Data_T> > > type;
+};
+
+//! Data types that dispatchFieldRes() resolves. These are the ones that
+//! Field3DInputFile reads.
+typedef boost::mpl::vector<half, float, double, V3h, V3f, V3d> 
+DispatchDataTypes;
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Calls op(f) with the field cast to the first type in the mpl sequence 
+//! FieldTypes_T that it is an instance of. 
+//! \returns False if the field is null or of none of the types, in which 
+//! case op isn't called.
+template <class FieldTypes_T, class Op_T>
+bool dispatchFieldAs(const FieldRes::Ptr &field, Op_T &op);
+
+//! Calls op(f) with the field cast to its type in DispatchFieldTypes.
+//! \returns False if the field is null or of none of the types.
+template <class Data_T, class Op_T>
+bool dispatchField(const typename Field<Data_T>::Ptr &field, Op_T &op);
+
+//! Same as dispatchField(), but calls op with the Field<Data_T> base class
+//! when the type isn't resolved. This is the virtual value() path, so op 
+//! must handle Field<Data_T> too.
+//! \returns True if op got the concrete type.
+template <class Data_T, class Op_T>
+bool dispatchFieldOrGeneric(const typename Field<Data_T>::Ptr &field, 
+                            Op_T &op);
+
+//! Calls dispatchField() for each field, e.g. the results of 
+//! Field3DInputFile::readLayers().
+//! \returns The number of fields that op was called for.
+template <class Data_T, class Op_T>
+size_t dispatchFields(const typename Field<Data_T>::Vec &fields, Op_T &op);
+
+//! Resolves both the data type, from DataTypes_T, and the field type, 
+//! from DispatchFieldTypes, for a field of unknown data type.
+//! \returns False if the field is null or of none of the types.
+template <class Op_T>
+bool dispatchFieldRes(const FieldRes::Ptr &field, Op_T &op);
+template <class DataTypes_T, class Op_T>
+bool dispatchFieldRes(const FieldRes::Ptr &field, Op_T &op);
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Tries each field type in [Iter_T, End_T) in turn
+  template <class Iter_T, class End_T>
+  struct DispatchFieldType
+  {
+    template <class Op_T>
+    static bool apply(FieldRes &field, Op_T &op)
+    {
+      typedef typename boost::mpl::deref<Iter_T>::type Field_T;
+      typedef typename boost::mpl::next<Iter_T>::type  Next_T;
+      if (field.checkTypeId(staticTypeId<Field_T>())) {
+        op(static_cast<Field_T&>(field));
+        return true;
+      }
+      return DispatchFieldType<Next_T, End_T>::apply(field, op);
+    }
+  };
+
+  //--------------------------------------------------------------------------//
+
+  template <class End_T>
+  struct DispatchFieldType<End_T, End_T>
+  {
+    template <class Op_T>
+    static bool apply(FieldRes &, Op_T &)
+    { return false; }
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Tries the field types of each data type in [Iter_T, End_T) in turn
+  template <class Iter_T, class End_T>
+  struct DispatchDataType
+  {
+    template <class Op_T>
+    static bool apply(FieldRes &field, Op_T &op)
+    {
+      typedef typename boost::mpl::deref<Iter_T>::type          Data_T;
+      typedef typename boost::mpl::next<Iter_T>::type           Next_T;
+      typedef typename DispatchFieldTypes<Data_T>::type         Types;
+      typedef typename boost::mpl::begin<Types>::type           Begin;
+      typedef typename boost::mpl::end<Types>::type             End;
+      // Checking the data type first skips the field types of the others
+      if (field.checkTypeId(staticTypeId<Field<Data_T> >())) {
+        return DispatchFieldType<Begin, End>::apply(field, op);
+      }
+      return DispatchDataType<Next_T, End_T>::apply(field, op);
+    }
+  };
+
+  //--------------------------------------------------------------------------//
+
+  template <class End_T>
+  struct DispatchDataType<End_T, End_T>
+  {
+    template <class Op_T>
+    static bool apply(FieldRes &, Op_T &)
+    { return false; }
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+template <class FieldTypes_T, class Op_T>
+bool dispatchFieldAs(const FieldRes::Ptr &field, Op_T &op)
+{
+  typedef typename boost::mpl::begin<FieldTypes_T>::type Begin;
+  typedef typename boost::mpl::end<FieldTypes_T>::type   End;
+
+  if (!field) {
+    return false;
+  }
+  return detail::DispatchFieldType<Begin, End>::apply(*field, op);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Op_T>
+bool dispatchField(const typename Field<Data_T>::Ptr &field, Op_T &op)
+{
+  typedef typename DispatchFieldTypes<Data_T>::type Types;
+  return dispatchFieldAs<Types>(field, op);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Op_T>
+bool dispatchFieldOrGeneric(const typename Field<Data_T>::Ptr &field, 
+                            Op_T &op)
+{
+  if (!field) {
+    return false;
+  }
+  if (dispatchField<Data_T>(field, op)) {
+    return true;
+  }
+  op(static_cast<Field<Data_T>&>(*field));
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Op_T>
+size_t dispatchFields(const typename Field<Data_T>::Vec &fields, Op_T &op)
+{
+  size_t numDispatched = 0;
+  for (size_t i = 0, end = fields.size(); i < end; ++i) {
+    if (dispatchField<Data_T>(fields[i], op)) {
+      numDispatched++;
+    }
+  }
+  return numDispatched;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Op_T>
+bool dispatchFieldRes(const FieldRes::Ptr &field, Op_T &op)
+{
+  return dispatchFieldRes<DispatchDataTypes>(field, op);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class DataTypes_T, class Op_T>
+bool dispatchFieldRes(const FieldRes::Ptr &field, Op_T &op)
+{
+  typedef typename boost::mpl::begin<DataTypes_T>::type Begin;
+  typedef typename boost::mpl::end<DataTypes_T>::type   End;
+
+  if (!field) {
+    return false;
+  }
+  return detail::DispatchDataType<Begin, End>::apply(*field, op);
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -5,10 +5,16 @@
 
 //------------------------------------------------------------------------------
 
+// System includes
+#include <cmath>
+#include <limits>
+
 // Boost includes
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/mpl/vector.hpp>
 #include <boost/mpl/for_each.hpp>
 #include <boost/mpl/placeholders.hpp>
@@ -20,13 +26,16 @@
 #include <boost/fusion/include/as_vector.hpp>
 
 // Field3D includes
+#include "BoundsBVH.h"
 #include "DenseField.h"
+#include "ExprField.h"
 #include "Field3DFile.h"
 #include "FieldInterp.h"
 #include "InitIO.h"
 #include "MIPField.h"
 #include "MIPUtil.h"
 #include "SparseField.h"
+#include "ThreadPool.h"
 #include "MinMaxUtil.h"
 
 // Project includes
@@ -81,6 +90,15 @@ struct MakeSparse
 
 //------------------------------------------------------------------------------
 
+//! MPL utility
+template <typename T>
+struct MakeExpr
+{
+  typedef typename FieldWrapper<Field3D::ExprField<T> >::Vec type;
+};
+
+//------------------------------------------------------------------------------
+
 //! MPL utility
 template <typename T>
 struct MakeMIPDense
@@ -207,6 +225,61 @@ struct LoadFields<3>
 
 //----------------------------------------------------------------------------//
 
+//! Reads the fields of a set of files, one file at a time per thread. Each
+//! file's fields go into its own slot of the result vectors, so that the 
+//! order of the fields doesn't depend on thread timing.
+template <typename BaseTypeList_T, int Dims_T>
+struct LoadFilesOp
+{
+  // Ctor
+  LoadFilesOp(const std::vector<std::string>         &filenames,
+              const std::string                      &attribute,
+              std::vector<Field3D::FieldRes::Vec>    &results,
+              std::vector<Field3D::FieldRes::Vec>    &minResults,
+              std::vector<Field3D::FieldRes::Vec>    &maxResults,
+              std::vector<char>                      &opened,
+              boost::atomic<size_t>                  &nextIdx)
+    : m_filenames(filenames),
+      m_attribute(attribute),
+      m_results(results),
+      m_minResults(minResults),
+      m_maxResults(maxResults),
+      m_opened(opened),
+      m_nextIdx(nextIdx)
+  { }
+  // Functor
+  void operator()()
+  {
+    size_t idx;
+    while ((idx = m_nextIdx++) < m_filenames.size()) {
+      Field3D::Field3DInputFile in;
+      if (!in.open(m_filenames[idx])) {
+        continue;
+      }
+      m_opened[idx] = 1;
+      // Use partition names to determine if fields should be loaded
+      std::vector<std::string> names;
+      in.getPartitionNames(names);
+      BOOST_FOREACH (const std::string &name, names) {
+        LoadFieldsParams params(in, name, m_attribute, m_results[idx], 
+                                m_minResults[idx], m_maxResults[idx]);
+        LoadFields<Dims_T> op(params);
+        mpl::for_each<BaseTypeList_T>(op);
+      }
+    }
+  }
+  // Data members
+  const std::vector<std::string>      &m_filenames;
+  const std::string                   &m_attribute;
+  std::vector<Field3D::FieldRes::Vec> &m_results;
+  std::vector<Field3D::FieldRes::Vec> &m_minResults;
+  std::vector<Field3D::FieldRes::Vec> &m_maxResults;
+  std::vector<char>                   &m_opened;
+  boost::atomic<size_t>               &m_nextIdx;
+};
+
+//----------------------------------------------------------------------------//
+
 inline std::vector<V3d> 
 cornerPoints(const Box3d &box)
 {
@@ -277,6 +350,95 @@ intersect(const Ray3d &ray, const Box3d &box, double &outT0, double &outT1)
 
 //------------------------------------------------------------------------------
 
+//! World space bounds of a wrapped field, object transform included
+template <typename Wrapper_T>
+Box3d wrapperWsBounds(const Wrapper_T &wrapper)
+{
+  Box3d wsBounds;
+  // Pointer to mapping
+  const FieldMapping* mapping = wrapper.mapping;
+  if (mapping) {
+    // Corner vertices in local space
+    std::vector<V3d> lsP = unitCornerPoints();
+    // Transform to world space and pad resulting bounds
+    for (size_t i = 0; i < 8; ++i) {
+      V3d wsP;
+      if (wrapper.doOsToWs) {
+        V3d osP;
+        mapping->localToWorld(lsP[i], osP);
+        wrapper.osToWs.multVecMatrix(osP, wsP);
+      } else {
+        mapping->localToWorld(lsP[i], wsP);
+      }
+      wsBounds.extendBy(wsP);
+    }
+  }
+  return wsBounds;
+}
+
+//------------------------------------------------------------------------------
+
+//! Steps through the members of a FieldGroup that a BoundsBVH query 
+//! selected. Members are numbered in the order the group visits its 
+//! wrapper vectors, so each vector covers the next size() numbers.
+class MemberSelection
+{
+public:
+  MemberSelection(const BoundsBVH::IndexVec &hits)
+    : m_hits(hits), m_pos(0), m_offset(0)
+  { }
+  //! Moves past the next vector, of n members. 
+  //! \returns The number of its members that were selected. Their 
+  //! indices within the vector are indices[i] - offset.
+  size_t next(const size_t n, const size_t *&indices, size_t &offset)
+  {
+    const size_t end  = m_offset + n;
+    size_t       last = m_pos;
+    while (last < m_hits.size() && m_hits[last] < end) {
+      ++last;
+    }
+    indices = m_hits.empty() ? NULL : &m_hits[0] + m_pos;
+    offset  = m_offset;
+    const size_t count = last - m_pos;
+    m_pos    = last;
+    m_offset = end;
+    return count;
+  }
+  //! Moves past the next n members without visiting them
+  void skip(const size_t n)
+  {
+    const size_t *indices;
+    size_t        offset;
+    next(n, indices, offset);
+  }
+private:
+  const BoundsBVH::IndexVec &m_hits;
+  size_t                     m_pos;
+  size_t                     m_offset;
+};
+
+//------------------------------------------------------------------------------
+
+//! Updates the world space step length at ray parameter t with the 
+//! intervals that contain t, never going below the ray footprint. Also 
+//! pulls tNext in to the start of the next interval after t, so that a 
+//! march doesn't step past it.
+inline void intervalStep(const IntervalVec &intervals, const double t,
+                         const double wsFootprint, double &wsStep, 
+                         double &tNext)
+{
+  for (size_t i = 0, end = intervals.size(); i < end; ++i) {
+    const Interval &iv = intervals[i];
+    if (t >= iv.t0 && t < iv.t1) {
+      wsStep = std::min(wsStep, std::max(iv.stepLength, wsFootprint));
+    } else if (iv.t0 > t) {
+      tNext = std::min(tNext, iv.t0);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace detail
 
 //------------------------------------------------------------------------------
@@ -314,6 +476,9 @@ struct FieldGroup
   typedef typename mpl::transform<
     MPLBaseTypes, 
     detail::MakeSparse<ph::_1> >::type    MPLSparseTypes;
+  typedef typename mpl::transform<
+    MPLBaseTypes, 
+    detail::MakeExpr<ph::_1> >::type      MPLExprTypes;
   typedef typename mpl::transform<
     MPLBaseTypes, 
     detail::MakeMIPDense<ph::_1> >::type  MPLMIPDenseTypes;
@@ -324,6 +489,7 @@ struct FieldGroup
   // Map MPL types to boost fusion types
   typedef typename fusion_ro::as_vector<MPLDenseTypes>::type     DenseTypes;
   typedef typename fusion_ro::as_vector<MPLSparseTypes>::type    SparseTypes;
+  typedef typename fusion_ro::as_vector<MPLExprTypes>::type      ExprTypes;
   typedef typename fusion_ro::as_vector<MPLMIPDenseTypes>::type  MIPDenseTypes;
   typedef typename fusion_ro::as_vector<MPLMIPSparseTypes>::type MIPSparseTypes;
 
@@ -364,6 +530,12 @@ struct FieldGroup
   //! remapping takes place.
   //! \note It is ok to pass in a null pointer to disable value remapping.
   void setValueRemapOp(ValueRemapOp::Ptr op);
+  //! Enables a bounding volume hierarchy over the world space bounds of 
+  //! the group's fields, used by sample(), intersects() and 
+  //! getIntersections() to only visit the fields near the lookup. Worth it
+  //! for groups of many fields, e.g. when instancing through setOsToWs().
+  //! The hierarchy is rebuilt by each setup() call. Disabled by default.
+  void setUseBVH(const bool useBVH);
   //! Adds a single field to the group
   virtual void setup(const Field3D::FieldRes::Ptr field);
   //! Initializes the FieldGroup from a set of fields.
@@ -377,6 +549,16 @@ struct FieldGroup
   //! \returns Number of fields loaded, or a negative number if 
   //! the file failed to open.
   int load(const std::string &filename, const std::string &attribute);
+  //! Loads all fields from a set of files and optional attribute pattern,
+  //! reading up to numThreads files at a time. The fields are added in the
+  //! order of the filenames.
+  //! \note Sparse fields are read according to SparseFileManager's dynamic
+  //! loading setting, so with it enabled only the block layout is read up
+  //! front and the voxel data is paged in by the first lookups.
+  //! \returns Number of fields loaded, or a negative number if any of 
+  //! the files failed to open, in which case no fields are added.
+  int load(const std::vector<std::string> &filenames, 
+           const std::string &attribute, const size_t numThreads);
   //! Make min/max representations of the fields in the group
   void makeMinMax(const float resMult);
   //! The number of fields in the group
@@ -400,12 +582,34 @@ struct FieldGroup
   //! Samples all the MIP fields in the group.
   void sampleMIPMultiple(const size_t n, const float *wsP, const float *wsSpotSize, 
                          float *result) const;
+  //! Integrates the group's fields along the ray between t0 and t1, e.g.
+  //! to compute optical depth, and adds the result to result. The ray is
+  //! treated as a cone of the given full angle (radians), whose footprint
+  //! at each sample is used as the spot size of the MIP fields. The step
+  //! length is stepMult times the voxel size of the finest level in use
+  //! at the current position: the voxel size of ordinary fields, and the 
+  //! larger of the footprint and the finest voxel size for MIP fields. 
+  //! Far away parts of the ray are thus marched through coarser data 
+  //! with fewer lookups, and gaps between fields are skipped.
+  void integrate(const Ray3d &wsRay, const double t0, const double t1,
+                 const float coneAngle, const float stepMult, 
+                 float *result) const;
   //! Returns the bounds of the group
   Box3d wsBounds() const;
   //! Whether the given point intersects any of the fields in the FieldGroup
   bool intersects(const V3d &wsP) const;
   //! Gets the intersection intervals between the ray and the fields
   bool getIntersections(const Ray3d &ray, IntervalVec &intervals) const;
+  //! Queues background loads for the blocks of dynamically loaded sparse
+  //! fields that a ray march along [t0,t1] of the ray will pass through,
+  //! in march order. Call it for the next segment while shading the 
+  //! current one to hide the decompression latency.
+  //! \note MIP fields are not prefetched, since the level that will be
+  //! used depends on the spot size.
+  void prefetch(const Ray3d &wsRay, const double t0, const double t1) const;
+  //! Prefetches along each of the intervals, as returned by 
+  //! getIntersections()
+  void prefetch(const Ray3d &wsRay, const IntervalVec &intervals) const;
   //! Returns the min/max range within a given bounding box.
   void getMinMax(const Box3d &wsBounds, float *min, float *max) const;
   //! Whether the FieldGroup has a pre-filtered min/max representation
@@ -424,11 +628,18 @@ protected:
   //! Set up the min/max MIP representations
   void setupMinMax(const FieldRes::Vec &minFields,
                    const FieldRes::Vec &maxFields);
+  //! Rebuilds m_bvh over the fields in the group
+  void buildBVH();
+  //! Samples all the fields in the group, MIP fields with the given spot
+  //! size, adding to result
+  void sampleAll(const V3d &wsP, const float wsSpotSize, float *result,
+                 size_t &numHits) const;
 
   // Data members --------------------------------------------------------------
   
   DenseTypes     m_dense;
   SparseTypes    m_sparse;
+  ExprTypes      m_expr;
   MIPDenseTypes  m_mipDense, m_mipDenseMin, m_mipDenseMax;
   MIPSparseTypes m_mipSparse, m_mipSparseMin, m_mipSparseMax;
 
@@ -444,6 +655,12 @@ protected:
   //! Current value remap op. Defaults to null pointer
   ValueRemapOp::Ptr m_valueRemapOp;
 
+  //! Whether lookups go through m_bvh
+  bool m_useBVH;
+  //! Hierarchy over the world space bounds of the fields in m_dense, 
+  //! m_sparse, m_expr, m_mipDense and m_mipSparse, numbered in that order
+  BoundsBVH m_bvh;
+
   //! Stores all the fields owned by the FieldGroup
   FieldRes::Vec  m_allFields;
   //! Stores all the auxiliary fields owned by the FieldGroup
@@ -461,7 +678,9 @@ protected:
   struct SampleMultiple;
   struct SampleMIPMultiple;
   struct GetWsBounds;
+  struct GetMemberWsBounds;
   struct GetIntersections;
+  struct Prefetch;
   struct GetMinMax;
   struct GetMinMaxMIP;
   struct GetMinMaxPrefilt;
@@ -481,7 +700,8 @@ typedef FieldGroup<VectorTypes, 3> VectorFieldGroup;
 
 template <typename BaseTypeList_T, int Dims_T>
 FieldGroup<BaseTypeList_T, Dims_T>::FieldGroup()
-  : m_hasPrefiltMinMax(false), m_doWsBoundsOptimization(false)
+  : m_hasPrefiltMinMax(false), m_doWsBoundsOptimization(false), 
+    m_useBVH(false)
 { }
 
 //------------------------------------------------------------------------------
@@ -489,7 +709,8 @@ FieldGroup<BaseTypeList_T, Dims_T>::FieldGroup()
 template <typename BaseTypeList_T, int Dims_T>
 FieldGroup<BaseTypeList_T, Dims_T>::FieldGroup
 (const Field3D::FieldRes::Vec &fields)
-  : m_hasPrefiltMinMax(false), m_doWsBoundsOptimization(false)
+  : m_hasPrefiltMinMax(false), m_doWsBoundsOptimization(false), 
+    m_useBVH(false)
 {
   // Perform setup
   setup(fields);
@@ -517,6 +738,7 @@ FieldGroup<BaseTypeList_T, Dims_T>::setWsBoundsOptimization(const bool doWsBound
 
     fusion::for_each(m_dense, op);
     fusion::for_each(m_sparse, op);
+    fusion::for_each(m_expr, op);
     fusion::for_each(m_mipDense, op);
     fusion::for_each(m_mipSparse, op);
   }
@@ -533,6 +755,36 @@ FieldGroup<BaseTypeList_T, Dims_T>::setValueRemapOp(ValueRemapOp::Ptr op)
 
 //------------------------------------------------------------------------------
 
+template <typename BaseTypeList_T, int Dims_T>
+void 
+FieldGroup<BaseTypeList_T, Dims_T>::setUseBVH(const bool useBVH)
+{
+  m_useBVH = useBVH;
+  if (m_useBVH) {
+    buildBVH();
+  } else {
+    m_bvh.clear();
+  }
+}
+
+//------------------------------------------------------------------------------
+
+template <typename BaseTypeList_T, int Dims_T>
+void 
+FieldGroup<BaseTypeList_T, Dims_T>::buildBVH()
+{
+  std::vector<Box3d> bounds;
+  GetMemberWsBounds op(bounds);
+  fusion::for_each(m_dense, op);
+  fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
+  fusion::for_each(m_mipDense, op);
+  fusion::for_each(m_mipSparse, op);
+  m_bvh.build(bounds);
+}
+
+//------------------------------------------------------------------------------
+
 template <typename BaseTypeList_T, int Dims_T>
 void 
 FieldGroup<BaseTypeList_T, Dims_T>::setup(const Field3D::FieldRes::Ptr field)
@@ -571,10 +823,16 @@ FieldGroup<BaseTypeList_T, Dims_T>::setup
     GrabFields op(fields[i], m_osToWs, m_valueRemapOp, m_doWsBoundsOptimization);
     fusion::for_each(m_dense, op);
     fusion::for_each(m_sparse, op);
+    fusion::for_each(m_expr, op);
     fusion::for_each(m_mipDense, op);
     fusion::for_each(m_mipSparse, op);
   }
 
+  // Index the fields
+  if (m_useBVH) {
+    buildBVH();
+  }
+
   // Pick out min/max fields
   setupMinMax(minFields, maxFields);
 }
@@ -618,40 +876,59 @@ template <typename BaseTypeList_T, int Dims_T>
 int
 FieldGroup<BaseTypeList_T, Dims_T>::load
 (const std::string &filename, const std::string &attribute)
+{
+  std::vector<std::string> filenames;
+  filenames.push_back(filename);
+
+  return load(filenames, attribute, Field3D::numIOThreads());
+}
+
+//------------------------------------------------------------------------------
+
+template <typename BaseTypeList_T, int Dims_T>
+int
+FieldGroup<BaseTypeList_T, Dims_T>::load
+(const std::vector<std::string> &filenames, const std::string &attribute,
+ const size_t numThreads)
 {
   using namespace Field3D;
 
-  // Storage for the primary fields
-  FieldRes::Vec results;
-  // Storage for the auxiliary fields
-  FieldRes::Vec minResults, maxResults;
+  typedef detail::LoadFilesOp<BaseTypeList_T, Dims_T> Op;
+
+  // Storage for the fields of each file
+  const size_t numFiles = filenames.size();
+  std::vector<FieldRes::Vec> fileResults(numFiles);
+  std::vector<FieldRes::Vec> fileMinResults(numFiles), fileMaxResults(numFiles);
+  std::vector<char>          opened(numFiles, 0);
 
   // Track number of fields in group before loading.
   const size_t sizeBeforeLoading = size();
 
-  // Open each file ---
+  // Read the files on the shared threads. A single thread reads them 
+  // itself ---
 
-  std::vector<std::string> filenames;
-  filenames.push_back(filename);
+  boost::atomic<size_t> nextIdx(0);
+  const Op op(filenames, attribute, fileResults, fileMinResults, 
+              fileMaxResults, opened, nextIdx);
+  runOnThreads(op, std::min(numThreads, numFiles));
 
-  BOOST_FOREACH (const std::string fn, filenames) {
+  // Gather the fields in file order ---
 
-    Field3DInputFile in;
-    if (!in.open(fn)) {
-      return k_missingFile;
-    }
-
-    // Use partition names to determine if fields should be loaded
-    std::vector<std::string> names;
-    in.getPartitionNames(names);
+  // Storage for the primary fields
+  FieldRes::Vec results;
+  // Storage for the auxiliary fields
+  FieldRes::Vec minResults, maxResults;
 
-    BOOST_FOREACH (const std::string &name, names) {
-      detail::LoadFieldsParams params(in, name, attribute, results, 
-                                      minResults, maxResults);
-      detail::LoadFields<Dims_T> op(params);
-      mpl::for_each<BaseTypeList_T>(op);
+  for (size_t i = 0; i < numFiles; ++i) {
+    if (!opened[i]) {
+      return k_missingFile;
     }
-
+    results.insert(results.end(), 
+                   fileResults[i].begin(), fileResults[i].end());
+    minResults.insert(minResults.end(), 
+                      fileMinResults[i].begin(), fileMinResults[i].end());
+    maxResults.insert(maxResults.end(), 
+                      fileMaxResults[i].begin(), fileMaxResults[i].end());
   }
 
   // Set up from fields
@@ -671,6 +948,7 @@ FieldGroup<BaseTypeList_T, Dims_T>::makeMinMax
   // Storage for the auxiliary fields
   FieldRes::Vec minFields, maxFields;
 
+  // Expression fields are left out, and always evaluated
   MakeMinMax op(minFields, maxFields, resMult);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
@@ -691,6 +969,7 @@ FieldGroup<BaseTypeList_T, Dims_T>::size() const
   CountFields op;
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
   return op.count;
@@ -712,23 +991,45 @@ FieldGroup<BaseTypeList_T, Dims_T>::sizeMIP() const
 
 template <typename BaseTypeList_T, int Dims_T>
 void 
-FieldGroup<BaseTypeList_T, Dims_T>::sample(const V3d &wsP, 
-                                           const float wsSpotSize, 
-                                           const float /* time */,
-                                           float *result, 
-                                           const CompositeOp compOp)
+FieldGroup<BaseTypeList_T, Dims_T>::sampleAll(const V3d &wsP, 
+                                              const float wsSpotSize, 
+                                              float *result,
+                                              size_t &numHits) const
 {
-  size_t numHits = 0;
+  // Narrow down the fields to visit
+  BoundsBVH::IndexVec      hits;
+  detail::MemberSelection  bvhSelection(hits);
+  detail::MemberSelection *selection = NULL;
+  if (m_useBVH) {
+    m_bvh.findPoint(wsP, hits);
+    selection = &bvhSelection;
+  }
 
   // Handle ordinary fields
-  Sample op(wsP, result, numHits);
+  Sample op(wsP, result, numHits, selection);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
 
   // Handle MIP fields
-  SampleMIP mipOp(wsP, wsSpotSize, result, numHits);
+  SampleMIP mipOp(wsP, wsSpotSize, result, numHits, selection);
   fusion::for_each(m_mipDense, mipOp);
   fusion::for_each(m_mipSparse, mipOp);
+}
+
+//------------------------------------------------------------------------------
+
+template <typename BaseTypeList_T, int Dims_T>
+void 
+FieldGroup<BaseTypeList_T, Dims_T>::sample(const V3d &wsP, 
+                                           const float wsSpotSize, 
+                                           const float /* time */,
+                                           float *result, 
+                                           const CompositeOp compOp)
+{
+  size_t numHits = 0;
+
+  sampleAll(wsP, wsSpotSize, result, numHits);
 
   // Check composite op
   if (compOp == Add) {
@@ -752,9 +1053,19 @@ FieldGroup<BaseTypeList_T, Dims_T>::sample(const V3d &vsP,
 {
   size_t numHits = 0;
 
-  Sample op(vsP, result, numHits);
+  // Narrow down the fields to visit
+  BoundsBVH::IndexVec      hits;
+  detail::MemberSelection  bvhSelection(hits);
+  detail::MemberSelection *selection = NULL;
+  if (m_useBVH) {
+    m_bvh.findPoint(vsP, hits);
+    selection = &bvhSelection;
+  }
+
+  Sample op(vsP, result, numHits, selection);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
 }
 
 //------------------------------------------------------------------------------
@@ -765,11 +1076,12 @@ FieldGroup<BaseTypeList_T, Dims_T>::sampleMultiple(const size_t n,
                                                    const float *wsP,
                                                    float *result) const
 {
-  size_t numHits = 0;
+  std::vector<size_t> numHits(n, 0);
 
-  SampleMultiple op(n, wsP, result, numHits);
+  SampleMultiple op(n, wsP, result, n > 0 ? &numHits[0] : NULL);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
 }
 
 //------------------------------------------------------------------------------
@@ -783,7 +1095,21 @@ FieldGroup<BaseTypeList_T, Dims_T>::sampleMIP(const V3d &vsP,
 {
   size_t numHits = 0;
 
-  SampleMIP op(vsP, wsSpotSize, result, numHits);
+  // Narrow down the fields to visit. The ordinary fields come first
+  BoundsBVH::IndexVec      hits;
+  detail::MemberSelection  bvhSelection(hits);
+  detail::MemberSelection *selection = NULL;
+  if (m_useBVH) {
+    m_bvh.findPoint(vsP, hits);
+    CountFields countOp;
+    fusion::for_each(m_dense, countOp);
+    fusion::for_each(m_sparse, countOp);
+    fusion::for_each(m_expr, countOp);
+    bvhSelection.skip(countOp.count);
+    selection = &bvhSelection;
+  }
+
+  SampleMIP op(vsP, wsSpotSize, result, numHits, selection);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
 }
@@ -797,9 +1123,10 @@ FieldGroup<BaseTypeList_T, Dims_T>::sampleMIPMultiple(const size_t n,
                                                       const float *wsSpotSize, 
                                                       float *result) const
 {
-  size_t numHits = 0;
+  std::vector<size_t> numHits(n, 0);
 
-  SampleMIPMultiple op(n, wsP, wsSpotSize, result, numHits);
+  SampleMIPMultiple op(n, wsP, wsSpotSize, result, 
+                       n > 0 ? &numHits[0] : NULL);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
 }
@@ -814,6 +1141,7 @@ FieldGroup<BaseTypeList_T, Dims_T>::wsBounds() const
   GetWsBounds op(wsBounds);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
   return wsBounds;
@@ -825,9 +1153,22 @@ template <typename BaseTypeList_T, int Dims_T>
 bool
 FieldGroup<BaseTypeList_T, Dims_T>::intersects(const V3d &wsP) const
 {
-  PointIsect op(wsP);
+  // Narrow down the fields to visit
+  BoundsBVH::IndexVec      hits;
+  detail::MemberSelection  bvhSelection(hits);
+  detail::MemberSelection *selection = NULL;
+  if (m_useBVH) {
+    m_bvh.findPoint(wsP, hits);
+    if (hits.empty()) {
+      return false;
+    }
+    selection = &bvhSelection;
+  }
+
+  PointIsect op(wsP, selection);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
   return op.result();
@@ -840,9 +1181,19 @@ bool
 FieldGroup<BaseTypeList_T, Dims_T>::getIntersections
 (const Ray3d &ray, IntervalVec &intervals) const
 {
-  GetIntersections op(ray, intervals);
+  // Narrow down the fields to visit
+  BoundsBVH::IndexVec      hits;
+  detail::MemberSelection  bvhSelection(hits);
+  detail::MemberSelection *selection = NULL;
+  if (m_useBVH) {
+    m_bvh.findRay(ray, hits);
+    selection = &bvhSelection;
+  }
+
+  GetIntersections op(ray, intervals, selection);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
   return intervals.size() > 0;
@@ -850,6 +1201,98 @@ FieldGroup<BaseTypeList_T, Dims_T>::getIntersections
 
 //------------------------------------------------------------------------------
 
+template <typename BaseTypeList_T, int Dims_T>
+void 
+FieldGroup<BaseTypeList_T, Dims_T>::integrate
+(const Ray3d &wsRay, const double t0, const double t1, 
+ const float coneAngle, const float stepMult, float *result) const
+{
+  const double dirLength = wsRay.dir.length();
+  if (dirLength == 0.0 || t1 <= t0 || stepMult <= 0.0f) {
+    return;
+  }
+
+  // Narrow down the fields to visit
+  BoundsBVH::IndexVec      hits;
+  detail::MemberSelection  bvhSelection(hits);
+  detail::MemberSelection *selection = NULL;
+  if (m_useBVH) {
+    m_bvh.findRay(wsRay, hits);
+    selection = &bvhSelection;
+  }
+
+  // Find where the ray is inside the fields. The step length of ordinary
+  // fields is fixed, that of MIP fields grows with the footprint
+  IntervalVec intervals, mipIntervals;
+  GetIntersections op(wsRay, intervals, selection);
+  fusion::for_each(m_dense, op);
+  fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
+  GetIntersections mipOp(wsRay, mipIntervals, selection);
+  fusion::for_each(m_mipDense, mipOp);
+  fusion::for_each(m_mipSparse, mipOp);
+
+  // Footprint per world space distance from the ray origin
+  const double spread = 2.0 * std::tan(0.5 * coneAngle);
+  const double noStep = std::numeric_limits<double>::max();
+
+  float  value[Dims_T];
+  double t = t0;
+  while (t < t1) {
+    // Step length at t
+    const double wsFootprint = spread * std::max(t, 0.0) * dirLength;
+    double       wsStep      = noStep;
+    double       tNext       = t1;
+    detail::intervalStep(intervals, t, 0.0, wsStep, tNext);
+    detail::intervalStep(mipIntervals, t, wsFootprint, wsStep, tNext);
+    if (wsStep == noStep) {
+      // Outside all fields. Skip ahead to the next one
+      t = tNext;
+      continue;
+    }
+    const double dt = std::min(stepMult * wsStep / dirLength, tNext - t);
+    if (dt <= 0.0) {
+      break;
+    }
+    // Sample at the middle of the step
+    const double tMid = t + 0.5 * dt;
+    const float  wsSpotSize = 
+      static_cast<float>(spread * std::max(tMid, 0.0) * dirLength);
+    size_t numHits = 0;
+    std::fill(value, value + Dims_T, 0.0f);
+    sampleAll(wsRay(tMid), wsSpotSize, value, numHits);
+    for (size_t i = 0; i < Dims_T; ++i) {
+      result[i] += value[i] * static_cast<float>(dt * dirLength);
+    }
+    t += dt;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+template <typename BaseTypeList_T, int Dims_T>
+void 
+FieldGroup<BaseTypeList_T, Dims_T>::prefetch
+(const Ray3d &wsRay, const double t0, const double t1) const
+{
+  Prefetch op(wsRay, t0, t1);
+  fusion::for_each(m_sparse, op);
+}
+
+//------------------------------------------------------------------------------
+
+template <typename BaseTypeList_T, int Dims_T>
+void 
+FieldGroup<BaseTypeList_T, Dims_T>::prefetch
+(const Ray3d &wsRay, const IntervalVec &intervals) const
+{
+  for (size_t i = 0, end = intervals.size(); i < end; ++i) {
+    prefetch(wsRay, intervals[i].t0, intervals[i].t1);
+  }
+}
+
+//------------------------------------------------------------------------------
+
 template <typename BaseTypeList_T, int Dims_T>
 void 
 FieldGroup<BaseTypeList_T, Dims_T>::getMinMax(const Box3d &wsBounds, 
@@ -864,11 +1307,15 @@ FieldGroup<BaseTypeList_T, Dims_T>::getMinMax(const Box3d &wsBounds,
     fusion::for_each(m_mipSparseMin, opMin);    
     fusion::for_each(m_mipDenseMax, opMax);
     fusion::for_each(m_mipSparseMax, opMax);
+    // Expression fields have no pre-filtered representation
+    GetMinMax op(wsBounds, min, max);
+    fusion::for_each(m_expr, op);
   } else {
     // Non-prefiltered types
     GetMinMax op(wsBounds, min, max);
     fusion::for_each(m_dense, op);
     fusion::for_each(m_sparse, op);
+    fusion::for_each(m_expr, op);
     // Non-prefiltered MIP types
     GetMinMaxMIP opMIP(wsBounds, min, max);
     fusion::for_each(m_mipDense, opMIP);
@@ -886,6 +1333,7 @@ FieldGroup<BaseTypeList_T, Dims_T>::memSize() const
   MemSize op(result);
   fusion::for_each(m_dense, op);
   fusion::for_each(m_sparse, op);
+  fusion::for_each(m_expr, op);
   fusion::for_each(m_mipDense, op);
   fusion::for_each(m_mipSparse, op);
   return result;
@@ -904,7 +1352,8 @@ struct FieldGroup<BaseTypeList_T, Dims_T>::GrabFields
              ValueRemapOp::Ptr op,
              const bool doWsBoundsOptimization)
     : m_field(f), m_osToWs(osToWs), m_op(op),
-      m_doWsBoundsOptimization(doWsBoundsOptimization)
+      m_doWsBoundsOptimization(doWsBoundsOptimization),
+      m_grabbed(false)
   { }
   //! Functor
   template <typename WrapperVec_T>
@@ -914,9 +1363,15 @@ struct FieldGroup<BaseTypeList_T, Dims_T>::GrabFields
     typedef typename WrapperVec_T::value_type Wrapper_T;
     typedef typename Wrapper_T::field_type    Field_T;
     typedef typename Field_T::Ptr             FieldPtr;
+    // A field only has one concrete type, so once it's been grabbed the
+    // remaining wrapper vectors don't need to cast it
+    if (m_grabbed) {
+      return;
+    }
     // Grab field if type matches
     if (FieldPtr f = 
         Field3D::field_dynamic_cast<Field_T>(m_field)) {
+      m_grabbed = true;
       // Add to FieldWrapper vector
       vec.push_back(f);
       // Grab just-inserted entry
@@ -948,6 +1403,9 @@ private:
   ValueRemapOp::Ptr      m_op;
   //! Enable world space bounds optimization
   bool                   m_doWsBoundsOptimization;
+  //! Whether the field has been added to a wrapper vector. fusion::for_each
+  //! calls the same const functor for every vector, hence mutable.
+  mutable bool           m_grabbed;
 };
 
 //------------------------------------------------------------------------------
@@ -1074,19 +1532,30 @@ template <typename BaseTypeList_T, int Dims_T>
 struct FieldGroup<BaseTypeList_T, Dims_T>::Sample
 {
   //! Ctor
-  Sample(const V3d &p, float *result, size_t &numHits)
-    : m_p(p), m_result(result), m_numHits(numHits)
+  Sample(const V3d &p, float *result, size_t &numHits, 
+         detail::MemberSelection *selection = NULL)
+    : m_p(p), m_result(result), m_numHits(numHits), m_selection(selection)
   { }
   //! Functor
   template <typename T>
   void operator()(const T &vec) const
   { 
-    FieldSampler<T, Dims_T>::sample(vec, m_p, m_result, m_numHits); 
+    if (m_selection) {
+      const size_t *indices;
+      size_t        offset;
+      const size_t  count = m_selection->next(vec.size(), indices, offset);
+      FieldSampler<T, Dims_T>::sample(vec, indices, count, offset, m_p, 
+                                      m_result, m_numHits);
+    } else {
+      FieldSampler<T, Dims_T>::sample(vec, m_p, m_result, m_numHits); 
+    }
   }
   // Data members
-  const V3d &m_p;
-  float     *m_result;
-  size_t    &m_numHits;
+  const V3d               &m_p;
+  float                   *m_result;
+  size_t                  &m_numHits;
+  //! Fields to visit, or null for all of them
+  detail::MemberSelection *m_selection;
 };
 
 //------------------------------------------------------------------------------
@@ -1096,21 +1565,32 @@ struct FieldGroup<BaseTypeList_T, Dims_T>::SampleMIP
 {
   //! Ctor
   SampleMIP(const V3d &p, const float wsSpotSize, float *result, 
-            size_t &numHits)
-    : m_p(p), m_wsSpotSize(wsSpotSize), m_result(result), m_numHits(numHits)
+            size_t &numHits, detail::MemberSelection *selection = NULL)
+    : m_p(p), m_wsSpotSize(wsSpotSize), m_result(result), m_numHits(numHits),
+      m_selection(selection)
   { }
   //! Functor
   template <typename T>
   void operator()(const T &vec) const
   { 
-    FieldSampler<T, Dims_T>::sampleMIP(vec, m_p, m_wsSpotSize, m_result, 
-                                       m_numHits); 
+    if (m_selection) {
+      const size_t *indices;
+      size_t        offset;
+      const size_t  count = m_selection->next(vec.size(), indices, offset);
+      FieldSampler<T, Dims_T>::sampleMIP(vec, indices, count, offset, m_p, 
+                                         m_wsSpotSize, m_result, m_numHits);
+    } else {
+      FieldSampler<T, Dims_T>::sampleMIP(vec, m_p, m_wsSpotSize, m_result, 
+                                         m_numHits); 
+    }
   }
   // Data members
-  const V3d   &m_p;
-  const float  m_wsSpotSize;
-  float       *m_result;
-  size_t      &m_numHits;
+  const V3d               &m_p;
+  const float              m_wsSpotSize;
+  float                   *m_result;
+  size_t                  &m_numHits;
+  //! Fields to visit, or null for all of them
+  detail::MemberSelection *m_selection;
 };
 
 //------------------------------------------------------------------------------
@@ -1176,24 +1656,7 @@ struct FieldGroup<BaseTypeList_T, Dims_T>::GetWsBounds
   void operator()(const T &vec) const
   { 
     for (size_t field = 0, end = vec.size(); field < end; ++field) {
-      // Pointer to mapping
-      const FieldMapping* mapping = vec[field].mapping;
-      if (mapping) {
-        // Corner vertices in local space
-        std::vector<V3d> lsP = detail::unitCornerPoints();
-        // Transform to world space and pad resulting bounds
-        for (size_t i = 0; i < 8; ++i) {
-          V3d wsP;
-          if (vec[field].doOsToWs) {
-            V3d osP;
-            mapping->localToWorld(lsP[i], osP);
-            vec[field].osToWs.multVecMatrix(osP, wsP);
-          } else {
-            mapping->localToWorld(lsP[i], wsP);
-          }
-          m_wsBounds.extendBy(wsP);
-        }
-      }
+      m_wsBounds.extendBy(detail::wrapperWsBounds(vec[field]));
     }
   }
   // Data members
@@ -1202,12 +1665,34 @@ struct FieldGroup<BaseTypeList_T, Dims_T>::GetWsBounds
 
 //------------------------------------------------------------------------------
 
+template <typename BaseTypeList_T, int Dims_T>
+struct FieldGroup<BaseTypeList_T, Dims_T>::GetMemberWsBounds
+{
+  //! Ctor
+  GetMemberWsBounds(std::vector<Box3d> &wsBounds)
+    : m_wsBounds(wsBounds)
+  { }
+  //! Functor
+  template <typename T>
+  void operator()(const T &vec) const
+  { 
+    for (size_t field = 0, end = vec.size(); field < end; ++field) {
+      m_wsBounds.push_back(detail::wrapperWsBounds(vec[field]));
+    }
+  }
+  // Data members
+  std::vector<Box3d> &m_wsBounds;
+};
+
+//------------------------------------------------------------------------------
+
 template <typename BaseTypeList_T, int Dims_T>
 struct FieldGroup<BaseTypeList_T, Dims_T>::GetIntersections
 {
   //! Ctor
-  GetIntersections(const Ray3d &wsRay, IntervalVec &intervals)
-    : m_wsRay(wsRay), m_intervals(intervals)
+  GetIntersections(const Ray3d &wsRay, IntervalVec &intervals,
+                   detail::MemberSelection *selection = NULL)
+    : m_wsRay(wsRay), m_intervals(intervals), m_selection(selection)
   { 
 
   }
@@ -1294,31 +1779,95 @@ struct FieldGroup<BaseTypeList_T, Dims_T>::GetIntersections
   template <typename T>
   void operator()(const T &vec) const
   { 
-    // Intersect the ray against all the fields
+    if (m_selection) {
+      // Intersect the ray against the selected fields
+      const size_t *indices;
+      size_t        offset;
+      const size_t  count = m_selection->next(vec.size(), indices, offset);
+      for (size_t i = 0; i < count; ++i) {
+        intersectField(vec[indices[i] - offset]);
+      }
+    } else {
+      // Intersect the ray against all the fields
+      for (size_t field = 0, end = vec.size(); field < end; ++field) {
+        intersectField(vec[field]);
+      }
+    }
+  }
+  //! Intersect a single field
+  template <typename Wrapper_T>
+  void intersectField(const Wrapper_T &field) const
+  {
+    // Check object space transform
+    Ray3d wsRay = m_wsRay;
+    if (field.doOsToWs) {
+      field.wsToOs.multVecMatrix(m_wsRay.pos, wsRay.pos);
+      field.wsToOs.multDirMatrix(m_wsRay.dir, wsRay.dir);
+    }
+    // Pointer to mapping
+    const FieldMapping* m = field.mapping;
+    // Check matrix mapping
+    if (const MatrixFieldMapping *mtx = 
+        dynamic_cast<const MatrixFieldMapping*>(m)) {
+      intersectMatrixMapping(wsRay, mtx, field.worldScale);
+    }
+    // Check frustum mapping
+    if (const FrustumFieldMapping *f = 
+        dynamic_cast<const FrustumFieldMapping*>(m)) {
+      intersectFrustumMapping(wsRay, f, field.worldScale);
+    }
+  }
+  // Data members
+  const Ray3d             &m_wsRay;
+  IntervalVec             &m_intervals;
+  //! Fields to visit, or null for all of them
+  detail::MemberSelection *m_selection;
+};
+
+//------------------------------------------------------------------------------
+
+template <typename BaseTypeList_T, int Dims_T>
+struct FieldGroup<BaseTypeList_T, Dims_T>::Prefetch
+{
+  //! Ctor
+  Prefetch(const Ray3d &wsRay, const double t0, const double t1)
+    : m_wsRay(wsRay), m_t0(t0), m_t1(t1)
+  { }
+  //! Functor
+  template <typename T>
+  void operator()(const T &vec) const
+  { 
+    // Straight lines stay straight in voxel space under a matrix mapping. 
+    // Other mappings get the segment split up.
+    static const int k_numCurvedSegments = 8;
+
     for (size_t field = 0, end = vec.size(); field < end; ++field) {
+      if (!vec[field].field->isDynamicLoad()) {
+        continue;
+      }
       // Check object space transform
       Ray3d wsRay = m_wsRay;
       if (vec[field].doOsToWs) {
         vec[field].wsToOs.multVecMatrix(m_wsRay.pos, wsRay.pos);
         vec[field].wsToOs.multDirMatrix(m_wsRay.dir, wsRay.dir);
       }
-      // Pointer to mapping
-      const FieldMapping* m = vec[field].mapping;
-      // Check matrix mapping
-      if (const MatrixFieldMapping *mtx = 
-          dynamic_cast<const MatrixFieldMapping*>(m)) {
-        intersectMatrixMapping(wsRay, mtx, vec[field].worldScale);
-      }
-      // Check frustum mapping
-      if (const FrustumFieldMapping *f = 
-          dynamic_cast<const FrustumFieldMapping*>(m)) {
-        intersectFrustumMapping(wsRay, f, vec[field].worldScale);
+      const FieldMapping *m = vec[field].mapping;
+      const int numSegments = 
+        dynamic_cast<const MatrixFieldMapping*>(m) ? 1 : k_numCurvedSegments;
+      // Walk the segments in march order
+      V3d vsP0, vsP1;
+      m->worldToVoxel(wsRay.pos + wsRay.dir * m_t0, vsP0);
+      for (int i = 1; i <= numSegments; ++i) {
+        const double t = m_t0 + (m_t1 - m_t0) * i / numSegments;
+        m->worldToVoxel(wsRay.pos + wsRay.dir * t, vsP1);
+        vec[field].field->prefetchSegment(vsP0, vsP1);
+        vsP0 = vsP1;
       }
     }
   }
   // Data members
   const Ray3d &m_wsRay;
-  IntervalVec &m_intervals;
+  const double m_t0, m_t1;
 };
 
 //------------------------------------------------------------------------------
@@ -1424,39 +1973,55 @@ template <typename BaseTypeList_T, int Dims_T>
 struct FieldGroup<BaseTypeList_T, Dims_T>::PointIsect
 {
   //! Ctor
-  PointIsect(const V3d &wsP)
-    : m_wsP(wsP), m_doesIntersect(false)
+  PointIsect(const V3d &wsP, detail::MemberSelection *selection = NULL)
+    : m_wsP(wsP), m_doesIntersect(false), m_selection(selection)
   { }
   //! Functor
   template <typename T>
   void operator()(const T &vec) const
   { 
-    for (size_t field = 0, end = vec.size(); field < end; ++field) {
+    if (m_selection) {
+      // Loop over the selected fields
+      const size_t *indices;
+      size_t        offset;
+      const size_t  count = m_selection->next(vec.size(), indices, offset);
+      for (size_t i = 0; i < count; ++i) {
+        intersectField(vec[indices[i] - offset]);
+      }
+    } else {
       // Loop over fields in vector
       for (size_t i = 0, end = vec.size(); i < end; ++i) {
-        V3d vsP;
-        // Apply world to object transform
-        if (vec[i].doOsToWs) {
-          V3d osP;
-          vec[i].wsToOs.multVecMatrix(m_wsP, osP);
-          vec[i].mapping->worldToVoxel(osP, vsP);
-        } else {
-          vec[i].mapping->worldToVoxel(m_wsP, vsP);
-        }
-        // Sample
-        if (vec[i].vsBounds.intersects(vsP)) {
-          m_doesIntersect = true;
-        } 
+        intersectField(vec[i]);
       }
     }
   }
+  //! Intersect a single field
+  template <typename Wrapper_T>
+  void intersectField(const Wrapper_T &field) const
+  {
+    V3d vsP;
+    // Apply world to object transform
+    if (field.doOsToWs) {
+      V3d osP;
+      field.wsToOs.multVecMatrix(m_wsP, osP);
+      field.mapping->worldToVoxel(osP, vsP);
+    } else {
+      field.mapping->worldToVoxel(m_wsP, vsP);
+    }
+    // Sample
+    if (field.vsBounds.intersects(vsP)) {
+      m_doesIntersect = true;
+    } 
+  }
   //! Result
   bool result() const
   { return m_doesIntersect; }
 private:
   // Data members
-  V3d  m_wsP;
-  bool m_doesIntersect;
+  V3d                      m_wsP;
+  mutable bool             m_doesIntersect;
+  //! Fields to visit, or null for all of them
+  detail::MemberSelection *m_selection;
 };
 
 //----------------------------------------------------------------------------//
@@ -76,6 +76,9 @@ FIELD3D_NAMESPACE_OPEN
    it is expected that the derived object knows how to read and write to an 
    hdf5 file through the layerGroup id.  
 
+   The ClassFactory hands out a single instance of each class to all 
+   readers and writers, so subclasses must not keep state between calls.
+
    \todo Merge this into ClassFactory.
 */
 
@@ -127,6 +130,30 @@ public:
                               const std::string &layerPath,
                               OgDataType typeEnum) = 0;
 
+  //! Reads only the part of the field at the given HDF5 location that 
+  //! overlaps voxelWindow. Subclasses that can't read part of a field read
+  //! all of it.
+  //! \returns Pointer to the created field, or a null pointer if the field
+  //! couldn't be read.
+  virtual FieldBase::Ptr readWindow(hid_t layerGroup, 
+                                    const std::string &filename,
+                                    const std::string &layerPath,
+                                    DataTypeEnum typeEnum,
+                                    const Box3i &/* voxelWindow */)
+  { return read(layerGroup, filename, layerPath, typeEnum); }
+
+  //! Reads only the part of the field at the given Ogawa group that 
+  //! overlaps voxelWindow. Subclasses that can't read part of a field read
+  //! all of it.
+  //! \returns Pointer to the created field, or a null pointer if the field
+  //! couldn't be read.
+  virtual FieldBase::Ptr readWindow(const OgIGroup &layerGroup, 
+                                    const std::string &filename,
+                                    const std::string &layerPath,
+                                    OgDataType typeEnum,
+                                    const Box3i &/* voxelWindow */)
+  { return read(layerGroup, filename, layerPath, typeEnum); }
+
   //! Write the field to the given layer group
   //! \returns Whether the operation was successful
   virtual bool write(hid_t layerGroup, FieldBase::Ptr field) = 0;
@@ -160,6 +160,18 @@ class LinearFieldInterp : public FieldInterp<Data_T>
   // From FieldInterp ----------------------------------------------------------
 
   virtual Data_T sample(const Field<Data_T> &data, const V3d &vsP) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Analytic voxel-space gradient of the interpolant. Only valid for 
+  //! scalar fields.
+  FIELD3D_VEC3_T<Data_T> sampleGradient(const Field<Data_T> &data, 
+                                        const V3d &vsP) const;
+
+  //! Interpolated value and its voxel-space gradient, using a single 
+  //! lookup of the 8 voxels. Only valid for scalar fields.
+  Data_T sampleValueAndGradient(const Field<Data_T> &data, const V3d &vsP,
+                                FIELD3D_VEC3_T<Data_T> &gradient) const;
   
 private:
 
@@ -238,6 +250,82 @@ private:
 
 FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(CubicFieldInterp);
 
+//----------------------------------------------------------------------------//
+// StochasticFieldInterp
+//----------------------------------------------------------------------------//
+
+/* \class StochasticFieldInterp
+   \ingroup field
+   \brief Jittered trilinear interpolator using voxel access through Field 
+   base class.
+
+   Instead of blending the eight neighboring voxels, a single voxel is
+   picked using the trilinear weights as probabilities. This costs one 
+   voxel lookup per sample, and the expected value over many samples equals 
+   the trilinear result. Useful for e.g. ray marching where the integration 
+   averages out the noise.
+
+   The explicit sample() call takes the random number to use. The 
+   FieldInterp::sample() override derives one from the sample position, 
+   so repeated lookups at the same point return the same voxel.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class StochasticFieldInterp : public FieldInterp<Data_T>
+{
+ public:
+ 
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Data_T value_type;
+  typedef boost::intrusive_ptr<StochasticFieldInterp> Ptr;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef StochasticFieldInterp class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "StochasticFieldInterp";
+  }
+
+  static const char* staticClassType()
+  {
+    return ms_classType.name();
+  }
+
+  // From FieldInterp ----------------------------------------------------------
+
+  virtual Data_T sample(const Field<Data_T> &data, const V3d &vsP) const;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Samples using the given random number, which should be in [0,1)
+  Data_T sample(const Field<Data_T> &data, const V3d &vsP, 
+                const double xi) const;
+  
+private:
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<StochasticFieldInterp<Data_T> > ms_classType;
+  
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef FieldInterp<Data_T> base;    
+
+};
+
+//----------------------------------------------------------------------------//
+// Static data member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(StochasticFieldInterp);
+
 //----------------------------------------------------------------------------//
 // LinearGenericFieldInterp
 //----------------------------------------------------------------------------//
@@ -278,6 +366,20 @@ public:
 
   value_type sample(const Field_T &data, const V3d &vsP) const;
 
+  //! Samples n points at once
+  void sample(const Field_T &data, size_t n, const V3f *vsP, 
+              value_type *out) const;
+
+  //! Analytic voxel-space gradient of the interpolant. Only valid for 
+  //! scalar fields.
+  FIELD3D_VEC3_T<value_type> sampleGradient(const Field_T &data, 
+                                            const V3d &vsP) const;
+
+  //! Interpolated value and its voxel-space gradient, using a single 
+  //! lookup of the stencil. Only valid for scalar fields.
+  value_type sampleValueAndGradient(const Field_T &data, const V3d &vsP,
+                                    FIELD3D_VEC3_T<value_type> &gradient) const;
+
 private:
 
   // Static data members -------------------------------------------------------
@@ -336,11 +438,24 @@ public:
   
   // Main methods --------------------------------------------------------------
   
-  Data_T sample(const MACField<Data_T> &data, const V3d &vsP) const;
+  //! \note Field_T is MACField<Data_T> or SparseMACField<Data_T>
+  template <class Field_T>
+  Data_T sample(const Field_T &data, const V3d &vsP) const;
 
-  double sample(const MACField<Data_T> &data,
+  //! \note Field_T is MACField<Data_T> or SparseMACField<Data_T>
+  template <class Field_T>
+  double sample(const Field_T &data,
                 const MACComponent &comp, 
                 const V3d &vsP) const;
+
+  //! Samples n points given as separate x, y and z voxel-space arrays. 
+  //! The corners and weights along each axis are found once per point and 
+  //! shared by the three components, a group of points at a time, so that
+  //! the stencil math vectorizes. Results match sample().
+  //! \note Field_T is MACField<Data_T> or SparseMACField<Data_T>
+  template <class Field_T>
+  void sample(const Field_T &data, const size_t n, const float *vsX, 
+              const float *vsY, const float *vsZ, Data_T *out) const;
                 
 private:
 
@@ -400,6 +515,19 @@ public:
 
   value_type sample(const Field_T &data, const V3d &vsP) const;
 
+  //! Samples n points at once
+  void sample(const Field_T &data, size_t n, const V3f *vsP, 
+              value_type *out) const;
+
+  //! Analytic voxel-space gradient of the interpolant. Only valid for 
+  //! scalar fields.
+  FIELD3D_VEC3_T<value_type> sampleGradient(const Field_T &data, 
+                                            const V3d &vsP) const;
+
+  //! Interpolated value and its voxel-space gradient, using a single 
+  //! lookup of the stencil. Only valid for scalar fields.
+  value_type sampleValueAndGradient(const Field_T &data, const V3d &vsP,
+                                    FIELD3D_VEC3_T<value_type> &gradient) const;
   
 private:
 
@@ -419,6 +547,156 @@ private:
 
 FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(CubicGenericFieldInterp);
 
+//----------------------------------------------------------------------------//
+// CubicBSplineGenericFieldInterp
+//----------------------------------------------------------------------------//
+
+/* \class CubicBSplineGenericFieldInterp
+   \ingroup field
+   \brief Uniform cubic B-spline interpolator for fields with a fastValue 
+   function.
+
+   Uses the same 4x4x4 stencil as CubicGenericFieldInterp. The B-spline is
+   smooth (C2) across voxels but approximating: it doesn't pass exactly 
+   through the voxel values, so it softens sharp features. Constant fields
+   are reproduced exactly.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+class CubicBSplineGenericFieldInterp : public RefBase
+{
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename Field_T::value_type value_type;
+  typedef boost::intrusive_ptr<CubicBSplineGenericFieldInterp> Ptr;
+  
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef CubicBSplineGenericFieldInterp class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "CubicBSplineGenericFieldInterp";
+  }
+
+  static const char* staticClassType()
+  {
+    return ms_classType.name();    
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  value_type sample(const Field_T &data, const V3d &vsP) const;
+
+  //! Samples n points at once
+  void sample(const Field_T &data, size_t n, const V3f *vsP, 
+              value_type *out) const;
+
+  //! Analytic voxel-space gradient of the interpolant. Only valid for 
+  //! scalar fields.
+  FIELD3D_VEC3_T<value_type> sampleGradient(const Field_T &data, 
+                                            const V3d &vsP) const;
+
+  //! Interpolated value and its voxel-space gradient, using a single 
+  //! lookup of the stencil. Only valid for scalar fields.
+  value_type sampleValueAndGradient(const Field_T &data, const V3d &vsP,
+                                    FIELD3D_VEC3_T<value_type> &gradient) const;
+  
+private:
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<CubicBSplineGenericFieldInterp<Field_T> > 
+  ms_classType;
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef RefBase base;    
+};
+
+//----------------------------------------------------------------------------//
+// Static data member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(CubicBSplineGenericFieldInterp);
+
+//----------------------------------------------------------------------------//
+// StochasticGenericFieldInterp
+//----------------------------------------------------------------------------//
+
+/* \class StochasticGenericFieldInterp
+   \ingroup field
+   \brief Jittered trilinear interpolator for fields with a fastValue 
+   function. See StochasticFieldInterp for details.
+
+   Can be used as the interpolator of a Sampler.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+class StochasticGenericFieldInterp : public RefBase
+{
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename Field_T::value_type value_type;  
+  typedef boost::intrusive_ptr<StochasticGenericFieldInterp> Ptr;
+  
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef StochasticGenericFieldInterp class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "StochasticGenericFieldInterp";
+  }
+  
+  static const char* staticClassType()
+  {
+    return ms_classType.name();
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Samples using a random number derived from the sample position
+  value_type sample(const Field_T &data, const V3d &vsP) const;
+
+  //! Samples using the given random number, which should be in [0,1)
+  value_type sample(const Field_T &data, const V3d &vsP, 
+                    const double xi) const;
+
+  //! Samples n points at once
+  void sample(const Field_T &data, size_t n, const V3f *vsP, 
+              value_type *out) const;
+
+private:
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<StochasticGenericFieldInterp<Field_T> > ms_classType;
+  
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef RefBase base;    
+
+};
+
+//----------------------------------------------------------------------------//
+// Static data member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(StochasticGenericFieldInterp);
+
 //----------------------------------------------------------------------------//
 // CubicMACFieldInterp
 //----------------------------------------------------------------------------//
@@ -457,7 +735,9 @@ public:
 
   // Main methods --------------------------------------------------------------
   
-  Data_T sample(const MACField<Data_T> &data, const V3d &vsP) const;
+  //! \note Field_T is MACField<Data_T> or SparseMACField<Data_T>
+  template <class Field_T>
+  Data_T sample(const Field_T &data, const V3d &vsP) const;
 
 private:
 
@@ -518,6 +798,10 @@ public:
 
   Data_T sample(const ProceduralField<Data_T> &data, const V3d &vsP) const;
 
+  //! Samples n points at once, through ProceduralField::lsSampleBatch()
+  void sample(const ProceduralField<Data_T> &data, size_t n, const V3f *vsP, 
+              Data_T *out) const;
+
 private:
 
   // Static data members -------------------------------------------------------
@@ -565,6 +849,19 @@ bool isPointInField(const FieldRes::Ptr f, const V3d &wsP);
 //! given (floating point) data window
 bool isLegalVoxelCoord(const V3d &vsP, const Box3d &vsDataWindow);
 
+//----------------------------------------------------------------------------//
+
+//! Picks the voxel used by the stochastic interpolators. Along each axis
+//! the upper neighbor is chosen with probability equal to its linear 
+//! weight, and the random number is rescaled so it can be reused for the
+//! next axis. The result is clamped to the data window.
+V3i stochasticVoxel(const Box3i &dataWindow, const V3d &vsP, double xi);
+
+//----------------------------------------------------------------------------//
+
+//! Returns a number in [0,1) derived from hashing the given position
+double stochasticHash(const V3d &vsP);
+
 //----------------------------------------------------------------------------//
 // Math functions
 //----------------------------------------------------------------------------//
@@ -602,6 +899,162 @@ Data_T monotonicCubicInterpolantVec(const Data_T &f1, const Data_T &f2,
 // Implementations
 //----------------------------------------------------------------------------//
 
+namespace detail {
+
+  //! Finds the clamped corners and the weights of a trilinear stencil
+  inline void linearStencilSetup(const Box3i &dataWindow, const V3d &vsP, 
+                                 V3i &c1, V3i &c2, 
+                                 FIELD3D_VEC3_T<double> &f1, 
+                                 FIELD3D_VEC3_T<double> &f2)
+  {
+    // Voxel centers are at .5 coordinates
+    // NOTE: Don't use contToDisc for this, we're looking for sample
+    // point locations, not coordinate shifts.
+    FIELD3D_VEC3_T<double> p(vsP - FIELD3D_VEC3_T<double>(0.5));
+    // Lower left corner
+    c1 = V3i(static_cast<int>(floor(p.x)), 
+             static_cast<int>(floor(p.y)), 
+             static_cast<int>(floor(p.z)));
+    // Upper right corner
+    c2 = c1 + V3i(1);
+    // C1 fractions
+    f1 = static_cast<FIELD3D_VEC3_T<double> >(c2) - p;
+    // C2 fraction
+    f2 = static_cast<FIELD3D_VEC3_T<double> >(1.0) - f1;
+    // Clamp the indexing coordinates
+    c1.x = std::max(dataWindow.min.x, std::min(c1.x, dataWindow.max.x));
+    c2.x = std::max(dataWindow.min.x, std::min(c2.x, dataWindow.max.x));
+    c1.y = std::max(dataWindow.min.y, std::min(c1.y, dataWindow.max.y));
+    c2.y = std::max(dataWindow.min.y, std::min(c2.y, dataWindow.max.y));
+    c1.z = std::max(dataWindow.min.z, std::min(c1.z, dataWindow.max.z));
+    c2.z = std::max(dataWindow.min.z, std::min(c2.z, dataWindow.max.z));
+  }
+
+  //! Trilinear value and voxel-space gradient of the 8 corner values, 
+  //! stored with x fastest: v[i + 2 * j + 4 * k]. The value is summed in 
+  //! the same order as the sample() calls.
+  template <class Data_T>
+  Data_T linearValueAndGradient(const Data_T *v, 
+                                const FIELD3D_VEC3_T<double> &f1,
+                                const FIELD3D_VEC3_T<double> &f2,
+                                FIELD3D_VEC3_T<Data_T> &gradient)
+  {
+    gradient.x = static_cast<Data_T>
+      (f1.y * (f1.z * (v[1] - v[0]) + f2.z * (v[5] - v[4])) +
+       f2.y * (f1.z * (v[3] - v[2]) + f2.z * (v[7] - v[6])));
+    gradient.y = static_cast<Data_T>
+      (f1.x * (f1.z * (v[2] - v[0]) + f2.z * (v[6] - v[4])) +
+       f2.x * (f1.z * (v[3] - v[1]) + f2.z * (v[7] - v[5])));
+    gradient.z = static_cast<Data_T>
+      (f1.x * (f1.y * (v[4] - v[0]) + f2.y * (v[6] - v[2])) +
+       f2.x * (f1.y * (v[5] - v[1]) + f2.y * (v[7] - v[3])));
+    return static_cast<Data_T>
+      (f1.x * (f1.y * (f1.z * v[0] + f2.z * v[4]) +
+               f2.y * (f1.z * v[2] + f2.z * v[6])) +
+       f2.x * (f1.y * (f1.z * v[1] + f2.z * v[5]) +
+               f2.y * (f1.z * v[3] + f2.z * v[7])));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of points handled together by the batched MAC sampler
+  const size_t k_macBatchSize = 8;
+
+  //! Clamped corners and weights along one axis for a group of points. 
+  //! The component stored on this axis' faces samples at the point itself, 
+  //! the two other components sample half a voxel lower.
+  struct MACBatchAxis
+  {
+    //! Face-aligned corners, clamped to [min, max + 1]
+    int    faceC1[k_macBatchSize], faceC2[k_macBatchSize];
+    //! Face-aligned weights of c1 and c2
+    double faceF1[k_macBatchSize], faceF2[k_macBatchSize];
+    //! Cell-centered corners, clamped to [min, max]
+    int    cellC1[k_macBatchSize], cellC2[k_macBatchSize];
+    //! Cell-centered weights of c1 and c2
+    double cellF1[k_macBatchSize], cellF2[k_macBatchSize];
+  };
+
+  //! Fills in the corners and weights of m points along one axis
+  inline void macBatchAxisSetup(const float *p, const size_t m, 
+                                const int min, const int max, 
+                                MACBatchAxis &axis)
+  {
+    for (size_t l = 0; l < m; ++l) {
+      const double face = p[l];
+      const double cell = face - 0.5;
+      const int    fc1  = static_cast<int>(floor(face));
+      const int    cc1  = static_cast<int>(floor(cell));
+      axis.faceF1[l] = static_cast<double>(fc1 + 1) - face;
+      axis.faceF2[l] = 1.0 - axis.faceF1[l];
+      axis.cellF1[l] = static_cast<double>(cc1 + 1) - cell;
+      axis.cellF2[l] = 1.0 - axis.cellF1[l];
+      axis.faceC1[l] = std::min(max + 1, std::max(min, fc1));
+      axis.faceC2[l] = std::min(max + 1, std::max(min, fc1 + 1));
+      axis.cellC1[l] = std::min(max, std::max(min, cc1));
+      axis.cellC2[l] = std::min(max, std::max(min, cc1 + 1));
+    }
+  }
+
+  //! Access to the u, v and w faces, used to share the batched component
+  //! lookup
+  struct MACAccessU
+  {
+    template <class Field_T>
+    static typename Field_T::real_t 
+    value(const Field_T &data, int i, int j, int k)
+    { return data.u(i, j, k); }
+  };
+
+  struct MACAccessV
+  {
+    template <class Field_T>
+    static typename Field_T::real_t 
+    value(const Field_T &data, int i, int j, int k)
+    { return data.v(i, j, k); }
+  };
+
+  struct MACAccessW
+  {
+    template <class Field_T>
+    static typename Field_T::real_t 
+    value(const Field_T &data, int i, int j, int k)
+    { return data.w(i, j, k); }
+  };
+
+  //! Trilinear interpolation of one component for point l, given the 
+  //! corners and weights to use along each axis. The sum is done in the 
+  //! same order as LinearMACFieldInterp::sample().
+  template <class Access_T, class Field_T>
+  double macBatchComponent(const Field_T &data, const size_t l,
+                           const int *c1x, const int *c2x, 
+                           const double *f1x, const double *f2x,
+                           const int *c1y, const int *c2y, 
+                           const double *f1y, const double *f2y,
+                           const int *c1z, const int *c2z, 
+                           const double *f1z, const double *f2z)
+  {
+    typedef typename Field_T::real_t real_t;
+
+    const real_t v111 = Access_T::value(data, c1x[l], c1y[l], c1z[l]);
+    const real_t v112 = Access_T::value(data, c1x[l], c1y[l], c2z[l]);
+    const real_t v121 = Access_T::value(data, c1x[l], c2y[l], c1z[l]);
+    const real_t v122 = Access_T::value(data, c1x[l], c2y[l], c2z[l]);
+    const real_t v211 = Access_T::value(data, c2x[l], c1y[l], c1z[l]);
+    const real_t v212 = Access_T::value(data, c2x[l], c1y[l], c2z[l]);
+    const real_t v221 = Access_T::value(data, c2x[l], c2y[l], c1z[l]);
+    const real_t v222 = Access_T::value(data, c2x[l], c2y[l], c2z[l]);
+
+    return (f1x[l] * (f1y[l] * (f1z[l] * v111 + f2z[l] * v112) +
+                      f2y[l] * (f1z[l] * v121 + f2z[l] * v122)) +
+            f2x[l] * (f1y[l] * (f1z[l] * v211 + f2z[l] * v212) +
+                      f2y[l] * (f1z[l] * v221 + f2z[l] * v222)));
+  }
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 Data_T LinearFieldInterp<Data_T>::sample(const Field<Data_T> &data, 
                                          const V3d &vsP) const
@@ -647,6 +1100,40 @@ Data_T LinearFieldInterp<Data_T>::sample(const Field<Data_T> &data,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+FIELD3D_VEC3_T<Data_T> 
+LinearFieldInterp<Data_T>::sampleGradient(const Field<Data_T> &data, 
+                                          const V3d &vsP) const
+{
+  FIELD3D_VEC3_T<Data_T> gradient;
+  sampleValueAndGradient(data, vsP, gradient);
+  return gradient;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T 
+LinearFieldInterp<Data_T>::sampleValueAndGradient
+(const Field<Data_T> &data, const V3d &vsP, 
+ FIELD3D_VEC3_T<Data_T> &gradient) const
+{
+  V3i c1, c2;
+  FIELD3D_VEC3_T<double> f1, f2;
+  detail::linearStencilSetup(data.dataWindow(), vsP, c1, c2, f1, f2);
+
+  const Data_T v[8] = {
+    data.value(c1.x, c1.y, c1.z), data.value(c2.x, c1.y, c1.z),
+    data.value(c1.x, c2.y, c1.z), data.value(c2.x, c2.y, c1.z),
+    data.value(c1.x, c1.y, c2.z), data.value(c2.x, c1.y, c2.z),
+    data.value(c1.x, c2.y, c2.z), data.value(c2.x, c2.y, c2.z)
+  };
+
+  return detail::linearValueAndGradient(v, f1, f2, gradient);
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 Data_T CubicFieldInterp<Data_T>::sample(const Field<Data_T> &data, 
                                         const V3d &vsP) const
@@ -768,6 +1255,26 @@ Data_T CubicFieldInterp<Data_T>::sample(const Field<Data_T> &data,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+Data_T StochasticFieldInterp<Data_T>::sample(const Field<Data_T> &data, 
+                                             const V3d &vsP) const
+{
+  return sample(data, vsP, stochasticHash(vsP));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T StochasticFieldInterp<Data_T>::sample(const Field<Data_T> &data, 
+                                             const V3d &vsP,
+                                             const double xi) const
+{
+  const V3i c = stochasticVoxel(data.dataWindow(), vsP, xi);
+  return data.value(c.x, c.y, c.z);
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Field_T>
 typename Field_T::value_type
 LinearGenericFieldInterp<Field_T>::sample(const Field_T &data, 
@@ -814,8 +1321,56 @@ LinearGenericFieldInterp<Field_T>::sample(const Field_T &data,
 
 //----------------------------------------------------------------------------//
 
+template <class Field_T>
+void
+LinearGenericFieldInterp<Field_T>::sample(const Field_T &data, size_t n,
+                                          const V3f *vsP, 
+                                          value_type *out) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = sample(data, V3d(vsP[i]));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+FIELD3D_VEC3_T<typename Field_T::value_type>
+LinearGenericFieldInterp<Field_T>::sampleGradient(const Field_T &data, 
+                                                  const V3d &vsP) const
+{
+  FIELD3D_VEC3_T<value_type> gradient;
+  sampleValueAndGradient(data, vsP, gradient);
+  return gradient;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename Field_T::value_type
+LinearGenericFieldInterp<Field_T>::sampleValueAndGradient
+(const Field_T &data, const V3d &vsP, 
+ FIELD3D_VEC3_T<value_type> &gradient) const
+{
+  V3i c1, c2;
+  FIELD3D_VEC3_T<double> f1, f2;
+  detail::linearStencilSetup(data.dataWindow(), vsP, c1, c2, f1, f2);
+
+  const value_type v[8] = {
+    data.fastValue(c1.x, c1.y, c1.z), data.fastValue(c2.x, c1.y, c1.z),
+    data.fastValue(c1.x, c2.y, c1.z), data.fastValue(c2.x, c2.y, c1.z),
+    data.fastValue(c1.x, c1.y, c2.z), data.fastValue(c2.x, c1.y, c2.z),
+    data.fastValue(c1.x, c2.y, c2.z), data.fastValue(c2.x, c2.y, c2.z)
+  };
+
+  return detail::linearValueAndGradient(v, f1, f2, gradient);
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
-Data_T LinearMACFieldInterp<Data_T>::sample(const MACField<Data_T> &data, 
+template <class Field_T>
+Data_T LinearMACFieldInterp<Data_T>::sample(const Field_T &data, 
                                             const V3d &vsP) const
 {
   // Pixel centers are at .5 coordinates
@@ -938,7 +1493,8 @@ Data_T LinearMACFieldInterp<Data_T>::sample(const MACField<Data_T> &data,
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-double LinearMACFieldInterp<Data_T>::sample(const MACField<Data_T> &data,
+template <class Field_T>
+double LinearMACFieldInterp<Data_T>::sample(const Field_T &data,
                                             const MACComponent &comp, 
                                             const V3d &vsP) const
 {
@@ -1078,6 +1634,267 @@ double LinearMACFieldInterp<Data_T>::sample(const MACField<Data_T> &data,
                                             
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+template <class Field_T>
+void LinearMACFieldInterp<Data_T>::sample(const Field_T &data, 
+                                          const size_t n, const float *vsX, 
+                                          const float *vsY, const float *vsZ,
+                                          Data_T *out) const
+{
+  using namespace detail;
+
+  const Box3i &dw = data.dataWindow();
+
+  MACBatchAxis x, y, z;
+
+  for (size_t first = 0; first < n; first += k_macBatchSize) {
+    const size_t m = std::min(k_macBatchSize, n - first);
+
+    // Stencil setup for the whole group
+    macBatchAxisSetup(vsX + first, m, dw.min.x, dw.max.x, x);
+    macBatchAxisSetup(vsY + first, m, dw.min.y, dw.max.y, y);
+    macBatchAxisSetup(vsZ + first, m, dw.min.z, dw.max.z, z);
+
+    // Each component uses the face-aligned stencil along its own axis
+    for (size_t l = 0; l < m; ++l) {
+      Data_T &ret = out[first + l];
+      ret.x = macBatchComponent<MACAccessU>
+        (data, l, 
+         x.faceC1, x.faceC2, x.faceF1, x.faceF2,
+         y.cellC1, y.cellC2, y.cellF1, y.cellF2,
+         z.cellC1, z.cellC2, z.cellF1, z.cellF2);
+      ret.y = macBatchComponent<MACAccessV>
+        (data, l, 
+         x.cellC1, x.cellC2, x.cellF1, x.cellF2,
+         y.faceC1, y.faceC2, y.faceF1, y.faceF2,
+         z.cellC1, z.cellC2, z.cellF1, z.cellF2);
+      ret.z = macBatchComponent<MACAccessW>
+        (data, l, 
+         x.cellC1, x.cellC2, x.cellF1, x.cellF2,
+         y.cellC1, y.cellC2, y.cellF1, y.cellF2,
+         z.faceC1, z.faceC2, z.faceF1, z.faceF2);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //! Finds the lower left corner and the fractions of a cubic stencil
+  inline void cubicStencilSetup(const V3d &vsP, V3i &c, 
+                                FIELD3D_VEC3_T<double> &t)
+  {
+    // Pixel centers are at .5 coordinates
+    // NOTE: Don't use contToDisc for this, we're looking for sample
+    // point locations, not coordinate shifts.
+    V3d clampedVsP(std::max(0.5, vsP.x),
+                   std::max(0.5, vsP.y),
+                   std::max(0.5, vsP.z));
+    FIELD3D_VEC3_T<double> p(clampedVsP - FIELD3D_VEC3_T<double>(0.5));
+    // Lower left corner
+    c = V3i(static_cast<int>(floor(p.x)), 
+            static_cast<int>(floor(p.y)), 
+            static_cast<int>(floor(p.z)));
+    // Fractions
+    t = p - static_cast<FIELD3D_VEC3_T<double> >(c);
+  }
+
+  //! Clamped coordinates c-1 .. c+2 along one axis
+  inline void cubicStencilAxis(int c, int min, int max, int *idx)
+  {
+    const int m = std::max(min, std::min(c, max));
+    idx[0] = std::max(min, std::min(m - 1, max));
+    idx[1] = m;
+    idx[2] = std::max(min, std::min(m + 1, max));
+    idx[3] = std::max(min, std::min(m + 2, max));
+  }
+
+  //! Reads the 4x4x4 voxels around the lower left corner c into v, 
+  //! clamped to the data window. x varies fastest, so each row of 4 voxels
+  //! is read in memory order.
+  template <class Field_T>
+  void gatherCubicStencil(const Field_T &data, const V3i &c,
+                          typename Field_T::value_type *v)
+  {
+    const Box3i &dw = data.dataWindow();
+    int is[4], js[4], ks[4];
+    cubicStencilAxis(c.x, dw.min.x, dw.max.x, is);
+    cubicStencilAxis(c.y, dw.min.y, dw.max.y, js);
+    cubicStencilAxis(c.z, dw.min.z, dw.max.z, ks);
+    for (int k = 0; k < 4; ++k) {
+      for (int j = 0; j < 4; ++j) {
+        for (int i = 0; i < 4; ++i) {
+          *v++ = data.fastValue(is[i], js[j], ks[k]);
+        }
+      }
+    }
+  }
+
+  //! Monotonic cubic interpolation of a gathered stencil. Reduces along z,
+  //! then y, then x, in the order CubicGenericFieldInterp always has.
+  template <class Data_T>
+  Data_T monotonicCubicStencil(const Data_T *v, 
+                               const FIELD3D_VEC3_T<double> &t)
+  {
+    Data_T y[4];
+    for (int i = 0; i < 4; ++i) {
+      Data_T z[4];
+      for (int j = 0; j < 4; ++j) {
+        const Data_T *col = v + i + 4 * j;
+        z[j] = monotonicCubicInterpolant(col[0], col[16], col[32], col[48], 
+                                         t.z);
+      }
+      y[i] = monotonicCubicInterpolant(z[0], z[1], z[2], z[3], t.y);
+    }
+    return monotonicCubicInterpolant(y[0], y[1], y[2], y[3], t.x);
+  }
+
+  //! Weights of f1 .. f4 in monotonicCubicInterpolant() and their 
+  //! derivatives with respect to t. Flat intervals (f2 == f3) reduce to f2.
+  inline void monotonicCubicWeights(bool isFlat, double t, 
+                                    double *w, double *dw)
+  {
+    if (isFlat) {
+      w[0] = 0.0; w[1] = 1.0; w[2] = 0.0; w[3] = 0.0;
+      dw[0] = 0.0; dw[1] = 0.0; dw[2] = 0.0; dw[3] = 0.0;
+      return;
+    }
+    const double t2 = t * t, t3 = t2 * t;
+    w[0]  = -0.5 * t + t2 - 0.5 * t3;
+    w[1]  = 1.0 - 2.5 * t2 + 1.5 * t3;
+    w[2]  = 0.5 * t + 2.0 * t2 - 1.5 * t3;
+    w[3]  = -0.5 * t2 + 0.5 * t3;
+    dw[0] = -0.5 + 2.0 * t - 1.5 * t2;
+    dw[1] = -5.0 * t + 4.5 * t2;
+    dw[2] = 0.5 + 4.0 * t - 4.5 * t2;
+    dw[3] = -t + 1.5 * t2;
+  }
+
+  //! Zeroes the gradient along axes where cubicStencilSetup() clamped vsP
+  template <class T>
+  void clampCubicGradient(const V3d &vsP, FIELD3D_VEC3_T<T> &gradient)
+  {
+    if (vsP.x < 0.5) gradient.x = static_cast<T>(0);
+    if (vsP.y < 0.5) gradient.y = static_cast<T>(0);
+    if (vsP.z < 0.5) gradient.z = static_cast<T>(0);
+  }
+
+  //! Voxel-space gradient of monotonicCubicStencil(). Each pass is linear
+  //! in its inputs once the flat intervals are known, so the derivatives 
+  //! of the inner passes are pushed through the weights of the outer ones.
+  template <class Data_T>
+  FIELD3D_VEC3_T<Data_T> 
+  monotonicCubicStencilGradient(const Data_T *v, 
+                                const FIELD3D_VEC3_T<double> &t)
+  {
+    double w[4], dw[4];
+    double y[4], dyy[4], dyz[4];
+    for (int i = 0; i < 4; ++i) {
+      double z[4], dz[4];
+      for (int j = 0; j < 4; ++j) {
+        const Data_T *col = v + i + 4 * j;
+        const double f[4] = { col[0], col[16], col[32], col[48] };
+        monotonicCubicWeights(f[1] == f[2], t.z, w, dw);
+        z[j]  = w[0] * f[0] + w[1] * f[1] + w[2] * f[2] + w[3] * f[3];
+        dz[j] = dw[0] * f[0] + dw[1] * f[1] + dw[2] * f[2] + dw[3] * f[3];
+      }
+      monotonicCubicWeights(z[1] == z[2], t.y, w, dw);
+      y[i]   = w[0] * z[0] + w[1] * z[1] + w[2] * z[2] + w[3] * z[3];
+      dyy[i] = dw[0] * z[0] + dw[1] * z[1] + dw[2] * z[2] + dw[3] * z[3];
+      dyz[i] = w[0] * dz[0] + w[1] * dz[1] + w[2] * dz[2] + w[3] * dz[3];
+    }
+    monotonicCubicWeights(y[1] == y[2], t.x, w, dw);
+    return FIELD3D_VEC3_T<Data_T>
+      (static_cast<Data_T>(dw[0] * y[0] + dw[1] * y[1] + 
+                           dw[2] * y[2] + dw[3] * y[3]),
+       static_cast<Data_T>(w[0] * dyy[0] + w[1] * dyy[1] + 
+                           w[2] * dyy[2] + w[3] * dyy[3]),
+       static_cast<Data_T>(w[0] * dyz[0] + w[1] * dyz[1] + 
+                           w[2] * dyz[2] + w[3] * dyz[3]));
+  }
+
+  //! Uniform cubic B-spline weights for the voxels c-1 .. c+2
+  inline void cubicBSplineWeights(double t, double *w)
+  {
+    const double t2 = t * t, t3 = t2 * t, s = 1.0 - t;
+    w[0] = s * s * s / 6.0;
+    w[1] = (3.0 * t3 - 6.0 * t2 + 4.0) / 6.0;
+    w[2] = (-3.0 * t3 + 3.0 * t2 + 3.0 * t + 1.0) / 6.0;
+    w[3] = t3 / 6.0;
+  }
+
+  //! B-spline interpolation of a gathered stencil. Each row is reduced 
+  //! along x first, so the weights are applied in memory order.
+  template <class Data_T>
+  Data_T bsplineCubicStencil(const Data_T *v, 
+                             const FIELD3D_VEC3_T<double> &t)
+  {
+    double wx[4], wy[4], wz[4];
+    cubicBSplineWeights(t.x, wx);
+    cubicBSplineWeights(t.y, wy);
+    cubicBSplineWeights(t.z, wz);
+    Data_T planes[4];
+    for (int k = 0; k < 4; ++k) {
+      Data_T rows[4];
+      for (int j = 0; j < 4; ++j) {
+        const Data_T *row = v + 16 * k + 4 * j;
+        rows[j] = static_cast<Data_T>(wx[0] * row[0] + wx[1] * row[1] + 
+                                      wx[2] * row[2] + wx[3] * row[3]);
+      }
+      planes[k] = static_cast<Data_T>(wy[0] * rows[0] + wy[1] * rows[1] + 
+                                      wy[2] * rows[2] + wy[3] * rows[3]);
+    }
+    return static_cast<Data_T>(wz[0] * planes[0] + wz[1] * planes[1] + 
+                               wz[2] * planes[2] + wz[3] * planes[3]);
+  }
+
+  //! Derivatives of cubicBSplineWeights() with respect to t
+  inline void cubicBSplineDerivWeights(double t, double *dw)
+  {
+    const double t2 = t * t, s = 1.0 - t;
+    dw[0] = -0.5 * s * s;
+    dw[1] = 1.5 * t2 - 2.0 * t;
+    dw[2] = -1.5 * t2 + t + 0.5;
+    dw[3] = 0.5 * t2;
+  }
+
+  //! Voxel-space gradient of bsplineCubicStencil()
+  template <class Data_T>
+  FIELD3D_VEC3_T<Data_T> 
+  bsplineCubicStencilGradient(const Data_T *v, 
+                              const FIELD3D_VEC3_T<double> &t)
+  {
+    double wx[4], wy[4], wz[4], dwx[4], dwy[4], dwz[4];
+    cubicBSplineWeights(t.x, wx);
+    cubicBSplineWeights(t.y, wy);
+    cubicBSplineWeights(t.z, wz);
+    cubicBSplineDerivWeights(t.x, dwx);
+    cubicBSplineDerivWeights(t.y, dwy);
+    cubicBSplineDerivWeights(t.z, dwz);
+    double gx = 0.0, gy = 0.0, gz = 0.0;
+    for (int k = 0; k < 4; ++k) {
+      for (int j = 0; j < 4; ++j) {
+        const Data_T *row = v + 16 * k + 4 * j;
+        double r = 0.0, dr = 0.0;
+        for (int i = 0; i < 4; ++i) {
+          r  += wx[i] * row[i];
+          dr += dwx[i] * row[i];
+        }
+        gx += wy[j] * wz[k] * dr;
+        gy += dwy[j] * wz[k] * r;
+        gz += wy[j] * dwz[k] * r;
+      }
+    }
+    return FIELD3D_VEC3_T<Data_T>(static_cast<Data_T>(gx), 
+                                  static_cast<Data_T>(gy), 
+                                  static_cast<Data_T>(gz));
+  }
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+
 template <class Field_T>
 typename Field_T::value_type
 CubicGenericFieldInterp<Field_T>::sample(const Field_T &data, 
@@ -1085,124 +1902,167 @@ CubicGenericFieldInterp<Field_T>::sample(const Field_T &data,
 {
   typedef typename Field_T::value_type Data_T;
 
-  // Pixel centers are at .5 coordinates
-  // NOTE: Don't use contToDisc for this, we're looking for sample
-  // point locations, not coordinate shifts.
-  V3d clampedVsP(std::max(0.5, vsP.x),
-                 std::max(0.5, vsP.y),
-                 std::max(0.5, vsP.z));
-  FIELD3D_VEC3_T<double> p(clampedVsP - FIELD3D_VEC3_T<double>(0.5));
+  V3i c;
+  FIELD3D_VEC3_T<double> t;
+  detail::cubicStencilSetup(vsP, c, t);
 
-  const Box3i &dataWindow = data.dataWindow();
+  Data_T v[64];
+  detail::gatherCubicStencil(data, c, v);
 
-  // Lower left corner
-  V3i c(static_cast<int>(floor(p.x)), 
-        static_cast<int>(floor(p.y)), 
-        static_cast<int>(floor(p.z)));
+  return detail::monotonicCubicStencil(v, t);
+}
 
-  // Fractions
-  FIELD3D_VEC3_T<double> t(p - static_cast<FIELD3D_VEC3_T<double> >(c));
+//----------------------------------------------------------------------------//
 
-  // Clamp the coordinates
-  int im, jm, km;
-  im = std::max(dataWindow.min.x, std::min(c.x, dataWindow.max.x));
-  jm = std::max(dataWindow.min.y, std::min(c.y, dataWindow.max.y));
-  km = std::max(dataWindow.min.z, std::min(c.z, dataWindow.max.z));
-  int im_1, jm_1, km_1;
-  im_1 = std::max(dataWindow.min.x, std::min(im - 1, dataWindow.max.x));
-  jm_1 = std::max(dataWindow.min.y, std::min(jm - 1, dataWindow.max.y));
-  km_1 = std::max(dataWindow.min.z, std::min(km - 1, dataWindow.max.z));
-  int im1, jm1, km1;
-  im1 = std::max(dataWindow.min.x, std::min(im + 1, dataWindow.max.x));
-  jm1 = std::max(dataWindow.min.y, std::min(jm + 1, dataWindow.max.y));
-  km1 = std::max(dataWindow.min.z, std::min(km + 1, dataWindow.max.z));
-  int im2, jm2, km2;
-  im2 = std::max(dataWindow.min.x, std::min(im + 2, dataWindow.max.x));
-  jm2 = std::max(dataWindow.min.y, std::min(jm + 2, dataWindow.max.y));
-  km2 = std::max(dataWindow.min.z, std::min(km + 2, dataWindow.max.z));
+template <class Field_T>
+void
+CubicGenericFieldInterp<Field_T>::sample(const Field_T &data, size_t n,
+                                         const V3f *vsP, 
+                                         value_type *out) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = sample(data, V3d(vsP[i]));
+  }
+}
 
-  Data_T z11 = monotonicCubicInterpolant(data.fastValue(im_1, jm_1, km_1), 
-                                         data.fastValue(im_1, jm_1, km), 
-                                         data.fastValue(im_1, jm_1, km1), 
-                                         data.fastValue(im_1, jm_1, km2), t.z);
-  Data_T z12 = monotonicCubicInterpolant(data.fastValue(im_1, jm, km_1), 
-                                         data.fastValue(im_1, jm, km), 
-                                         data.fastValue(im_1, jm, km1), 
-                                         data.fastValue(im_1, jm, km2), t.z);
-  Data_T z13 = monotonicCubicInterpolant(data.fastValue(im_1, jm1, km_1), 
-                                         data.fastValue(im_1, jm1, km), 
-                                         data.fastValue(im_1, jm1, km1), 
-                                         data.fastValue(im_1, jm1, km2), t.z);
-  Data_T z14 = monotonicCubicInterpolant(data.fastValue(im_1, jm2, km_1), 
-                                         data.fastValue(im_1, jm2, km), 
-                                         data.fastValue(im_1, jm2, km1), 
-                                         data.fastValue(im_1, jm2, km2), t.z);
-
-  Data_T z21 = monotonicCubicInterpolant(data.fastValue(im, jm_1, km_1), 
-                                         data.fastValue(im, jm_1, km), 
-                                         data.fastValue(im, jm_1, km1), 
-                                         data.fastValue(im, jm_1, km2), t.z);
-  Data_T z22 = monotonicCubicInterpolant(data.fastValue(im, jm, km_1), 
-                                         data.fastValue(im, jm, km), 
-                                         data.fastValue(im, jm, km1), 
-                                         data.fastValue(im, jm, km2), t.z);
-  Data_T z23 = monotonicCubicInterpolant(data.fastValue(im, jm1, km_1), 
-                                         data.fastValue(im, jm1, km), 
-                                         data.fastValue(im, jm1, km1), 
-                                         data.fastValue(im, jm1, km2), t.z);
-  Data_T z24 = monotonicCubicInterpolant(data.fastValue(im, jm2, km_1), 
-                                         data.fastValue(im, jm2, km), 
-                                         data.fastValue(im, jm2, km1), 
-                                         data.fastValue(im, jm2, km2), t.z);
-
-  Data_T z31 = monotonicCubicInterpolant(data.fastValue(im1, jm_1, km_1), 
-                                         data.fastValue(im1, jm_1, km), 
-                                         data.fastValue(im1, jm_1, km1), 
-                                         data.fastValue(im1, jm_1, km2), t.z);
-  Data_T z32 = monotonicCubicInterpolant(data.fastValue(im1, jm, km_1), 
-                                         data.fastValue(im1, jm, km), 
-                                         data.fastValue(im1, jm, km1), 
-                                         data.fastValue(im1, jm, km2), t.z);
-  Data_T z33 = monotonicCubicInterpolant(data.fastValue(im1, jm1, km_1), 
-                                         data.fastValue(im1, jm1, km), 
-                                         data.fastValue(im1, jm1, km1), 
-                                         data.fastValue(im1, jm1, km2), t.z);
-  Data_T z34 = monotonicCubicInterpolant(data.fastValue(im1, jm2, km_1), 
-                                         data.fastValue(im1, jm2, km), 
-                                         data.fastValue(im1, jm2, km1), 
-                                         data.fastValue(im1, jm2, km2), t.z);
-
-  Data_T z41 = monotonicCubicInterpolant(data.fastValue(im2, jm_1, km_1), 
-                                         data.fastValue(im2, jm_1, km), 
-                                         data.fastValue(im2, jm_1, km1), 
-                                         data.fastValue(im2, jm_1, km2), t.z);
-  Data_T z42 = monotonicCubicInterpolant(data.fastValue(im2, jm, km_1), 
-                                         data.fastValue(im2, jm, km), 
-                                         data.fastValue(im2, jm, km1), 
-                                         data.fastValue(im2, jm, km2), t.z);
-  Data_T z43 = monotonicCubicInterpolant(data.fastValue(im2, jm1, km_1), 
-                                         data.fastValue(im2, jm1, km), 
-                                         data.fastValue(im2, jm1, km1), 
-                                         data.fastValue(im2, jm1, km2), t.z);
-  Data_T z44 = monotonicCubicInterpolant(data.fastValue(im2, jm2, km_1), 
-                                         data.fastValue(im2, jm2, km), 
-                                         data.fastValue(im2, jm2, km1), 
-                                         data.fastValue(im2, jm2, km2), t.z);
+//----------------------------------------------------------------------------//
 
-  Data_T y1 = monotonicCubicInterpolant(z11, z12, z13, z14, t.y);
-  Data_T y2 = monotonicCubicInterpolant(z21, z22, z23, z24, t.y);
-  Data_T y3 = monotonicCubicInterpolant(z31, z32, z33, z34, t.y);
-  Data_T y4 = monotonicCubicInterpolant(z41, z42, z43, z44, t.y);
-                   
-  Data_T z0 = monotonicCubicInterpolant(y1, y2, y3, y4, t.x);
+template <class Field_T>
+FIELD3D_VEC3_T<typename Field_T::value_type>
+CubicGenericFieldInterp<Field_T>::sampleGradient(const Field_T &data, 
+                                                 const V3d &vsP) const
+{
+  FIELD3D_VEC3_T<value_type> gradient;
+  sampleValueAndGradient(data, vsP, gradient);
+  return gradient;
+}
 
-  return z0;
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename Field_T::value_type
+CubicGenericFieldInterp<Field_T>::sampleValueAndGradient
+(const Field_T &data, const V3d &vsP, 
+ FIELD3D_VEC3_T<value_type> &gradient) const
+{
+  V3i c;
+  FIELD3D_VEC3_T<double> t;
+  detail::cubicStencilSetup(vsP, c, t);
+
+  value_type v[64];
+  detail::gatherCubicStencil(data, c, v);
+
+  gradient = detail::monotonicCubicStencilGradient(v, t);
+  detail::clampCubicGradient(vsP, gradient);
+
+  return detail::monotonicCubicStencil(v, t);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename Field_T::value_type
+CubicBSplineGenericFieldInterp<Field_T>::sample(const Field_T &data, 
+                                                const V3d &vsP) const
+{
+  typedef typename Field_T::value_type Data_T;
+
+  V3i c;
+  FIELD3D_VEC3_T<double> t;
+  detail::cubicStencilSetup(vsP, c, t);
+
+  Data_T v[64];
+  detail::gatherCubicStencil(data, c, v);
+
+  return detail::bsplineCubicStencil(v, t);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+void
+CubicBSplineGenericFieldInterp<Field_T>::sample(const Field_T &data, 
+                                                size_t n, const V3f *vsP, 
+                                                value_type *out) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = sample(data, V3d(vsP[i]));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename Field_T::value_type
+StochasticGenericFieldInterp<Field_T>::sample(const Field_T &data, 
+                                              const V3d &vsP) const
+{
+  return sample(data, vsP, stochasticHash(vsP));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename Field_T::value_type
+StochasticGenericFieldInterp<Field_T>::sample(const Field_T &data, 
+                                              const V3d &vsP,
+                                              const double xi) const
+{
+  const V3i c = stochasticVoxel(data.dataWindow(), vsP, xi);
+  return data.fastValue(c.x, c.y, c.z);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+void
+StochasticGenericFieldInterp<Field_T>::sample(const Field_T &data, 
+                                              size_t n, const V3f *vsP, 
+                                              value_type *out) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = sample(data, V3d(vsP[i]));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+FIELD3D_VEC3_T<typename Field_T::value_type>
+CubicBSplineGenericFieldInterp<Field_T>::sampleGradient
+(const Field_T &data, const V3d &vsP) const
+{
+  FIELD3D_VEC3_T<value_type> gradient;
+  sampleValueAndGradient(data, vsP, gradient);
+  return gradient;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename Field_T::value_type
+CubicBSplineGenericFieldInterp<Field_T>::sampleValueAndGradient
+(const Field_T &data, const V3d &vsP, 
+ FIELD3D_VEC3_T<value_type> &gradient) const
+{
+  V3i c;
+  FIELD3D_VEC3_T<double> t;
+  detail::cubicStencilSetup(vsP, c, t);
+
+  value_type v[64];
+  detail::gatherCubicStencil(data, c, v);
+
+  gradient = detail::bsplineCubicStencilGradient(v, t);
+  detail::clampCubicGradient(vsP, gradient);
+
+  return detail::bsplineCubicStencil(v, t);
 }
 
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-Data_T CubicMACFieldInterp<Data_T>::sample(const MACField<Data_T> &data, 
+template <class Field_T>
+Data_T CubicMACFieldInterp<Data_T>::sample(const Field_T &data, 
                                            const V3d &vsP) const
 {
   typedef typename Data_T::BaseType T;
@@ -1554,6 +2414,30 @@ ProceduralFieldLookup<Data_T>::sample(const ProceduralField<Data_T> &data,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void
+ProceduralFieldLookup<Data_T>::sample(const ProceduralField<Data_T> &data,
+                                      size_t n, const V3f *vsP, 
+                                      Data_T *out) const
+{
+  // Points are handed to the field a chunk at a time
+  const size_t chunkSize = 64;
+  V3d          lsP[chunkSize];
+  const V3d    voxelScale = V3d(1.0) / data.dataResolution();
+  while (n > 0) {
+    const size_t numPoints = std::min(n, chunkSize);
+    for (size_t i = 0; i < numPoints; ++i) {
+      lsP[i] = V3d(vsP[i]) * voxelScale;
+    }
+    data.lsSampleBatch(numPoints, lsP, out);
+    vsP += numPoints;
+    out += numPoints;
+    n   -= numPoints;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 template <class S, class T>
 FIELD3D_VEC3_T<T> operator * (S s, const FIELD3D_VEC3_T<T> vec)
 {
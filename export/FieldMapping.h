@@ -175,6 +175,21 @@ class FIELD3D_API FieldMapping : public RefBase
   //! \name Transforms implemented in this class
   //! \{
 
+  //! Transforms n world space positions into voxel space. wsP and vsP may
+  //! be the same array. The default implementation calls the single point
+  //! worldToVoxel() for each point; subclasses may override it with 
+  //! something faster.
+  virtual void worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n) const;
+  //! Transforms n world space positions at the given time into voxel space
+  virtual void worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n,
+                            float time) const;
+  //! Transforms n voxel space positions into world space. vsP and wsP may
+  //! be the same array. 
+  virtual void voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n) const;
+  //! Transforms n voxel space positions at the given time into world space
+  virtual void voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n, 
+                            float time) const;
+
   //! Transform from local space to voxel space. This is just a multiplication
   //! by the resolution of the Field that we're mapping.
   void localToVoxel(const V3d &lsP, V3d &vsP) const;
@@ -271,6 +286,9 @@ public:
   //! \name From FieldMapping
   //! \{
 
+  using FieldMapping::worldToVoxel;
+  using FieldMapping::voxelToWorld;
+
   virtual void worldToVoxel(const V3d &wsP, V3d &vsP) const 
   { localToVoxel(wsP, vsP); }
   virtual void worldToVoxel(const V3d &wsP, V3d &vsP, float /*time*/) const 
@@ -387,7 +405,7 @@ public:
     if (!m_isTimeVarying) {
       return m_wsToVs;
     } else {
-      return m_vsToWsCurve.linear(time).inverse();
+      return matrixAtTime(WsToVs, time);
     }
   }
 
@@ -416,8 +434,7 @@ public:
     if (!m_isTimeVarying) {
       m_wsToVs.multVecMatrix(wsP, vsP);
     } else {
-      M44d wsToVs = m_vsToWsCurve.linear(time).inverse();
-      wsToVs.multVecMatrix(wsP, vsP);
+      matrixAtTime(WsToVs, time).multVecMatrix(wsP, vsP);
     }
   }
 
@@ -428,8 +445,7 @@ public:
     if (!m_isTimeVarying) {
       m_vsToWs.multVecMatrix(vsP, wsP); 
     } else {
-      M44d vsToWs = m_vsToWsCurve.linear(time);
-      vsToWs.multVecMatrix(vsP, wsP);
+      matrixAtTime(VsToWs, time).multVecMatrix(vsP, wsP);
     }
   }
 
@@ -441,8 +457,7 @@ public:
     if (!m_isTimeVarying) {
       m_wsToLs.multVecMatrix(wsP, lsP); 
     } else {
-      M44d wsToLs = m_lsToWsCurve.linear(time).inverse();
-      wsToLs.multVecMatrix(wsP, lsP);
+      matrixAtTime(WsToLs, time).multVecMatrix(wsP, lsP);
     }
   }
 
@@ -453,11 +468,19 @@ public:
     if (!m_isTimeVarying) {
       m_lsToWs.multVecMatrix(lsP, wsP); 
     } else {
-      M44d lsToWs = m_lsToWsCurve.linear(time);
-      lsToWs.multVecMatrix(lsP, wsP);
+      matrixAtTime(LsToWs, time).multVecMatrix(lsP, wsP);
     }
   }
 
+  //! Applies the matrix to all points in one pass. For time varying
+  //! mappings the curve is evaluated once per call.
+  virtual void worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n) const;
+  virtual void worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n,
+                            float time) const;
+  virtual void voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n) const;
+  virtual void voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n, 
+                            float time) const;
+
   //! \todo Generalize and make time-dependent.
   void worldToVoxelDir(const V3d &wsV, V3d &vsV) const 
   { m_wsToVs.multDirMatrix(wsV, vsV); }
@@ -490,12 +513,33 @@ public:
   
 private:
 
+  // Enums ---------------------------------------------------------------------
+
+  //! The transforms that matrixAtTime() can evaluate
+  enum TimeMatrix
+  {
+    LsToWs = 0,
+    WsToLs,
+    VsToWs,
+    WsToVs
+  };
+
+  // Utility methods -----------------------------------------------------------
+
   //! Updates the local to world transformation matrix
   void updateTransform();
 
   //! \todo Unit test this
   void getLocalToVoxelMatrix(M44d &result);
 
+  //! Returns one of the transforms of a time varying mapping at the given 
+  //! time. The interpolated (and inverted) matrices are kept in a small
+  //! per-thread cache, so repeated transforms at the same time only
+  //! evaluate the curves once.
+  //! \note The reference stays valid until the next call from the same 
+  //! thread.
+  const M44d& matrixAtTime(const TimeMatrix which, const float time) const;
+
   // Data members -------------------------------------------------------------
 
   //! Local space to world space
@@ -520,6 +564,10 @@ private:
   //! \note This is set by updateTransform().
   bool m_isTimeVarying;
 
+  //! Identifies the current curves in the cache used by matrixAtTime().
+  //! \note This is set by updateTransform().
+  size_t m_serial;
+
   //! Precomputed world-space voxel size. Calculations may assume orthogonal
   //! transformation for efficiency
   V3d m_wsVoxelSize;
@@ -673,6 +721,9 @@ public:
   //! \name From FieldMapping
   //! \{
 
+  using FieldMapping::worldToVoxel;
+  using FieldMapping::voxelToWorld;
+
   virtual void worldToVoxel(const V3d &wsP, V3d &vsP) const;
   virtual void worldToVoxel(const V3d &wsP, V3d &vsP, float time) const;
 
@@ -685,6 +736,15 @@ public:
   virtual void localToWorld(const V3d &lsP, V3d &wsP) const;
   virtual void localToWorld(const V3d &lsP, V3d &wsP, float time) const;
 
+  //! Uses the precomputed transforms for all points when the mapping 
+  //! has a single time sample.
+  virtual void worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n) const;
+  virtual void worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n,
+                            float time) const;
+  virtual void voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n) const;
+  virtual void voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n, 
+                            float time) const;
+
   virtual void extentsChanged();
 
   virtual std::string className() const;
@@ -700,9 +760,18 @@ public:
   
 private:
 
-  //! Updates the local to world transformation matrix
+  //! Updates the precomputed transforms and the per-slice voxel size
   void computeVoxelSize();
 
+  //! Precomputes the transforms used by the static fast paths. Called 
+  //! whenever the curves or the extents change.
+  void computeStaticTransforms();
+
+  //! worldToVoxel() using the precomputed transforms
+  void worldToVoxelStatic(const V3d &wsP, V3d &vsP) const;
+  //! voxelToWorld() using the precomputed transforms
+  void voxelToWorldStatic(const V3d &vsP, V3d &wsP) const;
+
   //! \todo Unit test this
   void getLocalToVoxelMatrix(M44d &result);
 
@@ -739,6 +808,25 @@ private:
   //! set through setTransforms(), the default samples must be cleared.
   bool m_defaultState;
 
+  //! Whether the curves hold a single sample, in which case the transforms
+  //! below are used instead of evaluating and inverting the curves.
+  bool m_isStatic;
+  //! World to voxel space, through local perspective space. Exact for 
+  //! PerspectiveDistribution, and gives x/y for UniformDistribution.
+  M44d m_wsToVs;
+  //! Inverse of m_wsToVs
+  M44d m_vsToWs;
+  //! Local perspective to world space
+  M44d m_lpsToWs;
+  //! World to camera space. UniformDistribution maps camera space depth
+  //! linearly to voxel space z.
+  M44d m_wsToCs;
+  //! Camera to local perspective space. Column 2 and 3 give the local 
+  //! perspective depth of a point on the camera axis in closed form.
+  M44d m_csToLps;
+  //! Near and far plane
+  double m_near, m_far;
+
   // Typedefs ------------------------------------------------------------------
 
   //! Convenience typedef for referring to base class
@@ -55,6 +55,8 @@
 #include <vector>
 #include <map>
 
+#include <boost/shared_ptr.hpp>
+
 #include "Types.h"
 
 //----------------------------------------------------------------------------//
@@ -108,13 +110,11 @@ class FieldMetadata
 
   // Operators -----------------------------------------------------------------
 
+  //! Shares the other object's dictionaries. They are only copied once
+  //! either side is modified, so copying fields and MIP levels is cheap.
   void operator = (const FieldMetadata &other) 
   { 
-    m_vecFloatMetadata = other.m_vecFloatMetadata;
-    m_floatMetadata    = other.m_floatMetadata;
-    m_vecIntMetadata   = other.m_vecIntMetadata;
-    m_intMetadata      = other.m_intMetadata;
-    m_strMetadata      = other.m_strMetadata;
+    m_data = other.m_data;
   }
 
   // Access to metadata --------------------------------------------------------
@@ -143,25 +143,26 @@ class FieldMetadata
   std::string strMetadata(const std::string &name, 
                           const std::string &defaultVal) const;
 
-  //! Read only access to the m_vecFloatMetadata dictionary
+  //! Read only access to the V3f dictionary. The reference is valid until
+  //! the metadata is next modified.
   const VecFloatMetadata& vecFloatMetadata() const
-  { return m_vecFloatMetadata; }
+  { return data().vecFloatMetadata; }
     
-  //! Read only access to the m_floatMetadata dictionary
+  //! Read only access to the float dictionary
   const FloatMetadata& floatMetadata() const
-  { return m_floatMetadata; }
+  { return data().floatMetadata; }
 
-  //! Read only access to the m_vecIntMetadata dictionary
+  //! Read only access to the V3i dictionary
   const VecIntMetadata& vecIntMetadata() const
-  { return m_vecIntMetadata; }
+  { return data().vecIntMetadata; }
 
-  //! Read only access to the m_intMetadata dictionary
+  //! Read only access to the int dictionary
   const IntMetadata& intMetadata() const
-  { return m_intMetadata; }
+  { return data().intMetadata; }
 
-  //! Read only access to the m_strMetadata dictionary
+  //! Read only access to the string dictionary
   const StrMetadata& strMetadata() const
-  { return m_strMetadata; }
+  { return data().strMetadata; }
 
   //! Set the a V3f value for the given metadata name.
   void setVecFloatMetadata(const std::string &name, const V3f &val);
@@ -182,22 +183,42 @@ class FieldMetadata
 
  private:
 
+  // Private types -------------------------------------------------------------
+
+  //! The dictionaries, shared between copies until one of them changes
+  struct Data
+  {
+    //! V3f metadata
+    VecFloatMetadata vecFloatMetadata;
+    //! Float metadata
+    FloatMetadata    floatMetadata;
+    //! V3i metadata
+    VecIntMetadata   vecIntMetadata;
+    //! Int metadata
+    IntMetadata      intMetadata;
+    //! String metadata
+    StrMetadata      strMetadata;
+  };
+
   // Private member functions --------------------------------------------------
 
   FieldMetadata(const FieldMetadata &);
 
+  //! Returns the dictionaries for reading. 
+  const Data& data() const
+  { return m_data ? *m_data : emptyData(); }
+
+  //! Returns the dictionaries for modification, first making a private 
+  //! copy if they are shared with another FieldMetadata.
+  Data& writableData();
+
+  //! Stands in for m_data while there is no metadata
+  static const Data& emptyData();
+
   // Private data members ------------------------------------------------------
 
-  //! V3f metadata
-  VecFloatMetadata m_vecFloatMetadata;
-  //! Float metadata
-  FloatMetadata m_floatMetadata;
-  //! V3i metadata
-  VecIntMetadata m_vecIntMetadata;
-  //! Int metadata
-  IntMetadata m_intMetadata;
-  //! String metadata
-  StrMetadata m_strMetadata;
+  //! The dictionaries. NULL until the first metadata is set.
+  boost::shared_ptr<Data> m_data;
 
   //! Pointer to owner. It is assumed that this has a lifetime at least as
   //! long as the Metadata instance.
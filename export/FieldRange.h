@@ -0,0 +1,362 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file FieldRange.h
+  \brief Contains splittable ranges over the blocks of a SparseField and the
+  z slices of any field, along with parallelFor() and parallelReduce().
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_FieldRange_H_
+#define _INCLUDED_Field3D_FieldRange_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Split
+//----------------------------------------------------------------------------//
+
+//! Tag type for the splitting constructor of ranges
+struct Split
+{ };
+
+//----------------------------------------------------------------------------//
+// SlabRange
+//----------------------------------------------------------------------------//
+
+/*! \class SlabRange
+  \brief A range of z slices of a bounding box.
+
+  Like all ranges in this file, it follows the range concept of Intel TBB:
+  empty(), is_divisible() and a splitting constructor that moves the upper
+  half of the given range into the new one. Suits DenseField and any other
+  field whose voxels are stored slice by slice.
+*/
+
+class SlabRange
+{
+public:
+
+  // Constructors --------------------------------------------------------------
+
+  //! Covers all the slices of the given bounds. Ranges of at most grainSize
+  //! slices aren't split further.
+  explicit SlabRange(const Box3i &bounds, const int grainSize = 1)
+    : m_bounds(bounds), m_grainSize(std::max(grainSize, 1))
+  { }
+
+  //! Splitting constructor. Takes over the upper half of the slices of r
+  SlabRange(SlabRange &r, Split)
+    : m_bounds(r.m_bounds), m_grainSize(r.m_grainSize)
+  {
+    const int mid = r.m_bounds.min.z + 
+      (r.m_bounds.max.z - r.m_bounds.min.z + 1) / 2;
+    m_bounds.min.z = mid;
+    r.m_bounds.max.z = mid - 1;
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Whether the range holds no slices
+  bool empty() const
+  { return m_bounds.isEmpty(); }
+
+  //! Whether the range can be split in two
+  bool is_divisible() const
+  { return !empty() && m_bounds.max.z - m_bounds.min.z + 1 > m_grainSize; }
+
+  //! Bounds of the voxels in the range
+  const Box3i& bounds() const
+  { return m_bounds; }
+
+  //! First slice of the range
+  int begin() const
+  { return m_bounds.min.z; }
+
+  //! One past the last slice of the range
+  int end() const
+  { return m_bounds.max.z + 1; }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  Box3i m_bounds;
+  int   m_grainSize;
+
+};
+
+//----------------------------------------------------------------------------//
+// SparseBlockRange
+//----------------------------------------------------------------------------//
+
+/*! \class SparseBlockRange
+  \brief A range of the blocks of a SparseField.
+
+  The blocks are gathered once, when the range is constructed, and the 
+  split ranges share them. By default, unallocated blocks are left out, so
+  work is only divided among the blocks that hold data.
+  \note The range doesn't hold a reference to the field. Changing the block
+  structure of the field invalidates the range.
+*/
+
+class SparseBlockRange
+{
+public:
+
+  // Structs -------------------------------------------------------------------
+
+  //! One block of the range
+  struct Block
+  {
+    //! Index of the block, i.e. its block coordinate
+    V3i   idx;
+    //! Voxel-space bounds of the block, clipped to the data window
+    Box3i vsBounds;
+  };
+
+  // Constructors --------------------------------------------------------------
+
+  //! Covers the blocks of the given field. Ranges of at most grainSize 
+  //! blocks aren't split further.
+  template <class Data_T>
+  explicit SparseBlockRange(const SparseField<Data_T> &field, 
+                            const bool allocatedOnly = true,
+                            const int grainSize = 1)
+    : m_blocks(new std::vector<Block>), m_begin(0), 
+      m_grainSize(std::max(grainSize, 1))
+  {
+    const V3i    br        = field.blockRes();
+    const size_t numBlocks = static_cast<size_t>(br.x) * br.y * br.z;
+    Block        block;
+    for (size_t i = 0; i < numBlocks; ++i) {
+      block.idx = indexToCoord(i, br);
+      if (allocatedOnly && 
+          !field.blockIsAllocated(block.idx.x, block.idx.y, block.idx.z)) {
+        continue;
+      }
+      field.getGrainBounds(i, block.vsBounds);
+      m_blocks->push_back(block);
+    }
+    m_end = m_blocks->size();
+  }
+
+  //! Splitting constructor. Takes over the upper half of the blocks of r
+  SparseBlockRange(SparseBlockRange &r, Split)
+    : m_blocks(r.m_blocks), m_end(r.m_end), m_grainSize(r.m_grainSize)
+  {
+    m_begin = r.m_begin + (r.m_end - r.m_begin) / 2;
+    r.m_end = m_begin;
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Whether the range holds no blocks
+  bool empty() const
+  { return m_begin == m_end; }
+
+  //! Whether the range can be split in two
+  bool is_divisible() const
+  { return m_end - m_begin > static_cast<size_t>(m_grainSize); }
+
+  //! Number of blocks in the range
+  size_t size() const
+  { return m_end - m_begin; }
+
+  //! The i'th block of the range
+  const Block& operator[] (const size_t i) const
+  { return (*m_blocks)[m_begin + i]; }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! Blocks of the original range, shared by the ranges split from it
+  boost::shared_ptr<std::vector<Block> > m_blocks;
+  //! First block of this range
+  size_t m_begin;
+  //! One past the last block of this range
+  size_t m_end;
+  int    m_grainSize;
+
+};
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of pieces ranges are split into. Fixed, rather than tied to the
+  //! thread count, so that reductions give the same result for any thread
+  //! count.
+  const size_t k_numRangePieces = 64;
+
+  //--------------------------------------------------------------------------//
+
+  //! Splits a range into at most numPieces pieces, in order
+  template <class Range_T>
+  void splitRange(const Range_T &range, const size_t numPieces, 
+                  std::vector<Range_T> &pieces)
+  {
+    pieces.assign(1, range);
+    bool didSplit = true;
+    while (didSplit && pieces.size() < numPieces) {
+      didSplit = false;
+      std::vector<Range_T> next;
+      next.reserve(pieces.size() * 2);
+      for (size_t i = 0; i < pieces.size(); ++i) {
+        Range_T &piece = pieces[i];
+        const size_t remaining = pieces.size() - i;
+        if (next.size() + remaining < numPieces && piece.is_divisible()) {
+          Range_T upper(piece, Split());
+          next.push_back(piece);
+          next.push_back(upper);
+          didSplit = true;
+        } else {
+          next.push_back(piece);
+        }
+      }
+      pieces.swap(next);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs a body over each piece of a range. Used by parallelFor()
+  template <class Range_T, class Body_T>
+  class ForPieceOp
+  {
+  public:
+    ForPieceOp(const std::vector<Range_T> &pieces, const Body_T &body)
+      : m_pieces(pieces), m_body(body)
+    { }
+    void operator() (const size_t i)
+    { m_body(m_pieces[i]); }
+  private:
+    const std::vector<Range_T> &m_pieces;
+    //! Each thread works on its own copy of the body
+    Body_T                      m_body;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs one body per piece of a range. Used by parallelReduce()
+  template <class Range_T, class Body_T>
+  class ReducePieceOp
+  {
+  public:
+    ReducePieceOp(const std::vector<Range_T> &pieces, 
+                  std::vector<Body_T> &bodies)
+      : m_pieces(pieces), m_bodies(bodies)
+    { }
+    void operator() (const size_t i) const
+    { m_bodies[i](m_pieces[i]); }
+  private:
+    const std::vector<Range_T> &m_pieces;
+    std::vector<Body_T>        &m_bodies;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Splits the range into pieces and calls body(piece) for each of them, on
+//! numIOThreads() threads. Each thread works on its own copy of body.
+template <class Range_T, class Body_T>
+void parallelFor(const Range_T &range, const Body_T &body)
+{
+  if (range.empty()) {
+    return;
+  }
+  std::vector<Range_T> pieces;
+  detail::splitRange(range, detail::k_numRangePieces, pieces);
+  Sparse::runBlockOp(detail::ForPieceOp<Range_T, Body_T>(pieces, body), 
+                     pieces.size());
+}
+
+//----------------------------------------------------------------------------//
+
+//! Splits the range into pieces and calls body(piece) on a copy of init for
+//! each of them, on numIOThreads() threads. The copies are then combined in
+//! order with join(), so the result doesn't depend on the number of 
+//! threads.
+//! \returns init, joined with the results of all pieces
+template <class Range_T, class Body_T>
+Body_T parallelReduce(const Range_T &range, const Body_T &init)
+{
+  Body_T result(init);
+  if (range.empty()) {
+    return result;
+  }
+  std::vector<Range_T> pieces;
+  detail::splitRange(range, detail::k_numRangePieces, pieces);
+  std::vector<Body_T> bodies(pieces.size(), init);
+  Sparse::runBlockOp(detail::ReducePieceOp<Range_T, Body_T>(pieces, bodies),
+                     pieces.size());
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    result.join(bodies[i]);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,626 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file FieldReduce.h
+  \brief Contains block-parallel reductions over fields, such as value 
+  ranges, sums and histograms.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_FieldReduce_H_
+#define _INCLUDED_Field3D_FieldReduce_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "DenseField.h"
+#include "SparseField.h"
+#include "SparseFieldMinMaxTree.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// ReduceTraits
+//----------------------------------------------------------------------------//
+
+//! Type that sums of a given voxel type are accumulated in
+template <class Data_T>
+struct ReduceTraits
+{
+  typedef double SumType;
+};
+
+template <class T>
+struct ReduceTraits<FIELD3D_VEC3_T<T> >
+{
+  typedef V3d SumType;
+};
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Computes the min and max of all voxels in the data window. Vectors are 
+//! reduced per component.
+//! \note Runs on numIOThreads() threads. Unallocated sparse blocks 
+//! contribute their empty value without being visited voxel by voxel.
+//! \returns False if the data window is empty, in which case min and max
+//! are left untouched.
+template <class Field_T>
+bool reduceMinMax(const Field_T &field, 
+                  typename Field_T::value_type &min, 
+                  typename Field_T::value_type &max);
+
+//! Computes the sum of all voxels in the data window
+//! \note The result doesn't depend on the number of threads.
+template <class Field_T>
+typename ReduceTraits<typename Field_T::value_type>::SumType
+reduceSum(const Field_T &field);
+
+//! Counts the voxels of a scalar field in numBins equal bins spanning 
+//! [min, max]. Values outside the range are counted in the first or last 
+//! bin, and NaNs aren't counted.
+template <class Field_T>
+std::vector<size_t> histogram(const Field_T &field, const double min, 
+                              const double max, const int numBins);
+
+//----------------------------------------------------------------------------//
+// Accumulators
+//----------------------------------------------------------------------------//
+
+/*! \class MinMaxAccumulator
+  Accumulators gather rows of voxels with addRow(), runs of a single value
+  with addValue(), and combine partial results with merge(). They are the 
+  unit of work that the reduceField() functions run in parallel.
+*/
+
+template <class Data_T>
+struct MinMaxAccumulator
+{
+  MinMaxAccumulator()
+    : isEmpty(true)
+  { }
+  void addRow(const Data_T *row, const int n)
+  {
+    if (n <= 0) {
+      return;
+    }
+    Data_T lo = isEmpty ? row[0] : min;
+    Data_T hi = isEmpty ? row[0] : max;
+    for (int i = 0; i < n; ++i) {
+      lo = Sparse::rangeMin(lo, row[i]);
+      hi = Sparse::rangeMax(hi, row[i]);
+    }
+    min = lo;
+    max = hi;
+    isEmpty = false;
+  }
+  void addValue(const Data_T &value, const size_t count)
+  {
+    if (count > 0) {
+      addRow(&value, 1);
+    }
+  }
+  void merge(const MinMaxAccumulator &other)
+  {
+    if (!other.isEmpty) {
+      addValue(other.min, 1);
+      addValue(other.max, 1);
+    }
+  }
+  bool   isEmpty;
+  Data_T min, max;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sums voxel values in ReduceTraits::SumType
+template <class Data_T>
+struct SumAccumulator
+{
+  typedef typename ReduceTraits<Data_T>::SumType SumType;
+  SumAccumulator()
+    : sum(0.0)
+  { }
+  void addRow(const Data_T *row, const int n)
+  {
+    SumType s(0.0);
+    for (int i = 0; i < n; ++i) {
+      s += static_cast<SumType>(row[i]);
+    }
+    sum += s;
+  }
+  void addValue(const Data_T &value, const size_t count)
+  {
+    sum += static_cast<SumType>(value) * static_cast<double>(count);
+  }
+  void merge(const SumAccumulator &other)
+  {
+    sum += other.sum;
+  }
+  SumType sum;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Counts scalar voxel values in equal bins
+template <class Data_T>
+struct HistogramAccumulator
+{
+  HistogramAccumulator(const double min, const double max, const int numBins)
+    : bins(static_cast<size_t>(std::max(numBins, 1)), 0), m_min(min), 
+      m_scale(max > min ? bins.size() / (max - min) : 0.0)
+  { }
+  void addRow(const Data_T *row, const int n)
+  {
+    for (int i = 0; i < n; ++i) {
+      addValue(row[i], 1);
+    }
+  }
+  void addValue(const Data_T &value, const size_t count)
+  {
+    const double x = (static_cast<double>(value) - m_min) * m_scale;
+    if (x != x) {
+      return;
+    }
+    const double last = static_cast<double>(bins.size() - 1);
+    bins[static_cast<size_t>(std::min(std::max(x, 0.0), last))] += count;
+  }
+  void merge(const HistogramAccumulator &other)
+  {
+    for (size_t i = 0; i < bins.size(); ++i) {
+      bins[i] += other.bins[i];
+    }
+  }
+  std::vector<size_t> bins;
+private:
+  double m_min, m_scale;
+};
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of pieces reductions are split into. Fixed, rather than tied to
+  //! the thread count, so that results are the same for any thread count.
+  const size_t k_numReduceChunks = 64;
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds the voxels of one block that lie within the data window
+  template <class Data_T, class Acc_T>
+  void reduceBlock(const SparseField<Data_T> &field, const V3i &blockIdx,
+                   Acc_T &acc, std::vector<Data_T> &scratch)
+  {
+    const Box3i dw        = field.dataWindow();
+    const int   order     = field.blockOrder();
+    const int   blockSize = field.blockSize();
+    const V3i   size      = 
+      Sparse::validBlockSize(dw.size() + V3i(1), order, blockIdx);
+    const V3i   first     = dw.min + blockIdx * blockSize;
+
+    if (!field.blockIsAllocated(blockIdx.x, blockIdx.y, blockIdx.z)) {
+      acc.addValue(field.getBlockEmptyValue(blockIdx.x, blockIdx.y, 
+                                            blockIdx.z),
+                   static_cast<size_t>(size.x) * size.y * size.z);
+      return;
+    }
+
+    // Dynamically loaded blocks go through the field's own cache
+    if (field.isDynamicLoad()) {
+      scratch.resize(size.x);
+      for (int k = first.z; k < first.z + size.z; ++k) {
+        for (int j = first.y; j < first.y + size.y; ++j) {
+          for (int i = 0; i < size.x; ++i) {
+            scratch[i] = field.fastValue(first.x + i, j, k);
+          }
+          acc.addRow(&scratch[0], size.x);
+        }
+      }
+      return;
+    }
+
+    // Whole blocks are reduced in one pass, whatever their layout
+    const Data_T *p = field.blockData(blockIdx.x, blockIdx.y, blockIdx.z);
+    if (size == V3i(blockSize)) {
+      acc.addRow(p, blockSize * blockSize * blockSize);
+      return;
+    }
+
+    // Blocks on the edge of the data window are reduced a row at a time
+    const Sparse::BlockLayout layout = field.blockLayout();
+    for (int k = 0; k < size.z; ++k) {
+      for (int j = 0; j < size.y; ++j) {
+        if (layout == Sparse::BlockLayoutLinear) {
+          acc.addRow(p + Sparse::blockIndex(0, j, k, order, layout), size.x);
+        } else {
+          scratch.resize(size.x);
+          for (int i = 0; i < size.x; ++i) {
+            scratch[i] = p[Sparse::blockIndex(i, j, k, order, layout)];
+          }
+          acc.addRow(&scratch[0], size.x);
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Reduces one chunk of the blocks of a sparse field
+  template <class Data_T, class Acc_T>
+  class SparseReduceOp
+  {
+  public:
+    SparseReduceOp(const SparseField<Data_T> &field, 
+                   std::vector<Acc_T> &accs)
+      : m_field(field), m_accs(accs)
+    { }
+    void operator() (const size_t chunk)
+    {
+      const V3i    br        = m_field.blockRes();
+      const size_t numBlocks = static_cast<size_t>(br.x) * br.y * br.z;
+      const size_t begin     = numBlocks * chunk / m_accs.size();
+      const size_t end       = numBlocks * (chunk + 1) / m_accs.size();
+      for (size_t idx = begin; idx < end; ++idx) {
+        const V3i blockIdx(idx % br.x, (idx / br.x) % br.y, 
+                           idx / (static_cast<size_t>(br.x) * br.y));
+        reduceBlock(m_field, blockIdx, m_accs[chunk], m_scratch);
+      }
+    }
+  private:
+    const SparseField<Data_T> &m_field;
+    std::vector<Acc_T>        &m_accs;
+    //! Per-thread row storage
+    std::vector<Data_T>        m_scratch;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Reduces one chunk of the z slices of a dense field
+  template <class Data_T, class Acc_T>
+  class DenseReduceOp
+  {
+  public:
+    DenseReduceOp(const DenseField<Data_T> &field, std::vector<Acc_T> &accs)
+      : m_field(field), m_accs(accs)
+    { }
+    void operator() (const size_t chunk) const
+    {
+      const Box3i  dw        = m_field.dataWindow();
+      const size_t numSlices = dw.max.z - dw.min.z + 1;
+      const int    begin     = dw.min.z + numSlices * chunk / m_accs.size();
+      const int    end       = 
+        dw.min.z + numSlices * (chunk + 1) / m_accs.size();
+      const int    nx        = dw.max.x - dw.min.x + 1;
+      for (int k = begin; k < end; ++k) {
+        for (int j = dw.min.y; j <= dw.max.y; ++j) {
+          m_accs[chunk].addRow(m_field.rowPtr(j, k), nx);
+        }
+      }
+    }
+  private:
+    const DenseField<Data_T> &m_field;
+    std::vector<Acc_T>       &m_accs;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Reduces one chunk of the z slices of any field, through value()
+  template <class Field_T, class Acc_T>
+  class FieldReduceOp
+  {
+  public:
+    typedef typename Field_T::value_type Data_T;
+    FieldReduceOp(const Field_T &field, std::vector<Acc_T> &accs)
+      : m_field(field), m_accs(accs)
+    { }
+    void operator() (const size_t chunk)
+    {
+      const Box3i  dw        = m_field.dataWindow();
+      const size_t numSlices = dw.max.z - dw.min.z + 1;
+      const int    begin     = dw.min.z + numSlices * chunk / m_accs.size();
+      const int    end       = 
+        dw.min.z + numSlices * (chunk + 1) / m_accs.size();
+      const int    nx        = dw.max.x - dw.min.x + 1;
+      m_scratch.resize(nx);
+      for (int k = begin; k < end; ++k) {
+        for (int j = dw.min.y; j <= dw.max.y; ++j) {
+          for (int i = 0; i < nx; ++i) {
+            m_scratch[i] = m_field.value(dw.min.x + i, j, k);
+          }
+          m_accs[chunk].addRow(&m_scratch[0], nx);
+        }
+      }
+    }
+  private:
+    const Field_T       &m_field;
+    std::vector<Acc_T>  &m_accs;
+    //! Per-thread row storage
+    std::vector<Data_T>  m_scratch;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Merges per-chunk results in chunk order
+  template <class Acc_T>
+  Acc_T mergeChunks(const std::vector<Acc_T> &accs, const Acc_T &init)
+  {
+    Acc_T result(init);
+    for (size_t i = 0; i < accs.size(); ++i) {
+      result.merge(accs[i]);
+    }
+    return result;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+
+//! Runs an accumulator over all voxels in the data window of a sparse field
+//! \note init is copied for each chunk of the work, so it should be empty.
+template <class Data_T, class Acc_T>
+Acc_T reduceField(const SparseField<Data_T> &field, const Acc_T &init)
+{
+  const V3i    br        = field.blockRes();
+  const size_t numBlocks = static_cast<size_t>(br.x) * br.y * br.z;
+  std::vector<Acc_T> accs(std::min(numBlocks, detail::k_numReduceChunks), 
+                          init);
+  Sparse::runBlockOp(detail::SparseReduceOp<Data_T, Acc_T>(field, accs), 
+                     accs.size());
+  return detail::mergeChunks(accs, init);
+}
+
+//! Dense version reduces whole rows
+template <class Data_T, class Acc_T>
+Acc_T reduceField(const DenseField<Data_T> &field, const Acc_T &init)
+{
+  const Box3i  dw        = field.dataWindow();
+  const size_t numSlices = dw.isEmpty() ? 0 : dw.max.z - dw.min.z + 1;
+  std::vector<Acc_T> accs(std::min(numSlices, detail::k_numReduceChunks), 
+                          init);
+  Sparse::runBlockOp(detail::DenseReduceOp<Data_T, Acc_T>(field, accs), 
+                     accs.size());
+  return detail::mergeChunks(accs, init);
+}
+
+//! Fallback version reads each voxel through value()
+template <class Field_T, class Acc_T>
+Acc_T reduceField(const Field_T &field, const Acc_T &init)
+{
+  const Box3i  dw        = field.dataWindow();
+  const size_t numSlices = dw.isEmpty() ? 0 : dw.max.z - dw.min.z + 1;
+  std::vector<Acc_T> accs(std::min(numSlices, detail::k_numReduceChunks), 
+                          init);
+  Sparse::runBlockOp(detail::FieldReduceOp<Field_T, Acc_T>(field, accs), 
+                     accs.size());
+  return detail::mergeChunks(accs, init);
+}
+
+//----------------------------------------------------------------------------//
+// SparseBlockStats
+//----------------------------------------------------------------------------//
+
+/*! \class SparseBlockStats
+  \ingroup field
+  \brief Caches the min, max and sum of each block of a SparseField.
+
+  The block ranges are kept in a SparseFieldMinMaxTree, so the min and max
+  of the field are read from its top node, and only the sums are cached 
+  here. A writer that knows which blocks it touched calls updateBlock() for
+  those blocks as it goes, which keeps the statistics current without 
+  rescanning the field.
+
+  \note The statistics don't hold a reference to the field. It must be kept
+  alive for as long as they are updated.
+*/
+
+template <class Data_T>
+class SparseBlockStats
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename ReduceTraits<Data_T>::SumType SumType;
+
+  // Constructors --------------------------------------------------------------
+
+  //! Computes the statistics of all blocks
+  explicit SparseBlockStats(const SparseField<Data_T> &field)
+    : m_field(field), m_tree(field)
+  { update(); }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Recomputes the statistics of all blocks, on numIOThreads() threads.
+  //! Call this after the field is resized.
+  void update();
+
+  //! Recomputes the statistics of a single block
+  void updateBlock(const int bi, const int bj, const int bk);
+
+  //! Min and max of the field, from the top node of the range tree
+  //! \returns False if the data window is empty
+  bool minMax(Data_T &min, Data_T &max) const;
+
+  //! Sum of the field, from the cached block statistics
+  SumType sum() const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Computes the sum of one block
+  class UpdateOp
+  {
+  public:
+    UpdateOp(SparseBlockStats &stats)
+      : m_stats(stats)
+    { }
+    void operator() (const size_t idx)
+    {
+      const V3i br = m_stats.m_field.blockRes();
+      const V3i blockIdx(idx % br.x, (idx / br.x) % br.y, 
+                         idx / (static_cast<size_t>(br.x) * br.y));
+      SumAccumulator<Data_T> &sum = m_stats.m_sums[idx];
+      sum = SumAccumulator<Data_T>();
+      detail::reduceBlock(m_stats.m_field, blockIdx, sum, m_scratch);
+    }
+  private:
+    SparseBlockStats    &m_stats;
+    std::vector<Data_T>  m_scratch;
+  };
+
+  // Data members --------------------------------------------------------------
+
+  //! The field the statistics describe
+  const SparseField<Data_T>            &m_field;
+  //! Min and max of each block and of the levels above
+  SparseFieldMinMaxTree<Data_T>         m_tree;
+  //! Sum of each block, in block index order
+  std::vector<SumAccumulator<Data_T> >  m_sums;
+
+};
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+bool reduceMinMax(const Field_T &field, 
+                  typename Field_T::value_type &min, 
+                  typename Field_T::value_type &max)
+{
+  typedef MinMaxAccumulator<typename Field_T::value_type> Acc;
+  const Acc acc = reduceField(field, Acc());
+  if (acc.isEmpty) {
+    return false;
+  }
+  min = acc.min;
+  max = acc.max;
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+typename ReduceTraits<typename Field_T::value_type>::SumType
+reduceSum(const Field_T &field)
+{
+  typedef SumAccumulator<typename Field_T::value_type> Acc;
+  return reduceField(field, Acc()).sum;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+std::vector<size_t> histogram(const Field_T &field, const double min, 
+                              const double max, const int numBins)
+{
+  typedef HistogramAccumulator<typename Field_T::value_type> Acc;
+  return reduceField(field, Acc(min, max, numBins)).bins;
+}
+
+//----------------------------------------------------------------------------//
+// SparseBlockStats implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseBlockStats<Data_T>::update()
+{
+  const V3i br = m_field.blockRes();
+  m_tree.update();
+  m_sums.resize(static_cast<size_t>(br.x) * br.y * br.z);
+  Sparse::runBlockOp(UpdateOp(*this), m_sums.size());
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseBlockStats<Data_T>::updateBlock(const int bi, const int bj, 
+                                           const int bk)
+{
+  const V3i br = m_field.blockRes();
+  m_tree.updateBlock(bi, bj, bk);
+  UpdateOp op(*this);
+  op(bi + br.x * (bj + br.y * static_cast<size_t>(bk)));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseBlockStats<Data_T>::minMax(Data_T &min, Data_T &max) const
+{
+  if (m_field.dataWindow().isEmpty()) {
+    return false;
+  }
+  m_tree.nodeMinMax(m_tree.numLevels() - 1, V3i(0), min, max);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseBlockStats<Data_T>::SumType 
+SparseBlockStats<Data_T>::sum() const
+{
+  SumAccumulator<Data_T> acc;
+  for (size_t i = 0; i < m_sums.size(); ++i) {
+    acc.merge(m_sums[i]);
+  }
+  return acc.sum;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -5,7 +5,14 @@
 
 //------------------------------------------------------------------------------
 
+// System includes
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 // Project includes
+#include "FieldMapping.h"
+#include "SparseField.h"
 #include "Types.h"
 
 //----------------------------------------------------------------------------//
@@ -70,6 +77,60 @@ namespace detail {
     typedef V3f type;
   };
 
+  //! Orders the points of a batch so that the interpolator sees coherent
+  //! runs. The default does no reordering.
+  template <typename Field_T>
+  struct BatchSortKey
+  {
+    static const bool isEnabled = false;
+    BatchSortKey(const Field_T &)
+    { }
+    size_t operator()(const V3f &) const
+    { return 0; }
+  };
+
+  //! SparseField points are grouped by the block their lookup falls in, 
+  //! so that the batched interpolator looks up each block once per run
+  template <typename Data_T>
+  struct BatchSortKey<SparseField<Data_T> >
+  {
+    static const bool isEnabled = true;
+    BatchSortKey(const SparseField<Data_T> &f)
+      : m_dwMin(f.dataWindow().min), m_blockRes(f.blockRes()), 
+        m_blockOrder(f.blockOrder())
+    { }
+    size_t operator()(const V3f &vsP) const
+    {
+      // The lookup's first voxel, relative to the data window
+      const int bi = std::max(0, contToDisc(vsP.x - 0.5) - m_dwMin.x) >> 
+        m_blockOrder;
+      const int bj = std::max(0, contToDisc(vsP.y - 0.5) - m_dwMin.y) >> 
+        m_blockOrder;
+      const int bk = std::max(0, contToDisc(vsP.z - 0.5) - m_dwMin.z) >> 
+        m_blockOrder;
+      return bi + m_blockRes.x * (bj + m_blockRes.y * static_cast<size_t>(bk));
+    }
+  private:
+    V3i m_dwMin, m_blockRes;
+    int m_blockOrder;
+  };
+
+  //! Returns the world to voxel transform of a wrapped field as a single
+  //! matrix, object transform included, if its mapping is a 
+  //! MatrixFieldMapping
+  template <typename Wrapper_T>
+  bool wsToVsMatrix(const Wrapper_T &field, M44d &wsToVs)
+  {
+    const MatrixFieldMapping *mtxMapping = 
+      dynamic_cast<const MatrixFieldMapping*>(field.mapping);
+    if (!mtxMapping) {
+      return false;
+    }
+    wsToVs = field.doOsToWs ? 
+      field.wsToOs * mtxMapping->worldToVoxel() : mtxMapping->worldToVoxel();
+    return true;
+  }
+
 }
 
 //------------------------------------------------------------------------------
@@ -85,7 +146,8 @@ struct FieldSampler
     Max
   };
 
-  typedef typename WrapperVec_T::value_type::field_type Field_T;
+  typedef typename WrapperVec_T::value_type            Wrapper_T;
+  typedef typename Wrapper_T::field_type                Field_T;
   typedef typename Field_T::value_type                  Data_T;
   typedef typename detail::ScalarOrVector<Dims_T>::type Input_T;
 
@@ -93,92 +155,172 @@ struct FieldSampler
   static void sample(const WrapperVec_T &f, const V3d &wsP, float *value, 
                      size_t &numHits)
   {
-    // Reinterpret the pointer according to Dims_T
-    Input_T *data = reinterpret_cast<Input_T*>(value);
     // Loop over fields in vector
     for (size_t i = 0, end = f.size(); i < end; ++i) {
-      V3d vsP;
-      // Apply world to object transform
-      if (f[i].doOsToWs) {
-        V3d osP;
-        f[i].wsToOs.multVecMatrix(wsP, osP);
-        f[i].mapping->worldToVoxel(osP, vsP);
+      sampleField(f[i], wsP, value, numHits);
+    }
+  }
+
+  // Ordinary fields, only visiting f[indices[i] - offset] for i in 
+  // [0, numIndices)
+  static void sample(const WrapperVec_T &f, const size_t *indices, 
+                     const size_t numIndices, const size_t offset, 
+                     const V3d &wsP, float *value, size_t &numHits)
+  {
+    for (size_t i = 0; i < numIndices; ++i) {
+      sampleField(f[indices[i] - offset], wsP, value, numHits);
+    }
+  }
+
+  // Ordinary field
+  static void sampleField(const Wrapper_T &field, const V3d &wsP, 
+                          float *value, size_t &numHits)
+  {
+    // Reinterpret the pointer according to Dims_T
+    Input_T *data = reinterpret_cast<Input_T*>(value);
+    V3d vsP;
+    // Apply world to object transform
+    if (field.doOsToWs) {
+      V3d osP;
+      field.wsToOs.multVecMatrix(wsP, osP);
+      field.mapping->worldToVoxel(osP, vsP);
+    } else {
+      field.mapping->worldToVoxel(wsP, vsP);
+    }
+    // Sample
+    if (field.vsBounds.intersects(vsP)) {
+      // Count as within field
+      numHits++;
+      // Sample and remap
+      if (field.valueRemapOp) {
+        const Data_T unremapped = field.interp.sample(*field.field, vsP);
+        *data += field.valueRemapOp->remap(unremapped);
       } else {
-        f[i].mapping->worldToVoxel(wsP, vsP);
+        *data += field.interp.sample(*field.field, vsP);
       }
-      // Sample
-      if (f[i].vsBounds.intersects(vsP)) {
-        // Count as within field
-        numHits++;
-        // Sample and remap
-        if (f[i].valueRemapOp) {
-          const Data_T unremapped = f[i].interp.sample(*f[i].field, vsP);
-          *data += f[i].valueRemapOp->remap(unremapped);
-        } else {
-          *data += f[i].interp.sample(*f[i].field, vsP);
-        }
-      } 
-    }
+    } 
   }
 
-  // Ordinary fields
+  // Ordinary fields. Each field is sampled with a single batch: points 
+  // outside its bounds are dropped, the rest are taken to voxel space, 
+  // ordered by block and handed to the batched interpolator.
   static void sampleMultiple(const WrapperVec_T &f, const size_t neval,
                              const float *wsPs, float *value, size_t *numHits)
   {
+    typedef detail::BatchSortKey<Field_T> SortKey;
+
+    // Reinterpret the pointers according to Dims_T
+    Input_T   *data = reinterpret_cast<Input_T*>(value);
+    const V3f *wsP  = reinterpret_cast<const V3f*>(wsPs);
+
+    // Scratch space, reused across fields
+    std::vector<size_t>                     hits;
+    std::vector<V3f>                        vsPs;
+    std::vector<std::pair<size_t, size_t> > order;
+    std::vector<V3f>                        sortedVsPs;
+    std::vector<Data_T>                     samples;
+    std::vector<Input_T>                    remapped;
+
     // Loop over fields in vector
     for (size_t i = 0; i < f.size(); ++i) {
       const typename WrapperVec_T::value_type &field = f[i];
 
-      // Reinterpret the pointer according to Dims_T
-      Input_T *data = reinterpret_cast<Input_T*>(value);
-
-      if (field.doOsToWs || field.valueRemapOp) {
-
-        // Loop over samples
+      hits.clear();
+      vsPs.clear();
+
+      // Transform to voxel space, keeping the points within the field
+      M44d wsToVs;
+      if (detail::wsToVsMatrix(field, wsToVs)) {
+        // A single affine transform, applied to all points at once
+        const double m[12] = {
+          wsToVs[0][0], wsToVs[0][1], wsToVs[0][2], 
+          wsToVs[1][0], wsToVs[1][1], wsToVs[1][2], 
+          wsToVs[2][0], wsToVs[2][1], wsToVs[2][2], 
+          wsToVs[3][0], wsToVs[3][1], wsToVs[3][2]
+        };
         for (size_t ieval = 0; ieval < neval; ++ieval) {
-          const V3d wsP(*reinterpret_cast<const V3f*>(wsPs + 3 * ieval));
-          V3d vsP;
-          // Apply world to object transform
+          const V3f &p = wsP[ieval];
+          if (field.doWsBoundsOptimization && !field.wsBounds.intersects(p)) {
+            continue;
+          }
+          const V3d vsP(p.x * m[0] + p.y * m[3] + p.z * m[6] + m[9],
+                        p.x * m[1] + p.y * m[4] + p.z * m[7] + m[10],
+                        p.x * m[2] + p.y * m[5] + p.z * m[8] + m[11]);
+          if (field.vsBounds.intersects(vsP)) {
+            hits.push_back(ieval);
+            vsPs.push_back(V3f(vsP));
+          }
+        }
+      } else {
+        // Gather the points in object space and let the mapping transform
+        // them as one batch
+        for (size_t ieval = 0; ieval < neval; ++ieval) {
+          const V3f &p = wsP[ieval];
+          if (field.doWsBoundsOptimization && !field.wsBounds.intersects(p)) {
+            continue;
+          }
           if (field.doOsToWs) {
             V3d osP;
-            field.wsToOs.multVecMatrix(wsP, osP);
-            field.mapping->worldToVoxel(osP, vsP);
+            field.wsToOs.multVecMatrix(V3d(p), osP);
+            vsPs.push_back(V3f(osP));
           } else {
-            field.mapping->worldToVoxel(wsP, vsP);
+            vsPs.push_back(p);
           }
-          // Sample
-          if (field.vsBounds.intersects(vsP)) {
-            // Count as within field
-            numHits[ieval]++;
-            // Sample and remap
-            if (field.valueRemapOp) {
-              const Data_T unremapped = field.interp.sample(*field.field, vsP);
-              data[ieval] += field.valueRemapOp->remap(unremapped);
-            } else {
-              data[ieval] += field.interp.sample(*field.field, vsP);
-            }
-          } 
+          hits.push_back(ieval);
         }
+        if (!vsPs.empty()) {
+          field.mapping->worldToVoxel(&vsPs[0], &vsPs[0], vsPs.size());
+        }
+        // Keep the points within the field
+        size_t numKept = 0;
+        for (size_t h = 0, end = hits.size(); h < end; ++h) {
+          if (field.vsBounds.intersects(V3d(vsPs[h]))) {
+            hits[numKept]   = hits[h];
+            vsPs[numKept++] = vsPs[h];
+          }
+        }
+        hits.resize(numKept);
+        vsPs.resize(numKept);
+      }
+      if (hits.empty()) {
+        continue;
+      }
 
-      } else {
-
-        const Imath::Box3d &vsBounds_d = field.vsBounds;
+      // Group the points by block
+      if (SortKey::isEnabled) {
+        const SortKey key(*field.field);
+        order.resize(hits.size());
+        for (size_t h = 0, end = hits.size(); h < end; ++h) {
+          order[h] = std::make_pair(key(vsPs[h]), h);
+        }
+        std::sort(order.begin(), order.end());
+        sortedVsPs.resize(hits.size());
+        for (size_t h = 0, end = hits.size(); h < end; ++h) {
+          sortedVsPs[h] = vsPs[order[h].second];
+        }
+        vsPs.swap(sortedVsPs);
+      }
 
-        // Loop over samples
-        for (size_t ieval = 0; ieval < neval; ++ieval) {
-          const V3d wsP(*reinterpret_cast<const V3f*>(wsPs + 3 * ieval));
-          V3d vsP;
+      // Sample the batch
+      samples.resize(hits.size());
+      field.interp.sample(*field.field, hits.size(), &vsPs[0], &samples[0]);
 
-          // Apply world to object transform
-          field.mapping->worldToVoxel(wsP, vsP);
+      // Remap the batch with a single call
+      if (field.valueRemapOp) {
+        remapped.assign(samples.begin(), samples.end());
+        field.valueRemapOp->remapBatch(remapped.size(), &remapped[0]);
+      }
 
-          // Sample
-          if (vsBounds_d.intersects(vsP)) {
-            // Count as within field
-            numHits[ieval]++;
-            // Sample
-            data[ieval] += field.interp.sample(*field.field, vsP);
-          }
+      // Accumulate
+      for (size_t h = 0, end = hits.size(); h < end; ++h) {
+        const size_t ieval = 
+          hits[SortKey::isEnabled ? order[h].second : h];
+        // Count as within field
+        numHits[ieval]++;
+        if (field.valueRemapOp) {
+          data[ieval] += remapped[h];
+        } else {
+          data[ieval] += samples[h];
         }
       }
     }
@@ -188,32 +330,52 @@ struct FieldSampler
   static void sampleMIP(const WrapperVec_T &f, const V3d &wsP,
                         const float wsSpotSize, float *value, size_t &numHits)
   {
-    // Reinterpret the pointer according to Dims_T
-    Input_T *data = reinterpret_cast<Input_T*>(value);
     // Loop over fields in vector
     for (size_t i = 0, end = f.size(); i < end; ++i) {
-      V3d vsP;
-      float spotSize = wsSpotSize / f[i].worldScale;
-      // Apply world to object transform
-      if (f[i].doOsToWs) {
-        V3d osP;
-        f[i].wsToOs.multVecMatrix(wsP, osP);
-        f[i].mapping->worldToVoxel(osP, vsP);
-        spotSize = wsSpotSize / f[i].worldScale;
+      sampleMIPField(f[i], wsP, wsSpotSize, value, numHits);
+    }
+  }
+
+  // MIP fields, only visiting f[indices[i] - offset] for i in 
+  // [0, numIndices)
+  static void sampleMIP(const WrapperVec_T &f, const size_t *indices, 
+                        const size_t numIndices, const size_t offset, 
+                        const V3d &wsP, const float wsSpotSize, float *value, 
+                        size_t &numHits)
+  {
+    for (size_t i = 0; i < numIndices; ++i) {
+      sampleMIPField(f[indices[i] - offset], wsP, wsSpotSize, value, numHits);
+    }
+  }
+
+  // MIP field
+  static void sampleMIPField(const Wrapper_T &field, const V3d &wsP,
+                             const float wsSpotSize, float *value, 
+                             size_t &numHits)
+  {
+    // Reinterpret the pointer according to Dims_T
+    Input_T *data = reinterpret_cast<Input_T*>(value);
+    V3d vsP;
+    float spotSize = wsSpotSize / field.worldScale;
+    // Apply world to object transform
+    if (field.doOsToWs) {
+      V3d osP;
+      field.wsToOs.multVecMatrix(wsP, osP);
+      field.mapping->worldToVoxel(osP, vsP);
+      spotSize = wsSpotSize / field.worldScale;
+    } else {
+      field.mapping->worldToVoxel(wsP, vsP);
+    }
+    // Sample
+    if (field.vsBounds.intersects(vsP)) {
+      // Count as within field
+      numHits++;
+      // Sample and remap
+      if (field.valueRemapOp) {
+        const Data_T unremapped = field.interp->sample(vsP, spotSize);
+        *data += field.valueRemapOp->remap(unremapped);
       } else {
-        f[i].mapping->worldToVoxel(wsP, vsP);
-      }
-      // Sample
-      if (f[i].vsBounds.intersects(vsP)) {
-        // Count as within field
-        numHits++;
-        // Sample and remap
-        if (f[i].valueRemapOp) {
-          const Data_T unremapped = f[i].interp->sample(vsP, spotSize);
-          *data += f[i].valueRemapOp->remap(unremapped);
-        } else {
-          *data += f[i].interp->sample(vsP, spotSize);
-        }
+        *data += field.interp->sample(vsP, spotSize);
       }
     }
   }
@@ -223,6 +385,10 @@ struct FieldSampler
                                 const float *wsPs, const float *wsSpotSizes,
                                 float *value, size_t *numHits)
   {
+    // Scratch space for samples to remap, reused across fields
+    std::vector<size_t>  hits;
+    std::vector<Input_T> remapped;
+
     // Loop over fields in vector
     for (size_t i = 0; i < f.size(); ++i) {
       const typename WrapperVec_T::value_type &field = f[i];
@@ -232,6 +398,10 @@ struct FieldSampler
 
       if (field.doOsToWs || field.valueRemapOp) {
 
+        // Samples to remap are gathered, then remapped as one batch
+        hits.clear();
+        remapped.clear();
+
         if (field.valueRemapOp && field.doWsBoundsOptimization) {
 
           // Loop over samples
@@ -250,8 +420,8 @@ struct FieldSampler
                 // Count as within field
                 numHits[ieval]++;
                 const float spotSize = wsSpotSizes[ieval] / field.worldScale;
-                const Data_T unremapped = field.interp->sample(vsP, spotSize);
-                data[ieval] += field.valueRemapOp->remap(unremapped);
+                hits.push_back(ieval);
+                remapped.push_back(field.interp->sample(vsP, spotSize));
               }
             }
           }
@@ -280,14 +450,22 @@ struct FieldSampler
               // Count as within field
               numHits[ieval]++;
               if (field.valueRemapOp) {
-                const Data_T unremapped = field.interp->sample(vsP, spotSize);
-                *idata += field.valueRemapOp->remap(unremapped);
+                hits.push_back(ieval);
+                remapped.push_back(field.interp->sample(vsP, spotSize));
               } else {
                 *idata += field.interp->sample(vsP, spotSize);
               }
             }
           }
         }
+
+        // Remap and accumulate
+        if (!hits.empty()) {
+          field.valueRemapOp->remapBatch(remapped.size(), &remapped[0]);
+          for (size_t h = 0, end = hits.size(); h < end; ++h) {
+            data[hits[h]] += remapped[h];
+          }
+        }
       } else {
 
         const Imath::Box3d &vsBounds_d = field.vsBounds;
@@ -344,15 +522,8 @@ struct FieldSampler
           return;
         }
       }
-      for (int k = dvsBounds.min.z; k <= dvsBounds.max.z; ++k) {
-        for (int j = dvsBounds.min.y; j <= dvsBounds.max.y; ++j) {
-          for (int i = dvsBounds.min.x; i <= dvsBounds.max.x; ++i) {
-            const Data_T val = f[field].field->fastValue(i, j, k);
-            *minData = detail::min(val, *minData);
-            *maxData = detail::max(val, *maxData);
-          }
-        }
-      }
+      f[field].minMaxAccel.getMinMax(*f[field].field, dvsBounds, 
+                                     *minData, *maxData);
     }
   }
 
@@ -6,6 +6,9 @@
 //------------------------------------------------------------------------------
 
 // Library includes
+#include <algorithm>
+#include <cmath>
+
 #include <OpenEXR/ImathMatrixAlgo.h>
 
 // Project includes
@@ -16,6 +19,7 @@
 #include "MIPField.h"
 #include "MIPUtil.h"
 #include "SparseField.h"
+#include "SparseFieldMinMaxTree.h"
 #include "FieldSampler.h"
 #include "FieldMapping.h"
 
@@ -36,6 +40,8 @@ FIELD3D_NAMESPACE_OPEN
 //! called upon to remap the resulting values.
 //! \note The class is not templated, and it needs to handle both scalar
 //! and vector values.
+//! \note The batched sampling calls of FieldGroup remap all the samples of
+//! a field with a single call to remapBatch().
 class ValueRemapOp
 {
 public:
@@ -44,6 +50,11 @@ public:
 
   typedef boost::shared_ptr<ValueRemapOp> Ptr;
 
+  // Ctors, dtor ---
+
+  virtual ~ValueRemapOp()
+  { }
+
   // To be implemented by subclasses ---
 
   //! Remaps a float value
@@ -51,6 +62,183 @@ public:
   //! Remaps a V3f value
   virtual V3f   remap(const V3f &value)  const = 0;
 
+  // May be implemented by subclasses ---
+
+  //! Remaps n float values in place. The default implementation calls 
+  //! remap() for each value.
+  virtual void remapBatch(const size_t n, float *values) const
+  {
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = remap(values[i]);
+    }
+  }
+  //! Remaps n V3f values in place. The default implementation calls 
+  //! remap() for each value.
+  virtual void remapBatch(const size_t n, V3f *values) const
+  {
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = remap(values[i]);
+    }
+  }
+
+};
+
+//------------------------------------------------------------------------------
+// ScaleOffsetRemapOp
+//------------------------------------------------------------------------------
+
+//! Remaps values to value * scale + offset. Vectors are remapped per 
+//! component.
+class ScaleOffsetRemapOp : public ValueRemapOp
+{
+public:
+
+  // Ctors ---
+
+  ScaleOffsetRemapOp(const float scale, const float offset)
+    : m_scale(scale), m_offset(offset)
+  { }
+
+  // From ValueRemapOp ---
+
+  virtual float remap(const float value) const
+  { return value * m_scale + m_offset; }
+  virtual V3f   remap(const V3f &value)  const
+  { return value * m_scale + V3f(m_offset); }
+
+  //! A single loop over the values, which the compiler can vectorize
+  virtual void remapBatch(const size_t n, float *values) const
+  {
+    const float scale = m_scale, offset = m_offset;
+    for (size_t i = 0; i < n; ++i) {
+      values[i] = values[i] * scale + offset;
+    }
+  }
+  //! Vectors are remapped as 3 * n floats
+  virtual void remapBatch(const size_t n, V3f *values) const
+  { remapBatch(3 * n, reinterpret_cast<float*>(values)); }
+
+private:
+
+  // Data members ---
+
+  float m_scale;
+  float m_offset;
+
+};
+
+//------------------------------------------------------------------------------
+// GammaRemapOp
+//------------------------------------------------------------------------------
+
+//! Remaps values to pow(value, gamma). Negative values are clamped to 
+//! zero first. Vectors are remapped per component.
+class GammaRemapOp : public ValueRemapOp
+{
+public:
+
+  // Ctors ---
+
+  GammaRemapOp(const float gamma)
+    : m_gamma(gamma)
+  { }
+
+  // From ValueRemapOp ---
+
+  virtual float remap(const float value) const
+  { return std::pow(std::max(value, 0.0f), m_gamma); }
+  virtual V3f   remap(const V3f &value)  const
+  { return V3f(remap(value.x), remap(value.y), remap(value.z)); }
+
+  //! Gamma 1 and 2 are common enough to skip pow() for
+  virtual void remapBatch(const size_t n, float *values) const
+  {
+    const float gamma = m_gamma;
+    if (gamma == 1.0f) {
+      for (size_t i = 0; i < n; ++i) {
+        values[i] = std::max(values[i], 0.0f);
+      }
+    } else if (gamma == 2.0f) {
+      for (size_t i = 0; i < n; ++i) {
+        const float v = std::max(values[i], 0.0f);
+        values[i] = v * v;
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        values[i] = std::pow(std::max(values[i], 0.0f), gamma);
+      }
+    }
+  }
+  //! Vectors are remapped as 3 * n floats
+  virtual void remapBatch(const size_t n, V3f *values) const
+  { remapBatch(3 * n, reinterpret_cast<float*>(values)); }
+
+private:
+
+  // Data members ---
+
+  float m_gamma;
+
+};
+
+//------------------------------------------------------------------------------
+// MinMaxAccel
+//------------------------------------------------------------------------------
+
+//! Answers min/max queries over a field's voxels for FieldSampler. The 
+//! default implementation loops over the voxels.
+template <typename Field_T>
+struct MinMaxAccel
+{
+  MinMaxAccel(const Field_T &)
+  { }
+
+  //! Expands min and max to include the voxels in dvsBounds, which must
+  //! lie inside the data window
+  template <typename T>
+  void getMinMax(const Field_T &f, const Box3i &dvsBounds, 
+                 T &min, T &max) const
+  {
+    for (int k = dvsBounds.min.z; k <= dvsBounds.max.z; ++k) {
+      for (int j = dvsBounds.min.y; j <= dvsBounds.max.y; ++j) {
+        for (int i = dvsBounds.min.x; i <= dvsBounds.max.x; ++i) {
+          const typename Field_T::value_type val = f.fastValue(i, j, k);
+          min = detail::min(val, min);
+          max = detail::max(val, max);
+        }
+      }
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
+//! SparseFields are queried through a SparseFieldMinMaxTree. The tree is 
+//! built on the first query, and shared by copies of the wrapper.
+template <typename Data_T>
+struct MinMaxAccel<SparseField<Data_T> >
+{
+  MinMaxAccel(const SparseField<Data_T> &f)
+    : tree(new SparseFieldMinMaxTree<Data_T>(f))
+  { }
+
+  template <typename T>
+  void getMinMax(const SparseField<Data_T> &f, const Box3i &dvsBounds, 
+                 T &min, T &max) const
+  {
+    if (dvsBounds.isEmpty()) {
+      return;
+    }
+    Data_T lo = f.fastValue(dvsBounds.min.x, dvsBounds.min.y, 
+                            dvsBounds.min.z);
+    Data_T hi = lo;
+    if (tree->getMinMax(dvsBounds, lo, hi)) {
+      min = detail::min(lo, min);
+      max = detail::max(hi, max);
+    }
+  }
+
+  boost::shared_ptr<SparseFieldMinMaxTree<Data_T> > tree;
 };
 
 //------------------------------------------------------------------------------
@@ -73,7 +261,8 @@ struct FieldWrapper
       worldScale(1.0), 
       doOsToWs(false),
       doWsBoundsOptimization(false),
-      valueRemapOp(NULL)
+      valueRemapOp(NULL),
+      minMaxAccel(*f)
   { }
 
   void setOsToWs(const M44d &i_osToWs)
@@ -145,6 +334,8 @@ struct FieldWrapper
   //! Optionally, set a ValueRemapOp to remap values
   ValueRemapOp::Ptr               valueRemapOpPtr;
   const ValueRemapOp             *valueRemapOp;
+  //! Answers getMinMax() queries
+  MinMaxAccel<Field_T>            minMaxAccel;
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,150 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file HalfConvert.h
+  \brief Contains functions converting arrays between half and float.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_HalfConvert_H_
+#define _INCLUDED_Field3D_HalfConvert_H_
+
+//----------------------------------------------------------------------------//
+
+#include <algorithm>
+
+#if defined(__F16C__)
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
+
+#include "Types.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// HalfConvert
+//----------------------------------------------------------------------------//
+
+//! Bulk conversion between half and float. Converting one value at a time
+//! goes through a 256kB lookup table for half to float, and through a 
+//! branchy rounding routine for float to half. When the compiler targets 
+//! F16C (-mf16c, or ENABLE_F16C in CMake) or AArch64, these convert 8 or 4
+//! values per instruction instead. Results are identical either way, 
+//! rounding to nearest even.
+//! \ingroup field
+namespace HalfConvert {
+
+  //! Converts n halfs to floats
+  inline void toFloat(const half *src, const size_t n, float *dst)
+  {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+      const __m128i h = 
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+      const uint16x4_t h = 
+        vld1_u16(reinterpret_cast<const unsigned short *>(src + i));
+      vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(h)));
+    }
+#endif
+    for (; i < n; ++i) {
+      dst[i] = src[i];
+    }
+  }
+
+  //! Converts n floats to halfs
+  inline void toHalf(const float *src, const size_t n, half *dst)
+  {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+      const __m128i h = 
+        _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), h);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+      const float16x4_t h = vcvt_f16_f32(vld1q_f32(src + i));
+      vst1_u16(reinterpret_cast<unsigned short *>(dst + i), 
+               vreinterpret_u16_f16(h));
+    }
+#endif
+    for (; i < n; ++i) {
+      dst[i] = src[i];
+    }
+  }
+
+  //! The type that values of Data_T are best computed in before being 
+  //! stored. Half values are computed as floats and stored in bulk.
+  template <typename Data_T>
+  struct Compute
+  {
+    typedef Data_T type;
+    //! Stores n computed values
+    static void store(const type *src, const size_t n, Data_T *dst)
+    { std::copy(src, src + n, dst); }
+  };
+
+  template <>
+  struct Compute<half>
+  {
+    typedef float type;
+    static void store(const float *src, const size_t n, half *dst)
+    { toHalf(src, n, dst); }
+  };
+
+} // namespace HalfConvert
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -438,6 +438,46 @@ public:
   }
 };
 
+//! Scoped object - creates a property list on creation and closes it on 
+//! destruction.
+//! \ingroup hdf5
+class H5ScopedPcreate : public H5Base
+{
+public:
+  H5ScopedPcreate(hid_t cls_id)
+  { 
+    GlobalLock lock(g_hdf5Mutex);
+    m_id = H5Pcreate(cls_id);
+  }
+  ~H5ScopedPcreate()
+  {
+    GlobalLock lock(g_hdf5Mutex);
+    if (m_id >= 0)
+      H5Pclose(m_id);
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Scoped object - gets a dataset's creation property list on creation and
+//! closes it on destruction.
+//! \ingroup hdf5
+class H5ScopedDget_create_plist : public H5Base
+{
+public:
+  H5ScopedDget_create_plist(hid_t dataset_id)
+  { 
+    GlobalLock lock(g_hdf5Mutex);
+    m_id = H5Dget_create_plist(dataset_id);
+  }
+  ~H5ScopedDget_create_plist()
+  {
+    GlobalLock lock(g_hdf5Mutex);
+    if (m_id >= 0)
+      H5Pclose(m_id);
+  }
+};
+
 //----------------------------------------------------------------------------//
 // Hdf5Util functions
 //----------------------------------------------------------------------------//
@@ -564,6 +604,50 @@ FIELD3D_API bool writeAttribute(hid_t location, const std::string& attrName,
 //! \ingroup hdf5
 FIELD3D_API bool checkHdf5Gzip();
 
+//----------------------------------------------------------------------------//
+
+//! Applies the chunk cache size set with setHdf5ChunkCache() to a file 
+//! access property list
+//! \ingroup hdf5
+FIELD3D_API void setChunkCache(hid_t fileAccessList);
+
+//----------------------------------------------------------------------------//
+
+//! Reads a one-dimensional, gzip-compressed data set by reading its raw 
+//! chunks under the HDF5 lock and inflating them on numIOThreads() threads
+//! outside of it. dst must hold the whole data set, in elementSize-byte
+//! elements stored in native byte order.
+//! \returns False if the data set can't be read this way, in which case 
+//! dst is left in an undefined state and H5Dread() should be used instead
+//! \ingroup hdf5
+FIELD3D_API bool readDeflatedChunks(hid_t dataSet, const size_t elementSize,
+                                    void *dst);
+
+//----------------------------------------------------------------------------//
+
+//! Writes a one-dimensional, gzip-compressed data set by deflating its 
+//! chunks on numIOThreads() threads and handing them to HDF5 as raw chunks
+//! under the HDF5 lock. src holds the whole data set, in elementSize-byte 
+//! elements stored in native byte order. The chunks are deflated at the 
+//! level the data set was created with, so the file is the same as if 
+//! H5Dwrite() had been used.
+//! \returns False if the data set can't be written this way, in which case
+//! nothing was written and H5Dwrite() should be used instead
+//! \ingroup hdf5
+FIELD3D_API bool writeDeflatedChunks(hid_t dataSet, const size_t elementSize,
+                                     const void *src);
+
+//----------------------------------------------------------------------------//
+
+//! Writes a two-dimensional, gzip-compressed data set whose chunks are 
+//! single rows, such as the blocks of a SparseField, the same way as 
+//! writeDeflatedChunks(). rows holds the data of each row, in order.
+//! \returns False if the data set can't be written this way, in which case
+//! nothing was written and H5Dwrite() should be used instead
+//! \ingroup hdf5
+FIELD3D_API bool writeDeflatedRows(hid_t dataSet, const size_t elementSize,
+                                   const std::vector<const void *> &rows);
+
 //----------------------------------------------------------------------------//
 // Templated functions and classes
 //----------------------------------------------------------------------------//
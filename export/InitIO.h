@@ -63,7 +63,10 @@ FIELD3D_API void initIO();
 
 //----------------------------------------------------------------------------//
 
-//! Sets the number of threads to use for I/O multi-threading
+//! Sets the number of threads to use for I/O multi-threading. This also
+//! bounds the threads of the MIP, resampling and other block-parallel
+//! utilities, which all run on the shared ThreadPool. Raising it adds
+//! threads to the pool.
 FIELD3D_API void setNumIOThreads(const size_t numThreads);
 
 //----------------------------------------------------------------------------//
@@ -73,6 +76,321 @@ FIELD3D_API size_t numIOThreads();
 
 //----------------------------------------------------------------------------//
 
+//! Sets whether Field3DInputFile memory-maps Ogawa files rather than reading
+//! them. Uncompressed data such as block maps is then used in place and
+//! compressed blocks are decompressed straight out of the mapping. Only
+//! affects files opened afterwards. Off by default.
+FIELD3D_API void setMapOgawaFiles(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether Field3DInputFile memory-maps Ogawa files
+FIELD3D_API bool mapOgawaFiles();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether uncompressed DenseField layers that are read whole from a
+//! memory-mapped Ogawa file point straight at the mapping rather than 
+//! copying it. Loading is then immediate, voxels are paged in as they're 
+//! sampled, and the pages are shared by all processes that map the file. 
+//! A field copies its voxels the first time it's written to. Layers whose 
+//! data isn't suitably aligned in the file are read as usual. Needs 
+//! setMapOgawaFiles(). Off by default.
+FIELD3D_API void setMapDenseLayers(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether DenseField layers point at memory-mapped files
+FIELD3D_API bool mapDenseLayers();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether large field storage is backed by 2 MB huge pages, which cuts
+//! TLB misses when sampling big fields at random. DenseField arrays of at
+//! least 2 MB, and the slabs of the SparseField block pool, are then
+//! aligned to 2 MB and advised to use transparent huge pages, where the
+//! platform supports it. Only affects storage allocated afterwards. Off by
+//! default.
+FIELD3D_API void setHugePages(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether large field storage is backed by huge pages
+FIELD3D_API bool hugePages();
+
+//----------------------------------------------------------------------------//
+
+//! Sets how many bytes of free voxel arrays the SparseField block pool of
+//! each data type may hold on to. The pool is trimmed back to whole slabs 
+//! in use when a SparseField is destroyed while it holds more. Defaults to
+//! 64 MB.
+FIELD3D_API void setSparseBlockPoolLimit(const size_t bytes);
+
+//----------------------------------------------------------------------------//
+
+//! Returns how many bytes of free voxel arrays the block pool may hold
+FIELD3D_API size_t sparseBlockPoolLimit();
+
+//----------------------------------------------------------------------------//
+
+//! Enumerates the ways SparseField block data may be stored in Ogawa files
+enum SparseStorageMode {
+  //! Each occupied block is zlib-compressed. This is the default.
+  SparseStorageCompressed = 0,
+  //! Each occupied block is stored uncompressed, starting on a page boundary,
+  //! so that dynamic reads can memory-map the blocks instead of copying them
+  SparseStorageMapped,
+  //! Each occupied block is split into up to 64 tiles of at least 4^3 
+  //! voxels that are compressed separately with the sparseCodec(). Dynamic
+  //! reads then only decompress the tiles that lookups touch. Blocks are
+  //! never quantized in this mode, and blocks smaller than 8^3 voxels are
+  //! compressed whole.
+  SparseStorageTiled
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sets the storage mode used when writing SparseFields to Ogawa files
+FIELD3D_API void setSparseStorageMode(const SparseStorageMode mode);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the storage mode used when writing SparseFields to Ogawa files
+FIELD3D_API SparseStorageMode sparseStorageMode();
+
+//----------------------------------------------------------------------------//
+
+//! Enumerates the codecs used for compressed SparseField blocks in Ogawa
+//! files. The values are stored in the files and must not change.
+//! The LZ4 and Zstd codecs are only available if the library was built with
+//! them, see BlockCodec::isValid().
+enum SparseCodec {
+  //! zlib at its fastest level. This is the default, and what files written
+  //! before codecs were recorded use.
+  SparseCodecZlib = 0,
+  //! Byte-shuffles each value before zlib compression. Usually compresses
+  //! float and half data better, and decompresses faster as a result
+  SparseCodecShuffleZlib,
+  //! LZ4. Compresses less than zlib, but decompresses several times faster
+  SparseCodecLz4,
+  //! Byte-shuffles each value before LZ4 compression
+  SparseCodecShuffleLz4,
+  //! Zstandard. Compresses about as well as zlib at a given level, and 
+  //! decompresses a few times faster
+  SparseCodecZstd,
+  //! Byte-shuffles each value before Zstandard compression
+  SparseCodecShuffleZstd
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sets the codec used when writing compressed SparseFields to Ogawa files.
+//! Codecs the library wasn't built with are refused with a warning, 
+//! leaving the current codec in place.
+FIELD3D_API void setSparseCodec(const SparseCodec codec);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the codec used when writing compressed SparseFields to Ogawa files
+FIELD3D_API SparseCodec sparseCodec();
+
+//----------------------------------------------------------------------------//
+
+//! Sets the zlib level, 1-9, that the codecs compress blocks and slabs
+//! with. Higher levels give smaller files that take longer to write;
+//! reading speed barely changes. The default is 1. Zstd uses the same
+//! level, LZ4 has no levels.
+FIELD3D_API void setSparseCompressionLevel(const int level);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the zlib level used by the codecs
+FIELD3D_API int sparseCompressionLevel();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether SparseFields written to Ogawa files store blocks that are
+//! bitwise identical to an earlier block of the same layer only once. The
+//! duplicates refer to the stored block through a block table, and are
+//! read and decompressed once. Such files can't be read by versions of the
+//! library that predate the block table. Off by default.
+FIELD3D_API void setSparseBlockDedupe(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether identical SparseField blocks are stored only once
+FIELD3D_API bool sparseBlockDedupe();
+
+//----------------------------------------------------------------------------//
+
+//! Enumerates the orders in which the occupied blocks of a SparseField may be
+//! laid out in Ogawa files
+enum SparseFileOrder {
+  //! Blocks follow their linear index, x fastest. This is the default.
+  SparseFileOrderLinear = 0,
+  //! Blocks follow a Morton (Z-order) curve through the block grid, so the
+  //! blocks of a compact region lie close together in the file, and partial
+  //! or dynamic reads of the region touch few, contiguous file ranges. The
+  //! blocks are found through a block table, so such files can't be read by
+  //! versions of the library that predate it.
+  SparseFileOrderMorton
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sets the order in which SparseField blocks are written to Ogawa files.
+//! SparseFieldIO::writeStreamed() always writes in linear order.
+FIELD3D_API void setSparseFileOrder(const SparseFileOrder order);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the order in which SparseField blocks are written to Ogawa files
+FIELD3D_API SparseFileOrder sparseFileOrder();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether SparseFields written to Ogawa files record the min, max
+//! and mean of each allocated block next to the block map. They are found
+//! while the blocks are compressed, and let dynamically loaded fields 
+//! answer value range queries, such as those of SparseFieldMinMaxTree, 
+//! without loading blocks. Quantized blocks are written without them. 
+//! Older readers ignore them. On by default.
+FIELD3D_API void setSparseBlockSummaries(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether block summaries are written with SparseFields
+FIELD3D_API bool sparseBlockSummaries();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether the compressed SparseField blocks and DenseField slabs 
+//! written to Ogawa files are accompanied by the CRC32C checksum of their
+//! bytes on disk. Files can then be checked with 
+//! Field3DInputFile::verifyLayer(), or as they are read, see 
+//! setVerifyChecksums(). Uncompressed data has no checksums. Older readers
+//! ignore them. Off by default.
+FIELD3D_API void setWriteChecksums(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether checksums are written with compressed data
+FIELD3D_API bool writeChecksums();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether compressed blocks and slabs that have checksums are checked
+//! against them as they are read. Reads of fields with blocks or slabs that
+//! don't match then fail, rather than passing the damage on to the codec. 
+//! Blocks that are dynamically loaded are reported and left as they are. 
+//! Tiles read on their own aren't checked. Off by default.
+FIELD3D_API void setVerifyChecksums(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether checksums are checked as data is read
+FIELD3D_API bool verifyChecksums();
+
+//----------------------------------------------------------------------------//
+
+//! Sets the number of bits that each component of a SparseField voxel is
+//! quantized to when written to Ogawa files with SparseStorageCompressed.
+//! Each block stores the offset and scale of its values, so the error is at
+//! most half a step of the block's own value range. Blocks that hold
+//! non-finite values are written losslessly. Only 8 and 12 are supported;
+//! 0, the default, writes every block losslessly. Such files can't be read
+//! by versions of the library that predate quantization.
+FIELD3D_API void setSparseQuantizeBits(const int bits);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the number of bits SparseField voxels are quantized to, or 0
+FIELD3D_API int sparseQuantizeBits();
+
+//----------------------------------------------------------------------------//
+
+//! Enumerates the ways DenseField data may be stored in Ogawa files
+enum DenseStorageMode {
+  //! The data is split into slabs of whole z slices, and each slab is
+  //! compressed separately with the codec set by setSparseCodec(). This is
+  //! the default.
+  DenseStorageCompressed = 0,
+  //! The data is stored uncompressed, in a single record. Files written this
+  //! way can be read by versions of the library that predate compression.
+  //! Records of 1 MB or more start on a page boundary, so that readers can
+  //! map them, see setMapDenseLayers().
+  DenseStorageRaw
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sets the storage mode used when writing DenseFields to Ogawa files
+FIELD3D_API void setDenseStorageMode(const DenseStorageMode mode);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the storage mode used when writing DenseFields to Ogawa files
+FIELD3D_API DenseStorageMode denseStorageMode();
+
+//----------------------------------------------------------------------------//
+
+//! Sets the size of the raw data chunk cache that HDF5 keeps for each data
+//! set in the .f3d files that are opened for reading, in bytes and in hash
+//! table slots. A value of 0 keeps the HDF5 default, which is 1MB and 521
+//! slots.
+FIELD3D_API void setHdf5ChunkCache(const size_t numBytes,
+                                   const size_t numSlots);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the HDF5 chunk cache size, in bytes, or 0 for the HDF5 default
+FIELD3D_API size_t hdf5ChunkCacheBytes();
+
+//----------------------------------------------------------------------------//
+
+//! Returns the number of HDF5 chunk cache slots, or 0 for the HDF5 default
+FIELD3D_API size_t hdf5ChunkCacheSlots();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether gzip-compressed DenseFields in HDF5 files are read as raw
+//! chunks that are inflated on numIOThreads() threads, outside of the HDF5
+//! lock. This is on by default.
+FIELD3D_API void setHdf5ParallelInflate(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether HDF5 DenseFields are inflated in parallel
+FIELD3D_API bool hdf5ParallelInflate();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether gzip-compressed fields written to HDF5 files are deflated 
+//! on numIOThreads() threads and handed to HDF5 as raw chunks, rather than 
+//! compressed by HDF5 itself under its lock. The files are the same either
+//! way. This is on by default.
+FIELD3D_API void setHdf5ParallelDeflate(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether fields written to HDF5 files are deflated in parallel
+FIELD3D_API bool hdf5ParallelDeflate();
+
+//----------------------------------------------------------------------------//
+
+//! Sets whether the attributes and metadata of layers written to Ogawa files
+//! are packed into a single record per group, which is read in one go when 
+//! the layer is opened. Older versions of the library can't read the 
+//! attributes of such layers. This is off by default.
+FIELD3D_API void setPackLayerAttributes(const bool enabled);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether the attributes of layers written to Ogawa files are packed
+FIELD3D_API bool packLayerAttributes();
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_HEADER_CLOSE
 
 //----------------------------------------------------------------------------//
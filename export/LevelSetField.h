@@ -0,0 +1,754 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file LevelSetField.h
+  \brief Contains the LevelSetField class, a narrow-band signed distance 
+  field, its interpolator and reinitializeLevelSet().
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_LevelSetField_H_
+#define _INCLUDED_Field3D_LevelSetField_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Forward declarations 
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class LevelSetFieldInterp;
+
+class LevelSetFieldIO;
+
+//----------------------------------------------------------------------------//
+// LevelSetField
+//----------------------------------------------------------------------------//
+
+/*! \class LevelSetField
+  \ingroup field
+  \brief A SparseField that stores a signed distance field, negative 
+  inside, in a narrow band around its zero level set.
+
+  Only the blocks that hold distances within halfWidth() of the surface 
+  are allocated. The rest are tiles: unallocated blocks whose empty value
+  is -halfWidth() inside the surface and halfWidth() outside, so that 
+  lookups far from the surface still get the right sign at no memory cost.
+
+  Since it is a SparseField, it can be passed to anything that takes one,
+  and its lookups are as fast. LevelSetFieldInterp adds the queries 
+  colliders need, which answer from the tile alone away from the surface.
+
+  \note The blocks are read and written on numIOThreads() threads, so the 
+  field must not be dynamically loaded.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class LevelSetField : public SparseField<Data_T>
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::intrusive_ptr<LevelSetField> Ptr;
+  typedef std::vector<Ptr> Vec;
+
+  typedef LevelSetFieldInterp<Data_T> LinearInterp;
+  typedef CubicGenericFieldInterp<LevelSetField<Data_T> > CubicInterp;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef LevelSetField<Data_T> class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "LevelSetField";
+  }
+
+  static const char *staticClassType()
+  {
+    return LevelSetField<Data_T>::ms_classType.name();
+  }
+
+  // Constructors --------------------------------------------------------------
+
+  //! Constructs an empty field with a half width of one
+  LevelSetField()
+    : m_halfWidth(static_cast<Data_T>(1))
+  { }
+
+  //! Takes the mapping, size and blocks of a signed distance field, whose
+  //! allocated blocks hold distances clamped to the band. Blocks are shared
+  //! with the original until either is written to. Tiles get their sign 
+  //! from the voxels next to them, and blocks that lie entirely outside the
+  //! band become tiles.
+  LevelSetField(const SparseField<Data_T> &sdf, const Data_T &halfWidth)
+    : SparseField<Data_T>(sdf), m_halfWidth(halfWidth)
+  { 
+    floodFillTileSigns();
+    pruneToBand();
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Half width of the band, in the units of the stored distances
+  const Data_T& halfWidth() const
+  { return m_halfWidth; }
+
+  //! Sets the half width of the band. Tiles are set to the new width, 
+  //! keeping their sign, but allocated blocks are left as they are.
+  void setHalfWidth(const Data_T &halfWidth);
+
+  //! Whether the unallocated block at (bi, bj, bk) is an inside tile
+  bool isInsideTile(int bi, int bj, int bk) const
+  { 
+    return !this->blockIsAllocated(bi, bj, bk) && 
+      this->getBlockEmptyValue(bi, bj, bk) < static_cast<Data_T>(0);
+  }
+
+  //! Makes the block at (bi, bj, bk) an inside or outside tile. Its data
+  //! is released if it was allocated.
+  void setTile(int bi, int bj, int bk, bool inside)
+  { 
+    this->setBlockEmptyValue(bi, bj, bk, inside ? -m_halfWidth : m_halfWidth);
+  }
+
+  //! Sets the sign of each tile from the nearest allocated block in its 
+  //! row of blocks along x. This is what a band written with fastLValue() 
+  //! needs, since every unallocated block starts out as an outside tile.
+  //! Rows without allocated blocks are left as they are.
+  void floodFillTileSigns();
+
+  //! Allocates the tiles next to allocated blocks whose voxels on the 
+  //! shared face are within the band, filled with the tile's value. Used 
+  //! before updating the band, so that it may move into the tiles.
+  //! \returns The number of blocks allocated
+  int dilateBand();
+
+  //! Turns the allocated blocks where every voxel is at least halfWidth() 
+  //! from the surface, on the same side of it, into tiles
+  //! \returns The number of blocks released
+  int pruneToBand();
+
+  // From FieldBase ------------------------------------------------------------
+
+  //! \name From FieldBase
+  //! \{
+
+  FIELD3D_CLASSNAME_CLASSTYPE_IMPLEMENTATION;
+
+  virtual FieldBase::Ptr clone() const
+  { return Ptr(new LevelSetField(*this)); }
+
+  //! \}
+
+private:
+
+  friend class LevelSetFieldIO;
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<LevelSetField<Data_T> > ms_classType;
+
+  // Data members --------------------------------------------------------------
+
+  //! Distance at the edge of the band, which tiles hold
+  Data_T m_halfWidth;
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef SparseField<Data_T> base;
+
+};
+
+//----------------------------------------------------------------------------//
+// Static member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(LevelSetField);
+
+//----------------------------------------------------------------------------//
+// Typedefs
+//----------------------------------------------------------------------------//
+
+typedef LevelSetField<half>   LevelSetFieldh;
+typedef LevelSetField<float>  LevelSetFieldf;
+typedef LevelSetField<double> LevelSetFieldd;
+
+//----------------------------------------------------------------------------//
+// LevelSetFieldInterp
+//----------------------------------------------------------------------------//
+
+/* \class LevelSetFieldInterp
+   \ingroup field
+   \brief Linear interpolator for LevelSetFields. Distances are looked up 
+   like in LinearSparseFieldInterp, and isInside() and sampleNormal() 
+   answer from the tile alone when the point is away from the band.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class LevelSetFieldInterp : public RefBase
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Data_T value_type;
+  typedef boost::intrusive_ptr<LevelSetFieldInterp> Ptr;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef LevelSetFieldInterp class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "LevelSetFieldInterp";
+  }
+
+  static const char* staticClassType()
+  {
+    return ms_classType.name();
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Signed distance at vsP
+  value_type sample(const SparseField<Data_T> &field, const V3d &vsP) const
+  { return m_interp.sample(field, vsP); }
+
+  //! Signed distances at n points at once
+  void sample(const SparseField<Data_T> &field, size_t n, const V3f *vsP, 
+              value_type *out) const
+  { m_interp.sample(field, n, vsP, out); }
+
+  //! Signed distance and its voxel-space gradient at vsP. Tiles have a 
+  //! zero gradient.
+  value_type sampleValueAndGradient(const SparseField<Data_T> &field, 
+                                    const V3d &vsP,
+                                    FIELD3D_VEC3_T<Data_T> &gradient) const
+  { return m_interp.sampleValueAndGradient(field, vsP, gradient); }
+
+  //! Whether vsP is inside the surface. Points in a tile take its sign 
+  //! without interpolating.
+  bool isInside(const LevelSetField<Data_T> &field, const V3d &vsP) const
+  {
+    int bi, bj, bk;
+    if (tileAt(field, vsP, bi, bj, bk)) {
+      return field.isInsideTile(bi, bj, bk);
+    }
+    return m_interp.sample(field, vsP) < static_cast<Data_T>(0);
+  }
+
+  //! Signed distance and the outward unit normal at vsP, in voxel space. 
+  //! Points in a tile, where the distance is constant, return the tile's 
+  //! value and a zero normal without interpolating.
+  value_type sampleNormal(const LevelSetField<Data_T> &field, const V3d &vsP,
+                          FIELD3D_VEC3_T<Data_T> &normal) const
+  {
+    int bi, bj, bk;
+    if (tileAt(field, vsP, bi, bj, bk)) {
+      normal = FIELD3D_VEC3_T<Data_T>(static_cast<Data_T>(0));
+      return field.getBlockEmptyValue(bi, bj, bk);
+    }
+    const value_type value = 
+      m_interp.sampleValueAndGradient(field, vsP, normal);
+    const double length = std::sqrt(static_cast<double>(normal.x) * normal.x +
+                                    static_cast<double>(normal.y) * normal.y +
+                                    static_cast<double>(normal.z) * normal.z);
+    if (length > 0.0) {
+      normal = FIELD3D_VEC3_T<Data_T>
+        (static_cast<Data_T>(normal.x / length), 
+         static_cast<Data_T>(normal.y / length),
+         static_cast<Data_T>(normal.z / length));
+    }
+    return value;
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Whether the voxel nearest vsP is in a tile that is surrounded by 
+  //! tiles of the same sign, in which case no stencil around vsP can reach
+  //! the band. Returns the tile's block coordinate.
+  static bool tileAt(const LevelSetField<Data_T> &field, const V3d &vsP,
+                     int &bi, int &bj, int &bk)
+  {
+    const Box3i &dataWindow = field.dataWindow();
+    int i = static_cast<int>(std::floor(vsP.x));
+    int j = static_cast<int>(std::floor(vsP.y));
+    int k = static_cast<int>(std::floor(vsP.z));
+    i = std::min(dataWindow.max.x, std::max(dataWindow.min.x, i));
+    j = std::min(dataWindow.max.y, std::max(dataWindow.min.y, j));
+    k = std::min(dataWindow.max.z, std::max(dataWindow.min.z, k));
+    field.applyDataWindowOffset(i, j, k);
+    int vi, vj, vk;
+    field.getVoxelInBlock(i, j, k, vi, vj, vk);
+    field.getBlockCoord(i, j, k, bi, bj, bk);
+    if (field.blockIsAllocated(bi, bj, bk)) {
+      return false;
+    }
+    // The stencil only reaches into the neighbouring blocks from the 
+    // voxels on the block's faces
+    const int    last    = field.blockSize() - 1;
+    const bool   inside  = field.isInsideTile(bi, bj, bk);
+    const int    di[2]   = { vi == 0 ? -1 : 0, vi == last ? 1 : 0 };
+    const int    dj[2]   = { vj == 0 ? -1 : 0, vj == last ? 1 : 0 };
+    const int    dk[2]   = { vk == 0 ? -1 : 0, vk == last ? 1 : 0 };
+    for (int z = dk[0]; z <= dk[1]; ++z) {
+      for (int y = dj[0]; y <= dj[1]; ++y) {
+        for (int x = di[0]; x <= di[1]; ++x) {
+          if (!field.blockIndexIsValid(bi + x, bj + y, bk + z)) {
+            continue;
+          }
+          if (field.blockIsAllocated(bi + x, bj + y, bk + z) ||
+              field.isInsideTile(bi + x, bj + y, bk + z) != inside) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  // Data members --------------------------------------------------------------
+
+  LinearSparseFieldInterp<Data_T> m_interp;
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<LevelSetFieldInterp<Data_T> > ms_classType;
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef RefBase base;
+
+};
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(LevelSetFieldInterp);
+
+//----------------------------------------------------------------------------//
+// reinitializeLevelSet
+//----------------------------------------------------------------------------//
+
+//! Restores the signed distance property of a LevelSetField after it has 
+//! been advected or otherwise edited, by solving the reinitialization
+//! equation of Sussman et al. with first order upwind differences. The 
+//! band is dilated first, so that it may follow a surface that has moved,
+//! and pruned back afterwards. Each iteration moves the distances by up to
+//! half a voxel, so numIterations bounds how far from the surface they are
+//! corrected. The blocks are updated on numIOThreads() threads.
+template <class Data_T>
+void reinitializeLevelSet(LevelSetField<Data_T> &field, 
+                          const int numIterations = 4);
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether the distance d is within the band, i.e. not a tile value
+  template <class Data_T>
+  inline bool isWithinBand(const Data_T &d, const Data_T &halfWidth)
+  {
+    return d > -halfWidth && d < halfWidth;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets the tile signs of one row of blocks along x. Used by 
+  //! LevelSetField::floodFillTileSigns().
+  template <class Data_T>
+  class FloodFillRowOp
+  {
+  public:
+    FloodFillRowOp(LevelSetField<Data_T> &field)
+      : m_field(&field), m_blockRes(field.blockRes())
+    { }
+    void operator() (const size_t row)
+    {
+      const int bj = static_cast<int>(row) % m_blockRes.y;
+      const int bk = static_cast<int>(row) / m_blockRes.y;
+      // Tiles before the first allocated block take the sign of its first 
+      // voxels, and the others the sign of the last voxels of the 
+      // allocated block before them
+      int  first  = 0;
+      bool inside = false;
+      for (; first < m_blockRes.x; ++first) {
+        if (m_field->blockIsAllocated(first, bj, bk)) {
+          inside = isInside(first, bj, bk, false);
+          break;
+        }
+      }
+      if (first == m_blockRes.x) {
+        return;
+      }
+      for (int bi = 0; bi < m_blockRes.x; ++bi) {
+        if (m_field->blockIsAllocated(bi, bj, bk)) {
+          inside = isInside(bi, bj, bk, true);
+        } else {
+          m_field->setTile(bi, bj, bk, inside);
+        }
+      }
+    }
+  private:
+    //! Sign of the voxel at the middle of the first or last x slice of a 
+    //! block
+    bool isInside(int bi, int bj, int bk, bool last) const
+    {
+      Box3i bounds;
+      m_field->getGrainBounds(bi + m_blockRes.x * (bj + m_blockRes.y * bk),
+                              bounds);
+      const int i = last ? bounds.max.x : bounds.min.x;
+      const int j = (bounds.min.y + bounds.max.y) / 2;
+      const int k = (bounds.min.z + bounds.max.z) / 2;
+      return m_field->fastValue(i, j, k) < static_cast<Data_T>(0);
+    }
+    LevelSetField<Data_T> *m_field;
+    V3i                    m_blockRes;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the tiles to allocate by LevelSetField::dilateBand(). A tile is 
+  //! allocated if a voxel just outside one of its faces is within the band.
+  template <class Data_T>
+  class DilateBandOp
+  {
+  public:
+    DilateBandOp(const LevelSetField<Data_T> &field, std::vector<int> &grow)
+      : m_field(&field), m_grow(&grow)
+    { }
+    void operator() (const size_t idx)
+    {
+      const V3i b = indexToCoord(idx, m_field->blockRes());
+      if (m_field->blockIsAllocated(b.x, b.y, b.z)) {
+        return;
+      }
+      Box3i bounds;
+      m_field->getGrainBounds(idx, bounds);
+      const Box3i &dataWindow = m_field->dataWindow();
+      for (int axis = 0; axis < 3; ++axis) {
+        for (int side = 0; side < 2; ++side) {
+          // The slice of voxels just outside this face
+          Box3i face = bounds;
+          if (side == 0) {
+            face.min[axis] = face.max[axis] = bounds.min[axis] - 1;
+          } else {
+            face.min[axis] = face.max[axis] = bounds.max[axis] + 1;
+          }
+          if (face.min[axis] < dataWindow.min[axis] || 
+              face.max[axis] > dataWindow.max[axis]) {
+            continue;
+          }
+          if (isAnyWithinBand(face)) {
+            (*m_grow)[idx] = 1;
+            return;
+          }
+        }
+      }
+    }
+  private:
+    bool isAnyWithinBand(const Box3i &box) const
+    {
+      const Data_T halfWidth = m_field->halfWidth();
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j) {
+          for (int i = box.min.x; i <= box.max.x; ++i) {
+            if (isWithinBand(m_field->fastValue(i, j, k), halfWidth)) {
+              return true;
+            }
+          }
+        }
+      }
+      return false;
+    }
+    const LevelSetField<Data_T> *m_field;
+    std::vector<int>            *m_grow;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Finds the blocks to release by LevelSetField::pruneToBand(). Records
+  //! -1 for blocks that are entirely inside, and 1 for blocks that are 
+  //! entirely outside.
+  template <class Data_T>
+  class PruneBandOp
+  {
+  public:
+    PruneBandOp(const LevelSetField<Data_T> &field, std::vector<int> &sides)
+      : m_field(&field), m_sides(&sides)
+    { }
+    void operator() (const size_t idx)
+    {
+      const V3i b = indexToCoord(idx, m_field->blockRes());
+      if (!m_field->blockIsAllocated(b.x, b.y, b.z)) {
+        return;
+      }
+      Box3i bounds;
+      m_field->getGrainBounds(idx, bounds);
+      const Data_T halfWidth = m_field->halfWidth();
+      const bool   inside    = 
+        m_field->fastValue(bounds.min.x, bounds.min.y, bounds.min.z) < 
+        static_cast<Data_T>(0);
+      for (int k = bounds.min.z; k <= bounds.max.z; ++k) {
+        for (int j = bounds.min.y; j <= bounds.max.y; ++j) {
+          for (int i = bounds.min.x; i <= bounds.max.x; ++i) {
+            const Data_T d = m_field->fastValue(i, j, k);
+            if (isWithinBand(d, halfWidth) || 
+                (d < static_cast<Data_T>(0)) != inside) {
+              return;
+            }
+          }
+        }
+      }
+      (*m_sides)[idx] = inside ? -1 : 1;
+    }
+  private:
+    const LevelSetField<Data_T> *m_field;
+    std::vector<int>            *m_sides;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs one iteration of reinitializeLevelSet() on each allocated block.
+  //! Distances are read from copies of the field taken before the 
+  //! iteration, which share their blocks with it, and written to the 
+  //! field's own blocks.
+  template <class Data_T>
+  class ReinitBlockOp
+  {
+  public:
+    ReinitBlockOp(LevelSetField<Data_T> &field, 
+                  const SparseField<Data_T> &initial,
+                  const SparseField<Data_T> &previous, 
+                  const V3d &voxelSize)
+      : m_field(&field), m_initial(&initial), m_previous(&previous),
+        m_invVoxelSize(1.0 / voxelSize.x, 1.0 / voxelSize.y, 
+                       1.0 / voxelSize.z),
+        m_dx(std::min(voxelSize.x, std::min(voxelSize.y, voxelSize.z))),
+        m_dt(0.5 * m_dx)
+    { }
+    void operator() (const size_t idx)
+    {
+      const V3i b = indexToCoord(idx, m_field->blockRes());
+      if (!m_field->blockIsAllocated(b.x, b.y, b.z)) {
+        return;
+      }
+      Box3i bounds;
+      m_field->getGrainBounds(idx, bounds);
+      const Box3i              &dataWindow = m_field->dataWindow();
+      const int                 order      = m_field->blockOrder();
+      const Sparse::BlockLayout layout     = m_field->blockLayout();
+      const double              halfWidth  = m_field->halfWidth();
+      Data_T *data = m_field->blockData(b.x, b.y, b.z);
+      for (int k = bounds.min.z; k <= bounds.max.z; ++k) {
+        for (int j = bounds.min.y; j <= bounds.max.y; ++j) {
+          for (int i = bounds.min.x; i <= bounds.max.x; ++i) {
+            const double phi0 = m_initial->fastValue(i, j, k);
+            const double phi  = m_previous->fastValue(i, j, k);
+            // Smoothed sign of the initial distance
+            const double s    = phi0 / std::sqrt(phi0 * phi0 + m_dx * m_dx);
+            const V3i    c(i, j, k);
+            double       gradSq = 0.0;
+            for (int axis = 0; axis < 3; ++axis) {
+              V3i lo(c), hi(c);
+              lo[axis] = std::max(dataWindow.min[axis], c[axis] - 1);
+              hi[axis] = std::min(dataWindow.max[axis], c[axis] + 1);
+              // One-sided differences, upwinded as in Godunov's scheme
+              const double a = (phi - m_previous->fastValue(lo.x, lo.y, lo.z))
+                * m_invVoxelSize[axis];
+              const double f = (m_previous->fastValue(hi.x, hi.y, hi.z) - phi)
+                * m_invVoxelSize[axis];
+              if (s > 0.0) {
+                const double ap = std::max(a, 0.0), fm = std::min(f, 0.0);
+                gradSq += std::max(ap * ap, fm * fm);
+              } else {
+                const double am = std::min(a, 0.0), fp = std::max(f, 0.0);
+                gradSq += std::max(am * am, fp * fp);
+              }
+            }
+            const double updated = 
+              phi - m_dt * s * (std::sqrt(gradSq) - 1.0);
+            data[Sparse::blockIndex(i - dataWindow.min.x - b.x * (1 << order),
+                                    j - dataWindow.min.y - b.y * (1 << order),
+                                    k - dataWindow.min.z - b.z * (1 << order),
+                                    order, layout)] = 
+              static_cast<Data_T>(std::min(halfWidth, 
+                                           std::max(-halfWidth, updated)));
+          }
+        }
+      }
+    }
+  private:
+    LevelSetField<Data_T>     *m_field;
+    const SparseField<Data_T> *m_initial;
+    const SparseField<Data_T> *m_previous;
+    V3d                        m_invVoxelSize;
+    //! Smallest voxel side, which smooths the sign of the distance
+    double                     m_dx;
+    //! Pseudo-time step, within the CFL limit of the upwind scheme
+    double                     m_dt;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Template implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void LevelSetField<Data_T>::setHalfWidth(const Data_T &halfWidth)
+{
+  const V3i blockRes = this->blockRes();
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        if (!this->blockIsAllocated(bi, bj, bk)) {
+          const bool inside = isInsideTile(bi, bj, bk);
+          this->setBlockEmptyValue(bi, bj, bk, 
+                                   inside ? -halfWidth : halfWidth);
+        }
+      }
+    }
+  }
+  m_halfWidth = halfWidth;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void LevelSetField<Data_T>::floodFillTileSigns()
+{
+  const V3i blockRes = this->blockRes();
+  Sparse::runBlockOp(detail::FloodFillRowOp<Data_T>(*this), 
+                     static_cast<size_t>(blockRes.y) * blockRes.z);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int LevelSetField<Data_T>::dilateBand()
+{
+  const size_t     numBlocks = this->numGrains();
+  std::vector<int> grow(numBlocks, 0);
+  Sparse::runBlockOp(detail::DilateBandOp<Data_T>(*this, grow), numBlocks);
+  // Writing a voxel allocates its block, filled with the empty value
+  int numAllocated = 0;
+  for (size_t idx = 0; idx < numBlocks; ++idx) {
+    if (grow[idx]) {
+      Box3i bounds;
+      this->getGrainBounds(idx, bounds);
+      this->fastLValue(bounds.min.x, bounds.min.y, bounds.min.z);
+      numAllocated++;
+    }
+  }
+  return numAllocated;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int LevelSetField<Data_T>::pruneToBand()
+{
+  const size_t     numBlocks = this->numGrains();
+  std::vector<int> sides(numBlocks, 0);
+  Sparse::runBlockOp(detail::PruneBandOp<Data_T>(*this, sides), numBlocks);
+  int numReleased = 0;
+  for (size_t idx = 0; idx < numBlocks; ++idx) {
+    if (sides[idx]) {
+      const V3i b = indexToCoord(idx, this->blockRes());
+      setTile(b.x, b.y, b.z, sides[idx] < 0);
+      numReleased++;
+    }
+  }
+  return numReleased;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void reinitializeLevelSet(LevelSetField<Data_T> &field, 
+                          const int numIterations)
+{
+  field.dilateBand();
+  // The sign of the distances is taken from the field as it was
+  const SparseField<Data_T> initial(field);
+  const V3d voxelSize = field.mapping()->wsVoxelSize(0, 0, 0);
+  const size_t numBlocks = field.numGrains();
+  for (int iteration = 0; iteration < numIterations; ++iteration) {
+    const SparseField<Data_T> previous(field);
+    Sparse::runBlockOp(detail::ReinitBlockOp<Data_T>(field, initial, previous,
+                                                     voxelSize), 
+                       numBlocks);
+  }
+  field.pruneToBand();
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
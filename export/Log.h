@@ -38,6 +38,12 @@
 /*! \file Log.h
   \brief Contains the Log class which can be used to redirect output to an
   arbitrary destination.  
+
+  Messages are queued and written to the sink by a background thread, so 
+  threads that print aren't serialized on the output stream. Call 
+  Msg::flush() to wait for queued messages to be written. Warnings are 
+  written before print() returns, so that they survive a crash, and so is
+  everything printed by a forked child process.
 */
 
 //----------------------------------------------------------------------------//
@@ -47,6 +53,8 @@
 
 //----------------------------------------------------------------------------//
 
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
 #include <boost/lexical_cast.hpp>
 
 //----------------------------------------------------------------------------//
@@ -62,12 +70,49 @@ FIELD3D_NAMESPACE_OPEN
 //! Contains logging-related functions.
 namespace Msg {
 
-  //! Used by the Msg::print() call
+  //! Used by the Msg::print() call. Messages and warnings are queued and
+  //! written by a background thread, see setAsync(). Errors are written 
+  //! before print() returns, so that they aren't lost if the process 
+  //! aborts or crashes right after.
   enum Severity {
     SevMessage, 
-    SevWarning
+    SevWarning,
+    SevError
+  };
+
+  //! Receives the messages that pass the severity filter. Sinks are called
+  //! from one thread at a time.
+  typedef boost::function<void (Severity, const std::string &)> Sink;
+
+  //--------------------------------------------------------------------------//
+
+  /*! \class RateLimit
+    Limits how often a message is printed from one place in the code. 
+    Declare one as a static next to the print() call that uses it. Messages
+    over the limit are counted, and the count is added to the next message 
+    that gets through.
+  */
+  class FIELD3D_API RateLimit
+  {
+  public:
+    //! Allows maxMessages messages per interval, in seconds
+    RateLimit(const size_t maxMessages = 10, const float interval = 1.0f);
+    //! Returns whether a message may be printed now. numSuppressed is set to
+    //! the number of messages suppressed since the last one allowed.
+    bool allow(size_t &numSuppressed);
+  private:
+    const size_t m_maxMessages;
+    //! Interval in microseconds
+    const int64_t m_interval;
+    //! Start of the current interval, in microseconds
+    boost::atomic<int64_t> m_start;
+    //! Messages in the current interval
+    boost::atomic<size_t> m_count;
+    boost::atomic<size_t> m_numSuppressed;
   };
 
+  //--------------------------------------------------------------------------//
+
   //! Sends the string to the assigned output, prefixing the message with
   //! the severity
   FIELD3D_API void print(Severity severity, const std::string &message);
@@ -76,10 +121,36 @@ namespace Msg {
   inline void print(const std::string &message)
   { print(SevMessage, message); }
 
+  //! Sends the string to the assigned output, unless the call site has 
+  //! exceeded its rate limit
+  FIELD3D_API void print(RateLimit &limit, Severity severity, 
+                         const std::string &message);
+
+  //! Returns whether messages of the given severity are printed. Call sites
+  //! that are expensive to format can check this first.
+  FIELD3D_API bool isEnabled(Severity severity);
+
   //! Set the verbosity level of console output: 0 = do not echo anything
   //! to the console; >=1 = echo all messages and warnings to the console.
   FIELD3D_API void setVerbosity (int level=1);
 
+  //! Sets the lowest severity that is printed. Defaults to SevMessage.
+  FIELD3D_API void setMinSeverity(Severity severity);
+
+  //! Sets the sink that messages are sent to. An empty sink restores the
+  //! default, which writes to the console. The verbosity level only applies
+  //! to the default sink.
+  FIELD3D_API void setSink(const Sink &sink);
+
+  //! Sets whether messages are written by a background thread, which is the
+  //! default. If not, print() writes them before returning.
+  FIELD3D_API void setAsync(const bool enabled);
+
+  //! Waits until the messages printed so far have been written, or for two
+  //! seconds at most. Messages that didn't fit in the queue are dropped and
+  //! counted instead.
+  FIELD3D_API void flush();
+
 } // namespace Msg
 
 //----------------------------------------------------------------------------//
@@ -33,6 +33,7 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 //----------------------------------------------------------------------------//
 
 /*! \file MACFieldUtil.h
@@ -45,7 +46,18 @@
 #ifndef _INCLUDED_Field3D_MACFieldUtil_H_
 #define _INCLUDED_Field3D_MACFieldUtil_H_
 
+#include <algorithm>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "DenseField.h"
+#include "InitIO.h"
 #include "MACField.h"
+#include "SparseField.h"
+#include "SparseMACField.h"
+#include "ThreadPool.h"
 
 //----------------------------------------------------------------------------//
 
@@ -58,189 +70,739 @@ FIELD3D_NAMESPACE_OPEN
 //----------------------------------------------------------------------------//
 
 //! Converts the MAC field to a cell-centered field
+//! \note Runs on numIOThreads() threads, a block of target voxels at a time.
+//! When the target is a SparseField, blocks that come out uniform are left
+//! unallocated.
 template <class Data_T, class Field_T>
 void convertMACToCellCentered(typename MACField<Data_T>::Ptr mac,
                               typename Field_T::Ptr cc);
 
+//! Converts the sparse MAC field to a cell-centered field
+//! \note Target blocks whose faces all lie in unallocated blocks of the 
+//! MAC field are filled without reading any faces.
+template <class Data_T, class Field_T>
+void convertMACToCellCentered(typename SparseMACField<Data_T>::Ptr mac,
+                              typename Field_T::Ptr cc);
+
 //----------------------------------------------------------------------------//
 
 //! Converts the cell-centered field to a MAC field
+//! \note Runs on numIOThreads() threads, a block of voxels at a time.
 template <class Field_T, class Data_T>
 void convertCellCenteredToMAC(typename Field_T::Ptr cc,
                               typename MACField<Data_T>::Ptr mac);
 
+//! Converts the cell-centered field to a sparse MAC field
+//! \note Face blocks that come out uniform are left unallocated, and 
+//! uniform regions of a SparseField source are not read voxel by voxel.
+template <class Field_T, class Data_T>
+void convertCellCenteredToMAC(typename Field_T::Ptr cc,
+                              typename SparseMACField<Data_T>::Ptr mac);
+
 //----------------------------------------------------------------------------//
-// Implementations
+// detail namespace
 //----------------------------------------------------------------------------//
 
-//! Sets up the cell-centered target field given a MAC field
-template <class Data_T, class Field_T>
-void convertMACToCellCentered(typename MACField<Data_T>::Ptr mac,
-                              typename Field_T::Ptr cc)
-{
-  // Make sure the extents and data window match
-  if (cc->extents().min != mac->extents().min ||
-      cc->extents().max != mac->extents().max ||
-      cc->dataWindow().min != mac->dataWindow().min ||
-      cc->dataWindow().max != mac->dataWindow().max ) {
-    cc->setSize(mac->extents(), mac->dataWindow());
-  }
-
-  // Make sure mapping matches
-  if (!cc->mapping()->isIdentical(mac->mapping())) {
-    cc->setMapping(mac->mapping());
-  }
-
-  // MAC velocities are in simulation space (axis-aligned to the
-  // mapping) because the values are stored on the faces, so rotate
-  // vectors from simulation-space to world-space when transferring
-  // from MAC to cell-centered
-
-  bool rotateVector = false;
-  M44d ssToWsMtx;
-  MatrixFieldMapping::Ptr mapping =
-    FIELD_DYNAMIC_CAST<MatrixFieldMapping>(mac->mapping());
-  if (mapping) {
-    M44d localToWorldMtx = mapping->localToWorld();
-    V3d scale, rot, trans, shear;
-    if (extractSHRT(localToWorldMtx, scale, shear, rot, trans, false)) {
-      ssToWsMtx.rotate(rot);
-      if (rot.length2() > FLT_EPSILON)
-        rotateVector = true;
-    }
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Size of the blocks that conversions are split into. Sparse fields use
+  //! their own block size, so that no two tasks write the same block.
+  template <class Data_T>
+  int macBlockSize(const SparseField<Data_T> &f)
+  {
+    return f.blockSize();
   }
 
-  // Loop over all the voxels in the output field ---
+  template <class Data_T>
+  int macBlockSize(const SparseMACField<Data_T> &f)
+  {
+    return 1 << f.blockOrder();
+  }
 
-  typename Field_T::iterator i = cc->begin();
-  typename Field_T::iterator end = cc->end();
+  //! Constant size for all other fields
+  template <class Field_T>
+  int macBlockSize(const Field_T &/*f*/)
+  {
+    return 16;
+  }
 
-  if (rotateVector) {
-    for (; i != end; ++i) {
-      *i = mac->value(i.x, i.y, i.z) * ssToWsMtx;
+  //--------------------------------------------------------------------------//
+
+  //! Splits the data window into blocks aligned to its min corner
+  inline std::vector<Box3i> macBlocks(const Box3i &dw, const int blockSize)
+  {
+    std::vector<Box3i> blocks;
+    for (int k = dw.min.z; k <= dw.max.z; k += blockSize) {
+      for (int j = dw.min.y; j <= dw.max.y; j += blockSize) {
+        for (int i = dw.min.x; i <= dw.max.x; i += blockSize) {
+          const V3i first(i, j, k);
+          blocks.push_back(clipBounds(Box3i(first, first + V3i(blockSize - 1)),
+                                      dw));
+        }
+      }
     }
-  } else {
-    for (; i != end; ++i) {
-      *i = mac->value(i.x, i.y, i.z);
+    return blocks;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs copies of op on up to numThreads threads of the shared 
+  //! ThreadPool. A single thread runs the op itself.
+  template <class Op_T>
+  void runMACOp(const Op_T &op, const size_t numThreads)
+  {
+    runOnThreads(op, numThreads);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns true if all voxels of region lie in unallocated blocks that 
+  //! share a single empty value, which is returned in value
+  template <class Data_T>
+  bool uniformRegion(const SparseField<Data_T> &f, const Box3i &region, 
+                     Data_T &value)
+  {
+    const Box3i dbsBounds = blockCoords(region, &f);
+    bool first = true;
+    for (int k = dbsBounds.min.z; k <= dbsBounds.max.z; ++k) {
+      for (int j = dbsBounds.min.y; j <= dbsBounds.max.y; ++j) {
+        for (int i = dbsBounds.min.x; i <= dbsBounds.max.x; ++i) {
+          if (f.blockIsAllocated(i, j, k)) {
+            return false;
+          }
+          const Data_T emptyValue = f.getBlockEmptyValue(i, j, k);
+          if (first) {
+            value = emptyValue;
+            first = false;
+          } else if (emptyValue != value) {
+            return false;
+          }
+        }
+      }
     }
+    return !first;
   }
-}
 
-//----------------------------------------------------------------------------//
+  //! Fallback version always returns false
+  template <class Field_T, class Data_T>
+  bool uniformRegion(const Field_T &/*f*/, const Box3i &/*region*/, 
+                     Data_T &/*value*/)
+  {
+    return false;
+  }
 
-template <class Field_T, class Data_T>
-void convertCellCenteredToMAC(typename Field_T::Ptr cc,
-                              typename MACField<Data_T>::Ptr mac)
-{
-  // Make sure the extents and data window match
-  if (mac->extents().min != cc->extents().min ||
-      mac->extents().max != cc->extents().max ||
-      mac->dataWindow().min != cc->dataWindow().min ||
-      mac->dataWindow().max != cc->dataWindow().max ) {
-    mac->setSize(cc->extents(), cc->dataWindow());
+  //--------------------------------------------------------------------------//
+
+  //! Returns true if the faces read by the voxels of box lie in uniform
+  //! regions of each component, with the per-component values in value
+  template <class Data_T>
+  bool uniformFaces(const SparseMACField<Data_T> &mac, const Box3i &box, 
+                    Data_T &value)
+  {
+    using namespace MACFieldUtil;
+    for (int c = 0; c < 3; ++c) {
+      const MACComponent comp = static_cast<MACComponent>(c);
+      if (!uniformRegion(*mac.component(comp), 
+                         makeDataWindowForComponent(box, comp), value[c])) {
+        return false;
+      }
+    }
+    return true;
   }
 
-  // Make sure mapping matches
-  if (!mac->mapping()->isIdentical(cc->mapping())) {
-    mac->setMapping(cc->mapping());
+  //! Fallback version always returns false
+  template <class MAC_T, class Data_T>
+  bool uniformFaces(const MAC_T &/*mac*/, const Box3i &/*box*/, 
+                    Data_T &/*value*/)
+  {
+    return false;
   }
-  
-  Box3i data = mac->dataWindow();
 
-  // MAC velocities are in simulation space (axis-aligned to the
-  // mapping) because the values are stored on the faces, so rotate
-  // vectors from world-space to simulation-space when transferring
-  // from cell-centered to MAC
+  //--------------------------------------------------------------------------//
+
+  //! Returns n faces of a component, starting at (i, j, k). MACField rows 
+  //! are contiguous, so a pointer into the field is returned.
+  template <class Data_T>
+  const typename Data_T::BaseType* 
+  faceRow(const MACField<Data_T> &mac, const MACComponent comp, 
+          const int i, const int j, const int k, const int /*n*/,
+          std::vector<typename Data_T::BaseType> &/*scratch*/)
+  {
+    switch (comp) {
+    case MACCompU:
+      return &mac.u(i, j, k);
+    case MACCompV:
+      return &mac.v(i, j, k);
+    default:
+      return &mac.w(i, j, k);
+    }
+  }
 
-  bool rotateVector = false;
-  M44d wsToSsMtx;
-  MatrixFieldMapping::Ptr mapping =
-    FIELD_DYNAMIC_CAST<MatrixFieldMapping>(mac->mapping());
-  if (mapping) {
-    M44d localToWorld = mapping->localToWorld();
-    V3d scale, rot, trans, shear;
-    if (FIELD3D_EXTRACT_SHRT(localToWorld, scale, shear, rot, trans, false)) {
-      wsToSsMtx.rotate(-rot);
-      rotateVector = true;
+  //! Sparse version reads the faces into scratch
+  template <class Data_T>
+  const typename Data_T::BaseType* 
+  faceRow(const SparseMACField<Data_T> &mac, const MACComponent comp, 
+          const int i, const int j, const int k, const int n,
+          std::vector<typename Data_T::BaseType> &scratch)
+  {
+    const typename SparseMACField<Data_T>::ComponentField &f = 
+      *mac.component(comp);
+    scratch.resize(n);
+    for (int x = 0; x < n; ++x) {
+      scratch[x] = f.fastValue(i + x, j, k);
     }
+    return &scratch[0];
   }
 
-  // Use a pointer to a field below so we can substitute it out for
-  // our intermediate, rotated field if necessary, without needing to
-  // duplicate the loops.  This should be more efficient CPU-wise so
-  // we don't need to do 3 matrix multiplies per cell-centered voxel
-  // because it's used in 3 separate loops (1 per MAC face).
-  typename Field_T::Ptr src = cc;
+  //--------------------------------------------------------------------------//
+
+  //! Reads the voxels of box into values, x fastest
+  template <class Data_T>
+  void readVoxels(const DenseField<Data_T> &f, const Box3i &box, 
+                  Data_T *values)
+  {
+    const int nx = box.max.x - box.min.x + 1;
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j, values += nx) {
+        const Data_T *row = &f.fastValue(box.min.x, j, k);
+        std::copy(row, row + nx, values);
+      }
+    }
+  }
 
-  typename Field_T::Ptr ccRotated;
-  if (rotateVector) {
-    ccRotated =
-      typename Field_T::Ptr(new Field_T);
-    ccRotated->matchDefinition(cc);
+  //! Fallback version reads one voxel at a time
+  template <class Field_T>
+  void readVoxels(const Field_T &f, const Box3i &box, 
+                  typename Field_T::value_type *values)
+  {
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j) {
+        for (int i = box.min.x; i <= box.max.x; ++i, ++values) {
+          *values = f.value(i, j, k);
+        }
+      }
+    }
+  }
 
-    typename Field_T::const_iterator iIn = cc->cbegin();
-    typename Field_T::const_iterator endIn = cc->cend();
-    typename Field_T::iterator iOut = ccRotated->begin();
+  //--------------------------------------------------------------------------//
+
+  //! Writes values, x fastest, to the voxels of box. Blocks whose values 
+  //! are all equal are left unallocated.
+  //! \note box must cover each block it touches, clipped to the data window
+  template <class Data_T>
+  void writeVoxels(SparseField<Data_T> &f, const Box3i &box, 
+                   const Data_T *values)
+  {
+    const Box3i               dw        = f.dataWindow();
+    const int                 blockSize = f.blockSize();
+    const int                 order     = f.blockOrder();
+    const Sparse::BlockLayout layout    = f.blockLayout();
+    const V3i                 size      = box.size() + V3i(1);
+    const Box3i               dbsBounds = blockCoords(box, &f);
+
+    for (int bk = dbsBounds.min.z; bk <= dbsBounds.max.z; ++bk) {
+      for (int bj = dbsBounds.min.y; bj <= dbsBounds.max.y; ++bj) {
+        for (int bi = dbsBounds.min.x; bi <= dbsBounds.max.x; ++bi) {
+          const V3i first = dw.min + V3i(bi, bj, bk) * blockSize;
+          const Box3i sub = 
+            clipBounds(Box3i(first, first + V3i(blockSize - 1)), box);
+          // Check for a uniform block
+          const Data_T v0 = values[((sub.min.z - box.min.z) * size.y + 
+                                    sub.min.y - box.min.y) * size.x + 
+                                   sub.min.x - box.min.x];
+          bool isUniform = true;
+          for (int k = sub.min.z; isUniform && k <= sub.max.z; ++k) {
+            for (int j = sub.min.y; isUniform && j <= sub.max.y; ++j) {
+              const Data_T *row = values + 
+                ((k - box.min.z) * size.y + j - box.min.y) * size.x;
+              for (int i = sub.min.x; i <= sub.max.x; ++i) {
+                if (row[i - box.min.x] != v0) {
+                  isUniform = false;
+                  break;
+                }
+              }
+            }
+          }
+          if (isUniform) {
+            f.setBlockEmptyValue(bi, bj, bk, v0);
+            continue;
+          }
+          // Allocate the block and write it directly
+          f.fastLValue(sub.min.x, sub.min.y, sub.min.z) = v0;
+          Data_T *p = f.blockData(bi, bj, bk);
+          for (int k = sub.min.z; k <= sub.max.z; ++k) {
+            for (int j = sub.min.y; j <= sub.max.y; ++j) {
+              const Data_T *row = values + 
+                ((k - box.min.z) * size.y + j - box.min.y) * size.x;
+              for (int i = sub.min.x; i <= sub.max.x; ++i) {
+                p[Sparse::blockIndex(i - first.x, j - first.y, k - first.z,
+                                     order, layout)] = row[i - box.min.x];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
 
-    for (; iIn != endIn; ++iIn, ++iOut) {
-      *iOut = *iIn * wsToSsMtx;
+  //! Dense version copies whole rows
+  template <class Data_T>
+  void writeVoxels(DenseField<Data_T> &f, const Box3i &box, 
+                   const Data_T *values)
+  {
+    const int nx = box.max.x - box.min.x + 1;
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j, values += nx) {
+        std::copy(values, values + nx, &f.fastLValue(box.min.x, j, k));
+      }
     }
-    src = ccRotated;
   }
 
-  // Set the u edge value to their closest voxel
-  for (int k = data.min.z; k <= data.max.z; k++) {
-    for (int j = data.min.y; j <= data.max.y; j++) {
-      mac->u(data.min.x, j, k) = src->value(data.min.x, j, k).x;
-      mac->u(data.max.x + 1, j, k) = src->value(data.max.x, j, k).x;
+  //! Fallback version writes one voxel at a time
+  template <class Field_T>
+  void writeVoxels(Field_T &f, const Box3i &box, 
+                   const typename Field_T::value_type *values)
+  {
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j) {
+        for (int i = box.min.x; i <= box.max.x; ++i, ++values) {
+          f.lvalue(i, j, k) = *values;
+        }
+      }
     }
   }
 
-  // Set the v edge value to their closest voxel
-  for (int k = data.min.z; k <= data.max.z; k++) {
-    for (int i = data.min.x; i <= data.max.x; i++) {
-      mac->v(i, data.min.y, k) = src->value(i, data.min.y, k).y;
-      mac->v(i, data.max.y + 1, k) = src->value(i, data.max.y, k).y;
+  //--------------------------------------------------------------------------//
+
+  //! Sets all voxels of box to value. Sparse blocks are left unallocated.
+  //! \note box must cover each block it touches, clipped to the data window
+  template <class Data_T>
+  void fillVoxels(SparseField<Data_T> &f, const Box3i &box, 
+                  const Data_T &value)
+  {
+    const Box3i dbsBounds = blockCoords(box, &f);
+    for (int bk = dbsBounds.min.z; bk <= dbsBounds.max.z; ++bk) {
+      for (int bj = dbsBounds.min.y; bj <= dbsBounds.max.y; ++bj) {
+        for (int bi = dbsBounds.min.x; bi <= dbsBounds.max.x; ++bi) {
+          f.setBlockEmptyValue(bi, bj, bk, value);
+        }
+      }
     }
   }
 
-  // Set the w edge value to their closest voxel
-  for (int j = data.min.y; j <= data.max.y; j++) {
-    for (int i = data.min.x; i <= data.max.x; i++) {
-      mac->w(i, j, data.min.z) = src->value(i, j, data.min.z).z;
-      mac->w(i, j, data.max.z + 1) = src->value(i, j, data.max.z).z;
+  //! Fallback version writes one voxel at a time
+  template <class Field_T>
+  void fillVoxels(Field_T &f, const Box3i &box, 
+                  const typename Field_T::value_type &value)
+  {
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j) {
+        for (int i = box.min.x; i <= box.max.x; ++i) {
+          f.lvalue(i, j, k) = value;
+        }
+      }
     }
   }
 
-  // Loop over internal u values
-  for (int k = data.min.z; k <= data.max.z; ++k) {
-    for (int j = data.min.y; j <= data.max.y; ++j) {
-      for (int i = data.min.x + 1; i <= data.max.x; ++i) {
-        mac->u(i, j, k) = 
-          (src->value(i, j, k).x + src->value(i - 1, j, k).x) * 0.5;
+  //--------------------------------------------------------------------------//
+
+  //! Writes values, x fastest, to the faces of a component in box
+  template <class Data_T>
+  void writeFaces(MACField<Data_T> &mac, const MACComponent comp, 
+                  const Box3i &box, const typename Data_T::BaseType *values)
+  {
+    const int nx = box.max.x - box.min.x + 1;
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j, values += nx) {
+        typename Data_T::BaseType *row = 
+          comp == MACCompU ? &mac.u(box.min.x, j, k) :
+          comp == MACCompV ? &mac.v(box.min.x, j, k) : 
+          &mac.w(box.min.x, j, k);
+        std::copy(values, values + nx, row);
       }
     }
   }
 
-  // Loop over internal v values
-  for (int k = data.min.z; k <= data.max.z; ++k) {
-    for (int j = data.min.y + 1; j <= data.max.y; ++j) {
-      for (int i = data.min.x; i <= data.max.x; ++i) {
-        mac->v(i, j, k) = 
-          (src->value(i, j, k).y + src->value(i, j - 1, k).y) * 0.5;
+  //! Sparse version leaves uniform blocks unallocated
+  template <class Data_T>
+  void writeFaces(SparseMACField<Data_T> &mac, const MACComponent comp, 
+                  const Box3i &box, const typename Data_T::BaseType *values)
+  {
+    writeVoxels(*mac.component(comp), box, values);
+  }
+
+  //! Sets the faces of a component in box to value
+  template <class Data_T>
+  void fillFaces(MACField<Data_T> &mac, const MACComponent comp, 
+                 const Box3i &box, const typename Data_T::BaseType &value)
+  {
+    const int nx = box.max.x - box.min.x + 1;
+    for (int k = box.min.z; k <= box.max.z; ++k) {
+      for (int j = box.min.y; j <= box.max.y; ++j) {
+        typename Data_T::BaseType *row = 
+          comp == MACCompU ? &mac.u(box.min.x, j, k) :
+          comp == MACCompV ? &mac.v(box.min.x, j, k) : 
+          &mac.w(box.min.x, j, k);
+        std::fill(row, row + nx, value);
+      }
+    }
+  }
+
+  //! Sparse version leaves the blocks unallocated
+  template <class Data_T>
+  void fillFaces(SparseMACField<Data_T> &mac, const MACComponent comp, 
+                 const Box3i &box, const typename Data_T::BaseType &value)
+  {
+    fillVoxels(*mac.component(comp), box, value);
+  }
+
+  //--------------------------------------------------------------------------//
+  // MACToCellCenteredOp
+  //--------------------------------------------------------------------------//
+
+  //! Converts blocks of a MAC field to cell-centered voxels. Each row of 
+  //! voxels averages five contiguous rows of faces.
+  template <class MAC_T, class Field_T>
+  struct MACToCellCenteredOp
+  {
+    typedef typename Field_T::value_type Data_T;
+    typedef typename MAC_T::real_t       real_t;
+
+    MACToCellCenteredOp(const MAC_T &mac, Field_T &cc, const M44d *ssToWs,
+                        const std::vector<Box3i> &blocks, 
+                        boost::atomic<size_t> &nextIdx)
+      : m_mac(mac), m_cc(cc), m_ssToWs(ssToWs), m_blocks(blocks), 
+        m_nextIdx(nextIdx)
+    { 
+      // Empty
+    }
+
+    void operator() ()
+    {
+      for (size_t idx = m_nextIdx.fetch_add(1); idx < m_blocks.size();
+           idx = m_nextIdx.fetch_add(1)) {
+        convertBlock(m_blocks[idx]);
+      }
+    }
+
+  private:
+
+    void convertBlock(const Box3i &box)
+    {
+      // Faces in uniform regions need no averaging
+      Data_T value;
+      if (uniformFaces(m_mac, box, value)) {
+        if (m_ssToWs) {
+          value = value * *m_ssToWs;
+        }
+        fillVoxels(m_cc, box, value);
+        return;
+      }
+
+      const V3i size = box.size() + V3i(1);
+      m_values.resize(size.x * size.y * size.z);
+      Data_T *out = &m_values[0];
+
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j, out += size.x) {
+          const int i = box.min.x;
+          const real_t *u  = faceRow(m_mac, MACCompU, i, j, k, size.x + 1, 
+                                     m_u);
+          const real_t *v0 = faceRow(m_mac, MACCompV, i, j, k, size.x, m_v0);
+          const real_t *v1 = faceRow(m_mac, MACCompV, i, j + 1, k, size.x, 
+                                     m_v1);
+          const real_t *w0 = faceRow(m_mac, MACCompW, i, j, k, size.x, m_w0);
+          const real_t *w1 = faceRow(m_mac, MACCompW, i, j, k + 1, size.x, 
+                                     m_w1);
+          for (int x = 0; x < size.x; ++x) {
+            out[x] = Data_T((u[x] + u[x + 1]) * 0.5, 
+                            (v0[x] + v1[x]) * 0.5,
+                            (w0[x] + w1[x]) * 0.5);
+          }
+          if (m_ssToWs) {
+            for (int x = 0; x < size.x; ++x) {
+              out[x] = out[x] * *m_ssToWs;
+            }
+          }
+        }
+      }
+
+      writeVoxels(m_cc, box, &m_values[0]);
+    }
+
+    // Data members ---
+
+    const MAC_T              &m_mac;
+    Field_T                  &m_cc;
+    //! Rotation from simulation space to world space. Null if none
+    const M44d               *m_ssToWs;
+    const std::vector<Box3i> &m_blocks;
+    boost::atomic<size_t>    &m_nextIdx;
+    //! Scratch space. Each thread has its own copy of the op
+    std::vector<Data_T>       m_values;
+    std::vector<real_t>       m_u, m_v0, m_v1, m_w0, m_w1;
+  };
+
+  //--------------------------------------------------------------------------//
+  // CellCenteredToMACOp
+  //--------------------------------------------------------------------------//
+
+  //! Converts blocks of a cell-centered field to MAC faces. Each block 
+  //! writes the faces on its min sides, plus the max side faces at the 
+  //! upper edges of the data window, so no two blocks share a face.
+  template <class Field_T, class MAC_T>
+  struct CellCenteredToMACOp
+  {
+    typedef typename Field_T::value_type Data_T;
+    typedef typename MAC_T::real_t       real_t;
+
+    CellCenteredToMACOp(const Field_T &cc, MAC_T &mac, const M44d *wsToSs,
+                        const std::vector<Box3i> &blocks, 
+                        boost::atomic<size_t> &nextIdx)
+      : m_cc(cc), m_mac(mac), m_wsToSs(wsToSs), m_blocks(blocks), 
+        m_nextIdx(nextIdx)
+    { 
+      // Empty
+    }
+
+    void operator() ()
+    {
+      for (size_t idx = m_nextIdx.fetch_add(1); idx < m_blocks.size();
+           idx = m_nextIdx.fetch_add(1)) {
+        convertBlock(m_blocks[idx]);
+      }
+    }
+
+  private:
+
+    //! Returns the faces of comp owned by box
+    Box3i faceBox(const Box3i &box, const int comp) const
+    {
+      Box3i faces = box;
+      if (box.max[comp] == m_mac.dataWindow().max[comp]) {
+        faces.max[comp] += 1;
+      }
+      return faces;
+    }
+
+    void convertBlock(const Box3i &box)
+    {
+      const Box3i &dw = m_mac.dataWindow();
+
+      // Source voxels, including the neighbors on the min sides
+      Box3i src = box;
+      src.min = V3i(std::max(box.min.x - 1, dw.min.x), 
+                    std::max(box.min.y - 1, dw.min.y), 
+                    std::max(box.min.z - 1, dw.min.z));
+
+      // Uniform source regions give uniform faces
+      Data_T value;
+      if (uniformRegion(m_cc, src, value)) {
+        if (m_wsToSs) {
+          value = value * *m_wsToSs;
+        }
+        for (int c = 0; c < 3; ++c) {
+          fillFaces(m_mac, static_cast<MACComponent>(c), faceBox(box, c), 
+                    static_cast<real_t>(value[c]));
+        }
+        return;
+      }
+
+      // Read the source voxels
+      const V3i srcSize = src.size() + V3i(1);
+      m_src.resize(srcSize.x * srcSize.y * srcSize.z);
+      readVoxels(m_cc, src, &m_src[0]);
+      if (m_wsToSs) {
+        for (size_t n = 0; n < m_src.size(); ++n) {
+          m_src[n] = m_src[n] * *m_wsToSs;
+        }
+      }
+
+      // Each face averages the voxels on either side, clamped to the 
+      // data window
+      for (int c = 0; c < 3; ++c) {
+        const Box3i faces = faceBox(box, c);
+        const V3i   size  = faces.size() + V3i(1);
+        m_faces.resize(size.x * size.y * size.z);
+        real_t *out = &m_faces[0];
+        for (int k = faces.min.z; k <= faces.max.z; ++k) {
+          for (int j = faces.min.y; j <= faces.max.y; ++j) {
+            for (int i = faces.min.x; i <= faces.max.x; ++i, ++out) {
+              V3i p1(i, j, k);
+              p1[c] = std::min(p1[c], dw.max[c]);
+              V3i p0(i, j, k);
+              p0[c] = std::max(p0[c] - 1, dw.min[c]);
+              *out = static_cast<real_t>((srcValue(p0, src, srcSize)[c] + 
+                                          srcValue(p1, src, srcSize)[c]) * 
+                                         0.5);
+            }
+          }
+        }
+        writeFaces(m_mac, static_cast<MACComponent>(c), faces, &m_faces[0]);
+      }
+    }
+
+    const Data_T& srcValue(const V3i &p, const Box3i &src, 
+                           const V3i &srcSize) const
+    {
+      return m_src[((p.z - src.min.z) * srcSize.y + p.y - src.min.y) * 
+                   srcSize.x + p.x - src.min.x];
+    }
+
+    // Data members ---
+
+    const Field_T            &m_cc;
+    MAC_T                    &m_mac;
+    //! Rotation from world space to simulation space. Null if none
+    const M44d               *m_wsToSs;
+    const std::vector<Box3i> &m_blocks;
+    boost::atomic<size_t>    &m_nextIdx;
+    //! Scratch space. Each thread has its own copy of the op
+    std::vector<Data_T>       m_src;
+    std::vector<real_t>       m_faces;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches the cell-centered target to the MAC field and runs the
+  //! conversion
+  template <class MAC_T, class Field_T>
+  void convertMACToCellCentered(const MAC_T &mac, Field_T &cc)
+  {
+    // Make sure the extents and data window match
+    if (cc.extents().min != mac.extents().min ||
+        cc.extents().max != mac.extents().max ||
+        cc.dataWindow().min != mac.dataWindow().min ||
+        cc.dataWindow().max != mac.dataWindow().max ) {
+      cc.setSize(mac.extents(), mac.dataWindow());
+    }
+
+    // Make sure mapping matches
+    if (!cc.mapping()->isIdentical(mac.mapping())) {
+      cc.setMapping(mac.mapping());
+    }
+
+    // MAC velocities are in simulation space (axis-aligned to the
+    // mapping) because the values are stored on the faces, so rotate
+    // vectors from simulation-space to world-space when transferring
+    // from MAC to cell-centered
+
+    bool rotateVector = false;
+    M44d ssToWsMtx;
+    MatrixFieldMapping::Ptr mapping =
+      FIELD_DYNAMIC_CAST<MatrixFieldMapping>(mac.mapping());
+    if (mapping) {
+      M44d localToWorldMtx = mapping->localToWorld();
+      V3d scale, rot, trans, shear;
+      if (extractSHRT(localToWorldMtx, scale, shear, rot, trans, false)) {
+        ssToWsMtx.rotate(rot);
+        if (rot.length2() > FLT_EPSILON)
+          rotateVector = true;
       }
     }
+
+    // Blocks follow the target, so sparse targets get whole blocks
+    const std::vector<Box3i> blocks = 
+      macBlocks(cc.dataWindow(), macBlockSize(cc));
+
+    typedef MACToCellCenteredOp<MAC_T, Field_T> Op;
+    boost::atomic<size_t> nextIdx(0);
+    const Op op(mac, cc, rotateVector ? &ssToWsMtx : NULL, blocks, nextIdx);
+    runMACOp(op, numIOThreads());
   }
 
-  // Loop over internal w values
-  for (int k = data.min.z + 1; k <= data.max.z; ++k) {
-    for (int j = data.min.y; j <= data.max.y; ++j) {
-      for (int i = data.min.x; i <= data.max.x; ++i) {
-        mac->w(i, j, k) = 
-          (src->value(i, j, k).z + src->value(i, j, k - 1).z) * 0.5;
+  //--------------------------------------------------------------------------//
+
+  //! Matches the MAC target to the cell-centered field and runs the
+  //! conversion
+  template <class Field_T, class MAC_T>
+  void convertCellCenteredToMAC(const Field_T &cc, MAC_T &mac)
+  {
+    // Make sure the extents and data window match
+    if (mac.extents().min != cc.extents().min ||
+        mac.extents().max != cc.extents().max ||
+        mac.dataWindow().min != cc.dataWindow().min ||
+        mac.dataWindow().max != cc.dataWindow().max ) {
+      mac.setSize(cc.extents(), cc.dataWindow());
+    }
+
+    // Make sure mapping matches
+    if (!mac.mapping()->isIdentical(cc.mapping())) {
+      mac.setMapping(cc.mapping());
+    }
+
+    // MAC velocities are in simulation space (axis-aligned to the
+    // mapping) because the values are stored on the faces, so rotate
+    // vectors from world-space to simulation-space when transferring
+    // from cell-centered to MAC
+
+    bool rotateVector = false;
+    M44d wsToSsMtx;
+    MatrixFieldMapping::Ptr mapping =
+      FIELD_DYNAMIC_CAST<MatrixFieldMapping>(mac.mapping());
+    if (mapping) {
+      M44d localToWorld = mapping->localToWorld();
+      V3d scale, rot, trans, shear;
+      if (FIELD3D_EXTRACT_SHRT(localToWorld, scale, shear, rot, trans, 
+                               false)) {
+        wsToSsMtx.rotate(-rot);
+        rotateVector = true;
       }
     }
+
+    // Blocks follow the target, so that sparse components get whole
+    // blocks
+    const std::vector<Box3i> blocks = 
+      macBlocks(mac.dataWindow(), macBlockSize(mac));
+
+    typedef CellCenteredToMACOp<Field_T, MAC_T> Op;
+    boost::atomic<size_t> nextIdx(0);
+    const Op op(cc, mac, rotateVector ? &wsToSsMtx : NULL, blocks, nextIdx);
+    runMACOp(op, numIOThreads());
   }
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Field_T>
+void convertMACToCellCentered(typename MACField<Data_T>::Ptr mac,
+                              typename Field_T::Ptr cc)
+{
+  detail::convertMACToCellCentered(*mac, *cc);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class Field_T>
+void convertMACToCellCentered(typename SparseMACField<Data_T>::Ptr mac,
+                              typename Field_T::Ptr cc)
+{
+  detail::convertMACToCellCentered(*mac, *cc);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T, class Data_T>
+void convertCellCenteredToMAC(typename Field_T::Ptr cc,
+                              typename MACField<Data_T>::Ptr mac)
+{
+  detail::convertCellCenteredToMAC(*cc, *mac);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T, class Data_T>
+void convertCellCenteredToMAC(typename Field_T::Ptr cc,
+                              typename SparseMACField<Data_T>::Ptr mac)
+{
+  detail::convertCellCenteredToMAC(*cc, *mac);
 }
 
 //----------------------------------------------------------------------------//
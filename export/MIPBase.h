@@ -179,6 +179,16 @@ public:
   //! Returns the base MIP offset
   const V3i& mipOffset() const
   { return m_mipOffset; }
+  //! Sets the last level at which each axis is reduced. Past it, the
+  //! axis keeps the resolution of that level. Defaults to no limit, so
+  //! that all axes are halved at every level.
+  void setMaxAxisLevels(const V3i &levels);
+  //! Returns the last level at which each axis is reduced
+  const V3i& maxAxisLevels() const
+  { return m_maxAxisLevels; }
+  //! Returns the number of times each axis has been halved in the given
+  //! level
+  V3i axisLevels(const size_t level) const;
 
 protected:
 
@@ -202,6 +212,9 @@ protected:
   //! \note This is stored on disk in metadata, and is updated by
   //! the standard I/O routines.
   V3i m_mipOffset;
+  //! Last level at which each axis is reduced.
+  //! \note Like the offset, this is stored on disk in metadata.
+  V3i m_maxAxisLevels;
 
 };
 
@@ -211,7 +224,8 @@ protected:
 
 template <typename Data_T>
 MIPBase<Data_T>::MIPBase()
-  : m_numLevels(1), m_lowestLevel(0), m_mipOffset(0)
+  : m_numLevels(1), m_lowestLevel(0), m_mipOffset(0),
+    m_maxAxisLevels(detail::k_mipNoAxisLimit)
 {
   
 }
@@ -233,6 +247,25 @@ void MIPBase<Data_T>::setMIPOffset(const V3i &offset)
   m_mipOffset = offset; 
 }
 
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void MIPBase<Data_T>::setMaxAxisLevels(const V3i &levels)
+{ 
+  this->metadata().setVecIntMetadata(detail::k_mipMaxAxisLevelsStr, levels);
+  m_maxAxisLevels = levels; 
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3i MIPBase<Data_T>::axisLevels(const size_t level) const
+{
+  const int l = static_cast<int>(level);
+  return V3i(std::min(l, m_maxAxisLevels.x), std::min(l, m_maxAxisLevels.y),
+             std::min(l, m_maxAxisLevels.z));
+}
+
 //----------------------------------------------------------------------------//
 // Static member initialization
 //----------------------------------------------------------------------------//
@@ -46,8 +46,10 @@
 
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "EmptyField.h"
 #include "MIPBase.h"
@@ -55,6 +57,8 @@
 #include "MIPUtil.h"
 #include "DenseField.h"
 #include "SparseField.h"
+#include "Stats.h"
+#include "Trace.h"
 
 //----------------------------------------------------------------------------//
 
@@ -94,9 +98,14 @@ class CubicMIPFieldInterp;
   The class is lazy loading, such that no MIP levels are read from disk until
   they are needed. On top of this, standard SparseField caching (memory 
   limiting) is available, and operates the same as normal SparseFields. 
+  Each dynamically loaded level gets its level index as its cache priority,
+  so the blocks of the finer levels are evicted before the coarser ones.
 
-  The class is thread safe, and ensures that data is read from disk from in one
-  single thread, using the double-checked locking mechanism.
+  The class is thread safe, and ensures that each level is read from disk in
+  one single thread, using the double-checked locking mechanism. Each level
+  has a lock of its own, so a thread needing a coarse level doesn't wait for
+  another one that is loading a fine level. Levels may also be loaded ahead
+  of time on a background thread using prefetchLevel() and prefetchLevels().
 
   Interpolation into a MIP field may be done either directly to a single level,
   or by blending between two MIP levels. When blending, each field is assumed
@@ -145,6 +154,10 @@ public:
   //! Assignment operator
   const MIPField& operator = (const MIPField &rhs);
 
+  //! Returns the memory of the levels it loaded from disk to the 
+  //! MemoryBudget
+  ~MIPField();
+
   // \}
 
   // From FieldRes base class --------------------------------------------------
@@ -153,6 +166,9 @@ public:
   //! \{  
   //! Returns -current- memory use, rather than the amount used if all
   //! levels were loaded.
+  //! \note Only the loaded levels are visited, through the same raw 
+  //! pointers the lookups use, so this may be called while other threads
+  //! load levels.
   virtual long long int memSize() const;
   //! We need to know if the mapping changed so that we may update the
   //! MIP levels' mappings
@@ -234,6 +250,18 @@ public:
   const Field_T* rawMipLevel(const size_t level) const;
   //! Returns a concretely typed pointer to a MIP level
   typename Field_T::Ptr concreteMipLevel(const size_t level) const;
+  //! Returns a concretely typed pointer to a MIP level. Levels that aren't
+  //! loaded yet are loaded, but not kept in memory, so that writing out a
+  //! lazy-loaded MIP field only holds one level at a time.
+  typename Field_T::Ptr streamMipLevel(const size_t level) const;
+  //! Starts loading the given level on a background thread, if it isn't 
+  //! loaded already. Accessing the level waits for the load to finish.
+  void prefetchLevel(const size_t level) const;
+  //! Starts loading all the levels that aren't loaded already on a 
+  //! background thread, one after the other.
+  //! \param coarsestFirst Whether to load the coarsest level first, so 
+  //! that a usable level becomes available as soon as possible
+  void prefetchLevels(const bool coarsestFirst = true) const;
 
 protected:
 
@@ -265,10 +293,12 @@ protected:
   //! Relative resolution of each MIP level. Pre-computed to avoid
   //! int-to-float conversions
   mutable std::vector<V3f> m_relativeResolution;
-  //! Mutex lock around IO. Used to make sure only one thread reads MIP 
-  //! level data at a time. When a field is cloned, the two new fields
-  //! will share the mutex, since they point to the same file.
-  boost::shared_ptr<boost::mutex> m_ioMutex;
+  //! Mutex lock around the IO of each level. Used to make sure only one 
+  //! thread reads a given MIP level's data.
+  std::vector<boost::shared_ptr<boost::mutex> > m_levelMutexes;
+  //! Bytes of the levels loaded from disk that are charged to the 
+  //! MemoryBudget. Copies don't inherit the charge.
+  mutable boost::atomic<long long int> m_budgetBytes;
 
   // Utility methods -----------------------------------------------------------
 
@@ -280,8 +310,11 @@ protected:
   void updateMapping(FieldRes::Ptr field);
   //! Updates the dependent data members based on m_field
   void updateAuxMembers() const;
-  //! Updates the name, attribute and metadata for a given level
-  void syncLevelInfo(const size_t level) const;
+  //! Gives each level a new mutex
+  void initLevelMutexes();
+  //! Runs the lazy load action of the given level and sets up the name, 
+  //! attribute, metadata and mapping of the result
+  FieldPtr runLoadAction(const size_t level) const;
   //! Loads the given level from disk
   void loadLevelFromDisk(size_t level) const;
   //! Sanity checks to ensure that the provided Fields are a MIP representation
@@ -316,34 +349,116 @@ class MIPDenseField : public MIPField<DenseField<Data_T> >
   }
 };
 
+//----------------------------------------------------------------------------//
+// Implementation details
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //! Loads MIP levels in the given order. Runs on the thread started by 
+  //! MIPField::prefetchLevel() and prefetchLevels(), and holds a reference 
+  //! to the field until it's done.
+  template <typename MIPField_T>
+  struct MIPPrefetchOp
+  {
+    MIPPrefetchOp(const MIPField_T *field, const std::vector<size_t> &levels)
+      : m_field(const_cast<MIPField_T*>(field)), m_levels(levels)
+    { }
+
+    void operator() () const
+    {
+      try {
+        for (size_t i = 0; i < m_levels.size(); ++i) {
+          m_field->rawMipLevel(m_levels[i]);
+        }
+      } 
+      catch (const std::exception &e) {
+        // The level will be loaded again, and the error reported, when 
+        // it's accessed
+        static Msg::RateLimit limit;
+        Msg::print(limit, Msg::SevWarning, 
+                   std::string("Couldn't prefetch MIP level: ") + e.what());
+      }
+    }
+
+    typename MIPField_T::Ptr m_field;
+    std::vector<size_t>      m_levels;
+  };
+
+  //! Sets the cache priority of a loaded MIP level. Only dynamically 
+  //! loaded SparseField levels have one.
+  template <typename Field_T>
+  void setMIPLevelCachePriority(Field_T &/* field */, const int /* level */)
+  { }
+
+  //! Coarser levels get higher priorities, so that the blocks of the finer
+  //! levels are evicted first
+  template <typename Data_T>
+  void setMIPLevelCachePriority(SparseField<Data_T> &field, const int level)
+  { 
+    field.setCachePriority(level);
+  }
+
+  //! Bytes a loaded MIP level is charged to the MemoryBudget
+  template <typename Field_T>
+  long long int mipLevelBudgetBytes(const Field_T &field)
+  { 
+    return field.memSize();
+  }
+
+  //! Dynamically loaded SparseField levels are charged through the 
+  //! SparseFileManager instead, block by block
+  template <typename Data_T>
+  long long int mipLevelBudgetBytes(const SparseField<Data_T> &field)
+  { 
+    return field.isDynamicLoad() ? 0 : field.memSize();
+  }
+
+} // namespace detail
+
 //----------------------------------------------------------------------------//
 // MIPField implementations
 //----------------------------------------------------------------------------//
 
 template <class Field_T>
 MIPField<Field_T>::MIPField()
-  : base(),
-    m_ioMutex(new boost::mutex)
+  : base(), m_budgetBytes(0)
 {
   m_fields.resize(base::m_numLevels);
+  initLevelMutexes();
 }
 
 //----------------------------------------------------------------------------//
 
 template <class Field_T>
 MIPField<Field_T>::MIPField(const MIPField &other)
-  : base(other)
+  : base(other), m_budgetBytes(0)
 {
   init(other);
 }
 
 //----------------------------------------------------------------------------//
 
+template <class Field_T>
+MIPField<Field_T>::~MIPField()
+{
+  if (m_budgetBytes > 0) {
+    detail::mipLevelMemory().subtract(m_budgetBytes);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Field_T>
 const MIPField<Field_T>& 
 MIPField<Field_T>::operator = (const MIPField &rhs)
 {
   base::operator=(rhs);
+  // The levels loaded so far are replaced by the ones of rhs
+  const long long int bytes = m_budgetBytes.exchange(0);
+  if (bytes > 0) {
+    detail::mipLevelMemory().subtract(bytes);
+  }
   return init(rhs);
 }
 
@@ -377,8 +492,8 @@ MIPField<Field_T>::init(const MIPField &rhs)
     // Update the raw pointer
     m_rawFields[i] = m_fields[i].get();
   }
-  // New mutex
-  m_ioMutex.reset(new boost::mutex);
+  // New mutexes
+  initLevelMutexes();
   // Done
   return *this;
 }
@@ -388,6 +503,10 @@ MIPField<Field_T>::init(const MIPField &rhs)
 template <class Field_T>
 void MIPField<Field_T>::clear()
 {
+  const long long int bytes = m_budgetBytes.exchange(0);
+  if (bytes > 0) {
+    detail::mipLevelMemory().subtract(bytes);
+  }
   m_fields.clear();
   m_rawFields.clear();
   base::m_numLevels = 0;
@@ -409,6 +528,7 @@ void MIPField<Field_T>::setup(const FieldVec &fields)
   base::m_lowestLevel = 0;
   updateMapping(fields[0]);
   updateAuxMembers();
+  initLevelMutexes();
   // Resize vectors
   m_mipRes.resize(base::m_numLevels);
   m_relativeResolution.resize(base::m_numLevels);
@@ -446,6 +566,7 @@ void MIPField<Field_T>::setupLazyLoad
   m_fields.resize(base::m_numLevels);
   updateMapping(proxies[0]);
   updateAuxMembers();
+  initLevelMutexes();
   // Resize vectors
   m_mipRes.resize(base::m_numLevels);
   m_relativeResolution.resize(base::m_numLevels);
@@ -506,6 +627,57 @@ MIPField<Field_T>::concreteMipLevel(size_t level) const
 
 //----------------------------------------------------------------------------//
 
+template <class Field_T>
+typename Field_T::Ptr
+MIPField<Field_T>::streamMipLevel(size_t level) const
+{
+  assert(level < base::m_numLevels);
+  // Loaded levels are returned as is
+  if (m_rawFields[level]) {
+    return m_fields[level];
+  }
+  Stats::ScopedLock<boost::mutex> 
+    lock(*m_levelMutexes[level], Stats::MIPLevelLockWait);
+  if (m_rawFields[level]) {
+    return m_fields[level];
+  }
+  // The lazy load action is kept, so the level may be loaded again
+  return runLoadAction(level);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+void MIPField<Field_T>::prefetchLevel(const size_t level) const
+{
+  assert(level < base::m_numLevels);
+  if (!m_rawFields[level]) {
+    std::vector<size_t> levels(1, level);
+    boost::thread(detail::MIPPrefetchOp<MIPField<Field_T> >(this, levels))
+      .detach();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+void MIPField<Field_T>::prefetchLevels(const bool coarsestFirst) const
+{
+  std::vector<size_t> levels;
+  for (size_t i = 0; i < base::m_numLevels; ++i) {
+    const size_t level = coarsestFirst ? base::m_numLevels - 1 - i : i;
+    if (!m_rawFields[level]) {
+      levels.push_back(level);
+    }
+  }
+  if (!levels.empty()) {
+    boost::thread(detail::MIPPrefetchOp<MIPField<Field_T> >(this, levels))
+      .detach();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Field_T>
 typename MIPField<Field_T>::Data_T 
 MIPField<Field_T>::value(int i, int j, int k) const
@@ -534,9 +706,9 @@ template <class Field_T>
 long long int MIPField<Field_T>::memSize() const
 { 
   long long int mem = 0;
-  for (size_t i = 0; i < m_fields.size(); i++) {
-    if (m_fields[i]) {
-      mem += m_fields[i]->memSize();
+  for (size_t i = 0; i < m_rawFields.size(); i++) {
+    if (const Field_T *field = m_rawFields[i]) {
+      mem += field->memSize();
     }
   }
   return mem + sizeof(*this);
@@ -551,6 +723,10 @@ void MIPField<Field_T>::mappingChanged()
   const V3i offset = 
     base::metadata().vecIntMetadata(detail::k_mipOffsetStr, V3i(0));
   base::setMIPOffset(offset);
+  // ... and the axis limits, which aren't in the metadata unless set
+  base::m_maxAxisLevels = 
+    base::metadata().vecIntMetadata(detail::k_mipMaxAxisLevelsStr, 
+                                    V3i(detail::k_mipNoAxisLimit));
 
   V3i baseRes = base::dataWindow().size() + V3i(1);
   if (m_fields[0]) {
@@ -600,18 +776,22 @@ void MIPField<Field_T>::getVsMIPCoord(const V3f &vsP, const size_t level,
                                       V3f &outVsP) const
 {
   const V3i &mipOff = base::mipOffset();
+  const V3i  l      = base::axisLevels(level);
 
   // Compute offset of current level 
-  const V3i offset((mipOff.x >> level) << level, 
-                   (mipOff.y >> level) << level, 
-                   (mipOff.z >> level) << level);
+  const V3i offset((mipOff.x >> l.x) << l.x, 
+                   (mipOff.y >> l.y) << l.y, 
+                   (mipOff.z >> l.z) << l.z);
 
   // Difference between current offset and base offset is num voxels
   // to offset current level by 
   const V3f diff = offset - mipOff;
 
   // Incorporate shift due to mip offset
-  outVsP = (vsP - diff) * pow(2.0, -static_cast<float>(level));
+  const V3f scale(pow(2.0, -static_cast<float>(l.x)), 
+                  pow(2.0, -static_cast<float>(l.y)), 
+                  pow(2.0, -static_cast<float>(l.z)));
+  outVsP = (vsP - diff) * scale;
 }
 
 //----------------------------------------------------------------------------//
@@ -658,15 +838,12 @@ void MIPField<Field_T>::updateAuxMembers() const
 //----------------------------------------------------------------------------//
 
 template <class Field_T>
-void MIPField<Field_T>::syncLevelInfo(const size_t level) const
+void MIPField<Field_T>::initLevelMutexes()
 {
-  // At this point, m_fields[level] is guaranteed in memory
-  
-  // First sync name, attribute
-  m_fields[level]->name      = base::name;
-  m_fields[level]->attribute = base::attribute;
-  // Copy metadata
-  m_fields[level]->copyMetadata(*this);
+  m_levelMutexes.resize(m_fields.size());
+  for (size_t i = 0; i < m_levelMutexes.size(); i++) {
+    m_levelMutexes[i].reset(new boost::mutex);
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -686,33 +863,60 @@ void MIPField<Field_T>::loadLevelFromDisk(size_t level) const
 {
   // Double-check locking
   if (!m_rawFields[level]) {
-    boost::mutex::scoped_lock lock(*m_ioMutex);
+    Stats::ScopedLock<boost::mutex> 
+      lock(*m_levelMutexes[level], Stats::MIPLevelLockWait);
     if (!m_rawFields[level]) {
+      Trace::ScopedEvent event("MIPField::loadLevelFromDisk", level);
       // Execute the lazy load action
-      m_fields[level] = m_loadActions[level]->load();
-      // Check that field was loaded
-      if (!m_fields[level]) {
-        throw Exc::MIPFieldException("Couldn't load MIP level: " + 
-                                     boost::lexical_cast<std::string>(level));
-      }
+      m_fields[level] = runLoadAction(level);
       // Remove lazy load action
       m_loadActions[level].reset();
-      // Update aux data
-      updateAuxMembers();
-      // Ensure metadata is up to date
-      syncLevelInfo(level);
-      // Update the mapping of the loaded field
-      V3i baseRes = base::dataWindow().size() + V3i(1);
-      FieldMapping::Ptr mapping = 
-        detail::adjustedMIPFieldMapping(this, baseRes, 
-                                        m_fields[level]->extents(), level);
-      m_fields[level]->setMapping(mapping);
+      // Charge the level to the global memory budget, making room for it 
+      // in the other caches if needed
+      const long long int bytes = detail::mipLevelBudgetBytes(*m_fields[level]);
+      if (bytes > 0) {
+        MemoryBudget::singleton().reserve(bytes);
+        detail::mipLevelMemory().add(bytes);
+        m_budgetBytes += bytes;
+      }
+      // Update the raw pointer last, since other threads check it without
+      // holding the lock. The other levels may be loading concurrently, so
+      // updateAuxMembers() can't be used
+      m_rawFields[level] = m_fields[level].get();
     }
   }
 }
 
 //----------------------------------------------------------------------------//
 
+template <class Field_T>
+typename MIPField<Field_T>::FieldPtr
+MIPField<Field_T>::runLoadAction(const size_t level) const
+{
+  // Execute the lazy load action
+  FieldPtr field = m_loadActions[level]->load();
+  // Check that field was loaded
+  if (!field) {
+    throw Exc::MIPFieldException("Couldn't load MIP level: " + 
+                                 boost::lexical_cast<std::string>(level));
+  }
+  // Ensure metadata is up to date
+  field->name      = base::name;
+  field->attribute = base::attribute;
+  field->copyMetadata(*this);
+  // Update the mapping of the loaded field
+  V3i baseRes = base::dataWindow().size() + V3i(1);
+  FieldMapping::Ptr mapping = 
+    detail::adjustedMIPFieldMapping(this, baseRes, field->extents(), level);
+  field->setMapping(mapping);
+  // Keep the coarse levels resident in the block cache
+  detail::setMIPLevelCachePriority(*field, static_cast<int>(level));
+
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Field_T>
 template <class T>
 void
@@ -79,6 +79,14 @@ public:
   //! size (which may be zero, forcing a lookup in the 0-level field).
   value_type sample(const V3d &vsP, const float wsSpotSize) const;
 
+  //! Performs interpolation of n points at once, each with its own spot 
+  //! size. The points are grouped by the levels they need, so that each 
+  //! level is looked up and its coordinate transform worked out once per 
+  //! batch, and each level is sampled with the batched sample() of the 
+  //! level's interpolator. Results match those of the single point sample().
+  void sample(size_t n, const V3f *vsP, const float *wsSpotSize, 
+              value_type *out) const;
+
 private:
 
   // Structs ---
@@ -131,12 +139,19 @@ MIPLinearInterp<MIPField_T>::MIPLinearInterp(const MIPField_T &mip)
 {
   // Base voxel size (represents finest level)
   const V3f   wsVoxelSize    = mip.mapping()->wsVoxelSize(0, 0, 0);
-  const float wsMinVoxelSize = 
-    std::min(std::min(wsVoxelSize.x, wsVoxelSize.y), wsVoxelSize.z);
-  // All subsequent levels are a 2x mult on the base voxel size
+  // All subsequent levels are a 2x mult on the base voxel size. Levels 
+  // are told apart by the axes that are still being reduced, since the
+  // others keep their voxel size
   for (size_t i = 0, end = mip.numLevels(); i < end; ++i) {
     const float factor = std::pow(2.0f, static_cast<float>(i));
-    m_wsVoxelSize.push_back(wsMinVoxelSize * factor);
+    const V3i   l      = mip.axisLevels(i);
+    float       size   = std::numeric_limits<float>::max();
+    for (int dim = 0; dim < 3; ++dim) {
+      if (l[dim] == static_cast<int>(i)) {
+        size = std::min(size, wsVoxelSize[dim] * factor);
+      }
+    }
+    m_wsVoxelSize.push_back(size);
   }
 }
 
@@ -173,6 +188,83 @@ MIPLinearInterp<MIPField_T>::sample(const V3d &vsP,
 
 //----------------------------------------------------------------------------//
 
+template <typename MIPField_T>
+void MIPLinearInterp<MIPField_T>::sample(size_t n, const V3f *vsP, 
+                                         const float *wsSpotSize,
+                                         value_type *out) const
+{
+  const size_t numLevels = m_mip.numLevels();
+
+  // Bucket the points by level. A point between two levels goes in both
+  // buckets. Each bucket keeps the points in their original order, so 
+  // coherent batches stay coherent within each level
+  std::vector<InterpInfo> infos(n);
+  std::vector<size_t>     bucketStart(numLevels + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    infos[i] = interpInfo(wsSpotSize[i]);
+    bucketStart[infos[i].lower + 1]++;
+    if (infos[i].upper != infos[i].lower) {
+      bucketStart[infos[i].upper + 1]++;
+    }
+  }
+  for (size_t level = 0; level < numLevels; ++level) {
+    bucketStart[level + 1] += bucketStart[level];
+  }
+  std::vector<size_t> indices(bucketStart[numLevels]);
+  std::vector<size_t> bucketEnd(bucketStart.begin(), bucketStart.end() - 1);
+  for (size_t i = 0; i < n; ++i) {
+    indices[bucketEnd[infos[i].lower]++] = i;
+    if (infos[i].upper != infos[i].lower) {
+      indices[bucketEnd[infos[i].upper]++] = i;
+    }
+  }
+
+  // Sample each level. Lower level values go straight to out, and upper 
+  // level values are blended in afterwards
+  std::vector<value_type> upperValues(n);
+  std::vector<V3f>        mipVsP;
+  std::vector<value_type> values;
+  for (size_t level = 0; level < numLevels; ++level) {
+    const size_t first = bucketStart[level], count = bucketEnd[level] - first;
+    if (count == 0) {
+      continue;
+    }
+    // Recover the level's offset from the transform of the origin. This is
+    // exact, since the scale of each axis is a power of two
+    const V3i l = m_mip.axisLevels(level);
+    const V3f scale(std::pow(2.0f, -static_cast<float>(l.x)), 
+                    std::pow(2.0f, -static_cast<float>(l.y)), 
+                    std::pow(2.0f, -static_cast<float>(l.z)));
+    V3f origin;
+    m_mip.getVsMIPCoord(V3f(0.0f), level, origin);
+    const V3f diff = -origin / scale;
+    mipVsP.resize(count);
+    values.resize(count);
+    for (size_t j = 0; j < count; ++j) {
+      const V3f &p = vsP[indices[first + j]];
+      mipVsP[j] = level == 0 ? p : (p - diff) * scale;
+    }
+    m_interp.sample(*m_mip.rawMipLevel(level), count, &mipVsP[0], &values[0]);
+    for (size_t j = 0; j < count; ++j) {
+      const size_t i = indices[first + j];
+      if (infos[i].lower == level) {
+        out[i] = values[j];
+      } else {
+        upperValues[i] = values[j];
+      }
+    }
+  }
+
+  // Blend between the levels
+  for (size_t i = 0; i < n; ++i) {
+    if (infos[i].upper != infos[i].lower) {
+      out[i] = FIELD3D_LERP(out[i], upperValues[i], infos[i].lerpT);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename MIPField_T>
 typename MIPLinearInterp<MIPField_T>::InterpInfo
 MIPLinearInterp<MIPField_T>::interpInfo(const float wsSpotSize) const
@@ -46,13 +46,21 @@
 
 //----------------------------------------------------------------------------//
 
+#include <limits>
 #include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 
+#include "EmptyField.h"
+#include "MemoryBudget.h"
 #include "Resample.h"
 #include "SparseField.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include "Types.h"
 
 //----------------------------------------------------------------------------//
@@ -61,6 +69,28 @@
 
 FIELD3D_NAMESPACE_OPEN
 
+//----------------------------------------------------------------------------//
+// Forward declarations 
+//----------------------------------------------------------------------------//
+
+template <class Field_T>
+class LazyLoadAction;
+
+//----------------------------------------------------------------------------//
+// Enums
+//----------------------------------------------------------------------------//
+
+//! How makeMIP() reduces the resolution from one level to the next
+enum MIPReduction {
+  //! All axes are halved together, while any axis is larger than minSize 
+  //! and none has reached two voxels
+  MIPReduceUniform = 0,
+  //! Each axis is halved until it's down to minSize voxels, and then 
+  //! keeps its resolution in the coarser levels. Flat fields keep being 
+  //! reduced along their long axes without wasting levels on the short one.
+  MIPReducePerAxis
+};
+
 //----------------------------------------------------------------------------//
 // Functions
 //----------------------------------------------------------------------------//
@@ -72,10 +102,12 @@ V3i computeOffset(const FieldRes &f);
 //! offset vector. The offset vector indicates the 'true' voxel space
 //! coordinate of the (0, 0, 0) voxel, such that a consistent voxel placement
 //! can be used for the MIP levels.
+//! The reduction decides which axes are halved from one level to the next.
 template <typename MIPField_T, typename Filter_T>
 typename MIPField_T::Ptr
 makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
-        const V3i &offset, const size_t numThreads);
+        const V3i &offset, const size_t numThreads, 
+        const MIPReduction reduction = MIPReduceUniform);
 
 //! Constructs a MIP representation of the given field.
 template <typename MIPField_T, typename Filter_T>
@@ -83,6 +115,30 @@ typename MIPField_T::Ptr
 makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
         const size_t numThreads);
 
+//! Constructs a MIP representation of the given field whose levels are 
+//! filtered when first accessed, each from the previous one. Writing the 
+//! result to a file filters, writes and frees one level at a time, so 
+//! only the base and two adjacent levels are held in memory at once.
+//! \note The base is shared rather than copied, and becomes level 0.
+template <typename MIPField_T, typename Filter_T>
+typename MIPField_T::Ptr
+makeStreamingMIP(const typename MIPField_T::NestedType::Ptr &base, 
+                 const int minSize, const V3i &offset, 
+                 const size_t numThreads, 
+                 const MIPReduction reduction = MIPReduceUniform);
+
+//! Refilters the MIP levels affected by a change to the voxels of 
+//! dirtyRegion in level 0, in place. Only the voxels of each level whose 
+//! filter footprint touches the changed voxels of the previous level are 
+//! recomputed, so the result matches that of a fresh makeMIP() of the 
+//! modified level 0, provided that the same filter is used.
+//! \returns The region updated in each level, indexed by level. Empty 
+//! regions mean the level was unaffected.
+template <typename MIPField_T, typename Filter_T>
+std::vector<Box3i>
+updateMIP(MIPField_T &mip, const Box3i &dirtyRegion, 
+          const size_t numThreads);
+
 //----------------------------------------------------------------------------//
 // Implementation details
 //----------------------------------------------------------------------------//
@@ -92,6 +148,81 @@ namespace detail {
   //--------------------------------------------------------------------------//
 
   extern const std::string k_mipOffsetStr;
+  extern const std::string k_mipMaxAxisLevelsStr;
+
+  //! Maximum axis level of axes that are reduced at every level
+  const int k_mipNoAxisLimit = std::numeric_limits<int>::max();
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether the given axis is halved going from level - 1 to level
+  inline bool mipAxisReduced(const size_t level, const V3i &maxAxisLevels,
+                             const int dim)
+  {
+    return static_cast<int>(level) <= maxAxisLevels[dim];
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Padding of the given level, from the offset of the previous one. 
+  //! Odd-numbered offsets need a pad of one in the negative directions
+  //! of the reduced axes.
+  inline V3i mipLevelPad(const size_t level, const V3i &offset, 
+                         const V3i &maxAxisLevels)
+  {
+    V3i add(0);
+    for (int dim = 0; dim < 3; ++dim) {
+      if (mipAxisReduced(level, maxAxisLevels, dim) && offset[dim] % 2 != 0) {
+        add[dim] = 1;
+      }
+    }
+    return add;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Turns the offset of the previous level into that of the given level
+  inline void mipAdvanceOffset(const size_t level, const V3i &maxAxisLevels,
+                               V3i &offset)
+  {
+    for (int dim = 0; dim < 3; ++dim) {
+      if (!mipAxisReduced(level, maxAxisLevels, dim)) {
+        continue;
+      }
+      // ... offset needs to be rounded towards negative inf, not towards 
+      // zero
+      if (offset[dim] < 0) {
+        offset[dim] = (offset[dim] - 1) / 2;
+      } else {
+        offset[dim] /= 2;
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Decides which axes to reduce in the given level, from the resolution
+  //! of the previous one. Axes that are done get the previous level as 
+  //! their maximum level.
+  //! \returns Whether the level should be made at all
+  inline bool mipNextLevel(const V3i &res, const int minSize, 
+                           const MIPReduction reduction, const size_t level,
+                           V3i &maxAxisLevels)
+  {
+    if (reduction == MIPReduceUniform) {
+      return (res.x > minSize || res.y > minSize || res.z > minSize) &&
+        (res.x > 2 && res.y > 2 && res.z > 2);
+    }
+    bool anyReduced = false;
+    for (int dim = 0; dim < 3; ++dim) {
+      if (mipAxisReduced(level, maxAxisLevels, dim) && 
+          (res[dim] <= minSize || res[dim] <= 2)) {
+        maxAxisLevels[dim] = static_cast<int>(level) - 1;
+      }
+      anyReduced = anyReduced || mipAxisReduced(level, maxAxisLevels, dim);
+    }
+    return anyReduced;
+  }
 
   //--------------------------------------------------------------------------//
 
@@ -116,22 +247,6 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
-  //! Constant size for all dense fields
-  template <typename Data_T>
-  size_t threadingBlockSize(const DenseField<Data_T> & /* f */)
-  {
-    return 16;
-  }
-  
-  //! Use block size for sparse fields
-  template <typename Data_T>
-  size_t threadingBlockSize(const SparseField<Data_T> &f)
-  {
-    return f.blockSize();
-  }
-
-  //--------------------------------------------------------------------------//
-
   template <typename Data_T>
   bool checkInputEmpty(const SparseField<Data_T> &src, 
                        const SparseField<Data_T> &/*tgt*/, 
@@ -151,10 +266,8 @@ namespace detail {
     const Box3i dbsBounds = blockCoords(clipBounds(srcBoxPad, src.dataWindow()),
                                         &src);
 
-    static boost::mutex mutex;
-    boost::mutex::scoped_lock lock(mutex);
-
-    // Check all blocks
+    // Check all blocks. MIPTaskGraph makes sure they have all been written
+    // by the previous pass
     for (int k = dbsBounds.min.z; k <= dbsBounds.max.z; ++k) {
       for (int j = dbsBounds.min.y; j <= dbsBounds.max.y; ++j) {
         for (int i = dbsBounds.min.x; i <= dbsBounds.max.x; ++i) {
@@ -183,32 +296,27 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
+  //! Filters one block of one pass of separable MIP filtering, with the 
+  //! taps of the pass's axis computed up front by mipFilterTaps()
   template <typename Field_T, typename FilterOp_T, bool IsAnalytic_T>
-  struct MIPSeparableThreadOp
+  struct MIPSeparableOp
   {
     typedef typename Field_T::value_type T;
 
-    MIPSeparableThreadOp(const Field_T &src, Field_T &tgt, 
-                         const size_t level, const V3i &add,
-                         const FilterOp_T &filterOp, 
-                         const size_t dim, 
-                         const std::vector<Box3i> &blocks,
-                         size_t &nextIdx, boost::mutex &mutex)
+    MIPSeparableOp(const Field_T &src, Field_T &tgt, 
+                   const FilterTaps &taps,
+                   const FilterOp_T &filterOp, 
+                   const size_t dim)
       : m_src(src),
         m_tgt(tgt),
+        m_taps(taps),
         m_filterOp(filterOp), 
-        m_level(level), 
-        m_add(add), 
-        m_dim(dim),
-        m_blocks(blocks),
-        m_nextIdx(nextIdx),
-        m_mutex(mutex),
-        m_numBlocks(blocks.size())
+        m_dim(dim)
     {
       // Empty
     }
 
-    void operator() () 
+    void operator() (const Box3i &box) const
     {
       using namespace std;
 
@@ -216,116 +324,52 @@ namespace detail {
       typedef typename Field_T::value_type           Data_T;
       typedef typename ComputationType<Data_T>::type Value_T;
 
-      // To ensure we don't sample outside source data
-      Box3i srcDw = m_src.dataWindow();
-
-      // Coordinate frame conversion constants
-      const float tgtToSrcMult    = 2.0;
-      const float filterCoordMult = 1.0f / (tgtToSrcMult);
-    
       // Filter info, support size in target space
       const float support = m_filterOp.support();
 
-      // Get next index to process
-      size_t idx;
-      {
-        boost::mutex::scoped_lock lock(m_mutex);
-        idx = m_nextIdx;
-        m_nextIdx++;
+      // Early exit if input blocks are all empty
+      if (detail::checkInputEmpty(m_src, m_tgt, box, support, m_dim)) {
+        return;
       }
-      // Keep going while there is data to process
-      while (idx < m_numBlocks) {
-        // Grab the bounds
-        const Box3i box =  m_blocks[idx];
-        // Early exit if input blocks are all empty
-        if (!detail::checkInputEmpty(m_src, m_tgt, box, support, m_dim)) {
-          // For each output voxel
-          for (int k = box.min.z; k <= box.max.z; ++k) {
-            for (int j = box.min.y; j <= box.max.y; ++j) {
-              for (int i = box.min.x; i <= box.max.x; ++i) {
-                Value_T accumValue(m_filterOp.initialValue());
-                if (IsAnalytic_T) {
-                  // Transform from current point in target frame to source frame
-                  const int   curTgt = V3i(i, j, k)[m_dim];
-                  const float curSrc = discToCont(curTgt) * tgtToSrcMult - m_add[m_dim];
-                  // Find interval
-                  int startSrc = 
-                    static_cast<int>(std::floor(curSrc - support * tgtToSrcMult));
-                  int endSrc   = 
-                    static_cast<int>(std::ceil(curSrc + support * 
-                                               tgtToSrcMult)) - 1;
-                  // Clamp coordinates
-                  startSrc     = std::max(startSrc, srcDw.min[m_dim]);
-                  endSrc       = std::min(endSrc, srcDw.max[m_dim]);
-                  // Loop over source voxels
-                  for (int s = startSrc; s <= endSrc; ++s) {
-                    // Source index
-                    const int xIdx = m_dim == 0 ? s : i;
-                    const int yIdx = m_dim == 1 ? s : j;
-                    const int zIdx = m_dim == 2 ? s : k;
-                    // Source voxel in continuous coords
-                    const float srcP   = discToCont(s);
-                    // Compute filter weight in source space (twice as wide)
-                    const float weight = m_filterOp.eval(std::abs(srcP - curSrc) *
-                                                         filterCoordMult);
-                    // Value
-                    const Value_T value = m_src.fastValue(xIdx, yIdx, zIdx);
-                    // Update
-                    if (weight > 0.0f) {
-                      FilterOp_T::op(accumValue, value);
-                    }
-                  }
-                  // Update final value
-                  if (accumValue != 
-                      static_cast<Value_T>(m_filterOp.initialValue())) {
-                    m_tgt.fastLValue(i, j, k) = accumValue;
-                  }
-                } else {
-                  float accumWeight  = 0.0f;
-                  // Transform from current point in target frame to source frame
-                  const int   curTgt = V3i(i, j, k)[m_dim];
-                  const float curSrc = discToCont(curTgt) * tgtToSrcMult - m_add[m_dim];
-                  // Find interval
-                  int startSrc = 
-                    static_cast<int>(std::floor(curSrc - support * tgtToSrcMult));
-                  int endSrc   = 
-                    static_cast<int>(std::ceil(curSrc + support * 
-                                               tgtToSrcMult)) - 1;
-                  // Clamp coordinates
-                  startSrc     = std::max(startSrc, srcDw.min[m_dim]);
-                  endSrc       = std::min(endSrc, srcDw.max[m_dim]);
-                  // Loop over source voxels
-                  for (int s = startSrc; s <= endSrc; ++s) {
-                    // Source index
-                    const int xIdx = m_dim == 0 ? s : i;
-                    const int yIdx = m_dim == 1 ? s : j;
-                    const int zIdx = m_dim == 2 ? s : k;
-                    // Source voxel in continuous coords
-                    const float srcP   = discToCont(s);
-                    // Compute filter weight in source space (twice as wide)
-                    const float weight = m_filterOp.eval(std::abs(srcP - curSrc) *
-                                                         filterCoordMult);
-                    // Value
-                    const Value_T value = m_src.fastValue(xIdx, yIdx, zIdx);
-                    // Update
-                    accumWeight += weight;
-                    accumValue  += value * weight;
-                  }
-                  // Update final value
-                  if (accumWeight > 0.0f && 
-                      accumValue != static_cast<Value_T>(0.0)) {
-                    m_tgt.fastLValue(i, j, k) = accumValue / accumWeight;
-                  }
-                } // if (IsAnalytic_T)
+
+      // For each output voxel
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j) {
+          for (int i = box.min.x; i <= box.max.x; ++i) {
+            // Taps of the current target coordinate
+            const int    t      = V3i(i, j, k)[m_dim];
+            const int    first  = m_taps.first[t];
+            const int    count  = m_taps.count[t];
+            const float *weight = &m_taps.weights[0] + m_taps.offset[t];
+            Value_T accumValue(m_filterOp.initialValue());
+            // Loop over source voxels
+            for (int s = 0; s < count; ++s) {
+              // Source index
+              const int xIdx = m_dim == 0 ? first + s : i;
+              const int yIdx = m_dim == 1 ? first + s : j;
+              const int zIdx = m_dim == 2 ? first + s : k;
+              // Value
+              const Value_T value = m_src.fastValue(xIdx, yIdx, zIdx);
+              // Update
+              if (IsAnalytic_T) {
+                if (weight[s] > 0.0f) {
+                  FilterOp_T::op(accumValue, value);
+                }
+              } else {
+                accumValue += value * weight[s];
+              }
+            }
+            // Update final value
+            if (IsAnalytic_T) {
+              if (accumValue != 
+                  static_cast<Value_T>(m_filterOp.initialValue())) {
+                m_tgt.fastLValue(i, j, k) = accumValue;
               }
+            } else if (m_taps.sum[t] > 0.0f && 
+                       accumValue != static_cast<Value_T>(0.0)) {
+              m_tgt.fastLValue(i, j, k) = accumValue / m_taps.sum[t];
             }
           }
-        } // Empty input
-        // Get next index
-        {
-          boost::mutex::scoped_lock lock(m_mutex);
-          idx = m_nextIdx;
-          m_nextIdx++;
         }
       }
     }
@@ -336,83 +380,692 @@ namespace detail {
 
     const Field_T            &m_src;
     Field_T                  &m_tgt;
+    const FilterTaps         &m_taps;
     const FilterOp_T         &m_filterOp;
-    const size_t              m_level;
-    const V3i                &m_add;
     const size_t              m_dim;
-    const std::vector<Box3i> &m_blocks;
-    size_t                   &m_nextIdx;
-    boost::mutex             &m_mutex;
-    const size_t              m_numBlocks;
     
   };
 
   //--------------------------------------------------------------------------//
 
-  //! Threaded implementation of separable MIP filtering
+  //! One block of one pass of separable MIP filtering
+  struct MIPTask
+  {
+    //! The pass, i.e. the axis being filtered
+    size_t              dim;
+    //! The voxels to compute, in the pass's output field
+    Box3i               box;
+    //! Number of tasks of the previous pass that haven't finished yet
+    int                 numDeps;
+    //! Tasks of the next pass that read this task's output
+    std::vector<size_t> dependents;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! The tasks of the three passes of separable MIP filtering, and the ones 
+  //! that are ready to run. Each task only waits for the blocks of the 
+  //! previous pass that it reads, so there's no barrier between passes.
+  struct MIPTaskGraph
+  {
+    MIPTaskGraph()
+      : numDone(0)
+    { }
+    std::vector<MIPTask>      tasks;
+    //! Tasks whose dependencies have finished. Guarded by mutex
+    std::vector<size_t>       ready;
+    //! Number of finished tasks. Guarded by mutex
+    size_t                    numDone;
+    boost::mutex              mutex;
+    //! Signaled when tasks become ready, or when all tasks are done
+    boost::condition_variable taskReady;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Sets up the tasks for filtering a field of resolution srcRes down to 
+  //! newRes, one pass per axis
+  //! \param blockSize Size of the blocks that the passes are split into
+  //! \param support Filter support, in target voxels
+  FIELD3D_API void buildMIPTaskGraph(const V3i &srcRes, const V3i &newRes,
+                                     const V3i &add, const size_t blockSize,
+                                     const float support, 
+                                     MIPTaskGraph &graph);
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs the tasks of a MIPTaskGraph until all of them are done
   template <typename Field_T, typename FilterOp_T>
-  void mipSeparable(const Field_T &src, Field_T &tgt, 
-                    const V3i &oldRes, const V3i &newRes, const size_t level, 
-                    const V3i &add, const FilterOp_T &filterOp, 
-                    const size_t dim, const size_t numThreads)
-  {
-    using namespace std;
-
-    // To ensure we don't sample outside source data
-    Box3i srcDw = src.dataWindow();
-
-    // Compute new res
-    V3i res;
-    if (dim == 2) {
-      res = newRes;
-    } else if (dim == 1) {
-      res = V3i(newRes.x, newRes.y, oldRes.z);
-    } else {
-      res = V3i(newRes.x, oldRes.y, oldRes.z);
+  struct MIPTaskThreadOp
+  {
+    typedef MIPSeparableOp<Field_T, FilterOp_T, FilterOp_T::isAnalytic> Op;
+
+    MIPTaskThreadOp(MIPTaskGraph &graph, const Op &xOp, const Op &yOp, 
+                    const Op &zOp)
+      : m_graph(graph),
+        m_xOp(xOp),
+        m_yOp(yOp),
+        m_zOp(zOp)
+    {
+      // Empty
     }
 
-    // Resize new field
-    tgt.setSize(res);
-    
-    // Determine granularity
-    const size_t blockSize = threadingBlockSize(src);
+    void operator() () 
+    {
+      const Op *ops[3] = { &m_xOp, &m_yOp, &m_zOp };
+      boost::mutex::scoped_lock lock(m_graph.mutex);
+      while (true) {
+        // Wait for a task to become ready
+        while (m_graph.ready.empty() && 
+               m_graph.numDone < m_graph.tasks.size()) {
+          m_graph.taskReady.wait(lock);
+        }
+        if (m_graph.ready.empty()) {
+          return;
+        }
+        // The most recently readied task reads the data that was just 
+        // written, so it goes first
+        const size_t   idx  = m_graph.ready.back();
+        const MIPTask &task = m_graph.tasks[idx];
+        m_graph.ready.pop_back();
+        // Do the filtering
+        lock.unlock();
+        (*ops[task.dim])(task.box);
+        lock.lock();
+        // Release the tasks waiting for this one
+        const size_t numReady = m_graph.ready.size();
+        for (size_t i = 0; i < task.dependents.size(); ++i) {
+          if (--m_graph.tasks[task.dependents[i]].numDeps == 0) {
+            m_graph.ready.push_back(task.dependents[i]);
+          }
+        }
+        m_graph.numDone++;
+        if (m_graph.ready.size() > numReady || 
+            m_graph.numDone == m_graph.tasks.size()) {
+          m_graph.taskReady.notify_all();
+        }
+      }
+    }
+
+  private:
+
+    // Data members ---
+
+    MIPTaskGraph &m_graph;
+    const Op     &m_xOp;
+    const Op     &m_yOp;
+    const Op     &m_zOp;
+
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes the taps of one axis
+  //! \param srcMin, srcMax The source data window along the axis
+  template <typename FilterOp_T>
+  void mipFilterTaps(const FilterOp_T &filterOp, const int tgtRes, 
+                     const int add, const int srcMin, const int srcMax,
+                     FilterTaps &taps)
+  {
+    // Coordinate frame conversion constants
+    const float tgtToSrcMult    = 2.0;
+    const float filterCoordMult = 1.0f / (tgtToSrcMult);
+    // Filter info, support size in target space
+    const float support = filterOp.support();
+
+    for (int t = 0; t < tgtRes; ++t) {
+      // Transform from current point in target frame to source frame
+      const float curSrc = discToCont(t) * tgtToSrcMult - add;
+      // Find interval
+      int startSrc = 
+        static_cast<int>(std::floor(curSrc - support * tgtToSrcMult));
+      int endSrc   = 
+        static_cast<int>(std::ceil(curSrc + support * tgtToSrcMult)) - 1;
+      // Clamp coordinates
+      startSrc     = std::max(startSrc, srcMin);
+      endSrc       = std::min(endSrc, srcMax);
+      // Add the weights, summing them in tap order
+      taps.first.push_back(startSrc);
+      taps.count.push_back(std::max(0, endSrc - startSrc + 1));
+      taps.offset.push_back(taps.weights.size());
+      float sum = 0.0f;
+      for (int s = startSrc; s <= endSrc; ++s) {
+        const float srcP   = discToCont(s);
+        const float weight = 
+          filterOp.eval(std::abs(srcP - curSrc) * filterCoordMult);
+        taps.weights.push_back(weight);
+        sum += weight;
+      }
+      taps.sum.push_back(sum);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes the taps of an axis that isn't reduced, which copy each 
+  //! source voxel
+  inline void mipCopyTaps(const int tgtRes, FilterTaps &taps)
+  {
+    for (int t = 0; t < tgtRes; ++t) {
+      taps.first.push_back(t);
+      taps.count.push_back(1);
+      taps.offset.push_back(taps.weights.size());
+      taps.weights.push_back(1.0f);
+      taps.sum.push_back(1.0f);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes the taps of each axis of the given level
+  template <typename FilterOp_T>
+  void mipLevelTaps(const FilterOp_T &filterOp, const size_t level, 
+                    const V3i &maxAxisLevels, const V3i &tgtRes, 
+                    const V3i &add, const Box3i &srcDw, FilterTaps *taps)
+  {
+    for (int dim = 0; dim < 3; ++dim) {
+      if (mipAxisReduced(level, maxAxisLevels, dim)) {
+        mipFilterTaps(filterOp, tgtRes[dim], add[dim], srcDw.min[dim], 
+                      srcDw.max[dim], taps[dim]);
+      } else {
+        mipCopyTaps(tgtRes[dim], taps[dim]);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Filters the values of one target coordinate, found stride apart in 
+  //! src
+  //! \returns Whether the result should be written. The remaining target
+  //! voxels are zero.
+  template <typename FilterOp_T, typename Value_T, typename Data_T>
+  inline bool mipFilterLine(const Data_T *src, const size_t stride, 
+                            const FilterTaps &taps, const int t,
+                            const float initialValue, Value_T &result)
+  {
+    const float *weight = &taps.weights[0] + taps.offset[t];
+    const int    count  = taps.count[t];
+    Value_T      accumValue(initialValue);
+    if (FilterOp_T::isAnalytic) {
+      for (int i = 0; i < count; ++i, src += stride) {
+        const Value_T value = *src;
+        if (weight[i] > 0.0f) {
+          FilterOp_T::op(accumValue, value);
+        }
+      }
+      if (accumValue != static_cast<Value_T>(initialValue)) {
+        result = accumValue;
+        return true;
+      }
+      return false;
+    }
+    for (int i = 0; i < count; ++i, src += stride) {
+      const Value_T value = *src;
+      accumValue += value * weight[i];
+    }
+    if (taps.sum[t] > 0.0f && accumValue != static_cast<Value_T>(0.0)) {
+      result = accumValue / taps.sum[t];
+      return true;
+    }
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the target voxels whose taps read any of the voxels in 
+  //! srcRegion. The result is empty if there are none.
+  inline Box3i mipDirtyRegion(const FilterTaps *taps, 
+                              const Box3i &srcRegion)
+  {
+    Box3i region;
+    for (int dim = 0; dim < 3; ++dim) {
+      const FilterTaps &t = taps[dim];
+      for (int i = 0, end = t.count.size(); i < end; ++i) {
+        if (t.count[i] > 0 && t.first[i] <= srcRegion.max[dim] &&
+            t.first[i] + t.count[i] - 1 >= srcRegion.min[dim]) {
+          region.min[dim] = std::min(region.min[dim], i);
+          region.max[dim] = std::max(region.max[dim], i);
+        }
+      }
+    }
+    return region;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  template <typename Data_T>
+  bool checkRegionEmpty(const SparseField<Data_T> &src, const Box3i &region)
+  {
+    const Box3i dbsBounds = 
+      blockCoords(clipBounds(region, src.dataWindow()), &src);
+    for (int k = dbsBounds.min.z; k <= dbsBounds.max.z; ++k) {
+      for (int j = dbsBounds.min.y; j <= dbsBounds.max.y; ++j) {
+        for (int i = dbsBounds.min.x; i <= dbsBounds.max.x; ++i) {
+          if (src.blockIsAllocated(i, j, k) ||
+              src.getBlockEmptyValue(i, j, k) != static_cast<Data_T>(0)) {
+            return false;
+          }
+        }
+      } 
+    }
+    return true;
+  }
+
+  //! Fallback version always returns false
+  template <typename Field_T>
+  bool checkRegionEmpty(const Field_T &/*src*/, const Box3i &/*region*/)
+  {
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads the voxels of region into data, x fastest. Each sparse block 
+  //! overlapping the region is looked up once, and dynamically loaded 
+  //! blocks stay referenced while they're read, instead of going through
+  //! the cache for every voxel.
+  template <typename Data_T>
+  void readRegion(const SparseField<Data_T> &src, const Box3i &region, 
+                  Data_T *data)
+  {
+    const Box3i               dw        = src.dataWindow();
+    const int                 blockSize = src.blockSize();
+    const int                 order     = src.blockOrder();
+    const Sparse::BlockLayout layout    = src.blockLayout();
+    const bool                isDynamic = src.isDynamicLoad();
+    const V3i                 size      = region.size() + V3i(1);
+    const Box3i               dbsBounds = blockCoords(region, &src);
+
+    for (int bk = dbsBounds.min.z; bk <= dbsBounds.max.z; ++bk) {
+      for (int bj = dbsBounds.min.y; bj <= dbsBounds.max.y; ++bj) {
+        for (int bi = dbsBounds.min.x; bi <= dbsBounds.max.x; ++bi) {
+          // Voxels of the region that lie in the block
+          const V3i first = dw.min + V3i(bi, bj, bk) * blockSize;
+          const Box3i box = 
+            clipBounds(Box3i(first, first + V3i(blockSize - 1)), region);
+          const bool isAllocated = src.blockIsAllocated(bi, bj, bk);
+          const Data_T emptyValue = src.getBlockEmptyValue(bi, bj, bk);
+          const int id = src.blockId(bi, bj, bk);
+          if (isAllocated && isDynamic) {
+            src.incBlockRef(id);
+            src.activateBlock(id);
+          }
+          const Data_T *p = isAllocated ? src.blockData(bi, bj, bk) : NULL;
+          for (int k = box.min.z; k <= box.max.z; ++k) {
+            for (int j = box.min.y; j <= box.max.y; ++j) {
+              Data_T *out = data + 
+                ((k - region.min.z) * size.y + j - region.min.y) * size.x +
+                box.min.x - region.min.x;
+              for (int i = box.min.x; i <= box.max.x; ++i, ++out) {
+                *out = p ? 
+                  p[Sparse::blockIndex(i - first.x, j - first.y, 
+                                       k - first.z, order, layout)] : 
+                  emptyValue;
+              }
+            }
+          }
+          if (isAllocated && isDynamic) {
+            src.decBlockRef(id);
+          }
+        }
+      }
+    }
+  }
+
+  //! Fallback version reads one voxel at a time
+  template <typename Field_T>
+  void readRegion(const Field_T &src, const Box3i &region, 
+                  typename Field_T::value_type *data)
+  {
+    for (int k = region.min.z; k <= region.max.z; ++k) {
+      for (int j = region.min.y; j <= region.max.y; ++j) {
+        for (int i = region.min.x; i <= region.max.x; ++i, ++data) {
+          *data = src.fastValue(i, j, k);
+        }
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Queues the blocks of region for loading, for dynamically loaded 
+  //! sparse fields
+  template <typename Data_T>
+  void prefetchRegion(const SparseField<Data_T> &src, const Box3i &region)
+  {
+    if (src.isDynamicLoad()) {
+      src.prefetch(region);
+    }
+  }
 
-    // Build block list
+  //! Fallback version does nothing
+  template <typename Field_T>
+  void prefetchRegion(const Field_T &/*src*/, const Box3i &/*region*/)
+  {
+    // Empty
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Filters blocks of the next MIP level straight from the previous one. 
+  //! Each block reads the source voxels it needs once, then runs the x, y 
+  //! and z passes on local buffers, so no intermediate fields are needed. 
+  //! The intermediate values are kept in the field's data type, so the 
+  //! results match those of MIPSeparableOp.
+  //! \note With overwrite set, target voxels that filter to zero are 
+  //! cleared, rather than assumed to be zero already.
+  template <typename Field_T, typename FilterOp_T>
+  struct MIPFusedThreadOp
+  {
+    typedef typename Field_T::value_type           Data_T;
+    typedef typename ComputationType<Data_T>::type Value_T;
+
+    MIPFusedThreadOp(const Field_T &src, Field_T &tgt, 
+                     const FilterTaps *taps, const float initialValue,
+                     const bool overwrite, const std::vector<Box3i> &blocks, 
+                     boost::atomic<size_t> &nextIdx)
+      : m_src(src),
+        m_tgt(tgt),
+        m_taps(taps),
+        m_initialValue(initialValue),
+        m_overwrite(overwrite),
+        m_blocks(blocks),
+        m_nextIdx(nextIdx)
+    {
+      // Empty
+    }
+
+    void operator() () 
+    {
+      // Keep going while there is data to process
+      for (size_t idx = m_nextIdx.fetch_add(1); idx < m_blocks.size();
+           idx = m_nextIdx.fetch_add(1)) {
+        // Dynamically loaded sources start reading the next block's input
+        // while this one is filtered
+        Box3i next;
+        if (idx + 1 < m_blocks.size() && 
+            sourceRegion(m_blocks[idx + 1], next)) {
+          prefetchRegion(m_src, next);
+        }
+        filterBlock(m_blocks[idx]);
+      }
+    }
+
+  private:
+
+    //! Returns the source region read by the target box
+    //! \returns False if no source voxels are read
+    bool sourceRegion(const Box3i &box, Box3i &region) const
+    {
+      for (int dim = 0; dim < 3; ++dim) {
+        if (!sourceRange(dim, box.min[dim], box.max[dim], 
+                         region.min[dim], region.max[dim])) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    //! Returns the source range read by the target range [tMin, tMax] 
+    //! along the given axis
+    //! \returns False if no source voxels are read
+    bool sourceRange(const int dim, const int tMin, const int tMax, 
+                     int &sMin, int &sMax) const
+    {
+      const FilterTaps &taps = m_taps[dim];
+      sMin = std::numeric_limits<int>::max();
+      sMax = std::numeric_limits<int>::min();
+      for (int t = tMin; t <= tMax; ++t) {
+        if (taps.count[t] > 0) {
+          sMin = std::min(sMin, taps.first[t]);
+          sMax = std::max(sMax, taps.first[t] + taps.count[t] - 1);
+        }
+      }
+      return sMin <= sMax;
+    }
+
+    //! Zeroes the target voxels in box, if overwriting
+    void clearBlock(const Box3i &box)
+    {
+      if (!m_overwrite) {
+        return;
+      }
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j) {
+          for (int i = box.min.x; i <= box.max.x; ++i) {
+            clearVoxel(i, j, k);
+          }
+        }
+      }
+    }
+
+    //! Zeroes a target voxel, leaving zero voxels untouched so that sparse
+    //! blocks aren't allocated needlessly
+    void clearVoxel(const int i, const int j, const int k)
+    {
+      if (m_tgt.fastValue(i, j, k) != static_cast<Data_T>(0.0)) {
+        m_tgt.fastLValue(i, j, k) = static_cast<Data_T>(0.0);
+      }
+    }
+
+    void filterBlock(const Box3i &box)
+    {
+      const FilterTaps &xTaps = m_taps[0];
+      const FilterTaps &yTaps = m_taps[1];
+      const FilterTaps &zTaps = m_taps[2];
+
+      // Find the source region. Blocks that read nothing stay zero
+      Box3i region;
+      if (!sourceRegion(box, region)) {
+        clearBlock(box);
+        return;
+      }
+      // Early exit if input blocks are all empty
+      if (checkRegionEmpty(m_src, region)) {
+        clearBlock(box);
+        return;
+      }
+
+      const V3i    srcSize  = region.size() + V3i(1);
+      const V3i    tgtSize  = box.size() + V3i(1);
+      const size_t srcXY    = srcSize.x * srcSize.y;
+
+      // Read the source region
+      m_region.resize(srcXY * srcSize.z);
+      readRegion(m_src, region, &m_region[0]);
+
+      Value_T value;
+
+      // X axis (region into m_x), laid out as tgtSize.x * srcSize.y * 
+      // srcSize.z
+      m_x.resize(tgtSize.x * srcSize.y * srcSize.z);
+      Data_T *p = &m_x[0];
+      for (int k = 0; k < srcSize.z; ++k) {
+        for (int j = 0; j < srcSize.y; ++j) {
+          const Data_T *line = &m_region[k * srcXY + j * srcSize.x];
+          for (int i = box.min.x; i <= box.max.x; ++i, ++p) {
+            *p = static_cast<Data_T>(0.0);
+            if (mipFilterLine<FilterOp_T>(line + xTaps.first[i] - 
+                                          region.min.x, 1, xTaps, i, 
+                                          m_initialValue, value)) {
+              *p = value;
+            }
+          }
+        }
+      }
+
+      // Y axis (m_x into m_y), laid out as tgtSize.x * tgtSize.y * 
+      // srcSize.z
+      m_y.resize(tgtSize.x * tgtSize.y * srcSize.z);
+      p = &m_y[0];
+      for (int k = 0; k < srcSize.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j) {
+          const Data_T *line = &m_x[0] + (k * srcSize.y + 
+                                          yTaps.first[j] - region.min.y) * 
+            tgtSize.x;
+          for (int i = 0; i < tgtSize.x; ++i, ++p) {
+            *p = static_cast<Data_T>(0.0);
+            if (mipFilterLine<FilterOp_T>(line + i, tgtSize.x, yTaps, j, 
+                                          m_initialValue, value)) {
+              *p = value;
+            }
+          }
+        }
+      }
+
+      // Z axis (m_y into target). Only non-zero values are written, so 
+      // that sparse blocks aren't allocated needlessly
+      const size_t tgtXY = tgtSize.x * tgtSize.y;
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        const Data_T *plane = 
+          &m_y[0] + (zTaps.first[k] - region.min.z) * tgtXY;
+        for (int j = 0; j < tgtSize.y; ++j) {
+          for (int i = 0; i < tgtSize.x; ++i) {
+            if (mipFilterLine<FilterOp_T>(plane + j * tgtSize.x + i, tgtXY,
+                                          zTaps, k, m_initialValue, 
+                                          value)) {
+              m_tgt.fastLValue(box.min.x + i, box.min.y + j, k) = value;
+            } else if (m_overwrite) {
+              clearVoxel(box.min.x + i, box.min.y + j, k);
+            }
+          }
+        }
+      }
+    }
+
+    // Data members ---
+
+    const Field_T            &m_src;
+    Field_T                  &m_tgt;
+    //! Taps of the x, y and z axes
+    const FilterTaps      *m_taps;
+    const float               m_initialValue;
+    const bool                m_overwrite;
+    const std::vector<Box3i> &m_blocks;
+    boost::atomic<size_t>    &m_nextIdx;
+    //! Scratch space. Each thread has its own copy of the op
+    std::vector<Data_T>       m_region, m_x, m_y;
+
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Gives a target field the source's block order, so that the 
+  //! threading blocks never share a sparse block
+  template <typename Data_T>
+  void matchThreadingBlocks(const SparseField<Data_T> &src, 
+                            SparseField<Data_T> &tgt)
+  {
+    tgt.setBlockOrder(src.blockOrder());
+  }
+
+  //! Fallback version does nothing
+  template <typename Field_T>
+  void matchThreadingBlocks(const Field_T &/*src*/, Field_T &/*tgt*/)
+  {
+    // Empty
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Filters the voxels of tgt in region straight from src, a block at a
+  //! time. See MIPFusedThreadOp.
+  template <typename Field_T, typename FilterOp_T>
+  void mipFilterRegion(const Field_T &src, Field_T &tgt, 
+                       const FilterTaps *taps, const Box3i &region,
+                       const bool overwrite, const FilterOp_T &filterOp, 
+                       const size_t numThreads)
+  {
+    typedef MIPFusedThreadOp<Field_T, FilterOp_T> Op;
+
+    // Build block list. The blocks stay aligned to the threading block 
+    // grid, so that no two of them share a sparse block
+    const int          blockSize = threadingBlockSize(src);
+    const V3i          first     = region.min / blockSize * blockSize;
     std::vector<Box3i> blocks;
-    for (int k = 0; k < res.z; k += blockSize) {
-      for (int j = 0; j < res.y; j += blockSize) {
-        for (int i = 0; i < res.x; i += blockSize) {
+    for (int k = first.z; k <= region.max.z; k += blockSize) {
+      for (int j = first.y; j <= region.max.y; j += blockSize) {
+        for (int i = first.x; i <= region.max.x; i += blockSize) {
           Box3i box;
           // Initialize block size
           box.min = V3i(i, j, k);
           box.max = box.min + V3i(blockSize - 1);
-          // Clip against resolution
-          box.max.x = std::min(box.max.x, res.x - 1);
-          box.max.y = std::min(box.max.y, res.y - 1);
-          box.max.z = std::min(box.max.z, res.z - 1);
-          // Add to list
-          blocks.push_back(box);
+          // Clip against region
+          blocks.push_back(clipBounds(box, region));
         }
       }
     }
 
-    // Next index counter and mutex
-    size_t nextIdx = 0;
-    boost::mutex mutex;
+    // Run on the shared threads. A single thread runs the blocks itself ---
+
+    boost::atomic<size_t> nextIdx(0);
+    const Op op(src, tgt, taps, filterOp.initialValue(), overwrite, blocks, 
+                nextIdx);
+    runOnThreads(op, numThreads);
+  }
+
+  //--------------------------------------------------------------------------//
 
-    // Launch threads ---
+  //! Filters src into tgt in a single pass over the target's blocks. Used 
+  //! by mipResample() for non-analytic filters.
+  template <typename Field_T, typename FilterOp_T>
+  void mipResampleFused(const Field_T &src, Field_T &tgt, const Box3i &srcDw,
+                        const V3i &newRes, const size_t level, 
+                        const V3i &maxAxisLevels, const V3i &add, 
+                        const FilterOp_T &filterOp, const size_t numThreads)
+  {
+    // Filter taps of each axis
+    FilterTaps taps[3];
+    mipLevelTaps(filterOp, level, maxAxisLevels, newRes, add, srcDw, taps);
+    // Target voxels start out zero, so there's nothing to overwrite
+    mipFilterRegion(src, tgt, taps, Box3i(V3i(0), newRes - V3i(1)), false,
+                    filterOp, numThreads);
+  }
 
-    boost::thread_group threads;
+  //--------------------------------------------------------------------------//
 
-    for (size_t i = 0; i < numThreads; ++i) {
-      threads.create_thread(
-        MIPSeparableThreadOp<Field_T, FilterOp_T, FilterOp_T::isAnalytic >
-        (src, tgt, level, add, filterOp, 
-         dim, blocks, nextIdx, mutex));
+  //! Filters src into tgt with one separable pass per axis. Used by 
+  //! mipResample() for analytic filters.
+  template <typename Field_T, typename FilterOp_T>
+  void mipResamplePasses(const Field_T &src, Field_T &tgt, const V3i &srcRes,
+                         const V3i &newRes, const size_t level, 
+                         const V3i &add, const FilterOp_T &filterOp, 
+                         const size_t numThreads)
+  {
+    typedef MIPSeparableOp<Field_T, FilterOp_T, FilterOp_T::isAnalytic> Op;
+
+    // Temporary fields for the x and y passes. All passes run at once, so 
+    // each writes a field of its own
+    Field_T tmpX, tmpY;
+    matchThreadingBlocks(src, tmpX);
+    matchThreadingBlocks(src, tmpY);
+    tmpX.setSize(V3i(newRes.x, srcRes.y, srcRes.z));
+    tmpY.setSize(V3i(newRes.x, newRes.y, srcRes.z));
+
+    // Filter taps of each axis, clipped against the source of its pass
+    const Box3i passDw[3] = { src.dataWindow(), tmpX.dataWindow(), 
+                              tmpY.dataWindow() };
+    FilterTaps taps[3];
+    for (int dim = 0; dim < 3; ++dim) {
+      mipFilterTaps(filterOp, newRes[dim], add[dim], passDw[dim].min[dim], 
+                    passDw[dim].max[dim], taps[dim]);
     }
 
-    // Join
-    threads.join_all();
+    // X axis (src into tmpX), Y axis (tmpX into tmpY), Z axis (tmpY into tgt)
+    const Op xOp(src, tmpX, taps[0], filterOp, 0);
+    const Op yOp(tmpX, tmpY, taps[1], filterOp, 1);
+    const Op zOp(tmpY, tgt, taps[2], filterOp, 2);
+
+    // Set up the tasks
+    MIPTaskGraph graph;
+    buildMIPTaskGraph(srcRes, newRes, add, threadingBlockSize(src), 
+                      filterOp.support(), graph);
+
+    // Run on the shared threads. A single thread runs the tasks itself ---
+
+    runOnThreads(MIPTaskThreadOp<Field_T, FilterOp_T>(graph, xOp, yOp, zOp),
+                 numThreads);
   }
 
   //--------------------------------------------------------------------------//
@@ -420,34 +1073,41 @@ namespace detail {
   template <typename Field_T, typename FilterOp_T>
   void mipResample(const Field_T &base, const Field_T &src, Field_T &tgt, 
                    const size_t level, const V3i &offset, 
-                   const FilterOp_T &filterOp, 
+                   const V3i &maxAxisLevels, const FilterOp_T &filterOp, 
                    const size_t numThreads)
   {
     using std::ceil;
 
-    // Odd-numbered offsets need a pad of one in the negative directions
-    const V3i add((offset.x % 2 == 0) ? 0 : 1,
-                  (offset.y % 2 == 0) ? 0 : 1,
-                  (offset.z % 2 == 0) ? 0 : 1);
-
-    // Compute new res
-    const Box3i baseDw  = base.dataWindow();
-    const V3i   baseRes = baseDw.size() + V3i(1);
-    const V3i   newRes  = mipResolution(baseRes, level, add);
+    const V3i add = mipLevelPad(level, offset, maxAxisLevels);
 
     // Source res
     const Box3i srcDw  = src.dataWindow();
     const V3i   srcRes = srcDw.size() + V3i(1);
 
-    // Temporary field for y component
-    Field_T tmp;
+    // Compute new res. Axes that aren't reduced keep the source's
+    const Box3i baseDw   = base.dataWindow();
+    const V3i   baseRes  = baseDw.size() + V3i(1);
+    V3i         newRes   = mipResolution(baseRes, level, add);
+    bool        uniform  = true;
+    for (int dim = 0; dim < 3; ++dim) {
+      if (!mipAxisReduced(level, maxAxisLevels, dim)) {
+        newRes[dim] = srcRes[dim];
+        uniform     = false;
+      }
+    }
+
+    matchThreadingBlocks(src, tgt);
+    tgt.setSize(newRes);
 
-    // X axis (src into tgt)
-    mipSeparable(src, tgt, srcRes, newRes, level, add, filterOp, 0, numThreads);
-    // Y axis (tgt into temp)
-    mipSeparable(tgt, tmp, srcRes, newRes, level, add, filterOp, 1, numThreads);
-    // Z axis (temp into tgt)
-    mipSeparable(tmp, tgt, srcRes, newRes, level, add, filterOp, 2, numThreads);
+    // The separable passes only filter by two, so levels that keep the
+    // resolution of some axis go through the fused path
+    if (!FilterOp_T::isAnalytic || !uniform) {
+      mipResampleFused(src, tgt, srcDw, newRes, level, maxAxisLevels, add, 
+                       filterOp, numThreads);
+    } else {
+      mipResamplePasses(src, tgt, srcRes, newRes, level, add, filterOp, 
+                        numThreads);
+    }
 
     // Update final target with mapping and metadata
     tgt.name      = base.name;
@@ -458,6 +1118,85 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
+  //! State shared by the lazy load actions of makeStreamingMIP(). Holds on
+  //! to the most recently filtered level, which the next is filtered from.
+  template <typename Field_T, typename Filter_T>
+  struct MIPStreamState
+  {
+    typedef typename Field_T::Ptr FieldPtr;
+
+    MIPStreamState(const FieldPtr &base, const size_t numThreads)
+      : m_maxAxisLevels(k_mipNoAxisLimit), m_base(base), m_current(base), 
+        m_currentLevel(0), m_numThreads(numThreads)
+    { }
+
+    //! Returns the given level, filtering it from the current one
+    FieldPtr level(const size_t level)
+    {
+      if (level == 0) {
+        return m_base;
+      }
+      // The MIPField may load different levels at once
+      boost::mutex::scoped_lock lock(m_mutex);
+      // Start over from the base if the level lies behind us
+      if (m_currentLevel > level) {
+        m_current      = m_base;
+        m_currentLevel = 0;
+      }
+      while (m_currentLevel < level) {
+        FieldPtr next(new Field_T);
+        mipResample(*m_base, *m_current, *next, m_currentLevel + 1, 
+                    m_offsets[m_currentLevel], m_maxAxisLevels, Filter_T(), 
+                    m_numThreads);
+        // Let go of the previous level
+        m_current = next;
+        m_currentLevel++;
+      }
+      return m_current;
+    }
+
+    //! The offset that each level is filtered from, indexed by level - 1
+    std::vector<V3i> m_offsets;
+    //! Last level at which each axis is reduced
+    V3i              m_maxAxisLevels;
+
+  private:
+
+    FieldPtr     m_base;
+    FieldPtr     m_current;
+    size_t       m_currentLevel;
+    const size_t m_numThreads;
+    boost::mutex m_mutex;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Lazy load action that filters a level of a makeStreamingMIP() field
+  template <typename Field_T, typename Filter_T>
+  class MIPStreamAction : public LazyLoadAction<Field_T>
+  {
+  public:
+
+    typedef MIPStreamState<Field_T, Filter_T> State;
+
+    MIPStreamAction(const boost::shared_ptr<State> &state, 
+                    const size_t level)
+      : m_state(state), m_level(level)
+    { }
+
+    virtual typename Field_T::Ptr load() const
+    { 
+      return m_state->level(m_level);
+    }
+
+  private:
+
+    boost::shared_ptr<State> m_state;
+    const size_t             m_level;
+  };
+
+  //--------------------------------------------------------------------------//
+
   FIELD3D_API
   FieldMapping::Ptr adjustedMIPFieldMapping(const FieldRes *base,
                                             const V3i &baseRes,
@@ -466,6 +1205,13 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
+  //! Memory used by MIP levels loaded from disk. Registered with the 
+  //! MemoryBudget on first use. The levels are only accounted for, since
+  //! readers hold raw pointers to them and they can't be released early.
+  FIELD3D_API MemoryBudgetCounter& mipLevelMemory();
+
+  //--------------------------------------------------------------------------//
+
 } // namespace detail
 
 //----------------------------------------------------------------------------//
@@ -488,7 +1234,8 @@ makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
 template <typename MIPField_T, typename Filter_T>
 typename MIPField_T::Ptr
 makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
-        const V3i &baseOffset, const size_t numThreads)
+        const V3i &baseOffset, const size_t numThreads, 
+        const MIPReduction reduction)
 {
   using namespace Field3D::detail;
 
@@ -507,29 +1254,25 @@ makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
   result.push_back(field_dynamic_cast<Src_T>(base.clone()));
 
   // Iteration variables
-  V3i res    = base.extents().size() + V3i(1);
-  V3i offset = baseOffset;
+  V3i res           = base.extents().size() + V3i(1);
+  V3i offset        = baseOffset;
+  V3i maxAxisLevels = V3i(k_mipNoAxisLimit);
   
   // Loop until minimum size is found
   size_t level = 1;
-  while ((res.x > minSize || res.y > minSize || res.z > minSize) &&
-         (res.x > 2 && res.y > 2 && res.z > 2)) {
+  while (mipNextLevel(res, minSize, reduction, level, maxAxisLevels)) {
     // Perform filtering
     SrcPtr nextField(new Src_T);
-    mipResample(base, *result.back(), *nextField, level, offset, 
-                Filter_T(), numThreads);
+    {
+      Trace::ScopedEvent event("makeMIP pass", level);
+      mipResample(base, *result.back(), *nextField, level, offset, 
+                  maxAxisLevels, Filter_T(), numThreads);
+    }
     // Add to vector of filtered fields
     result.push_back(nextField);
     // Set up for next iteration
     res = nextField->dataWindow().size() + V3i(1);
-    // ... offset needs to be rounded towards negative inf, not towards zero
-    for (int i = 0; i < 3; ++i) {
-      if (offset[i] < 0) {
-        offset[i] = (offset[i] - 1) / 2;
-      } else {
-        offset[i] /= 2;
-      }
-    }
+    mipAdvanceOffset(level, maxAxisLevels, offset);
     level++;
   }
 
@@ -538,6 +1281,9 @@ makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
   mipField->attribute = base.attribute;
   mipField->copyMetadata(base);
   mipField->setMIPOffset(baseOffset);
+  if (reduction != MIPReduceUniform) {
+    mipField->setMaxAxisLevels(maxAxisLevels);
+  }
   mipField->setup(result);
 
   return mipField;
@@ -545,6 +1291,125 @@ makeMIP(const typename MIPField_T::NestedType &base, const int minSize,
 
 //----------------------------------------------------------------------------//
 
+template <typename MIPField_T, typename Filter_T>
+typename MIPField_T::Ptr
+makeStreamingMIP(const typename MIPField_T::NestedType::Ptr &base, 
+                 const int minSize, const V3i &baseOffset, 
+                 const size_t numThreads, const MIPReduction reduction)
+{
+  using namespace Field3D::detail;
+
+  typedef typename MIPField_T::NestedType    Src_T;
+  typedef typename MIPField_T::ProxyField    Proxy_T;
+  typedef typename MIPField_T::ProxyPtr      ProxyPtr;
+  typedef typename MIPField_T::Ptr           MIPPtr;
+  typedef MIPStreamState<Src_T, Filter_T>    State;
+  typedef MIPStreamAction<Src_T, Filter_T>   Action;
+
+  if (base->extents() != base->dataWindow()) {
+    return MIPPtr();
+  }
+
+  boost::shared_ptr<State>                 state(new State(base, numThreads));
+  typename MIPField_T::ProxyVec            proxies;
+  typename LazyLoadAction<Src_T>::Vec      actions;
+
+  // Level 0 is the base itself
+  ProxyPtr proxy(new Proxy_T);
+  proxy->setSize(base->extents(), base->dataWindow());
+  proxy->setMapping(base->mapping());
+  proxies.push_back(proxy);
+  actions.push_back(typename Action::Ptr(new Action(state, 0)));
+
+  // Iteration variables
+  const V3i baseRes = base->extents().size() + V3i(1);
+  V3i       res     = baseRes;
+  V3i       offset  = baseOffset;
+
+  // Find the resolution of each level the same way makeMIP() does
+  V3i &maxAxisLevels = state->m_maxAxisLevels;
+  size_t level = 1;
+  while (mipNextLevel(res, minSize, reduction, level, maxAxisLevels)) {
+    const V3i add     = mipLevelPad(level, offset, maxAxisLevels);
+    const V3i prevRes = res;
+    res = mipResolution(baseRes, level, add);
+    for (int dim = 0; dim < 3; ++dim) {
+      if (!mipAxisReduced(level, maxAxisLevels, dim)) {
+        res[dim] = prevRes[dim];
+      }
+    }
+    // Add the level
+    proxy.reset(new Proxy_T);
+    proxy->setSize(res);
+    proxies.push_back(proxy);
+    actions.push_back(typename Action::Ptr(new Action(state, level)));
+    state->m_offsets.push_back(offset);
+    mipAdvanceOffset(level, maxAxisLevels, offset);
+    level++;
+  }
+
+  MIPPtr mipField(new MIPField_T);
+  mipField->name = base->name;
+  mipField->attribute = base->attribute;
+  mipField->copyMetadata(*base);
+  mipField->setMIPOffset(baseOffset);
+  if (reduction != MIPReduceUniform) {
+    mipField->setMaxAxisLevels(maxAxisLevels);
+  }
+  mipField->setupLazyLoad(proxies, actions);
+
+  return mipField;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename MIPField_T, typename Filter_T>
+std::vector<Box3i>
+updateMIP(MIPField_T &mip, const Box3i &dirtyRegion, 
+          const size_t numThreads)
+{
+  using namespace Field3D::detail;
+
+  typedef typename MIPField_T::NestedType    Src_T;
+  typedef typename Src_T::Ptr                SrcPtr;
+
+  const Filter_T     filterOp;
+  std::vector<Box3i> result;
+
+  // Level 0 is edited by the caller
+  SrcPtr src    = mip.concreteMipLevel(0);
+  Box3i  region = clipBounds(dirtyRegion, src->dataWindow());
+  V3i    offset = mip.mipOffset();
+  const V3i maxAxisLevels = mip.maxAxisLevels();
+  result.push_back(region);
+
+  for (size_t level = 1; level < mip.numLevels(); ++level) {
+    SrcPtr tgt = mip.concreteMipLevel(level);
+    if (!region.isEmpty()) {
+      const V3i   add    = mipLevelPad(level, offset, maxAxisLevels);
+      const Box3i srcDw  = src->dataWindow();
+      const V3i   tgtRes = tgt->dataWindow().size() + V3i(1);
+      // Filter taps of each axis, as used by makeMIP()
+      FilterTaps taps[3];
+      mipLevelTaps(filterOp, level, maxAxisLevels, tgtRes, add, srcDw, taps);
+      // Refilter the voxels that read the changed ones
+      region = mipDirtyRegion(taps, region);
+      if (!region.isEmpty()) {
+        mipFilterRegion(*src, *tgt, taps, region, true, filterOp, 
+                        numThreads);
+      }
+    }
+    result.push_back(region);
+    // Set up for next iteration
+    src = tgt;
+    mipAdvanceOffset(level, maxAxisLevels, offset);
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_HEADER_CLOSE
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,252 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file MemoryBudget.h
+  \brief Contains the MemoryBudget class, which enforces one memory limit 
+  across the caches of the library.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_MemoryBudget_H_
+#define _INCLUDED_Field3D_MemoryBudget_H_
+
+//----------------------------------------------------------------------------//
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// MemoryBudgetClient
+//----------------------------------------------------------------------------//
+
+/*! \class MemoryBudgetClient
+  \ingroup file
+  Interface of the caches that register with the MemoryBudget.
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API MemoryBudgetClient
+{
+public:
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  virtual ~MemoryBudgetClient()
+  { }
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Returns the number of bytes the client currently holds. Called often,
+  //! so it should be cheap.
+  virtual long long int budgetMemUse() const = 0;
+  //! Releases at least the given number of bytes, if possible. Called 
+  //! without any of the MemoryBudget's clients' locks held.
+  //! \returns The number of bytes released
+  virtual long long int budgetRelease(const long long int bytes) = 0;
+};
+
+//----------------------------------------------------------------------------//
+// MemoryBudgetCounter
+//----------------------------------------------------------------------------//
+
+/*! \class MemoryBudgetCounter
+  \ingroup file
+  A client that accounts for memory it has no way to release, so that the
+  MemoryBudget can make room for it elsewhere.
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API MemoryBudgetCounter : public MemoryBudgetClient
+{
+public:
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  MemoryBudgetCounter()
+    : m_memUse(0)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Adds to the memory accounted for
+  void add(const long long int bytes)
+  { m_memUse += bytes; }
+  //! Subtracts from the memory accounted for
+  void subtract(const long long int bytes)
+  { m_memUse -= bytes; }
+
+  // From MemoryBudgetClient ---------------------------------------------------
+
+  virtual long long int budgetMemUse() const
+  { return m_memUse; }
+  virtual long long int budgetRelease(const long long int /* bytes */)
+  { return 0; }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! The memory accounted for, in bytes
+  boost::atomic<long long int> m_memUse;
+};
+
+//----------------------------------------------------------------------------//
+// MemoryBudget
+//----------------------------------------------------------------------------//
+
+/*! \class MemoryBudget
+  \ingroup file
+
+  Enforces a single memory limit across the caches of the library. Each 
+  cache registers itself as a client with a priority, and reports how many
+  bytes it holds. When a client is about to grow past the limit, the 
+  budget asks the clients to release memory, lowest priority first.
+
+  The built-in clients are the fields retained by each FieldCache, the 
+  dynamically loaded blocks of the SparseFileManager and the lazily loaded
+  levels of MIP fields, which are accounted for but can't be released.
+  Each client's own limit, such as SparseFileManager::setMaxMemUse(), 
+  still applies.
+
+  The limit is 0, meaning unlimited, by default.
+
+  \code
+  MemoryBudget::singleton().setLimit(8LL << 30);  // 8 GB across all caches
+  \endcode
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API MemoryBudget
+{
+public:
+
+  // Constants -----------------------------------------------------------------
+
+  //! Default priority of the fields retained by FieldCache
+  static const int k_priorityFieldCache = 0;
+  //! Default priority of the SparseFileManager's blocks
+  static const int k_prioritySparseBlocks = 100;
+  //! Default priority of lazily loaded MIP levels
+  static const int k_priorityMIPLevels = 200;
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns a reference to the singleton instance
+  static MemoryBudget& singleton();
+
+  //! Sets the limit, in bytes, releasing memory if the clients exceed it.
+  //! 0 means unlimited.
+  void setLimit(const long long int bytes);
+  //! Returns the limit, in bytes
+  long long int limit() const;
+
+  //! Returns the memory held by all clients, in bytes
+  long long int memUse() const;
+
+  //! Registers a client. Clients with lower priorities are asked to release
+  //! memory first. Clients with equal priorities are asked in the order 
+  //! they registered.
+  void registerClient(MemoryBudgetClient *client, const int priority);
+  //! Unregisters a client
+  void unregisterClient(MemoryBudgetClient *client);
+  //! Changes the priority of a registered client
+  void setPriority(MemoryBudgetClient *client, const int priority);
+
+  //! Makes room for the given number of bytes that a client is about to 
+  //! allocate, by releasing memory from the clients until the total 
+  //! stays within the limit. Returns immediately if there is no limit.
+  //! \note Must not be called while holding a lock that a client's 
+  //! budgetRelease() takes.
+  void reserve(const long long int bytes);
+  //! Releases memory until the clients are within the limit
+  void enforce()
+  { reserve(0); }
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Entry
+  {
+    MemoryBudgetClient *client;
+    int priority;
+  };
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! Private to prevent instantiation
+  MemoryBudget();
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the memory held by all clients. m_mutex must be held.
+  long long int memUseLocked() const;
+
+  // Data members --------------------------------------------------------------
+
+  //! The limit, in bytes. Read without the mutex, so that reserve() costs
+  //! nothing when there is no limit
+  boost::atomic<long long int> m_limit;
+  //! The registered clients, sorted by priority
+  std::vector<Entry> m_clients;
+  //! Protects m_clients, and serializes the releasing of memory
+  mutable boost::mutex m_mutex;
+  //! Pointer to singleton
+  static MemoryBudget *ms_singleton;
+  //! Mutex to prevent multiple allocation of the singleton
+  static boost::mutex ms_creationMutex;
+};
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -110,8 +110,8 @@ makeMinMax(const typename MIPField_T::NestedType &base,
   FieldPtr maxSrc(new Field);
 
   // Resample 
-  resample(base, *minSrc, res, MinFilter());
-  resample(base, *maxSrc, res, MaxFilter());
+  resample(base, *minSrc, res, MinFilter(), numThreads);
+  resample(base, *maxSrc, res, MaxFilter(), numThreads);
 
   // Second, generate MIP representations ---
 
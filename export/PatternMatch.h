@@ -36,7 +36,8 @@
 //----------------------------------------------------------------------------//
 
 /*! \file PatternMatch.h
-  \brief Contains functions for pattern matching field name/attributes.
+  \brief Contains functions for pattern matching field name/attributes, 
+  along with classes for matching many names against the same patterns.
 */
 
 //----------------------------------------------------------------------------//
@@ -44,6 +45,7 @@
 #ifndef _INCLUDED_PatternMatch_H_
 #define _INCLUDED_PatternMatch_H_
 
+#include <string>
 #include <vector>
 
 // Boost includes
@@ -110,6 +112,155 @@ bool
 match(const FieldRes *f, const std::string &patterns, 
       const MatchFlags flags = MatchEmptyPattern);
 
+//----------------------------------------------------------------------------//
+// MatchPattern
+//----------------------------------------------------------------------------//
+
+/*! \class MatchPattern
+  \brief A set of patterns, parsed once so that it may be matched against 
+  many names.
+
+  Matches the same way as the match() functions, which construct one for 
+  each call. Patterns starting with '-' or '^' exclude the names they 
+  match, and patterns containing ':' match against <name>:<attribute>.
+  Each pattern's literal prefix, i.e. the part before its first wildcard, 
+  is compared before calling fnmatch(), and patterns without wildcards are
+  compared as plain strings.
+*/
+
+//----------------------------------------------------------------------------//
+
+class MatchPattern
+{
+public:
+
+  // Structs -------------------------------------------------------------------
+
+  //! A single parsed pattern
+  struct Glob
+  {
+    //! The pattern, without its exclusion character
+    std::string pattern;
+    //! The part of pattern before the first wildcard
+    std::string prefix;
+    //! The part of pattern after the ':', if any, which is what attributes
+    //! are matched against
+    std::string attributePattern;
+    //! The part of attributePattern before the first wildcard
+    std::string attributePrefix;
+    //! Whether pattern contains ':'
+    bool        hasSeparator;
+    //! Whether pattern has no wildcards
+    bool        isLiteral;
+    //! Whether attributePattern has no wildcards
+    bool        isAttributeLiteral;
+  };
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! Parses the given patterns
+  MatchPattern(const std::vector<std::string> &patterns, 
+               const MatchFlags flags = MatchEmptyPattern);
+  //! Parses the given patterns, split at spaces
+  MatchPattern(const std::string &patterns, 
+               const MatchFlags flags = MatchEmptyPattern);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Matches a <name>:<attribute> string
+  bool match(const std::string &name, const std::string &attribute) const;
+  //! Matches an <attribute> string
+  bool match(const std::string &attribute) const;
+  //! Matches a field's name and attribute
+  bool match(const FieldRes *f) const;
+
+  //! Whether the pattern list was empty
+  bool isEmpty() const
+  { return m_isEmpty; }
+  //! What an empty pattern list matches
+  bool emptyMatches() const
+  { return m_emptyMatches; }
+  //! The patterns that select names
+  const std::vector<Glob>& includes() const
+  { return m_includes; }
+  //! The patterns that exclude names
+  const std::vector<Glob>& excludes() const
+  { return m_excludes; }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Parses the patterns. Used by the constructors
+  void parse(const std::vector<std::string> &patterns);
+
+  // Data members --------------------------------------------------------------
+
+  //! Patterns that select names
+  std::vector<Glob> m_includes;
+  //! Patterns that exclude names
+  std::vector<Glob> m_excludes;
+  //! Whether the pattern list was empty
+  bool              m_isEmpty;
+  //! What an empty pattern list matches
+  bool              m_emptyMatches;
+};
+
+//----------------------------------------------------------------------------//
+// MatchIndex
+//----------------------------------------------------------------------------//
+
+/*! \class MatchIndex
+  \brief A sorted index of a list of attribute names, such as the layers 
+  of a file, for finding the names that match a MatchPattern.
+
+  Only names sharing the literal prefix of one of the pattern's include
+  globs are tested, which are found by binary search. Build the index once 
+  and reuse it across lookups.
+*/
+
+//----------------------------------------------------------------------------//
+
+class MatchIndex
+{
+public:
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! Indexes the given names
+  MatchIndex(const std::vector<std::string> &names);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Number of indexed names
+  size_t size() const
+  { return m_sorted.size(); }
+
+  //! Finds the names that match the pattern as attributes.
+  //! \param indices Set to the positions of the matching names in the 
+  //! list that was indexed, in increasing order
+  void find(const MatchPattern &pattern, std::vector<size_t> &indices) const;
+
+  //! Finds the names that match the pattern as attributes, in the order
+  //! of the list that was indexed
+  void find(const MatchPattern &pattern, 
+            std::vector<std::string> &names) const;
+
+private:
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! A name along with its position in the indexed list
+  typedef std::pair<std::string, size_t> Entry;
+
+  // Data members --------------------------------------------------------------
+
+  //! The names, in the order given
+  std::vector<std::string> m_names;
+  //! The names, sorted
+  std::vector<Entry>       m_sorted;
+};
+
 //----------------------------------------------------------------------------//
 
 FIELD3D_NAMESPACE_HEADER_CLOSE
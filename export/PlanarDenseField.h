@@ -0,0 +1,480 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file PlanarDenseField.h
+  \brief Contains the PlanarDenseField class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_PlanarDenseField_H_
+#define _INCLUDED_Field3D_PlanarDenseField_H_
+
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include "DenseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// PlanarDenseField
+//----------------------------------------------------------------------------//
+
+/*! \class PlanarDenseField
+  \ingroup field
+  \brief This subclass of Field stores vector data as one dense plane per 
+  component, rather than interleaved like DenseField does.
+
+  Each plane is laid out like the storage of a DenseField of the component
+  type, and starts on a k_alignment byte boundary. Loops that only touch 
+  one component, such as taking the y component of a velocity field, can
+  process its rows directly through componentRowPtr() and componentSpan().
+  On disk the planes are stored, and compressed, separately.
+
+  \note This class can only be templated on Vec3 instances.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class PlanarDenseField
+  : public ResizableField<Data_T>
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+  
+  typedef boost::intrusive_ptr<PlanarDenseField> Ptr;
+  typedef std::vector<Ptr> Vec;
+
+  //! This typedef is used to refer to the scalar component type of the vectors
+  typedef typename Data_T::BaseType real_t;
+
+  typedef ResizableField<Data_T> base;
+
+  //! Alignment of each component plane, in bytes
+  static const size_t k_alignment = DenseField<real_t>::k_alignment;
+
+  typedef typename DenseField<real_t>::StorageVec StorageVec;
+  typedef typename DenseField<real_t>::Span       Span;
+  typedef typename DenseField<real_t>::ConstSpan  ConstSpan;
+
+  // Constructors --------------------------------------------------------------
+
+  //! \name Constructors & destructor
+  //! \{
+
+  //! Constructs an empty buffer
+  PlanarDenseField();
+
+  // \}
+
+  // Main methods --------------------------------------------------------------
+
+  //! Clears all the voxels in the storage
+  virtual void clear(const Data_T &value);
+
+  // From Field base class -----------------------------------------------------
+
+  //! \name From Field
+  //! \{  
+  virtual Data_T value(int i, int j, int k) const;
+  virtual long long int memSize() const;
+  //! \}
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef PlanarDenseField<Data_T> class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS
+
+  static const char *staticClassName()
+  {
+    return "PlanarDenseField";
+  }
+
+  static const char *staticClassType()
+  {
+    return PlanarDenseField<Data_T>::ms_classType.name();
+  } 
+    
+  // From WritableField base class ---------------------------------------------
+
+  //! \name From WritableField
+  //! \{
+
+  //! This will return the voxel's value, but since the components aren't 
+  //! stored together, setting it to something else does not change the 
+  //! field. Use setValue() or component() instead.
+  //! \warning See description
+  virtual Data_T& lvalue(int i, int j, int k);
+
+  //! \}
+  
+  // Concrete voxel access -----------------------------------------------------
+
+  //! Read access to voxel. Notice that this is non-virtual.
+  Data_T fastValue(int i, int j, int k) const;
+  //! Sets all components of a voxel
+  void setValue(int i, int j, int k, const Data_T &value);
+  //! Read access to one component of a voxel
+  const real_t& component(int c, int i, int j, int k) const;
+  //! Write access to one component of a voxel
+  real_t& component(int c, int i, int j, int k);
+
+  // Bulk component access -----------------------------------------------------
+
+  //! \name Bulk component access
+  //! \{
+
+  //! Pointer to the first voxel of component c in row (j, k), which is 
+  //! followed by the rest of the row's values of that component in x order.
+  const real_t* componentRowPtr(int c, int j, int k) const;
+  //! Pointer to the first voxel of component c in row (j, k), which is 
+  //! followed by the rest of the row's values of that component in x order.
+  real_t* componentRowPtr(int c, int j, int k);
+  //! Read access to component c of the voxels of a box, clipped to the data 
+  //! window
+  ConstSpan componentSpan(int c, const Box3i &box) const;
+  //! Write access to component c of the voxels of a box, clipped to the 
+  //! data window
+  Span componentSpan(int c, const Box3i &box);
+  //! Number of values from one row of a component plane to the next
+  size_t rowStride() const
+  { return m_memSize.x; }
+  //! Number of values from one slice of a component plane to the next
+  size_t sliceStride() const
+  { return m_memSizeXY; }
+
+  //! \}
+
+  // From FieldBase ------------------------------------------------------------
+
+  //! \name From FieldBase
+  //! \{
+
+  FIELD3D_CLASSNAME_CLASSTYPE_IMPLEMENTATION;
+  
+  virtual FieldBase::Ptr clone() const
+  { return Ptr(new PlanarDenseField(*this)); }
+
+  //! \}
+
+protected:
+
+  // From ResizableField class -------------------------------------------------
+
+  virtual void sizeChanged();
+
+  // Data members --------------------------------------------------------------
+
+  //! Memory allocation size of each plane in each dimension
+  FIELD3D_VEC3_T<size_t> m_memSize;
+  //! X scanline * Y scanline size
+  size_t m_memSizeXY;
+  //! Number of values from the start of one plane to the next. This is 
+  //! padded so that every plane starts on a k_alignment byte boundary.
+  size_t m_planeStride;
+  //! Field storage. Holds the x, y and z planes, in order.
+  StorageVec m_data;
+
+  //! Dummy storage of a temp value that lvalue() can write to
+  mutable Data_T m_dummy;
+
+private:
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<PlanarDenseField<Data_T> > ms_classType;
+
+  // Direct access to memory ---------------------------------------------------
+
+  //! Returns a pointer to a component of a given element
+  inline real_t* ptr(int c, int i, int j, int k);
+  //! Returns a pointer to a component of a given element
+  inline const real_t* ptr(int c, int i, int j, int k) const;
+
+};
+
+//----------------------------------------------------------------------------//
+// Typedefs
+//----------------------------------------------------------------------------//
+
+typedef PlanarDenseField<V3h> PlanarDenseField3h;
+typedef PlanarDenseField<V3f> PlanarDenseField3f;
+typedef PlanarDenseField<V3d> PlanarDenseField3d;
+
+//----------------------------------------------------------------------------//
+// PlanarDenseField implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+PlanarDenseField<Data_T>::PlanarDenseField()
+  : base(),
+    m_memSize(0), m_memSizeXY(0), m_planeStride(0)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void PlanarDenseField<Data_T>::clear(const Data_T &value)
+{
+  for (size_t c = 0; c < 3; ++c) {
+    std::fill(m_data.begin() + c * m_planeStride, 
+              m_data.begin() + (c + 1) * m_planeStride, value[c]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T PlanarDenseField<Data_T>::value(int i, int j, int k) const
+{
+  return fastValue(i, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+long long int PlanarDenseField<Data_T>::memSize() const
+{ 
+  long long int superClassMemSize = base::memSize();
+  long long int vectorMemSize = m_data.capacity() * sizeof(real_t);
+  return sizeof(*this) + vectorMemSize + superClassMemSize; 
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T& PlanarDenseField<Data_T>::lvalue(int i, int j, int k)
+{
+  m_dummy = value(i, j, k);
+  return m_dummy;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T PlanarDenseField<Data_T>::fastValue(int i, int j, int k) const
+{
+  return Data_T(*ptr(0, i, j, k), *ptr(1, i, j, k), *ptr(2, i, j, k));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void PlanarDenseField<Data_T>::setValue(int i, int j, int k, 
+                                        const Data_T &value)
+{
+  *ptr(0, i, j, k) = value.x;
+  *ptr(1, i, j, k) = value.y;
+  *ptr(2, i, j, k) = value.z;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+const typename PlanarDenseField<Data_T>::real_t& 
+PlanarDenseField<Data_T>::component(int c, int i, int j, int k) const
+{
+  return *ptr(c, i, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename PlanarDenseField<Data_T>::real_t& 
+PlanarDenseField<Data_T>::component(int c, int i, int j, int k)
+{
+  return *ptr(c, i, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+const typename PlanarDenseField<Data_T>::real_t* 
+PlanarDenseField<Data_T>::componentRowPtr(int c, int j, int k) const
+{
+  return ptr(c, base::m_dataWindow.min.x, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename PlanarDenseField<Data_T>::real_t* 
+PlanarDenseField<Data_T>::componentRowPtr(int c, int j, int k)
+{
+  return ptr(c, base::m_dataWindow.min.x, j, k);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename PlanarDenseField<Data_T>::ConstSpan 
+PlanarDenseField<Data_T>::componentSpan(int c, const Box3i &box) const
+{
+  ConstSpan result;
+  const Box3i bounds = Field3D::clipBounds(box, base::m_dataWindow);
+  if (bounds.isEmpty()) {
+    return result;
+  }
+  result.data        = ptr(c, bounds.min.x, bounds.min.y, bounds.min.z);
+  result.bounds      = bounds;
+  result.rowStride   = m_memSize.x;
+  result.sliceStride = m_memSizeXY;
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename PlanarDenseField<Data_T>::Span 
+PlanarDenseField<Data_T>::componentSpan(int c, const Box3i &box)
+{
+  Span result;
+  const Box3i bounds = Field3D::clipBounds(box, base::m_dataWindow);
+  if (bounds.isEmpty()) {
+    return result;
+  }
+  result.data        = ptr(c, bounds.min.x, bounds.min.y, bounds.min.z);
+  result.bounds      = bounds;
+  result.rowStride   = m_memSize.x;
+  result.sliceStride = m_memSizeXY;
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void PlanarDenseField<Data_T>::sizeChanged() 
+{
+  // Call base class
+  base::sizeChanged();
+
+  // Calculate offsets
+  m_memSize = base::m_dataWindow.max - base::m_dataWindow.min + V3i(1);
+  m_memSizeXY = m_memSize.x * m_memSize.y;
+
+  // Check that mem size is >= 0 in all dimensions
+  if (base::m_dataWindow.max.x < base::m_dataWindow.min.x ||
+      base::m_dataWindow.max.y < base::m_dataWindow.min.y ||
+      base::m_dataWindow.max.z < base::m_dataWindow.min.z)
+    throw Exc::ResizeException("Attempt to resize ResizableField object "
+                               "using negative size. Data window was: " +
+                               boost::lexical_cast<std::string>(
+                                 base::m_dataWindow.min) + " - " +
+                               boost::lexical_cast<std::string>(
+                                 base::m_dataWindow.max));
+
+  // Pad each plane so that the next one starts aligned
+  const size_t planeAlign = k_alignment / sizeof(real_t);
+  m_planeStride = (m_memSizeXY * m_memSize.z + planeAlign - 1) / 
+    planeAlign * planeAlign;
+
+  // Allocate memory
+  try {
+    StorageVec().swap(m_data);
+    m_data.resize(3 * m_planeStride);
+  }
+  catch (std::bad_alloc &) {
+    throw Exc::MemoryException("Couldn't allocate PlanarDenseField of size " + 
+                               boost::lexical_cast<std::string>(m_memSize));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+inline typename PlanarDenseField<Data_T>::real_t* 
+PlanarDenseField<Data_T>::ptr(int c, int i, int j, int k)
+{
+  assert (c >= 0 && c < 3);
+  assert (i >= base::m_dataWindow.min.x);
+  assert (i <= base::m_dataWindow.max.x);
+  assert (j >= base::m_dataWindow.min.y);
+  assert (j <= base::m_dataWindow.max.y);
+  assert (k >= base::m_dataWindow.min.z);
+  assert (k <= base::m_dataWindow.max.z);
+  // Add crop window offset
+  i -= base::m_dataWindow.min.x;
+  j -= base::m_dataWindow.min.y;
+  k -= base::m_dataWindow.min.z;
+  // Access data
+  return &m_data[c * m_planeStride + i + j * m_memSize.x + k * m_memSizeXY];
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+inline const typename PlanarDenseField<Data_T>::real_t* 
+PlanarDenseField<Data_T>::ptr(int c, int i, int j, int k) const
+{
+  assert (c >= 0 && c < 3);
+  assert (i >= base::m_dataWindow.min.x);
+  assert (i <= base::m_dataWindow.max.x);
+  assert (j >= base::m_dataWindow.min.y);
+  assert (j <= base::m_dataWindow.max.y);
+  assert (k >= base::m_dataWindow.min.z);
+  assert (k <= base::m_dataWindow.max.z);
+  // Add crop window offset
+  i -= base::m_dataWindow.min.x;
+  j -= base::m_dataWindow.min.y;
+  k -= base::m_dataWindow.min.z;
+  // Access data
+  return &m_data[c * m_planeStride + i + j * m_memSize.x + k * m_memSizeXY];
+}
+
+//----------------------------------------------------------------------------//
+// Static data member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(PlanarDenseField);
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -44,9 +44,12 @@
 #ifndef _INCLUDED_Field3D_PluginLoader_H_
 #define _INCLUDED_Field3D_PluginLoader_H_
 
+#include <map>
 #include <string>
 #include <vector>
 
+#include <boost/thread/mutex.hpp>
+
 //----------------------------------------------------------------------------//
 
 #include "ns.h"
@@ -79,9 +82,26 @@ public:
  
   // Main methods --------------------------------------------------------------
 
-  //! Checks all paths in $FIELD3D_DSO_PATH and loads the plugins it finds
+  //! Checks all paths in $FIELD3D_DSO_PATH and loads the plugins it finds.
+  //! Directories that contain a field3d_plugins.txt manifest are not
+  //! scanned. Instead, the plugins the manifest lists are loaded by 
+  //! loadPluginForClass() once one of their classes is asked for, which 
+  //! keeps startup cheap for processes that never use them. 
+  //! Each manifest line holds a plugin file name, relative to the
+  //! directory, followed by the names of the classes it registers:
+  //! \code
+  //! # Comment
+  //! MyFieldPlugin.so MyField MyFieldIO
+  //! \endcode
   static void loadPlugins();
 
+  //! Loads the plugin that a manifest lists for the given class, if it 
+  //! hasn't been tried yet. Templated names also match the manifest entry
+  //! of the plain class name.
+  //! \returns Whether a plugin was loaded, in which case the lookup of the
+  //! class is worth retrying.
+  static bool loadPluginForClass(const std::string &className);
+
 #if 0
   //! Doesn't appear to be needed yet, but leave in the library just in case
   bool resolveGlobalsForPlugins(const char *dso);
@@ -90,11 +110,29 @@ public:
 
 private:
   
+  // Private member functions --------------------------------------------------
+
+  //! Reads the manifest of the directory into ms_classPlugins
+  //! \returns False if there is no manifest
+  static bool readManifest(const std::string &dir);
+
+  //! Loads the plugin and calls its registration function, unless a plugin
+  //! with the same file name was loaded before.
+  //! \returns Whether the plugin was loaded and registered
+  static bool loadPlugin(const std::string &sofile);
+
   // Private data members ------------------------------------------------------
 
   //! List of plugins loaded
   static std::vector<std::string> ms_pluginsLoaded;
 
+  //! Plugins listed by manifests that haven't been loaded yet, by the 
+  //! names of the classes they register
+  static std::map<std::string, std::string> ms_classPlugins;
+
+  //! Serializes loading
+  static boost::mutex ms_mutex;
+
 };
 
 //----------------------------------------------------------------------------//
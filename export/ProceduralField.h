@@ -112,6 +112,11 @@ class ProceduralFieldLookup;
   procedural/discrete volumes, but to the functions that use them, they all
   function the same.
 
+  Baking or ray marching a procedural costs a virtual call per point when
+  going through lsSample() and value(). Subclasses that can evaluate many
+  points at once should also implement lsSampleBatch() and 
+  evaluateBlock(), which by default fall back to the point-wise calls.
+
 */
 
 //----------------------------------------------------------------------------//
@@ -154,6 +159,19 @@ public:
 
   virtual Data_T lsSample(const V3d &lsP) const = 0;
 
+  // May be implemented by subclasses ------------------------------------------
+
+  //! Samples n local-space points at once. The default implementation 
+  //! calls lsSample() for each point.
+  virtual void lsSampleBatch(const size_t n, const V3d *lsP, 
+                             Data_T *out) const;
+
+  //! Evaluates the voxels of the given voxel-space bounds, with x varying
+  //! fastest, then y, then z. The bounds need not lie within the data 
+  //! window. The default implementation calls value() for each voxel.
+  //! \note Called concurrently by bakeToSparse()
+  virtual void evaluateBlock(const Box3i &vsBounds, Data_T *out) const;
+
   // From FieldBase ------------------------------------------------------------
 
   FIELD3D_CLASSNAME_CLASSTYPE_IMPLEMENTATION
@@ -206,6 +224,34 @@ typedef ProceduralField<V3d>    ProceduralField3d;
 
 FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(ProceduralField);
 
+//----------------------------------------------------------------------------//
+// Template implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void ProceduralField<Data_T>::lsSampleBatch(const size_t n, const V3d *lsP, 
+                                            Data_T *out) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = lsSample(lsP[i]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void ProceduralField<Data_T>::evaluateBlock(const Box3i &vsBounds, 
+                                            Data_T *out) const
+{
+  for (int k = vsBounds.min.z; k <= vsBounds.max.z; ++k) {
+    for (int j = vsBounds.min.y; j <= vsBounds.max.y; ++j) {
+      for (int i = vsBounds.min.x; i <= vsBounds.max.x; ++i, ++out) {
+        *out = value(i, j, k);
+      }
+    }
+  }
+}
+
 //----------------------------------------------------------------------------//
 // Template specializations
 //----------------------------------------------------------------------------//
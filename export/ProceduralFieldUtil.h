@@ -0,0 +1,176 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file ProceduralFieldUtil.h
+  \brief Contains utility functions for procedural fields, such as baking
+  to a SparseField.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_ProceduralFieldUtil_H_
+#define _INCLUDED_Field3D_ProceduralFieldUtil_H_
+
+#include <vector>
+
+#include "ProceduralField.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Bakes the procedural field to a SparseField with the same extents, data
+//! window and mapping. Only the blocks for whose voxel-space bounds 
+//! boundsTest(const Box3i &) returns true are evaluated, through 
+//! ProceduralField::evaluateBlock(). All other blocks are left unallocated,
+//! holding emptyValue.
+//! \note Runs on numIOThreads() threads, a block at a time. evaluateBlock()
+//! and boundsTest are called concurrently.
+template <class Data_T, class BoundsTest_T>
+typename SparseField<Data_T>::Ptr 
+bakeToSparse(const ProceduralField<Data_T> &field, 
+             const BoundsTest_T &boundsTest, const Data_T &emptyValue, 
+             const int blockOrder = BLOCK_ORDER);
+
+//! Bakes all blocks of the procedural field to a SparseField
+template <class Data_T>
+typename SparseField<Data_T>::Ptr 
+bakeToSparse(const ProceduralField<Data_T> &field, 
+             const int blockOrder = BLOCK_ORDER);
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Bounds test that passes all blocks
+  struct BakeAllBlocks
+  {
+    bool operator() (const Box3i &/*vsBounds*/) const
+    { return true; }
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Evaluates the blocks that pass the bounds test. Used by bakeToSparse()
+  template <class Data_T, class BoundsTest_T>
+  class BakeBlockOp
+  {
+  public:
+    BakeBlockOp(const ProceduralField<Data_T> &field, 
+                SparseField<Data_T> &result, const BoundsTest_T &boundsTest)
+      : m_field(&field), m_result(&result), m_boundsTest(boundsTest)
+    { }
+    void operator() (const Box3i &vsBounds)
+    {
+      if (!m_boundsTest(vsBounds)) {
+        return;
+      }
+      const V3i size = vsBounds.size() + V3i(1);
+      m_values.resize(size.x * size.y * size.z);
+      m_field->evaluateBlock(vsBounds, &m_values[0]);
+      // Writes within the block's bounds only touch the block itself
+      const Data_T *value = &m_values[0];
+      for (int k = vsBounds.min.z; k <= vsBounds.max.z; ++k) {
+        for (int j = vsBounds.min.y; j <= vsBounds.max.y; ++j) {
+          for (int i = vsBounds.min.x; i <= vsBounds.max.x; ++i, ++value) {
+            m_result->fastLValue(i, j, k) = *value;
+          }
+        }
+      }
+    }
+  private:
+    const ProceduralField<Data_T> *m_field;
+    SparseField<Data_T>           *m_result;
+    const BoundsTest_T            &m_boundsTest;
+    //! Each thread works on its own copy of the op, and values
+    std::vector<Data_T>            m_values;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T, class BoundsTest_T>
+typename SparseField<Data_T>::Ptr 
+bakeToSparse(const ProceduralField<Data_T> &field, 
+             const BoundsTest_T &boundsTest, const Data_T &emptyValue, 
+             const int blockOrder)
+{
+  typename SparseField<Data_T>::Ptr result(new SparseField<Data_T>);
+  result->setMapping(field.mapping());
+  result->setBlockOrder(blockOrder);
+  result->setSize(field.extents(), field.dataWindow());
+  result->clear(emptyValue);
+  result->parallelForBlocks(detail::BakeBlockOp<Data_T, BoundsTest_T>
+                            (field, *result, boundsTest));
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseField<Data_T>::Ptr 
+bakeToSparse(const ProceduralField<Data_T> &field, const int blockOrder)
+{
+  return bakeToSparse(field, detail::BakeAllBlocks(), Data_T(0.0f), 
+                      blockOrder);
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
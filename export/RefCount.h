@@ -36,7 +36,7 @@
 //----------------------------------------------------------------------------//
 
 /*! \file RefCount.h
-  \brief Contains base class for reference counting with Mutex
+  \brief Contains base class for atomic reference counting
 */
 
 //----------------------------------------------------------------------------//
@@ -44,6 +44,8 @@
 #ifndef _INCLUDED_Field3D_REF_COUNT_H_
 #define _INCLUDED_Field3D_REF_COUNT_H_
 
+//! Reference counts are always atomic. The define is kept for code that
+//! checks for it.
 #define FIELD3D_USE_ATOMIC_COUNT
 
 //----------------------------------------------------------------------------//
@@ -51,12 +53,7 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
-
-#ifdef FIELD3D_USE_ATOMIC_COUNT
 #include <boost/detail/atomic_count.hpp>
-#else
-#include <boost/thread/mutex.hpp>
-#endif
 
 #include <string.h>
 #include "Traits.h"
@@ -68,9 +65,42 @@ FIELD3D_NAMESPACE_OPEN
 // Field RTTI Replacement
 //----------------------------------------------------------------------------//
 
+//! Integer identifying a class for field_dynamic_cast. 
+typedef uint64_t RTTITypeId;
+
+//----------------------------------------------------------------------------//
+
+//! Hashes a staticClassType() string into an RTTITypeId (64 bit FNV-1a). 
+//! Since the id only depends on the name, it is the same on both sides of 
+//! a shared library boundary, just like the string.
+inline RTTITypeId rttiTypeId(const char *typenameStr)
+{
+  RTTITypeId hash = 14695981039346656037ULL;
+  for (const unsigned char *c = 
+         reinterpret_cast<const unsigned char*>(typenameStr); *c; ++c) {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the RTTITypeId of Class_T, hashing its name on the first call only
+template <class Class_T>
+RTTITypeId staticTypeId()
+{
+  static const RTTITypeId id = rttiTypeId(Class_T::staticClassType());
+  return id;
+}
+
+//----------------------------------------------------------------------------//
+
 #define DEFINE_CHECK_RTTI_CALL                    \
   virtual bool checkRTTI(const char *typenameStr) \
   { return matchRTTI(typenameStr); }              \
+  virtual bool checkTypeId(const RTTITypeId id)   \
+  { return matchTypeId(id); }                     \
   
 #define DEFINE_MATCH_RTTI_CALL                        \
   bool matchRTTI(const char *typenameStr)             \
@@ -80,6 +110,15 @@ FIELD3D_NAMESPACE_OPEN
     }                                                 \
     return base::matchRTTI(typenameStr);              \
   }                                                   \
+  bool matchTypeId(const RTTITypeId id)               \
+  {                                                   \
+    static const RTTITypeId s_typeId =                \
+      rttiTypeId(staticClassType());                  \
+    if (id == s_typeId) {                             \
+      return true;                                    \
+    }                                                 \
+    return base::matchTypeId(id);                     \
+  }                                                   \
 
 #define DEFINE_FIELD_RTTI_CONCRETE_CLASS        \
   DEFINE_CHECK_RTTI_CALL                        \
@@ -119,24 +158,23 @@ public:
 
   RefBase() 
     : m_counter(0), 
-      m_sharedPtr(this, null_deleter()) 
+      m_sharedPtr(NULL) 
   { }
 
-  //! Copy constructor
-  //! \note The null_deleter ensures we never try to actually delete this
-  //! object using the shared pointer.
+  //! Copy constructor. The copy starts out unreferenced, and without 
+  //! weak pointers.
   RefBase(const RefBase&) 
     : m_counter(0),
-      m_sharedPtr(this, null_deleter()) 
+      m_sharedPtr(NULL) 
   { }
 
   //! Assignment operator
   RefBase& operator= (const RefBase&)
   { return *this; }
 
-  //! Destructor
+  //! Destructor. Expires any weak pointers to the object.
   virtual ~RefBase() 
-  {}
+  { delete m_sharedPtr; }
 
   //! \}
 
@@ -148,35 +186,32 @@ public:
     
   //! Used by boost::intrusive_pointer
   void ref() const
-  { 
-#ifndef FIELD3D_USE_ATOMIC_COUNT
-    boost::mutex::scoped_lock lock(m_refMutex);
-#endif
-    ++m_counter; 
-  }
+  { ++m_counter; }
 
-  //! Used by boost::intrusive_pointer
-  void unref() const
+  //! Used by boost::intrusive_pointer. Returns the count after the 
+  //! decrement, which is the only safe way to tell whether this released 
+  //! the last reference.
+  long unref() const
   {
-#ifndef FIELD3D_USE_ATOMIC_COUNT
-    boost::mutex::scoped_lock lock(m_refMutex);
-#endif
-    --m_counter; 
     // since we use intrusive_pointer no need
     // to delete the object ourselves.
+    return --m_counter; 
   }
   
   // Cache handling ------------------------------------------------------------
 
-  WeakPtr weakPtr() const
-  { return m_sharedPtr; }
+  //! Returns a weak pointer that expires when the object is destroyed.
+  //! The shared pointer backing it is only allocated on the first call,
+  //! so objects that are never cached don't pay for it.
+  WeakPtr weakPtr() const;
 
   // RTTI replacement ----------------------------------------------------------
 
   /*! \note A note on why the RTTI replacement is needed:
      RTTI calls fail once the object crosses the dso boundary. We revert
-     to using simple string checks which is more expensive but at least works
-     once the dso is used in Houdini, etc.
+     to comparing class names, which at least works once the dso is used in
+     Houdini, etc. The names are hashed into RTTITypeIds once, so a check
+     costs an integer comparison per class in the hierarchy.
      Use field_dynamic_cast<> for any RefBase subclass instead of 
      dynamic_cast<>.
   */
@@ -187,6 +222,10 @@ public:
   //! This function is only implemented by concrete classes and triggers
   //! the actual RTTI check through matchRTTI();
   virtual bool checkRTTI(const char *typenameStr) = 0;
+
+  //! Same as checkRTTI(), but compares integer ids instead of strings.
+  //! This is what field_dynamic_cast uses.
+  virtual bool checkTypeId(const RTTITypeId id) = 0;
   
   //! Performs a check to see if the given typename string matches this class'
   //! This needs to be implemented in -all- subclasses, even abstract ones.
@@ -197,6 +236,12 @@ public:
     return false;
   }
 
+  //! Same as matchRTTI(), for ids from staticTypeId()
+  bool matchTypeId(const RTTITypeId id)
+  {
+    return id == staticTypeId<RefBase>();
+  }
+
   static const char *staticClassType()
   {
     return "RefBase";
@@ -207,17 +252,12 @@ public:
 private:
 
   //! For boost intrusive pointer
-#ifdef FIELD3D_USE_ATOMIC_COUNT
   mutable boost::detail::atomic_count m_counter;
-#else
-  mutable long m_counter;
-  //! Mutex for ref counting
-  mutable boost::mutex m_refMutex;     
-#endif
 
   //! For use by the FieldCache only:
-  //! The shared pointer lets us see if this object is still alive.
-  boost::shared_ptr<RefBase> m_sharedPtr;
+  //! The shared pointer lets us see if this object is still alive. 
+  //! Allocated by weakPtr(), NULL until then.
+  mutable boost::shared_ptr<RefBase> *m_sharedPtr;
 
 };
 
@@ -238,9 +278,7 @@ intrusive_ptr_add_ref(RefBase* r)
 inline void
 intrusive_ptr_release(RefBase* r)
 {
-  r->unref();
-
-  if (r->refcnt() == 0)
+  if (r->unref() == 0)
     delete r;
 }
 
@@ -248,8 +286,9 @@ intrusive_ptr_release(RefBase* r)
 // field_dynamic_cast
 //----------------------------------------------------------------------------//
 
-//! Dynamic cast that uses string-comparison in order to be safe even
-//! after an object crosses a shared library boundary.
+//! Dynamic cast that compares class ids hashed from the class names, in 
+//! order to be safe even after an object crosses a shared library boundary.
+//! Each class in the hierarchy costs one integer comparison.
 //! \ingroup field
 template <class Field_T>
 typename Field_T::Ptr
@@ -258,9 +297,7 @@ field_dynamic_cast(RefBase::Ptr field)
   if (!field) 
     return NULL;
 
-  const char *tgtTypeString =  Field_T::staticClassType();
-  
-  if (field->checkRTTI(tgtTypeString)) {
+  if (field->checkTypeId(staticTypeId<Field_T>())) {
     return static_cast<Field_T*>(field.get());
   } else {
     return NULL;
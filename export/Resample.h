@@ -44,8 +44,18 @@
 #ifndef _INCLUDED_Field3D_Resample_H_
 #define _INCLUDED_Field3D_Resample_H_
 
+#include <limits>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
 #include "DenseField.h"
+#include "FieldInterp.h"
+#include "FieldMapping.h"
+#include "InitIO.h"
 #include "SparseField.h"
+#include "ThreadPool.h"
 
 //----------------------------------------------------------------------------//
 
@@ -54,7 +64,7 @@
  * x Implement dumb, dense resampling
  * x For SparseField, only write non-zero results
  * x Implement more filters
- * For SparseField, be smart about which blocks are computed
+ * x For SparseField, be smart about which blocks are computed
  * x Multi-threading using boost
  * Multi-threading using TBB
 
@@ -76,10 +86,39 @@ FIELD3D_NAMESPACE_OPEN
 //! if possible.
 //! \note The extents of the field will be reset to match the data window.
 //! This should 
+//! \note Runs on numIOThreads() threads. Blocks of target voxels whose 
+//! source support lies in empty, unallocated SparseField blocks are 
+//! skipped, so the cost follows the occupied volume.
 template <typename Field_T, typename FilterOp_T>
 bool resample(const Field_T &src, Field_T &tgt, const V3i &newRes,
               const FilterOp_T &filter);
 
+//! Resamples the source field into the target field on numThreads threads.
+//! \sa resample()
+template <typename Field_T, typename FilterOp_T>
+bool resample(const Field_T &src, Field_T &tgt, const V3i &newRes,
+              const FilterOp_T &filter, const size_t numThreads);
+
+//! Resamples the source field into the mapping and data window that the 
+//! target field already has, e.g. a rotated MatrixFieldMapping or a 
+//! FrustumFieldMapping. Each target voxel center is transformed into the
+//! source's voxel space and sampled with a LinearGenericFieldInterp. 
+//! Target voxels outside the source's data window are left at zero.
+//! \note Runs on numIOThreads() threads, a block of target voxels at a 
+//! time. Blocks that miss the source's data window, or whose source 
+//! voxels lie in empty, unallocated SparseField blocks, are skipped.
+//! \returns False if either field lacks a mapping.
+template <typename Field_T>
+bool resampleToMapping(const Field_T &src, Field_T &tgt);
+
+//! Resamples the source field into the target field's mapping with the 
+//! given interpolator, on numThreads threads. The interpolator needs a 
+//! batched sample(data, n, vsP, out) and a support of at most two voxels.
+//! \sa resampleToMapping()
+template <typename Field_T, typename Interp_T>
+bool resampleToMapping(const Field_T &src, Field_T &tgt, 
+                       const Interp_T &interp, const size_t numThreads);
+
 //----------------------------------------------------------------------------//
 // Filter
 //----------------------------------------------------------------------------//
@@ -406,100 +445,261 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
-  template <typename Field_T, typename FilterOp_T, bool IsAnalytic_T>
-  void separable(const Field_T &src, Field_T &tgt, const V3i &newRes,
-                 const FilterOp_T &filterOp, const size_t dim)
+  //! Constant size for all dense fields
+  template <typename Data_T>
+  size_t threadingBlockSize(const DenseField<Data_T> & /* f */)
   {
-    typedef typename Field_T::value_type T;
+    return 16;
+  }
+  
+  //! Use block size for sparse fields
+  template <typename Data_T>
+  size_t threadingBlockSize(const SparseField<Data_T> &f)
+  {
+    return f.blockSize();
+  }
 
-    const V3i   srcRes    = src.dataWindow().size() + V3i(1);
-    const float srcDomain = V3f(srcRes)[dim];
-    const float tgtDomain = V3f(newRes)[dim];
-    const float srcSize   = 1.0 / srcDomain;
-    const float tgtSize   = 1.0 / tgtDomain;
+  //--------------------------------------------------------------------------//
 
-    // Filter info
+  //! Returns true if all voxels of srcBox lie in unallocated blocks whose 
+  //! empty value is zero, in which case any target voxel that only draws 
+  //! from them resamples to zero.
+  template <typename Data_T>
+  bool checkSourceEmpty(const SparseField<Data_T> &src, const Box3i &srcBox)
+  {
+    const Box3i clipped = clipBounds(srcBox, src.dataWindow());
+    if (clipped.isEmpty()) {
+      return true;
+    }
+    const Box3i dbsBounds = blockCoords(clipped, &src);
+    for (int k = dbsBounds.min.z; k <= dbsBounds.max.z; ++k) {
+      for (int j = dbsBounds.min.y; j <= dbsBounds.max.y; ++j) {
+        for (int i = dbsBounds.min.x; i <= dbsBounds.max.x; ++i) {
+          if (src.blockIsAllocated(i, j, k) ||
+              src.getBlockEmptyValue(i, j, k) != static_cast<Data_T>(0)) {
+            return false;
+          }
+        }
+      } 
+    }
+    return true;
+  }
+
+  //! Fallback version always returns false
+  template <typename Field_T>
+  bool checkSourceEmpty(const Field_T &/*src*/, const Box3i &/*srcBox*/)
+  {
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! The source voxels and weights used for each target coordinate along 
+  //! one axis. The weights only depend on the target coordinate along the
+  //! axis, so they are evaluated once per pass rather than once per voxel.
+  struct FilterTaps
+  {
+    //! First source coordinate of each target coordinate
+    std::vector<int>    first;
+    //! Number of source voxels of each target coordinate
+    std::vector<int>    count;
+    //! Offset of each target coordinate's weights in weights
+    std::vector<size_t> offset;
+    //! Sum of each target coordinate's weights
+    std::vector<float>  sum;
+    std::vector<float>  weights;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Computes the taps of one axis when resampling from srcRes to tgtRes
+  //! voxels
+  //! \param srcMin, srcMax The source data window along the axis
+  template <typename FilterOp_T>
+  void resampleFilterTaps(const FilterOp_T &filterOp, const int srcRes, 
+                          const int tgtRes, const int srcMin, 
+                          const int srcMax, FilterTaps &taps)
+  {
+    const float srcSize = 1.0 / static_cast<float>(srcRes);
+    const float tgtSize = 1.0 / static_cast<float>(tgtRes);
     const float support = filterOp.support();
+    const bool  doUpres = tgtRes > srcRes;
+
+    for (int t = 0; t < tgtRes; ++t) {
+      // Current position in target coordinates
+      const float tgtP = discToCont(t);
+      // Transform support to source coordinates
+      std::pair<int, int> srcInterval = 
+        srcSupportBBox(tgtP, support, doUpres, srcSize, tgtSize);
+      // Clip against source data window
+      srcInterval.first  = std::max(srcInterval.first, srcMin);
+      srcInterval.second = std::min(srcInterval.second, srcMax);
+      // Add the weights, summing them in tap order
+      taps.first.push_back(srcInterval.first);
+      taps.count.push_back(std::max(0, srcInterval.second - 
+                                    srcInterval.first + 1));
+      taps.offset.push_back(taps.weights.size());
+      float sum = 0.0f;
+      for (int s = srcInterval.first; s <= srcInterval.second; ++s) {
+        const float srcP   = discToCont(s);
+        const float dist   = getDist(doUpres, srcP, tgtP, srcSize, tgtSize);
+        const float weight = filterOp.eval(dist);
+        taps.weights.push_back(weight);
+        sum += weight;
+      }
+      taps.sum.push_back(sum);
+    }
+  }
+
+  //--------------------------------------------------------------------------//
 
-    // Check if we're up-res'ing
-    const bool doUpres = newRes[dim] > srcRes[dim] ? 1 : 0;
+  //! Resamples src into tgt along a single axis, one block of target voxels
+  //! at a time. Each thread calls operator()() on its own copy, claiming 
+  //! blocks until there are none left. Blocks whose source support is 
+  //! empty are skipped, leaving their target voxels unallocated.
+  template <typename Field_T, typename FilterOp_T, bool IsAnalytic_T>
+  struct SeparableResampleOp
+  {
+    typedef typename Field_T::value_type T;
 
-    // Resize the target
-    tgt.setSize(newRes);
+    SeparableResampleOp(const Field_T &src, Field_T &tgt, 
+                        const FilterTaps &taps, const float initialValue,
+                        const size_t dim, const std::vector<Box3i> &blocks, 
+                        boost::atomic<size_t> &nextIdx)
+      : m_src(src),
+        m_tgt(tgt),
+        m_taps(taps),
+        m_initialValue(initialValue),
+        m_dim(dim),
+        m_blocks(blocks),
+        m_nextIdx(nextIdx)
+    {
+      // Empty
+    }
+
+    void operator() ()
+    {
+      // Keep going while there is data to process
+      for (size_t idx = m_nextIdx.fetch_add(1); idx < m_blocks.size();
+           idx = m_nextIdx.fetch_add(1)) {
+        resampleBlock(m_blocks[idx]);
+      }
+    }
+
+  private:
+
+    void resampleBlock(const Box3i &box) const
+    {
+      // Early exit if the source voxels of the whole block are empty
+      Box3i srcBox = box;
+      srcBox.min[m_dim] = std::numeric_limits<int>::max();
+      srcBox.max[m_dim] = std::numeric_limits<int>::min();
+      for (int t = box.min[m_dim]; t <= box.max[m_dim]; ++t) {
+        if (m_taps.count[t] > 0) {
+          srcBox.min[m_dim] = std::min(srcBox.min[m_dim], m_taps.first[t]);
+          srcBox.max[m_dim] = std::max(srcBox.max[m_dim], m_taps.first[t] +
+                                       m_taps.count[t] - 1);
+        }
+      }
+      if (srcBox.isEmpty() || checkSourceEmpty(m_src, srcBox)) {
+        return;
+      }
 
-    // For each output voxel
-    for (int k = 0; k < newRes.z; ++k) {
-      for (int j = 0; j < newRes.y; ++j) {
-        for (int i = 0; i < newRes.x; ++i) {
-          T accumValue(filterOp.initialValue());
-          if (IsAnalytic_T) {
-            // Current position in target coordinates
-            const float tgtP = discToCont(V3i(i, j ,k)[dim]);
-            // Transform support to source coordinates
-            std::pair<int, int> srcInterval = 
-              srcSupportBBox(tgtP, support, doUpres, srcSize, tgtSize);
-            // Clip against new data window
-            srcInterval.first = 
-              std::max(srcInterval.first, src.dataWindow().min[dim]);
-            srcInterval.second = 
-              std::min(srcInterval.second, src.dataWindow().max[dim]);
+      // For each output voxel
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j) {
+          for (int i = box.min.x; i <= box.max.x; ++i) {
+            // Taps of the current target coordinate
+            const int    t      = V3i(i, j, k)[m_dim];
+            const int    first  = m_taps.first[t];
+            const int    count  = m_taps.count[t];
+            const float *weight = &m_taps.weights[0] + m_taps.offset[t];
+            T accumValue(m_initialValue);
             // For each input voxel
-            for (int s = srcInterval.first; s <= srcInterval.second; ++s) {
+            for (int s = 0; s < count; ++s) {
               // Index
-              const int xIdx = dim == 0 ? s : i;
-              const int yIdx = dim == 1 ? s : j;
-              const int zIdx = dim == 2 ? s : k;
+              const int xIdx = m_dim == 0 ? first + s : i;
+              const int yIdx = m_dim == 1 ? first + s : j;
+              const int zIdx = m_dim == 2 ? first + s : k;
               // Value
-              const T value = src.fastValue(xIdx, yIdx, zIdx);
-              // Weights
-              const float srcP   = discToCont(V3i(xIdx, yIdx, zIdx)[dim]);
-              const float dist   = getDist(doUpres, srcP, tgtP, srcSize, tgtSize);
-              const float weight = filterOp.eval(dist);
+              const T value = m_src.fastValue(xIdx, yIdx, zIdx);
               // Update
-              if (weight > 0.0f) {
-                FilterOp_T::op(accumValue, value);
+              if (IsAnalytic_T) {
+                if (weight[s] > 0.0f) {
+                  FilterOp_T::op(accumValue, value);
+                }
+              } else {
+                accumValue += value * weight[s];
               }
             }
             // Update final value
-            if (accumValue != static_cast<T>(filterOp.initialValue())) {
-              tgt.fastLValue(i, j, k) = accumValue;
-            }
-          } else {
-            float accumWeight = 0.0f;
-            // Current position in target coordinates
-            const float tgtP = discToCont(V3i(i, j ,k)[dim]);
-            // Transform support to source coordinates
-            std::pair<int, int> srcInterval = 
-              srcSupportBBox(tgtP, support, doUpres, srcSize, tgtSize);
-            // Clip against new data window
-            srcInterval.first = 
-              std::max(srcInterval.first, src.dataWindow().min[dim]);
-            srcInterval.second = 
-              std::min(srcInterval.second, src.dataWindow().max[dim]);
-            // For each input voxel
-            for (int s = srcInterval.first; s <= srcInterval.second; ++s) {
-              // Index
-              const int xIdx = dim == 0 ? s : i;
-              const int yIdx = dim == 1 ? s : j;
-              const int zIdx = dim == 2 ? s : k;
-              // Value
-              const T value      = src.fastValue(xIdx, yIdx, zIdx);
-              // Weights
-              const float srcP   = discToCont(V3i(xIdx, yIdx, zIdx)[dim]);
-              const float dist   = getDist(doUpres, srcP, tgtP, srcSize, tgtSize);
-              const float weight = filterOp.eval(dist);
-              // Update
-              accumWeight += weight;
-              accumValue  += value * weight;
-            }
-            // Update final value
-            if (accumWeight > 0.0f && accumValue != static_cast<T>(0.0)) {
-              tgt.fastLValue(i, j, k) = accumValue / accumWeight;
+            if (IsAnalytic_T) {
+              if (accumValue != static_cast<T>(m_initialValue)) {
+                m_tgt.fastLValue(i, j, k) = accumValue;
+              }
+            } else if (m_taps.sum[t] > 0.0f && 
+                       accumValue != static_cast<T>(0.0)) {
+              m_tgt.fastLValue(i, j, k) = accumValue / m_taps.sum[t];
             }
           }
         }
       }
     }
+
+    // Data members ---
+
+    const Field_T            &m_src;
+    Field_T                  &m_tgt;
+    const FilterTaps         &m_taps;
+    const float               m_initialValue;
+    const size_t              m_dim;
+    const std::vector<Box3i> &m_blocks;
+    boost::atomic<size_t>    &m_nextIdx;
+
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Resamples src into tgt along a single axis, on numThreads threads. 
+  //! The blocks of work are aligned to the target's threading blocks, so 
+  //! that no two threads write to the same sparse block.
+  template <typename Field_T, typename FilterOp_T, bool IsAnalytic_T>
+  void separable(const Field_T &src, Field_T &tgt, const V3i &newRes,
+                 const FilterOp_T &filterOp, const size_t dim,
+                 const size_t numThreads)
+  {
+    typedef SeparableResampleOp<Field_T, FilterOp_T, IsAnalytic_T> Op;
+
+    // Resize the target
+    tgt.setSize(newRes);
+
+    // Weights of the axis
+    const Box3i srcDw  = src.dataWindow();
+    const V3i   srcRes = srcDw.size() + V3i(1);
+    FilterTaps  taps;
+    resampleFilterTaps(filterOp, srcRes[dim], newRes[dim], srcDw.min[dim], 
+                       srcDw.max[dim], taps);
+
+    // Build block list
+    const int          blockSize = threadingBlockSize(tgt);
+    std::vector<Box3i> blocks;
+    for (int k = 0; k < newRes.z; k += blockSize) {
+      for (int j = 0; j < newRes.y; j += blockSize) {
+        for (int i = 0; i < newRes.x; i += blockSize) {
+          Box3i box;
+          box.min = V3i(i, j, k);
+          box.max = box.min + V3i(blockSize - 1);
+          blocks.push_back(clipBounds(box, tgt.dataWindow()));
+        }
+      }
+    }
+
+    // Run on the shared threads. A single thread runs the blocks itself ---
+
+    boost::atomic<size_t> nextIdx(0);
+    const Op op(src, tgt, taps, filterOp.initialValue(), dim, blocks, 
+                nextIdx);
+    runOnThreads(op, numThreads);
   }
 
   //--------------------------------------------------------------------------//
@@ -509,7 +709,7 @@ namespace detail {
   //! \note The extents of the field will be reset to match the data window.
   template <typename Field_T, typename FilterOp_T>
   bool separableResample(const Field_T &src, Field_T &tgt, const V3i &newRes,
-                         const FilterOp_T &filterOp)
+                         const FilterOp_T &filterOp, const size_t numThreads)
   {
     using namespace detail;
   
@@ -533,11 +733,14 @@ namespace detail {
     V3i zRes(newRes.x, newRes.y, newRes.z);
 
     // X axis (src into tgt)
-    separable<Field_T, FilterOp_T, FilterOp_T::isAnalytic>(src, tgt, xRes, filterOp, 0);
+    separable<Field_T, FilterOp_T, FilterOp_T::isAnalytic>
+      (src, tgt, xRes, filterOp, 0, numThreads);
     // Y axis (tgt into temp)
-    separable<Field_T, FilterOp_T, FilterOp_T::isAnalytic>(tgt, tmp, yRes, filterOp, 1);
+    separable<Field_T, FilterOp_T, FilterOp_T::isAnalytic>
+      (tgt, tmp, yRes, filterOp, 1, numThreads);
     // Z axis (temp into tgt)
-    separable<Field_T, FilterOp_T, FilterOp_T::isAnalytic>(tmp, tgt, zRes, filterOp, 2);
+    separable<Field_T, FilterOp_T, FilterOp_T::isAnalytic>
+      (tmp, tgt, zRes, filterOp, 2, numThreads);
 
     // Update final target with mapping and metadata
     tgt.name      = src.name;
@@ -550,6 +753,152 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
+  //! Transforms target voxel space points into source voxel space. Two 
+  //! MatrixFieldMappings collapse into a single matrix, other mappings go
+  //! through world space.
+  class VoxelToVoxel
+  {
+  public:
+    VoxelToVoxel(const FieldMapping::Ptr &srcMapping, 
+                 const FieldMapping::Ptr &tgtMapping)
+      : m_srcMapping(srcMapping), m_tgtMapping(tgtMapping), 
+        m_isMatrix(false)
+    {
+      MatrixFieldMapping::Ptr srcMatrix = 
+        FIELD_DYNAMIC_CAST<MatrixFieldMapping>(srcMapping);
+      MatrixFieldMapping::Ptr tgtMatrix = 
+        FIELD_DYNAMIC_CAST<MatrixFieldMapping>(tgtMapping);
+      if (srcMatrix && tgtMatrix) {
+        // Row vectors, so the target's transform is applied first
+        m_tgtToSrc = tgtMatrix->voxelToWorld() * srcMatrix->worldToVoxel();
+        m_isMatrix = true;
+      }
+    }
+    V3d operator() (const V3d &tgtVsP) const
+    {
+      V3d srcVsP;
+      if (m_isMatrix) {
+        m_tgtToSrc.multVecMatrix(tgtVsP, srcVsP);
+      } else {
+        V3d wsP;
+        m_tgtMapping->voxelToWorld(tgtVsP, wsP);
+        m_srcMapping->worldToVoxel(wsP, srcVsP);
+      }
+      return srcVsP;
+    }
+  private:
+    FieldMapping::Ptr m_srcMapping, m_tgtMapping;
+    M44d              m_tgtToSrc;
+    bool              m_isMatrix;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Gathers one block of target voxels at a time from the source. Each 
+  //! thread calls operator()() on its own copy, claiming blocks until 
+  //! there are none left.
+  template <typename Field_T, typename Interp_T>
+  struct ResampleToMappingOp
+  {
+    typedef typename Field_T::value_type T;
+
+    ResampleToMappingOp(const Field_T &src, Field_T &tgt, 
+                        const Interp_T &interp, const VoxelToVoxel &xform,
+                        const std::vector<Box3i> &blocks, 
+                        boost::atomic<size_t> &nextIdx)
+      : m_src(src),
+        m_tgt(tgt),
+        m_interp(interp),
+        m_xform(xform),
+        m_blocks(blocks),
+        m_nextIdx(nextIdx)
+    {
+      // Empty
+    }
+
+    void operator() ()
+    {
+      // Keep going while there is data to process
+      for (size_t idx = m_nextIdx.fetch_add(1); idx < m_blocks.size();
+           idx = m_nextIdx.fetch_add(1)) {
+        gatherBlock(m_blocks[idx]);
+      }
+    }
+
+  private:
+
+    void gatherBlock(const Box3i &box)
+    {
+      const Box3i srcDw = m_src.dataWindow();
+      const Box3d srcBounds(V3d(srcDw.min), V3d(srcDw.max + V3i(1)));
+
+      // Source voxels touched by the block. The corners of the block bound
+      // it under both affine and projective mappings
+      Box3d srcVsBox;
+      for (int c = 0; c < 8; ++c) {
+        const V3d corner(c & 1 ? box.max.x + 1 : box.min.x,
+                         c & 2 ? box.max.y + 1 : box.min.y,
+                         c & 4 ? box.max.z + 1 : box.min.z);
+        srcVsBox.extendBy(m_xform(corner));
+      }
+      // Pad by the interpolation stencil
+      const Box3i srcBox(V3i(contToDisc(srcVsBox.min.x) - 2, 
+                             contToDisc(srcVsBox.min.y) - 2, 
+                             contToDisc(srcVsBox.min.z) - 2),
+                         V3i(contToDisc(srcVsBox.max.x) + 2, 
+                             contToDisc(srcVsBox.max.y) + 2, 
+                             contToDisc(srcVsBox.max.z) + 2));
+      const Box3i clipped = clipBounds(srcBox, srcDw);
+      if (clipped.isEmpty() || checkSourceEmpty(m_src, clipped)) {
+        return;
+      }
+
+      // Source positions of the voxel centers that fall within the source
+      m_vsP.clear();
+      m_voxels.clear();
+      for (int k = box.min.z; k <= box.max.z; ++k) {
+        for (int j = box.min.y; j <= box.max.y; ++j) {
+          for (int i = box.min.x; i <= box.max.x; ++i) {
+            const V3d vsP = m_xform(discToCont(V3i(i, j, k)));
+            if (srcBounds.intersects(vsP)) {
+              m_vsP.push_back(V3f(vsP));
+              m_voxels.push_back(V3i(i, j, k));
+            }
+          }
+        }
+      }
+      if (m_vsP.empty()) {
+        return;
+      }
+
+      // Sample them in one batch, and only write non-zero results
+      m_values.resize(m_vsP.size());
+      m_interp.sample(m_src, m_vsP.size(), &m_vsP[0], &m_values[0]);
+      for (size_t i = 0, end = m_values.size(); i < end; ++i) {
+        if (m_values[i] != static_cast<T>(0.0)) {
+          const V3i &v = m_voxels[i];
+          m_tgt.fastLValue(v.x, v.y, v.z) = m_values[i];
+        }
+      }
+    }
+
+    // Data members ---
+
+    const Field_T            &m_src;
+    Field_T                  &m_tgt;
+    const Interp_T           &m_interp;
+    const VoxelToVoxel       &m_xform;
+    const std::vector<Box3i> &m_blocks;
+    boost::atomic<size_t>    &m_nextIdx;
+    //! Scratch space. Each thread has its own copy of the op
+    std::vector<V3f>          m_vsP;
+    std::vector<V3i>          m_voxels;
+    std::vector<T>            m_values;
+
+  };
+
+  //--------------------------------------------------------------------------//
+
 } // namespace detail
 
 //----------------------------------------------------------------------------//
@@ -560,7 +909,69 @@ template <typename Field_T, typename FilterOp_T>
 bool resample(const Field_T &src, Field_T &tgt, const V3i &newRes,
               const FilterOp_T &filterOp)
 {
-  return detail::separableResample(src, tgt, newRes, filterOp);
+  return detail::separableResample(src, tgt, newRes, filterOp, 
+                                   numIOThreads());
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T, typename FilterOp_T>
+bool resample(const Field_T &src, Field_T &tgt, const V3i &newRes,
+              const FilterOp_T &filterOp, const size_t numThreads)
+{
+  return detail::separableResample(src, tgt, newRes, filterOp, numThreads);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T>
+bool resampleToMapping(const Field_T &src, Field_T &tgt)
+{
+  return resampleToMapping(src, tgt, LinearGenericFieldInterp<Field_T>(),
+                           numIOThreads());
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Field_T, typename Interp_T>
+bool resampleToMapping(const Field_T &src, Field_T &tgt, 
+                       const Interp_T &interp, const size_t numThreads)
+{
+  using namespace detail;
+
+  typedef ResampleToMappingOp<Field_T, Interp_T> Op;
+
+  if (!src.mapping() || !tgt.mapping()) {
+    return false;
+  }
+
+  const Box3i tgtDw = tgt.dataWindow();
+  if (!src.dataWindow().hasVolume() || !tgtDw.hasVolume()) {
+    return true;
+  }
+
+  // Build block list, aligned to the target's blocks
+  const int          blockSize = threadingBlockSize(tgt);
+  std::vector<Box3i> blocks;
+  for (int k = tgtDw.min.z; k <= tgtDw.max.z; k += blockSize) {
+    for (int j = tgtDw.min.y; j <= tgtDw.max.y; j += blockSize) {
+      for (int i = tgtDw.min.x; i <= tgtDw.max.x; i += blockSize) {
+        Box3i box;
+        box.min = V3i(i, j, k);
+        box.max = box.min + V3i(blockSize - 1);
+        blocks.push_back(clipBounds(box, tgtDw));
+      }
+    }
+  }
+
+  // Run on the shared threads. A single thread runs the blocks itself ---
+
+  const VoxelToVoxel    xform(src.mapping(), tgt.mapping());
+  boost::atomic<size_t> nextIdx(0);
+  const Op op(src, tgt, interp, xform, blocks, nextIdx);
+  runOnThreads(op, numThreads);
+
+  return true;
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,314 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Sampler.h
+  \brief Contains the Sampler and TemporalSampler classes and 
+  dispatchSampler().
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_Sampler_H_
+#define _INCLUDED_Field3D_Sampler_H_
+
+#include <algorithm>
+
+#include "DenseField.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Sampler
+//----------------------------------------------------------------------------//
+
+/*! \class Sampler
+  \ingroup field
+  \brief Samples a field whose concrete type is known at compile time.
+
+  Field::value() and FieldInterp::sample() are virtual. Sampler calls 
+  fastValue() and the field's own interpolator directly, so a loop over its
+  methods inlines completely. Use dispatchSampler() to go from a FieldRes
+  to a Sampler with a single type check per field, rather than a virtual 
+  call per voxel.
+
+  \note The Sampler doesn't hold a reference to the field. It must be kept
+  alive for as long as the Sampler is used.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T, class Interp_T = typename Field_T::LinearInterp>
+class Sampler
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Field_T                       field_type;
+  typedef Interp_T                      interp_type;
+  typedef typename Field_T::value_type  value_type;
+
+  // Constructors --------------------------------------------------------------
+
+  explicit Sampler(const Field_T &field)
+    : m_field(field)
+  { /* Empty */ }
+
+  Sampler(const Field_T &field, const Interp_T &interp)
+    : m_field(field), m_interp(interp)
+  { /* Empty */ }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Interpolated value at the given voxel-space position
+  value_type sample(const V3d &vsP) const
+  { return m_interp.sample(m_field, vsP); }
+
+  //! Interpolated values at n voxel-space positions. 
+  //! \note Only available if Interp_T has a batched sample() 
+  void sample(size_t n, const V3f *vsP, value_type *out) const
+  { m_interp.sample(m_field, n, vsP, out); }
+
+  //! Value of the given voxel
+  value_type value(int i, int j, int k) const
+  { return m_field.fastValue(i, j, k); }
+
+  //! The sampled field
+  const Field_T& field() const
+  { return m_field; }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  const Field_T &m_field;
+  Interp_T       m_interp;
+
+};
+
+//----------------------------------------------------------------------------//
+// TemporalSampler
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //! Number of points that TemporalSampler hands to each frame at a time
+  const size_t k_temporalBatchSize = 64;
+
+  //! Samples and blends both frames in one pass where the interpolator 
+  //! supports it. The generic version doesn't.
+  template <class Field_T, class Interp_T>
+  bool sampleBlend(const Interp_T &, const Field_T &, const Field_T &, 
+                   double, size_t, const V3f *, 
+                   typename Field_T::value_type *)
+  { return false; }
+
+  //! SparseFields that share their block structure are blended with a 
+  //! single stencil and block lookup per point
+  template <class Data_T>
+  bool sampleBlend(const LinearSparseFieldInterp<Data_T> &interp, 
+                   const SparseField<Data_T> &f0, 
+                   const SparseField<Data_T> &f1, double t, size_t n, 
+                   const V3f *vsP, Data_T *out)
+  {
+    if (f0.dataWindow() != f1.dataWindow() || 
+        f0.blockOrder() != f1.blockOrder() || 
+        f0.blockLayout() != f1.blockLayout()) {
+      return false;
+    }
+    interp.sampleBlend(f0, f1, t, n, vsP, out);
+    return true;
+  }
+
+}
+
+//----------------------------------------------------------------------------//
+
+/*! \class TemporalSampler
+  \ingroup field
+  \brief Interpolates between the fields of two adjacent frames.
+
+  Frame t0 is sampled at t = 0 and frame t1 at t = 1, and values in 
+  between are blended linearly. Both frames are sampled through the batched
+  interpolator, in chunks, so that each frame's block lookups stay 
+  coherent. Two SparseFields with the same block structure are sampled 
+  together, sharing each point's stencil and block lookup.
+
+  Motion compensation is optional. Given a velocity per point, in voxels 
+  per frame, frame t0 is sampled at p - t * v and frame t1 at 
+  p + (1 - t) * v, which keeps moving features sharp rather than 
+  cross-fading them.
+
+  \note Both frames are expected to share their mapping, so that voxel 
+  space positions mean the same thing in each. As with Sampler, the fields
+  must outlive the TemporalSampler.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Field_T, class Interp_T = typename Field_T::LinearInterp>
+class TemporalSampler
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef Field_T                       field_type;
+  typedef Interp_T                      interp_type;
+  typedef typename Field_T::value_type  value_type;
+
+  // Constructors --------------------------------------------------------------
+
+  TemporalSampler(const Field_T &t0, const Field_T &t1)
+    : m_t0(t0), m_t1(t1)
+  { /* Empty */ }
+
+  TemporalSampler(const Field_T &t0, const Field_T &t1, 
+                  const Interp_T &interp)
+    : m_t0(t0), m_t1(t1), m_interp(interp)
+  { /* Empty */ }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Interpolated value at the given voxel-space position and time
+  value_type sample(const V3d &vsP, double t) const
+  { 
+    return static_cast<value_type>((1.0 - t) * m_interp.sample(m_t0, vsP) + 
+                                   t * m_interp.sample(m_t1, vsP)); 
+  }
+
+  //! Interpolated values at n voxel-space positions, all at time t
+  void sample(size_t n, const V3f *vsP, double t, value_type *out) const
+  {
+    if (detail::sampleBlend(m_interp, m_t0, m_t1, t, n, vsP, out)) {
+      return;
+    }
+    value_type v1[detail::k_temporalBatchSize];
+    for (size_t first = 0; first < n; first += detail::k_temporalBatchSize) {
+      const size_t m = std::min(detail::k_temporalBatchSize, n - first);
+      m_interp.sample(m_t0, m, vsP + first, out + first);
+      m_interp.sample(m_t1, m, vsP + first, v1);
+      blend(m, t, v1, out + first);
+    }
+  }
+
+  //! Interpolated values at n voxel-space positions, all at time t, 
+  //! following the given velocities. Velocities are in voxels per frame.
+  void sample(size_t n, const V3f *vsP, const V3f *vsVel, double t, 
+              value_type *out) const
+  {
+    const float w0 = static_cast<float>(t), w1 = static_cast<float>(1.0 - t);
+    V3f        p0[detail::k_temporalBatchSize], p1[detail::k_temporalBatchSize];
+    value_type v1[detail::k_temporalBatchSize];
+    for (size_t first = 0; first < n; first += detail::k_temporalBatchSize) {
+      const size_t m = std::min(detail::k_temporalBatchSize, n - first);
+      for (size_t i = 0; i < m; ++i) {
+        p0[i] = vsP[first + i] - vsVel[first + i] * w0;
+        p1[i] = vsP[first + i] + vsVel[first + i] * w1;
+      }
+      m_interp.sample(m_t0, m, p0, out + first);
+      m_interp.sample(m_t1, m, p1, v1);
+      blend(m, t, v1, out + first);
+    }
+  }
+
+  //! The field at t = 0
+  const Field_T& field0() const
+  { return m_t0; }
+  //! The field at t = 1
+  const Field_T& field1() const
+  { return m_t1; }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Blends frame t1's values into frame t0's, in place
+  static void blend(size_t n, double t, const value_type *v1, value_type *v0)
+  {
+    for (size_t i = 0; i < n; ++i) {
+      v0[i] = static_cast<value_type>((1.0 - t) * v0[i] + t * v1[i]);
+    }
+  }
+
+  // Data members --------------------------------------------------------------
+
+  const Field_T &m_t0;
+  const Field_T &m_t1;
+  Interp_T       m_interp;
+
+};
+
+//----------------------------------------------------------------------------//
+// dispatchSampler
+//----------------------------------------------------------------------------//
+
+/*! Calls functor(sampler) with a Sampler for the concrete type of field.
+  Functor_T needs a templated operator() that takes a const Sampler_T &,
+  which is where the inner loop goes. DenseField and SparseField are 
+  recognized.
+  \returns Whether the field was of a recognized type. If not, the functor
+  isn't called and the caller should fall back to the virtual interface.
+*/
+template <class Data_T, class Functor_T>
+bool dispatchSampler(const FieldRes::Ptr &field, Functor_T &functor)
+{
+  if (typename DenseField<Data_T>::Ptr dense = 
+      field_dynamic_cast<DenseField<Data_T> >(field)) {
+    functor(Sampler<DenseField<Data_T> >(*dense));
+    return true;
+  }
+  if (typename SparseField<Data_T>::Ptr sparse = 
+      field_dynamic_cast<SparseField<Data_T> >(field)) {
+    functor(Sampler<SparseField<Data_T> >(*sparse));
+    return true;
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
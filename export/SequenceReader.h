@@ -0,0 +1,510 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*! \file SequenceReader.h
+  \brief Contains the SequenceReader class, which reads the frames of a
+  FileSequence ahead of playback.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SequenceReader_H_
+#define _INCLUDED_Field3D_SequenceReader_H_
+
+//----------------------------------------------------------------------------//
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "Field3DFile.h"
+#include "FileSequence.h"
+#include "Log.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// SequenceReader
+//----------------------------------------------------------------------------//
+
+/*! \class SequenceReader
+  \ingroup file
+  Reads the layers of the frames of a FileSequence, opening and reading the
+  frames that follow the current one on a background thread. 
+
+  Frames are read ahead in the direction of play, which is that of the 
+  last change of frame, and the frames just behind the current one are 
+  kept for scrubbing back. Frames outside of that window are dropped. When
+  the direction changes, the frames queued for reading are cancelled; a 
+  frame that is already being read is finished, and kept if it falls 
+  inside the new window. 
+
+  The memory limit bounds the frames that the reader holds. Frames are 
+  only read ahead while the last frame read would still fit, and the 
+  frames furthest from the current one are dropped first when the limit 
+  is exceeded. The current frame is always kept.
+
+  \code
+  SequenceReader<float> reader(FileSequence("smoke.1-240#.f3d"), "density");
+  reader.setReadAhead(4);
+  for (size_t f = 0; f < reader.size(); ++f) {
+    Field<float>::Vec fields = reader.frame(f);
+    ...
+  }
+  \endcode
+
+  \note The fields returned are shared with the reader, and shouldn't be 
+  modified.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class SequenceReader : boost::noncopyable
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename Field<Data_T>::Vec FieldVec;
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  //! Reads the layers with the given name from each frame, or all of the
+  //! Data_T layers if the name is empty. Nothing is read until the first
+  //! call to frame().
+  SequenceReader(const FileSequence &sequence, 
+                 const std::string &layerName = std::string());
+  //! Cancels the queued reads and waits for the frame being read, if any
+  ~SequenceReader();
+
+  // Main methods --------------------------------------------------------------
+
+  //! Number of frames in the sequence
+  size_t size() const
+  { return m_sequence.size(); }
+
+  //! Sets the number of frames read ahead of the current one. The default 
+  //! is 2.
+  void setReadAhead(const size_t numFrames);
+  //! Sets the number of frames kept behind the current one. The default 
+  //! is 2.
+  void setKeepBehind(const size_t numFrames);
+  //! Sets the number of bytes that the frames held by the reader may use.
+  //! 0, the default, means unlimited.
+  void setMemoryLimit(const long long int bytes);
+
+  //! Returns the layers of the given frame, and makes it the current one.
+  //! A frame that is being read ahead is waited for, and one that isn't 
+  //! held is read on the calling thread.
+  //! \returns An empty vector if the frame is out of range, or couldn't be
+  //! read.
+  FieldVec frame(const size_t idx);
+
+  //! Returns whether the given frame is held, so that frame() returns it
+  //! without reading
+  bool isReady(const size_t idx) const;
+
+  //! Returns the memory used by the frames held, in bytes
+  long long int memSize() const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  struct Frame
+  {
+    FieldVec      fields;
+    long long int memSize;
+  };
+
+  typedef std::map<size_t, Frame> FrameMap;
+
+  // Constants -----------------------------------------------------------------
+
+  //! Index of no frame
+  static const size_t k_noFrame = static_cast<size_t>(-1);
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Opens and reads a frame. Called without the mutex held.
+  Frame readFrame(const size_t idx) const;
+  //! Whether a frame is inside the window around the current one
+  bool inWindow(const size_t idx) const;
+  //! Stores a frame that was read, if it is still wanted
+  void store(const size_t idx, const Frame &frame);
+  //! Drops the frames outside the window, then those furthest from the 
+  //! current frame until the memory limit is met
+  void trim();
+  //! Queues the frames ahead of the current one that aren't held
+  void schedule();
+  //! Main loop of the background thread
+  void workerLoop();
+
+  // Data members --------------------------------------------------------------
+
+  const FileSequence m_sequence;
+  const std::string  m_layerName;
+  size_t             m_readAhead;
+  size_t             m_keepBehind;
+  long long int      m_memoryLimit;
+  //! The frames held
+  FrameMap           m_frames;
+  //! Memory used by m_frames
+  long long int      m_memUse;
+  //! Memory used by the most recently read frame. Used to tell whether the
+  //! next frame will fit.
+  long long int      m_lastFrameSize;
+  //! Frames waiting to be read ahead, in order
+  std::deque<size_t> m_queue;
+  //! Frame the background thread is reading, or k_noFrame
+  size_t             m_reading;
+  //! The current frame, or k_noFrame before the first call to frame()
+  size_t             m_current;
+  //! Direction of play, 1 or -1
+  int                m_direction;
+  //! Set to stop the background thread
+  bool               m_quit;
+  //! Protects all of the above
+  mutable boost::mutex      m_mutex;
+  //! Signaled when frames are queued, or the reader is destroyed
+  boost::condition_variable m_queued;
+  //! Signaled when the background thread is done with a frame
+  boost::condition_variable m_read;
+  //! The background thread. Declared last, so that it starts once the 
+  //! other members are set up
+  boost::thread             m_worker;
+
+};
+
+//----------------------------------------------------------------------------//
+// SequenceReader implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+SequenceReader<Data_T>::SequenceReader(const FileSequence &sequence,
+                                       const std::string &layerName)
+  : m_sequence(sequence), 
+    m_layerName(layerName),
+    m_readAhead(2),
+    m_keepBehind(2),
+    m_memoryLimit(0),
+    m_memUse(0),
+    m_lastFrameSize(0),
+    m_reading(k_noFrame),
+    m_current(k_noFrame),
+    m_direction(1),
+    m_quit(false),
+    m_worker(&SequenceReader::workerLoop, this)
+{ 
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+SequenceReader<Data_T>::~SequenceReader()
+{
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_quit = true;
+    m_queue.clear();
+    m_queued.notify_all();
+  }
+  m_worker.join();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::setReadAhead(const size_t numFrames)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_readAhead = numFrames;
+  trim();
+  schedule();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::setKeepBehind(const size_t numFrames)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_keepBehind = numFrames;
+  trim();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::setMemoryLimit(const long long int bytes)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_memoryLimit = bytes;
+  trim();
+  schedule();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SequenceReader<Data_T>::FieldVec 
+SequenceReader<Data_T>::frame(const size_t idx)
+{
+  if (idx >= m_sequence.size()) {
+    return FieldVec();
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  // A change of direction cancels the frames queued in the old one
+  if (m_current != k_noFrame && idx != m_current) {
+    const int direction = idx > m_current ? 1 : -1;
+    if (direction != m_direction) {
+      m_direction = direction;
+      m_queue.clear();
+    }
+  }
+  m_current = idx;
+  m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), idx), 
+                m_queue.end());
+  trim();
+
+  // Wait for the frame if it's being read ahead
+  while (m_reading == idx) {
+    m_read.wait(lock);
+  }
+
+  typename FrameMap::const_iterator i = m_frames.find(idx);
+  if (i == m_frames.end()) {
+    lock.unlock();
+    const Frame frame = readFrame(idx);
+    lock.lock();
+    store(idx, frame);
+    i = m_frames.find(idx);
+  }
+  const FieldVec fields = i != m_frames.end() ? i->second.fields : FieldVec();
+
+  schedule();
+
+  return fields;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SequenceReader<Data_T>::isReady(const size_t idx) const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return m_frames.find(idx) != m_frames.end();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int SequenceReader<Data_T>::memSize() const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return m_memUse;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SequenceReader<Data_T>::Frame 
+SequenceReader<Data_T>::readFrame(const size_t idx) const
+{
+  Frame frame;
+  frame.memSize = 0;
+  try {
+    Field3DInputFile in;
+    if (in.open(m_sequence.filename(idx))) {
+      frame.fields = in.readLayers<Data_T>(m_layerName);
+    }
+  }
+  catch (const std::exception &e) {
+    Msg::print(Msg::SevWarning, "SequenceReader: Couldn't read " + 
+               m_sequence.filename(idx) + ": " + e.what());
+  }
+  for (size_t i = 0; i < frame.fields.size(); ++i) {
+    frame.memSize += frame.fields[i]->memSize();
+  }
+  return frame;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SequenceReader<Data_T>::inWindow(const size_t idx) const
+{
+  if (m_current == k_noFrame) {
+    return false;
+  }
+  const std::ptrdiff_t ahead = m_direction * 
+    (static_cast<std::ptrdiff_t>(idx) - static_cast<std::ptrdiff_t>(m_current));
+  return ahead >= -static_cast<std::ptrdiff_t>(m_keepBehind) && 
+    ahead <= static_cast<std::ptrdiff_t>(m_readAhead);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::store(const size_t idx, const Frame &frame)
+{
+  m_lastFrameSize = frame.memSize;
+  if (!inWindow(idx) || m_frames.find(idx) != m_frames.end()) {
+    return;
+  }
+  m_frames[idx] = frame;
+  m_memUse += frame.memSize;
+  trim();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::trim()
+{
+  // Frames outside the window
+  for (typename FrameMap::iterator i = m_frames.begin(); 
+       i != m_frames.end(); ) {
+    if (i->first != m_current && !inWindow(i->first)) {
+      m_memUse -= i->second.memSize;
+      m_frames.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+  // Frames furthest from the current one, ahead of it before behind it
+  while (m_memoryLimit > 0 && m_memUse > m_memoryLimit && 
+         m_frames.size() > 1) {
+    typename FrameMap::iterator furthest = m_frames.end();
+    std::ptrdiff_t              distance = 0;
+    for (typename FrameMap::iterator i = m_frames.begin(); 
+         i != m_frames.end(); ++i) {
+      const std::ptrdiff_t ahead = m_direction * 
+        (static_cast<std::ptrdiff_t>(i->first) - 
+         static_cast<std::ptrdiff_t>(m_current));
+      const std::ptrdiff_t d = ahead > 0 ? 2 * ahead : -2 * ahead - 1;
+      if (i->first != m_current && d > distance) {
+        furthest = i;
+        distance = d;
+      }
+    }
+    if (furthest == m_frames.end()) {
+      break;
+    }
+    m_memUse -= furthest->second.memSize;
+    m_frames.erase(furthest);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::schedule()
+{
+  m_queue.clear();
+  if (m_current == k_noFrame) {
+    return;
+  }
+  for (size_t n = 1; n <= m_readAhead; ++n) {
+    const std::ptrdiff_t idx = static_cast<std::ptrdiff_t>(m_current) + 
+      m_direction * static_cast<std::ptrdiff_t>(n);
+    if (idx < 0 || idx >= static_cast<std::ptrdiff_t>(m_sequence.size())) {
+      break;
+    }
+    const size_t frame = static_cast<size_t>(idx);
+    if (frame != m_reading && m_frames.find(frame) == m_frames.end()) {
+      m_queue.push_back(frame);
+    }
+  }
+  if (!m_queue.empty()) {
+    m_queued.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SequenceReader<Data_T>::workerLoop()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (!m_quit) {
+    if (m_queue.empty()) {
+      m_queued.wait(lock);
+      continue;
+    }
+    const size_t idx = m_queue.front();
+    m_queue.pop_front();
+    if (!inWindow(idx) || m_frames.find(idx) != m_frames.end()) {
+      continue;
+    }
+    // Stop reading ahead once another frame wouldn't fit
+    if (m_memoryLimit > 0 && m_memUse + m_lastFrameSize > m_memoryLimit) {
+      m_queue.clear();
+      continue;
+    }
+    m_reading = idx;
+    lock.unlock();
+    const Frame frame = readFrame(idx);
+    lock.lock();
+    m_reading = k_noFrame;
+    store(idx, frame);
+    m_read.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,485 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseAtlas.h
+  \brief Contains the SparseAtlas class and makeSparseAtlases().
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseAtlas_H_
+#define _INCLUDED_Field3D_SparseAtlas_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "MIPField.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// SparseAtlas
+//----------------------------------------------------------------------------//
+
+/*! \class SparseAtlas
+  \ingroup field
+  \brief The allocated blocks of a SparseField, packed into a single 3D 
+  array of bricks, with an indirection table.
+
+  Each allocated block becomes a brick of blockSize() + 2 * padding() 
+  voxels per side. The padding holds the neighboring voxels of the field,
+  clamped to the data window, so that a brick may be filtered trilinearly
+  on its own. The bricks are laid out on a grid of brickRes() bricks, which
+  makes the voxels() ready for upload as a single 3D texture, x varying 
+  fastest.
+
+  The indirection table holds, for each block, x varying fastest, the 
+  index of its brick, or k_noBrick if the block is unallocated. The 
+  value of such blocks is in emptyValues().
+
+  \note The atlas is a copy. It doesn't track changes to the field.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class SparseAtlas : boost::noncopyable
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_ptr<SparseAtlas> Ptr;
+  typedef std::vector<Ptr>               Vec;
+
+  // Constants -----------------------------------------------------------------
+
+  //! Indirection entry of unallocated blocks
+  enum { k_noBrick = -1 };
+
+  // Constructors --------------------------------------------------------------
+
+  //! Creates an empty atlas. Used when reading atlases back from a file.
+  SparseAtlas()
+    : m_blockOrder(0), m_padding(0), m_brickRes(0)
+  { }
+
+  //! Packs the allocated blocks of the field, on numIOThreads() threads
+  SparseAtlas(const SparseField<Data_T> &field, const int padding = 1);
+
+  // Main methods --------------------------------------------------------------
+
+  //! Sets up the atlas from its parts, swapping out the contents of the
+  //! vectors.
+  //! \returns False, leaving the atlas untouched, if the sizes of the 
+  //! parts don't agree with each other.
+  bool setData(const Box3i &dataWindow, const int blockOrder, 
+               const int padding, const V3i &brickRes,
+               std::vector<int> &indirection, 
+               std::vector<Data_T> &emptyValues,
+               std::vector<Data_T> &voxels);
+
+  //! Looks up a voxel of the field through the indirection table, as a GPU
+  //! reader would. Voxels outside the data window are clamped to it.
+  Data_T value(int i, int j, int k) const;
+
+  //! Returns the memory use of the atlas in bytes
+  long long int memSize() const;
+
+  // Accessors -----------------------------------------------------------------
+
+  //! Data window of the field the atlas was made from
+  const Box3i& dataWindow() const
+  { return m_dataWindow; }
+  //! Block order of the field
+  int blockOrder() const
+  { return m_blockOrder; }
+  //! Block size of the field
+  int blockSize() const
+  { return 1 << m_blockOrder; }
+  //! Number of blocks of the field along each axis
+  V3i blockRes() const;
+  //! Number of padding voxels on each side of a brick
+  int padding() const
+  { return m_padding; }
+  //! Number of voxels per side of a brick
+  int brickSize() const
+  { return blockSize() + 2 * m_padding; }
+  //! Number of bricks along each axis of the atlas
+  const V3i& brickRes() const
+  { return m_brickRes; }
+  //! Number of voxels along each axis of the atlas
+  V3i resolution() const
+  { return m_brickRes * brickSize(); }
+  //! Number of bricks, i.e. of allocated blocks
+  size_t numBricks() const;
+  //! Brick index of each block, or k_noBrick
+  const std::vector<int>& indirection() const
+  { return m_indirection; }
+  //! Value of each block that has no brick
+  const std::vector<Data_T>& emptyValues() const
+  { return m_emptyValues; }
+  //! Voxels of the atlas, x varying fastest
+  const std::vector<Data_T>& voxels() const
+  { return m_voxels; }
+  //! Atlas coordinates of the first voxel of a brick, padding included
+  V3i brickOrigin(const int brick) const;
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  Box3i               m_dataWindow;
+  int                 m_blockOrder;
+  int                 m_padding;
+  V3i                 m_brickRes;
+  std::vector<int>    m_indirection;
+  std::vector<Data_T> m_emptyValues;
+  std::vector<Data_T> m_voxels;
+
+};
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Packs each level of a MIP field into an atlas, finest first. The levels
+//! are loaded, or filtered, one at a time.
+template <typename Data_T>
+typename SparseAtlas<Data_T>::Vec
+makeSparseAtlases(const MIPField<SparseField<Data_T> > &mip, 
+                  const int padding = 1);
+
+//----------------------------------------------------------------------------//
+// Implementation details
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Number of bricks along each axis of an atlas of numBricks bricks. The
+  //! grid is kept close to a cube.
+  inline V3i atlasBrickRes(const size_t numBricks)
+  {
+    if (numBricks == 0) {
+      return V3i(0);
+    }
+    const int x = static_cast<int>
+      (std::ceil(std::pow(static_cast<double>(numBricks), 1.0 / 3.0)));
+    const size_t perSlice = (numBricks + x - 1) / x;
+    const int y = static_cast<int>
+      (std::ceil(std::sqrt(static_cast<double>(perSlice))));
+    const int z = static_cast<int>((numBricks + x * y - 1) / (x * y));
+    return V3i(x, y, z);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies an allocated block, with its padding, into its brick. Used by
+  //! the SparseAtlas constructor.
+  template <typename Data_T>
+  struct FillBrickOp
+  {
+    FillBrickOp(const SparseField<Data_T> &field, 
+                const std::vector<int> &blocks, const V3i &brickRes, 
+                const int padding, Data_T *voxels)
+      : m_field(field), m_blocks(blocks), m_brickRes(brickRes), 
+        m_padding(padding), m_voxels(voxels)
+    { }
+    void operator() (const size_t brick)
+    {
+      const int   blockOrder = m_field.blockOrder();
+      const int   blockSize  = 1 << blockOrder;
+      const int   brickSize  = blockSize + 2 * m_padding;
+      const V3i   blockRes   = m_field.blockRes();
+      const Box3i &dw        = m_field.dataWindow();
+      const int   b          = m_blocks[brick];
+      const V3i   blockIdx(b % blockRes.x, (b / blockRes.x) % blockRes.y,
+                           b / blockRes.x / blockRes.y);
+      const V3i   valid = Sparse::validBlockSize(m_field.dataResolution(), 
+                                                 blockOrder, blockIdx);
+      const bool  isMorton = 
+        m_field.blockLayout() == Sparse::BlockLayoutMorton;
+      // Keep the block in memory while it's copied
+      const bool isDynamicLoad = m_field.isDynamicLoad();
+      if (isDynamicLoad) {
+        m_field.incBlockRef(b);
+        m_field.activateBlock(b);
+      }
+      const Data_T *data = m_field.blockData(blockIdx.x, blockIdx.y, 
+                                             blockIdx.z);
+      // Where the brick goes
+      const V3i    res(m_brickRes * brickSize);
+      const V3i    origin(brick % m_brickRes.x * brickSize, 
+                          brick / m_brickRes.x % m_brickRes.y * brickSize,
+                          brick / m_brickRes.x / m_brickRes.y * brickSize);
+      // Block voxel coordinates of the first voxel of the brick
+      const V3i    start(-m_padding);
+      for (int k = 0; k < brickSize; ++k) {
+        const int vk = start.z + k;
+        const int fk = std::min(std::max(dw.min.z + blockIdx.z * blockSize + 
+                                         vk, dw.min.z), dw.max.z);
+        for (int j = 0; j < brickSize; ++j) {
+          const int vj = start.y + j;
+          const int fj = std::min(std::max(dw.min.y + blockIdx.y * blockSize +
+                                           vj, dw.min.y), dw.max.y);
+          Data_T *out = m_voxels + origin.x + 
+            res.x * (origin.y + j + res.y * static_cast<size_t>(origin.z + k));
+          const bool rowInBlock = data && vj >= 0 && vj < valid.y && 
+            vk >= 0 && vk < valid.z;
+          for (int i = 0; i < brickSize; ++i) {
+            const int vi = start.x + i;
+            if (rowInBlock && vi >= 0 && vi < valid.x) {
+              out[i] = isMorton ? 
+                data[Sparse::MortonBlockIndex::index(vi, vj, vk, blockOrder)] :
+                data[Sparse::LinearBlockIndex::index(vi, vj, vk, blockOrder)];
+            } else {
+              // Padding, and the part of the block outside the data window
+              const int fi = 
+                std::min(std::max(dw.min.x + blockIdx.x * blockSize + vi, 
+                                  dw.min.x), dw.max.x);
+              out[i] = m_field.fastValue(fi, fj, fk);
+            }
+          }
+        }
+      }
+      if (isDynamicLoad) {
+        m_field.decBlockRef(b);
+      }
+    }
+  private:
+    const SparseField<Data_T> &m_field;
+    const std::vector<int>    &m_blocks;
+    const V3i                  m_brickRes;
+    const int                  m_padding;
+    Data_T                    *m_voxels;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// SparseAtlas implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+SparseAtlas<Data_T>::SparseAtlas(const SparseField<Data_T> &field, 
+                                 const int padding)
+  : m_dataWindow(field.dataWindow()), m_blockOrder(field.blockOrder()), 
+    m_padding(std::max(padding, 0))
+{
+  // Assign bricks to the allocated blocks, in block order
+  const V3i blockRes = field.blockRes();
+  std::vector<int> blocks;
+  m_indirection.resize(static_cast<size_t>(blockRes.x) * blockRes.y * 
+                       blockRes.z, k_noBrick);
+  m_emptyValues.resize(m_indirection.size());
+  for (int k = 0, b = 0; k < blockRes.z; ++k) {
+    for (int j = 0; j < blockRes.y; ++j) {
+      for (int i = 0; i < blockRes.x; ++i, ++b) {
+        if (field.blockIsAllocated(i, j, k)) {
+          m_indirection[b] = static_cast<int>(blocks.size());
+          blocks.push_back(b);
+        } 
+        m_emptyValues[b] = field.getBlockEmptyValue(i, j, k);
+      }
+    }
+  }
+
+  // Fill in the bricks
+  m_brickRes = detail::atlasBrickRes(blocks.size());
+  const V3i res = resolution();
+  // Bricks past the last one are zero
+  m_voxels.resize(static_cast<size_t>(res.x) * res.y * res.z, 
+                  static_cast<Data_T>(0));
+  if (!blocks.empty()) {
+    Sparse::runBlockOp(detail::FillBrickOp<Data_T>(field, blocks, m_brickRes,
+                                                   m_padding, &m_voxels[0]),
+                       blocks.size());
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SparseAtlas<Data_T>::setData(const Box3i &dataWindow, 
+                                  const int blockOrder, const int padding, 
+                                  const V3i &brickRes,
+                                  std::vector<int> &indirection, 
+                                  std::vector<Data_T> &emptyValues,
+                                  std::vector<Data_T> &voxels)
+{
+  if (dataWindow.isEmpty() || blockOrder < 0 || padding < 0 ||
+      brickRes.x < 0 || brickRes.y < 0 || brickRes.z < 0) {
+    return false;
+  }
+  const int  blockSize = 1 << blockOrder;
+  const V3i  dataRes   = dataWindow.size() + V3i(1);
+  const V3i  blocks((dataRes.x + blockSize - 1) >> blockOrder,
+                    (dataRes.y + blockSize - 1) >> blockOrder,
+                    (dataRes.z + blockSize - 1) >> blockOrder);
+  const V3i  res       = brickRes * (blockSize + 2 * padding);
+  const size_t numBlocks = static_cast<size_t>(blocks.x) * blocks.y * blocks.z;
+  if (indirection.size() != numBlocks || emptyValues.size() != numBlocks ||
+      voxels.size() != static_cast<size_t>(res.x) * res.y * res.z) {
+    return false;
+  }
+  const int maxBrick = brickRes.x * brickRes.y * brickRes.z;
+  for (size_t i = 0; i < indirection.size(); ++i) {
+    if (indirection[i] < k_noBrick || indirection[i] >= maxBrick) {
+      return false;
+    }
+  }
+  m_dataWindow = dataWindow;
+  m_blockOrder = blockOrder;
+  m_padding    = padding;
+  m_brickRes   = brickRes;
+  m_indirection.swap(indirection);
+  m_emptyValues.swap(emptyValues);
+  m_voxels.swap(voxels);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+Data_T SparseAtlas<Data_T>::value(int i, int j, int k) const
+{
+  i = std::min(std::max(i, m_dataWindow.min.x), m_dataWindow.max.x) - 
+    m_dataWindow.min.x;
+  j = std::min(std::max(j, m_dataWindow.min.y), m_dataWindow.max.y) - 
+    m_dataWindow.min.y;
+  k = std::min(std::max(k, m_dataWindow.min.z), m_dataWindow.max.z) - 
+    m_dataWindow.min.z;
+  const V3i blocks = blockRes();
+  const size_t block = (i >> m_blockOrder) + blocks.x * 
+    ((j >> m_blockOrder) + blocks.y * static_cast<size_t>(k >> m_blockOrder));
+  const int brick = m_indirection[block];
+  if (brick == k_noBrick) {
+    return m_emptyValues[block];
+  }
+  const int mask = blockSize() - 1;
+  const V3i p = brickOrigin(brick) + 
+    V3i((i & mask) + m_padding, (j & mask) + m_padding, (k & mask) + m_padding);
+  const V3i res = resolution();
+  return m_voxels[p.x + res.x * (p.y + res.y * static_cast<size_t>(p.z))];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int SparseAtlas<Data_T>::memSize() const
+{
+  return sizeof(*this) + m_indirection.capacity() * sizeof(int) + 
+    (m_emptyValues.capacity() + m_voxels.capacity()) * sizeof(Data_T);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3i SparseAtlas<Data_T>::blockRes() const
+{
+  if (m_dataWindow.isEmpty()) {
+    return V3i(0);
+  }
+  const V3i dataRes = m_dataWindow.size() + V3i(1);
+  const int mask    = blockSize() - 1;
+  return V3i((dataRes.x + mask) >> m_blockOrder,
+             (dataRes.y + mask) >> m_blockOrder,
+             (dataRes.z + mask) >> m_blockOrder);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+size_t SparseAtlas<Data_T>::numBricks() const
+{
+  return m_indirection.size() - 
+    std::count(m_indirection.begin(), m_indirection.end(), 
+               static_cast<int>(k_noBrick));
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3i SparseAtlas<Data_T>::brickOrigin(const int brick) const
+{
+  const int size = brickSize();
+  return V3i(brick % m_brickRes.x * size,
+             brick / m_brickRes.x % m_brickRes.y * size,
+             brick / m_brickRes.x / m_brickRes.y * size);
+}
+
+//----------------------------------------------------------------------------//
+// Utility function implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SparseAtlas<Data_T>::Vec
+makeSparseAtlases(const MIPField<SparseField<Data_T> > &mip, 
+                  const int padding)
+{
+  typename SparseAtlas<Data_T>::Vec atlases;
+  for (size_t level = 0; level < mip.numLevels(); ++level) {
+    typename SparseField<Data_T>::Ptr field = mip.concreteMipLevel(level);
+    if (!field) {
+      return typename SparseAtlas<Data_T>::Vec();
+    }
+    atlases.push_back(typename SparseAtlas<Data_T>::Ptr
+                      (new SparseAtlas<Data_T>(*field, padding)));
+  }
+  return atlases;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,332 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseConvert.h
+  \brief Contains functions for converting between dense and sparse fields.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseConvert_H_
+#define _INCLUDED_Field3D_SparseConvert_H_
+
+#include <algorithm>
+
+#include "DenseField.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Converts a dense field to a sparse field with the same extents, data 
+//! window, mapping and metadata. Blocks whose voxels are all within 
+//! tolerance of emptyValue are left unallocated.
+//! \note Runs on numIOThreads() threads, one block at a time. Each block is
+//! checked for emptiness before anything is allocated for it.
+template <class Data_T>
+typename SparseField<Data_T>::Ptr
+denseToSparse(const DenseField<Data_T> &dense, const Data_T &emptyValue,
+              const double tolerance = 0.0, 
+              const int blockOrder = BLOCK_ORDER);
+
+//! Converts a sparse field to a dense field with the same extents, data 
+//! window, mapping and metadata.
+//! \note Runs on numIOThreads() threads, one block of the sparse field at a 
+//! time. Unallocated blocks are filled from their empty value.
+template <class Data_T>
+typename DenseField<Data_T>::Ptr
+sparseToDense(const SparseField<Data_T> &sparse);
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the block coordinate of the given block index
+  inline V3i blockCoord(const size_t idx, const V3i &blockRes)
+  {
+    const size_t bi = idx % blockRes.x;
+    const size_t bj = (idx / blockRes.x) % blockRes.y;
+    const size_t bk = idx / (static_cast<size_t>(blockRes.x) * blockRes.y);
+    return V3i(bi, bj, bk);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns true if all n values of row equal value. The loop has no early
+  //! exit so that the compiler may vectorize it.
+  template <class Data_T>
+  bool rowIsUniform(const Data_T *row, const int n, const Data_T &value)
+  {
+    bool same = true;
+    for (int i = 0; i < n; ++i) {
+      same &= (row[i] == value);
+    }
+    return same;
+  }
+
+  //! Returns true if all n values of row are within tolerance of value
+  template <class Data_T>
+  bool rowIsUniform(const Data_T *row, const int n, const Data_T &value,
+                    const double tolerance)
+  {
+    bool same = true;
+    for (int i = 0; i < n; ++i) {
+      same &= Sparse::isWithinTolerance(row[i], value, tolerance);
+    }
+    return same;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies one block of a dense field into a sparse field
+  template <class Data_T>
+  class DenseToSparseBlockOp
+  {
+  public:
+    DenseToSparseBlockOp(const DenseField<Data_T> &dense, 
+                         SparseField<Data_T> &sparse, 
+                         const Data_T &emptyValue, const double tolerance)
+      : m_dense(dense), m_sparse(sparse), m_emptyValue(emptyValue), 
+        m_tolerance(tolerance)
+    { }
+    void operator() (const size_t idx) const
+    {
+      const Box3i               dw        = m_sparse.dataWindow();
+      const V3i                 dataRes   = dw.size() + V3i(1);
+      const int                 order     = m_sparse.blockOrder();
+      const Sparse::BlockLayout layout    = m_sparse.blockLayout();
+      const V3i                 blockIdx  = 
+        blockCoord(idx, m_sparse.blockRes());
+      const V3i                 first     = 
+        dw.min + blockIdx * m_sparse.blockSize();
+      const V3i                 size      = 
+        Sparse::validBlockSize(dataRes, order, blockIdx);
+      const int                 xOffset   = first.x - dw.min.x;
+
+      // Check for an empty block. Rows are tested whole, and the scan stops
+      // at the first row that differs.
+      bool isEmpty = true;
+      for (int k = first.z; isEmpty && k < first.z + size.z; ++k) {
+        for (int j = first.y; isEmpty && j < first.y + size.y; ++j) {
+          const Data_T *row = m_dense.rowPtr(j, k) + xOffset;
+          isEmpty = m_tolerance > 0.0 ? 
+            rowIsUniform(row, size.x, m_emptyValue, m_tolerance) :
+            rowIsUniform(row, size.x, m_emptyValue);
+        }
+      }
+      m_sparse.setBlockEmptyValue(blockIdx.x, blockIdx.y, blockIdx.z, 
+                                  m_emptyValue);
+      if (isEmpty) {
+        return;
+      }
+
+      // Allocate the block and write it directly
+      m_sparse.fastLValue(first.x, first.y, first.z) = m_emptyValue;
+      Data_T *p = m_sparse.blockData(blockIdx.x, blockIdx.y, blockIdx.z);
+      for (int k = 0; k < size.z; ++k) {
+        for (int j = 0; j < size.y; ++j) {
+          const Data_T *row = m_dense.rowPtr(first.y + j, first.z + k) + 
+            xOffset;
+          if (layout == Sparse::BlockLayoutLinear) {
+            std::copy(row, row + size.x, 
+                      p + Sparse::blockIndex(0, j, k, order, layout));
+          } else {
+            for (int i = 0; i < size.x; ++i) {
+              p[Sparse::blockIndex(i, j, k, order, layout)] = row[i];
+            }
+          }
+        }
+      }
+    }
+  private:
+    const DenseField<Data_T> &m_dense;
+    SparseField<Data_T>      &m_sparse;
+    const Data_T              m_emptyValue;
+    const double              m_tolerance;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies one block of a sparse field into a dense field
+  template <class Data_T>
+  class SparseToDenseBlockOp
+  {
+  public:
+    SparseToDenseBlockOp(const SparseField<Data_T> &sparse, 
+                         DenseField<Data_T> &dense)
+      : m_sparse(sparse), m_dense(dense)
+    { }
+    void operator() (const size_t idx) const
+    {
+      const Box3i               dw        = m_sparse.dataWindow();
+      const V3i                 dataRes   = dw.size() + V3i(1);
+      const int                 order     = m_sparse.blockOrder();
+      const Sparse::BlockLayout layout    = m_sparse.blockLayout();
+      const V3i                 blockIdx  = 
+        blockCoord(idx, m_sparse.blockRes());
+      const V3i                 first     = 
+        dw.min + blockIdx * m_sparse.blockSize();
+      const V3i                 size      = 
+        Sparse::validBlockSize(dataRes, order, blockIdx);
+      const int                 xOffset   = first.x - dw.min.x;
+
+      // Dynamically loaded blocks go through the field's own cache
+      if (m_sparse.isDynamicLoad()) {
+        for (int k = first.z; k < first.z + size.z; ++k) {
+          for (int j = first.y; j < first.y + size.y; ++j) {
+            Data_T *row = m_dense.rowPtr(j, k) + xOffset;
+            for (int i = 0; i < size.x; ++i) {
+              row[i] = m_sparse.fastValue(first.x + i, j, k);
+            }
+          }
+        }
+        return;
+      }
+
+      // Unallocated blocks are filled with their empty value
+      if (!m_sparse.blockIsAllocated(blockIdx.x, blockIdx.y, blockIdx.z)) {
+        const Data_T value = 
+          m_sparse.getBlockEmptyValue(blockIdx.x, blockIdx.y, blockIdx.z);
+        for (int k = first.z; k < first.z + size.z; ++k) {
+          for (int j = first.y; j < first.y + size.y; ++j) {
+            std::fill_n(m_dense.rowPtr(j, k) + xOffset, size.x, value);
+          }
+        }
+        return;
+      }
+
+      // Allocated blocks are read directly
+      const Data_T *p = 
+        m_sparse.blockData(blockIdx.x, blockIdx.y, blockIdx.z);
+      for (int k = 0; k < size.z; ++k) {
+        for (int j = 0; j < size.y; ++j) {
+          Data_T *row = m_dense.rowPtr(first.y + j, first.z + k) + xOffset;
+          if (layout == Sparse::BlockLayoutLinear) {
+            const Data_T *src = p + Sparse::blockIndex(0, j, k, order, layout);
+            std::copy(src, src + size.x, row);
+          } else {
+            for (int i = 0; i < size.x; ++i) {
+              row[i] = p[Sparse::blockIndex(i, j, k, order, layout)];
+            }
+          }
+        }
+      }
+    }
+  private:
+    const SparseField<Data_T> &m_sparse;
+    DenseField<Data_T>        &m_dense;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies name, attribute, mapping and metadata from src to dst
+  template <class Src_T, class Dst_T>
+  void copyFieldDefinition(const Src_T &src, Dst_T &dst)
+  {
+    dst.name      = src.name;
+    dst.attribute = src.attribute;
+    dst.setMapping(src.mapping());
+    dst.copyMetadata(src);
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseField<Data_T>::Ptr
+denseToSparse(const DenseField<Data_T> &dense, const Data_T &emptyValue,
+              const double tolerance, const int blockOrder)
+{
+  typedef SparseField<Data_T> SparseType;
+
+  typename SparseType::Ptr sparse(new SparseType);
+  sparse->setBlockOrder(blockOrder);
+  sparse->setSize(dense.extents(), dense.dataWindow());
+  detail::copyFieldDefinition(dense, *sparse);
+
+  const V3i br = sparse->blockRes();
+  Sparse::runBlockOp(detail::DenseToSparseBlockOp<Data_T>(dense, *sparse, 
+                                                          emptyValue, 
+                                                          tolerance),
+                     static_cast<size_t>(br.x) * br.y * br.z);
+
+  return sparse;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename DenseField<Data_T>::Ptr
+sparseToDense(const SparseField<Data_T> &sparse)
+{
+  typedef DenseField<Data_T> DenseType;
+
+  typename DenseType::Ptr dense(new DenseType);
+  dense->setSize(sparse.extents(), sparse.dataWindow());
+  detail::copyFieldDefinition(sparse, *dense);
+
+  const V3i br = sparse.blockRes();
+  Sparse::runBlockOp(detail::SparseToDenseBlockOp<Data_T>(sparse, *dense),
+                     static_cast<size_t>(br.x) * br.y * br.z);
+
+  return dense;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -47,7 +47,6 @@
 //----------------------------------------------------------------------------//
 
 #include <hdf5.h>
-#include <string.h> // for memcpy
 
 #include "Hdf5Util.h"
 #include "Log.h"
@@ -233,61 +232,35 @@ void SparseDataReader<Data_T>::readBlockList
   hsize_t count[2];
   herr_t status;
 
-  offset[0] = idxLo;            // Index of block
-  offset[1] = 0;                // Index of first data in block. Always 0
-  count[0] = memoryList.size(); // Number of columns to read.
-  count[1] = m_valuesPerBlock;  // Number of values in one column
-  
-  status = H5Sselect_hyperslab(fileDataSpace.id(), H5S_SELECT_SET, 
-                               offset, NULL, count, NULL);
-  if (status < 0) {
-    throw ReadHyperSlabException("Couldn't select slab in readBlockList():" + 
-                                 boost::lexical_cast<std::string>(idxLo));
-  }
-
-  // Make the memory data space ---
- 
-  Hdf5Util::H5ScopedScreate localMemDataSpace;
-  hsize_t fileDims[2];  
-  fileDims[0] = memoryList.size();
-  fileDims[1] = m_valuesPerBlock;
-  localMemDataSpace.create(H5S_SIMPLE);
-  H5Sset_extent_simple(localMemDataSpace.id(), 2, fileDims, NULL);
-
-  // Setup the temporary memory region ---
-
-  int bytesPerValue = 0;
-  {
-    hid_t t = DataTypeTraits<Data_T>::h5type();
-    if (t == H5T_NATIVE_CHAR)
-      bytesPerValue = 1;
-    else if (t == H5T_NATIVE_SHORT)
-      bytesPerValue = 2;
-    else if (t == H5T_NATIVE_FLOAT)
-      bytesPerValue = 4;
-    else if (t == H5T_NATIVE_DOUBLE)
-      bytesPerValue = 8;
-  }
-
-  int dim = sizeof(Data_T) / bytesPerValue;
-  std::vector<Data_T> bigblock(memoryList.size() * m_valuesPerBlock/dim);
+  count[0] = 1;                // Number of columns to read. Always 1
+  count[1] = m_valuesPerBlock; // Number of values in one column
 
-  status = H5Dread(dataSet.id(), 
-                   DataTypeTraits<Data_T>::h5type(), 
-                   localMemDataSpace.id(),
-                   fileDataSpace.id(), 
-                   H5P_DEFAULT, &bigblock[0]);
+  // Each block is read straight into its own memory, rather than into a 
+  // temporary buffer that then gets copied out
+  for (size_t i = 0; i < memoryList.size(); ++i) {
 
-  if (status < 0) {
-    throw Hdf5DataReadException("Couldn't read slab " + 
-                                boost::lexical_cast<std::string>(idxLo));
-  }
+    offset[0] = idxLo + i;     // Index of block
+    offset[1] = 0;             // Index of first data in block. Always 0
+
+    status = H5Sselect_hyperslab(fileDataSpace.id(), H5S_SELECT_SET, 
+                                 offset, NULL, count, NULL);
+    if (status < 0) {
+      throw ReadHyperSlabException("Couldn't select slab in readBlockList():" 
+                                   + boost::lexical_cast<std::string>
+                                   (idxLo + i));
+    }
+
+    status = H5Dread(dataSet.id(), 
+                     DataTypeTraits<Data_T>::h5type(), 
+                     memDataSpace.id(),
+                     fileDataSpace.id(), 
+                     H5P_DEFAULT, memoryList[i]);
+    if (status < 0) {
+      throw Hdf5DataReadException("Couldn't read slab " + 
+                                  boost::lexical_cast<std::string>
+                                  (idxLo + i));
+    }
 
-  // Distribute block data into memory slots ---
-  for (size_t i = 0; i < memoryList.size(); ++i) {
-    memcpy(memoryList[i], 
-           &bigblock[i * m_valuesPerBlock / dim],
-           bytesPerValue * m_valuesPerBlock);
   }
 }
 
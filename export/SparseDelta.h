@@ -0,0 +1,528 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*! \file SparseDelta.h
+  \brief Contains the temporal delta encoding of SparseField sequences.
+
+  A delta frame stores each voxel of a SparseField XORed, bit for bit, with
+  the same voxel of a keyframe. Voxels that didn't change become zero, so
+  blocks that didn't change at all are written as constant tiles that take
+  no space on disk, and the rest compress much better. The keyframe's 
+  filename is recorded in the metadata of the delta layer.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseDelta_H_
+#define _INCLUDED_Field3D_SparseDelta_H_
+
+//----------------------------------------------------------------------------//
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+
+#include "Field3DFile.h"
+#include "FileSequence.h"
+#include "InitIO.h"
+#include "Log.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+
+//! Name of the string metadata that holds the keyframe of a delta layer.
+//! Empty or missing on keyframes.
+const char * const k_sparseDeltaKeyframeStr = "sparse_delta_keyframe";
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Returns a field whose voxels are the bitwise XOR of those of a and b. 
+//! This encodes a frame against its keyframe and, since XOR is its own 
+//! inverse, decodes it again. The result takes its mapping, name, attribute
+//! and metadata from a.
+//! \returns Null if the fields differ in data window, block order or block
+//! layout, or if either is dynamically loaded.
+template <typename Data_T>
+typename SparseField<Data_T>::Ptr
+sparseDelta(const SparseField<Data_T> &a, const SparseField<Data_T> &b);
+
+//----------------------------------------------------------------------------//
+// SparseDeltaWriter
+//----------------------------------------------------------------------------//
+
+/*! \class SparseDeltaWriter
+  \ingroup file
+  Writes the scalar SparseField layers of a FileSequence with a keyframe 
+  every keyInterval frames. The frames in between are written as deltas
+  against the most recent keyframe of their layer, which the writer keeps
+  a copy of. Frames are expected to be written in order.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class SparseDeltaWriter
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename SparseField<Data_T>::Ptr FieldPtr;
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! A keyInterval of 1 or less writes every frame as a keyframe
+  SparseDeltaWriter(const FileSequence &sequence, const size_t keyInterval)
+    : m_sequence(sequence), m_keyInterval(std::max(keyInterval, size_t(1)))
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns whether the given frame is meant to be a keyframe
+  bool isKeyframe(const size_t frame) const
+  { return frame % m_keyInterval == 0; }
+
+  //! Writes field as the given layer of a frame into out, which is expected
+  //! to have been created for the frame's filename in the sequence. The 
+  //! layer is written as a keyframe if its keyframe wasn't written by this
+  //! writer, or if the field's layout doesn't match it. Quantized blocks
+  //! don't survive the delta, so with setSparseQuantizeBits() every frame
+  //! is written as a keyframe.
+  //! \returns Whether the layer was written
+  bool writeLayer(Field3DOutputFile &out, const size_t frame, 
+                  const std::string &partition, const std::string &layer,
+                  FieldPtr field);
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the keyframe's filename, as recorded in the frame's file. It's
+  //! relative to the frame's directory if the two share it.
+  std::string keyframePath(const size_t frame, const size_t keyframe) const;
+
+  // Typedefs ------------------------------------------------------------------
+
+  struct Keyframe
+  {
+    size_t   frame;
+    FieldPtr field;
+  };
+
+  //! Most recent keyframe of each layer, by partition/layer
+  typedef std::map<std::string, Keyframe> KeyframeMap;
+
+  // Data members --------------------------------------------------------------
+
+  FileSequence m_sequence;
+  size_t       m_keyInterval;
+  KeyframeMap  m_keyframes;
+
+};
+
+//----------------------------------------------------------------------------//
+// SparseDeltaReader
+//----------------------------------------------------------------------------//
+
+/*! \class SparseDeltaReader
+  \ingroup file
+  Reads scalar SparseField layers written by SparseDeltaWriter, resolving
+  each delta through the chain of keyframes it refers to. The most recently
+  decoded frames are kept, so that playing back consecutive frames reads
+  each keyframe only once.
+  \note Delta frames can't be decoded while SparseFileManager does dynamic
+  loading, since the blocks of both frames need to be in memory.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class SparseDeltaReader
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef typename SparseField<Data_T>::Ptr FieldPtr;
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! cacheSize is the number of decoded layers that are kept
+  SparseDeltaReader(const size_t cacheSize = 4)
+    : m_cacheSize(cacheSize)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Reads the given layer, decoding it if it was written as a delta. 
+  //! The result is shared with the reader's cache and shouldn't be 
+  //! modified.
+  //! \returns Null if the layer, or a keyframe it depends on, couldn't be 
+  //! read or decoded.
+  FieldPtr read(const std::string &filename, const std::string &partition,
+                const std::string &layer);
+
+  //! Drops all the decoded layers
+  void clear();
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Reads a layer, following at most k_maxChainLength keyframes
+  FieldPtr readChain(const std::string &filename, const std::string &partition,
+                     const std::string &layer, const int depth);
+  //! Returns the cached layer, if any, and marks it as recently used
+  FieldPtr cached(const std::string &filename, const std::string &layerPath);
+  //! Adds a layer to the cache, dropping the least recently used one if full
+  void cache(const std::string &filename, const std::string &layerPath,
+             FieldPtr field);
+
+  // Typedefs ------------------------------------------------------------------
+
+  struct Entry
+  {
+    std::string filename;
+    std::string layerPath;
+    FieldPtr    field;
+  };
+
+  // Constants -----------------------------------------------------------------
+
+  //! Keyframe chains longer than this are assumed to be cyclic
+  static const int k_maxChainLength = 64;
+
+  // Data members --------------------------------------------------------------
+
+  //! Decoded layers, most recently used first
+  std::list<Entry> m_recent;
+  size_t           m_cacheSize;
+  boost::mutex     m_mutex;
+
+};
+
+//----------------------------------------------------------------------------//
+// Implementation details
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //! Bitwise XOR of two values
+  template <typename Data_T>
+  inline Data_T xorBits(const Data_T &a, const Data_T &b)
+  {
+    Data_T result;
+    const unsigned char *pa = reinterpret_cast<const unsigned char *>(&a);
+    const unsigned char *pb = reinterpret_cast<const unsigned char *>(&b);
+    unsigned char       *pr = reinterpret_cast<unsigned char *>(&result);
+    for (size_t i = 0; i < sizeof(Data_T); ++i) {
+      pr[i] = pa[i] ^ pb[i];
+    }
+    return result;
+  }
+
+  //! Returns the directory of a path, including the trailing slash
+  inline std::string sparseDeltaDir(const std::string &path)
+  {
+    const size_t slash = path.rfind('/');
+    return slash == std::string::npos ? std::string() : 
+      path.substr(0, slash + 1);
+  }
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SparseField<Data_T>::Ptr
+sparseDelta(const SparseField<Data_T> &a, const SparseField<Data_T> &b)
+{
+  typedef typename SparseField<Data_T>::Ptr FieldPtr;
+
+  if (a.dataWindow() != b.dataWindow() || 
+      a.blockOrder() != b.blockOrder() ||
+      a.blockLayout() != b.blockLayout() ||
+      a.isDynamicLoad() || b.isDynamicLoad()) {
+    return FieldPtr();
+  }
+
+  FieldPtr result(new SparseField<Data_T>);
+  result->name      = a.name;
+  result->attribute = a.attribute;
+  result->setMapping(a.mapping());
+  result->copyMetadata(a);
+  result->setBlockOrder(a.blockOrder());
+  result->setSize(a.extents(), a.dataWindow());
+  result->setBlockLayout(a.blockLayout());
+
+  const V3i    blockRes  = a.blockRes();
+  const int    blockSize = a.blockSize();
+  const size_t numVoxels = 
+    static_cast<size_t>(blockSize) * blockSize * blockSize;
+  const V3i    origin    = a.dataWindow().min;
+
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        const Data_T *pa = a.blockData(bi, bj, bk);
+        const Data_T *pb = b.blockData(bi, bj, bk);
+        const Data_T  ea = a.getBlockEmptyValue(bi, bj, bk);
+        const Data_T  eb = b.getBlockEmptyValue(bi, bj, bk);
+        if (!pa && !pb) {
+          result->setBlockEmptyValue(bi, bj, bk, detail::xorBits(ea, eb));
+          continue;
+        }
+        // Writing to the block's first voxel allocates it
+        result->fastLValue(origin.x + bi * blockSize, 
+                           origin.y + bj * blockSize,
+                           origin.z + bk * blockSize) = ea;
+        Data_T *dst = result->blockData(bi, bj, bk);
+        for (size_t v = 0; v < numVoxels; ++v) {
+          dst[v] = detail::xorBits(pa ? pa[v] : ea, pb ? pb[v] : eb);
+        }
+      }
+    }
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+// SparseDeltaWriter implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SparseDeltaWriter<Data_T>::writeLayer(Field3DOutputFile &out, 
+                                           const size_t frame,
+                                           const std::string &partition, 
+                                           const std::string &layer,
+                                           FieldPtr field)
+{
+  if (!field || frame >= m_sequence.size()) {
+    return false;
+  }
+
+  const std::string layerPath = partition + "/" + layer;
+  const size_t      keyframe  = frame - frame % m_keyInterval;
+
+  // Deltas are taken against the most recent keyframe in the interval 
+  typename KeyframeMap::const_iterator k = m_keyframes.find(layerPath);
+  if (!isKeyframe(frame) && sparseQuantizeBits() == 0 &&
+      k != m_keyframes.end() && 
+      k->second.frame >= keyframe && k->second.frame < frame) {
+    FieldPtr delta = sparseDelta(*field, *k->second.field);
+    if (delta) {
+      delta->metadata().setStrMetadata(k_sparseDeltaKeyframeStr, 
+                                       keyframePath(frame, k->second.frame));
+      return out.writeScalarLayer<Data_T>(partition, layer, delta);
+    }
+  }
+
+  // Keep a copy of the keyframe, since the caller may go on to modify the
+  // field for the next frame
+  FieldPtr key = field_dynamic_cast<SparseField<Data_T> >(field->clone());
+  if (!key) {
+    return false;
+  }
+  key->metadata().setStrMetadata(k_sparseDeltaKeyframeStr, "");
+  Keyframe &entry = m_keyframes[layerPath];
+  entry.frame = frame;
+  entry.field = key;
+  return out.writeScalarLayer<Data_T>(partition, layer, key);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+std::string SparseDeltaWriter<Data_T>::keyframePath(const size_t frame, 
+                                                    const size_t keyframe) 
+  const
+{
+  const std::string &framePath = m_sequence.filename(frame);
+  const std::string &keyPath   = m_sequence.filename(keyframe);
+  const std::string  dir       = detail::sparseDeltaDir(framePath);
+  if (detail::sparseDeltaDir(keyPath) == dir) {
+    return keyPath.substr(dir.size());
+  }
+  return keyPath;
+}
+
+//----------------------------------------------------------------------------//
+// SparseDeltaReader implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SparseDeltaReader<Data_T>::FieldPtr
+SparseDeltaReader<Data_T>::read(const std::string &filename, 
+                                const std::string &partition,
+                                const std::string &layer)
+{
+  return readChain(filename, partition, layer, 0);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseDeltaReader<Data_T>::clear()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_recent.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SparseDeltaReader<Data_T>::FieldPtr
+SparseDeltaReader<Data_T>::readChain(const std::string &filename, 
+                                     const std::string &partition,
+                                     const std::string &layer, 
+                                     const int depth)
+{
+  const std::string layerPath = partition + "/" + layer;
+
+  FieldPtr field = cached(filename, layerPath);
+  if (field) {
+    return field;
+  }
+
+  if (depth > k_maxChainLength) {
+    Msg::print(Msg::SevWarning, "SparseDeltaReader: Keyframe chain too long "
+               "at " + filename);
+    return FieldPtr();
+  }
+
+  // Read the layer ---
+
+  Field3DInputFile in;
+  if (!in.open(filename)) {
+    return FieldPtr();
+  }
+  typename Field<Data_T>::Vec fields = 
+    in.readScalarLayers<Data_T>(partition, layer);
+  if (fields.empty()) {
+    return FieldPtr();
+  }
+  field = field_dynamic_cast<SparseField<Data_T> >(fields[0]);
+  if (!field) {
+    return FieldPtr();
+  }
+
+  // Decode it against its keyframe ---
+
+  const std::string keyframe = 
+    field->metadata().strMetadata(k_sparseDeltaKeyframeStr, "");
+  if (!keyframe.empty()) {
+    // Bare filenames are relative to the frame's directory
+    const std::string keyPath = keyframe.find('/') == std::string::npos ?
+      detail::sparseDeltaDir(filename) + keyframe : keyframe;
+    FieldPtr key = readChain(keyPath, partition, layer, depth + 1);
+    if (!key) {
+      Msg::print(Msg::SevWarning, "SparseDeltaReader: Couldn't read keyframe "
+                 + keyPath + " of " + filename);
+      return FieldPtr();
+    }
+    field = sparseDelta(*field, *key);
+    if (!field) {
+      Msg::print(Msg::SevWarning, "SparseDeltaReader: Couldn't decode " + 
+                 filename + " against its keyframe");
+      return FieldPtr();
+    }
+    field->metadata().setStrMetadata(k_sparseDeltaKeyframeStr, "");
+  }
+
+  cache(filename, layerPath, field);
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+typename SparseDeltaReader<Data_T>::FieldPtr
+SparseDeltaReader<Data_T>::cached(const std::string &filename, 
+                                  const std::string &layerPath)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  for (typename std::list<Entry>::iterator i = m_recent.begin(); 
+       i != m_recent.end(); ++i) {
+    if (i->filename == filename && i->layerPath == layerPath) {
+      m_recent.splice(m_recent.begin(), m_recent, i);
+      return m_recent.front().field;
+    }
+  }
+  return FieldPtr();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseDeltaReader<Data_T>::cache(const std::string &filename, 
+                                      const std::string &layerPath,
+                                      FieldPtr field)
+{
+  if (m_cacheSize == 0) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(m_mutex);
+  Entry entry;
+  entry.filename  = filename;
+  entry.layerPath = layerPath;
+  entry.field     = field;
+  m_recent.push_front(entry);
+  while (m_recent.size() > m_cacheSize) {
+    m_recent.pop_back();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -46,13 +46,22 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
+#include <map>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/static_assert.hpp>
 
+#include "AlignedAllocator.h"
 #include "Field.h"
+#include "HalfConvert.h"
+#include "InitIO.h"
 #include "SparseFile.h"
+#include "ThreadPool.h"
 
 #define BLOCK_ORDER 4 // 2^BLOCK_ORDER is the block size along each axis
 
@@ -71,6 +80,124 @@ class LinearGenericFieldInterp;
 template <class Field_T>
 class CubicGenericFieldInterp;
 
+//----------------------------------------------------------------------------//
+// Block layouts
+//----------------------------------------------------------------------------//
+
+namespace Sparse {
+
+//----------------------------------------------------------------------------//
+
+//! Order of the voxels within each block of a SparseField
+enum BlockLayout {
+  //! x varies fastest, then y, then z. This is what older files contain
+  BlockLayoutLinear = 0,
+  //! Voxels are ordered along a Morton (Z-order) curve, which keeps each 
+  //! voxel's neighbors in all three dimensions close by in memory
+  BlockLayoutMorton
+};
+
+//----------------------------------------------------------------------------//
+
+//! \class LinearBlockIndex
+//! \ingroup field_int
+//! Computes the offset of a voxel within a block stored in 
+//! BlockLayoutLinear order.
+struct LinearBlockIndex
+{
+  static size_t index(int i, int j, int k, int blockOrder)
+  { 
+    return (static_cast<size_t>(k) << blockOrder << blockOrder) + 
+      (static_cast<size_t>(j) << blockOrder) + i; 
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! \class MortonBlockIndex
+//! \ingroup field_int
+//! Computes the offset of a voxel within a block stored in 
+//! BlockLayoutMorton order. The bits of i, j and k are interleaved, so 
+//! block orders up to 10 are supported.
+struct MortonBlockIndex
+{
+  static size_t index(int i, int j, int k, int /* blockOrder */)
+  { 
+    return dilate(i) | (dilate(j) << 1) | (dilate(k) << 2);
+  }
+  //! Spreads the lower 10 bits of v so that there are two zero bits 
+  //! between each of them
+  static size_t dilate(int v)
+  {
+    size_t x = static_cast<size_t>(v) & 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8))  & 0x0300f00f;
+    x = (x | (x << 4))  & 0x030c30c3;
+    x = (x | (x << 2))  & 0x09249249;
+    return x;
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! Computes the offset of a voxel within a block stored in the given layout
+inline size_t blockIndex(int i, int j, int k, int blockOrder, 
+                         BlockLayout layout)
+{
+  return layout == BlockLayoutMorton ? 
+    MortonBlockIndex::index(i, j, k, blockOrder) :
+    LinearBlockIndex::index(i, j, k, blockOrder);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Checks whether all the voxels of a block that lie within the field's 
+//! data window hold the same value. Voxels outside the data window are
+//! undefined and are ignored.
+//! \param data The block's voxels, stored in the given layout
+//! \param validSize Number of voxels per dim within field data window
+//! \param value Set to the value of the voxels if they are all equal
+//! \returns Whether the block holds a single value
+template <typename Data_T>
+bool isUniformBlock(const Data_T *data, const V3i &validSize, 
+                    const int blockOrder, const BlockLayout layout, 
+                    Data_T &value)
+{
+  // Voxel 0,0,0 comes first in all layouts
+  const Data_T first = data[0];
+  if (validSize == V3i(1 << blockOrder)) {
+    // Interior block, so look at all voxels
+    const size_t len = static_cast<size_t>(1) << (blockOrder * 3);
+    for (size_t i = 0; i < len; ++i) {
+      if (data[i] != first) {
+        return false;
+      }
+    }
+  } else {
+    // Only look at valid voxels
+    for (int k = 0; k < validSize.z; ++k) {
+      for (int j = 0; j < validSize.y; ++j) {
+        for (int i = 0; i < validSize.x; ++i) {
+          if (data[blockIndex(i, j, k, blockOrder, layout)] != first) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  value = first;
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Number of points the batched interpolators compute before storing them
+const size_t k_sampleBatchSize = 64;
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sparse
+
 //----------------------------------------------------------------------------//
 // LinearSparseFieldInterp
 //----------------------------------------------------------------------------//
@@ -110,6 +237,146 @@ public:
   // Main methods --------------------------------------------------------------
 
   value_type sample(const SparseField<Data_T> &field, const V3d &vsP) const
+  {
+    Stencil st;
+    setupStencil(field, vsP, st);
+
+    // If in the middle of a block, optimize lookup stencil
+    if (st.isInterior) {
+      if (field.blockIsAllocated(st.bi, st.bj, st.bk)) {
+        // Ensure block data is active and kept alive
+        const int blockId        = field.blockId(st.bi, st.bj, st.bk);
+        const bool isDynamicLoad = field.isDynamicLoad();
+        if (isDynamicLoad) {
+          field.incBlockRef(blockId);
+          field.activateBlock(blockId);
+        }
+        // Only do work if the block is allocated
+        const Data_T * const p = field.blockData(st.bi, st.bj, st.bk);
+        Data_T value;
+        if (field.blockLayout() == Sparse::BlockLayoutMorton) {
+          value = sampleBlock<Sparse::MortonBlockIndex>
+            (p, st, field.blockOrder());
+        } else {
+          value = sampleBlock<Sparse::LinearBlockIndex>
+            (p, st, field.blockOrder());
+        }
+        // Decrement the block ref count
+        if (isDynamicLoad) {
+          field.decBlockRef(blockId);
+        }
+        // Done.
+        return value;
+      } else {
+        return static_cast<Data_T>
+          (field.getBlockEmptyValue(st.bi, st.bj, st.bk));
+      }
+    } else {
+      return sampleBorder(field, st);
+    }
+
+  }
+
+  //! Samples n points at once. Consecutive points that fall in the same
+  //! block share the block lookup, and for dynamically loaded fields the
+  //! block stays referenced until the points move on to another block, so 
+  //! coherent batches such as shading packets are cheapest.
+  void sample(const SparseField<Data_T> &field, size_t n, const V3f *vsP, 
+              value_type *out) const
+  {
+    if (field.blockLayout() == Sparse::BlockLayoutMorton) {
+      sampleBatch<Sparse::MortonBlockIndex>(field, n, vsP, out);
+    } else {
+      sampleBatch<Sparse::LinearBlockIndex>(field, n, vsP, out);
+    }
+  }
+
+  //! Samples two fields at n points at once and blends them, as 
+  //! (1 - t) * a + t * b. The fields must share their data window, block
+  //! order and block layout, which lets each point's stencil and block 
+  //! lookup serve both. Used to interpolate between frames.
+  void sampleBlend(const SparseField<Data_T> &a, const SparseField<Data_T> &b,
+                   const double t, size_t n, const V3f *vsP, 
+                   value_type *out) const
+  {
+    if (a.blockLayout() == Sparse::BlockLayoutMorton) {
+      sampleBlendBatch<Sparse::MortonBlockIndex>(a, b, t, n, vsP, out);
+    } else {
+      sampleBlendBatch<Sparse::LinearBlockIndex>(a, b, t, n, vsP, out);
+    }
+  }
+
+  //! Analytic voxel-space gradient of the interpolant. Only valid for 
+  //! scalar fields.
+  FIELD3D_VEC3_T<Data_T> sampleGradient(const SparseField<Data_T> &field, 
+                                        const V3d &vsP) const
+  {
+    FIELD3D_VEC3_T<Data_T> gradient;
+    sampleValueAndGradient(field, vsP, gradient);
+    return gradient;
+  }
+
+  //! Interpolated value and its voxel-space gradient, using a single 
+  //! lookup of the 8 voxels. Only valid for scalar fields.
+  value_type sampleValueAndGradient(const SparseField<Data_T> &field, 
+                                    const V3d &vsP,
+                                    FIELD3D_VEC3_T<Data_T> &gradient) const
+  {
+    Stencil st;
+    setupStencil(field, vsP, st);
+
+    Data_T v[8];
+    if (st.isInterior) {
+      if (field.blockIsAllocated(st.bi, st.bj, st.bk)) {
+        // Ensure block data is active and kept alive
+        const int blockId        = field.blockId(st.bi, st.bj, st.bk);
+        const bool isDynamicLoad = field.isDynamicLoad();
+        if (isDynamicLoad) {
+          field.incBlockRef(blockId);
+          field.activateBlock(blockId);
+        }
+        const Data_T * const p = field.blockData(st.bi, st.bj, st.bk);
+        if (field.blockLayout() == Sparse::BlockLayoutMorton) {
+          gatherBlock<Sparse::MortonBlockIndex>(p, st, field.blockOrder(), v);
+        } else {
+          gatherBlock<Sparse::LinearBlockIndex>(p, st, field.blockOrder(), v);
+        }
+        if (isDynamicLoad) {
+          field.decBlockRef(blockId);
+        }
+      } else {
+        // Empty blocks are constant
+        gradient = FIELD3D_VEC3_T<Data_T>(static_cast<Data_T>(0));
+        return static_cast<Data_T>
+          (field.getBlockEmptyValue(st.bi, st.bj, st.bk));
+      }
+    } else {
+      gatherBorder(field, st, v);
+    }
+
+    return valueAndGradient(v, st, gradient);
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! The voxels and weights of one lookup
+  struct Stencil
+  {
+    //! Lower and upper corners, clamped to the data window
+    V3i c1, c2;
+    //! Weights of the lower and upper corners
+    FIELD3D_VEC3_T<double> f1, f2;
+    //! Lower corner within its block, and the block's coordinate
+    int vi, vj, vk, bi, bj, bk;
+    //! Whether all 8 voxels are in the same block
+    bool isInterior;
+  };
+
+  //! Finds the voxels and weights for a lookup at vsP
+  static void setupStencil(const SparseField<Data_T> &field, const V3d &vsP,
+                           Stencil &st)
   {
     // Pixel centers are at .5 coordinates
     // NOTE: Don't use contToDisc for this, we're looking for sample
@@ -117,15 +384,17 @@ public:
     FIELD3D_VEC3_T<double> p(vsP - FIELD3D_VEC3_T<double>(0.5));
 
     // Lower left corner
-    V3i c1(static_cast<int>(floor(p.x)),
-           static_cast<int>(floor(p.y)),
-           static_cast<int>(floor(p.z)));
+    V3i &c1 = st.c1;
+    c1 = V3i(static_cast<int>(floor(p.x)),
+             static_cast<int>(floor(p.y)),
+             static_cast<int>(floor(p.z)));
     // Upper right corner
-    V3i c2(c1 + V3i(1));
+    V3i &c2 = st.c2;
+    c2 = c1 + V3i(1);
     // C1 fractions
-    FIELD3D_VEC3_T<double> f1(static_cast<FIELD3D_VEC3_T<double> >(c2) - p);
+    st.f1 = static_cast<FIELD3D_VEC3_T<double> >(c2) - p;
     // C2 fraction
-    FIELD3D_VEC3_T<double> f2(static_cast<FIELD3D_VEC3_T<double> >(1.0) - f1);
+    st.f2 = static_cast<FIELD3D_VEC3_T<double> >(1.0) - st.f1;
 
     const Box3i &dataWindow = field.dataWindow();
 
@@ -138,64 +407,256 @@ public:
     c2.z = std::min(dataWindow.max.z, std::max(dataWindow.min.z, c2.z));
 
     // Determine which block we're in
-    int i = c1.x, j = c1.y, k = c1.z, vi, vj, vk, bi, bj, bk;
+    int i = c1.x, j = c1.y, k = c1.z;
     field.applyDataWindowOffset(i, j, k);
-    field.getVoxelInBlock(i, j, k, vi, vj, vk);
-    field.getBlockCoord(i, j, k, bi, bj, bk);
-    int blockSize = 1 << field.blockOrder();
+    field.getVoxelInBlock(i, j, k, st.vi, st.vj, st.vk);
+    field.getBlockCoord(i, j, k, st.bi, st.bj, st.bk);
+    const int blockSize = 1 << field.blockOrder();
 
-    // If in the middle of a block, optimize lookup stencil
-    if (vi < blockSize - 1 && vj < blockSize - 1 && vk < blockSize - 1) {
-      if (field.blockIsAllocated(bi, bj, bk)) {
-        // Ensure block data is active and kept alive
-        const int blockId        = field.blockId(bi, bj, bk);
-        const bool isDynamicLoad = field.isDynamicLoad();
-        if (isDynamicLoad) {
-          field.incBlockRef(blockId);
-          field.activateBlock(blockId);
+    st.isInterior = 
+      st.vi < blockSize - 1 && st.vj < blockSize - 1 && st.vk < blockSize - 1;
+  }
+
+  //! Interpolates a stencil that lies within the given block data, with 
+  //! the offsets computed by Index_T.
+  template <class Index_T>
+  static Data_T sampleBlock(const Data_T *p, const Stencil &st, int order)
+  { return interpolateBlock<Index_T, Data_T>(p, st, order); }
+
+  //! Implementation of sampleBlock(), returning Result_T
+  template <class Index_T, class Result_T>
+  static Result_T interpolateBlock(const Data_T *p, const Stencil &st, 
+                                   int order)
+  {
+    const FIELD3D_VEC3_T<double> &f1 = st.f1, &f2 = st.f2;
+    const int vi = st.vi, vj = st.vj, vk = st.vk;
+    const int vi2 = vi + st.c2.x - st.c1.x;
+    const int vj2 = vj + st.c2.y - st.c1.y;
+    const int vk2 = vk + st.c2.z - st.c1.z;
+    return static_cast<Result_T>
+      (f1.x * (f1.y * (f1.z * p[Index_T::index(vi, vj, vk, order)] +
+                       f2.z * p[Index_T::index(vi, vj, vk2, order)]) +
+               f2.y * (f1.z * p[Index_T::index(vi, vj2, vk, order)] +
+                       f2.z * p[Index_T::index(vi, vj2, vk2, order)])) +
+       f2.x * (f1.y * (f1.z * p[Index_T::index(vi2, vj, vk, order)] +
+                       f2.z * p[Index_T::index(vi2, vj, vk2, order)]) +
+               f2.y * (f1.z * p[Index_T::index(vi2, vj2, vk, order)] +
+                       f2.z * p[Index_T::index(vi2, vj2, vk2, order)])));
+  }
+
+  //! Interpolates a stencil that straddles blocks
+  static Data_T sampleBorder(const SparseField<Data_T> &field, 
+                             const Stencil &st)
+  { return interpolateBorder<Data_T>(field, st); }
+
+  //! Implementation of sampleBorder(), returning Result_T
+  template <class Result_T>
+  static Result_T interpolateBorder(const SparseField<Data_T> &field, 
+                                    const Stencil &st)
+  {
+    const V3i &c1 = st.c1, &c2 = st.c2;
+    const FIELD3D_VEC3_T<double> &f1 = st.f1, &f2 = st.f2;
+    return static_cast<Result_T>
+      (f1.x * (f1.y * (f1.z * field.fastValue(c1.x, c1.y, c1.z) +
+                       f2.z * field.fastValue(c1.x, c1.y, c2.z)) +
+               f2.y * (f1.z * field.fastValue(c1.x, c2.y, c1.z) +
+                       f2.z * field.fastValue(c1.x, c2.y, c2.z))) +
+       f2.x * (f1.y * (f1.z * field.fastValue(c2.x, c1.y, c1.z) +
+                       f2.z * field.fastValue(c2.x, c1.y, c2.z)) +
+               f2.y * (f1.z * field.fastValue(c2.x, c2.y, c1.z) +
+                       f2.z * field.fastValue(c2.x, c2.y, c2.z))));
+  }
+
+  //! Reads the 8 voxels of a stencil within the given block data, with
+  //! x varying fastest
+  template <class Index_T>
+  static void gatherBlock(const Data_T *p, const Stencil &st, int order,
+                          Data_T *v)
+  {
+    const int vi = st.vi, vj = st.vj, vk = st.vk;
+    const int vi2 = vi + st.c2.x - st.c1.x;
+    const int vj2 = vj + st.c2.y - st.c1.y;
+    const int vk2 = vk + st.c2.z - st.c1.z;
+    v[0] = p[Index_T::index(vi,  vj,  vk,  order)];
+    v[1] = p[Index_T::index(vi2, vj,  vk,  order)];
+    v[2] = p[Index_T::index(vi,  vj2, vk,  order)];
+    v[3] = p[Index_T::index(vi2, vj2, vk,  order)];
+    v[4] = p[Index_T::index(vi,  vj,  vk2, order)];
+    v[5] = p[Index_T::index(vi2, vj,  vk2, order)];
+    v[6] = p[Index_T::index(vi,  vj2, vk2, order)];
+    v[7] = p[Index_T::index(vi2, vj2, vk2, order)];
+  }
+
+  //! Reads the 8 voxels of a stencil that straddles blocks, with x 
+  //! varying fastest
+  static void gatherBorder(const SparseField<Data_T> &field, 
+                           const Stencil &st, Data_T *v)
+  {
+    const V3i &c1 = st.c1, &c2 = st.c2;
+    v[0] = field.fastValue(c1.x, c1.y, c1.z);
+    v[1] = field.fastValue(c2.x, c1.y, c1.z);
+    v[2] = field.fastValue(c1.x, c2.y, c1.z);
+    v[3] = field.fastValue(c2.x, c2.y, c1.z);
+    v[4] = field.fastValue(c1.x, c1.y, c2.z);
+    v[5] = field.fastValue(c2.x, c1.y, c2.z);
+    v[6] = field.fastValue(c1.x, c2.y, c2.z);
+    v[7] = field.fastValue(c2.x, c2.y, c2.z);
+  }
+
+  //! Value and gradient of 8 gathered voxels. The value is summed in the
+  //! same order as sampleBlock().
+  static Data_T valueAndGradient(const Data_T *v, const Stencil &st,
+                                 FIELD3D_VEC3_T<Data_T> &gradient)
+  {
+    const FIELD3D_VEC3_T<double> &f1 = st.f1, &f2 = st.f2;
+    gradient.x = static_cast<Data_T>
+      (f1.y * (f1.z * (v[1] - v[0]) + f2.z * (v[5] - v[4])) +
+       f2.y * (f1.z * (v[3] - v[2]) + f2.z * (v[7] - v[6])));
+    gradient.y = static_cast<Data_T>
+      (f1.x * (f1.z * (v[2] - v[0]) + f2.z * (v[6] - v[4])) +
+       f2.x * (f1.z * (v[3] - v[1]) + f2.z * (v[7] - v[5])));
+    gradient.z = static_cast<Data_T>
+      (f1.x * (f1.y * (v[4] - v[0]) + f2.y * (v[6] - v[2])) +
+       f2.x * (f1.y * (v[5] - v[1]) + f2.y * (v[7] - v[3])));
+    return static_cast<Data_T>
+      (f1.x * (f1.y * (f1.z * v[0] + f2.z * v[4]) +
+               f2.y * (f1.z * v[2] + f2.z * v[6])) +
+       f2.x * (f1.y * (f1.z * v[1] + f2.z * v[5]) +
+               f2.y * (f1.z * v[3] + f2.z * v[7])));
+  }
+
+  //! Implementation of the batched sample() for one block layout. Results
+  //! are computed a chunk at a time in HalfConvert::Compute's type, so 
+  //! that half results are converted in bulk.
+  template <class Index_T>
+  static void sampleBatch(const SparseField<Data_T> &field, size_t n, 
+                          const V3f *vsP, value_type *out)
+  {
+    typedef HalfConvert::Compute<Data_T> Compute;
+    typedef typename Compute::type       Result_T;
+
+    const bool isDynamicLoad = field.isDynamicLoad();
+    const int  order         = field.blockOrder();
+    // The block used by the previous interior lookup
+    int           currentId   = -1;
+    const Data_T *currentData = NULL;
+    Result_T      currentEmpty = static_cast<Result_T>(0);
+
+    Stencil  st;
+    Result_T results[Sparse::k_sampleBatchSize];
+    for (size_t first = 0; first < n; first += Sparse::k_sampleBatchSize) {
+      const size_t m = std::min(Sparse::k_sampleBatchSize, n - first);
+      for (size_t i = 0; i < m; ++i) {
+        setupStencil(field, V3d(vsP[first + i]), st);
+        if (!st.isInterior) {
+          results[i] = interpolateBorder<Result_T>(field, st);
+          continue;
         }
-        // Only do work if the block is allocated
-        const Data_T * const p = field.blockData(bi, bj, bk);
-        const Data_T * const c111 = 
-          p + vi + vj * blockSize + vk * blockSize * blockSize;
-        const Data_T * const c121 = c111 + blockSize * (c2.y - c1.y);
-        const Data_T * const 
-          c112 = c111 + blockSize * blockSize * (c2.z - c1.z);
-        const Data_T * const c122 = c112 + blockSize * (c2.y - c1.y);
-        int xInc = c2.x - c1.x;
-        Data_T value = static_cast<Data_T>
-          (f1.x * (f1.y * (f1.z * *c111 +
-                           f2.z * *c112) +
-                   f2.y * (f1.z * *c121 +
-                           f2.z * *c122)) +
-           f2.x * (f1.y * (f1.z * *(c111 + xInc) +
-                           f2.z * *(c112 + xInc)) +
-                   f2.y * (f1.z * *(c121 + xInc) +
-                           f2.z * *(c122 + xInc))));
-        // Decrement the block ref count
-        if (isDynamicLoad) {
-          field.decBlockRef(blockId);
+        const int blockId = field.blockId(st.bi, st.bj, st.bk);
+        if (blockId != currentId) {
+          if (isDynamicLoad && currentData) {
+            field.decBlockRef(currentId);
+          }
+          currentId = blockId;
+          currentData = NULL;
+          if (field.blockIsAllocated(st.bi, st.bj, st.bk)) {
+            if (isDynamicLoad) {
+              field.incBlockRef(blockId);
+              field.activateBlock(blockId);
+            }
+            currentData = field.blockData(st.bi, st.bj, st.bk);
+          } else {
+            currentEmpty = static_cast<Result_T>
+              (field.getBlockEmptyValue(st.bi, st.bj, st.bk));
+          }
         }
-        // Done.
-        return value;
-      } else {
-        return static_cast<Data_T>(field.getBlockEmptyValue(bi, bj, bk));
+        results[i] = currentData ? 
+          interpolateBlock<Index_T, Result_T>(currentData, st, order) : 
+          currentEmpty;
       }
-    } else {
-      return static_cast<Data_T>
-        (f1.x * (f1.y * (f1.z * field.fastValue(c1.x, c1.y, c1.z) +
-                         f2.z * field.fastValue(c1.x, c1.y, c2.z)) +
-                 f2.y * (f1.z * field.fastValue(c1.x, c2.y, c1.z) +
-                         f2.z * field.fastValue(c1.x, c2.y, c2.z))) +
-         f2.x * (f1.y * (f1.z * field.fastValue(c2.x, c1.y, c1.z) +
-                         f2.z * field.fastValue(c2.x, c1.y, c2.z)) +
-                 f2.y * (f1.z * field.fastValue(c2.x, c2.y, c1.z) +
-                         f2.z * field.fastValue(c2.x, c2.y, c2.z))));
+      Compute::store(results, m, out + first);
     }
+    // Release the last block
+    if (isDynamicLoad && currentData) {
+      field.decBlockRef(currentId);
+    }
+  }
 
+  //! Looks up a block for sampleBlendBatch(), referencing it if the field
+  //! is dynamically loaded. Returns NULL and sets empty if unallocated.
+  static const Data_T* blendBlock(const SparseField<Data_T> &field, 
+                                  const Stencil &st, const int blockId,
+                                  Data_T &empty)
+  {
+    if (!field.blockIsAllocated(st.bi, st.bj, st.bk)) {
+      empty = field.getBlockEmptyValue(st.bi, st.bj, st.bk);
+      return NULL;
+    }
+    if (field.isDynamicLoad()) {
+      field.incBlockRef(blockId);
+      field.activateBlock(blockId);
+    }
+    return field.blockData(st.bi, st.bj, st.bk);
   }
 
-private:
+  //! Implementation of sampleBlend() for one block layout
+  template <class Index_T>
+  static void sampleBlendBatch(const SparseField<Data_T> &a, 
+                               const SparseField<Data_T> &b, const double t,
+                               size_t n, const V3f *vsP, value_type *out)
+  {
+    typedef HalfConvert::Compute<Data_T> Compute;
+    typedef typename Compute::type       Result_T;
+
+    const int order = a.blockOrder();
+    // The block used by the previous interior lookup, in each field
+    int           currentId = -1;
+    const Data_T *dataA = NULL, *dataB = NULL;
+    Data_T        emptyA = static_cast<Data_T>(0);
+    Data_T        emptyB = static_cast<Data_T>(0);
+
+    Stencil  st;
+    Result_T results[Sparse::k_sampleBatchSize];
+    for (size_t first = 0; first < n; first += Sparse::k_sampleBatchSize) {
+      const size_t m = std::min(Sparse::k_sampleBatchSize, n - first);
+      for (size_t i = 0; i < m; ++i) {
+        setupStencil(a, V3d(vsP[first + i]), st);
+        if (!st.isInterior) {
+          results[i] = static_cast<Result_T>
+            ((1.0 - t) * interpolateBorder<Result_T>(a, st) + 
+             t * interpolateBorder<Result_T>(b, st));
+          continue;
+        }
+        const int blockId = a.blockId(st.bi, st.bj, st.bk);
+        if (blockId != currentId) {
+          if (dataA && a.isDynamicLoad()) {
+            a.decBlockRef(currentId);
+          }
+          if (dataB && b.isDynamicLoad()) {
+            b.decBlockRef(currentId);
+          }
+          currentId = blockId;
+          dataA = blendBlock(a, st, blockId, emptyA);
+          dataB = blendBlock(b, st, blockId, emptyB);
+        }
+        const Result_T valueA = dataA ? 
+          interpolateBlock<Index_T, Result_T>(dataA, st, order) : 
+          static_cast<Result_T>(emptyA);
+        const Result_T valueB = dataB ? 
+          interpolateBlock<Index_T, Result_T>(dataB, st, order) : 
+          static_cast<Result_T>(emptyB);
+        results[i] = static_cast<Result_T>((1.0 - t) * valueA + t * valueB);
+      }
+      Compute::store(results, m, out + first);
+    }
+    // Release the last blocks
+    if (dataA && a.isDynamicLoad()) {
+      a.decBlockRef(currentId);
+    }
+    if (dataB && b.isDynamicLoad()) {
+      b.decBlockRef(currentId);
+    }
+  }
 
   // Static data members -------------------------------------------------------
 
@@ -220,6 +681,105 @@ FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(LinearSparseFieldInterp);
 //! \ingroup field_int
 namespace Sparse {
 
+//! \class SparseBlockPool
+//! \ingroup field_int
+//! Recycles the voxel arrays of SparseBlocks. Arrays are carved out of 
+//! larger slabs and returned to a free list for their size, so that blocks
+//! being loaded and unloaded by the SparseFileManager don't fragment the 
+//! heap. Memory is given back to the system by trim(), which 
+//! SparseFileManager::flushCache() calls, and by trimToLimit(), which each
+//! SparseField calls as it's destroyed so that the free arrays stay within
+//! sparseBlockPoolLimit(). Slabs are sized to whole huge pages when 
+//! hugePages() is on. Arrays are reference
+//! counted, so that SparseField copies can share them until written to.
+template <typename Data_T>
+class SparseBlockPool
+{
+public:
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns an uninitialized array of n values
+  static Data_T* allocate(size_t n);
+  //! Drops a reference to an array, returning it to the pool once no 
+  //! references are left
+  static void    deallocate(Data_T *data);
+  //! Adds a reference to an array, for another block to share it
+  static Data_T* share(Data_T *data);
+  //! Returns whether more than one block refers to an array
+  static bool    isShared(const Data_T *data);
+  //! Returns the number of values in an array handed out by allocate()
+  static size_t  size(const Data_T *data);
+  //! Frees the slabs that have no arrays in use
+  static void    trim();
+  //! Calls trim() if the pool holds more than sparseBlockPoolLimit() bytes
+  //! that aren't in use
+  static void    trimToLimit();
+  //! Bytes held by the pool, in use or not
+  static size_t  reservedBytes();
+  //! Bytes in arrays that are currently handed out
+  static size_t  usedBytes();
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Precedes each array, in k_headerBytes so that the array stays 
+  //! 16-byte aligned
+  struct Header
+  {
+    size_t             n;
+    boost::atomic<int> refs;
+  };
+
+  static const size_t k_headerBytes = 16;
+
+  //! The slabs and free arrays for one array size
+  struct SizeClass
+  {
+    SizeClass() : slotBytes(0), slotsPerSlab(0), slabBytes(0) { }
+    size_t               slotBytes;
+    size_t               slotsPerSlab;
+    size_t               slabBytes;
+    std::vector<char *>  slabs;
+    std::vector<char *>  freeSlots;
+  };
+
+  typedef std::map<size_t, SizeClass> SizeClassMap;
+
+  struct State
+  {
+    State() : reservedBytes(0), usedBytes(0) { }
+    SizeClassMap sizeClasses;
+    size_t       reservedBytes;
+    size_t       usedBytes;
+    boost::mutex mutex;
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! The pool's state. A function-local static avoids depending on the 
+  //! order of static initialization.
+  static State& state()
+  {
+    static State s;
+    return s;
+  }
+
+  //! Frees the slabs that have no arrays in use. The caller holds the
+  //! mutex.
+  static void trim(State &s);
+
+  static Header* header(const Data_T *data)
+  { 
+    return reinterpret_cast<Header *>
+      (reinterpret_cast<char *>(const_cast<Data_T *>(data)) - k_headerBytes); 
+  }
+
+};
+
+//----------------------------------------------------------------------------//
+
 //! \class SparseBlock
 //! \ingroup field_int
 //! Storage for one individual block of a SparseField
@@ -231,16 +791,19 @@ struct SparseBlock : boost::noncopyable
   //! Ctor
   SparseBlock()
     : isAllocated(false),
+      isMapped(false),
       emptyValue(static_cast<Data_T>(0)),
-      data(NULL)
+      data(NULL),
+      numDataBlocks(NULL)
   { /* Empty */ }
 
   //! Dtor
   ~SparseBlock()
   {
-    if (data) {
-      delete[] data;
+    if (data && !isMapped) {
+      SparseBlockPool<Data_T>::deallocate(data);
     }
+    setData(NULL);
   }
 
   // Main methods --------------------------------------------------------------
@@ -255,18 +818,42 @@ struct SparseBlock : boost::noncopyable
   inline const Data_T& value(int i, int j, int k, int blockOrder) const
   { return data[(k << blockOrder << blockOrder) + (j << blockOrder) + i]; }
 
+  //! Gets the value of a given voxel in a block stored in the given layout
+  inline Data_T& value(int i, int j, int k, int blockOrder, 
+                       BlockLayout layout)
+  { return data[blockIndex(i, j, k, blockOrder, layout)]; }
+
+  //! Gets the const value of a given voxel in a block stored in the given 
+  //! layout
+  inline const Data_T& value(int i, int j, int k, int blockOrder, 
+                             BlockLayout layout) const
+  { return data[blockIndex(i, j, k, blockOrder, layout)]; }
+
   //! Alloc data
   void resize(int n)
+  {
+    alloc(n);
+    std::fill_n(data, n, emptyValue);
+  }
+
+  //! Alloc data, leaving the values uninitialized
+  void alloc(int n)
   {
     // First hold lock
     boost::mutex::scoped_lock lock(ms_resizeMutex);
-    // Perform work
-    if (data) {
-      delete[] data;
+    // Perform work, reusing the array if it's already the right size and 
+    // not shared with another block
+    if (data && !isMapped && 
+        (SparseBlockPool<Data_T>::size(data) != static_cast<size_t>(n) ||
+         SparseBlockPool<Data_T>::isShared(data))) {
+      SparseBlockPool<Data_T>::deallocate(data);
+      setData(NULL);
+    }
+    if (!data || isMapped) {
+      setData(SparseBlockPool<Data_T>::allocate(n));
     }
-    data = new Data_T[n];
+    isMapped = false;
     isAllocated = true;
-    std::fill_n(data, n, emptyValue);
   }
 
   //! Remove data
@@ -275,33 +862,83 @@ struct SparseBlock : boost::noncopyable
     // First hold lock
     boost::mutex::scoped_lock lock(ms_resizeMutex);
     // Perform work
-    if (data) {
-      delete[] data;
-      data = NULL;
+    if (data && !isMapped) {
+      SparseBlockPool<Data_T>::deallocate(data);
+    }
+    setData(NULL);
+    isMapped = false;
+  }
+
+  //! Point the block at data that lives in a memory-mapped file. The block
+  //! does not own the memory and will not free it.
+  void map(Data_T *mapped)
+  {
+    // First hold lock
+    boost::mutex::scoped_lock lock(ms_resizeMutex);
+    // Perform work
+    if (data && !isMapped) {
+      SparseBlockPool<Data_T>::deallocate(data);
     }
+    setData(mapped);
+    isMapped = true;
+    isAllocated = true;
   }
 
   //! Copy data from another block
   void copy(const SparseBlock &other, size_t n)
   {
     if (other.isAllocated) {
-      if (!data) {
-        resize(n);
-      }
-      Data_T *p = data, *end = data + n, *o = other.data;
-      while (p != end) {
-        *p++ = *o++;
+      if (!data || isMapped || isShared()) {
+        alloc(n);
       }
+      std::copy(other.data, other.data + n, data);
     } else {
       clear();
     }
   }
 
+  //! Refer to the data of another block instead of copying it. The data
+  //! is copied by unshare() before either block is written to. Mapped 
+  //! data is copied right away.
+  void share(const SparseBlock &other, size_t n)
+  {
+    if (!other.isAllocated || !other.data || other.isMapped) {
+      copy(other, n);
+      return;
+    }
+    clear();
+    setData(SparseBlockPool<Data_T>::share(other.data));
+    isAllocated = true;
+  }
+
+  //! Whether the data is also referred to by another block
+  bool isShared() const
+  { 
+    return data && !isMapped && SparseBlockPool<Data_T>::isShared(data); 
+  }
+
+  //! Gives the block its own copy of its data if it's shared, so that it 
+  //! can be written to
+  void unshare(size_t n)
+  {
+    if (isShared()) {
+      Data_T *shared = data;
+      Data_T *own = SparseBlockPool<Data_T>::allocate(n);
+      std::copy(shared, shared + n, own);
+      data = own;
+      SparseBlockPool<Data_T>::deallocate(shared);
+    }
+  }
+
   // Data members --------------------------------------------------------------
 
   //! Whether the block is allocated or not
   bool isAllocated;
 
+  //! Whether data points into a memory-mapped file rather than to memory
+  //! owned by the block
+  bool isMapped;
+
   //! The value to use if the block isn't allocated. We allow setting this
   //! per block so that we for example can have different inside/outside
   //! values when storing narrow-band levelsets
@@ -310,6 +947,11 @@ struct SparseBlock : boost::noncopyable
   //! Pointer to data. Null if block is unallocated
   Data_T *data;
 
+  //! Count of the blocks of the owning field that have data, which the 
+  //! block updates when data is set or cleared. NULL for blocks that 
+  //! don't belong to a field.
+  boost::atomic<size_t> *numDataBlocks;
+
 private:
 
   //! Non-copyable
@@ -317,6 +959,21 @@ private:
   //! Non-copyable
   const SparseBlock& operator=(const SparseBlock&);
 
+  //! Points the block at new data, counting it in numDataBlocks if the 
+  //! block didn't have data before, or no longer counting it if it has 
+  //! none now
+  void setData(Data_T *newData)
+  {
+    if (numDataBlocks && !data != !newData) {
+      if (newData) {
+        numDataBlocks->fetch_add(1, boost::memory_order_relaxed);
+      } else {
+        numDataBlocks->fetch_sub(1, boost::memory_order_relaxed);
+      }
+    }
+    data = newData;
+  }
+
   // Data members --------------------------------------------------------------
 
   //! Prevents concurrent allocation of blocks. There should be little 
@@ -341,7 +998,18 @@ private:
 
   Refer to \ref using_fields for examples of how to use this in your code.
 
-  \todo Make this class thread safe!
+  By default, writes that allocate blocks must not happen concurrently. 
+  After setConcurrentWrites(true), any number of threads may call lvalue()
+  and fastLValue() at the same time. Each block is then allocated by 
+  whichever thread first claims it with a compare-and-swap, and writes to
+  allocated blocks take no locks. Writes to the same voxel still need to be
+  coordinated by the caller.
+
+  Copies made by the copy constructor, assignment, clone() or copyFrom() 
+  share block data with the source field, so copying only costs a pointer 
+  per block. A shared block is copied the first time either field writes
+  to it, through lvalue(), fastLValue(), an iterator or the non-const 
+  blockData(). memSize() counts shared data in each field that refers to it.
 */
 
 //----------------------------------------------------------------------------//
@@ -395,6 +1063,22 @@ public:
 
   // \}
 
+  // From ResizableField -------------------------------------------------------
+
+  //! Copies the mapping, size and values of another field. Unlike 
+  //! ResizableField::copyFrom(), blocks that hold a single value are kept
+  //! unallocated, with that value as their empty value. The blocks are 
+  //! filled on numIOThreads() threads, so the field must allow concurrent
+  //! calls to value().
+  //! \note To convert a SparseField to another block order, call 
+  //! setBlockOrder() on a new field, then copy the original into it.
+  void copyFrom(typename Field<Data_T>::Ptr other);
+
+  //! Copies the mapping, size and values of a field with another data type.
+  //! \sa copyFrom(typename Field<Data_T>::Ptr other)
+  template <class Data_T2>
+  void copyFrom(typename Field<Data_T2>::Ptr other);
+
   // Main methods --------------------------------------------------------------
 
   //! Clears all the voxels in the storage
@@ -410,6 +1094,16 @@ public:
   //! Returns the block size
   int blockSize() const;
 
+  //! Sets the order of the voxels within each block. Allocated blocks are
+  //! reordered in place. 
+  //! \note May not be called on a dynamically loaded field, since its 
+  //! blocks are read back in the layout they were written in.
+  void setBlockLayout(Sparse::BlockLayout layout);
+
+  //! Returns the order of the voxels within each block
+  Sparse::BlockLayout blockLayout() const
+  { return m_blockLayout; }
+
   //! Checks if a voxel is in an allocated block
   bool voxelIsInAllocatedBlock(int i, int j, int k) const;
 
@@ -438,6 +1132,32 @@ public:
   template <typename Functor_T>
   int releaseBlocks(Functor_T func);
 
+  //! Returns whether a block is allocated and holds the same value in all 
+  //! of its voxels within the data window. 
+  //! \param value Set to the block's value if it is uniform
+  bool blockIsUniform(int bi, int bj, int bk, Data_T &value) const;
+
+  //! Returns the min, max and mean of a block's voxels within the data 
+  //! window, as recorded in the file that a dynamically loaded field reads
+  //! its blocks from. The block isn't loaded. Vectors are reduced per 
+  //! component.
+  //! \returns False if the field isn't dynamically loaded, or if its file
+  //! holds no block summaries
+  bool blockSummary(int bi, int bj, int bk, 
+                    Data_T &min, Data_T &max, Data_T &mean) const;
+
+  //! Releases the allocated blocks that hold a single value, storing each
+  //! as a constant tile, i.e. an unallocated block whose empty value is 
+  //! that value. The field's values don't change.
+  //! \returns Number of released blocks
+  int releaseUniformBlocks();
+
+  //! Releases the allocated blocks whose voxels within the data window are
+  //! all within tolerance of the block's empty value. The blocks are 
+  //! checked on numIOThreads() threads.
+  //! \returns Number of released blocks
+  int pruneEmptyBlocks(double tolerance = 0.0);
+
   //! Calculates the block number based on a block i,j,k index
   int blockId(int blockI, int blockJ, int blockK) const;
 
@@ -472,6 +1192,30 @@ public:
   //! Decrements the block ref count for the given block
   void decBlockRef(const int blockId) const;
 
+  //! Queues the allocated blocks overlapping the given voxel-space bounds 
+  //! for loading on a background thread, so that later accesses don't 
+  //! have to wait for them. Does nothing unless the field is dynamically 
+  //! loaded.
+  void prefetch(const Box3i &vsBounds) const;
+
+  //! Queues the given blocks for loading on a background thread.
+  //! Does nothing unless the field is dynamically loaded.
+  void prefetchBlocks(const std::vector<int> &blockIds) const;
+
+  //! Queues the allocated blocks that the given voxel-space line segment 
+  //! passes through, in the order a ray march from vsStart to vsEnd would 
+  //! reach them. Does nothing unless the field is dynamically loaded.
+  void prefetchSegment(const V3d &vsStart, const V3d &vsEnd) const;
+
+  //! Sets the priority of the field's blocks in the dynamic loading cache.
+  //! When memory is needed, blocks of lower priority fields are evicted
+  //! first. Does nothing unless the field is dynamically loaded.
+  void setCachePriority(const int priority);
+
+  //! Returns the priority of the field's blocks in the dynamic loading
+  //! cache. Always zero unless the field is dynamically loaded.
+  int cachePriority() const;
+
   // Threading-related ---------------------------------------------------------
 
   //! Number of 'grains' to use with threaded access
@@ -480,6 +1224,24 @@ public:
   //! \return Whether the grain is contiguous in memory
   bool   getGrainBounds(const size_t idx, Box3i &vsBounds) const;
 
+  //! Enables or disables concurrent writes. While enabled, lvalue() and 
+  //! fastLValue() may be called from several threads at once, with block 
+  //! allocation done through a compare-and-swap on the block's state.
+  //! \note Other methods that change the field, and value(), must not be
+  //! called while concurrent writes are in progress.
+  void setConcurrentWrites(const bool enabled);
+
+  //! Returns whether concurrent writes are enabled
+  bool concurrentWrites() const
+  { return m_writeStates != NULL; }
+
+  //! Calls op(vsBounds) for the bounds of each grain, i.e. each block, on
+  //! numIOThreads() threads. Each thread works on its own copy of op. 
+  //! Writes within the given bounds only touch that block, so ops need no
+  //! concurrent writes unless they write outside of the bounds.
+  template <typename Op_T>
+  void parallelForBlocks(const Op_T &op) const;
+
   // From Field base class -----------------------------------------------------
 
   //! \name From Field
@@ -504,8 +1266,14 @@ public:
   Data_T& fastLValue(int i, int j, int k);
 
   //! Returns a pointer to the data in a block, or null if the given block is
-  //! unallocated
+  //! unallocated. The voxels are ordered according to blockLayout()
+  //! \note The block may share its data with copies of the field. Use the 
+  //! non-const version to write through the pointer.
   Data_T* blockData(int bi, int bj, int bk) const;
+  //! Returns a pointer to the data in a block, or null if the given block is
+  //! unallocated. Data shared with copies of the field is copied first, so
+  //! the block may be written to through the pointer.
+  Data_T* blockData(int bi, int bj, int bk);
 
   // From FieldBase ------------------------------------------------------------
 
@@ -561,6 +1329,10 @@ public:
   //! Const iterator pointing to element one past the last valid block
   block_iterator blockEnd() const;
 
+  //! Random access to voxels that remembers the last block it looked in. 
+  //! See SparseField::Accessor for details.
+  class Accessor;
+
   //! \}
 
   // Internal utility functions ------------------------------------------------
@@ -570,8 +1342,19 @@ public:
   void addReference(const std::string &filename, const std::string &layerPath,
                     int valuesPerBlock, int numVoxels, int occupiedBlocks);
   //! Internal function to setup the Reference's block pointers, for
-  //! use with dynamic reading.
-  void setupReferenceBlocks();
+  //! use with dynamic reading. blockTable, if given, holds the index on 
+  //! disk of each allocated block, in order. Without it, the allocated 
+  //! blocks are stored one after the other.
+  void setupReferenceBlocks(const std::vector<uint32_t> *blockTable = NULL);
+  //! Internal function to hand the Reference the block summaries read 
+  //! from disk, for use in dynamic reading. summaries holds the min, max
+  //! and mean of each allocated block, in order. Summaries that don't 
+  //! match the allocated blocks are ignored.
+  void setupReferenceSummaries(const std::vector<Data_T> &summaries);
+  //! Internal function to tell the Reference that the blocks on disk are
+  //! split into tiles of the given order, for use in dynamic reading. 
+  //! Lookups of single voxels then only load the tile they fall in.
+  void setupReferenceTiles(int tileOrder);
 
  protected:
 
@@ -599,15 +1382,29 @@ public:
   //! Initializes the block structure. Will clear any existing data
   void setupBlocks();
 
+  //! Replaces the block array with m_numBlocks unallocated blocks that 
+  //! count themselves in m_numDataBlocks
+  void allocBlocks();
+
   //! Deallocated the data of the given block and sets its empty value
   void deallocBlock(Block &block, const Data_T &emptyValue);
 
+  //! Returns the given block, allocating it if needed. Used by 
+  //! fastLValue() when concurrent writes are enabled.
+  Block& concurrentBlock(const int id);
+
+  //! Resets the concurrent write state of each block to match the blocks.
+  //! Does nothing unless concurrent writes are enabled.
+  void syncWriteStates();
+
   //! \}
 
   // Data members --------------------------------------------------------------
 
   //! Block order (size = 2^blockOrder)
   int m_blockOrder;
+  //! Order of the voxels within each block
+  Sparse::BlockLayout m_blockLayout;
   //! Block array resolution
   V3i m_blockRes;
   //! Block array res.x * res.y
@@ -616,6 +1413,12 @@ public:
   Block *m_blocks;
   //! Number of blocks in field.
   size_t m_numBlocks;
+  //! Number of blocks that have data in memory, kept up to date by the 
+  //! blocks themselves, so that memSize() doesn't visit them
+  boost::atomic<size_t> m_numDataBlocks;
+  //! Allocation state of each block, one of the WriteState values. Only
+  //! allocated when concurrent writes are enabled, otherwise NULL.
+  boost::atomic<int> *m_writeStates;
 
   //! Pointer to SparseFileManager. Used when doing dynamic reading.
   //! NULL if not in use.
@@ -628,6 +1431,15 @@ public:
 
 private:
 
+  // Enums ---------------------------------------------------------------------
+
+  //! Allocation states of a block when concurrent writes are enabled
+  enum WriteState {
+    WriteUnallocated = 0,
+    WriteAllocating,
+    WriteAllocated
+  };
+
   // Static data members -------------------------------------------------------
 
   static TemplatedFieldType<SparseField<Data_T> > ms_classType;
@@ -642,6 +1454,11 @@ private:
   //! without copying data, used when copying a dynamically read field
   void copyBlockStates(const SparseField<Data_T> &o);
 
+  //! Sets up the blocks to hold the values of another field, of the same 
+  //! definition, used by copyFrom()
+  template <class Data_T2>
+  void fillBlocksFrom(const Field<Data_T2> &other);
+
 };
 
 //----------------------------------------------------------------------------//
@@ -657,6 +1474,197 @@ boost::mutex SparseBlock<Data_T>::ms_resizeMutex;
 
 }
 
+//----------------------------------------------------------------------------//
+// SparseBlockPool implementations
+//----------------------------------------------------------------------------//
+
+namespace Sparse {
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+Data_T* SparseBlockPool<Data_T>::allocate(size_t n)
+{
+  State &s = state();
+  boost::mutex::scoped_lock lock(s.mutex);
+
+  SizeClass &sizeClass = s.sizeClasses[n];
+  if (sizeClass.slotBytes == 0) {
+    // Round slots up to keep every array 16-byte aligned, and put around a
+    // megabyte in each slab
+    sizeClass.slotBytes = 
+      (k_headerBytes + n * sizeof(Data_T) + 15) & ~static_cast<size_t>(15);
+    sizeClass.slotsPerSlab = 
+      std::max(static_cast<size_t>(1), (1 << 20) / sizeClass.slotBytes);
+    sizeClass.slabBytes = sizeClass.slotBytes * sizeClass.slotsPerSlab;
+    if (hugePages()) {
+      // Fill whole huge pages instead, so that every slab is backed by them
+      sizeClass.slabBytes = 
+        (sizeClass.slotBytes + k_hugePageBytes - 1) / k_hugePageBytes * 
+        k_hugePageBytes;
+      sizeClass.slotsPerSlab = sizeClass.slabBytes / sizeClass.slotBytes;
+    }
+  }
+
+  if (sizeClass.freeSlots.empty()) {
+    char *slab = static_cast<char *>(allocFieldStorage(sizeClass.slabBytes, 
+                                                       k_headerBytes));
+    if (!slab) {
+      throw std::bad_alloc();
+    }
+    sizeClass.slabs.push_back(slab);
+    for (size_t i = sizeClass.slotsPerSlab; i > 0; --i) {
+      sizeClass.freeSlots.push_back(slab + (i - 1) * sizeClass.slotBytes);
+    }
+    s.reservedBytes += sizeClass.slabBytes;
+  }
+
+  char *slot = sizeClass.freeSlots.back();
+  sizeClass.freeSlots.pop_back();
+  s.usedBytes += sizeClass.slotBytes;
+
+  BOOST_STATIC_ASSERT(sizeof(Header) <= k_headerBytes);
+  Header *h = new (slot) Header;
+  h->n = n;
+  h->refs.store(1, boost::memory_order_relaxed);
+  return reinterpret_cast<Data_T *>(slot + k_headerBytes);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseBlockPool<Data_T>::deallocate(Data_T *data)
+{
+  Header *h = header(data);
+  // Other blocks still use the array. Release makes this block's reads of
+  // it happen before the last owner writes to it
+  if (h->refs.fetch_sub(1, boost::memory_order_acq_rel) > 1) {
+    return;
+  }
+
+  State &s = state();
+  boost::mutex::scoped_lock lock(s.mutex);
+
+  SizeClass &sizeClass = s.sizeClasses[h->n];
+  sizeClass.freeSlots.push_back(reinterpret_cast<char *>(h));
+  s.usedBytes -= sizeClass.slotBytes;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+Data_T* SparseBlockPool<Data_T>::share(Data_T *data)
+{
+  header(data)->refs.fetch_add(1, boost::memory_order_relaxed);
+  return data;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SparseBlockPool<Data_T>::isShared(const Data_T *data)
+{
+  return header(data)->refs.load(boost::memory_order_acquire) > 1;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+size_t SparseBlockPool<Data_T>::size(const Data_T *data)
+{
+  return header(data)->n;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseBlockPool<Data_T>::trim()
+{
+  State &s = state();
+  boost::mutex::scoped_lock lock(s.mutex);
+  trim(s);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseBlockPool<Data_T>::trimToLimit()
+{
+  State &s = state();
+  boost::mutex::scoped_lock lock(s.mutex);
+  if (s.reservedBytes - s.usedBytes > sparseBlockPoolLimit()) {
+    trim(s);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseBlockPool<Data_T>::trim(State &s)
+{
+  for (typename SizeClassMap::iterator i = s.sizeClasses.begin(); 
+       i != s.sizeClasses.end(); ++i) {
+    SizeClass &sizeClass = i->second;
+    // Count the free slots in each slab
+    std::sort(sizeClass.slabs.begin(), sizeClass.slabs.end());
+    std::vector<size_t> numFree(sizeClass.slabs.size(), 0);
+    for (size_t f = 0; f < sizeClass.freeSlots.size(); ++f) {
+      const size_t slab = 
+        std::upper_bound(sizeClass.slabs.begin(), sizeClass.slabs.end(),
+                         sizeClass.freeSlots[f]) - sizeClass.slabs.begin() - 1;
+      numFree[slab]++;
+    }
+    // Free the slabs where every slot is free, and drop their slots
+    std::vector<char *> keptSlabs;
+    for (size_t slab = 0; slab < sizeClass.slabs.size(); ++slab) {
+      if (numFree[slab] == sizeClass.slotsPerSlab) {
+        freeFieldStorage(sizeClass.slabs[slab]);
+        s.reservedBytes -= sizeClass.slabBytes;
+      } else {
+        keptSlabs.push_back(sizeClass.slabs[slab]);
+      }
+    }
+    if (keptSlabs.size() == sizeClass.slabs.size()) {
+      continue;
+    }
+    std::vector<char *> keptSlots;
+    for (size_t f = 0; f < sizeClass.freeSlots.size(); ++f) {
+      const size_t slab = 
+        std::upper_bound(sizeClass.slabs.begin(), sizeClass.slabs.end(),
+                         sizeClass.freeSlots[f]) - sizeClass.slabs.begin() - 1;
+      if (numFree[slab] != sizeClass.slotsPerSlab) {
+        keptSlots.push_back(sizeClass.freeSlots[f]);
+      }
+    }
+    sizeClass.slabs.swap(keptSlabs);
+    sizeClass.freeSlots.swap(keptSlots);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+size_t SparseBlockPool<Data_T>::reservedBytes()
+{
+  State &s = state();
+  boost::mutex::scoped_lock lock(s.mutex);
+  return s.reservedBytes;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+size_t SparseBlockPool<Data_T>::usedBytes()
+{
+  State &s = state();
+  boost::mutex::scoped_lock lock(s.mutex);
+  return s.usedBytes;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace Sparse
+
 //----------------------------------------------------------------------------//
 // Typedefs
 //----------------------------------------------------------------------------//
@@ -874,6 +1882,257 @@ private:
 
 //----------------------------------------------------------------------------//
 
+//! Checks whether two values are within tolerance of each other, 
+//! componentwise for vectors.
+template <typename Data_T>
+inline bool isWithinTolerance(const Data_T &a, const Data_T &b, 
+                              const double tolerance)
+{
+  return std::abs(static_cast<double>(a) - static_cast<double>(b)) <= 
+    tolerance;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Vec_T>
+inline bool isVecWithinTolerance(const Vec_T &a, const Vec_T &b, 
+                                 const double tolerance)
+{
+  return (isWithinTolerance(a.x, b.x, tolerance) &&
+          isWithinTolerance(a.y, b.y, tolerance) &&
+          isWithinTolerance(a.z, b.z, tolerance));
+}
+
+//----------------------------------------------------------------------------//
+
+template <>
+inline bool isWithinTolerance(const V3h &a, const V3h &b, 
+                              const double tolerance)
+{
+  return isVecWithinTolerance(a, b, tolerance);
+}
+
+//----------------------------------------------------------------------------//
+
+template <>
+inline bool isWithinTolerance(const V3f &a, const V3f &b, 
+                              const double tolerance)
+{
+  return isVecWithinTolerance(a, b, tolerance);
+}
+
+//----------------------------------------------------------------------------//
+
+template <>
+inline bool isWithinTolerance(const V3d &a, const V3d &b, 
+                              const double tolerance)
+{
+  return isVecWithinTolerance(a, b, tolerance);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Runs a block operation, i.e. a function object called with the index of 
+//! each block to work on. Used by runBlockOp().
+template <typename Op_T>
+class BlockOpThread
+{
+public:
+  BlockOpThread(const Op_T &op, boost::atomic<size_t> &nextBlock, 
+                const size_t numBlocks)
+    : m_op(op), m_nextBlock(nextBlock), m_numBlocks(numBlocks)
+  { }
+  void operator() ()
+  {
+    // Claim blocks until we run out
+    for (size_t i = m_nextBlock.fetch_add(1); i < m_numBlocks; 
+         i = m_nextBlock.fetch_add(1)) {
+      m_op(i);
+    }
+  }
+private:
+  //! Each thread works on a copy of the operation, so that it may keep 
+  //! scratch space of its own
+  Op_T                   m_op;
+  boost::atomic<size_t> &m_nextBlock;
+  const size_t           m_numBlocks;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Calls op for each block index in [0, numBlocks), on up to 
+//! numIOThreads() threads of the shared ThreadPool. Each call should only 
+//! touch its own block.
+template <typename Op_T>
+void runBlockOp(const Op_T &op, const size_t numBlocks)
+{
+  boost::atomic<size_t> nextBlock(0);
+  runOnThreads(BlockOpThread<Op_T>(op, nextBlock, numBlocks), 
+               std::min(numIOThreads(), numBlocks));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Calls an op with the voxel-space bounds of each grain of a field. Used 
+//! by SparseField::parallelForBlocks().
+template <typename Field_T, typename Op_T>
+class GrainBoundsOp
+{
+public:
+  GrainBoundsOp(const Field_T &field, const Op_T &op)
+    : m_field(&field), m_op(op)
+  { }
+  void operator() (const size_t i)
+  {
+    Box3i vsBounds;
+    m_field->getGrainBounds(i, vsBounds);
+    m_op(vsBounds);
+  }
+private:
+  const Field_T *m_field;
+  Op_T           m_op;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Returns the number of voxels per dim of a block that lie within a data
+//! window of the given resolution
+inline V3i validBlockSize(const V3i &dataRes, const int blockOrder, 
+                          const V3i &blockIdx)
+{
+  const int blockSize = 1 << blockOrder;
+  return V3i(std::min(blockSize, dataRes.x - blockIdx.x * blockSize),
+             std::min(blockSize, dataRes.y - blockIdx.y * blockSize),
+             std::min(blockSize, dataRes.z - blockIdx.z * blockSize));
+}
+
+//----------------------------------------------------------------------------//
+
+//! Copies blocks, along with their allocated flags and empty values. 
+//! If share is set, the blocks refer to the source's data until either is
+//! written to. Used by SparseField's copy constructor and copyFrom().
+template <typename Data_T>
+struct CopyBlockOp
+{
+  CopyBlockOp(SparseBlock<Data_T> *dst, const SparseBlock<Data_T> *src, 
+              const size_t numVoxels, const bool share)
+    : m_dst(dst), m_src(src), m_numVoxels(numVoxels), m_share(share)
+  { }
+  void operator() (const size_t i)
+  {
+    m_dst[i].isAllocated = m_src[i].isAllocated;
+    m_dst[i].emptyValue = m_src[i].emptyValue;
+    if (m_share) {
+      m_dst[i].share(m_src[i], m_numVoxels);
+    } else {
+      m_dst[i].copy(m_src[i], m_numVoxels);
+    }
+  }
+private:
+  SparseBlock<Data_T>       *m_dst;
+  const SparseBlock<Data_T> *m_src;
+  const size_t               m_numVoxels;
+  const bool                 m_share;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Fills unallocated blocks with the values of another field. Blocks that
+//! would hold a single value stay unallocated, with that value as their
+//! empty value. Used by SparseField::copyFrom().
+template <typename Data_T, typename Data_T2>
+struct FillBlockOp
+{
+  FillBlockOp(SparseBlock<Data_T> *blocks, const Field<Data_T2> &src,
+              const V3i &blockRes, const int blockOrder, 
+              const BlockLayout layout)
+    : m_blocks(blocks), m_src(&src), m_blockRes(blockRes), 
+      m_blockOrder(blockOrder), m_layout(layout), 
+      m_scratch(static_cast<size_t>(1) << (blockOrder * 3))
+  { }
+  void operator() (const size_t b)
+  {
+    const V3i blockIdx(b % m_blockRes.x, (b / m_blockRes.x) % m_blockRes.y,
+                       b / m_blockRes.x / m_blockRes.y);
+    const V3i origin = 
+      m_src->dataWindow().min + blockIdx * (1 << m_blockOrder);
+    const V3i valid = 
+      validBlockSize(m_src->dataResolution(), m_blockOrder, blockIdx);
+    for (int k = 0; k < valid.z; ++k) {
+      for (int j = 0; j < valid.y; ++j) {
+        for (int i = 0; i < valid.x; ++i) {
+          m_scratch[blockIndex(i, j, k, m_blockOrder, m_layout)] = 
+            m_src->value(origin.x + i, origin.y + j, origin.z + k);
+        }
+      }
+    }
+    SparseBlock<Data_T> &block = m_blocks[b];
+    if (!isUniformBlock(&m_scratch[0], valid, m_blockOrder, m_layout, 
+                        block.emptyValue)) {
+      block.alloc(m_scratch.size());
+      std::copy(m_scratch.begin(), m_scratch.end(), block.data);
+    }
+  }
+private:
+  SparseBlock<Data_T>      *m_blocks;
+  const Field<Data_T2>     *m_src;
+  const V3i                 m_blockRes;
+  const int                 m_blockOrder;
+  const BlockLayout         m_layout;
+  std::vector<Data_T>       m_scratch;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Releases the allocated blocks whose valid voxels are all within 
+//! tolerance of the block's empty value. Used by 
+//! SparseField::pruneEmptyBlocks().
+template <typename Data_T>
+struct PruneBlockOp
+{
+  PruneBlockOp(SparseBlock<Data_T> *blocks, const V3i &dataRes, 
+               const V3i &blockRes, const int blockOrder, 
+               const BlockLayout layout, const double tolerance, 
+               boost::atomic<int> &numReleased)
+    : m_blocks(blocks), m_dataRes(dataRes), m_blockRes(blockRes), 
+      m_blockOrder(blockOrder), m_layout(layout), m_tolerance(tolerance),
+      m_numReleased(numReleased)
+  { }
+  void operator() (const size_t b)
+  {
+    SparseBlock<Data_T> &block = m_blocks[b];
+    if (!block.isAllocated || !block.data) {
+      return;
+    }
+    const V3i blockIdx(b % m_blockRes.x, (b / m_blockRes.x) % m_blockRes.y,
+                       b / m_blockRes.x / m_blockRes.y);
+    const V3i valid = validBlockSize(m_dataRes, m_blockOrder, blockIdx);
+    for (int k = 0; k < valid.z; ++k) {
+      for (int j = 0; j < valid.y; ++j) {
+        for (int i = 0; i < valid.x; ++i) {
+          if (!isWithinTolerance(block.value(i, j, k, m_blockOrder, m_layout),
+                                 block.emptyValue, m_tolerance)) {
+            return;
+          }
+        }
+      }
+    }
+    block.isAllocated = false;
+    block.clear();
+    m_numReleased++;
+  }
+private:
+  SparseBlock<Data_T> *m_blocks;
+  const V3i            m_dataRes;
+  const V3i            m_blockRes;
+  const int            m_blockOrder;
+  const BlockLayout    m_layout;
+  const double         m_tolerance;
+  boost::atomic<int>  &m_numReleased;
+};
+
+//----------------------------------------------------------------------------//
+
 } // namespace Sparse
 
 //----------------------------------------------------------------------------//
@@ -901,6 +2160,7 @@ class SparseField<Data_T>::const_iterator
     : x(currentPos.x), y(currentPos.y), z(currentPos.z),
       m_p(NULL), m_blockIsActivated(false),
       m_blockStepsTicker(0), m_blockOrder(blockOrder),
+      m_layout(field.m_blockLayout),
       m_blockId(-1), m_window(window), m_field(&field)
   {
     m_manager = m_field->m_fileManager;
@@ -933,12 +2193,22 @@ class SparseField<Data_T>::const_iterator
     }
     // These can both safely be incremented here
     ++m_blockStepsTicker;
-    // ... but only step forward if we're in a non-empty block
-    if (!m_isEmptyBlock && (!m_manager || m_blockIsActivated))
-      ++m_p;
     // Check if we've reached the end of this block
     if (m_blockStepsTicker == (1 << m_blockOrder))
       resetPtr = true;
+    // ... but only step forward if we're in a non-empty block
+    if (!m_isEmptyBlock && (!m_manager || m_blockIsActivated)) {
+      if (m_layout == Sparse::BlockLayoutLinear) {
+        ++m_p;
+      } else if (!resetPtr) {
+        // Still in the same block, but not next to the previous voxel
+        int i = x, j = y, k = z, vi, vj, vk;
+        m_field->applyDataWindowOffset(i, j, k);
+        m_field->getVoxelInBlock(i, j, k, vi, vj, vk);
+        m_p = &m_field->m_blocks[m_blockId].value(vi, vj, vk, m_blockOrder, 
+                                                  m_layout);
+      }
+    }
     if (resetPtr) {
       // If we have, we need to reset the current block, etc.
       m_blockStepsTicker = 0;
@@ -964,7 +2234,7 @@ class SparseField<Data_T>::const_iterator
       const Block &block = m_field->m_blocks[m_blockId];
       int vi, vj, vk;
       m_field->getVoxelInBlock(x, y, z, vi, vj, vk);
-      m_p = &block.value(vi, vj, vk, m_blockOrder);
+      m_p = &block.value(vi, vj, vk, m_blockOrder, m_layout);
     }
     return *m_p;
   }
@@ -977,7 +2247,7 @@ class SparseField<Data_T>::const_iterator
       const Block &block = m_field->m_blocks[m_blockId];
       int vi, vj, vk;
       m_field->getVoxelInBlock(x, y, z, vi, vj, vk);
-      m_p = &block.value(vi, vj, vk, m_blockOrder);
+      m_p = &block.value(vi, vj, vk, m_blockOrder, m_layout);
     }
     return m_p;
   }
@@ -1025,7 +2295,7 @@ private:
       } else {
         // only set m_p to the voxel's address if this is not a
         // managed field, i.e., if the data is already in memory.
-        m_p = &block.value(vi, vj, vk, m_blockOrder);
+        m_p = &block.value(vi, vj, vk, m_blockOrder, m_layout);
       }
       m_isEmptyBlock = false;
     } else {
@@ -1048,6 +2318,8 @@ private:
   int m_blockStepsTicker;
   //! Block size
   int m_blockOrder;
+  //! Order of the voxels within each block
+  Sparse::BlockLayout m_layout;
   //! Current block index
   int m_blockI, m_blockJ, m_blockK, m_blockId;
   //! Window to traverse
@@ -1082,6 +2354,7 @@ class SparseField<Data_T>::iterator
            const V3i &currentPos, int blockOrder)
     : x(currentPos.x), y(currentPos.y), z(currentPos.z),
       m_p(NULL), m_blockStepsTicker(0), m_blockOrder(blockOrder),
+      m_layout(field.m_blockLayout),
       m_blockId(-1), m_window(window), m_field(&field)
   {
     setupNextBlock(x, y, z);
@@ -1106,12 +2379,22 @@ class SparseField<Data_T>::iterator
     }
     // These can both safely be incremented here
     ++m_blockStepsTicker;
-    // ... but only step forward if we're in a non-empty block
-    if (!m_isEmptyBlock)
-      ++m_p;
     // Check if we've reached the end of this block
     if (m_blockStepsTicker == (1 << m_blockOrder))
       resetPtr = true;
+    // ... but only step forward if we're in a non-empty block
+    if (!m_isEmptyBlock) {
+      if (m_layout == Sparse::BlockLayoutLinear) {
+        ++m_p;
+      } else if (!resetPtr) {
+        // Still in the same block, but not next to the previous voxel
+        int i = x, j = y, k = z, vi, vj, vk;
+        m_field->applyDataWindowOffset(i, j, k);
+        m_field->getVoxelInBlock(i, j, k, vi, vj, vk);
+        m_p = &m_field->m_blocks[m_blockId].value(vi, vj, vk, m_blockOrder, 
+                                                  m_layout);
+      }
+    }
     if (resetPtr) {
       // If we have, we need to reset the current block, etc.
       m_blockStepsTicker = 0;
@@ -1180,7 +2463,9 @@ private:
     m_field->getVoxelInBlock(i, j, k, vi, vj, vk);
     m_blockStepsTicker = vi;
     if (block.isAllocated) {
-      m_p = &block.value(vi, vj, vk, m_blockOrder);
+      // The iterator writes, so the block can't stay shared with a copy
+      block.unshare(1 << m_blockOrder << m_blockOrder << m_blockOrder);
+      m_p = &block.value(vi, vj, vk, m_blockOrder, m_layout);
       m_isEmptyBlock = false;
     } else {
       m_p = &block.emptyValue;
@@ -1195,6 +2480,8 @@ private:
   int m_blockStepsTicker;
   //! Block size
   int m_blockOrder;
+  //! Order of the voxels within each block
+  Sparse::BlockLayout m_layout;
   //! Current block index
   int m_blockI, m_blockJ, m_blockK, m_blockId;
   //! Window to traverse
@@ -1271,12 +2558,126 @@ private:
     // Set the member variable
     m_currentBlockWindow = box;
   }
-  //! Bounding box for block indices
-  Box3i m_window;
-  //! Pointer to field we're traversing
-  const class_type& m_field;
-  //! Bounding box in voxel coordinates for the current block
-  Box3i m_currentBlockWindow;
+  //! Bounding box for block indices
+  Box3i m_window;
+  //! Pointer to field we're traversing
+  const class_type& m_field;
+  //! Bounding box in voxel coordinates for the current block
+  Box3i m_currentBlockWindow;
+};
+
+//----------------------------------------------------------------------------//
+// SparseField::Accessor
+//----------------------------------------------------------------------------//
+
+/*! \class SparseField::Accessor
+  Reads voxels like fastValue(), but remembers the block of the previous
+  lookup along with its data pointer. Lookups that stay in the same block
+  skip the allocation check, and for dynamically loaded fields the block 
+  stays referenced until the accessor moves on, so the cache isn't touched
+  either. Spatially coherent access patterns benefit the most.
+
+  An accessor isn't thread safe. Each thread should use its own.
+
+  \note Writes that allocate or release blocks aren't seen by an accessor
+  that is already looking at the block. Call release() after modifying the
+  field's block structure.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class SparseField<Data_T>::Accessor : boost::noncopyable
+{
+public:
+
+  //! Convenience typedef
+  typedef SparseField<Data_T> class_type;
+
+  // Constructors --------------------------------------------------------------
+
+  explicit Accessor(const class_type &field)
+    : m_field(&field), m_blockId(-1), m_data(NULL), 
+      m_emptyValue(static_cast<Data_T>(0)), m_holdsRef(false)
+  { /* Empty */ }
+
+  ~Accessor()
+  { release(); }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Read access to voxel. Same rules as SparseField::fastValue()
+  Data_T value(int i, int j, int k)
+  {
+    assert (i >= m_field->m_dataWindow.min.x);
+    assert (i <= m_field->m_dataWindow.max.x);
+    assert (j >= m_field->m_dataWindow.min.y);
+    assert (j <= m_field->m_dataWindow.max.y);
+    assert (k >= m_field->m_dataWindow.min.z);
+    assert (k <= m_field->m_dataWindow.max.z);
+    // Add crop window offset
+    m_field->applyDataWindowOffset(i, j, k);
+    // Find block
+    int bi, bj, bk;
+    m_field->getBlockCoord(i, j, k, bi, bj, bk);
+    const int id = m_field->blockId(bi, bj, bk);
+    if (id != m_blockId) {
+      setBlock(id);
+    }
+    if (!m_data) {
+      return m_emptyValue;
+    }
+    // Find coord in block
+    int vi, vj, vk;
+    m_field->getVoxelInBlock(i, j, k, vi, vj, vk);
+    return m_data[Sparse::blockIndex(vi, vj, vk, m_field->m_blockOrder,
+                                     m_field->m_blockLayout)];
+  }
+
+  //! Forgets the current block, releasing its reference for dynamically 
+  //! loaded fields
+  void release()
+  {
+    if (m_holdsRef) {
+      m_field->decBlockRef(m_blockId);
+    }
+    m_blockId = -1;
+    m_data = NULL;
+    m_holdsRef = false;
+  }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  void setBlock(const int id)
+  {
+    release();
+    const Block &block = m_field->m_blocks[id];
+    m_blockId = id;
+    m_emptyValue = block.emptyValue;
+    if (block.isAllocated) {
+      if (m_field->m_fileManager) {
+        m_field->incBlockRef(id);
+        m_field->activateBlock(id);
+        m_holdsRef = true;
+      }
+      m_data = block.data;
+    }
+  }
+
+  // Data members --------------------------------------------------------------
+
+  //! The field being accessed
+  const class_type *m_field;
+  //! Index of the current block, or -1
+  int m_blockId;
+  //! Data of the current block. Null if it's unallocated
+  const Data_T *m_data;
+  //! Empty value of the current block
+  Data_T m_emptyValue;
+  //! Whether the current block's ref count was incremented
+  bool m_holdsRef;
 };
 
 //----------------------------------------------------------------------------//
@@ -1287,7 +2688,10 @@ template <class Data_T>
 SparseField<Data_T>::SparseField()
   : base(),
     m_blockOrder(BLOCK_ORDER),
+    m_blockLayout(Sparse::BlockLayoutLinear),
     m_blocks(NULL),
+    m_numDataBlocks(0),
+    m_writeStates(NULL),
     m_fileManager(NULL)
 {
   setupBlocks();
@@ -1299,7 +2703,10 @@ template <class Data_T>
 SparseField<Data_T>::SparseField(const SparseField<Data_T> &o)
  : base(o),
    m_blockOrder(o.m_blockOrder),
+   m_blockLayout(o.m_blockLayout),
    m_blocks(NULL),
+   m_numDataBlocks(0),
+   m_writeStates(NULL),
    m_fileManager(o.m_fileManager)
 {
   copySparseField(o);
@@ -1318,6 +2725,11 @@ SparseField<Data_T>::~SparseField()
   }
   if (m_blocks) {
     delete[] m_blocks;
+    // Hand the freed arrays back to the system if the pool holds too many
+    Sparse::SparseBlockPool<Data_T>::trimToLimit();
+  }
+  if (m_writeStates) {
+    delete[] m_writeStates;
   }
 }
 
@@ -1341,6 +2753,9 @@ void
 SparseField<Data_T>::copySparseField(const SparseField<Data_T> &o)
 {
   m_blockOrder = o.m_blockOrder;
+  m_blockLayout = o.m_blockLayout;
+  // The write states are set up again once the blocks are copied
+  setConcurrentWrites(false);
   if (o.m_fileManager) {
     // allocate m_blocks, sets m_blockRes, m_blockXYSize, m_blocks
     setupBlocks();
@@ -1353,24 +2768,78 @@ SparseField<Data_T>::copySparseField(const SparseField<Data_T> &o)
                  oldReference->occupiedBlocks);
     copyBlockStates(o);
     setupReferenceBlocks();
+    setupReferenceTiles(oldReference->tileOrder);
+    setCachePriority(oldReference->cachePriority);
   } else {
     // directly copy all values and blocks from the source, no extra setup
     m_blockRes = o.m_blockRes;
     m_blockXYSize = o.m_blockXYSize;
-    if (m_blocks) {
-      delete[] m_blocks;
-    }
     m_numBlocks = o.m_numBlocks;
-    m_blocks = new Block[m_numBlocks];
-    for (size_t i = 0; i < m_numBlocks; ++i) {
-      m_blocks[i].isAllocated = o.m_blocks[i].isAllocated;
-      m_blocks[i].emptyValue = o.m_blocks[i].emptyValue;
-      m_blocks[i].copy(o.m_blocks[i],
-                       1 << m_blockOrder << m_blockOrder << m_blockOrder);
-    }
+    allocBlocks();
+    // Blocks are shared until written to, unless the source may be written
+    // to concurrently, which can't stop to copy them
+    Sparse::runBlockOp(Sparse::CopyBlockOp<Data_T>
+                       (m_blocks, o.m_blocks, 
+                        1 << m_blockOrder << m_blockOrder << m_blockOrder,
+                        !o.concurrentWrites()),
+                       m_numBlocks);
     m_fileId = -1;
     m_fileManager = NULL;
   }
+  setConcurrentWrites(o.concurrentWrites());
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::copyFrom(typename Field<Data_T>::Ptr other)
+{
+  // Set mapping
+  FieldRes::setMapping(other->mapping());
+  // Set size to match. This sets up empty blocks
+  base::setSize(other->extents(), other->dataWindow());
+  // In-memory fields with the same block setup copy their blocks directly
+  typename SparseField<Data_T>::Ptr sparse = 
+    field_dynamic_cast<SparseField<Data_T> >(other);
+  if (sparse && !sparse->m_fileManager && 
+      sparse->m_blockOrder == m_blockOrder && 
+      sparse->m_blockLayout == m_blockLayout) {
+    Sparse::runBlockOp(Sparse::CopyBlockOp<Data_T>
+                       (m_blocks, sparse->m_blocks, 
+                        1 << m_blockOrder << m_blockOrder << m_blockOrder,
+                        !concurrentWrites() && !sparse->concurrentWrites()),
+                       m_numBlocks);
+  } else {
+    fillBlocksFrom(*other);
+  }
+  syncWriteStates();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+template <class Data_T2>
+void SparseField<Data_T>::copyFrom(typename Field<Data_T2>::Ptr other)
+{
+  // Set mapping
+  FieldRes::setMapping(other->mapping());
+  // Set size to match. This sets up empty blocks
+  base::setSize(other->extents(), other->dataWindow());
+  // Copy over the data
+  fillBlocksFrom(*other);
+  syncWriteStates();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+template <class Data_T2>
+void SparseField<Data_T>::fillBlocksFrom(const Field<Data_T2> &other)
+{
+  Sparse::runBlockOp(Sparse::FillBlockOp<Data_T, Data_T2>
+                     (m_blocks, other, m_blockRes, m_blockOrder, 
+                      m_blockLayout), 
+                     m_numBlocks);
 }
 
 //----------------------------------------------------------------------------//
@@ -1410,7 +2879,8 @@ void SparseField<Data_T>::copyBlockStates(const SparseField<Data_T> &o)
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-void SparseField<Data_T>::setupReferenceBlocks()
+void SparseField<Data_T>::setupReferenceBlocks
+(const std::vector<uint32_t> *blockTable)
 {
   if (!m_fileManager || m_fileId < 0) return;
 
@@ -1423,7 +2893,7 @@ void SparseField<Data_T>::setupReferenceBlocks()
   int nextBlockIdx = 0;
   for (size_t i = 0; i < m_numBlocks; ++i, ++fb) {
     if (m_blocks[i].isAllocated) {
-      *fb = nextBlockIdx;
+      *fb = blockTable ? (*blockTable)[nextBlockIdx] : nextBlockIdx;
       nextBlockIdx++;
     } else {
       *fb = -1;
@@ -1436,7 +2906,7 @@ void SparseField<Data_T>::setupReferenceBlocks()
   int nextBlockIdx = 0;
   for (size_t i = 0; i < m_numBlocks; ++i, ++fb, ++bp) {
     if (m_blocks[i].isAllocated) {
-      *fb = nextBlockIdx;
+      *fb = blockTable ? (*blockTable)[nextBlockIdx] : nextBlockIdx;
       *bp = m_blocks + i;
       nextBlockIdx++;
     } else {
@@ -1448,6 +2918,54 @@ void SparseField<Data_T>::setupReferenceBlocks()
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void SparseField<Data_T>::setupReferenceTiles(int tileOrder)
+{
+  if (!m_fileManager || m_fileId < 0) return;
+
+  m_fileManager->reference<Data_T>(m_fileId)->setTileOrder(tileOrder);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::setupReferenceSummaries
+(const std::vector<Data_T> &summaries)
+{
+  if (!m_fileManager || m_fileId < 0) return;
+
+  SparseFile::Reference<Data_T> *reference =
+    m_fileManager->reference<Data_T>(m_fileId);
+
+  size_t numAllocated = 0;
+  for (size_t i = 0; i < m_numBlocks; ++i) {
+    if (m_blocks[i].isAllocated) {
+      numAllocated++;
+    }
+  }
+  if (summaries.size() != 3 * numAllocated) {
+    reference->blockSummaries.clear();
+    reference->updateMemSize();
+    return;
+  }
+  // Unallocated blocks hold their empty value throughout
+  reference->blockSummaries.resize(3 * m_numBlocks);
+  typename std::vector<Data_T>::const_iterator s = summaries.begin();
+  typename std::vector<Data_T>::iterator       d = 
+    reference->blockSummaries.begin();
+  for (size_t i = 0; i < m_numBlocks; ++i, d += 3) {
+    if (m_blocks[i].isAllocated) {
+      std::copy(s, s + 3, d);
+      s += 3;
+    } else {
+      std::fill(d, d + 3, m_blocks[i].emptyValue);
+    }
+  }
+  reference->updateMemSize();
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 void SparseField<Data_T>::clear(const Data_T &value)
 {
@@ -1479,6 +2997,47 @@ int SparseField<Data_T>::blockOrder() const
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void SparseField<Data_T>::setBlockLayout(Sparse::BlockLayout layout)
+{
+  if (layout == m_blockLayout) {
+    return;
+  }
+  if (m_fileManager) {
+    Msg::print(Msg::SevWarning, "Called setBlockLayout() on a dynamic-read "
+               "sparse field");
+    return;
+  }
+  // Reorder the allocated blocks
+  const int    blockSize = 1 << m_blockOrder;
+  const size_t numVoxels = 
+    static_cast<size_t>(1) << m_blockOrder << m_blockOrder << m_blockOrder;
+  std::vector<Data_T> tmp(numVoxels);
+  for (size_t b = 0; b < m_numBlocks; ++b) {
+    Block &block = m_blocks[b];
+    if (!block.isAllocated) {
+      continue;
+    }
+    for (int k = 0; k < blockSize; ++k) {
+      for (int j = 0; j < blockSize; ++j) {
+        for (int i = 0; i < blockSize; ++i) {
+          tmp[Sparse::blockIndex(i, j, k, m_blockOrder, layout)] = 
+            block.value(i, j, k, m_blockOrder, m_blockLayout);
+        }
+      }
+    }
+    // Mapped and shared blocks can't be written to, so they get an array of
+    // their own
+    if (block.isMapped || block.isShared()) {
+      block.resize(numVoxels);
+    }
+    std::copy(tmp.begin(), tmp.end(), block.data);
+  }
+  m_blockLayout = layout;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 int SparseField<Data_T>::blockSize() const
 {
@@ -1561,6 +3120,13 @@ int SparseField<Data_T>::releaseBlocks(Functor_T func)
   V3i validSize;
   V3i blockAllocSize(blockSize());
 
+  // Scratch block for the linear copies of edge blocks. It's flagged as 
+  // mapped so that it doesn't try to free the vector's storage
+  std::vector<Data_T> linear;
+  Block linearBlock;
+  linearBlock.isAllocated = true;
+  linearBlock.isMapped = true;
+
   int bx = 0, by = 0, bz = 0;
   for (size_t i = 0; i < m_numBlocks; ++i, ++bx) {
     if (bx >= m_blockRes.x) {
@@ -1582,10 +3148,86 @@ int SparseField<Data_T>::releaseBlocks(Functor_T func)
       validSize.z = dataRes.z - bz * blockAllocSize.z;
     }
 
-    if (m_blocks[i].isAllocated) {
-      if (func.check(m_blocks[i], emptyValue, validSize, blockAllocSize)) {
-        deallocBlock(m_blocks[i], emptyValue);
-        numDeallocs++;
+    if (!m_blocks[i].isAllocated) {
+      continue;
+    }
+    // The functors walk the valid voxels of edge blocks in linear order,
+    // so those get handed over as a linear copy
+    Block *block = &m_blocks[i];
+    if (validSize != blockAllocSize && 
+        m_blockLayout != Sparse::BlockLayoutLinear) {
+      linear.resize(blockAllocSize.x * blockAllocSize.y * blockAllocSize.z);
+      linearBlock.data = &linear[0];
+      for (int vk = 0; vk < blockAllocSize.z; ++vk) {
+        for (int vj = 0; vj < blockAllocSize.y; ++vj) {
+          for (int vi = 0; vi < blockAllocSize.x; ++vi) {
+            linearBlock.value(vi, vj, vk, m_blockOrder) = 
+              block->value(vi, vj, vk, m_blockOrder, m_blockLayout);
+          }
+        }
+      }
+      block = &linearBlock;
+    }
+    if (func.check(*block, emptyValue, validSize, blockAllocSize)) {
+      deallocBlock(m_blocks[i], emptyValue);
+      numDeallocs++;
+    }
+  }
+  return numDeallocs;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseField<Data_T>::blockIsUniform(int bi, int bj, int bk, 
+                                         Data_T &value) const
+{
+  const Block &block = m_blocks[blockId(bi, bj, bk)];
+  if (!block.isAllocated || !block.data) {
+    return false;
+  }
+  // Edge blocks only count the voxels within the data window
+  const V3i validSize = Sparse::validBlockSize(FieldRes::dataResolution(), 
+                                               m_blockOrder, V3i(bi, bj, bk));
+  return Sparse::isUniformBlock(block.data, validSize, m_blockOrder, 
+                                m_blockLayout, value);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseField<Data_T>::blockSummary(int bi, int bj, int bk, Data_T &min, 
+                                       Data_T &max, Data_T &mean) const
+{
+  if (!m_fileManager || m_fileId < 0) {
+    return false;
+  }
+  const SparseFile::Reference<Data_T> *reference = 
+    m_fileManager->reference<Data_T>(m_fileId);
+  if (reference->blockSummaries.empty()) {
+    return false;
+  }
+  const Data_T *summary = &reference->blockSummaries[3 * blockId(bi, bj, bk)];
+  min  = summary[0];
+  max  = summary[1];
+  mean = summary[2];
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int SparseField<Data_T>::releaseUniformBlocks()
+{
+  int numDeallocs = 0;
+  Data_T value;
+  for (int k = 0; k < m_blockRes.z; ++k) {
+    for (int j = 0; j < m_blockRes.y; ++j) {
+      for (int i = 0; i < m_blockRes.x; ++i) {
+        if (blockIsUniform(i, j, k, value)) {
+          deallocBlock(m_blocks[blockId(i, j, k)], value);
+          numDeallocs++;
+        }
       }
     }
   }
@@ -1594,6 +3236,20 @@ int SparseField<Data_T>::releaseBlocks(Functor_T func)
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+int SparseField<Data_T>::pruneEmptyBlocks(double tolerance)
+{
+  boost::atomic<int> numReleased(0);
+  Sparse::runBlockOp(Sparse::PruneBlockOp<Data_T>
+                     (m_blocks, FieldRes::dataResolution(), m_blockRes, 
+                      m_blockOrder, m_blockLayout, tolerance, numReleased),
+                     m_numBlocks);
+  syncWriteStates();
+  return numReleased;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 Data_T SparseField<Data_T>::value(int i, int j, int k) const
 {
@@ -1633,13 +3289,16 @@ Data_T SparseField<Data_T>::fastValue(int i, int j, int k) const
   // Check if block data is allocated
   if (block.isAllocated) {
     if (m_fileManager) {
+      // Tiled blocks only need the voxel's tile
+      const size_t voxelIdx = 
+        Sparse::blockIndex(vi, vj, vk, m_blockOrder, m_blockLayout);
       m_fileManager->incBlockRef<Data_T>(m_fileId, id);
-      m_fileManager->activateBlock<Data_T>(m_fileId, id);
-      Data_T tmpValue = block.value(vi, vj, vk, m_blockOrder);
+      m_fileManager->activateVoxel<Data_T>(m_fileId, id, voxelIdx);
+      Data_T tmpValue = block.data[voxelIdx];
       m_fileManager->decBlockRef<Data_T>(m_fileId, id);
       return tmpValue;
     } else {
-      return block.value(vi, vj, vk, m_blockOrder);
+      return block.value(vi, vj, vk, m_blockOrder, m_blockLayout);
     }
   } else {
     return block.emptyValue;
@@ -1676,15 +3335,24 @@ Data_T& SparseField<Data_T>::fastLValue(int i, int j, int k)
   getVoxelInBlock(i, j, k, vi, vj, vk);
   // Get the actual block
   int id = blockId(bi, bj, bk);
+  // With concurrent writes, the block's state tells if it's allocated
+  if (m_writeStates) {
+    return concurrentBlock(id).value(vi, vj, vk, m_blockOrder, 
+                                     m_blockLayout);
+  }
   Block &block = m_blocks[id];
   // If block is allocated, return a reference to the data
   if (block.isAllocated) {
-    return block.value(vi, vj, vk, m_blockOrder);
+    // Data shared with a copy of the field gets copied on the first write
+    if (block.isShared()) {
+      block.unshare(1 << m_blockOrder << m_blockOrder << m_blockOrder);
+    }
+    return block.value(vi, vj, vk, m_blockOrder, m_blockLayout);
   } else {
     // ... Otherwise, allocate block
     size_t blockSize = 1 << m_blockOrder << m_blockOrder << m_blockOrder;
     block.resize(blockSize);
-    return block.value(vi, vj, vk, m_blockOrder);
+    return block.value(vi, vj, vk, m_blockOrder, m_blockLayout);
   }
 }
 
@@ -1705,17 +3373,41 @@ Data_T* SparseField<Data_T>::blockData(int bi, int bj, int bk) const
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-long long int SparseField<Data_T>::memSize() const
+Data_T* SparseField<Data_T>::blockData(int bi, int bj, int bk)
 {
-  long long int blockSize = m_numBlocks * sizeof(Block);
-  long long int dataSize = 0;
+  Block &block = m_blocks[blockId(bi, bj, bk)];
+  if (block.isAllocated) {
+    block.unshare(1 << m_blockOrder << m_blockOrder << m_blockOrder);
+    return block.data;
+  } else {
+    return NULL;
+  }
+}
 
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::allocBlocks()
+{
+  if (m_blocks) {
+    delete[] m_blocks;
+  }
+  m_blocks = new Block[m_numBlocks];
   for (size_t i = 0; i < m_numBlocks; ++i) {
-    if (m_blocks[i].data) {
-      dataSize += (1 << m_blockOrder << m_blockOrder << m_blockOrder) *
-        sizeof(Data_T);
-    }
+    m_blocks[i].numDataBlocks = &m_numDataBlocks;
   }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+long long int SparseField<Data_T>::memSize() const
+{
+  long long int blockSize = m_numBlocks * sizeof(Block);
+  long long int dataSize = 
+    static_cast<long long int>
+    (m_numDataBlocks.load(boost::memory_order_relaxed)) *
+    (1 << m_blockOrder << m_blockOrder << m_blockOrder) * sizeof(Data_T);
 
   return sizeof(*this) + dataSize + blockSize;
 }
@@ -1868,11 +3560,13 @@ void SparseField<Data_T>::setupBlocks()
                          static_cast<int>(blockRes.z));
   m_blockRes = intBlockRes;
   m_blockXYSize = m_blockRes.x * m_blockRes.y;
-  if (m_blocks) {
-    delete[] m_blocks;
-  }
   m_numBlocks = intBlockRes.x * intBlockRes.y * intBlockRes.z;
-  m_blocks = new Block[m_numBlocks];
+  allocBlocks();
+  if (m_writeStates) {
+    delete[] m_writeStates;
+    m_writeStates = new boost::atomic<int>[m_numBlocks];
+    syncWriteStates();
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -1939,6 +3633,168 @@ void SparseField<Data_T>::decBlockRef(const int blockId) const
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void SparseField<Data_T>::prefetch(const Box3i &vsBounds) const
+{
+  if (!m_fileManager) {
+    return;
+  }
+
+  const Box3i bounds = clipBounds(vsBounds, base::m_dataWindow);
+  if (bounds.isEmpty()) {
+    return;
+  }
+
+  // Find the range of blocks
+  int iMin = bounds.min.x, jMin = bounds.min.y, kMin = bounds.min.z;
+  int iMax = bounds.max.x, jMax = bounds.max.y, kMax = bounds.max.z;
+  applyDataWindowOffset(iMin, jMin, kMin);
+  applyDataWindowOffset(iMax, jMax, kMax);
+  int biMin, bjMin, bkMin, biMax, bjMax, bkMax;
+  getBlockCoord(iMin, jMin, kMin, biMin, bjMin, bkMin);
+  getBlockCoord(iMax, jMax, kMax, biMax, bjMax, bkMax);
+
+  std::vector<int> blockIds;
+  for (int bk = bkMin; bk <= bkMax; ++bk) {
+    for (int bj = bjMin; bj <= bjMax; ++bj) {
+      for (int bi = biMin; bi <= biMax; ++bi) {
+        const int id = blockId(bi, bj, bk);
+        if (m_blocks[id].isAllocated) {
+          blockIds.push_back(id);
+        }
+      }
+    }
+  }
+
+  prefetchBlocks(blockIds);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::prefetchBlocks(const std::vector<int> &blockIds) const
+{
+  if (!m_fileManager) {
+    return;
+  }
+
+  for (size_t i = 0, end = blockIds.size(); i < end; ++i) {
+    const int id = blockIds[i];
+    if (id >= 0 && static_cast<size_t>(id) < m_numBlocks) {
+      m_fileManager->prefetchBlock<Data_T>(m_fileId, id);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::prefetchSegment(const V3d &vsStart, 
+                                          const V3d &vsEnd) const
+{
+  if (!m_fileManager) {
+    return;
+  }
+
+  // Work in block space, where each block is a unit cube and the block
+  // grid starts at the origin
+  const double blockSize = static_cast<double>(1 << m_blockOrder);
+  const V3d    origin(base::m_dataWindow.min);
+  const V3d    p0  = (vsStart - origin) / blockSize;
+  const V3d    dir = (vsEnd - origin) / blockSize - p0;
+  const V3d    res(m_blockRes);
+
+  // Clip the segment, parameterized on [0,1], to the block grid
+  double tStart = 0.0, tEnd = 1.0;
+  for (int dim = 0; dim < 3; ++dim) {
+    if (dir[dim] == 0.0) {
+      if (p0[dim] < 0.0 || p0[dim] > res[dim]) {
+        return;
+      }
+      continue;
+    }
+    double t0 = -p0[dim] / dir[dim];
+    double t1 = (res[dim] - p0[dim]) / dir[dim];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    tStart = std::max(tStart, t0);
+    tEnd   = std::min(tEnd, t1);
+  }
+  if (tStart > tEnd) {
+    return;
+  }
+
+  // 3D DDA, after Amanatides & Woo, "A Fast Voxel Traversal Algorithm"
+  const V3d start = p0 + dir * tStart;
+  int    b[3], step[3];
+  double tMax[3], tDelta[3];
+  for (int dim = 0; dim < 3; ++dim) {
+    b[dim] = std::min(std::max(static_cast<int>(std::floor(start[dim])), 0),
+                      m_blockRes[dim] - 1);
+    if (dir[dim] > 0.0) {
+      step[dim]   = 1;
+      tDelta[dim] = 1.0 / dir[dim];
+      tMax[dim]   = tStart + (b[dim] + 1 - start[dim]) / dir[dim];
+    } else if (dir[dim] < 0.0) {
+      step[dim]   = -1;
+      tDelta[dim] = -1.0 / dir[dim];
+      tMax[dim]   = tStart + (b[dim] - start[dim]) / dir[dim];
+    } else {
+      step[dim]   = 0;
+      tDelta[dim] = std::numeric_limits<double>::max();
+      tMax[dim]   = std::numeric_limits<double>::max();
+    }
+  }
+
+  std::vector<int> blockIds;
+  while (true) {
+    const int id = blockId(b[0], b[1], b[2]);
+    if (m_blocks[id].isAllocated) {
+      blockIds.push_back(id);
+    }
+    // Step across the nearest block boundary
+    const int dim = (tMax[0] < tMax[1]) ? 
+      (tMax[0] < tMax[2] ? 0 : 2) : (tMax[1] < tMax[2] ? 1 : 2);
+    if (tMax[dim] > tEnd) {
+      break;
+    }
+    b[dim] += step[dim];
+    if (b[dim] < 0 || b[dim] >= m_blockRes[dim]) {
+      break;
+    }
+    tMax[dim] += tDelta[dim];
+  }
+
+  prefetchBlocks(blockIds);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::setCachePriority(const int priority)
+{
+  if (!m_fileManager) {
+    return;
+  }
+
+  m_fileManager->reference<Data_T>(m_fileId)->cachePriority = priority;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int SparseField<Data_T>::cachePriority() const
+{
+  if (!m_fileManager) {
+    return 0;
+  }
+
+  return m_fileManager->reference<Data_T>(m_fileId)->cachePriority;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 size_t SparseField<Data_T>::numGrains() const
 {
@@ -1973,6 +3829,85 @@ void SparseField<Data_T>::deallocBlock(Block &block, const Data_T &emptyValue)
   //! Block::clear() deallocates the data
   block.clear();
   block.emptyValue = emptyValue;
+  if (m_writeStates) {
+    m_writeStates[&block - m_blocks].store(WriteUnallocated, 
+                                           boost::memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseField<Data_T>::Block& 
+SparseField<Data_T>::concurrentBlock(const int id)
+{
+  Block &block = m_blocks[id];
+  boost::atomic<int> &state = m_writeStates[id];
+  // Allocated blocks need no locking
+  if (state.load(boost::memory_order_acquire) == WriteAllocated) {
+    return block;
+  }
+  // The thread that claims the block allocates it. Others wait for it
+  int expected = WriteUnallocated;
+  if (state.compare_exchange_strong(expected, WriteAllocating,
+                                    boost::memory_order_acquire,
+                                    boost::memory_order_acquire)) {
+    block.resize(1 << m_blockOrder << m_blockOrder << m_blockOrder);
+    state.store(WriteAllocated, boost::memory_order_release);
+  } else {
+    while (state.load(boost::memory_order_acquire) != WriteAllocated) {
+      boost::this_thread::yield();
+    }
+  }
+  return block;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::syncWriteStates()
+{
+  if (!m_writeStates) {
+    return;
+  }
+  for (size_t i = 0; i < m_numBlocks; ++i) {
+    m_writeStates[i].store(m_blocks[i].isAllocated ? 
+                           WriteAllocated : WriteUnallocated, 
+                           boost::memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseField<Data_T>::setConcurrentWrites(const bool enabled)
+{
+  if (enabled == concurrentWrites()) {
+    return;
+  }
+  if (enabled) {
+    // Concurrent writers can't copy shared blocks, so that's done up front
+    const size_t numVoxels = 
+      1 << m_blockOrder << m_blockOrder << m_blockOrder;
+    for (size_t i = 0; i < m_numBlocks; ++i) {
+      m_blocks[i].unshare(numVoxels);
+    }
+    m_writeStates = new boost::atomic<int>[m_numBlocks];
+    syncWriteStates();
+  } else {
+    delete[] m_writeStates;
+    m_writeStates = NULL;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+template <typename Op_T>
+void SparseField<Data_T>::parallelForBlocks(const Op_T &op) const
+{
+  Sparse::runBlockOp(Sparse::GrainBoundsOp<SparseField<Data_T>, Op_T>
+                     (*this, op), m_numBlocks);
 }
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,536 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseFieldMinMaxTree.h
+  \brief Contains the SparseFieldMinMaxTree class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseFieldMinMaxTree_H_
+#define _INCLUDED_Field3D_SparseFieldMinMaxTree_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Range helpers
+//----------------------------------------------------------------------------//
+
+namespace Sparse {
+
+  //! Min of two values. Vectors are compared per component.
+  template <typename T>
+  T rangeMin(const T &a, const T &b)
+  { return std::min(a, b); }
+
+  //! Max of two values. Vectors are compared per component.
+  template <typename T>
+  T rangeMax(const T &a, const T &b)
+  { return std::max(a, b); }
+
+  template <typename T>
+  FIELD3D_VEC3_T<T> rangeMin(const FIELD3D_VEC3_T<T> &a, 
+                             const FIELD3D_VEC3_T<T> &b)
+  {
+    return FIELD3D_VEC3_T<T>(std::min(a.x, b.x), std::min(a.y, b.y), 
+                             std::min(a.z, b.z));
+  }
+
+  template <typename T>
+  FIELD3D_VEC3_T<T> rangeMax(const FIELD3D_VEC3_T<T> &a, 
+                             const FIELD3D_VEC3_T<T> &b)
+  {
+    return FIELD3D_VEC3_T<T>(std::max(a.x, b.x), std::max(a.y, b.y), 
+                             std::max(a.z, b.z));
+  }
+
+} // namespace Sparse
+
+//----------------------------------------------------------------------------//
+// SparseFieldMinMaxTree
+//----------------------------------------------------------------------------//
+
+/*! \class SparseFieldMinMaxTree
+  \ingroup field
+  \brief Hierarchy of value ranges over the block grid of a SparseField.
+
+  Level 0 holds the min and max of each block. Unallocated blocks get 
+  their empty value. Each level above halves the resolution, so the node
+  at level L covers up to 2^L x 2^L x 2^L blocks, and level 3 nodes are
+  super-blocks of 8^3 blocks. Nodes whose min equals their max are 
+  constant, which lets a whole region of the field be skipped or answered
+  in one step.
+
+  The tree is built lazily, on the first query, and is safe to query from
+  several threads. Only the voxels inside the data window are considered.
+  The blocks of dynamically loaded fields whose files record block 
+  summaries aren't loaded to build the tree.
+
+  \note The tree doesn't track changes to the field. Call update() after 
+  writing to it, or updateBlock() for each block that was written.
+  \note The tree doesn't hold a reference to the field. It must be kept
+  alive for as long as the tree is used.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class SparseFieldMinMaxTree : boost::noncopyable
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_ptr<SparseFieldMinMaxTree> Ptr;
+
+  // Constructors --------------------------------------------------------------
+
+  //! Sets up the tree. Nothing is computed until the first query.
+  explicit SparseFieldMinMaxTree(const SparseField<Data_T> &field)
+    : m_field(field), m_isBuilt(false)
+  { }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Rebuilds the tree from the current contents of the field
+  void update();
+
+  //! Recomputes the range of a single block and of the nodes above it.
+  //! The block resolution of the field must not have changed since the
+  //! tree was built.
+  void updateBlock(const int bi, const int bj, const int bk);
+
+  //! Expands min and max to include the voxels inside vsBounds. Constant
+  //! nodes and nodes that lie entirely inside the bounds are used as is, so
+  //! only the allocated blocks on the boundary of the bounds are read.
+  //! \returns False if the bounds don't intersect the data window, in 
+  //! which case min and max are left untouched.
+  bool getMinMax(const Box3i &vsBounds, Data_T &min, Data_T &max) const;
+
+  //! Number of levels. The top level has a single node.
+  int numLevels() const;
+
+  //! Resolution of the given level
+  V3i levelRes(const int level) const;
+
+  //! Whether all voxels under the given node hold the same value
+  bool isConstant(const int level, const V3i &node, Data_T &value) const;
+
+  //! Min and max of the given node
+  void nodeMinMax(const int level, const V3i &node, 
+                  Data_T &min, Data_T &max) const;
+
+  //! Returns the memory use of the tree in bytes
+  long long int memSize() const;
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! Value ranges of the nodes of one level
+  struct Level
+  {
+    V3i                 res;
+    std::vector<Data_T> min, max;
+
+    size_t index(int i, int j, int k) const
+    { return i + res.x * (j + res.y * static_cast<size_t>(k)); }
+  };
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Builds the tree unless it's already built
+  void ensureBuilt() const;
+  //! Builds all levels
+  void build() const;
+  //! Range of the voxels of one block
+  void blockMinMax(const int bi, const int bj, const int bk, 
+                   Data_T &min, Data_T &max) const;
+  //! Merges the ranges of the children of a node above level 0
+  void mergeChildren(const int level, const int i, const int j, 
+                     const int k) const;
+  //! Voxel bounds of a node, clipped to the data window
+  Box3i nodeBounds(const int level, const V3i &node) const;
+  //! Recursive part of getMinMax()
+  void getMinMax(const int level, const V3i &node, const Box3i &vsBounds, 
+                 Data_T &min, Data_T &max) const;
+
+  // Data members --------------------------------------------------------------
+
+  //! The field the tree describes
+  const SparseField<Data_T> &m_field;
+  //! Levels, finest first
+  mutable std::vector<Level> m_levels;
+  //! Whether m_levels is up to date
+  mutable boost::atomic<bool> m_isBuilt;
+  //! Serializes building
+  mutable boost::mutex m_mutex;
+
+};
+
+//----------------------------------------------------------------------------//
+// SparseFieldMinMaxTree implementations
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::update()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  build();
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::updateBlock(const int bi, const int bj, 
+                                                const int bk)
+{
+  ensureBuilt();
+  boost::mutex::scoped_lock lock(m_mutex);
+  Level &base = m_levels[0];
+  const size_t idx = base.index(bi, bj, bk);
+  blockMinMax(bi, bj, bk, base.min[idx], base.max[idx]);
+  for (int level = 1, i = bi / 2, j = bj / 2, k = bk / 2; 
+       level < static_cast<int>(m_levels.size()); 
+       ++level, i /= 2, j /= 2, k /= 2) {
+    mergeChildren(level, i, j, k);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SparseFieldMinMaxTree<Data_T>::getMinMax(const Box3i &vsBounds, 
+                                              Data_T &min, Data_T &max) const
+{
+  const Box3i &dw = m_field.dataWindow();
+  const Box3i bounds(V3i(std::max(vsBounds.min.x, dw.min.x),
+                         std::max(vsBounds.min.y, dw.min.y),
+                         std::max(vsBounds.min.z, dw.min.z)),
+                     V3i(std::min(vsBounds.max.x, dw.max.x),
+                         std::min(vsBounds.max.y, dw.max.y),
+                         std::min(vsBounds.max.z, dw.max.z)));
+  if (bounds.isEmpty()) {
+    return false;
+  }
+  ensureBuilt();
+  const int top = static_cast<int>(m_levels.size()) - 1;
+  Data_T lo = m_levels[top].min[0], hi = m_levels[top].max[0];
+  if (bounds != dw) {
+    // Seed with a voxel inside the bounds, then refine
+    lo = hi = m_field.fastValue(bounds.min.x, bounds.min.y, bounds.min.z);
+    getMinMax(top, V3i(0), bounds, lo, hi);
+  }
+  min = Sparse::rangeMin(min, lo);
+  max = Sparse::rangeMax(max, hi);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+int SparseFieldMinMaxTree<Data_T>::numLevels() const
+{
+  ensureBuilt();
+  return static_cast<int>(m_levels.size());
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+V3i SparseFieldMinMaxTree<Data_T>::levelRes(const int level) const
+{
+  ensureBuilt();
+  return m_levels[level].res;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+bool SparseFieldMinMaxTree<Data_T>::isConstant(const int level, 
+                                               const V3i &node,
+                                               Data_T &value) const
+{
+  ensureBuilt();
+  const Level &l = m_levels[level];
+  const size_t idx = l.index(node.x, node.y, node.z);
+  value = l.min[idx];
+  return l.min[idx] == l.max[idx];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::nodeMinMax(const int level, 
+                                               const V3i &node,
+                                               Data_T &min, Data_T &max) const
+{
+  ensureBuilt();
+  const Level &l = m_levels[level];
+  const size_t idx = l.index(node.x, node.y, node.z);
+  min = l.min[idx];
+  max = l.max[idx];
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+long long int SparseFieldMinMaxTree<Data_T>::memSize() const
+{
+  long long int size = sizeof(*this);
+  for (size_t i = 0; i < m_levels.size(); ++i) {
+    size += 2 * m_levels[i].min.capacity() * sizeof(Data_T);
+  }
+  return size;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::ensureBuilt() const
+{
+  if (m_isBuilt.load(boost::memory_order_acquire)) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (!m_isBuilt.load(boost::memory_order_relaxed)) {
+    build();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::build() const
+{
+  m_levels.clear();
+
+  // Level 0 - one node per block
+  Level base;
+  base.res = m_field.blockRes();
+  const size_t numBlocks = 
+    static_cast<size_t>(base.res.x) * base.res.y * base.res.z;
+  base.min.resize(numBlocks);
+  base.max.resize(numBlocks);
+  for (int bk = 0; bk < base.res.z; ++bk) {
+    for (int bj = 0; bj < base.res.y; ++bj) {
+      for (int bi = 0; bi < base.res.x; ++bi) {
+        const size_t idx = base.index(bi, bj, bk);
+        blockMinMax(bi, bj, bk, base.min[idx], base.max[idx]);
+      }
+    }
+  }
+  m_levels.push_back(base);
+
+  // Coarser levels - each node merges up to 2x2x2 children
+  while (m_levels.back().res != V3i(1)) {
+    const V3i childRes = m_levels.back().res;
+    Level level;
+    level.res = V3i((childRes.x + 1) / 2, (childRes.y + 1) / 2, 
+                    (childRes.z + 1) / 2);
+    const size_t numNodes = 
+      static_cast<size_t>(level.res.x) * level.res.y * level.res.z;
+    level.min.resize(numNodes);
+    level.max.resize(numNodes);
+    m_levels.push_back(level);
+    const int l = static_cast<int>(m_levels.size()) - 1;
+    for (int k = 0; k < level.res.z; ++k) {
+      for (int j = 0; j < level.res.y; ++j) {
+        for (int i = 0; i < level.res.x; ++i) {
+          mergeChildren(l, i, j, k);
+        }
+      }
+    }
+  }
+
+  m_isBuilt.store(true, boost::memory_order_release);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::blockMinMax(const int bi, const int bj, 
+                                                const int bk, Data_T &min, 
+                                                Data_T &max) const
+{
+  if (!m_field.blockIsAllocated(bi, bj, bk)) {
+    min = max = m_field.getBlockEmptyValue(bi, bj, bk);
+    return;
+  }
+  // Dynamically loaded blocks may have their range recorded on disk,
+  // which saves loading them
+  Data_T mean;
+  if (m_field.blockSummary(bi, bj, bk, min, max, mean)) {
+    return;
+  }
+  const Box3i bounds = nodeBounds(0, V3i(bi, bj, bk));
+  Data_T lo = m_field.fastValue(bounds.min.x, bounds.min.y, bounds.min.z);
+  Data_T hi = lo;
+  for (int k = bounds.min.z; k <= bounds.max.z; ++k) {
+    for (int j = bounds.min.y; j <= bounds.max.y; ++j) {
+      for (int i = bounds.min.x; i <= bounds.max.x; ++i) {
+        const Data_T value = m_field.fastValue(i, j, k);
+        lo = Sparse::rangeMin(lo, value);
+        hi = Sparse::rangeMax(hi, value);
+      }
+    }
+  }
+  min = lo;
+  max = hi;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::mergeChildren(const int level, 
+                                                  const int i, const int j, 
+                                                  const int k) const
+{
+  const Level &child = m_levels[level - 1];
+  Level       &l     = m_levels[level];
+  const size_t first = child.index(2 * i, 2 * j, 2 * k);
+  Data_T lo = child.min[first], hi = child.max[first];
+  for (int ck = 2 * k; ck < std::min(2 * k + 2, child.res.z); ++ck) {
+    for (int cj = 2 * j; cj < std::min(2 * j + 2, child.res.y); ++cj) {
+      for (int ci = 2 * i; ci < std::min(2 * i + 2, child.res.x); ++ci) {
+        const size_t idx = child.index(ci, cj, ck);
+        lo = Sparse::rangeMin(lo, child.min[idx]);
+        hi = Sparse::rangeMax(hi, child.max[idx]);
+      }
+    }
+  }
+  const size_t idx = l.index(i, j, k);
+  l.min[idx] = lo;
+  l.max[idx] = hi;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+Box3i SparseFieldMinMaxTree<Data_T>::nodeBounds(const int level, 
+                                                const V3i &node) const
+{
+  const Box3i &dw = m_field.dataWindow();
+  const int size = m_field.blockSize() << level;
+  const V3i min = dw.min + node * size;
+  const V3i max = min + V3i(size - 1);
+  return Box3i(min, V3i(std::min(max.x, dw.max.x), std::min(max.y, dw.max.y),
+                        std::min(max.z, dw.max.z)));
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+void SparseFieldMinMaxTree<Data_T>::getMinMax(const int level, 
+                                              const V3i &node, 
+                                              const Box3i &vsBounds,
+                                              Data_T &min, Data_T &max) const
+{
+  const Box3i bounds = nodeBounds(level, node);
+  if (!bounds.intersects(vsBounds)) {
+    return;
+  }
+
+  const Level &l = m_levels[level];
+  const size_t idx = l.index(node.x, node.y, node.z);
+
+  // Constant nodes, and nodes entirely inside the bounds
+  if (l.min[idx] == l.max[idx] || 
+      (vsBounds.intersects(bounds.min) && vsBounds.intersects(bounds.max))) {
+    min = Sparse::rangeMin(min, l.min[idx]);
+    max = Sparse::rangeMax(max, l.max[idx]);
+    return;
+  }
+
+  // Nothing to gain from reading voxels if the node's range is covered
+  if (Sparse::rangeMin(min, l.min[idx]) == min && 
+      Sparse::rangeMax(max, l.max[idx]) == max) {
+    return;
+  }
+
+  if (level == 0) {
+    // Partially covered allocated block - read the voxels
+    const Box3i clipped(V3i(std::max(bounds.min.x, vsBounds.min.x),
+                            std::max(bounds.min.y, vsBounds.min.y),
+                            std::max(bounds.min.z, vsBounds.min.z)),
+                        V3i(std::min(bounds.max.x, vsBounds.max.x),
+                            std::min(bounds.max.y, vsBounds.max.y),
+                            std::min(bounds.max.z, vsBounds.max.z)));
+    for (int k = clipped.min.z; k <= clipped.max.z; ++k) {
+      for (int j = clipped.min.y; j <= clipped.max.y; ++j) {
+        for (int i = clipped.min.x; i <= clipped.max.x; ++i) {
+          const Data_T value = m_field.fastValue(i, j, k);
+          min = Sparse::rangeMin(min, value);
+          max = Sparse::rangeMax(max, value);
+        }
+      }
+    }
+    return;
+  }
+
+  // Recurse into the children
+  const Level &child = m_levels[level - 1];
+  for (int k = 2 * node.z; k < std::min(2 * node.z + 2, child.res.z); ++k) {
+    for (int j = 2 * node.y; j < std::min(2 * node.y + 2, child.res.y); ++j) {
+      for (int i = 2 * node.x; i < std::min(2 * node.x + 2, child.res.x); ++i) {
+        getMinMax(level - 1, V3i(i, j, k), vsBounds, min, max);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,397 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseFieldRayIterator.h
+  \brief Contains the SparseFieldRayIterator class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseFieldRayIterator_H_
+#define _INCLUDED_Field3D_SparseFieldRayIterator_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "SparseField.h"
+#include "SparseFieldMinMaxTree.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// SparseFieldRayIterator
+//----------------------------------------------------------------------------//
+
+/*! \class SparseFieldRayIterator
+  \ingroup field
+  \brief Walks the blocks of a SparseField that a voxel-space ray passes
+  through, in order, using a 3D DDA over the block grid.
+
+  Each step reports the block coordinate and the parametric interval
+  [t0, t1) the ray spends inside it. When constructed with a skip value, 
+  unallocated blocks whose empty value equals it are jumped over without 
+  being reported, so a ray marcher only visits the parts of the field that
+  hold data:
+
+  \code
+  SparseFieldRayIterator<float> i(field, vsOrigin, vsDir, 0.0, tMax, 0.0f);
+  for (; i.isValid(); ++i) {
+    for (double t = i.t0(); t < i.t1(); t += step) {
+      ...
+    }
+  }
+  \endcode
+
+  Given a SparseFieldMinMaxTree, any node of the tree that is constant 
+  and holds the skip value is jumped over in a single step. This includes
+  allocated blocks, and super-blocks of many blocks.
+
+  The ray is clipped to the data window. vsDir need not be normalized; 
+  t is measured in multiples of it.
+
+  \note Interpolated lookups within half a voxel of a skipped block still 
+  read the voxels of its neighbors, so they may differ slightly from the 
+  skip value.
+
+  \note The iterator doesn't hold a reference to the field or the tree. 
+  They must be kept alive for as long as the iterator is used.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+class SparseFieldRayIterator
+{
+public:
+
+  // Constructors --------------------------------------------------------------
+
+  //! Visits every block the ray passes through between tMin and tMax
+  SparseFieldRayIterator(const SparseField<Data_T> &field, 
+                         const V3d &vsOrigin, const V3d &vsDir,
+                         const double tMin, const double tMax)
+    : m_field(field), m_tree(NULL), m_origin(vsOrigin), m_dir(vsDir), 
+      m_doSkip(false), m_skipValue(static_cast<Data_T>(0))
+  { 
+    init(tMin, tMax);
+  }
+
+  //! Visits the blocks the ray passes through between tMin and tMax, 
+  //! except unallocated ones whose empty value is skipValue
+  SparseFieldRayIterator(const SparseField<Data_T> &field, 
+                         const V3d &vsOrigin, const V3d &vsDir,
+                         const double tMin, const double tMax, 
+                         const Data_T &skipValue)
+    : m_field(field), m_tree(NULL), m_origin(vsOrigin), m_dir(vsDir), 
+      m_doSkip(true), m_skipValue(skipValue)
+  { 
+    init(tMin, tMax);
+  }
+
+  //! Visits the blocks the ray passes through between tMin and tMax, 
+  //! except those under a constant node of the tree that holds skipValue.
+  //! The tree must have been built from the same field.
+  SparseFieldRayIterator(const SparseField<Data_T> &field, 
+                         const SparseFieldMinMaxTree<Data_T> &tree,
+                         const V3d &vsOrigin, const V3d &vsDir,
+                         const double tMin, const double tMax, 
+                         const Data_T &skipValue)
+    : m_field(field), m_tree(&tree), m_origin(vsOrigin), m_dir(vsDir), 
+      m_doSkip(true), m_skipValue(skipValue)
+  { 
+    init(tMin, tMax);
+  }
+
+  // Main methods --------------------------------------------------------------
+
+  //! Whether the iterator points to a block. False once the ray has left 
+  //! the data window or passed tMax.
+  bool isValid() const
+  { return m_isValid; }
+
+  //! Moves on to the next block along the ray
+  const SparseFieldRayIterator& operator ++ ()
+  {
+    advance();
+    if (m_doSkip) {
+      skipEmpty();
+    }
+    return *this;
+  }
+
+  //! Coordinate of the current block
+  const V3i& blockCoord() const
+  { return m_block; }
+
+  //! Ray parameter where the ray enters the current block
+  double t0() const
+  { return m_t0; }
+
+  //! Ray parameter where the ray leaves the current block
+  double t1() const
+  { return m_t1; }
+
+  //! Whether the current block is allocated
+  bool isAllocated() const
+  { return m_field.blockIsAllocated(m_block.x, m_block.y, m_block.z); }
+
+  //! The constant value of the current block, if it isn't allocated
+  Data_T emptyValue() const
+  { return m_field.getBlockEmptyValue(m_block.x, m_block.y, m_block.z); }
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Clips the ray to the data window and finds the first block
+  void init(const double tMin, const double tMax)
+  {
+    const Box3i &dw = m_field.dataWindow();
+    const V3d boundsMin(dw.min);
+    const V3d boundsMax(dw.max + V3i(1));
+
+    m_blockRes = m_field.blockRes();
+    m_isValid = false;
+
+    // Clip against the data window
+    double tEnter = tMin, tExit = tMax;
+    for (int dim = 0; dim < 3; ++dim) {
+      if (m_dir[dim] == 0.0) {
+        if (m_origin[dim] < boundsMin[dim] || m_origin[dim] >= boundsMax[dim]) {
+          return;
+        }
+      } else {
+        double ta = (boundsMin[dim] - m_origin[dim]) / m_dir[dim];
+        double tb = (boundsMax[dim] - m_origin[dim]) / m_dir[dim];
+        if (ta > tb) {
+          std::swap(ta, tb);
+        }
+        tEnter = std::max(tEnter, ta);
+        tExit = std::min(tExit, tb);
+      }
+    }
+    if (!(tEnter < tExit)) {
+      return;
+    }
+
+    m_tExit = tExit;
+    start(tEnter);
+
+    if (m_doSkip) {
+      skipEmpty();
+    }
+  }
+
+  //! Sets up the DDA for the block the ray is in at parameter t
+  void start(const double t)
+  {
+    const V3d boundsMin(m_field.dataWindow().min);
+    const double blockSize = m_field.blockSize();
+    const double inf = std::numeric_limits<double>::max();
+
+    m_isValid = false;
+    if (!(t < m_tExit)) {
+      return;
+    }
+
+    const V3d p = m_origin + m_dir * t;
+    for (int dim = 0; dim < 3; ++dim) {
+      const double x = (p[dim] - boundsMin[dim]) / blockSize;
+      int b = static_cast<int>(std::floor(x));
+      // On a boundary, travelling backwards, we're in the lower block
+      if (m_dir[dim] < 0.0 && x == std::floor(x)) {
+        b -= 1;
+      }
+      m_block[dim] = std::max(0, std::min(b, m_blockRes[dim] - 1));
+      if (m_dir[dim] > 0.0) {
+        m_step[dim] = 1;
+        m_tNext[dim] = (boundsMin[dim] + (m_block[dim] + 1) * blockSize - 
+                        m_origin[dim]) / m_dir[dim];
+        m_tDelta[dim] = blockSize / m_dir[dim];
+      } else if (m_dir[dim] < 0.0) {
+        m_step[dim] = -1;
+        m_tNext[dim] = (boundsMin[dim] + m_block[dim] * blockSize - 
+                        m_origin[dim]) / m_dir[dim];
+        m_tDelta[dim] = -blockSize / m_dir[dim];
+      } else {
+        m_step[dim] = 0;
+        m_tNext[dim] = inf;
+        m_tDelta[dim] = inf;
+      }
+    }
+
+    m_t0 = t;
+    m_t1 = std::max(m_t0, std::min(nextCrossing(), m_tExit));
+    m_isValid = true;
+
+    // The ray may only touch the first block at an edge or corner
+    if (!(m_t1 > m_t0)) {
+      advance();
+    }
+  }
+
+  //! Ray parameter of the nearest block boundary crossing
+  double nextCrossing() const
+  { return std::min(m_tNext.x, std::min(m_tNext.y, m_tNext.z)); }
+
+  //! Steps to the next block the ray spends a non-zero interval in. 
+  //! Blocks that are only touched where the ray crosses an edge or corner
+  //! are stepped over.
+  void advance()
+  {
+    while (m_isValid) {
+      int axis = 0;
+      if (m_tNext.y < m_tNext[axis]) {
+        axis = 1;
+      }
+      if (m_tNext.z < m_tNext[axis]) {
+        axis = 2;
+      }
+      m_t0 = m_t1;
+      m_block[axis] += m_step[axis];
+      m_tNext[axis] += m_tDelta[axis];
+      if (m_t0 >= m_tExit || 
+          m_block[axis] < 0 || m_block[axis] >= m_blockRes[axis]) {
+        m_isValid = false;
+        return;
+      }
+      m_t1 = std::max(m_t0, std::min(nextCrossing(), m_tExit));
+      if (m_t1 > m_t0) {
+        return;
+      }
+    }
+  }
+
+  //! Steps past the blocks that hold the skip value
+  void skipEmpty()
+  {
+    if (!m_tree) {
+      while (m_isValid && !isAllocated() && emptyValue() == m_skipValue) {
+        advance();
+      }
+      return;
+    }
+    while (m_isValid) {
+      // Find the coarsest skippable node containing the current block
+      const int numLevels = m_tree->numLevels();
+      int level = -1;
+      Data_T value;
+      while (level + 1 < numLevels && 
+             m_tree->isConstant(level + 1, nodeCoord(level + 1), value) &&
+             value == m_skipValue) {
+        ++level;
+      }
+      if (level < 0) {
+        return;
+      } 
+      if (level == 0) {
+        advance();
+        continue;
+      }
+      // Jump to where the ray leaves the node
+      const double tNode = nodeExit(level);
+      if (tNode > m_t0) {
+        start(tNode);
+      } else {
+        advance();
+      }
+    }
+  }
+
+  //! Coordinate of the node at the given level containing the current block
+  V3i nodeCoord(const int level) const
+  { return V3i(m_block.x >> level, m_block.y >> level, m_block.z >> level); }
+
+  //! Ray parameter where the ray leaves the node at the given level 
+  //! containing the current block
+  double nodeExit(const int level) const
+  {
+    const V3d boundsMin(m_field.dataWindow().min);
+    const double nodeSize = static_cast<double>(m_field.blockSize() << level);
+    const V3i node = nodeCoord(level);
+    double t = m_tExit;
+    for (int dim = 0; dim < 3; ++dim) {
+      if (m_dir[dim] > 0.0) {
+        const double plane = boundsMin[dim] + (node[dim] + 1) * nodeSize;
+        t = std::min(t, (plane - m_origin[dim]) / m_dir[dim]);
+      } else if (m_dir[dim] < 0.0) {
+        const double plane = boundsMin[dim] + node[dim] * nodeSize;
+        t = std::min(t, (plane - m_origin[dim]) / m_dir[dim]);
+      }
+    }
+    return t;
+  }
+
+  // Data members --------------------------------------------------------------
+
+  //! The field being traversed
+  const SparseField<Data_T> &m_field;
+  //! Optional value ranges of the field, used for skipping
+  const SparseFieldMinMaxTree<Data_T> *m_tree;
+  //! Ray origin and direction in voxel space
+  V3d m_origin, m_dir;
+  //! Whether to jump over unallocated blocks holding m_skipValue
+  bool m_doSkip;
+  //! Empty value of the blocks to jump over
+  Data_T m_skipValue;
+  //! Resolution of the block grid
+  V3i m_blockRes;
+  //! Current block, and the direction of travel along each axis
+  V3i m_block, m_step;
+  //! Ray parameter of the next block boundary along each axis
+  V3d m_tNext;
+  //! Ray parameter distance between block boundaries along each axis
+  V3d m_tDelta;
+  //! Interval of the current block, and the end of the clipped ray
+  double m_t0, m_t1, m_tExit;
+  //! Whether the iterator points to a block
+  bool m_isValid;
+
+};
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
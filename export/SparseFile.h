@@ -46,16 +46,27 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
 #include <deque>
 #include <list>
+#include <map>
 #include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 #include <hdf5.h>
 
 #include "Exception.h"
 #include "Hdf5Util.h"
+#include "MemoryBudget.h"
 #include "OgawaFwd.h"
 #include "SparseDataReader.h"
+#include "Stats.h"
 #include "Traits.h"
 
 //----------------------------------------------------------------------------//
@@ -63,6 +74,7 @@
 #define F3D_SHORT_MUTEX_ARRAY 1
 #define F3D_MUTEX_ARRAY_SIZE  1000
 #define F3D_NO_BLOCKS_ARRAY   1
+#define F3D_CACHE_SHARD_COUNT 16
 
 #include "ns.h"
 
@@ -129,35 +141,73 @@ public:
   int numVoxels;
   int numBlocks;
   int occupiedBlocks;
+  //! Whether the blocks are loaded lazily. Lazily loaded blocks stay in
+  //! memory once loaded and are never handed to the cache, so they are
+  //! neither reference counted nor evicted.
+  bool lazyLoading;
+  //! Eviction priority of the blocks in the cache. Blocks of references
+  //! with a lower priority are evicted first, and higher priority blocks
+  //! only once nothing of lower priority can be freed. Priorities below 
+  //! zero are treated as zero, the default.
+  int cachePriority;
+  //! Order of the tiles that the blocks are split into on disk, or 0 if 
+  //! the blocks are stored whole. Tiled blocks may be in memory with only
+  //! some of their tiles loaded, as recorded in tileMasks. Set with 
+  //! setTileOrder().
+  int tileOrder;
  
   //! Index in file for each block
   std::vector<int> fileBlockIndices;
-  //! Whether each block is loaded. We don't use bools since vector<bool> 
-  //! is weird
-  std::vector<int> blockLoaded;
   //! Pointers to each block. This is so we can go in and manipulate them
   //! as we please
   BlockPtrs blocks;
-  //! Flags of whether the blocks have been accessed since they were
-  //! last considered for deallocation by the Second-chance/Clock
-  //! caching system
-  std::vector<bool> blockUsed;
+  //! Allocated array of flags, numBlocks long, of whether the blocks have
+  //! been accessed since they were last considered for deallocation by 
+  //! the Second-chance/Clock caching system. Set without locks.
+  boost::atomic<bool> *blockUsed;
+  //! Allocated array, numBlocks long, of the tick of the owning cache 
+  //! shard at the time of each block's most recent access. Only 
+  //! maintained for the queue-based cache policies. Set without locks.
+  boost::atomic<int64_t> *lastUsed;
+  //! Per-block time, in seconds, that the most recent load took. Used by
+  //! the cost-aware cache policy.
+  std::vector<float> loadCost;
   //! Per-block counts of the number of times each block has been
   //! loaded, for cache statistics
   std::vector<int> loadCounts;
-  //! Per-block counts of the number of current references to the
-  //! blocks.  If a block's ref count is non-zero, then the block
-  //! shouldn't be unloaded.
-  std::vector<int> refCounts;
+  //! Min, max and mean of each block, three values per block, as recorded
+  //! in the file. Lets value ranges be found without loading blocks. Empty
+  //! if the file holds no block summaries.
+  std::vector<Data_T> blockSummaries;
+  //! Allocated array of per-block state words, numBlocks long. The low
+  //! bits count the current references to the block, which mustn't be
+  //! unloaded while the count is non-zero. The BlockLoaded and 
+  //! BlockEvicting flags are kept in the high bits. Updated without locks.
+  boost::atomic<int> *blockStates;
+  //! Allocated array of per-block masks, numBlocks long, with a bit set
+  //! for each tile of the block whose voxels are loaded. Only used when 
+  //! the blocks are tiled.
+  boost::atomic<uint64_t> *tileMasks;
   //! Allocated array of mutexes, one per block, to lock each block
-  //! individually, for guaranteeing thread-safe updates of the ref
-  //! counts
+  //! individually while it's being loaded
   boost::mutex *blockMutex;
 #if F3D_SHORT_MUTEX_ARRAY
   //! Size of the mutex array. Used as modulus base.
   int blockMutexSize;
 #endif
 
+  // Enums ---------------------------------------------------------------------
+
+  //! Flags and masks of the block state words
+  enum BlockStateBits {
+    //! The block's data is in memory
+    BlockLoaded   = 1 << 30,
+    //! The cache holds the block for unloading. References must wait.
+    BlockEvicting = 1 << 29,
+    //! The reference count
+    BlockRefMask  = BlockEvicting - 1
+  };
+
   // Ctors, dtor ---------------------------------------------------------------
 
   //! Destructor
@@ -173,6 +223,10 @@ public:
   bool fileIsOpen();
   //! Sets the number of blocks used by the SparseField we're supporting
   void setNumBlocks(int numBlocks);
+  //! Sets the order of the tiles that the blocks are split into on disk.
+  //! Orders that don't give between 2 and 64 tiles per block are ignored,
+  //! and the blocks are then loaded whole. numVoxels must be set first.
+  void setTileOrder(int order);
   //! Opens the file. This is done just before the first request to loadBlock.
   //! This is delayed so that the original file open  has closed the file and
   //! doesn't cause any Hdf5 hiccups.
@@ -181,15 +235,47 @@ public:
   void closeFile();
   //! Loads the block with the given index into memory. We don't pass in 
   //! a reference to where the data should go since this is already know in the
-  //! blocks data member.
-  void loadBlock(int blockIdx);
+  //! blocks data member. If the blocks are tiled, only the tiles whose bits
+  //! are set in tiles are read, and the rest are left for loadTiles().
+  void loadBlock(int blockIdx, uint64_t tiles = allTiles());
+  //! Reads the tiles whose bits are set in tiles, and that aren't in 
+  //! memory yet, into a loaded block
+  void loadTiles(int blockIdx, uint64_t tiles);
   //! Unloads the block with the given index from memory.
   void unloadBlock(int blockIdx);
+  //! Returns whether the block's data is in memory
+  bool isLoaded(int blockIdx) const;
+  //! Returns the tiles of the given mask that aren't in memory yet. Always
+  //! 0 if the blocks aren't tiled.
+  uint64_t missingTiles(int blockIdx, uint64_t tiles) const;
+  //! Returns whether the block, or any of the given tiles of it, has yet 
+  //! to be loaded
+  bool needsLoad(int blockIdx, uint64_t tiles) const
+  { return !isLoaded(blockIdx) || missingTiles(blockIdx, tiles) != 0; }
+  //! Returns the mask of the tile that holds the voxel at the given offset
+  //! in its block. All tiles if the blocks aren't tiled.
+  uint64_t voxelTile(size_t voxelIdx) const
+  { 
+    return tileOrder > 0 ? 
+      static_cast<uint64_t>(1) << (voxelIdx >> (3 * tileOrder)) : allTiles();
+  }
+  //! Mask that selects all the tiles of a block
+  static uint64_t allTiles()
+  { return ~static_cast<uint64_t>(0); }
   //! Increment reference count on a block, indicates the block is
   //! currently in use, so prevents it from being unloaded
   void incBlockRef(int blockIdx);
   //! Decrement reference count on a block
   void decBlockRef(int blockIdx);
+  //! Returns the number of current references to the block
+  int blockRefCount(int blockIdx) const;
+  //! Claims an unreferenced block for unloading. References taken in the
+  //! meantime wait until endEviction() is called.
+  //! \returns False if the block is referenced, in which case it must not
+  //! be unloaded
+  bool beginEviction(int blockIdx);
+  //! Releases a block claimed by beginEviction()
+  void endEviction(int blockIdx);
   //! Returns the number of bytes used by the data in the block
   int blockSize(int blockIdx) const;
   //! Returns the total number of loads of the blocks of this file,
@@ -208,6 +294,12 @@ public:
   void resetCacheStatistics();
   //! Memory use for the Reference
   long long int memSize() const;
+  //! Adds the Reference's memory use to the given total, which 
+  //! updateMemSize() then keeps up to date
+  void trackMemSize(boost::atomic<long long int> *total);
+  //! Adds the change in memSize() since the last update to the tracked
+  //! total, if any. Called whenever the per-block arrays are resized.
+  void updateMemSize();
 
 private:
 
@@ -224,6 +316,22 @@ private:
   //! Assignment operator.  Clears ref counts and rebuilds mutex array.
   Reference & operator=(const Reference &o);
 
+  // Private methods ---
+
+  //! Memory-maps the file, if the layer's blocks were written uncompressed
+  //! and page-aligned. Leaves m_mapping NULL otherwise.
+  void mapFile();
+  //! Releases the memory-mapped file, if any
+  void unmapFile();
+  //! Reads a block from the file into data
+  void readBlockData(int fileBlockIdx, Data_T *data);
+  //! Reads the tiles of the given mask that aren't in memory yet into the
+  //! block's data, and marks them as loaded
+  void readTileData(int blockIdx, uint64_t tiles, Data_T *data);
+  //! Returns the host's shared copy of a block, loading it if this is the
+  //! first process to ask for it. NULL if the block couldn't be shared.
+  Data_T* loadSharedBlock(int fileBlockIdx);
+
   // Data members ---
 
   //! Holds the Hdf5 handle to the file
@@ -249,12 +357,30 @@ private:
   //! Ogawa layer group
   OgIGroupPtr m_ogLayerGroup;
 
+  //! Start of the read-only view of the file, when its blocks are mapped
+  //! rather than read. NULL otherwise.
+  uint8_t *m_mapping;
+  //! Size in bytes of m_mapping
+  uint64_t m_mappingSize;
+
+  //! Identifies the file's contents and the layer when sharing blocks 
+  //! between processes. Set in openFile().
+  std::string m_sharedKey;
+
   //! Mutex to prevent two threads from modifying conflicting data
   mutable Mutex m_mutex;
 
   //! Number of currently active blocks
   size_t m_numActiveBlocks;
 
+  //! Mask of all the tiles of a block, or 0 if the blocks aren't tiled
+  uint64_t m_tileBits;
+
+  //! Total that the memory use is counted in. NULL if not tracked.
+  boost::atomic<long long int> *m_memSizeTotal;
+  //! Memory use as of the last updateMemSize()
+  boost::atomic<long long int> m_countedMemSize;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -276,6 +402,7 @@ public:
 
   // Ctors, dtor ---------------------------------------------------------------
 
+  FileReferences();
   ~FileReferences();
 
   // Main methods --------------------------------------------------------------
@@ -294,13 +421,17 @@ public:
   template <class Data_T>
   size_t numRefs() const;
 
-  //! Returns the memory use for the refs
+  //! Returns the memory use for the refs. The References' own memory use
+  //! is kept in a running total, so this doesn't visit them.
   long long int memSize() const;
 
 private:
 
   // Data members --------------------------------------------------------------
 
+  //! Total memory use of the References
+  boost::atomic<long long int> m_refsMemSize;
+
   std::deque<Reference<half>::Ptr>   m_hRefs;
   std::deque<Reference<V3h>::Ptr>    m_vhRefs;
   std::deque<Reference<float>::Ptr>  m_fRefs;
@@ -318,14 +449,163 @@ private:
 
 //----------------------------------------------------------------------------//
 
+//! Eviction policies available to the SparseFileManager's block cache
+enum CachePolicyEnum {
+  //! Second-chance/Clock paging. This is the default.
+  CachePolicyClock = 0,
+  //! Least recently used block is evicted first
+  CachePolicyLRU,
+  //! 2Q. Newly loaded blocks are kept on probation in a FIFO queue, and
+  //! only blocks that are touched again (or reloaded soon after being
+  //! evicted) make it into the LRU-managed main queue. Protects the cache
+  //! from being flushed by a single pass over a large volume.
+  CachePolicy2Q,
+  //! GreedyDual-Size. Blocks that took long to load relative to their
+  //! size are kept longer than cheap ones.
+  CachePolicyCostAware,
+  //! Number of policies. Not a valid policy.
+  CachePolicyNumPolicies
+};
+
+//----------------------------------------------------------------------------//
+
+//! Cache statistics, accumulated separately for each CachePolicyEnum
+struct CacheStats
+{
+  CacheStats()
+    : loads(0), reloads(0), evictions(0), bytesEvicted(0), loadTime(0.0)
+  { }
+
+  //! Accumulates the statistics of another shard
+  CacheStats& operator += (const CacheStats &o)
+  {
+    loads += o.loads;
+    reloads += o.reloads;
+    evictions += o.evictions;
+    bytesEvicted += o.bytesEvicted;
+    loadTime += o.loadTime;
+    return *this;
+  }
+
+  //! Ratio of first-time loads to all loads. Same definition as 
+  //! SparseFileManager::cacheEfficiency().
+  float efficiency() const
+  { 
+    return static_cast<double>(loads - reloads) / 
+      std::max(1.0, static_cast<double>(loads)); 
+  }
+
+  //! Number of blocks loaded while the policy was active
+  long long loads;
+  //! Number of those loads that were of blocks loaded before
+  long long reloads;
+  //! Number of blocks evicted by the policy
+  long long evictions;
+  //! Number of bytes freed by evictions
+  long long bytesEvicted;
+  //! Total time spent loading blocks, in seconds
+  double loadTime;
+};
+
+//----------------------------------------------------------------------------//
+
 class CacheBlock {
 public:
   DataTypeEnum blockType;
   int refIdx;
   int blockIdx;
+  //! Shard tick at the time the block was queued. Used by the queue-based
+  //! policies to tell whether the block has been touched since.
+  int64_t stamp;
   CacheBlock(DataTypeEnum blockTypeIn, int refIdxIn,  int blockIdxIn) :
-    blockType(blockTypeIn), refIdx(refIdxIn), blockIdx(blockIdxIn) 
+    blockType(blockTypeIn), refIdx(refIdxIn), blockIdx(blockIdxIn),
+    stamp(0)
   { }
+  //! Orders blocks by identity, ignoring the stamp
+  bool operator < (const CacheBlock &o) const
+  {
+    if (blockType != o.blockType) return blockType < o.blockType;
+    if (refIdx != o.refIdx) return refIdx < o.refIdx;
+    return blockIdx < o.blockIdx;
+  }
+};
+
+//----------------------------------------------------------------------------//
+
+//! A block waiting to be loaded by one of the prefetch threads
+struct PrefetchRequest
+{
+  PrefetchRequest(const CacheBlock &blockIn, int sizeIn)
+    : block(blockIn), size(sizeIn)
+  { }
+  CacheBlock block;
+  //! Size of the block's data, in bytes
+  int size;
+};
+
+//----------------------------------------------------------------------------//
+
+typedef std::list<CacheBlock> CacheList;
+//! Blocks ordered by eviction priority, lowest first
+typedef std::multimap<double, CacheBlock> CacheQueue;
+
+//----------------------------------------------------------------------------//
+// CacheShard
+//----------------------------------------------------------------------------//
+
+/*! \class CacheShard
+  One partition of the SparseFileManager's block cache. Each shard owns
+  its own clock list, clock hand, memory budget and mutex, so that threads
+  missing on blocks that hash to different shards never contend with 
+  each other.
+
+  Only the containers belonging to the current CachePolicyEnum are in use.
+  The clock policy uses blockCacheList. LRU and the cost-aware policy use 
+  the first queue. 2Q uses the first queue for probation, the second as 
+  its main queue and remembers recently evicted blocks in ghosts.
+*/
+
+//----------------------------------------------------------------------------//
+
+class CacheShard : boost::noncopyable
+{
+public:
+
+  // Ctors ---------------------------------------------------------------------
+
+  CacheShard()
+    : memUse(0), maxMemUseInBytes(0), probationMemUse(0), tick(0), 
+      inflation(0.0)
+  { nextBlock = blockCacheList.begin(); }
+
+  // Data members --------------------------------------------------------------
+
+  //! List of dynamically loaded blocks in this shard
+  CacheList blockCacheList;
+  //! The "hand" of the clock for this shard
+  CacheList::iterator nextBlock;
+  //! Blocks managed by the queue-based policies
+  CacheQueue queues[2];
+  //! 2Q: Recently evicted probation blocks, oldest first
+  CacheList ghostList;
+  //! 2Q: Position of each block in ghostList, for lookup
+  std::map<CacheBlock, CacheList::iterator> ghostIndex;
+  //! Current amount of memory in use by this shard, in bytes
+  int64_t memUse;
+  //! This shard's portion of the global memory budget, in bytes
+  int64_t maxMemUseInBytes;
+  //! 2Q: Memory in use by the blocks on probation, in bytes
+  int64_t probationMemUse;
+  //! Incremented on each block load. Serves as the shard's clock for 
+  //! recency. Read without the lock when blocks are accessed.
+  boost::atomic<int64_t> tick;
+  //! GreedyDual-Size: priority of the most recently evicted block
+  double inflation;
+  //! Statistics, per cache policy
+  CacheStats stats[CachePolicyNumPolicies];
+  //! Protects the data members above
+  mutable boost::mutex mutex;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -346,6 +626,23 @@ public:
   before opening the file.  If you want other files to be fully loaded, call
   setLimitMemUse(false).
 
+  If memory isn't a concern but only part of each field will be accessed,
+  call setLazyLoading(true) instead. Blocks of layers read afterwards are 
+  loaded the first time they're accessed and then stay in memory until the 
+  field is destroyed. They bypass the cache entirely, so there is no
+  eviction, no reference counting and no shard locking. 
+  setLimitMemUse(true) takes precedence.
+
+  The block cache is split into F3D_CACHE_SHARD_COUNT shards, keyed on
+  file id and block index. Each shard runs its own clock and owns an equal
+  part of the budget given to setMaxMemUse(), so cache misses in different
+  shards don't serialize on a single mutex.
+
+  Fields may be given a cache priority with SparseField::setCachePriority().
+  When a shard needs memory, blocks of the lowest priority are evicted 
+  first, so that e.g. the coarse levels of a MIP field stay in memory while
+  the blocks of its finer levels come and go.
+
   Example of how to use the cache manager to automatically unload
   sparse blocks from a f3d file:
 
@@ -381,6 +678,10 @@ public:
     boost::lexical_cast<std::string>(sparseManager.cacheEfficiency()));
   </pre>
 
+  Blocks can also be loaded ahead of time on background threads using
+  SparseField::prefetch(). The number of prefetch threads is taken from
+  numIOThreads() when the first request is made.
+
   If you want to flush the cache manually instead of waiting for the
   process to end and clean up its memory:
 
@@ -393,7 +694,7 @@ public:
 
 //----------------------------------------------------------------------------//
 
-class FIELD3D_API SparseFileManager
+class FIELD3D_API SparseFileManager : public MemoryBudgetClient
 {
 
 public:
@@ -403,7 +704,7 @@ public:
 
   // typedefs ------------------------------------------------------------------
 
-  typedef std::list<SparseFile::CacheBlock> CacheList;
+  typedef SparseFile::CacheList CacheList;
 
   // Main methods --------------------------------------------------------------
 
@@ -418,11 +719,28 @@ public:
   //! fields.
   bool doLimitMemUse() const;
 
+  //! Sets whether sparse fields read from disk load each block the first time
+  //! it is accessed, and keep it, rather than reading all blocks up front.
+  //! Off by default. Ignored while doLimitMemUse() is true.
+  void setLazyLoading(bool enabled);
+
+  //! Returns whether sparse fields read from disk load their blocks lazily
+  bool doLazyLoading() const;
+
   //! Sets the maximum memory usage, in MB, by dynamically loaded sparse fields.
   void setMaxMemUse(float maxMemUse);
 
+  //! Sets whether dynamically loaded blocks are kept in shared memory, 
+  //! where they're loaded once per host and used by every process reading 
+  //! the same file. Off by default. Only affects blocks loaded afterwards.
+  void setShareBlocks(bool enabled);
+
+  //! Returns whether dynamically loaded blocks are kept in shared memory
+  bool doShareBlocks() const;
+
   //! Flushes the entire block cache for all files, should probably
-  //! only be used for debugging
+  //! only be used for debugging. Memory pooled for the flushed blocks is
+  //! released.
   void flushCache();
 
   //! Returns the total number of block loads in the cache
@@ -445,12 +763,44 @@ public:
   //! loaded to the number of loads.  If this is <1, then there were reloads.
   float cacheEfficiency();
 
+  //! Computes the efficiency of the given policy, counting only the loads
+  //! that happened while it was active
+  float cacheEfficiency(SparseFile::CachePolicyEnum policy) const;
+
+  //! Returns the statistics accumulated while the given policy was active
+  SparseFile::CacheStats cacheStatistics(SparseFile::CachePolicyEnum policy) 
+    const;
+
+  //! Sets the eviction policy used by the block cache. Blocks already in
+  //! the cache are handed over to the new policy.
+  void setCachePolicy(SparseFile::CachePolicyEnum policy);
+
+  //! Returns the eviction policy used by the block cache
+  SparseFile::CachePolicyEnum cachePolicy() const;
+
   //! Resets block load
   void resetCacheStatistics();
 
-  //! Returns the number of bytes used by the SparseFileManager itself
+  //! Returns the number of bytes used by the SparseFileManager itself,
+  //! including memory reserved by the block pools that no block is using
   long long int memSize() const;
 
+  //! Returns the number of bytes the SparseBlock pools have reserved from 
+  //! the system. This covers both dynamically loaded and in-memory fields.
+  long long int blockPoolReservedBytes() const;
+
+  //! Returns the number of bytes of the SparseBlock pools that are in use
+  //! by blocks
+  long long int blockPoolUsedBytes() const;
+
+  // From MemoryBudgetClient ---------------------------------------------------
+
+  //! Returns the memory used by dynamically loaded blocks
+  virtual long long int budgetMemUse() const;
+  //! Unloads dynamically loaded blocks that aren't in use, using the 
+  //! current cache policy
+  virtual long long int budgetRelease(const long long int bytes);
+
   //--------------------------------------------------------------------------//
   // Utility functions
 
@@ -474,6 +824,26 @@ public:
   template <class Data_T>
   void activateBlock(int fileId, int blockIdx);
 
+  //! Called by SparseField when it's about to read a single voxel of a
+  //! block, given by its offset in the block's data. If the block is 
+  //! stored in tiles, only the tile holding the voxel is loaded.
+  //! This should not be called by the user, and may be removed from the
+  //! public interface later.
+  template <class Data_T>
+  void activateVoxel(int fileId, int blockIdx, size_t voxelIdx);
+
+  //! Queues the block to be loaded by a background thread. Requests are
+  //! dropped once the queued blocks would take up a quarter of the memory 
+  //! budget, since prefetching further ahead only evicts the blocks that 
+  //! were prefetched first.
+  //! This should not be called by the user, and may be removed from the
+  //! public interface later. Use SparseField::prefetch() instead.
+  template <class Data_T>
+  void prefetchBlock(int fileId, int blockIdx);
+
+  //! Waits until all queued prefetch requests have been processed
+  void waitForPrefetch();
+
 protected:
 
   //! Returns a reference to the Reference object with the given index
@@ -496,21 +866,95 @@ private:
   //! Pointer to singleton
   static SparseFileManager *ms_singleton;
 
+  //! Returns the index of the shard that manages the given block
+  size_t shardIdx(DataTypeEnum blockType, int fileId, int blockIdx) const;
+
+  //! Loads the block if it isn't in memory, along with those of the given
+  //! tiles of it that aren't. Implements activateBlock() and 
+  //! activateVoxel().
+  template <class Data_T>
+  void activateTiles(int fileId, int blockIdx, uint64_t tiles);
+
   //! Adds the newly loaded block to the cache, managed by the paging algorithm
-  void addBlockToCache(DataTypeEnum blockType, int fileId, int blockIdx);
+  //! \note The shard's mutex must be held by the caller.
+  void addBlockToCache(SparseFile::CacheShard &shard, DataTypeEnum blockType,
+                       int fileId, int blockIdx);
+
+  //! Hands the block to the current policy's containers
+  //! \note The shard's mutex must be held by the caller.
+  void queueBlock(SparseFile::CacheShard &shard, SparseFile::CacheBlock cb);
 
   //! Utility function to reclaim the specified number of bytes by
-  //! deallocating unneeded blocks
-  void deallocateBlocks(int64_t bytesNeeded);
+  //! deallocating unneeded blocks from the given shard
+  void deallocateBlocks(SparseFile::CacheShard &shard, int64_t bytesNeeded);
+
+  //! Implementation of deallocateBlocks() for the clock policy
+  void deallocateBlocksClock(SparseFile::CacheShard &shard, 
+                             int64_t bytesNeeded);
+
+  //! Implementation of deallocateBlocks() for the queue-based policies
+  void deallocateBlocksQueued(SparseFile::CacheShard &shard, 
+                              int64_t bytesNeeded);
+
+  //! Evicts the first evictable block in the given queue of the shard,
+  //! considering only blocks whose priority is at most maxPriority. 
+  //! Blocks touched since they were queued are requeued instead.
+  //! nextPriority is lowered to the smallest priority that was skipped.
+  //! \returns Whether a block was evicted
+  bool evictFromQueue(SparseFile::CacheShard &shard, int queueIdx, 
+                      int maxPriority, int &nextPriority);
+
+  //! Unloads the block if it isn't in use, or regardless of use if force
+  //! is true. Doesn't touch the shard's containers.
+  //! \returns The number of bytes freed
+  int64_t unloadCachedBlock(SparseFile::CacheShard &shard, 
+                            const SparseFile::CacheBlock &cb, bool force);
+
+  //! Typed implementation of unloadCachedBlock()
+  template <class Data_T>
+  int64_t unloadCachedBlock(SparseFile::CacheShard &shard, 
+                            const SparseFile::CacheBlock &cb, bool force);
+
+  //! Unloads every block in the queue regardless of use, and clears it
+  void flushQueue(SparseFile::CacheShard &shard, SparseFile::CacheQueue &queue);
+
+  //! Returns the last use, load cost, size and cache priority of the block
+  void blockState(const SparseFile::CacheBlock &cb, int64_t &lastUsed, 
+                  float &loadCost, int &size, int &priority);
+
+  //! Typed implementation of blockState()
+  template <class Data_T>
+  void blockState(const SparseFile::CacheBlock &cb, int64_t &lastUsed, 
+                  float &loadCost, int &size, int &priority);
+
+  //! Returns the cost-aware priority of a block
+  static double costPriority(const SparseFile::CacheShard &shard,
+                             float loadCost, int size);
+
+  //! Starts the prefetch threads, unless they're already running
+  //! \note m_prefetchMutex must be held by the caller.
+  void startPrefetchThreads();
+
+  //! Main loop of each prefetch thread
+  void prefetchLoop();
+
+  //! Loads the block of a prefetch request
+  void prefetch(const SparseFile::CacheBlock &cb);
+
+  //! Drops queued prefetch requests for the given reference and waits for 
+  //! the ones in flight to finish
+  void cancelPrefetch(DataTypeEnum blockType, int refIdx);
 
   //! Utility function to attempt to deallocate a single block and
-  //! advance the "hand"
+  //! advance the shard's "hand"
   template <class Data_T>
-  int64_t deallocateBlock(const SparseFile::CacheBlock &cb);
+  int64_t deallocateBlock(SparseFile::CacheShard &shard,
+                          const SparseFile::CacheBlock &cb);
 
   //! Utility function to deallocate a single block
   template <class Data_T>
-  void deallocateBlock(CacheList::iterator &it);
+  void deallocateBlock(SparseFile::CacheShard &shard, 
+                       CacheList::iterator &it);
 
   //! Max amount om memory to use in megabytes
   float m_maxMemUse;
@@ -518,32 +962,55 @@ private:
   //! Max amount om memory to use in bytes
   int64_t m_maxMemUseInBytes;
 
-  //! Current amount of memory in use in bytes
-  int64_t m_memUse;
-
   //! Whether to limit memory use of sparse fields from disk. Enables the
   //! cache and dynamic loading when true.
   bool m_limitMemUse;
 
+  //! Whether sparse fields from disk load their blocks on first access, 
+  //! without the cache
+  bool m_lazyLoading;
+
+  //! Whether loaded blocks are kept in shared memory
+  bool m_shareBlocks;
+
+  //! Current eviction policy. Only changed while all shards are locked.
+  SparseFile::CachePolicyEnum m_policy;
+
   //! Vector containing information for each of the managed fields.
   //! The order matches the index stored in each SparseField::m_fileId
   SparseFile::FileReferences m_fileData;
 
-  //! List of dynamically loaded blocks to be considered for unloading
-  //! when the cache is full.
-  //! Currently using Second-chance/Clock paging algorithm.
-  //! For a description of the algorithm, look at:
+  //! Dynamically loaded blocks to be considered for unloading when the
+  //! cache is full, partitioned by file id and block index. Each shard
+  //! gets an equal part of m_maxMemUseInBytes, so the sum never exceeds
+  //! the global budget.
+  //! By default the Second-chance/Clock paging algorithm is used in each 
+  //! shard. For a description of the algorithm, look at:
   //! http://en.wikipedia.org/wiki/Page_replacement_algorithm#Second-chance
-  CacheList m_blockCacheList;
-
-  //! Pointer to the next block to test for unloading in the cache,
-  //! the "hand" of the clock
-  CacheList::iterator m_nextBlock;
+  //! See CachePolicyEnum for the alternatives.
+  SparseFile::CacheShard m_shards[F3D_CACHE_SHARD_COUNT];
 
-  //! Mutex to prevent multiple threads from deallocating blocks at
-  //! the same time
+  //! Mutex to prevent multiple threads from adding references at the 
+  //! same time
   mutable boost::mutex m_mutex;
 
+  //! Blocks waiting to be prefetched, in request order
+  std::deque<SparseFile::PrefetchRequest> m_prefetchQueue;
+  //! Blocks currently being loaded by the prefetch threads
+  std::vector<SparseFile::CacheBlock> m_prefetchActive;
+  //! Total size of the queued and active prefetch requests, in bytes
+  int64_t m_prefetchBytes;
+  //! Prefetch threads. Started on the first request.
+  boost::thread_group m_prefetchThreads;
+  //! Whether the prefetch threads have been started
+  bool m_prefetchStarted;
+  //! Protects the prefetch data members above
+  boost::mutex m_prefetchMutex;
+  //! Signalled when a request is queued
+  boost::condition_variable m_prefetchQueued;
+  //! Signalled when a request is done
+  boost::condition_variable m_prefetchDone;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -559,8 +1026,12 @@ Reference<Data_T>::Reference(const std::string a_filename,
                              const std::string a_layerPath)
   : filename(a_filename), layerPath(a_layerPath),
     valuesPerBlock(-1), numVoxels(-1), numBlocks(-1), occupiedBlocks(-1),
-    blockMutex(NULL), m_fileHandle(-1), m_reader(NULL), m_ogReader(NULL), 
-    m_numActiveBlocks(0)
+    lazyLoading(false), cachePriority(0), tileOrder(0),
+    blockUsed(NULL), lastUsed(NULL), blockStates(NULL), tileMasks(NULL), 
+    blockMutex(NULL), m_fileHandle(-1), 
+    m_reader(NULL), m_ogReader(NULL), 
+    m_mapping(NULL), m_mappingSize(0), m_numActiveBlocks(0), m_tileBits(0),
+    m_memSizeTotal(NULL), m_countedMemSize(0)
 { 
   /* Empty */ 
 }
@@ -571,6 +1042,7 @@ template <class Data_T>
 Reference<Data_T>::~Reference()
 {
   closeFile();
+  unmapFile();
 
   if (m_reader) {
     delete m_reader;
@@ -578,6 +1050,14 @@ Reference<Data_T>::~Reference()
 
   if (blockMutex)
     delete [] blockMutex;
+  if (blockUsed)
+    delete [] blockUsed;
+  if (lastUsed)
+    delete [] lastUsed;
+  if (blockStates)
+    delete [] blockStates;
+  if (tileMasks)
+    delete [] tileMasks;
 }
 
 //----------------------------------------------------------------------------//
@@ -588,7 +1068,15 @@ Reference<Data_T>::Reference(const Reference<Data_T> &o)
   m_ogReaderPtr.reset();
   m_ogReader = NULL;
   m_reader = NULL;
+  m_mapping = NULL;
+  m_mappingSize = 0;
+  blockUsed = NULL;
+  lastUsed = NULL;
+  blockStates = NULL;
+  tileMasks = NULL;
   blockMutex = NULL;
+  m_memSizeTotal = NULL;
+  m_countedMemSize = 0;
   *this = o;
 }
 
@@ -607,13 +1095,53 @@ Reference<Data_T>::operator=(const Reference<Data_T> &o)
   layerPath = o.layerPath;
   valuesPerBlock = o.valuesPerBlock;
   numVoxels = o.numVoxels;
+  numBlocks = o.numBlocks;
   occupiedBlocks = o.occupiedBlocks;
+  lazyLoading = o.lazyLoading;
+  cachePriority = o.cachePriority;
+  tileOrder = o.tileOrder;
+  m_tileBits = o.m_tileBits;
   fileBlockIndices = o.fileBlockIndices;
-  blockLoaded = o.blockLoaded;
   blocks = o.blocks;
-  blockUsed = o.blockUsed;
+  loadCost = o.loadCost;
   loadCounts = o.loadCounts;
-  refCounts = o.refCounts;
+  blockSummaries = o.blockSummaries;
+  if (blockUsed)
+    delete[] blockUsed;
+  blockUsed = NULL;
+  if (o.blockUsed) {
+    blockUsed = new boost::atomic<bool>[numBlocks];
+    for (int i = 0; i < numBlocks; ++i) {
+      blockUsed[i].store(o.blockUsed[i].load());
+    }
+  }
+  if (lastUsed)
+    delete[] lastUsed;
+  lastUsed = NULL;
+  if (o.lastUsed) {
+    lastUsed = new boost::atomic<int64_t>[numBlocks];
+    for (int i = 0; i < numBlocks; ++i) {
+      lastUsed[i].store(o.lastUsed[i].load());
+    }
+  }
+  if (blockStates)
+    delete[] blockStates;
+  blockStates = NULL;
+  if (o.blockStates) {
+    blockStates = new boost::atomic<int>[numBlocks];
+    for (int i = 0; i < numBlocks; ++i) {
+      blockStates[i].store(o.blockStates[i].load());
+    }
+  }
+  if (tileMasks)
+    delete[] tileMasks;
+  tileMasks = NULL;
+  if (o.tileMasks) {
+    tileMasks = new boost::atomic<uint64_t>[numBlocks];
+    for (int i = 0; i < numBlocks; ++i) {
+      tileMasks[i].store(o.tileMasks[i].load());
+    }
+  }
   if (blockMutex)
     delete[] blockMutex;
 #if F3D_SHORT_MUTEX_ARRAY
@@ -648,6 +1176,9 @@ Reference<Data_T>::operator=(const Reference<Data_T> &o)
 
   m_ogReaderPtr.reset();
   m_ogReader = NULL;
+  unmapFile();
+
+  updateMemSize();
 
   return *this;
 }
@@ -667,7 +1198,7 @@ Reference<Data_T>::create(const std::string a_filename,
 template <class Data_T>
 bool Reference<Data_T>::fileIsOpen()
 {
-  return m_fileHandle >= 0;
+  return m_fileHandle >= 0 || m_ogReader != NULL;
 }
 
 //----------------------------------------------------------------------------//
@@ -681,13 +1212,35 @@ void Reference<Data_T>::setNumBlocks(int a_numBlocks)
   numBlocks = a_numBlocks;
 
   fileBlockIndices.resize(numBlocks);
-  blockLoaded.resize(numBlocks, 0);
 #if !F3D_NO_BLOCKS_ARRAY
   blocks.resize(numBlocks, 0);
 #endif
-  blockUsed.resize(numBlocks, false);
+  loadCost.resize(numBlocks, 0.0f);
   loadCounts.resize(numBlocks, 0);
-  refCounts.resize(numBlocks, 0);
+  if (blockUsed)
+    delete[] blockUsed;
+  blockUsed = new boost::atomic<bool>[numBlocks];
+  for (int i = 0; i < numBlocks; ++i) {
+    blockUsed[i].store(false, boost::memory_order_relaxed);
+  }
+  if (lastUsed)
+    delete[] lastUsed;
+  lastUsed = new boost::atomic<int64_t>[numBlocks];
+  for (int i = 0; i < numBlocks; ++i) {
+    lastUsed[i].store(0, boost::memory_order_relaxed);
+  }
+  if (blockStates)
+    delete[] blockStates;
+  blockStates = new boost::atomic<int>[numBlocks];
+  for (int i = 0; i < numBlocks; ++i) {
+    blockStates[i].store(0, boost::memory_order_relaxed);
+  }
+  if (tileMasks)
+    delete[] tileMasks;
+  tileMasks = new boost::atomic<uint64_t>[numBlocks];
+  for (int i = 0; i < numBlocks; ++i) {
+    tileMasks[i].store(0, boost::memory_order_relaxed);
+  }
   if (blockMutex)
     delete[] blockMutex;
 #if F3D_SHORT_MUTEX_ARRAY
@@ -701,6 +1254,30 @@ void Reference<Data_T>::setNumBlocks(int a_numBlocks)
 #else
   blockMutex = new boost::mutex[numBlocks];
 #endif
+
+  lock.unlock();
+  updateMemSize();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::setTileOrder(int order)
+{
+  int blockOrder = 0;
+  while ((1 << (3 * (blockOrder + 1))) <= numVoxels) {
+    blockOrder++;
+  }
+  // Each tile needs a bit in the tile masks
+  if (order <= 0 || order >= blockOrder || blockOrder - order > 2) {
+    tileOrder = 0;
+    m_tileBits = 0;
+    return;
+  }
+  const int numTiles = 1 << (3 * (blockOrder - order));
+  tileOrder = order;
+  m_tileBits = numTiles >= 64 ? 
+    allTiles() : (static_cast<uint64_t>(1) << numTiles) - 1;
 }
 
 //----------------------------------------------------------------------------//
@@ -718,24 +1295,25 @@ void Reference<Data_T>::closeFile()
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-void Reference<Data_T>::unloadBlock(int blockIdx)
+bool Reference<Data_T>::isLoaded(int blockIdx) const
 {
-  // Deallocate the block
-#if F3D_NO_BLOCKS_ARRAY
-  blocks[blockIdx].clear();
-#else
-  blocks[blockIdx]->clear();
-#endif
-  // Mark block as unloaded
-  blockLoaded[blockIdx] = 0;
-  // Track count
-  m_numActiveBlocks--;
-#if 0
-  // If no active blocks, close the file. De-activate for now.
-  if (m_numActiveBlocks == 0) {
-    closeFile();
+  // Acquire pairs with the release in loadBlock(), so the block's data is
+  // visible once the flag is
+  return blockStates[blockIdx].load(boost::memory_order_acquire) & BlockLoaded;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+uint64_t Reference<Data_T>::missingTiles(int blockIdx, uint64_t tiles) const
+{
+  if (tileOrder == 0) {
+    return 0;
   }
-#endif
+  // Acquire pairs with the release in readTileData(), so the voxels of
+  // the tiles are visible once their bits are
+  return tiles & m_tileBits & 
+    ~tileMasks[blockIdx].load(boost::memory_order_acquire);
 }
 
 //----------------------------------------------------------------------------//
@@ -743,12 +1321,19 @@ void Reference<Data_T>::unloadBlock(int blockIdx)
 template <class Data_T>
 void Reference<Data_T>::incBlockRef(int blockIdx)
 {
-#if F3D_SHORT_MUTEX_ARRAY
-  boost::mutex::scoped_lock lock(blockMutex[blockIdx % blockMutexSize]);
-#else
-  boost::mutex::scoped_lock lock(blockMutex[blockIdx]);
-#endif
-  ++refCounts[blockIdx];
+  boost::atomic<int> &state = blockStates[blockIdx];
+  int current = state.load(boost::memory_order_relaxed);
+  while (true) {
+    if (current & BlockEvicting) {
+      // Unloading takes a few microseconds, and is rare
+      boost::this_thread::yield();
+      current = state.load(boost::memory_order_relaxed);
+    } else if (state.compare_exchange_weak(current, current + 1, 
+                                           boost::memory_order_acquire,
+                                           boost::memory_order_relaxed)) {
+      return;
+    }
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -756,12 +1341,39 @@ void Reference<Data_T>::incBlockRef(int blockIdx)
 template <class Data_T>
 void Reference<Data_T>::decBlockRef(int blockIdx)
 {
-#if F3D_SHORT_MUTEX_ARRAY
-  boost::mutex::scoped_lock lock(blockMutex[blockIdx % blockMutexSize]);
-#else
-  boost::mutex::scoped_lock lock(blockMutex[blockIdx]);
-#endif
-  --refCounts[blockIdx];
+  blockStates[blockIdx].fetch_sub(1, boost::memory_order_release);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int Reference<Data_T>::blockRefCount(int blockIdx) const
+{
+  return blockStates[blockIdx].load(boost::memory_order_relaxed) & 
+    BlockRefMask;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool Reference<Data_T>::beginEviction(int blockIdx)
+{
+  boost::atomic<int> &state = blockStates[blockIdx];
+  int current = state.load(boost::memory_order_relaxed);
+  // Only succeeds while the reference count is zero
+  current &= ~(BlockRefMask | BlockEvicting);
+  return state.compare_exchange_strong(current, current | BlockEvicting, 
+                                       boost::memory_order_acquire,
+                                       boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::endEviction(int blockIdx)
+{
+  blockStates[blockIdx].fetch_and(~BlockEvicting, 
+                                  boost::memory_order_release);
 }
 
 //----------------------------------------------------------------------------//
@@ -791,11 +1403,13 @@ int Reference<Data_T>::totalLoads() const
 template <class Data_T>
 int Reference<Data_T>::numLoadedBlocks() const
 {
-  std::vector<int>::const_iterator i = blockLoaded.begin();
-  std::vector<int>::const_iterator end = blockLoaded.end();
+  if (!blockStates) {
+    return 0;
+  }
+
   int numBlockCounter = 0;
-  for (; i != end; ++i)
-    if (*i)
+  for (int i = 0; i < numBlocks; ++i)
+    if (isLoaded(i))
       numBlockCounter++;
 
   return numBlockCounter;
@@ -807,19 +1421,18 @@ template <class Data_T>
 int Reference<Data_T>::totalLoadedBlocks() const
 {
   std::vector<int>::const_iterator i = loadCounts.begin();
-  std::vector<int>::const_iterator li = blockLoaded.begin();
   std::vector<int>::const_iterator end = loadCounts.end();
   int numBlockCounter = 0;
 
-  if (blockLoaded.size() == 0) {
+  if (!blockStates) {
     for (; i != end; ++i)
       if (*i)
         numBlockCounter++;
   } else {
-    assert(loadCounts.size() == blockLoaded.size());
+    assert(loadCounts.size() == static_cast<size_t>(numBlocks));
 
-    for (; i != end; ++i, ++li)
-      if (*i || *li)
+    for (int li = 0; i != end; ++i, ++li)
+      if (*i || isLoaded(li))
         numBlockCounter++;
   }
   
@@ -865,13 +1478,16 @@ Reference<Data_T>::memSize() const
 
   return sizeof(*this) + 
     fileBlockIndices.capacity() * sizeof(int) + 
-    blockLoaded.capacity() * sizeof(int) + 
 #if !F3D_NO_BLOCKS_ARRAY
     blocks.capacity() * sizeof(Sparse::SparseBlock<Data_T>*) + 
 #endif
-    blockUsed.capacity() * sizeof(bool) + 
+    loadCost.capacity() * sizeof(float) + 
     loadCounts.capacity() * sizeof(int) + 
-    refCounts.capacity() * sizeof(int) + 
+    blockSummaries.capacity() * sizeof(Data_T) + 
+    (blockUsed ? numBlocks * sizeof(boost::atomic<bool>) : 0) + 
+    (lastUsed ? numBlocks * sizeof(boost::atomic<int64_t>) : 0) + 
+    (blockStates ? numBlocks * sizeof(boost::atomic<int>) : 0) + 
+    (tileMasks ? numBlocks * sizeof(boost::atomic<uint64_t>) : 0) + 
 #if F3D_SHORT_MUTEX_ARRAY
     blockMutexSize * sizeof(boost::mutex) + 
 #else
@@ -882,6 +1498,30 @@ Reference<Data_T>::memSize() const
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void 
+Reference<Data_T>::trackMemSize(boost::atomic<long long int> *total)
+{
+  m_memSizeTotal = total;
+  m_countedMemSize = 0;
+  updateMemSize();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::updateMemSize()
+{
+  if (!m_memSizeTotal) {
+    return;
+  }
+  const long long int size = memSize();
+  const long long int prev = m_countedMemSize.exchange(size);
+  m_memSizeTotal->fetch_add(size - prev, boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace SparseFile
 
 //----------------------------------------------------------------------------//
@@ -892,6 +1532,14 @@ namespace SparseFile {
 
 //----------------------------------------------------------------------------//
 
+inline FileReferences::FileReferences()
+  : m_refsMemSize(0)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
 inline FileReferences::~FileReferences()
 {
 #if !USE_SHPTR
@@ -1001,6 +1649,7 @@ inline size_t FileReferences::append<half>(Reference<half>::Ptr ref)
 {
   Mutex::scoped_lock lock(m_mutex);
 
+  ref->trackMemSize(&m_refsMemSize);
   m_hRefs.push_back(ref);
   return m_hRefs.size() - 1;
 }
@@ -1012,6 +1661,7 @@ inline size_t FileReferences::append<V3h>(Reference<V3h>::Ptr ref)
 {
   Mutex::scoped_lock lock(m_mutex);
 
+  ref->trackMemSize(&m_refsMemSize);
   m_vhRefs.push_back(ref);
   return m_vhRefs.size() - 1;
 }
@@ -1023,6 +1673,7 @@ inline size_t FileReferences::append<float>(Reference<float>::Ptr ref)
 {
   Mutex::scoped_lock lock(m_mutex);
 
+  ref->trackMemSize(&m_refsMemSize);
   m_fRefs.push_back(ref);
   return m_fRefs.size() - 1;
 }
@@ -1034,6 +1685,7 @@ inline size_t FileReferences::append<V3f>(Reference<V3f>::Ptr ref)
 {
   Mutex::scoped_lock lock(m_mutex);
 
+  ref->trackMemSize(&m_refsMemSize);
   m_vfRefs.push_back(ref);
   return m_vfRefs.size() - 1;
 }
@@ -1045,6 +1697,7 @@ inline size_t FileReferences::append<double>(Reference<double>::Ptr ref)
 {
   Mutex::scoped_lock lock(m_mutex);
 
+  ref->trackMemSize(&m_refsMemSize);
   m_dRefs.push_back(ref);
   return m_dRefs.size() - 1;
 }
@@ -1056,6 +1709,7 @@ inline size_t FileReferences::append<V3d>(Reference<V3d>::Ptr ref)
 {
   Mutex::scoped_lock lock(m_mutex);
 
+  ref->trackMemSize(&m_refsMemSize);
   m_vdRefs.push_back(ref);
   return m_vdRefs.size() - 1;
 }
@@ -1176,6 +1830,21 @@ size_t FileReferences::numRefs() const
 // SparseFileManager implementations
 //----------------------------------------------------------------------------//
 
+inline size_t
+SparseFileManager::shardIdx(DataTypeEnum blockType, int fileId, 
+                            int blockIdx) const
+{
+  // Spatially adjacent blocks should land in different shards, so that
+  // threads marching through the same region spread their misses out
+  const size_t h = 
+    static_cast<size_t>(blockIdx) * 73856093u ^
+    static_cast<size_t>(fileId) * 19349663u ^
+    static_cast<size_t>(blockType) * 83492791u;
+  return h % F3D_CACHE_SHARD_COUNT;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 int 
 SparseFileManager::getNextId(const std::string filename, 
@@ -1188,6 +1857,7 @@ SparseFileManager::getNextId(const std::string filename,
 
   int id = m_fileData.append<Data_T>(Reference<Data_T>::create(filename, 
                                                                layerPath));
+  m_fileData.ref<Data_T>(id)->lazyLoading = m_lazyLoading && !m_limitMemUse;
   return id;
 }
 
@@ -1197,32 +1867,80 @@ template <class Data_T>
 void
 SparseFileManager::removeFieldFromCache(int refIdx)
 {
-  boost::mutex::scoped_lock lock(m_mutex);
-
   DataTypeEnum blockType = DataTypeTraits<Data_T>::typeEnum();
+
+  // The prefetch threads must be done with the field before its blocks
+  // go away
+  cancelPrefetch(blockType, refIdx);
+
+  boost::mutex::scoped_lock lock(m_mutex);
   SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(refIdx);
 
-  CacheList::iterator it = m_blockCacheList.begin();
-  CacheList::iterator end = m_blockCacheList.end();
-  CacheList::iterator next;
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+
+    SparseFile::CacheShard &shard = m_shards[s];
+    boost::mutex::scoped_lock lock_S(shard.mutex);
+
+    CacheList::iterator it = shard.blockCacheList.begin();
+    CacheList::iterator end = shard.blockCacheList.end();
+    CacheList::iterator next;
+
+    int64_t bytesFreed = 0;
+
+    while (it != end) {
+      if (it->blockType == blockType && it->refIdx == refIdx) {
+        if (it == shard.nextBlock) {
+          ++shard.nextBlock;
+        }
+        next = it;
+        ++next;
+        bytesFreed += reference->blockSize(it->blockIdx);
+        shard.blockCacheList.erase(it);
+        it = next;
+      } else {
+        ++it;
+      }
+    }
+
+    for (int q = 0; q < 2; ++q) {
+      SparseFile::CacheQueue &queue = shard.queues[q];
+      SparseFile::CacheQueue::iterator qi = queue.begin();
+      while (qi != queue.end()) {
+        if (qi->second.blockType == blockType && qi->second.refIdx == refIdx) {
+          const int size = reference->blockSize(qi->second.blockIdx);
+          bytesFreed += size;
+          if (q == 0 && m_policy == SparseFile::CachePolicy2Q) {
+            shard.probationMemUse -= size;
+          }
+          queue.erase(qi++);
+        } else {
+          ++qi;
+        }
+      }
+    }
+
+    it = shard.ghostList.begin();
+    while (it != shard.ghostList.end()) {
+      if (it->blockType == blockType && it->refIdx == refIdx) {
+        shard.ghostIndex.erase(*it);
+        it = shard.ghostList.erase(it);
+      } else {
+        ++it;
+      }
+    }
 
-  int64_t bytesFreed = 0;
+    shard.memUse -= bytesFreed;
+  }
 
-  while (it != end) {
-    if (it->blockType == blockType && it->refIdx == refIdx) {
-      if (it == m_nextBlock) {
-        ++m_nextBlock;
+  // Unload the blocks here, since the field doesn't know to detach from 
+  // the shared ones
+  if (reference->blockStates) {
+    for (int i = 0; i < reference->numBlocks; ++i) {
+      if (reference->isLoaded(i)) {
+        reference->unloadBlock(i);
       }
-      next = it;
-      ++next;
-      bytesFreed += reference->blockSize(it->blockIdx);
-      m_blockCacheList.erase(it);
-      it = next;
-    } else {
-      ++it;
     }
   }
-  m_memUse -= bytesFreed;
 
   std::vector<int>().swap(reference->fileBlockIndices);
 #if F3D_NO_BLOCKS_ARRAY
@@ -1232,12 +1950,19 @@ SparseFileManager::removeFieldFromCache(int refIdx)
   typedef typename SparseFile::Reference<Data_T>::BlockPtrs BlockPtrs;
   BlockPtrs().swap(reference->blocks);
 #endif
-  std::vector<int>().swap(reference->blockLoaded);
-  std::vector<bool>().swap(reference->blockUsed);
+  delete[] reference->blockUsed;
+  reference->blockUsed = NULL;
+  delete[] reference->lastUsed;
+  reference->lastUsed = NULL;
+  std::vector<float>().swap(reference->loadCost);
   std::vector<int>().swap(reference->loadCounts);
-  std::vector<int>().swap(reference->refCounts);
+  delete[] reference->blockStates;
+  reference->blockStates = NULL;
+  delete[] reference->tileMasks;
+  reference->tileMasks = NULL;
   delete[] reference->blockMutex;
   reference->blockMutex = NULL;
+  reference->updateMemSize();
 }
 
 //----------------------------------------------------------------------------//
@@ -1254,40 +1979,157 @@ SparseFileManager::reference(int index)
 template <class Data_T>
 void 
 SparseFileManager::activateBlock(int fileId, int blockIdx)
+{
+  activateTiles<Data_T>(fileId, blockIdx, 
+                        SparseFile::Reference<Data_T>::allTiles());
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void 
+SparseFileManager::activateVoxel(int fileId, int blockIdx, size_t voxelIdx)
+{
+  SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(fileId);
+  activateTiles<Data_T>(fileId, blockIdx, reference->voxelTile(voxelIdx));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void 
+SparseFileManager::activateTiles(int fileId, int blockIdx, uint64_t tiles)
 {
   SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(fileId);
+  const DataTypeEnum blockType = DataTypeTraits<Data_T>::typeEnum();
+
+  if (reference->lazyLoading) {
+    // Only the block's own mutex is needed, since nothing ever unloads it
+    if (reference->fileBlockIndices[blockIdx] >= 0 && 
+        reference->needsLoad(blockIdx, tiles)) {
+      if (!reference->fileIsOpen()) {
+        reference->openFile();
+      }
+#if F3D_SHORT_MUTEX_ARRAY
+      Stats::ScopedLock<boost::mutex> 
+        lock(reference->blockMutex[blockIdx % reference->blockMutexSize],
+             Stats::SparseCacheLockWait);
+#else
+      Stats::ScopedLock<boost::mutex> 
+        lock(reference->blockMutex[blockIdx], Stats::SparseCacheLockWait);
+#endif
+      if (!reference->isLoaded(blockIdx)) {
+        reference->loadBlock(blockIdx, tiles);
+        reference->loadCounts[blockIdx]++;
+        Stats::add(Stats::BlocksLoaded);
+      } else {
+        reference->loadTiles(blockIdx, tiles);
+      }
+    }
+    return;
+  }
 
   if (reference->fileBlockIndices[blockIdx] >= 0) {
-    if (!reference->blockLoaded[blockIdx]) {
+    if (reference->needsLoad(blockIdx, tiles)) {
+      SparseFile::CacheShard &shard = 
+        m_shards[shardIdx(blockType, fileId, blockIdx)];
       int blockSize = reference->blockSize(blockIdx);
-      if (m_limitMemUse) {
+      // Tiles of a block that's already in the cache take no more memory
+      if (m_limitMemUse && !reference->isLoaded(blockIdx)) {
+        // Make room under the global budget first, since it may unload
+        // blocks from any shard
+        MemoryBudget::singleton().reserve(blockSize);
         // if we already have enough free memory, deallocateBlocks()
         // will just return
-        deallocateBlocks(blockSize);
+        deallocateBlocks(shard, blockSize);
       }
 
       if (!reference->fileIsOpen()) {
         reference->openFile();
       }
 
-      boost::mutex::scoped_lock lock_A(m_mutex);
+      // The shard's mutex also keeps the block from being evicted while
+      // tiles are read into it
+      Stats::ScopedLock<boost::mutex> 
+        lock_A(shard.mutex, Stats::SparseCacheLockWait);
 #if F3D_SHORT_MUTEX_ARRAY
-      boost::mutex::scoped_lock 
-        lock_B(reference->blockMutex[blockIdx % reference->blockMutexSize]);
+      Stats::ScopedLock<boost::mutex> 
+        lock_B(reference->blockMutex[blockIdx % reference->blockMutexSize],
+               Stats::SparseCacheLockWait);
 #else
-      boost::mutex::scoped_lock lock_B(reference->blockMutex[blockIdx]);
+      Stats::ScopedLock<boost::mutex> 
+        lock_B(reference->blockMutex[blockIdx], Stats::SparseCacheLockWait);
 #endif
       // check to see if it was loaded between when the function
       // started and we got the lock on the block
-      if (!reference->blockLoaded[blockIdx]) {
-        reference->loadBlock(blockIdx);
+      if (!reference->isLoaded(blockIdx)) {
+        using namespace boost::posix_time;
+        const ptime start = microsec_clock::universal_time();
+        reference->loadBlock(blockIdx, tiles);
+        const float loadTime = 
+          (microsec_clock::universal_time() - start).total_microseconds() *
+          1e-6f;
+        SparseFile::CacheStats &stats = shard.stats[m_policy];
+        stats.loads++;
+        if (reference->loadCounts[blockIdx] > 0) {
+          stats.reloads++;
+        }
+        stats.loadTime += loadTime;
+        Stats::add(Stats::BlocksLoaded);
         reference->loadCounts[blockIdx]++;
-        addBlockToCache(DataTypeTraits<Data_T>::typeEnum(), fileId, blockIdx);
-        m_memUse += blockSize;
+        reference->loadCost[blockIdx] = loadTime;
+        reference->lastUsed[blockIdx].store(
+          shard.tick.fetch_add(1, boost::memory_order_relaxed) + 1, 
+          boost::memory_order_relaxed);
+        addBlockToCache(shard, blockType, fileId, blockIdx);
+        shard.memUse += blockSize;
+      } else {
+        reference->loadTiles(blockIdx, tiles);
       }
     }
   }
-  reference->blockUsed[blockIdx] = true;
+  // Recency is recorded without the shard's lock, so that cache hits 
+  // don't contend for it. The eviction code reads it under the lock and
+  // only needs a recent value, not an ordered one
+  reference->blockUsed[blockIdx].store(true, boost::memory_order_relaxed);
+  if (m_policy != SparseFile::CachePolicyClock) {
+    reference->lastUsed[blockIdx].store(
+      m_shards[shardIdx(blockType, fileId, blockIdx)].tick.load(
+        boost::memory_order_relaxed), 
+      boost::memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void 
+SparseFileManager::prefetchBlock(int fileId, int blockIdx)
+{
+  SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(fileId);
+
+  if (reference->fileBlockIndices[blockIdx] < 0 || 
+      !reference->needsLoad(blockIdx, 
+                            SparseFile::Reference<Data_T>::allTiles())) {
+    return;
+  }
+
+  const int blockSize = reference->blockSize(blockIdx);
+  const DataTypeEnum blockType = DataTypeTraits<Data_T>::typeEnum();
+
+  boost::mutex::scoped_lock lock(m_prefetchMutex);
+
+  if (m_prefetchBytes + blockSize > m_maxMemUseInBytes / 4) {
+    return;
+  }
+
+  startPrefetchThreads();
+  m_prefetchQueue.push_back(
+    SparseFile::PrefetchRequest(SparseFile::CacheBlock(blockType, fileId, 
+                                                       blockIdx), 
+                                blockSize));
+  m_prefetchBytes += blockSize;
+  m_prefetchQueued.notify_one();
 }
 
 //----------------------------------------------------------------------------//
@@ -1298,7 +2140,7 @@ SparseFileManager::incBlockRef(int fileId, int blockIdx)
 {
   SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(fileId);
 
-  if (reference->fileBlockIndices[blockIdx] >= 0) {
+  if (reference->fileBlockIndices[blockIdx] >= 0 && !reference->lazyLoading) {
     reference->incBlockRef(blockIdx);
   }
 }
@@ -1311,7 +2153,7 @@ SparseFileManager::decBlockRef(int fileId, int blockIdx)
 {
   SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(fileId);
 
-  if (reference->fileBlockIndices[blockIdx] >= 0) {
+  if (reference->fileBlockIndices[blockIdx] >= 0 && !reference->lazyLoading) {
     reference->decBlockRef(blockIdx);
   }
 }
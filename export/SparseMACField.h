@@ -0,0 +1,456 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseMACField.h
+  \brief Contains the SparseMACField class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseMACField_H_
+#define _INCLUDED_Field3D_SparseMACField_H_
+
+#include <boost/lexical_cast.hpp>
+
+#include "MACField.h"
+#include "SparseField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Forward declarations 
+//----------------------------------------------------------------------------//
+
+class SparseMACFieldIO;
+
+//----------------------------------------------------------------------------//
+// SparseMACField
+//----------------------------------------------------------------------------//
+
+/*! \class SparseMACField
+  \ingroup field
+  \brief This subclass of Field implements a MAC field whose u,v,w face
+  components are each stored in a SparseField. 
+
+  Indexing follows MACField, i.e. u(i, j, k) is the value at i-1/2. Blocks
+  of each component are allocated on first write through u(), v() or w(), 
+  so only the regions of the field that are touched use memory.
+
+  \note This class can only be templated on Vec3 instances.
+  \note The non-const component accessors allocate blocks and are not
+  thread safe.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+class SparseMACField : public ResizableField<Data_T>
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+  
+  typedef boost::intrusive_ptr<SparseMACField> Ptr;
+  typedef std::vector<Ptr> Vec;
+
+  //! This typedef is used to refer to the scalar component type of the vectors
+  typedef typename Data_T::BaseType real_t;
+  //! Storage for a single face component
+  typedef SparseField<real_t> ComponentField;
+
+  typedef LinearMACFieldInterp<Data_T> LinearInterp;
+  typedef CubicMACFieldInterp<Data_T> CubicInterp;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef SparseMACField<Data_T> class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassName()
+  {
+    return "SparseMACField";
+  }
+
+  static const char* staticClassType()
+  {
+    return SparseMACField<Data_T>::ms_classType.name();
+  }
+  
+  // Constructors --------------------------------------------------------------
+
+  //! \name Constructors & destructor
+  //! \{
+
+  //! Constructs an empty buffer
+  SparseMACField();
+
+  //! Copy constructor. The component fields are deep-copied.
+  SparseMACField(const SparseMACField &o);
+
+  //! Assignment operator. The component fields are deep-copied.
+  SparseMACField& operator=(const SparseMACField &o);
+
+  // \}
+
+  // Main methods --------------------------------------------------------------
+
+  //! Clears all the voxels in the storage. This deallocates all blocks.
+  virtual void clear(const Data_T &value);
+
+  //! Sets the block order of all three components. 
+  //! \note This discards the current contents of the field.
+  void setBlockOrder(int order);
+
+  //! Returns the block order
+  int blockOrder() const;
+
+  //! Deallocates the blocks of each component that hold a single value 
+  //! within the given tolerance.
+  //! \returns The total number of blocks released
+  int pruneEmptyBlocks(double tolerance = 0.0);
+
+  //! Returns the storage of the given face component. The component's
+  //! data window is the field's data window grown by one along the 
+  //! component's axis.
+  typename ComponentField::Ptr component(MACComponent comp) const;
+
+  // From Field base class -----------------------------------------------------
+
+  //! \name From Field
+  //! \{  
+
+  //! \note This returns the voxel-centered interpolated value
+  virtual Data_T value(int i, int j, int k) const;
+  virtual long long int memSize() const;
+
+  //! \}
+
+  // From WritableField base class ---------------------------------------------
+
+  //! \name From WritableField
+  //! \{
+
+  //! This will return the appropriate interpolated value but
+  //! setting that to something else does not change the MAC field.
+  //! \warning See description
+  virtual Data_T& lvalue(int i, int j, int k);
+
+  //! \}
+  
+  // Concrete component access -------------------------------------------------
+
+  //! \name MAC-component access
+  //! \{
+
+  //! Read access to value on u-facing wall
+  //! \note i coordinate represents i-1/2!
+  real_t u(int i, int j, int k) const
+  { return m_u->fastValue(i, j, k); }
+  //! Write access to value on u-facing wall. Allocates the block if needed.
+  //! \note i coordinate represents i-1/2!
+  real_t& u(int i, int j, int k)
+  { return m_u->fastLValue(i, j, k); }
+  //! Read access to value on v-facing wall
+  //! \note j coordinate represents j-1/2!
+  real_t v(int i, int j, int k) const
+  { return m_v->fastValue(i, j, k); }
+  //! Write access to value on v-facing wall. Allocates the block if needed.
+  //! \note j coordinate represents j-1/2!
+  real_t& v(int i, int j, int k)
+  { return m_v->fastLValue(i, j, k); }
+  //! Read access to value on w-facing wall
+  //! \note k coordinate represents k-1/2!
+  real_t w(int i, int j, int k) const
+  { return m_w->fastValue(i, j, k); }
+  //! Write access to value on w-facing wall. Allocates the block if needed.
+  //! \note k coordinate represents k-1/2!
+  real_t& w(int i, int j, int k)
+  { return m_w->fastLValue(i, j, k); }
+
+  //! \}
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Returns the u-component interpolated to the cell center
+  real_t uCenter(int i, int j, int k) const
+  {
+    return (u(i, j, k) + u(i + 1, j, k)) * 0.5;
+  }
+  //! Returns the v-component interpolated to the cell center
+  real_t vCenter(int i, int j, int k) const
+  {
+    return (v(i, j, k) + v(i, j + 1, k)) * 0.5;
+  }
+  //! Returns the w-component interpolated to the cell center
+  real_t wCenter(int i, int j, int k) const
+  {
+    return (w(i, j, k) + w(i, j, k + 1)) * 0.5;
+  }
+
+  // From FieldBase ------------------------------------------------------------
+
+  //! \name From FieldBase
+  //! \{
+
+  FIELD3D_CLASSNAME_CLASSTYPE_IMPLEMENTATION;
+
+  virtual FieldBase::Ptr clone() const
+  { return Ptr(new SparseMACField(*this)); }
+
+  //! \}
+
+protected:
+
+  friend class SparseMACFieldIO;
+
+  // From ResizableField class ---------------------------------------------
+
+  virtual void sizeChanged();
+
+  // Data members --------------------------------------------------------------
+
+  //! U component storage
+  typename ComponentField::Ptr m_u;
+  //! V component storage
+  typename ComponentField::Ptr m_v;
+  //! W component storage
+  typename ComponentField::Ptr m_w;
+
+  //! Dummy storage of a temp value that lvalue() can write to
+  mutable Data_T m_dummy;
+
+private:
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Deep-copies the components of another field
+  void copyComponents(const SparseMACField &o);
+
+  // Static data members -------------------------------------------------------
+
+  static TemplatedFieldType<SparseMACField<Data_T> > ms_classType;
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef ResizableField<Data_T> base;
+
+};
+
+//----------------------------------------------------------------------------//
+// Static member instantiation
+//----------------------------------------------------------------------------//
+
+FIELD3D_CLASSTYPE_TEMPL_INSTANTIATION(SparseMACField);
+
+//----------------------------------------------------------------------------//
+// Typedefs
+//----------------------------------------------------------------------------//
+
+typedef SparseMACField<V3h> SparseMACField3h;
+typedef SparseMACField<V3f> SparseMACField3f;
+typedef SparseMACField<V3d> SparseMACField3d;
+
+//----------------------------------------------------------------------------//
+// SparseMACField implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+SparseMACField<Data_T>::SparseMACField()
+  : base(), 
+    m_u(new ComponentField), 
+    m_v(new ComponentField), 
+    m_w(new ComponentField)
+{
+  
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+SparseMACField<Data_T>::SparseMACField(const SparseMACField &o)
+  : base(o)
+{
+  copyComponents(o);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+SparseMACField<Data_T>& 
+SparseMACField<Data_T>::operator=(const SparseMACField &o)
+{
+  if (this != &o) {
+    base::operator=(o);
+    copyComponents(o);
+  }
+  return *this;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseMACField<Data_T>::copyComponents(const SparseMACField &o)
+{
+  m_u = new ComponentField(*o.m_u);
+  m_v = new ComponentField(*o.m_v);
+  m_w = new ComponentField(*o.m_w);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseMACField<Data_T>::clear(const Data_T &value)
+{
+  m_u->clear(value.x);
+  m_v->clear(value.y);
+  m_w->clear(value.z);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseMACField<Data_T>::setBlockOrder(int order)
+{
+  m_u->setBlockOrder(order);
+  m_v->setBlockOrder(order);
+  m_w->setBlockOrder(order);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int SparseMACField<Data_T>::blockOrder() const
+{
+  return m_u->blockOrder();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+int SparseMACField<Data_T>::pruneEmptyBlocks(double tolerance)
+{
+  return m_u->pruneEmptyBlocks(tolerance) + 
+    m_v->pruneEmptyBlocks(tolerance) + 
+    m_w->pruneEmptyBlocks(tolerance);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseMACField<Data_T>::ComponentField::Ptr 
+SparseMACField<Data_T>::component(MACComponent comp) const
+{
+  switch (comp) {
+  case MACCompU:
+    return m_u;
+  case MACCompV:
+    return m_v;
+  case MACCompW:
+    return m_w;
+  default:
+    assert(false && "Illegal MACComponent in SparseMACField::component");
+    return typename ComponentField::Ptr();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T SparseMACField<Data_T>::value(int i, int j, int k) const
+{
+  return Data_T(uCenter(i, j, k), vCenter(i, j, k), wCenter(i, j, k));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+long long int SparseMACField<Data_T>::memSize() const
+{ 
+  long long int superClassMemSize = base::memSize();
+  long long int componentMemSize = 
+    m_u->memSize() + m_v->memSize() + m_w->memSize();
+  return sizeof(*this) + componentMemSize + superClassMemSize; 
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T& SparseMACField<Data_T>::lvalue(int i, int j, int k)
+{
+  m_dummy = value(i, j, k);
+  return m_dummy;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseMACField<Data_T>::sizeChanged() 
+{
+  using namespace MACFieldUtil;
+
+  // Call base class
+  base::sizeChanged();
+
+  V3i baseSize = 
+    base::m_dataWindow.max - base::m_dataWindow.min + V3i(1);
+
+  if (std::min(std::min(baseSize.x, baseSize.y), baseSize.z) < 0)
+    throw Exc::ResizeException("Attempt to resize ResizableField object "
+                               "using negative size. Data window was: " +
+                               boost::lexical_cast<std::string>(baseSize));
+
+  // Each component covers one more face than voxels along its axis
+  m_u->setSize(makeDataWindowForComponent(base::m_extents, MACCompU),
+               makeDataWindowForComponent(base::m_dataWindow, MACCompU));
+  m_v->setSize(makeDataWindowForComponent(base::m_extents, MACCompV),
+               makeDataWindowForComponent(base::m_dataWindow, MACCompV));
+  m_w->setSize(makeDataWindowForComponent(base::m_extents, MACCompW),
+               makeDataWindowForComponent(base::m_dataWindow, MACCompW));
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
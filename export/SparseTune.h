@@ -0,0 +1,174 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*! \file SparseTune.h
+  \brief Contains tuneSparseField(), which picks the block order and codec
+  to write a SparseField with.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SparseTune_H_
+#define _INCLUDED_Field3D_SparseTune_H_
+
+//----------------------------------------------------------------------------//
+
+#include <vector>
+
+//----------------------------------------------------------------------------//
+
+#include "InitIO.h"
+#include "SparseField.h"
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// SparseTuneOptions
+//----------------------------------------------------------------------------//
+
+//! Controls which settings tuneSparseField() tries, and how it ranks them
+struct FIELD3D_API SparseTuneOptions
+{
+  //! Tries block orders 3-5, all codecs built into the library and
+  //! compression levels 1 and 6
+  SparseTuneOptions();
+  //! Block orders to try
+  std::vector<int>         blockOrders;
+  //! Codecs to try
+  std::vector<SparseCodec> codecs;
+  //! Compression levels to try, 1-9
+  std::vector<int>         levels;
+  //! How much file size counts in the score, from 0 to 1. The rest of the 
+  //! score is the sampling cost. The default is 0.5.
+  double                   sizeWeight;
+  //! Rate that compressed blocks are read from disk, in bytes per second.
+  //! Used to estimate the sampling cost. The default is 200 MB/s.
+  double                   readBytesPerSecond;
+  //! Largest number of blocks that are trial-encoded per block order. The 
+  //! size and decode time of the other blocks is estimated from these.
+  //! The default is 256.
+  size_t                   maxSampleBlocks;
+};
+
+//----------------------------------------------------------------------------//
+// SparseTuneResult
+//----------------------------------------------------------------------------//
+
+//! The estimated cost of writing a field with one combination of settings
+struct SparseTuneResult
+{
+  SparseTuneResult()
+    : blockOrder(0), codec(SparseCodecZlib), level(0), numBlocks(0),
+      numTouchedBlocks(0), fileBytes(0.0), decodeBytesPerSecond(0.0),
+      sampleSeconds(0.0), score(0.0)
+  { }
+  int         blockOrder;
+  SparseCodec codec;
+  int         level;
+  //! Number of allocated blocks the field would have
+  size_t      numBlocks;
+  //! Number of allocated blocks the access trace visits. All of them if 
+  //! the trace is empty.
+  size_t      numTouchedBlocks;
+  //! Estimated size of the layer's block data in the file
+  double      fileBytes;
+  //! Measured decompression speed, in uncompressed bytes per second
+  double      decodeBytesPerSecond;
+  //! Estimated time to read and decompress the visited blocks once
+  double      sampleSeconds;
+  //! Weighted cost relative to the cheapest candidate, lower is better. 
+  //! 1.0 means the candidate is both the smallest and the fastest.
+  double      score;
+};
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Trial-encodes a field with every combination of options.blockOrders,
+//! options.codecs and options.levels and estimates the file size and 
+//! sampling cost of each. A block of another block order is allocated if
+//! it overlaps an allocated block of the field.
+//! \param trace Voxels that a typical render looks up, in the field's 
+//! voxel space. See makePointTrace() and makeRayTrace() for synthetic 
+//! ones. An empty trace visits every block.
+//! \returns The candidates, best first
+template <class Data_T>
+FIELD3D_API std::vector<SparseTuneResult> 
+tuneSparseField(const SparseField<Data_T> &field, 
+                const std::vector<V3i> &trace,
+                const SparseTuneOptions &options = SparseTuneOptions());
+
+//----------------------------------------------------------------------------//
+
+//! Computes the score of each result and sorts them, best first. Useful for
+//! ranking results that were summed over several layers.
+FIELD3D_API void scoreSparseTuning(std::vector<SparseTuneResult> &results,
+                                   const double sizeWeight);
+
+//----------------------------------------------------------------------------//
+
+//! Makes the codec and compression level of a result the ones that sparse
+//! blocks are written with. The block order is a property of each field,
+//! see SparseField::setBlockOrder() and TranscodeOptions::blockOrder.
+FIELD3D_API void applySparseTuning(const SparseTuneResult &result);
+
+//----------------------------------------------------------------------------//
+
+//! Returns numPoints random voxels in the data window, as a trace for 
+//! scattered point lookups
+FIELD3D_API std::vector<V3i> makePointTrace(const Box3i &dataWindow,
+                                            const size_t numPoints,
+                                            const unsigned int seed = 0);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the voxels visited by numRays straight rays in random directions
+//! through random points of the data window, one-voxel steps apart, as a 
+//! trace for ray marching
+FIELD3D_API std::vector<V3i> makeRayTrace(const Box3i &dataWindow,
+                                          const size_t numRays,
+                                          const unsigned int seed = 0);
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,293 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file Stats.h
+  \brief Contains the Stats namespace, which counts I/O, decompression, 
+  cache and locking activity across the library.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_Stats_H_
+#define _INCLUDED_Field3D_Stats_H_
+
+//----------------------------------------------------------------------------//
+
+#include <iosfwd>
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/locks.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+#include "Trace.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Stats
+//----------------------------------------------------------------------------//
+
+/*! \namespace Stats
+  \ingroup file
+  Counters for the hot paths of the library. Each thread counts into its 
+  own set of counters, which are merged when queried, so counting never 
+  contends between threads. Times are in microseconds.
+
+  Building the library and its clients with FIELD3D_DISABLE_STATS defined
+  compiles the counting out. The query functions then return zeros.
+
+  Setting the FIELD3D_STATS_FILE environment variable before initIO() 
+  writes the counters as JSON to that file when the process exits.
+*/
+
+//----------------------------------------------------------------------------//
+
+namespace Stats {
+
+//----------------------------------------------------------------------------//
+
+enum Counter {
+  //! Bytes of field data read from files, before decompression
+  BytesRead = 0,
+  //! Bytes produced by decompression
+  BytesDecompressed,
+  //! Time spent decompressing with SparseCodecZlib
+  DecompressTimeZlib,
+  //! Time spent decompressing with SparseCodecShuffleZlib
+  DecompressTimeShuffleZlib,
+  //! Time spent decompressing with SparseCodecLz4 and SparseCodecShuffleLz4
+  DecompressTimeLz4,
+  //! Time spent decompressing with SparseCodecZstd and 
+  //! SparseCodecShuffleZstd
+  DecompressTimeZstd,
+  //! Blocks loaded by the SparseFileManager
+  BlocksLoaded,
+  //! Blocks evicted by the SparseFileManager
+  BlocksEvicted,
+  //! Time spent waiting for the SparseFileManager's shard and block locks
+  SparseCacheLockWait,
+  //! Time spent waiting for the locks around MIPField level loads
+  MIPLevelLockWait,
+  //! Time spent waiting for the FieldCache's locks
+  FieldCacheLockWait,
+  //! Files opened by Field3DInputFile
+  FilesOpened,
+  //! Time spent in Field3DInputFile::open()
+  FileOpenTime,
+  //! Layers read by Field3DInputFile
+  LayersRead,
+  //! Time spent reading layers
+  LayerReadTime,
+  NumCounters
+};
+
+//----------------------------------------------------------------------------//
+
+//! Read statistics of one layer
+struct LayerStats
+{
+  LayerStats()
+    : numReads(0), readTime(0)
+  { }
+  boost::uint64_t numReads;
+  boost::uint64_t readTime;
+};
+
+//! Layer statistics by "filename:layer path"
+typedef std::map<std::string, LayerStats> LayerStatsMap;
+
+//----------------------------------------------------------------------------//
+
+//! Whether the library was built with counting enabled
+FIELD3D_API bool isEnabled();
+
+//! Name of the counter, as used in the JSON output
+FIELD3D_API const char* counterName(const Counter counter);
+
+//! Value of the counter, summed over all threads
+FIELD3D_API boost::uint64_t value(const Counter counter);
+
+//! Read statistics of each layer read so far
+FIELD3D_API LayerStatsMap layerStats();
+
+//! Sets all counters to zero
+//! \note Counts made by other threads while resetting may be lost.
+FIELD3D_API void reset();
+
+//! Writes the counters and layer statistics as a JSON object
+FIELD3D_API void writeJson(std::ostream &os);
+
+//! Writes the counters and layer statistics as JSON to the given file
+FIELD3D_API bool writeJson(const std::string &filename);
+
+//! Writes the statistics to the given file when the process exits. An 
+//! empty filename turns this off.
+FIELD3D_API void setDumpAtExit(const std::string &filename);
+
+//! Monotonic clock, in microseconds
+FIELD3D_API boost::uint64_t microseconds();
+
+//----------------------------------------------------------------------------//
+
+#ifndef FIELD3D_DISABLE_STATS
+
+//! Adds to the calling thread's counter
+FIELD3D_API void add(const Counter counter, const boost::uint64_t amount = 1);
+
+//! Records one read of a layer
+FIELD3D_API void addLayerRead(const std::string &layer, 
+                              const boost::uint64_t time);
+
+#else
+
+inline void add(const Counter, const boost::uint64_t = 1)
+{ }
+
+inline void addLayerRead(const std::string &, const boost::uint64_t)
+{ }
+
+#endif
+
+//----------------------------------------------------------------------------//
+// ScopedTimer
+//----------------------------------------------------------------------------//
+
+/*! \class ScopedTimer
+  Adds the time between construction and destruction to a counter.
+*/
+
+//----------------------------------------------------------------------------//
+
+class ScopedTimer : boost::noncopyable
+{
+public:
+
+#ifndef FIELD3D_DISABLE_STATS
+
+  explicit ScopedTimer(const Counter counter)
+    : m_counter(counter), m_start(microseconds())
+  { }
+
+  ~ScopedTimer()
+  { add(m_counter, elapsed()); }
+
+  //! Time since construction
+  boost::uint64_t elapsed() const
+  { return microseconds() - m_start; }
+
+private:
+
+  const Counter         m_counter;
+  const boost::uint64_t m_start;
+
+#else
+
+  explicit ScopedTimer(const Counter)
+  { }
+
+  boost::uint64_t elapsed() const
+  { return 0; }
+
+#endif
+
+};
+
+//----------------------------------------------------------------------------//
+// ScopedLock
+//----------------------------------------------------------------------------//
+
+/*! \class ScopedLock
+  Locks a mutex for its lifetime, like boost::mutex::scoped_lock, and adds
+  the time spent waiting for it to a counter. An uncontended lock is taken
+  without reading the clock. Contended waits also show up in the Trace,
+  named after the counter.
+*/
+
+//----------------------------------------------------------------------------//
+
+template <class Mutex_T>
+class ScopedLock : boost::noncopyable
+{
+public:
+
+#ifndef FIELD3D_DISABLE_STATS
+
+  ScopedLock(Mutex_T &mutex, const Counter counter)
+    : m_lock(mutex, boost::try_to_lock)
+  { 
+    if (!m_lock.owns_lock()) {
+      const boost::uint64_t start = microseconds();
+      m_lock.lock();
+      const boost::uint64_t wait = microseconds() - start;
+      add(counter, wait);
+      if (Trace::isEnabled()) {
+        Trace::addEvent(counterName(counter), start, wait);
+      }
+    }
+  }
+
+#else
+
+  ScopedLock(Mutex_T &mutex, const Counter)
+    : m_lock(mutex)
+  { }
+
+#endif
+
+private:
+
+  boost::unique_lock<Mutex_T> m_lock;
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Stats
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
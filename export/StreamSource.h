@@ -0,0 +1,306 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*! \file StreamSource.h
+  \brief Contains the StreamSource classes, which let Field3DInputFile read
+  Ogawa files from places other than the local file system.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_StreamSource_H_
+#define _INCLUDED_Field3D_StreamSource_H_
+
+//----------------------------------------------------------------------------//
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// StreamSource
+//----------------------------------------------------------------------------//
+
+/*! \class StreamSource
+  \brief A random access source of bytes that Ogawa files are read from.
+
+  Field3DInputFile::open() and the dynamic reading of SparseFields read 
+  through a StreamSource whenever the filename starts with a scheme, 
+  e.g. "http://", that a source has been registered for with 
+  registerStreamSource(). Implementations must allow any number of 
+  threads to call read() at once.
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API StreamSource
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_ptr<StreamSource> Ptr;
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  virtual ~StreamSource()
+  { }
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Returns the total number of bytes in the source
+  virtual boost::uint64_t size() const = 0;
+
+  //! Reads numBytes bytes at pos into buffer
+  //! \returns False if they couldn't all be read
+  virtual bool read(const boost::uint64_t pos, const boost::uint64_t numBytes,
+                    void *buffer) = 0;
+
+  //! Hints that numBytes bytes at pos will be read soon. This is called 
+  //! for the blocks that SparseField::prefetch() asks for. Does nothing 
+  //! by default.
+  virtual void willNeed(const boost::uint64_t /* pos */, 
+                        const boost::uint64_t /* numBytes */)
+  { }
+
+};
+
+//----------------------------------------------------------------------------//
+// RangeStreamOptions
+//----------------------------------------------------------------------------//
+
+//! Controls how a RangeStreamSource caches and batches its requests
+struct FIELD3D_API RangeStreamOptions
+{
+  RangeStreamOptions()
+    : pageBytes(256 * 1024), cacheBytes(256 * 1024 * 1024), 
+      pinnedBytes(32 * 1024 * 1024), smallReadBytes(4096), 
+      maxRequestBytes(8 * 1024 * 1024), maxInFlight(16)
+  { }
+  //! Size of the pages that the source is fetched and cached in
+  size_t pageBytes;
+  //! Pages of data that are kept in memory, least recently used first 
+  //! out
+  size_t cacheBytes;
+  //! Pages touched by small reads, which hold the file header, group 
+  //! indices and attributes, stay in memory for the lifetime of the 
+  //! source, up to this many bytes
+  size_t pinnedBytes;
+  //! Reads up to this size count as small, see pinnedBytes
+  size_t smallReadBytes;
+  //! Largest request that neighboring pages are coalesced into
+  size_t maxRequestBytes;
+  //! Number of requests for willNeed() ranges that are kept in flight
+  size_t maxInFlight;
+};
+
+//----------------------------------------------------------------------------//
+// RangeStreamSource
+//----------------------------------------------------------------------------//
+
+/*! \class RangeStreamSource
+  \brief Base class for sources where each request has a high latency, 
+  e.g. HTTP range requests to object storage.
+
+  The source is fetched in pages, which are cached. Pages that several 
+  threads need at once are fetched once, and the missing neighboring 
+  pages of a read are fetched in a single request. willNeed() queues its 
+  pages for up to maxInFlight background threads, which coalesce 
+  neighboring queued pages into requests of up to maxRequestBytes. 
+
+  Subclasses implement fetch() and call setSize() in their constructor.
+  \note Subclasses must call stopFetching() in their destructor, so that
+  no background fetch() calls are made on a partially destroyed object.
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API RangeStreamSource : public StreamSource
+{
+public:
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  RangeStreamSource(const RangeStreamOptions &options);
+  virtual ~RangeStreamSource();
+
+  // From StreamSource ---------------------------------------------------------
+
+  virtual boost::uint64_t size() const;
+  virtual bool read(const boost::uint64_t pos, const boost::uint64_t numBytes,
+                    void *buffer);
+  virtual void willNeed(const boost::uint64_t pos, 
+                        const boost::uint64_t numBytes);
+
+protected:
+
+  // To be implemented by subclasses -------------------------------------------
+
+  //! Fetches numBytes bytes at pos into buffer. Called from any number of
+  //! threads at once.
+  //! \returns False if they couldn't all be fetched
+  virtual bool fetch(const boost::uint64_t pos, const boost::uint64_t numBytes,
+                     void *buffer) = 0;
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Sets the total size of the source
+  void setSize(const boost::uint64_t size);
+
+  //! Stops and joins the background threads. Pages queued by willNeed() 
+  //! are fetched on demand from then on.
+  void stopFetching();
+
+private:
+
+  // Noncopyable ---------------------------------------------------------------
+
+  RangeStreamSource(const RangeStreamSource &);
+  RangeStreamSource& operator=(const RangeStreamSource &);
+
+  // Data members --------------------------------------------------------------
+
+  //! The pages, the willNeed() queue and the background threads. The 
+  //! threads call fetch() through it.
+  struct Cache;
+  boost::scoped_ptr<Cache> m_cache;
+
+};
+
+//----------------------------------------------------------------------------//
+// HttpStreamSource
+//----------------------------------------------------------------------------//
+
+/*! \class HttpStreamSource
+  \brief Reads a file with HTTP/1.1 range requests, e.g. from an 
+  S3-compatible object store.
+
+  Connections are kept alive and reused, and the URL's query string is 
+  sent along, so that presigned URLs work. Only plain http:// URLs are 
+  supported. Sources that need TLS or request signing can be added with 
+  registerStreamSource().
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API HttpStreamSource : public RangeStreamSource
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_ptr<HttpStreamSource> Ptr;
+
+  // Ctors, dtor ---------------------------------------------------------------
+
+  virtual ~HttpStreamSource();
+
+  //! Connects to the server and asks it for the size of the file
+  //! \returns NULL if the URL couldn't be parsed or the file couldn't be 
+  //! found
+  static StreamSource::Ptr open(const std::string &url, 
+                                const RangeStreamOptions &options = 
+                                RangeStreamOptions());
+
+protected:
+
+  // From RangeStreamSource ----------------------------------------------------
+
+  virtual bool fetch(const boost::uint64_t pos, const boost::uint64_t numBytes,
+                     void *buffer);
+
+private:
+
+  // Ctors ---------------------------------------------------------------------
+
+  HttpStreamSource(const RangeStreamOptions &options);
+
+  // Data members --------------------------------------------------------------
+
+  //! The parsed URL and the idle keep-alive connections
+  struct Connection;
+  boost::scoped_ptr<Connection> m_connection;
+
+};
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Creates the source for a URL
+typedef boost::function<StreamSource::Ptr (const std::string &)> 
+StreamSourceFactory;
+
+//----------------------------------------------------------------------------//
+
+//! Registers the factory that opens filenames starting with scheme, e.g.
+//! "s3" for "s3://bucket/file.f3d". Replaces any factory that was 
+//! registered for the scheme before. HttpStreamSource::open() is 
+//! registered for "http" by default.
+FIELD3D_API void registerStreamSource(const std::string &scheme,
+                                      const StreamSourceFactory &factory);
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether a filename starts with the scheme of a registered 
+//! stream source
+FIELD3D_API bool hasStreamSource(const std::string &filename);
+
+//----------------------------------------------------------------------------//
+
+//! Opens a filename with the stream source registered for its scheme. 
+//! Sources are shared for as long as they are in use, so that all readers
+//! of a file share one cache.
+//! \returns NULL if no source is registered for the scheme, or if the 
+//! source couldn't be opened
+FIELD3D_API StreamSource::Ptr openStreamSource(const std::string &filename);
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,223 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file ThreadPool.h
+  \brief Contains the ThreadPool class, which runs the multi-threaded work
+  of the library on one set of persistent threads.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_ThreadPool_H_
+#define _INCLUDED_Field3D_ThreadPool_H_
+
+//----------------------------------------------------------------------------//
+
+#include <deque>
+
+#include <boost/exception_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// ThreadPool
+//----------------------------------------------------------------------------//
+
+/*! \class ThreadPool
+  \ingroup file
+
+  Runs tasks on a set of threads that are created once and then shared by 
+  the IO, MIP, resampling and other multi-threaded code of the library. 
+  The threads are added as needed, up to the largest thread count asked 
+  for; initIO() and setNumIOThreads() create numIOThreads() of them.
+
+  A task is run by the calling thread, plus any pool threads that are idle
+  before it finishes. The calling thread therefore never waits for the 
+  pool to take a task, and tasks that are started from within other tasks 
+  share the same threads rather than creating more. In turn, a task must 
+  be able to finish all of its work on its own, which is the case for the
+  usual loop that claims work items from a shared atomic counter.
+*/
+
+//----------------------------------------------------------------------------//
+
+class FIELD3D_API ThreadPool
+{
+public:
+
+  // Nested classes ------------------------------------------------------------
+
+  //! Base class for tasks run by the pool
+  class Task
+  {
+  public:
+    virtual ~Task()
+    { }
+    //! Called on each thread that works on the task, with a thread index
+    //! that is unique within the task and less than the number of threads
+    //! that the task was run with. The calling thread has index 0.
+    virtual void run(const size_t threadIdx) = 0;
+  };
+
+  // Main methods --------------------------------------------------------------
+
+  //! Returns a reference to the singleton instance
+  static ThreadPool& singleton();
+
+  //! Makes sure the pool can run tasks on numThreads threads, counting the 
+  //! calling one. Threads are only ever added.
+  void reserve(const size_t numThreads);
+
+  //! Returns the number of threads tasks can run on, counting the calling
+  //! one
+  size_t numThreads() const;
+
+  //! Runs the task on up to numThreads threads, counting the calling one, 
+  //! and returns once all of them are done with it. If the task throws on
+  //! any of the threads, the first exception is rethrown from here.
+  void run(Task &task, const size_t numThreads);
+
+private:
+
+  // Structs -------------------------------------------------------------------
+
+  //! A task that is being run
+  struct Job
+  {
+    Task   *task;
+    //! Number of threads the task may run on
+    size_t  numThreads;
+    //! Index of the next thread to work on the task
+    size_t  nextThreadIdx;
+    //! Number of pool threads working on the task
+    size_t  numActive;
+    //! First exception thrown by the task on a pool thread
+    boost::exception_ptr exception;
+  };
+
+  // Ctors ---------------------------------------------------------------------
+
+  //! Private to prevent instantiation
+  ThreadPool();
+
+  // Utility methods -----------------------------------------------------------
+
+  //! Stops handing out the job and waits for the pool threads working on
+  //! it. Used by run()
+  void finishJob(Job &job);
+
+  //! Main loop of the pool threads
+  void workerLoop();
+
+  // Data members --------------------------------------------------------------
+
+  //! Jobs that may still take more threads, oldest first
+  std::deque<Job*> m_jobs;
+  //! The pool threads. They run until the process exits
+  boost::thread_group m_workers;
+  //! Number of pool threads
+  size_t m_numWorkers;
+  //! Protects all of the above
+  mutable boost::mutex m_mutex;
+  //! Signaled when a job is queued
+  boost::condition_variable m_jobQueued;
+  //! Signaled when a pool thread is done with a job
+  boost::condition_variable m_jobDone;
+  //! Pointer to singleton
+  static ThreadPool *ms_singleton;
+  //! Mutex to prevent multiple allocation of the singleton
+  static boost::mutex ms_creationMutex;
+};
+
+//----------------------------------------------------------------------------//
+// detail namespace
+//----------------------------------------------------------------------------//
+
+namespace detail {
+
+  //--------------------------------------------------------------------------//
+
+  //! Runs a copy of an op on each thread. Used by runOnThreads()
+  template <class Op_T>
+  class CopyOpTask : public ThreadPool::Task
+  {
+  public:
+    CopyOpTask(const Op_T &op)
+      : m_op(op)
+    { }
+    virtual void run(const size_t /* threadIdx */)
+    {
+      Op_T op(m_op);
+      op();
+    }
+  private:
+    const Op_T &m_op;
+  };
+
+  //--------------------------------------------------------------------------//
+
+} // namespace detail
+
+//----------------------------------------------------------------------------//
+// Utility functions
+//----------------------------------------------------------------------------//
+
+//! Calls a copy of op on each of up to numThreads threads of the shared
+//! ThreadPool, counting the calling one, and returns once all are done. 
+//! Fewer copies may run than asked for, so op has to claim its work from 
+//! state that the copies share.
+template <class Op_T>
+void runOnThreads(const Op_T &op, const size_t numThreads)
+{
+  detail::CopyOpTask<Op_T> task(op);
+  ThreadPool::singleton().run(task, numThreads);
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
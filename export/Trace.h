@@ -0,0 +1,202 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file Trace.h
+  \brief Contains the Trace namespace, which records a timeline of I/O, 
+  decompression, locking and MIP events for viewing in chrome://tracing 
+  or Perfetto.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_Trace_H_
+#define _INCLUDED_Field3D_Trace_H_
+
+//----------------------------------------------------------------------------//
+
+#include <iosfwd>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Trace
+//----------------------------------------------------------------------------//
+
+/*! \namespace Trace
+  \ingroup file
+  Timeline of the library's hot paths. Each thread records its events into
+  its own fixed-size ring buffer, without locking, and only the most recent
+  events of each thread are kept. Recording is off until setEnabled() is 
+  called, and an event then costs two clock reads.
+
+  Event names must be string literals, or otherwise outlive the trace, 
+  since only the pointer is stored.
+
+  Tracing is compiled out along with the Stats counters when 
+  FIELD3D_DISABLE_STATS is defined.
+
+  Setting the FIELD3D_TRACE_FILE environment variable before initIO() 
+  turns recording on and writes the trace to that file when the process 
+  exits.
+*/
+
+//----------------------------------------------------------------------------//
+
+namespace Trace {
+
+//----------------------------------------------------------------------------//
+
+//! Number of events kept per thread
+const size_t k_eventsPerThread = 1 << 14;
+
+//----------------------------------------------------------------------------//
+
+//! Turns recording on or off
+FIELD3D_API void setEnabled(const bool enabled);
+
+//! Whether events are being recorded
+FIELD3D_API bool isEnabled();
+
+//! Discards all recorded events
+FIELD3D_API void clear();
+
+//! Number of events currently held, over all threads
+FIELD3D_API size_t numEvents();
+
+//! Writes the recorded events in the Chrome trace event format
+//! \note Events recorded while writing may or may not be included.
+FIELD3D_API void writeChromeTrace(std::ostream &os);
+
+//! Writes the recorded events in the Chrome trace event format to the 
+//! given file
+FIELD3D_API bool writeChromeTrace(const std::string &filename);
+
+//! Writes the trace to the given file when the process exits. An empty 
+//! filename turns this off.
+FIELD3D_API void setDumpAtExit(const std::string &filename);
+
+//! The clock that events are timed with, in microseconds
+FIELD3D_API boost::uint64_t now();
+
+//----------------------------------------------------------------------------//
+
+#ifndef FIELD3D_DISABLE_STATS
+
+//! Records an event of the calling thread that started at the given time. 
+//! A non-negative arg, such as a block index, is shown with the event.
+FIELD3D_API void addEvent(const char *name, const boost::uint64_t start, 
+                          const boost::uint64_t duration, 
+                          const boost::int64_t arg = -1);
+
+//! Records an event without duration, such as a cache eviction
+FIELD3D_API void addInstant(const char *name, const boost::int64_t arg = -1);
+
+#else
+
+inline void addEvent(const char *, const boost::uint64_t, 
+                     const boost::uint64_t, const boost::int64_t = -1)
+{ }
+
+inline void addInstant(const char *, const boost::int64_t = -1)
+{ }
+
+#endif
+
+//----------------------------------------------------------------------------//
+// ScopedEvent
+//----------------------------------------------------------------------------//
+
+/*! \class ScopedEvent
+  Records an event spanning its lifetime. The clock is only read when
+  recording is enabled.
+*/
+
+//----------------------------------------------------------------------------//
+
+class ScopedEvent : boost::noncopyable
+{
+public:
+
+#ifndef FIELD3D_DISABLE_STATS
+
+  explicit ScopedEvent(const char *name, const boost::int64_t arg = -1)
+    : m_name(isEnabled() ? name : NULL), m_arg(arg), 
+      m_start(m_name ? now() : 0)
+  { }
+
+  ~ScopedEvent()
+  { 
+    if (m_name) {
+      addEvent(m_name, m_start, now() - m_start, m_arg);
+    }
+  }
+
+private:
+
+  const char            *m_name;
+  const boost::int64_t   m_arg;
+  const boost::uint64_t  m_start;
+
+#else
+
+  explicit ScopedEvent(const char *, const boost::int64_t = -1)
+  { }
+
+#endif
+
+};
+
+//----------------------------------------------------------------------------//
+
+} // namespace Trace
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
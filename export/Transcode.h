@@ -0,0 +1,112 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Transcode.h
+  \brief Contains the transcode() function, which converts .f3d files to Ogawa.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_Transcode_H_
+#define _INCLUDED_Field3D_Transcode_H_
+
+//----------------------------------------------------------------------------//
+
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// TranscodeOptions
+//----------------------------------------------------------------------------//
+
+//! Controls which layers transcode() converts, and how
+struct TranscodeOptions
+{
+  TranscodeOptions()
+    : numThreads(0), blockOrder(0), releaseUniformBlocks(false)
+  { }
+  //! Patterns that partition names must match, see PatternMatch.h. An empty
+  //! list matches all partitions.
+  std::vector<std::string> partitions;
+  //! Patterns that layer names must match. An empty list matches all layers.
+  std::vector<std::string> layers;
+  //! Number of layers that are read at the same time. This is also the 
+  //! number of layers held in memory at once. 0 uses numIOThreads().
+  size_t numThreads;
+  //! Block order that SparseFields are converted to before being written.
+  //! 0 keeps each field's own block order.
+  int blockOrder;
+  //! Whether allocated SparseField blocks that hold a single value are 
+  //! released before writing, see SparseField::releaseUniformBlocks()
+  bool releaseUniformBlocks;
+};
+
+//----------------------------------------------------------------------------//
+// Functions
+//----------------------------------------------------------------------------//
+
+//! Converts an .f3d file, usually an HDF5 one, to an Ogawa file. Layers are 
+//! read in batches of options.numThreads, one layer per thread, and each 
+//! batch is written with Field3DOutputFile::writeLayers(), which compresses 
+//! the blocks of all its SparseFields on numIOThreads() threads. MIP layers
+//! stay MIP layers, and the global and per-layer metadata is kept. The 
+//! input may also be an Ogawa file, e.g. to rewrite it with other 
+//! compression settings.
+//! \note options.blockOrder and options.releaseUniformBlocks only affect 
+//! plain SparseFields, not the levels of MIP fields.
+//! \note Group membership isn't carried over, since input files don't 
+//! expose it.
+//! \returns False if the input couldn't be read, or if the output or any 
+//! layer couldn't be written
+FIELD3D_API bool transcode(const std::string &inputPath, 
+                           const std::string &outputPath,
+                           const TranscodeOptions &options = 
+                           TranscodeOptions());
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
@@ -0,0 +1,97 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2014 Sony Pictures Imageworks Inc
+ *                    Pixar Animation Studios
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlockChecksum.h
+  \brief Contains the checksums stored with compressed blocks and slabs.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_BlockChecksum_H_
+#define _INCLUDED_Field3D_BlockChecksum_H_
+
+//----------------------------------------------------------------------------//
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// BlockChecksum
+//----------------------------------------------------------------------------//
+
+/*! \namespace BlockChecksum
+  Compressed datasets may be accompanied by a uint32 dataset that holds the
+  CRC32C (Castagnoli) checksum of each of their elements, as stored on disk.
+  Checking them is much cheaper than decompressing, and catches damage that
+  the codec wouldn't notice. See setWriteChecksums().
+  \ingroup file_int
+*/
+
+//----------------------------------------------------------------------------//
+
+namespace BlockChecksum {
+
+  //! Returns the CRC32C of numBytes of data, continuing from the checksum
+  //! of the bytes that precede them, if any. Uses the CRC32 instructions of
+  //! SSE4.2 or ARMv8 when compiled for them.
+  FIELD3D_API boost::uint32_t crc32c(const boost::uint8_t *data, 
+                                     const size_t numBytes,
+                                     const boost::uint32_t crc = 0);
+
+  //! Returns the name of the dataset that holds the checksums of the
+  //! elements of the compressed dataset dataName
+  FIELD3D_API std::string datasetName(const std::string &dataName);
+
+} // namespace BlockChecksum
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // include guard
+
+//----------------------------------------------------------------------------//
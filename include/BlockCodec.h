@@ -0,0 +1,126 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2014 Sony Pictures Imageworks Inc
+ *                    Pixar Animation Studios
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlockCodec.h
+  \brief Contains functions for compressing and decompressing sparse blocks
+  with the codec named in the file.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_BlockCodec_H_
+#define _INCLUDED_Field3D_BlockCodec_H_
+
+//----------------------------------------------------------------------------//
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+//----------------------------------------------------------------------------//
+
+#include "InitIO.h"
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// BlockCodec
+//----------------------------------------------------------------------------//
+
+/*! \namespace BlockCodec
+  Every codec is identified on disk by its SparseCodec value. Readers 
+  treat files without a codec attribute as SparseCodecZlib. The shuffling
+  codecs regroup the bytes of the elementSize-byte values before 
+  compressing, so that the sign/exponent bytes of neighboring voxels end up
+  next to each other.
+  \ingroup file_int
+*/
+
+//----------------------------------------------------------------------------//
+
+namespace BlockCodec {
+
+  //! Returns whether the given codec is known to this library and was 
+  //! built into it
+  FIELD3D_API bool   isValid(const int codec);
+
+  //! Returns the largest compressed size of numBytes of data
+  FIELD3D_API size_t compressBound(const SparseCodec codec, 
+                                   const size_t numBytes);
+
+  //! Compresses srcLen bytes of src into dst. 
+  //! \param dstLen Size of dst on input, compressed size on output
+  //! \param scratch Temporary storage, reused between calls
+  //! \returns False if compression failed
+  FIELD3D_API bool   compress(const SparseCodec codec, 
+                              const size_t elementSize,
+                              const boost::uint8_t *src, const size_t srcLen,
+                              boost::uint8_t *dst, size_t &dstLen,
+                              std::vector<boost::uint8_t> &scratch);
+
+  //! Compresses with the given compression level instead of 
+  //! sparseCompressionLevel(), e.g. to try out levels without changing 
+  //! the global setting
+  FIELD3D_API bool   compress(const SparseCodec codec, const int level,
+                              const size_t elementSize,
+                              const boost::uint8_t *src, const size_t srcLen,
+                              boost::uint8_t *dst, size_t &dstLen,
+                              std::vector<boost::uint8_t> &scratch);
+
+  //! Decompresses srcLen bytes of src into the dstLen bytes of dst
+  //! \returns False if the data was corrupt or didn't fill dst
+  FIELD3D_API bool   decompress(const SparseCodec codec, 
+                                const size_t elementSize,
+                                const boost::uint8_t *src, 
+                                const size_t srcLen, 
+                                boost::uint8_t *dst, const size_t dstLen,
+                                std::vector<boost::uint8_t> &scratch);
+
+} // namespace BlockCodec
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // include guard
+
+//----------------------------------------------------------------------------//
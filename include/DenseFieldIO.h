@@ -48,6 +48,7 @@
 
 #include <string>
 
+#include <boost/function.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include <hdf5.h>
@@ -126,6 +127,26 @@ public:
                               const std::string &layerPath,
                               OgDataType typeEnum);
 
+  //! Reads only the voxels of the field that overlap voxelWindow, using a
+  //! hyperslab selection. The resulting field's data window is the overlap.
+  //! \returns Null if no object was read, or if the field's data window 
+  //! misses voxelWindow
+  virtual FieldBase::Ptr readWindow(hid_t layerGroup, 
+                                    const std::string &filename,
+                                    const std::string &layerPath,
+                                    DataTypeEnum typeEnum,
+                                    const Box3i &voxelWindow);
+
+  //! Reads only the rows of the field that overlap voxelWindow. The 
+  //! resulting field's data window is the overlap.
+  //! \returns Null if no object was read, or if the field's data window 
+  //! misses voxelWindow
+  virtual FieldBase::Ptr readWindow(const OgIGroup &layerGroup, 
+                                    const std::string &filename,
+                                    const std::string &layerPath,
+                                    OgDataType typeEnum,
+                                    const Box3i &voxelWindow);
+
   //! Writes the given field to disk. This function calls out to writeInternal
   //! once the template type has been determined.
   //! \return true if successful, otherwise false
@@ -139,11 +160,61 @@ public:
   //! Returns the class name
   virtual std::string className() const
   { return "DenseField"; }
+
+  // Streaming -----------------------------------------------------------------
+
+  //! Writes a layer that reads back as a DenseField<Data_T>, without the 
+  //! field ever being in memory. fillSlice(k, slice) is called for each z 
+  //! slice of the data window, in order, and fills in its voxels with x 
+  //! varying fastest. Only one slice is held in memory at a time.
+  //! \note The caller is expected to have written the class_name attribute,
+  //! as for write().
+  template <class Data_T>
+  static bool 
+  writeStreamed(OgOGroup &layerGroup, const Box3i &extents, 
+                const Box3i &dataWindow,
+                const boost::function<void (int, Data_T *)> &fillSlice);
+
+  // Compressed slabs ----------------------------------------------------------
+
+  //! Returns the number of z slices per compressed slab for a data window of
+  //! the given resolution, or 0 if denseStorageMode() stores data raw
+  static int writeChunkSlices(const V3i &res);
+
+  //! Writes res.x * res.y * res.z voxels to the named dataset as separately 
+  //! compressed slabs of chunkSlices z slices. The slabs are compressed on
+  //! numIOThreads() threads with sparseCodec().
+  template <class Data_T>
+  static bool writeChunks(OgOGroup &layerGroup, const std::string &name, 
+                          const Data_T *data, const V3i &res, 
+                          const int chunkSlices);
+
+  //! Decompresses the slabs of the named dataset that overlap window into 
+  //! dst, which holds the window's voxels with x varying fastest. res is the
+  //! resolution of the data window, and window is relative to its minimum.
+  //! The slabs are decompressed on numIOThreads() threads.
+  //! \returns False if the dataset is missing or couldn't be decompressed
+  template <class Data_T>
+  static bool readChunks(const OgIGroup &layerGroup, const std::string &name,
+                         const SparseCodec codec, const V3i &res, 
+                         const int chunkSlices, const Box3i &window, 
+                         Data_T *dst);
   
 private:
 
   // Internal methods ----------------------------------------------------------
 
+  //! Shared implementation of the HDF5 read() and readWindow(). A null
+  //! voxelWindow reads the whole field.
+  FieldBase::Ptr readInternal(hid_t layerGroup, DataTypeEnum typeEnum,
+                              const Box3i *voxelWindow);
+
+  //! Shared implementation of the Ogawa read() and readWindow(). A null
+  //! voxelWindow reads the whole field.
+  FieldBase::Ptr readInternal(const OgIGroup &layerGroup, 
+                              OgDataType typeEnum,
+                              const Box3i *voxelWindow);
+
   //! This call writes all the attributes and sets up the data space.
   template <class Data_T>
   bool writeInternal(hid_t layerGroup, 
@@ -154,6 +225,13 @@ private:
   bool writeInternal(OgOGroup &layerGroup, 
                      typename DenseField<Data_T>::Ptr field);
 
+  //! Writes the version and the attributes that describe a field of the 
+  //! given size. chunkSlices is the number of z slices per compressed slab, 
+  //! or 0 if the data is stored raw.
+  template <class Data_T>
+  static void writeAttributes(OgOGroup &layerGroup, const Box3i &ext, 
+                              const Box3i &dw, const int chunkSlices);
+
   //! This call performs the actual writing of data to disk. 
   template <class Data_T>
   bool writeData(hid_t dataSet, typename DenseField<Data_T>::Ptr field,
@@ -162,17 +240,28 @@ private:
   //! This call performs the actual reading of data from disk.
   template <class Data_T>
   typename DenseField<Data_T>::Ptr 
-  readData(hid_t dataSet, const Box3i &extents, const Box3i &dataW);
+  readData(hid_t dataSet, const Box3i &extents, const Box3i &dataW,
+           const Box3i *voxelWindow);
 
   //! This call performs the actual reading of data from disk.
   template <class Data_T>
   typename DenseField<Data_T>::Ptr 
   readData(const OgIGroup &layerGroup, const Box3i &extents, 
-           const Box3i &dataW);
+           const Box3i &dataW, const Box3i *voxelWindow);
+
+  //! Reads the voxels of a compressed layer that overlap voxelWindow, or all
+  //! of them if it's null. The slabs are decompressed on numIOThreads() 
+  //! threads.
+  template <class Data_T>
+  typename DenseField<Data_T>::Ptr 
+  readCompressedData(const OgIGroup &layerGroup, const Box3i &extents, 
+                     const Box3i &dataW, const Box3i *voxelWindow, 
+                     const int chunkSlices);
 
   // Strings -------------------------------------------------------------------
 
   static const int         k_versionNumber;
+  static const int         k_compressedVersionNumber;
   static const std::string k_versionAttrName;
   static const std::string k_extentsStr;
   static const std::string k_extentsMinStr;
@@ -183,6 +272,8 @@ private:
   static const std::string k_componentsStr;
   static const std::string k_bitsPerComponentStr;
   static const std::string k_dataStr;
+  static const std::string k_codecStr;
+  static const std::string k_chunkSlicesStr;
 
   // Typedefs ------------------------------------------------------------------
 
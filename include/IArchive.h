@@ -49,8 +49,12 @@ namespace ALEMBIC_VERSION_NS {
 class IArchive
 {
 public:
-    IArchive(const std::string & iFileName, std::size_t iNumStreams=1);
+    // iMapFile memory-maps the file rather than reading it, see IStreams
+    IArchive(const std::string & iFileName, std::size_t iNumStreams=1,
+             bool iMapFile=false);
     IArchive(const std::vector< std::istream * > & iStreams);
+    // reads through a stream source, see IStreams
+    IArchive(IStreamSourcePtr iSource);
     ~IArchive();
 
     bool isValid() const;
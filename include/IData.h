@@ -54,6 +54,13 @@ public:
 
     Alembic::Util::uint64_t getSize() const;
 
+    // returns a pointer to the data in the memory-mapped file, valid for as
+    // long as the archive is open. NULL if the file isn't mapped.
+    const void * getMappedData() const;
+
+    // asks the OS to start reading the data in the background
+    void willNeed() const;
+
     // not really necessary for most workflows, it could be used by some
     // Ogawa utilities to detect when this IData is shared
     Alembic::Util::uint64_t getPos() const;
@@ -57,6 +57,14 @@ public:
 
     IDataPtr getData(Alembic::Util::uint64_t iIndex, std::size_t iThreadIndex);
 
+    // asks the OS to start reading the data children at iIndices in the
+    // background. Each child's extent runs from its position to that of
+    // the child after it, so nothing is read to find the extents, and
+    // extents that touch are hinted as one range. Light groups hint each
+    // child separately.
+    void willNeedData(const std::vector<Alembic::Util::uint64_t> &iIndices,
+                      std::size_t iThreadIndex);
+
     Alembic::Util::uint64_t getNumChildren() const;
 
     bool isChildGroup(Alembic::Util::uint64_t iIndex) const;
@@ -44,18 +44,73 @@ namespace Alembic {
 namespace Ogawa {
 namespace ALEMBIC_VERSION_NS {
 
+// a random access source of bytes that IStreams reads from instead of a
+// local file, e.g. a file in an object store. Any number of threads may
+// call read() at once.
+class IStreamSource
+{
+public:
+    virtual ~IStreamSource() {}
+
+    // total number of bytes in the source
+    virtual Alembic::Util::uint64_t size() = 0;
+
+    // reads iSize bytes at iPos into oBuf, returns false if they couldn't
+    // all be read
+    virtual bool read(Alembic::Util::uint64_t iPos,
+                      Alembic::Util::uint64_t iSize, void * oBuf) = 0;
+
+    // hints that iSize bytes at iPos will be read soon. Does nothing by
+    // default.
+    virtual void willNeed(Alembic::Util::uint64_t iPos,
+                          Alembic::Util::uint64_t iSize)
+    {
+        (void)iPos;
+        (void)iSize;
+    }
+};
+typedef Alembic::Util::shared_ptr< IStreamSource > IStreamSourcePtr;
+
 class IStreams
 {
 public:
-    IStreams(const std::string & iFileName, std::size_t iNumStreams=1);
+    // opens the file for positional reads, which any number of threads can
+    // issue at once. iNumStreams is no longer needed and is ignored.
+    // If iMapFile is true the whole file is memory-mapped instead, when
+    // possible, and reads become copies out of the mapping.
+    IStreams(const std::string & iFileName, std::size_t iNumStreams=1,
+             bool iMapFile=false);
     IStreams(const std::vector< std::istream * > & iStreams);
+    // reads through iSource, which is shared by all threads. A NULL source
+    // gives an invalid IStreams.
+    IStreams(IStreamSourcePtr iSource);
     ~IStreams();
 
     bool isValid();
     bool isFrozen();
     Alembic::Util::uint16_t getVersion();
 
-    // locks on the threadId, seeks to iPos, and reads iSize bytes into oBuf
+    // whether the file is memory-mapped
+    bool isMapped();
+
+    // returns a pointer to iSize bytes at iPos in the mapping, which
+    // stays valid for the lifetime of this IStreams. NULL if the file
+    // isn't mapped or the range lies outside it.
+    const void * data(Alembic::Util::uint64_t iPos,
+                      Alembic::Util::uint64_t iSize);
+
+    // tells the OS that iSize bytes at iPos will be read soon, so that it
+    // can start reading them in the background. Returns immediately, and
+    // does nothing where the OS has no such hint or for caller-supplied
+    // streams. Stream sources get the hint passed on.
+    void willNeed(Alembic::Util::uint64_t iPos,
+                  Alembic::Util::uint64_t iSize);
+
+    // reads iSize bytes at iPos into oBuf. Streams handed to the
+    // constructor are locked on the threadId and seeked. Files opened by
+    // name are read positionally, and once the reads of a threadId turn
+    // sequential, they are served from a buffer that reads 4 to 16MB ahead.
+    // Keeping each thread's reads in file order makes the most of it.
     void read(std::size_t iThreadId, Alembic::Util::uint64_t iPos,
               Alembic::Util::uint64_t iSize, void * oBuf);
 
@@ -0,0 +1,181 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file LevelSetFieldIO.h
+  \brief Contains the LevelSetFieldIO class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_LevelSetFieldIO_H_
+#define _INCLUDED_Field3D_LevelSetFieldIO_H_
+
+//----------------------------------------------------------------------------//
+
+#include <string>
+
+#include <boost/intrusive_ptr.hpp>
+
+#include <hdf5.h>
+
+#include "Exception.h"
+#include "Field3DFile.h"
+#include "FieldIO.h"
+#include "Hdf5Util.h"
+#include "LevelSetField.h"
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// LevelSetFieldIO
+//----------------------------------------------------------------------------//
+
+/*! \class LevelSetFieldIO
+  \ingroup file_int
+  Defines the IO for a LevelSetField object. The distances are stored in a
+  subgroup using SparseFieldIO, which keeps the tiles' values, so only the
+  band is written and it may be dynamically loaded.
+*/
+
+//----------------------------------------------------------------------------//
+
+class LevelSetFieldIO : public FieldIO 
+{
+
+public:
+  
+  // Typedefs ------------------------------------------------------------------
+  
+  typedef boost::intrusive_ptr<LevelSetFieldIO> Ptr;
+
+  // RTTI replacement ----------------------------------------------------------
+
+  typedef LevelSetFieldIO class_type;
+  DEFINE_FIELD_RTTI_CONCRETE_CLASS;
+
+  static const char *staticClassType()
+  {
+    return "LevelSetFieldIO";
+  }
+    
+  // Constructors --------------------------------------------------------------
+
+  //! Ctor
+  LevelSetFieldIO() 
+   : FieldIO()
+  { }
+
+  //! Dtor
+  virtual ~LevelSetFieldIO() 
+  { /* Empty */ }
+
+  static FieldIO::Ptr create()
+  { return Ptr(new LevelSetFieldIO); }
+
+  // From FieldIO --------------------------------------------------------------
+
+  //! Reads the field at the given location and tries to create a 
+  //! LevelSetField object from it.
+  //! \returns Null if no object was read
+  virtual FieldBase::Ptr read(hid_t layerGroup, const std::string &filename, 
+                              const std::string &layerPath,
+                              DataTypeEnum typeEnum);
+
+  //! Reads the field at the given location and tries to create a 
+  //! LevelSetField object from it.
+  //! \returns Null if no object was read
+  virtual FieldBase::Ptr read(const OgIGroup &layerGroup, 
+                              const std::string &filename, 
+                              const std::string &layerPath,
+                              OgDataType typeEnum);
+
+  //! Writes the given field to disk. 
+  //! \return true if successful, otherwise false
+  virtual bool write(hid_t layerGroup, FieldBase::Ptr field);
+
+  //! Writes the given field to disk. 
+  //! \return true if successful, otherwise false
+  virtual bool write(OgOGroup &layerGroup, FieldBase::Ptr field);
+
+  //! Returns the class name
+  virtual std::string className() const
+  { return "LevelSetField"; }
+
+private:
+
+  // Internal methods ----------------------------------------------------------
+
+  //! Writes the half width and the distance subgroup.
+  template <class Data_T>
+  bool writeInternal(hid_t layerGroup, 
+                     typename LevelSetField<Data_T>::Ptr field);
+
+  //! Writes the half width and the distance subgroup.
+  template <class Data_T>
+  bool writeInternal(OgOGroup &layerGroup, 
+                     typename LevelSetField<Data_T>::Ptr field);
+
+  //! Wraps the distances read from the subgroup in a new field.
+  template <class Data_T>
+  static typename LevelSetField<Data_T>::Ptr 
+  makeField(FieldBase::Ptr sdf, const float halfWidth);
+
+  // Strings -------------------------------------------------------------------
+
+  static const int         k_versionNumber;
+  static const std::string k_versionAttrName;
+  static const std::string k_halfWidthStr;
+  static const std::string k_sdfDataStr;
+
+  // Typedefs ------------------------------------------------------------------
+
+  //! Convenience typedef for referring to base class
+  typedef FieldIO base;    
+};
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // Include guard
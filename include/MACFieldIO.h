@@ -52,10 +52,12 @@
 
 #include <hdf5.h>
 
+#include "DenseField.h"
 #include "Exception.h"
 #include "Field3DFile.h"
 #include "FieldIO.h"
 #include "Hdf5Util.h"
+#include "InitIO.h"
 #include "MACField.h"
 
 //----------------------------------------------------------------------------//
@@ -137,6 +139,18 @@ public:
   virtual std::string className() const
   { return "MACField"; }
 
+  // Partial reads -------------------------------------------------------------
+
+  //! Reads a single face component of a MACField layer in an Ogawa file, 
+  //! without touching the other two. Voxel (i, j, k) of the returned field
+  //! holds the same face as MACField::u(i, j, k), v(i, j, k) or w(i, j, k),
+  //! so its data window is one voxel longer than the layer's along the 
+  //! component's axis. The extents are those of the layer.
+  //! \returns Null if the layer doesn't hold Data_T components
+  template <class Data_T>
+  static typename DenseField<Data_T>::Ptr 
+  readComponent(const OgIGroup &layerGroup, const MACComponent comp);
+
 private:
 
   // Internal methods ----------------------------------------------------------
@@ -144,6 +158,13 @@ private:
   //! This call writes all the attributes and sets up the data space.
   template <class Data_T>
   bool writeInternal(hid_t layerGroup, typename MACField<Data_T>::Ptr field);
+
+  //! Writes the attributes and the u,v,w data to an Ogawa layer. Each 
+  //! component is compressed in slabs on numIOThreads() threads, unless
+  //! denseStorageMode() stores data raw.
+  template <class Data_T>
+  bool writeInternal(OgOGroup &layerGroup, 
+                     typename MACField<Data_T>::Ptr field);
   
   //! This call writes out the u,v,w data 
   template <class Data_T>
@@ -154,14 +175,43 @@ private:
   template <class Data_T>
   bool readData(hid_t location, typename MACField<Data_T>::Ptr result);
 
+  //! Reads the u,v,w data of an Ogawa layer
+  template <class Data_T>
+  static typename MACField<Data_T>::Ptr 
+  readData(const OgIGroup &layerGroup, const Box3i &extents, 
+           const Box3i &dataW);
+
+  //! Reads the voxels of one component of an Ogawa layer into dst, which
+  //! holds the component's whole data window. Compressed components are 
+  //! decompressed on numIOThreads() threads.
+  template <class Data_T>
+  static void readComponentData(const OgIGroup &layerGroup, 
+                                const MACComponent comp, const Box3i &dataW,
+                                Data_T *dst);
+
+  //! Reads the version, extents, data window and bits per component of an
+  //! Ogawa layer
+  //! \throws An Exc::MissingAttributeException if one is missing
+  static void readAttributes(const OgIGroup &layerGroup, Box3i &extents, 
+                             Box3i &dataW, int &bits);
+
+  //! Returns the name of the data set that holds the given component
+  static const std::string& componentStr(const MACComponent comp);
+
   // Strings -------------------------------------------------------------------
 
   static const int         k_versionNumber;
   static const std::string k_versionAttrName;
   static const std::string k_extentsStr;
+  static const std::string k_extentsMinStr;
+  static const std::string k_extentsMaxStr;
   static const std::string k_dataWindowStr;
+  static const std::string k_dataWindowMinStr;
+  static const std::string k_dataWindowMaxStr;
   static const std::string k_componentsStr;
   static const std::string k_bitsPerComponentStr;
+  static const std::string k_codecStr;
+  static const std::string k_chunkSlicesStr;
   static const std::string k_uDataStr;
   static const std::string k_vDataStr;
   static const std::string k_wDataStr;
@@ -244,6 +294,8 @@ bool MACFieldIO::writeData(hid_t layerGroup,
   using namespace Exc;
   using namespace Hdf5Util;
 
+  typedef typename MACField<Data_T>::real_t real_t;
+
   const V3i &compSize = field->getComponentSize();
 
   hsize_t totalSize[1];
@@ -303,6 +355,14 @@ bool MACFieldIO::writeData(hid_t layerGroup,
     throw CreateDataSetException("Couldn't create data set in "
                                  "MACFieldIO::writeData");
 
+  // The data sets are in the native type, so the component's chunks can be
+  // deflated straight out of the field
+  if (hdf5ParallelDeflate() && 
+      writeDeflatedChunks(dataSet.id(), sizeof(real_t), 
+                          &(*field->cbegin_comp(comp)))) {
+    return true;
+  }
+
   hid_t err = H5Dwrite(dataSet, 
                        DataTypeTraits<Data_T>::h5type(), 
                        H5S_ALL, H5S_ALL, 
@@ -325,83 +385,28 @@ bool MACFieldIO::readData(hid_t layerGroup,
   using namespace Exc;
   using namespace Hdf5Util;
 
-  hsize_t dims[1];
-
-  // read u_data
-  {
-
-    H5ScopedDopen dataSet(layerGroup, k_uDataStr, H5P_DEFAULT);
-    if (dataSet.id() < 0) 
-      throw OpenDataSetException("Couldn't open data set: " + k_uDataStr);
-
-    H5ScopedDget_space dataSpace(dataSet.id());
-    H5ScopedDget_type dataType(dataSet.id());
-    H5Sget_simple_extent_dims(dataSpace.id(), dims, NULL);
-
-    if (dataSpace.id() < 0) 
-      throw GetDataSpaceException("Couldn't get data space");
-
-    if (dataType.id() < 0)
-      throw GetDataTypeException("Couldn't get data type");
-
-    if (H5Dread(dataSet, DataTypeTraits<Data_T>::h5type(), 
-                H5S_ALL, H5S_ALL, H5P_DEFAULT, &(*field->begin_comp(MACCompU))) < 0) 
-      {
-        std::string typeName = "MACField<" + 
-          DataTypeTraits<Data_T>::name() + ">";
-        throw Exc::Hdf5DataReadException("Couldn't read " + typeName + " data");
-      } 
-
-  }
+  typedef typename MACField<Data_T>::real_t real_t;
 
-  // read v_data
-  {
+  for (int c = 0; c < 3; ++c) {
 
-    H5ScopedDopen dataSet(layerGroup, k_vDataStr, H5P_DEFAULT);
-    if (dataSet.id() < 0) 
-      throw OpenDataSetException("Couldn't open data set: " + k_vDataStr);
+    const MACComponent comp    = static_cast<MACComponent>(c);
+    const std::string &compStr = componentStr(comp);
 
-    H5ScopedDget_space dataSpace(dataSet.id());
-    H5ScopedDget_type dataType(dataSet.id());
-    H5Sget_simple_extent_dims(dataSpace.id(), dims, NULL);
-
-    if (dataSpace.id() < 0) 
-      throw GetDataSpaceException("Couldn't get data space");
-
-    if (dataType.id() < 0)
-      throw GetDataTypeException("Couldn't get data type");
-
-
-    if (H5Dread(dataSet, DataTypeTraits<Data_T>::h5type(), 
-                H5S_ALL, H5S_ALL, H5P_DEFAULT, &(*field->begin_comp(MACCompV))) < 0) 
-      {
-        std::string typeName = "MACField<" + 
-          DataTypeTraits<Data_T>::name() + ">";
-        throw Exc::Hdf5DataReadException("Couldn't read " + typeName + " data");
-      } 
-
-  }
-
-  // read w_data
-  {
-
-    H5ScopedDopen dataSet(layerGroup, k_wDataStr, H5P_DEFAULT);
+    H5ScopedDopen dataSet(layerGroup, compStr, H5P_DEFAULT);
     if (dataSet.id() < 0) 
-      throw OpenDataSetException("Couldn't open data set: " + k_wDataStr);
+      throw OpenDataSetException("Couldn't open data set: " + compStr);
 
-    H5ScopedDget_space dataSpace(dataSet.id());
-    H5ScopedDget_type dataType(dataSet.id());
-    H5Sget_simple_extent_dims(dataSpace.id(), dims, NULL);
-
-    if (dataSpace.id() < 0) 
-      throw GetDataSpaceException("Couldn't get data space");
-
-    if (dataType.id() < 0)
-      throw GetDataTypeException("Couldn't get data type");
+    real_t *dst = &(*field->begin_comp(comp));
 
+    // The data sets are in the native type, so their raw chunks can be 
+    // inflated straight into the field
+    if (hdf5ParallelInflate() && 
+        readDeflatedChunks(dataSet.id(), sizeof(real_t), dst)) {
+      continue;
+    }
 
     if (H5Dread(dataSet, DataTypeTraits<Data_T>::h5type(), 
-                H5S_ALL, H5S_ALL, H5P_DEFAULT, &(*field->begin_comp(MACCompW))) < 0) 
+                H5S_ALL, H5S_ALL, H5P_DEFAULT, dst) < 0) 
       {
         std::string typeName = "MACField<" + 
           DataTypeTraits<Data_T>::name() + ">";
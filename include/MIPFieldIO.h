@@ -268,7 +268,9 @@ public:
       GlobalLock lock(g_hdf5Mutex);
       
       // Open the HDF5 file
-      file = H5Fopen(m_filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+      H5ScopedPcreate fileAccess(H5P_FILE_ACCESS);
+      setChunkCache(fileAccess.id());
+      file = H5Fopen(m_filename.c_str(), H5F_ACC_RDONLY, fileAccess.id());
       if (file < 0) {
         throw Exc::NoSuchFileException(m_filename);
       }
@@ -277,7 +279,7 @@ public:
 
     // Instantiate I/O
     FieldIO::Ptr io = 
-      ClassFactory::singleton().createFieldIO(Field_T::staticClassName());
+      ClassFactory::singleton().sharedFieldIO(Field_T::staticClassName());
     FieldBase::Ptr field = io->read(*levelGroup, m_filename, m_path, m_typeEnum);
     if (!field) {
       throw Exc::MIPFieldIOException("Failed to read MIP level from disk.");
@@ -343,9 +345,8 @@ public:
 
   virtual typename Field_T::Ptr load() const
   {
-    // Lock Ogawa access
-    boost::mutex::scoped_lock lock(ms_ogawaMutex);
-
+    // Each load opens an archive of its own, so levels may be read from 
+    // several threads at once
     Alembic::Ogawa::IArchive archive(m_filename);
     if (!archive.isValid()) {
       throw Exc::NoSuchFileException(m_filename);
@@ -358,7 +359,7 @@ public:
     OgIGroup levelGroup = root.findGroup(m_path);
 
     FieldIO::Ptr io = 
-      ClassFactory::singleton().createFieldIO(Field_T::staticClassName());
+      ClassFactory::singleton().sharedFieldIO(Field_T::staticClassName());
     FieldBase::Ptr field = io->read(levelGroup, m_filename, m_path, m_typeEnum);
     if (!field) {
       throw Exc::MIPFieldIOException("Failed to read MIP level from disk.");
@@ -377,9 +378,6 @@ private:
   //! Data type enum
   const OgDataType m_typeEnum;
 
-  //! Ogawa access mutex
-  static boost::mutex ms_ogawaMutex;
-
 };
 
 //----------------------------------------------------------------------------//
@@ -454,11 +452,12 @@ bool MIPFieldIO::writeInternal(hid_t layerGroup,
     H5ScopedGcreate levelGroup(mipGroup, k_levelGroupStr + "." + 
                                boost::lexical_cast<std::string>(i));
     
-    // Add the field to the group
+    // Add the field to the group. Levels that weren't loaded are freed
+    // once written
     std::string className = Field_T<Data_T>::staticClassName();
     FieldIO::Ptr io = 
-      ClassFactory::singleton().createFieldIO(className);
-    io->write(levelGroup, field->mipLevel(i));
+      ClassFactory::singleton().sharedFieldIO(className);
+    io->write(levelGroup, field->streamMipLevel(i));
 
   }
 
@@ -504,6 +503,8 @@ bool MIPFieldIO::writeInternal(OgOGroup &layerGroup,
 
   OgOAttribute<uint32_t> numLevelsAttr(mipGroup, k_levelsStr, numLevels);
 
+  bool success = true;
+
   // For each level ---
 
   for (size_t i = 0; i < field->numLevels(); i++) {
@@ -512,15 +513,17 @@ bool MIPFieldIO::writeInternal(OgOGroup &layerGroup,
     OgOGroup levelGroup(mipGroup, k_levelGroupStr + "." + 
                         boost::lexical_cast<std::string>(i));
     
-    // Add the field to the group
+    // Add the field to the group. Levels that weren't loaded are freed
+    // once written
     std::string className = Field_T<Data_T>::staticClassName();
     FieldIO::Ptr io = 
-      ClassFactory::singleton().createFieldIO(className);
-    io->write(levelGroup, field->mipLevel(i));
+      ClassFactory::singleton().sharedFieldIO(className);
+    io->write(levelGroup, field->streamMipLevel(i));
+    success = levelGroup.writePackedAttributes() && success;
 
   }
 
-  return true; 
+  return mipGroup.writePackedAttributes() && success; 
 }
 
 //----------------------------------------------------------------------------//
@@ -753,11 +756,6 @@ boost::mutex GenericLazyLoadActionHDF5<Field_T>::ms_hdf5Mutex;
 
 //----------------------------------------------------------------------------//
 
-template <typename Field_T> 
-boost::mutex GenericLazyLoadAction<Field_T>::ms_ogawaMutex;
-
-//----------------------------------------------------------------------------//
-
 FIELD3D_NAMESPACE_HEADER_CLOSE
 
 //----------------------------------------------------------------------------//
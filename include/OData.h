@@ -61,13 +61,15 @@ public:
 
     Alembic::Util::uint64_t getSize() const;
 
+    // position of the data in the stream, the data itself starts 8 bytes
+    // later, after the written out size
+    Alembic::Util::uint64_t getPos() const;
+
 private:
     friend class OGroup; // friend so we can call the constructor below
     OData(OStreamPtr iStream, Alembic::Util::uint64_t iPos,
           Alembic::Util::uint64_t iSize);
 
-    Alembic::Util::uint64_t getPos() const;
-
     class PrivateData;
     Alembic::Util::auto_ptr< PrivateData > mData;
 };
@@ -77,6 +77,14 @@ public:
                         const Alembic::Util::uint64_t * iSizes,
                         const void ** iDatas);
 
+    // write the size of a data stream and add it as a child to this group.
+    // The iSize bytes of the stream itself are then written in pieces with
+    // streamData(), before anything else is written to the archive.
+    ODataPtr addStreamedData(Alembic::Util::uint64_t iSize);
+
+    // write the next piece of the data stream started by addStreamedData()
+    void streamData(Alembic::Util::uint64_t iSize, const void * iData);
+
     // reference existing data
     void addData(ODataPtr iData);
 
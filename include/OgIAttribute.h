@@ -52,12 +52,30 @@ public:
   //! marked invalid.
   OgIAttribute(Alembic::Ogawa::IGroupPtr group);
 
+  //! Initialize from packed attribute data. The attribute is marked invalid 
+  //! if the type enum doesn't match the template parameter.
+  OgIAttribute(const std::string &name, const OgDataType type, 
+               const uint8_t *data, const size_t numBytes);
+
   // Main methods --------------------------------------------------------------
 
+  //! Whether the attribute is valid
+  bool isValid() const
+  { return m_isPacked || OgIBase::isValid(); }
+
   //! Returns the value of the attribute. This will be zero if the attribute
   //! is invalid.
   T value() const;
 
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! Whether the value came from packed attributes
+  bool m_isPacked;
+  //! The value, if it came from packed attributes
+  T    m_packedValue;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -66,6 +84,7 @@ public:
 
 template <typename T>
 OgIAttribute<T>::OgIAttribute()
+  : m_isPacked(false)
 { 
   // Empty
 }
@@ -74,7 +93,7 @@ OgIAttribute<T>::OgIAttribute()
 
 template <typename T>
 OgIAttribute<T>::OgIAttribute(Alembic::Ogawa::IGroupPtr group)
-  : OgIBase(group)
+  : OgIBase(group), m_isPacked(false)
 {
   // Handle null pointer
   if (!OgIBase::m_group) {
@@ -92,9 +111,26 @@ OgIAttribute<T>::OgIAttribute(Alembic::Ogawa::IGroupPtr group)
 
 //----------------------------------------------------------------------------//
 
+template <typename T>
+OgIAttribute<T>::OgIAttribute(const std::string &name, const OgDataType type,
+                              const uint8_t *data, const size_t numBytes)
+  : m_isPacked(false)
+{
+  if (type != OgawaTypeTraits<T>::typeEnum()) {
+    return;
+  }
+  m_isPacked = readAttributeData(data, numBytes, m_packedValue);
+  OgIBase::m_name = name;
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename T>
 T OgIAttribute<T>::value() const
 {
+  if (m_isPacked) {
+    return m_packedValue;
+  }
   T v;
   if (readData(m_group, 3, v)) {
     return v;
@@ -7,6 +7,8 @@
 // Includes
 //----------------------------------------------------------------------------//
 
+#include <boost/type_traits/alignment_of.hpp>
+
 #include "OgUtil.h"
 
 //----------------------------------------------------------------------------//
@@ -68,6 +70,40 @@ public:
   bool                    getData(const size_t index, T *data, 
                                   const size_t threadId) const;
 
+  //! Reads numElements of an element's data, starting at firstElement.
+  //! \return false if the range lies outside the element
+  bool                    getData(const size_t index, T *data, 
+                                  const Alembic::Util::uint64_t firstElement,
+                                  const Alembic::Util::uint64_t numElements,
+                                  const size_t threadId) const;
+
+  //! Returns a pointer to the element's data in the memory-mapped file, 
+  //! valid while the file is open.
+  //! \return NULL if the file isn't mapped or the data isn't aligned for T
+  const T*                mappedData(const size_t index, 
+                                     const size_t threadId) const;
+
+  //! Like mappedData(), but the file stays mapped for as long as the 
+  //! returned pointer, or a copy of it, is held, even after it's closed.
+  boost::shared_ptr<const T> sharedMappedData(const size_t index, 
+                                              const size_t threadId) const;
+
+  //! Asks the OS to start reading an element's data in the background, so
+  //! that a later getData() finds it in memory. Returns immediately.
+  void                    prefetch(const size_t index, 
+                                   const size_t threadId) const;
+
+  //! Prefetches several elements with as few requests to the OS as 
+  //! possible. Their extents come from the dataset's index, so nothing is
+  //! read up front.
+  void                    prefetch(const std::vector<size_t> &indices,
+                                   const size_t threadId) const;
+
+  //! Returns the offset in the file of the first byte of an element's data
+  //! \return OGAWA_INVALID_DATASET_INDEX if index provided is not a data set
+  Alembic::Util::uint64_t dataOffset(const size_t index, 
+                                     const size_t threadId) const;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -123,6 +159,29 @@ public:
   bool                    getData(const size_t index, uint8_t *data, 
                                   const size_t threadId) const;
 
+  //! Reads numBytes of an element's data, starting offset bytes in
+  bool                    getData(const size_t index, uint8_t *data, 
+                                  const Alembic::Util::uint64_t offset,
+                                  const Alembic::Util::uint64_t numBytes,
+                                  const size_t threadId) const;
+
+  //! Returns a pointer to the element's compressed data in the 
+  //! memory-mapped file, valid while the file is open.
+  //! \return NULL if the file isn't mapped
+  const uint8_t*          mappedData(const size_t index, 
+                                     const size_t threadId) const;
+
+  //! Asks the OS to start reading an element's data in the background, so
+  //! that a later getData() finds it in memory. Returns immediately.
+  void                    prefetch(const size_t index, 
+                                   const size_t threadId) const;
+
+  //! Prefetches several elements with as few requests to the OS as 
+  //! possible. Their extents come from the dataset's index, so nothing is
+  //! read up front.
+  void                    prefetch(const std::vector<size_t> &indices,
+                                   const size_t threadId) const;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -209,6 +268,151 @@ bool OgIDataset<T>::getData(const size_t index, T *data,
 
 //----------------------------------------------------------------------------//
 
+template <typename T>
+bool OgIDataset<T>::getData(const size_t index, T *data, 
+                            const Alembic::Util::uint64_t firstElement,
+                            const Alembic::Util::uint64_t numElements,
+                            const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return false;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  // Handle null pointer and out-of-range reads
+  const Alembic::Util::uint64_t offset   = firstElement * sizeof(T);
+  const Alembic::Util::uint64_t numBytes = numElements * sizeof(T);
+  if (!idata || offset + numBytes > idata->getSize()) {
+    return false;
+  }
+  // Read the data
+  idata->read(numBytes, data, offset, threadId);
+  // Done
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+const T* OgIDataset<T>::mappedData(const size_t index, 
+                                   const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return NULL;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  if (!idata) {
+    return NULL;
+  }
+  // Ogawa doesn't align its data, so the pointer may not be usable
+  const void *data = idata->getMappedData();
+  if (reinterpret_cast<size_t>(data) % boost::alignment_of<T>::value != 0) {
+    return NULL;
+  }
+  return static_cast<const T*>(data);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Deleter for OgIDataset::sharedMappedData(). Holding on to the Ogawa data
+//! keeps the file mapped.
+struct OgMappedDataRef
+{
+  OgMappedDataRef(Alembic::Ogawa::IDataPtr i_data)
+    : data(i_data)
+  { }
+  void operator()(const void *) const
+  { }
+  Alembic::Ogawa::IDataPtr data;
+};
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+boost::shared_ptr<const T> 
+OgIDataset<T>::sharedMappedData(const size_t index, 
+                                const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return boost::shared_ptr<const T>();
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  if (!idata) {
+    return boost::shared_ptr<const T>();
+  }
+  // Ogawa doesn't align its data, so the pointer may not be usable
+  const void *data = idata->getMappedData();
+  if (!data || 
+      reinterpret_cast<size_t>(data) % boost::alignment_of<T>::value != 0) {
+    return boost::shared_ptr<const T>();
+  }
+  return boost::shared_ptr<const T>(static_cast<const T*>(data), 
+                                    OgMappedDataRef(idata));
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void OgIDataset<T>::prefetch(const size_t index, const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  if (idata) {
+    idata->willNeed();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void OgIDataset<T>::prefetch(const std::vector<size_t> &indices, 
+                             const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  std::vector<Alembic::Util::uint64_t> internalIndices(indices.size());
+  for (size_t i = 0, end = indices.size(); i < end; ++i) {
+    internalIndices[i] = indices[i] + OGAWA_DATASET_BASEOFFSET;
+  }
+  m_group->willNeedData(internalIndices, threadId);
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+Alembic::Util::uint64_t 
+OgIDataset<T>::dataOffset(const size_t index, const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return OGAWA_INVALID_DATASET_INDEX;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  // +8 accounts for the size stored ahead of the data
+  return idata->getPos() + 8;
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename T>
 OgICDataset<T>::OgICDataset()
 {
@@ -287,6 +491,84 @@ bool OgICDataset<T>::getData(const size_t index, uint8_t *data,
   return true;
 }
 
+//----------------------------------------------------------------------------//
+
+template <typename T>
+bool OgICDataset<T>::getData(const size_t index, uint8_t *data, 
+                             const Alembic::Util::uint64_t offset,
+                             const Alembic::Util::uint64_t numBytes,
+                             const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return false;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  // Handle null pointer and out-of-range reads
+  if (!idata || offset + numBytes > idata->getSize()) {
+    return false;
+  }
+  // Read the data
+  idata->read(numBytes, data, offset, threadId);
+  // Done
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+const uint8_t* OgICDataset<T>::mappedData(const size_t index, 
+                                          const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return NULL;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  if (!idata) {
+    return NULL;
+  }
+  return static_cast<const uint8_t*>(idata->getMappedData());
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void OgICDataset<T>::prefetch(const size_t index, const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  const size_t internalIndex = index + OGAWA_DATASET_BASEOFFSET;
+  // Check that we have a data set
+  if (!m_group->isChildData(internalIndex)) {
+    return;
+  }
+  // Grab the data set
+  Alembic::Ogawa::IDataPtr idata = m_group->getData(internalIndex, threadId);
+  if (idata) {
+    idata->willNeed();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void OgICDataset<T>::prefetch(const std::vector<size_t> &indices, 
+                              const size_t threadId) const
+{
+  // Indices start at OGAWA_DATASET_BASEOFFSET
+  std::vector<Alembic::Util::uint64_t> internalIndices(indices.size());
+  for (size_t i = 0, end = indices.size(); i < end; ++i) {
+    internalIndices[i] = indices[i] + OGAWA_DATASET_BASEOFFSET;
+  }
+  m_group->willNeedData(internalIndices, threadId);
+}
+
 //----------------------------------------------------------------------------//
   
 FIELD3D_NAMESPACE_HEADER_CLOSE
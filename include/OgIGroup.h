@@ -61,6 +61,11 @@ public:
   //! in which case the nested group will be searched for.
   OgIGroup                 findGroup(const std::string &path) const;
 
+  //! Returns the F3D group at the given ogawa-level child index, as reported
+  //! by OgOGroup::numChildren() when it was written. The returned OgIGroup
+  //! will not be valid if that child isn't an F3D group.
+  OgIGroup                 childGroup(const size_t index) const;
+
   //! Finds an F3D group. The returned OgIAttribute will not be valid if the 
   //! name wasn't found.
   template <typename T>
@@ -71,6 +76,13 @@ public:
   template <typename T>
   OgIDataset<T>            findDataset(const std::string &name) const;
 
+  //! Finds an F3D dataset, searching from the last child backwards. This is
+  //! cheap for datasets that were added just before the file was closed.
+  //! \param maxChildren Number of children to check, 0 means all of them
+  template <typename T>
+  OgIDataset<T>            findLastDataset(const std::string &name,
+                                           const size_t maxChildren = 0) const;
+
   //! Finds a compressed F3D dataset. The returned OgIGroup will not be valid 
   //! if the name wasn't found.
   template <typename T>
@@ -85,6 +97,15 @@ public:
   //! Returns the data type of a compressed dataset
   OgDataType               compressedDatasetType(const std::string &name) const;
 
+  //! Returns the underlying Ogawa group, for copying it verbatim
+  Alembic::Ogawa::IGroupPtr ogawaGroup() const
+  { return m_group; }
+
+  //! Returns the group's packed attributes, or null if its attributes are 
+  //! stored one per subgroup
+  const OgPackedAttributes* packedAttributes() const
+  { return m_packed.get(); }
+
 private:
   
   // Private ctors -------------------------------------------------------------
@@ -101,6 +122,12 @@ private:
   Alembic::Ogawa::IGroupPtr findGroup(const std::string &name,
                                       const OgGroupType groupType) const;
 
+  //! Finds an ogawa-level group, searching from the last child backwards
+  //! through at most maxChildren children, or all of them if it's 0
+  Alembic::Ogawa::IGroupPtr findLastGroup(const std::string &name,
+                                          const OgGroupType groupType,
+                                          const size_t maxChildren) const;
+
   //! Recursively finds an ogawa-level group
   Alembic::Ogawa::IGroupPtr recursiveFindGroup
   (const std::string &name, const OgGroupType groupType) const;
@@ -111,6 +138,11 @@ private:
   //! Validates the current group
   void                      validate();
 
+  // Data members --------------------------------------------------------------
+
+  //! Packed attributes, read when the group is opened
+  OgPackedAttributes::CPtr  m_packed;
+
 };
 
 //----------------------------------------------------------------------------//
@@ -120,6 +152,15 @@ private:
 template <typename T>
 OgIAttribute<T> OgIGroup::findAttribute(const std::string &name) const
 {
+  if (m_packed) {
+    const OgPackedAttributes::Entry *entry = m_packed->find(name);
+    if (entry) {
+      return OgIAttribute<T>(name, entry->type, m_packed->data(*entry), 
+                             entry->numBytes);
+    }
+    return OgIAttribute<T>();
+  }
+
   Alembic::Ogawa::IGroupPtr group = findGroup(name, F3DAttributeType);
 
   if (group) {
@@ -145,6 +186,22 @@ OgIDataset<T> OgIGroup::findDataset(const std::string &name) const
 
 //----------------------------------------------------------------------------//
 
+template <typename T>
+OgIDataset<T> OgIGroup::findLastDataset(const std::string &name,
+                                        const size_t maxChildren) const
+{
+  Alembic::Ogawa::IGroupPtr group = 
+    findLastGroup(name, F3DDatasetType, maxChildren);
+
+  if (group) {
+    return OgIDataset<T>(group);
+  }
+
+  return OgIDataset<T>();
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename T>
 OgICDataset<T> OgIGroup::findCompressedDataset(const std::string &name) const
 {
@@ -46,11 +46,25 @@ public:
   //! Adds a data element to the data set. Each element may be of different
   //! length
   void addData(const size_t length, const T *data);
+  //! Adds a data element of the given length whose contents are then 
+  //! written in pieces by streamData(), so that the element never has to be
+  //! in memory all at once. Nothing else may be written to the file until
+  //! the whole element has been streamed.
+  void beginStreamedData(const size_t length);
+  //! Writes the next piece of the element started by beginStreamedData()
+  void streamData(const size_t length, const T *data);
+  //! Adds a data element whose first byte lands on a multiple of alignment
+  //! bytes in the file. The gap is filled with unreferenced Ogawa records,
+  //! which readers never see.
+  void addAlignedData(const size_t length, const T *data, 
+                      const size_t alignment);
 
 private:
 
   //! Pointer to the enclosing group
   Alembic::Ogawa::OGroupPtr m_group;
+  //! Number of elements of the streamed data element still to be written
+  size_t m_streamRemaining;
 
 };
 
@@ -102,6 +116,7 @@ private:
 
 template <typename T>
 OgODataset<T>::OgODataset(OgOGroup &parent, const std::string &name)
+  : m_streamRemaining(0)
 {
   // Create a group to store the basic data
   m_group = parent.addSubGroup();
@@ -124,6 +139,57 @@ void OgODataset<T>::addData(const size_t length, const T *data)
 
 //----------------------------------------------------------------------------//
 
+template <typename T>
+void OgODataset<T>::beginStreamedData(const size_t length)
+{
+  if (m_streamRemaining != 0) {
+    throw Field3D::Exc::OgODatasetException(
+      "Previous streamed data element is incomplete.");
+  }
+  m_group->addStreamedData(length * sizeof(T));
+  m_streamRemaining = length;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void OgODataset<T>::streamData(const size_t length, const T *data)
+{
+  if (length > m_streamRemaining) {
+    throw Field3D::Exc::OgODatasetException(
+      "Streamed data exceeds the length of the data element.");
+  }
+  m_group->streamData(length * sizeof(T), data);
+  m_streamRemaining -= length;
+}
+
+//----------------------------------------------------------------------------//
+
+template <typename T>
+void OgODataset<T>::addAlignedData(const size_t length, const T *data,
+                                   const size_t alignment)
+{
+  using Alembic::Util::uint64_t;
+  // Each Ogawa record is an 8 byte size followed by the payload. Writing a
+  // small unreferenced record tells us where the end of the stream is.
+  const uint8_t probe = 0;
+  Alembic::Ogawa::ODataPtr probeData = m_group->createData(1, &probe);
+  const uint64_t end = probeData->getPos() + 8 + 1;
+  // Without padding, the payload would start at end + 8
+  if ((end + 8) % alignment != 0) {
+    // With a padding record of n bytes, the payload starts at end + 16 + n
+    size_t padding = (alignment - (end + 16) % alignment) % alignment;
+    if (padding == 0) {
+      padding = alignment;
+    }
+    std::vector<uint8_t> pad(padding, 0);
+    m_group->createData(padding, &pad[0]);
+  }
+  m_group->addData(length * sizeof(T), data);
+}
+
+//----------------------------------------------------------------------------//
+
 template <typename T>
 OgOCDataset<T>::OgOCDataset(OgOGroup &parent, const std::string &name)
 {
@@ -9,6 +9,7 @@
 
 #include "OgUtil.h"
 #include "Exception.h"
+#include "Log.h"
 
 //----------------------------------------------------------------------------//
 
@@ -36,7 +37,7 @@ public:
 
   //! Constructs the root group in an Ogawa archive
   OgOGroup(Alembic::Ogawa::OArchive &archive)
-    : m_name("f3droot") 
+    : m_name("f3droot"), m_packAttributes(false)
   {
     // Reference the root group
     m_group = archive.getGroup();
@@ -46,7 +47,7 @@ public:
 
   //! Constructs a group as a child to an existing group.
   OgOGroup(OgOGroup &parent, const std::string &name)
-    : m_name(name)
+    : m_name(name), m_packAttributes(parent.m_packAttributes)
   {
     // Make sure there is no '/' in the name
     if (name.find("/") != std::string::npos) {
@@ -58,14 +59,101 @@ public:
     addBaseData();
   }
 
+  //! Writes the packed attributes, unless writePackedAttributes() already 
+  //! did.
+  ~OgOGroup()
+  {
+    writePackedAttributes();
+  }
+
   // Main methods --------------------------------------------------------------
 
+  //! Writes the packed attributes, if any, as the last child of the group.
+  //! Call it once the group is complete to find out whether that worked, 
+  //! the destructor can't say.
+  //! \returns False if the attributes couldn't be written
+  bool writePackedAttributes()
+  {
+    if (m_packed.empty()) {
+      return true;
+    }
+    std::string error;
+    try {
+      if (!m_group->addData(m_packed.size(), &m_packed[0])) {
+        error = "Couldn't write packed attributes for " + m_name;
+      }
+    }
+    catch (std::exception &e) {
+      error = "Couldn't write packed attributes for " + m_name + ": " + 
+        e.what();
+    }
+    // Written, or not, only once
+    std::vector<uint8_t>().swap(m_packed);
+    if (!error.empty()) {
+      Msg::print(Msg::SevWarning, error);
+      return false;
+    }
+    return true;
+  }
+
+  //! Sets whether attributes are packed into a single record instead of 
+  //! written as one subgroup each. Subgroups created afterwards inherit the
+  //! setting. 
+  //! \note Must be set before the first attribute is added.
+  void setPackAttributes(const bool enabled)
+  { m_packAttributes = enabled; }
+
+  //! Returns whether attributes are packed
+  bool packAttributes() const
+  { return m_packAttributes; }
+
+  //! Adds an attribute from its data type and bytes. Called from 
+  //! OgOAttribute.
+  void addAttribute(const std::string &name, const OgDataType type, 
+                    const void *data, const size_t numBytes)
+  {
+    using Field3D::Exc::OgOAttributeException;
+
+    if (m_packAttributes) {
+      OgPackedAttributes::append(m_packed, name, type, data, numBytes);
+      return;
+    }
+
+    // Create a group to store the attribute data
+    Alembic::Ogawa::OGroupPtr group = addSubGroup();
+    // Index 0 is the name
+    if (!writeString(group, name)) {
+      throw OgOAttributeException("Couldn't write attribute name for " + name);
+    }
+    // Index 1 is the type
+    if (!writeData(group, F3DAttributeType)) {
+      throw OgOAttributeException("Couldn't write attribute group type for " + 
+                                  name);
+    }
+    // Index 2 is the data type
+    if (!group->addData(sizeof(OgDataType), &type)) {
+      throw OgOAttributeException("Couldn't write attribute data type for " + 
+                                  name);
+    }
+    // Index 3 is the data
+    if (!group->addData(numBytes, data)) {
+      throw OgOAttributeException("Couldn't write attribute data for " + name);
+    }
+  }
+
   //! Adds an ogawa-level subgroup. Called from OgOAttribute and OgODataset.
   Alembic::Ogawa::OGroupPtr addSubGroup() 
   {
     return m_group->addGroup();
   }
 
+  //! Returns the number of ogawa-level children. The next group, attribute
+  //! or dataset added to this group gets this as its child index.
+  size_t numChildren() const
+  {
+    return m_group->getNumChildren();
+  }
+
 private:
 
   // Utility methods -----------------------------------------------------------
@@ -88,6 +176,10 @@ private:
   Alembic::Ogawa::OGroupPtr m_group;
   //! Name of the curren
   std::string               m_name;
+  //! Whether attributes are packed. See setPackAttributes().
+  bool                      m_packAttributes;
+  //! Packed attributes, written when the group is closed.
+  std::vector<uint8_t>      m_packed;
 };
 
 //----------------------------------------------------------------------------//
@@ -47,13 +47,23 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
+#include <vector>
+
 #include <hdf5.h>
 #include <string.h> // for memcpy
 
 #include <zlib.h>
 
+#include "BlockChecksum.h"
+#include "BlockCodec.h"
+#include "HalfConvert.h"
+#include "InitIO.h"
+#include "Log.h"
 #include "OgIO.h"
 #include "Hdf5Util.h"
+#include "Stats.h"
+#include "Types.h"
 
 //----------------------------------------------------------------------------//
 
@@ -61,6 +71,317 @@
 
 FIELD3D_NAMESPACE_OPEN
 
+//----------------------------------------------------------------------------//
+// SparseTiles
+//----------------------------------------------------------------------------//
+
+//! Tiled blocks are stored as independently compressed runs of 
+//! 2^(3 * tileOrder) voxels, so that a lookup can inflate just the run it
+//! needs. Tiles follow the block's voxels in storage order, which makes
+//! each tile a cube of 2^tileOrder voxels per side in BlockLayoutMorton,
+//! and a slab of whole rows in BlockLayoutLinear. Each block's data 
+//! element starts with numTiles + 1 uint32 offsets into the compressed 
+//! tiles that follow it.
+//! \ingroup file_int
+namespace SparseTiles {
+
+  //! Most tiles a block is split into, so that the tiles of a block that 
+  //! are in memory can be tracked in a single 64 bit mask
+  const size_t k_maxTiles = 64;
+
+  //! Returns the tile order to split blocks of the given order into, or 0
+  //! if they're too small to be tiled. Tiles hold at least 4^3 voxels.
+  inline int tileOrder(const int blockOrder)
+  {
+    const int order = std::max(2, blockOrder - 2);
+    return order < blockOrder ? order : 0;
+  }
+
+  //! Returns the number of tiles in a block
+  inline size_t numTiles(const int blockOrder, const int tileOrder)
+  {
+    return static_cast<size_t>(1) << (3 * (blockOrder - tileOrder));
+  }
+
+  //! Returns the size of the offset table that starts each block
+  inline size_t tableBytes(const int blockOrder, const int tileOrder)
+  {
+    return (numTiles(blockOrder, tileOrder) + 1) * sizeof(uint32_t);
+  }
+
+  //! Returns the tile that holds the voxel at the given offset in its 
+  //! block
+  inline size_t tileIndex(const size_t voxelIdx, const int tileOrder)
+  {
+    return voxelIdx >> (3 * tileOrder);
+  }
+
+  //! Returns the mask with a bit set for each tile of a block
+  inline uint64_t allTiles(const int blockOrder, const int tileOrder)
+  {
+    const size_t n = numTiles(blockOrder, tileOrder);
+    return n >= k_maxTiles ? 
+      ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << n) - 1;
+  }
+
+} // namespace SparseTiles
+
+//----------------------------------------------------------------------------//
+// SparseQuantize
+//----------------------------------------------------------------------------//
+
+//! Quantized blocks store each component in 8 or 12 bits, relative to the
+//! block's own range of values. Each block's data element starts with one
+//! uncompressed Format byte, followed by the compressed payload. Quantized
+//! payloads hold the float32 offset and scale of each component, then the 
+//! codes of each component in turn. 12-bit codes are packed in pairs into 
+//! three bytes.
+//! \ingroup file_int
+namespace SparseQuantize {
+
+  //! How the payload of a block is stored
+  enum Format {
+    //! The block's voxels, as is. Used for blocks with non-finite values
+    FormatRaw = 0,
+    //! Offsets and scales, followed by the codes
+    FormatQuantized
+  };
+
+  //! Number of components of a voxel, and their type
+  template <typename Data_T>
+  struct Components
+  {
+    typedef Data_T type;
+    static int size() { return 1; }
+  };
+
+  template <typename T>
+  struct Components<FIELD3D_VEC3_T<T> >
+  {
+    typedef T type;
+    static int size() { return 3; }
+  };
+
+  //! Returns the number of bytes taken by numCodes codes
+  inline size_t codeBytes(const size_t numCodes, const int bits)
+  {
+    return bits == 8 ? numCodes : (numCodes + 1) / 2 * 3;
+  }
+
+  //! Returns the size of the quantized payload of a block
+  template <typename Data_T>
+  size_t payloadBytes(const size_t numVoxels, const int bits)
+  {
+    const size_t comps = Components<Data_T>::size();
+    return comps * (2 * sizeof(float) + codeBytes(numVoxels, bits));
+  }
+
+  //! Whether the value is neither infinite nor NaN
+  inline bool isFinite(const float x)
+  {
+    return x - x == 0.0f;
+  }
+
+  //! Number of voxels of a component converted to or from float at a time
+  const size_t k_chunkSize = 256;
+
+  //! Reads n values of a component, stride components apart, as floats
+  template <typename Comp_T>
+  void loadComponent(const Comp_T *src, const size_t n, const int stride,
+                     float *dst)
+  {
+    for (size_t v = 0; v < n; ++v) {
+      dst[v] = static_cast<float>(src[v * stride]);
+    }
+  }
+
+  //! Half components are converted in bulk
+  inline void loadComponent(const half *src, const size_t n, const int stride,
+                            float *dst)
+  {
+    if (stride == 1) {
+      HalfConvert::toFloat(src, n, dst);
+      return;
+    }
+    half gathered[k_chunkSize];
+    for (size_t v = 0; v < n; ++v) {
+      gathered[v] = src[v * stride];
+    }
+    HalfConvert::toFloat(gathered, n, dst);
+  }
+
+  //! Writes n float values of a component, stride components apart
+  template <typename Comp_T>
+  void storeComponent(const float *src, const size_t n, const int stride,
+                      Comp_T *dst)
+  {
+    for (size_t v = 0; v < n; ++v) {
+      dst[v * stride] = static_cast<Comp_T>(src[v]);
+    }
+  }
+
+  //! Half components are converted in bulk
+  inline void storeComponent(const float *src, const size_t n, 
+                             const int stride, half *dst)
+  {
+    if (stride == 1) {
+      HalfConvert::toHalf(src, n, dst);
+      return;
+    }
+    half converted[k_chunkSize];
+    HalfConvert::toHalf(src, n, converted);
+    for (size_t v = 0; v < n; ++v) {
+      dst[v * stride] = converted[v];
+    }
+  }
+
+  //! Quantizes the voxels of a block into dst, which must hold 
+  //! payloadBytes() bytes.
+  //! \returns False, leaving dst undefined, if the block holds values that
+  //! can't be quantized
+  template <typename Data_T>
+  bool quantize(const Data_T *block, const size_t numVoxels, const int bits,
+                uint8_t *dst)
+  {
+    typedef typename Components<Data_T>::type Comp_T;
+
+    const int     comps   = Components<Data_T>::size();
+    const Comp_T *values  = reinterpret_cast<const Comp_T *>(block);
+    const float   maxCode = static_cast<float>((1 << bits) - 1);
+    uint8_t      *codes   = dst + comps * 2 * sizeof(float);
+    float         x[k_chunkSize];
+
+    for (int c = 0; c < comps; ++c, codes += codeBytes(numVoxels, bits)) {
+      // Range of the component
+      float lo = static_cast<float>(values[c]), hi = lo;
+      for (size_t first = 0; first < numVoxels; first += k_chunkSize) {
+        const size_t m = std::min(k_chunkSize, numVoxels - first);
+        loadComponent(values + first * comps + c, m, comps, x);
+        for (size_t v = 0; v < m; ++v) {
+          if (!isFinite(x[v])) {
+            return false;
+          }
+          lo = std::min(lo, x[v]);
+          hi = std::max(hi, x[v]);
+        }
+      }
+      const float scale    = (hi - lo) / maxCode;
+      const float invScale = scale > 0.0f ? 1.0f / scale : 0.0f;
+      if (!isFinite(scale) || !isFinite(invScale)) {
+        return false;
+      }
+      memcpy(dst + c * 2 * sizeof(float), &lo, sizeof(float));
+      memcpy(dst + (c * 2 + 1) * sizeof(float), &scale, sizeof(float));
+      // Codes
+      for (size_t first = 0; first < numVoxels; first += k_chunkSize) {
+        const size_t m = std::min(k_chunkSize, numVoxels - first);
+        loadComponent(values + first * comps + c, m, comps, x);
+        for (size_t i = 0; i < m; ++i) {
+          const size_t   v    = first + i;
+          const uint32_t code = static_cast<uint32_t>
+            (std::min((x[i] - lo) * invScale + 0.5f, maxCode));
+          if (bits == 8) {
+            codes[v] = static_cast<uint8_t>(code);
+          } else if (v % 2 == 0) {
+            uint8_t *pair = codes + v / 2 * 3;
+            pair[0] = static_cast<uint8_t>(code & 0xff);
+            pair[1] = static_cast<uint8_t>(code >> 8);
+            pair[2] = 0;
+          } else {
+            uint8_t *pair = codes + v / 2 * 3;
+            pair[1] |= static_cast<uint8_t>((code & 0xf) << 4);
+            pair[2]  = static_cast<uint8_t>(code >> 4);
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+  //! Expands a quantized payload into the voxels of a block. Codes are
+  //! decoded to floats a chunk at a time, in loops over contiguous codes 
+  //! that the compiler can vectorize, and then stored, which converts half
+  //! data in bulk.
+  template <typename Data_T>
+  void dequantize(const uint8_t *src, const size_t numVoxels, const int bits,
+                  Data_T *block)
+  {
+    typedef typename Components<Data_T>::type Comp_T;
+
+    const int      comps  = Components<Data_T>::size();
+    Comp_T        *values = reinterpret_cast<Comp_T *>(block);
+    const uint8_t *codes  = src + comps * 2 * sizeof(float);
+    float          decoded[k_chunkSize];
+
+    for (int c = 0; c < comps; ++c, codes += codeBytes(numVoxels, bits)) {
+      float offset, scale;
+      memcpy(&offset, src + c * 2 * sizeof(float), sizeof(float));
+      memcpy(&scale, src + (c * 2 + 1) * sizeof(float), sizeof(float));
+      // Chunks hold an even number of codes, so 12-bit pairs never 
+      // straddle them
+      for (size_t first = 0; first < numVoxels; first += k_chunkSize) {
+        const size_t m = std::min(k_chunkSize, numVoxels - first);
+        if (bits == 8) {
+          for (size_t v = 0; v < m; ++v) {
+            decoded[v] = offset + scale * codes[first + v];
+          }
+        } else {
+          const uint8_t *pairs = codes + first / 2 * 3;
+          const size_t   numPairs = m / 2;
+          for (size_t p = 0; p < numPairs; ++p) {
+            const uint8_t *pair = pairs + p * 3;
+            const uint32_t a = pair[0] | ((pair[1] & 0xf) << 8);
+            const uint32_t b = (pair[1] >> 4) | (pair[2] << 4);
+            decoded[2 * p]     = offset + scale * a;
+            decoded[2 * p + 1] = offset + scale * b;
+          }
+          if (m % 2 != 0) {
+            const uint8_t *pair = pairs + numPairs * 3;
+            const uint32_t a = pair[0] | ((pair[1] & 0xf) << 8);
+            decoded[2 * numPairs] = offset + scale * a;
+          }
+        }
+        storeComponent(decoded, m, comps, values + first * comps + c);
+      }
+    }
+  }
+
+} // namespace SparseQuantize
+
+//----------------------------------------------------------------------------//
+// SparseReadScratch
+//----------------------------------------------------------------------------//
+
+//! Scratch buffers of the OgSparseDataReaders running on one thread. 
+//! Readers are created for each layer that is read, so keeping the buffers 
+//! per thread saves allocating them over again. Buffers only ever grow.
+//! \ingroup file_int
+struct SparseReadScratch
+{
+  //! Compressed data read from the file
+  std::vector<uint8_t>  compressed;
+  //! Offset table of a tiled block
+  std::vector<uint32_t> tileOffsets;
+  //! Scratch space for the codec
+  std::vector<uint8_t>  codec;
+  //! Decompressed payload of a quantized block
+  std::vector<uint8_t>  payload;
+
+  //! Returns the buffers of the calling thread
+  static SparseReadScratch& forThread();
+
+  //! Grows a buffer to hold at least size entries, and returns its data
+  template <typename T>
+  static T* grow(std::vector<T> &buffer, const size_t size)
+  {
+    if (buffer.size() < size) {
+      buffer.resize(size);
+    }
+    return buffer.empty() ? NULL : &buffer[0];
+  }
+};
+
 //----------------------------------------------------------------------------//
 // OgSparseDataReader
 //----------------------------------------------------------------------------//
@@ -89,11 +410,50 @@ public:
   void setThreadId(const size_t id);
 
   //! Reads a block, storing the data in result, which is assumed to contain
-  //! enough room for m_valuesPerBlock entries.
-  void readBlock(const size_t idx, Data_T *result);
+  //! enough room for m_valuesPerBlock entries. If verifyChecksums() is on
+  //! and the blocks have checksums, the block's bytes are checked before
+  //! they are decompressed.
+  //! \returns False if the block couldn't be decompressed or doesn't match
+  //! its checksum. The contents of result are then undefined.
+  bool readBlock(const size_t idx, Data_T *result);
+
+  //! Hands the extents of all the given blocks to the OS at once, so they
+  //! are read in the background, at whatever queue depth the storage 
+  //! allows, while the caller works through them with readBlock().
+  void prefetchBlocks(const std::vector<size_t> &indices);
+
+  //! Returns the offset in the file of a block's data. Only valid for 
+  //! uncompressed data, where the bytes on disk are the block's voxels.
+  uint64_t blockOffset(const size_t idx);
+
+  //! Reads only the voxels of the tiles whose bits are set in tiles into 
+  //! their place in result, leaving the rest untouched. If the blocks 
+  //! aren't tiled, the entire block is read.
+  //! \returns False if a tile couldn't be decompressed, or if the block
+  //! doesn't match its checksum. The voxels of the tiles are then 
+  //! undefined.
+  //! \sa SparseTiles::tileIndex()
+  bool readTiles(const size_t idx, const uint64_t tiles, Data_T *result);
+
+  //! Returns the tile order of the blocks, or 0 if they aren't tiled
+  int tileOrder() const
+  { return m_tileOrder; }
 
 private:
 
+  // Utility methods -----------------------------------------------------------
+
+  //! Checks the offset table of a tiled block against the block's length
+  bool checkTileOffsets(const uint32_t *offsets, const uint64_t length,
+                        const size_t idx) const;
+  //! Checks a block's bytes against its checksum, if it has one
+  bool checkBlock(const uint8_t *data, const uint64_t length, 
+                  const size_t idx) const;
+  //! Inflates one compressed tile into its place in result
+  bool inflateTile(const uint8_t *src, const size_t length,
+                   const size_t tileIdx, Data_T *result,
+                   SparseReadScratch &scratch);
+
   // Data members --------------------------------------------------------------
 
   //! Og Dataset
@@ -111,8 +471,25 @@ private:
   //! the API concurrently.
   size_t m_threadId;
 
-  //! Cache for decompression
-  std::vector<uint8_t> m_compressionCache;
+  //! Block order, derived from the number of voxels
+  int m_blockOrder;
+  //! Tile order of the compressed blocks. 0 if untiled
+  int m_tileOrder;
+  //! Codec of the compressed blocks
+  SparseCodec m_codec;
+  //! Bits per component of quantized blocks. 0 if not quantized
+  int m_quantizeBits;
+
+  //! Bytes needed to read a compressed block
+  size_t m_compressedBytes;
+  //! Number of voxels in a tile. 0 if untiled
+  size_t m_tileVoxels;
+  //! Bytes in the decompressed payload of a quantized block. 0 if not
+  //! quantized
+  size_t m_payloadBytes;
+  //! Checksums of the compressed blocks, if they're verified. Empty 
+  //! otherwise
+  std::vector<uint32_t> m_checksums;
 };
 
 //----------------------------------------------------------------------------//
@@ -127,10 +504,21 @@ OgSparseDataReader<Data_T>::OgSparseDataReader(const OgIGroup &location,
   : m_numVoxels(numVoxels), 
     k_dataStr("data"),
     m_isCompressed(isCompressed),
-    m_threadId(0)
+    m_threadId(0),
+    m_blockOrder(0),
+    m_tileOrder(0),
+    m_codec(SparseCodecZlib),
+    m_quantizeBits(0),
+    m_compressedBytes(0),
+    m_tileVoxels(0),
+    m_payloadBytes(0)
 {
   using namespace Exc;
 
+  while ((static_cast<size_t>(1) << (3 * (m_blockOrder + 1))) <= numVoxels) {
+    m_blockOrder++;
+  }
+
   if (isCompressed) {
     // Find the dataset
     m_cDataset = location.findCompressedDataset<Data_T>(k_dataStr);
@@ -148,8 +536,66 @@ OgSparseDataReader<Data_T>::OgSparseDataReader(const OgIGroup &location,
     if (typeOnDisk != OgawaTypeTraits<Data_T>::typeEnum()) {
       throw ReadDataException("Data type mismatch in SparseDataReader");
     }
-    // Set the compresession cache size
-    m_compressionCache.resize(compressBound(numVoxels * sizeof(Data_T)));
+    // Files without a codec attribute predate it and use zlib
+    OgIAttribute<uint8_t> codecAttr = 
+      location.findAttribute<uint8_t>("data_codec");
+    if (codecAttr.isValid()) {
+      if (!BlockCodec::isValid(codecAttr.value())) {
+        throw ReadDataException("Unknown codec in SparseDataReader");
+      }
+      m_codec = static_cast<SparseCodec>(codecAttr.value());
+    }
+    // Size of the compression cache
+    m_compressedBytes = BlockCodec::compressBound(m_codec, numVoxels * 
+                                                  sizeof(Data_T));
+    // Check for tiled blocks
+    OgIAttribute<uint8_t> tileOrderAttr =
+      location.findAttribute<uint8_t>("data_tile_order");
+    if (tileOrderAttr.isValid() && tileOrderAttr.value() > 0) {
+      m_tileOrder = tileOrderAttr.value();
+      if (m_tileOrder >= m_blockOrder || 
+          SparseTiles::numTiles(m_blockOrder, m_tileOrder) > 
+          SparseTiles::k_maxTiles) {
+        throw ReadDataException("Unsupported tile order in "
+                                "SparseDataReader");
+      }
+      m_tileVoxels = static_cast<size_t>(1) << (3 * m_tileOrder);
+      m_compressedBytes = SparseTiles::tableBytes(m_blockOrder, m_tileOrder) +
+        SparseTiles::numTiles(m_blockOrder, m_tileOrder) * 
+        BlockCodec::compressBound(m_codec, m_tileVoxels * sizeof(Data_T));
+    }
+    // Check for quantized blocks. They're never tiled
+    OgIAttribute<uint8_t> quantizeBitsAttr =
+      location.findAttribute<uint8_t>("data_quantize_bits");
+    if (quantizeBitsAttr.isValid() && quantizeBitsAttr.value() > 0) {
+      m_quantizeBits = quantizeBitsAttr.value();
+      if ((m_quantizeBits != 8 && m_quantizeBits != 12) || m_tileOrder > 0) {
+        throw ReadDataException("Unsupported quantization in "
+                                "SparseDataReader");
+      }
+      m_payloadBytes = SparseQuantize::payloadBytes<Data_T>
+        (numVoxels, m_quantizeBits);
+      // Room for the format byte that precedes the payload
+      m_compressedBytes = 1 + 
+        BlockCodec::compressBound(m_codec, std::max(m_payloadBytes, 
+                                                    numVoxels * 
+                                                    sizeof(Data_T)));
+    }
+    // Checksums are only read if they're going to be verified
+    if (verifyChecksums()) {
+      OgIDataset<uint32_t> checksumData = location.findDataset<uint32_t>
+        (BlockChecksum::datasetName(k_dataStr));
+      if (checksumData.isValid()) {
+        if (checksumData.dataSize(0, m_threadId) != occupiedBlocks) {
+          throw ReadDataException("Checksum count mismatch in "
+                                  "SparseDataReader");
+        }
+        m_checksums.resize(occupiedBlocks);
+        if (occupiedBlocks > 0) {
+          checksumData.getData(0, &m_checksums[0], m_threadId);
+        }
+      }
+    }
   } else {
     // Find the dataset
     m_dataset = location.findDataset<Data_T>(k_dataStr);
@@ -181,34 +627,259 @@ void OgSparseDataReader<Data_T>::setThreadId(const size_t id)
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-void OgSparseDataReader<Data_T>::readBlock(const size_t idx, Data_T *result)
+bool OgSparseDataReader<Data_T>::readBlock(const size_t idx, Data_T *result)
 {
   using namespace Exc;
 
-  if (m_isCompressed) {
+  if (m_isCompressed && m_tileOrder > 0) {
 
+    SparseReadScratch &scratch = SparseReadScratch::forThread();
+    // Read the offset table and all tiles in one go
+    const uint64_t length = m_cDataset.dataSize(idx, m_threadId);
+    const uint8_t *block = m_cDataset.mappedData(idx, m_threadId);
+    Stats::add(Stats::BytesRead, length);
+    // The offset table is only usable in place if it's aligned
+    if (!block || reinterpret_cast<size_t>(block) % sizeof(uint32_t) != 0) {
+      uint8_t *cache = SparseReadScratch::grow(scratch.compressed, length);
+      m_cDataset.getData(idx, cache, m_threadId);
+      block = cache;
+    }
+    const uint32_t *offsets = reinterpret_cast<const uint32_t *>(block);
+    if (!checkBlock(block, length, idx) || 
+        !checkTileOffsets(offsets, length, idx)) {
+      return false;
+    }
+    const uint8_t *tiles = block +
+      SparseTiles::tableBytes(m_blockOrder, m_tileOrder);
+    const size_t numTiles = SparseTiles::numTiles(m_blockOrder, m_tileOrder);
+    for (size_t t = 0; t < numTiles; ++t) {
+      if (!inflateTile(tiles + offsets[t], offsets[t + 1] - offsets[t],
+                       t, result, scratch)) {
+        return false;
+      }
+    }
+
+  } else if (m_isCompressed) {
+
+    SparseReadScratch &scratch = SparseReadScratch::forThread();
     // Length of compressed data
     const uint64_t length = m_cDataset.dataSize(idx, m_threadId);
-    // Read data into compression cache
-    m_cDataset.getData(idx, &m_compressionCache[0], m_threadId);
-    // Target location
-    uint8_t *ucmpData = reinterpret_cast<uint8_t *>(result);
-    // Length of uncompressed data is stored here
-    uLong ucmpLen = m_numVoxels * sizeof(Data_T);
+    // Decompress straight out of a mapped file, otherwise read the data 
+    // into the compression cache
+    const uint8_t *cmpData = m_cDataset.mappedData(idx, m_threadId);
+    Stats::add(Stats::BytesRead, length);
+    if (!cmpData) {
+      uint8_t *cache = 
+        SparseReadScratch::grow(scratch.compressed, m_compressedBytes);
+      m_cDataset.getData(idx, cache, m_threadId);
+      cmpData = cache;
+    }
+    if (!checkBlock(cmpData, length, idx)) {
+      return false;
+    }
+    // Quantized blocks start with the format of their payload
+    bool isQuantized = false;
+    size_t cmpLen = length;
+    if (m_quantizeBits > 0 && length > 0) {
+      isQuantized = cmpData[0] == SparseQuantize::FormatQuantized;
+      cmpData++;
+      cmpLen--;
+    }
+    // Target location. Unquantized blocks are decompressed straight into
+    // their storage
+    uint8_t *ucmpData = isQuantized ? 
+      SparseReadScratch::grow(scratch.payload, m_payloadBytes) : 
+      reinterpret_cast<uint8_t *>(result);
+    // Length of uncompressed data
+    const size_t ucmpLen = isQuantized ? 
+      m_payloadBytes : m_numVoxels * sizeof(Data_T);
     // Uncompress
-    int status = uncompress(ucmpData, &ucmpLen, &m_compressionCache[0], 
-                            length);
-    if (status != Z_OK) {
-      std::cout << "ERROR in uncompress: " << status
-                << " " << ucmpLen << " " << length << std::endl;
-      return;
+    if (!BlockCodec::decompress(m_codec, isQuantized ? 1 : sizeof(Data_T), 
+                                cmpData, cmpLen, 
+                                ucmpData, ucmpLen, scratch.codec)) {
+      static Msg::RateLimit limit;
+      Msg::print(limit, Msg::SevWarning, "Couldn't uncompress block " + 
+                 boost::lexical_cast<std::string>(idx) + " with codec " + 
+                 boost::lexical_cast<std::string>(m_codec));
+      return false;
+    }
+    // Expand the codes into the block
+    if (isQuantized) {
+      SparseQuantize::dequantize(ucmpData, m_numVoxels, m_quantizeBits, 
+                                 result);
     }
 
   } else {
 
-    m_dataset.getData(idx, result, OGAWA_THREAD);
+    m_dataset.getData(idx, result, m_threadId);
+    Stats::add(Stats::BytesRead, m_numVoxels * sizeof(Data_T));
+
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void 
+OgSparseDataReader<Data_T>::prefetchBlocks(const std::vector<size_t> &indices)
+{
+  if (m_isCompressed) {
+    m_cDataset.prefetch(indices, m_threadId);
+  } else {
+    m_dataset.prefetch(indices, m_threadId);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool OgSparseDataReader<Data_T>::readTiles(const size_t idx,
+                                           const uint64_t tiles,
+                                           Data_T *result)
+{
+  if (!m_isCompressed || m_tileOrder == 0) {
+    return readBlock(idx, result);
+  }
+
+  SparseReadScratch &scratch = SparseReadScratch::forThread();
+  const size_t   numTiles   = SparseTiles::numTiles(m_blockOrder, m_tileOrder);
+  const size_t   tableBytes = SparseTiles::tableBytes(m_blockOrder, 
+                                                      m_tileOrder);
+  const uint64_t length     = m_cDataset.dataSize(idx, m_threadId);
+  const uint8_t *block      = m_cDataset.mappedData(idx, m_threadId);
+
+  // The checksum covers the entire block, so checking it means reading
+  // all of it. Only the requested tiles are inflated either way.
+  if (!m_checksums.empty()) {
+    Stats::add(Stats::BytesRead, length);
+    if (!block) {
+      uint8_t *cache = SparseReadScratch::grow(scratch.compressed, length);
+      m_cDataset.getData(idx, cache, m_threadId);
+      block = cache;
+    }
+    if (!checkBlock(block, length, idx)) {
+      return false;
+    }
+  } else {
+    Stats::add(Stats::BytesRead, tableBytes);
+  }
+
+  // Copy the offset table, since it needn't be aligned in a mapped file
+  uint32_t *offsets = SparseReadScratch::grow(scratch.tileOffsets, 
+                                              numTiles + 1);
+  if (block) {
+    memcpy(offsets, block, tableBytes);
+  } else if (!m_cDataset.getData(idx, reinterpret_cast<uint8_t *>(offsets),
+                                 0, tableBytes, m_threadId)) {
+    return false;
+  }
+  if (!checkTileOffsets(offsets, length, idx)) {
+    return false;
+  }
+
+  for (size_t t = 0; t < numTiles; ++t) {
+    if (!(tiles & (static_cast<uint64_t>(1) << t))) {
+      continue;
+    }
+    const uint32_t start   = offsets[t];
+    const uint32_t tileLen = offsets[t + 1] - start;
+    const uint8_t *src = block ? block + tableBytes + start : NULL;
+    if (!src) {
+      uint8_t *cache = SparseReadScratch::grow(scratch.compressed, tileLen);
+      if (!m_cDataset.getData(idx, cache, tableBytes + start, tileLen, 
+                              m_threadId)) {
+        return false;
+      }
+      Stats::add(Stats::BytesRead, tileLen);
+      src = cache;
+    } else if (m_checksums.empty()) {
+      Stats::add(Stats::BytesRead, tileLen);
+    }
+    if (!inflateTile(src, tileLen, t, result, scratch)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool OgSparseDataReader<Data_T>::checkTileOffsets(const uint32_t *offsets,
+                                                  const uint64_t length,
+                                                  const size_t idx) const
+{
+  const size_t numTiles   = SparseTiles::numTiles(m_blockOrder, m_tileOrder);
+  const size_t tableBytes = SparseTiles::tableBytes(m_blockOrder, 
+                                                    m_tileOrder);
+  bool isValid = length >= tableBytes && offsets[0] == 0 &&
+    offsets[numTiles] <= length - tableBytes;
+  for (size_t t = 0; isValid && t < numTiles; ++t) {
+    isValid = offsets[t] <= offsets[t + 1];
+  }
+  if (!isValid) {
+    static Msg::RateLimit limit;
+    Msg::print(limit, Msg::SevWarning, "Block " + 
+               boost::lexical_cast<std::string>(idx) + 
+               " has a corrupt tile table");
+  }
+  return isValid;
+}
+
+//----------------------------------------------------------------------------//
 
+template <class Data_T>
+bool OgSparseDataReader<Data_T>::checkBlock(const uint8_t *data,
+                                            const uint64_t length,
+                                            const size_t idx) const
+{
+  if (!m_checksums.empty() && 
+      BlockChecksum::crc32c(data, length) != m_checksums[idx]) {
+    static Msg::RateLimit limit;
+    Msg::print(limit, Msg::SevWarning, "Block " + 
+               boost::lexical_cast<std::string>(idx) + 
+               " doesn't match its checksum");
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool OgSparseDataReader<Data_T>::inflateTile(const uint8_t *src,
+                                             const size_t length,
+                                             const size_t tileIdx,
+                                             Data_T *result,
+                                             SparseReadScratch &scratch)
+{
+  // Tiles are runs of the block's voxels, so they inflate straight into
+  // place
+  Data_T *dst = result + tileIdx * m_tileVoxels;
+  if (!BlockCodec::decompress(m_codec, sizeof(Data_T), src, length, 
+                              reinterpret_cast<uint8_t *>(dst), 
+                              m_tileVoxels * sizeof(Data_T), scratch.codec)) {
+    static Msg::RateLimit limit;
+    Msg::print(limit, Msg::SevWarning, "Couldn't uncompress tile " + 
+               boost::lexical_cast<std::string>(tileIdx) + " with codec " + 
+               boost::lexical_cast<std::string>(m_codec));
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+uint64_t OgSparseDataReader<Data_T>::blockOffset(const size_t idx)
+{
+  if (m_isCompressed) {
+    return OGAWA_INVALID_DATASET_INDEX;
   }
+  return m_dataset.dataOffset(idx, m_threadId);
 }
 
 //----------------------------------------------------------------------------//
@@ -7,8 +7,14 @@
 // Includes
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
 
 #include <OpenEXR/ImathVec.h>
 
@@ -174,6 +180,136 @@ bool writeDataType(Alembic::Ogawa::OGroupPtr group)
 //! first data set in the group.
 bool getGroupName(Alembic::Ogawa::IGroupPtr group, std::string &name);
 
+//----------------------------------------------------------------------------//
+
+//! Opens an Ogawa archive for reading. Filenames that start with the scheme
+//! of a registered stream source, see StreamSource.h, are read through it.
+//! Others are opened as local files, memory-mapped if mapOgawaFiles() is 
+//! on. The archive is invalid if the file couldn't be opened.
+boost::shared_ptr<Alembic::Ogawa::IArchive> 
+openOgawaArchive(const std::string &filename);
+
+//----------------------------------------------------------------------------//
+
+//! Returns the bytes of an attribute's value, as written by writeData()
+template <typename T>
+const void* attributeData(const T &value)
+{
+  return &value;
+}
+
+//! Returns the number of bytes of an attribute's value
+template <typename T>
+size_t attributeSize(const T &)
+{
+  return sizeof(T);
+}
+
+//! Strings are written without zero terminator
+inline const void* attributeData(const std::string &value)
+{
+  return value.c_str();
+}
+
+inline size_t attributeSize(const std::string &value)
+{
+  return value.size() * sizeof(std::string::value_type);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads an attribute's value from its bytes
+template <typename T>
+bool readAttributeData(const uint8_t *data, const size_t numBytes, T &value)
+{
+  if (numBytes != sizeof(T)) {
+    return false;
+  }
+  memcpy(&value, data, sizeof(T));
+  return true;
+}
+
+//! Specialization of readAttributeData for strings
+template <>
+inline bool readAttributeData(const uint8_t *data, const size_t numBytes, 
+                              std::string &value)
+{
+  // Like readString(), the string ends at the first zero
+  const char *chars = reinterpret_cast<const char *>(data);
+  value = std::string(chars, std::find(chars, chars + numBytes, '\0'));
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+// OgPackedAttributes
+//----------------------------------------------------------------------------//
+
+/*! \class OgPackedAttributes
+  The attributes of a group, packed into a single data child so that they
+  can be read with one I/O instead of a few per attribute. Written by 
+  OgOGroup if asked to, see OgOGroup::setPackAttributes(), and read when an
+  OgIGroup is opened.
+
+  The packed attributes are the group's last child, and its only data child
+  other than the group's name and type. They start with a magic number, 
+  followed by the name length, name, data type, value length and value of 
+  each attribute, with lengths stored as uint32.
+*/
+
+//----------------------------------------------------------------------------//
+
+class OgPackedAttributes
+{
+public:
+
+  // Typedefs ------------------------------------------------------------------
+
+  typedef boost::shared_ptr<const OgPackedAttributes> CPtr;
+
+  //! Where an attribute is found in the packed bytes
+  struct Entry
+  {
+    OgDataType type;
+    size_t     offset;
+    size_t     numBytes;
+  };
+
+  // Main methods --------------------------------------------------------------
+
+  //! Appends an attribute to packed bytes, starting them if they're empty
+  static void append(std::vector<uint8_t> &bytes, const std::string &name,
+                     const OgDataType type, const void *data, 
+                     const size_t numBytes);
+
+  //! Reads the packed attributes of a group
+  //! \returns Null if the group's attributes aren't packed
+  static CPtr read(Alembic::Ogawa::IGroupPtr group);
+
+  //! Returns the names of the attributes, in the order they were written
+  const std::vector<std::string>& names() const
+  { return m_names; }
+
+  //! Finds an attribute
+  //! \returns Null if there is no attribute of that name
+  const Entry* find(const std::string &name) const;
+
+  //! Returns the bytes of an attribute's value
+  const uint8_t* data(const Entry &entry) const
+  { return &m_bytes[0] + entry.offset; }
+
+private:
+
+  // Data members --------------------------------------------------------------
+
+  //! The packed attributes, as read from the file
+  std::vector<uint8_t>         m_bytes;
+  //! Attribute names, in the order they were written
+  std::vector<std::string>     m_names;
+  //! Attributes by name
+  std::map<std::string, Entry> m_entries;
+
+};
+
 //----------------------------------------------------------------------------//
 // OgIBase
 //----------------------------------------------------------------------------//
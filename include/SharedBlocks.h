@@ -0,0 +1,113 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2014 Sony Pictures Imageworks Inc
+ *                    Pixar Animation Studios
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//----------------------------------------------------------------------------//
+
+/*! \file SharedBlocks.h
+  \brief Contains functions for sharing loaded sparse blocks between the
+  processes on a host.
+*/
+
+//----------------------------------------------------------------------------//
+
+#ifndef _INCLUDED_Field3D_SharedBlocks_H_
+#define _INCLUDED_Field3D_SharedBlocks_H_
+
+//----------------------------------------------------------------------------//
+
+#include <string>
+
+//----------------------------------------------------------------------------//
+
+#include "ns.h"
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// SharedBlocks
+//----------------------------------------------------------------------------//
+
+/*! \namespace SharedBlocks
+  Each shared block lives in its own named shared memory segment. The 
+  segment starts with a header identifying the block, followed by the 
+  page-aligned voxel data. The first process to ask for a block fills it 
+  in while holding an exclusive flock() on the segment, others map it 
+  read-only and hold a shared lock for as long as they use it. The 
+  segment is removed by the last process to detach from it.
+
+  Since the kernel drops the locks of a process that dies, a crash never
+  blocks other processes. A block whose owner died while filling it in is 
+  replaced by the next process to ask for it, and segments outlived by all 
+  their users are removed by the next process to use them.
+
+  \note Only POSIX hosts share blocks.
+  \ingroup file_int
+*/
+
+//----------------------------------------------------------------------------//
+
+namespace SharedBlocks {
+
+  //! Attaches to the shared copy of the block identified by key, creating
+  //! it if no other process has. Waits for another process that is 
+  //! filling the block in.
+  //! \param isOwner Set to true if the segment was created, in which case 
+  //! the caller must fill in the data and then call publish() or abandon(). 
+  //! Otherwise the data is published and mapped read-only.
+  //! \returns Pointer to the block's data, or NULL if the segment couldn't 
+  //! be created or attached to.
+  void* acquire(const std::string &key, const size_t numBytes, bool &isOwner);
+
+  //! Marks a block's data as filled in and lets waiting processes attach
+  void  publish(void *data);
+
+  //! Marks a block's data as unusable, for when filling it in failed
+  void  abandon(void *data);
+
+  //! Detaches from a block, removing it once no process uses it.
+  //! \returns False if data isn't a shared block, which is left alone
+  bool  release(void *data);
+
+} // namespace SharedBlocks
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_HEADER_CLOSE
+
+//----------------------------------------------------------------------------//
+
+#endif // include guard
+
+//----------------------------------------------------------------------------//
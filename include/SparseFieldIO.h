@@ -50,6 +50,10 @@
 
 #include <string>
 #include <cmath>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <hdf5.h>
 
@@ -129,6 +133,16 @@ public:
                               const std::string &layerPath,
                               OgDataType typeEnum);
 
+  //! Reads only the blocks of the field that overlap voxelWindow. Blocks
+  //! outside the window are left unallocated and hold their empty value.
+  //! The window is ignored when dynamic loading is enabled.
+  //! \returns Null if no object was read
+  virtual FieldBase::Ptr readWindow(const OgIGroup &layerGroup, 
+                                    const std::string &filename, 
+                                    const std::string &layerPath,
+                                    OgDataType typeEnum,
+                                    const Box3i &voxelWindow);
+
   //! Writes the given field to disk. 
   //! \return true if successful, otherwise false
   virtual bool write(hid_t layerGroup, FieldBase::Ptr field);
@@ -141,18 +155,87 @@ public:
   virtual std::string className() const
   { return "SparseField"; }
 
+  // Batch writing -------------------------------------------------------------
+
+  //! Blocks of one field, compressed ahead of writing by precompress()
+  struct PrecompressedBlocks
+  {
+    typedef boost::shared_ptr<PrecompressedBlocks> Ptr;
+    //! Tile order, or 0 if the blocks are compressed whole
+    int tileOrder;
+    SparseCodec codec;
+    int quantizeBits;
+    //! Compressed data of each allocated block, in file order
+    std::vector<std::vector<uint8_t> > blocks;
+  };
+
+  //! Compresses the blocks of the given fields ahead of writing them to an
+  //! Ogawa file, spreading the blocks of all the fields over numIOThreads() 
+  //! threads. 
+  //! \returns The blocks of each field, in the order of fields, to be 
+  //! handed to writePrecompressed(). Empty if the blocks are stored 
+  //! uncompressed or if compression failed.
+  template <class Data_T>
+  static std::vector<PrecompressedBlocks::Ptr> precompress
+  (const std::vector<typename SparseField<Data_T>::Ptr> &fields);
+
+  //! Writes the given field to disk like write(), using the blocks that
+  //! precompress() made for it. The blocks are compressed again if the 
+  //! compression settings changed in between.
+  //! \return true if successful, otherwise false
+  template <class Data_T>
+  static bool writePrecompressed(OgOGroup &layerGroup, 
+                                 typename SparseField<Data_T>::Ptr field,
+                                 const PrecompressedBlocks &precompressed);
+
+  // Streaming -----------------------------------------------------------------
+
+  //! Writes a layer that reads back as a SparseField<Data_T>, without the
+  //! field ever being in memory. fillBlock(block, voxels, emptyValue) is 
+  //! called for each block, in file order, with the block coordinate. It 
+  //! either fills in the block's voxels with x varying fastest and returns
+  //! true, or sets emptyValue and returns false to leave the block 
+  //! unallocated. Voxels outside the data window are ignored. Only one block
+  //! is held in memory at a time, and blocks are compressed on the calling
+  //! thread.
+  //! \note The caller is expected to have written the class_name attribute,
+  //! as for write().
+  template <class Data_T>
+  static bool 
+  writeStreamed(OgOGroup &layerGroup, const Box3i &extents, 
+                const Box3i &dataWindow, const int blockOrder,
+                const boost::function<bool (const V3i &, Data_T *, 
+                                            Data_T &)> &fillBlock);
+
 private:
 
   // Internal methods ----------------------------------------------------------
 
+  //! Shared implementation of the Ogawa read() and readWindow(). A null
+  //! voxelWindow reads the whole field.
+  FieldBase::Ptr readInternal(const OgIGroup &layerGroup, 
+                              const std::string &filename, 
+                              const std::string &layerPath,
+                              OgDataType typeEnum,
+                              const Box3i *voxelWindow);
+
   //! This call writes all the attributes and sets up the data space.
   template <class Data_T>
   bool writeInternal(hid_t layerGroup, typename SparseField<Data_T>::Ptr field);
 
-  //! This call writes all the attributes and sets up the data space.
+  //! This call writes all the attributes and sets up the data space. 
+  //! Blocks compressed by precompress() are used if given.
   template <class Data_T>
   bool writeInternal(OgOGroup &layerGroup, 
-                     typename SparseField<Data_T>::Ptr field);
+                     typename SparseField<Data_T>::Ptr field,
+                     const PrecompressedBlocks *precompressed = NULL);
+
+  //! Writes the attributes that describe a field of the given layout, up to
+  //! but not including the block data
+  template <class Data_T>
+  static void writeAttributes(OgOGroup &layerGroup, const Box3i &ext, 
+                              const Box3i &dw, const int blockOrder, 
+                              const V3i &blockRes);
 
   //! Reads the data that is dependent on the data type on disk
   template <class Data_T>
@@ -167,11 +250,16 @@ private:
   readData(const OgIGroup &location, const Box3i &extents, 
            const Box3i &dataWindow, const size_t blockOrder, 
            const size_t numBlocks, const std::string &filename, 
-           const std::string &layerPath);
+           const std::string &layerPath, const Box3i *voxelWindow);
 
   // Strings -------------------------------------------------------------------
 
   static const int         k_versionNumber;
+  static const int         k_blockLayoutVersionNumber;
+  static const int         k_blockTableVersionNumber;
+  static const int         k_quantizedVersionNumber;
+  static const int         k_codecVersionNumber;
+  static const int         k_tiledVersionNumber;
   static const std::string k_versionAttrName;
   static const std::string k_extentsStr;
   static const std::string k_extentsMinStr;
@@ -187,6 +275,13 @@ private:
   static const std::string k_numOccupiedBlocksStr;
   static const std::string k_dataStr;
   static const std::string k_isCompressed;
+  static const std::string k_dataAlignmentStr;
+  static const std::string k_tileOrderStr;
+  static const std::string k_codecStr;
+  static const std::string k_blockLayoutStr;
+  static const std::string k_blockTableStr;
+  static const std::string k_blockSummaryStr;
+  static const std::string k_quantizeBitsStr;
   
   // Typedefs ------------------------------------------------------------------
 
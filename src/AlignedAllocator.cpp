@@ -0,0 +1,103 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file AlignedAllocator.cpp
+  Contains the implementation of field storage allocation.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "AlignedAllocator.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+#ifdef WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "InitIO.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+void* allocFieldStorage(const size_t bytes, const size_t alignment)
+{
+  const bool huge = hugePages() && bytes >= k_hugePageBytes;
+  void *p = NULL;
+#ifdef WIN32
+  // Large pages need privileges on Windows, so only the alignment applies
+  p = _aligned_malloc(bytes, alignment);
+#else
+  const size_t align = huge ? std::max(alignment, k_hugePageBytes) : alignment;
+  if (posix_memalign(&p, align, bytes) != 0) {
+    return NULL;
+  }
+#  ifdef MADV_HUGEPAGE
+  // Only whole huge pages are advised, so the tail keeps using small pages
+  // and resident memory stays close to the bytes asked for
+  if (huge) {
+    madvise(p, bytes - bytes % k_hugePageBytes, MADV_HUGEPAGE);
+  }
+#  endif
+#endif
+  return p;
+}
+
+//----------------------------------------------------------------------------//
+
+void freeFieldStorage(void *p)
+{
+#ifdef WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,195 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2014 Sony Pictures Imageworks Inc
+ *                    Pixar Animation Studios
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlockChecksum.cpp
+  \brief Contains the CRC32C implementation.
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "BlockChecksum.h"
+
+// System includes
+#include <string.h>
+
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#endif
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+
+using boost::uint8_t;
+using boost::uint32_t;
+using boost::uint64_t;
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+#if !defined(__SSE4_2__) && !defined(__ARM_FEATURE_CRC32)
+
+//! Tables for slicing-by-8. Entry [s][b] is the checksum of byte b followed
+//! by s zero bytes
+struct Crc32cTables
+{
+  Crc32cTables()
+  {
+    // Reflected Castagnoli polynomial
+    const uint32_t poly = 0x82f63b78;
+    for (uint32_t b = 0; b < 256; ++b) {
+      uint32_t crc = b;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ (crc & 1 ? poly : 0);
+      }
+      table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; ++b) {
+      for (int s = 1; s < 8; ++s) {
+        table[s][b] = (table[s - 1][b] >> 8) ^ table[0][table[s - 1][b] & 0xff];
+      }
+    }
+  }
+  uint32_t table[8][256];
+};
+
+//----------------------------------------------------------------------------//
+
+const Crc32cTables& crc32cTables()
+{
+  static const Crc32cTables tables;
+  return tables;
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+
+namespace BlockChecksum {
+
+//----------------------------------------------------------------------------//
+
+uint32_t crc32c(const uint8_t *data, const size_t numBytes, const uint32_t crc)
+{
+  uint32_t     c = ~crc;
+  const uint8_t *p = data;
+  size_t       n = numBytes;
+
+#if defined(__SSE4_2__)
+
+  for (; n > 0 && reinterpret_cast<size_t>(p) % 8 != 0; --n, ++p) {
+    c = _mm_crc32_u8(c, *p);
+  }
+#  if defined(__x86_64__)
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    c = static_cast<uint32_t>(_mm_crc32_u64(c, word));
+  }
+#  endif
+  for (; n >= 4; n -= 4, p += 4) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    c = _mm_crc32_u32(c, word);
+  }
+  for (; n > 0; --n, ++p) {
+    c = _mm_crc32_u8(c, *p);
+  }
+
+#elif defined(__ARM_FEATURE_CRC32)
+
+  for (; n > 0 && reinterpret_cast<size_t>(p) % 8 != 0; --n, ++p) {
+    c = __crc32cb(c, *p);
+  }
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    c = __crc32cd(c, word);
+  }
+  for (; n > 0; --n, ++p) {
+    c = __crc32cb(c, *p);
+  }
+
+#else
+
+  // Slicing-by-8 processes eight bytes per step, little endian
+  const uint32_t (&t)[8][256] = crc32cTables().table;
+  for (; n >= 8; n -= 8, p += 8) {
+    const uint32_t lo = c ^ (p[0] | (p[1] << 8) | (p[2] << 16) | 
+                             (static_cast<uint32_t>(p[3]) << 24));
+    c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ 
+      t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^ 
+      t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+  }
+  for (; n > 0; --n, ++p) {
+    c = (c >> 8) ^ t[0][(c ^ *p) & 0xff];
+  }
+
+#endif
+
+  return ~c;
+}
+
+//----------------------------------------------------------------------------//
+
+std::string datasetName(const std::string &dataName)
+{
+  return dataName + "_checksums";
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace BlockChecksum
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,378 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2014 Sony Pictures Imageworks Inc
+ *                    Pixar Animation Studios
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BlockCodec.cpp
+  \brief Contains implementations of the sparse block codecs.
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "BlockCodec.h"
+
+// Library includes
+#include <zlib.h>
+#ifdef FIELD3D_LZ4
+#include <lz4.h>
+#endif
+#ifdef FIELD3D_ZSTD
+#include <zstd.h>
+#endif
+
+// Project includes
+#include "Stats.h"
+#include "Trace.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+
+using boost::uint8_t;
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Places byte b of every value in the b'th run of the output
+void shuffle(const uint8_t *src, uint8_t *dst, const size_t numBytes, 
+             const size_t elementSize)
+{
+  const size_t numElements = numBytes / elementSize;
+  for (size_t b = 0; b < elementSize; ++b) {
+    uint8_t *run = dst + b * numElements;
+    for (size_t i = 0; i < numElements; ++i) {
+      run[i] = src[i * elementSize + b];
+    }
+  }
+  // Any trailing bytes are left as they are
+  for (size_t i = numElements * elementSize; i < numBytes; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Inverse of shuffle()
+void unshuffle(const uint8_t *src, uint8_t *dst, const size_t numBytes, 
+               const size_t elementSize)
+{
+  const size_t numElements = numBytes / elementSize;
+  for (size_t b = 0; b < elementSize; ++b) {
+    const uint8_t *run = src + b * numElements;
+    for (size_t i = 0; i < numElements; ++i) {
+      dst[i * elementSize + b] = run[i];
+    }
+  }
+  for (size_t i = numElements * elementSize; i < numBytes; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool zlibCompress(const uint8_t *src, const size_t srcLen, 
+                  uint8_t *dst, size_t &dstLen, const int level)
+{
+  uLong cmpLen = dstLen;
+  const int status = compress2(dst, &cmpLen, src, srcLen, level);
+  dstLen = cmpLen;
+  return status == Z_OK;
+}
+
+//----------------------------------------------------------------------------//
+
+bool zlibDecompress(const uint8_t *src, const size_t srcLen, 
+                    uint8_t *dst, const size_t dstLen)
+{
+  uLong ucmpLen = dstLen;
+  const int status = uncompress(dst, &ucmpLen, src, srcLen);
+  return status == Z_OK && ucmpLen == dstLen;
+}
+
+//----------------------------------------------------------------------------//
+
+#ifdef FIELD3D_LZ4
+
+bool lz4Compress(const uint8_t *src, const size_t srcLen, 
+                 uint8_t *dst, size_t &dstLen)
+{
+  const int cmpLen = 
+    LZ4_compress_default(reinterpret_cast<const char *>(src), 
+                         reinterpret_cast<char *>(dst), srcLen, dstLen);
+  dstLen = cmpLen;
+  return cmpLen > 0;
+}
+
+//----------------------------------------------------------------------------//
+
+bool lz4Decompress(const uint8_t *src, const size_t srcLen, 
+                   uint8_t *dst, const size_t dstLen)
+{
+  const int ucmpLen = 
+    LZ4_decompress_safe(reinterpret_cast<const char *>(src), 
+                        reinterpret_cast<char *>(dst), srcLen, dstLen);
+  return ucmpLen >= 0 && static_cast<size_t>(ucmpLen) == dstLen;
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+#ifdef FIELD3D_ZSTD
+
+bool zstdCompress(const uint8_t *src, const size_t srcLen, 
+                  uint8_t *dst, size_t &dstLen, const int level)
+{
+  const size_t cmpLen = ZSTD_compress(dst, dstLen, src, srcLen, level);
+  if (ZSTD_isError(cmpLen)) {
+    return false;
+  }
+  dstLen = cmpLen;
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool zstdDecompress(const uint8_t *src, const size_t srcLen, 
+                    uint8_t *dst, const size_t dstLen)
+{
+  const size_t ucmpLen = ZSTD_decompress(dst, dstLen, src, srcLen);
+  return !ZSTD_isError(ucmpLen) && ucmpLen == dstLen;
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+//! Whether the codec shuffles the bytes of the values before compressing
+bool isShuffled(const SparseCodec codec)
+{
+  return codec == SparseCodecShuffleZlib || 
+    codec == SparseCodecShuffleLz4 || codec == SparseCodecShuffleZstd;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Compresses with the codec's underlying compressor, without shuffling
+bool compressBytes(const SparseCodec codec, const int level,
+                   const uint8_t *src, const size_t srcLen, 
+                   uint8_t *dst, size_t &dstLen)
+{
+  switch (codec) {
+  case SparseCodecZlib:
+  case SparseCodecShuffleZlib:
+    return zlibCompress(src, srcLen, dst, dstLen, level);
+#ifdef FIELD3D_LZ4
+  case SparseCodecLz4:
+  case SparseCodecShuffleLz4:
+    return lz4Compress(src, srcLen, dst, dstLen);
+#endif
+#ifdef FIELD3D_ZSTD
+  case SparseCodecZstd:
+  case SparseCodecShuffleZstd:
+    return zstdCompress(src, srcLen, dst, dstLen, level);
+#endif
+  default:
+    return false;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Inverse of compressBytes()
+bool decompressBytes(const SparseCodec codec, 
+                     const uint8_t *src, const size_t srcLen, 
+                     uint8_t *dst, const size_t dstLen)
+{
+  switch (codec) {
+  case SparseCodecZlib:
+  case SparseCodecShuffleZlib:
+    return zlibDecompress(src, srcLen, dst, dstLen);
+#ifdef FIELD3D_LZ4
+  case SparseCodecLz4:
+  case SparseCodecShuffleLz4:
+    return lz4Decompress(src, srcLen, dst, dstLen);
+#endif
+#ifdef FIELD3D_ZSTD
+  case SparseCodecZstd:
+  case SparseCodecShuffleZstd:
+    return zstdDecompress(src, srcLen, dst, dstLen);
+#endif
+  default:
+    return false;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the counter that decompression time with the codec goes to
+Stats::Counter decompressCounter(const SparseCodec codec)
+{
+  switch (codec) {
+  case SparseCodecShuffleZlib:
+    return Stats::DecompressTimeShuffleZlib;
+  case SparseCodecLz4:
+  case SparseCodecShuffleLz4:
+    return Stats::DecompressTimeLz4;
+  case SparseCodecZstd:
+  case SparseCodecShuffleZstd:
+    return Stats::DecompressTimeZstd;
+  default:
+    return Stats::DecompressTimeZlib;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// BlockCodec implementations
+//----------------------------------------------------------------------------//
+
+namespace BlockCodec {
+
+//----------------------------------------------------------------------------//
+
+bool isValid(const int codec)
+{
+  switch (codec) {
+  case SparseCodecZlib:
+  case SparseCodecShuffleZlib:
+    return true;
+#ifdef FIELD3D_LZ4
+  case SparseCodecLz4:
+  case SparseCodecShuffleLz4:
+    return true;
+#endif
+#ifdef FIELD3D_ZSTD
+  case SparseCodecZstd:
+  case SparseCodecShuffleZstd:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t compressBound(const SparseCodec codec, const size_t numBytes)
+{
+  switch (codec) {
+#ifdef FIELD3D_LZ4
+  case SparseCodecLz4:
+  case SparseCodecShuffleLz4:
+    return LZ4_compressBound(numBytes);
+#endif
+#ifdef FIELD3D_ZSTD
+  case SparseCodecZstd:
+  case SparseCodecShuffleZstd:
+    return ZSTD_compressBound(numBytes);
+#endif
+  default:
+    return ::compressBound(numBytes);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool compress(const SparseCodec codec, const size_t elementSize,
+              const uint8_t *src, const size_t srcLen, 
+              uint8_t *dst, size_t &dstLen,
+              std::vector<uint8_t> &scratch)
+{
+  return compress(codec, sparseCompressionLevel(), elementSize, 
+                  src, srcLen, dst, dstLen, scratch);
+}
+
+//----------------------------------------------------------------------------//
+
+bool compress(const SparseCodec codec, const int level,
+              const size_t elementSize,
+              const uint8_t *src, const size_t srcLen, 
+              uint8_t *dst, size_t &dstLen,
+              std::vector<uint8_t> &scratch)
+{
+  if (!isShuffled(codec)) {
+    return compressBytes(codec, level, src, srcLen, dst, dstLen);
+  }
+  if (scratch.size() < srcLen) {
+    scratch.resize(srcLen);
+  }
+  shuffle(src, &scratch[0], srcLen, elementSize);
+  return compressBytes(codec, level, &scratch[0], srcLen, dst, dstLen);
+}
+
+//----------------------------------------------------------------------------//
+
+bool decompress(const SparseCodec codec, const size_t elementSize,
+                const uint8_t *src, const size_t srcLen, 
+                uint8_t *dst, const size_t dstLen,
+                std::vector<uint8_t> &scratch)
+{
+  Stats::ScopedTimer timer(decompressCounter(codec));
+  Stats::add(Stats::BytesDecompressed, dstLen);
+  Trace::ScopedEvent event("decompress");
+
+  if (!isShuffled(codec)) {
+    return decompressBytes(codec, src, srcLen, dst, dstLen);
+  }
+  if (scratch.size() < dstLen) {
+    scratch.resize(dstLen);
+  }
+  if (!decompressBytes(codec, src, srcLen, &scratch[0], dstLen)) {
+    return false;
+  }
+  unshuffle(&scratch[0], dst, dstLen, elementSize);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace BlockCodec
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,262 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file BoundsBVH.cpp
+  Contains implementations of the BoundsBVH class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include <algorithm>
+#include <limits>
+
+#include "BoundsBVH.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Orders box indices by the center of their box along one axis
+  struct CenterLess
+  {
+    CenterLess(const std::vector<V3d> &centers, const int axis)
+      : m_centers(centers), m_axis(axis)
+    { }
+    bool operator() (const size_t a, const size_t b) const
+    { return m_centers[a][m_axis] < m_centers[b][m_axis]; }
+  private:
+    const std::vector<V3d> &m_centers;
+    const int               m_axis;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether the ray passes through the box at or after its origin
+  bool rayHitsBox(const Ray3d &ray, const V3d &invDir, const Box3d &box)
+  {
+    double tNear = 0.0;
+    double tFar  = std::numeric_limits<double>::max();
+    for (int dim = 0; dim < 3; ++dim) {
+      if (ray.dir[dim] == 0.0) {
+        // Parallel to the slab
+        if (ray.pos[dim] < box.min[dim] || ray.pos[dim] > box.max[dim]) {
+          return false;
+        }
+        continue;
+      }
+      double t0 = (box.min[dim] - ray.pos[dim]) * invDir[dim];
+      double t1 = (box.max[dim] - ray.pos[dim]) * invDir[dim];
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+      tNear = std::max(tNear, t0);
+      tFar  = std::min(tFar, t1);
+      if (tNear > tFar) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// BoundsBVH implementations
+//----------------------------------------------------------------------------//
+
+void BoundsBVH::build(const std::vector<Box3d> &bounds)
+{
+  clear();
+
+  m_numBoxes = bounds.size();
+
+  // Pad each box by a fraction of its size, so that points on its faces 
+  // aren't lost to rounding
+  std::vector<V3d> centers;
+  for (size_t i = 0; i < bounds.size(); ++i) {
+    Box3d padded = bounds[i];
+    if (!padded.isEmpty()) {
+      const V3d size = padded.size();
+      const double pad = 
+        1e-6 * std::max(std::max(size.x, size.y), std::max(size.z, 1.0));
+      padded.min -= V3d(pad);
+      padded.max += V3d(pad);
+      m_indices.push_back(i);
+    }
+    m_bounds.push_back(padded);
+    centers.push_back(padded.center());
+  }
+
+  if (m_indices.empty()) {
+    return;
+  }
+
+  // A binary tree with leaves of at least one box has fewer than 
+  // 2 * numBoxes nodes
+  m_nodes.reserve(2 * m_indices.size());
+  m_nodes.push_back(Node());
+  buildNode(0, 0, m_indices.size(), m_bounds, centers);
+}
+
+//----------------------------------------------------------------------------//
+
+void BoundsBVH::clear()
+{
+  m_nodes.clear();
+  m_indices.clear();
+  m_bounds.clear();
+  m_numBoxes = 0;
+}
+
+//----------------------------------------------------------------------------//
+
+void BoundsBVH::findPoint(const V3d &wsP, IndexVec &hits) const
+{
+  hits.clear();
+  if (m_nodes.empty()) {
+    return;
+  }
+  size_t stack[64];
+  size_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = m_nodes[stack[--top]];
+    if (!node.bounds.intersects(wsP)) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (size_t i = node.first, end = node.first + node.count; 
+           i < end; ++i) {
+        if (m_bounds[m_indices[i]].intersects(wsP)) {
+          hits.push_back(m_indices[i]);
+        }
+      }
+    } else {
+      stack[top++] = node.first;
+      stack[top++] = node.first + 1;
+    }
+  }
+  std::sort(hits.begin(), hits.end());
+}
+
+//----------------------------------------------------------------------------//
+
+void BoundsBVH::findRay(const Ray3d &wsRay, IndexVec &hits) const
+{
+  hits.clear();
+  if (m_nodes.empty()) {
+    return;
+  }
+  const V3d invDir(wsRay.dir.x != 0.0 ? 1.0 / wsRay.dir.x : 0.0,
+                   wsRay.dir.y != 0.0 ? 1.0 / wsRay.dir.y : 0.0,
+                   wsRay.dir.z != 0.0 ? 1.0 / wsRay.dir.z : 0.0);
+  size_t stack[64];
+  size_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node &node = m_nodes[stack[--top]];
+    if (!rayHitsBox(wsRay, invDir, node.bounds)) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (size_t i = node.first, end = node.first + node.count; 
+           i < end; ++i) {
+        if (rayHitsBox(wsRay, invDir, m_bounds[m_indices[i]])) {
+          hits.push_back(m_indices[i]);
+        }
+      }
+    } else {
+      stack[top++] = node.first;
+      stack[top++] = node.first + 1;
+    }
+  }
+  std::sort(hits.begin(), hits.end());
+}
+
+//----------------------------------------------------------------------------//
+
+void BoundsBVH::buildNode(const size_t node, const size_t first, 
+                          const size_t count, 
+                          const std::vector<Box3d> &bounds,
+                          const std::vector<V3d> &centers)
+{
+  // Bounds of the boxes, and of their centers
+  Box3d nodeBounds, centerBounds;
+  for (size_t i = first; i < first + count; ++i) {
+    nodeBounds.extendBy(bounds[m_indices[i]]);
+    centerBounds.extendBy(centers[m_indices[i]]);
+  }
+  m_nodes[node].bounds = nodeBounds;
+
+  // Few enough boxes, or all centered on the same point, make a leaf
+  const int axis = centerBounds.majorAxis();
+  if (count <= k_maxLeafSize || 
+      centerBounds.max[axis] <= centerBounds.min[axis]) {
+    m_nodes[node].first = first;
+    m_nodes[node].count = count;
+    return;
+  }
+
+  // Split at the median center along the widest axis. The median split 
+  // keeps the tree balanced, so its depth stays below log2 of the count
+  IndexVec::iterator begin = m_indices.begin() + first;
+  const size_t half = count / 2;
+  std::nth_element(begin, begin + half, begin + count, 
+                   CenterLess(centers, axis));
+
+  const size_t children = m_nodes.size();
+  m_nodes[node].first = children;
+  m_nodes[node].count = 0;
+  m_nodes.push_back(Node());
+  m_nodes.push_back(Node());
+  buildNode(children, first, half, bounds, centers);
+  buildNode(children + 1, first + half, count - half, bounds, centers);
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -64,7 +64,28 @@ ClassFactory* ClassFactory::ms_instance = NULL;
 
 ClassFactory::ClassFactory()
 {
-  PluginLoader::loadPlugins();
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Map_T>
+typename Map_T::mapped_type 
+ClassFactory::lookup(const Map_T &map, const std::string &className) const
+{
+  {
+    SharedLock lock(m_mutex);
+    typename Map_T::const_iterator i = map.find(className);
+    if (i != map.end()) {
+      return i->second;
+    }
+  }
+  // The class may come from a plugin that is only loaded on demand. This 
+  // must happen without the lock, since the plugin registers its classes.
+  if (this == ms_instance && PluginLoader::loadPluginForClass(className)) {
+    return lookup(map, className);
+  }
+  return typename Map_T::mapped_type();
 }
 
 //----------------------------------------------------------------------------//
@@ -88,6 +109,8 @@ void ClassFactory::registerField(CreateFieldFnPtr createFunc)
   string dataTypeName = instance->dataTypeString();
   string className = simpleClassName + "<" + dataTypeName + ">";
   
+  UniqueLock lock(m_mutex);
+
   FieldFuncMap::const_iterator i = m_fields.find(className);
   if (i != m_fields.end())
     nameExists = true;  
@@ -113,9 +136,9 @@ void ClassFactory::registerField(CreateFieldFnPtr createFunc)
 FieldRes::Ptr 
 ClassFactory::createField(const std::string &className) const
 {
-  FieldFuncMap::const_iterator i = m_fields.find(className);
-  if (i != m_fields.end())
-   return i->second();
+  CreateFieldFnPtr createFunc = lookup(m_fields, className);
+  if (createFunc)
+   return createFunc();
   else
     return FieldRes::Ptr();
 }
@@ -139,12 +162,15 @@ void ClassFactory::registerFieldIO(CreateFieldIOFnPtr createFunc)
 
   string className = instance->className();
 
+  UniqueLock lock(m_mutex);
+
   FieldIOFuncMap::const_iterator i = m_fieldIOs.find(className);
   if (i != m_fieldIOs.end())
     nameExists = true;  
 
   if (!nameExists) {
     m_fieldIOs[className] = createFunc;
+    m_sharedFieldIOs[className] = instance;
     // if the simple (untemplated) class name hasn't been registered
     // yet, add it to the list and print a message
     if (find(m_fieldIONames.begin(), m_fieldIONames.end(),
@@ -164,16 +190,23 @@ void ClassFactory::registerFieldIO(CreateFieldIOFnPtr createFunc)
 FieldIO::Ptr 
 ClassFactory::createFieldIO(const std::string &className) const
 {
-//  FieldIOFuncMap::const_iterator m = m_fieldIOs.begin();
-  FieldIOFuncMap::const_iterator i = m_fieldIOs.find(className);
-  if (i != m_fieldIOs.end())
-    return i->second();
+  CreateFieldIOFnPtr createFunc = lookup(m_fieldIOs, className);
+  if (createFunc)
+    return createFunc();
   else
     return FieldIO::Ptr();
 }
 
 //----------------------------------------------------------------------------//
 
+FieldIO::Ptr 
+ClassFactory::sharedFieldIO(const std::string &className) const
+{
+  return lookup(m_sharedFieldIOs, className);
+}
+
+//----------------------------------------------------------------------------//
+
 void ClassFactory::registerFieldMapping(CreateFieldMappingFnPtr createFunc)
 {
   // Make sure we don't add the same class twice
@@ -191,6 +224,8 @@ void ClassFactory::registerFieldMapping(CreateFieldMappingFnPtr createFunc)
 
   string className = instance->className();
 
+  UniqueLock lock(m_mutex);
+
   FieldMappingFuncMap::const_iterator i = m_mappings.find(className);
   if (i != m_mappings.end())
     nameExists = true;  
@@ -215,9 +250,9 @@ void ClassFactory::registerFieldMapping(CreateFieldMappingFnPtr createFunc)
 FieldMapping::Ptr 
 ClassFactory::createFieldMapping(const std::string &className) const
 {
-  FieldMappingFuncMap::const_iterator i = m_mappings.find(className);
-  if (i != m_mappings.end())
-    return i->second();
+  CreateFieldMappingFnPtr createFunc = lookup(m_mappings, className);
+  if (createFunc)
+    return createFunc();
   else
     return FieldMapping::Ptr();
 }
@@ -241,12 +276,15 @@ void ClassFactory::registerFieldMappingIO(CreateFieldMappingIOFnPtr createFunc)
 
   string className = instance->className();
 
+  UniqueLock lock(m_mutex);
+
   FieldMappingIOFuncMap::const_iterator i = m_mappingIOs.find(className);
   if (i != m_mappingIOs.end())
     nameExists = true;  
 
   if (!nameExists) {
     m_mappingIOs[className] = createFunc;
+    m_sharedMappingIOs[className] = instance;
     // if the simple (untemplated) class name hasn't been registered
     // yet, add it to the list and print a message
     if (find(m_fieldMappingNames.begin(), m_fieldMappingNames.end(),
@@ -265,20 +303,31 @@ void ClassFactory::registerFieldMappingIO(CreateFieldMappingIOFnPtr createFunc)
 FieldMappingIO::Ptr 
 ClassFactory::createFieldMappingIO(const std::string &className) const
 {
-  FieldMappingIOFuncMap::const_iterator i = m_mappingIOs.find(className);
-  if (i != m_mappingIOs.end())
-    return i->second();
+  CreateFieldMappingIOFnPtr createFunc = lookup(m_mappingIOs, className);
+  if (createFunc)
+    return createFunc();
   else
     return FieldMappingIO::Ptr();
 }
 
 //----------------------------------------------------------------------------//
 
+FieldMappingIO::Ptr 
+ClassFactory::sharedFieldMappingIO(const std::string &className) const
+{
+  return lookup(m_sharedMappingIOs, className);
+}
+
+//----------------------------------------------------------------------------//
+
 ClassFactory& 
 ClassFactory::singleton()
 { 
-  if (!ms_instance)
+  if (!ms_instance) {
     ms_instance = new ClassFactory;
+    // Plugins register with the singleton, so it has to exist first
+    PluginLoader::loadPlugins();
+  }
   return *ms_instance;
 }
 
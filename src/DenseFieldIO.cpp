@@ -41,9 +41,22 @@
 
 //----------------------------------------------------------------------------//
 
-#include "DenseFieldIO.h"
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
 
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "BlockChecksum.h"
+#include "BlockCodec.h"
+#include "DenseFieldIO.h"
+#include "InitIO.h"
 #include "OgIO.h"
+#include "Stats.h"
+#include "ThreadPool.h"
 
 //----------------------------------------------------------------------------//
 
@@ -61,11 +74,242 @@ FIELD3D_NAMESPACE_OPEN
 using namespace Exc;
 using namespace Hdf5Util;
 
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Preferred number of voxels in each compressed slab
+const size_t k_slabVoxels = 1 << 18;
+
+//! Uncompressed data of at least this many bytes starts on a page boundary,
+//! so that readers can map it
+const size_t k_pageAlignBytes = 1 << 20;
+
+//----------------------------------------------------------------------------//
+
+//! Returns the alignment, in bytes, of large uncompressed data
+size_t pageAlignment()
+{
+#ifdef WIN32
+  return 4096;
+#else
+  return std::max(4096L, static_cast<long>(sysconf(_SC_PAGESIZE)));
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+//! Compresses numVoxels values of src into dst, which is resized to fit
+//! \returns False if compression failed
+template <typename Data_T>
+bool compressSlab(const SparseCodec codec, const Data_T *src, 
+                  const size_t numVoxels, std::vector<uint8_t> &dst, 
+                  std::vector<uint8_t> &scratch)
+{
+  const size_t srcLen = numVoxels * sizeof(Data_T);
+  dst.resize(BlockCodec::compressBound(codec, srcLen));
+  size_t cmpLen = dst.size();
+  if (!BlockCodec::compress(codec, sizeof(Data_T), 
+                            reinterpret_cast<const uint8_t *>(src), srcLen, 
+                            &dst[0], cmpLen, scratch)) {
+    Msg::print(Msg::SevWarning, "Couldn't compress slab in DenseFieldIO.");
+    return false;
+  }
+  dst.resize(cmpLen);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Compresses a batch of slabs, handing out one slab at a time. Each
+//! slab's checksum is stored in the matching entry of checksums, unless it
+//! is NULL
+template <typename Data_T>
+class CompressSlabOp
+{
+public:
+  CompressSlabOp(const Data_T *data, const V3i &res, const int chunkSlices, 
+                 const SparseCodec codec, const size_t firstSlab,
+                 std::vector<std::vector<uint8_t> > &slots,
+                 std::vector<uint32_t> *checksums,
+                 boost::atomic<size_t> &nextSlot, boost::atomic<bool> &failed)
+    : m_data(data), m_res(res), m_chunkSlices(chunkSlices), m_codec(codec),
+      m_firstSlab(firstSlab), m_slots(slots), m_checksums(checksums),
+      m_nextSlot(nextSlot), m_failed(failed)
+  { }
+  void operator() ()
+  {
+    const size_t sliceLength = static_cast<size_t>(m_res.x) * m_res.y;
+    for (size_t i = m_nextSlot.fetch_add(1); i < m_slots.size() && !m_failed;
+         i = m_nextSlot.fetch_add(1)) {
+      const int first = (m_firstSlab + i) * m_chunkSlices;
+      const int last  = std::min(first + m_chunkSlices, m_res.z);
+      if (!compressSlab(m_codec, m_data + first * sliceLength, 
+                        (last - first) * sliceLength, m_slots[i], 
+                        m_scratch)) {
+        m_failed = true;
+      } else if (m_checksums) {
+        (*m_checksums)[i] = BlockChecksum::crc32c(&m_slots[i][0], 
+                                                  m_slots[i].size());
+      }
+    }
+  }
+private:
+  // Data members ---
+  const Data_T *m_data;
+  const V3i m_res;
+  const int m_chunkSlices;
+  const SparseCodec m_codec;
+  const size_t m_firstSlab;
+  std::vector<std::vector<uint8_t> > &m_slots;
+  std::vector<uint32_t> *m_checksums;
+  boost::atomic<size_t> &m_nextSlot;
+  boost::atomic<bool> &m_failed;
+  //! Scratch space for the codec
+  std::vector<uint8_t> m_scratch;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Decompresses the slabs that overlap a voxel window into the window's 
+//! voxels, handing out one slab at a time. The window is relative to the
+//! data window. Slabs are checked against their entry of checksums first,
+//! unless it is NULL.
+template <typename Data_T>
+class DecompressSlabOp
+{
+public:
+  DecompressSlabOp(const OgICDataset<Data_T> &data, const SparseCodec codec,
+                   const V3i &res, const int chunkSlices, const Box3i &window,
+                   Data_T *dst, const uint32_t *checksums, 
+                   const size_t lastSlab, boost::atomic<size_t> &nextSlab, 
+                   boost::atomic<bool> &failed, const size_t threadId)
+    : m_data(data), m_codec(codec), m_res(res), m_chunkSlices(chunkSlices), 
+      m_window(window), m_dst(dst), m_checksums(checksums), 
+      m_lastSlab(lastSlab), m_nextSlab(nextSlab), m_failed(failed), 
+      m_threadId(threadId)
+  { }
+  void setThreadId(const size_t threadId)
+  { m_threadId = threadId; }
+  void operator() ()
+  {
+    const size_t sliceLength = static_cast<size_t>(m_res.x) * m_res.y;
+    const V3i    winRes      = m_window.size() + V3i(1);
+    const bool   fullSlices  = winRes.x == m_res.x && winRes.y == m_res.y;
+    for (size_t slab = m_nextSlab.fetch_add(1); 
+         slab <= m_lastSlab && !m_failed; 
+         slab = m_nextSlab.fetch_add(1)) {
+      const int    first     = slab * m_chunkSlices;
+      const int    last      = std::min(first + m_chunkSlices, m_res.z) - 1;
+      const size_t numVoxels = (last - first + 1) * sliceLength;
+      // Slabs that lie inside the window are decompressed in place
+      const bool inPlace = fullSlices && first >= m_window.min.z && 
+        last <= m_window.max.z;
+      Data_T *target = m_dst + (first - m_window.min.z) * sliceLength;
+      if (!inPlace) {
+        m_slab.resize(numVoxels);
+        target = &m_slab[0];
+      }
+      // Decompress straight out of a mapped file, otherwise read the data 
+      // into the compression cache
+      const uint64_t length  = m_data.dataSize(slab, m_threadId);
+      const uint8_t *cmpData = m_data.mappedData(slab, m_threadId);
+      Stats::add(Stats::BytesRead, length);
+      if (!cmpData) {
+        m_cache.resize(length);
+        if (!m_data.getData(slab, &m_cache[0], m_threadId)) {
+          m_failed = true;
+          return;
+        }
+        cmpData = &m_cache[0];
+      }
+      if (m_checksums && 
+          BlockChecksum::crc32c(cmpData, length) != m_checksums[slab]) {
+        Msg::print(Msg::SevWarning, "DenseFieldIO::readChunks() found a "
+                   "slab that doesn't match its checksum.");
+        m_failed = true;
+        return;
+      }
+      if (!BlockCodec::decompress(m_codec, sizeof(Data_T), cmpData, length,
+                                  reinterpret_cast<uint8_t *>(target),
+                                  numVoxels * sizeof(Data_T), m_scratch)) {
+        m_failed = true;
+        return;
+      }
+      if (inPlace) {
+        continue;
+      }
+      // Copy the rows that overlap the window
+      const int kMin = std::max(first, m_window.min.z);
+      const int kMax = std::min(last, m_window.max.z);
+      for (int k = kMin; k <= kMax; ++k) {
+        for (int j = m_window.min.y; j <= m_window.max.y; ++j) {
+          const Data_T *src = &m_slab[0] + 
+            ((k - first) * m_res.y + j) * m_res.x + m_window.min.x;
+          Data_T *dst = m_dst + 
+            ((k - m_window.min.z) * winRes.y + (j - m_window.min.y)) * 
+            static_cast<size_t>(winRes.x);
+          std::copy(src, src + winRes.x, dst);
+        }
+      }
+    }
+  }
+private:
+  // Data members ---
+  const OgICDataset<Data_T> &m_data;
+  const SparseCodec m_codec;
+  const V3i m_res;
+  const int m_chunkSlices;
+  const Box3i m_window;
+  Data_T *m_dst;
+  const uint32_t *m_checksums;
+  const size_t m_lastSlab;
+  boost::atomic<size_t> &m_nextSlab;
+  boost::atomic<bool> &m_failed;
+  size_t m_threadId;
+  //! Voxels of a slab that only partially overlaps the window
+  std::vector<Data_T> m_slab;
+  //! Compressed data, when the file isn't mapped
+  std::vector<uint8_t> m_cache;
+  //! Scratch space for the codec
+  std::vector<uint8_t> m_scratch;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Runs a copy of a DecompressSlabOp on each thread that works on the read,
+//! with the thread's index as its thread id
+template <typename Data_T>
+class DecompressSlabTask : public ThreadPool::Task
+{
+public:
+  DecompressSlabTask(const DecompressSlabOp<Data_T> &op)
+    : m_op(op)
+  { }
+  virtual void run(const size_t threadIdx)
+  {
+    DecompressSlabOp<Data_T> op(m_op);
+    op.setThreadId(threadIdx);
+    op();
+  }
+private:
+  const DecompressSlabOp<Data_T> &m_op;
+};
+
+//----------------------------------------------------------------------------//
+
+} // Anonymous namespace
+
 //----------------------------------------------------------------------------//
 // Static members
 //----------------------------------------------------------------------------//
 
 const int         DenseFieldIO::k_versionNumber(1);
+const int         DenseFieldIO::k_compressedVersionNumber(2);
 const std::string DenseFieldIO::k_versionAttrName("version");
 const std::string DenseFieldIO::k_extentsStr("extents");
 const std::string DenseFieldIO::k_extentsMinStr("extents_min");
@@ -76,6 +320,8 @@ const std::string DenseFieldIO::k_dataWindowMaxStr("data_window_max");
 const std::string DenseFieldIO::k_componentsStr("components");
 const std::string DenseFieldIO::k_bitsPerComponentStr("bits_per_component");
 const std::string DenseFieldIO::k_dataStr("data");
+const std::string DenseFieldIO::k_codecStr("data_codec");
+const std::string DenseFieldIO::k_chunkSlicesStr("data_chunk_slices");
 
 //----------------------------------------------------------------------------//
 
@@ -83,6 +329,25 @@ FieldBase::Ptr
 DenseFieldIO::read(hid_t layerGroup, const std::string &/*filename*/, 
                    const std::string &/*layerPath*/,
                    DataTypeEnum typeEnum)
+{
+  return readInternal(layerGroup, typeEnum, NULL);
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+DenseFieldIO::readWindow(hid_t layerGroup, const std::string &/*filename*/, 
+                         const std::string &/*layerPath*/,
+                         DataTypeEnum typeEnum, const Box3i &voxelWindow)
+{
+  return readInternal(layerGroup, typeEnum, &voxelWindow);
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+DenseFieldIO::readInternal(hid_t layerGroup, DataTypeEnum typeEnum,
+                           const Box3i *voxelWindow)
 {
   Box3i extents, dataW;
   int components;
@@ -147,17 +412,23 @@ DenseFieldIO::read(hid_t layerGroup, const std::string &/*filename*/,
   isDouble = H5Tequal(dataType, H5T_NATIVE_DOUBLE);
 
   if (isHalf && components == 1 && typeEnum == DataTypeHalf)
-    result = readData<half>(dataSet.id(), extents, dataW);
+    result = readData<half>(dataSet.id(), extents, dataW, 
+                            voxelWindow);
   if (isFloat && components == 1 && typeEnum == DataTypeFloat)
-    result = readData<float>(dataSet.id(), extents, dataW);
+    result = readData<float>(dataSet.id(), extents, dataW, 
+                             voxelWindow);
   if (isDouble && components == 1 && typeEnum == DataTypeDouble)
-    result = readData<double>(dataSet.id(), extents, dataW);
+    result = readData<double>(dataSet.id(), extents, dataW, 
+                              voxelWindow);
   if (isHalf && components == 3 && typeEnum == DataTypeVecHalf)
-    result = readData<V3h>(dataSet.id(), extents, dataW);
+    result = readData<V3h>(dataSet.id(), extents, dataW, 
+                           voxelWindow);
   if (isFloat && components == 3 && typeEnum == DataTypeVecFloat)
-    result = readData<V3f>(dataSet.id(), extents, dataW);
+    result = readData<V3f>(dataSet.id(), extents, dataW, 
+                           voxelWindow);
   if (isDouble && components == 3 && typeEnum == DataTypeVecDouble)
-    result = readData<V3d>(dataSet.id(), extents, dataW);
+    result = readData<V3d>(dataSet.id(), extents, dataW, 
+                           voxelWindow);
 
   return result;
 }
@@ -167,6 +438,25 @@ DenseFieldIO::read(hid_t layerGroup, const std::string &/*filename*/,
 FieldBase::Ptr
 DenseFieldIO::read(const OgIGroup &lg, const std::string &/*filename*/, 
                    const std::string &/*layerPath*/, OgDataType typeEnum)
+{
+  return readInternal(lg, typeEnum, NULL);
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+DenseFieldIO::readWindow(const OgIGroup &lg, const std::string &/*filename*/, 
+                         const std::string &/*layerPath*/, OgDataType typeEnum,
+                         const Box3i &voxelWindow)
+{
+  return readInternal(lg, typeEnum, &voxelWindow);
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+DenseFieldIO::readInternal(const OgIGroup &lg, OgDataType typeEnum,
+                           const Box3i *voxelWindow)
 {
   Box3i extents, dataW;
 
@@ -183,7 +473,7 @@ DenseFieldIO::read(const OgIGroup &lg, const std::string &/*filename*/,
   }
 
   int version = versionAttr.value();
-  if (version != k_versionNumber) {
+  if (version != k_versionNumber && version != k_compressedVersionNumber) {
     throw UnsupportedVersionException("DenseField version not supported: " + 
                                       lexical_cast<std::string>(version));
   }
@@ -237,21 +527,22 @@ DenseFieldIO::read(const OgIGroup &lg, const std::string &/*filename*/,
 
   FieldBase::Ptr result;
   
-  OgDataType typeOnDisk = lg.datasetType(k_dataStr);
+  OgDataType typeOnDisk = version == k_compressedVersionNumber ? 
+    lg.compressedDatasetType(k_dataStr) : lg.datasetType(k_dataStr);
 
   if (typeEnum == typeOnDisk) {
     if (typeEnum == F3DFloat16) {
-      result = readData<float16_t>(lg, extents, dataW);
+      result = readData<float16_t>(lg, extents, dataW, voxelWindow);
     } else if (typeEnum == F3DFloat32) {
-      result = readData<float32_t>(lg, extents, dataW);
+      result = readData<float32_t>(lg, extents, dataW, voxelWindow);
     } else if (typeEnum == F3DFloat64) {
-      result = readData<float64_t>(lg, extents, dataW);
+      result = readData<float64_t>(lg, extents, dataW, voxelWindow);
     } else if (typeEnum == F3DVec16) {
-      result = readData<vec16_t>(lg, extents, dataW);
+      result = readData<vec16_t>(lg, extents, dataW, voxelWindow);
     } else if (typeEnum == F3DVec32) {
-      result = readData<vec32_t>(lg, extents, dataW);
+      result = readData<vec32_t>(lg, extents, dataW, voxelWindow);
     } else if (typeEnum == F3DVec64) {
-      result = readData<vec64_t>(lg, extents, dataW);
+      result = readData<vec64_t>(lg, extents, dataW, voxelWindow);
     } 
   }
 
@@ -321,9 +612,6 @@ DenseFieldIO::write(OgOGroup &layerGroup, FieldBase::Ptr field)
 {
   using namespace Exc;
 
-  // Add version attribute
-  OgOAttribute<int> version(layerGroup, k_versionAttrName, k_versionNumber);
-
   DenseField<half>::Ptr halfField = 
     field_dynamic_cast<DenseField<half> >(field);
   DenseField<float>::Ptr floatField = 
@@ -478,14 +766,47 @@ template <class Data_T>
 bool DenseFieldIO::writeInternal(OgOGroup &layerGroup, 
                                  typename DenseField<Data_T>::Ptr field)
 {
-  using namespace Exc;
+  const V3i& memSize = field->internalMemSize();
+  const int chunkSlices = writeChunkSlices(memSize);
 
-  const int    components  = FieldTraits<Data_T>::dataDims();
-  const V3i&   memSize     = field->internalMemSize();
-  const int    bits        = DataTypeTraits<Data_T>::h5bits();
-  
-  Box3i ext(field->extents()), dw(field->dataWindow());
+  writeAttributes<Data_T>(layerGroup, field->extents(), field->dataWindow(),
+                          chunkSlices);
 
+  // Add data to file ---
+
+  if (chunkSlices > 0) {
+    return writeChunks<Data_T>(layerGroup, k_dataStr, &(*field->cbegin()), 
+                               memSize, chunkSlices);
+  }
+
+  const size_t length = memSize[0] * memSize[1] * memSize[2];
+
+  OgODataset<Data_T> data(layerGroup, k_dataStr);
+  if (length * sizeof(Data_T) >= k_pageAlignBytes) {
+    data.addAlignedData(length, &(*field->cbegin()), pageAlignment());
+  } else {
+    data.addData(length, &(*field->cbegin()));
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void DenseFieldIO::writeAttributes(OgOGroup &layerGroup, const Box3i &ext, 
+                                   const Box3i &dw, const int chunkSlices)
+{
+  const int components = FieldTraits<Data_T>::dataDims();
+  const int bits       = DataTypeTraits<Data_T>::h5bits();
+
+  // Add version attribute. Compressed layers get their own version, so that
+  // older readers refuse them rather than misread them ---
+
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, 
+                            chunkSlices > 0 ? k_compressedVersionNumber : 
+                            k_versionNumber);
+  
   // Add extents attributes ---
 
   OgOAttribute<veci32_t> extMinAttr(layerGroup, k_extentsMinStr, ext.min);
@@ -504,12 +825,141 @@ bool DenseFieldIO::writeInternal(OgOGroup &layerGroup,
 
   OgOAttribute<int> bitsAttr(layerGroup, k_bitsPerComponentStr, bits);
 
-  // Add data to file ---
+  // Add the compression attributes ---
 
-  const size_t length = memSize[0] * memSize[1] * memSize[2];
+  if (chunkSlices > 0) {
+    OgOAttribute<uint8_t> codecAttr(layerGroup, k_codecStr, sparseCodec());
+    OgOAttribute<int> chunkSlicesAttr(layerGroup, k_chunkSlicesStr, 
+                                      chunkSlices);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+int DenseFieldIO::writeChunkSlices(const V3i &res)
+{
+  if (denseStorageMode() == DenseStorageRaw) {
+    return 0;
+  }
+  const size_t sliceLength = static_cast<size_t>(res.x) * res.y;
+  const size_t slices      = k_slabVoxels / std::max(sliceLength, size_t(1));
+  return static_cast<int>(std::min(std::max(slices, size_t(1)), 
+                                   static_cast<size_t>(res.z)));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool DenseFieldIO::writeChunks(OgOGroup &layerGroup, const std::string &name,
+                               const Data_T *data, const V3i &res, 
+                               const int chunkSlices)
+{
+  const SparseCodec codec      = sparseCodec();
+  const size_t      numSlabs   = (res.z + chunkSlices - 1) / chunkSlices;
+  const size_t      numThreads = numIOThreads();
+  // Compression runs a few slabs per thread ahead of the writer
+  const size_t      batchSize  = 4 * numThreads;
+
+  OgOCDataset<Data_T> dataset(layerGroup, name);
+  
+  std::vector<std::vector<uint8_t> > slots;
+  std::vector<uint32_t>              slotChecksums, checksums;
+  for (size_t first = 0; first < numSlabs; first += batchSize) {
+    slots.resize(std::min(batchSize, numSlabs - first));
+    slotChecksums.resize(slots.size());
+    boost::atomic<size_t> nextSlot(0);
+    boost::atomic<bool>   failed(false);
+    CompressSlabOp<Data_T> op(data, res, chunkSlices, codec, first, slots, 
+                              writeChecksums() ? &slotChecksums : NULL,
+                              nextSlot, failed);
+    if (slots.size() > 1) {
+      runOnThreads(op, numThreads);
+    } else {
+      op();
+    }
+    if (failed) {
+      return false;
+    }
+    for (size_t i = 0; i < slots.size(); ++i) {
+      dataset.addData(slots[i].size(), &slots[i][0]);
+    }
+    if (writeChecksums()) {
+      checksums.insert(checksums.end(), slotChecksums.begin(), 
+                       slotChecksums.end());
+    }
+  }
+
+  if (!checksums.empty()) {
+    OgODataset<uint32_t> checksumData(layerGroup, 
+                                      BlockChecksum::datasetName(name));
+    checksumData.addData(checksums.size(), &checksums[0]);
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool DenseFieldIO::writeStreamed
+(OgOGroup &layerGroup, const Box3i &extents, const Box3i &dataWindow,
+ const boost::function<void (int, Data_T *)> &fillSlice)
+{
+  using namespace Exc;
+
+  if (dataWindow.isEmpty()) {
+    throw WriteLayerException("DenseFieldIO::writeStreamed() was given an "
+                              "empty data window");
+  }
+
+  const V3i    res         = dataWindow.size() + V3i(1);
+  const size_t sliceLength = static_cast<size_t>(res.x) * res.y;
+  const int    chunkSlices = writeChunkSlices(res);
+
+  writeAttributes<Data_T>(layerGroup, extents, dataWindow, chunkSlices);
+
+  // Add compressed data to file, one slab at a time. The slabs are 
+  // compressed on the calling thread ---
+
+  if (chunkSlices > 0) {
+    const SparseCodec     codec = sparseCodec();
+    std::vector<Data_T>   slab(sliceLength * chunkSlices);
+    std::vector<uint8_t>  compressed, scratch;
+    std::vector<uint32_t> checksums;
+    OgOCDataset<Data_T>   data(layerGroup, k_dataStr);
+    for (int first = 0; first < res.z; first += chunkSlices) {
+      const int numSlices = std::min(chunkSlices, res.z - first);
+      for (int k = 0; k < numSlices; ++k) {
+        fillSlice(dataWindow.min.z + first + k, &slab[k * sliceLength]);
+      }
+      if (!compressSlab(codec, &slab[0], numSlices * sliceLength, 
+                        compressed, scratch)) {
+        return false;
+      }
+      data.addData(compressed.size(), &compressed[0]);
+      if (writeChecksums()) {
+        checksums.push_back(BlockChecksum::crc32c(&compressed[0], 
+                                                  compressed.size()));
+      }
+    }
+    if (!checksums.empty()) {
+      OgODataset<uint32_t> checksumData(layerGroup, 
+                                        BlockChecksum::datasetName(k_dataStr));
+      checksumData.addData(checksums.size(), &checksums[0]);
+    }
+    return true;
+  }
+
+  // Add raw data to file, one slice at a time ---
+
+  std::vector<Data_T> slice(sliceLength);
 
   OgODataset<Data_T> data(layerGroup, k_dataStr);
-  data.addData(length, &(*field->begin()));
+  data.beginStreamedData(sliceLength * res.z);
+  for (int k = dataWindow.min.z; k <= dataWindow.max.z; ++k) {
+    fillSlice(k, &slice[0]);
+    data.streamData(sliceLength, &slice[0]);
+  }
 
   return true;
 }
@@ -523,6 +973,14 @@ bool DenseFieldIO::writeData(hid_t dataSet,
 { 
   using namespace Hdf5Util;
 
+  // The data set is in the native type, so the field's chunks can be 
+  // deflated straight out of it
+  const size_t elementSize = sizeof(Data_T) / FieldTraits<Data_T>::dataDims();
+  if (hdf5ParallelDeflate() && 
+      writeDeflatedChunks(dataSet, elementSize, &(*field->begin()))) {
+    return true;
+  }
+
   hid_t err = H5Dwrite(dataSet, 
                        DataTypeTraits<Data_T>::h5type(), 
                        H5S_ALL, H5S_ALL, 
@@ -540,16 +998,77 @@ bool DenseFieldIO::writeData(hid_t dataSet,
 
 template <class Data_T>
 typename DenseField<Data_T>::Ptr 
-DenseFieldIO::readData(hid_t dataSet, const Box3i &extents, const Box3i &dataW)
+DenseFieldIO::readData(hid_t dataSet, const Box3i &extents, const Box3i &dataW,
+                       const Box3i *voxelWindow)
 {
   typename DenseField<Data_T>::Ptr field(new DenseField<Data_T>);
-  field->setSize(extents, dataW);
+
+  const std::string typeName = "DenseField<" + 
+    DataTypeTraits<Data_T>::name() + ">";
+
+  if (!voxelWindow) {
+    field->setSize(extents, dataW);
+    // The data set is in the native type, so its raw chunks can be inflated
+    // straight into the field
+    const size_t elementSize = sizeof(Data_T) / FieldTraits<Data_T>::dataDims();
+    if (hdf5ParallelInflate() && 
+        readDeflatedChunks(dataSet, elementSize, &(*field->begin()))) {
+      return field;
+    }
+    if (H5Dread(dataSet, DataTypeTraits<Data_T>::h5type(), 
+                H5S_ALL, H5S_ALL, H5P_DEFAULT, &(*field->begin())) < 0) 
+    {
+      throw Exc::Hdf5DataReadException("Couldn't read " + typeName + " data");
+    } 
+    return field;
+  }
+
+  // Only the overlap with the window is allocated and read. A layer that
+  // misses the window is skipped
+  const Box3i window = clipBounds(*voxelWindow, dataW);
+  if (window.isEmpty()) {
+    return typename DenseField<Data_T>::Ptr();
+  }
+  field->setSize(extents, window);
+
+  // The data set is one-dimensional, with the components of each voxel next
+  // to each other. Each z slice of the window is a strided selection of 
+  // rows, and the slices are combined into a single selection
+  const hsize_t components = FieldTraits<Data_T>::dataDims();
+  const V3i     res        = dataW.size() + V3i(1);
+  const V3i     winRes     = window.size() + V3i(1);
+
+  Hdf5Util::H5ScopedDget_space fileDataSpace(dataSet);
+  if (fileDataSpace.id() < 0) {
+    throw Exc::GetDataSpaceException("Couldn't get data space");
+  }
+
+  for (int k = window.min.z; k <= window.max.z; ++k) {
+    hsize_t offset[1], stride[1], count[1], block[1];
+    offset[0] = ((static_cast<hsize_t>(k - dataW.min.z) * res.y + 
+                  (window.min.y - dataW.min.y)) * res.x + 
+                 (window.min.x - dataW.min.x)) * components;
+    stride[0] = static_cast<hsize_t>(res.x) * components;
+    count[0]  = winRes.y;
+    block[0]  = static_cast<hsize_t>(winRes.x) * components;
+    if (H5Sselect_hyperslab(fileDataSpace.id(), 
+                            k == window.min.z ? H5S_SELECT_SET : H5S_SELECT_OR,
+                            offset, stride, count, block) < 0) {
+      throw Exc::ReadHyperSlabException("Couldn't select hyperslab of " + 
+                                        typeName);
+    }
+  }
+
+  hsize_t memDims[1];
+  memDims[0] = static_cast<hsize_t>(winRes.x) * winRes.y * winRes.z * 
+    components;
+  Hdf5Util::H5ScopedScreate memDataSpace(H5S_SIMPLE);
+  H5Sset_extent_simple(memDataSpace.id(), 1, memDims, NULL);
 
   if (H5Dread(dataSet, DataTypeTraits<Data_T>::h5type(), 
-              H5S_ALL, H5S_ALL, H5P_DEFAULT, &(*field->begin())) < 0) 
+              memDataSpace.id(), fileDataSpace.id(), H5P_DEFAULT, 
+              &(*field->begin())) < 0) 
   {
-    std::string typeName = "DenseField<" + 
-      DataTypeTraits<Data_T>::name() + ">";
     throw Exc::Hdf5DataReadException("Couldn't read " + typeName + " data");
   } 
 
@@ -561,10 +1080,17 @@ DenseFieldIO::readData(hid_t dataSet, const Box3i &extents, const Box3i &dataW)
 template <class Data_T>
 typename DenseField<Data_T>::Ptr 
 DenseFieldIO::readData(const OgIGroup &layerGroup, const Box3i &extents, 
-                       const Box3i &dataW)
+                       const Box3i &dataW, const Box3i *voxelWindow)
 {
   typename DenseField<Data_T>::Ptr field(new DenseField<Data_T>);
-  field->setSize(extents, dataW);
+
+  // Compressed layers are read slab by slab
+  OgIAttribute<int> chunkSlicesAttr = 
+    layerGroup.findAttribute<int>(k_chunkSlicesStr);
+  if (chunkSlicesAttr.isValid()) {
+    return readCompressedData<Data_T>(layerGroup, extents, dataW, voxelWindow, 
+                                      chunkSlicesAttr.value());
+  }
 
   // Open the dataset
   OgIDataset<Data_T> data = layerGroup.findDataset<Data_T>(k_dataStr);
@@ -574,9 +1100,102 @@ DenseFieldIO::readData(const OgIGroup &layerGroup, const Box3i &extents,
   }
 
   // Read the data
-  if (!data.getData(0, &(*field->begin()), OGAWA_THREAD)) {
-    throw Exc::ReadDataException("DenseFieldIO::readData() couldn't read "
-                                 "the dataset.");
+  if (!voxelWindow) {
+    // Point at the mapped file, if the data can be used in place
+    const V3i dataRes = dataW.size() + V3i(1);
+    const Alembic::Util::uint64_t numVoxels = 
+      static_cast<Alembic::Util::uint64_t>(dataRes.x) * dataRes.y * dataRes.z;
+    if (mapDenseLayers() && data.dataSize(0, OGAWA_THREAD) == numVoxels) {
+      boost::shared_ptr<const Data_T> mapped = 
+        data.sharedMappedData(0, OGAWA_THREAD);
+      if (mapped) {
+        field->setMappedData(extents, dataW, mapped.get(), mapped);
+        return field;
+      }
+    }
+    field->setSize(extents, dataW);
+    if (!data.getData(0, &(*field->begin()), OGAWA_THREAD)) {
+      throw Exc::ReadDataException("DenseFieldIO::readData() couldn't read "
+                                   "the dataset.");
+    }
+    Stats::add(Stats::BytesRead, numVoxels * sizeof(Data_T));
+    return field;
+  }
+
+  // Only the overlap with the window is allocated and read. A layer that
+  // misses the window is skipped
+  const Box3i window = clipBounds(*voxelWindow, dataW);
+  if (window.isEmpty()) {
+    return typename DenseField<Data_T>::Ptr();
+  }
+  field->setSize(extents, window);
+
+  const V3i res    = dataW.size() + V3i(1);
+  const V3i winRes = window.size() + V3i(1);
+  
+  // Rows that span the full width of the data window are contiguous on disk,
+  // as are slices that span its full height, so read those in one go
+  const bool fullRows   = winRes.x == res.x;
+  const bool fullSlices = fullRows && winRes.y == res.y;
+  const int  numRows    = fullSlices ? 1 : (fullRows ? winRes.z : 
+                                            winRes.y * winRes.z);
+  const Alembic::Util::uint64_t runLength = 
+    fullSlices ? static_cast<Alembic::Util::uint64_t>(winRes.x) * 
+                 winRes.y * winRes.z :
+    (fullRows ? static_cast<Alembic::Util::uint64_t>(winRes.x) * winRes.y :
+     winRes.x);
+
+  Data_T *dst = &(*field->begin());
+  for (int row = 0; row < numRows; ++row) {
+    const int j = fullRows ? window.min.y : window.min.y + row % winRes.y;
+    const int k = fullSlices ? window.min.z : 
+      (fullRows ? window.min.z + row : window.min.z + row / winRes.y);
+    const Alembic::Util::uint64_t first = 
+      (static_cast<Alembic::Util::uint64_t>(k - dataW.min.z) * res.y + 
+       (j - dataW.min.y)) * res.x + (window.min.x - dataW.min.x);
+    if (!data.getData(0, dst, first, runLength, OGAWA_THREAD)) {
+      throw Exc::ReadDataException("DenseFieldIO::readData() couldn't read "
+                                   "the dataset.");
+    }
+    dst += runLength;
+  }
+  Stats::add(Stats::BytesRead, numRows * runLength * sizeof(Data_T));
+
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename DenseField<Data_T>::Ptr 
+DenseFieldIO::readCompressedData(const OgIGroup &layerGroup, 
+                                 const Box3i &extents, const Box3i &dataW, 
+                                 const Box3i *voxelWindow, 
+                                 const int chunkSlices)
+{
+  typename DenseField<Data_T>::Ptr field(new DenseField<Data_T>);
+
+  OgIAttribute<uint8_t> codecAttr = layerGroup.findAttribute<uint8_t>(k_codecStr);
+  if (!codecAttr.isValid() || !BlockCodec::isValid(codecAttr.value())) {
+    throw Exc::ReadDataException("DenseFieldIO::readData() found an "
+                                 "unknown codec.");
+  }
+  const SparseCodec codec = static_cast<SparseCodec>(codecAttr.value());
+
+  // Only the overlap with the window is allocated and read. A layer that
+  // misses the window is skipped
+  const Box3i window = voxelWindow ? clipBounds(*voxelWindow, dataW) : dataW;
+  if (voxelWindow && window.isEmpty()) {
+    return typename DenseField<Data_T>::Ptr();
+  }
+  field->setSize(extents, window);
+
+  const V3i   res = dataW.size() + V3i(1);
+  const Box3i localWindow(window.min - dataW.min, window.max - dataW.min);
+  if (!readChunks<Data_T>(layerGroup, k_dataStr, codec, res, chunkSlices, 
+                          localWindow, &(*field->begin()))) {
+    throw Exc::ReadDataException("DenseFieldIO::readData() couldn't "
+                                 "decompress the dataset.");
   }
 
   return field;
@@ -584,6 +1203,109 @@ DenseFieldIO::readData(const OgIGroup &layerGroup, const Box3i &extents,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+bool DenseFieldIO::readChunks(const OgIGroup &layerGroup, 
+                              const std::string &name, 
+                              const SparseCodec codec, const V3i &res, 
+                              const int chunkSlices, const Box3i &window, 
+                              Data_T *dst)
+{
+  if (chunkSlices < 1) {
+    Msg::print(Msg::SevWarning, "DenseFieldIO::readChunks() found an "
+               "invalid slab size.");
+    return false;
+  }
+  const size_t numSlabs = (res.z + chunkSlices - 1) / chunkSlices;
+
+  // Open the dataset
+  OgICDataset<Data_T> data = layerGroup.findCompressedDataset<Data_T>(name);
+  if (!data.isValid()) {
+    Msg::print(Msg::SevWarning, "DenseFieldIO::readChunks() couldn't open "
+               "the dataset " + name);
+    return false;
+  }
+  if (data.numDataElements() != numSlabs) {
+    Msg::print(Msg::SevWarning, "DenseFieldIO::readChunks() found the wrong "
+               "number of slabs in " + name);
+    return false;
+  }
+
+  // Slabs are checked against their checksums, if asked to and there are
+  // any
+  std::vector<uint32_t> checksums;
+  if (verifyChecksums()) {
+    OgIDataset<uint32_t> checksumData = 
+      layerGroup.findDataset<uint32_t>(BlockChecksum::datasetName(name));
+    if (checksumData.isValid()) {
+      checksums.resize(numSlabs);
+      if (checksumData.dataSize(0, OGAWA_THREAD) != numSlabs || 
+          !checksumData.getData(0, &checksums[0], OGAWA_THREAD)) {
+        Msg::print(Msg::SevWarning, "DenseFieldIO::readChunks() couldn't "
+                   "read the checksums of " + name);
+        return false;
+      }
+    }
+  }
+
+  // Decompress the overlapping slabs on numIOThreads() threads
+  const size_t firstSlab  = window.min.z / chunkSlices;
+  const size_t lastSlab   = window.max.z / chunkSlices;
+  const size_t numThreads = std::min(numIOThreads(), 
+                                     lastSlab - firstSlab + 1);
+
+  boost::atomic<size_t> nextSlab(firstSlab);
+  boost::atomic<bool>   failed(false);
+  DecompressSlabOp<Data_T> op(data, codec, res, chunkSlices, window, dst,
+                              checksums.empty() ? NULL : &checksums[0],
+                              lastSlab, nextSlab, failed, OGAWA_THREAD);
+  if (numThreads > 1) {
+    DecompressSlabTask<Data_T> task(op);
+    ThreadPool::singleton().run(task, numThreads);
+  } else {
+    op();
+  }
+
+  return !failed;
+}
+
+//----------------------------------------------------------------------------//
+// Template instantiations
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_WRITESTREAMED(type)                       \
+  template                                                              \
+  bool DenseFieldIO::writeStreamed<type>                                \
+  (OgOGroup &, const Box3i &, const Box3i &,                            \
+   const boost::function<void (int, type *)> &);                        \
+
+FIELD3D_INSTANTIATION_WRITESTREAMED(float16_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(float32_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(float64_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec16_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec32_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec64_t);
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_CHUNKS(type)                              \
+  template                                                              \
+  bool DenseFieldIO::writeChunks<type>                                  \
+  (OgOGroup &, const std::string &, const type *, const V3i &,          \
+   const int);                                                          \
+  template                                                              \
+  bool DenseFieldIO::readChunks<type>                                   \
+  (const OgIGroup &, const std::string &, const SparseCodec,            \
+   const V3i &, const int, const Box3i &, type *);                      \
+
+FIELD3D_INSTANTIATION_CHUNKS(float16_t);
+FIELD3D_INSTANTIATION_CHUNKS(float32_t);
+FIELD3D_INSTANTIATION_CHUNKS(float64_t);
+FIELD3D_INSTANTIATION_CHUNKS(vec16_t);
+FIELD3D_INSTANTIATION_CHUNKS(vec32_t);
+FIELD3D_INSTANTIATION_CHUNKS(vec64_t);
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_SOURCE_CLOSE
 
 //----------------------------------------------------------------------------//
@@ -50,13 +50,23 @@
 #include <unistd.h>
 #endif
 
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/utility.hpp>
 
+#include "BlockChecksum.h"
 #include "Field.h"
 #include "FieldCache.h"
 #include "Field3DFileHDF5.h"
+#include "InitIO.h"
 #include "ClassFactory.h"
+#include "DenseFieldIO.h"
+#include "MACFieldIO.h"
 #include "OArchive.h"
 #include "OgIAttribute.h"
 #include "OgIDataset.h"
@@ -64,6 +74,13 @@
 #include "OgOAttribute.h"
 #include "OgODataset.h"
 #include "OgOGroup.h"
+#include "PatternMatch.h"
+#include "SparseAtlas.h"
+#include "SparseFieldIO.h"
+#include "Stats.h"
+#include "StreamSource.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 
 //----------------------------------------------------------------------------//
 
@@ -92,6 +109,28 @@ namespace {
   const std::string k_versionAttrName("version_number");
   const std::string k_classNameAttrName("class_name");
   const std::string k_mappingTypeAttrName("mapping_type");
+  const std::string k_layerIndexStr("field3d_layer_index");
+  const std::string k_layerIndexNamesStr("field3d_layer_index_names");
+  const std::string k_atlasGroupStr("sparse_atlas");
+  const std::string k_atlasLevelsStr("levels");
+  const std::string k_atlasLevelStr("level");
+  const std::string k_atlasDataWindowMinStr("data_window_min");
+  const std::string k_atlasDataWindowMaxStr("data_window_max");
+  const std::string k_atlasBlockOrderStr("block_order");
+  const std::string k_atlasPaddingStr("padding");
+  const std::string k_atlasBrickResStr("brick_res");
+  const std::string k_atlasIndirectionStr("indirection");
+  const std::string k_atlasEmptyValuesStr("empty_values");
+  const std::string k_atlasVoxelsStr("voxels");
+
+  //! The layer index is a dataset of int32 whose first element holds the
+  //! version, the number of layers and the number of columns, and whose 
+  //! second element holds one row per layer: the child indices of the 
+  //! partition, mapping and layer groups, the data type and the data window.
+  //! The partition, layer and class names of each layer are stored as 
+  //! 0-terminated strings in a separate dataset of uint8.
+  const int k_layerIndexVersion = 1;
+  const int k_layerIndexColumns = 10;
 
   //! This version is stored in every file to determine which library version
   //! produced it.
@@ -200,7 +239,7 @@ namespace {
     }
     const std::string className = mappingAttr.value();
 
-    FieldMappingIO::Ptr io = factory.createFieldMappingIO(className);
+    FieldMappingIO::Ptr io = factory.sharedFieldMappingIO(className);
     assert(io != 0);
     if (!io) {
       Msg::print(Msg::SevWarning, "Unable to find class type: " + className);
@@ -224,7 +263,7 @@ namespace {
   {
     ClassFactory &factory = ClassFactory::singleton();
     
-    FieldIO::Ptr io = factory.createFieldIO(field->className());
+    FieldIO::Ptr io = factory.sharedFieldIO(field->className());
     assert(io != 0);
     if (!io) {
       Msg::print(Msg::SevWarning, "Unable to find class type: " + 
@@ -242,18 +281,663 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Writes brick atlases as a group of a layer. Each atlas gets a group 
+  //! of its own, holding its layout as attributes and its indirection 
+  //! table, empty values and voxels as datasets.
+  template <class Data_T>
+  bool writeAtlasGroup(OgOGroup &layerGroup, 
+                       const typename SparseAtlas<Data_T>::Vec &atlases)
+  {
+    OgOGroup atlasGroup(layerGroup, k_atlasGroupStr);
+    OgOAttribute<uint32_t> numLevelsAttr(atlasGroup, k_atlasLevelsStr, 
+                                         atlases.size());
+    bool success = true;
+    for (size_t i = 0; i < atlases.size(); ++i) {
+      const SparseAtlas<Data_T> &atlas = *atlases[i];
+      OgOGroup levelGroup(atlasGroup, k_atlasLevelStr + "." + 
+                          boost::lexical_cast<std::string>(i));
+      OgOAttribute<veci32_t> dwMinAttr(levelGroup, k_atlasDataWindowMinStr,
+                                       atlas.dataWindow().min);
+      OgOAttribute<veci32_t> dwMaxAttr(levelGroup, k_atlasDataWindowMaxStr,
+                                       atlas.dataWindow().max);
+      OgOAttribute<int> blockOrderAttr(levelGroup, k_atlasBlockOrderStr, 
+                                       atlas.blockOrder());
+      OgOAttribute<int> paddingAttr(levelGroup, k_atlasPaddingStr, 
+                                    atlas.padding());
+      OgOAttribute<veci32_t> brickResAttr(levelGroup, k_atlasBrickResStr, 
+                                          atlas.brickRes());
+      // Indirection table and empty values, one element each
+      OgODataset<int32_t> indirectionData(levelGroup, k_atlasIndirectionStr);
+      indirectionData.addData(atlas.indirection().size(), 
+                              &atlas.indirection()[0]);
+      OgODataset<Data_T> emptyValueData(levelGroup, k_atlasEmptyValuesStr);
+      emptyValueData.addData(atlas.emptyValues().size(), 
+                             &atlas.emptyValues()[0]);
+      // Voxels, as one element. Atlases without bricks have none
+      OgODataset<Data_T> voxelData(levelGroup, k_atlasVoxelsStr);
+      if (!atlas.voxels().empty()) {
+        voxelData.addData(atlas.voxels().size(), &atlas.voxels()[0]);
+      }
+      success = levelGroup.writePackedAttributes() && success;
+    }
+    return atlasGroup.writePackedAttributes() && success;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads the brick atlases written by writeAtlasGroup()
+  //! \returns An empty vector if there are none, or they are incomplete
+  template <class Data_T>
+  typename SparseAtlas<Data_T>::Vec 
+  readAtlasGroup(const OgIGroup &layerGroup)
+  {
+    typedef typename SparseAtlas<Data_T>::Vec AtlasList;
+
+    const OgIGroup atlasGroup = layerGroup.findGroup(k_atlasGroupStr);
+    if (!atlasGroup.isValid()) {
+      return AtlasList();
+    }
+    const OgIAttribute<uint32_t> numLevelsAttr = 
+      atlasGroup.findAttribute<uint32_t>(k_atlasLevelsStr);
+    if (!numLevelsAttr.isValid()) {
+      return AtlasList();
+    }
+
+    AtlasList atlases;
+    for (uint32_t i = 0; i < numLevelsAttr.value(); ++i) {
+      const OgIGroup levelGroup = 
+        atlasGroup.findGroup(k_atlasLevelStr + "." + 
+                             boost::lexical_cast<std::string>(i));
+      if (!levelGroup.isValid()) {
+        return AtlasList();
+      }
+      const OgIAttribute<veci32_t> dwMinAttr = 
+        levelGroup.findAttribute<veci32_t>(k_atlasDataWindowMinStr);
+      const OgIAttribute<veci32_t> dwMaxAttr = 
+        levelGroup.findAttribute<veci32_t>(k_atlasDataWindowMaxStr);
+      const OgIAttribute<int> blockOrderAttr = 
+        levelGroup.findAttribute<int>(k_atlasBlockOrderStr);
+      const OgIAttribute<int> paddingAttr = 
+        levelGroup.findAttribute<int>(k_atlasPaddingStr);
+      const OgIAttribute<veci32_t> brickResAttr = 
+        levelGroup.findAttribute<veci32_t>(k_atlasBrickResStr);
+      const OgIDataset<int32_t> indirectionData = 
+        levelGroup.findDataset<int32_t>(k_atlasIndirectionStr);
+      const OgIDataset<Data_T> emptyValueData = 
+        levelGroup.findDataset<Data_T>(k_atlasEmptyValuesStr);
+      const OgIDataset<Data_T> voxelData = 
+        levelGroup.findDataset<Data_T>(k_atlasVoxelsStr);
+      if (!dwMinAttr.isValid() || !dwMaxAttr.isValid() || 
+          !blockOrderAttr.isValid() || !paddingAttr.isValid() || 
+          !brickResAttr.isValid() || !indirectionData.isValid() || 
+          !emptyValueData.isValid() || !voxelData.isValid() ||
+          indirectionData.numDataElements() != 1 || 
+          emptyValueData.numDataElements() != 1) {
+        return AtlasList();
+      }
+      std::vector<int>    indirection(indirectionData.dataSize(0, 
+                                                               OGAWA_THREAD));
+      std::vector<Data_T> emptyValues(emptyValueData.dataSize(0, 
+                                                              OGAWA_THREAD));
+      std::vector<Data_T> voxels;
+      if (indirection.empty() || emptyValues.empty() ||
+          !indirectionData.getData(0, &indirection[0], OGAWA_THREAD) ||
+          !emptyValueData.getData(0, &emptyValues[0], OGAWA_THREAD)) {
+        return AtlasList();
+      }
+      if (voxelData.numDataElements() > 0) {
+        voxels.resize(voxelData.dataSize(0, OGAWA_THREAD));
+        if (voxels.empty() || 
+            !voxelData.getData(0, &voxels[0], OGAWA_THREAD)) {
+          return AtlasList();
+        }
+      }
+      typename SparseAtlas<Data_T>::Ptr atlas(new SparseAtlas<Data_T>);
+      if (!atlas->setData(Box3i(dwMinAttr.value(), dwMaxAttr.value()), 
+                          blockOrderAttr.value(), paddingAttr.value(), 
+                          brickResAttr.value(), indirection, emptyValues, 
+                          voxels)) {
+        return AtlasList();
+      }
+      atlases.push_back(atlas);
+    }
+    return atlases;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the data of a layer like writeField(), followed by the brick 
+  //! atlases of SparseFields and MIP fields of SparseFields if padding 
+  //! isn't negative
+  template <class Data_T>
+  bool writeFieldAndAtlases
+  (OgOGroup &layerGroup, typename Field<Data_T>::Ptr field, 
+   const int padding, SparseFieldIO::PrecompressedBlocks::Ptr precompressed)
+  {
+    typename SparseField<Data_T>::Ptr sparse = 
+      field_dynamic_cast<SparseField<Data_T> >(field);
+    if (sparse && precompressed) {
+      OgOAttribute<string>(layerGroup, k_classNameAttrName, 
+                           field->className());
+      if (!SparseFieldIO::writePrecompressed<Data_T>(layerGroup, sparse,
+                                                     *precompressed)) {
+        return false;
+      }
+    } else if (!writeField(layerGroup, field)) {
+      return false;
+    }
+    if (padding < 0) {
+      return true;
+    }
+    typename SparseAtlas<Data_T>::Vec atlases;
+    if (sparse) {
+      atlases.push_back(typename SparseAtlas<Data_T>::Ptr
+                        (new SparseAtlas<Data_T>(*sparse, padding)));
+    } else if (typename MIPField<SparseField<Data_T> >::Ptr mip = 
+               field_dynamic_cast<MIPField<SparseField<Data_T> > >(field)) {
+      atlases = makeSparseAtlases(*mip, padding);
+    }
+    if (atlases.empty()) {
+      return true;
+    }
+    return writeAtlasGroup<Data_T>(layerGroup, atlases);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the class name attribute and the voxels of a dense layer that
+  //! is streamed to disk
+  template <class Data_T>
+  bool writeStreamedDense(OgOGroup &layerGroup, FieldRes::Ptr layout,
+                          const boost::function<void (int, Data_T *)> &fill)
+  {
+    OgOAttribute<string>(layerGroup, k_classNameAttrName, 
+                         DenseField<Data_T>::staticClassName());
+
+    return DenseFieldIO::writeStreamed<Data_T>(layerGroup, layout->extents(),
+                                               layout->dataWindow(), fill);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the class name attribute and the voxels of a sparse layer that
+  //! is streamed to disk
+  template <class Data_T>
+  bool writeStreamedSparse
+  (OgOGroup &layerGroup, FieldRes::Ptr layout, const int blockOrder,
+   const boost::function<bool (const V3i &, Data_T *, Data_T &)> &fill)
+  {
+    OgOAttribute<string>(layerGroup, k_classNameAttrName, 
+                         SparseField<Data_T>::staticClassName());
+
+    return SparseFieldIO::writeStreamed<Data_T>(layerGroup, layout->extents(),
+                                                layout->dataWindow(), 
+                                                blockOrder, fill);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! One child of a group copied by copyLayerGroup(), in depth-first order
+  struct CopyNode
+  {
+    enum Type {
+      Group,
+      EmptyGroup,
+      Data,
+      EmptyData
+    };
+    Type   type;
+    //! Number of children of a group
+    size_t numChildren;
+    //! Index of a data child in CopyState::data
+    size_t dataIdx;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Lists the children of a group, and theirs, in the order they're written
+  void listCopyNodes(Alembic::Ogawa::IGroupPtr group, 
+                     std::vector<CopyNode> &nodes,
+                     std::vector<Alembic::Ogawa::IDataPtr> &data)
+  {
+    const size_t numChildren = group->getNumChildren();
+    for (size_t i = 0; i < numChildren; ++i) {
+      CopyNode node;
+      node.numChildren = 0;
+      node.dataIdx     = 0;
+      if (group->isEmptyChildGroup(i)) {
+        node.type = CopyNode::EmptyGroup;
+        nodes.push_back(node);
+      } else if (group->isChildGroup(i)) {
+        Alembic::Ogawa::IGroupPtr child = group->getGroup(i, false, 
+                                                          OGAWA_THREAD);
+        node.type        = CopyNode::Group;
+        node.numChildren = child->getNumChildren();
+        nodes.push_back(node);
+        listCopyNodes(child, nodes, data);
+      } else if (group->isEmptyChildData(i)) {
+        node.type = CopyNode::EmptyData;
+        nodes.push_back(node);
+      } else {
+        node.type    = CopyNode::Data;
+        node.dataIdx = data.size();
+        nodes.push_back(node);
+        data.push_back(group->getData(i, OGAWA_THREAD));
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Data read ahead of the writer by CopyReadOp. Reading runs at most 
+  //! numSlots data children ahead of writing.
+  struct CopyState
+  {
+    CopyState(const std::vector<Alembic::Ogawa::IDataPtr> &i_data, 
+              const size_t i_numSlots)
+      : data(i_data), numSlots(i_numSlots), slots(i_numSlots), 
+        slotIsReady(i_numSlots, false), nextToRead(0), nextToWrite(0),
+        failed(false)
+    { }
+    const std::vector<Alembic::Ogawa::IDataPtr> &data;
+    const size_t numSlots;
+    //! Bytes of each data child, indexed by data index % numSlots. Left 
+    //! empty for data that can be taken straight from the mapped file
+    std::vector<std::vector<uint8_t> > slots;
+    std::vector<bool> slotIsReady;
+    //! Next data child to read. Claimed without locking
+    boost::atomic<size_t> nextToRead;
+    //! Next data child to write. Guarded by mutex
+    size_t nextToWrite;
+    //! Set if any read failed. Guarded by mutex
+    bool failed;
+    boost::mutex mutex;
+    boost::condition_variable slotReady;
+    boost::condition_variable slotFree;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Reads data children into the slots of a CopyState
+  class CopyReadOp
+  {
+  public:
+    CopyReadOp(CopyState &state)
+      : m_state(state)
+    { }
+    void operator() ()
+    {
+      const size_t numData = m_state.data.size();
+      for (size_t i = m_state.nextToRead.fetch_add(1); i < numData; 
+           i = m_state.nextToRead.fetch_add(1)) {
+        const size_t slot = i % m_state.numSlots;
+        // Wait for the slot to be written out
+        {
+          boost::mutex::scoped_lock lock(m_state.mutex);
+          while (!m_state.failed && 
+                 i >= m_state.nextToWrite + m_state.numSlots) {
+            m_state.slotFree.wait(lock);
+          }
+          if (m_state.failed) {
+            return;
+          }
+        }
+        // The slot belongs to this thread until it is marked as ready
+        bool success = true;
+        try {
+          const Alembic::Ogawa::IDataPtr &data = m_state.data[i];
+          std::vector<uint8_t> &bytes = m_state.slots[slot];
+          if (data->getMappedData()) {
+            data->willNeed();
+          } else if (data->getSize() > 0) {
+            bytes.resize(data->getSize());
+            data->read(bytes.size(), &bytes[0], 0, OGAWA_THREAD);
+          }
+        }
+        catch (std::exception &) {
+          success = false;
+        }
+        // Hand the data to the writer
+        boost::mutex::scoped_lock lock(m_state.mutex);
+        if (!success) {
+          m_state.failed = true;
+          m_state.slotReady.notify_all();
+          m_state.slotFree.notify_all();
+          return;
+        }
+        m_state.slotIsReady[slot] = true;
+        m_state.slotReady.notify_all();
+      }
+    }
+  private:
+    CopyState &m_state;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  size_t writeCopyChildren(const std::vector<CopyNode> &nodes, size_t pos, 
+                           const size_t numChildren, 
+                           Alembic::Ogawa::OGroupPtr dst, CopyState &state);
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes nodes[pos], and its children if it is a group, to dst. Data 
+  //! comes from the slots filled in by CopyReadOp.
+  //! \returns The position of the next node to write, or the number of 
+  //! nodes if a read failed
+  size_t writeCopyNode(const std::vector<CopyNode> &nodes, size_t pos, 
+                       Alembic::Ogawa::OGroupPtr dst, CopyState &state)
+  {
+    const CopyNode &node = nodes[pos++];
+    switch (node.type) {
+    case CopyNode::EmptyGroup:
+      dst->addEmptyGroup();
+      break;
+    case CopyNode::EmptyData:
+      dst->addEmptyData();
+      break;
+    case CopyNode::Group:
+      pos = writeCopyChildren(nodes, pos, node.numChildren, dst->addGroup(), 
+                              state);
+      break;
+    case CopyNode::Data:
+      {
+        const size_t slot = node.dataIdx % state.numSlots;
+        {
+          boost::mutex::scoped_lock lock(state.mutex);
+          while (!state.failed && !state.slotIsReady[slot]) {
+            state.slotReady.wait(lock);
+          }
+          if (state.failed) {
+            return nodes.size();
+          }
+        }
+        const Alembic::Ogawa::IDataPtr &data  = state.data[node.dataIdx];
+        std::vector<uint8_t>           &bytes = state.slots[slot];
+        const void *mapped = data->getMappedData();
+        dst->addData(data->getSize(), 
+                     mapped ? mapped : (bytes.empty() ? NULL : &bytes[0]));
+        // Release the slot
+        std::vector<uint8_t>().swap(bytes);
+        boost::mutex::scoped_lock lock(state.mutex);
+        state.slotIsReady[slot] = false;
+        state.nextToWrite++;
+        state.slotFree.notify_all();
+      }
+      break;
+    }
+    return pos;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes the numChildren nodes starting at nodes[pos] to dst
+  //! \returns The position of the next node to write
+  size_t writeCopyChildren(const std::vector<CopyNode> &nodes, size_t pos, 
+                           const size_t numChildren, 
+                           Alembic::Ogawa::OGroupPtr dst, CopyState &state)
+  {
+    for (size_t c = 0; c < numChildren && pos < nodes.size(); ++c) {
+      pos = writeCopyNode(nodes, pos, dst, state);
+    }
+    return pos;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Sums the sizes of the data in a group and its children
+  uint64_t groupDataBytes(Alembic::Ogawa::IGroupPtr group)
+  {
+    uint64_t bytes = 0;
+    for (size_t i = 0, end = group->getNumChildren(); i < end; ++i) {
+      if (group->isEmptyChildGroup(i) || group->isEmptyChildData(i)) {
+        continue;
+      }
+      if (group->isChildGroup(i)) {
+        bytes += groupDataBytes(group->getGroup(i, false, OGAWA_THREAD));
+      } else {
+        bytes += group->getData(i, OGAWA_THREAD)->getSize();
+      }
+    }
+    return bytes;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Checks the elements of a compressed dataset against their checksums,
+  //! handing out one element at a time
+  template <typename T>
+  class VerifyChecksumsTask : public ThreadPool::Task
+  {
+  public:
+    VerifyChecksumsTask(const OgICDataset<T> &data, 
+                        const std::vector<uint32_t> &checksums)
+      : m_data(data), m_checksums(checksums), m_nextElement(0), 
+        m_numCorrupt(0)
+    { }
+    virtual void run(const size_t threadIdx)
+    {
+      std::vector<uint8_t> cache;
+      for (size_t i = m_nextElement.fetch_add(1); i < m_checksums.size(); 
+           i = m_nextElement.fetch_add(1)) {
+        const uint64_t length = m_data.dataSize(i, threadIdx);
+        if (length == OGAWA_INVALID_DATASET_INDEX) {
+          m_numCorrupt++;
+          continue;
+        }
+        const uint8_t *bytes = m_data.mappedData(i, threadIdx);
+        if (!bytes && length > 0) {
+          cache.resize(length);
+          m_data.getData(i, &cache[0], threadIdx);
+          bytes = &cache[0];
+        }
+        Stats::add(Stats::BytesRead, length);
+        if (BlockChecksum::crc32c(bytes, length) != m_checksums[i]) {
+          m_numCorrupt++;
+        }
+      }
+    }
+    size_t numCorrupt() const
+    { return m_numCorrupt; }
+  private:
+    const OgICDataset<T>        &m_data;
+    const std::vector<uint32_t> &m_checksums;
+    boost::atomic<size_t>        m_nextElement;
+    boost::atomic<size_t>        m_numCorrupt;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Checks a compressed dataset against its checksums
+  template <typename T>
+  void verifyDataset(const OgIGroup &group, const std::string &name, 
+                     File::LayerVerification &result)
+  {
+    const OgICDataset<T> data = group.findCompressedDataset<T>(name);
+    if (!data.isValid()) {
+      return;
+    }
+    const size_t numElements = data.numDataElements();
+    const OgIDataset<uint32_t> checksumData = 
+      group.findDataset<uint32_t>(BlockChecksum::datasetName(name));
+    if (!checksumData.isValid()) {
+      result.numUnchecked += numElements;
+      return;
+    }
+    // A checksum list that doesn't match the data says nothing about the
+    // elements, so they all count as corrupt
+    std::vector<uint32_t> checksums(numElements);
+    if (checksumData.dataSize(0, OGAWA_THREAD) != numElements ||
+        (numElements > 0 && 
+         !checksumData.getData(0, &checksums[0], OGAWA_THREAD))) {
+      result.numCorrupt += numElements;
+      return;
+    }
+    if (numElements == 0) {
+      return;
+    }
+    VerifyChecksumsTask<T> task(data, checksums);
+    ThreadPool::singleton().run(task, std::min(numIOThreads(), numElements));
+    result.numCorrupt += task.numCorrupt();
+    result.numChecked += numElements - task.numCorrupt();
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Checks the compressed datasets of a group and its children against
+  //! their checksums
+  void verifyGroup(const OgIGroup &group, File::LayerVerification &result)
+  {
+    const std::vector<std::string> names = group.compressedDatasetNames();
+    for (size_t i = 0; i < names.size(); ++i) {
+      switch (group.compressedDatasetType(names[i])) {
+      case F3DFloat16:
+        verifyDataset<float16_t>(group, names[i], result);
+        break;
+      case F3DFloat32:
+        verifyDataset<float32_t>(group, names[i], result);
+        break;
+      case F3DFloat64:
+        verifyDataset<float64_t>(group, names[i], result);
+        break;
+      case F3DVec16:
+        verifyDataset<vec16_t>(group, names[i], result);
+        break;
+      case F3DVec32:
+        verifyDataset<vec32_t>(group, names[i], result);
+        break;
+      case F3DVec64:
+        verifyDataset<vec64_t>(group, names[i], result);
+        break;
+      default:
+        break;
+      }
+    }
+    const std::vector<std::string> groups = group.groupNames();
+    for (size_t i = 0; i < groups.size(); ++i) {
+      const OgIGroup child = group.findGroup(groups[i]);
+      if (child.isValid()) {
+        verifyGroup(child, result);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Adds an attribute stored as its own group to a layer group, packing it
+  //! if the layer group packs its attributes
+  bool copyAttribute(OgOGroup &layerGroup, const std::string &name,
+                     Alembic::Ogawa::IGroupPtr attrGroup)
+  {
+    if (attrGroup->getNumChildren() < 4 || !attrGroup->isChildData(3)) {
+      return false;
+    }
+    Alembic::Ogawa::IDataPtr data = attrGroup->getData(3, OGAWA_THREAD);
+    std::vector<uint8_t> bytes(data->getSize());
+    if (!bytes.empty()) {
+      data->read(bytes.size(), &bytes[0], 0, OGAWA_THREAD);
+    }
+    layerGroup.addAttribute(name, readDataType(attrGroup, 2), 
+                            bytes.empty() ? NULL : &bytes[0], bytes.size());
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Copies the field data of a layer group byte for byte, reading ahead on
+  //! the I/O threads while this thread writes. The layer's name, class type
+  //! and metadata are skipped, since writeLayerGroup() writes those. The
+  //! layer's attributes are added to layerGroup, so they end up packed or 
+  //! not depending on the destination rather than the source.
+  bool copyLayerGroup(OgOGroup &layerGroup, const OgIGroup &src)
+  {
+    Alembic::Ogawa::IGroupPtr srcGroup = src.ogawaGroup();
+    if (!srcGroup) {
+      return false;
+    }
+
+    // Packed attributes
+    if (const OgPackedAttributes *packed = src.packedAttributes()) {
+      const std::vector<std::string> &names = packed->names();
+      for (size_t i = 0; i < names.size(); ++i) {
+        const OgPackedAttributes::Entry *entry = packed->find(names[i]);
+        if (names[i] != "class_type") {
+          layerGroup.addAttribute(names[i], entry->type, 
+                                  packed->data(*entry), entry->numBytes);
+        }
+      }
+    }
+
+    // List the groups to copy. The layer's own data is its name and type
+    std::vector<CopyNode>                 nodes;
+    std::vector<Alembic::Ogawa::IDataPtr> data;
+    std::vector<size_t>                   topLevel;
+    for (size_t i = 0, end = srcGroup->getNumChildren(); i < end; ++i) {
+      if (!srcGroup->isChildGroup(i) || srcGroup->isEmptyChildGroup(i)) {
+        continue;
+      }
+      Alembic::Ogawa::IGroupPtr child = srcGroup->getGroup(i, false, 
+                                                           OGAWA_THREAD);
+      std::string name;
+      if (!getGroupName(child, name) || name == "class_type" || 
+          name == "metadata") {
+        continue;
+      }
+      OgGroupType groupType;
+      if (readData(child, 1, groupType) && groupType == F3DAttributeType) {
+        if (!copyAttribute(layerGroup, name, child)) {
+          return false;
+        }
+        continue;
+      }
+      CopyNode node;
+      node.type        = CopyNode::Group;
+      node.numChildren = child->getNumChildren();
+      node.dataIdx     = 0;
+      topLevel.push_back(nodes.size());
+      nodes.push_back(node);
+      listCopyNodes(child, nodes, data);
+    }
+
+    // Launch the readers and write as the data comes in
+    const size_t numThreads = std::max(numIOThreads(), size_t(1));
+    CopyState state(data, 4 * numThreads);
+    boost::thread_group threads;
+    for (size_t i = 0; i < numThreads; ++i) {
+      threads.create_thread(CopyReadOp(state));
+    }
+    for (size_t t = 0; t < topLevel.size(); ++t) {
+      writeCopyChildren(nodes, topLevel[t] + 1, nodes[topLevel[t]].numChildren,
+                        layerGroup.addSubGroup(), state);
+    }
+    {
+      boost::mutex::scoped_lock lock(state.mutex);
+      if (state.nextToWrite < data.size()) {
+        // The writer gave up early. Let any waiting readers go
+        state.failed = true;
+        state.slotFree.notify_all();
+      }
+    }
+    threads.join_all();
+
+    return !state.failed;
+  }
+
+  //--------------------------------------------------------------------------//
+
   //! This function creates a FieldIO instance based on className
   //! which then reads the field data from layerGroup location
   template <class Data_T>
   typename Field<Data_T>::Ptr 
   readField(const std::string &className, const OgIGroup &layerGroup,
-            const std::string &filename, const std::string &layerPath)
+            const std::string &filename, const std::string &layerPath,
+            const Box3i *voxelWindow = NULL)
   {
     ClassFactory &factory = ClassFactory::singleton();
   
     typedef typename Field<Data_T>::Ptr FieldPtr;
 
-    FieldIO::Ptr io = factory.createFieldIO(className);
+    FieldIO::Ptr io = factory.sharedFieldIO(className);
     if (!io) {
       Msg::print(Msg::SevWarning, "Unable to find class type: " + 
                  className);
@@ -261,7 +945,9 @@ namespace {
     }
 
     OgDataType typeEnum = OgawaTypeTraits<Data_T>::typeEnum();
-    FieldBase::Ptr field = io->read(layerGroup, filename, layerPath, typeEnum);
+    FieldBase::Ptr field = voxelWindow ? 
+      io->readWindow(layerGroup, filename, layerPath, typeEnum, *voxelWindow) :
+      io->read(layerGroup, filename, layerPath, typeEnum);
 
     if (!field) {
       // We don't need to print a message, because it could just be that
@@ -328,6 +1014,22 @@ namespace {
 
   //--------------------------------------------------------------------------//
 
+  //! Removes the names that don't match the pattern, keeping the order of
+  //! the others
+  void filterNames(std::vector<std::string> &names, 
+                   const MatchPattern &pattern)
+  {
+    size_t numKept = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (pattern.match(names[i])) {
+        names[numKept++].swap(names[i]);
+      }
+    }
+    names.resize(numKept);
+  }
+
+  //--------------------------------------------------------------------------//
+
 } // end of local namespace
 
 //----------------------------------------------------------------------------//
@@ -452,8 +1154,10 @@ File::Partition::Ptr Field3DFileBase::partition(const string &partitionName)
 {
   for (PartitionList::iterator i = m_partitions.begin();
        i != m_partitions.end(); ++i) {
-    if ((**i).name == partitionName)
+    if ((**i).name == partitionName) {
+      expandPartition(**i);
       return *i;
+    }
   }
 
   return File::Partition::Ptr();
@@ -466,8 +1170,10 @@ Field3DFileBase::partition(const string &partitionName) const
 {
   for (PartitionList::const_iterator i = m_partitions.begin();
        i != m_partitions.end(); ++i) {
-    if ((**i).name == partitionName)
+    if ((**i).name == partitionName) {
+      expandPartition(**i);
       return *i;
+    }
   }
 
   return File::Partition::Ptr();
@@ -560,6 +1266,38 @@ Field3DFileBase::getVectorLayerNames(vector<string> &names,
 
 //----------------------------------------------------------------------------//
 
+void 
+Field3DFileBase::getPartitionNames(vector<string> &names, 
+                                   const MatchPattern &pattern) const
+{
+  getPartitionNames(names);
+  filterNames(names, pattern);
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+Field3DFileBase::getScalarLayerNames(vector<string> &names, 
+                                     const string &partitionName,
+                                     const MatchPattern &pattern) const
+{
+  getScalarLayerNames(names, partitionName);
+  filterNames(names, pattern);
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+Field3DFileBase::getVectorLayerNames(vector<string> &names, 
+                                     const string &partitionName,
+                                     const MatchPattern &pattern) const
+{
+  getVectorLayerNames(names, partitionName);
+  filterNames(names, pattern);
+}
+
+//----------------------------------------------------------------------------//
+
 void 
 Field3DFileBase::getIntPartitionNames(vector<string> &names) const
 {
@@ -698,6 +1436,7 @@ Field3DFileBase::addGroupMembership(const GroupMembershipMap& groupMembers)
 //----------------------------------------------------------------------------//
 
 Field3DInputFile::Field3DInputFile() 
+  : m_isMetadataRead(false)
 { 
   // Empty
 }
@@ -713,6 +1452,10 @@ Field3DInputFile::~Field3DInputFile()
 
 bool Field3DInputFile::open(const string &filename)
 {
+  Stats::ScopedTimer timer(Stats::FileOpenTime);
+  Stats::add(Stats::FilesOpened);
+  Trace::ScopedEvent event("Field3DInputFile::open");
+
   clear();
 
   bool success = true;
@@ -722,11 +1465,15 @@ bool Field3DInputFile::open(const string &filename)
 
   try {
 
-    // Throws exceptions if the file doesn't exist.
-    checkFile(filename);
+    // Throws exceptions if the file doesn't exist. Files read through a 
+    // stream source aren't on the local file system.
+    if (!hasStreamSource(filename)) {
+      checkFile(filename);
+    }
     
-    // Open the Ogawa archive
-    m_archive.reset(new Alembic::Ogawa::IArchive(filename));
+    // Open the Ogawa archive. Its reads are positional, so the I/O threads
+    // can all read through it concurrently.
+    m_archive = openOgawaArchive(filename);
 
     // Error check and HDF5 fallback
     if (!m_archive->isValid()) {
@@ -765,20 +1512,10 @@ bool Field3DInputFile::open(const string &filename)
       
     }
 
-    // Read the global metadata. This does not always exists, 
-    // depends on if it was written or not.
-    try { 
-      const OgIGroup metadataGroup = m_root->findGroup("field3d_global_metadata");
-      if (metadataGroup.isValid()) {
-        readMetadata(metadataGroup);
-      } 
-    }
-    catch (...) {
-      Msg::print(Msg::SevWarning, 
-                 "Unknown error when reading file metadata ");
-    }
+    // The global metadata is read by expandMetadata() on first access
+    m_isMetadataRead = false;
 
-    // Read the partition and layer info
+    // Read the partition names
     try {
       if (!readPartitionAndLayerInfo()) {
         success = false;
@@ -856,10 +1593,17 @@ bool Field3DInputFile::open(const string &filename)
 
 bool Field3DInputFile::readPartitionAndLayerInfo()
 {
+  // Files with a layer index list their partitions and layers up front
+  if (readLayerIndex()) {
+    return true;
+  }
+
   // Find all the partition names
   std::vector<std::string> groups = m_root->groupNames();
   
-  // Store the partition names
+  // Store the partition names. The mapping and layers of each partition are
+  // left for expandPartition(), so that opening a file only touches the
+  // top level of the hierarchy.
   m_partitions.clear();
   for (std::vector<std::string>::const_iterator i = groups.begin(), 
          end = groups.end(); i != end; ++i) {
@@ -872,51 +1616,186 @@ bool Field3DInputFile::readPartitionAndLayerInfo()
     // Build partition
     File::Partition::Ptr part(new File::Partition);
     part->name = name;
+    part->setExpanded(false);
     m_partitions.push_back(part);
   }
 
-  // For each partition, find its mapping ---
+  return true;
+}
 
-  for (PartitionList::iterator i = m_partitions.begin();
-       i != m_partitions.end(); ++i) {
-    // Grab the name
-    const std::string &name = (**i).name;
-    // Open the partition group
-    const OgIGroup partitionGroup = m_root->findGroup(name);
-    if (!partitionGroup.isValid()) {
-      Msg::print(Msg::SevWarning, "Couldn't open partition group " + name);
-    }
-    // Open the mapping group
-    const OgIGroup mappingGroup = partitionGroup.findGroup(k_mappingStr);
-    if (!mappingGroup.isValid()) {
-      Msg::print(Msg::SevWarning, "Couldn't open mapping group " + name);
-    }
-    // Build the mapping
-    FieldMapping::Ptr mapping = readFieldMapping(mappingGroup);
-#if 0
-    if (!mapping) {
-      Msg::print(Msg::SevWarning, "Got a null pointer when reading mapping");
-      throw ReadMappingException((**i).name);
-    }
-#endif
-    // Attach the mapping to the partition
-    (**i).mapping = mapping;
+//----------------------------------------------------------------------------//
+
+bool Field3DInputFile::readLayerIndex()
+{
+  // The index datasets are the last two children of the root group. Files
+  // without them are read by walking the partitions, so there's no point 
+  // searching any further.
+  const OgIDataset<int32_t> indexData = 
+    m_root->findLastDataset<int32_t>(k_layerIndexStr, 2);
+  if (!indexData.isValid() || indexData.numDataElements() != 2) {
+    return false;
+  }
+  const OgIDataset<uint8_t> namesData = 
+    m_root->findLastDataset<uint8_t>(k_layerIndexNamesStr, 2);
+  if (!namesData.isValid() || namesData.numDataElements() != 1) {
+    return false;
   }
 
-  // ... And then find its layers ---
+  // Read the header. Indices written by a later version are ignored
+  int32_t header[3];
+  if (indexData.dataSize(0, OGAWA_THREAD) != 3 ||
+      !indexData.getData(0, header, OGAWA_THREAD)) {
+    return false;
+  }
+  if (header[0] != k_layerIndexVersion || header[1] <= 0 ||
+      header[2] != k_layerIndexColumns) {
+    return false;
+  }
+  const size_t numLayers = header[1];
 
-  for (PartitionList::const_iterator i = m_partitions.begin();
-       i != m_partitions.end(); ++i) {
-    // Grab the name
-    const std::string &partitionName = (**i).name;
-    // Open the partition group
-    const OgIGroup partitionGroup = m_root->findGroup(partitionName);
-    if (!partitionGroup.isValid()) {
-      Msg::print(Msg::SevWarning, "Couldn't open partition group " + 
-                 partitionName);
+  // Read the rows
+  std::vector<int32_t> rows(numLayers * k_layerIndexColumns);
+  if (indexData.dataSize(1, OGAWA_THREAD) != rows.size() ||
+      !indexData.getData(1, &rows[0], OGAWA_THREAD)) {
+    return false;
+  }
+
+  // Read the names
+  const Alembic::Util::uint64_t namesSize = 
+    namesData.dataSize(0, OGAWA_THREAD);
+  if (namesSize == 0 || namesSize == OGAWA_INVALID_DATASET_INDEX) {
+    return false;
+  }
+  std::vector<uint8_t> namesBuffer(namesSize);
+  if (!namesData.getData(0, &namesBuffer[0], OGAWA_THREAD) ||
+      namesBuffer.back() != 0) {
+    return false;
+  }
+  std::vector<std::string> names;
+  for (size_t start = 0; start < namesBuffer.size(); ) {
+    const char *name = reinterpret_cast<const char*>(&namesBuffer[start]);
+    names.push_back(name);
+    start += names.back().size() + 1;
+  }
+  if (names.size() != numLayers * 3) {
+    return false;
+  }
+
+  // Build the partitions and their layers. The mappings are still read
+  // by expandPartition()
+  m_partitions.clear();
+  for (size_t i = 0; i < numLayers; ++i) {
+    const int32_t     *row           = &rows[i * k_layerIndexColumns];
+    const std::string &partitionName = names[i * 3 + 0];
+    // Find or build the partition
+    File::Partition::Ptr part;
+    for (PartitionList::const_iterator p = m_partitions.begin();
+         p != m_partitions.end(); ++p) {
+      if ((**p).name == partitionName) {
+        part = *p;
+        break;
+      }
+    }
+    if (!part) {
+      part = new File::Partition;
+      part->name = partitionName;
+      part->childIndex = row[0];
+      part->mappingChildIndex = row[1];
+      part->setExpanded(false);
+      m_partitions.push_back(part);
+    }
+    // Construct the layer
+    File::Layer layer;
+    layer.name       = names[i * 3 + 1];
+    layer.parent     = partitionName;
+    layer.className  = names[i * 3 + 2];
+    layer.childIndex = row[2];
+    layer.dataType   = row[3];
+    layer.dataWindow = Box3i(V3i(row[4], row[5], row[6]), 
+                             V3i(row[7], row[8], row[9]));
+    // Add to partition
+    part->addLayer(layer);
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+OgIGroup 
+Field3DInputFile::openPartitionGroup(const File::Partition &part) const
+{
+  if (part.childIndex >= 0) {
+    const OgIGroup group = m_root->childGroup(part.childIndex);
+    if (group.isValid() && group.name() == part.name) {
+      return group;
     }
+  }
+  return m_root->findGroup(part.name);
+}
+
+//----------------------------------------------------------------------------//
+
+OgIGroup 
+Field3DInputFile::openLayerGroup(const OgIGroup &partitionGroup,
+                                 const File::Layer &layer) const
+{
+  if (layer.childIndex >= 0) {
+    const OgIGroup group = partitionGroup.childGroup(layer.childIndex);
+    if (group.isValid() && group.name() == layer.name) {
+      return group;
+    }
+  }
+  return partitionGroup.findGroup(layer.name);
+}
+
+//----------------------------------------------------------------------------//
+
+void Field3DInputFile::expandPartition(File::Partition &part) const
+{
+  boost::mutex::scoped_lock lock(m_expandMutex);
+
+  if (part.isExpanded()) {
+    return;
+  }
+  // Only try once, even if the partition turns out to be broken
+  part.setExpanded(true);
+
+  // Grab the name
+  const std::string &partitionName = part.name;
+
+  try {
+    // Open the partition group
+    const OgIGroup partitionGroup = openPartitionGroup(part);
+    if (!partitionGroup.isValid()) {
+      Msg::print(Msg::SevWarning, "Couldn't open partition group " + 
+                 partitionName);
+      return;
+    }
+
+    // Find its mapping ---
+
+    // Open the mapping group, directly if the layer index gave its position
+    OgIGroup mappingGroup = partitionGroup.childGroup(part.mappingChildIndex);
+    if (part.mappingChildIndex < 0 || !mappingGroup.isValid() || 
+        mappingGroup.name() != k_mappingStr) {
+      mappingGroup = partitionGroup.findGroup(k_mappingStr);
+    }
+    if (!mappingGroup.isValid()) {
+      Msg::print(Msg::SevWarning, "Couldn't open mapping group " + 
+                 partitionName);
+    }
+    // Build the mapping and attach it to the partition
+    part.mapping = readFieldMapping(mappingGroup);
+
+    // ... And then find its layers, unless the layer index listed them ---
+
+    if (part.childIndex >= 0) {
+      return;
+    }
+
     // Get all the layer names
-    groups = partitionGroup.groupNames();
+    std::vector<std::string> groups = partitionGroup.groupNames();
     for (std::vector<std::string>::const_iterator l = groups.begin(), 
            lEnd = groups.end(); l != lEnd; ++l) {
       // Grab layer name
@@ -930,26 +1809,52 @@ bool Field3DInputFile::readPartitionAndLayerInfo()
       layer.name = *l;
       layer.parent = partitionName;
       // Add to partition
-      partition(partitionName)->addLayer(layer);
+      part.addLayer(layer);
     }
   }
-
-  return true;
+  catch (Exception &e) {
+    Msg::print(Msg::SevWarning, "In file: " + m_filename + 
+               " - Error when reading partition " + partitionName + ": " + 
+               string(e.what()));
+  }
+  catch (...) {
+    Msg::print(Msg::SevWarning, "In file: " + m_filename + 
+               " - Unknown error when reading partition " + partitionName);
+  }
 }
 
 //----------------------------------------------------------------------------//
 
-bool Field3DInputFile::readMetadata(const OgIGroup &metadataGroup, 
-                                    FieldBase::Ptr field) const
+void Field3DInputFile::expandMetadata() const
 {
-  return readMeta(metadataGroup, field->metadata());
+  boost::mutex::scoped_lock lock(m_expandMutex);
+
+  if (m_isMetadataRead || !m_root) {
+    return;
+  }
+  m_isMetadataRead = true;
+
+  // Read the global metadata. This does not always exists, 
+  // depends on if it was written or not.
+  try { 
+    const OgIGroup metadataGroup = m_root->findGroup("field3d_global_metadata");
+    if (metadataGroup.isValid()) {
+      // metadata() is what brought us here, so fill in the member directly
+      readMeta(metadataGroup, const_cast<FieldMetadata&>(m_metadata));
+    } 
+  }
+  catch (...) {
+    Msg::print(Msg::SevWarning, 
+               "Unknown error when reading file metadata ");
+  }
 }
 
 //----------------------------------------------------------------------------//
 
-bool Field3DInputFile::readMetadata(const OgIGroup &metadataGroup)
+bool Field3DInputFile::readMetadata(const OgIGroup &metadataGroup, 
+                                    FieldBase::Ptr field) const
 {
-  return readMeta(metadataGroup, metadata());
+  return readMeta(metadataGroup, field->metadata());
 }
 
 //----------------------------------------------------------------------------//
@@ -957,10 +1862,126 @@ bool Field3DInputFile::readMetadata(const OgIGroup &metadataGroup)
 //----------------------------------------------------------------------------//
 
 bool Field3DOutputFile::ms_doOgawa = true;
+bool Field3DOutputFile::ms_doLayerIndex = true;
+
+//----------------------------------------------------------------------------//
 
+//----------------------------------------------------------------------------//
+// Field3DOutputFile::BackgroundWriter
+//----------------------------------------------------------------------------//
+
+//! Runs queued layer writes, in order, on a thread of its own
+class Field3DOutputFile::BackgroundWriter
+{
+public:
+  typedef boost::function<bool ()> Job;
+
+  BackgroundWriter()
+    : m_maxMemUse(0), m_queuedMemUse(0), m_isWriting(false), 
+      m_success(true), m_quit(false)
+  {
+    m_thread = boost::thread(boost::bind(&BackgroundWriter::run, this));
+  }
+
+  ~BackgroundWriter()
+  {
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_quit = true;
+      m_changed.notify_all();
+    }
+    m_thread.join();
+  }
+
+  void setMaxMemUse(const long long int bytes)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_maxMemUse = bytes;
+    m_changed.notify_all();
+  }
+
+  //! Queues a job, waiting for room in the queue first
+  void push(const Job &job, const long long int memUse)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_queuedMemUse > 0 && m_queuedMemUse + memUse > m_maxMemUse) {
+      m_changed.wait(lock);
+    }
+    m_jobs.push_back(std::make_pair(job, memUse));
+    m_queuedMemUse += memUse;
+    m_changed.notify_all();
+  }
+
+  //! Waits for the queue to drain
+  bool flush()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (!m_jobs.empty() || m_isWriting) {
+      m_changed.wait(lock);
+    }
+    const bool success = m_success;
+    m_success = true;
+    return success;
+  }
+
+private:
+
+  void run()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (true) {
+      while (m_jobs.empty() && !m_quit) {
+        m_changed.wait(lock);
+      }
+      if (m_jobs.empty()) {
+        return;
+      }
+      Job job = m_jobs.front().first;
+      const long long int memUse = m_jobs.front().second;
+      m_jobs.pop_front();
+      m_isWriting = true;
+      lock.unlock();
+      bool success = false;
+      try {
+        success = job();
+      }
+      catch (std::exception &e) {
+        Msg::print(Msg::SevWarning, 
+                   std::string("Background layer write failed: ") + e.what());
+      }
+      // Release the layer before accounting for its memory
+      job = Job();
+      lock.lock();
+      m_isWriting = false;
+      m_queuedMemUse -= memUse;
+      m_success = m_success && success;
+      m_changed.notify_all();
+    }
+  }
+
+  // Data members ---
+
+  //! Queued jobs and the memory they hold on to
+  std::list<std::pair<Job, long long int> > m_jobs;
+  long long int m_maxMemUse;
+  //! Memory held by queued jobs, including the one being written
+  long long int m_queuedMemUse;
+  bool m_isWriting;
+  //! Whether all jobs since the last flush() succeeded
+  bool m_success;
+  bool m_quit;
+  boost::mutex m_mutex;
+  //! Signaled whenever the queue changes
+  boost::condition_variable m_changed;
+  boost::thread m_thread;
+};
+
+//----------------------------------------------------------------------------//
+// Field3DOutputFile implementations
 //----------------------------------------------------------------------------//
 
 Field3DOutputFile::Field3DOutputFile() 
+  : m_maxBackgroundMemUse(1024.0f), m_atlasPadding(-1)
 { 
   // Empty
 }
@@ -969,11 +1990,50 @@ Field3DOutputFile::Field3DOutputFile()
 
 Field3DOutputFile::~Field3DOutputFile() 
 { 
+  flush();
+  m_backgroundWriter.reset();
+  // Files that weren't closed still get their index. After close() the
+  // root is gone and nothing is written
+  writeLayerIndex();
   cleanup();
 }
 
 //----------------------------------------------------------------------------//
 
+void Field3DOutputFile::setBackgroundWrites(const bool enabled)
+{
+  if (enabled && !m_backgroundWriter) {
+    m_backgroundWriter.reset(new BackgroundWriter);
+    setMaxBackgroundMemUse(m_maxBackgroundMemUse);
+  } else if (!enabled && m_backgroundWriter) {
+    flush();
+    m_backgroundWriter.reset();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void Field3DOutputFile::setMaxBackgroundMemUse(const float megabytes)
+{
+  m_maxBackgroundMemUse = megabytes;
+  if (m_backgroundWriter) {
+    m_backgroundWriter->setMaxMemUse
+      (static_cast<long long int>(megabytes * 1024.0 * 1024.0));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool Field3DOutputFile::flush()
+{
+  if (!m_backgroundWriter) {
+    return true;
+  }
+  return m_backgroundWriter->flush();
+}
+
+//----------------------------------------------------------------------------//
+
 bool Field3DOutputFile::create(const string &filename, CreateMode cm)
 {
   if (!ms_doOgawa) {
@@ -1019,18 +2079,20 @@ bool Field3DOutputFile::writeMapping(OgOGroup &partitionGroup,
   try {
 
     OgOGroup mappingGroup(partitionGroup, k_mappingStr);
+    mappingGroup.setPackAttributes(packLayerAttributes());
 
     OgOAttribute<string> classNameAttr(mappingGroup, k_mappingTypeAttrName,
                                        className);
 
-    FieldMappingIO::Ptr io = factory.createFieldMappingIO(className);
+    FieldMappingIO::Ptr io = factory.sharedFieldMappingIO(className);
     if (!io) {
       Msg::print(Msg::SevWarning, "Unable to find class type: " + 
                  className);
       return false;
     }
 
-    return io->write(mappingGroup, mapping);
+    return io->write(mappingGroup, mapping) && 
+      mappingGroup.writePackedAttributes();
 
   }
   catch (OgOGroupException &e) {
@@ -1237,8 +2299,11 @@ Field3DOutputFile::writeGlobalMetadata()
     return m_hdf5->writeGlobalMetadata();
   }
 
+  // Queued layers must be written first
+  flush();
+
   OgOGroup ogMetadata(*m_root, "field3d_global_metadata");
-  if (!writeMetadata(ogMetadata)) {
+  if (!writeMetadata(ogMetadata) || !ogMetadata.writePackedAttributes()) {
     Msg::print(Msg::SevWarning, "Error writing file metadata.");
     return false;
   } 
@@ -1248,6 +2313,68 @@ Field3DOutputFile::writeGlobalMetadata()
 
 //----------------------------------------------------------------------------//
 
+bool 
+Field3DOutputFile::writeLayerIndex()
+{
+  if (!ms_doLayerIndex || !m_root) {
+    return true;
+  }
+
+  // Gather a row and the names of each layer, in the order they were written
+  std::vector<int32_t> rows;
+  std::vector<uint8_t> names;
+  int32_t              numLayers = 0;
+
+  for (PartitionList::const_iterator i = m_partitions.begin();
+       i != m_partitions.end(); ++i) {
+    vector<string> layerNames;
+    (**i).getLayerNames(layerNames);
+    for (vector<string>::const_iterator l = layerNames.begin();
+         l != layerNames.end(); ++l) {
+      const File::Layer *layer = (**i).layer(*l);
+      const Box3i       &dw    = layer->dataWindow;
+      const int32_t      row[k_layerIndexColumns] = {
+        (**i).childIndex, (**i).mappingChildIndex, layer->childIndex,
+        layer->dataType, 
+        dw.min.x, dw.min.y, dw.min.z, dw.max.x, dw.max.y, dw.max.z
+      };
+      rows.insert(rows.end(), row, row + k_layerIndexColumns);
+      const string *strings[3] = { &(**i).name, &layer->name, 
+                                   &layer->className };
+      for (int s = 0; s < 3; ++s) {
+        names.insert(names.end(), strings[s]->begin(), strings[s]->end());
+        names.push_back(0);
+      }
+      numLayers++;
+    }
+  }
+
+  if (numLayers == 0) {
+    return true;
+  }
+
+  try {
+    // The names go first, so that the rows are the very last child
+    OgODataset<uint8_t> namesData(*m_root, k_layerIndexNamesStr);
+    namesData.addData(names.size(), &names[0]);
+    OgODataset<int32_t> indexData(*m_root, k_layerIndexStr);
+    const int32_t header[3] = { 
+      k_layerIndexVersion, numLayers, k_layerIndexColumns 
+    };
+    indexData.addData(3, header);
+    indexData.addData(rows.size(), &rows[0]);
+  }
+  catch (std::exception &e) {
+    Msg::print(Msg::SevWarning, "Couldn't write layer index: " + 
+               string(e.what()));
+    return false; 
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
 bool 
 Field3DOutputFile::writeGroupMembership()
 {
@@ -1322,6 +2449,7 @@ void Field3DFileBase::printHierarchy() const
   // For each partition
   for (PartitionList::const_iterator i = m_partitions.begin();
        i != m_partitions.end(); ++i) {
+    expandPartition(**i);
     cout << "Name: " << (**i).name << endl;
     if ((**i).mapping)
       cout << "  Mapping: " << (**i).mapping->className() << endl;
@@ -1360,9 +2488,11 @@ Field3DOutputFile::createNewPartition(const std::string &partitionName,
   
   File::Partition::Ptr newPart(new File::Partition);
   newPart->name = partitionName;
+  newPart->childIndex = m_root->numChildren();
 
   boost::shared_ptr<OgOGroup> ogPartition(new OgOGroup(*m_root, newPart->name));
   newPart->setGroup(ogPartition);
+  newPart->mappingChildIndex = ogPartition->numChildren();
 
   m_partitions.push_back(newPart);
 
@@ -1410,15 +2540,123 @@ bool Field3DOutputFile::writeLayer(const std::string &userPartitionName,
                                    const std::string &layerName, 
                                    typename Field<Data_T>::Ptr field)
 {
-  using std::string;
+  if (!m_backgroundWriter || !field || !m_archive) {
+    return writeLayerNow<Data_T>(userPartitionName, layerName, field);
+  }
+
+  // Queue a copy of the field, so that the caller may keep modifying it
+  typename Field<Data_T>::Ptr snapshot = 
+    field_dynamic_cast<Field<Data_T> >(field->clone());
+  if (!snapshot) {
+    // Fields that can't be copied are written right away. The background
+    // writer mustn't be writing to the archive meanwhile, so the queued 
+    // layers go first
+    flush();
+    return writeLayerNow<Data_T>(userPartitionName, layerName, field);
+  }
+  m_backgroundWriter->push(boost::bind(&Field3DOutputFile::writeLayerNow<Data_T>,
+                                       this, userPartitionName, layerName, 
+                                       snapshot), 
+                           snapshot->memSize());
+  return true;
+}
+
+//----------------------------------------------------------------------------//
 
+template <class Data_T>
+bool Field3DOutputFile::writeLayerNow(const std::string &userPartitionName, 
+                                      const std::string &layerName, 
+                                      typename Field<Data_T>::Ptr field)
+{
   // Null pointer check
   if (!field) {
     Msg::print(Msg::SevWarning,
                "Called writeLayer with null pointer. Ignoring...");
     return false;
   }
-  
+
+  // Blocks are compressed as they're written
+  const SparseFieldIO::PrecompressedBlocks::Ptr precompressed;
+
+  return writeLayerGroup(userPartitionName, layerName, field, 
+                         field->className(), 
+                         OgawaTypeTraits<Data_T>::typeEnum(), 
+                         boost::bind(&writeFieldAndAtlases<Data_T>, _1, 
+                                     field, m_atlasPadding, precompressed));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool Field3DOutputFile::writeDenseLayer
+(const std::string &partitionName, const std::string &layerName, 
+ typename EmptyField<Data_T>::Ptr layout,
+ const boost::function<void (int, Data_T *)> &fillSlice)
+{
+  if (!layout) {
+    Msg::print(Msg::SevWarning,
+               "Called writeDenseLayer with null pointer. Ignoring...");
+    return false;
+  }
+  if (m_hdf5) {
+    Msg::print(Msg::SevWarning, 
+               "Streamed layers can only be written to Ogawa files.");
+    return false;
+  }
+
+  // Nothing else may be written while the layer streams to disk, so the
+  // queued layers go first
+  flush();
+
+  return writeLayerGroup(partitionName, layerName, layout, 
+                         DenseField<Data_T>::staticClassName(), 
+                         OgawaTypeTraits<Data_T>::typeEnum(), 
+                         boost::bind(&writeStreamedDense<Data_T>, _1, 
+                                     layout, fillSlice));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool Field3DOutputFile::writeSparseLayer
+(const std::string &partitionName, const std::string &layerName, 
+ typename EmptyField<Data_T>::Ptr layout, const int blockOrder,
+ const boost::function<bool (const V3i &, Data_T *, Data_T &)> &fillBlock)
+{
+  if (!layout) {
+    Msg::print(Msg::SevWarning,
+               "Called writeSparseLayer with null pointer. Ignoring...");
+    return false;
+  }
+  if (m_hdf5) {
+    Msg::print(Msg::SevWarning, 
+               "Streamed layers can only be written to Ogawa files.");
+    return false;
+  }
+
+  // Nothing else may be written while the layer streams to disk, so the
+  // queued layers go first
+  flush();
+
+  return writeLayerGroup(partitionName, layerName, layout, 
+                         SparseField<Data_T>::staticClassName(), 
+                         OgawaTypeTraits<Data_T>::typeEnum(), 
+                         boost::bind(&writeStreamedSparse<Data_T>, _1, 
+                                     layout, blockOrder, fillBlock));
+}
+
+//----------------------------------------------------------------------------//
+
+bool 
+Field3DOutputFile::writeLayerGroup(const std::string &userPartitionName, 
+                                   const std::string &layerName, 
+                                   FieldRes::Ptr field,
+                                   const std::string &className,
+                                   const int dataType,
+                                   const WriteDataFunc &writeData)
+{
+  using std::string;
+
   // Make sure archive is open
   if (!m_archive) {
     Msg::print(Msg::SevWarning, 
@@ -1483,12 +2721,17 @@ bool Field3DOutputFile::writeLayer(const std::string &userPartitionName,
   // Build a Layer
 
   File::Layer layer;
-  layer.name   = layerName;
-  layer.parent = partitionName;
+  layer.name       = layerName;
+  layer.parent     = partitionName;
+  layer.childIndex = ogPartition.numChildren();
+  layer.className  = className;
+  layer.dataType   = dataType;
+  layer.dataWindow = field->dataWindow();
 
   // Add Layer to file ---
 
   OgOGroup ogLayer(ogPartition, layerName);
+  ogLayer.setPackAttributes(packLayerAttributes());
 
   // Tag as layer
   OgOAttribute<string> classType(ogLayer, "class_type", "field3d_layer");
@@ -1498,15 +2741,149 @@ bool Field3DOutputFile::writeLayer(const std::string &userPartitionName,
 
   // Write metadata
   writeMetadata(ogMetadata, field);
+  bool success = ogMetadata.writePackedAttributes();
 
   // Write field data
-  writeField(ogLayer, field);
+  success = writeData(ogLayer) && success;
+  success = ogLayer.writePackedAttributes() && success;
 
   // Add to partition
 
   part->addLayer(layer);
 
-  return true;
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+bool Field3DOutputFile::copyLayer(const Field3DInputFile &in, 
+                                  const std::string &partitionName,
+                                  const std::string &layerName)
+{
+  if (m_hdf5 || in.m_hdf5 || !m_archive || !in.m_archive) {
+    Msg::print(Msg::SevWarning, 
+               "Layers can only be copied between open Ogawa files.");
+    return false;
+  }
+
+  // Nothing else may be written while the layer is copied, so the queued
+  // layers go first
+  flush();
+
+  std::vector<std::string> parts;
+  in.getIntPartitionNames(parts);
+
+  bool found = false, success = true;
+
+  for (std::vector<std::string>::const_iterator p = parts.begin(); 
+       p != parts.end(); ++p) {
+    if (in.removeUniqueId(*p) != partitionName) {
+      continue;
+    }
+    File::Partition::Ptr part = in.partition(*p);
+    const File::Layer *layer = part ? part->layer(layerName) : NULL;
+    if (!layer) {
+      continue;
+    }
+    found = true;
+    try {
+      const OgIGroup partitionGroup = in.openPartitionGroup(*part);
+      OgIGroup layerGroup = partitionGroup;
+      if (partitionGroup.isValid()) {
+        layerGroup = in.openLayerGroup(partitionGroup, *layer);
+      }
+      if (!layerGroup.isValid()) {
+        Msg::print(Msg::SevWarning, "Couldn't open layer " + *p + "/" + 
+                   layerName + " to copy it");
+        success = false;
+        continue;
+      }
+      std::string className = layer->className;
+      if (className.empty()) {
+        OgIAttribute<string> classNameAttr = 
+          layerGroup.findAttribute<string>(k_classNameAttrName);
+        className = classNameAttr.isValid() ? classNameAttr.value() : "";
+      }
+      // The proxy carries the extents, data window, mapping and metadata
+      EmptyField<float>::Ptr layout = 
+        in.readProxyLayer<float>(layerGroup, partitionName, layerName, 
+                                 part->mapping);
+      success &= writeLayerGroup(partitionName, layerName, layout, className,
+                                 layer->dataType, 
+                                 boost::bind(&copyLayerGroup, _1, 
+                                             layerGroup));
+    }
+    catch (std::exception &e) {
+      Msg::print(Msg::SevWarning, "Couldn't copy layer " + *p + "/" + 
+                 layerName + ": " + e.what());
+      success = false;
+    }
+  }
+
+  return found && success;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool Field3DOutputFile::writeLayers(const typename Field<Data_T>::Vec &layers)
+{
+  typedef SparseFieldIO::PrecompressedBlocks::Ptr PrecompressedPtr;
+
+  // Compressed blocks are held until their layer is written, so the sparse 
+  // layers are compressed a batch at a time, and each batch is written 
+  // before the next is compressed
+  static const size_t k_maxBatchBytes = 256 << 20;
+
+  bool success = true;
+  for (size_t begin = 0; begin < layers.size(); ) {
+    // Gather the sparse layers of the batch. Background writes copy each 
+    // layer, so the blocks of the original aren't the ones that get written
+    std::vector<typename SparseField<Data_T>::Ptr> sparseLayers;
+    std::vector<size_t> sparseIdx;
+    size_t end = begin, batchBytes = 0;
+    for (; end < layers.size() && batchBytes < k_maxBatchBytes; ++end) {
+      typename SparseField<Data_T>::Ptr sparse = 
+        field_dynamic_cast<SparseField<Data_T> >(layers[end]);
+      if (sparse && m_archive && !m_backgroundWriter) {
+        sparseLayers.push_back(sparse);
+        sparseIdx.push_back(end);
+        batchBytes += sparse->memSize();
+      }
+    }
+
+    // Compress the blocks of all the sparse layers of the batch at once
+    std::vector<PrecompressedPtr> precompressed(end - begin);
+    const std::vector<PrecompressedPtr> blocks = 
+      SparseFieldIO::precompress<Data_T>(sparseLayers);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      precompressed[sparseIdx[i] - begin] = blocks[i];
+    }
+
+    // Write the layers of the batch in order
+    for (size_t i = begin; i < end; ++i) {
+      if (PrecompressedPtr layerBlocks = precompressed[i - begin]) {
+        success &= 
+          writeLayerGroup(layers[i]->name, layers[i]->attribute, layers[i],
+                          layers[i]->className(), 
+                          OgawaTypeTraits<Data_T>::typeEnum(), 
+                          boost::bind(&writeFieldAndAtlases<Data_T>, _1, 
+                                      layers[i], m_atlasPadding, 
+                                      layerBlocks));
+      } else if (layers[i]) {
+        success &= writeLayer<Data_T>(layers[i]->name, layers[i]->attribute,
+                                      layers[i]);
+      } else {
+        success &= writeLayer<Data_T>("", "", layers[i]);
+      }
+      // Free the layer's compressed blocks as soon as it's written
+      precompressed[i - begin].reset();
+    }
+
+    begin = end;
+  }
+
+  return success;
 }
 
 //----------------------------------------------------------------------------//
@@ -1515,6 +2892,17 @@ template <class Data_T>
 typename Field<Data_T>::Ptr
 Field3DInputFile::readLayer(const std::string &intPartitionName,
                             const std::string &layerName) const
+{
+  return readLayerWindow<Data_T>(intPartitionName, layerName, NULL);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename Field<Data_T>::Ptr
+Field3DInputFile::readLayerWindow(const std::string &intPartitionName,
+                                  const std::string &layerName,
+                                  const Box3i *voxelWindow) const
 {
   typedef typename Field<Data_T>::Ptr FieldPtr;
 
@@ -1535,8 +2923,15 @@ Field3DInputFile::readLayer(const std::string &intPartitionName,
     return nullPtr;
   }
 
+  // If the layer index says the layer holds another data type, there is 
+  // nothing to read
+  if (layer->dataType >= 0 && 
+      layer->dataType != OgawaTypeTraits<Data_T>::typeEnum()) {
+    return nullPtr;
+  }
+
   // Open the partition group
-  const OgIGroup partitionGroup = m_root->findGroup(intPartitionName);
+  const OgIGroup partitionGroup = openPartitionGroup(*part);
   if (!partitionGroup.isValid()) {
     Msg::print(Msg::SevWarning, "Couldn't open partition group " + 
                intPartitionName);
@@ -1544,7 +2939,7 @@ Field3DInputFile::readLayer(const std::string &intPartitionName,
   }
 
   // Open the layer group
-  const OgIGroup layerGroup = partitionGroup.findGroup(layerName);
+  const OgIGroup layerGroup = openLayerGroup(partitionGroup, *layer);
   if (!layerGroup.isValid()) {
     Msg::print(Msg::SevWarning, "Couldn't open layer group " + 
                layerName);
@@ -1553,14 +2948,16 @@ Field3DInputFile::readLayer(const std::string &intPartitionName,
 
   // Get the class name
   string layerPath = layer->parent + "/" + layer->name;
-  string className;
-  try {
-    className = layerGroup.findAttribute<string>("class_name").value();
-  }
-  catch (OgIAttributeException &e) {
-    Msg::print(Msg::SevWarning, "Couldn't find class_name attrib in layer " + 
-               layerName);
-    return nullPtr;
+  string className = layer->className;
+  if (className.empty()) {
+    try {
+      className = layerGroup.findAttribute<string>("class_name").value();
+    }
+    catch (OgIAttributeException &e) {
+      Msg::print(Msg::SevWarning, "Couldn't find class_name attrib in layer " + 
+                 layerName);
+      return nullPtr;
+    }
   }
   
   // Check the cache
@@ -1574,13 +2971,22 @@ Field3DInputFile::readLayer(const std::string &intPartitionName,
 
   // Construct the field and load the data
 
+  const boost::uint64_t readStart = Stats::microseconds();
+
   typename Field<Data_T>::Ptr field;
-  field = readField<Data_T>(className, layerGroup, m_filename, layerPath);
+  {
+    Trace::ScopedEvent event("readLayer");
+    field = readField<Data_T>(className, layerGroup, m_filename, layerPath,
+                              voxelWindow);
+  }
 
   if (!field) {
     // This isn't really an error
     return nullPtr;
   }
+
+  Stats::addLayerRead(m_filename + ":" + layerPath, 
+                      Stats::microseconds() - readStart);
   
   // Read the metadata
   const OgIGroup metadataGroup = layerGroup.findGroup("metadata");
@@ -1593,8 +2999,9 @@ Field3DInputFile::readLayer(const std::string &intPartitionName,
   field->attribute = layerName;
   field->setMapping(part->mapping);
 
-  // Cache the field for future use
-  if (field) {
+  // Cache the field for future use. Part of a field must not stand in for
+  // all of it
+  if (field && !voxelWindow) {
     cache.cacheField(field, m_filename, layerPath);
   }
 
@@ -1675,6 +3082,346 @@ Field3DInputFile::readLayers(const std::string &partitionName,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+std::vector<boost::shared_ptr<SparseAtlas<Data_T> > >
+Field3DInputFile::readSparseAtlases(const std::string &partitionName, 
+                                    const std::string &layerName) const
+{
+  typedef typename SparseAtlas<Data_T>::Vec AtlasList;
+
+  if (m_hdf5 || layerName.empty() || partitionName.empty()) {
+    return AtlasList();
+  }
+
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (std::vector<std::string>::const_iterator p = parts.begin(); 
+       p != parts.end(); ++p) {
+    if (removeUniqueId(*p) != partitionName) {
+      continue;
+    }
+    File::Partition::Ptr part = partition(*p);
+    const File::Layer *layer = part ? part->layer(layerName) : NULL;
+    if (!layer || (layer->dataType >= 0 && 
+                   layer->dataType != OgawaTypeTraits<Data_T>::typeEnum())) {
+      continue;
+    }
+    const OgIGroup partitionGroup = openPartitionGroup(*part);
+    if (!partitionGroup.isValid()) {
+      continue;
+    }
+    const OgIGroup layerGroup = openLayerGroup(partitionGroup, *layer);
+    if (!layerGroup.isValid()) {
+      continue;
+    }
+    try {
+      return readAtlasGroup<Data_T>(layerGroup);
+    }
+    catch (std::exception &e) {
+      Msg::print(Msg::SevWarning, "In file: " + m_filename + 
+                 " - Couldn't read the sparse atlases of layer " + 
+                 layerName + ": " + e.what());
+      return AtlasList();
+    }
+  }
+
+  return AtlasList();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename DenseField<Data_T>::Ptr
+Field3DInputFile::readMACComponent(const std::string &partitionName, 
+                                   const std::string &layerName,
+                                   const MACComponent comp) const
+{
+  typedef typename DenseField<Data_T>::Ptr FieldPtr;
+
+  if (m_hdf5 || layerName.empty() || partitionName.empty()) {
+    return FieldPtr();
+  }
+
+  const OgDataType typeEnum = 
+    OgawaTypeTraits<FIELD3D_VEC3_T<Data_T> >::typeEnum();
+
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (std::vector<std::string>::const_iterator p = parts.begin(); 
+       p != parts.end(); ++p) {
+    if (removeUniqueId(*p) != partitionName) {
+      continue;
+    }
+    File::Partition::Ptr part = partition(*p);
+    const File::Layer *layer = part ? part->layer(layerName) : NULL;
+    if (!layer || (layer->dataType >= 0 && layer->dataType != typeEnum)) {
+      continue;
+    }
+    const OgIGroup partitionGroup = openPartitionGroup(*part);
+    if (!partitionGroup.isValid()) {
+      continue;
+    }
+    const OgIGroup layerGroup = openLayerGroup(partitionGroup, *layer);
+    if (!layerGroup.isValid()) {
+      continue;
+    }
+    std::string className = layer->className;
+    if (className.empty()) {
+      OgIAttribute<string> classNameAttr = 
+        layerGroup.findAttribute<string>(k_classNameAttrName);
+      className = classNameAttr.isValid() ? classNameAttr.value() : "";
+    }
+    if (className != MACField<FIELD3D_VEC3_T<Data_T> >::staticClassName()) {
+      continue;
+    }
+    try {
+      FieldPtr field = MACFieldIO::readComponent<Data_T>(layerGroup, comp);
+      if (!field) {
+        continue;
+      }
+      field->name      = partitionName;
+      field->attribute = layerName;
+      field->setMapping(part->mapping);
+      return field;
+    }
+    catch (std::exception &e) {
+      Msg::print(Msg::SevWarning, "In file: " + m_filename + 
+                 " - Couldn't read a component of layer " + 
+                 layerName + ": " + e.what());
+      return FieldPtr();
+    }
+  }
+
+  return FieldPtr();
+}
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Reads layers off a shared list until there are none left
+template <class Data_T>
+class ReadLayerOp
+{
+public:
+  typedef typename Field<Data_T>::Ptr FieldPtr;
+  typedef boost::function<FieldPtr (const string&, const string&)> ReadFunc;
+  typedef std::vector<std::pair<string, string> > LayerList;
+  ReadLayerOp(const ReadFunc &read, const LayerList &layers, 
+              std::vector<FieldPtr> &results, size_t &nextLayer, 
+              boost::mutex &mutex)
+    : m_read(read), m_layers(layers), m_results(results), 
+      m_nextLayer(nextLayer), m_mutex(mutex)
+  { }
+  void operator() ()
+  {
+    while (true) {
+      size_t i;
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        i = m_nextLayer++;
+      }
+      if (i >= m_layers.size()) {
+        return;
+      }
+      m_results[i] = m_read(m_layers[i].first, m_layers[i].second);
+    }
+  }
+private:
+  ReadFunc m_read;
+  const LayerList &m_layers;
+  std::vector<FieldPtr> &m_results;
+  size_t &m_nextLayer;
+  boost::mutex &m_mutex;
+};
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename Field<Data_T>::Vec
+Field3DInputFile::readLayers(const std::vector<std::string> &layerNames) const
+{
+  typedef typename Field<Data_T>::Ptr FieldPtr;
+  typedef typename Field<Data_T>::Vec FieldList;
+  typedef ReadLayerOp<Data_T>         Op;
+
+  // Collect the layers to read, in the order readLayers() visits them
+  typename Op::LayerList layers;
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+  for (vector<string>::iterator p = parts.begin(); p != parts.end(); ++p) {
+    vector<std::string> names;
+    getIntScalarLayerNames(names, *p);
+    for (vector<string>::iterator l = names.begin(); l != names.end(); ++l) {
+      if (layerNames.empty() || 
+          std::find(layerNames.begin(), layerNames.end(), *l) != 
+          layerNames.end()) {
+        layers.push_back(std::make_pair(*p, *l));
+      }
+    }
+  }
+
+  // Read them. Each layer still reads its blocks with numIOThreads() threads
+  std::vector<FieldPtr> results(layers.size());
+  const size_t numThreads = std::min(numIOThreads(), layers.size());
+  if (numThreads > 1) {
+    typename Op::ReadFunc read = 
+      boost::bind(&Field3DInputFile::readLayer<Data_T>, this, _1, _2);
+    size_t nextLayer = 0;
+    boost::mutex mutex;
+    runOnThreads(Op(read, layers, results, nextLayer, mutex), numThreads);
+  } else {
+    for (size_t i = 0; i < layers.size(); ++i) {
+      results[i] = readLayer<Data_T>(layers[i].first, layers[i].second);
+    }
+  }
+
+  FieldList ret;
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (results[i]) {
+      ret.push_back(results[i]);
+    }
+  }
+  return ret;
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<File::LayerStorage> 
+Field3DInputFile::layerStorage(const std::string &partitionName, 
+                               const std::string &layerName) const
+{
+  std::vector<File::LayerStorage> result;
+
+  if (m_hdf5 || !m_archive) {
+    return result;
+  }
+
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (std::vector<std::string>::const_iterator p = parts.begin(); 
+       p != parts.end(); ++p) {
+    if (removeUniqueId(*p) != partitionName) {
+      continue;
+    }
+    File::Partition::Ptr part = partition(*p);
+    const File::Layer *layer = part ? part->layer(layerName) : NULL;
+    if (!layer) {
+      continue;
+    }
+    try {
+      const OgIGroup partitionGroup = openPartitionGroup(*part);
+      if (!partitionGroup.isValid()) {
+        continue;
+      }
+      const OgIGroup layerGroup = openLayerGroup(partitionGroup, *layer);
+      if (!layerGroup.isValid()) {
+        continue;
+      }
+      File::LayerStorage storage;
+      storage.partition = *p;
+      storage.className = layer->className;
+      if (storage.className.empty()) {
+        OgIAttribute<string> classNameAttr = 
+          layerGroup.findAttribute<string>(k_classNameAttrName);
+        if (classNameAttr.isValid()) {
+          storage.className = classNameAttr.value();
+        }
+      }
+      // Everything but the layer's name, type, class type and metadata
+      Alembic::Ogawa::IGroupPtr group = layerGroup.ogawaGroup();
+      for (size_t i = 0, end = group->getNumChildren(); i < end; ++i) {
+        if (!group->isChildGroup(i) || group->isEmptyChildGroup(i)) {
+          continue;
+        }
+        Alembic::Ogawa::IGroupPtr child = group->getGroup(i, false, 
+                                                          OGAWA_THREAD);
+        std::string name;
+        if (getGroupName(child, name) && name != "class_type" && 
+            name != "metadata") {
+          storage.dataBytes += groupDataBytes(child);
+        }
+      }
+      result.push_back(storage);
+    }
+    catch (std::exception &e) {
+      Msg::print(Msg::SevWarning, "In file: " + m_filename + 
+                 " - Couldn't read the storage of layer " + *p + "/" + 
+                 layerName + ": " + e.what());
+    }
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<File::LayerVerification> 
+Field3DInputFile::verifyLayer(const std::string &partitionName, 
+                              const std::string &layerName) const
+{
+  std::vector<File::LayerVerification> result;
+
+  if (m_hdf5 || !m_archive) {
+    return result;
+  }
+
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (std::vector<std::string>::const_iterator p = parts.begin(); 
+       p != parts.end(); ++p) {
+    if (removeUniqueId(*p) != partitionName) {
+      continue;
+    }
+    File::Partition::Ptr part = partition(*p);
+    const File::Layer *layer = part ? part->layer(layerName) : NULL;
+    if (!layer) {
+      continue;
+    }
+    try {
+      const OgIGroup partitionGroup = openPartitionGroup(*part);
+      if (!partitionGroup.isValid()) {
+        continue;
+      }
+      const OgIGroup layerGroup = openLayerGroup(partitionGroup, *layer);
+      if (!layerGroup.isValid()) {
+        continue;
+      }
+      File::LayerVerification verification;
+      verification.partition = *p;
+      verification.className = layer->className;
+      if (verification.className.empty()) {
+        OgIAttribute<string> classNameAttr = 
+          layerGroup.findAttribute<string>(k_classNameAttrName);
+        if (classNameAttr.isValid()) {
+          verification.className = classNameAttr.value();
+        }
+      }
+      verifyGroup(layerGroup, verification);
+      result.push_back(verification);
+    }
+    catch (std::exception &e) {
+      Msg::print(Msg::SevWarning, "In file: " + m_filename + 
+                 " - Couldn't verify layer " + *p + "/" + layerName + 
+                 ": " + e.what());
+    }
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 typename EmptyField<Data_T>::Ptr 
 Field3DInputFile::readProxyLayer(OgIGroup &location, 
@@ -1806,13 +3553,13 @@ Field3DInputFile::readProxyLayer(const std::string &partitionName,
           }
           // Open the layer group
           string layerPath = layer->parent + "/" + layer->name;
-          OgIGroup parent = m_root->findGroup(layer->parent);
+          OgIGroup parent = openPartitionGroup(*part);
           if (!parent.isValid()) {
             Msg::print(Msg::SevWarning, "Couldn't find layer parent " 
                       + layerPath + " in .f3d file ");
             return emptyList;
           }
-          OgIGroup layerGroup = parent.findGroup(layer->name);
+          OgIGroup layerGroup = openLayerGroup(parent, *layer);
           if (!layerGroup.isValid()) {
             Msg::print(Msg::SevWarning, "Couldn't find layer group " 
                       + layerPath + " in .f3d file ");
@@ -1939,6 +3686,40 @@ FIELD3D_INSTANTIATION_WRITELAYER(vec64_t);
 
 //----------------------------------------------------------------------------//
 
+#define FIELD3D_INSTANTIATION_WRITELAYERS(type)                         \
+  template                                                              \
+  bool Field3DOutputFile::writeLayers<type>                             \
+  (const Field<type>::Vec &);                                           \
+  
+FIELD3D_INSTANTIATION_WRITELAYERS(float16_t);
+FIELD3D_INSTANTIATION_WRITELAYERS(float32_t);
+FIELD3D_INSTANTIATION_WRITELAYERS(float64_t);
+FIELD3D_INSTANTIATION_WRITELAYERS(vec16_t);
+FIELD3D_INSTANTIATION_WRITELAYERS(vec32_t);
+FIELD3D_INSTANTIATION_WRITELAYERS(vec64_t);
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_WRITESTREAMED(type)                       \
+  template                                                              \
+  bool Field3DOutputFile::writeDenseLayer<type>                         \
+  (const std::string &, const std::string &, EmptyField<type>::Ptr,     \
+   const boost::function<void (int, type *)> &);                        \
+  template                                                              \
+  bool Field3DOutputFile::writeSparseLayer<type>                        \
+  (const std::string &, const std::string &, EmptyField<type>::Ptr,     \
+   const int,                                                           \
+   const boost::function<bool (const V3i &, type *, type &)> &);        \
+  
+FIELD3D_INSTANTIATION_WRITESTREAMED(float16_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(float32_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(float64_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec16_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec32_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec64_t);
+
+//----------------------------------------------------------------------------//
+
 #if 0
 
 #define FIELD3D_INSTANTIATION_READLAYER(type)                           \
@@ -1987,6 +3768,96 @@ FIELD3D_INSTANTIATION_READLAYERS2(vec64_t);
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+typename Field<Data_T>::Vec
+Field3DInputFile::readLayers(const std::string &name, 
+                             const Box3i &voxelWindow) const
+{
+  typedef typename Field<Data_T>::Ptr FieldPtr;
+  typedef typename Field<Data_T>::Vec FieldList;
+  
+  FieldList ret;
+  std::vector<std::string> parts;
+  getIntPartitionNames(parts);
+
+  for (vector<string>::iterator p = parts.begin(); p != parts.end(); ++p) {
+    vector<std::string> layers;
+    getIntScalarLayerNames(layers, *p);
+    for (vector<string>::iterator l = layers.begin(); l != layers.end(); ++l) {
+      // Only read if it matches the name
+      if ((name.length() == 0) || (*l == name)) {
+        FieldPtr mf = readLayerWindow<Data_T>(*p, *l, &voxelWindow);
+        if (mf) {
+          ret.push_back(mf);
+        }
+      }
+    }
+  }
+  
+  return ret;
+}
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_READLAYERS3(type)                         \
+  template                                                              \
+  Field<type>::Vec                                                      \
+  Field3DInputFile::readLayers<type>                                    \
+  (const std::vector<std::string> &layerNames) const;                   \
+
+FIELD3D_INSTANTIATION_READLAYERS3(float16_t);
+FIELD3D_INSTANTIATION_READLAYERS3(float32_t);
+FIELD3D_INSTANTIATION_READLAYERS3(float64_t);
+FIELD3D_INSTANTIATION_READLAYERS3(vec16_t);
+FIELD3D_INSTANTIATION_READLAYERS3(vec32_t);
+FIELD3D_INSTANTIATION_READLAYERS3(vec64_t);
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_READLAYERS4(type)                         \
+  template                                                              \
+  Field<type>::Vec                                                      \
+  Field3DInputFile::readLayers<type>                                    \
+  (const std::string &name, const Box3i &voxelWindow) const;            \
+
+FIELD3D_INSTANTIATION_READLAYERS4(float16_t);
+FIELD3D_INSTANTIATION_READLAYERS4(float32_t);
+FIELD3D_INSTANTIATION_READLAYERS4(float64_t);
+FIELD3D_INSTANTIATION_READLAYERS4(vec16_t);
+FIELD3D_INSTANTIATION_READLAYERS4(vec32_t);
+FIELD3D_INSTANTIATION_READLAYERS4(vec64_t);
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_READSPARSEATLASES(type)                   \
+  template                                                              \
+  std::vector<boost::shared_ptr<SparseAtlas<type> > >                   \
+  Field3DInputFile::readSparseAtlases<type>                             \
+  (const std::string &partitionName,                                    \
+   const std::string &layerName) const;                                 \
+
+FIELD3D_INSTANTIATION_READSPARSEATLASES(float16_t);
+FIELD3D_INSTANTIATION_READSPARSEATLASES(float32_t);
+FIELD3D_INSTANTIATION_READSPARSEATLASES(float64_t);
+FIELD3D_INSTANTIATION_READSPARSEATLASES(vec16_t);
+FIELD3D_INSTANTIATION_READSPARSEATLASES(vec32_t);
+FIELD3D_INSTANTIATION_READSPARSEATLASES(vec64_t);
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_READMACCOMPONENT(type)                    \
+  template                                                              \
+  DenseField<type>::Ptr                                                 \
+  Field3DInputFile::readMACComponent<type>                              \
+  (const std::string &partitionName, const std::string &layerName,      \
+   const MACComponent comp) const;                                      \
+
+FIELD3D_INSTANTIATION_READMACCOMPONENT(float16_t);
+FIELD3D_INSTANTIATION_READMACCOMPONENT(float32_t);
+FIELD3D_INSTANTIATION_READMACCOMPONENT(float64_t);
+
+//----------------------------------------------------------------------------//
+
 #define FIELD3D_INSTANTIATION_READPROXYLAYER(type)                      \
   template                                                              \
   EmptyField<type>::Vec                                                 \
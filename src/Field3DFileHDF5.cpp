@@ -603,7 +603,9 @@ bool Field3DInputFileHDF5::open(const string &filename)
     // to the terminal.
     checkFile(filename);
 
-    m_file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    H5ScopedPcreate fileAccess(H5P_FILE_ACCESS);
+    setChunkCache(fileAccess.id());
+    m_file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, fileAccess.id());
 
     if (m_file < 0)
       throw NoSuchFileException(filename);
@@ -1590,7 +1592,7 @@ bool writeField(hid_t layerGroup, FieldBase::Ptr field)
 {
   ClassFactory &factory = ClassFactory::singleton();
     
-  FieldIO::Ptr io = factory.createFieldIO(field->className());
+  FieldIO::Ptr io = factory.sharedFieldIO(field->className());
   assert(io != 0);
   if (!io) {
     Msg::print(Msg::SevWarning, "Unable to find class type: " + 
@@ -1622,7 +1624,7 @@ FieldMapping::Ptr readFieldMapping(hid_t mappingGroup)
     return FieldMapping::Ptr();    
   }
 
-  FieldMappingIO::Ptr io = factory.createFieldMappingIO(className);
+  FieldMappingIO::Ptr io = factory.sharedFieldMappingIO(className);
   assert(io != 0);
   if (!io) {
     Msg::print(Msg::SevWarning, "Unable to find class type: " + 
@@ -1653,7 +1655,7 @@ bool writeFieldMapping(hid_t mappingGroup, FieldMapping::Ptr mapping)
     return false;
   }
 
-  FieldMappingIO::Ptr io = factory.createFieldMappingIO(className);
+  FieldMappingIO::Ptr io = factory.sharedFieldMappingIO(className);
   assert(io != 0);
   if (!io) {
     Msg::print(Msg::SevWarning, "Unable to find class type: " + 
@@ -56,8 +56,6 @@ FIELD3D_NAMESPACE_OPEN
 template <typename Data_T>
 boost::mutex FieldCache<Data_T>::ms_creationMutex;
 template <typename Data_T>
-boost::mutex FieldCache<Data_T>::ms_accessMutex;
-template <typename Data_T>
 FieldCache<Data_T>* FieldCache<Data_T>::ms_singleton;
 
 template class FieldCache<half>;
@@ -41,6 +41,11 @@
 
 //----------------------------------------------------------------------------//
 
+#include <cstring>
+#include <limits>
+
+#include <boost/cstdint.hpp>
+
 #include "FieldInterp.h"
 
 //----------------------------------------------------------------------------//
@@ -72,6 +77,58 @@ bool isLegalVoxelCoord(const V3d &vsP, const Box3d &vsDataWindow)
 
 //----------------------------------------------------------------------------//
 
+V3i stochasticVoxel(const Box3i &dataWindow, const V3d &vsP, double xi)
+{
+  // Largest value below 1.0, used to keep the rescaled random number in range
+  static const double maxXi = 1.0 - std::numeric_limits<double>::epsilon();
+
+  xi = std::max(0.0, std::min(xi, maxXi));
+
+  V3i c;
+  for (int dim = 0; dim < 3; ++dim) {
+    // Voxel centers are at .5 coordinates
+    const double p = vsP[dim] - 0.5;
+    const double floorP = std::floor(p);
+    const double f = p - floorP;
+    c[dim] = static_cast<int>(floorP);
+    if (xi < f) {
+      c[dim] += 1;
+      xi = xi / f;
+    } else {
+      xi = (xi - f) / (1.0 - f);
+    }
+    xi = std::min(xi, maxXi);
+  }
+
+  c.x = std::max(dataWindow.min.x, std::min(c.x, dataWindow.max.x));
+  c.y = std::max(dataWindow.min.y, std::min(c.y, dataWindow.max.y));
+  c.z = std::max(dataWindow.min.z, std::min(c.z, dataWindow.max.z));
+
+  return c;
+}
+
+//----------------------------------------------------------------------------//
+
+double stochasticHash(const V3d &vsP)
+{
+  boost::uint64_t h = 0;
+  for (int dim = 0; dim < 3; ++dim) {
+    boost::uint64_t bits;
+    std::memcpy(&bits, &vsP[dim], sizeof(bits));
+    // SplitMix64 finalizer
+    h ^= bits + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+  }
+  // Top 53 bits give a uniform double in [0,1)
+  return static_cast<double>(h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_SOURCE_CLOSE
 
 //----------------------------------------------------------------------------//
@@ -42,9 +42,13 @@
 
 //----------------------------------------------------------------------------//
 
+#include <cstring>
 #include <iostream>
 #include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/thread/tss.hpp>
+
 #include "Field.h"
 #include "FieldMapping.h"
 #include "Types.h"
@@ -104,6 +108,71 @@ namespace {
     return true;
   }
 
+  // Time varying matrix cache ---
+
+  //! Number of entries in each thread's cache of time varying matrices
+  const size_t k_matrixCacheSize = 16;
+
+  //! The transforms of one MatrixFieldMapping at one time. The valid bits
+  //! record which of the matrices have been computed.
+  struct MatrixCacheEntry
+  {
+    MatrixCacheEntry()
+      : serial(0), time(0.0f), valid(0)
+    { }
+    size_t   serial;
+    float    time;
+    unsigned valid;
+    M44d     matrices[4];
+  };
+
+  //! A small direct mapped cache, one per thread
+  struct MatrixCache
+  {
+    MatrixCacheEntry entries[k_matrixCacheSize];
+  };
+
+  boost::thread_specific_ptr<MatrixCache> s_matrixCache;
+
+  //! Hands out the MatrixFieldMapping serial numbers. Zero is never used,
+  //! so empty cache entries never match.
+  boost::atomic<size_t> s_nextMatrixSerial(1);
+
+  //! Picks the cache entry for a mapping and time
+  size_t matrixCacheIndex(const size_t serial, const float time)
+  {
+    unsigned int bits;
+    std::memcpy(&bits, &time, sizeof(bits));
+    return (serial * 31 + bits) % k_matrixCacheSize;
+  }
+
+  //! Transforms n points by the matrix. Affine matrices, which is what
+  //! MatrixFieldMapping normally holds, skip the homogeneous divide so the
+  //! loop is a plain multiply-add the compiler can vectorize.
+  void transformPoints(const M44d &mtx, const V3f *in, V3f *out, 
+                       const size_t n)
+  {
+    if (mtx[0][3] != 0.0 || mtx[1][3] != 0.0 || mtx[2][3] != 0.0 || 
+        mtx[3][3] != 1.0) {
+      for (size_t i = 0; i < n; ++i) {
+        V3d p;
+        mtx.multVecMatrix(V3d(in[i]), p);
+        out[i] = V3f(p);
+      }
+      return;
+    }
+    const double m00 = mtx[0][0], m01 = mtx[0][1], m02 = mtx[0][2];
+    const double m10 = mtx[1][0], m11 = mtx[1][1], m12 = mtx[1][2];
+    const double m20 = mtx[2][0], m21 = mtx[2][1], m22 = mtx[2][2];
+    const double m30 = mtx[3][0], m31 = mtx[3][1], m32 = mtx[3][2];
+    for (size_t i = 0; i < n; ++i) {
+      const double x = in[i].x, y = in[i].y, z = in[i].z;
+      out[i].x = static_cast<float>(x * m00 + y * m10 + z * m20 + m30);
+      out[i].y = static_cast<float>(x * m01 + y * m11 + z * m21 + m31);
+      out[i].z = static_cast<float>(x * m02 + y * m12 + z * m22 + m32);
+    }
+  }
+
 }
 
 //----------------------------------------------------------------------------//
@@ -166,6 +235,54 @@ void FieldMapping::voxelToLocal(const V3d &vsP, V3d &lsP) const
   lsP.z = FIELD3D_LERPFACTOR(vsP.z, m_origin.z, m_origin.z + m_res.z);
 }
 
+//----------------------------------------------------------------------------//
+
+void FieldMapping::worldToVoxel(const V3f *wsP, V3f *vsP, 
+                                const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    V3d p;
+    worldToVoxel(V3d(wsP[i]), p);
+    vsP[i] = V3f(p);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void FieldMapping::worldToVoxel(const V3f *wsP, V3f *vsP, const size_t n,
+                                float time) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    V3d p;
+    worldToVoxel(V3d(wsP[i]), p, time);
+    vsP[i] = V3f(p);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void FieldMapping::voxelToWorld(const V3f *vsP, V3f *wsP, 
+                                const size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    V3d p;
+    voxelToWorld(V3d(vsP[i]), p);
+    wsP[i] = V3f(p);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void FieldMapping::voxelToWorld(const V3f *vsP, V3f *wsP, const size_t n,
+                                float time) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    V3d p;
+    voxelToWorld(V3d(vsP[i]), p, time);
+    wsP[i] = V3f(p);
+  }
+}
+
 //----------------------------------------------------------------------------//
 // Utilities
 //----------------------------------------------------------------------------//
@@ -380,6 +497,9 @@ void MatrixFieldMapping::updateTransform()
   // See if the curve has more than just a single sample
   m_isTimeVarying = m_lsToWsCurve.numSamples() > 1;
 
+  // Previously cached matrices no longer apply
+  m_serial = s_nextMatrixSerial++;
+
   // Sample the time-varying transforms at time=0.0
   m_lsToWs = m_lsToWsCurve.linear(0.0);
   m_wsToLs = m_lsToWs.inverse();
@@ -399,6 +519,47 @@ void MatrixFieldMapping::updateTransform()
 
 //----------------------------------------------------------------------------//
 
+const M44d& 
+MatrixFieldMapping::matrixAtTime(const TimeMatrix which, const float time) const
+{
+  MatrixCache *cache = s_matrixCache.get();
+  if (!cache) {
+    cache = new MatrixCache;
+    s_matrixCache.reset(cache);
+  }
+
+  MatrixCacheEntry &entry = cache->entries[matrixCacheIndex(m_serial, time)];
+  if (entry.serial != m_serial || entry.time != time) {
+    entry.serial = m_serial;
+    entry.time   = time;
+    entry.valid  = 0;
+  }
+
+  const unsigned bit = 1u << which;
+  if (!(entry.valid & bit)) {
+    switch (which) {
+    case LsToWs:
+      entry.matrices[which] = m_lsToWsCurve.linear(time);
+      break;
+    case WsToLs:
+      entry.matrices[which] = m_lsToWsCurve.linear(time).inverse();
+      break;
+    case VsToWs:
+      entry.matrices[which] = m_vsToWsCurve.linear(time);
+      break;
+    case WsToVs:
+    default:
+      entry.matrices[which] = m_vsToWsCurve.linear(time).inverse();
+      break;
+    }
+    entry.valid |= bit;
+  }
+
+  return entry.matrices[which];
+}
+
+//----------------------------------------------------------------------------//
+
 void MatrixFieldMapping::getLocalToVoxelMatrix(M44d &result)
 {
   // Local to voxel is a scale by the resolution of the field, offset
@@ -411,6 +572,46 @@ void MatrixFieldMapping::getLocalToVoxelMatrix(M44d &result)
 
 //----------------------------------------------------------------------------//
 
+void MatrixFieldMapping::worldToVoxel(const V3f *wsP, V3f *vsP, 
+                                      const size_t n) const
+{
+  transformPoints(m_wsToVs, wsP, vsP, n);
+}
+
+//----------------------------------------------------------------------------//
+
+void MatrixFieldMapping::worldToVoxel(const V3f *wsP, V3f *vsP, 
+                                      const size_t n, float time) const
+{
+  if (!m_isTimeVarying) {
+    transformPoints(m_wsToVs, wsP, vsP, n);
+  } else {
+    transformPoints(matrixAtTime(WsToVs, time), wsP, vsP, n);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void MatrixFieldMapping::voxelToWorld(const V3f *vsP, V3f *wsP, 
+                                      const size_t n) const
+{
+  transformPoints(m_vsToWs, vsP, wsP, n);
+}
+
+//----------------------------------------------------------------------------//
+
+void MatrixFieldMapping::voxelToWorld(const V3f *vsP, V3f *wsP, 
+                                      const size_t n, float time) const
+{
+  if (!m_isTimeVarying) {
+    transformPoints(m_vsToWs, vsP, wsP, n);
+  } else {
+    transformPoints(matrixAtTime(VsToWs, time), vsP, wsP, n);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 FieldMapping::Ptr MatrixFieldMapping::clone() const
 {
   return Ptr(new MatrixFieldMapping(*this));
@@ -423,7 +624,8 @@ FieldMapping::Ptr MatrixFieldMapping::clone() const
 FrustumFieldMapping::FrustumFieldMapping()
   : FieldMapping(),
     m_zDistribution(PerspectiveDistribution),
-    m_defaultState(true)
+    m_defaultState(true),
+    m_isStatic(false)
 { 
   reset();
 }
@@ -431,7 +633,10 @@ FrustumFieldMapping::FrustumFieldMapping()
 //----------------------------------------------------------------------------//
 
 FrustumFieldMapping::FrustumFieldMapping(const Box3i &extents)
-  : FieldMapping(extents)
+  : FieldMapping(extents),
+    m_zDistribution(PerspectiveDistribution),
+    m_defaultState(true),
+    m_isStatic(false)
 { 
   reset();
 }
@@ -556,6 +761,10 @@ void FrustumFieldMapping::worldToVoxel(const V3d &wsP, V3d &vsP) const
 
 void FrustumFieldMapping::worldToVoxel(const V3d &wsP, V3d &vsP, float time) const
 {
+  if (m_isStatic) {
+    worldToVoxelStatic(wsP, vsP);
+    return;
+  }
   V3d lsP;
   worldToLocal(wsP, lsP, time);
   localToVoxel(lsP, vsP);
@@ -572,6 +781,10 @@ void FrustumFieldMapping::voxelToWorld(const V3d &vsP, V3d &wsP) const
 
 void FrustumFieldMapping::voxelToWorld(const V3d &vsP, V3d &wsP, float time) const
 {
+  if (m_isStatic) {
+    voxelToWorldStatic(vsP, wsP);
+    return;
+  }
   V3d lsP;
   voxelToLocal(vsP, lsP);
   localToWorld(lsP, wsP, time);
@@ -659,6 +872,54 @@ void FrustumFieldMapping::localToWorld(const V3d &lsP, V3d &wsP, float time) con
 
 //----------------------------------------------------------------------------//
 
+void FrustumFieldMapping::worldToVoxel(const V3f *wsP, V3f *vsP, 
+                                       const size_t n) const
+{
+  worldToVoxel(wsP, vsP, n, 0.0);
+}
+
+//----------------------------------------------------------------------------//
+
+void FrustumFieldMapping::worldToVoxel(const V3f *wsP, V3f *vsP, 
+                                       const size_t n, float time) const
+{
+  if (!m_isStatic) {
+    FieldMapping::worldToVoxel(wsP, vsP, n, time);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    V3d p;
+    worldToVoxelStatic(V3d(wsP[i]), p);
+    vsP[i] = V3f(p);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void FrustumFieldMapping::voxelToWorld(const V3f *vsP, V3f *wsP, 
+                                       const size_t n) const
+{
+  voxelToWorld(vsP, wsP, n, 0.0);
+}
+
+//----------------------------------------------------------------------------//
+
+void FrustumFieldMapping::voxelToWorld(const V3f *vsP, V3f *wsP, 
+                                       const size_t n, float time) const
+{
+  if (!m_isStatic) {
+    FieldMapping::voxelToWorld(vsP, wsP, n, time);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    V3d p;
+    voxelToWorldStatic(V3d(vsP[i]), p);
+    wsP[i] = V3f(p);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 std::string FrustumFieldMapping::className() const
 {
   return std::string(staticClassType());
@@ -736,6 +997,10 @@ V3d FrustumFieldMapping::wsVoxelSize(int /*i*/, int /*j*/, int k) const
 
 void FrustumFieldMapping::computeVoxelSize() 
 {
+  // The voxel size is measured with voxelToWorld(), so the fast path
+  // needs to be current first
+  computeStaticTransforms();
+
   // Precompute the voxel size ---
 
   m_wsVoxelSize.resize(static_cast<int>(m_res.z),V3d(0.0));
@@ -772,6 +1037,65 @@ void FrustumFieldMapping::computeVoxelSize()
 
 //----------------------------------------------------------------------------//
 
+void FrustumFieldMapping::computeStaticTransforms()
+{
+  m_isStatic = 
+    m_lpsToWsCurve.numSamples() == 1 && m_csToWsCurve.numSamples() == 1 &&
+    m_nearCurve.numSamples() == 1 && m_farCurve.numSamples() == 1;
+  if (!m_isStatic) {
+    return;
+  }
+
+  M44d lsToVs;
+  getLocalToVoxelMatrix(lsToVs);
+
+  m_lpsToWs = m_lpsToWsCurve.linear(0.0);
+  const M44d wsToLps = m_lpsToWs.inverse();
+  const M44d csToWs = m_csToWsCurve.linear(0.0);
+
+  m_wsToVs  = wsToLps * lsToVs;
+  m_vsToWs  = lsToVs.inverse() * m_lpsToWs;
+  m_wsToCs  = csToWs.inverse();
+  m_csToLps = csToWs * wsToLps;
+  m_near    = m_nearCurve.linear(0.0);
+  m_far     = m_farCurve.linear(0.0);
+}
+
+//----------------------------------------------------------------------------//
+
+void FrustumFieldMapping::worldToVoxelStatic(const V3d &wsP, V3d &vsP) const
+{
+  m_wsToVs.multVecMatrix(wsP, vsP);
+  if (m_zDistribution == UniformDistribution) {
+    // Camera space depth, mapped linearly from near to far
+    V3d csP;
+    m_wsToCs.multVecMatrix(wsP, csP);
+    vsP.z = m_origin.z + 
+      m_res.z * FIELD3D_LERPFACTOR(-csP.z, m_near, m_far);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void FrustumFieldMapping::voxelToWorldStatic(const V3d &vsP, V3d &wsP) const
+{
+  if (m_zDistribution != UniformDistribution) {
+    m_vsToWs.multVecMatrix(vsP, wsP);
+    return;
+  }
+  // Distance from the camera of the voxel's slice
+  V3d lsP;
+  voxelToLocal(vsP, lsP);
+  const double depth = FIELD3D_LERP(m_near, m_far, lsP.z);
+  // Local perspective depth of the camera space point (0, 0, -depth)
+  const double z = -depth * m_csToLps[2][2] + m_csToLps[3][2];
+  const double w = -depth * m_csToLps[2][3] + m_csToLps[3][3];
+  // Transform the voxel at that depth
+  m_lpsToWs.multVecMatrix(V3d(lsP.x, lsP.y, z / w), wsP);
+}
+
+//----------------------------------------------------------------------------//
+
 void FrustumFieldMapping::getLocalToVoxelMatrix(M44d &result)
 {
   // Local to voxel is a scale by the resolution of the field, offset
@@ -55,10 +55,30 @@ FIELD3D_NAMESPACE_OPEN
 // FieldMetadata implementations
 //----------------------------------------------------------------------------//
 
+FieldMetadata::Data& FieldMetadata::writableData()
+{
+  if (!m_data) {
+    m_data.reset(new Data);
+  } else if (!m_data.unique()) {
+    m_data.reset(new Data(*m_data));
+  }
+  return *m_data;
+}
+
+//----------------------------------------------------------------------------//
+
+const FieldMetadata::Data& FieldMetadata::emptyData()
+{
+  static const Data empty;
+  return empty;
+}
+
+//----------------------------------------------------------------------------//
+
 void FieldMetadata::setVecFloatMetadata(const std::string &name, 
                                         const V3f &val)
 { 
-  m_vecFloatMetadata[name] = val; 
+  writableData().vecFloatMetadata[name] = val; 
   if (m_owner) {
     m_owner->metadataHasChanged(name);
   }
@@ -69,7 +89,7 @@ void FieldMetadata::setVecFloatMetadata(const std::string &name,
 void FieldMetadata::setFloatMetadata(const std::string &name, 
                                      const float val)
 { 
-  m_floatMetadata[name] = val; 
+  writableData().floatMetadata[name] = val; 
   if (m_owner) {
     m_owner->metadataHasChanged(name);
   }
@@ -80,7 +100,7 @@ void FieldMetadata::setFloatMetadata(const std::string &name,
 void FieldMetadata::setVecIntMetadata(const std::string &name, 
                                       const V3i &val)
 { 
-  m_vecIntMetadata[name] = val; 
+  writableData().vecIntMetadata[name] = val; 
   if (m_owner) {
     m_owner->metadataHasChanged(name);
   }
@@ -91,7 +111,7 @@ void FieldMetadata::setVecIntMetadata(const std::string &name,
 void FieldMetadata::setIntMetadata(const std::string &name, 
                                    const int val)
 { 
-  m_intMetadata[name] = val; 
+  writableData().intMetadata[name] = val; 
   if (m_owner) {
     m_owner->metadataHasChanged(name);
   }
@@ -102,7 +122,7 @@ void FieldMetadata::setIntMetadata(const std::string &name,
 void FieldMetadata::setStrMetadata(const std::string &name, 
                                    const std::string &val)
 { 
-  m_strMetadata[name] = val; 
+  writableData().strMetadata[name] = val; 
   if (m_owner) {
     m_owner->metadataHasChanged(name);
   }
@@ -115,8 +135,9 @@ V3f FieldMetadata::vecFloatMetadata(const std::string &name,
 {
   V3f retVal = defaultVal;
   
-  VecFloatMetadata::const_iterator i = m_vecFloatMetadata.find(name);
-  if (i != m_vecFloatMetadata.end()) {
+  const VecFloatMetadata &metadata = data().vecFloatMetadata;
+  VecFloatMetadata::const_iterator i = metadata.find(name);
+  if (i != metadata.end()) {
     retVal = i->second;
   } 
 
@@ -130,8 +151,9 @@ float FieldMetadata::floatMetadata(const std::string &name,
 {
   float retVal = defaultVal;
 
-  FloatMetadata::const_iterator i = m_floatMetadata.find(name);
-  if (i != m_floatMetadata.end()) {
+  const FloatMetadata &metadata = data().floatMetadata;
+  FloatMetadata::const_iterator i = metadata.find(name);
+  if (i != metadata.end()) {
     retVal = i->second;
   } 
 
@@ -145,8 +167,9 @@ V3i FieldMetadata::vecIntMetadata(const std::string &name,
 {
   V3i retVal = defaultVal;
 
-  VecIntMetadata::const_iterator i = m_vecIntMetadata.find(name);
-  if (i != m_vecIntMetadata.end()) {
+  const VecIntMetadata &metadata = data().vecIntMetadata;
+  VecIntMetadata::const_iterator i = metadata.find(name);
+  if (i != metadata.end()) {
     retVal = i->second;
   } 
 
@@ -160,8 +183,9 @@ int FieldMetadata::intMetadata(const std::string &name,
 {
   int retVal = defaultVal;
 
-  IntMetadata::const_iterator i = m_intMetadata.find(name);
-  if (i != m_intMetadata.end()) {
+  const IntMetadata &metadata = data().intMetadata;
+  IntMetadata::const_iterator i = metadata.find(name);
+  if (i != metadata.end()) {
     retVal = i->second;
   } 
 
@@ -175,8 +199,9 @@ std::string FieldMetadata::strMetadata(const std::string &name,
 {
   std::string retVal = defaultVal;
 
-  StrMetadata::const_iterator i = m_strMetadata.find(name);
-  if (i != m_strMetadata.end()) {
+  const StrMetadata &metadata = data().strMetadata;
+  StrMetadata::const_iterator i = metadata.find(name);
+  if (i != metadata.end()) {
     retVal = i->second;
   } 
 
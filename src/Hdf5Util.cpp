@@ -47,7 +47,15 @@
 
 #include <iostream>
 #include <vector>
+#include <boost/atomic.hpp>
 #include <boost/scoped_array.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <zlib.h>
+
+#include "BlockCodec.h"
+#include "InitIO.h"
+#include "ThreadPool.h"
 
 
 //----------------------------------------------------------------------------//
@@ -743,6 +751,378 @@ bool checkHdf5Gzip()
 
 //----------------------------------------------------------------------------//
 
+void setChunkCache(hid_t fileAccessList)
+{
+  GlobalLock lock(g_hdf5Mutex);
+
+  if (hdf5ChunkCacheBytes() == 0 && hdf5ChunkCacheSlots() == 0) {
+    return;
+  }
+
+  int    mdcElements;
+  size_t numSlots, numBytes;
+  double w0;
+  if (H5Pget_cache(fileAccessList, &mdcElements, &numSlots, &numBytes, 
+                   &w0) < 0) {
+    return;
+  }
+  if (hdf5ChunkCacheBytes() > 0) {
+    numBytes = hdf5ChunkCacheBytes();
+  }
+  if (hdf5ChunkCacheSlots() > 0) {
+    numSlots = hdf5ChunkCacheSlots();
+  }
+  H5Pset_cache(fileAccessList, mdcElements, numSlots, numBytes, w0);
+}
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //! Inflates a batch of raw chunks, handing out one chunk at a time
+  class InflateChunkOp
+  {
+  public:
+    InflateChunkOp(const std::vector<std::vector<uint8_t> > &chunks,
+                   const size_t firstChunk, const size_t chunkBytes,
+                   const size_t totalBytes, uint8_t *dst,
+                   boost::atomic<size_t> &nextChunk, 
+                   boost::atomic<bool> &failed)
+      : m_chunks(chunks), m_firstChunk(firstChunk), m_chunkBytes(chunkBytes),
+        m_totalBytes(totalBytes), m_dst(dst), m_nextChunk(nextChunk), 
+        m_failed(failed)
+    { }
+    void operator() ()
+    {
+      for (size_t i = m_nextChunk.fetch_add(1); 
+           i < m_chunks.size() && !m_failed; i = m_nextChunk.fetch_add(1)) {
+        const size_t offset = (m_firstChunk + i) * m_chunkBytes;
+        const size_t length = std::min(m_chunkBytes, m_totalBytes - offset);
+        // Chunks are always stored whole, so the last one is inflated 
+        // off to the side
+        uint8_t *target = m_dst + offset;
+        if (length < m_chunkBytes) {
+          m_partial.resize(m_chunkBytes);
+          target = &m_partial[0];
+        }
+        if (!BlockCodec::decompress(SparseCodecZlib, 1, &m_chunks[i][0], 
+                                    m_chunks[i].size(), target, m_chunkBytes,
+                                    m_scratch)) {
+          m_failed = true;
+          return;
+        }
+        if (length < m_chunkBytes) {
+          std::copy(m_partial.begin(), m_partial.begin() + length, 
+                    m_dst + offset);
+        }
+      }
+    }
+  private:
+    const std::vector<std::vector<uint8_t> > &m_chunks;
+    const size_t m_firstChunk;
+    const size_t m_chunkBytes;
+    const size_t m_totalBytes;
+    uint8_t *m_dst;
+    boost::atomic<size_t> &m_nextChunk;
+    boost::atomic<bool> &m_failed;
+    std::vector<uint8_t> m_partial;
+    std::vector<uint8_t> m_scratch;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Where the data of a chunk comes from, and where it goes in the data set
+  struct DeflateChunk
+  {
+    //! The chunk's data
+    const uint8_t *src;
+    //! Bytes of data in the chunk. Only the last chunk of a one-dimensional
+    //! data set may be short
+    size_t numBytes;
+    //! Position of the chunk's first element in the data set
+    hsize_t offset[2];
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Deflates a batch of chunks, handing out one chunk at a time. Short 
+  //! chunks are padded with zeros, which is HDF5's default fill value.
+  class DeflateChunkOp
+  {
+  public:
+    DeflateChunkOp(const std::vector<DeflateChunk> &chunks, 
+                   const size_t firstChunk, const size_t chunkBytes,
+                   const int level, std::vector<std::vector<uint8_t> > &dst,
+                   boost::atomic<size_t> &nextChunk, 
+                   boost::atomic<bool> &failed)
+      : m_chunks(chunks), m_firstChunk(firstChunk), m_chunkBytes(chunkBytes),
+        m_level(level), m_dst(dst), m_nextChunk(nextChunk), m_failed(failed)
+    { }
+    void operator() ()
+    {
+      for (size_t i = m_nextChunk.fetch_add(1); 
+           i < m_dst.size() && !m_failed; i = m_nextChunk.fetch_add(1)) {
+        const DeflateChunk &chunk = m_chunks[m_firstChunk + i];
+        const uint8_t *src = chunk.src;
+        if (chunk.numBytes < m_chunkBytes) {
+          m_partial.assign(m_chunkBytes, 0);
+          std::copy(src, src + chunk.numBytes, m_partial.begin());
+          src = &m_partial[0];
+        }
+        std::vector<uint8_t> &cmp = m_dst[i];
+        cmp.resize(compressBound(m_chunkBytes));
+        uLong cmpLen = cmp.size();
+        if (compress2(&cmp[0], &cmpLen, src, m_chunkBytes, m_level) != Z_OK) {
+          m_failed = true;
+          return;
+        }
+        cmp.resize(cmpLen);
+      }
+    }
+  private:
+    const std::vector<DeflateChunk> &m_chunks;
+    const size_t m_firstChunk;
+    const size_t m_chunkBytes;
+    const int m_level;
+    std::vector<std::vector<uint8_t> > &m_dst;
+    boost::atomic<size_t> &m_nextChunk;
+    boost::atomic<bool> &m_failed;
+    std::vector<uint8_t> m_partial;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Checks that a data set is chunked and that its only filter is deflate,
+  //! and returns its dimensions, those of its chunks and the deflate level
+  bool deflatedLayout(hid_t dataSet, int &rank, hsize_t dims[2], 
+                      hsize_t chunkDims[2], int &level)
+  {
+    GlobalLock lock(g_hdf5Mutex);
+
+    H5ScopedDget_space dataSpace(dataSet);
+    if (dataSpace.id() < 0) {
+      return false;
+    }
+    rank = H5Sget_simple_extent_ndims(dataSpace.id());
+    if (rank < 1 || rank > 2) {
+      return false;
+    }
+    H5Sget_simple_extent_dims(dataSpace.id(), dims, NULL);
+
+    H5ScopedDget_create_plist dcpl(dataSet);
+    if (dcpl.id() < 0 || H5Pget_layout(dcpl.id()) != H5D_CHUNKED || 
+        H5Pget_chunk(dcpl.id(), rank, chunkDims) != rank ||
+        H5Pget_nfilters(dcpl.id()) != 1) {
+      return false;
+    }
+    unsigned int flags, filterConfig, values[1];
+    size_t numValues = 1;
+    if (H5Pget_filter2(dcpl.id(), 0, &flags, &numValues, values, 0, NULL, 
+                       &filterConfig) != H5Z_FILTER_DEFLATE || 
+        numValues < 1) {
+      return false;
+    }
+    level = static_cast<int>(values[0]);
+
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Deflates chunks of chunkBytes bytes on numIOThreads() threads, and 
+  //! writes them under the HDF5 lock
+  bool writeChunks(hid_t dataSet, const std::vector<DeflateChunk> &chunks,
+                   const size_t chunkBytes, const int level)
+  {
+#if H5_VERSION_GE(1, 10, 3)
+
+    const size_t numThreads = numIOThreads();
+    // Chunks are deflated a few per thread ahead of the writes
+    const size_t batchSize  = 4 * numThreads;
+
+    std::vector<std::vector<uint8_t> > deflated;
+    for (size_t first = 0; first < chunks.size(); first += batchSize) {
+      deflated.resize(std::min(batchSize, chunks.size() - first));
+      // Deflate them
+      boost::atomic<size_t> nextChunk(0);
+      boost::atomic<bool>   failed(false);
+      DeflateChunkOp op(chunks, first, chunkBytes, level, deflated, 
+                        nextChunk, failed);
+      if (deflated.size() > 1) {
+        runOnThreads(op, numThreads);
+      } else {
+        op();
+      }
+      if (failed) {
+        return false;
+      }
+      // Write the raw chunks
+      GlobalLock lock(g_hdf5Mutex);
+      for (size_t i = 0; i < deflated.size(); ++i) {
+        if (H5Dwrite_chunk(dataSet, H5P_DEFAULT, 0, chunks[first + i].offset,
+                           deflated[i].size(), &deflated[i][0]) < 0) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+
+#else
+
+    return false;
+
+#endif
+  }
+
+}
+
+//----------------------------------------------------------------------------//
+
+bool readDeflatedChunks(hid_t dataSet, const size_t elementSize, void *dst)
+{
+#if H5_VERSION_GE(1, 10, 3)
+
+  hsize_t length, chunkLength;
+
+  // Check that the data set is a chunked, one-dimensional array whose only
+  // filter is deflate
+  {
+    GlobalLock lock(g_hdf5Mutex);
+
+    H5ScopedDget_space dataSpace(dataSet);
+    if (dataSpace.id() < 0 || 
+        H5Sget_simple_extent_ndims(dataSpace.id()) != 1) {
+      return false;
+    }
+    H5Sget_simple_extent_dims(dataSpace.id(), &length, NULL);
+
+    H5ScopedDget_create_plist dcpl(dataSet);
+    if (dcpl.id() < 0 || H5Pget_layout(dcpl.id()) != H5D_CHUNKED || 
+        H5Pget_chunk(dcpl.id(), 1, &chunkLength) != 1 ||
+        H5Pget_nfilters(dcpl.id()) != 1) {
+      return false;
+    }
+    unsigned int flags, filterConfig;
+    size_t numValues = 0;
+    if (H5Pget_filter2(dcpl.id(), 0, &flags, &numValues, NULL, 0, NULL, 
+                       &filterConfig) != H5Z_FILTER_DEFLATE) {
+      return false;
+    }
+  }
+
+  if (length == 0 || chunkLength == 0) {
+    return false;
+  }
+
+  const size_t numChunks  = (length + chunkLength - 1) / chunkLength;
+  const size_t chunkBytes = chunkLength * elementSize;
+  const size_t totalBytes = length * elementSize;
+  const size_t numThreads = numIOThreads();
+  // Raw chunks are read a few per thread ahead of the inflation
+  const size_t batchSize  = 4 * numThreads;
+
+  std::vector<std::vector<uint8_t> > chunks;
+  for (size_t first = 0; first < numChunks; first += batchSize) {
+    chunks.resize(std::min(batchSize, numChunks - first));
+    // Read the raw chunks
+    {
+      GlobalLock lock(g_hdf5Mutex);
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        hsize_t offset = (first + i) * chunkLength;
+        hsize_t storageSize;
+        if (H5Dget_chunk_storage_size(dataSet, &offset, &storageSize) < 0 ||
+            storageSize == 0) {
+          return false;
+        }
+        chunks[i].resize(storageSize);
+        uint32_t filterMask = 0;
+        if (H5Dread_chunk(dataSet, H5P_DEFAULT, &offset, &filterMask, 
+                          &chunks[i][0]) < 0 || filterMask != 0) {
+          return false;
+        }
+      }
+    }
+    // Inflate them
+    boost::atomic<size_t> nextChunk(0);
+    boost::atomic<bool>   failed(false);
+    InflateChunkOp op(chunks, first, chunkBytes, totalBytes, 
+                      static_cast<uint8_t *>(dst), nextChunk, failed);
+    if (chunks.size() > 1) {
+      runOnThreads(op, numThreads);
+    } else {
+      op();
+    }
+    if (failed) {
+      return false;
+    }
+  }
+
+  return true;
+
+#else
+
+  return false;
+
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+bool writeDeflatedChunks(hid_t dataSet, const size_t elementSize, 
+                         const void *src)
+{
+  int     rank, level;
+  hsize_t dims[2], chunkDims[2];
+  if (!deflatedLayout(dataSet, rank, dims, chunkDims, level) || rank != 1 ||
+      dims[0] == 0 || chunkDims[0] == 0) {
+    return false;
+  }
+
+  const size_t   numChunks  = (dims[0] + chunkDims[0] - 1) / chunkDims[0];
+  const size_t   chunkBytes = chunkDims[0] * elementSize;
+  const size_t   totalBytes = dims[0] * elementSize;
+  const uint8_t *bytes      = static_cast<const uint8_t *>(src);
+
+  std::vector<DeflateChunk> chunks(numChunks);
+  for (size_t i = 0; i < numChunks; ++i) {
+    chunks[i].src       = bytes + i * chunkBytes;
+    chunks[i].numBytes  = std::min(chunkBytes, totalBytes - i * chunkBytes);
+    chunks[i].offset[0] = i * chunkDims[0];
+    chunks[i].offset[1] = 0;
+  }
+
+  return writeChunks(dataSet, chunks, chunkBytes, level);
+}
+
+//----------------------------------------------------------------------------//
+
+bool writeDeflatedRows(hid_t dataSet, const size_t elementSize, 
+                       const std::vector<const void *> &rows)
+{
+  int     rank, level;
+  hsize_t dims[2], chunkDims[2];
+  if (!deflatedLayout(dataSet, rank, dims, chunkDims, level) || rank != 2 ||
+      dims[0] != rows.size() || chunkDims[0] != 1 || 
+      chunkDims[1] != dims[1]) {
+    return false;
+  }
+
+  const size_t chunkBytes = dims[1] * elementSize;
+
+  std::vector<DeflateChunk> chunks(rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    chunks[i].src       = static_cast<const uint8_t *>(rows[i]);
+    chunks[i].numBytes  = chunkBytes;
+    chunks[i].offset[0] = i;
+    chunks[i].offset[1] = 0;
+  }
+
+  return writeChunks(dataSet, chunks, chunkBytes, level);
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Hdf5Util
 
 //----------------------------------------------------------------------------//
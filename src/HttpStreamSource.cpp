@@ -0,0 +1,465 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*! \file HttpStreamSource.cpp
+  Contains the implementation of HttpStreamSource
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "StreamSource.h"
+
+// System includes
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#ifndef WIN32
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+// Boost includes
+#include <boost/thread/mutex.hpp>
+
+// Library includes
+#include "Log.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Seconds that sending or receiving may stall before a request fails
+const int k_timeoutSeconds = 30;
+
+//! Number of times a failed request is sent again
+const int k_numRetries = 2;
+
+//! Largest response header that is accepted
+const size_t k_maxHeaderBytes = 64 * 1024;
+
+//----------------------------------------------------------------------------//
+
+//! Splits an http:// URL into its host, port and path, which includes the
+//! query string
+bool parseUrl(const std::string &url, std::string &host, std::string &port,
+              std::string &path)
+{
+  const std::string prefix("http://");
+  if (url.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  const size_t hostStart = prefix.size();
+  const size_t pathStart = url.find('/', hostStart);
+  const std::string authority = 
+    url.substr(hostStart, pathStart == std::string::npos ? 
+               std::string::npos : pathStart - hostStart);
+  path = pathStart == std::string::npos ? "/" : url.substr(pathStart);
+  const size_t colon = authority.rfind(':');
+  if (colon == std::string::npos) {
+    host = authority;
+    port = "80";
+  } else {
+    host = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  }
+  return !host.empty() && !port.empty();
+}
+
+//----------------------------------------------------------------------------//
+
+//! What a range request's response said about the data
+struct RangeResponse
+{
+  RangeResponse()
+    : status(0), contentLength(0), totalSize(0), keepAlive(true)
+  { }
+  int             status;
+  boost::uint64_t contentLength;
+  boost::uint64_t totalSize;
+  bool            keepAlive;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Parses the status line and the headers that matter for range requests
+bool parseResponseHeader(const std::string &header, RangeResponse &response)
+{
+  std::istringstream in(header);
+  std::string line;
+  if (!std::getline(in, line)) {
+    return false;
+  }
+  // "HTTP/1.1 206 Partial Content"
+  const size_t space = line.find(' ');
+  if (line.compare(0, 5, "HTTP/") != 0 || space == std::string::npos) {
+    return false;
+  }
+  response.status = std::atoi(line.c_str() + space + 1);
+  response.keepAlive = line.compare(0, 8, "HTTP/1.0") != 0;
+  bool hasLength = false;
+  while (std::getline(in, line)) {
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    std::string value = line.substr(colon + 1);
+    const size_t begin = value.find_first_not_of(" \t");
+    const size_t end = value.find_last_not_of(" \t\r");
+    value = begin == std::string::npos ? 
+      std::string() : value.substr(begin, end - begin + 1);
+    if (name == "content-length") {
+      response.contentLength = std::strtoull(value.c_str(), NULL, 10);
+      hasLength = true;
+    } else if (name == "content-range") {
+      // "bytes 0-1023/146515"
+      const size_t slash = value.find('/');
+      if (slash != std::string::npos) {
+        response.totalSize = 
+          std::strtoull(value.c_str() + slash + 1, NULL, 10);
+      }
+    } else if (name == "connection") {
+      std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+      response.keepAlive = value != "close";
+    } else if (name == "transfer-encoding") {
+      // Range responses have a length, chunked ones aren't expected
+      return false;
+    }
+  }
+  return hasLength;
+}
+
+//----------------------------------------------------------------------------//
+
+#ifndef WIN32
+
+//----------------------------------------------------------------------------//
+
+//! Opens a TCP connection, returns -1 on failure
+int connectTo(const std::string &host, const std::string &port)
+{
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = NULL;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd >= 0) {
+    timeval timeout;
+    timeout.tv_sec = k_timeoutSeconds;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    const int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  }
+  return fd;
+}
+
+//----------------------------------------------------------------------------//
+
+bool sendAll(const int fd, const std::string &data)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t n = send(fd, data.data() + sent, data.size() - sent, flags);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Receives up to numBytes, returns the number received or -1 on failure
+ssize_t receiveSome(const int fd, char *buffer, const size_t numBytes)
+{
+  for (;;) {
+    const ssize_t n = recv(fd, buffer, numBytes, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    return n;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Requests numBytes bytes at pos and reads them into buffer. The body is
+//! only accepted if it's exactly the requested range.
+bool rangeRequest(const int fd, const std::string &host, 
+                  const std::string &path, const boost::uint64_t pos, 
+                  const boost::uint64_t numBytes, char *buffer, 
+                  RangeResponse &response)
+{
+  std::ostringstream request;
+  request << "GET " << path << " HTTP/1.1\r\n"
+          << "Host: " << host << "\r\n"
+          << "Range: bytes=" << pos << "-" << pos + numBytes - 1 << "\r\n"
+          << "Connection: keep-alive\r\n"
+          << "\r\n";
+  if (!sendAll(fd, request.str())) {
+    return false;
+  }
+
+  // Read until the end of the header. What follows it is body.
+  std::string header;
+  size_t headerEnd = std::string::npos;
+  char chunk[16384];
+  while (headerEnd == std::string::npos) {
+    const ssize_t n = receiveSome(fd, chunk, sizeof(chunk));
+    if (n <= 0 || header.size() > k_maxHeaderBytes) {
+      return false;
+    }
+    header.append(chunk, n);
+    headerEnd = header.find("\r\n\r\n");
+  }
+  if (!parseResponseHeader(header.substr(0, headerEnd + 2), response)) {
+    return false;
+  }
+  if (response.status != 206 || response.contentLength != numBytes) {
+    return false;
+  }
+
+  const size_t bodyStart = headerEnd + 4;
+  const boost::uint64_t early = 
+    std::min(static_cast<boost::uint64_t>(header.size() - bodyStart), 
+             numBytes);
+  std::memcpy(buffer, header.data() + bodyStart, early);
+  boost::uint64_t received = early;
+  while (received < numBytes) {
+    const ssize_t n = receiveSome(fd, buffer + received, numBytes - received);
+    if (n <= 0) {
+      return false;
+    }
+    received += n;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+#endif // WIN32
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// HttpStreamSource::Connection
+//----------------------------------------------------------------------------//
+
+struct HttpStreamSource::Connection
+{
+  ~Connection()
+  {
+#ifndef WIN32
+    for (size_t i = 0; i < idle.size(); ++i) {
+      close(idle[i]);
+    }
+#endif
+  }
+  std::string      url;
+  std::string      host;
+  std::string      port;
+  std::string      path;
+  boost::mutex     mutex;
+  //! Sockets of finished requests that the server keeps open
+  std::vector<int> idle;
+};
+
+//----------------------------------------------------------------------------//
+// HttpStreamSource implementations
+//----------------------------------------------------------------------------//
+
+HttpStreamSource::HttpStreamSource(const RangeStreamOptions &options)
+  : RangeStreamSource(options), m_connection(new Connection)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+HttpStreamSource::~HttpStreamSource()
+{
+  stopFetching();
+}
+
+//----------------------------------------------------------------------------//
+
+StreamSource::Ptr HttpStreamSource::open(const std::string &url, 
+                                         const RangeStreamOptions &options)
+{
+  HttpStreamSource::Ptr source(new HttpStreamSource(options));
+  Connection &c = *source->m_connection;
+  c.url = url;
+  if (!parseUrl(url, c.host, c.port, c.path)) {
+    Msg::print(Msg::SevWarning, "HttpStreamSource: Couldn't parse " + url);
+    return StreamSource::Ptr();
+  }
+
+#ifdef WIN32
+  Msg::print(Msg::SevWarning, 
+             "HttpStreamSource: Not supported on this platform");
+  return StreamSource::Ptr();
+#else
+  // The first byte comes with the total size
+  const int fd = connectTo(c.host, c.port);
+  if (fd < 0) {
+    Msg::print(Msg::SevWarning, "HttpStreamSource: Couldn't connect to " + 
+               c.host + ":" + c.port);
+    return StreamSource::Ptr();
+  }
+  char byte = 0;
+  RangeResponse response;
+  if (!rangeRequest(fd, c.host, c.path, 0, 1, &byte, response) || 
+      response.totalSize == 0) {
+    close(fd);
+    Msg::print(Msg::SevWarning, "HttpStreamSource: Couldn't read " + url);
+    return StreamSource::Ptr();
+  }
+  if (response.keepAlive) {
+    c.idle.push_back(fd);
+  } else {
+    close(fd);
+  }
+  source->setSize(response.totalSize);
+  return source;
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+bool HttpStreamSource::fetch(const boost::uint64_t pos, 
+                             const boost::uint64_t numBytes, void *buffer)
+{
+#ifdef WIN32
+  return false;
+#else
+  Connection &c = *m_connection;
+  for (int attempt = 0; attempt <= k_numRetries; ++attempt) {
+    // Reuse an idle connection. The server may have closed it since, so
+    // a failure on one doesn't count as an attempt.
+    int fd = -1;
+    bool isReused = false;
+    {
+      boost::mutex::scoped_lock lock(c.mutex);
+      if (!c.idle.empty()) {
+        fd = c.idle.back();
+        c.idle.pop_back();
+        isReused = true;
+      }
+    }
+    if (fd < 0) {
+      fd = connectTo(c.host, c.port);
+      if (fd < 0) {
+        continue;
+      }
+    }
+    RangeResponse response;
+    const bool success = rangeRequest(fd, c.host, c.path, pos, numBytes, 
+                                      static_cast<char*>(buffer), response);
+    if (success && response.keepAlive) {
+      boost::mutex::scoped_lock lock(c.mutex);
+      c.idle.push_back(fd);
+    } else {
+      close(fd);
+    }
+    if (success) {
+      return true;
+    }
+    if (isReused) {
+      --attempt;
+    }
+  }
+  static Msg::RateLimit limit;
+  std::ostringstream message;
+  message << "HttpStreamSource: Couldn't read " << numBytes 
+          << " bytes at " << pos << " of " << c.url;
+  Msg::print(limit, Msg::SevWarning, message.str());
+  return false;
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
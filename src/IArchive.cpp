@@ -39,8 +39,9 @@ namespace Alembic {
 namespace Ogawa {
 namespace ALEMBIC_VERSION_NS {
 
-IArchive::IArchive(const std::string & iFileName, std::size_t iNumStreams) :
-    mStreams(new IStreams(iFileName, iNumStreams))
+IArchive::IArchive(const std::string & iFileName, std::size_t iNumStreams,
+                   bool iMapFile) :
+    mStreams(new IStreams(iFileName, iNumStreams, iMapFile))
 {
     init();
 }
@@ -51,6 +52,12 @@ IArchive::IArchive(const std::vector< std::istream * > & iStreams) :
     init();
 }
 
+IArchive::IArchive(IStreamSourcePtr iSource) :
+    mStreams(new IStreams(iSource))
+{
+    init();
+}
+
 void IArchive::init()
 {
     if (mStreams->isValid())
@@ -102,6 +102,28 @@ Alembic::Util::uint64_t IData::getSize() const
     return mData->size;
 }
 
+const void * IData::getMappedData() const
+{
+    if (mData->size == 0)
+    {
+        return NULL;
+    }
+
+    // +8 is to account for the size
+    return mData->streams->data(mData->pos + 8, mData->size);
+}
+
+void IData::willNeed() const
+{
+    if (mData->size == 0)
+    {
+        return;
+    }
+
+    // the size is read along with the data
+    mData->streams->willNeed(mData->pos, mData->size + 8);
+}
+
 Alembic::Util::uint64_t IData::getPos() const
 {
     return mData->pos;
@@ -37,6 +37,9 @@
 #include "IArchive.h"
 #include "IStreams.h"
 
+#include <algorithm>
+#include <utility>
+
 namespace Alembic {
 namespace Ogawa {
 namespace ALEMBIC_VERSION_NS {
@@ -149,6 +152,87 @@ IDataPtr IGroup::getData(Alembic::Util::uint64_t iIndex,
     return child;
 }
 
+void IGroup::willNeedData(
+    const std::vector<Alembic::Util::uint64_t> &iIndices,
+    std::size_t iThreadIndex)
+{
+    if (!mData->streams || !mData->streams->isValid())
+    {
+        return;
+    }
+
+    if (isLight())
+    {
+        for (std::size_t i = 0; i < iIndices.size(); ++i)
+        {
+            IDataPtr child = getData(iIndices[i], iThreadIndex);
+            if (child)
+            {
+                child->willNeed();
+            }
+        }
+        return;
+    }
+
+    typedef std::pair<Alembic::Util::uint64_t, Alembic::Util::uint64_t> Range;
+    std::vector<Range> ranges;
+    ranges.reserve(iIndices.size());
+
+    for (std::size_t i = 0; i < iIndices.size(); ++i)
+    {
+        const Alembic::Util::uint64_t index = iIndices[i];
+        if (!isChildData(index) || isEmptyChildData(index))
+        {
+            continue;
+        }
+
+        // children are written in order, each right after the previous
+        // one, and the group itself after all of them
+        const Alembic::Util::uint64_t pos = 
+            mData->childVec[index] & ~EMPTY_DATA;
+        Alembic::Util::uint64_t end = 0;
+        if (index + 1 < mData->childVec.size() &&
+            (mData->childVec[index + 1] & ~EMPTY_DATA) > pos)
+        {
+            end = mData->childVec[index + 1] & ~EMPTY_DATA;
+        }
+        else if (mData->pos > pos)
+        {
+            end = mData->pos;
+        }
+        else
+        {
+            // out of order, so only the child's own size will do
+            Alembic::Util::uint64_t size = 0;
+            mData->streams->read(iThreadIndex, pos, 8, &size);
+            end = pos + 8 + size;
+        }
+        ranges.push_back(Range(pos, end));
+    }
+
+    if (ranges.empty())
+    {
+        return;
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+    Range current = ranges[0];
+    for (std::size_t i = 1; i < ranges.size(); ++i)
+    {
+        if (ranges[i].first <= current.second)
+        {
+            current.second = std::max(current.second, ranges[i].second);
+        }
+        else
+        {
+            mData->streams->willNeed(current.first,
+                                     current.second - current.first);
+            current = ranges[i];
+        }
+    }
+    mData->streams->willNeed(current.first, current.second - current.first);
+}
+
 Alembic::Util::uint64_t IGroup::getNumChildren() const
 {
     return mData->numChildren;
@@ -34,19 +34,287 @@
 //-*****************************************************************************
 
 #include "IStreams.h"
+#include <algorithm>
 #include <fstream>
 #include <stdexcept>
 
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace Alembic {
 namespace Ogawa {
 namespace ALEMBIC_VERSION_NS {
 
+namespace
+{
+
+#ifdef _MSC_VER
+typedef HANDLE FileHandle;
+static const FileHandle kInvalidFile = INVALID_HANDLE_VALUE;
+#else
+typedef int FileHandle;
+static const FileHandle kInvalidFile = -1;
+#endif
+
+FileHandle openFile(const std::string & iFileName)
+{
+#ifdef _MSC_VER
+    return CreateFileA(iFileName.c_str(), GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+    return open(iFileName.c_str(), O_RDONLY);
+#endif
+}
+
+void closeFile(FileHandle iFile)
+{
+#ifdef _MSC_VER
+    CloseHandle(iFile);
+#else
+    close(iFile);
+#endif
+}
+
+// reads iSize bytes at iPos without touching any shared file position, so
+// any number of threads may call this on the same handle at once
+bool readFile(FileHandle iFile, Alembic::Util::uint64_t iPos,
+              Alembic::Util::uint64_t iSize, void * oBuf)
+{
+    char * buf = static_cast< char * >(oBuf);
+    while (iSize > 0)
+    {
+        // keep each request within what a single call can report
+        const Alembic::Util::uint64_t kMaxChunk = 1 << 30;
+        const Alembic::Util::uint64_t chunk =
+            iSize < kMaxChunk ? iSize : kMaxChunk;
+#ifdef _MSC_VER
+        OVERLAPPED overlapped;
+        ZeroMemory(&overlapped, sizeof(overlapped));
+        overlapped.Offset = static_cast< DWORD >(iPos & 0xffffffff);
+        overlapped.OffsetHigh = static_cast< DWORD >(iPos >> 32);
+        DWORD numRead = 0;
+        if (!ReadFile(iFile, buf, static_cast< DWORD >(chunk), &numRead,
+                      &overlapped) || numRead == 0)
+        {
+            return false;
+        }
+#else
+        const ssize_t numRead = pread(iFile, buf, chunk,
+                                      static_cast< off_t >(iPos));
+        if (numRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (numRead <= 0)
+        {
+            return false;
+        }
+#endif
+        buf += numRead;
+        iPos += numRead;
+        iSize -= numRead;
+    }
+    return true;
+}
+
+// maps the whole file read-only, returns NULL if it can't be mapped
+const char * mapFile(FileHandle iFile, Alembic::Util::uint64_t & oSize)
+{
+    oSize = 0;
+#ifdef _MSC_VER
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(iFile, &size) || size.QuadPart <= 0)
+    {
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(iFile, NULL, PAGE_READONLY, 0, 0,
+                                        NULL);
+    if (mapping == NULL)
+    {
+        return NULL;
+    }
+    void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    // the view keeps the mapping alive
+    CloseHandle(mapping);
+    if (view == NULL)
+    {
+        return NULL;
+    }
+    oSize = size.QuadPart;
+    return static_cast< const char * >(view);
+#else
+    struct stat info;
+    if (fstat(iFile, &info) != 0 || info.st_size <= 0)
+    {
+        return NULL;
+    }
+    void * view = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, iFile, 0);
+    if (view == MAP_FAILED)
+    {
+        return NULL;
+    }
+    oSize = info.st_size;
+    return static_cast< const char * >(view);
+#endif
+}
+
+void unmapFile(const char * iMapping, Alembic::Util::uint64_t iSize)
+{
+#ifdef _MSC_VER
+    (void)iSize;
+    UnmapViewOfFile(iMapping);
+#else
+    munmap(const_cast< char * >(iMapping), iSize);
+#endif
+}
+
+// returns the size of the file, or 0 if it can't be found
+Alembic::Util::uint64_t getFileSize(FileHandle iFile)
+{
+#ifdef _MSC_VER
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(iFile, &size) || size.QuadPart <= 0)
+    {
+        return 0;
+    }
+    return size.QuadPart;
+#else
+    struct stat info;
+    if (fstat(iFile, &info) != 0 || info.st_size <= 0)
+    {
+        return 0;
+    }
+    return info.st_size;
+#endif
+}
+
+// a read that starts at most this far past the end of the previous read
+// with the same thread id counts as sequential
+const Alembic::Util::uint64_t kSequentialGap = 64 << 10;
+
+// once reads are sequential, this many bytes are read ahead at a time,
+// doubling up to kMaxReadAhead for as long as they stay sequential
+const Alembic::Util::uint64_t kMinReadAhead = 4 << 20;
+const Alembic::Util::uint64_t kMaxReadAhead = 16 << 20;
+
+// number of sequential reads in a row before reading ahead
+const std::size_t kReadAheadStreak = 2;
+
+// number of read-ahead buffers, which are picked by thread id
+const std::size_t kNumReadAheads = 64;
+
+// the bytes that follow a thread's recent sequential reads. Reading the
+// neighboring data sets of a group one by one then takes a few large
+// reads instead of a round trip for each, which is what matters on
+// network file systems.
+struct ReadAhead
+{
+    ReadAhead() : pos(0), size(0), lastEnd(0), streak(0) {}
+
+    bool contains(Alembic::Util::uint64_t iPos,
+                  Alembic::Util::uint64_t iSize) const
+    {
+        return iPos >= pos && iSize <= size && iPos - pos <= size - iSize;
+    }
+
+    Alembic::Util::mutex lock;
+    std::vector<char> buffer;
+    Alembic::Util::uint64_t pos;
+    Alembic::Util::uint64_t size;
+    Alembic::Util::uint64_t lastEnd;
+    std::size_t streak;
+};
+
+// serves a read from the read-ahead buffer, filling it first if reads have
+// been sequential. Returns false if the read should go to the file instead
+bool readAhead(ReadAhead & ioAhead, FileHandle iFile,
+               Alembic::Util::uint64_t iFileSize,
+               Alembic::Util::uint64_t iPos, Alembic::Util::uint64_t iSize,
+               void * oBuf)
+{
+    Alembic::Util::scoped_lock l(ioAhead.lock);
+
+    const bool sequential = iPos >= ioAhead.lastEnd &&
+        iPos - ioAhead.lastEnd <= kSequentialGap;
+    ioAhead.streak = sequential ? ioAhead.streak + 1 : 0;
+    ioAhead.lastEnd = iPos + iSize;
+
+    if (!ioAhead.contains(iPos, iSize))
+    {
+        if (ioAhead.streak < kReadAheadStreak || iSize >= kMaxReadAhead ||
+            iPos >= iFileSize)
+        {
+            return false;
+        }
+
+        Alembic::Util::uint64_t size = kMinReadAhead;
+        for (std::size_t i = kReadAheadStreak;
+             i < ioAhead.streak && size < kMaxReadAhead; ++i)
+        {
+            size *= 2;
+        }
+        size = std::min(std::max(size, iSize), iFileSize - iPos);
+        if (size < iSize)
+        {
+            return false;
+        }
+
+        if (ioAhead.buffer.size() < size)
+        {
+            ioAhead.buffer.resize(size);
+        }
+        ioAhead.size = 0;
+        if (!readFile(iFile, iPos, size, &ioAhead.buffer[0]))
+        {
+            return false;
+        }
+        ioAhead.pos = iPos;
+        ioAhead.size = size;
+    }
+
+    std::memcpy(oBuf, &ioAhead.buffer[iPos - ioAhead.pos], iSize);
+    return true;
+}
+
+// checks the 16 byte header, returns false if it isn't an Ogawa one
+bool readHeader(const char * header, bool & oFrozen,
+                Alembic::Util::uint16_t & oVersion,
+                Alembic::Util::uint64_t & oGroupPos)
+{
+    std::string magicStr(header, 5);
+    if (magicStr != "Ogawa")
+    {
+        return false;
+    }
+    oFrozen = (header[5] == char(0xff));
+    oVersion = (header[6] << 8) | header[7];
+    oGroupPos = *((Alembic::Util::uint64_t *)(&(header[8])));
+    return true;
+}
+
+} // End anonymous namespace
+
 class IStreams::PrivateData
 {
 public:
     PrivateData()
     {
         locks = NULL;
+        file = kInvalidFile;
+        fileSize = 0;
+        readAheads = NULL;
+        mapping = NULL;
+        mappingSize = 0;
         valid = false;
         frozen = false;
         version = 0;
@@ -59,63 +327,81 @@ public:
             delete [] locks;
         }
 
+        if (readAheads)
+        {
+            delete [] readAheads;
+        }
+
+        if (mapping)
+        {
+            unmapFile(mapping, mappingSize);
+        }
+
         // only cleanup if we were the ones who opened it
-        if (!fileName.empty())
+        if (file != kInvalidFile)
         {
-            std::vector<std::istream *>::iterator it;
-            for (it = streams.begin(); it != streams.end(); ++it)
-            {
-                std::ifstream * filestream = dynamic_cast<std::ifstream *>(*it);
-                if (filestream)
-                {
-                    filestream->close();
-                    delete filestream;
-                }
-            }
+            closeFile(file);
         }
     }
 
+    // only used when reading from streams handed to us
     std::vector<std::istream *> streams;
     std::vector<Alembic::Util::uint64_t> offsets;
     Alembic::Util::mutex * locks;
-    std::string fileName;
+
+    // used when we opened the file ourselves
+    FileHandle file;
+    Alembic::Util::uint64_t fileSize;
+    ReadAhead * readAheads;
+
+    // the whole file, when it was opened to be mapped
+    const char * mapping;
+    Alembic::Util::uint64_t mappingSize;
+
+    // used when reading through a stream source
+    IStreamSourcePtr source;
+
     bool valid;
     bool frozen;
     Alembic::Util::uint16_t version;
 };
 
-IStreams::IStreams(const std::string & iFileName, std::size_t iNumStreams) :
+IStreams::IStreams(const std::string & iFileName, std::size_t,
+                   bool iMapFile) :
     mData(new IStreams::PrivateData())
 {
-
-    std::ifstream * filestream = new std::ifstream;
-    filestream->open(iFileName.c_str(), std::ios::binary);
-
-    if (filestream->is_open())
+    mData->file = openFile(iFileName);
+    if (mData->file == kInvalidFile)
     {
-        mData->fileName = iFileName;
+        return;
     }
-    else
+
+    // fall back to positional reads if the file can't be mapped
+    if (iMapFile)
     {
-        delete filestream;
-        return;
+        mData->mapping = mapFile(mData->file, mData->mappingSize);
     }
 
-    mData->streams.push_back(filestream);
     init();
     if (!mData->valid || mData->version != 1)
     {
-        mData->streams.clear();
-        filestream->close();
-        delete filestream;
+        if (mData->mapping)
+        {
+            unmapFile(mData->mapping, mData->mappingSize);
+            mData->mapping = NULL;
+            mData->mappingSize = 0;
+        }
+        closeFile(mData->file);
+        mData->file = kInvalidFile;
+        mData->valid = false;
+        return;
     }
-    else
+
+    if (!mData->mapping)
     {
-        // we are valid, so we'll allocate (but not open) the others
-        mData->streams.resize(iNumStreams, NULL);
-        mData->offsets.resize(iNumStreams, 0);
+        mData->fileSize = getFileSize(mData->file);
+        mData->readAheads = new ReadAhead[kNumReadAheads];
     }
-    mData->locks = new Alembic::Util::mutex[mData->streams.size()];
 }
 
 IStreams::IStreams(const std::vector< std::istream * > & iStreams) :
@@ -132,6 +418,18 @@ IStreams::IStreams(const std::vector< std::istream * > & iStreams) :
     mData->locks = new Alembic::Util::mutex[mData->streams.size()];
 }
 
+IStreams::IStreams(IStreamSourcePtr iSource) :
+    mData(new IStreams::PrivateData())
+{
+    mData->source = iSource;
+    init();
+    if (!mData->valid || mData->version != 1)
+    {
+        mData->source.reset();
+        mData->valid = false;
+    }
+}
+
 void IStreams::init()
 {
     // simple temporary endian check
@@ -148,6 +446,44 @@ void IStreams::init()
             "Ogawa currently only supports little-endian reading.");
     }
 
+    if (mData->file != kInvalidFile)
+    {
+        char header[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+        Alembic::Util::uint64_t groupPos = 0;
+        if (mData->mapping)
+        {
+            mData->valid = mData->mappingSize >= 16 &&
+                readHeader(mData->mapping, mData->frozen, mData->version,
+                           groupPos);
+        }
+        else
+        {
+            mData->valid = readFile(mData->file, 0, 16, header) &&
+                readHeader(header, mData->frozen, mData->version, groupPos);
+        }
+        if (!mData->valid)
+        {
+            mData->frozen = false;
+            mData->version = 0;
+        }
+        return;
+    }
+
+    if (mData->source)
+    {
+        char header[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
+        Alembic::Util::uint64_t groupPos = 0;
+        mData->valid = mData->source->size() >= 16 &&
+            mData->source->read(0, 16, header) &&
+            readHeader(header, mData->frozen, mData->version, groupPos);
+        if (!mData->valid)
+        {
+            mData->frozen = false;
+            mData->version = 0;
+        }
+        return;
+    }
+
     if (mData->streams.empty())
     {
         return;
@@ -160,18 +496,16 @@ void IStreams::init()
         char header[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
         mData->offsets.push_back(mData->streams[i]->tellg());
         mData->streams[i]->read(header, 16);
-        std::string magicStr(header, 5);
-        if (magicStr != "Ogawa")
+        bool frozen = false;
+        Alembic::Util::uint16_t version = 0;
+        Alembic::Util::uint64_t groupPos = 0;
+        if (!readHeader(header, frozen, version, groupPos))
         {
             mData->frozen = false;
             mData->valid = false;
             mData->version = 0;
             return;
         }
-        bool frozen = (header[5] == char(0xff));
-        Alembic::Util::uint16_t version = (header[6] << 8) | header[7];
-        Alembic::Util::uint64_t groupPos =
-            *((Alembic::Util::uint64_t *)(&(header[8])));
 
         if (i == 0)
         {
@@ -211,6 +545,61 @@ Alembic::Util::uint16_t IStreams::getVersion()
     return mData->version;
 }
 
+bool IStreams::isMapped()
+{
+    return mData->mapping != NULL;
+}
+
+const void * IStreams::data(Alembic::Util::uint64_t iPos,
+                            Alembic::Util::uint64_t iSize)
+{
+    if (!mData->mapping || iPos > mData->mappingSize ||
+        iSize > mData->mappingSize - iPos)
+    {
+        return NULL;
+    }
+    return mData->mapping + iPos;
+}
+
+void IStreams::willNeed(Alembic::Util::uint64_t iPos,
+                        Alembic::Util::uint64_t iSize)
+{
+#ifndef _MSC_VER
+    if (mData->mapping)
+    {
+        if (!data(iPos, iSize))
+        {
+            return;
+        }
+        // madvise wants a page aligned start
+        const long pageSize = sysconf(_SC_PAGESIZE);
+        if (pageSize <= 0)
+        {
+            return;
+        }
+        const Alembic::Util::uint64_t start = iPos - iPos % pageSize;
+        madvise(const_cast< char * >(mData->mapping) + start,
+                iSize + (iPos - start), MADV_WILLNEED);
+    }
+    else if (mData->source)
+    {
+        mData->source->willNeed(iPos, iSize);
+    }
+#  ifdef POSIX_FADV_WILLNEED
+    else if (mData->file != kInvalidFile)
+    {
+        posix_fadvise(mData->file, static_cast< off_t >(iPos),
+                      static_cast< off_t >(iSize), POSIX_FADV_WILLNEED);
+    }
+#  endif
+#else
+    if (mData->source)
+    {
+        mData->source->willNeed(iPos, iSize);
+    }
+#endif
+}
+
 void IStreams::read(std::size_t iThreadId, Alembic::Util::uint64_t iPos,
                     Alembic::Util::uint64_t iSize, void * oBuf)
 {
@@ -219,6 +608,36 @@ void IStreams::read(std::size_t iThreadId, Alembic::Util::uint64_t iPos,
         return;
     }
 
+    if (mData->mapping)
+    {
+        const void * src = data(iPos, iSize);
+        if (src)
+        {
+            std::memcpy(oBuf, src, iSize);
+        }
+        return;
+    }
+
+    // sources take care of their own concurrency and caching
+    if (mData->source)
+    {
+        mData->source->read(iPos, iSize, oBuf);
+        return;
+    }
+
+    // positional reads need no stream per thread. Sequential ones are
+    // served from the read-ahead buffer of their thread id
+    if (mData->file != kInvalidFile)
+    {
+        ReadAhead & ahead = mData->readAheads[iThreadId % kNumReadAheads];
+        if (!readAhead(ahead, mData->file, mData->fileSize, iPos, iSize,
+                       oBuf))
+        {
+            readFile(mData->file, iPos, iSize, oBuf);
+        }
+        return;
+    }
+
     std::size_t threadId = 0;
     if (iThreadId < mData->streams.size())
     {
@@ -228,32 +647,6 @@ void IStreams::read(std::size_t iThreadId, Alembic::Util::uint64_t iPos,
     {
         Alembic::Util::scoped_lock l(mData->locks[threadId]);
         std::istream * stream = mData->streams[threadId];
-
-        // the file hasn't been opened for this id yet
-        if (stream == NULL && !mData->fileName.empty())
-        {
-            std::ifstream * filestream = new std::ifstream;
-            filestream->open(mData->fileName.c_str(), std::ios::binary);
-
-            if (filestream->is_open())
-            {
-                stream = filestream;
-                mData->streams[threadId] = filestream;
-                mData->offsets[threadId] = filestream->tellg();
-            }
-            // couldnt open the file, do cleanup
-            else
-            {
-                delete filestream;
-
-                // read from thread 0 instead until it can be opened
-                if (threadId != 0)
-                {
-                    read(0, iPos, iSize, oBuf);
-                }
-                return;
-            }
-        }
         stream->seekg(iPos + mData->offsets[threadId]);
         stream->read((char *)oBuf, iSize);
     }
@@ -43,11 +43,24 @@
 
 #include "InitIO.h"
 
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/lexical_cast.hpp>
+
+#include "BlockCodec.h"
 #include "DenseFieldIO.h"
 #include "SparseFieldIO.h"
 #include "MACFieldIO.h"
+#include "SparseMACFieldIO.h"
+#include "LevelSetFieldIO.h"
+#include "Log.h"
 #include "FieldMappingIO.h"
 #include "MIPFieldIO.h"
+#include "PlanarDenseFieldIO.h"
+#include "Stats.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 
 //----------------------------------------------------------------------------//
 
@@ -59,6 +72,31 @@ namespace {
 
   size_t g_numIOThreads = 1;
 
+  bool g_mapOgawaFiles = false;
+  bool g_mapDenseLayers = false;
+
+  bool g_hugePages = false;
+  size_t g_sparseBlockPoolLimit = 64 << 20;
+
+  SparseStorageMode g_sparseStorageMode = SparseStorageCompressed;
+  SparseCodec g_sparseCodec = SparseCodecZlib;
+  int g_sparseCompressionLevel = 1;
+  bool g_sparseBlockDedupe = false;
+  SparseFileOrder g_sparseFileOrder = SparseFileOrderLinear;
+  bool g_sparseBlockSummaries = true;
+  int g_sparseQuantizeBits = 0;
+
+  bool g_writeChecksums = false;
+  bool g_verifyChecksums = false;
+
+  DenseStorageMode g_denseStorageMode = DenseStorageCompressed;
+
+  size_t g_hdf5ChunkCacheBytes = 0;
+  size_t g_hdf5ChunkCacheSlots = 0;
+  bool g_hdf5ParallelInflate = true;
+  bool g_hdf5ParallelDeflate = true;
+  bool g_packLayerAttributes = false;
+
 }
 
 //----------------------------------------------------------------------------//
@@ -73,11 +111,30 @@ void initIO()
   factory.registerFieldIO(DenseFieldIO::create);
   factory.registerFieldIO(SparseFieldIO::create);
   factory.registerFieldIO(MACFieldIO::create);
+  factory.registerFieldIO(SparseMACFieldIO::create);
+  factory.registerFieldIO(LevelSetFieldIO::create);
   factory.registerFieldIO(MIPFieldIO::create);
+  factory.registerFieldIO(PlanarDenseFieldIO::create);
 
   factory.registerFieldMappingIO(NullFieldMappingIO::create);
   factory.registerFieldMappingIO(MatrixFieldMappingIO::create);
   factory.registerFieldMappingIO(FrustumFieldMappingIO::create);
+
+  // Statistics are written at exit if a file is given
+  const char *statsFile = getenv("FIELD3D_STATS_FILE");
+  if (statsFile) {
+    Stats::setDumpAtExit(statsFile);
+  }
+
+  // As is the trace, which is then recorded from the start
+  const char *traceFile = getenv("FIELD3D_TRACE_FILE");
+  if (traceFile) {
+    Trace::setEnabled(true);
+    Trace::setDumpAtExit(traceFile);
+  }
+
+  // Start the threads that all multi-threaded work shares
+  ThreadPool::singleton().reserve(g_numIOThreads);
 }
 
 //----------------------------------------------------------------------------//
@@ -85,6 +142,7 @@ void initIO()
 void setNumIOThreads(const size_t numThreads)
 {
   g_numIOThreads = numThreads;
+  ThreadPool::singleton().reserve(numThreads);
 }
 
 //----------------------------------------------------------------------------//
@@ -96,6 +154,272 @@ size_t numIOThreads()
 
 //----------------------------------------------------------------------------//
 
+void setMapOgawaFiles(const bool enabled)
+{
+  g_mapOgawaFiles = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool mapOgawaFiles()
+{
+  return g_mapOgawaFiles;
+}
+
+//----------------------------------------------------------------------------//
+
+void setMapDenseLayers(const bool enabled)
+{
+  g_mapDenseLayers = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool mapDenseLayers()
+{
+  return g_mapDenseLayers;
+}
+
+//----------------------------------------------------------------------------//
+
+void setHugePages(const bool enabled)
+{
+  g_hugePages = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool hugePages()
+{
+  return g_hugePages;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseBlockPoolLimit(const size_t bytes)
+{
+  g_sparseBlockPoolLimit = bytes;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t sparseBlockPoolLimit()
+{
+  return g_sparseBlockPoolLimit;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseStorageMode(const SparseStorageMode mode)
+{
+  g_sparseStorageMode = mode;
+}
+
+//----------------------------------------------------------------------------//
+
+SparseStorageMode sparseStorageMode()
+{
+  return g_sparseStorageMode;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseCodec(const SparseCodec codec)
+{
+  if (!BlockCodec::isValid(codec)) {
+    Msg::print(Msg::SevWarning, "setSparseCodec(): Codec " + 
+               boost::lexical_cast<std::string>(static_cast<int>(codec)) + 
+               " isn't available in this build of Field3D");
+    return;
+  }
+  g_sparseCodec = codec;
+}
+
+//----------------------------------------------------------------------------//
+
+SparseCodec sparseCodec()
+{
+  return g_sparseCodec;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseCompressionLevel(const int level)
+{
+  g_sparseCompressionLevel = std::min(std::max(level, 1), 9);
+}
+
+//----------------------------------------------------------------------------//
+
+int sparseCompressionLevel()
+{
+  return g_sparseCompressionLevel;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseBlockDedupe(const bool enabled)
+{
+  g_sparseBlockDedupe = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool sparseBlockDedupe()
+{
+  return g_sparseBlockDedupe;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseFileOrder(const SparseFileOrder order)
+{
+  g_sparseFileOrder = order;
+}
+
+//----------------------------------------------------------------------------//
+
+SparseFileOrder sparseFileOrder()
+{
+  return g_sparseFileOrder;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseBlockSummaries(const bool enabled)
+{
+  g_sparseBlockSummaries = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool sparseBlockSummaries()
+{
+  return g_sparseBlockSummaries;
+}
+
+//----------------------------------------------------------------------------//
+
+void setWriteChecksums(const bool enabled)
+{
+  g_writeChecksums = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool writeChecksums()
+{
+  return g_writeChecksums;
+}
+
+//----------------------------------------------------------------------------//
+
+void setVerifyChecksums(const bool enabled)
+{
+  g_verifyChecksums = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool verifyChecksums()
+{
+  return g_verifyChecksums;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSparseQuantizeBits(const int bits)
+{
+  g_sparseQuantizeBits = (bits == 8 || bits == 12) ? bits : 0;
+}
+
+//----------------------------------------------------------------------------//
+
+int sparseQuantizeBits()
+{
+  return g_sparseQuantizeBits;
+}
+
+//----------------------------------------------------------------------------//
+
+void setDenseStorageMode(const DenseStorageMode mode)
+{
+  g_denseStorageMode = mode;
+}
+
+//----------------------------------------------------------------------------//
+
+DenseStorageMode denseStorageMode()
+{
+  return g_denseStorageMode;
+}
+
+//----------------------------------------------------------------------------//
+
+void setHdf5ChunkCache(const size_t numBytes, const size_t numSlots)
+{
+  g_hdf5ChunkCacheBytes = numBytes;
+  g_hdf5ChunkCacheSlots = numSlots;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t hdf5ChunkCacheBytes()
+{
+  return g_hdf5ChunkCacheBytes;
+}
+
+//----------------------------------------------------------------------------//
+
+size_t hdf5ChunkCacheSlots()
+{
+  return g_hdf5ChunkCacheSlots;
+}
+
+//----------------------------------------------------------------------------//
+
+void setHdf5ParallelInflate(const bool enabled)
+{
+  g_hdf5ParallelInflate = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool hdf5ParallelInflate()
+{
+  return g_hdf5ParallelInflate;
+}
+
+//----------------------------------------------------------------------------//
+
+void setHdf5ParallelDeflate(const bool enabled)
+{
+  g_hdf5ParallelDeflate = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool hdf5ParallelDeflate()
+{
+  return g_hdf5ParallelDeflate;
+}
+
+//----------------------------------------------------------------------------//
+
+void setPackLayerAttributes(const bool enabled)
+{
+  g_packLayerAttributes = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool packLayerAttributes()
+{
+  return g_packLayerAttributes;
+}
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_SOURCE_CLOSE
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,300 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file LevelSetFieldIO.cpp
+  \brief Contains implementations of the LevelSetFieldIO class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "LevelSetFieldIO.h"
+#include "SparseFieldIO.h"
+
+//----------------------------------------------------------------------------//
+
+using namespace boost;
+using namespace std;
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Field3D namespaces
+//----------------------------------------------------------------------------//
+
+using namespace Exc;
+using namespace Hdf5Util;
+
+//----------------------------------------------------------------------------//
+// Static members
+//----------------------------------------------------------------------------//
+
+const int         LevelSetFieldIO::k_versionNumber(1);
+const std::string LevelSetFieldIO::k_versionAttrName("version");
+const std::string LevelSetFieldIO::k_halfWidthStr("half_width");
+const std::string LevelSetFieldIO::k_sdfDataStr("sdf_data");
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+LevelSetFieldIO::read(hid_t layerGroup, const std::string &filename, 
+                      const std::string &layerPath,
+                      DataTypeEnum typeEnum)
+{
+  if (layerGroup == -1)
+    throw BadHdf5IdException("Bad layer group in LevelSetFieldIO::read");
+
+  int version;
+  if (!readAttribute(layerGroup, k_versionAttrName, 1, version))
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_versionAttrName);
+
+  if (version != k_versionNumber)
+    throw UnsupportedVersionException("LevelSetField version not supported: "
+                                      + lexical_cast<std::string>(version));
+
+  float halfWidth;
+  if (!readAttribute(layerGroup, k_halfWidthStr, 1, halfWidth))
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_halfWidthStr);
+
+  // The distances are stored as a scalar sparse field
+  FieldBase::Ptr sdf;
+  {
+    H5ScopedGopen sdfGroup(layerGroup, k_sdfDataStr);
+    SparseFieldIO io;
+    sdf = io.read(sdfGroup, filename, layerPath + "/" + k_sdfDataStr, 
+                  typeEnum);
+  }
+
+  switch (typeEnum) {
+  case DataTypeHalf:
+    return makeField<half>(sdf, halfWidth);
+  case DataTypeFloat:
+    return makeField<float>(sdf, halfWidth);
+  case DataTypeDouble:
+    return makeField<double>(sdf, halfWidth);
+  default:
+    return FieldBase::Ptr();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+LevelSetFieldIO::read(const OgIGroup &layerGroup, 
+                      const std::string &filename, 
+                      const std::string &layerPath,
+                      OgDataType typeEnum)
+{
+  if (!layerGroup.isValid()) {
+    throw MissingGroupException("Invalid group in LevelSetFieldIO::read()");
+  }
+
+  OgIAttribute<int> versionAttr = 
+    layerGroup.findAttribute<int>(k_versionAttrName);
+  if (!versionAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute: " +
+                                    k_versionAttrName);
+  }
+  const int version = versionAttr.value();
+
+  if (version != k_versionNumber) {
+    throw UnsupportedVersionException("LevelSetField version not supported: "
+                                      + lexical_cast<std::string>(version));
+  }
+
+  OgIAttribute<float32_t> halfWidthAttr = 
+    layerGroup.findAttribute<float32_t>(k_halfWidthStr);
+  if (!halfWidthAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute: " +
+                                    k_halfWidthStr);
+  }
+  const float halfWidth = halfWidthAttr.value();
+
+  // The distances are stored as a scalar sparse field
+  OgIGroup sdfGroup = layerGroup.findGroup(k_sdfDataStr);
+  if (!sdfGroup.isValid()) {
+    throw MissingGroupException("Couldn't find group " + k_sdfDataStr);
+  }
+  SparseFieldIO io;
+  FieldBase::Ptr sdf = 
+    io.read(sdfGroup, filename, layerPath + "/" + k_sdfDataStr, typeEnum);
+
+  switch (typeEnum) {
+  case F3DFloat16:
+    return makeField<half>(sdf, halfWidth);
+  case F3DFloat32:
+    return makeField<float>(sdf, halfWidth);
+  case F3DFloat64:
+    return makeField<double>(sdf, halfWidth);
+  default:
+    return FieldBase::Ptr();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool
+LevelSetFieldIO::write(hid_t layerGroup, FieldBase::Ptr field)
+{
+  if (layerGroup == -1) {
+    throw BadHdf5IdException("Bad layer group in LevelSetFieldIO::write");
+  }
+
+  // Add version attribute
+  if (!writeAttribute(layerGroup, k_versionAttrName, 
+                      1, k_versionNumber)) {
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_versionAttrName);
+  }
+
+  LevelSetField<half>::Ptr halfField = 
+    field_dynamic_cast<LevelSetField<half> >(field);
+  LevelSetField<float>::Ptr floatField = 
+    field_dynamic_cast<LevelSetField<float> >(field);
+  LevelSetField<double>::Ptr doubleField = 
+    field_dynamic_cast<LevelSetField<double> >(field);
+
+  bool success = true;
+  if (floatField) {
+    success = writeInternal<float>(layerGroup, floatField);
+  } else if (halfField) {
+    success = writeInternal<half>(layerGroup, halfField);
+  } else if (doubleField) {
+    success = writeInternal<double>(layerGroup, doubleField);
+  } else {
+    throw WriteLayerException("LevelSetFieldIO does not support the given "
+                              "LevelSetField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+bool
+LevelSetFieldIO::write(OgOGroup &layerGroup, FieldBase::Ptr field)
+{
+  // Add version attribute
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, k_versionNumber);
+
+  LevelSetField<half>::Ptr halfField = 
+    field_dynamic_cast<LevelSetField<half> >(field);
+  LevelSetField<float>::Ptr floatField = 
+    field_dynamic_cast<LevelSetField<float> >(field);
+  LevelSetField<double>::Ptr doubleField = 
+    field_dynamic_cast<LevelSetField<double> >(field);
+
+  bool success = true;
+  if (floatField) {
+    success = writeInternal<float>(layerGroup, floatField);
+  } else if (halfField) {
+    success = writeInternal<half>(layerGroup, halfField);
+  } else if (doubleField) {
+    success = writeInternal<double>(layerGroup, doubleField);
+  } else {
+    throw WriteLayerException("LevelSetFieldIO does not support the given "
+                              "LevelSetField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+// Template methods
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool LevelSetFieldIO::writeInternal(hid_t layerGroup, 
+                                    typename LevelSetField<Data_T>::Ptr field)
+{
+  const float halfWidth = field->halfWidth();
+  if (!writeAttribute(layerGroup, k_halfWidthStr, 1, halfWidth)) 
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_halfWidthStr);
+
+  // The distances, tiles included, go in their own group ---
+
+  SparseFieldIO io;
+  H5ScopedGcreate sdfGroup(layerGroup, k_sdfDataStr);
+  return io.write(sdfGroup, field);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool LevelSetFieldIO::writeInternal(OgOGroup &layerGroup, 
+                                    typename LevelSetField<Data_T>::Ptr field)
+{
+  const float32_t halfWidth = field->halfWidth();
+  OgOAttribute<float32_t> halfWidthAttr(layerGroup, k_halfWidthStr, 
+                                        halfWidth);
+
+  // The distances, tiles included, go in their own group ---
+
+  SparseFieldIO io;
+  OgOGroup sdfGroup(layerGroup, k_sdfDataStr);
+  return io.write(sdfGroup, field) && sdfGroup.writePackedAttributes();
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename LevelSetField<Data_T>::Ptr 
+LevelSetFieldIO::makeField(FieldBase::Ptr sdf, const float halfWidth)
+{
+  typename SparseField<Data_T>::Ptr sparse = 
+    field_dynamic_cast<SparseField<Data_T> >(sdf);
+  if (!sparse) {
+    return typename LevelSetField<Data_T>::Ptr();
+  }
+  // The tiles were written with their values, so the blocks are taken as
+  // they are. Assigning keeps them dynamically loaded if they were read 
+  // that way.
+  typename LevelSetField<Data_T>::Ptr result(new LevelSetField<Data_T>);
+  static_cast<SparseField<Data_T>&>(*result) = *sparse;
+  result->m_halfWidth = static_cast<Data_T>(halfWidth);
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
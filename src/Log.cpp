@@ -42,11 +42,21 @@
 //----------------------------------------------------------------------------//
 
 #include <unistd.h>
+#ifndef WIN32
+#include <pthread.h>
+#endif
 #include <ios>
 #include <fstream>
 
 #include <iostream>
 
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 #include "Log.h"
 
 //----------------------------------------------------------------------------//
@@ -67,22 +77,319 @@ static int g_verbosity = 1;
 
 //----------------------------------------------------------------------------//
 
-void print(Severity severity, const std::string &message)
-{
-  if (g_verbosity < 1)
+namespace {
+
+  //! Messages queued at most. More than that are dropped.
+  const size_t k_queueCapacity = 4096;
+  //! Longest that flush() waits for the writer, in microseconds
+  const int64_t k_flushTimeout = 2000000;
+
+  boost::atomic<int>  g_minSeverity(SevMessage);
+  boost::atomic<bool> g_hasSink(false);
+  boost::atomic<bool> g_async(true);
+  boost::atomic<bool> g_hasWriter(false);
+
+  //--------------------------------------------------------------------------//
+
+  //! Microseconds since the epoch
+  int64_t now()
+  {
+    using namespace boost::posix_time;
+    static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+    return (microsec_clock::universal_time() - epoch).total_microseconds();
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! The default sink
+  void printToConsole(Severity severity, const std::string &message)
+  {
+    if (g_verbosity < 1)
       return;
 
-  switch(severity) {
-  case SevWarning:
-    cout << "WARNING: ";
-    break;
-  case SevMessage:
-  default:
-    break;
-    // Do nothing
+    switch(severity) {
+    case SevWarning:
+      cout << "WARNING: ";
+      break;
+    case SevError:
+      cout << "ERROR: ";
+      break;
+    case SevMessage:
+    default:
+      break;
+      // Do nothing
+    }
+
+    cout << message << endl;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! A queued message
+  struct Entry
+  {
+    Entry(Severity i_severity, const std::string &i_message)
+      : severity(i_severity), message(i_message)
+    { }
+    Severity    severity;
+    std::string message;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  /*! Writes messages to the sink. Messages are pushed onto a lock-free 
+    queue, which a background thread drains. A process forked from this one
+    has no such thread, and writes synchronously.
+  */
+  class Writer
+  {
+  public:
+
+    //! Never destroyed, so that static destructors can print
+    static Writer& singleton()
+    {
+      static Writer *writer = new Writer;
+      return *writer;
+    }
+
+    //! Calls the sink
+    void write(Severity severity, const std::string &message)
+    {
+      boost::mutex::scoped_lock lock(m_sinkMutex);
+      if (m_sink) {
+        m_sink(severity, message);
+      } else {
+        printToConsole(severity, message);
+      }
+    }
+
+    //! Queues a message for the background thread
+    void push(Severity severity, const std::string &message)
+    {
+      Entry *entry = new Entry(severity, message);
+      if (!m_queue.bounded_push(entry)) {
+        delete entry;
+        ++m_numDropped;
+      } else {
+        ++m_numQueued;
+      }
+      if (m_isIdle) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_wake.notify_one();
+      }
+    }
+
+    //! Waits for the queued messages to be written, for at most 
+    //! k_flushTimeout, in case the sink is stuck
+    void flush()
+    {
+      if (!m_isRunning) {
+        return;
+      }
+      const size_t  numQueued = m_numQueued;
+      const int64_t deadline  = now() + k_flushTimeout;
+      boost::mutex::scoped_lock lock(m_mutex);
+      while ((m_numWritten < numQueued || m_numDropped > 0) && 
+             now() < deadline) {
+        m_wake.notify_one();
+        m_drained.timed_wait(lock, boost::posix_time::milliseconds(10));
+      }
+    }
+
+    //! Whether the background thread is running in this process
+    bool isRunning() const
+    { return m_isRunning; }
+
+    //! Whether this is the background thread, i.e. print() was called by 
+    //! the sink
+    bool isWriterThread() const
+    { return boost::this_thread::get_id() == m_thread.get_id(); }
+
+    void setSink(const Sink &sink)
+    {
+      boost::mutex::scoped_lock lock(m_sinkMutex);
+      m_sink = sink;
+    }
+
+  private:
+
+    Writer()
+      : m_queue(k_queueCapacity), m_numQueued(0), m_numWritten(0), 
+        m_numDropped(0), m_isIdle(false), m_isRunning(true)
+    {
+      m_thread = boost::thread(boost::bind(&Writer::run, this));
+      g_hasWriter = true;
+#ifndef WIN32
+      pthread_atfork(&Writer::prepareFork, &Writer::parentAfterFork, 
+                     &Writer::childAfterFork);
+#endif
+    }
+
+    //! Holds the locks across fork(), so the child doesn't inherit them
+    //! locked by a thread that it doesn't have
+    static void prepareFork()
+    {
+      singleton().m_mutex.lock();
+      singleton().m_sinkMutex.lock();
+    }
+
+    static void parentAfterFork()
+    {
+      singleton().m_sinkMutex.unlock();
+      singleton().m_mutex.unlock();
+    }
+
+    //! Only the forking thread exists in the child. What's still queued is
+    //! left to the parent to write.
+    static void childAfterFork()
+    {
+      singleton().m_isRunning = false;
+      singleton().m_sinkMutex.unlock();
+      singleton().m_mutex.unlock();
+    }
+
+    //! Drains the queue, then sleeps until more messages arrive
+    void run()
+    {
+      while (true) {
+        Entry *entry;
+        while (m_queue.pop(entry)) {
+          write(entry->severity, entry->message);
+          delete entry;
+          ++m_numWritten;
+        }
+        if (const size_t numDropped = m_numDropped.exchange(0)) {
+          write(SevWarning, boost::lexical_cast<std::string>(numDropped) + 
+                " messages were dropped");
+        }
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_drained.notify_all();
+        m_isIdle = true;
+        if (m_queue.empty()) {
+          // Producers only notify while we're idle. The timeout covers a 
+          // message pushed just before m_isIdle was set.
+          m_wake.timed_wait(lock, boost::posix_time::milliseconds(50));
+        }
+        m_isIdle = false;
+      }
+    }
+
+    boost::lockfree::queue<Entry *> m_queue;
+    boost::atomic<size_t>           m_numQueued;
+    boost::atomic<size_t>           m_numWritten;
+    boost::atomic<size_t>           m_numDropped;
+    boost::atomic<bool>             m_isIdle;
+    boost::atomic<bool>             m_isRunning;
+    boost::mutex                    m_mutex;
+    boost::condition_variable       m_wake;
+    boost::condition_variable       m_drained;
+    boost::mutex                    m_sinkMutex;
+    Sink                            m_sink;
+    boost::thread                   m_thread;
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Writes out the queue when the program exits. Anything printed after 
+  //! that is written synchronously. This doesn't run on abort() or a 
+  //! crash, which is why errors are never queued.
+  struct FlushAtExit
+  {
+    ~FlushAtExit()
+    {
+      g_async = false;
+      if (g_hasWriter) {
+        Writer::singleton().flush();
+      }
+    }
+  } g_flushAtExit;
+
+}
+
+//----------------------------------------------------------------------------//
+// RateLimit implementations
+//----------------------------------------------------------------------------//
+
+RateLimit::RateLimit(const size_t maxMessages, const float interval)
+  : m_maxMessages(maxMessages), 
+    m_interval(static_cast<int64_t>(interval * 1e6)), m_start(now()), 
+    m_count(0), m_numSuppressed(0)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+bool RateLimit::allow(size_t &numSuppressed)
+{
+  // Start a new interval if the current one is over. Only the thread that
+  // moves the start resets the count.
+  const int64_t time = now();
+  int64_t start = m_start;
+  if (time - start >= m_interval && 
+      m_start.compare_exchange_strong(start, time)) {
+    m_count = 0;
+  }
+  if (++m_count > m_maxMessages) {
+    ++m_numSuppressed;
+    return false;
+  }
+  numSuppressed = m_numSuppressed.exchange(0);
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+// Msg implementations
+//----------------------------------------------------------------------------//
+
+bool isEnabled(Severity severity)
+{
+  return severity >= g_minSeverity && (g_verbosity >= 1 || g_hasSink);
+}
+
+//----------------------------------------------------------------------------//
+
+void print(Severity severity, const std::string &message)
+{
+  if (!isEnabled(severity)) {
+    return;
   }
+  Writer &writer = Writer::singleton();
+  if (writer.isWriterThread()) {
+    // Printed by the sink. Writing or waiting for the queue here would 
+    // deadlock on the writer's own locks.
+    writer.push(severity, message);
+  } else if (g_async && writer.isRunning() && severity < SevError) {
+    writer.push(severity, message);
+  } else {
+    // Errors are written before print() returns, after the messages 
+    // queued ahead of them, so that they aren't lost if the process 
+    // aborts or crashes before exiting normally
+    if (g_async) {
+      writer.flush();
+    }
+    writer.write(severity, message);
+  }
+}
+
+//----------------------------------------------------------------------------//
 
-  cout << message << endl;
+void print(RateLimit &limit, Severity severity, const std::string &message)
+{
+  if (!isEnabled(severity)) {
+    return;
+  }
+  size_t numSuppressed = 0;
+  if (!limit.allow(numSuppressed)) {
+    return;
+  }
+  if (numSuppressed > 0) {
+    print(severity, message + " (" + 
+          boost::lexical_cast<std::string>(numSuppressed) + 
+          " similar messages suppressed)");
+  } else {
+    print(severity, message);
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -94,6 +401,41 @@ void setVerbosity (int level)
 
 //----------------------------------------------------------------------------//
 
+void setMinSeverity(Severity severity)
+{
+  g_minSeverity = severity;
+}
+
+//----------------------------------------------------------------------------//
+
+void setSink(const Sink &sink)
+{
+  Writer::singleton().setSink(sink);
+  g_hasSink = !sink.empty();
+}
+
+//----------------------------------------------------------------------------//
+
+void setAsync(const bool enabled)
+{
+  if (!enabled && g_async) {
+    g_async = false;
+    Writer::singleton().flush();
+  }
+  g_async = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+void flush()
+{
+  if (g_async) {
+    Writer::singleton().flush();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
 } // namespace Log
 
 //----------------------------------------------------------------------------//
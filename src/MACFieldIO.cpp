@@ -41,7 +41,10 @@
 
 //----------------------------------------------------------------------------//
 
+#include "BlockCodec.h"
+#include "DenseFieldIO.h"
 #include "MACFieldIO.h"
+#include "OgIO.h"
 
 //----------------------------------------------------------------------------//
 
@@ -66,9 +69,15 @@ using namespace Hdf5Util;
 const int         MACFieldIO::k_versionNumber(1);
 const std::string MACFieldIO::k_versionAttrName("version");
 const std::string MACFieldIO::k_extentsStr("extents");
+const std::string MACFieldIO::k_extentsMinStr("extents_min");
+const std::string MACFieldIO::k_extentsMaxStr("extents_max");
 const std::string MACFieldIO::k_dataWindowStr("data_window");
+const std::string MACFieldIO::k_dataWindowMinStr("data_window_min");
+const std::string MACFieldIO::k_dataWindowMaxStr("data_window_max");
 const std::string MACFieldIO::k_componentsStr("components");
 const std::string MACFieldIO::k_bitsPerComponentStr("bits_per_component");
+const std::string MACFieldIO::k_codecStr("data_codec");
+const std::string MACFieldIO::k_chunkSlicesStr("data_chunk_slices");
 const std::string MACFieldIO::k_uDataStr("u_data");
 const std::string MACFieldIO::k_vDataStr("v_data");
 const std::string MACFieldIO::k_wDataStr("w_data");
@@ -155,12 +164,37 @@ MACFieldIO::read(hid_t layerGroup, const std::string & /* filename */,
 //----------------------------------------------------------------------------//
 
 FieldBase::Ptr
-MACFieldIO::read(const OgIGroup & /* layerGroup */, 
+MACFieldIO::read(const OgIGroup &layerGroup, 
                  const std::string & /* filename */, 
                  const std::string & /* layerPath */,
-                 OgDataType /* typeEnum */)
+                 OgDataType typeEnum)
 {
-  return FieldBase::Ptr();
+  Box3i extents, dataW;
+  int bits;
+
+  readAttributes(layerGroup, extents, dataW, bits);
+
+  // Build a MACField to store everything in
+  FieldBase::Ptr result;
+  switch (bits) {
+  case 16:
+    if (typeEnum == F3DVec16) {
+      result = readData<V3h>(layerGroup, extents, dataW);
+    }
+    break;
+  case 64:
+    if (typeEnum == F3DVec64) {
+      result = readData<V3d>(layerGroup, extents, dataW);
+    }
+    break;
+  case 32:
+  default:
+    if (typeEnum == F3DVec32) {
+      result = readData<V3f>(layerGroup, extents, dataW);
+    }
+  }
+
+  return result;
 }
 
 //----------------------------------------------------------------------------//
@@ -204,13 +238,273 @@ MACFieldIO::write(hid_t layerGroup, FieldBase::Ptr field)
 //----------------------------------------------------------------------------//
 
 bool
-MACFieldIO::write(OgOGroup & /* layerGroup */ , FieldBase::Ptr /* field */)
+MACFieldIO::write(OgOGroup &layerGroup, FieldBase::Ptr field)
+{
+  MACField<V3h>::Ptr vecHalfField = 
+    field_dynamic_cast<MACField<V3h> >(field);
+  MACField<V3f>::Ptr vecFloatField = 
+    field_dynamic_cast<MACField<V3f> >(field);
+  MACField<V3d>::Ptr vecDoubleField = 
+    field_dynamic_cast<MACField<V3d> >(field);
+
+  bool success = true;
+  if (vecFloatField) {
+    success = writeInternal<V3f>(layerGroup, vecFloatField);
+  } else if (vecHalfField) {
+    success = writeInternal<V3h>(layerGroup, vecHalfField);
+  } else if (vecDoubleField) {
+    success = writeInternal<V3d>(layerGroup, vecDoubleField);
+  } else {
+    throw WriteLayerException("MACFieldIO does not support the given "
+                              "MACField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename DenseField<Data_T>::Ptr
+MACFieldIO::readComponent(const OgIGroup &layerGroup, const MACComponent comp)
+{
+  typedef typename DenseField<Data_T>::Ptr FieldPtr;
+
+  Box3i extents, dataW;
+  int bits;
+
+  readAttributes(layerGroup, extents, dataW, bits);
+
+  if (bits != DataTypeTraits<Data_T>::h5bits()) {
+    return FieldPtr();
+  }
+
+  FieldPtr field(new DenseField<Data_T>);
+  field->setSize(extents, 
+                 MACFieldUtil::makeDataWindowForComponent(dataW, comp));
+  readComponentData<Data_T>(layerGroup, comp, dataW, &(*field->begin()));
+
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+void
+MACFieldIO::readAttributes(const OgIGroup &layerGroup, Box3i &extents, 
+                           Box3i &dataW, int &bits)
+{
+  if (!layerGroup.isValid()) {
+    throw MissingGroupException("Invalid group in MACFieldIO::read()");
+  }
+
+  // Check version ---
+
+  OgIAttribute<int> versionAttr = 
+    layerGroup.findAttribute<int>(k_versionAttrName);
+  if (!versionAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_versionAttrName);
+  }
+
+  const int version = versionAttr.value();
+  if (version != k_versionNumber) {
+    throw UnsupportedVersionException("MACField version not supported: " + 
+                                      lexical_cast<std::string>(version));
+  }
+
+  // Get extents ---
+
+  OgIAttribute<veci32_t> extMinAttr = 
+    layerGroup.findAttribute<veci32_t>(k_extentsMinStr);
+  OgIAttribute<veci32_t> extMaxAttr = 
+    layerGroup.findAttribute<veci32_t>(k_extentsMaxStr);
+  if (!extMinAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsMinStr);
+  }
+  if (!extMaxAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsMaxStr);
+  }
+
+  extents.min = extMinAttr.value();
+  extents.max = extMaxAttr.value();
+
+  // Get data window ---
+
+  OgIAttribute<veci32_t> dwMinAttr = 
+    layerGroup.findAttribute<veci32_t>(k_dataWindowMinStr);
+  OgIAttribute<veci32_t> dwMaxAttr = 
+    layerGroup.findAttribute<veci32_t>(k_dataWindowMaxStr);
+  if (!dwMinAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowMinStr);
+  }
+  if (!dwMaxAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowMaxStr);
+  }
+
+  dataW.min = dwMinAttr.value();
+  dataW.max = dwMaxAttr.value();
+
+  // Get the bits per component ---
+
+  OgIAttribute<int> bitsAttr = 
+    layerGroup.findAttribute<int>(k_bitsPerComponentStr);
+  if (!bitsAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_bitsPerComponentStr);
+  }
+
+  bits = bitsAttr.value();
+}
+
+//----------------------------------------------------------------------------//
+
+const std::string& 
+MACFieldIO::componentStr(const MACComponent comp)
+{
+  switch (comp) {
+  case MACCompU:
+    return k_uDataStr;
+  case MACCompV:
+    return k_vDataStr;
+  case MACCompW:
+  default:
+    return k_wDataStr;
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Templated methods
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool MACFieldIO::writeInternal(OgOGroup &layerGroup, 
+                               typename MACField<Data_T>::Ptr field)
 {
+  typedef typename MACField<Data_T>::real_t real_t;
+
+  const Box3i ext(field->extents()), dw(field->dataWindow());
+  const int   chunkSlices = DenseFieldIO::writeChunkSlices(dw.size() + V3i(1));
+
+  // Add attributes ---
+
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, k_versionNumber);
+  OgOAttribute<veci32_t> extMinAttr(layerGroup, k_extentsMinStr, ext.min);
+  OgOAttribute<veci32_t> extMaxAttr(layerGroup, k_extentsMaxStr, ext.max);
+  OgOAttribute<veci32_t> dwMinAttr(layerGroup, k_dataWindowMinStr, dw.min);
+  OgOAttribute<veci32_t> dwMaxAttr(layerGroup, k_dataWindowMaxStr, dw.max);
+  OgOAttribute<int> componentsAttr(layerGroup, k_componentsStr, 
+                                   FieldTraits<Data_T>::dataDims());
+  OgOAttribute<int> bitsAttr(layerGroup, k_bitsPerComponentStr, 
+                             DataTypeTraits<Data_T>::h5bits());
+  if (chunkSlices > 0) {
+    OgOAttribute<uint8_t> codecAttr(layerGroup, k_codecStr, sparseCodec());
+    OgOAttribute<int> chunkSlicesAttr(layerGroup, k_chunkSlicesStr, 
+                                      chunkSlices);
+  }
+
+  // Add one dataset per component. The slabs of compressed components are
+  // compressed in parallel. All three components use the same number of 
+  // slices per slab, so that a component can be read on its own ---
+
+  for (int c = 0; c < 3; ++c) {
+    const MACComponent comp = static_cast<MACComponent>(c);
+    const V3i res = 
+      MACFieldUtil::makeDataWindowForComponent(dw, comp).size() + V3i(1);
+    const real_t *data = &(*field->cbegin_comp(comp));
+    if (chunkSlices > 0) {
+      if (!DenseFieldIO::writeChunks<real_t>(layerGroup, componentStr(comp), 
+                                             data, res, chunkSlices)) {
+        throw WriteMACFieldDataException("Error writing " + 
+                                         componentStr(comp));
+      }
+    } else {
+      OgODataset<real_t> dataset(layerGroup, componentStr(comp));
+      dataset.addData(static_cast<size_t>(res.x) * res.y * res.z, data);
+    }
+  }
+
   return true;
 }
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+typename MACField<Data_T>::Ptr 
+MACFieldIO::readData(const OgIGroup &layerGroup, const Box3i &extents, 
+                     const Box3i &dataW)
+{
+  typedef typename MACField<Data_T>::real_t real_t;
+
+  typename MACField<Data_T>::Ptr field(new MACField<Data_T>);
+  field->setSize(extents, dataW);
+
+  for (int c = 0; c < 3; ++c) {
+    const MACComponent comp = static_cast<MACComponent>(c);
+    readComponentData<real_t>(layerGroup, comp, dataW, 
+                              &(*field->begin_comp(comp)));
+  }
+
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void MACFieldIO::readComponentData(const OgIGroup &layerGroup, 
+                                   const MACComponent comp, 
+                                   const Box3i &dataW, Data_T *dst)
+{
+  const std::string &name = componentStr(comp);
+  const V3i res = 
+    MACFieldUtil::makeDataWindowForComponent(dataW, comp).size() + V3i(1);
+
+  // Compressed components are read slab by slab
+  OgIAttribute<int> chunkSlicesAttr = 
+    layerGroup.findAttribute<int>(k_chunkSlicesStr);
+  if (chunkSlicesAttr.isValid()) {
+    OgIAttribute<uint8_t> codecAttr = 
+      layerGroup.findAttribute<uint8_t>(k_codecStr);
+    if (!codecAttr.isValid() || !BlockCodec::isValid(codecAttr.value())) {
+      throw ReadDataException("MACFieldIO::readData() found an "
+                              "unknown codec.");
+    }
+    const SparseCodec codec = static_cast<SparseCodec>(codecAttr.value());
+    const Box3i localWindow(V3i(0), res - V3i(1));
+    if (!DenseFieldIO::readChunks<Data_T>(layerGroup, name, codec, res, 
+                                          chunkSlicesAttr.value(), 
+                                          localWindow, dst)) {
+      throw ReadDataException("MACFieldIO::readData() couldn't "
+                              "decompress " + name);
+    }
+    return;
+  }
+
+  OgIDataset<Data_T> data = layerGroup.findDataset<Data_T>(name);
+  if (!data.isValid() || !data.getData(0, dst, OGAWA_THREAD)) {
+    throw ReadDataException("MACFieldIO::readData() couldn't read " + name);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Template instantiations
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_READCOMPONENT(type)                       \
+  template                                                              \
+  DenseField<type>::Ptr                                                 \
+  MACFieldIO::readComponent<type>                                       \
+  (const OgIGroup &, const MACComponent);                               \
+
+FIELD3D_INSTANTIATION_READCOMPONENT(float16_t);
+FIELD3D_INSTANTIATION_READCOMPONENT(float32_t);
+FIELD3D_INSTANTIATION_READCOMPONENT(float64_t);
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_SOURCE_CLOSE
 
 //----------------------------------------------------------------------------//
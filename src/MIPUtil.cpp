@@ -45,6 +45,7 @@
 #include "MIPUtil.h"
 
 // System includes
+#include <algorithm>
 #include <cmath>
 
 // Library includes
@@ -64,6 +65,7 @@ namespace detail {
   //--------------------------------------------------------------------------//
 
   const std::string k_mipOffsetStr = "mipoffset";
+  const std::string k_mipMaxAxisLevelsStr = "mipmaxaxislevels";
 
   //--------------------------------------------------------------------------//
 
@@ -78,6 +80,92 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
+  void buildMIPTaskGraph(const V3i &srcRes, const V3i &newRes, 
+                         const V3i &add, const size_t blockSize,
+                         const float support, MIPTaskGraph &graph)
+  {
+    // Output resolution of each pass. Each pass only changes the resolution
+    // along its own axis
+    const V3i res[3] = { V3i(newRes.x, srcRes.y, srcRes.z),
+                         V3i(newRes.x, newRes.y, srcRes.z),
+                         newRes };
+    const int bs = static_cast<int>(blockSize);
+
+    graph.tasks.clear();
+    graph.ready.clear();
+    graph.numDone = 0;
+
+    // Add one task per block of each pass
+    V3i    blockRes[3];
+    size_t firstTask[3];
+    for (size_t dim = 0; dim < 3; ++dim) {
+      blockRes[dim]  = (res[dim] + V3i(bs - 1)) / bs;
+      firstTask[dim] = graph.tasks.size();
+      for (int k = 0; k < blockRes[dim].z; ++k) {
+        for (int j = 0; j < blockRes[dim].y; ++j) {
+          for (int i = 0; i < blockRes[dim].x; ++i) {
+            MIPTask task;
+            task.dim     = dim;
+            task.box.min = V3i(i, j, k) * bs;
+            task.box.max = task.box.min + V3i(bs - 1);
+            task.box.max.x = std::min(task.box.max.x, res[dim].x - 1);
+            task.box.max.y = std::min(task.box.max.y, res[dim].y - 1);
+            task.box.max.z = std::min(task.box.max.z, res[dim].z - 1);
+            task.numDeps = 0;
+            graph.tasks.push_back(task);
+          }
+        }
+      }
+    }
+
+    // Each y and z block depends on the blocks of the previous pass that 
+    // it reads. Along the pass's axis, that's the filter footprint, as 
+    // well as the input that checkInputEmpty() looks at. The other two 
+    // axes have the same blocks in both passes.
+    const float tgtToSrcMult = 2.0f;
+    const int   pad          = std::max(0, static_cast<int>
+                                        (std::ceil(support * 0.5f)));
+    for (size_t dim = 1; dim < 3; ++dim) {
+      const V3i &srcBlockRes = blockRes[dim - 1];
+      const int  srcMax      = res[dim - 1][dim] - 1;
+      for (size_t t = firstTask[dim]; t < graph.tasks.size() && 
+             graph.tasks[t].dim == dim; ++t) {
+        MIPTask    &task = graph.tasks[t];
+        const int   tMin = task.box.min[dim], tMax = task.box.max[dim];
+        const float cMin = discToCont(tMin) * tgtToSrcMult - add[dim];
+        const float cMax = discToCont(tMax) * tgtToSrcMult - add[dim];
+        // Pad by one voxel to stay clear of rounding
+        int lo = std::min(static_cast<int>
+                          (std::floor(cMin - support * tgtToSrcMult)),
+                          (tMin - pad) * 2) - 1;
+        int hi = std::max(static_cast<int>
+                          (std::ceil(cMax + support * tgtToSrcMult)) - 1,
+                          (tMax + pad) * 2) + 1;
+        lo = std::max(lo, 0);
+        hi = std::min(hi, srcMax);
+        V3i srcBlock = task.box.min / bs;
+        for (int b = lo / bs; lo <= hi && b <= hi / bs; ++b) {
+          srcBlock[dim] = b;
+          const size_t src = firstTask[dim - 1] + 
+            (srcBlock.z * srcBlockRes.y + srcBlock.y) * srcBlockRes.x + 
+            srcBlock.x;
+          graph.tasks[src].dependents.push_back(t);
+          task.numDeps++;
+        }
+      }
+    }
+
+    // Tasks without dependencies can start right away. They're taken from 
+    // the back, so the first block goes last
+    for (size_t t = graph.tasks.size(); t > 0; --t) {
+      if (graph.tasks[t - 1].numDeps == 0) {
+        graph.ready.push_back(t - 1);
+      }
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
   //! \todo Update to use MIPField's mipOffset() instead of metadata
   FieldMapping::Ptr adjustedMIPFieldMapping(const FieldRes *base, 
                                             const V3i &/*baseRes*/,
@@ -90,13 +178,21 @@ namespace detail {
 
     const V3i   zero   = V3i(0);
     const V3i   mipOff = base->metadata().vecIntMetadata(k_mipOffsetStr, zero);
-    const float mult   = 1 << level;
+    const V3i   maxLvl = 
+      base->metadata().vecIntMetadata(k_mipMaxAxisLevelsStr, 
+                                      V3i(k_mipNoAxisLimit));
     const V3i   res    = extents.size() + V3i(1);
+
+    // Number of times each axis has been halved
+    const int l = static_cast<int>(level);
+    const V3i axisLevel(std::min(l, maxLvl.x), std::min(l, maxLvl.y),
+                        std::min(l, maxLvl.z));
+    const V3f mult(1 << axisLevel.x, 1 << axisLevel.y, 1 << axisLevel.z);
       
     // Compute offset of current level 
-    const V3i offset((mipOff.x >> level) << level, 
-                     (mipOff.y >> level) << level, 
-                     (mipOff.z >> level) << level);
+    const V3i offset((mipOff.x >> axisLevel.x) << axisLevel.x, 
+                     (mipOff.y >> axisLevel.y) << axisLevel.y, 
+                     (mipOff.z >> axisLevel.z) << axisLevel.z);
 
     // Difference between current offset and base offset is num voxels
     // to offset current level by 
@@ -150,6 +246,22 @@ namespace detail {
 
   //--------------------------------------------------------------------------//
 
+  MemoryBudgetCounter& mipLevelMemory()
+  {
+    static boost::mutex s_mutex;
+    static MemoryBudgetCounter *s_counter = NULL;
+
+    boost::mutex::scoped_lock lock(s_mutex);
+    if (!s_counter) {
+      s_counter = new MemoryBudgetCounter;
+      MemoryBudget::singleton().registerClient(
+        s_counter, MemoryBudget::k_priorityMIPLevels);
+    }
+    return *s_counter;
+  }
+
+  //--------------------------------------------------------------------------//
+
 } // namespace detail
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,174 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file MemoryBudget.cpp
+  Contains implementation of the MemoryBudget class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "MemoryBudget.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Static members
+//----------------------------------------------------------------------------//
+
+MemoryBudget *MemoryBudget::ms_singleton = NULL;
+boost::mutex  MemoryBudget::ms_creationMutex;
+
+//----------------------------------------------------------------------------//
+// MemoryBudget implementations
+//----------------------------------------------------------------------------//
+
+MemoryBudget::MemoryBudget()
+  : m_limit(0)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+MemoryBudget& MemoryBudget::singleton()
+{
+  boost::mutex::scoped_lock lock(ms_creationMutex);
+  if (!ms_singleton) {
+    ms_singleton = new MemoryBudget;
+  }
+  return *ms_singleton;
+}
+
+//----------------------------------------------------------------------------//
+
+void MemoryBudget::setLimit(const long long int bytes)
+{
+  m_limit = bytes;
+  enforce();
+}
+
+//----------------------------------------------------------------------------//
+
+long long int MemoryBudget::limit() const
+{
+  return m_limit;
+}
+
+//----------------------------------------------------------------------------//
+
+long long int MemoryBudget::memUse() const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return memUseLocked();
+}
+
+//----------------------------------------------------------------------------//
+
+void MemoryBudget::registerClient(MemoryBudgetClient *client, 
+                                  const int priority)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  Entry entry;
+  entry.client   = client;
+  entry.priority = priority;
+  // Insert after the clients of the same priority
+  std::vector<Entry>::iterator i = m_clients.begin();
+  while (i != m_clients.end() && i->priority <= priority) {
+    ++i;
+  }
+  m_clients.insert(i, entry);
+}
+
+//----------------------------------------------------------------------------//
+
+void MemoryBudget::unregisterClient(MemoryBudgetClient *client)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  for (std::vector<Entry>::iterator i = m_clients.begin(); 
+       i != m_clients.end(); ++i) {
+    if (i->client == client) {
+      m_clients.erase(i);
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void MemoryBudget::setPriority(MemoryBudgetClient *client, const int priority)
+{
+  unregisterClient(client);
+  registerClient(client, priority);
+}
+
+//----------------------------------------------------------------------------//
+
+void MemoryBudget::reserve(const long long int bytes)
+{
+  const long long int limit = m_limit;
+  if (limit <= 0) {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  long long int excess = memUseLocked() + bytes - limit;
+  for (std::vector<Entry>::const_iterator i = m_clients.begin(); 
+       i != m_clients.end() && excess > 0; ++i) {
+    excess -= i->client->budgetRelease(excess);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+long long int MemoryBudget::memUseLocked() const
+{
+  long long int memUse = 0;
+  for (std::vector<Entry>::const_iterator i = m_clients.begin(); 
+       i != m_clients.end(); ++i) {
+    memUse += i->client->budgetMemUse();
+  }
+  return memUse;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -187,6 +187,45 @@ ODataPtr OGroup::addData(Alembic::Util::uint64_t iNumData,
     return child;
 }
 
+ODataPtr OGroup::addStreamedData(Alembic::Util::uint64_t iSize)
+{
+    ODataPtr child;
+    if (isFrozen())
+    {
+        return child;
+    }
+
+    if (iSize == 0)
+    {
+        mData->childVec.push_back(EMPTY_DATA);
+        child.reset(new OData());
+        return child;
+    }
+
+    Alembic::Util::uint64_t pos = mData->stream->getAndSeekEndPos();
+
+    // only the size is written for now, the data follows it
+    Alembic::Util::uint64_t size = iSize;
+    mData->stream->write(&size, 8);
+
+    child.reset(new OData(mData->stream, pos, iSize));
+
+    // flip top bit for data so we can easily distinguish between it and
+    // a group
+    mData->childVec.push_back(child->getPos() | 0x8000000000000000ULL);
+
+    return child;
+}
+
+void OGroup::streamData(Alembic::Util::uint64_t iSize, const void * iData)
+{
+    if (iSize != 0)
+    {
+        mData->stream->getAndSeekEndPos();
+        mData->stream->write(iData, iSize);
+    }
+}
+
 void OGroup::addData(ODataPtr iData)
 {
     if (!isFrozen())
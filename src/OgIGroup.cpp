@@ -23,6 +23,7 @@ OgIGroup::OgIGroup(Alembic::Ogawa::IArchive &archive)
   validate();
   if (m_group) {
     getGroupName(m_group, m_name);
+    m_packed = OgPackedAttributes::read(m_group);
   }
 }
 
@@ -44,6 +45,9 @@ std::vector<std::string> OgIGroup::groupNames() const
 
 std::vector<std::string> OgIGroup::attributeNames() const
 {
+  if (m_packed) {
+    return m_packed->names();
+  }
   return groupNames(F3DAttributeType);
 }
 
@@ -76,6 +80,73 @@ OgIGroup OgIGroup::findGroup(const std::string &name) const
 
 //----------------------------------------------------------------------------//
 
+OgIGroup OgIGroup::childGroup(const size_t index) const
+{
+  // If not valid, return non-valid group
+  if (!isValid()) {
+    return OgIGroup();
+  }
+  // The first children are the name and type of this group
+  if (index < OGAWA_START_ID || index >= m_group->getNumChildren() ||
+      !m_group->isChildGroup(index)) {
+    return OgIGroup();
+  }
+  // Grab the ogawa group
+  Alembic::Ogawa::IGroupPtr group = 
+    m_group->getGroup(index, false, OGAWA_THREAD);
+  // Data set 1 is the type. Attributes and datasets are ogawa groups too.
+  OgGroupType type;
+  if (!group || !readData(group, 1, type) || type != F3DGroupType) {
+    return OgIGroup();
+  }
+  return OgIGroup(group);
+}
+
+//----------------------------------------------------------------------------//
+
+Alembic::Ogawa::IGroupPtr 
+OgIGroup::findLastGroup(const std::string &name,
+                        const OgGroupType groupType,
+                        const size_t maxChildren) const
+{
+  // If not valid, return non-valid group
+  if (!isValid()) {
+    return Alembic::Ogawa::IGroupPtr();
+  }
+  // Check the children, last one first
+  const size_t numChildren = m_group->getNumChildren();
+  const size_t first = 
+    maxChildren > 0 && numChildren > OGAWA_START_ID + maxChildren ? 
+    numChildren - maxChildren : OGAWA_START_ID;
+  for (size_t i = numChildren; i > first; --i) {
+    // Is it an Ogawa group? If not, continue
+    if (!m_group->isChildGroup(i - 1)) {
+      continue;
+    }
+    // Grab the ogawa group
+    Alembic::Ogawa::IGroupPtr group = 
+      m_group->getGroup(i - 1, false, OGAWA_THREAD);
+    // Data set 0 is the name
+    std::string groupName;
+    if (!readString(group, 0, groupName)) {
+      continue;
+    }
+    // Data set 1 is the type
+    OgGroupType type;
+    if (!readData(group, 1, type)) {
+      continue;
+    }
+    // Check that group type and name match
+    if (type == groupType && groupName == name) {
+      return group;
+    }
+  }
+  // Didn't find one
+  return Alembic::Ogawa::IGroupPtr();
+}
+
+//----------------------------------------------------------------------------//
+
 Alembic::Ogawa::IGroupPtr 
 OgIGroup::findGroup(const std::string &path,
                     const OgGroupType groupType) const
@@ -233,6 +304,11 @@ OgIGroup::groupNames(const OgGroupType groupType) const
 
 OgDataType OgIGroup::attributeType(const std::string &name) const
 {
+  if (m_packed) {
+    const OgPackedAttributes::Entry *entry = m_packed->find(name);
+    return entry ? entry->type : F3DInvalidDataType;
+  }
+
   Alembic::Ogawa::IGroupPtr group = findGroup(name, F3DAttributeType);
 
   if (group && group->getNumChildren() > 2) {
@@ -281,7 +357,10 @@ OgIGroup::OgIGroup(Alembic::Ogawa::IGroupPtr group)
   : OgIBase(group)
 {
   validate();
-  getGroupName(m_group, m_name);
+  if (m_group) {
+    getGroupName(m_group, m_name);
+    m_packed = OgPackedAttributes::read(m_group);
+  }
 }
 
 //----------------------------------------------------------------------------//
@@ -4,6 +4,9 @@
 
 #include "OgUtil.h"
 
+#include "InitIO.h"
+#include "StreamSource.h"
+
 //----------------------------------------------------------------------------//
 
 FIELD3D_NAMESPACE_OPEN
@@ -101,6 +104,160 @@ bool getGroupName(Alembic::Ogawa::IGroupPtr group,
 
 //----------------------------------------------------------------------------//
 
+namespace {
+
+  //! Lets Ogawa read through a StreamSource
+  class OgStreamSource : public Alembic::Ogawa::IStreamSource
+  {
+  public:
+    OgStreamSource(const StreamSource::Ptr &source)
+      : m_source(source)
+    { }
+    virtual Alembic::Util::uint64_t size()
+    { return m_source->size(); }
+    virtual bool read(Alembic::Util::uint64_t pos, 
+                      Alembic::Util::uint64_t numBytes, void *buffer)
+    { return m_source->read(pos, numBytes, buffer); }
+    virtual void willNeed(Alembic::Util::uint64_t pos, 
+                          Alembic::Util::uint64_t numBytes)
+    { m_source->willNeed(pos, numBytes); }
+  private:
+    StreamSource::Ptr m_source;
+  };
+
+}
+
+//----------------------------------------------------------------------------//
+
+boost::shared_ptr<Alembic::Ogawa::IArchive> 
+openOgawaArchive(const std::string &filename)
+{
+  if (!hasStreamSource(filename)) {
+    return boost::shared_ptr<Alembic::Ogawa::IArchive>
+      (new Alembic::Ogawa::IArchive(filename, 1, mapOgawaFiles()));
+  }
+  Alembic::Ogawa::IStreamSourcePtr ogSource;
+  if (StreamSource::Ptr source = openStreamSource(filename)) {
+    ogSource.reset(new OgStreamSource(source));
+  }
+  return boost::shared_ptr<Alembic::Ogawa::IArchive>
+    (new Alembic::Ogawa::IArchive(ogSource));
+}
+
+//----------------------------------------------------------------------------//
+// OgPackedAttributes implementations
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //! Start of packed attributes, "F3PA"
+  const uint32_t k_packedAttributesMagic = 0x41503346;
+
+  //! Appends a value to packed bytes
+  template <typename T>
+  void appendBytes(std::vector<uint8_t> &bytes, const T &value)
+  {
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(&value);
+    bytes.insert(bytes.end(), data, data + sizeof(T));
+  }
+
+  //! Reads a value from packed bytes, advancing pos past it
+  template <typename T>
+  bool readBytes(const std::vector<uint8_t> &bytes, size_t &pos, T &value)
+  {
+    if (bytes.size() - pos < sizeof(T)) {
+      return false;
+    }
+    memcpy(&value, &bytes[pos], sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+
+}
+
+//----------------------------------------------------------------------------//
+
+void OgPackedAttributes::append(std::vector<uint8_t> &bytes, 
+                                const std::string &name, 
+                                const OgDataType type, const void *data, 
+                                const size_t numBytes)
+{
+  if (bytes.empty()) {
+    appendBytes(bytes, k_packedAttributesMagic);
+  }
+  appendBytes(bytes, static_cast<uint32_t>(name.size()));
+  bytes.insert(bytes.end(), name.begin(), name.end());
+  appendBytes(bytes, static_cast<int32_t>(type));
+  appendBytes(bytes, static_cast<uint32_t>(numBytes));
+  const uint8_t *value = static_cast<const uint8_t *>(data);
+  bytes.insert(bytes.end(), value, value + numBytes);
+}
+
+//----------------------------------------------------------------------------//
+
+OgPackedAttributes::CPtr 
+OgPackedAttributes::read(Alembic::Ogawa::IGroupPtr group)
+{
+  // The packed attributes are the last child, and a data child
+  const size_t numChildren = group ? group->getNumChildren() : 0;
+  if (numChildren <= OGAWA_START_ID || !group->isChildData(numChildren - 1)) {
+    return CPtr();
+  }
+  Alembic::Ogawa::IDataPtr data = 
+    group->getData(numChildren - 1, OGAWA_THREAD);
+  if (!data || data->getSize() < sizeof(uint32_t)) {
+    return CPtr();
+  }
+
+  // Read them in one go
+  boost::shared_ptr<OgPackedAttributes> result(new OgPackedAttributes);
+  std::vector<uint8_t> &bytes = result->m_bytes;
+  bytes.resize(data->getSize());
+  data->read(bytes.size(), &bytes[0], 0, OGAWA_THREAD);
+
+  size_t   pos = 0;
+  uint32_t magic;
+  if (!readBytes(bytes, pos, magic) || magic != k_packedAttributesMagic) {
+    return CPtr();
+  }
+  while (pos < bytes.size()) {
+    uint32_t nameLength, numBytes;
+    int32_t  type;
+    if (!readBytes(bytes, pos, nameLength) || 
+        bytes.size() - pos < nameLength) {
+      return CPtr();
+    }
+    const std::string name(bytes.begin() + pos, 
+                           bytes.begin() + pos + nameLength);
+    pos += nameLength;
+    if (!readBytes(bytes, pos, type) || !readBytes(bytes, pos, numBytes) ||
+        bytes.size() - pos < numBytes) {
+      return CPtr();
+    }
+    Entry entry;
+    entry.type     = static_cast<OgDataType>(type);
+    entry.offset   = pos;
+    entry.numBytes = numBytes;
+    pos += numBytes;
+    if (result->m_entries.insert(std::make_pair(name, entry)).second) {
+      result->m_names.push_back(name);
+    }
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+const OgPackedAttributes::Entry* 
+OgPackedAttributes::find(const std::string &name) const
+{
+  std::map<std::string, Entry>::const_iterator i = m_entries.find(name);
+  return i == m_entries.end() ? NULL : &i->second;
+}
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_SOURCE_CLOSE
 
 //----------------------------------------------------------------------------//
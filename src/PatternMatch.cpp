@@ -44,6 +44,8 @@
 // Header include
 #include "PatternMatch.h"
 
+#include <algorithm>
+
 // System includes
 #ifdef WIN32
 #include "Shlwapi.h"
@@ -71,6 +73,91 @@ fnmatch(const char *pattern, const char *string, int /*flags*/)
 
 //----------------------------------------------------------------------------//
 
+namespace {
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether literal parts of patterns may be compared as plain strings. 
+  //! PathMatchSpec() is case insensitive, so Windows always calls it.
+#ifdef WIN32
+  const bool k_literalChecks = false;
+#else
+  const bool k_literalChecks = true;
+#endif
+
+  //--------------------------------------------------------------------------//
+
+  //! Returns the part of a pattern before its first wildcard
+  std::string literalPrefix(const std::string &pattern)
+  {
+    return pattern.substr(0, pattern.find_first_of("*?["));
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Matches a string against a pattern with the given literal prefix
+  bool matchGlob(const std::string &pattern, const std::string &prefix, 
+                 const bool isLiteral, const std::string &s)
+  {
+    if (k_literalChecks) {
+      if (isLiteral) {
+        return s == pattern;
+      }
+      if (s.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+      }
+    }
+    return fnmatch(pattern.c_str(), s.c_str(), FNM_NOESCAPE) == 0;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether any of the globs matches <name>:<attribute>, or <attribute> 
+  //! for globs without a separator
+  bool matchAny(const std::vector<MatchPattern::Glob> &globs, 
+                const std::string &name, const std::string &attribute)
+  {
+    // The name:attribute string is only built if it's needed
+    std::string nameAttribute;
+    BOOST_FOREACH (const MatchPattern::Glob &glob, globs) {
+      if (glob.hasSeparator) {
+        if (nameAttribute.empty()) {
+          nameAttribute = name + ":" + attribute;
+        }
+        if (matchGlob(glob.pattern, glob.prefix, glob.isLiteral, 
+                      nameAttribute)) {
+          return true;
+        }
+      } else if (matchGlob(glob.pattern, glob.prefix, glob.isLiteral, 
+                           attribute)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Whether any of the globs matches <attribute>, using the part after 
+  //! the separator of globs that have one
+  bool matchAny(const std::vector<MatchPattern::Glob> &globs, 
+                const std::string &attribute)
+  {
+    BOOST_FOREACH (const MatchPattern::Glob &glob, globs) {
+      if (matchGlob(glob.attributePattern, glob.attributePrefix, 
+                    glob.isAttributeLiteral, attribute)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //--------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+
 std::vector<std::string> 
 split(const std::string &s)
 {
@@ -103,48 +190,7 @@ match(const std::string &name, const std::string &attribute,
       const std::vector<std::string> &patterns, 
       const MatchFlags flags)
 {
-  bool foundMatch = false;
-  bool foundExclusion = false;
-
-  if (patterns.size() == 0) {
-    return flags && MatchEmptyPattern;
-  }
-
-  BOOST_FOREACH (const std::string &i, patterns) {
-
-    if (i.size() == 0) {
-      continue;
-    }
-
-    // Check exclusion string
-    bool isExclusion = i[0] == '-' || i[0] == '^';
-    // Update string
-    const std::string pattern = isExclusion ? i.substr(1) : i;
-
-    // String to match
-    std::string s;
-
-    // Determine type of matching
-    if (pattern.find(":") != std::string::npos) {
-      // Pattern includes separator. Match against name:attribute
-      s = name + ":" + attribute;
-    } else {
-      // No separator. Just match against attribute
-      s = attribute;
-    }
-    
-    // Match with wildcards
-    if (fnmatch(pattern.c_str(), s.c_str(), FNM_NOESCAPE) == 0) {
-      if (isExclusion) {
-        foundExclusion = true;
-      } else {
-        foundMatch = true;
-      }
-    }
-
-  }
-
-  return foundMatch && !foundExclusion;
+  return MatchPattern(patterns, flags).match(name, attribute);
 }
 
 //------------------------------------------------------------------------------
@@ -163,43 +209,7 @@ bool
 match(const std::string &attribute, const std::vector<std::string> &patterns, 
       const MatchFlags flags)
 {
-  bool foundMatch = false;
-  bool foundExclusion = false;
-
-  if (patterns.size() == 0) {
-    return flags && MatchEmptyPattern;
-  }
-
-  BOOST_FOREACH (const std::string &i, patterns) {
-
-    if (i.size() == 0) {
-      continue;
-    }
-
-    // Check exclusion string
-    bool isExclusion = i[0] == '-' || i[0] == '^';
-    // Update string
-    std::string pattern = isExclusion ? i.substr(1) : i;
-
-    // Determine type of matching
-    size_t pos = pattern.find(":");
-    if (pos != std::string::npos) {
-      // Pattern includes separator. Just use second half
-      pattern = pattern.substr(pos + 1);
-    } 
-    
-    // Match with wildcards
-    if (fnmatch(pattern.c_str(), attribute.c_str(), FNM_NOESCAPE) == 0) {
-      if (isExclusion) {
-        foundExclusion = true;
-      } else {
-        foundMatch = true;
-      }
-    }
-
-  }
-
-  return foundMatch && !foundExclusion;
+  return MatchPattern(patterns, flags).match(attribute);
 }
 
 //------------------------------------------------------------------------------
@@ -229,6 +239,168 @@ match(const FieldRes *f, const std::string &patterns,
   return match(f->name, f->attribute, split(patterns), flags);
 }
 
+//----------------------------------------------------------------------------//
+// MatchPattern implementations
+//----------------------------------------------------------------------------//
+
+MatchPattern::MatchPattern(const std::vector<std::string> &patterns, 
+                           const MatchFlags flags)
+  : m_isEmpty(patterns.empty()), 
+    m_emptyMatches((flags & MatchEmptyPattern) != 0)
+{
+  parse(patterns);
+}
+
+//----------------------------------------------------------------------------//
+
+MatchPattern::MatchPattern(const std::string &patterns, 
+                           const MatchFlags flags)
+  : m_isEmpty(false), 
+    m_emptyMatches((flags & MatchEmptyPattern) != 0)
+{
+  const std::vector<std::string> list = split(patterns);
+  m_isEmpty = list.empty();
+  parse(list);
+}
+
+//----------------------------------------------------------------------------//
+
+bool 
+MatchPattern::match(const std::string &name, 
+                    const std::string &attribute) const
+{
+  if (m_isEmpty) {
+    return m_emptyMatches;
+  }
+  return !matchAny(m_excludes, name, attribute) && 
+    matchAny(m_includes, name, attribute);
+}
+
+//----------------------------------------------------------------------------//
+
+bool 
+MatchPattern::match(const std::string &attribute) const
+{
+  if (m_isEmpty) {
+    return m_emptyMatches;
+  }
+  return !matchAny(m_excludes, attribute) && matchAny(m_includes, attribute);
+}
+
+//----------------------------------------------------------------------------//
+
+bool 
+MatchPattern::match(const FieldRes *f) const
+{
+  return match(f->name, f->attribute);
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+MatchPattern::parse(const std::vector<std::string> &patterns)
+{
+  BOOST_FOREACH (const std::string &i, patterns) {
+
+    if (i.size() == 0) {
+      continue;
+    }
+
+    // Check exclusion string
+    const bool isExclusion = i[0] == '-' || i[0] == '^';
+
+    Glob glob;
+    glob.pattern            = isExclusion ? i.substr(1) : i;
+    glob.prefix             = literalPrefix(glob.pattern);
+    glob.isLiteral          = glob.prefix.size() == glob.pattern.size();
+    // Attributes are matched against the second half of patterns that 
+    // include the separator
+    const size_t pos        = glob.pattern.find(":");
+    glob.hasSeparator       = pos != std::string::npos;
+    glob.attributePattern   = 
+      glob.hasSeparator ? glob.pattern.substr(pos + 1) : glob.pattern;
+    glob.attributePrefix    = literalPrefix(glob.attributePattern);
+    glob.isAttributeLiteral = 
+      glob.attributePrefix.size() == glob.attributePattern.size();
+
+    if (isExclusion) {
+      m_excludes.push_back(glob);
+    } else {
+      m_includes.push_back(glob);
+    }
+
+  }
+}
+
+//----------------------------------------------------------------------------//
+// MatchIndex implementations
+//----------------------------------------------------------------------------//
+
+MatchIndex::MatchIndex(const std::vector<std::string> &names)
+  : m_names(names)
+{
+  m_sorted.reserve(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    m_sorted.push_back(Entry(names[i], i));
+  }
+  std::sort(m_sorted.begin(), m_sorted.end());
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+MatchIndex::find(const MatchPattern &pattern, 
+                 std::vector<size_t> &indices) const
+{
+  indices.clear();
+
+  if (pattern.isEmpty()) {
+    if (pattern.emptyMatches()) {
+      for (size_t i = 0; i < m_names.size(); ++i) {
+        indices.push_back(i);
+      }
+    }
+    return;
+  }
+
+  BOOST_FOREACH (const MatchPattern::Glob &glob, pattern.includes()) {
+    // Only the names that start with the glob's literal prefix can match
+    std::vector<Entry>::const_iterator i = m_sorted.begin();
+    if (k_literalChecks) {
+      i = std::lower_bound(m_sorted.begin(), m_sorted.end(), 
+                           Entry(glob.attributePrefix, 0));
+    }
+    for (; i != m_sorted.end(); ++i) {
+      if (k_literalChecks && 
+          i->first.compare(0, glob.attributePrefix.size(), 
+                           glob.attributePrefix) != 0) {
+        break;
+      }
+      if (pattern.match(i->first)) {
+        indices.push_back(i->second);
+      }
+    }
+  }
+
+  // Several globs may match the same name
+  std::sort(indices.begin(), indices.end());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+}
+
+//----------------------------------------------------------------------------//
+
+void 
+MatchIndex::find(const MatchPattern &pattern, 
+                 std::vector<std::string> &names) const
+{
+  std::vector<size_t> indices;
+  find(pattern, indices);
+  names.clear();
+  BOOST_FOREACH (const size_t i, indices) {
+    names.push_back(m_names[i]);
+  }
+}
+
 //----------------------------------------------------------------------------//
 
 FIELD3D_NAMESPACE_SOURCE_CLOSE
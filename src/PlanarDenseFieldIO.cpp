@@ -0,0 +1,566 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file PlanarDenseFieldIO.cpp
+  Contains the implementation of the PlanarDenseFieldIO class
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "BlockCodec.h"
+#include "DenseFieldIO.h"
+#include "InitIO.h"
+#include "OgIO.h"
+#include "PlanarDenseFieldIO.h"
+
+//----------------------------------------------------------------------------//
+
+using namespace boost;
+using namespace std;
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Field3D namespaces
+//----------------------------------------------------------------------------//
+
+using namespace Exc;
+using namespace Hdf5Util;
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Writes one component plane of numValues values to a new data set
+template <class Data_T>
+void writePlane(hid_t layerGroup, const std::string &name, 
+                const Data_T *data, const size_t numValues)
+{
+  hsize_t totalSize[1];
+  totalSize[0] = numValues;
+
+  // Make sure chunk size isn't too big.
+  hsize_t preferredChunkSize = 4096 * 16;
+  const hsize_t chunkSize = std::min(preferredChunkSize, 
+                                     std::max(totalSize[0] / 2, hsize_t(1)));
+
+  H5ScopedScreate dataSpace(H5S_SIMPLE);
+  if (dataSpace.id() < 0) {
+    throw CreateDataSpaceException("Couldn't create data space in "
+                                   "PlanarDenseFieldIO::writeInternal");
+  }
+  H5Sset_extent_simple(dataSpace.id(), 1, totalSize, NULL);
+
+  // Set up gzip property list
+  H5ScopedPcreate dcpl(H5P_DATASET_CREATE);
+  if (checkHdf5Gzip()) {
+    if (H5Pset_deflate(dcpl.id(), 9) < 0 || 
+        H5Pset_chunk(dcpl.id(), 1, &chunkSize) < 0) {
+      throw CreateDataSetException("Couldn't set up compression in "
+                                   "PlanarDenseFieldIO::writeInternal");
+    }
+  }
+  
+  H5ScopedDcreate dataSet(layerGroup, name, DataTypeTraits<Data_T>::h5type(), 
+                          dataSpace.id(), H5P_DEFAULT, dcpl.id(), 
+                          H5P_DEFAULT);
+  if (dataSet.id() < 0) {
+    throw CreateDataSetException("Couldn't create data set in "
+                                 "PlanarDenseFieldIO::writeInternal");
+  }
+
+  // The data set is in the native type, so the plane's chunks can be 
+  // deflated straight out of it
+  if (hdf5ParallelDeflate() && 
+      writeDeflatedChunks(dataSet.id(), sizeof(Data_T), data)) {
+    return;
+  }
+  if (H5Dwrite(dataSet.id(), DataTypeTraits<Data_T>::h5type(), 
+               H5S_ALL, H5S_ALL, H5P_DEFAULT, data) < 0) {
+    throw WriteLayerException("Error writing " + name + " in "
+                              "PlanarDenseFieldIO::writeInternal");
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads one component plane into dst
+template <class Data_T>
+void readPlane(hid_t layerGroup, const std::string &name, Data_T *dst)
+{
+  H5ScopedDopen dataSet(layerGroup, name, H5P_DEFAULT);
+  if (dataSet.id() < 0) {
+    throw OpenDataSetException("Couldn't open data set: " + name);
+  }
+  // The data set is in the native type, so its raw chunks can be inflated
+  // straight into the plane
+  if (hdf5ParallelInflate() && 
+      readDeflatedChunks(dataSet.id(), sizeof(Data_T), dst)) {
+    return;
+  }
+  if (H5Dread(dataSet.id(), DataTypeTraits<Data_T>::h5type(), 
+              H5S_ALL, H5S_ALL, H5P_DEFAULT, dst) < 0) {
+    throw Hdf5DataReadException("Couldn't read " + name);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the component type of a vector type, or F3DInvalidDataType
+OgDataType componentType(const OgDataType typeEnum)
+{
+  switch (typeEnum) {
+  case F3DVec16:
+    return F3DFloat16;
+  case F3DVec32:
+    return F3DFloat32;
+  case F3DVec64:
+    return F3DFloat64;
+  default:
+    return F3DInvalidDataType;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// Static members
+//----------------------------------------------------------------------------//
+
+const int         PlanarDenseFieldIO::k_versionNumber(1);
+const std::string PlanarDenseFieldIO::k_versionAttrName("version");
+const std::string PlanarDenseFieldIO::k_extentsStr("extents");
+const std::string PlanarDenseFieldIO::k_extentsMinStr("extents_min");
+const std::string PlanarDenseFieldIO::k_extentsMaxStr("extents_max");
+const std::string PlanarDenseFieldIO::k_dataWindowStr("data_window");
+const std::string PlanarDenseFieldIO::k_dataWindowMinStr("data_window_min");
+const std::string PlanarDenseFieldIO::k_dataWindowMaxStr("data_window_max");
+const std::string PlanarDenseFieldIO::k_componentsStr("components");
+const std::string 
+PlanarDenseFieldIO::k_bitsPerComponentStr("bits_per_component");
+const std::string PlanarDenseFieldIO::k_codecStr("data_codec");
+const std::string PlanarDenseFieldIO::k_chunkSlicesStr("data_chunk_slices");
+const std::string PlanarDenseFieldIO::k_planeStrs[3] = 
+  { "x_data", "y_data", "z_data" };
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+PlanarDenseFieldIO::read(hid_t layerGroup, const std::string &/*filename*/, 
+                         const std::string &/*layerPath*/,
+                         DataTypeEnum typeEnum)
+{
+  Box3i extents, dataW;
+  int components;
+  
+  if (layerGroup == -1) {
+    throw BadHdf5IdException("Bad layer group in PlanarDenseFieldIO::read");
+  }
+
+  int version;
+  if (!readAttribute(layerGroup, k_versionAttrName, 1, version)) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_versionAttrName);
+  }
+
+  if (version != k_versionNumber) {
+    throw UnsupportedVersionException("PlanarDenseField version not "
+                                      "supported: " + 
+                                      lexical_cast<std::string>(version));
+  }
+
+  if (!readAttribute(layerGroup, k_extentsStr, 6, extents.min.x)) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsStr);
+  }
+
+  if (!readAttribute(layerGroup, k_dataWindowStr, 6, dataW.min.x)) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowStr);
+  }
+  
+  if (!readAttribute(layerGroup, k_componentsStr, 1, components)) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_componentsStr);
+  }
+
+  int bits;
+  if (!readAttribute(layerGroup, k_bitsPerComponentStr, 1, bits)) {
+    throw MissingAttributeException("Couldn't find attribute: " +
+                                    k_bitsPerComponentStr);  
+  }
+
+  // Only read the data if it matches the requested type ---
+
+  FieldBase::Ptr result;
+
+  if (bits == 16 && typeEnum == DataTypeVecHalf) {
+    result = readData<V3h>(layerGroup, extents, dataW);
+  } else if (bits == 32 && typeEnum == DataTypeVecFloat) {
+    result = readData<V3f>(layerGroup, extents, dataW);
+  } else if (bits == 64 && typeEnum == DataTypeVecDouble) {
+    result = readData<V3d>(layerGroup, extents, dataW);
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+PlanarDenseFieldIO::read(const OgIGroup &lg, const std::string &/*filename*/, 
+                         const std::string &/*layerPath*/, 
+                         OgDataType typeEnum)
+{
+  Box3i extents, dataW;
+
+  if (!lg.isValid()) {
+    throw MissingGroupException("Invalid group in PlanarDenseFieldIO::read()");
+  }
+
+  // Check version ---
+
+  OgIAttribute<int> versionAttr = lg.findAttribute<int>(k_versionAttrName);
+  if (!versionAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_versionAttrName);
+  }
+  if (versionAttr.value() != k_versionNumber) {
+    throw UnsupportedVersionException("PlanarDenseField version not "
+                                      "supported: " + 
+                                      lexical_cast<std::string>
+                                      (versionAttr.value()));
+  }
+
+  // Get extents and data window ---
+
+  OgIAttribute<veci32_t> extMinAttr = 
+    lg.findAttribute<veci32_t>(k_extentsMinStr);
+  OgIAttribute<veci32_t> extMaxAttr = 
+    lg.findAttribute<veci32_t>(k_extentsMaxStr);
+  OgIAttribute<veci32_t> dwMinAttr = 
+    lg.findAttribute<veci32_t>(k_dataWindowMinStr);
+  OgIAttribute<veci32_t> dwMaxAttr = 
+    lg.findAttribute<veci32_t>(k_dataWindowMaxStr);
+  if (!extMinAttr.isValid() || !extMaxAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsMinStr + "/" + k_extentsMaxStr);
+  }
+  if (!dwMinAttr.isValid() || !dwMaxAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowMinStr + "/" + 
+                                    k_dataWindowMaxStr);
+  }
+
+  extents.min = extMinAttr.value();
+  extents.max = extMaxAttr.value();
+  dataW.min   = dwMinAttr.value();
+  dataW.max   = dwMaxAttr.value();
+
+  // Read the data ---
+
+  OgIAttribute<int> chunkSlicesAttr = lg.findAttribute<int>(k_chunkSlicesStr);
+  const int chunkSlices = chunkSlicesAttr.isValid() ? 
+    std::max(chunkSlicesAttr.value(), 1) : 0;
+
+  const OgDataType typeOnDisk = chunkSlices > 0 ? 
+    lg.compressedDatasetType(k_planeStrs[0]) : 
+    lg.datasetType(k_planeStrs[0]);
+
+  FieldBase::Ptr result;
+
+  if (componentType(typeEnum) == typeOnDisk) {
+    if (typeEnum == F3DVec16) {
+      result = readData<vec16_t>(lg, extents, dataW, chunkSlices);
+    } else if (typeEnum == F3DVec32) {
+      result = readData<vec32_t>(lg, extents, dataW, chunkSlices);
+    } else if (typeEnum == F3DVec64) {
+      result = readData<vec64_t>(lg, extents, dataW, chunkSlices);
+    } 
+  }
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+bool
+PlanarDenseFieldIO::write(hid_t layerGroup, FieldBase::Ptr field)
+{
+  if (layerGroup == -1) {
+    throw BadHdf5IdException("Bad layer group in PlanarDenseFieldIO::write");
+  }
+
+  // Add version attribute
+  if (!writeAttribute(layerGroup, k_versionAttrName, 1, k_versionNumber)) {
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_versionAttrName);
+  }
+
+  PlanarDenseField<V3h>::Ptr vecHalfField = 
+    field_dynamic_cast<PlanarDenseField<V3h> >(field);
+  PlanarDenseField<V3f>::Ptr vecFloatField = 
+    field_dynamic_cast<PlanarDenseField<V3f> >(field);
+  PlanarDenseField<V3d>::Ptr vecDoubleField = 
+    field_dynamic_cast<PlanarDenseField<V3d> >(field);
+
+  bool success = true;
+  if (vecFloatField) {
+    success = writeInternal<V3f>(layerGroup, vecFloatField);
+  } else if (vecHalfField) {
+    success = writeInternal<V3h>(layerGroup, vecHalfField);
+  } else if (vecDoubleField) {
+    success = writeInternal<V3d>(layerGroup, vecDoubleField);
+  } else {
+    throw WriteLayerException("PlanarDenseFieldIO does not support the given "
+                              "PlanarDenseField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+bool
+PlanarDenseFieldIO::write(OgOGroup &layerGroup, FieldBase::Ptr field)
+{
+  PlanarDenseField<V3h>::Ptr vecHalfField = 
+    field_dynamic_cast<PlanarDenseField<V3h> >(field);
+  PlanarDenseField<V3f>::Ptr vecFloatField = 
+    field_dynamic_cast<PlanarDenseField<V3f> >(field);
+  PlanarDenseField<V3d>::Ptr vecDoubleField = 
+    field_dynamic_cast<PlanarDenseField<V3d> >(field);
+
+  bool success = true;
+  if (vecFloatField) {
+    success = writeInternal<V3f>(layerGroup, vecFloatField);
+  } else if (vecHalfField) {
+    success = writeInternal<V3h>(layerGroup, vecHalfField);
+  } else if (vecDoubleField) {
+    success = writeInternal<V3d>(layerGroup, vecDoubleField);
+  } else {
+    throw WriteLayerException("PlanarDenseFieldIO does not support the given "
+                              "PlanarDenseField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+// Templated methods
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool PlanarDenseFieldIO::writeInternal
+(hid_t layerGroup, typename PlanarDenseField<Data_T>::Ptr field)
+{
+  typedef typename PlanarDenseField<Data_T>::real_t real_t;
+
+  const Box3i ext(field->extents()), dw(field->dataWindow());
+
+  // Add extents and data window attributes ---
+
+  int extents[6] = 
+    { ext.min.x, ext.min.y, ext.min.z, ext.max.x, ext.max.y, ext.max.z };
+  if (!writeAttribute(layerGroup, k_extentsStr, 6, extents[0])) {
+    throw WriteAttributeException("Couldn't write attribute " + k_extentsStr);
+  }
+
+  int dataWindow[6] = 
+    { dw.min.x, dw.min.y, dw.min.z, dw.max.x, dw.max.y, dw.max.z };
+  if (!writeAttribute(layerGroup, k_dataWindowStr, 6, dataWindow[0])) {
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_dataWindowStr);
+  }
+
+  // Add components and bits per component attributes ---
+
+  const int components = FieldTraits<Data_T>::dataDims();
+  if (!writeAttribute(layerGroup, k_componentsStr, 1, components)) {
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_componentsStr);
+  }
+
+  const int bits = DataTypeTraits<Data_T>::h5bits();
+  if (!writeAttribute(layerGroup, k_bitsPerComponentStr, 1, bits)) {
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_bitsPerComponentStr);
+  }
+
+  // Add one data set per component ---
+
+  const V3i    res       = dw.size() + V3i(1);
+  const size_t numValues = static_cast<size_t>(res.x) * res.y * res.z;
+  for (int c = 0; c < 3; ++c) {
+    writePlane<real_t>(layerGroup, k_planeStrs[c], 
+                       field->componentRowPtr(c, dw.min.y, dw.min.z), 
+                       numValues);
+  }
+
+  return true; 
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool PlanarDenseFieldIO::writeInternal
+(OgOGroup &layerGroup, typename PlanarDenseField<Data_T>::Ptr field)
+{
+  typedef typename PlanarDenseField<Data_T>::real_t real_t;
+
+  const Box3i ext(field->extents()), dw(field->dataWindow());
+  const V3i   res         = dw.size() + V3i(1);
+  const int   chunkSlices = DenseFieldIO::writeChunkSlices(res);
+
+  // Add attributes ---
+
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, k_versionNumber);
+  OgOAttribute<veci32_t> extMinAttr(layerGroup, k_extentsMinStr, ext.min);
+  OgOAttribute<veci32_t> extMaxAttr(layerGroup, k_extentsMaxStr, ext.max);
+  OgOAttribute<veci32_t> dwMinAttr(layerGroup, k_dataWindowMinStr, dw.min);
+  OgOAttribute<veci32_t> dwMaxAttr(layerGroup, k_dataWindowMaxStr, dw.max);
+  OgOAttribute<int> componentsAttr(layerGroup, k_componentsStr, 
+                                   FieldTraits<Data_T>::dataDims());
+  OgOAttribute<int> bitsAttr(layerGroup, k_bitsPerComponentStr, 
+                             DataTypeTraits<Data_T>::h5bits());
+  if (chunkSlices > 0) {
+    OgOAttribute<uint8_t> codecAttr(layerGroup, k_codecStr, sparseCodec());
+    OgOAttribute<int> chunkSlicesAttr(layerGroup, k_chunkSlicesStr, 
+                                      chunkSlices);
+  }
+
+  // Add one dataset per component. Compressed planes get their slabs 
+  // compressed in parallel ---
+
+  const size_t numValues = static_cast<size_t>(res.x) * res.y * res.z;
+  for (int c = 0; c < 3; ++c) {
+    const real_t *plane = field->componentRowPtr(c, dw.min.y, dw.min.z);
+    if (chunkSlices > 0) {
+      if (!DenseFieldIO::writeChunks<real_t>(layerGroup, k_planeStrs[c], 
+                                             plane, res, chunkSlices)) {
+        return false;
+      }
+    } else {
+      OgODataset<real_t> data(layerGroup, k_planeStrs[c]);
+      data.addData(numValues, plane);
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename PlanarDenseField<Data_T>::Ptr 
+PlanarDenseFieldIO::readData(hid_t layerGroup, const Box3i &extents, 
+                             const Box3i &dataW)
+{
+  typedef typename PlanarDenseField<Data_T>::real_t real_t;
+
+  typename PlanarDenseField<Data_T>::Ptr field(new PlanarDenseField<Data_T>);
+  field->setSize(extents, dataW);
+
+  for (int c = 0; c < 3; ++c) {
+    readPlane<real_t>(layerGroup, k_planeStrs[c], 
+                      field->componentRowPtr(c, dataW.min.y, dataW.min.z));
+  }
+
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename PlanarDenseField<Data_T>::Ptr 
+PlanarDenseFieldIO::readData(const OgIGroup &layerGroup, const Box3i &extents,
+                             const Box3i &dataW, const int chunkSlices)
+{
+  typedef typename PlanarDenseField<Data_T>::real_t real_t;
+
+  typename PlanarDenseField<Data_T>::Ptr field(new PlanarDenseField<Data_T>);
+  field->setSize(extents, dataW);
+
+  SparseCodec codec = SparseCodecZlib;
+  if (chunkSlices > 0) {
+    OgIAttribute<uint8_t> codecAttr = 
+      layerGroup.findAttribute<uint8_t>(k_codecStr);
+    if (!codecAttr.isValid() || !BlockCodec::isValid(codecAttr.value())) {
+      throw ReadDataException("PlanarDenseFieldIO::readData() found an "
+                              "unknown codec.");
+    }
+    codec = static_cast<SparseCodec>(codecAttr.value());
+  }
+
+  const V3i   res = dataW.size() + V3i(1);
+  const Box3i localWindow(V3i(0), res - V3i(1));
+
+  for (int c = 0; c < 3; ++c) {
+    real_t *plane = field->componentRowPtr(c, dataW.min.y, dataW.min.z);
+    if (chunkSlices > 0) {
+      if (!DenseFieldIO::readChunks<real_t>(layerGroup, k_planeStrs[c], codec,
+                                            res, chunkSlices, localWindow, 
+                                            plane)) {
+        throw ReadDataException("PlanarDenseFieldIO::readData() couldn't "
+                                "decompress " + k_planeStrs[c]);
+      }
+    } else {
+      OgIDataset<real_t> data = 
+        layerGroup.findDataset<real_t>(k_planeStrs[c]);
+      if (!data.isValid() || !data.getData(0, plane, OGAWA_THREAD)) {
+        throw ReadDataException("PlanarDenseFieldIO::readData() couldn't "
+                                "read " + k_planeStrs[c]);
+      }
+    }
+  }
+
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -57,6 +57,9 @@
 #include <errno.h>
 #include <string.h>
 
+#include <fstream>
+#include <sstream>
+
 #include <boost/tokenizer.hpp>
 
 #include "ClassFactory.h"
@@ -83,6 +86,15 @@ namespace {
     }
   }
 
+  //! Name of the manifest file that can accompany a plugin directory
+  const std::string k_manifestName("field3d_plugins.txt");
+
+  //! Returns the class name without its template arguments
+  std::string untemplatedName(const std::string &className)
+  {
+    return className.substr(0, className.find('<'));
+  }
+
 }
 
 //----------------------------------------------------------------------------//
@@ -97,6 +109,8 @@ typedef int (*RegistrationFunc)(ClassFactory &);
 //----------------------------------------------------------------------------//
 
 std::vector<std::string> PluginLoader::ms_pluginsLoaded;
+std::map<std::string, std::string> PluginLoader::ms_classPlugins;
+boost::mutex PluginLoader::ms_mutex;
 
 //----------------------------------------------------------------------------//
 // PluginLoader implementations
@@ -264,9 +278,16 @@ void PluginLoader::loadPlugins()
   
   tokenize(path, delimiters, paths);
 
+  boost::mutex::scoped_lock lock(ms_mutex);
+
   // For each path
   for (unsigned int i = 0; i < paths.size(); i++) {
 
+    // Directories with a manifest are loaded on demand
+    if (readManifest(paths[i])) {
+      continue;
+    }
+
     // List the contents of the directory
     std::vector<std::string> sos;
     if (!getDirSos(sos,paths[i])) {
@@ -275,50 +296,113 @@ void PluginLoader::loadPlugins()
     
     // Open each file
     for (unsigned int j = 0; j < sos.size(); j++) {
-      std::string sofile = sos[j];
-      
-      //First check to see if a plugin of the same name has already been loaded
-      const std::string pathDelimiter = "/";
-      std::vector<std::string> pluginName;
-      tokenize(sofile, pathDelimiter, pluginName);
-
-      bool pluginAlreadyLoaded = false;
-
-      for (unsigned int i = 0; i < ms_pluginsLoaded.size(); i++) {
-        if (pluginName.size() > 0) {
-          if (ms_pluginsLoaded[i] == pluginName[pluginName.size() - 1]) {
-            //This plugin has been loaded so look for another one
-            //std::cout << ms_pluginsLoaded[i] << " is already loaded\n";
-            pluginAlreadyLoaded = true;
-            break;
-          } 
-        }
+      loadPlugin(sos[j]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool PluginLoader::loadPluginForClass(const std::string &className)
+{
+  boost::mutex::scoped_lock lock(ms_mutex);
+
+  std::map<std::string, std::string>::iterator i = 
+    ms_classPlugins.find(className);
+  if (i == ms_classPlugins.end()) {
+    i = ms_classPlugins.find(untemplatedName(className));
+  }
+  if (i == ms_classPlugins.end()) {
+    return false;
+  }
+
+  // Each plugin is only tried once, whether or not it loads
+  const std::string sofile = i->second;
+  for (i = ms_classPlugins.begin(); i != ms_classPlugins.end(); ) {
+    if (i->second == sofile) {
+      ms_classPlugins.erase(i++);
+    } else {
+      ++i;
+    }
+  }
+
+  return loadPlugin(sofile);
+}
+
+//----------------------------------------------------------------------------//
+
+bool PluginLoader::readManifest(const std::string &dir)
+{
+  std::ifstream in((dir + "/" + k_manifestName).c_str());
+  if (!in) {
+    return false;
+  }
+
+  // Each line holds a plugin file name, relative to the directory, followed
+  // by the classes it registers. Lines starting with # are comments.
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream tokens(line);
+    std::string sofile, className;
+    if (!(tokens >> sofile) || sofile[0] == '#') {
+      continue;
+    }
+    while (tokens >> className) {
+      // Earlier directories take precedence, like for eager loading
+      if (ms_classPlugins.find(className) == ms_classPlugins.end()) {
+        ms_classPlugins[className] = dir + "/" + sofile;
       }
+    }
+  }
+
+  char *debugEnvVar = getenv("FIELD3D_DEBUG");
+  if (debugEnvVar) {
+    Msg::print("Read Field3D plugin manifest in " + dir);
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+bool PluginLoader::loadPlugin(const std::string &sofile)
+{
+  //First check to see if a plugin of the same name has already been loaded
+  const std::string pathDelimiter = "/";
+  std::vector<std::string> pluginName;
+  tokenize(sofile, pathDelimiter, pluginName);
+
+  for (unsigned int i = 0; i < ms_pluginsLoaded.size(); i++) {
+    if (pluginName.size() > 0) {
+      if (ms_pluginsLoaded[i] == pluginName[pluginName.size() - 1]) {
+        //This plugin has been loaded so look for another one
+        return false;
+      } 
+    }
+  }
     
-      if (pluginAlreadyLoaded) {
-        continue;
-      }
-      
-      if (pluginName.size() > 0) {
-        std::string lastName = pluginName[pluginName.size() -1];
-        ms_pluginsLoaded.push_back(lastName);
-      }
+  if (pluginName.size() > 0) {
+    std::string lastName = pluginName[pluginName.size() -1];
+    ms_pluginsLoaded.push_back(lastName);
+  }
       
-      RegistrationFunc  fptr;
-
-      fptr = findRegistrationFunc(sofile);
-      if (fptr) {
-        // Call the registration function
-        int res = (*fptr)(ClassFactory::singleton());
-        if (!res) {
-          Msg::print(Msg::SevWarning,
-                    "failed to init Field3D plugin " + sofile);
-        } else {
-          Msg::print("Initialized Field3D Plugin " + sofile);
-        }
-      }
-    }
+  RegistrationFunc  fptr;
+
+  fptr = findRegistrationFunc(sofile);
+  if (!fptr) {
+    return false;
   }
+
+  // Call the registration function
+  int res = (*fptr)(ClassFactory::singleton());
+  if (!res) {
+    Msg::print(Msg::SevWarning,
+               "failed to init Field3D plugin " + sofile);
+    return false;
+  } 
+
+  Msg::print("Initialized Field3D Plugin " + sofile);
+  return true;
 }
 
 //----------------------------------------------------------------------------//
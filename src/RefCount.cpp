@@ -0,0 +1,85 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file RefCount.cpp
+  Contains implementations of RefBase's out-of-line members.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "RefCount.h"
+
+#include <boost/thread/mutex.hpp>
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Static data
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//! Guards the lazy creation of RefBase::m_sharedPtr. Weak pointers are only
+//! requested by the FieldCache, so one mutex for all objects is enough.
+boost::mutex g_weakPtrMutex;
+
+}
+
+//----------------------------------------------------------------------------//
+// RefBase implementations
+//----------------------------------------------------------------------------//
+
+RefBase::WeakPtr RefBase::weakPtr() const
+{
+  boost::mutex::scoped_lock lock(g_weakPtrMutex);
+  if (!m_sharedPtr) {
+    // The null_deleter ensures we never try to actually delete this
+    // object using the shared pointer.
+    m_sharedPtr = 
+      new boost::shared_ptr<RefBase>(const_cast<RefBase*>(this), 
+                                     null_deleter());
+  }
+  return *m_sharedPtr;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
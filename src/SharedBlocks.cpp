@@ -0,0 +1,436 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2014 Sony Pictures Imageworks Inc
+ *                    Pixar Animation Studios
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+//----------------------------------------------------------------------------//
+
+/*! \file SharedBlocks.cpp
+  \brief Contains implementations of the functions for sharing loaded sparse
+  blocks between processes.
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "SharedBlocks.h"
+
+// System includes
+#include <algorithm>
+#include <errno.h>
+#include <map>
+#include <new>
+#include <string.h>
+#ifndef WIN32
+#include <sys/file.h>
+#endif
+
+// Library includes
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+// Project includes
+#include "Log.h"
+#include "Types.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  namespace bip = boost::interprocess;
+
+  //--------------------------------------------------------------------------//
+
+  //! Identifies a Field3D block segment
+  const uint32_t k_magic = 0xf3db10c5;
+  //! Size of the segment header. A whole page keeps the data page-aligned.
+  const size_t k_headerSize = 4096;
+  //! Longest key that fits in the header
+  const size_t k_maxKeyLength = 3072;
+  //! Seconds to wait for another process to publish a block
+  const int k_publishTimeout = 60;
+  //! Longest pause between checks on a block another process is loading
+  const int k_maxPollMilliseconds = 50;
+
+  //--------------------------------------------------------------------------//
+
+  enum LockMode {
+    SharedLock = 0,
+    ExclusiveLock
+  };
+
+  //--------------------------------------------------------------------------//
+
+  enum SegmentState {
+    SegmentLoading = 0,
+    SegmentPublished,
+    SegmentAbandoned
+  };
+
+  //--------------------------------------------------------------------------//
+
+  //! Lives at the start of each segment. Only written by the owner, while
+  //! it holds the exclusive lock.
+  struct Header
+  {
+    uint32_t magic;
+    int32_t  state;
+    uint64_t numBytes;
+    uint32_t keyLength;
+    char     key[k_maxKeyLength];
+  };
+
+  BOOST_STATIC_ASSERT(sizeof(Header) <= k_headerSize);
+
+  //--------------------------------------------------------------------------//
+
+  //! This process' view of a segment. The open segment holds the lock 
+  //! that marks this process as a user of it.
+  struct Attachment
+  {
+    std::string                name;
+    bip::shared_memory_object *shm;
+    bip::mapped_region        *region;
+  };
+
+  typedef std::map<void*, Attachment> AttachmentMap;
+
+  //! Segments this process is attached to, keyed by data pointer
+  AttachmentMap g_attachments;
+  //! Guards g_attachments
+  boost::mutex  g_attachmentsMutex;
+
+  //--------------------------------------------------------------------------//
+
+  //! Hashes the key into a name short enough for all platforms' shared 
+  //! memory namespaces. Collisions are caught by comparing the full key.
+  std::string segmentName(const std::string &key)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); ++i) {
+      hash ^= static_cast<unsigned char>(key[i]);
+      hash *= 1099511628211ULL;
+    }
+    static const char *digits = "0123456789abcdef";
+    std::string name("f3d_");
+    for (int shift = 60; shift >= 0; shift -= 4) {
+      name += digits[(hash >> shift) & 0xf];
+    }
+    return name;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  Header* header(void *data)
+  {
+    return reinterpret_cast<Header*>(static_cast<uint8_t*>(data) - 
+                                     k_headerSize);
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Locks the segment with flock(), converting any lock already held. The
+  //! kernel drops the lock when the segment is closed or the process dies,
+  //! so a crash never leaves other processes waiting.
+  //! \returns False if the lock is held elsewhere and wait is false, or if
+  //! the platform can't lock shared memory.
+  bool lockSegment(const bip::shared_memory_object &shm, const LockMode mode,
+                   const bool wait)
+  {
+#ifdef WIN32
+    return false;
+#else
+    const int fd = shm.get_mapping_handle().handle;
+    const int op = (mode == SharedLock ? LOCK_SH : LOCK_EX) | 
+      (wait ? 0 : LOCK_NB);
+    while (flock(fd, op) != 0) {
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+    return true;
+#endif
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Takes a shared lock on the segment, waiting while its owner holds the
+  //! exclusive lock to fill it in.
+  //! \returns False if the owner didn't finish in time
+  bool waitForSharedLock(const bip::shared_memory_object &shm)
+  {
+    using namespace boost::posix_time;
+
+    const ptime deadline = 
+      microsec_clock::universal_time() + seconds(k_publishTimeout);
+    int pause = 1;
+    while (!lockSegment(shm, SharedLock, false)) {
+      if (errno != EWOULDBLOCK || 
+          microsec_clock::universal_time() > deadline) {
+        return false;
+      }
+      boost::this_thread::sleep(milliseconds(pause));
+      pause = std::min(pause * 2, k_maxPollMilliseconds);
+    }
+    return true;
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Removes the segment's name if no other process is using it. 
+  //! \note Drops this process' shared lock either way.
+  void removeIfUnused(const std::string &name, 
+                      const bip::shared_memory_object &shm)
+  {
+    if (lockSegment(shm, ExclusiveLock, false)) {
+      bip::shared_memory_object::remove(name.c_str());
+    }
+  }
+
+  //--------------------------------------------------------------------------//
+
+  //! Creates the segment and maps it for filling in. 
+  //! \returns NULL if it already exists
+  bip::mapped_region* create(const std::string &name, const std::string &key,
+                             const size_t numBytes, 
+                             bip::shared_memory_object *&shm)
+  {
+    try {
+      shm = new bip::shared_memory_object(bip::create_only, name.c_str(), 
+                                          bip::read_write);
+    }
+    catch (bip::interprocess_exception &e) {
+      if (e.get_error_code() != bip::already_exists_error) {
+        throw;
+      }
+      return NULL;
+    }
+
+    bip::mapped_region *region = NULL;
+    try {
+      // Held until the block is published, which keeps others out
+      if (!lockSegment(*shm, ExclusiveLock, true)) {
+        throw bip::interprocess_exception("Couldn't lock segment");
+      }
+      shm->truncate(k_headerSize + numBytes);
+      region = new bip::mapped_region(*shm, bip::read_write);
+    }
+    catch (...) {
+      bip::shared_memory_object::remove(name.c_str());
+      delete shm;
+      shm = NULL;
+      throw;
+    }
+
+    Header *h = new (region->get_address()) Header;
+    h->magic = k_magic;
+    h->state = SegmentLoading;
+    h->numBytes = numBytes;
+    h->keyLength = key.size();
+    memcpy(h->key, key.c_str(), key.size());
+
+    return region;
+  }
+
+}
+
+//----------------------------------------------------------------------------//
+// SharedBlocks implementations
+//----------------------------------------------------------------------------//
+
+namespace SharedBlocks {
+
+//----------------------------------------------------------------------------//
+
+void* acquire(const std::string &key, const size_t numBytes, bool &isOwner)
+{
+#ifdef WIN32
+  // Sharing relies on flock() to survive crashed processes
+  return NULL;
+#endif
+
+  if (key.size() > k_maxKeyLength) {
+    return NULL;
+  }
+
+  const std::string name = segmentName(key);
+  bip::shared_memory_object *shm = NULL;
+  bip::mapped_region *region = NULL;
+
+  try {
+    // A second pass follows reclaiming a segment left by a dead owner
+    for (int pass = 0; pass < 2 && !region; ++pass) {
+
+      region = create(name, key, numBytes, shm);
+      if (region) {
+        isOwner = true;
+        break;
+      }
+
+      // Attach to the existing segment. Only the owner may write to it.
+      shm = new bip::shared_memory_object(bip::open_only, name.c_str(), 
+                                          bip::read_only);
+      bip::offset_t size = 0;
+      if (!waitForSharedLock(*shm) || !shm->get_size(size) || 
+          size < static_cast<bip::offset_t>(k_headerSize + numBytes)) {
+        // Still being filled in, or just created and not yet sized
+        delete shm;
+        return NULL;
+      }
+
+      region = new bip::mapped_region(*shm, bip::read_only);
+      const Header *h = static_cast<const Header*>(region->get_address());
+      if (h->magic != k_magic || h->numBytes != numBytes ||
+          h->keyLength != key.size() || 
+          memcmp(h->key, key.c_str(), key.size()) != 0) {
+        // Another block hashed to the same name
+        delete region;
+        delete shm;
+        return NULL;
+      }
+
+      if (h->state != SegmentPublished) {
+        // The owner gave up or died without publishing, since we couldn't 
+        // have locked it otherwise. Start over with a fresh segment.
+        delete region;
+        region = NULL;
+        removeIfUnused(name, *shm);
+        delete shm;
+        shm = NULL;
+      } else {
+        isOwner = false;
+      }
+    }
+  }
+  catch (bip::interprocess_exception &e) {
+    Msg::print(Msg::SevWarning, "In SharedBlocks::acquire(): Couldn't "
+               "share block " + name + ": " + e.what());
+    delete region;
+    delete shm;
+    return NULL;
+  }
+
+  if (!region) {
+    delete shm;
+    return NULL;
+  }
+
+  void *data = static_cast<uint8_t*>(region->get_address()) + k_headerSize;
+
+  Attachment attachment;
+  attachment.name = name;
+  attachment.shm = shm;
+  attachment.region = region;
+
+  boost::mutex::scoped_lock lock(g_attachmentsMutex);
+  g_attachments[data] = attachment;
+
+  return data;
+}
+
+//----------------------------------------------------------------------------//
+
+void publish(void *data)
+{
+  const bip::shared_memory_object *shm = NULL;
+  {
+    boost::mutex::scoped_lock lock(g_attachmentsMutex);
+    AttachmentMap::iterator i = g_attachments.find(data);
+    if (i == g_attachments.end()) {
+      return;
+    }
+    shm = i->second.shm;
+  }
+  header(data)->state = SegmentPublished;
+  // Downgrading lets waiting processes in while keeping this one a user
+  lockSegment(*shm, SharedLock, true);
+}
+
+//----------------------------------------------------------------------------//
+
+void abandon(void *data)
+{
+  header(data)->state = SegmentAbandoned;
+}
+
+//----------------------------------------------------------------------------//
+
+bool release(void *data)
+{
+  Attachment attachment;
+
+  {
+    boost::mutex::scoped_lock lock(g_attachmentsMutex);
+    AttachmentMap::iterator i = g_attachments.find(data);
+    if (i == g_attachments.end()) {
+      return false;
+    }
+    attachment = i->second;
+    g_attachments.erase(i);
+  }
+
+  try {
+    // Users that crashed no longer hold their locks, so the last one alive
+    // cleans up after them
+    removeIfUnused(attachment.name, *attachment.shm);
+  }
+  catch (bip::interprocess_exception &e) {
+    Msg::print(Msg::SevWarning, "In SharedBlocks::release(): " + 
+               std::string(e.what()));
+  }
+
+  delete attachment.region;
+  delete attachment.shm;
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+} // namespace SharedBlocks
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
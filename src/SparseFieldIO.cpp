@@ -41,13 +41,29 @@
 
 //----------------------------------------------------------------------------//
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+
 #include <boost/intrusive_ptr.hpp>
 
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
+#include "BlockChecksum.h"
+#include "BlockCodec.h"
+#include "FieldReduce.h"
 #include "InitIO.h"
 #include "SparseFieldIO.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include "Types.h"
 
 //----------------------------------------------------------------------------//
@@ -91,8 +107,52 @@ struct ReadThreadingState
       numOccupiedBlocks(i_numOccupiedBlocks),
       isCompressed(i_isCompressed), 
       blockIdxToDatasetIdx(i_blockIdxToDatasetIdx), 
-      nextBlockToRead(0)
-  { }
+      blocksPerClaim(1),
+      nextBlockToRead(0),
+      numFailedBlocks(0)
+  { 
+    // Only the allocated blocks need reading, and each block on disk only
+    // once. Blocks that share their data with an earlier one are copied
+    std::vector<size_t> firstBlock(numOccupiedBlocks, numBlocks);
+    for (size_t i = 0; i < numBlocks; ++i) {
+      if (blocks[i].isAllocated) {
+        size_t &first = firstBlock[blockIdxToDatasetIdx[i]];
+        if (first == numBlocks) {
+          first = i;
+        } else {
+          duplicates.push_back(std::make_pair(i, first));
+        }
+      }
+    }
+    // The datasets are laid out in index order, so reading in dataset order
+    // reads the file front to back
+    for (size_t i = 0; i < numOccupiedBlocks; ++i) {
+      if (firstBlock[i] != numBlocks) {
+        readOrder.push_back(firstBlock[i]);
+      }
+    }
+  }
+  //! Sets how many consecutive entries of readOrder a thread claims at a
+  //! time. Runs of neighboring blocks let the stream coalesce the reads,
+  //! while keeping enough runs around to balance the threads
+  void setNumThreads(const size_t numThreads)
+  {
+    const size_t maxBlocksPerClaim = 32;
+    const size_t runs = readOrder.size() / (8 * std::max(numThreads, 
+                                                         size_t(1)));
+    blocksPerClaim = std::max(size_t(1), std::min(maxBlocksPerClaim, runs));
+  }
+  //! Allocates and copies the data of the duplicate blocks once the reads
+  //! are done
+  void copyDuplicates()
+  {
+    for (size_t i = 0; i < duplicates.size(); ++i) {
+      Sparse::SparseBlock<Data_T> &dst = blocks[duplicates[i].first];
+      const Data_T *src = blocks[duplicates[i].second].data;
+      dst.alloc(numVoxels);
+      std::copy(src, src + numVoxels, dst.data);
+    }
+  }
   // Data members
   const OgIGroup &location;
   Sparse::SparseBlock<Data_T> *blocks;
@@ -101,9 +161,18 @@ struct ReadThreadingState
   const size_t numOccupiedBlocks;
   const bool   isCompressed;
   const std::vector<size_t> &blockIdxToDatasetIdx;
-  size_t nextBlockToRead;
-  // Mutexes
-  boost::mutex readMutex;
+  //! Indices of the allocated blocks that are read from disk
+  std::vector<size_t> readOrder;
+  //! Allocated blocks whose data is that of an earlier block, paired with
+  //! that block
+  std::vector<std::pair<size_t, size_t> > duplicates;
+  //! Number of entries of readOrder claimed at a time
+  size_t blocksPerClaim;
+  //! Next entry of readOrder to read. Claimed without locking
+  boost::atomic<size_t> nextBlockToRead;
+  //! Number of blocks that couldn't be decompressed or failed their
+  //! checksum
+  boost::atomic<size_t> numFailedBlocks;
 };
 
 //----------------------------------------------------------------------------//
@@ -115,10 +184,6 @@ public:
   ReadBlockOp(ReadThreadingState<Data_T> &state, const size_t threadId)
     : m_state(state)
   { 
-    // Set up the compression cache
-    const uLong srcLen      = m_state.numVoxels * sizeof(Data_T);
-    const uLong cmpLenBound = compressBound(srcLen);
-    m_cache.resize(cmpLenBound);
     // Initialize the reader
     m_readerPtr.reset(
       new OgSparseDataReader<Data_T>(m_state.location, m_state.numVoxels, 
@@ -130,175 +195,736 @@ public:
   }
   void operator() ()
   {
-    // Get next block to read
-    size_t blockIdx;
-    {
-      boost::mutex::scoped_lock lock(m_state.readMutex);
-      blockIdx = m_state.nextBlockToRead;
-      m_state.nextBlockToRead++;
-    }
-    // Loop over blocks until we run out
-    while (blockIdx < m_state.numBlocks) {
-      if (m_state.blocks[blockIdx].isAllocated) {
+    const size_t numBlocks = m_state.readOrder.size();
+    const size_t claim     = m_state.blocksPerClaim;
+    // Loop over runs of blocks until we run out. Each block is decompressed
+    // straight into its final storage
+    for (size_t first = m_state.nextBlockToRead.fetch_add(claim); 
+         first < numBlocks; 
+         first = m_state.nextBlockToRead.fetch_add(claim)) {
+      const size_t last = std::min(first + claim, numBlocks);
+      for (size_t order = first; order < last; ++order) {
+        const size_t blockIdx   = m_state.readOrder[order];
         const size_t datasetIdx = m_state.blockIdxToDatasetIdx[blockIdx];
-        m_reader->readBlock(datasetIdx, m_state.blocks[blockIdx].data);
-      }
-      // Get next block idx
-      {
-        boost::mutex::scoped_lock lock(m_state.readMutex);
-        blockIdx = m_state.nextBlockToRead;
-        m_state.nextBlockToRead++;
+        Trace::ScopedEvent event("readBlock", blockIdx);
+        // The block is allocated uninitialized, so its pages are first 
+        // touched when the thread that reads it writes the voxels. The OS 
+        // then places freshly mapped pages on that thread's NUMA node.
+        // Memory reused from the SparseBlockPool stays wherever it was 
+        // first touched.
+        Sparse::SparseBlock<Data_T> &block = m_state.blocks[blockIdx];
+        block.alloc(m_state.numVoxels);
+        if (!m_reader->readBlock(datasetIdx, block.data)) {
+          m_state.numFailedBlocks++;
+        }
       }
     }
   }
 private:
   // Data members ---
   ReadThreadingState<Data_T> &m_state;
-  std::vector<uint8_t> m_cache;
   boost::shared_ptr<OgSparseDataReader<Data_T> > m_readerPtr;
   OgSparseDataReader<Data_T> *m_reader;
 };
 
 //----------------------------------------------------------------------------//
 
+//! Runs a ReadBlockOp on each thread that works on the read, with the 
+//! thread's index as its thread id
 template <typename Data_T>
-struct ThreadingState
+class ReadBlockTask : public ThreadPool::Task
 {
-  ThreadingState(OgOCDataset<Data_T> &i_data, 
-                 Sparse::SparseBlock<Data_T> *i_blocks, 
-                 const size_t i_numVoxels, 
-                 const size_t i_numBlocks,
-                 const std::vector<uint8_t> &i_isAllocated)
-    : data(i_data),
-      blocks(i_blocks),
-      numVoxels(i_numVoxels), 
-      numBlocks(i_numBlocks),
-      isAllocated(i_isAllocated), 
-      nextBlockToCompress(0),
-      nextBlockToWrite(0)
+public:
+  ReadBlockTask(ReadThreadingState<Data_T> &state)
+    : m_state(state)
+  { }
+  virtual void run(const size_t threadIdx)
+  { ReadBlockOp<Data_T>(m_state, threadIdx)(); }
+private:
+  ReadThreadingState<Data_T> &m_state;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Compresses single blocks with a given codec and tiling, optionally
+//! quantizing them first
+template <typename Data_T>
+class BlockCompressor
+{
+public:
+  BlockCompressor(const int blockOrder, const int tileOrder, 
+                  const SparseCodec codec, const int quantizeBits)
+    : m_numVoxels(static_cast<size_t>(1) << (3 * blockOrder)),
+      m_blockOrder(blockOrder), m_tileOrder(tileOrder), m_codec(codec),
+      m_quantizeBits(quantizeBits), m_tileVoxels(0)
   { 
-    // Find first in-use block
-    for (size_t i = 0; i < numBlocks; ++i) {
-      if (blocks[i].isAllocated) {
-        nextBlockToCompress = i;
-        nextBlockToWrite = i;
-        return;
+    const size_t srcLen = m_numVoxels * sizeof(Data_T);
+    if (m_quantizeBits > 0) {
+      m_quantized.resize(SparseQuantize::payloadBytes<Data_T>(m_numVoxels,
+                                                              m_quantizeBits));
+      // The format byte precedes the compressed payload
+      m_cacheSize = 1 + 
+        BlockCodec::compressBound(m_codec, std::max(srcLen, 
+                                                    m_quantized.size()));
+    } else if (m_tileOrder > 0) {
+      const size_t numTiles = SparseTiles::numTiles(m_blockOrder, m_tileOrder);
+      m_tileVoxels = static_cast<size_t>(1) << (3 * m_tileOrder);
+      m_cacheSize = SparseTiles::tableBytes(m_blockOrder, m_tileOrder) + 
+        numTiles * BlockCodec::compressBound(m_codec, 
+                                             m_tileVoxels * sizeof(Data_T));
+    } else {
+      m_cacheSize = BlockCodec::compressBound(m_codec, srcLen);
+    }
+  }
+  //! Compresses the block into dst, which is resized to fit
+  //! \returns False if compression failed
+  bool compress(Data_T *block, std::vector<uint8_t> &dst)
+  {
+    dst.resize(m_cacheSize);
+    // Block data as bytes
+    const uint8_t *srcData = reinterpret_cast<const uint8_t *>(block);
+    // Length of compressed data is stored here
+    const size_t srcLen = m_numVoxels * sizeof(Data_T);
+    size_t cmpLen       = dst.size();
+    // Perform compression
+    bool status;
+    if (m_quantizeBits > 0) {
+      status = compressQuantized(block, &dst[0], cmpLen);
+    } else if (m_tileOrder > 0) {
+      status = compressTiles(block, &dst[0], cmpLen);
+    } else {
+      status = BlockCodec::compress(m_codec, sizeof(Data_T), srcData, srcLen,
+                                    &dst[0], cmpLen, m_codecCache);
+    }
+    // Error check
+    if (!status) {
+      std::cout << "ERROR: Couldn't compress in SparseFieldIO." << std::endl
+                << "  Codec:  " << m_codec << std::endl
+                << "  srcLen: " << srcLen << std::endl
+                << "  cmpLenBound: " << m_cacheSize << std::endl;
+      return false;
+    }
+    dst.resize(cmpLen);
+    return true;
+  }
+private:
+  //! Compresses each tile of the block separately, preceded by the table
+  //! of tile offsets. See SparseTiles.
+  bool compressTiles(Data_T *block, uint8_t *dst, size_t &cmpLen)
+  {
+    const size_t numTiles   = SparseTiles::numTiles(m_blockOrder, m_tileOrder);
+    const size_t tableBytes = SparseTiles::tableBytes(m_blockOrder, 
+                                                      m_tileOrder);
+    const size_t srcLen     = m_tileVoxels * sizeof(Data_T);
+    uint32_t    *offsets    = reinterpret_cast<uint32_t *>(dst);
+    uint8_t     *tiles      = dst + tableBytes;
+    offsets[0] = 0;
+    for (size_t t = 0; t < numTiles; ++t) {
+      // Tiles are runs of the block's voxels in storage order
+      const uint8_t *src = 
+        reinterpret_cast<const uint8_t *>(block + t * m_tileVoxels);
+      size_t tileLen = m_cacheSize - tableBytes - offsets[t];
+      if (!BlockCodec::compress(m_codec, sizeof(Data_T), src, srcLen, 
+                                tiles + offsets[t], tileLen, 
+                                m_codecCache)) {
+        return false;
       }
+      offsets[t + 1] = offsets[t] + tileLen;
     }
-    // If we get here, there are no active blocks. Set to numBlocks
-    nextBlockToCompress = numBlocks;
-    nextBlockToWrite = numBlocks;
+    cmpLen = tableBytes + offsets[numTiles];
+    return true;
   }
-  // Data members
-  OgOCDataset<Data_T> &data;
-  Sparse::SparseBlock<Data_T> *blocks;
-  const size_t numVoxels;
-  const size_t numBlocks;
-  const std::vector<uint8_t> isAllocated;
-  size_t nextBlockToCompress;
-  size_t nextBlockToWrite;
-  // Mutexes
-  boost::mutex compressMutex;
+  //! Quantizes the block and compresses the codes, preceded by the format
+  //! byte. Blocks that can't be quantized are compressed as they are.
+  //! See SparseQuantize.
+  bool compressQuantized(Data_T *block, uint8_t *dst, size_t &cmpLen)
+  {
+    const bool isQuantized = 
+      SparseQuantize::quantize(block, m_numVoxels, m_quantizeBits, 
+                               &m_quantized[0]);
+    dst[0] = isQuantized ? 
+      SparseQuantize::FormatQuantized : SparseQuantize::FormatRaw;
+    cmpLen -= 1;
+    const bool status = isQuantized ?
+      BlockCodec::compress(m_codec, 1, &m_quantized[0], m_quantized.size(),
+                           dst + 1, cmpLen, m_codecCache) :
+      BlockCodec::compress(m_codec, sizeof(Data_T), 
+                           reinterpret_cast<const uint8_t *>(block), 
+                           m_numVoxels * sizeof(Data_T),
+                           dst + 1, cmpLen, m_codecCache);
+    cmpLen += 1;
+    return status;
+  }
+  // Data members ---
+  const size_t      m_numVoxels;
+  const int         m_blockOrder;
+  //! Tile order, or 0 if blocks are compressed whole
+  const int         m_tileOrder;
+  const SparseCodec m_codec;
+  //! Bits per quantized component, or 0 if blocks are stored losslessly
+  const int         m_quantizeBits;
+  //! Size to reserve for each compressed block
+  size_t m_cacheSize;
+  //! Number of voxels in a tile, or 0 if blocks are compressed whole
+  size_t m_tileVoxels;
+  //! Payload of the block being quantized
+  std::vector<uint8_t> m_quantized;
+  //! Scratch space for the codec
+  std::vector<uint8_t> m_codecCache;
 };
 
 //----------------------------------------------------------------------------//
 
+//! Computes the min, max and mean of the voxels of a block that lie inside
+//! the data window, into summary. Vectors are reduced per component.
 template <typename Data_T>
-class WriteBlockOp
+void summarizeBlock(const Data_T *data, const V3i &validSize, 
+                    const int blockOrder, const Sparse::BlockLayout layout,
+                    Data_T *summary)
+{
+  typedef typename ReduceTraits<Data_T>::SumType SumType;
+
+  Data_T  lo = data[0], hi = data[0];
+  SumType sum(0.0);
+  for (int k = 0; k < validSize.z; ++k) {
+    for (int j = 0; j < validSize.y; ++j) {
+      for (int i = 0; i < validSize.x; ++i) {
+        const Data_T value = 
+          data[Sparse::blockIndex(i, j, k, blockOrder, layout)];
+        lo = Sparse::rangeMin(lo, value);
+        hi = Sparse::rangeMax(hi, value);
+        sum += static_cast<SumType>(value);
+      }
+    }
+  }
+  const double count = 
+    static_cast<double>(validSize.x) * validSize.y * validSize.z;
+  summary[0] = lo;
+  summary[1] = hi;
+  summary[2] = static_cast<Data_T>(sum / count);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Fills in the block summaries of a field as its blocks are written. 
+//! Summaries holds three values per block, indexed like the blocks.
+template <typename Data_T>
+class BlockSummarizer
 {
 public:
-  WriteBlockOp(ThreadingState<Data_T> &state, const size_t threadId)
-    : m_state(state), m_threadId(threadId)
+  BlockSummarizer(const SparseField<Data_T> &field, 
+                  std::vector<Data_T> &summaries)
+    : m_field(field), m_summaries(summaries)
   { 
-    const uLong srcLen      = m_state.numVoxels * sizeof(Data_T);
-    const uLong cmpLenBound = compressBound(srcLen);
-    m_cache.resize(cmpLenBound);
+    const V3i blockRes = field.blockRes();
+    m_summaries.resize(3 * static_cast<size_t>(blockRes.x) * blockRes.y * 
+                       blockRes.z);
   }
-  void operator() ()
+  //! Summarizes the given allocated block. Different blocks may be 
+  //! summarized concurrently.
+  void operator() (const size_t blockIdx) const
   {
-    const int level = 1;
-    // Get next block to compress
-    size_t blockIdx;
-    {
-      boost::mutex::scoped_lock lock(m_state.compressMutex);
-      blockIdx = m_state.nextBlockToCompress;
-      // Step counter to next
-      while (m_state.nextBlockToCompress < m_state.numBlocks) {
-        m_state.nextBlockToCompress++;
-        if (m_state.blocks[m_state.nextBlockToCompress].isAllocated) {
-          break;
-        }
+    const V3i   blockRes = m_field.blockRes();
+    const V3i   blockCoord(blockIdx % blockRes.x, 
+                           (blockIdx / blockRes.x) % blockRes.y,
+                           blockIdx / (blockRes.x * blockRes.y));
+    const int   blockOrder = m_field.blockOrder();
+    const V3i   validSize = 
+      Sparse::validBlockSize(m_field.dataResolution(), blockOrder, 
+                             blockCoord);
+    summarizeBlock(m_field.blockData(blockCoord.x, blockCoord.y, 
+                                     blockCoord.z), 
+                   validSize, blockOrder, m_field.blockLayout(), 
+                   &m_summaries[3 * blockIdx]);
+  }
+  //! Writes the summaries of the blocks written as allocated, in order
+  void write(OgOGroup &layerGroup, const std::vector<uint8_t> &isAllocated,
+             const std::string &name) const
+  {
+    std::vector<Data_T> written;
+    for (size_t i = 0; i < isAllocated.size(); ++i) {
+      if (isAllocated[i]) {
+        written.insert(written.end(), m_summaries.begin() + 3 * i, 
+                       m_summaries.begin() + 3 * i + 3);
       }
     }
+    if (!written.empty()) {
+      OgODataset<Data_T> data(layerGroup, name);
+      data.addData(written.size(), &written[0]);
+    }
+  }
+private:
+  const SparseField<Data_T> &m_field;
+  std::vector<Data_T>       &m_summaries;
+};
+
+//----------------------------------------------------------------------------//
+
+template <typename Data_T>
+struct ThreadingState
+{
+  ThreadingState(Sparse::SparseBlock<Data_T> *i_blocks, 
+                 const std::vector<size_t> &i_writeOrder,
+                 const int i_blockOrder,
+                 const int i_tileOrder,
+                 const SparseCodec i_codec,
+                 const int i_quantizeBits,
+                 const BlockSummarizer<Data_T> *i_summarizer,
+                 std::vector<uint32_t> *i_checksums,
+                 const size_t i_numSlots)
+    : blocks(i_blocks),
+      blockOrder(i_blockOrder),
+      tileOrder(i_tileOrder),
+      codec(i_codec),
+      quantizeBits(i_quantizeBits),
+      writeOrder(i_writeOrder),
+      summarizer(i_summarizer),
+      checksums(i_checksums),
+      numSlots(i_numSlots),
+      slots(i_numSlots),
+      slotIsReady(i_numSlots, false),
+      nextBlockToCompress(0),
+      nextBlockToWrite(0),
+      failed(false)
+  { }
+  // Data members
+  Sparse::SparseBlock<Data_T> *blocks;
+  const int blockOrder;
+  //! Tile order, or 0 if blocks are compressed whole
+  const int tileOrder;
+  const SparseCodec codec;
+  //! Bits per quantized component, or 0 if blocks are stored losslessly
+  const int quantizeBits;
+  //! Indices of the stored blocks, in the order they are written
+  std::vector<size_t> writeOrder;
+  //! Summarizes each block as it is compressed. NULL if not wanted
+  const BlockSummarizer<Data_T> *summarizer;
+  //! Checksums of the compressed blocks, indexed like writeOrder. NULL if
+  //! not wanted
+  std::vector<uint32_t> *checksums;
+  //! Size of the reorder buffer. Compression stays at most this many blocks
+  //! ahead of the writer.
+  const size_t numSlots;
+  //! Compressed data waiting to be written, indexed by order % numSlots
+  std::vector<std::vector<uint8_t> > slots;
+  std::vector<bool> slotIsReady;
+  //! Next entry of writeOrder to compress. Claimed without locking
+  boost::atomic<size_t> nextBlockToCompress;
+  //! Next entry of writeOrder to write. Guarded by slotMutex
+  size_t nextBlockToWrite;
+  //! Set if any block failed to compress. Guarded by slotMutex
+  bool failed;
+  // Synchronization
+  boost::mutex slotMutex;
+  //! Signaled when a compressed block is ready to write
+  boost::condition_variable slotReady;
+  //! Signaled when the writer has freed up a slot
+  boost::condition_variable slotFree;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Compresses blocks into the reorder buffer of a ThreadingState. The
+//! blocks are written to disk, in order, by writeBlocks().
+template <typename Data_T>
+class CompressBlockOp
+{
+public:
+  CompressBlockOp(ThreadingState<Data_T> &state)
+    : m_state(state), 
+      m_compressor(state.blockOrder, state.tileOrder, state.codec, 
+                   state.quantizeBits)
+  { }
+  void operator() ()
+  {
+    const size_t numBlocks = m_state.writeOrder.size();
     // Loop over blocks until we run out
-    while (blockIdx < m_state.numBlocks) {
-      if (m_state.blocks[blockIdx].isAllocated) {
-        // Block data as bytes
-        const uint8_t *srcData = 
-          reinterpret_cast<const uint8_t *>(m_state.blocks[blockIdx].data);
-        // Length of compressed data is stored here
-        const uLong srcLen      = m_state.numVoxels * sizeof(Data_T);
-        const uLong cmpLenBound = compressBound(srcLen);
-        uLong cmpLen            = cmpLenBound;
-        // Perform compression
-        const int status = compress2(&m_cache[0], &cmpLen, 
-                                     srcData, srcLen, level);
-        // Error check
-        if (status != Z_OK) {
-          std::cout << "ERROR: Couldn't compress in SparseFieldIO." << std::endl
-                    << "  Level:  " << level << std::endl
-                    << "  Status: " << status << std::endl
-                    << "  srcLen: " << srcLen << std::endl
-                    << "  cmpLenBound: " << cmpLenBound << std::endl
-                    << "  cmpLen: " << cmpLen << std::endl;
-          return;
-        }
-        // Wait to write data
-        while (m_state.nextBlockToWrite != blockIdx) {
-          // Spin
-          boost::this_thread::sleep(boost::posix_time::microseconds(1));
+    for (size_t order = m_state.nextBlockToCompress.fetch_add(1); 
+         order < numBlocks; 
+         order = m_state.nextBlockToCompress.fetch_add(1)) {
+      const size_t slot = order % m_state.numSlots;
+      // Wait for the slot to be written out
+      {
+        boost::mutex::scoped_lock lock(m_state.slotMutex);
+        while (!m_state.failed && 
+               order >= m_state.nextBlockToWrite + m_state.numSlots) {
+          m_state.slotFree.wait(lock);
         }
-        // Do the writing
-        m_state.data.addData(cmpLen, &m_cache[0]);
-        // Let next block write
-        while (m_state.nextBlockToWrite < m_state.numBlocks){
-          // Increment to next
-          m_state.nextBlockToWrite++;
-          if (m_state.blocks[m_state.nextBlockToWrite].isAllocated) {
-            break;
-          }
+        if (m_state.failed) {
+          return;
         }
       }
-      // Get next block idx
+      // The slot belongs to this thread until it is marked as ready
+      Data_T *block = m_state.blocks[m_state.writeOrder[order]].data;
+      bool status;
+      // Summarize the block while it's in cache
+      if (m_state.summarizer) {
+        (*m_state.summarizer)(m_state.writeOrder[order]);
+      }
       {
-        boost::mutex::scoped_lock lock(m_state.compressMutex);
-        blockIdx = m_state.nextBlockToCompress;
-        // Step counter to next
-        while (m_state.nextBlockToCompress < m_state.numBlocks) {
-          m_state.nextBlockToCompress++;
-          if (m_state.blocks[m_state.nextBlockToCompress].isAllocated) {
-            break;
-          }
-        }
+        Trace::ScopedEvent event("compressBlock", m_state.writeOrder[order]);
+        status = m_compressor.compress(block, m_state.slots[slot]);
+      }
+      // Checksum the bytes that go to disk
+      if (status && m_state.checksums) {
+        const std::vector<uint8_t> &compressed = m_state.slots[slot];
+        (*m_state.checksums)[order] = 
+          BlockChecksum::crc32c(&compressed[0], compressed.size());
+      }
+      // Hand the block to the writer
+      boost::mutex::scoped_lock lock(m_state.slotMutex);
+      if (!status) {
+        m_state.failed = true;
+        m_state.slotReady.notify_all();
+        m_state.slotFree.notify_all();
+        return;
       }
+      m_state.slotIsReady[slot] = true;
+      m_state.slotReady.notify_all();
     }
   }
 private:
   // Data members ---
   ThreadingState<Data_T> &m_state;
-  std::vector<uint8_t> m_cache;
-  const size_t m_threadId;
+  BlockCompressor<Data_T> m_compressor;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Writes the blocks compressed by CompressBlockOp to the dataset, in order
+//! \returns False if any block failed to compress
+template <typename Data_T>
+bool writeBlocks(ThreadingState<Data_T> &state, OgOCDataset<Data_T> &data)
+{
+  const size_t numBlocks = state.writeOrder.size();
+  for (size_t order = 0; order < numBlocks; ++order) {
+    const size_t slot = order % state.numSlots;
+    // Wait for the block to be compressed
+    {
+      boost::mutex::scoped_lock lock(state.slotMutex);
+      while (!state.failed && !state.slotIsReady[slot]) {
+        state.slotReady.wait(lock);
+      }
+      if (state.failed) {
+        return false;
+      }
+    }
+    // Do the writing. The slot can't be touched until it is released below
+    {
+      Trace::ScopedEvent event("writeBlock", state.writeOrder[order]);
+      data.addData(state.slots[slot].size(), &state.slots[slot][0]);
+    }
+    // Let the compression threads reuse the slot
+    {
+      boost::mutex::scoped_lock lock(state.slotMutex);
+      state.slotIsReady[slot] = false;
+      state.nextBlockToWrite++;
+      state.slotFree.notify_all();
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Finds out how each block of a field gets written. Allocated blocks that
+//! hold a single value are written as constant tiles, i.e. as unallocated
+//! blocks whose empty value is that value, so that they take no space in
+//! the file nor in memory once read back.
+template <typename Data_T>
+void writtenBlocks(const SparseField<Data_T> &field, 
+                   std::vector<uint8_t> &isAllocated, 
+                   std::vector<Data_T> &emptyValue)
+{
+  const V3i    blockRes  = field.blockRes();
+  const size_t numBlocks = blockRes.x * blockRes.y * blockRes.z;
+  isAllocated.resize(numBlocks);
+  emptyValue.resize(numBlocks);
+  size_t b = 0;
+  for (int k = 0; k < blockRes.z; ++k) {
+    for (int j = 0; j < blockRes.y; ++j) {
+      for (int i = 0; i < blockRes.x; ++i, ++b) {
+        emptyValue[b] = field.getBlockEmptyValue(i, j, k);
+        isAllocated[b] = field.blockIsAllocated(i, j, k) && 
+          !field.blockIsUniform(i, j, k, emptyValue[b]);
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! 64-bit FNV-1a hash of the given bytes
+uint64_t hashBytes(const uint8_t *data, const size_t numBytes)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < numBytes; ++i) {
+    hash ^= data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Finds the blocks written as allocated whose voxels are bitwise identical
+//! to those of an earlier one. isStored is set for the blocks whose data
+//! gets written, and blockTable receives, for each block written as 
+//! allocated, in file order, the index among the stored blocks of the one
+//! holding its data.
+//! \returns The number of stored blocks
+template <typename Data_T>
+size_t dedupeBlocks(const Sparse::SparseBlock<Data_T> *blocks, 
+                    const std::vector<uint8_t> &isAllocated,
+                    const size_t numVoxels, std::vector<uint8_t> &isStored,
+                    std::vector<uint32_t> &blockTable)
+{
+  typedef std::multimap<uint64_t, size_t> HashMap;
+  typedef HashMap::const_iterator         HashIter;
+
+  const size_t numBytes = numVoxels * sizeof(Data_T);
+
+  // Stored blocks by the hash of their data
+  HashMap stored;
+  // Index among the stored blocks, for each stored block
+  std::vector<uint32_t> storedIdx(isAllocated.size(), 0);
+  size_t numStored = 0;
+
+  isStored.assign(isAllocated.size(), 0);
+  blockTable.clear();
+
+  for (size_t i = 0; i < isAllocated.size(); ++i) {
+    if (!isAllocated[i]) {
+      continue;
+    }
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(blocks[i].data);
+    const uint64_t hash = hashBytes(data, numBytes);
+    // Hashes may collide, so the data is compared too
+    bool isDuplicate = false;
+    std::pair<HashIter, HashIter> range = stored.equal_range(hash);
+    for (HashIter h = range.first; h != range.second; ++h) {
+      const uint8_t *other = 
+        reinterpret_cast<const uint8_t *>(blocks[h->second].data);
+      if (std::memcmp(data, other, numBytes) == 0) {
+        blockTable.push_back(storedIdx[h->second]);
+        isDuplicate = true;
+        break;
+      }
+    }
+    if (!isDuplicate) {
+      storedIdx[i] = static_cast<uint32_t>(numStored++);
+      isStored[i] = 1;
+      blockTable.push_back(storedIdx[i]);
+      stored.insert(std::make_pair(hash, i));
+    }
+  }
+
+  return numStored;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Spreads the lower 21 bits of v so that there are two zero bits between
+//! each of them
+uint64_t dilateBits(const int v)
+{
+  uint64_t x = static_cast<uint64_t>(v) & 0x1fffff;
+  x = (x | (x << 32)) & 0x001f00000000ffffULL;
+  x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+  x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+  x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+  x = (x | (x << 2))  & 0x1249249249249249ULL;
+  return x;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the blocks in isStored, in the order their data is written
+std::vector<size_t> blockWriteOrder(const std::vector<uint8_t> &isStored, 
+                                    const V3i &blockRes, 
+                                    const SparseFileOrder order)
+{
+  std::vector<size_t> writeOrder;
+  if (order == SparseFileOrderMorton) {
+    // Sort the blocks by the Morton code of their block coordinate
+    std::vector<std::pair<uint64_t, size_t> > codes;
+    for (size_t i = 0; i < isStored.size(); ++i) {
+      if (isStored[i]) {
+        const int x = i % blockRes.x;
+        const int y = (i / blockRes.x) % blockRes.y;
+        const int z = i / (blockRes.x * blockRes.y);
+        codes.push_back(std::make_pair(dilateBits(x) | 
+                                       (dilateBits(y) << 1) | 
+                                       (dilateBits(z) << 2), i));
+      }
+    }
+    std::sort(codes.begin(), codes.end());
+    for (size_t i = 0; i < codes.size(); ++i) {
+      writeOrder.push_back(codes[i].second);
+    }
+  } else {
+    for (size_t i = 0; i < isStored.size(); ++i) {
+      if (isStored[i]) {
+        writeOrder.push_back(i);
+      }
+    }
+  }
+  return writeOrder;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Makes blockTable, which refers to the stored blocks by their linear 
+//! order, refer to their position in writeOrder instead. An empty table
+//! stands for every allocated block being stored.
+void reorderBlockTable(const std::vector<uint8_t> &isStored, 
+                       const std::vector<size_t> &writeOrder,
+                       std::vector<uint32_t> &blockTable)
+{
+  // Position on disk of each stored block
+  std::vector<uint32_t> filePos(isStored.size(), 0);
+  for (size_t order = 0; order < writeOrder.size(); ++order) {
+    filePos[writeOrder[order]] = static_cast<uint32_t>(order);
+  }
+  // ... by their linear order
+  std::vector<uint32_t> storedPos;
+  for (size_t i = 0; i < isStored.size(); ++i) {
+    if (isStored[i]) {
+      storedPos.push_back(filePos[i]);
+    }
+  }
+  if (blockTable.empty()) {
+    for (size_t i = 0; i < storedPos.size(); ++i) {
+      blockTable.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  for (size_t i = 0; i < blockTable.size(); ++i) {
+    blockTable[i] = storedPos[blockTable[i]];
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the tile order to write blocks of the given order with, or 0
+//! if they're compressed whole
+int writeTileOrder(const int blockOrder)
+{
+  return sparseStorageMode() == SparseStorageTiled ? 
+    SparseTiles::tileOrder(blockOrder) : 0;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the bits per component to quantize blocks with, or 0 if they
+//! are stored losslessly. Only whole compressed blocks are quantized
+int writeQuantizeBits()
+{
+  return sparseStorageMode() == SparseStorageCompressed ? 
+    sparseQuantizeBits() : 0;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the alignment, in bytes, of uncompressed blocks. Each block 
+//! starts on a page boundary, so that readers may map the blocks straight
+//! from the file
+uint32_t writeBlockAlignment()
+{
+#ifdef WIN32
+  return 4096;
+#else
+  return std::max(4096L, static_cast<long>(sysconf(_SC_PAGESIZE)));
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+typedef SparseFieldIO::PrecompressedBlocks PrecompressedBlocks;
+typedef PrecompressedBlocks::Ptr           PrecompressedBlocksPtr;
+
+//----------------------------------------------------------------------------//
+
+//! Compresses blocks of several fields, handing out one block at a time
+template <typename Data_T>
+class PrecompressOp
+{
+public:
+  typedef typename SparseField<Data_T>::Ptr FieldPtr;
+  //! A block's data, its field and its index among the field's blocks
+  struct Task 
+  {
+    Data_T *data;
+    size_t  field, order;
+  };
+  PrecompressOp(const std::vector<FieldPtr> &fields, 
+                const std::vector<PrecompressedBlocksPtr> &results, 
+                const std::vector<Task> &tasks, 
+                boost::atomic<size_t> &nextTask, 
+                boost::atomic<bool> &failed)
+    : m_fields(fields), m_results(results), m_tasks(tasks), 
+      m_nextTask(nextTask), m_failed(failed)
+  { }
+  void operator() ()
+  {
+    // Each field may have its own block order, and so needs a compressor
+    std::map<int, boost::shared_ptr<BlockCompressor<Data_T> > > compressors;
+    for (size_t i = m_nextTask.fetch_add(1); i < m_tasks.size() && !m_failed; 
+         i = m_nextTask.fetch_add(1)) {
+      const Task &task = m_tasks[i];
+      const FieldPtr &field = m_fields[task.field];
+      PrecompressedBlocks &result = *m_results[task.field];
+      boost::shared_ptr<BlockCompressor<Data_T> > &compressor = 
+        compressors[field->blockOrder()];
+      if (!compressor) {
+        compressor.reset(new BlockCompressor<Data_T>(field->blockOrder(), 
+                                                     result.tileOrder,
+                                                     result.codec,
+                                                     result.quantizeBits));
+      }
+      if (!compressor->compress(task.data, result.blocks[task.order])) {
+        m_failed = true;
+      }
+    }
+  }
+private:
+  const std::vector<FieldPtr> &m_fields;
+  const std::vector<PrecompressedBlocksPtr> &m_results;
+  const std::vector<Task> &m_tasks;
+  boost::atomic<size_t> &m_nextTask;
+  boost::atomic<bool> &m_failed;
 };
 
 //----------------------------------------------------------------------------//
 
 } // Anonymous namespace
 
+//----------------------------------------------------------------------------//
+// SparseReadScratch implementations
+//----------------------------------------------------------------------------//
+
+SparseReadScratch& SparseReadScratch::forThread()
+{
+  // Never deleted, so that threads exiting late can still clean up theirs
+  static boost::thread_specific_ptr<SparseReadScratch> *s_scratch = 
+    new boost::thread_specific_ptr<SparseReadScratch>;
+  SparseReadScratch *scratch = s_scratch->get();
+  if (!scratch) {
+    scratch = new SparseReadScratch;
+    s_scratch->reset(scratch);
+  }
+  return *scratch;
+}
+
 //----------------------------------------------------------------------------//
 // Static members
 //----------------------------------------------------------------------------//
 
 const int         SparseFieldIO::k_versionNumber(1);
+const int         SparseFieldIO::k_blockLayoutVersionNumber(2);
+const int         SparseFieldIO::k_blockTableVersionNumber(3);
+const int         SparseFieldIO::k_quantizedVersionNumber(4);
+const int         SparseFieldIO::k_codecVersionNumber(5);
+const int         SparseFieldIO::k_tiledVersionNumber(6);
 const std::string SparseFieldIO::k_versionAttrName("version");
 const std::string SparseFieldIO::k_extentsStr("extents");
 const std::string SparseFieldIO::k_extentsMinStr("extents_min");
@@ -314,6 +940,13 @@ const std::string SparseFieldIO::k_blockResStr("block_res");
 const std::string SparseFieldIO::k_bitsPerComponentStr("bits_per_component");
 const std::string SparseFieldIO::k_numOccupiedBlocksStr("num_occupied_blocks");
 const std::string SparseFieldIO::k_isCompressed("data_is_compressed");
+const std::string SparseFieldIO::k_tileOrderStr("data_tile_order");
+const std::string SparseFieldIO::k_codecStr("data_codec");
+const std::string SparseFieldIO::k_blockLayoutStr("block_layout");
+const std::string SparseFieldIO::k_dataAlignmentStr("data_alignment");
+const std::string SparseFieldIO::k_blockTableStr("block_table_data");
+const std::string SparseFieldIO::k_blockSummaryStr("block_summary_data");
+const std::string SparseFieldIO::k_quantizeBitsStr("data_quantize_bits");
 
 //----------------------------------------------------------------------------//
 
@@ -338,7 +971,7 @@ SparseFieldIO::read(hid_t layerGroup, const std::string &filename,
     throw MissingAttributeException("Couldn't find attribute: " +
                                     k_versionAttrName);
 
-  if (version != k_versionNumber) 
+  if (version != k_versionNumber && version != k_blockLayoutVersionNumber) 
     throw UnsupportedVersionException("SparseField version not supported: " +
                                       lexical_cast<std::string>(version));
 
@@ -459,6 +1092,29 @@ SparseFieldIO::read(hid_t layerGroup, const std::string &filename,
 FieldBase::Ptr 
 SparseFieldIO::read(const OgIGroup &layerGroup, const std::string &filename, 
                     const std::string &layerPath, OgDataType typeEnum)
+{
+  return readInternal(layerGroup, filename, layerPath, typeEnum, NULL);
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr 
+SparseFieldIO::readWindow(const OgIGroup &layerGroup, 
+                          const std::string &filename, 
+                          const std::string &layerPath, OgDataType typeEnum,
+                          const Box3i &voxelWindow)
+{
+  return readInternal(layerGroup, filename, layerPath, typeEnum, 
+                      &voxelWindow);
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr 
+SparseFieldIO::readInternal(const OgIGroup &layerGroup, 
+                            const std::string &filename, 
+                            const std::string &layerPath, OgDataType typeEnum,
+                            const Box3i *voxelWindow)
 {
   Box3i extents, dataW;
   int blockOrder;
@@ -479,7 +1135,11 @@ SparseFieldIO::read(const OgIGroup &layerGroup, const std::string &filename,
   }
   const int version = versionAttr.value();
 
-  if (version != k_versionNumber) {
+  if (version != k_versionNumber && version != k_blockLayoutVersionNumber &&
+      version != k_blockTableVersionNumber && 
+      version != k_quantizedVersionNumber && 
+      version != k_codecVersionNumber &&
+      version != k_tiledVersionNumber) {
     throw UnsupportedVersionException("SparseField version not supported: " +
                                       lexical_cast<std::string>(version));
   }
@@ -600,22 +1260,28 @@ SparseFieldIO::read(const OgIGroup &layerGroup, const std::string &filename,
   if (typeEnum == typeOnDisk) {
     if (typeEnum == F3DFloat16) {
       result = readData<float16_t>(layerGroup, extents, dataW, blockOrder,
-                                   numBlocks, filename, layerPath);
+                                   numBlocks, filename, layerPath,
+                                   voxelWindow);
     } else if (typeEnum == F3DFloat32) {
       result = readData<float32_t>(layerGroup, extents, dataW, blockOrder,
-                                   numBlocks, filename, layerPath);
+                                   numBlocks, filename, layerPath,
+                                   voxelWindow);
     } else if (typeEnum == F3DFloat64) {
       result = readData<float64_t>(layerGroup, extents, dataW, blockOrder,
-                                   numBlocks, filename, layerPath);
+                                   numBlocks, filename, layerPath,
+                                   voxelWindow);
     } else if (typeEnum == F3DVec16) {
       result = readData<vec16_t>(layerGroup, extents, dataW, blockOrder,
-                                 numBlocks, filename, layerPath);
+                                 numBlocks, filename, layerPath,
+                                 voxelWindow);
     } else if (typeEnum == F3DVec32) {
       result = readData<vec32_t>(layerGroup, extents, dataW, blockOrder,
-                                 numBlocks, filename, layerPath);
+                                 numBlocks, filename, layerPath,
+                                 voxelWindow);
     } else if (typeEnum == F3DVec64) {
       result = readData<vec64_t>(layerGroup, extents, dataW, blockOrder,
-                                 numBlocks, filename, layerPath);
+                                 numBlocks, filename, layerPath,
+                                 voxelWindow);
     } 
   }
 
@@ -632,13 +1298,6 @@ SparseFieldIO::write(hid_t layerGroup, FieldBase::Ptr field)
     return false;
   }
 
-  // Add version attribute
-  if (!writeAttribute(layerGroup, k_versionAttrName, 
-                    1, k_versionNumber)) {
-    Msg::print(Msg::SevWarning, "Error adding version attribute.");
-    return false;
-  }
-
   SparseField<half>::Ptr halfField = 
     field_dynamic_cast<SparseField<half> >(field);
   SparseField<float>::Ptr floatField = 
@@ -680,9 +1339,6 @@ SparseFieldIO::write(OgOGroup &layerGroup, FieldBase::Ptr field)
 {
   using namespace Exc;
 
-  // Add version attribute
-  OgOAttribute<int> version(layerGroup, k_versionAttrName, k_versionNumber);
-
   SparseField<half>::Ptr halfField = 
     field_dynamic_cast<SparseField<half> >(field);
   SparseField<float>::Ptr floatField = 
@@ -731,7 +1387,8 @@ typename SparseField<Data_T>::Ptr
 SparseFieldIO::readData(const OgIGroup &location, const Box3i &extents, 
                         const Box3i &dataW, const size_t blockOrder, 
                         const size_t numBlocks, const std::string &filename, 
-                        const std::string &layerPath)
+                        const std::string &layerPath, 
+                        const Box3i *voxelWindow)
 {
   using namespace std;
   using namespace Exc;
@@ -741,7 +1398,20 @@ SparseFieldIO::readData(const OgIGroup &location, const Box3i &extents,
   result->setSize(extents, dataW);
   result->setBlockOrder(blockOrder);
 
-  const bool   dynamicLoading = SparseFileManager::singleton().doLimitMemUse();
+  // Blocks are read back in the layout they were written in
+  OgIAttribute<uint8_t> layoutAttr = 
+    location.findAttribute<uint8_t>(k_blockLayoutStr);
+  if (layoutAttr.isValid()) {
+    if (layoutAttr.value() > BlockLayoutMorton) {
+      throw UnsupportedVersionException("Unknown SparseField block layout: " +
+        lexical_cast<std::string>(static_cast<int>(layoutAttr.value())));
+    }
+    result->setBlockLayout(static_cast<BlockLayout>(layoutAttr.value()));
+  }
+
+  const bool   dynamicLoading = 
+    SparseFileManager::singleton().doLimitMemUse() || 
+    SparseFileManager::singleton().doLazyLoading();
   const int    components     = FieldTraits<Data_T>::dataDims();
   const size_t numVoxels      = (1 << (result->m_blockOrder * 3));
   const int    valuesPerBlock = (1 << (result->m_blockOrder * 3)) * components;
@@ -763,31 +1433,96 @@ SparseFieldIO::readData(const OgIGroup &location, const Box3i &extents,
     //! \todo The valuesPerBlock is wrong. Fix
     result->addReference(filename, layerPath, valuesPerBlock, numVoxels,
                          occupiedBlocks);
+    // Tiled blocks are loaded one tile at a time
+    OgIAttribute<uint8_t> tileOrderAttr = 
+      location.findAttribute<uint8_t>(k_tileOrderStr);
+    if (tileOrderAttr.isValid()) {
+      result->setupReferenceTiles(tileOrderAttr.value());
+    }
+  }
+
+  // Find the blocks that overlap the voxel window ---
+
+  const V3i blockRes = result->m_blockRes;
+  Box3i     blockWindow(V3i(0), blockRes - V3i(1));
+
+  if (voxelWindow && !dynamicLoading) {
+    const Box3i window = clipBounds(*voxelWindow, dataW);
+    if (window.isEmpty()) {
+      blockWindow = Box3i();
+    } else {
+      blockWindow.min.x = (window.min.x - dataW.min.x) >> blockOrder;
+      blockWindow.min.y = (window.min.y - dataW.min.y) >> blockOrder;
+      blockWindow.min.z = (window.min.z - dataW.min.z) >> blockOrder;
+      blockWindow.max.x = (window.max.x - dataW.min.x) >> blockOrder;
+      blockWindow.max.y = (window.max.y - dataW.min.y) >> blockOrder;
+      blockWindow.max.z = (window.max.z - dataW.min.z) >> blockOrder;
+    }
   }
 
   // Read the block info data sets ---
 
   SparseBlock<Data_T> *blocks = result->m_blocks;
 
+  // ... Read the block table, if blocks share their data on disk
+  std::vector<uint32_t> blockTable;
+  
+  {
+    OgIDataset<uint32_t> blockTableData = 
+      location.findDataset<uint32_t>(k_blockTableStr);
+    if (blockTableData.isValid()) {
+      blockTable.resize(blockTableData.dataSize(0, OGAWA_THREAD));
+      if (!blockTable.empty()) {
+        blockTableData.getData(0, &blockTable[0], OGAWA_THREAD);
+      }
+      for (size_t i = 0; i < blockTable.size(); ++i) {
+        if (blockTable[i] >= occupiedBlocks) {
+          throw FileIntegrityException("Block table refers to missing block "
+                                       "in SparseFieldIO::readData()");
+        }
+      }
+    }
+  }
+
   // ... Read the isAllocated array and set up the block mapping array
   std::vector<size_t> blockIdxToDatasetIdx(numBlocks);
 
   {
-    // Grab the data
-    vector<uint8_t> isAllocated(numBlocks);
+    // Grab the data. Mapped files are used in place
+    vector<uint8_t> isAllocatedCopy;
     OgIDataset<uint8_t> isAllocatedData = 
       location.findDataset<uint8_t>("block_is_allocated_data");
     if (!isAllocatedData.isValid()) {
       throw MissingGroupException("Couldn't find block_is_allocated_data: ");
     }
-    isAllocatedData.getData(0, &isAllocated[0], OGAWA_THREAD);
-    // Allocate the blocks and set up the block mapping array
+    const uint8_t *isAllocated = 
+      isAllocatedData.dataSize(0, OGAWA_THREAD) >= numBlocks ? 
+      isAllocatedData.mappedData(0, OGAWA_THREAD) : NULL;
+    if (!isAllocated) {
+      isAllocatedCopy.resize(numBlocks);
+      isAllocatedData.getData(0, &isAllocatedCopy[0], OGAWA_THREAD);
+      isAllocated = &isAllocatedCopy[0];
+    }
+    // Set up the block mapping array. The blocks are allocated by the 
+    // threads that read them
     for (size_t i = 0, nextBlockOnDisk = 0; i < numBlocks; ++i) {
-      blocks[i].isAllocated = isAllocated[i];
-      if (!dynamicLoading && isAllocated[i]) {
-        blocks[i].resize(numVoxels);
+      const V3i blockCoord(i % blockRes.x, (i / blockRes.x) % blockRes.y,
+                           i / (blockRes.x * blockRes.y));
+      const bool inWindow = blockWindow.intersects(blockCoord);
+      blocks[i].isAllocated = isAllocated[i] && inWindow;
+      if (isAllocated[i] && !blockTable.empty() && 
+          nextBlockOnDisk >= blockTable.size()) {
+        throw FileIntegrityException("Block table too short in "
+                                     "SparseFieldIO::readData()");
+      }
+      if (!dynamicLoading && blocks[i].isAllocated) {
         // Update the block mapping array
-        blockIdxToDatasetIdx[i] = nextBlockOnDisk;
+        blockIdxToDatasetIdx[i] = blockTable.empty() ? 
+          nextBlockOnDisk : blockTable[nextBlockOnDisk];
+      }
+      // Blocks outside the window still occupy a slot in the block table,
+      // or on disk
+      if (isAllocated[i]) {
         nextBlockOnDisk++;
       }
     }
@@ -796,14 +1531,21 @@ SparseFieldIO::readData(const OgIGroup &location, const Box3i &extents,
   // ... Read the emptyValue array ---
 
   {
-    // Grab the data
-    vector<Data_T> emptyValue(numBlocks);
+    // Grab the data. Mapped files are used in place
+    vector<Data_T> emptyValueCopy;
     OgIDataset<Data_T> emptyValueData = 
       location.findDataset<Data_T>("block_empty_value_data");
     if (!emptyValueData.isValid()) {
       throw MissingGroupException("Couldn't find block_empty_value_data: ");
     }
-    emptyValueData.getData(0, &emptyValue[0], OGAWA_THREAD);
+    const Data_T *emptyValue = 
+      emptyValueData.dataSize(0, OGAWA_THREAD) >= numBlocks ? 
+      emptyValueData.mappedData(0, OGAWA_THREAD) : NULL;
+    if (!emptyValue) {
+      emptyValueCopy.resize(numBlocks);
+      emptyValueData.getData(0, &emptyValueCopy[0], OGAWA_THREAD);
+      emptyValue = &emptyValueCopy[0];
+    }
     // Fill in the field
     for (size_t i = 0; i < numBlocks; ++i) {
       blocks[i].emptyValue = emptyValue[i];
@@ -819,21 +1561,52 @@ SparseFieldIO::readData(const OgIGroup &location, const Box3i &extents,
 
   if (occupiedBlocks > 0) {
     if (dynamicLoading) {
-      // Defer loading to the sparse cache
-      result->setupReferenceBlocks();
+      // Defer loading to the sparse cache. Duplicate blocks refer to the
+      // same block on disk, and so to the same shared or mapped block
+      result->setupReferenceBlocks(blockTable.empty() ? NULL : &blockTable);
+      // Block summaries let value ranges be found without loading blocks
+      OgIDataset<Data_T> summaryData = 
+        location.findDataset<Data_T>(k_blockSummaryStr);
+      if (summaryData.isValid()) {
+        std::vector<Data_T> summaries(summaryData.dataSize(0, OGAWA_THREAD));
+        if (!summaries.empty()) {
+          summaryData.getData(0, &summaries[0], OGAWA_THREAD);
+        }
+        result->setupReferenceSummaries(summaries);
+      }
     } else {
       // Threading state
       ReadThreadingState<Data_T> state(location, blocks, numVoxels, numBlocks,
                                        occupiedBlocks, isCompressed,
                                        blockIdxToDatasetIdx);
-      // Number of threads
-      const size_t numThreads = numIOThreads();
-      // Launch threads
-      boost::thread_group threads;
-      for (size_t i = 0; i < numThreads; ++i) {
-        threads.create_thread(ReadBlockOp<Data_T>(state, i));
+      // Submit every block's extent up front, so the reads below find the
+      // data in flight or already in memory
+      {
+        std::vector<size_t> fileBlocks;
+        fileBlocks.reserve(state.readOrder.size());
+        for (size_t i = 0; i < state.readOrder.size(); ++i) {
+          fileBlocks.push_back(blockIdxToDatasetIdx[state.readOrder[i]]);
+        }
+        OgSparseDataReader<Data_T> reader(location, numVoxels, 
+                                          occupiedBlocks, isCompressed);
+        reader.prefetchBlocks(fileBlocks);
       }
-      threads.join_all();
+      // Number of threads. Ogawa reads are positional, so they all share
+      // the archive
+      const size_t numThreads = 
+        std::min(numIOThreads(), state.readOrder.size());
+      state.setNumThreads(numThreads);
+      // Run on the shared threads
+      ReadBlockTask<Data_T> task(state);
+      ThreadPool::singleton().run(task, numThreads);
+      if (state.numFailedBlocks > 0) {
+        throw FileIntegrityException("Couldn't read " + 
+                                     lexical_cast<std::string>
+                                     (state.numFailedBlocks.load()) + 
+                                     " blocks in SparseFieldIO::read");
+      }
+      // Blocks that share their data were read only once
+      state.copyDuplicates();
     }
   }
 
@@ -860,6 +1633,25 @@ bool SparseFieldIO::writeInternal(hid_t layerGroup,
 
   int valuesPerBlock = (1 << (field->m_blockOrder * 3)) * components;
 
+  // Add version attribute. Files whose blocks aren't in linear layout get
+  // a version that older readers refuse, rather than misread ---
+
+  const bool isLinear = field->m_blockLayout == BlockLayoutLinear;
+  int version = isLinear ? k_versionNumber : k_blockLayoutVersionNumber;
+
+  if (!writeAttribute(layerGroup, k_versionAttrName, 1, version)) {
+    Msg::print(Msg::SevWarning, "Error adding version attribute.");
+    return false;
+  }
+
+  if (!isLinear) {
+    int layout = field->m_blockLayout;
+    if (!writeAttribute(layerGroup, k_blockLayoutStr, 1, layout)) {
+      Msg::print(Msg::SevWarning, "Error adding block layout attribute.");
+      return false;
+    }
+  }
+
   // Add extents attribute ---
 
   int extents[6] = 
@@ -923,30 +1715,23 @@ bool SparseFieldIO::writeInternal(hid_t layerGroup,
 
   // Write the block info data sets ---
   
-  SparseBlock<Data_T> *blocks = field->m_blocks;
+  vector<uint8_t> writeAllocated;
+  vector<Data_T>  emptyValue;
+  writtenBlocks(*field, writeAllocated, emptyValue);
 
   // ... Write the isAllocated array
   {
-    vector<char> isAllocated(numBlocks);
-    for (int i = 0; i < numBlocks; ++i) {
-      isAllocated[i] = static_cast<char>(blocks[i].isAllocated);
-    }
+    vector<char> isAllocated(writeAllocated.begin(), writeAllocated.end());
     writeSimpleData<char>(layerGroup, "block_is_allocated_data", isAllocated);
   }
 
   // ... Write the emptyValue array
-  {
-    vector<Data_T> emptyValue(numBlocks);
-    for (int i = 0; i < numBlocks; ++i) {
-      emptyValue[i] = static_cast<Data_T>(blocks[i].emptyValue);
-    }
-    writeSimpleData<Data_T>(layerGroup, "block_empty_value_data", emptyValue);
-  }
+  writeSimpleData<Data_T>(layerGroup, "block_empty_value_data", emptyValue);
 
   // Count the number of occupied blocks ---
   int occupiedBlocks = 0;
   for (int i = 0; i < numBlocks; ++i) {
-    if (blocks[i].isAllocated) {
+    if (writeAllocated[i]) {
       occupiedBlocks++;
     }
   }
@@ -997,6 +1782,23 @@ bool SparseFieldIO::writeInternal(hid_t layerGroup,
       throw CreateDataSetException("Couldn't create data set in "
                                    "SparseFieldIO::writeInternal");
 
+    // Each block is a chunk, so the blocks can be deflated straight out of
+    // the field ---
+
+    if (hdf5ParallelDeflate()) {
+      std::vector<const void *> rows;
+      rows.reserve(occupiedBlocks);
+      for (int i = 0; i < numBlocks; ++i) {
+        if (writeAllocated[i]) {
+          rows.push_back(field->m_blocks[i].data);
+        }
+      }
+      if (writeDeflatedRows(dataSet.id(), sizeof(Data_T) / 
+                            FieldTraits<Data_T>::dataDims(), rows)) {
+        return true;
+      }
+    }
+
     // For each allocated block ---
 
     int nextBlockIdx = 0;
@@ -1005,7 +1807,7 @@ bool SparseFieldIO::writeInternal(hid_t layerGroup,
     herr_t status;
 
     for (int i = 0; i < numBlocks; ++i) {
-      if (blocks[i].isAllocated) {
+      if (writeAllocated[i]) {
         offset[0] = nextBlockIdx;  // Index of next block
         offset[1] = 0;             // Index of first data in block. Always 0
         count[0] = 1;              // Number of columns to read. Always 1
@@ -1041,87 +1843,220 @@ bool SparseFieldIO::writeInternal(hid_t layerGroup,
 
 template <class Data_T>
 bool SparseFieldIO::writeInternal(OgOGroup &layerGroup, 
-                                  typename SparseField<Data_T>::Ptr field)
+                                  typename SparseField<Data_T>::Ptr field,
+                                  const PrecompressedBlocks *precompressed)
 {
   using namespace Exc;
   using namespace Sparse;
 
   SparseBlock<Data_T> *blocks = field->m_blocks;
 
-  const int    components     = FieldTraits<Data_T>::dataDims();
-  const int    bits           = DataTypeTraits<Data_T>::h5bits();
   const V3i   &blockRes       = field->m_blockRes;
   const size_t numBlocks      = blockRes.x * blockRes.y * blockRes.z;
   const size_t numVoxels      = (1 << (field->m_blockOrder * 3));
   
-  const Box3i ext(field->extents()), dw(field->dataWindow());
+  const bool        isCompressed = sparseStorageMode() != SparseStorageMapped;
+  const int         tileOrder    = writeTileOrder(field->m_blockOrder);
+  const SparseCodec codec        = sparseCodec();
+  const int         quantizeBits = writeQuantizeBits();
+  
+  std::vector<uint8_t> isAllocated;
+  std::vector<Data_T>  emptyValue;
+  writtenBlocks(*field, isAllocated, emptyValue);
 
-  // Add attributes ---
+  // Count the number of occupied blocks
+  int occupiedBlocks = 0;
+  for (size_t i = 0; i < numBlocks; ++i) {
+    if (isAllocated[i]) {
+      occupiedBlocks++;
+    }
+  }
 
-  OgOAttribute<veci32_t> extMinAttr(layerGroup, k_extentsMinStr, ext.min);
-  OgOAttribute<veci32_t> extMaxAttr(layerGroup, k_extentsMaxStr, ext.max);
-  
-  OgOAttribute<veci32_t> dwMinAttr(layerGroup, k_dataWindowMinStr, dw.min);
-  OgOAttribute<veci32_t> dwMaxAttr(layerGroup, k_dataWindowMaxStr, dw.max);
+  // Find the blocks that duplicate an earlier one. Only the blocks in 
+  // isStored have their data written
+  std::vector<uint8_t>  isStored;
+  std::vector<uint32_t> blockTable;
+  int storedBlocks = occupiedBlocks;
+  if (sparseBlockDedupe() && occupiedBlocks > 1) {
+    storedBlocks = static_cast<int>(dedupeBlocks(blocks, isAllocated, 
+                                                 numVoxels, isStored, 
+                                                 blockTable));
+    if (storedBlocks == occupiedBlocks) {
+      blockTable.clear();
+    }
+  }
+  if (blockTable.empty()) {
+    isStored = isAllocated;
+  }
 
-  OgOAttribute<uint8_t> componentsAttr(layerGroup, k_componentsStr, components);
+  // Lay out the stored blocks on disk. Unless they are in linear order, 
+  // the block table records where each one went
+  const std::vector<size_t> writeOrder = 
+    blockWriteOrder(isStored, blockRes, sparseFileOrder());
+  for (size_t i = 1; i < writeOrder.size(); ++i) {
+    if (writeOrder[i] < writeOrder[i - 1]) {
+      reorderBlockTable(isStored, writeOrder, blockTable);
+      break;
+    }
+  }
 
-  OgOAttribute<uint8_t> bitsAttr(layerGroup, k_bitsPerComponentStr, bits);
+  // Summarize the blocks as they are written. Quantized blocks read back 
+  // slightly different values, so they go without
+  std::vector<Data_T>            summaries;
+  BlockSummarizer<Data_T>        summarizer(*field, summaries);
+  const BlockSummarizer<Data_T> *summarize = 
+    sparseBlockSummaries() && quantizeBits == 0 ? &summarizer : NULL;
+  if (summarize) {
+    // Duplicates of a stored block aren't written themselves
+    for (size_t i = 0; i < numBlocks; ++i) {
+      if (isAllocated[i] && !isStored[i]) {
+        summarizer(i);
+      }
+    }
+  }
 
-  OgOAttribute<uint8_t> blockOrderAttr(layerGroup, k_blockOrderStr, 
-                                       field->m_blockOrder);
+  // Add version attribute. Files whose blocks aren't in linear layout, 
+  // that refer to blocks through a block table, whose blocks are tiled or
+  // quantized, or that use a codec other than zlib, get a version that 
+  // older readers refuse, rather than misread. Readers of any version 
+  // above 1 know about codecs ---
+
+  const BlockLayout layout = field->m_blockLayout;
+  int versionNumber = k_versionNumber;
+  if (tileOrder > 0) {
+    versionNumber = k_tiledVersionNumber;
+  } else if (quantizeBits > 0) {
+    versionNumber = k_quantizedVersionNumber;
+  } else if (!blockTable.empty()) {
+    versionNumber = k_blockTableVersionNumber;
+  } else if (layout != BlockLayoutLinear) {
+    versionNumber = k_blockLayoutVersionNumber;
+  } else if (isCompressed && codec != SparseCodecZlib) {
+    versionNumber = k_codecVersionNumber;
+  }
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, versionNumber);
+  if (layout != BlockLayoutLinear) {
+    OgOAttribute<uint8_t> layoutAttr(layerGroup, k_blockLayoutStr, layout);
+  }
 
-  OgOAttribute<uint32_t> numBlocksAttr(layerGroup, k_numBlocksStr, numBlocks);
+  // Add attributes ---
 
-  OgOAttribute<veci32_t> blockResAttr(layerGroup, k_blockResStr, blockRes);
+  writeAttributes<Data_T>(layerGroup, field->extents(), field->dataWindow(),
+                          field->m_blockOrder, blockRes);
 
-  OgOAttribute<uint8_t> isCompressedAttr(layerGroup, k_isCompressed, 1);
-  
   // Write the isAllocated array
-  std::vector<uint8_t> isAllocated(numBlocks);
-  for (size_t i = 0; i < numBlocks; ++i) {
-    isAllocated[i] = static_cast<uint8_t>(blocks[i].isAllocated);
-  }
   OgODataset<uint8_t> isAllocatedData(layerGroup, "block_is_allocated_data");
   isAllocatedData.addData(numBlocks, &isAllocated[0]);
 
   // Write the emptyValue array
-  std::vector<Data_T> emptyValue(numBlocks);
-  for (size_t i = 0; i < numBlocks; ++i) {
-    emptyValue[i] = static_cast<Data_T>(blocks[i].emptyValue);
-  }
   OgODataset<Data_T> emptyValueData(layerGroup, "block_empty_value_data");
   emptyValueData.addData(numBlocks, &emptyValue[0]);
-    
-  // Count the number of occupied blocks
-  int occupiedBlocks = 0;
-  for (size_t i = 0; i < numBlocks; ++i) {
-    if (blocks[i].isAllocated) {
-      occupiedBlocks++;
-    }
+
+  // Write the block table
+  if (!blockTable.empty()) {
+    OgODataset<uint32_t> blockTableData(layerGroup, k_blockTableStr);
+    blockTableData.addData(blockTable.size(), &blockTable[0]);
   }
+    
+  // The occupied blocks are those with data on disk
   OgOAttribute<uint32_t> numOccupiedBlockAttr(layerGroup, 
                                               k_numOccupiedBlocksStr, 
-                                              occupiedBlocks);
+                                              storedBlocks);
 
   // Add data to file ---
 
+  if (!isCompressed) {
+    const uint32_t alignment = writeBlockAlignment();
+    OgOAttribute<uint32_t> alignmentAttr(layerGroup, k_dataAlignmentStr, 
+                                         alignment);
+    OgODataset<Data_T> data(layerGroup, k_dataStr);
+    for (size_t i = 0; i < writeOrder.size(); ++i) {
+      if (summarize) {
+        summarizer(writeOrder[i]);
+      }
+      data.addAlignedData(numVoxels, blocks[writeOrder[i]].data, alignment);
+    }
+    if (summarize) {
+      summarizer.write(layerGroup, isAllocated, k_blockSummaryStr);
+    }
+    return true;
+  }
+
   // Create the compressed dataset regardless of whether there are blocks
   // to write.
   OgOCDataset<Data_T> data(layerGroup, k_dataStr);
+  // Checksums of the stored blocks, in the order they are written
+  std::vector<uint32_t> checksums;
+  if (writeChecksums()) {
+    checksums.resize(writeOrder.size());
+  }
+  // Use the blocks compressed by precompress(), if they were compressed 
+  // the same way
+  if (precompressed && precompressed->tileOrder == tileOrder && 
+      precompressed->codec == codec && 
+      precompressed->quantizeBits == quantizeBits &&
+      precompressed->blocks.size() == static_cast<size_t>(occupiedBlocks)) {
+    // The precompressed blocks are those written as allocated, in linear
+    // order
+    std::vector<size_t> precompressedIdx(numBlocks, 0);
+    for (size_t i = 0, order = 0; i < numBlocks; ++i) {
+      if (isAllocated[i]) {
+        precompressedIdx[i] = order++;
+      }
+    }
+    for (size_t i = 0; i < writeOrder.size(); ++i) {
+      if (summarize) {
+        summarizer(writeOrder[i]);
+      }
+      const std::vector<uint8_t> &block = 
+        precompressed->blocks[precompressedIdx[writeOrder[i]]];
+      data.addData(block.size(), &block[0]);
+      if (!checksums.empty()) {
+        checksums[i] = BlockChecksum::crc32c(&block[0], block.size());
+      }
+    }
+    if (summarize) {
+      summarizer.write(layerGroup, isAllocated, k_blockSummaryStr);
+    }
+    if (!checksums.empty()) {
+      OgODataset<uint32_t> checksumData(layerGroup, 
+                                        BlockChecksum::datasetName(k_dataStr));
+      checksumData.addData(checksums.size(), &checksums[0]);
+    }
+    return true;
+  }
   // Write data if there is any
-  if (occupiedBlocks > 0) {
+  if (storedBlocks > 0) {
     // Threading state
-    ThreadingState<Data_T> state(data, blocks, numVoxels, numBlocks, 
-                                 isAllocated);
     // Number of threads
     const size_t numThreads = numIOThreads();
-    // Launch threads
+    // Threading state. Compression may run a few blocks per thread ahead
+    // of the writer
+    ThreadingState<Data_T> state(blocks, writeOrder, 
+                                 field->m_blockOrder, tileOrder, codec,
+                                 quantizeBits, summarize, 
+                                 checksums.empty() ? NULL : &checksums,
+                                 4 * numThreads);
+    // Launch compression threads. This thread does the writing
     boost::thread_group threads;
     for (size_t i = 0; i < numThreads; ++i) {
-      threads.create_thread(WriteBlockOp<Data_T>(state, i));
+      threads.create_thread(CompressBlockOp<Data_T>(state));
     }
+    const bool success = writeBlocks(state, data);
     threads.join_all();
+    if (!success) {
+      return false;
+    }
+  }
+
+  if (summarize) {
+    summarizer.write(layerGroup, isAllocated, k_blockSummaryStr);
+  }
+
+  if (!checksums.empty()) {
+    OgODataset<uint32_t> checksumData(layerGroup, 
+                                      BlockChecksum::datasetName(k_dataStr));
+    checksumData.addData(checksums.size(), &checksums[0]);
   }
 
   return true;
@@ -1129,6 +2064,207 @@ bool SparseFieldIO::writeInternal(OgOGroup &layerGroup,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void SparseFieldIO::writeAttributes(OgOGroup &layerGroup, const Box3i &ext, 
+                                    const Box3i &dw, const int blockOrder, 
+                                    const V3i &blockRes)
+{
+  const int      components = FieldTraits<Data_T>::dataDims();
+  const int      bits       = DataTypeTraits<Data_T>::h5bits();
+  const uint32_t numBlocks  = blockRes.x * blockRes.y * blockRes.z;
+
+  OgOAttribute<veci32_t> extMinAttr(layerGroup, k_extentsMinStr, ext.min);
+  OgOAttribute<veci32_t> extMaxAttr(layerGroup, k_extentsMaxStr, ext.max);
+  
+  OgOAttribute<veci32_t> dwMinAttr(layerGroup, k_dataWindowMinStr, dw.min);
+  OgOAttribute<veci32_t> dwMaxAttr(layerGroup, k_dataWindowMaxStr, dw.max);
+
+  OgOAttribute<uint8_t> componentsAttr(layerGroup, k_componentsStr, components);
+
+  OgOAttribute<uint8_t> bitsAttr(layerGroup, k_bitsPerComponentStr, bits);
+
+  OgOAttribute<uint8_t> blockOrderAttr(layerGroup, k_blockOrderStr, 
+                                       blockOrder);
+
+  OgOAttribute<uint32_t> numBlocksAttr(layerGroup, k_numBlocksStr, numBlocks);
+
+  OgOAttribute<veci32_t> blockResAttr(layerGroup, k_blockResStr, blockRes);
+
+  const bool isCompressed = sparseStorageMode() != SparseStorageMapped;
+
+  OgOAttribute<uint8_t> isCompressedAttr(layerGroup, k_isCompressed, 
+                                         isCompressed ? 1 : 0);
+
+  const int tileOrder = writeTileOrder(blockOrder);
+
+  if (tileOrder > 0) {
+    OgOAttribute<uint8_t> tileOrderAttr(layerGroup, k_tileOrderStr, 
+                                        tileOrder);
+  }
+
+  if (isCompressed) {
+    OgOAttribute<uint8_t> codecAttr(layerGroup, k_codecStr, sparseCodec());
+  }
+
+  const int quantizeBits = writeQuantizeBits();
+
+  if (quantizeBits > 0) {
+    OgOAttribute<uint8_t> quantizeBitsAttr(layerGroup, k_quantizeBitsStr, 
+                                           quantizeBits);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseFieldIO::writeStreamed
+(OgOGroup &layerGroup, const Box3i &extents, const Box3i &dataWindow, 
+ const int blockOrder,
+ const boost::function<bool (const V3i &, Data_T *, Data_T &)> &fillBlock)
+{
+  using namespace Exc;
+
+  if (dataWindow.isEmpty()) {
+    throw WriteLayerException("SparseFieldIO::writeStreamed() was given an "
+                              "empty data window");
+  }
+
+  // Add version attribute. Tiled or quantized blocks and codecs other 
+  // than zlib need a newer reader
+  const bool        isCompressed = sparseStorageMode() != SparseStorageMapped;
+  const int         tileOrder    = writeTileOrder(blockOrder);
+  const SparseCodec codec        = sparseCodec();
+  const int         quantizeBits = writeQuantizeBits();
+  int versionNumber = k_versionNumber;
+  if (tileOrder > 0) {
+    versionNumber = k_tiledVersionNumber;
+  } else if (quantizeBits > 0) {
+    versionNumber = k_quantizedVersionNumber;
+  } else if (isCompressed && codec != SparseCodecZlib) {
+    versionNumber = k_codecVersionNumber;
+  }
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, versionNumber);
+
+  // Same block layout as SparseField::setupBlocks()
+  const int    blockSize = 1 << blockOrder;
+  const V3i    res       = dataWindow.size() + V3i(1);
+  const V3i    blockRes  = (res + V3i(blockSize - 1)) / blockSize;
+  const size_t numBlocks = blockRes.x * blockRes.y * blockRes.z;
+  const size_t numVoxels = static_cast<size_t>(1) << (blockOrder * 3);
+
+  // Add attributes ---
+
+  writeAttributes<Data_T>(layerGroup, extents, dataWindow, blockOrder, 
+                          blockRes);
+
+  // Add data to file, one block at a time. Which blocks are allocated is 
+  // only known afterwards, so the per-block arrays follow the data. Blocks
+  // that hold a single value are written as constant tiles ---
+
+  std::vector<uint8_t> isAllocated(numBlocks);
+  std::vector<Data_T>  emptyValue(numBlocks);
+  std::vector<Data_T>  block(numVoxels);
+  uint32_t             occupiedBlocks = 0;
+  // Checksums of the compressed blocks, if wanted
+  std::vector<uint32_t> checksums;
+  // Summaries of the allocated blocks, unless they are quantized
+  std::vector<Data_T>  summaries;
+  const bool           summarize = 
+    sparseBlockSummaries() && quantizeBits == 0;
+
+  if (!isCompressed) {
+    const uint32_t alignment = writeBlockAlignment();
+    OgOAttribute<uint32_t> alignmentAttr(layerGroup, k_dataAlignmentStr, 
+                                         alignment);
+    OgODataset<Data_T> data(layerGroup, k_dataStr);
+    size_t b = 0;
+    for (int k = 0; k < blockRes.z; ++k) {
+      for (int j = 0; j < blockRes.y; ++j) {
+        for (int i = 0; i < blockRes.x; ++i, ++b) {
+          const V3i validSize = 
+            Sparse::validBlockSize(res, blockOrder, V3i(i, j, k));
+          emptyValue[b] = Data_T(0.0f);
+          isAllocated[b] = 
+            fillBlock(V3i(i, j, k), &block[0], emptyValue[b]) &&
+            !Sparse::isUniformBlock(&block[0], validSize, blockOrder, 
+                                    Sparse::BlockLayoutLinear, 
+                                    emptyValue[b]);
+          if (isAllocated[b] && summarize) {
+            summaries.resize(summaries.size() + 3);
+            summarizeBlock(&block[0], validSize, blockOrder, 
+                           Sparse::BlockLayoutLinear, 
+                           &summaries[summaries.size() - 3]);
+          }
+          if (isAllocated[b]) {
+            data.addAlignedData(numVoxels, &block[0], alignment);
+            occupiedBlocks++;
+          }
+        }
+      }
+    }
+  } else {
+    OgOCDataset<Data_T>     data(layerGroup, k_dataStr);
+    BlockCompressor<Data_T> compressor(blockOrder, tileOrder, codec, 
+                                       quantizeBits);
+    std::vector<uint8_t>    compressed;
+    size_t b = 0;
+    for (int k = 0; k < blockRes.z; ++k) {
+      for (int j = 0; j < blockRes.y; ++j) {
+        for (int i = 0; i < blockRes.x; ++i, ++b) {
+          const V3i validSize = 
+            Sparse::validBlockSize(res, blockOrder, V3i(i, j, k));
+          emptyValue[b] = Data_T(0.0f);
+          isAllocated[b] = 
+            fillBlock(V3i(i, j, k), &block[0], emptyValue[b]) &&
+            !Sparse::isUniformBlock(&block[0], validSize, blockOrder, 
+                                    Sparse::BlockLayoutLinear, 
+                                    emptyValue[b]);
+          if (isAllocated[b] && summarize) {
+            summaries.resize(summaries.size() + 3);
+            summarizeBlock(&block[0], validSize, blockOrder, 
+                           Sparse::BlockLayoutLinear, 
+                           &summaries[summaries.size() - 3]);
+          }
+          if (isAllocated[b]) {
+            if (!compressor.compress(&block[0], compressed)) {
+              return false;
+            }
+            data.addData(compressed.size(), &compressed[0]);
+            if (writeChecksums()) {
+              checksums.push_back(BlockChecksum::crc32c(&compressed[0], 
+                                                        compressed.size()));
+            }
+            occupiedBlocks++;
+          }
+        }
+      }
+    }
+  }
+
+  // Write the isAllocated, emptyValue and summary arrays
+  OgODataset<uint8_t> isAllocatedData(layerGroup, "block_is_allocated_data");
+  isAllocatedData.addData(numBlocks, &isAllocated[0]);
+  OgODataset<Data_T> emptyValueData(layerGroup, "block_empty_value_data");
+  emptyValueData.addData(numBlocks, &emptyValue[0]);
+  if (!summaries.empty()) {
+    OgODataset<Data_T> summaryData(layerGroup, k_blockSummaryStr);
+    summaryData.addData(summaries.size(), &summaries[0]);
+  }
+  if (!checksums.empty()) {
+    OgODataset<uint32_t> checksumData(layerGroup, 
+                                      BlockChecksum::datasetName(k_dataStr));
+    checksumData.addData(checksums.size(), &checksums[0]);
+  }
+
+  OgOAttribute<uint32_t> numOccupiedBlockAttr(layerGroup, 
+                                              k_numOccupiedBlocksStr, 
+                                              occupiedBlocks);
+
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 bool SparseFieldIO::readData(hid_t location, 
                              int numBlocks, 
@@ -1143,11 +2279,25 @@ bool SparseFieldIO::readData(hid_t location,
 
   int occupiedBlocks;
 
-  bool dynamicLoading = SparseFileManager::singleton().doLimitMemUse();
+  bool dynamicLoading = SparseFileManager::singleton().doLimitMemUse() ||
+    SparseFileManager::singleton().doLazyLoading();
 
   int components = FieldTraits<Data_T>::dataDims();
   int numVoxels = (1 << (result->m_blockOrder * 3));
   int valuesPerBlock = numVoxels * components;
+
+  // Blocks are read back in the layout they were written in ---
+
+  if (H5Aexists(location, k_blockLayoutStr.c_str()) > 0) {
+    int layout;
+    if (!readAttribute(location, k_blockLayoutStr, 1, layout)) 
+      throw MissingAttributeException("Couldn't find attribute: " +
+                                      k_blockLayoutStr);
+    if (layout < BlockLayoutLinear || layout > BlockLayoutMorton) 
+      throw UnsupportedVersionException("Unknown SparseField block layout: " +
+                                        lexical_cast<std::string>(layout));
+    result->setBlockLayout(static_cast<BlockLayout>(layout));
+  }
   
   // Read the number of occupied blocks ---
 
@@ -1239,6 +2389,102 @@ bool SparseFieldIO::readData(hid_t location,
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+std::vector<SparseFieldIO::PrecompressedBlocks::Ptr> 
+SparseFieldIO::precompress
+(const std::vector<typename SparseField<Data_T>::Ptr> &fields)
+{
+  typedef PrecompressOp<Data_T>    Op;
+  typedef typename Op::Task        Task;
+
+  // Uncompressed blocks are written as they are
+  if (sparseStorageMode() == SparseStorageMapped || fields.empty()) {
+    return std::vector<PrecompressedBlocksPtr>();
+  }
+
+  // Set up the results and list every allocated block of every field
+  std::vector<PrecompressedBlocksPtr> results(fields.size());
+  std::vector<Task> tasks;
+  for (size_t f = 0; f < fields.size(); ++f) {
+    results[f].reset(new PrecompressedBlocks);
+    results[f]->tileOrder = writeTileOrder(fields[f]->m_blockOrder);
+    results[f]->codec     = sparseCodec();
+    results[f]->quantizeBits = writeQuantizeBits();
+    // Only the blocks that writeInternal() writes as allocated
+    std::vector<uint8_t> isAllocated;
+    std::vector<Data_T>  emptyValue;
+    writtenBlocks(*fields[f], isAllocated, emptyValue);
+    for (size_t b = 0; b < isAllocated.size(); ++b) {
+      if (isAllocated[b]) {
+        Task task = { fields[f]->m_blocks[b].data, f, 
+                      results[f]->blocks.size() };
+        tasks.push_back(task);
+        results[f]->blocks.push_back(std::vector<uint8_t>());
+      }
+    }
+  }
+
+  // Compress all the blocks on a shared set of threads
+  boost::atomic<size_t> nextTask(0);
+  boost::atomic<bool>   failed(false);
+  runOnThreads(Op(fields, results, tasks, nextTask, failed), 
+               std::min(numIOThreads(), tasks.size()));
+
+  // On failure, writing compresses the blocks again as usual
+  if (failed) {
+    return std::vector<PrecompressedBlocksPtr>();
+  }
+
+  return results;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseFieldIO::writePrecompressed
+(OgOGroup &layerGroup, typename SparseField<Data_T>::Ptr field,
+ const PrecompressedBlocks &precompressed)
+{
+  SparseFieldIO io;
+  return io.writeInternal<Data_T>(layerGroup, field, &precompressed);
+}
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_PRECOMPRESS(type)                         \
+  template                                                              \
+  std::vector<SparseFieldIO::PrecompressedBlocks::Ptr>                  \
+  SparseFieldIO::precompress<type>                                      \
+  (const std::vector<SparseField<type>::Ptr> &fields);                  \
+  template                                                              \
+  bool SparseFieldIO::writePrecompressed<type>                          \
+  (OgOGroup &layerGroup, SparseField<type>::Ptr field,                  \
+   const PrecompressedBlocks &precompressed);                           \
+
+FIELD3D_INSTANTIATION_PRECOMPRESS(float16_t);
+FIELD3D_INSTANTIATION_PRECOMPRESS(float32_t);
+FIELD3D_INSTANTIATION_PRECOMPRESS(float64_t);
+FIELD3D_INSTANTIATION_PRECOMPRESS(vec16_t);
+FIELD3D_INSTANTIATION_PRECOMPRESS(vec32_t);
+FIELD3D_INSTANTIATION_PRECOMPRESS(vec64_t);
+
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_WRITESTREAMED(type)                       \
+  template                                                              \
+  bool SparseFieldIO::writeStreamed<type>                               \
+  (OgOGroup &, const Box3i &, const Box3i &, const int,                 \
+   const boost::function<bool (const V3i &, type *, type &)> &);        \
+
+FIELD3D_INSTANTIATION_WRITESTREAMED(float16_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(float32_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(float64_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec16_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec32_t);
+FIELD3D_INSTANTIATION_WRITESTREAMED(vec64_t);
+
+//----------------------------------------------------------------------------//
+
 FIELD3D_NAMESPACE_SOURCE_CLOSE
 
 //----------------------------------------------------------------------------//
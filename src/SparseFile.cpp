@@ -46,8 +46,25 @@
 // files
 #include "SparseField.h"
 
+#include <limits>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "InitIO.h"
 #include "OgIO.h"
 #include "OgSparseDataReader.h"
+#include "SharedBlocks.h"
+#include "Trace.h"
 
 //----------------------------------------------------------------------------//
 
@@ -87,87 +104,287 @@ bool SparseFileManager::doLimitMemUse() const
 
 //----------------------------------------------------------------------------//
 
+void SparseFileManager::setLazyLoading(bool enabled) 
+{
+  m_lazyLoading = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool SparseFileManager::doLazyLoading() const
+{ 
+  return m_lazyLoading; 
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::setShareBlocks(bool enabled) 
+{
+  m_shareBlocks = enabled;
+}
+
+//----------------------------------------------------------------------------//
+
+bool SparseFileManager::doShareBlocks() const
+{ 
+  return m_shareBlocks; 
+}
+
+//----------------------------------------------------------------------------//
+
 void SparseFileManager::setMaxMemUse(float maxMemUse) 
 {
   m_maxMemUse = maxMemUse;
   m_maxMemUseInBytes = static_cast<int64_t>(m_maxMemUse * 1024 * 1024);
+
+  // Split the budget evenly, so the global limit holds as long as each
+  // shard stays within its own part
+  const int64_t shardBytes = m_maxMemUseInBytes / F3D_CACHE_SHARD_COUNT;
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+    boost::mutex::scoped_lock lock(m_shards[s].mutex);
+    m_shards[s].maxMemUseInBytes = shardBytes;
+  }
 }
 
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-int64_t SparseFileManager::deallocateBlock(const SparseFile::CacheBlock &cb)
+int64_t 
+SparseFileManager::deallocateBlock(SparseFile::CacheShard &shard,
+                                   const SparseFile::CacheBlock &cb)
 {
   int64_t bytesFreed = 0;
   SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(cb.refIdx);
 
   // Note: we don't need to lock the block's mutex because
-  // deallocateBlock() is only called while the SparseFileManager's
+  // deallocateBlock() is only called while the shard's
   // mutex is also locked (in flushCache() or deallocateBlocks()).
   // Don't lock the block, to make sure we don't have a deadlock by
   // holding two locks at the same time.  (Because addBlockToCache()
-  // locks the manager but is also in a block-specific lock.)
+  // locks the shard but is also in a block-specific lock.)
 
-  // lock the current block to make sure its blockUsed flag and ref
-  // counts don't change
-  // Note: this lock order is made consistent w/ allocate to prevent
-  // deadlocks and crashes.
-
-#if F3D_SHORT_MUTEX_ARRAY
-  boost::mutex::scoped_lock 
-    lock_B(reference->blockMutex[cb.blockIdx % reference->blockMutexSize]);
-#else
-  boost::mutex::scoped_lock lock_B(reference->blockMutex[cb.blockIdx]);
-#endif
-  
-  // check whether the block is still in use
-  if (reference->refCounts[cb.blockIdx] > 0)
+  // Claim the block so that its ref count can't change until we're
+  // done. This fails if the block is still in use.
+  if (!reference->beginEviction(cb.blockIdx))
     return bytesFreed;
 
-  if (reference->blockUsed[cb.blockIdx]) {
+  if (reference->blockUsed[cb.blockIdx].load(boost::memory_order_relaxed)) {
     // the block was recently used according to Second-chance paging
     // algorithm, so skip it
-    reference->blockUsed[cb.blockIdx] = false;
+    reference->blockUsed[cb.blockIdx].store(false, 
+                                            boost::memory_order_relaxed);
   }
   else {
 
     // the block wasn't in use, so free it
     reference->unloadBlock(cb.blockIdx);
     bytesFreed = reference->blockSize(cb.blockIdx);
-    m_memUse -= bytesFreed;
-    CacheList::iterator toRemove = m_nextBlock;
-    ++m_nextBlock;
-    m_blockCacheList.erase(toRemove);
+    shard.memUse -= bytesFreed;
+    shard.stats[m_policy].evictions++;
+    shard.stats[m_policy].bytesEvicted += bytesFreed;
+    Stats::add(Stats::BlocksEvicted);
+    Trace::addInstant("evictBlock", cb.blockIdx);
+    CacheList::iterator toRemove = shard.nextBlock;
+    ++shard.nextBlock;
+    shard.blockCacheList.erase(toRemove);
   }
+  reference->endEviction(cb.blockIdx);
   return bytesFreed;
 }
 
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-void SparseFileManager::deallocateBlock(CacheList::iterator &it)
+void SparseFileManager::deallocateBlock(SparseFile::CacheShard &shard,
+                                        CacheList::iterator &it)
 {
   SparseFile::CacheBlock &cb = *it;
   SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(cb.refIdx);
   int64_t bytesFreed = reference->blockSize(cb.blockIdx);
-  m_memUse -= bytesFreed;
+  shard.memUse -= bytesFreed;
   reference->unloadBlock(cb.blockIdx);
-  it = m_blockCacheList.erase(it);
+  it = shard.blockCacheList.erase(it);
 }
 
 //----------------------------------------------------------------------------//
 
-void SparseFileManager::deallocateBlocks(int64_t bytesNeeded)
+template <class Data_T>
+int64_t 
+SparseFileManager::unloadCachedBlock(SparseFile::CacheShard &shard,
+                                     const SparseFile::CacheBlock &cb,
+                                     bool force)
 {
-  boost::mutex::scoped_lock lock_A(m_mutex);
+  SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(cb.refIdx);
+
+  // Forced unloads ignore the ref counts, like flushCache() does
+  if (!force && !reference->beginEviction(cb.blockIdx)) {
+    return 0;
+  }
+
+  reference->unloadBlock(cb.blockIdx);
+  reference->blockUsed[cb.blockIdx].store(false, boost::memory_order_relaxed);
+  const int64_t bytesFreed = reference->blockSize(cb.blockIdx);
+  shard.memUse -= bytesFreed;
+  if (!force) {
+    shard.stats[m_policy].evictions++;
+    shard.stats[m_policy].bytesEvicted += bytesFreed;
+    Stats::add(Stats::BlocksEvicted);
+    Trace::addInstant("evictBlock", cb.blockIdx);
+    reference->endEviction(cb.blockIdx);
+  }
+  return bytesFreed;
+}
+
+//----------------------------------------------------------------------------//
+
+int64_t SparseFileManager::unloadCachedBlock(SparseFile::CacheShard &shard,
+                                             const SparseFile::CacheBlock &cb,
+                                             bool force)
+{
+  switch(cb.blockType) {
+  case DataTypeHalf:
+    return unloadCachedBlock<half>(shard, cb, force);
+  case DataTypeFloat:
+    return unloadCachedBlock<float>(shard, cb, force);
+  case DataTypeDouble:
+    return unloadCachedBlock<double>(shard, cb, force);
+  case DataTypeVecHalf:
+    return unloadCachedBlock<V3h>(shard, cb, force);
+  case DataTypeVecFloat:
+    return unloadCachedBlock<V3f>(shard, cb, force);
+  case DataTypeVecDouble:
+    return unloadCachedBlock<V3d>(shard, cb, force);
+  case DataTypeUnknown:
+  default:
+    return 0;
+  }
+}
 
-  while (m_blockCacheList.begin() != m_blockCacheList.end() &&
-         m_maxMemUseInBytes-m_memUse < bytesNeeded) {
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void SparseFileManager::blockState(const SparseFile::CacheBlock &cb, 
+                                   int64_t &lastUsed, float &loadCost, 
+                                   int &size, int &priority)
+{
+  SparseFile::Reference<Data_T> *reference = m_fileData.ref<Data_T>(cb.refIdx);
+  lastUsed = reference->lastUsed[cb.blockIdx].load(boost::memory_order_relaxed);
+  loadCost = reference->loadCost[cb.blockIdx];
+  size = reference->blockSize(cb.blockIdx);
+  priority = reference->cachePriority;
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::blockState(const SparseFile::CacheBlock &cb, 
+                                   int64_t &lastUsed, float &loadCost, 
+                                   int &size, int &priority)
+{
+  lastUsed = 0;
+  loadCost = 0.0f;
+  size = 0;
+  priority = 0;
+
+  switch(cb.blockType) {
+  case DataTypeHalf:
+    blockState<half>(cb, lastUsed, loadCost, size, priority);
+    break;
+  case DataTypeFloat:
+    blockState<float>(cb, lastUsed, loadCost, size, priority);
+    break;
+  case DataTypeDouble:
+    blockState<double>(cb, lastUsed, loadCost, size, priority);
+    break;
+  case DataTypeVecHalf:
+    blockState<V3h>(cb, lastUsed, loadCost, size, priority);
+    break;
+  case DataTypeVecFloat:
+    blockState<V3f>(cb, lastUsed, loadCost, size, priority);
+    break;
+  case DataTypeVecDouble:
+    blockState<V3d>(cb, lastUsed, loadCost, size, priority);
+    break;
+  case DataTypeUnknown:
+  default:
+    break;
+  }
+}
 
-    if (m_nextBlock == m_blockCacheList.end())
-      m_nextBlock = m_blockCacheList.begin();
+//----------------------------------------------------------------------------//
+
+double SparseFileManager::costPriority(const SparseFile::CacheShard &shard,
+                                       float loadCost, int size)
+{
+  // GreedyDual-Size: H = L + cost / size, where L is the priority of the
+  // last evicted block. Aging through L lets blocks that were expensive
+  // once, but are no longer used, eventually leave the cache.
+  return shard.inflation + 
+    static_cast<double>(loadCost) / static_cast<double>(std::max(size, 1));
+}
+
+//----------------------------------------------------------------------------//
 
-    SparseFile::CacheBlock &cb = *m_nextBlock;
+void SparseFileManager::deallocateBlocks(SparseFile::CacheShard &shard,
+                                         int64_t bytesNeeded)
+{
+  boost::mutex::scoped_lock lock_A(shard.mutex);
+
+  if (m_policy == SparseFile::CachePolicyClock) {
+    deallocateBlocksClock(shard, bytesNeeded);
+  } else {
+    deallocateBlocksQueued(shard, bytesNeeded);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::deallocateBlocksClock(SparseFile::CacheShard &shard,
+                                              int64_t bytesNeeded)
+{
+  // Only blocks of at most this priority are considered. It's raised to 
+  // the next priority seen once nothing more can be freed at the current one
+  int maxPriority = 0;
+  int nextPriority = std::numeric_limits<int>::max();
+  // Number of times the clock hand wrapped around since the last block was
+  // freed. Two whole turns clear every used flag, so if nothing could be 
+  // freed by then, everything left at this priority is in use
+  int numTurns = 0;
+  // Whether the current turn passed any block of at most maxPriority
+  bool candidates = false;
+
+  while (shard.blockCacheList.begin() != shard.blockCacheList.end() &&
+         shard.maxMemUseInBytes - shard.memUse < bytesNeeded) {
+
+    if (shard.nextBlock == shard.blockCacheList.end()) {
+      shard.nextBlock = shard.blockCacheList.begin();
+      ++numTurns;
+      // The first turn may have started anywhere in the list, so only 
+      // skip the remaining turns once a whole one found no candidates
+      if (numTurns > 2 || (numTurns > 1 && !candidates)) {
+        if (nextPriority == std::numeric_limits<int>::max()) {
+          break;
+        }
+        maxPriority = nextPriority;
+        nextPriority = std::numeric_limits<int>::max();
+        numTurns = 0;
+      }
+      candidates = false;
+    }
+
+    SparseFile::CacheBlock &cb = *shard.nextBlock;
+
+    int64_t lastUsed;
+    float loadCost;
+    int size, priority;
+    blockState(cb, lastUsed, loadCost, size, priority);
+    if (priority > maxPriority) {
+      // Left alone, including its used flag, until the lower priorities
+      // are exhausted
+      nextPriority = std::min(nextPriority, priority);
+      ++shard.nextBlock;
+      continue;
+    }
+    candidates = true;
 
     // if bytesFreed is set to >0, then we've already freed a block
     // and advanced the "clock hand" iterator
@@ -175,38 +392,44 @@ void SparseFileManager::deallocateBlocks(int64_t bytesNeeded)
 
     switch(cb.blockType) {
     case DataTypeHalf:
-      bytesFreed = deallocateBlock<half>(cb);
+      bytesFreed = deallocateBlock<half>(shard, cb);
       if (bytesFreed > 0) {
+        numTurns = 0;
         continue;
       }
       break;
     case DataTypeFloat:
-      bytesFreed = deallocateBlock<float>(cb);
+      bytesFreed = deallocateBlock<float>(shard, cb);
       if (bytesFreed > 0) {
+        numTurns = 0;
         continue;
       }
       break;
     case DataTypeDouble:
-      bytesFreed = deallocateBlock<double>(cb);
+      bytesFreed = deallocateBlock<double>(shard, cb);
       if (bytesFreed > 0) {
+        numTurns = 0;
         continue;
       }
       break;
     case DataTypeVecHalf:
-      bytesFreed = deallocateBlock<V3h>(cb);
+      bytesFreed = deallocateBlock<V3h>(shard, cb);
       if (bytesFreed > 0) {
+        numTurns = 0;
         continue;
       }
       break;
     case DataTypeVecFloat:
-      bytesFreed = deallocateBlock<V3f>(cb);
+      bytesFreed = deallocateBlock<V3f>(shard, cb);
       if (bytesFreed > 0) {
+        numTurns = 0;
         continue;
       }
       break;
     case DataTypeVecDouble:
-      bytesFreed = deallocateBlock<V3d>(cb);
+      bytesFreed = deallocateBlock<V3d>(shard, cb);
       if (bytesFreed > 0) {
+        numTurns = 0;
         continue;
       }
       break;
@@ -214,77 +437,453 @@ void SparseFileManager::deallocateBlocks(int64_t bytesNeeded)
     default:
       break;
     }
-    ++m_nextBlock;
+    ++shard.nextBlock;
   }
 }
 
 //----------------------------------------------------------------------------//
 
-void SparseFileManager::flushCache()
+void SparseFileManager::deallocateBlocksQueued(SparseFile::CacheShard &shard,
+                                               int64_t bytesNeeded)
 {
-  boost::mutex::scoped_lock lock(m_mutex);
+  // Only blocks of at most this priority are considered, see 
+  // deallocateBlocksClock()
+  int maxPriority = 0;
+
+  while (shard.memUse > 0 && 
+         shard.maxMemUseInBytes - shard.memUse < bytesNeeded) {
+    int nextPriority = std::numeric_limits<int>::max();
+    bool evicted = false;
+    if (m_policy == SparseFile::CachePolicy2Q) {
+      // Evict from probation while it holds more than a quarter of the
+      // budget, otherwise from the main queue
+      const int first = 
+        (shard.queues[1].empty() || 
+         shard.probationMemUse > shard.maxMemUseInBytes / 4) ? 0 : 1;
+      evicted = evictFromQueue(shard, first, maxPriority, nextPriority) || 
+        evictFromQueue(shard, 1 - first, maxPriority, nextPriority);
+    } else {
+      evicted = evictFromQueue(shard, 0, maxPriority, nextPriority);
+    }
+    if (!evicted) {
+      if (nextPriority == std::numeric_limits<int>::max()) {
+        // Everything left is in use
+        break;
+      }
+      maxPriority = nextPriority;
+    }
+  }
+}
 
-  CacheList::iterator it = m_blockCacheList.begin();
-  while (it != m_blockCacheList.end()) {
-    SparseFile::CacheBlock &cb = *it;
+//----------------------------------------------------------------------------//
 
-    switch(cb.blockType) {
-    case DataTypeHalf:
-      deallocateBlock<half>(it);
-      break;
-    case DataTypeFloat:
-      deallocateBlock<float>(it);
-      break;
-    case DataTypeDouble:
-      deallocateBlock<double>(it);
-      break;
-    case DataTypeVecHalf:
-      deallocateBlock<V3h>(it);
-      break;
-    case DataTypeVecFloat:
-      deallocateBlock<V3f>(it);
-      break;
-    case DataTypeVecDouble:
-      deallocateBlock<V3d>(it);
-      break;
-    case DataTypeUnknown:
-    default:
-      break;
+bool SparseFileManager::evictFromQueue(SparseFile::CacheShard &shard,
+                                       int queueIdx, int maxPriority, 
+                                       int &nextPriority)
+{
+  using namespace SparseFile;
+
+  CacheQueue &queue = shard.queues[queueIdx];
+  CacheQueue::iterator it = queue.begin();
+
+  while (it != queue.end()) {
+
+    CacheBlock cb = it->second;
+    int64_t lastUsed;
+    float loadCost;
+    int size, priority;
+    blockState(cb, lastUsed, loadCost, size, priority);
+
+    if (priority > maxPriority) {
+      nextPriority = std::min(nextPriority, priority);
+      ++it;
+      continue;
+    }
+
+    if (lastUsed > cb.stamp) {
+      // Touched since it was queued. Requeue it according to the policy
+      // and keep looking. Since the stamp is brought up to date, the
+      // block is evictable the next time around.
+      queue.erase(it++);
+      cb.stamp = lastUsed;
+      if (m_policy == CachePolicy2Q && queueIdx == 0) {
+        // Promote from probation to the main queue
+        shard.probationMemUse -= size;
+        shard.queues[1].insert(std::make_pair(static_cast<double>(cb.stamp), 
+                                              cb));
+      } else if (m_policy == CachePolicyCostAware) {
+        queue.insert(std::make_pair(costPriority(shard, loadCost, size), cb));
+      } else {
+        queue.insert(std::make_pair(static_cast<double>(cb.stamp), cb));
+      }
+      continue;
+    }
+
+    const int64_t bytesFreed = unloadCachedBlock(shard, cb, false);
+    if (bytesFreed == 0) {
+      // Still in use
+      ++it;
+      continue;
+    }
+
+    if (m_policy == CachePolicyCostAware) {
+      shard.inflation = it->first;
     }
+    queue.erase(it);
+
+    if (m_policy == CachePolicy2Q && queueIdx == 0) {
+      shard.probationMemUse -= bytesFreed;
+      // Remember the block, so that it goes straight to the main queue if
+      // it's reloaded soon. Keep as many ghosts as half the blocks held.
+      shard.ghostList.push_back(cb);
+      shard.ghostIndex[cb] = --shard.ghostList.end();
+      const size_t maxGhosts = 
+        std::max(static_cast<size_t>(1), 
+                 (shard.queues[0].size() + shard.queues[1].size()) / 2);
+      while (shard.ghostList.size() > maxGhosts) {
+        shard.ghostIndex.erase(shard.ghostList.front());
+        shard.ghostList.pop_front();
+      }
+    }
+    return true;
   }
-  m_nextBlock = m_blockCacheList.begin();
+
+  return false;
 }
 
 //----------------------------------------------------------------------------//
 
-void SparseFileManager::addBlockToCache(DataTypeEnum blockType,
+void SparseFileManager::flushQueue(SparseFile::CacheShard &shard, 
+                                   SparseFile::CacheQueue &queue)
+{
+  SparseFile::CacheQueue::iterator it = queue.begin();
+  for (; it != queue.end(); ++it) {
+    unloadCachedBlock(shard, it->second, true);
+  }
+  queue.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::flushCache()
+{
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+
+    SparseFile::CacheShard &shard = m_shards[s];
+    boost::mutex::scoped_lock lock(shard.mutex);
+
+    CacheList::iterator it = shard.blockCacheList.begin();
+    while (it != shard.blockCacheList.end()) {
+      SparseFile::CacheBlock &cb = *it;
+
+      switch(cb.blockType) {
+      case DataTypeHalf:
+        deallocateBlock<half>(shard, it);
+        break;
+      case DataTypeFloat:
+        deallocateBlock<float>(shard, it);
+        break;
+      case DataTypeDouble:
+        deallocateBlock<double>(shard, it);
+        break;
+      case DataTypeVecHalf:
+        deallocateBlock<V3h>(shard, it);
+        break;
+      case DataTypeVecFloat:
+        deallocateBlock<V3f>(shard, it);
+        break;
+      case DataTypeVecDouble:
+        deallocateBlock<V3d>(shard, it);
+        break;
+      case DataTypeUnknown:
+      default:
+        break;
+      }
+    }
+    shard.nextBlock = shard.blockCacheList.begin();
+
+    flushQueue(shard, shard.queues[0]);
+    flushQueue(shard, shard.queues[1]);
+    shard.ghostList.clear();
+    shard.ghostIndex.clear();
+    shard.probationMemUse = 0;
+    shard.inflation = 0.0;
+  }
+
+  // Hand the memory of the flushed blocks back to the system
+  Sparse::SparseBlockPool<half>::trim();
+  Sparse::SparseBlockPool<float>::trim();
+  Sparse::SparseBlockPool<double>::trim();
+  Sparse::SparseBlockPool<V3h>::trim();
+  Sparse::SparseBlockPool<V3f>::trim();
+  Sparse::SparseBlockPool<V3d>::trim();
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::addBlockToCache(SparseFile::CacheShard &shard,
+                                        DataTypeEnum blockType,
                                         int fileId, int blockIdx)
 {
-  // Note: this lock is obtained while we also have a lock on the
-  // specific block (in activateBlock()), so we should make sure we
-  // never lock the SparseFileManager and *then* a block, to ensure we
-  // don't have a deadlock.
-  //
-  //  Note: this was changed so the order was consistent w/ dealloc
-  //  again, see activateBlock()
-  //  boost::mutex::scoped_lock lock(m_mutex);
+  // Note: the shard's lock is obtained by activateBlock() before the
+  // lock on the specific block, consistent w/ dealloc, so we don't
+  // lock anything here.
 
   SparseFile::CacheBlock block(blockType, fileId, blockIdx);
-  if (m_nextBlock == m_blockCacheList.end()) {
-    m_blockCacheList.push_back(block);
-  } else {
-    m_blockCacheList.insert(m_nextBlock, block);
+  block.stamp = shard.tick.load(boost::memory_order_relaxed);
+  queueBlock(shard, block);
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::queueBlock(SparseFile::CacheShard &shard,
+                                   SparseFile::CacheBlock cb)
+{
+  using namespace SparseFile;
+
+  switch (m_policy) {
+  case CachePolicyLRU:
+    shard.queues[0].insert(std::make_pair(static_cast<double>(cb.stamp), cb));
+    break;
+  case CachePolicy2Q:
+    {
+      std::map<CacheBlock, CacheList::iterator>::iterator ghost = 
+        shard.ghostIndex.find(cb);
+      if (ghost != shard.ghostIndex.end()) {
+        // Evicted from probation recently, so this is a re-reference
+        shard.ghostList.erase(ghost->second);
+        shard.ghostIndex.erase(ghost);
+        shard.queues[1].insert(std::make_pair(static_cast<double>(cb.stamp), 
+                                              cb));
+      } else {
+        int64_t lastUsed;
+        float loadCost;
+        int size, priority;
+        blockState(cb, lastUsed, loadCost, size, priority);
+        shard.queues[0].insert(std::make_pair(static_cast<double>(cb.stamp), 
+                                              cb));
+        shard.probationMemUse += size;
+      }
+    }
+    break;
+  case CachePolicyCostAware:
+    {
+      int64_t lastUsed;
+      float loadCost;
+      int size, priority;
+      blockState(cb, lastUsed, loadCost, size, priority);
+      shard.queues[0].insert(std::make_pair(costPriority(shard, loadCost, size), 
+                                            cb));
+    }
+    break;
+  case CachePolicyClock:
+  default:
+    if (shard.nextBlock == shard.blockCacheList.end()) {
+      shard.blockCacheList.push_back(cb);
+    } else {
+      shard.blockCacheList.insert(shard.nextBlock, cb);
+    }
+    break;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::setCachePolicy(SparseFile::CachePolicyEnum policy)
+{
+  using namespace SparseFile;
+
+  if (policy < 0 || policy >= CachePolicyNumPolicies) {
+    Msg::print(Msg::SevWarning, "SparseFileManager::setCachePolicy(): "
+               "Invalid cache policy. Ignoring.");
+    return;
+  }
+
+  // Lock every shard, in order, so that no block gets queued under the
+  // old policy while we're moving things over
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+    m_shards[s].mutex.lock();
+  }
+
+  if (policy != m_policy) {
+    m_policy = policy;
+    for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+      CacheShard &shard = m_shards[s];
+      // Gather the resident blocks from the old policy's containers
+      std::vector<CacheBlock> blocks(shard.blockCacheList.begin(), 
+                                     shard.blockCacheList.end());
+      for (int q = 0; q < 2; ++q) {
+        CacheQueue::const_iterator it = shard.queues[q].begin();
+        for (; it != shard.queues[q].end(); ++it) {
+          blocks.push_back(it->second);
+        }
+        shard.queues[q].clear();
+      }
+      shard.blockCacheList.clear();
+      shard.nextBlock = shard.blockCacheList.begin();
+      shard.ghostList.clear();
+      shard.ghostIndex.clear();
+      shard.probationMemUse = 0;
+      shard.inflation = 0.0;
+      // And hand them to the new one
+      for (size_t i = 0, end = blocks.size(); i < end; ++i) {
+        blocks[i].stamp = shard.tick.load(boost::memory_order_relaxed);
+        queueBlock(shard, blocks[i]);
+      }
+    }
+  }
+
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+    m_shards[s].mutex.unlock();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+SparseFile::CachePolicyEnum SparseFileManager::cachePolicy() const
+{
+  return m_policy;
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::startPrefetchThreads()
+{
+  if (m_prefetchStarted) {
+    return;
+  }
+
+  const size_t numThreads = std::max(numIOThreads(), static_cast<size_t>(1));
+  for (size_t i = 0; i < numThreads; ++i) {
+    m_prefetchThreads.create_thread(
+      boost::bind(&SparseFileManager::prefetchLoop, this));
+  }
+  m_prefetchStarted = true;
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::prefetchLoop()
+{
+  // The threads live as long as the singleton, which is never destroyed
+  while (true) {
+
+    boost::mutex::scoped_lock lock(m_prefetchMutex);
+    while (m_prefetchQueue.empty()) {
+      m_prefetchQueued.wait(lock);
+    }
+    const SparseFile::PrefetchRequest request = m_prefetchQueue.front();
+    m_prefetchQueue.pop_front();
+    m_prefetchActive.push_back(request.block);
+    lock.unlock();
+
+    try {
+      prefetch(request.block);
+    }
+    catch (std::exception &e) {
+      static Msg::RateLimit limit;
+      Msg::print(limit, Msg::SevWarning, "SparseFileManager::prefetchLoop(): "
+                 "Couldn't load block: " + std::string(e.what()));
+    }
+
+    lock.lock();
+    for (size_t i = 0, end = m_prefetchActive.size(); i < end; ++i) {
+      const SparseFile::CacheBlock &cb = m_prefetchActive[i];
+      if (cb.blockType == request.block.blockType && 
+          cb.refIdx == request.block.refIdx &&
+          cb.blockIdx == request.block.blockIdx) {
+        m_prefetchActive.erase(m_prefetchActive.begin() + i);
+        break;
+      }
+    }
+    m_prefetchBytes -= request.size;
+    m_prefetchDone.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::prefetch(const SparseFile::CacheBlock &cb)
+{
+  switch(cb.blockType) {
+  case DataTypeHalf:
+    activateBlock<half>(cb.refIdx, cb.blockIdx);
+    break;
+  case DataTypeFloat:
+    activateBlock<float>(cb.refIdx, cb.blockIdx);
+    break;
+  case DataTypeDouble:
+    activateBlock<double>(cb.refIdx, cb.blockIdx);
+    break;
+  case DataTypeVecHalf:
+    activateBlock<V3h>(cb.refIdx, cb.blockIdx);
+    break;
+  case DataTypeVecFloat:
+    activateBlock<V3f>(cb.refIdx, cb.blockIdx);
+    break;
+  case DataTypeVecDouble:
+    activateBlock<V3d>(cb.refIdx, cb.blockIdx);
+    break;
+  case DataTypeUnknown:
+  default:
+    break;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::cancelPrefetch(DataTypeEnum blockType, int refIdx)
+{
+  boost::mutex::scoped_lock lock(m_prefetchMutex);
+
+  std::deque<SparseFile::PrefetchRequest>::iterator it = 
+    m_prefetchQueue.begin();
+  while (it != m_prefetchQueue.end()) {
+    if (it->block.blockType == blockType && it->block.refIdx == refIdx) {
+      m_prefetchBytes -= it->size;
+      it = m_prefetchQueue.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  bool isActive = true;
+  while (isActive) {
+    isActive = false;
+    for (size_t i = 0, end = m_prefetchActive.size(); i < end; ++i) {
+      if (m_prefetchActive[i].blockType == blockType && 
+          m_prefetchActive[i].refIdx == refIdx) {
+        isActive = true;
+        break;
+      }
+    }
+    if (isActive) {
+      m_prefetchDone.wait(lock);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void SparseFileManager::waitForPrefetch()
+{
+  boost::mutex::scoped_lock lock(m_prefetchMutex);
+
+  while (!m_prefetchQueue.empty() || !m_prefetchActive.empty()) {
+    m_prefetchDone.wait(lock);
   }
 }
 
 //----------------------------------------------------------------------------//
 
 SparseFileManager::SparseFileManager()
-  : m_memUse(0),
-    m_limitMemUse(false)
+  : m_limitMemUse(false), m_lazyLoading(false), m_shareBlocks(false), 
+    m_policy(SparseFile::CachePolicyClock),
+    m_prefetchBytes(0), m_prefetchStarted(false)
 {
   setMaxMemUse(1000.0);
-  m_nextBlock = m_blockCacheList.begin();
+  MemoryBudget::singleton().registerClient(
+    this, MemoryBudget::k_prioritySparseBlocks);
 }
 
 //----------------------------------------------------------------------------//
@@ -409,6 +1008,33 @@ float SparseFileManager::cacheEfficiency()
 
 //----------------------------------------------------------------------------//
 
+float 
+SparseFileManager::cacheEfficiency(SparseFile::CachePolicyEnum policy) const
+{
+  return cacheStatistics(policy).efficiency();
+}
+
+//----------------------------------------------------------------------------//
+
+SparseFile::CacheStats 
+SparseFileManager::cacheStatistics(SparseFile::CachePolicyEnum policy) const
+{
+  SparseFile::CacheStats stats;
+
+  if (policy < 0 || policy >= SparseFile::CachePolicyNumPolicies) {
+    return stats;
+  }
+
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+    boost::mutex::scoped_lock lock(m_shards[s].mutex);
+    stats += m_shards[s].stats[policy];
+  }
+
+  return stats;
+}
+
+//----------------------------------------------------------------------------//
+
 void SparseFileManager::resetCacheStatistics()
 {
 
@@ -435,6 +1061,50 @@ void SparseFileManager::resetCacheStatistics()
   for (size_t i=0; i<m_fileData.numRefs<V3d>(); i++) {
     m_fileData.ref<V3d>(i)->resetCacheStatistics();
   }
+
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+    boost::mutex::scoped_lock lock(m_shards[s].mutex);
+    for (int p = 0; p < SparseFile::CachePolicyNumPolicies; ++p) {
+      m_shards[s].stats[p] = SparseFile::CacheStats();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+long long int SparseFileManager::budgetMemUse() const
+{
+  long long int memUse = 0;
+  for (size_t i = 0; i < F3D_CACHE_SHARD_COUNT; ++i) {
+    boost::mutex::scoped_lock lock(m_shards[i].mutex);
+    memUse += m_shards[i].memUse;
+  }
+  return memUse;
+}
+
+//----------------------------------------------------------------------------//
+
+long long int SparseFileManager::budgetRelease(const long long int bytes)
+{
+  long long int released = 0;
+
+  for (size_t i = 0; i < F3D_CACHE_SHARD_COUNT && released < bytes; ++i) {
+    SparseFile::CacheShard &shard = m_shards[i];
+    boost::mutex::scoped_lock lock(shard.mutex);
+    const int64_t before = shard.memUse;
+    // deallocateBlocks*() free until bytesNeeded fit under the shard's 
+    // own budget, so ask for the remainder on top of its current free space
+    const int64_t bytesNeeded = 
+      shard.maxMemUseInBytes - shard.memUse + (bytes - released);
+    if (m_policy == SparseFile::CachePolicyClock) {
+      deallocateBlocksClock(shard, bytesNeeded);
+    } else {
+      deallocateBlocksQueued(shard, bytesNeeded);
+    }
+    released += before - shard.memUse;
+  }
+
+  return released;
 }
 
 //----------------------------------------------------------------------------//
@@ -443,8 +1113,49 @@ long long int SparseFileManager::memSize() const
 {
   boost::mutex::scoped_lock lock(m_mutex);
 
-  return sizeof(*this) + m_fileData.memSize() + 
-    m_blockCacheList.size() * sizeof(SparseFile::CacheBlock);
+  long long int size = sizeof(*this) + m_fileData.memSize();
+
+  for (size_t s = 0; s < F3D_CACHE_SHARD_COUNT; ++s) {
+    boost::mutex::scoped_lock lock_S(m_shards[s].mutex);
+    const SparseFile::CacheShard &shard = m_shards[s];
+    size += (shard.blockCacheList.size() + shard.ghostList.size()) * 
+      sizeof(SparseFile::CacheBlock);
+    size += (shard.queues[0].size() + shard.queues[1].size()) * 
+      sizeof(SparseFile::CacheQueue::value_type);
+    size += shard.ghostIndex.size() * 
+      (sizeof(SparseFile::CacheBlock) + sizeof(SparseFile::CacheList::iterator));
+  }
+
+  // Block data is counted by the fields, the pool's spare capacity here
+  size += blockPoolReservedBytes() - blockPoolUsedBytes();
+
+  return size;
+}
+
+//----------------------------------------------------------------------------//
+
+long long int SparseFileManager::blockPoolReservedBytes() const
+{
+  return 
+    Sparse::SparseBlockPool<half>::reservedBytes() + 
+    Sparse::SparseBlockPool<float>::reservedBytes() + 
+    Sparse::SparseBlockPool<double>::reservedBytes() + 
+    Sparse::SparseBlockPool<V3h>::reservedBytes() + 
+    Sparse::SparseBlockPool<V3f>::reservedBytes() + 
+    Sparse::SparseBlockPool<V3d>::reservedBytes();
+}
+
+//----------------------------------------------------------------------------//
+
+long long int SparseFileManager::blockPoolUsedBytes() const
+{
+  return 
+    Sparse::SparseBlockPool<half>::usedBytes() + 
+    Sparse::SparseBlockPool<float>::usedBytes() + 
+    Sparse::SparseBlockPool<double>::usedBytes() + 
+    Sparse::SparseBlockPool<V3h>::usedBytes() + 
+    Sparse::SparseBlockPool<V3f>::usedBytes() + 
+    Sparse::SparseBlockPool<V3d>::usedBytes();
 }
 
 //----------------------------------------------------------------------------//
@@ -464,24 +1175,7 @@ long long int SparseFile::FileReferences::memSize() const
   size += m_vdRefs.size() * sizeof(Reference<V3d>::Ptr);
 
   // Size of the references themselves
-  for (size_t i = 0, end = m_hRefs.size(); i < end; ++i) {
-    size += m_hRefs[i]->memSize();
-  }
-  for (size_t i = 0, end = m_vhRefs.size(); i < end; ++i) {
-    size += m_vhRefs[i]->memSize();
-  }
-  for (size_t i = 0, end = m_fRefs.size(); i < end; ++i) {
-    size += m_fRefs[i]->memSize();
-  }
-  for (size_t i = 0, end = m_vfRefs.size(); i < end; ++i) {
-    size += m_vfRefs[i]->memSize();
-  }
-  for (size_t i = 0, end = m_dRefs.size(); i < end; ++i) {
-    size += m_dRefs[i]->memSize();
-  }
-  for (size_t i = 0, end = m_vdRefs.size(); i < end; ++i) {
-    size += m_vdRefs[i]->memSize();
-  }
+  size += m_refsMemSize.load(boost::memory_order_relaxed);
   
   return size;
 }
@@ -495,44 +1189,186 @@ namespace SparseFile {
 //----------------------------------------------------------------------------//
 
 template <class Data_T>
-void Reference<Data_T>::loadBlock(int blockIdx)
+void Reference<Data_T>::loadBlock(int blockIdx, uint64_t tiles)
 {
   boost::mutex::scoped_lock lock(m_mutex);
 
-  // Allocate the block
 #if F3D_NO_BLOCKS_ARRAY
-  blocks[blockIdx].resize(numVoxels);
-  assert(blocks[blockIdx].data != NULL);
-  // Read the data
+  Sparse::SparseBlock<Data_T> &block = blocks[blockIdx];
+#else
+  Sparse::SparseBlock<Data_T> &block = *blocks[blockIdx];
+#endif
+
   assert(m_reader || m_ogReader);
-  if (m_reader) {
-    m_reader->readBlock(fileBlockIndices[blockIdx], *blocks[blockIdx].data);
+  if (m_mapping) {
+    // Point the block straight at the file's pages
+    const uint64_t offset = m_ogReader->blockOffset(fileBlockIndices[blockIdx]);
+    assert(offset + numVoxels * sizeof(Data_T) <= m_mappingSize);
+    block.map(reinterpret_cast<Data_T *>(m_mapping + offset));
   } else {
-    m_ogReader->readBlock(fileBlockIndices[blockIdx], blocks[blockIdx].data);
+    Data_T *shared = NULL;
+    if (SparseFileManager::singleton().doShareBlocks()) {
+      shared = loadSharedBlock(fileBlockIndices[blockIdx]);
+    }
+    if (shared) {
+      block.map(shared);
+    } else {
+      try {
+        if (tileOrder > 0) {
+          // Only the requested tiles are read. The others stay undefined 
+          // until loadTiles() reads them.
+          block.alloc(numVoxels);
+          assert(block.data != NULL);
+          readTileData(blockIdx, tiles, block.data);
+        } else {
+          // Allocate the block
+          block.resize(numVoxels);
+          assert(block.data != NULL);
+          // Read the data
+          readBlockData(fileBlockIndices[blockIdx], block.data);
+        }
+      }
+      catch (...) {
+        // Leave the block unloaded, so the next access tries again
+        block.clear();
+        tileMasks[blockIdx].store(0, boost::memory_order_relaxed);
+        throw;
+      }
+    }
+  }
+  // Mapped and shared blocks are always complete
+  if (tileOrder > 0 && block.isMapped) {
+    tileMasks[blockIdx].store(m_tileBits, boost::memory_order_relaxed);
   }
-  // Mark block as loaded
-  blockLoaded[blockIdx] = 1;
+  // Mark block as loaded. Release publishes the data to threads that see
+  // the flag.
+  blockStates[blockIdx].fetch_or(BlockLoaded, boost::memory_order_release);
   // Track count
   m_numActiveBlocks++;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::loadTiles(int blockIdx, uint64_t tiles)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+#if F3D_NO_BLOCKS_ARRAY
+  Sparse::SparseBlock<Data_T> &block = blocks[blockIdx];
 #else
-  blocks[blockIdx]->resize(numVoxels);
-  assert(blocks[blockIdx]->data != NULL);
-  // Read the data
-  assert(m_reader || m_ogReader);
-  if (m_reader) {
-    m_reader->readBlock(fileBlockIndices[blockIdx], *blocks[blockIdx]->data);
-  } else {
-    m_ogReader->readBlock(fileBlockIndices[blockIdx], blocks[blockIdx]->data);
+  Sparse::SparseBlock<Data_T> &block = *blocks[blockIdx];
+#endif
+
+  assert(isLoaded(blockIdx));
+  readTileData(blockIdx, tiles, block.data);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::unloadBlock(int blockIdx)
+{
+#if F3D_NO_BLOCKS_ARRAY
+  Sparse::SparseBlock<Data_T> &block = blocks[blockIdx];
+#else
+  Sparse::SparseBlock<Data_T> &block = *blocks[blockIdx];
+#endif
+
+  // Detach from the block if it's shared. Mapped files stay mapped.
+  if (block.isMapped) {
+    SharedBlocks::release(block.data);
   }
-  // Mark block as loaded
-  blockLoaded[blockIdx] = 1;
+  // Deallocate the block
+  block.clear();
+  tileMasks[blockIdx].store(0, boost::memory_order_relaxed);
+  // Mark block as unloaded
+  blockStates[blockIdx].fetch_and(~BlockLoaded, boost::memory_order_release);
   // Track count
-  m_numActiveBlocks++;
+  m_numActiveBlocks--;
+#if 0
+  // If no active blocks, close the file. De-activate for now.
+  if (m_numActiveBlocks == 0) {
+    closeFile();
+  }
 #endif
 }
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void Reference<Data_T>::readBlockData(int fileBlockIdx, Data_T *data)
+{
+  assert(m_reader || m_ogReader);
+  if (m_reader) {
+    m_reader->readBlock(fileBlockIdx, *data);
+  } else if (!m_ogReader->readBlock(fileBlockIdx, data)) {
+    throw Exc::FileIntegrityException(filename);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::readTileData(int blockIdx, uint64_t tiles, 
+                                     Data_T *data)
+{
+  assert(m_ogReader);
+  const uint64_t missing = missingTiles(blockIdx, tiles);
+  if (!missing) {
+    return;
+  }
+  // A complete block is read in one go
+  const int  fileBlockIdx = fileBlockIndices[blockIdx];
+  const bool success      = missing == m_tileBits ?
+    m_ogReader->readBlock(fileBlockIdx, data) :
+    m_ogReader->readTiles(fileBlockIdx, missing, data);
+  if (!success) {
+    throw Exc::FileIntegrityException(filename);
+  }
+  // Release publishes the voxels to threads that see the bits
+  tileMasks[blockIdx].fetch_or(missing, boost::memory_order_release);
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+Data_T* Reference<Data_T>::loadSharedBlock(int fileBlockIdx)
+{
+  if (m_sharedKey.empty()) {
+    return NULL;
+  }
+
+  const std::string key = 
+    m_sharedKey + boost::lexical_cast<std::string>(fileBlockIdx);
+
+  bool isOwner = false;
+  void *shared = SharedBlocks::acquire(key, numVoxels * sizeof(Data_T), 
+                                       isOwner);
+  if (!shared) {
+    return NULL;
+  }
+
+  Data_T *data = static_cast<Data_T*>(shared);
+
+  if (isOwner) {
+    // We're the first process to need the block, so fill it in for everyone
+    try {
+      readBlockData(fileBlockIdx, data);
+    }
+    catch (...) {
+      SharedBlocks::abandon(shared);
+      SharedBlocks::release(shared);
+      throw;
+    }
+    SharedBlocks::publish(shared);
+  }
+
+  return data;
+}
+
+//----------------------------------------------------------------------------//
+
 template <class Data_T>
 void Reference<Data_T>::openFile()
 {
@@ -546,19 +1382,43 @@ void Reference<Data_T>::openFile()
     return;
   }
 
+  // Blocks are only shared between readers of identical files. The device 
+  // and inode make the key independent of how the file was named, the size 
+  // and modification time keep rewritten files from matching.
+  struct stat info;
+  if (stat(filename.c_str(), &info) == 0) {
+    using boost::lexical_cast;
+    m_sharedKey = 
+      lexical_cast<std::string>(info.st_dev) + ":" + 
+      lexical_cast<std::string>(info.st_ino) + ":" + 
+      lexical_cast<std::string>(info.st_size) + ":" + 
+      lexical_cast<std::string>(info.st_mtime) + ":" + 
+      layerPath + ":" + DataTypeTraits<Data_T>::name() + ":" +
+      lexical_cast<std::string>(numVoxels) + ":";
+  }
+
   // First try Ogawa ---
 
-  m_ogArchive.reset(new Alembic::Ogawa::IArchive(filename));
+  m_ogArchive = openOgawaArchive(filename);
   if (m_ogArchive->isValid()) {
     m_ogRoot.reset(new OgIGroup(*m_ogArchive));
     m_ogLayerGroup.reset(new OgIGroup(m_ogRoot->findGroup(layerPath)));
     if (m_ogLayerGroup->isValid()) {
+      // Check how the blocks were stored
+      OgIAttribute<uint8_t> isCompressedAttr = 
+        m_ogLayerGroup->findAttribute<uint8_t>("data_is_compressed");
+      const bool isCompressed = 
+        !isCompressedAttr.isValid() || isCompressedAttr.value() != 0;
       // Allocate the reader
       m_ogReaderPtr.reset(new OgSparseDataReader<Data_T>(*m_ogLayerGroup,
                                                          numVoxels,
                                                          occupiedBlocks,
-                                                         true));
+                                                         isCompressed));
       m_ogReader = m_ogReaderPtr.get();
+      // Page-aligned blocks can be used in place
+      if (!isCompressed) {
+        mapFile();
+      }
       // Done
       return;
     }
@@ -570,7 +1430,10 @@ void Reference<Data_T>::openFile()
     // Hold the global lock
     GlobalLock lock(g_hdf5Mutex);
     // Open the file
-    m_fileHandle = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    H5ScopedPcreate fileAccess(H5P_FILE_ACCESS);
+    setChunkCache(fileAccess.id());
+    m_fileHandle = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, 
+                           fileAccess.id());
     if (m_fileHandle >= 0) {
       // Open the layer group
       m_layerGroup.open(m_fileHandle, layerPath.c_str());
@@ -598,9 +1461,70 @@ void Reference<Data_T>::openFile()
 
 //----------------------------------------------------------------------------//
 
+template <class Data_T>
+void Reference<Data_T>::mapFile()
+{
+#ifndef WIN32
+  if (m_mapping) {
+    return;
+  }
+
+  // Blocks are only usable in place if each one starts on a page boundary
+  OgIAttribute<uint32_t> alignmentAttr = 
+    m_ogLayerGroup->findAttribute<uint32_t>("data_alignment");
+  const long pageSize = sysconf(_SC_PAGESIZE);
+  if (!alignmentAttr.isValid() || pageSize <= 0 || 
+      alignmentAttr.value() % pageSize != 0) {
+    return;
+  }
+
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    // Renderer processes that map the same file share its page cache. 
+    // Dynamic-read fields are never written to, so the mapping is 
+    // read-only, and a stray write faults rather than silently copying 
+    // the page.
+    void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      m_mapping = static_cast<uint8_t *>(mapping);
+      m_mappingSize = info.st_size;
+    } else {
+      Msg::print(Msg::SevWarning, "In SparseFile::Reference::mapFile: "
+                 "Couldn't map " + filename + ", reading blocks instead");
+    }
+  }
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+void Reference<Data_T>::unmapFile()
+{
+#ifndef WIN32
+  if (m_mapping) {
+    munmap(m_mapping, m_mappingSize);
+  }
+#endif
+  m_mapping = NULL;
+  m_mappingSize = 0;
+}
+
+//----------------------------------------------------------------------------//
+
 #define FIELD3D_INSTANTIATION_LOADBLOCK(type)                       \
   template                                                          \
-  void Reference<type>::loadBlock(int blockIdx);                    \
+  void Reference<type>::loadBlock(int blockIdx, uint64_t tiles);    \
+  template                                                          \
+  void Reference<type>::loadTiles(int blockIdx, uint64_t tiles);    \
+  template                                                          \
+  void Reference<type>::unloadBlock(int blockIdx);                  \
   
 FIELD3D_INSTANTIATION_LOADBLOCK(float16_t);
 FIELD3D_INSTANTIATION_LOADBLOCK(float32_t);
@@ -622,6 +1546,21 @@ FIELD3D_INSTANTIATION_OPENFILE(vec16_t);
 FIELD3D_INSTANTIATION_OPENFILE(vec32_t);
 FIELD3D_INSTANTIATION_OPENFILE(vec64_t);
 
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_MAPFILE(type)                         \
+  template                                                          \
+  void Reference<type>::mapFile();                                  \
+  template                                                          \
+  void Reference<type>::unmapFile();                                \
+  
+FIELD3D_INSTANTIATION_MAPFILE(float16_t);
+FIELD3D_INSTANTIATION_MAPFILE(float32_t);
+FIELD3D_INSTANTIATION_MAPFILE(float64_t);
+FIELD3D_INSTANTIATION_MAPFILE(vec16_t);
+FIELD3D_INSTANTIATION_MAPFILE(vec32_t);
+FIELD3D_INSTANTIATION_MAPFILE(vec64_t);
+
 } // namespace SparseFile
 
 //----------------------------------------------------------------------------//
@@ -0,0 +1,443 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file SparseMACFieldIO.cpp
+  \brief Contains implementations of the SparseMACFieldIO class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "SparseFieldIO.h"
+#include "SparseMACFieldIO.h"
+
+//----------------------------------------------------------------------------//
+
+using namespace boost;
+using namespace std;
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Field3D namespaces
+//----------------------------------------------------------------------------//
+
+using namespace Exc;
+using namespace Hdf5Util;
+
+//----------------------------------------------------------------------------//
+// Static members
+//----------------------------------------------------------------------------//
+
+const int         SparseMACFieldIO::k_versionNumber(1);
+const std::string SparseMACFieldIO::k_versionAttrName("version");
+const std::string SparseMACFieldIO::k_extentsStr("extents");
+const std::string SparseMACFieldIO::k_extentsMinStr("extents_min");
+const std::string SparseMACFieldIO::k_extentsMaxStr("extents_max");
+const std::string SparseMACFieldIO::k_dataWindowStr("data_window");
+const std::string SparseMACFieldIO::k_dataWindowMinStr("data_window_min");
+const std::string SparseMACFieldIO::k_dataWindowMaxStr("data_window_max");
+const std::string SparseMACFieldIO::k_componentsStr("components");
+const std::string SparseMACFieldIO::k_uDataStr("u_data");
+const std::string SparseMACFieldIO::k_vDataStr("v_data");
+const std::string SparseMACFieldIO::k_wDataStr("w_data");
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+SparseMACFieldIO::read(hid_t layerGroup, const std::string &filename, 
+                       const std::string &layerPath,
+                       DataTypeEnum typeEnum)
+{
+  if (layerGroup == -1)
+    throw BadHdf5IdException("Bad layer group in SparseMACFieldIO::read");
+
+  int version;
+  if (!readAttribute(layerGroup, k_versionAttrName, 1, version))
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_versionAttrName);
+
+  if (version != k_versionNumber)
+    throw UnsupportedVersionException("SparseMACField version not supported: "
+                                      + lexical_cast<std::string>(version));
+
+  // The components are stored as scalar sparse fields
+  switch (typeEnum) {
+  case DataTypeVecHalf:
+    return readInternal<V3h>(layerGroup, filename, layerPath, DataTypeHalf);
+  case DataTypeVecFloat:
+    return readInternal<V3f>(layerGroup, filename, layerPath, DataTypeFloat);
+  case DataTypeVecDouble:
+    return readInternal<V3d>(layerGroup, filename, layerPath, DataTypeDouble);
+  default:
+    return FieldBase::Ptr();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+FieldBase::Ptr
+SparseMACFieldIO::read(const OgIGroup &layerGroup, 
+                       const std::string &filename, 
+                       const std::string &layerPath,
+                       OgDataType typeEnum)
+{
+  if (!layerGroup.isValid()) {
+    throw MissingGroupException("Invalid group in SparseMACFieldIO::read()");
+  }
+
+  OgIAttribute<int> versionAttr = 
+    layerGroup.findAttribute<int>(k_versionAttrName);
+  if (!versionAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute: " +
+                                    k_versionAttrName);
+  }
+  const int version = versionAttr.value();
+
+  if (version != k_versionNumber) {
+    throw UnsupportedVersionException("SparseMACField version not supported: "
+                                      + lexical_cast<std::string>(version));
+  }
+
+  // The components are stored as scalar sparse fields
+  switch (typeEnum) {
+  case F3DVec16:
+    return readInternal<V3h>(layerGroup, filename, layerPath, F3DFloat16);
+  case F3DVec32:
+    return readInternal<V3f>(layerGroup, filename, layerPath, F3DFloat32);
+  case F3DVec64:
+    return readInternal<V3d>(layerGroup, filename, layerPath, F3DFloat64);
+  default:
+    return FieldBase::Ptr();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+bool
+SparseMACFieldIO::write(hid_t layerGroup, FieldBase::Ptr field)
+{
+  if (layerGroup == -1) {
+    throw BadHdf5IdException("Bad layer group in SparseMACFieldIO::write");
+  }
+
+  // Add version attribute
+  if (!writeAttribute(layerGroup, k_versionAttrName, 
+                      1, k_versionNumber)) {
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_versionAttrName);
+  }
+
+  SparseMACField<V3h>::Ptr vecHalfField = 
+    field_dynamic_cast<SparseMACField<V3h> >(field);
+  SparseMACField<V3f>::Ptr vecFloatField = 
+    field_dynamic_cast<SparseMACField<V3f> >(field);
+  SparseMACField<V3d>::Ptr vecDoubleField = 
+    field_dynamic_cast<SparseMACField<V3d> >(field);
+
+  bool success = true;
+  if (vecFloatField) {
+    success = writeInternal<V3f>(layerGroup, vecFloatField);
+  } else if (vecHalfField) {
+    success = writeInternal<V3h>(layerGroup, vecHalfField);
+  } else if (vecDoubleField) {
+    success = writeInternal<V3d>(layerGroup, vecDoubleField);
+  } else {
+    throw WriteLayerException("SparseMACFieldIO does not support the given "
+                              "SparseMACField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+bool
+SparseMACFieldIO::write(OgOGroup &layerGroup, FieldBase::Ptr field)
+{
+  // Add version attribute
+  OgOAttribute<int> version(layerGroup, k_versionAttrName, k_versionNumber);
+
+  SparseMACField<V3h>::Ptr vecHalfField = 
+    field_dynamic_cast<SparseMACField<V3h> >(field);
+  SparseMACField<V3f>::Ptr vecFloatField = 
+    field_dynamic_cast<SparseMACField<V3f> >(field);
+  SparseMACField<V3d>::Ptr vecDoubleField = 
+    field_dynamic_cast<SparseMACField<V3d> >(field);
+
+  bool success = true;
+  if (vecFloatField) {
+    success = writeInternal<V3f>(layerGroup, vecFloatField);
+  } else if (vecHalfField) {
+    success = writeInternal<V3h>(layerGroup, vecHalfField);
+  } else if (vecDoubleField) {
+    success = writeInternal<V3d>(layerGroup, vecDoubleField);
+  } else {
+    throw WriteLayerException("SparseMACFieldIO does not support the given "
+                              "SparseMACField template parameter");
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+// Template methods
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseMACFieldIO::writeInternal(hid_t layerGroup, 
+                                     typename SparseMACField<Data_T>::Ptr field)
+{
+  int components = FieldTraits<Data_T>::dataDims();
+
+  Box3i ext(field->extents()), dw(field->dataWindow());
+
+  // Add extents attribute ---
+
+  int extents[6] = 
+    { ext.min.x, ext.min.y, ext.min.z, ext.max.x, ext.max.y, ext.max.z };
+
+  if (!writeAttribute(layerGroup, k_extentsStr, 6, extents[0]))
+    throw WriteAttributeException("Couldn't write attribute " + k_extentsStr);
+
+  // Add data window attribute ---
+
+  int dataWindow[6] = 
+    { dw.min.x, dw.min.y, dw.min.z, dw.max.x, dw.max.y, dw.max.z };
+
+  if (!writeAttribute(layerGroup, k_dataWindowStr, 6, dataWindow[0])) 
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_dataWindowStr);
+
+  // Add components attribute ---
+
+  if (!writeAttribute(layerGroup, k_componentsStr, 1, components)) 
+    throw WriteAttributeException("Couldn't write attribute " + 
+                                  k_componentsStr);
+
+  // Add the components, each in its own group ---
+
+  SparseFieldIO io;
+  bool success = true;
+
+  {
+    H5ScopedGcreate uGroup(layerGroup, k_uDataStr);
+    success &= io.write(uGroup, field->component(MACCompU));
+  }
+  {
+    H5ScopedGcreate vGroup(layerGroup, k_vDataStr);
+    success &= io.write(vGroup, field->component(MACCompV));
+  }
+  {
+    H5ScopedGcreate wGroup(layerGroup, k_wDataStr);
+    success &= io.write(wGroup, field->component(MACCompW));
+  }
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+bool SparseMACFieldIO::writeInternal(OgOGroup &layerGroup, 
+                                     typename SparseMACField<Data_T>::Ptr field)
+{
+  const Box3i ext(field->extents()), dw(field->dataWindow());
+
+  const int components = FieldTraits<Data_T>::dataDims();
+
+  OgOAttribute<veci32_t> extMinAttr(layerGroup, k_extentsMinStr, ext.min);
+  OgOAttribute<veci32_t> extMaxAttr(layerGroup, k_extentsMaxStr, ext.max);
+  
+  OgOAttribute<veci32_t> dwMinAttr(layerGroup, k_dataWindowMinStr, dw.min);
+  OgOAttribute<veci32_t> dwMaxAttr(layerGroup, k_dataWindowMaxStr, dw.max);
+
+  OgOAttribute<uint8_t> componentsAttr(layerGroup, k_componentsStr, components);
+
+  // Add the components, each in its own group ---
+
+  SparseFieldIO io;
+  bool success = true;
+
+  OgOGroup uGroup(layerGroup, k_uDataStr);
+  success &= io.write(uGroup, field->component(MACCompU));
+  success &= uGroup.writePackedAttributes();
+
+  OgOGroup vGroup(layerGroup, k_vDataStr);
+  success &= io.write(vGroup, field->component(MACCompV));
+  success &= vGroup.writePackedAttributes();
+
+  OgOGroup wGroup(layerGroup, k_wDataStr);
+  success &= io.write(wGroup, field->component(MACCompW));
+  success &= wGroup.writePackedAttributes();
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseMACField<Data_T>::Ptr 
+SparseMACFieldIO::readInternal(hid_t layerGroup, const std::string &filename, 
+                               const std::string &layerPath, 
+                               DataTypeEnum compTypeEnum)
+{
+  typedef SparseMACField<Data_T>                    MACType;
+  typedef typename MACType::ComponentField          CompType;
+
+  Box3i extents, dataW;
+
+  if (!readAttribute(layerGroup, k_extentsStr, 6, extents.min.x)) 
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsStr);
+
+  if (!readAttribute(layerGroup, k_dataWindowStr, 6, dataW.min.x)) 
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowStr);
+
+  // Read the components ---
+
+  const std::string groupNames[3] = { k_uDataStr, k_vDataStr, k_wDataStr };
+  typename CompType::Ptr comps[3];
+
+  SparseFieldIO io;
+
+  for (int c = 0; c < 3; ++c) {
+    H5ScopedGopen compGroup(layerGroup, groupNames[c]);
+    comps[c] = field_dynamic_cast<CompType>(
+      io.read(compGroup, filename, layerPath + "/" + groupNames[c], 
+              compTypeEnum));
+    if (!comps[c]) {
+      return typename MACType::Ptr();
+    }
+  }
+
+  typename MACType::Ptr result(new MACType);
+  result->setSize(extents, dataW);
+  result->m_u = comps[0];
+  result->m_v = comps[1];
+  result->m_w = comps[2];
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+typename SparseMACField<Data_T>::Ptr 
+SparseMACFieldIO::readInternal(const OgIGroup &layerGroup, 
+                               const std::string &filename, 
+                               const std::string &layerPath, 
+                               OgDataType compTypeEnum)
+{
+  typedef SparseMACField<Data_T>                    MACType;
+  typedef typename MACType::ComponentField          CompType;
+
+  Box3i extents, dataW;
+
+  // Get extents ---
+
+  OgIAttribute<veci32_t> extMinAttr = 
+    layerGroup.findAttribute<veci32_t>(k_extentsMinStr);
+  OgIAttribute<veci32_t> extMaxAttr = 
+    layerGroup.findAttribute<veci32_t>(k_extentsMaxStr);
+  if (!extMinAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsMinStr);
+  }
+  if (!extMaxAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_extentsMaxStr);
+  }
+
+  extents.min = extMinAttr.value();
+  extents.max = extMaxAttr.value();
+
+  // Get data window ---
+
+  OgIAttribute<veci32_t> dwMinAttr = 
+    layerGroup.findAttribute<veci32_t>(k_dataWindowMinStr);
+  OgIAttribute<veci32_t> dwMaxAttr = 
+    layerGroup.findAttribute<veci32_t>(k_dataWindowMaxStr);
+  if (!dwMinAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowMinStr);
+  }
+  if (!dwMaxAttr.isValid()) {
+    throw MissingAttributeException("Couldn't find attribute " + 
+                                    k_dataWindowMaxStr);
+  }
+
+  dataW.min = dwMinAttr.value();
+  dataW.max = dwMaxAttr.value();
+
+  // Read the components ---
+
+  const std::string groupNames[3] = { k_uDataStr, k_vDataStr, k_wDataStr };
+  typename CompType::Ptr comps[3];
+
+  SparseFieldIO io;
+
+  for (int c = 0; c < 3; ++c) {
+    OgIGroup compGroup = layerGroup.findGroup(groupNames[c]);
+    if (!compGroup.isValid()) {
+      throw MissingGroupException("Couldn't find group " + groupNames[c]);
+    }
+    comps[c] = field_dynamic_cast<CompType>(
+      io.read(compGroup, filename, layerPath + "/" + groupNames[c], 
+              compTypeEnum));
+    if (!comps[c]) {
+      return typename MACType::Ptr();
+    }
+  }
+
+  typename MACType::Ptr result(new MACType);
+  result->setSize(extents, dataW);
+  result->m_u = comps[0];
+  result->m_v = comps[1];
+  result->m_w = comps[2];
+
+  return result;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
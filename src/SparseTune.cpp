@@ -0,0 +1,446 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*! \file SparseTune.cpp
+  Contains the implementation of tuneSparseField()
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "SparseTune.h"
+
+// System includes
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Boost includes
+#include <boost/cstdint.hpp>
+#include <boost/random.hpp>
+
+// Library includes
+#include "BlockCodec.h"
+#include "Stats.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+using boost::uint8_t;
+
+//----------------------------------------------------------------------------//
+
+//! Approximate file overhead of each allocated block: its offset and size
+const double k_bytesPerAllocatedBlock = 16.0;
+//! Approximate file overhead of each block, allocated or not: its entry in
+//! the block map
+const double k_bytesPerBlock = 4.0;
+
+//----------------------------------------------------------------------------//
+
+//! Orders results by score, then by file size
+bool betterResult(const SparseTuneResult &a, const SparseTuneResult &b)
+{
+  if (a.score != b.score) {
+    return a.score < b.score;
+  }
+  return a.fileBytes < b.fileBytes;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns value relative to the best value of all candidates
+double relativeCost(const double value, const double best)
+{
+  if (best > 0.0) {
+    return value / best;
+  }
+  return value > 0.0 ? 2.0 : 1.0;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns whether a block of the given order, in data window relative 
+//! voxel coordinates, overlaps an allocated block of the field
+template <class Data_T>
+bool overlapsAllocated(const SparseField<Data_T> &field, const V3i &res,
+                       const V3i &min, const V3i &max)
+{
+  const int order = field.blockOrder();
+  const V3i last(std::min(max.x, res.x - 1), std::min(max.y, res.y - 1),
+                 std::min(max.z, res.z - 1));
+  for (int bk = min.z >> order; bk <= last.z >> order; ++bk) {
+    for (int bj = min.y >> order; bj <= last.y >> order; ++bj) {
+      for (int bi = min.x >> order; bi <= last.x >> order; ++bi) {
+        if (field.blockIsAllocated(bi, bj, bk)) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Copies the voxels of a block of the given order into data. Voxels 
+//! outside the data window are zeroed, the way partial blocks are padded.
+template <class Data_T>
+void gatherBlock(const SparseField<Data_T> &field, const V3i &res, 
+                 const V3i &min, const int blockSize, 
+                 std::vector<Data_T> &data)
+{
+  const V3i &offset = field.dataWindow().min;
+  typename std::vector<Data_T>::iterator v = data.begin();
+  for (int k = min.z; k < min.z + blockSize; ++k) {
+    for (int j = min.y; j < min.y + blockSize; ++j) {
+      for (int i = min.x; i < min.x + blockSize; ++i, ++v) {
+        if (i < res.x && j < res.y && k < res.z) {
+          *v = field.fastValue(i + offset.x, j + offset.y, k + offset.z);
+        } else {
+          *v = Data_T(0.0);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// SparseTuneOptions implementations
+//----------------------------------------------------------------------------//
+
+SparseTuneOptions::SparseTuneOptions()
+  : sizeWeight(0.5), readBytesPerSecond(200.0 * 1024.0 * 1024.0),
+    maxSampleBlocks(256)
+{
+  for (int order = 3; order <= 5; ++order) {
+    blockOrders.push_back(order);
+  }
+  for (int codec = SparseCodecZlib; codec <= SparseCodecShuffleZstd; 
+       ++codec) {
+    if (BlockCodec::isValid(codec)) {
+      codecs.push_back(static_cast<SparseCodec>(codec));
+    }
+  }
+  levels.push_back(1);
+  levels.push_back(6);
+}
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+template <class Data_T>
+std::vector<SparseTuneResult> 
+tuneSparseField(const SparseField<Data_T> &field, 
+                const std::vector<V3i> &trace,
+                const SparseTuneOptions &options)
+{
+  using std::vector;
+
+  vector<SparseTuneResult> results;
+  const V3i res = field.dataResolution();
+  const V3i &offset = field.dataWindow().min;
+
+  vector<uint8_t> compressed, decompressed, scratch;
+  vector<size_t>  sizes;
+
+  for (size_t o = 0; o < options.blockOrders.size(); ++o) {
+
+    const int  order     = options.blockOrders[o];
+    const int  blockSize = 1 << order;
+    const V3i  blockRes((res.x + blockSize - 1) >> order,
+                        (res.y + blockSize - 1) >> order,
+                        (res.z + blockSize - 1) >> order);
+    const size_t numBlocks = 
+      static_cast<size_t>(blockRes.x) * blockRes.y * blockRes.z;
+
+    // Find the blocks that would be allocated
+    vector<bool>   isAllocated(numBlocks, false);
+    vector<size_t> allocated;
+    for (int bk = 0, id = 0; bk < blockRes.z; ++bk) {
+      for (int bj = 0; bj < blockRes.y; ++bj) {
+        for (int bi = 0; bi < blockRes.x; ++bi, ++id) {
+          const V3i min(bi << order, bj << order, bk << order);
+          const V3i max(min + V3i(blockSize - 1));
+          if (overlapsAllocated(field, res, min, max)) {
+            isAllocated[id] = true;
+            allocated.push_back(id);
+          }
+        }
+      }
+    }
+
+    // Count the allocated blocks that the trace visits
+    size_t numTouched = allocated.size();
+    if (!trace.empty()) {
+      vector<bool> isTouched(numBlocks, false);
+      numTouched = 0;
+      for (size_t t = 0; t < trace.size(); ++t) {
+        const V3i v = trace[t] - offset;
+        if (v.x < 0 || v.y < 0 || v.z < 0 || 
+            v.x >= res.x || v.y >= res.y || v.z >= res.z) {
+          continue;
+        }
+        const size_t id = (v.x >> order) + 
+          blockRes.x * ((v.y >> order) + blockRes.y * (v.z >> order));
+        if (isAllocated[id] && !isTouched[id]) {
+          isTouched[id] = true;
+          ++numTouched;
+        }
+      }
+    }
+
+    // Gather evenly spaced allocated blocks to trial-encode
+    const size_t numVoxels = static_cast<size_t>(blockSize) * 
+      blockSize * blockSize;
+    const size_t stride = 
+      std::max(static_cast<size_t>(1), 
+               (allocated.size() + options.maxSampleBlocks - 1) / 
+               std::max(options.maxSampleBlocks, static_cast<size_t>(1)));
+    vector<vector<Data_T> > samples;
+    for (size_t b = 0; b < allocated.size(); b += stride) {
+      const int id = static_cast<int>(allocated[b]);
+      const V3i min((id % blockRes.x) << order, 
+                    ((id / blockRes.x) % blockRes.y) << order,
+                    (id / (blockRes.x * blockRes.y)) << order);
+      samples.push_back(vector<Data_T>(numVoxels));
+      gatherBlock(field, res, min, blockSize, samples.back());
+    }
+    const size_t rawBytes = numVoxels * sizeof(Data_T);
+    const size_t elementSize = sizeof(Data_T);
+
+    for (size_t c = 0; c < options.codecs.size(); ++c) {
+      for (size_t l = 0; l < options.levels.size(); ++l) {
+
+        SparseTuneResult result;
+        result.blockOrder       = order;
+        result.codec            = options.codecs[c];
+        result.level            = options.levels[l];
+        result.numBlocks        = allocated.size();
+        result.numTouchedBlocks = numTouched;
+
+        // Compress the samples back to back
+        const size_t bound = BlockCodec::compressBound(result.codec, rawBytes);
+        compressed.resize(bound * samples.size());
+        sizes.resize(samples.size());
+        size_t totalCompressed = 0;
+        for (size_t s = 0; s < samples.size(); ++s) {
+          size_t len = bound;
+          const uint8_t *src = 
+            reinterpret_cast<const uint8_t*>(&samples[s][0]);
+          if (!BlockCodec::compress(result.codec, result.level, 
+                                    elementSize, src, rawBytes, 
+                                    &compressed[s * bound], len, scratch)) {
+            len = rawBytes;
+          }
+          sizes[s] = len;
+          totalCompressed += len;
+        }
+
+        // Time their decompression
+        decompressed.resize(rawBytes);
+        const boost::uint64_t start = Stats::microseconds();
+        for (size_t s = 0; s < samples.size(); ++s) {
+          BlockCodec::decompress(result.codec, elementSize, 
+                                 &compressed[s * bound], sizes[s], 
+                                 &decompressed[0], rawBytes, scratch);
+        }
+        const double decodeSeconds = 
+          std::max(Stats::microseconds() - start, 
+                   static_cast<boost::uint64_t>(1)) * 1e-6;
+
+        if (!samples.empty()) {
+          const double blockBytes = 
+            static_cast<double>(totalCompressed) / samples.size();
+          const double blockSeconds = decodeSeconds / samples.size();
+          result.decodeBytesPerSecond = 
+            rawBytes * samples.size() / decodeSeconds;
+          result.fileBytes = blockBytes * allocated.size();
+          result.sampleSeconds = numTouched * 
+            (blockBytes / options.readBytesPerSecond + blockSeconds);
+        }
+        result.fileBytes += allocated.size() * k_bytesPerAllocatedBlock + 
+          numBlocks * k_bytesPerBlock;
+
+        results.push_back(result);
+      }
+    }
+  }
+
+  scoreSparseTuning(results, options.sizeWeight);
+  return results;
+}
+
+//----------------------------------------------------------------------------//
+
+void scoreSparseTuning(std::vector<SparseTuneResult> &results,
+                       const double sizeWeight)
+{
+  if (results.empty()) {
+    return;
+  }
+  double minBytes = results[0].fileBytes;
+  double minSeconds = results[0].sampleSeconds;
+  for (size_t i = 1; i < results.size(); ++i) {
+    minBytes = std::min(minBytes, results[i].fileBytes);
+    minSeconds = std::min(minSeconds, results[i].sampleSeconds);
+  }
+  const double weight = std::min(std::max(sizeWeight, 0.0), 1.0);
+  for (size_t i = 0; i < results.size(); ++i) {
+    results[i].score = 
+      weight * relativeCost(results[i].fileBytes, minBytes) + 
+      (1.0 - weight) * relativeCost(results[i].sampleSeconds, minSeconds);
+  }
+  std::stable_sort(results.begin(), results.end(), betterResult);
+}
+
+//----------------------------------------------------------------------------//
+
+void applySparseTuning(const SparseTuneResult &result)
+{
+  setSparseCodec(result.codec);
+  setSparseCompressionLevel(result.level);
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<V3i> makePointTrace(const Box3i &dataWindow, 
+                                const size_t numPoints,
+                                const unsigned int seed)
+{
+  std::vector<V3i> trace;
+  if (dataWindow.isEmpty()) {
+    return trace;
+  }
+  boost::mt19937 rng(seed);
+  boost::uniform_int<int> x(dataWindow.min.x, dataWindow.max.x);
+  boost::uniform_int<int> y(dataWindow.min.y, dataWindow.max.y);
+  boost::uniform_int<int> z(dataWindow.min.z, dataWindow.max.z);
+  trace.reserve(numPoints);
+  for (size_t i = 0; i < numPoints; ++i) {
+    trace.push_back(V3i(x(rng), y(rng), z(rng)));
+  }
+  return trace;
+}
+
+//----------------------------------------------------------------------------//
+
+std::vector<V3i> makeRayTrace(const Box3i &dataWindow, const size_t numRays,
+                              const unsigned int seed)
+{
+  std::vector<V3i> trace;
+  if (dataWindow.isEmpty()) {
+    return trace;
+  }
+  const V3d min(dataWindow.min);
+  const V3d max(V3d(dataWindow.max) + V3d(1.0));
+  boost::mt19937 rng(seed);
+  boost::uniform_01<> uniform;
+  for (size_t r = 0; r < numRays; ++r) {
+    // Random point in the data window and random direction on the sphere
+    const V3d o(min.x + (max.x - min.x) * uniform(rng), 
+                min.y + (max.y - min.y) * uniform(rng), 
+                min.z + (max.z - min.z) * uniform(rng));
+    const double cosTheta = 2.0 * uniform(rng) - 1.0;
+    const double sinTheta = std::sqrt(1.0 - cosTheta * cosTheta);
+    const double phi = 2.0 * M_PI * uniform(rng);
+    const V3d d(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    // Where the ray enters and leaves the data window
+    double t0 = -std::numeric_limits<double>::max();
+    double t1 = std::numeric_limits<double>::max();
+    for (int a = 0; a < 3; ++a) {
+      if (d[a] != 0.0) {
+        const double ta = (min[a] - o[a]) / d[a];
+        const double tb = (max[a] - o[a]) / d[a];
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+      }
+    }
+    // March in one-voxel steps, skipping repeats
+    V3i last(dataWindow.min - V3i(1));
+    for (double t = t0; t <= t1; t += 1.0) {
+      const V3d p = o + d * t;
+      V3i v(static_cast<int>(std::floor(p.x)), 
+            static_cast<int>(std::floor(p.y)), 
+            static_cast<int>(std::floor(p.z)));
+      for (int a = 0; a < 3; ++a) {
+        v[a] = std::min(std::max(v[a], dataWindow.min[a]), dataWindow.max[a]);
+      }
+      if (v != last) {
+        trace.push_back(v);
+        last = v;
+      }
+    }
+  }
+  return trace;
+}
+
+//----------------------------------------------------------------------------//
+// Template instantiations
+//----------------------------------------------------------------------------//
+
+#define FIELD3D_INSTANTIATION_TUNE(type)                                \
+  template std::vector<SparseTuneResult>                                \
+  tuneSparseField<type>(const SparseField<type> &,                      \
+                        const std::vector<V3i> &,                       \
+                        const SparseTuneOptions &)
+
+FIELD3D_INSTANTIATION_TUNE(half);
+FIELD3D_INSTANTIATION_TUNE(float);
+FIELD3D_INSTANTIATION_TUNE(double);
+FIELD3D_INSTANTIATION_TUNE(V3h);
+FIELD3D_INSTANTIATION_TUNE(V3f);
+FIELD3D_INSTANTIATION_TUNE(V3d);
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,363 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file Stats.cpp
+  Contains implementations of the Stats counters.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "JsonUtil.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+
+namespace Stats {
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+const char* k_counterNames[NumCounters] = {
+  "bytes_read",
+  "bytes_decompressed",
+  "decompress_us_zlib",
+  "decompress_us_shuffle_zlib",
+  "decompress_us_lz4",
+  "decompress_us_zstd",
+  "blocks_loaded",
+  "blocks_evicted",
+  "sparse_cache_lock_wait_us",
+  "mip_level_lock_wait_us",
+  "field_cache_lock_wait_us",
+  "files_opened",
+  "file_open_us",
+  "layers_read",
+  "layer_read_us"
+};
+
+//----------------------------------------------------------------------------//
+
+//! The counters of one thread. Only the owning thread adds to them.
+struct ThreadCounters
+{
+  ThreadCounters()
+  {
+    for (int i = 0; i < NumCounters; ++i) {
+      values[i].store(0, boost::memory_order_relaxed);
+    }
+  }
+  boost::atomic<boost::uint64_t> values[NumCounters];
+};
+
+//----------------------------------------------------------------------------//
+
+//! All counters, and the totals of threads that have exited
+struct Registry
+{
+  Registry()
+    : isDumpRegistered(false)
+  {
+    std::fill(retired, retired + NumCounters, 0);
+  }
+  boost::mutex                  mutex;
+  std::vector<ThreadCounters *> live;
+  boost::uint64_t               retired[NumCounters];
+  LayerStatsMap                 layers;
+  std::string                   dumpFilename;
+  bool                          isDumpRegistered;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Never destroyed, so that threads exiting during static destruction can 
+//! still retire their counters
+Registry& registry()
+{
+  static Registry *s_registry = new Registry;
+  return *s_registry;
+}
+
+//----------------------------------------------------------------------------//
+
+#ifndef FIELD3D_DISABLE_STATS
+
+//! Called as a thread exits. Folds its counters into the retired totals.
+void retireCounters(ThreadCounters *counters)
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  for (int i = 0; i < NumCounters; ++i) {
+    r.retired[i] += counters->values[i].load(boost::memory_order_relaxed);
+  }
+  r.live.erase(std::remove(r.live.begin(), r.live.end(), counters), 
+               r.live.end());
+  delete counters;
+}
+
+//----------------------------------------------------------------------------//
+
+boost::thread_specific_ptr<ThreadCounters>& threadCountersPtr()
+{
+  static boost::thread_specific_ptr<ThreadCounters> *s_ptr = 
+    new boost::thread_specific_ptr<ThreadCounters>(retireCounters);
+  return *s_ptr;
+}
+
+//----------------------------------------------------------------------------//
+
+ThreadCounters& threadCounters()
+{
+  ThreadCounters *counters = threadCountersPtr().get();
+  if (!counters) {
+    counters = new ThreadCounters;
+    threadCountersPtr().reset(counters);
+    Registry &r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    r.live.push_back(counters);
+  }
+  return *counters;
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+void dumpAtExit()
+{
+  std::string filename;
+  {
+    Registry &r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    filename = r.dumpFilename;
+  }
+  if (!filename.empty()) {
+    writeJson(filename);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// Stats implementations
+//----------------------------------------------------------------------------//
+
+bool isEnabled()
+{
+#ifndef FIELD3D_DISABLE_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+const char* counterName(const Counter counter)
+{
+  if (counter < 0 || counter >= NumCounters) {
+    return "unknown";
+  }
+  return k_counterNames[counter];
+}
+
+//----------------------------------------------------------------------------//
+
+boost::uint64_t value(const Counter counter)
+{
+  if (counter < 0 || counter >= NumCounters) {
+    return 0;
+  }
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  boost::uint64_t total = r.retired[counter];
+  for (size_t i = 0; i < r.live.size(); ++i) {
+    total += r.live[i]->values[counter].load(boost::memory_order_relaxed);
+  }
+  return total;
+}
+
+//----------------------------------------------------------------------------//
+
+LayerStatsMap layerStats()
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  return r.layers;
+}
+
+//----------------------------------------------------------------------------//
+
+void reset()
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  std::fill(r.retired, r.retired + NumCounters, 0);
+  for (size_t i = 0; i < r.live.size(); ++i) {
+    for (int c = 0; c < NumCounters; ++c) {
+      r.live[i]->values[c].store(0, boost::memory_order_relaxed);
+    }
+  }
+  r.layers.clear();
+}
+
+//----------------------------------------------------------------------------//
+
+void writeJson(std::ostream &os)
+{
+  const LayerStatsMap layers = layerStats();
+
+  os << "{\n  \"enabled\": " << (isEnabled() ? "true" : "false") << ",\n";
+  os << "  \"counters\": {\n";
+  for (int i = 0; i < NumCounters; ++i) {
+    const Counter c = static_cast<Counter>(i);
+    os << "    \"" << counterName(c) << "\": " << value(c)
+       << (i + 1 < NumCounters ? ",\n" : "\n");
+  }
+  os << "  },\n  \"layers\": {";
+  for (LayerStatsMap::const_iterator i = layers.begin(); i != layers.end(); 
+       ++i) {
+    os << (i == layers.begin() ? "\n    " : ",\n    ");
+    writeJsonString(os, i->first);
+    os << ": { \"reads\": " << i->second.numReads 
+       << ", \"read_us\": " << i->second.readTime << " }";
+  }
+  os << (layers.empty() ? "}\n" : "\n  }\n") << "}\n";
+}
+
+//----------------------------------------------------------------------------//
+
+bool writeJson(const std::string &filename)
+{
+  std::ofstream out(filename.c_str());
+  if (!out) {
+    return false;
+  }
+  writeJson(out);
+  return out.good();
+}
+
+//----------------------------------------------------------------------------//
+
+void setDumpAtExit(const std::string &filename)
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  r.dumpFilename = filename;
+  if (!filename.empty() && !r.isDumpRegistered) {
+    std::atexit(dumpAtExit);
+    r.isDumpRegistered = true;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+boost::uint64_t microseconds()
+{
+#ifdef WIN32
+  LARGE_INTEGER frequency, count;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&count);
+  return static_cast<boost::uint64_t>(count.QuadPart) * 1000000 / 
+    frequency.QuadPart;
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<boost::uint64_t>(ts.tv_sec) * 1000000 + 
+    ts.tv_nsec / 1000;
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+#ifndef FIELD3D_DISABLE_STATS
+
+void add(const Counter counter, const boost::uint64_t amount)
+{
+  threadCounters().values[counter].fetch_add(amount, 
+                                             boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
+void addLayerRead(const std::string &layer, const boost::uint64_t time)
+{
+  add(LayersRead);
+  add(LayerReadTime, time);
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  LayerStats &stats = r.layers[layer];
+  stats.numReads++;
+  stats.readTime += time;
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+} // namespace Stats
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
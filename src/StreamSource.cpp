@@ -0,0 +1,542 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*! \file StreamSource.cpp
+  Contains the implementations of RangeStreamSource and the stream source 
+  registry
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "StreamSource.h"
+
+// System includes
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+// Boost includes
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/weak_ptr.hpp>
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! The registered factories, and the sources that are open
+struct Registry
+{
+  Registry()
+  {
+    factories["http"] = 
+      boost::bind(&HttpStreamSource::open, _1, RangeStreamOptions());
+  }
+  boost::mutex                                         mutex;
+  std::map<std::string, StreamSourceFactory>           factories;
+  std::map<std::string, boost::weak_ptr<StreamSource> > sources;
+};
+
+//----------------------------------------------------------------------------//
+
+Registry& registry()
+{
+  static Registry *s_registry = new Registry;
+  return *s_registry;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns the scheme of a filename, e.g. "http" for "http://host/file",
+//! or an empty string if it has none
+std::string scheme(const std::string &filename)
+{
+  const size_t pos = filename.find("://");
+  return pos == std::string::npos ? std::string() : filename.substr(0, pos);
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// RangeStreamSource::Cache
+//----------------------------------------------------------------------------//
+
+struct RangeStreamSource::Cache
+{
+  //! A page of the source. Its bytes don't change once it's Ready, so 
+  //! readers that hold on to it may copy them without the lock.
+  struct Page
+  {
+    enum State { Loading, Ready, Failed };
+    Page()
+      : state(Loading), isPinned(false), isInLru(false)
+    { }
+    State                                state;
+    bool                                 isPinned;
+    bool                                 isInLru;
+    std::vector<char>                    bytes;
+    std::list<boost::uint64_t>::iterator lruPos;
+  };
+
+  typedef boost::shared_ptr<Page>             PagePtr;
+  typedef std::map<boost::uint64_t, PagePtr>  PageMap;
+
+  Cache(RangeStreamSource &i_owner, const RangeStreamOptions &i_options)
+    : owner(i_owner), options(i_options), 
+      pageBytes(std::max(i_options.pageBytes, static_cast<size_t>(1))),
+      size(0), dataBytes(0), pinnedBytes(0), 
+      isStarted(false), isStopping(false)
+  { }
+
+  //! Fetches count pages from first on, which the caller has put in the 
+  //! map as Loading, and publishes them
+  bool fetchRun(const boost::uint64_t first, const boost::uint64_t count,
+                const bool doPin);
+
+  //! Marks a page as recently used
+  void touch(Page &page);
+
+  //! Keeps a page in memory for good, if the budget allows
+  void pin(Page &page);
+
+  //! Drops the least recently used pages until they fit in the budget
+  void evict();
+
+  //! Main loop of the background threads
+  void fetchLoop();
+
+  RangeStreamSource          &owner;
+  const RangeStreamOptions    options;
+  const boost::uint64_t       pageBytes;
+  boost::uint64_t             size;
+
+  boost::mutex                mutex;
+  //! Signaled whenever pages are done loading
+  boost::condition_variable   pageDone;
+  //! Signaled when pages are queued, or the threads should stop
+  boost::condition_variable   queueChanged;
+  PageMap                     pages;
+  //! Unpinned Ready pages, most recently used first
+  std::list<boost::uint64_t>  lru;
+  boost::uint64_t             dataBytes;
+  boost::uint64_t             pinnedBytes;
+  //! Pages queued by willNeed(), oldest first. Pages that are no longer 
+  //! in queued have been taken by a reader or coalesced into another 
+  //! request and are skipped.
+  std::deque<boost::uint64_t> queue;
+  std::set<boost::uint64_t>   queued;
+  boost::thread_group         threads;
+  bool                        isStarted;
+  bool                        isStopping;
+};
+
+//----------------------------------------------------------------------------//
+
+bool RangeStreamSource::Cache::fetchRun(const boost::uint64_t first, 
+                                        const boost::uint64_t count,
+                                        const bool doPin)
+{
+  const boost::uint64_t start = first * pageBytes;
+  const boost::uint64_t end = std::min(size, (first + count) * pageBytes);
+  std::vector<char> buffer(end - start);
+  const bool success = owner.fetch(start, end - start, &buffer[0]);
+
+  boost::mutex::scoped_lock lock(mutex);
+  for (boost::uint64_t i = first; i < first + count; ++i) {
+    PageMap::iterator p = pages.find(i);
+    if (p == pages.end()) {
+      continue;
+    }
+    Page &page = *p->second;
+    if (!success) {
+      // Readers that are waiting see the failure, later ones try again
+      page.state = Page::Failed;
+      pages.erase(p);
+      continue;
+    }
+    const boost::uint64_t pageStart = i * pageBytes;
+    const boost::uint64_t pageEnd = std::min(size, pageStart + pageBytes);
+    page.bytes.assign(buffer.begin() + (pageStart - start), 
+                      buffer.begin() + (pageEnd - start));
+    page.state = Page::Ready;
+    if (doPin) {
+      pin(page);
+    }
+    if (!page.isPinned) {
+      lru.push_front(i);
+      page.lruPos = lru.begin();
+      page.isInLru = true;
+      dataBytes += page.bytes.size();
+    }
+  }
+  evict();
+  pageDone.notify_all();
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::Cache::touch(Page &page)
+{
+  if (page.isInLru) {
+    lru.splice(lru.begin(), lru, page.lruPos);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::Cache::pin(Page &page)
+{
+  if (page.isPinned || 
+      pinnedBytes + page.bytes.size() > options.pinnedBytes) {
+    return;
+  }
+  if (page.isInLru) {
+    lru.erase(page.lruPos);
+    page.isInLru = false;
+    dataBytes -= page.bytes.size();
+  }
+  page.isPinned = true;
+  pinnedBytes += page.bytes.size();
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::Cache::evict()
+{
+  while (dataBytes > options.cacheBytes && !lru.empty()) {
+    PageMap::iterator p = pages.find(lru.back());
+    lru.pop_back();
+    dataBytes -= p->second->bytes.size();
+    p->second->isInLru = false;
+    pages.erase(p);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::Cache::fetchLoop()
+{
+  const boost::uint64_t maxPages = 
+    std::max(static_cast<boost::uint64_t>(options.maxRequestBytes) / 
+             pageBytes, static_cast<boost::uint64_t>(1));
+  for (;;) {
+    boost::uint64_t first = 0, count = 1;
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      for (;;) {
+        if (isStopping) {
+          return;
+        }
+        while (!queue.empty() && !queued.count(queue.front())) {
+          queue.pop_front();
+        }
+        if (!queue.empty()) {
+          break;
+        }
+        queueChanged.wait(lock);
+      }
+      first = queue.front();
+      queue.pop_front();
+      queued.erase(first);
+      // Take along the queued neighbors, in either direction
+      while (count < maxPages && queued.erase(first + count)) {
+        ++count;
+      }
+      while (count < maxPages && first > 0 && queued.erase(first - 1)) {
+        --first;
+        ++count;
+      }
+    }
+    fetchRun(first, count, false);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// RangeStreamSource implementations
+//----------------------------------------------------------------------------//
+
+RangeStreamSource::RangeStreamSource(const RangeStreamOptions &options)
+  : m_cache(new Cache(*this, options))
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+RangeStreamSource::~RangeStreamSource()
+{
+  stopFetching();
+}
+
+//----------------------------------------------------------------------------//
+
+boost::uint64_t RangeStreamSource::size() const
+{
+  return m_cache->size;
+}
+
+//----------------------------------------------------------------------------//
+
+bool RangeStreamSource::read(const boost::uint64_t pos, 
+                             const boost::uint64_t numBytes, void *buffer)
+{
+  typedef Cache::Page    Page;
+  typedef Cache::PagePtr PagePtr;
+
+  Cache &c = *m_cache;
+
+  if (numBytes == 0) {
+    return true;
+  }
+  if (pos > c.size || numBytes > c.size - pos) {
+    return false;
+  }
+
+  const boost::uint64_t first = pos / c.pageBytes;
+  const boost::uint64_t last = (pos + numBytes - 1) / c.pageBytes;
+  const bool isSmall = numBytes <= c.options.smallReadBytes;
+
+  // Claim the pages that nobody is loading yet, including those that 
+  // are still waiting in the willNeed() queue
+  std::vector<PagePtr> needed;
+  std::vector<boost::uint64_t> missing;
+  {
+    boost::mutex::scoped_lock lock(c.mutex);
+    for (boost::uint64_t i = first; i <= last; ++i) {
+      PagePtr &page = c.pages[i];
+      if (!page) {
+        page.reset(new Page);
+        missing.push_back(i);
+      } else if (c.queued.erase(i)) {
+        missing.push_back(i);
+      } else if (page->state == Page::Ready) {
+        c.touch(*page);
+        if (isSmall) {
+          c.pin(*page);
+        }
+      }
+      needed.push_back(page);
+    }
+  }
+
+  // Fetch them, one request per run of neighboring pages
+  bool success = true;
+  const boost::uint64_t maxPages = 
+    std::max(static_cast<boost::uint64_t>(c.options.maxRequestBytes) / 
+             c.pageBytes, 
+             static_cast<boost::uint64_t>(1));
+  for (size_t i = 0; i < missing.size(); ) {
+    size_t count = 1;
+    while (i + count < missing.size() && count < maxPages &&
+           missing[i + count] == missing[i] + count) {
+      ++count;
+    }
+    success = c.fetchRun(missing[i], count, isSmall) && success;
+    i += count;
+  }
+
+  // Wait for the pages that other threads are loading
+  {
+    boost::mutex::scoped_lock lock(c.mutex);
+    for (size_t i = 0; i < needed.size(); ++i) {
+      while (needed[i]->state == Page::Loading) {
+        c.pageDone.wait(lock);
+      }
+      success = success && needed[i]->state == Page::Ready;
+    }
+  }
+  if (!success) {
+    return false;
+  }
+
+  // Copy out
+  char *dst = static_cast<char*>(buffer);
+  boost::uint64_t offset = pos - first * c.pageBytes;
+  boost::uint64_t remaining = numBytes;
+  for (size_t i = 0; i < needed.size(); ++i) {
+    const boost::uint64_t n = 
+      std::min(remaining, 
+               static_cast<boost::uint64_t>(needed[i]->bytes.size()) - offset);
+    std::memcpy(dst, &needed[i]->bytes[offset], n);
+    dst += n;
+    remaining -= n;
+    offset = 0;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::willNeed(const boost::uint64_t pos, 
+                                 const boost::uint64_t numBytes)
+{
+  Cache &c = *m_cache;
+
+  if (numBytes == 0 || pos >= c.size || c.options.maxInFlight == 0) {
+    return;
+  }
+
+  const boost::uint64_t first = pos / c.pageBytes;
+  const boost::uint64_t last = 
+    (pos + std::min(numBytes, c.size - pos) - 1) / c.pageBytes;
+
+  boost::mutex::scoped_lock lock(c.mutex);
+  if (c.isStopping) {
+    return;
+  }
+  if (!c.isStarted) {
+    for (size_t i = 0; i < c.options.maxInFlight; ++i) {
+      c.threads.create_thread(boost::bind(&Cache::fetchLoop, &c));
+    }
+    c.isStarted = true;
+  }
+  bool isQueued = false;
+  for (boost::uint64_t i = first; i <= last; ++i) {
+    Cache::PagePtr &page = c.pages[i];
+    if (!page) {
+      page.reset(new Cache::Page);
+      c.queue.push_back(i);
+      c.queued.insert(i);
+      isQueued = true;
+    }
+  }
+  if (isQueued) {
+    c.queueChanged.notify_all();
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::setSize(const boost::uint64_t size)
+{
+  m_cache->size = size;
+}
+
+//----------------------------------------------------------------------------//
+
+void RangeStreamSource::stopFetching()
+{
+  {
+    boost::mutex::scoped_lock lock(m_cache->mutex);
+    m_cache->isStopping = true;
+    m_cache->queueChanged.notify_all();
+  }
+  m_cache->threads.join_all();
+}
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+void registerStreamSource(const std::string &scheme,
+                          const StreamSourceFactory &factory)
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  r.factories[scheme] = factory;
+}
+
+//----------------------------------------------------------------------------//
+
+bool hasStreamSource(const std::string &filename)
+{
+  const std::string s = scheme(filename);
+  if (s.empty()) {
+    return false;
+  }
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  return r.factories.count(s) != 0;
+}
+
+//----------------------------------------------------------------------------//
+
+StreamSource::Ptr openStreamSource(const std::string &filename)
+{
+  Registry &r = registry();
+
+  // Share the source if it's still open
+  StreamSourceFactory factory;
+  {
+    boost::mutex::scoped_lock lock(r.mutex);
+    std::map<std::string, StreamSourceFactory>::const_iterator f = 
+      r.factories.find(scheme(filename));
+    if (f == r.factories.end()) {
+      return StreamSource::Ptr();
+    }
+    if (StreamSource::Ptr source = r.sources[filename].lock()) {
+      return source;
+    }
+    factory = f->second;
+  }
+
+  // Opening may take a round trip, so it's done without the lock
+  StreamSource::Ptr source = factory(filename);
+  if (!source) {
+    return source;
+  }
+
+  boost::mutex::scoped_lock lock(r.mutex);
+  if (StreamSource::Ptr other = r.sources[filename].lock()) {
+    return other;
+  }
+  r.sources[filename] = source;
+  return source;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,197 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file ThreadPool.cpp
+  Contains implementation of the ThreadPool class.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Static members
+//----------------------------------------------------------------------------//
+
+ThreadPool   *ThreadPool::ms_singleton = NULL;
+boost::mutex  ThreadPool::ms_creationMutex;
+
+//----------------------------------------------------------------------------//
+// ThreadPool implementations
+//----------------------------------------------------------------------------//
+
+ThreadPool::ThreadPool()
+  : m_numWorkers(0)
+{
+  // Empty
+}
+
+//----------------------------------------------------------------------------//
+
+ThreadPool& ThreadPool::singleton()
+{
+  boost::mutex::scoped_lock lock(ms_creationMutex);
+  if (!ms_singleton) {
+    ms_singleton = new ThreadPool;
+  }
+  return *ms_singleton;
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::reserve(const size_t numThreads)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (m_numWorkers + 1 < numThreads) {
+    m_workers.create_thread(boost::bind(&ThreadPool::workerLoop, this));
+    m_numWorkers++;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t ThreadPool::numThreads() const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  return m_numWorkers + 1;
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::run(Task &task, const size_t numThreads)
+{
+  if (numThreads <= 1) {
+    task.run(0);
+    return;
+  }
+
+  reserve(numThreads);
+
+  // Offer the job to the pool threads, then work on it from this one
+  Job job;
+  job.task          = &task;
+  job.numThreads    = numThreads;
+  job.nextThreadIdx = 1;
+  job.numActive     = 0;
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_jobs.push_back(&job);
+  }
+  m_jobQueued.notify_all();
+
+  try {
+    task.run(0);
+  }
+  catch (...) {
+    finishJob(job);
+    throw;
+  }
+  finishJob(job);
+
+  // The pool threads can't throw to anyone, so their exception is passed 
+  // on from here
+  if (job.exception) {
+    boost::rethrow_exception(job.exception);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::finishJob(Job &job)
+{
+  // Threads that haven't started on the job by now aren't needed. The 
+  // job lives on the stack of run(), so wait for those that did
+  boost::mutex::scoped_lock lock(m_mutex);
+  std::deque<Job*>::iterator i = std::find(m_jobs.begin(), m_jobs.end(), 
+                                           &job);
+  if (i != m_jobs.end()) {
+    m_jobs.erase(i);
+  }
+  while (job.numActive > 0) {
+    m_jobDone.wait(lock);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void ThreadPool::workerLoop()
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+  while (true) {
+    if (m_jobs.empty()) {
+      m_jobQueued.wait(lock);
+      continue;
+    }
+    // Take the next thread index of the oldest job
+    Job *job = m_jobs.front();
+    const size_t threadIdx = job->nextThreadIdx++;
+    job->numActive++;
+    if (job->nextThreadIdx >= job->numThreads) {
+      m_jobs.pop_front();
+    }
+    lock.unlock();
+    boost::exception_ptr exception;
+    try {
+      job->task->run(threadIdx);
+    }
+    catch (...) {
+      exception = boost::current_exception();
+    }
+    lock.lock();
+    if (exception && !job->exception) {
+      job->exception = exception;
+    }
+    job->numActive--;
+    if (job->numActive == 0) {
+      m_jobDone.notify_all();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
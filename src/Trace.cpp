@@ -0,0 +1,386 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file Trace.cpp
+  Contains implementations of the Trace event recording.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "JsonUtil.h"
+#include "Stats.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+
+namespace Trace {
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! Number of events kept from threads that have exited
+const size_t k_maxRetiredEvents = 1 << 18;
+
+//----------------------------------------------------------------------------//
+
+struct Event
+{
+  const char      *name;
+  boost::uint64_t  start;
+  boost::uint64_t  duration;
+  boost::int64_t   arg;
+  int              threadId;
+  bool             isInstant;
+};
+
+//----------------------------------------------------------------------------//
+
+/*! The ring buffer of one thread. Only the owning thread writes events. 
+  Readers copy the events between first and head, and then discard any 
+  that the owner may have overwritten while they were copying.
+*/
+struct ThreadBuffer
+{
+  ThreadBuffer(const int id)
+    : threadId(id), events(k_eventsPerThread)
+  { 
+    head.store(0, boost::memory_order_relaxed);
+    first.store(0, boost::memory_order_relaxed);
+  }
+  const int                      threadId;
+  std::vector<Event>             events;
+  //! Number of events ever written. Published after each write.
+  boost::atomic<boost::uint64_t> head;
+  //! Index of the first event not discarded by clear()
+  boost::atomic<boost::uint64_t> first;
+};
+
+//----------------------------------------------------------------------------//
+
+//! All buffers, and the events of threads that have exited
+struct Registry
+{
+  Registry()
+    : nextThreadId(1), isDumpRegistered(false)
+  { }
+  boost::mutex                mutex;
+  std::vector<ThreadBuffer *> live;
+  std::deque<Event>           retired;
+  int                         nextThreadId;
+  std::string                 dumpFilename;
+  bool                        isDumpRegistered;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Never destroyed, so that threads exiting during static destruction can 
+//! still retire their events
+Registry& registry()
+{
+  static Registry *s_registry = new Registry;
+  return *s_registry;
+}
+
+//----------------------------------------------------------------------------//
+
+boost::atomic<bool> s_isEnabled(false);
+
+//----------------------------------------------------------------------------//
+
+//! Appends the events held by the buffer to out
+void copyEvents(const ThreadBuffer &buffer, std::vector<Event> &out)
+{
+  const boost::uint64_t size  = buffer.events.size();
+  const boost::uint64_t end   = buffer.head.load(boost::memory_order_acquire);
+  const boost::uint64_t first = buffer.first.load(boost::memory_order_relaxed);
+  const boost::uint64_t begin = std::max(first, end > size ? end - size : 0);
+  const size_t          start = out.size();
+  for (boost::uint64_t i = begin; i < end; ++i) {
+    out.push_back(buffer.events[i % size]);
+  }
+  // The event being written when we finished copying may have overwritten 
+  // one of the oldest ones
+  const boost::uint64_t after = buffer.head.load(boost::memory_order_acquire);
+  if (after + 1 > begin + size) {
+    const size_t numStale = 
+      std::min(after + 1 - (begin + size), end - begin);
+    out.erase(out.begin() + start, out.begin() + start + numStale);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+#ifndef FIELD3D_DISABLE_STATS
+
+//! Called as a thread exits. Keeps its events with the retired ones.
+void retireBuffer(ThreadBuffer *buffer)
+{
+  std::vector<Event> events;
+  copyEvents(*buffer, events);
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  r.retired.insert(r.retired.end(), events.begin(), events.end());
+  if (r.retired.size() > k_maxRetiredEvents) {
+    r.retired.erase(r.retired.begin(), 
+                    r.retired.end() - k_maxRetiredEvents);
+  }
+  r.live.erase(std::remove(r.live.begin(), r.live.end(), buffer), 
+               r.live.end());
+  delete buffer;
+}
+
+//----------------------------------------------------------------------------//
+
+boost::thread_specific_ptr<ThreadBuffer>& threadBufferPtr()
+{
+  static boost::thread_specific_ptr<ThreadBuffer> *s_ptr = 
+    new boost::thread_specific_ptr<ThreadBuffer>(retireBuffer);
+  return *s_ptr;
+}
+
+//----------------------------------------------------------------------------//
+
+ThreadBuffer& threadBuffer()
+{
+  ThreadBuffer *buffer = threadBufferPtr().get();
+  if (!buffer) {
+    Registry &r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    buffer = new ThreadBuffer(r.nextThreadId++);
+    r.live.push_back(buffer);
+    threadBufferPtr().reset(buffer);
+  }
+  return *buffer;
+}
+
+//----------------------------------------------------------------------------//
+
+void push(const char *name, const boost::uint64_t start, 
+          const boost::uint64_t duration, const boost::int64_t arg, 
+          const bool isInstant)
+{
+  ThreadBuffer &buffer = threadBuffer();
+  const boost::uint64_t h = buffer.head.load(boost::memory_order_relaxed);
+  Event &e = buffer.events[h % buffer.events.size()];
+  e.name      = name;
+  e.start     = start;
+  e.duration  = duration;
+  e.arg       = arg;
+  e.threadId  = buffer.threadId;
+  e.isInstant = isInstant;
+  buffer.head.store(h + 1, boost::memory_order_release);
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+//! All events currently held
+std::vector<Event> snapshot()
+{
+  std::vector<Event> events;
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  events.assign(r.retired.begin(), r.retired.end());
+  for (size_t i = 0; i < r.live.size(); ++i) {
+    copyEvents(*r.live[i], events);
+  }
+  return events;
+}
+
+//----------------------------------------------------------------------------//
+
+void dumpAtExit()
+{
+  std::string filename;
+  {
+    Registry &r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    filename = r.dumpFilename;
+  }
+  if (!filename.empty()) {
+    writeChromeTrace(filename);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// Trace implementations
+//----------------------------------------------------------------------------//
+
+void setEnabled(const bool enabled)
+{
+#ifndef FIELD3D_DISABLE_STATS
+  s_isEnabled.store(enabled, boost::memory_order_relaxed);
+#endif
+}
+
+//----------------------------------------------------------------------------//
+
+bool isEnabled()
+{
+  return s_isEnabled.load(boost::memory_order_relaxed);
+}
+
+//----------------------------------------------------------------------------//
+
+void clear()
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  r.retired.clear();
+  for (size_t i = 0; i < r.live.size(); ++i) {
+    r.live[i]->first.store(r.live[i]->head.load(boost::memory_order_acquire),
+                           boost::memory_order_relaxed);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+size_t numEvents()
+{
+  return snapshot().size();
+}
+
+//----------------------------------------------------------------------------//
+
+void writeChromeTrace(std::ostream &os)
+{
+  const std::vector<Event> events = snapshot();
+
+  os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  for (size_t i = 0; i < events.size(); ++i) {
+    const Event &e = events[i];
+    os << (i == 0 ? "\n" : ",\n") << "{\"name\": ";
+    writeJsonString(os, e.name);
+    os << ", \"cat\": \"field3d\", \"ph\": " 
+       << (e.isInstant ? "\"i\", \"s\": \"t\"" : "\"X\"") 
+       << ", \"ts\": " << e.start;
+    if (!e.isInstant) {
+      os << ", \"dur\": " << e.duration;
+    }
+    os << ", \"pid\": 1, \"tid\": " << e.threadId;
+    if (e.arg >= 0) {
+      os << ", \"args\": {\"index\": " << e.arg << "}";
+    }
+    os << "}";
+  }
+  os << "\n]}\n";
+}
+
+//----------------------------------------------------------------------------//
+
+bool writeChromeTrace(const std::string &filename)
+{
+  std::ofstream out(filename.c_str());
+  if (!out) {
+    return false;
+  }
+  writeChromeTrace(out);
+  return out.good();
+}
+
+//----------------------------------------------------------------------------//
+
+void setDumpAtExit(const std::string &filename)
+{
+  Registry &r = registry();
+  boost::mutex::scoped_lock lock(r.mutex);
+  r.dumpFilename = filename;
+  if (!filename.empty() && !r.isDumpRegistered) {
+    std::atexit(dumpAtExit);
+    r.isDumpRegistered = true;
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+boost::uint64_t now()
+{
+  return Stats::microseconds();
+}
+
+//----------------------------------------------------------------------------//
+
+#ifndef FIELD3D_DISABLE_STATS
+
+void addEvent(const char *name, const boost::uint64_t start, 
+              const boost::uint64_t duration, const boost::int64_t arg)
+{
+  push(name, start, duration, arg, false);
+}
+
+//----------------------------------------------------------------------------//
+
+void addInstant(const char *name, const boost::int64_t arg)
+{
+  push(name, now(), 0, arg, true);
+}
+
+#endif
+
+//----------------------------------------------------------------------------//
+
+} // namespace Trace
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
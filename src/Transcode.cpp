@@ -0,0 +1,295 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//----------------------------------------------------------------------------//
+
+/*! \file Transcode.cpp
+  Contains the implementation of transcode()
+*/
+
+//----------------------------------------------------------------------------//
+
+// Header include
+#include "Transcode.h"
+
+// System includes
+#include <algorithm>
+
+// Boost includes
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+
+// Library includes
+#include "Field3DFile.h"
+#include "InitIO.h"
+#include "Log.h"
+#include "PatternMatch.h"
+#include "SparseField.h"
+#include "ThreadPool.h"
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_OPEN
+
+//----------------------------------------------------------------------------//
+// Local namespace
+//----------------------------------------------------------------------------//
+
+namespace {
+
+//----------------------------------------------------------------------------//
+
+//! A layer to convert
+struct TranscodeJob
+{
+  TranscodeJob(const std::string &i_partition, const std::string &i_layer)
+    : partition(i_partition), layer(i_layer)
+  { }
+  std::string partition;
+  std::string layer;
+};
+
+//----------------------------------------------------------------------------//
+
+//! The fields read for a layer. Only the list matching the layer's data type
+//! is filled in.
+struct TranscodeResult
+{
+  Field<half>::Vec   halfFields;
+  Field<float>::Vec  floatFields;
+  Field<double>::Vec doubleFields;
+  Field<V3h>::Vec    vecHalfFields;
+  Field<V3f>::Vec    vecFloatFields;
+  Field<V3d>::Vec    vecDoubleFields;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Reads a batch of layers, handing out one layer at a time
+class ReadLayerOp
+{
+public:
+  ReadLayerOp(const Field3DInputFile &in, 
+              const std::vector<TranscodeJob> &jobs,
+              const size_t firstJob, std::vector<TranscodeResult> &results,
+              boost::atomic<size_t> &nextResult)
+    : m_in(in), m_jobs(jobs), m_firstJob(firstJob), m_results(results), 
+      m_nextResult(nextResult)
+  { }
+  void operator() ()
+  {
+    for (size_t i = m_nextResult.fetch_add(1); i < m_results.size(); 
+         i = m_nextResult.fetch_add(1)) {
+      const TranscodeJob &job    = m_jobs[m_firstJob + i];
+      TranscodeResult    &result = m_results[i];
+      // Reading a layer as the wrong data type returns nothing, without 
+      // touching the voxel data
+      result.halfFields = 
+        m_in.readScalarLayers<half>(job.partition, job.layer);
+      result.floatFields = 
+        m_in.readScalarLayers<float>(job.partition, job.layer);
+      result.doubleFields = 
+        m_in.readScalarLayers<double>(job.partition, job.layer);
+      result.vecHalfFields = 
+        m_in.readVectorLayers<half>(job.partition, job.layer);
+      result.vecFloatFields = 
+        m_in.readVectorLayers<float>(job.partition, job.layer);
+      result.vecDoubleFields = 
+        m_in.readVectorLayers<double>(job.partition, job.layer);
+    }
+  }
+private:
+  const Field3DInputFile &m_in;
+  const std::vector<TranscodeJob> &m_jobs;
+  const size_t m_firstJob;
+  std::vector<TranscodeResult> &m_results;
+  boost::atomic<size_t> &m_nextResult;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Appends the fields of one list to another
+template <class Data_T>
+void append(const typename Field<Data_T>::Vec &src, 
+            typename Field<Data_T>::Vec &dst)
+{
+  dst.insert(dst.end(), src.begin(), src.end());
+}
+
+//----------------------------------------------------------------------------//
+
+//! Converts the SparseFields of a list to the requested block order and 
+//! releases their uniform blocks. Other fields are left alone.
+template <class Data_T>
+void restructure(typename Field<Data_T>::Vec &fields, 
+                 const TranscodeOptions &options)
+{
+  for (size_t i = 0; i < fields.size(); ++i) {
+    typename SparseField<Data_T>::Ptr sparse = 
+      field_dynamic_cast<SparseField<Data_T> >(fields[i]);
+    if (!sparse) {
+      continue;
+    }
+    if (options.blockOrder > 0 && options.blockOrder != sparse->blockOrder()) {
+      typename SparseField<Data_T>::Ptr converted(new SparseField<Data_T>);
+      converted->setBlockOrder(options.blockOrder);
+      converted->copyFrom(fields[i]);
+      converted->name = sparse->name;
+      converted->attribute = sparse->attribute;
+      converted->copyMetadata(*sparse);
+      fields[i] = sparse = converted;
+    }
+    if (options.releaseUniformBlocks) {
+      sparse->releaseUniformBlocks();
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Writes all fields of one data type from a batch of results
+template <class Data_T>
+bool writeFields(Field3DOutputFile &out, 
+                 const typename Field<Data_T>::Vec &fields)
+{
+  return fields.empty() || out.writeLayers<Data_T>(fields);
+}
+
+//----------------------------------------------------------------------------//
+
+} // anonymous namespace
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+bool transcode(const std::string &inputPath, const std::string &outputPath,
+               const TranscodeOptions &options)
+{
+  using std::string;
+  using std::vector;
+
+  Field3DInputFile in;
+  if (!in.open(inputPath)) {
+    Msg::print(Msg::SevWarning, "transcode(): Couldn't open " + inputPath);
+    return false;
+  }
+
+  // Always write Ogawa, regardless of the current setting
+  Field3DOutputFile out;
+  const bool doOgawa = Field3DOutputFile::usingOgawa();
+  Field3DOutputFile::useOgawa(true);
+  const bool created = out.create(outputPath);
+  Field3DOutputFile::useOgawa(doOgawa);
+  if (!created) {
+    Msg::print(Msg::SevWarning, "transcode(): Couldn't create " + outputPath);
+    return false;
+  }
+
+  // Find the layers to convert, in file order. The patterns are parsed 
+  // once for all partitions and layers.
+  const MatchPattern partitionPattern(options.partitions);
+  const MatchPattern layerPattern(options.layers);
+  vector<TranscodeJob> jobs;
+  vector<string> partitions;
+  in.getPartitionNames(partitions, partitionPattern);
+  for (size_t p = 0; p < partitions.size(); ++p) {
+    // Ogawa files list every layer as both a scalar and a vector layer
+    vector<string> layers, vectorLayers;
+    in.getScalarLayerNames(layers, partitions[p], layerPattern);
+    in.getVectorLayerNames(vectorLayers, partitions[p], layerPattern);
+    for (size_t l = 0; l < vectorLayers.size(); ++l) {
+      if (std::find(layers.begin(), layers.end(), vectorLayers[l]) == 
+          layers.end()) {
+        layers.push_back(vectorLayers[l]);
+      }
+    }
+    for (size_t l = 0; l < layers.size(); ++l) {
+      jobs.push_back(TranscodeJob(partitions[p], layers[l]));
+    }
+  }
+
+  // Read and write the layers in batches
+  const size_t numThreads = 
+    std::max(options.numThreads > 0 ? options.numThreads : numIOThreads(),
+             size_t(1));
+
+  bool success = true;
+
+  for (size_t first = 0; first < jobs.size(); first += numThreads) {
+    vector<TranscodeResult> results(std::min(numThreads, 
+                                             jobs.size() - first));
+    boost::atomic<size_t> nextResult(0);
+    ReadLayerOp op(in, jobs, first, results, nextResult);
+    runOnThreads(op, results.size());
+    // Gather the fields by data type, so that each type's SparseFields are
+    // compressed together
+    TranscodeResult batch;
+    for (size_t i = 0; i < results.size(); ++i) {
+      append<half>(results[i].halfFields, batch.halfFields);
+      append<float>(results[i].floatFields, batch.floatFields);
+      append<double>(results[i].doubleFields, batch.doubleFields);
+      append<V3h>(results[i].vecHalfFields, batch.vecHalfFields);
+      append<V3f>(results[i].vecFloatFields, batch.vecFloatFields);
+      append<V3d>(results[i].vecDoubleFields, batch.vecDoubleFields);
+    }
+    restructure<half>(batch.halfFields, options);
+    restructure<float>(batch.floatFields, options);
+    restructure<double>(batch.doubleFields, options);
+    restructure<V3h>(batch.vecHalfFields, options);
+    restructure<V3f>(batch.vecFloatFields, options);
+    restructure<V3d>(batch.vecDoubleFields, options);
+    success &= writeFields<half>(out, batch.halfFields);
+    success &= writeFields<float>(out, batch.floatFields);
+    success &= writeFields<double>(out, batch.doubleFields);
+    success &= writeFields<V3h>(out, batch.vecHalfFields);
+    success &= writeFields<V3f>(out, batch.vecFloatFields);
+    success &= writeFields<V3d>(out, batch.vecDoubleFields);
+  }
+
+  // Global metadata
+  out.metadata() = in.metadata();
+  success &= out.writeGlobalMetadata();
+
+  success &= out.close();
+
+  return success;
+}
+
+//----------------------------------------------------------------------------//
+
+FIELD3D_NAMESPACE_SOURCE_CLOSE
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,948 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file main.cpp
+  Microbenchmarks of the library's hot kernels. Each benchmark is run for
+  a minimum time, a number of times, and the fastest run is reported as 
+  nanoseconds per item. Results can be saved as JSON and later used as a
+  baseline, in which case benchmarks that got slower than the tolerance 
+  allows are reported and the exit status is non-zero.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/mpl/vector.hpp>
+#include <boost/program_options.hpp>
+
+#include <Field3D/DenseField.h>
+#include <Field3D/FieldGroup.h>
+#include <Field3D/FieldInterp.h>
+#include <Field3D/FieldMapping.h>
+#include <Field3D/InitIO.h>
+#include <Field3D/MACField.h>
+#include <Field3D/MIPField.h>
+#include <Field3D/MIPUtil.h>
+#include <Field3D/Resample.h>
+#include <Field3D/SparseField.h>
+
+#include "BlockCodec.h"
+
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+// Options struct
+//----------------------------------------------------------------------------//
+
+struct Options {
+  Options()
+    : minTime(0.25), numRepeats(3), numThreads(1), tolerance(0.1), 
+      list(false)
+  { }
+  vector<string> filters;
+  string         outputFile;
+  string         baselineFile;
+  double         minTime;
+  size_t         numRepeats;
+  size_t         numThreads;
+  double         tolerance;
+  bool           list;
+};
+
+//----------------------------------------------------------------------------//
+// Constants
+//----------------------------------------------------------------------------//
+
+//! Number of random points used by the lookup benchmarks
+const size_t k_numPoints = 1 << 16;
+
+//----------------------------------------------------------------------------//
+// Function prototypes
+//----------------------------------------------------------------------------//
+
+//! Parses command line options, puts them in Options struct.
+Options parseOptions(int argc, char **argv);
+
+//! Returns the wall clock time in seconds
+double wallTime();
+
+//! Adds all benchmarks to the registry
+void registerBenchmarks();
+
+//----------------------------------------------------------------------------//
+// BenchState
+//----------------------------------------------------------------------------//
+
+/*! \class BenchState
+  Passed to each benchmark function, which does its setup and then loops 
+  while keepRunning() returns true. Only the loop is timed.
+*/
+
+//----------------------------------------------------------------------------//
+
+class BenchState
+{
+public:
+  BenchState(const int arg, const size_t numThreads, const double minTime)
+    : m_arg(arg), m_numThreads(numThreads), m_minTime(minTime), 
+      m_numIterations(0), m_itemsPerIteration(1), m_start(0.0), 
+      m_elapsed(0.0), m_isRunning(false), m_sink(0.0)
+  { }
+  //! Benchmark parameter, e.g. a resolution or a codec
+  int arg() const
+  { return m_arg; }
+  //! Number of threads the benchmark may use
+  size_t numThreads() const
+  { return m_numThreads; }
+  //! Sets the number of items, e.g. lookups or voxels, processed by each 
+  //! iteration of the loop
+  void setItemsPerIteration(const size_t numItems)
+  { m_itemsPerIteration = numItems; }
+  //! Starts the clock on the first call, and returns false once the 
+  //! minimum time has passed
+  bool keepRunning()
+  {
+    const double now = wallTime();
+    if (!m_isRunning) {
+      m_isRunning = true;
+      m_start = now;
+      return true;
+    }
+    ++m_numIterations;
+    if (now - m_start < m_minTime) {
+      return true;
+    }
+    m_elapsed = now - m_start;
+    return false;
+  }
+  //! Consumes a result so that the work producing it isn't optimized away
+  void keep(const double value)
+  { m_sink = m_sink + value; }
+  //! Time per item, in nanoseconds
+  double nsPerItem() const
+  { 
+    if (m_numIterations == 0) {
+      return 0.0;
+    }
+    return m_elapsed * 1e9 / 
+      (static_cast<double>(m_numIterations) * m_itemsPerIteration);
+  }
+private:
+  int             m_arg;
+  size_t          m_numThreads;
+  double          m_minTime;
+  size_t          m_numIterations;
+  size_t          m_itemsPerIteration;
+  double          m_start;
+  double          m_elapsed;
+  bool            m_isRunning;
+  volatile double m_sink;
+};
+
+//----------------------------------------------------------------------------//
+// Benchmark registry
+//----------------------------------------------------------------------------//
+
+typedef void (*BenchFunc)(BenchState &state);
+
+struct Benchmark {
+  string    name;
+  BenchFunc func;
+  int       arg;
+};
+
+//----------------------------------------------------------------------------//
+
+vector<Benchmark>& benchmarks()
+{
+  static vector<Benchmark> s_benchmarks;
+  return s_benchmarks;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Registers a benchmark. The argument, if non-negative, is appended to 
+//! the name.
+void addBenchmark(const string &name, const BenchFunc func, const int arg = -1)
+{
+  Benchmark b;
+  b.name = name;
+  if (arg >= 0) {
+    b.name += "/" + boost::lexical_cast<string>(arg);
+  }
+  b.func = func;
+  b.arg  = arg;
+  benchmarks().push_back(b);
+}
+
+//----------------------------------------------------------------------------//
+// Setup helpers
+//----------------------------------------------------------------------------//
+
+//! Returns a pseudo-random number in [0,1). Deterministic, so that runs 
+//! are comparable.
+inline double random01(unsigned int &seed)
+{
+  seed = seed * 1664525u + 1013904223u;
+  return (seed >> 8) * (1.0 / 16777216.0);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns k_numPoints random points within the given box
+vector<V3d> randomPoints(const Box3d &box)
+{
+  unsigned int seed = 1;
+  vector<V3d> points(k_numPoints);
+  const V3d size = box.size();
+  for (size_t i = 0; i < points.size(); ++i) {
+    points[i] = box.min + V3d(random01(seed) * size.x, 
+                              random01(seed) * size.y,
+                              random01(seed) * size.z);
+  }
+  return points;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns random voxel space points within the field's data window
+template <class Field_T>
+vector<V3d> randomVoxelPoints(const Field_T &field)
+{
+  const Box3i dataW = field.dataWindow();
+  return randomPoints(Box3d(V3d(dataW.min) + V3d(0.5), 
+                            V3d(dataW.max) + V3d(0.5)));
+}
+
+//----------------------------------------------------------------------------//
+
+inline float smoothValue(const int i, const int j, const int k)
+{
+  return std::sin(i * 0.1f) * std::cos(j * 0.07f) + k * 0.01f;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Fills a dense or sparse field of the given resolution with smoothly 
+//! varying values
+template <class Field_T>
+void fillField(Field_T &field, const int res)
+{
+  typedef typename Field_T::value_type Data_T;
+  field.setSize(V3i(res));
+  for (int k = 0; k < res; ++k) {
+    for (int j = 0; j < res; ++j) {
+      for (int i = 0; i < res; ++i) {
+        field.lvalue(i, j, k) = Data_T(smoothValue(i, j, k));
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+void fillField(MACField<V3f> &field, const int res)
+{
+  field.setSize(V3i(res));
+  for (int k = 0; k <= res; ++k) {
+    for (int j = 0; j <= res; ++j) {
+      for (int i = 0; i <= res; ++i) {
+        if (j < res && k < res) {
+          field.u(i, j, k) = smoothValue(i, j, k);
+        }
+        if (i < res && k < res) {
+          field.v(i, j, k) = smoothValue(j, k, i);
+        }
+        if (i < res && j < res) {
+          field.w(i, j, k) = smoothValue(k, i, j);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+inline double toDouble(const float value)
+{ return value; }
+
+inline double toDouble(const V3f &value)
+{ return value.x + value.y + value.z; }
+
+//----------------------------------------------------------------------------//
+// fastValue benchmarks
+//----------------------------------------------------------------------------//
+
+//! Looks up every voxel in order. The argument is the resolution.
+template <class Field_T>
+void benchFastValueSequential(BenchState &state)
+{
+  const int res = state.arg();
+  Field_T field;
+  fillField(field, res);
+  state.setItemsPerIteration(static_cast<size_t>(res) * res * res);
+  while (state.keepRunning()) {
+    float sum = 0.0f;
+    for (int k = 0; k < res; ++k) {
+      for (int j = 0; j < res; ++j) {
+        for (int i = 0; i < res; ++i) {
+          sum += field.fastValue(i, j, k);
+        }
+      }
+    }
+    state.keep(sum);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Looks up random voxels. The argument is the resolution.
+template <class Field_T>
+void benchFastValueRandom(BenchState &state)
+{
+  Field_T field;
+  fillField(field, state.arg());
+  const vector<V3d> points = randomVoxelPoints(field);
+  vector<V3i> voxels(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    voxels[i] = V3i(static_cast<int>(points[i].x), 
+                    static_cast<int>(points[i].y), 
+                    static_cast<int>(points[i].z));
+  }
+  state.setItemsPerIteration(voxels.size());
+  while (state.keepRunning()) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < voxels.size(); ++i) {
+      sum += field.fastValue(voxels[i].x, voxels[i].y, voxels[i].z);
+    }
+    state.keep(sum);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Interpolator benchmarks
+//----------------------------------------------------------------------------//
+
+//! Samples random points one at a time. The argument is the resolution.
+template <class Interp_T, class Field_T>
+void benchInterp(BenchState &state)
+{
+  typedef typename Field_T::value_type Data_T;
+  Field_T field;
+  fillField(field, state.arg());
+  const vector<V3d> points = randomVoxelPoints(field);
+  Interp_T interp;
+  state.setItemsPerIteration(points.size());
+  while (state.keepRunning()) {
+    Data_T sum(0.0f);
+    for (size_t i = 0; i < points.size(); ++i) {
+      sum += interp.sample(field, points[i]);
+    }
+    state.keep(toDouble(sum));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Samples random points with the batched sample() call of the generic
+//! interpolators. The argument is the resolution.
+template <class Interp_T, class Field_T>
+void benchInterpBatch(BenchState &state)
+{
+  typedef typename Field_T::value_type Data_T;
+  Field_T field;
+  fillField(field, state.arg());
+  const vector<V3d> points = randomVoxelPoints(field);
+  const vector<V3f> pointsF(points.begin(), points.end());
+  vector<Data_T> results(points.size());
+  Interp_T interp;
+  state.setItemsPerIteration(points.size());
+  while (state.keepRunning()) {
+    interp.sample(field, pointsF.size(), &pointsF[0], &results[0]);
+    state.keep(toDouble(results[results.size() / 2]));
+  }
+}
+
+//----------------------------------------------------------------------------//
+// FieldMapping benchmarks
+//----------------------------------------------------------------------------//
+
+//! Returns a mapping set up for a 64^3 field
+template <class Mapping_T>
+FieldMapping::Ptr makeMapping()
+{
+  typename Mapping_T::Ptr mapping(new Mapping_T);
+  DenseField<float> field;
+  field.setSize(V3i(64));
+  field.setMapping(mapping);
+  return field.mapping();
+}
+
+//----------------------------------------------------------------------------//
+
+//! World space points within the default frustum and the unit box
+vector<V3d> mappingPoints()
+{
+  return randomPoints(Box3d(V3d(-0.25, -0.25, -1.75), V3d(0.25, 0.25, -1.25)));
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Mapping_T>
+void benchWorldToVoxel(BenchState &state)
+{
+  const FieldMapping::Ptr mapping = makeMapping<Mapping_T>();
+  const vector<V3d> points = mappingPoints();
+  state.setItemsPerIteration(points.size());
+  while (state.keepRunning()) {
+    double sum = 0.0;
+    V3d vsP;
+    for (size_t i = 0; i < points.size(); ++i) {
+      mapping->worldToVoxel(points[i], vsP);
+      sum += vsP.x;
+    }
+    state.keep(sum);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Mapping_T>
+void benchVoxelToWorld(BenchState &state)
+{
+  const FieldMapping::Ptr mapping = makeMapping<Mapping_T>();
+  const vector<V3d> points = randomPoints(Box3d(V3d(0.0), V3d(64.0)));
+  state.setItemsPerIteration(points.size());
+  while (state.keepRunning()) {
+    double sum = 0.0;
+    V3d wsP;
+    for (size_t i = 0; i < points.size(); ++i) {
+      mapping->voxelToWorld(points[i], wsP);
+      sum += wsP.x;
+    }
+    state.keep(sum);
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+template <class Mapping_T>
+void benchWorldToVoxelBatch(BenchState &state)
+{
+  const FieldMapping::Ptr mapping = makeMapping<Mapping_T>();
+  const vector<V3d> points = mappingPoints();
+  const vector<V3f> wsP(points.begin(), points.end());
+  vector<V3f> vsP(wsP.size());
+  state.setItemsPerIteration(wsP.size());
+  while (state.keepRunning()) {
+    mapping->worldToVoxel(&wsP[0], &vsP[0], wsP.size());
+    state.keep(vsP[vsP.size() / 2].x);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// BlockCodec benchmarks
+//----------------------------------------------------------------------------//
+
+//! Returns a 16^3 block of float data
+vector<float> codecBlock()
+{
+  vector<float> block;
+  block.reserve(16 * 16 * 16);
+  for (int k = 0; k < 16; ++k) {
+    for (int j = 0; j < 16; ++j) {
+      for (int i = 0; i < 16; ++i) {
+        block.push_back(smoothValue(i, j, k));
+      }
+    }
+  }
+  return block;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Compresses a block. The argument is the SparseCodec.
+void benchCompress(BenchState &state)
+{
+  const SparseCodec codec = static_cast<SparseCodec>(state.arg());
+  const vector<float> block = codecBlock();
+  const size_t srcLen = block.size() * sizeof(float);
+  vector<boost::uint8_t> dst(BlockCodec::compressBound(codec, srcLen));
+  vector<boost::uint8_t> scratch;
+  state.setItemsPerIteration(block.size());
+  while (state.keepRunning()) {
+    size_t dstLen = dst.size();
+    BlockCodec::compress(codec, sizeof(float), 
+                         reinterpret_cast<const boost::uint8_t*>(&block[0]),
+                         srcLen, &dst[0], dstLen, scratch);
+    state.keep(static_cast<double>(dstLen));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Decompresses a block. The argument is the SparseCodec.
+void benchDecompress(BenchState &state)
+{
+  const SparseCodec codec = static_cast<SparseCodec>(state.arg());
+  vector<float> block = codecBlock();
+  const size_t srcLen = block.size() * sizeof(float);
+  vector<boost::uint8_t> compressed(BlockCodec::compressBound(codec, srcLen));
+  vector<boost::uint8_t> scratch;
+  size_t compressedLen = compressed.size();
+  if (!BlockCodec::compress(codec, sizeof(float), 
+                            reinterpret_cast<const boost::uint8_t*>(&block[0]),
+                            srcLen, &compressed[0], compressedLen, scratch)) {
+    return;
+  }
+  state.setItemsPerIteration(block.size());
+  while (state.keepRunning()) {
+    BlockCodec::decompress(codec, sizeof(float), &compressed[0], 
+                           compressedLen, 
+                           reinterpret_cast<boost::uint8_t*>(&block[0]),
+                           srcLen, scratch);
+    state.keep(block[block.size() / 2]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// makeMIP and resample benchmarks
+//----------------------------------------------------------------------------//
+
+//! Builds a MIP field. The argument is the base resolution, and the time
+//! is per base voxel.
+template <class Filter_T>
+void benchMakeMIP(BenchState &state)
+{
+  const int res = state.arg();
+  SparseField<float> base;
+  fillField(base, res);
+  state.setItemsPerIteration(static_cast<size_t>(res) * res * res);
+  while (state.keepRunning()) {
+    MIPSparseField<float>::Ptr mip = 
+      makeMIP<MIPSparseField<float>, Filter_T>(base, 8, state.numThreads());
+    state.keep(static_cast<double>(mip->numLevels()));
+  }
+}
+
+//----------------------------------------------------------------------------//
+
+//! Resamples a field to half its resolution. The argument is the source
+//! resolution, and the time is per target voxel.
+template <class Filter_T>
+void benchResample(BenchState &state)
+{
+  const int res = state.arg();
+  DenseField<float> src, tgt;
+  fillField(src, res);
+  const V3i newRes(res / 2);
+  state.setItemsPerIteration(static_cast<size_t>(newRes.x) * newRes.y * 
+                             newRes.z);
+  while (state.keepRunning()) {
+    resample(src, tgt, newRes, Filter_T(), state.numThreads());
+    state.keep(tgt.fastValue(0, 0, 0));
+  }
+}
+
+//----------------------------------------------------------------------------//
+// FieldGroup benchmarks
+//----------------------------------------------------------------------------//
+
+//! Samples a group of a dense and a sparse field, overlapping in world 
+//! space. The argument is the resolution.
+void benchSampleMultiple(BenchState &state)
+{
+  typedef FieldGroup<boost::mpl::vector<float>, 1> Group;
+
+  DenseField<float>::Ptr  dense(new DenseField<float>);
+  SparseField<float>::Ptr sparse(new SparseField<float>);
+  fillField(*dense, state.arg());
+  fillField(*sparse, state.arg());
+  FieldRes::Vec fields;
+  fields.push_back(dense);
+  fields.push_back(sparse);
+  Group group(fields);
+
+  const vector<V3d> points = randomPoints(Box3d(V3d(0.0), V3d(1.0)));
+  vector<float> wsP;
+  wsP.reserve(3 * points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    wsP.push_back(points[i].x);
+    wsP.push_back(points[i].y);
+    wsP.push_back(points[i].z);
+  }
+  vector<float> results(points.size());
+  state.setItemsPerIteration(points.size());
+  while (state.keepRunning()) {
+    std::fill(results.begin(), results.end(), 0.0f);
+    group.sampleMultiple(points.size(), &wsP[0], &results[0]);
+    state.keep(results[results.size() / 2]);
+  }
+}
+
+//----------------------------------------------------------------------------//
+// Registration
+//----------------------------------------------------------------------------//
+
+void registerBenchmarks()
+{
+  typedef DenseField<float>  DenseF;
+  typedef SparseField<float> SparseF;
+  typedef MACField<V3f>      MACF;
+
+  // fastValue
+  for (int res = 64; res <= 128; res *= 2) {
+    addBenchmark("fastValue/sequential/DenseField", 
+                 &benchFastValueSequential<DenseF>, res);
+    addBenchmark("fastValue/sequential/SparseField", 
+                 &benchFastValueSequential<SparseF>, res);
+    addBenchmark("fastValue/random/DenseField", 
+                 &benchFastValueRandom<DenseF>, res);
+    addBenchmark("fastValue/random/SparseField", 
+                 &benchFastValueRandom<SparseF>, res);
+  }
+
+  // Interpolators
+  const int res = 128;
+  addBenchmark("interp/LinearFieldInterp/DenseField", 
+               &benchInterp<LinearFieldInterp<float>, DenseF>, res);
+  addBenchmark("interp/LinearFieldInterp/SparseField", 
+               &benchInterp<LinearFieldInterp<float>, SparseF>, res);
+  addBenchmark("interp/CubicFieldInterp/DenseField", 
+               &benchInterp<CubicFieldInterp<float>, DenseF>, res);
+  addBenchmark("interp/StochasticFieldInterp/DenseField", 
+               &benchInterp<StochasticFieldInterp<float>, DenseF>, res);
+  addBenchmark("interp/LinearGenericFieldInterp/DenseField", 
+               &benchInterp<LinearGenericFieldInterp<DenseF>, DenseF>, res);
+  addBenchmark("interp/LinearGenericFieldInterp/SparseField", 
+               &benchInterp<LinearGenericFieldInterp<SparseF>, SparseF>, res);
+  addBenchmark("interp/LinearGenericFieldInterp/DenseField/batch", 
+               &benchInterpBatch<LinearGenericFieldInterp<DenseF>, DenseF>, 
+               res);
+  addBenchmark("interp/LinearGenericFieldInterp/SparseField/batch", 
+               &benchInterpBatch<LinearGenericFieldInterp<SparseF>, SparseF>,
+               res);
+  addBenchmark("interp/CubicGenericFieldInterp/DenseField", 
+               &benchInterp<CubicGenericFieldInterp<DenseF>, DenseF>, res);
+  addBenchmark("interp/CubicGenericFieldInterp/SparseField", 
+               &benchInterp<CubicGenericFieldInterp<SparseF>, SparseF>, res);
+  addBenchmark("interp/CubicGenericFieldInterp/DenseField/batch", 
+               &benchInterpBatch<CubicGenericFieldInterp<DenseF>, DenseF>, 
+               res);
+  addBenchmark("interp/CubicBSplineGenericFieldInterp/DenseField", 
+               &benchInterp<CubicBSplineGenericFieldInterp<DenseF>, DenseF>,
+               res);
+  addBenchmark("interp/StochasticGenericFieldInterp/DenseField", 
+               &benchInterp<StochasticGenericFieldInterp<DenseF>, DenseF>, 
+               res);
+  addBenchmark("interp/LinearMACFieldInterp/MACField", 
+               &benchInterp<LinearMACFieldInterp<V3f>, MACF>, 64);
+  addBenchmark("interp/CubicMACFieldInterp/MACField", 
+               &benchInterp<CubicMACFieldInterp<V3f>, MACF>, 64);
+
+  // Mappings
+  addBenchmark("mapping/MatrixFieldMapping/worldToVoxel", 
+               &benchWorldToVoxel<MatrixFieldMapping>);
+  addBenchmark("mapping/MatrixFieldMapping/voxelToWorld", 
+               &benchVoxelToWorld<MatrixFieldMapping>);
+  addBenchmark("mapping/MatrixFieldMapping/worldToVoxel/batch", 
+               &benchWorldToVoxelBatch<MatrixFieldMapping>);
+  addBenchmark("mapping/FrustumFieldMapping/worldToVoxel", 
+               &benchWorldToVoxel<FrustumFieldMapping>);
+  addBenchmark("mapping/FrustumFieldMapping/voxelToWorld", 
+               &benchVoxelToWorld<FrustumFieldMapping>);
+  addBenchmark("mapping/FrustumFieldMapping/worldToVoxel/batch", 
+               &benchWorldToVoxelBatch<FrustumFieldMapping>);
+
+  // Codecs
+  const int codecs[] = { SparseCodecZlib, SparseCodecShuffleZlib };
+  for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); ++i) {
+    addBenchmark("codec/compress", &benchCompress, codecs[i]);
+    addBenchmark("codec/decompress", &benchDecompress, codecs[i]);
+  }
+
+  // MIP generation and resampling
+  addBenchmark("makeMIP/BoxFilter", &benchMakeMIP<BoxFilter>, 128);
+  addBenchmark("makeMIP/TriangleFilter", &benchMakeMIP<TriangleFilter>, 128);
+  addBenchmark("makeMIP/GaussianFilter", &benchMakeMIP<GaussianFilter>, 128);
+  addBenchmark("makeMIP/MitchellFilter", &benchMakeMIP<MitchellFilter>, 128);
+  addBenchmark("makeMIP/MinFilter", &benchMakeMIP<MinFilter>, 128);
+  addBenchmark("makeMIP/MaxFilter", &benchMakeMIP<MaxFilter>, 128);
+  addBenchmark("resample/BoxFilter", &benchResample<BoxFilter>, 128);
+  addBenchmark("resample/TriangleFilter", &benchResample<TriangleFilter>, 128);
+  addBenchmark("resample/GaussianFilter", &benchResample<GaussianFilter>, 128);
+  addBenchmark("resample/MitchellFilter", &benchResample<MitchellFilter>, 128);
+
+  // FieldGroup
+  addBenchmark("FieldGroup/sampleMultiple", &benchSampleMultiple, 64);
+}
+
+//----------------------------------------------------------------------------//
+// Baselines
+//----------------------------------------------------------------------------//
+
+typedef map<string, double> ResultMap;
+
+//----------------------------------------------------------------------------//
+
+//! Reads the ns_per_item of each benchmark from a file written with 
+//! --output-file. Each benchmark is on a line of its own.
+bool readBaseline(const string &filename, ResultMap &baseline)
+{
+  ifstream in(filename.c_str());
+  if (!in) {
+    return false;
+  }
+  const string nameKey("\"name\": \""), timeKey("\"ns_per_item\": ");
+  string line;
+  while (getline(in, line)) {
+    const size_t namePos = line.find(nameKey);
+    const size_t timePos = line.find(timeKey);
+    if (namePos == string::npos || timePos == string::npos) {
+      continue;
+    }
+    const size_t nameStart = namePos + nameKey.size();
+    const size_t nameEnd   = line.find('"', nameStart);
+    if (nameEnd == string::npos) {
+      continue;
+    }
+    baseline[line.substr(nameStart, nameEnd - nameStart)] = 
+      std::atof(line.c_str() + timePos + timeKey.size());
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Writes the results, one benchmark per line
+void writeResults(ostream &os, const vector<string> &names, 
+                  const ResultMap &results)
+{
+  os << "{\n  \"benchmarks\": [";
+  for (size_t i = 0; i < names.size(); ++i) {
+    const double ns = results.find(names[i])->second;
+    os << (i == 0 ? "\n" : ",\n") 
+       << "    { \"name\": \"" << names[i] << "\", \"ns_per_item\": " 
+       << setprecision(6) << ns << ", \"items_per_second\": " 
+       << (ns > 0.0 ? 1e9 / ns : 0.0) << " }";
+  }
+  os << "\n  ]\n}\n";
+}
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv)
+{
+  Field3D::initIO();
+
+  Options options = parseOptions(argc, argv);
+
+  setNumIOThreads(options.numThreads);
+
+  registerBenchmarks();
+
+  ResultMap baseline;
+  if (!options.baselineFile.empty() && 
+      !readBaseline(options.baselineFile, baseline)) {
+    cerr << "ERROR: Couldn't read baseline file: " 
+         << options.baselineFile << endl;
+    return 1;
+  }
+
+  vector<string> names;
+  ResultMap      results;
+  size_t         numRegressions = 0;
+
+  for (size_t b = 0; b < benchmarks().size(); ++b) {
+    const Benchmark &bench = benchmarks()[b];
+    bool isSelected = options.filters.empty();
+    for (size_t f = 0; f < options.filters.size(); ++f) {
+      if (bench.name.find(options.filters[f]) != string::npos) {
+        isSelected = true;
+      }
+    }
+    if (!isSelected) {
+      continue;
+    }
+    if (options.list) {
+      cout << bench.name << endl;
+      continue;
+    }
+    // Keep the fastest of the repeats
+    double ns = numeric_limits<double>::max();
+    for (size_t r = 0; r < options.numRepeats; ++r) {
+      BenchState state(bench.arg, options.numThreads, options.minTime);
+      bench.func(state);
+      ns = std::min(ns, state.nsPerItem());
+    }
+    names.push_back(bench.name);
+    results[bench.name] = ns;
+    cout << left << setw(56) << bench.name << right << setw(12) 
+         << fixed << setprecision(3) << ns << " ns/item";
+    ResultMap::const_iterator base = baseline.find(bench.name);
+    if (base != baseline.end() && base->second > 0.0) {
+      const double change = ns / base->second - 1.0;
+      cout << setw(9) << showpos << setprecision(1) << change * 100.0 
+           << noshowpos << "%";
+      if (change > options.tolerance) {
+        cout << "  REGRESSION";
+        numRegressions++;
+      }
+    }
+    cout << endl;
+  }
+
+  if (!options.outputFile.empty()) {
+    ofstream os(options.outputFile.c_str());
+    if (!os) {
+      cerr << "ERROR: Couldn't create output file: " 
+           << options.outputFile << endl;
+      return 1;
+    }
+    writeResults(os, names, results);
+  }
+
+  if (numRegressions > 0) {
+    cerr << numRegressions << " benchmark(s) slower than the baseline by "
+         << "more than " << options.tolerance * 100.0 << "%" << endl;
+    return 1;
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------//
+
+Options parseOptions(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+
+  po::options_description desc("Available options");
+
+  desc.add_options()
+    ("help,h", "Display help")
+    ("filter,f", po::value<vector<string> >(), 
+     "Only run benchmarks whose names contain the given string")
+    ("list,l", "List the benchmarks instead of running them")
+    ("output-file,o", po::value<string>(), 
+     "File to write the JSON results to, for use as a baseline")
+    ("baseline,b", po::value<string>(), 
+     "Results of an earlier run to compare against")
+    ("tolerance", po::value<double>(), 
+     "Slowdown relative to the baseline that counts as a regression. "
+     "Defaults to 0.1.")
+    ("min-time", po::value<double>(), 
+     "Minimum time to run each benchmark for, in seconds")
+    ("repeats,r", po::value<size_t>(), 
+     "Number of times to run each benchmark. The fastest run is reported.")
+    ("threads,t", po::value<size_t>(), 
+     "Threads used by the multithreaded kernels. Defaults to 1.")
+    ;
+  
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  if (vm.count("help")) {
+    cout << desc << endl;
+    exit(0);
+  }
+
+  if (vm.count("filter")) {
+    options.filters = vm["filter"].as<vector<string> >();
+  }
+  if (vm.count("list")) {
+    options.list = true;
+  }
+  if (vm.count("output-file")) {
+    options.outputFile = vm["output-file"].as<string>();
+  }
+  if (vm.count("baseline")) {
+    options.baselineFile = vm["baseline"].as<string>();
+  }
+  if (vm.count("tolerance")) {
+    options.tolerance = vm["tolerance"].as<double>();
+  }
+  if (vm.count("min-time")) {
+    options.minTime = vm["min-time"].as<double>();
+  }
+  if (vm.count("repeats")) {
+    options.numRepeats = std::max(vm["repeats"].as<size_t>(), size_t(1));
+  }
+  if (vm.count("threads")) {
+    options.numThreads = std::max(vm["threads"].as<size_t>(), size_t(1));
+  }
+
+  return options;
+}
+
+//----------------------------------------------------------------------------//
+
+double wallTime()
+{
+  using namespace boost::posix_time;
+  static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+  return (microsec_clock::universal_time() - epoch).total_microseconds() * 
+    1e-6;
+}
+
+//----------------------------------------------------------------------------//
@@ -0,0 +1,584 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+//----------------------------------------------------------------------------//
+
+/*! \file main.cpp
+  Measures how write, read and dynamic loading throughput scale with the 
+  number of threads. A sparse test field is generated, written and read 
+  back with each I/O thread count, then read with dynamic loading and 
+  sampled by each number of sampler threads, for several cache sizes 
+  relative to the working set. Results are written as JSON.
+*/
+
+//----------------------------------------------------------------------------//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <Field3D/Field3DFile.h>
+#include <Field3D/InitIO.h>
+#include <Field3D/SparseField.h>
+#include <Field3D/SparseFile.h>
+#include <Field3D/Stats.h>
+
+//----------------------------------------------------------------------------//
+
+using namespace std;
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+// Options struct
+//----------------------------------------------------------------------------//
+
+struct Options {
+  Options()
+    : tempFile("io_scaling.f3d"), resolution(256), numSamples(4000000), 
+      numRepeats(3), keepFile(false)
+  { }
+  string         tempFile;
+  string         outputFile;
+  vector<size_t> ioThreads;
+  vector<size_t> samplerThreads;
+  vector<float>  cacheRatios;
+  int            resolution;
+  size_t         numSamples;
+  size_t         numRepeats;
+  bool           keepFile;
+};
+
+//----------------------------------------------------------------------------//
+// Result structs
+//----------------------------------------------------------------------------//
+
+//! Throughput of writing or reading the whole field with a number of I/O
+//! threads
+struct IOResult {
+  IOResult()
+    : threads(0), seconds(std::numeric_limits<double>::max())
+  { }
+  size_t threads;
+  //! Fastest of the repeats
+  double seconds;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Sampling throughput and cache behavior with dynamic loading
+struct CacheResult {
+  CacheResult()
+    : cacheRatio(0.0f), threads(0), seconds(0.0), loads(0), evictions(0), 
+      lockWait(0)
+  { }
+  float     cacheRatio;
+  size_t    threads;
+  double    seconds;
+  long long loads, evictions;
+  //! Time spent waiting for the cache's locks, over all threads, in 
+  //! microseconds
+  long long lockWait;
+};
+
+//----------------------------------------------------------------------------//
+// Function prototypes
+//----------------------------------------------------------------------------//
+
+//! Parses command line options, puts them in Options struct.
+Options parseOptions(int argc, char **argv);
+
+//! Returns the wall clock time in seconds
+double wallTime();
+
+//----------------------------------------------------------------------------//
+// Helpers
+//----------------------------------------------------------------------------//
+
+//! Returns a pseudo-random number in [0,1). Deterministic, so that runs 
+//! are comparable.
+inline double random01(unsigned int &seed)
+{
+  seed = seed * 1664525u + 1013904223u;
+  return (seed >> 8) * (1.0 / 16777216.0);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns a field whose voxels are allocated in a thick spherical shell,
+//! so that about half of the blocks are empty
+SparseField<float>::Ptr makeField(const int res)
+{
+  SparseField<float>::Ptr field(new SparseField<float>);
+  field->name = "scaling";
+  field->attribute = "density";
+  field->setSize(V3i(res));
+  const float center = 0.5f * res, radius = 0.35f * res, width = 0.15f * res;
+  for (int k = 0; k < res; ++k) {
+    for (int j = 0; j < res; ++j) {
+      for (int i = 0; i < res; ++i) {
+        const float dx = i - center, dy = j - center, dz = k - center;
+        const float r = std::sqrt(dx * dx + dy * dy + dz * dz);
+        if (std::abs(r - radius) < width) {
+          field->fastLValue(i, j, k) = 
+            std::sin(i * 0.1f) * std::cos(j * 0.13f) + 0.01f * k;
+        }
+      }
+    }
+  }
+  return field;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Returns random voxels within the allocated blocks of the field, so that
+//! every lookup goes through the block cache
+vector<V3i> randomVoxels(const SparseField<float> &field, 
+                         const size_t numSamples)
+{
+  const V3i blockRes  = field.blockRes();
+  const int blockSize = field.blockSize();
+  const V3i origin    = field.dataWindow().min;
+  const V3i maxVoxel  = field.dataWindow().max;
+  vector<V3i> blocks;
+  for (int bk = 0; bk < blockRes.z; ++bk) {
+    for (int bj = 0; bj < blockRes.y; ++bj) {
+      for (int bi = 0; bi < blockRes.x; ++bi) {
+        if (field.blockIsAllocated(bi, bj, bk)) {
+          blocks.push_back(V3i(bi, bj, bk));
+        }
+      }
+    }
+  }
+  vector<V3i> voxels;
+  if (blocks.empty()) {
+    return voxels;
+  }
+  unsigned int seed = 1;
+  voxels.resize(numSamples);
+  for (size_t s = 0; s < numSamples; ++s) {
+    const size_t b = std::min(static_cast<size_t>(random01(seed) * 
+                                                  blocks.size()),
+                              blocks.size() - 1);
+    V3i v = origin + blocks[b] * blockSize + 
+      V3i(static_cast<int>(random01(seed) * blockSize),
+          static_cast<int>(random01(seed) * blockSize),
+          static_cast<int>(random01(seed) * blockSize));
+    // Blocks along the upper edges may be partially outside
+    v.x = std::min(v.x, maxVoxel.x);
+    v.y = std::min(v.y, maxVoxel.y);
+    v.z = std::min(v.z, maxVoxel.z);
+    voxels[s] = v;
+  }
+  return voxels;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Looks up a range of voxels. The sum is kept so that the lookups can't 
+//! be optimized away.
+struct SampleOp
+{
+  SampleOp(const SparseField<float> &field, const vector<V3i> &voxels,
+           const size_t begin, const size_t end, float &result)
+    : m_field(field), m_voxels(voxels), m_begin(begin), m_end(end), 
+      m_result(result)
+  { }
+  void operator() ()
+  {
+    float sum = 0.0f;
+    for (size_t i = m_begin; i < m_end; ++i) {
+      const V3i &v = m_voxels[i];
+      sum += m_field.fastValue(v.x, v.y, v.z);
+    }
+    m_result = sum;
+  }
+private:
+  const SparseField<float> &m_field;
+  const vector<V3i>        &m_voxels;
+  const size_t              m_begin, m_end;
+  float                    &m_result;
+};
+
+//----------------------------------------------------------------------------//
+
+//! Reads the test field. Returns a null pointer on failure.
+//! \note Dynamically loaded fields need the file to stay open while they
+//! are sampled.
+SparseField<float>::Ptr readField(Field3DInputFile &in, 
+                                  const string &filename)
+{
+  if (!in.open(filename)) {
+    return SparseField<float>::Ptr();
+  }
+  Field<float>::Vec fields = in.readScalarLayers<float>("scaling", "density");
+  if (fields.empty()) {
+    return SparseField<float>::Ptr();
+  }
+  return field_dynamic_cast<SparseField<float> >(fields[0]);
+}
+
+//----------------------------------------------------------------------------//
+// Benchmarks
+//----------------------------------------------------------------------------//
+
+//! Writes the field with each I/O thread count. The file of the last run 
+//! is left for the read benchmarks.
+vector<IOResult> benchWrite(const Options &options, 
+                            const SparseField<float>::Ptr &field)
+{
+  vector<IOResult> results;
+  for (size_t t = 0; t < options.ioThreads.size(); ++t) {
+    setNumIOThreads(options.ioThreads[t]);
+    IOResult result;
+    result.threads = options.ioThreads[t];
+    for (size_t r = 0; r < options.numRepeats; ++r) {
+      Field3DOutputFile out;
+      const double start = wallTime();
+      if (!out.create(options.tempFile) || 
+          !out.writeScalarLayer<float>(field)) {
+        cerr << "ERROR: Couldn't write file: " << options.tempFile << endl;
+        exit(1);
+      }
+      out.close();
+      result.seconds = std::min(result.seconds, wallTime() - start);
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Reads the whole field with each I/O thread count
+vector<IOResult> benchRead(const Options &options)
+{
+  vector<IOResult> results;
+  for (size_t t = 0; t < options.ioThreads.size(); ++t) {
+    setNumIOThreads(options.ioThreads[t]);
+    IOResult result;
+    result.threads = options.ioThreads[t];
+    for (size_t r = 0; r < options.numRepeats; ++r) {
+      Field3DInputFile in;
+      const double start = wallTime();
+      if (!readField(in, options.tempFile)) {
+        cerr << "ERROR: Couldn't read file: " << options.tempFile << endl;
+        exit(1);
+      }
+      result.seconds = std::min(result.seconds, wallTime() - start);
+    }
+    results.push_back(result);
+  }
+  return results;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Samples the field with dynamic loading, for each cache size and number
+//! of sampler threads, starting from an empty cache each time
+vector<CacheResult> benchCache(const Options &options, 
+                               const vector<V3i> &voxels, 
+                               const double workingSetMB)
+{
+  SparseFileManager &manager = SparseFileManager::singleton();
+
+  vector<CacheResult> results;
+
+  manager.setLimitMemUse(true);
+  for (size_t c = 0; c < options.cacheRatios.size(); ++c) {
+    manager.setMaxMemUse(static_cast<float>(workingSetMB * 
+                                            options.cacheRatios[c]));
+    for (size_t t = 0; t < options.samplerThreads.size(); ++t) {
+      const size_t numThreads = options.samplerThreads[t];
+      manager.flushCache();
+      Field3DInputFile in;
+      SparseField<float>::Ptr field = readField(in, options.tempFile);
+      if (!field) {
+        cerr << "ERROR: Couldn't read file: " << options.tempFile << endl;
+        exit(1);
+      }
+      manager.resetCacheStatistics();
+      Stats::reset();
+      vector<float> sums(numThreads);
+      const double start = wallTime();
+      boost::thread_group threads;
+      for (size_t i = 0; i < numThreads; ++i) {
+        threads.create_thread(SampleOp(*field, voxels, 
+                                       voxels.size() * i / numThreads,
+                                       voxels.size() * (i + 1) / numThreads,
+                                       sums[i]));
+      }
+      threads.join_all();
+      CacheResult result;
+      result.cacheRatio = options.cacheRatios[c];
+      result.threads    = numThreads;
+      result.seconds    = wallTime() - start;
+      result.loads      = manager.totalLoads();
+      result.evictions  = 
+        manager.cacheStatistics(manager.cachePolicy()).evictions;
+      result.lockWait   = Stats::value(Stats::SparseCacheLockWait);
+      results.push_back(result);
+    }
+  }
+  manager.flushCache();
+  manager.setLimitMemUse(false);
+
+  return results;
+}
+
+//----------------------------------------------------------------------------//
+// Output
+//----------------------------------------------------------------------------//
+
+void writeIOResults(ostream &os, const string &key, 
+                    const vector<IOResult> &results, const double mb)
+{
+  os << "  \"" << key << "\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const IOResult &r = results[i];
+    os << (i == 0 ? "\n" : ",\n") 
+       << "    { \"threads\": " << r.threads 
+       << ", \"seconds\": " << r.seconds
+       << ", \"mb_per_second\": " << mb / std::max(r.seconds, 1e-9) 
+       << ", \"speedup\": " << results[0].seconds / std::max(r.seconds, 1e-9)
+       << " }";
+  }
+  os << "\n  ]";
+}
+
+//----------------------------------------------------------------------------//
+
+void writeCacheResults(ostream &os, const vector<CacheResult> &results, 
+                       const size_t numSamples)
+{
+  os << "  \"dynamic_load\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const CacheResult &r = results[i];
+    // Each lookup touches one block, so every load is a miss
+    const double hitRate = 
+      numSamples ? 1.0 - static_cast<double>(r.loads) / numSamples : 0.0;
+    const double threadSeconds = std::max(r.seconds * r.threads, 1e-9);
+    os << (i == 0 ? "\n" : ",\n") 
+       << "    { \"cache_ratio\": " << r.cacheRatio 
+       << ", \"threads\": " << r.threads 
+       << ", \"seconds\": " << r.seconds
+       << ", \"samples_per_second\": " 
+       << numSamples / std::max(r.seconds, 1e-9)
+       << ", \"hit_rate\": " << hitRate
+       << ", \"block_loads\": " << r.loads
+       << ", \"evictions\": " << r.evictions
+       << ", \"lock_wait_us\": " << r.lockWait
+       << ", \"lock_wait_fraction\": " << r.lockWait * 1e-6 / threadSeconds
+       << " }";
+  }
+  os << "\n  ]";
+}
+
+//----------------------------------------------------------------------------//
+// Function implementations
+//----------------------------------------------------------------------------//
+
+int main(int argc, char **argv)
+{
+  Field3D::initIO();
+
+  Options options = parseOptions(argc, argv);
+
+  Field3DOutputFile::useOgawa(true);
+
+  SparseField<float>::Ptr field = makeField(options.resolution);
+  const double mb = field->memSize() / (1024.0 * 1024.0);
+
+  // Full writes and reads ---
+
+  const vector<IOResult> writes = benchWrite(options, field);
+  const vector<IOResult> reads = benchRead(options);
+
+  // Dynamic loading ---
+
+  const vector<V3i> voxels = randomVoxels(*field, options.numSamples);
+  field.reset();
+  const vector<CacheResult> cache = benchCache(options, voxels, mb);
+
+  if (!options.keepFile) {
+    std::remove(options.tempFile.c_str());
+  }
+
+  // Output ---
+
+  ofstream file;
+  if (!options.outputFile.empty()) {
+    file.open(options.outputFile.c_str());
+    if (!file) {
+      cerr << "ERROR: Couldn't create output file: " 
+           << options.outputFile << endl;
+      return 1;
+    }
+  }
+  ostream &os = options.outputFile.empty() ? cout : file;
+
+  os << "{\n"
+     << "  \"resolution\": " << options.resolution << ",\n"
+     << "  \"working_set_mb\": " << mb << ",\n"
+     << "  \"samples\": " << voxels.size() << ",\n"
+     << "  \"stats_enabled\": " << (Stats::isEnabled() ? "true" : "false") 
+     << ",\n";
+  writeIOResults(os, "write", writes, mb);
+  os << ",\n";
+  writeIOResults(os, "read", reads, mb);
+  os << ",\n";
+  writeCacheResults(os, cache, voxels.size());
+  os << "\n}\n";
+
+  return 0;
+}
+
+//----------------------------------------------------------------------------//
+
+Options parseOptions(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+
+  po::options_description desc("Available options");
+
+  desc.add_options()
+    ("help,h", "Display help")
+    ("output-file,o", po::value<string>(), 
+     "File to write the JSON results to. Defaults to stdout.")
+    ("temp-file", po::value<string>(), 
+     "Where to write the test field. Defaults to io_scaling.f3d.")
+    ("keep", "Keep the test field's file")
+    ("resolution", po::value<int>(), "Resolution of the test field")
+    ("io-threads,t", po::value<vector<size_t> >()->multitoken(), 
+     "I/O thread counts to write and read with. Defaults to powers of two "
+     "up to the number of cores.")
+    ("sampler-threads,s", po::value<vector<size_t> >()->multitoken(), 
+     "Numbers of threads to sample with. Defaults to the I/O thread "
+     "counts.")
+    ("cache-ratios,c", po::value<vector<float> >()->multitoken(), 
+     "Cache sizes, relative to the working set. Defaults to 0.25 0.5 1 2.")
+    ("samples", po::value<size_t>(), "Number of lookups per sampling run")
+    ("repeats,r", po::value<size_t>(), "Number of times to repeat writes "
+     "and reads")
+    ;
+  
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+  } catch(...) {
+    cerr << "Unknown command line option.\n";
+    cout << desc << endl;
+    exit(1);
+  }
+  po::notify(vm);
+  
+  if (vm.count("help")) {
+    cout << desc << endl;
+    exit(0);
+  }
+
+  if (vm.count("output-file")) {
+    options.outputFile = vm["output-file"].as<string>();
+  }
+  if (vm.count("temp-file")) {
+    options.tempFile = vm["temp-file"].as<string>();
+  }
+  if (vm.count("keep")) {
+    options.keepFile = true;
+  }
+  if (vm.count("resolution")) {
+    options.resolution = std::max(vm["resolution"].as<int>(), 16);
+  }
+  if (vm.count("io-threads")) {
+    options.ioThreads = vm["io-threads"].as<vector<size_t> >();
+  } else {
+    const size_t numCores = 
+      std::max(boost::thread::hardware_concurrency(), 1u);
+    for (size_t t = 1; t < numCores; t *= 2) {
+      options.ioThreads.push_back(t);
+    }
+    options.ioThreads.push_back(numCores);
+  }
+  if (vm.count("sampler-threads")) {
+    options.samplerThreads = vm["sampler-threads"].as<vector<size_t> >();
+  } else {
+    options.samplerThreads = options.ioThreads;
+  }
+  if (vm.count("cache-ratios")) {
+    options.cacheRatios = vm["cache-ratios"].as<vector<float> >();
+  } else {
+    options.cacheRatios.push_back(0.25f);
+    options.cacheRatios.push_back(0.5f);
+    options.cacheRatios.push_back(1.0f);
+    options.cacheRatios.push_back(2.0f);
+  }
+  if (vm.count("samples")) {
+    options.numSamples = std::max(vm["samples"].as<size_t>(), size_t(1));
+  }
+  if (vm.count("repeats")) {
+    options.numRepeats = std::max(vm["repeats"].as<size_t>(), size_t(1));
+  }
+
+  // Thread counts of zero are meaningless
+  std::replace(options.ioThreads.begin(), options.ioThreads.end(), 
+               size_t(0), size_t(1));
+  std::replace(options.samplerThreads.begin(), options.samplerThreads.end(),
+               size_t(0), size_t(1));
+
+  return options;
+}
+
+//----------------------------------------------------------------------------//
+
+double wallTime()
+{
+  using namespace boost::posix_time;
+  static const ptime epoch(boost::gregorian::date(1970, 1, 1));
+  return (microsec_clock::universal_time() - epoch).total_microseconds() * 
+    1e-6;
+}
+
+//----------------------------------------------------------------------------//
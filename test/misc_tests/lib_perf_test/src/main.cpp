@@ -41,6 +41,7 @@
 #include <InitIO.h>
 #include <Log.h>
 #include <SparseField.h>
+#include <SparseFieldRayIterator.h>
 
 #include <openvdb/openvdb.h>
 #include <openvdb/tree/ValueAccessor.h>
@@ -50,8 +51,13 @@
 #include <openvdb/tools/ValueTransformer.h>
 #include <openvdb/Types.h>
 
+#include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -59,13 +65,13 @@
 #include <boost/random.hpp>
 #include <boost/generator_iterator.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/program_options.hpp>
 
 #ifdef __APPLE__
 #include <mach/mach.h>
 #elif __linux__
 #include <unistd.h>
 #include <ios>
-#include <fstream>
 #endif
 
 //----------------------------------------------------------------------------//
@@ -84,6 +90,12 @@ typedef boost::mt19937 RNGType;
 
 static size_t g_baseRSS;
 
+//! Title of the section that results are currently printed under
+static std::string g_section;
+
+//! Number of codec round trips that didn't read back what was written
+static int g_roundTripFailures = 0;
+
 //----------------------------------------------------------------------------//
 // Util
 //----------------------------------------------------------------------------//
@@ -131,9 +143,9 @@ static size_t currentRSS()
 
 //----------------------------------------------------------------------------//
 
-struct Stats
+struct PerfStats
 {
-  Stats(size_t a, size_t t, size_t m, size_t r, size_t c = 0)
+  PerfStats(size_t a, size_t t, size_t m, size_t r, size_t c = 0)
     : mAllocTime(a), mTime(t), mMemSize(m), mRSS(r), mCheckSum(c) 
   { }
   size_t mAllocTime, mTime, mMemSize, mRSS, mCheckSum;
@@ -162,8 +174,32 @@ private:
 
 //----------------------------------------------------------------------------//
 
-void printStats(const std::string s, const Stats &stats)
+//! One printed result, kept for the machine-readable report
+struct Result
+{
+  Result(const std::string &s, const std::string &n, const PerfStats &p)
+    : section(s), name(n), stats(p)
+  { }
+  std::string section, name;
+  PerfStats   stats;
+};
+
+static std::vector<Result> g_results;
+
+//----------------------------------------------------------------------------//
+
+//! Starts a new section of results
+void printSection(const std::string &title)
 {
+  std::cout << title << "\n";
+  g_section = title;
+}
+
+//----------------------------------------------------------------------------//
+
+void printStats(const std::string s, const PerfStats &stats)
+{
+  g_results.push_back(Result(g_section, s, stats));
   std::cout << std::left << " - " << std::setw (15) << s 
             << " | alloc: " << std::setw(9) << stats.mAllocTime 
             << " | run: " << std::setw(9) << stats.mTime 
@@ -175,6 +211,145 @@ void printStats(const std::string s, const Stats &stats)
 
 //----------------------------------------------------------------------------//
 
+//! Writes the results in the same layout as test_results/*.csv, with the
+//! check sum added as a last column
+bool writeCSV(const std::string &filename, const std::string &header)
+{
+  std::ofstream out(filename.c_str());
+  if (!out) {
+    return false;
+  }
+  out << header;
+  std::string section;
+  for (size_t i = 0, end = g_results.size(); i < end; ++i) {
+    const Result &r = g_results[i];
+    if (i == 0 || r.section != section) {
+      out << r.section << "\n";
+      section = r.section;
+    }
+    out << r.name << "," << r.stats.mAllocTime << "," << r.stats.mTime << ","
+        << r.stats.mTime + r.stats.mAllocTime << "," << r.stats.mMemSize 
+        << "," << r.stats.mRSS - g_baseRSS << "," << r.stats.mCheckSum 
+        << "\n";
+  }
+  return bool(out);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Writes one JSON object per result
+bool writeJSON(const std::string &filename)
+{
+  std::ofstream out(filename.c_str());
+  if (!out) {
+    return false;
+  }
+  out << "{\n  \"field3d\": \"" << FIELD3D_MAJOR_VER << "." 
+      << FIELD3D_MINOR_VER << "." << FIELD3D_MICRO_VER << "\",\n"
+      << "  \"openvdb\": \"" << OPENVDB_LIBRARY_MAJOR_VERSION << "." 
+      << OPENVDB_LIBRARY_MINOR_VERSION << "." 
+      << OPENVDB_LIBRARY_PATCH_VERSION << "\",\n"
+      << "  \"results\": [\n";
+  for (size_t i = 0, end = g_results.size(); i < end; ++i) {
+    const Result &r = g_results[i];
+    out << "    {\"section\": \"" << r.section << "\", \"name\": \"" 
+        << r.name << "\", \"alloc_ms\": " << r.stats.mAllocTime 
+        << ", \"run_ms\": " << r.stats.mTime
+        << ", \"total_ms\": " << r.stats.mTime + r.stats.mAllocTime
+        << ", \"mem\": " << r.stats.mMemSize 
+        << ", \"rss\": " << r.stats.mRSS - g_baseRSS
+        << ", \"checksum\": " << r.stats.mCheckSum << "}"
+        << (i + 1 < end ? ",\n" : "\n");
+  }
+  out << "  ]\n}\n";
+  return bool(out);
+}
+
+//----------------------------------------------------------------------------//
+
+//! A result read back from a baseline CSV file
+struct BaselineEntry
+{
+  BaselineEntry()
+    : total(0), checkSum(0), hasCheckSum(false)
+  { }
+  size_t total, checkSum;
+  bool   hasCheckSum;
+};
+
+typedef std::map<std::string, BaselineEntry> Baseline;
+
+//----------------------------------------------------------------------------//
+
+//! Reads a CSV file written by writeCSV() or statstocsv.py. Rows have at 
+//! least six comma separated fields, every other line is a section title.
+bool readBaseline(const std::string &filename, Baseline &baseline)
+{
+  std::ifstream in(filename.c_str());
+  if (!in) {
+    return false;
+  }
+  std::string line, section;
+  while (std::getline(in, line)) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ',')) {
+      fields.push_back(field);
+    }
+    if (fields.size() < 6) {
+      section = line;
+      continue;
+    }
+    BaselineEntry entry;
+    entry.total = std::strtoul(fields[3].c_str(), NULL, 10);
+    if (fields.size() > 6) {
+      entry.checkSum = std::strtoul(fields[6].c_str(), NULL, 10);
+      entry.hasCheckSum = true;
+    }
+    baseline[section + "/" + fields[0]] = entry;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------//
+
+//! Compares the results against a baseline. Returns the number of results 
+//! that were slower than tolerance allows, or whose check sum changed.
+//! Results that took less than minTime in the baseline are too noisy to 
+//! compare times for.
+int compareToBaseline(const Baseline &baseline, double tolerance, 
+                      size_t minTime)
+{
+  int failures = 0, compared = 0;
+  for (size_t i = 0, end = g_results.size(); i < end; ++i) {
+    const Result &r = g_results[i];
+    Baseline::const_iterator b = baseline.find(r.section + "/" + r.name);
+    if (b == baseline.end()) {
+      continue;
+    }
+    ++compared;
+    const size_t total = r.stats.mTime + r.stats.mAllocTime;
+    if (b->second.hasCheckSum && b->second.checkSum != r.stats.mCheckSum) {
+      cout << "  CHECKSUM " << r.section << " / " << r.name << ": " 
+           << r.stats.mCheckSum << " (baseline " << b->second.checkSum 
+           << ")" << endl;
+      ++failures;
+    }
+    if (b->second.total >= minTime && 
+        total > b->second.total * (1.0 + tolerance)) {
+      cout << "  SLOWER   " << r.section << " / " << r.name << ": " 
+           << total << " ms (baseline " << b->second.total << " ms)" << endl;
+      ++failures;
+    }
+  }
+  cout << "Compared " << compared << " results to the baseline, " 
+       << failures << " failed" << endl;
+  return failures;
+}
+
+//----------------------------------------------------------------------------//
+
 // Check if region is properly filled, no over or under filling.
 
 size_t checksumF3DDense(const DenseField<float> &field)
@@ -235,6 +410,13 @@ size_t checksumVDB(const TreeType &tree)
   size_t checkSum = 0;                                   \
   size_t memRSS = 0;                                     \
 
+#define BEGIN_SECTION(text)                            \
+  {                                                    \
+    std::ostringstream title;                          \
+    title << text;                                     \
+    printSection(title.str());                         \
+  }
+
 #define ALLOC_TIMER \
   Timer allocTimer;
 #define RUN_TIMER \
@@ -250,216 +432,369 @@ size_t checksumVDB(const TreeType &tree)
 //----------------------------------------------------------------------------//
 
 void  testContiguousWriteAccess(int size, int samples);
-Stats testContiguousWriteAccessDense(int size, int samples);
-Stats testContiguousWriteAccessSparse(int size, int blockOrder, int samples);
+PerfStats testContiguousWriteAccessDense(int size, int samples);
+PerfStats testContiguousWriteAccessSparse(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testContiguousWriteAccessVDB(int size, int samples);
+PerfStats testContiguousWriteAccessVDB(int size, int samples);
 
 // --
 
 void  testContiguousPreAllocWriteAccess(int size, int samples);
-Stats testContiguousPreAllocWriteAccessDense(int size, int samples);
-Stats testContiguousPreAllocWriteAccessSparse(int size, int blockOrder, int samples);
+PerfStats testContiguousPreAllocWriteAccessDense(int size, int samples);
+PerfStats testContiguousPreAllocWriteAccessSparse(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testContiguousPreAllocWriteAccessVDB(int size, int samples);
+PerfStats testContiguousPreAllocWriteAccessVDB(int size, int samples);
 
 // --
 
 void  testContiguousReadAccess(int size, int samples);
-Stats testContiguousReadAccessDense(int size, int samples);
-Stats testContiguousReadAccessSparse(int size, int blockOrder, int samples);
+PerfStats testContiguousReadAccessDense(int size, int samples);
+PerfStats testContiguousReadAccessSparse(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testContiguousReadAccessVDB(int size, int samples);
+PerfStats testContiguousReadAccessVDB(int size, int samples);
 
 // --
 
 void  testMemoryCoherentWriteAccess(int size, int samples);
-Stats testMemoryCoherentWriteAccessDense(int size, int samples);
-Stats testMemoryCoherentWriteAccessSparse(int size, int blockOrder, int samples);
+PerfStats testMemoryCoherentWriteAccessDense(int size, int samples);
+PerfStats testMemoryCoherentWriteAccessSparse(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testMemoryCoherentWriteAccessVDB(int size, int samples);
+PerfStats testMemoryCoherentWriteAccessVDB(int size, int samples);
 
 // --
 
 void  testMemoryCoherentPreAllocWriteAccess(int size, int samples);
-Stats testMemoryCoherentPreAllocWriteAccessDense(int size, int samples);
-Stats testMemoryCoherentPreAllocWriteAccessSparse(int size, int blockOrder, int samples);
+PerfStats testMemoryCoherentPreAllocWriteAccessDense(int size, int samples);
+PerfStats testMemoryCoherentPreAllocWriteAccessSparse(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testMemoryCoherentPreAllocWriteAccessVDB(int size, int samples);
+PerfStats testMemoryCoherentPreAllocWriteAccessVDB(int size, int samples);
 
 // --
 
 void  testMemoryCoherentReadAccess(int size, int samples);
-Stats testMemoryCoherentReadAccessDense(int size, int samples);
-Stats testMemoryCoherentReadAccessSparse(int size, int blockOrder, int samples);
+PerfStats testMemoryCoherentReadAccessDense(int size, int samples);
+PerfStats testMemoryCoherentReadAccessSparse(int size, int blockOrder, int samples);
+PerfStats testMemoryCoherentReadAccessSparseAccessor(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testMemoryCoherentReadAccessVDB(int size, int samples);
+PerfStats testMemoryCoherentReadAccessVDB(int size, int samples);
 
 // --
 
 void  testWriteSparse(int size, int samples);
-Stats testWriteSparseDense(int narrowBand, bool useOgawa, int size, int samples);
-Stats testWriteSparseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
+PerfStats testWriteSparseDense(int narrowBand, bool useOgawa, int size, int samples);
+PerfStats testWriteSparseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testWriteSparseVDB(int narrowBand, int size, int samples);
+PerfStats testWriteSparseVDB(int narrowBand, int size, int samples);
 
 // --
 
 void  testWriteDense(int size, int samples);
-Stats testWriteDenseDense(int narrowBand, bool useOgawa, int size, int samples);
-Stats testWriteDenseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
+PerfStats testWriteDenseDense(int narrowBand, bool useOgawa, int size, int samples);
+PerfStats testWriteDenseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testWriteDenseVDB(int narrowBand, int size, int samples);
+PerfStats testWriteDenseVDB(int narrowBand, int size, int samples);
 
 // --
 
 void  testReadSparse(int size, int samples);
-Stats testReadSparseDense(int narrowBand, bool useOgawa, int size, int samples);
-Stats testReadSparseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
+PerfStats testReadSparseDense(int narrowBand, bool useOgawa, int size, int samples);
+PerfStats testReadSparseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testReadSparseVDB(int narrowBand, int size, int samples);
+PerfStats testReadSparseVDB(int narrowBand, int size, int samples);
 
 // --
 
 void  testReadDense(int size, int samples);
-Stats testReadDenseDense(int narrowBand, bool useOgawa, int size, int samples);
-Stats testReadDenseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
+PerfStats testReadDenseDense(int narrowBand, bool useOgawa, int size, int samples);
+PerfStats testReadDenseSparse(int narrowBand, bool useOgawa, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testReadDenseVDB(int narrowBand, int size, int samples);
+PerfStats testReadDenseVDB(int narrowBand, int size, int samples);
 
 // --
 
 void testSparseFill(int size, int samples);
-Stats testSparseFillSparse(int size, int order, int samples);
+PerfStats testSparseFillSparse(int size, int order, int samples);
 template<openvdb::Index Log2Dim>
-Stats testSparseFillVDB(int size, int samples);
+PerfStats testSparseFillVDB(int size, int samples);
 
 // --
 
 void  testRandomWriteAccess(int numPoints, int size, int samples);
-Stats testRandomWriteAccessDense(int numPoints, int size, int samples);
-Stats testRandomWriteAccessSparse(int numPoints, int size, int blockOrder, int samples);
+PerfStats testRandomWriteAccessDense(int numPoints, int size, int samples);
+PerfStats testRandomWriteAccessSparse(int numPoints, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testRandomWriteAccessVDB(int numPoints, int size, int samples);
+PerfStats testRandomWriteAccessVDB(int numPoints, int size, int samples);
 
 // --
 
 void  testRandomPreAllocWriteAccess(int numPoints, int size, int samples);
-Stats testRandomPreAllocWriteAccessDense(int numPoints, int size, int samples);
-Stats testRandomPreAllocWriteAccessSparse(int numPoints, int size, int blockOrder, int samples);
+PerfStats testRandomPreAllocWriteAccessDense(int numPoints, int size, int samples);
+PerfStats testRandomPreAllocWriteAccessSparse(int numPoints, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testRandomPreAllocWriteAccessVDB(int numPoints, int size, int samples);
+PerfStats testRandomPreAllocWriteAccessVDB(int numPoints, int size, int samples);
 
 // --
 
 void  testRandomReadAccess(int numPoints, int size, int samples);
-Stats testRandomReadAccessDense(int numPoints, int size, int samples);
-Stats testRandomReadAccessSparse(int numPoints, int size, int blockOrder, int samples);
+PerfStats testRandomReadAccessDense(int numPoints, int size, int samples);
+PerfStats testRandomReadAccessSparse(int numPoints, int size, int blockOrder, int samples);
+PerfStats testRandomReadAccessSparseAccessor(int numPoints, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testRandomReadAccessVDB(int numPoints, int size, int samples);
+PerfStats testRandomReadAccessVDB(int numPoints, int size, int samples);
 
 // --
 
 void  testRandomPointInterpolation(int numPoints, int size, int samples);
-Stats testRandomPointInterpolationDense(int numPoints, int size, int samples);
-Stats testRandomPointInterpolationSparse(int numPoints, int size, int blockOrder, int samples);
+PerfStats testRandomPointInterpolationDense(int numPoints, int size, int samples);
+PerfStats testRandomPointInterpolationSparse(int numPoints, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testRandomPointInterpolationVDB(int numPoints, int size, int samples);
+PerfStats testRandomPointInterpolationVDB(int numPoints, int size, int samples);
 
 // --
 
 void testUniformRaymarching(int numRays, double stepSize, int size, int samples);
-Stats testUniformRaymarchingDense(int numRays, double stepSize, int size, int samples);
-Stats testUniformRaymarchingSparse(int numRays, double stepSize, int size, int blockOrder, int samples);
+PerfStats testUniformRaymarchingDense(int numRays, double stepSize, int size, int samples);
+PerfStats testUniformRaymarchingSparse(int numRays, double stepSize, int size, int blockOrder, int samples);
+PerfStats testUniformRaymarchingSparseSkip(int numRays, double stepSize, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testUniformRaymarchingVDB(int numRays, double stepSize, int size, int samples);
+PerfStats testUniformRaymarchingVDB(int numRays, double stepSize, int size, int samples);
 
 // --
 
 void testDenseLevelSetSphere(int size, int samples);
-Stats testDenseLevelSetSphereDense(int size, int samples);
-Stats testDenseLevelSetSphereSparse(int size, int blockOrder, int samples);
+PerfStats testDenseLevelSetSphereDense(int size, int samples);
+PerfStats testDenseLevelSetSphereSparse(int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testDenseLevelSetSphereVDB(int size, int samples);
+PerfStats testDenseLevelSetSphereVDB(int size, int samples);
 
 // --
 
 void  testNarrowBandLevelSetSphere(int halfWidth, int size, int samples);
-Stats testNarrowBandLevelSetSphereDense(int halfWidth, int size, int samples);
-Stats testNarrowBandLevelSetSphereSparse(int halfWidth, int size, int blockOrder, int samples);
+PerfStats testNarrowBandLevelSetSphereDense(int halfWidth, int size, int samples);
+PerfStats testNarrowBandLevelSetSphereSparse(int halfWidth, int size, int blockOrder, int samples);
 template<openvdb::Index Log2Dim>
-Stats testNarrowBandLevelSetSphereVDB(int halfWidth, int size, int samples);
+PerfStats testNarrowBandLevelSetSphereVDB(int halfWidth, int size, int samples);
+
+// --
+
+void  testCodecRoundTrip(int size, int samples);
+PerfStats testCodecRoundTripSparse(int halfWidth, SparseCodec codec, int size, int blockOrder, int samples);
+template<openvdb::Index Log2Dim>
+PerfStats testCodecRoundTripVDB(int halfWidth, int size, int samples);
+
+//----------------------------------------------------------------------------//
+// Options
+//----------------------------------------------------------------------------//
+
+//! Groups of tests that can be selected with --tests
+static const char *k_testGroups[] = {
+  "contiguous", "coherent", "io", "fill", "random", "interpolation", 
+  "raymarch", "levelset", "codecs", NULL
+};
+
+//----------------------------------------------------------------------------//
+
+struct Options
+{
+  Options()
+    : samples(1), res(200), ioThreads(16), tolerance(0.1), minTime(10)
+  { }
+  int                   samples, res, ioThreads;
+  std::set<std::string> tests;
+  std::string           csvFile, jsonFile, baselineFile;
+  double                tolerance;
+  size_t                minTime;
+};
+
+//----------------------------------------------------------------------------//
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+  namespace po = boost::program_options;
+
+  std::vector<std::string> tests;
+
+  po::options_description desc("Usage: lib_perf_test [options]");
+  desc.add_options()
+    ("help,h", "Print help message")
+    ("samples,s", po::value<int>(&options.samples), 
+     "Number of samples per test. The fastest is reported. Default: 1")
+    ("res,r", po::value<int>(&options.res), 
+     "Base resolution. test_results/ were taken at 800. Default: 200")
+    ("tests,t", po::value<std::vector<std::string> >(&tests)->multitoken(),
+     "Test groups to run: contiguous, coherent, io, fill, random, "
+     "interpolation, raymarch, levelset, codecs. Default: all")
+    ("io-threads", po::value<int>(&options.ioThreads), 
+     "Number of Field3D I/O threads. Default: 16")
+    ("output-file,o", po::value<std::string>(&options.csvFile), 
+     "Write the results as CSV, same layout as test_results/")
+    ("json-file,j", po::value<std::string>(&options.jsonFile), 
+     "Write the results as JSON")
+    ("baseline,b", po::value<std::string>(&options.baselineFile), 
+     "CSV file to compare against. Exits with 1 on regressions")
+    ("tolerance", po::value<double>(&options.tolerance), 
+     "Allowed slowdown compared to the baseline. Default: 0.1 (10%)")
+    ("min-time", po::value<size_t>(&options.minTime), 
+     "Baseline times below this (ms) aren't compared. Default: 10")
+    ;
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  } 
+  catch (std::exception &e) {
+    cout << e.what() << endl << desc << endl;
+    return false;
+  }
+
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return false;
+  }
+
+  if (options.samples < 1 || options.res < 2) {
+    cout << "--samples and --res must be positive" << endl;
+    return false;
+  }
+
+  for (size_t i = 0; i < tests.size(); ++i) {
+    bool known = false;
+    for (const char **g = k_testGroups; *g; ++g) {
+      known = known || tests[i] == *g;
+    }
+    if (!known) {
+      cout << "Unknown test group: " << tests[i] << endl << desc << endl;
+      return false;
+    }
+    options.tests.insert(tests[i]);
+  }
+  if (options.tests.empty()) {
+    for (const char **g = k_testGroups; *g; ++g) {
+      options.tests.insert(*g);
+    }
+  }
+
+  return true;
+}
 
 //----------------------------------------------------------------------------//
 // Main
 //----------------------------------------------------------------------------//
 
-int main()
+int main(int argc, char *argv[])
 {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+
   openvdb::initialize();
   Field3D::initIO();
-  Field3D::setNumIOThreads(16);
+  Field3D::setNumIOThreads(options.ioThreads);
 
-  int samples = 1;
-  int baseRes = 200;
+  const int samples = options.samples;
+  const int baseRes = options.res;
+  const std::set<std::string> &tests = options.tests;
 
   g_baseRSS = currentRSS();
 
-  cout << "Dense Domain Tests - Field3D & OpenVDB (taking " << samples << 
+  std::ostringstream header;
+  header << "Dense Domain Tests - Field3D & OpenVDB (taking " << samples << 
     " samples, time in ms)" << endl;
-  cout << "  Field3D - " << FIELD3D_MAJOR_VER << "." << FIELD3D_MINOR_VER 
-       << "." << FIELD3D_MICRO_VER << endl;
-  cout << "  OpenVDB - " << OPENVDB_LIBRARY_MAJOR_VERSION << "." 
-       << OPENVDB_LIBRARY_MINOR_VERSION << "."
-       << OPENVDB_LIBRARY_PATCH_VERSION << endl;
+  header << "  Field3D - " << FIELD3D_MAJOR_VER << "." << FIELD3D_MINOR_VER 
+         << "." << FIELD3D_MICRO_VER << endl;
+  header << "  OpenVDB - " << OPENVDB_LIBRARY_MAJOR_VERSION << "." 
+         << OPENVDB_LIBRARY_MINOR_VERSION << "."
+         << OPENVDB_LIBRARY_PATCH_VERSION << endl;
+  cout << header.str();
+
+  if (tests.count("contiguous")) {
+    testContiguousWriteAccess(baseRes, samples);
+    testContiguousPreAllocWriteAccess(baseRes, samples);
+    testContiguousReadAccess(baseRes, samples);
+  }
 
-#if 0
+  if (tests.count("coherent")) {
+    testMemoryCoherentWriteAccess(baseRes, samples);
+    testMemoryCoherentPreAllocWriteAccess(baseRes, samples);
+    testMemoryCoherentReadAccess(baseRes, samples);
+  }
 
-  testContiguousWriteAccess(baseRes, samples);
-  testContiguousPreAllocWriteAccess(baseRes, samples);
-  testContiguousReadAccess(baseRes, samples);
+  if (tests.count("io")) {
+    testWriteDense(baseRes, samples);
+    testWriteSparse(baseRes, samples);
+    testReadDense(baseRes, samples);
+    testReadSparse(baseRes, samples);
+  }
 
-  testMemoryCoherentWriteAccess(baseRes, samples);
-  testMemoryCoherentPreAllocWriteAccess(baseRes, samples);
-  testMemoryCoherentReadAccess(baseRes, samples);
+  if (tests.count("fill")) {
+    // Fixed sizes, independent of --res, as in test_results/
+    testSparseFill(1024, samples);
+    testSparseFill(2048, samples);
+  }
 
-#endif
+  if (tests.count("random")) {
+    testRandomWriteAccess(200000, baseRes, samples);
+    testRandomPreAllocWriteAccess(200000, baseRes, samples);
+    testRandomReadAccess(1000000, baseRes, samples);
+  }
 
-  // testWriteDense(baseRes, samples);
-  testWriteSparse(baseRes, samples);
-  // testReadDense(baseRes, samples);
-  testReadSparse(baseRes, samples);
+  if (tests.count("interpolation")) {
+    testRandomPointInterpolation(1000000, baseRes, samples);
+  }
 
-#if 0
+  if (tests.count("raymarch")) {
+    int numRays = 10000;
+    double stepSize = 0.5;
+    testUniformRaymarching(numRays, stepSize, baseRes, samples);
+  }
 
-  testSparseFill(1024, samples);
-  testSparseFill(2048, samples);
+  if (tests.count("levelset")) {
+    // Fixed sizes, independent of --res, as in test_results/
+    testDenseLevelSetSphere(1000, samples);
+    // MW: Width should be 5?
+    testNarrowBandLevelSetSphere(3, 1000, samples);
+    testNarrowBandLevelSetSphere(3, 2000, samples);
+    testNarrowBandLevelSetSphere(3, 3000, samples);
+    testNarrowBandLevelSetSphere(3, 4000, samples);
+  }
 
-  int randomPoints = 200000;
-  testRandomWriteAccess(randomPoints, baseRes, samples);
-  testRandomPreAllocWriteAccess(randomPoints, baseRes, samples);
+  if (tests.count("codecs")) {
+    testCodecRoundTrip(baseRes, samples);
+  }
 
-  randomPoints = 1000000;
-  testRandomReadAccess(randomPoints, baseRes, samples);
-  testRandomPointInterpolation(randomPoints, baseRes, samples);
+  int status = 0;
 
-  int numRays = 10000;
-  double stepSize = 0.5;
-  testUniformRaymarching(numRays, stepSize, baseRes, samples);
+  if (g_roundTripFailures) {
+    cout << g_roundTripFailures << " codec round trips failed" << endl;
+    status = 1;
+  }
 
-  testDenseLevelSetSphere(1000, samples);
+  if (options.csvFile.size() && !writeCSV(options.csvFile, header.str())) {
+    cout << "Couldn't write " << options.csvFile << endl;
+    status = 1;
+  }
 
-  // MW: Width should be 5?
-  testNarrowBandLevelSetSphere(3, 1000, samples);
-  testNarrowBandLevelSetSphere(3, 2000, samples);
-  testNarrowBandLevelSetSphere(3, 3000, samples);
-  testNarrowBandLevelSetSphere(3, 4000, samples);
+  if (options.jsonFile.size() && !writeJSON(options.jsonFile)) {
+    cout << "Couldn't write " << options.jsonFile << endl;
+    status = 1;
+  }
 
-#endif
+  if (options.baselineFile.size()) {
+    Baseline baseline;
+    if (!readBaseline(options.baselineFile, baseline)) {
+      cout << "Couldn't read " << options.baselineFile << endl;
+      status = 1;
+    } else if (compareToBaseline(baseline, options.tolerance, 
+                                 options.minTime)) {
+      status = 1;
+    }
+  }
 
+  return status;
 }
 
-
 //----------------------------------------------------------------------------//
 // Contiguous write access
 //----------------------------------------------------------------------------//
@@ -467,7 +802,7 @@ int main()
 void
 testContiguousWriteAccess(int size, int samples)
 {
-  cout << "Contiguous write access "<< size << "^3\n";
+  BEGIN_SECTION("Contiguous write access "<< size << "^3");
 
   printStats("Dense", testContiguousWriteAccessDense(size, samples));
   
@@ -483,7 +818,7 @@ testContiguousWriteAccess(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats
+PerfStats
 testContiguousWriteAccessDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -517,13 +852,13 @@ testContiguousWriteAccessDense(int size, int samples)
   }
 
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 // MW: This text used to use pointer arithmetic. Too fast, apparently.
-Stats
+PerfStats
 testContiguousWriteAccessSparse(int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -556,13 +891,13 @@ testContiguousWriteAccessSparse(int size, int blockOrder, int samples)
   }
   
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testContiguousWriteAccessVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -600,7 +935,7 @@ testContiguousWriteAccessVDB(int size, int samples)
     memRSS = currentRSS();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -610,7 +945,7 @@ testContiguousWriteAccessVDB(int size, int samples)
 void
 testContiguousPreAllocWriteAccess(int size, int samples)
 {
-  cout << "Contiguous write access (preallocated) "<< size << "^3\n";
+  BEGIN_SECTION("Contiguous write access (preallocated) "<< size << "^3");
 
   printStats("Dense", testContiguousPreAllocWriteAccessDense(size, samples));
 
@@ -626,7 +961,7 @@ testContiguousPreAllocWriteAccess(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats
+PerfStats
 testContiguousPreAllocWriteAccessDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -664,13 +999,13 @@ testContiguousPreAllocWriteAccessDense(int size, int samples)
     memRSS = currentRSS();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 // MW: This test used to use pointer arithmetic.
-Stats
+PerfStats
 testContiguousPreAllocWriteAccessSparse(int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -706,13 +1041,13 @@ testContiguousPreAllocWriteAccessSparse(int size, int blockOrder, int samples)
     memRSS = currentRSS();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
   
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testContiguousPreAllocWriteAccessVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -752,7 +1087,7 @@ testContiguousPreAllocWriteAccessVDB(int size, int samples)
     memRSS = currentRSS();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -762,7 +1097,7 @@ testContiguousPreAllocWriteAccessVDB(int size, int samples)
 void
 testContiguousReadAccess(int size, int samples)
 {
-  cout << "Contiguous read access "<< size << "^3\n";
+  BEGIN_SECTION("Contiguous read access "<< size << "^3");
 
   printStats("Dense", testContiguousReadAccessDense(size, samples));
 
@@ -778,7 +1113,7 @@ testContiguousReadAccess(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats
+PerfStats
 testContiguousReadAccessDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -815,14 +1150,14 @@ testContiguousReadAccessDense(int size, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 
 //----------------------------------------------------------------------------//
 
 // This test used to use pointer arithmetic.
-Stats
+PerfStats
 testContiguousReadAccessSparse(int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -859,13 +1194,13 @@ testContiguousReadAccessSparse(int size, int blockOrder, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testContiguousReadAccessVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -904,7 +1239,7 @@ testContiguousReadAccessVDB(int size, int samples)
     checkSum = size_t(sum);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -913,7 +1248,7 @@ testContiguousReadAccessVDB(int size, int samples)
 
 void testMemoryCoherentWriteAccess(int size, int samples)
 {
-  cout << "Memory coherent write access "<< size << "^3\n";
+  BEGIN_SECTION("Memory coherent write access "<< size << "^3");
   
   printStats("Dense", testMemoryCoherentWriteAccessDense (size, samples));
 
@@ -929,7 +1264,7 @@ void testMemoryCoherentWriteAccess(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testMemoryCoherentWriteAccessDense(int size, int samples)
+PerfStats testMemoryCoherentWriteAccessDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -960,12 +1295,12 @@ Stats testMemoryCoherentWriteAccessDense(int size, int samples)
     memUsage = dense.memSize();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testMemoryCoherentWriteAccessSparse(int size, int blockOrder, int samples)
+PerfStats testMemoryCoherentWriteAccessSparse(int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -1019,14 +1354,14 @@ Stats testMemoryCoherentWriteAccessSparse(int size, int blockOrder, int samples)
     memUsage = sparse.memSize();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testMemoryCoherentWriteAccessVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -1056,7 +1391,7 @@ testMemoryCoherentWriteAccessVDB(int size, int samples)
     memUsage = tree.memUsage();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -1065,7 +1400,7 @@ testMemoryCoherentWriteAccessVDB(int size, int samples)
 
 void testMemoryCoherentPreAllocWriteAccess(int size, int samples)
 {
-  cout << "Memory coherent write access (preallocated) "<< size << "^3\n";
+  BEGIN_SECTION("Memory coherent write access (preallocated) "<< size << "^3");
 
   printStats("Dense", testMemoryCoherentPreAllocWriteAccessDense (size, samples));
 
@@ -1081,7 +1416,7 @@ void testMemoryCoherentPreAllocWriteAccess(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testMemoryCoherentPreAllocWriteAccessDense(int size, int samples)
+PerfStats testMemoryCoherentPreAllocWriteAccessDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -1115,12 +1450,12 @@ Stats testMemoryCoherentPreAllocWriteAccessDense(int size, int samples)
     memUsage = dense.memSize();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testMemoryCoherentPreAllocWriteAccessSparse(int size, int blockOrder, 
+PerfStats testMemoryCoherentPreAllocWriteAccessSparse(int size, int blockOrder, 
                                                   int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -1180,13 +1515,13 @@ Stats testMemoryCoherentPreAllocWriteAccessSparse(int size, int blockOrder,
     memUsage = sparse.memSize();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testMemoryCoherentPreAllocWriteAccessVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -1225,7 +1560,7 @@ testMemoryCoherentPreAllocWriteAccessVDB(int size, int samples)
     memUsage = tree.memUsage();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -1234,23 +1569,26 @@ testMemoryCoherentPreAllocWriteAccessVDB(int size, int samples)
 
 void testMemoryCoherentReadAccess(int size, int samples)
 {
-  cout << "Memory coherent read access "<< size << "^3\n";
+  BEGIN_SECTION("Memory coherent read access "<< size << "^3");
 
   printStats("Dense", testMemoryCoherentReadAccessDense (size, samples));
 
   printStats("Sparse 8", testMemoryCoherentReadAccessSparse(size, 3, samples));
+  printStats("Sparse 8 (accessor)", testMemoryCoherentReadAccessSparseAccessor(size, 3, samples));
   printStats("VDB 8", testMemoryCoherentReadAccessVDB<3>(size, samples));
 
   printStats("Sparse 16", testMemoryCoherentReadAccessSparse(size, 4, samples));
+  printStats("Sparse 16 (accessor)", testMemoryCoherentReadAccessSparseAccessor(size, 4, samples));
   printStats("VDB 16", testMemoryCoherentReadAccessVDB<4>(size, samples));
 
   printStats("Sparse 32", testMemoryCoherentReadAccessSparse(size, 5, samples));
+  printStats("Sparse 32 (accessor)", testMemoryCoherentReadAccessSparseAccessor(size, 5, samples));
   printStats("VDB 32", testMemoryCoherentReadAccessVDB<5>(size, samples));
 }
 
 //----------------------------------------------------------------------------//
 
-Stats
+PerfStats
 testMemoryCoherentReadAccessDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -1284,12 +1622,12 @@ testMemoryCoherentReadAccessDense(int size, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats
+PerfStats
 testMemoryCoherentReadAccessSparse(int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -1349,13 +1687,59 @@ testMemoryCoherentReadAccessSparse(int size, int blockOrder, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
+}
+
+//----------------------------------------------------------------------------//
+
+PerfStats
+testMemoryCoherentReadAccessSparseAccessor(int size, int blockOrder, int samples)
+{
+  int rangeMin = 0, rangeMax = size - 1;
+
+  DECLARE_TIMING_VARIABLES;
+
+  ALLOC_TIMER;
+  UPDATE_ALLOC_TIME(ms);
+  
+  // pre generate dense volume
+  SparseField<float> sparse;
+  sparse.setBlockOrder(blockOrder);
+  sparse.setSize(Box3i(V3i(rangeMin), V3i(rangeMax)));
+  
+  std::fill(sparse.begin(), sparse.end(), 1.0);
+
+  for (int s = 0; s < samples; ++s) {
+  
+    double sum = 0.0;
+        
+    RUN_TIMER;
+
+    // Plain scanline order. The accessor only looks up a new block 
+    // when a scanline crosses a block boundary
+    SparseField<float>::Accessor accessor(sparse);
+    for (int k = rangeMin; k <= rangeMax; ++k) {
+      for (int j = rangeMin; j <= rangeMax; ++j) {
+        for (int i = rangeMin; i <= rangeMax; ++i) {
+          sum += accessor.value(i, j, k);
+        }
+      }
+    }
+
+    UPDATE_RUN_TIME(ms);
+
+    memRSS = currentRSS();
+    memUsage = sparse.memSize();
+    checkSum = size_t(sum);
+  }
+  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testMemoryCoherentReadAccessVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -1396,7 +1780,7 @@ testMemoryCoherentReadAccessVDB(int size, int samples)
     checkSum = size_t(sum);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -1406,7 +1790,7 @@ testMemoryCoherentReadAccessVDB(int size, int samples)
 void
 testWriteSparse(int size, int samples)
 {
-  cout << "Sparse write "<< size << "^3\n";
+  BEGIN_SECTION("Sparse write "<< size << "^3");
 
   const int narrowBand = 3;
 
@@ -1430,7 +1814,7 @@ testWriteSparse(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testWriteSparseDense(int halfWidth, bool useOgawa, int size, int samples)
+PerfStats testWriteSparseDense(int halfWidth, bool useOgawa, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -1509,13 +1893,13 @@ Stats testWriteSparseDense(int halfWidth, bool useOgawa, int size, int samples)
     checkSum = checksumF3DDense(*dense);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testWriteSparseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
+PerfStats testWriteSparseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -1594,13 +1978,13 @@ Stats testWriteSparseSparse(int halfWidth, bool useOgawa, int size, int blockOrd
     checkSum = checksumF3DSparse(*sparse);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testWriteSparseVDB(int halfWidth, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -1680,7 +2064,7 @@ testWriteSparseVDB(int halfWidth, int size, int samples)
     checkSum = checksumVDB(grid->tree());
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -1690,7 +2074,7 @@ testWriteSparseVDB(int halfWidth, int size, int samples)
 void
 testWriteDense(int size, int samples)
 {
-  cout << "Dense write "<< size << "^3\n";
+  BEGIN_SECTION("Dense write "<< size << "^3");
 
   const int narrowBand = 3;
 
@@ -1714,7 +2098,7 @@ testWriteDense(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testWriteDenseDense(int halfWidth, bool useOgawa, int size, int samples)
+PerfStats testWriteDenseDense(int halfWidth, bool useOgawa, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -1789,13 +2173,13 @@ Stats testWriteDenseDense(int halfWidth, bool useOgawa, int size, int samples)
     checkSum = checksumF3DDense(*dense);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testWriteDenseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
+PerfStats testWriteDenseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -1870,13 +2254,13 @@ Stats testWriteDenseSparse(int halfWidth, bool useOgawa, int size, int blockOrde
     checkSum = checksumF3DSparse(*sparse);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testWriteDenseVDB(int halfWidth, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -1953,7 +2337,7 @@ testWriteDenseVDB(int halfWidth, int size, int samples)
     checkSum = checksumVDB(grid->tree());
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -1963,7 +2347,7 @@ testWriteDenseVDB(int halfWidth, int size, int samples)
 void
 testReadSparse(int size, int samples)
 {
-  cout << "Sparse read "<< size << "^3\n";
+  BEGIN_SECTION("Sparse read "<< size << "^3");
 
   const int narrowBand = 3;
 
@@ -1987,7 +2371,7 @@ testReadSparse(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testReadSparseDense(int halfWidth, bool useOgawa, int size, int samples)
+PerfStats testReadSparseDense(int halfWidth, bool useOgawa, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -2018,13 +2402,13 @@ Stats testReadSparseDense(int halfWidth, bool useOgawa, int size, int samples)
     memRSS = currentRSS();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testReadSparseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
+PerfStats testReadSparseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -2055,13 +2439,13 @@ Stats testReadSparseSparse(int halfWidth, bool useOgawa, int size, int blockOrde
     memRSS = currentRSS();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testReadSparseVDB(int halfWidth, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2100,7 +2484,7 @@ testReadSparseVDB(int halfWidth, int size, int samples)
     memRSS = currentRSS();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -2110,7 +2494,7 @@ testReadSparseVDB(int halfWidth, int size, int samples)
 void
 testReadDense(int size, int samples)
 {
-  cout << "Dense read "<< size << "^3\n";
+  BEGIN_SECTION("Dense read "<< size << "^3");
 
   const int narrowBand = 3;
 
@@ -2132,7 +2516,7 @@ testReadDense(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testReadDenseDense(int halfWidth, bool useOgawa, int size, int samples)
+PerfStats testReadDenseDense(int halfWidth, bool useOgawa, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -2163,13 +2547,13 @@ Stats testReadDenseDense(int halfWidth, bool useOgawa, int size, int samples)
     memRSS = currentRSS();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testReadDenseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
+PerfStats testReadDenseSparse(int halfWidth, bool useOgawa, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -2200,13 +2584,13 @@ Stats testReadDenseSparse(int halfWidth, bool useOgawa, int size, int blockOrder
     memRSS = currentRSS();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testReadDenseVDB(int halfWidth, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2245,7 +2629,7 @@ testReadDenseVDB(int halfWidth, int size, int samples)
     memRSS = currentRSS();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -2255,7 +2639,7 @@ testReadDenseVDB(int halfWidth, int size, int samples)
 void
 testSparseFill(int size, int samples)
 {
-  std::cout << "Sparse fill (time in us) "<< size << "^3\n";
+  BEGIN_SECTION("Sparse fill (time in us) "<< size << "^3");
 
   printStats("Sparse 8", testSparseFillSparse(size, 3, samples));
   printStats("VDB 8", testSparseFillVDB<3>(size, samples));
@@ -2269,7 +2653,7 @@ testSparseFill(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats 
+PerfStats 
 testSparseFillSparse(int size, int order, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -2298,13 +2682,13 @@ testSparseFillSparse(int size, int order, int samples)
   
   checkSum = 0;
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testSparseFillVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2329,7 +2713,7 @@ testSparseFillVDB(int size, int samples)
 
   checkSum = 0;
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -2338,7 +2722,7 @@ testSparseFillVDB(int size, int samples)
 
 void testRandomWriteAccess(int numPoints, int size, int samples)
 {
-  cout << "Random incoherent write access " << numPoints << " points, "<< size << "^3\n";
+  BEGIN_SECTION("Random incoherent write access " << numPoints << " points, "<< size << "^3");
   
   if(size <= 1000) {
     printStats("Dense", testRandomWriteAccessDense (numPoints, size, samples));
@@ -2356,7 +2740,7 @@ void testRandomWriteAccess(int numPoints, int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomWriteAccessDense(int numPoints, int size, int samples)
+PerfStats testRandomWriteAccessDense(int numPoints, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
     
@@ -2402,12 +2786,12 @@ Stats testRandomWriteAccessDense(int numPoints, int size, int samples)
     memUsage = dense.memSize();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomWriteAccessSparse(int numPoints, int size, int blockOrder, int samples)
+PerfStats testRandomWriteAccessSparse(int numPoints, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
   
@@ -2448,13 +2832,13 @@ Stats testRandomWriteAccessSparse(int numPoints, int size, int blockOrder, int s
     memUsage = sparse.memSize();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testRandomWriteAccessVDB(int numPoints, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2495,7 +2879,7 @@ testRandomWriteAccessVDB(int numPoints, int size, int samples)
     memUsage = tree.memUsage();
   }
     
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -2504,7 +2888,7 @@ testRandomWriteAccessVDB(int numPoints, int size, int samples)
 
 void testRandomPreAllocWriteAccess(int numPoints, int size, int samples)
 {
-  cout << "Random incoherent write access (preallocated) " << numPoints << " points, "<< size << "^3\n";
+  BEGIN_SECTION("Random incoherent write access (preallocated) " << numPoints << " points, "<< size << "^3");
   
   if(size <= 1000) {
     printStats("Dense", testRandomPreAllocWriteAccessDense (numPoints, size, samples));
@@ -2522,7 +2906,7 @@ void testRandomPreAllocWriteAccess(int numPoints, int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomPreAllocWriteAccessDense(int numPoints, int size, int samples)
+PerfStats testRandomPreAllocWriteAccessDense(int numPoints, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
     
@@ -2563,12 +2947,12 @@ Stats testRandomPreAllocWriteAccessDense(int numPoints, int size, int samples)
     memUsage = dense.memSize();
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomPreAllocWriteAccessSparse(int numPoints, int size, int blockOrder, int samples)
+PerfStats testRandomPreAllocWriteAccessSparse(int numPoints, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
   
@@ -2609,11 +2993,11 @@ Stats testRandomPreAllocWriteAccessSparse(int numPoints, int size, int blockOrde
     memUsage = sparse.memSize();
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testRandomPreAllocWriteAccessVDB(int numPoints, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2655,7 +3039,7 @@ testRandomPreAllocWriteAccessVDB(int numPoints, int size, int samples)
     memUsage = tree.memUsage();
   }
     
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -2664,25 +3048,28 @@ testRandomPreAllocWriteAccessVDB(int numPoints, int size, int samples)
 
 void testRandomReadAccess(int numPoints, int size, int samples)
 {
-  cout << "Random incoherent read access "<< numPoints << " points, "<< size << "^3\n";
+  BEGIN_SECTION("Random incoherent read access "<< numPoints << " points, "<< size << "^3");
   
   if(size <= 1000) {
     printStats("Dense", testRandomReadAccessDense(numPoints, size, samples));
   }
 
   printStats("Sparse 8", testRandomReadAccessSparse(numPoints, size, 3, samples));
+  printStats("Sparse 8 (accessor)", testRandomReadAccessSparseAccessor(numPoints, size, 3, samples));
   printStats("VDB 8", testRandomReadAccessVDB<3>(numPoints, size, samples));
 
   printStats("Sparse 16", testRandomReadAccessSparse(numPoints, size, 4, samples));
+  printStats("Sparse 16 (accessor)", testRandomReadAccessSparseAccessor(numPoints, size, 4, samples));
   printStats("VDB 16", testRandomReadAccessVDB<4>(numPoints, size, samples));
 
   printStats("Sparse 32", testRandomReadAccessSparse(numPoints, size, 5, samples));
+  printStats("Sparse 32 (accessor)", testRandomReadAccessSparseAccessor(numPoints, size, 5, samples));
   printStats("VDB 32", testRandomReadAccessVDB<5>(numPoints, size, samples));
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomReadAccessDense(int numPoints, int size, int samples)
+PerfStats testRandomReadAccessDense(int numPoints, int size, int samples)
 {
   int rangeMax = size - 1 >> 1, rangeMin = -rangeMax;
     
@@ -2725,12 +3112,12 @@ Stats testRandomReadAccessDense(int numPoints, int size, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomReadAccessSparse(int numPoints, int size, int blockOrder, int samples)
+PerfStats testRandomReadAccessSparse(int numPoints, int size, int blockOrder, int samples)
 {
   int rangeMax = size - 1 >> 1, rangeMin = -rangeMax;
   
@@ -2774,13 +3161,62 @@ Stats testRandomReadAccessSparse(int numPoints, int size, int blockOrder, int sa
     checkSum = size_t(sum);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
+}
+
+//----------------------------------------------------------------------------//
+
+PerfStats testRandomReadAccessSparseAccessor(int numPoints, int size, int blockOrder, int samples)
+{
+  int rangeMax = size - 1 >> 1, rangeMin = -rangeMax;
+  
+  RNGType rng(1);
+  boost::uniform_int<int> range(rangeMin, rangeMax);
+  boost::variate_generator< RNGType, boost::uniform_int<int> > randNr(rng, range);
+
+  // pre generate random points
+  std::vector<V3i> points;
+  points.reserve(numPoints);
+  for (int n = 0; n < numPoints; ++n) {  
+    points.push_back(V3i(randNr(), randNr(), randNr()));
+  }
+  
+  // pre generate dense volume
+  SparseField<float> sparse;
+  sparse.setBlockOrder(blockOrder);
+  sparse.setSize(Box3i(V3i(rangeMin), V3i(rangeMax)));
+  std::fill(sparse.begin(), sparse.end(), 1.0f);
+  
+  DECLARE_TIMING_VARIABLES;
+
+  ALLOC_TIMER;  
+  UPDATE_ALLOC_TIME(ms);
+  
+  for (int s = 0; s < samples; ++s) {
+
+    double sum = 0.0;
+
+    RUN_TIMER;
+
+    SparseField<float>::Accessor accessor(sparse);
+    for (size_t n = 0, N = points.size(); n < N; ++n) {
+      sum += accessor.value(points[n].x, points[n].z, points[n].y);
+    }
+
+    UPDATE_RUN_TIME(ms);
+
+    memRSS = currentRSS();
+    memUsage = sparse.memSize();
+    checkSum = size_t(sum);
+  }
+
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testRandomReadAccessVDB(int numPoints, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2824,7 +3260,7 @@ testRandomReadAccessVDB(int numPoints, int size, int samples)
     checkSum = size_t(sum);
   }
     
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -2833,7 +3269,7 @@ testRandomReadAccessVDB(int numPoints, int size, int samples)
 
 void testRandomPointInterpolation(int numPoints, int size, int samples)
 {
-  cout << "Random incoherent point interpolation "<< size << "^3\n";
+  BEGIN_SECTION("Random incoherent point interpolation "<< size << "^3");
   
   if (size <= 1000) {
     printStats("Dense", testRandomPointInterpolationDense (numPoints, size, samples));
@@ -2851,7 +3287,7 @@ void testRandomPointInterpolation(int numPoints, int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomPointInterpolationDense(int numPoints, int size, int samples)
+PerfStats testRandomPointInterpolationDense(int numPoints, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
   
@@ -2895,13 +3331,13 @@ Stats testRandomPointInterpolationDense(int numPoints, int size, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testRandomPointInterpolationSparse(int numPoints, int size, int blockOrder, int samples)
+PerfStats testRandomPointInterpolationSparse(int numPoints, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
   
@@ -2946,13 +3382,13 @@ Stats testRandomPointInterpolationSparse(int numPoints, int size, int blockOrder
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testRandomPointInterpolationVDB(int numPoints, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -2999,7 +3435,7 @@ testRandomPointInterpolationVDB(int numPoints, int size, int samples)
     checkSum = size_t(sum);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -3008,24 +3444,27 @@ testRandomPointInterpolationVDB(int numPoints, int size, int samples)
 
 void testUniformRaymarching(int numRays, double stepSize, int size, int samples)
 {
-  cout << "Uniform raymarching - #rays:"<< numRays << ", step size: " << stepSize
-    << ", resolution: " << size << "^3\n";
+  BEGIN_SECTION("Uniform raymarching - #rays:"<< numRays << ", step size: " 
+                << stepSize << ", resolution: " << size << "^3");
 
   printStats("Dense", testUniformRaymarchingDense(numRays, stepSize, size, samples));
 
   printStats("Sparse 8", testUniformRaymarchingSparse(numRays, stepSize, size, 3, samples));
+  printStats("Sparse 8 skip", testUniformRaymarchingSparseSkip(numRays, stepSize, size, 3, samples));
   printStats("VDB 8", testUniformRaymarchingVDB<3>(numRays, stepSize, size, samples));
 
   printStats("Sparse 16", testUniformRaymarchingSparse(numRays, stepSize, size, 4, samples));
+  printStats("Sparse 16 skip", testUniformRaymarchingSparseSkip(numRays, stepSize, size, 4, samples));
   printStats("VDB 16", testUniformRaymarchingVDB<4>(numRays, stepSize, size, samples));
 
   printStats("Sparse 32", testUniformRaymarchingSparse(numRays, stepSize, size, 5, samples));
+  printStats("Sparse 32 skip", testUniformRaymarchingSparseSkip(numRays, stepSize, size, 5, samples));
   printStats("VDB 32", testUniformRaymarchingVDB<5>(numRays, stepSize, size, samples));
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testUniformRaymarchingDense(int numRays, double stepSize, int size, 
+PerfStats testUniformRaymarchingDense(int numRays, double stepSize, int size, 
                                   int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -3076,12 +3515,12 @@ Stats testUniformRaymarchingDense(int numRays, double stepSize, int size,
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
-Stats testUniformRaymarchingSparse(int numRays, double stepSize, int size, 
+PerfStats testUniformRaymarchingSparse(int numRays, double stepSize, int size, 
                                    int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
@@ -3132,13 +3571,76 @@ Stats testUniformRaymarchingSparse(int numRays, double stepSize, int size,
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
+}
+
+//----------------------------------------------------------------------------//
+
+//! Same rays and volume as testUniformRaymarchingSparse(), but the march 
+//! walks the block grid with SparseFieldRayIterator and skips unallocated 
+//! blocks holding zero. Samples are taken at the same distances along the
+//! ray, so the checksums match.
+PerfStats testUniformRaymarchingSparseSkip(int numRays, double stepSize, int size, 
+                                       int blockOrder, int samples)
+{
+  int rangeMin = 0, rangeMax = size - 1;
+    
+  RNGType rng(1);
+  boost::uniform_real<double> range(rangeMin, rangeMax);  
+  boost::variate_generator< RNGType, boost::uniform_real<double> > randNr(rng, range);
+
+  // pre generate dense volume
+  SparseField<float> sparse;
+  sparse.setBlockOrder(blockOrder);
+  sparse.setSize(Box3i(V3i(rangeMin), V3i(rangeMax)));
+  std::fill(sparse.begin(), sparse.end(), 1.0f);
+  
+  DECLARE_TIMING_VARIABLES;
+
+  ALLOC_TIMER;
+  UPDATE_ALLOC_TIME(ms);
+
+  V3d origin, dir;
+  SparseField<float>::LinearInterp interp;
+
+  for (int s = 0; s < samples; ++s) {
+
+    double sum = 0.0;
+
+    RUN_TIMER;
+        
+    for (int n = 0; n < numRays; ++n) {
+
+      origin = V3d(randNr(), rangeMin, randNr()),
+        dir = V3d(randNr(), rangeMax, randNr()) - origin;
+
+      double dMax = dir.length();
+      dir.normalize();
+
+      SparseFieldRayIterator<float> i(sparse, origin, dir, 0.0, dMax, 0.0f);
+      for (; i.isValid(); ++i) {
+        double d = std::ceil(i.t0() / stepSize) * stepSize;
+        while (d < i.t1()) {
+          sum += interp.sample(sparse, origin + (dir * d));
+          d += stepSize;
+        }
+      }
+    }
+
+    UPDATE_RUN_TIME(ms);
+    
+    memRSS = currentRSS();
+    memUsage = sparse.memSize();
+    checkSum = size_t(sum);
+  }
+  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats 
+PerfStats 
 testUniformRaymarchingVDB(int numRays, double stepSize, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -3188,7 +3690,7 @@ testUniformRaymarchingVDB(int numRays, double stepSize, int size, int samples)
     checkSum = size_t(sum);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -3197,7 +3699,7 @@ testUniformRaymarchingVDB(int numRays, double stepSize, int size, int samples)
 
 void testDenseLevelSetSphere(int size, int samples)
 {
-  cout << "Dense level set sphere "<< size << "^3\n";
+  BEGIN_SECTION("Dense level set sphere "<< size << "^3");
 
   printStats("Dense", testDenseLevelSetSphereDense(size, samples));
 
@@ -3213,7 +3715,7 @@ void testDenseLevelSetSphere(int size, int samples)
 
 //----------------------------------------------------------------------------//
 
-Stats testDenseLevelSetSphereDense(int size, int samples)
+PerfStats testDenseLevelSetSphereDense(int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -3267,13 +3769,13 @@ Stats testDenseLevelSetSphereDense(int size, int samples)
     checkSum = checksumF3DDense(dense);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testDenseLevelSetSphereSparse(int size, int blockOrder, int samples)
+PerfStats testDenseLevelSetSphereSparse(int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -3328,13 +3830,13 @@ Stats testDenseLevelSetSphereSparse(int size, int blockOrder, int samples)
     checkSum = checksumF3DSparse(sparse);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testDenseLevelSetSphereVDB(int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -3391,7 +3893,7 @@ testDenseLevelSetSphereVDB(int size, int samples)
     checkSum = checksumVDB(tree);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
 }
 
 //----------------------------------------------------------------------------//
@@ -3400,7 +3902,7 @@ testDenseLevelSetSphereVDB(int size, int samples)
 
 void testNarrowBandLevelSetSphere(int halfWidth, int size, int samples)
 {
-  cout << "Narrow band level set sphere "<< size << "^3\n";
+  BEGIN_SECTION("Narrow band level set sphere "<< size << "^3");
   
   if (size <= 1000) {
     printStats("Dense", testNarrowBandLevelSetSphereDense(halfWidth, size, samples));
@@ -3419,7 +3921,7 @@ void testNarrowBandLevelSetSphere(int halfWidth, int size, int samples)
 //----------------------------------------------------------------------------//
 
 
-Stats testNarrowBandLevelSetSphereDense(int halfWidth, int size, int samples)
+PerfStats testNarrowBandLevelSetSphereDense(int halfWidth, int size, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -3478,13 +3980,13 @@ Stats testNarrowBandLevelSetSphereDense(int halfWidth, int size, int samples)
     checkSum = checksumF3DDense(dense);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 
 //----------------------------------------------------------------------------//
 
-Stats testNarrowBandLevelSetSphereSparse(int halfWidth, int size, int blockOrder, int samples)
+PerfStats testNarrowBandLevelSetSphereSparse(int halfWidth, int size, int blockOrder, int samples)
 {
   int rangeMin = 0, rangeMax = size - 1;
 
@@ -3544,13 +4046,13 @@ Stats testNarrowBandLevelSetSphereSparse(int halfWidth, int size, int blockOrder
     checkSum = checksumF3DSparse(sparse);
   }
 
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);  
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
 }
 
 //----------------------------------------------------------------------------//
 
 template<openvdb::Index Log2Dim>
-Stats
+PerfStats
 testNarrowBandLevelSetSphereVDB(int halfWidth, int size, int samples)
 {
   typedef typename tree::Tree4<float, 5, 4, Log2Dim>::Type TreeType;
@@ -3612,7 +4114,189 @@ testNarrowBandLevelSetSphereVDB(int halfWidth, int size, int samples)
     checkSum = checksumVDB(tree);
   }
   
-  return Stats(allocTime, runTime, memUsage, memRSS, checkSum);
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);
+}
+
+//----------------------------------------------------------------------------//
+// Codec round trip
+//----------------------------------------------------------------------------//
+
+size_t fileSize(const std::string &filename)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary | std::ios::ate);
+  return in ? size_t(in.tellg()) : 0;
+}
+
+//----------------------------------------------------------------------------//
+
+void
+testCodecRoundTrip(int size, int samples)
+{
+  BEGIN_SECTION("Codec round trip (alloc: write, run: read, mem: file size) "
+                << size << "^3");
+
+  const int narrowBand = 3;
+
+  printStats("Sparse 8 (zlib)", 
+             testCodecRoundTripSparse(narrowBand, SparseCodecZlib, 
+                                      size, 3, samples));
+  printStats("Sparse 8 (shuffle)", 
+             testCodecRoundTripSparse(narrowBand, SparseCodecShuffleZlib, 
+                                      size, 3, samples));
+  printStats("VDB 8", testCodecRoundTripVDB<3>(narrowBand, size, samples));
+
+  printStats("Sparse 16 (zlib)", 
+             testCodecRoundTripSparse(narrowBand, SparseCodecZlib, 
+                                      size, 4, samples));
+  printStats("Sparse 16 (shuffle)", 
+             testCodecRoundTripSparse(narrowBand, SparseCodecShuffleZlib, 
+                                      size, 4, samples));
+  printStats("VDB 16", testCodecRoundTripVDB<4>(narrowBand, size, samples));
+
+  printStats("Sparse 32 (zlib)", 
+             testCodecRoundTripSparse(narrowBand, SparseCodecZlib, 
+                                      size, 5, samples));
+  printStats("Sparse 32 (shuffle)", 
+             testCodecRoundTripSparse(narrowBand, SparseCodecShuffleZlib, 
+                                      size, 5, samples));
+  printStats("VDB 32", testCodecRoundTripVDB<5>(narrowBand, size, samples));
+}
+
+//----------------------------------------------------------------------------//
+
+PerfStats testCodecRoundTripSparse(int halfWidth, SparseCodec codec, int size, int blockOrder, int samples)
+{
+  int rangeMin = 0, rangeMax = size - 1;
+
+  std::stringstream ss;
+  ss << "/tmp/testCodecRoundTripSparse." << size << "." << blockOrder << "."
+     << (codec == SparseCodecZlib ? "zlib" : "shuffle")
+     << ".f3d";
+  const std::string filename(ss.str());
+
+  Field3DOutputFile::useOgawa(true);
+  setSparseCodec(codec);
+
+  // Setup
+  const float
+    dim = float(size),
+    w = float(halfWidth), // narrow band half-width
+    dx = 1.0f / dim,
+    backgroundValue = w * dx,
+    radius = (0.5 - backgroundValue) / dx;
+
+  const int center = int(0.5 / dx);
+  int i, j, k, m = 1;
+  float x2, x2y2, x2y2z2;
+
+  // Generate data ---
+
+  SparseField<float>::Ptr sparsePtr(new SparseField<float>);
+  SparseField<float> *sparse = sparsePtr.get();
+  sparse->name = "default";
+  sparse->attribute = "surface";
+  sparse->setBlockOrder(blockOrder);
+  sparse->setSize(Box3i(V3i(rangeMin), V3i(rangeMax)));
+
+  // Gen level-set sphere
+  for (i = rangeMin; i <= rangeMax; ++i) {
+    x2 = i - center;
+    x2 *= x2;
+    for (j = rangeMin; j <= rangeMax; ++j) {
+      x2y2 = j - center;
+      x2y2 *= x2y2;
+      x2y2 += x2;
+      for (k = rangeMin; k <= rangeMax; k += m) {
+        x2y2z2 = k - center;
+        x2y2z2 *= x2y2z2;
+        x2y2z2 += x2y2;
+
+        const float v = std::sqrt(x2y2z2) - radius, d = std::abs(v);
+        m = 1;
+
+        if (d < w) sparse->fastLValue(k, j, i) = dx * v; 
+        else m += int(std::floor(d - w));
+      }
+    }
+  }
+
+  // Run test ---
+
+  DECLARE_TIMING_VARIABLES;
+  
+  for (int s = 0; s < samples; ++s) {
+  
+    ALLOC_TIMER;
+
+    {
+      Field3DOutputFile out;
+      out.create(filename);
+      out.writeScalarLayer<float>(sparsePtr);
+    }
+    
+    UPDATE_ALLOC_TIME(ms);
+
+    RUN_TIMER;
+
+    Field3DInputFile in;
+    in.open(filename);
+    Field<float>::Vec layers = in.readScalarLayers<float>();
+
+    UPDATE_RUN_TIME(ms);
+
+    memRSS = currentRSS();
+    memUsage = fileSize(filename);
+
+    // Compare what was read back against the source, voxel by voxel
+    SparseField<float>::Ptr result = layers.empty() ? 
+      SparseField<float>::Ptr() : 
+      field_dynamic_cast<SparseField<float> >(layers[0]);
+    size_t mismatches = 0;
+    if (result && result->dataWindow() == sparse->dataWindow()) {
+      SparseField<float>::Accessor source(*sparse), dest(*result);
+      for (k = rangeMin; k <= rangeMax; ++k) {
+        for (j = rangeMin; j <= rangeMax; ++j) {
+          for (i = rangeMin; i <= rangeMax; ++i) {
+            if (source.value(i, j, k) != dest.value(i, j, k)) {
+              ++mismatches;
+            }
+          }
+        }
+      }
+      checkSum = checksumF3DSparse(*result);
+    } else {
+      mismatches = 1;
+    }
+
+    if (mismatches) {
+      cout << "   round trip of " << filename << " failed (" 
+           << mismatches << " voxels differ)" << endl;
+      ++g_roundTripFailures;
+    }
+  }
+
+  setSparseCodec(SparseCodecZlib);
+
+  return PerfStats(allocTime, runTime, memUsage, memRSS, checkSum);  
+}
+
+//----------------------------------------------------------------------------//
+
+template<openvdb::Index Log2Dim>
+PerfStats
+testCodecRoundTripVDB(int halfWidth, int size, int samples)
+{
+  std::stringstream ss;
+  ss << "/tmp/testWriteSparseVDB." << size << "." << Log2Dim << ".vdb";
+  const std::string filename(ss.str());
+
+  // Same files as the sparse write/read sections, reported the same way as
+  // the Field3D round trips
+  const PerfStats write = testWriteSparseVDB<Log2Dim>(halfWidth, size, samples);
+  const PerfStats read = testReadSparseVDB<Log2Dim>(halfWidth, size, samples);
+
+  return PerfStats(write.mTime, read.mTime, fileSize(filename), 
+                   std::max(write.mRSS, read.mRSS), write.mCheckSum);
 }
 
 //----------------------------------------------------------------------------//
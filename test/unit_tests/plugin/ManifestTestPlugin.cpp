@@ -0,0 +1,75 @@
+//----------------------------------------------------------------------------//
+
+/*
+ * Copyright (c) 2009 Sony Pictures Imageworks Inc
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the
+ * distribution.  Neither the name of Sony Pictures Imageworks nor the
+ * names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written
+ * permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*! \file ManifestTestPlugin.cpp
+  \brief Plugin that the unit tests load through a plugin manifest
+*/
+
+//----------------------------------------------------------------------------//
+
+#include "Field3D/ClassFactory.h"
+#include "Field3D/DenseField.h"
+
+//----------------------------------------------------------------------------//
+
+using namespace Field3D;
+
+//----------------------------------------------------------------------------//
+
+namespace {
+
+  //! Dense field under a class name that only this plugin registers
+  class ManifestTestField : public DenseField<float>
+  {
+  public:
+    static const char *staticClassName()
+    { return "ManifestTestField"; }
+    virtual std::string className() const
+    { return staticClassName(); }
+    static FieldRes::Ptr create()
+    { return FieldRes::Ptr(new ManifestTestField); }
+  };
+
+}
+
+//----------------------------------------------------------------------------//
+
+extern "C" int registerField3DPlugin(ClassFactory &factory)
+{
+  factory.registerField(ManifestTestField::create);
+  return 1;
+}
+
+//----------------------------------------------------------------------------//